@@ -0,0 +1,416 @@
+/*
+ * anscache.c - wireformat answer cache for the server processes.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include <string.h>
+#include "anscache.h"
+#include "hash.h"
+#include "options.h"
+#include "packet.h"
+#include "rdata.h"
+#include "util.h"
+
+/** most compression pointers in a wildcard answer that is stored */
+#define ANSCACHE_MAX_POINTERS 256
+
+/** An entry in the answer cache */
+struct anscache_entry {
+	/* the lowercased query name, followed by the answer part of the
+	 * packet (everything after the question section), or NULL */
+	uint8_t* data;
+	/* the zone, delegation and wildcard of the query, for the
+	 * statistics and the ratelimit */
+	zone_type* zone;
+	domain_type* delegation_domain;
+#ifdef RATELIMIT
+	domain_type* wildcard_domain;
+#endif
+	/* the full hash of the key */
+	uint32_t hash;
+	/* available size for the answer, q->maxlen - q->reserved_space */
+	uint32_t limit;
+	/* length of the query name and the answer in data */
+	uint16_t qname_len;
+	uint16_t answer_len;
+	uint16_t qtype;
+	uint16_t qclass;
+	/* header flags and counts of the answer */
+	uint16_t flags;
+	uint16_t ancount;
+	uint16_t nscount;
+	uint16_t arcount;
+	uint8_t dnssec_ok;
+};
+
+/**
+ * An answer synthesized from a wildcard.  The owner of the answer is a
+ * pointer to the query name, and the names below the closest encloser
+ * point into the end of the query name, or into the answer.  Those
+ * pointers are listed, they move with the length of the query name.
+ */
+struct anscache_wildcard {
+	/* the answer part of the packet, followed by the positions of the
+	 * compression pointers in it, uint16 each, or NULL */
+	uint8_t* data;
+	/* the key */
+	domain_type* wildcard;
+	domain_type* cover;
+	/* the zone of the wildcard, and of the answer */
+	zone_type* wildcard_zone;
+	zone_type* zone;
+	uint32_t hash;
+	uint32_t limit;
+	/* end of the question section when it was stored */
+	uint16_t qend;
+	uint16_t answer_len;
+	uint16_t pointers;
+	uint16_t qtype;
+	uint16_t qclass;
+	uint16_t flags;
+	uint16_t ancount;
+	uint16_t nscount;
+	uint16_t arcount;
+	uint8_t dnssec_ok;
+};
+
+static void
+anscache_cleanup(void* arg)
+{
+	struct anscache* cache = (struct anscache*)arg;
+	size_t i;
+	for(i=0; i<cache->size; i++) {
+		free(cache->table[i].data);
+		free(cache->wctable[i].data);
+	}
+}
+
+struct anscache*
+anscache_create(region_type* region, size_t size)
+{
+	struct anscache* cache = (struct anscache*)region_alloc_zero(region,
+		sizeof(*cache));
+	cache->size = size;
+	cache->table = (struct anscache_entry*)region_alloc_array_zero(
+		region, size, sizeof(struct anscache_entry));
+	cache->wctable = (struct anscache_wildcard*)region_alloc_array_zero(
+		region, size, sizeof(struct anscache_wildcard));
+	region_add_cleanup(region, anscache_cleanup, cache);
+	return cache;
+}
+
+/** return true if the answer for the query can be cached */
+static int
+anscache_usable(struct query* q, size_t qend)
+{
+	/* TSIG answers are signed per query; and the question must be
+	 * present without compression so the stored offsets stay valid */
+	return q->tsig.status == TSIG_NOT_PRESENT &&
+		qend == (size_t)QHEADERSZ + q->qname->name_size + 4 &&
+		q->maxlen > q->reserved_space;
+}
+
+/** hash the key of the query */
+static uint32_t
+anscache_hash(struct query* q, uint32_t limit)
+{
+	uint64_t k = ((uint64_t)limit<<33) | ((uint64_t)q->qtype<<17) |
+		((uint64_t)q->qclass<<1) | (q->edns.dnssec_ok?1:0);
+	return (uint32_t)hash_bytes(dname_name(q->qname),
+		q->qname->name_size, k);
+}
+
+/** see if the entry matches the query */
+static int
+anscache_match(struct anscache_entry* e, struct query* q, uint32_t hash,
+	uint32_t limit)
+{
+	return e->data && e->hash == hash && e->limit == limit &&
+		e->qtype == q->qtype && e->qclass == q->qclass &&
+		e->dnssec_ok == (q->edns.dnssec_ok?1:0) &&
+		e->qname_len == q->qname->name_size &&
+		memcmp(e->data, dname_name(q->qname), e->qname_len) == 0;
+}
+
+int
+anscache_lookup(struct anscache* cache, struct query* q)
+{
+	size_t qend = buffer_position(q->packet);
+	uint32_t limit, hash;
+	struct anscache_entry* e;
+	if(!anscache_usable(q, qend))
+		return 0;
+	limit = (uint32_t)(q->maxlen - q->reserved_space);
+	hash = anscache_hash(q, limit);
+	e = &cache->table[hash % cache->size];
+	if(!anscache_match(e, q, hash, limit))
+		return 0;
+	if(buffer_remaining(q->packet) < e->answer_len)
+		return 0;
+
+	buffer_write(q->packet, e->data + e->qname_len, e->answer_len);
+	/* keep the RD flag of this query */
+	FLAGS_SET(q->packet, (e->flags & ~0x0100U) |
+		(FLAGS(q->packet) & 0x0100U));
+	ANCOUNT_SET(q->packet, e->ancount);
+	NSCOUNT_SET(q->packet, e->nscount);
+	ARCOUNT_SET(q->packet, e->arcount);
+	q->zone = e->zone;
+	q->delegation_domain = e->delegation_domain;
+#ifdef RATELIMIT
+	q->wildcard_domain = e->wildcard_domain;
+#endif
+	return 1;
+}
+
+/** hash the wildcard key of the query */
+static uint32_t
+anscache_wildcard_hash(struct query* q, domain_type* wildcard,
+	domain_type* cover, uint32_t limit)
+{
+	uint64_t k = ((uint64_t)limit<<33) | ((uint64_t)q->qtype<<17) |
+		((uint64_t)q->qclass<<1) | (q->edns.dnssec_ok?1:0);
+	domain_type* key[2];
+	key[0] = wildcard;
+	key[1] = cover;
+	return (uint32_t)hash_bytes((uint8_t*)key, sizeof(key), k);
+}
+
+/** true if the secondary zone has expired, it is answered with SERVFAIL */
+static int
+anscache_zone_expired(zone_type* zone)
+{
+	return zone && zone->opts && zone->opts->pattern &&
+		zone->opts->pattern->request_xfr != 0 && !zone->is_ok;
+}
+
+int
+anscache_lookup_wildcard(struct anscache* cache, struct query* q,
+	zone_type* zone, domain_type* wildcard, domain_type* cover)
+{
+	size_t qend = buffer_position(q->packet);
+	uint32_t limit, hash;
+	struct anscache_wildcard* e;
+	uint8_t* p, *pos;
+	uint16_t i, ptr;
+	long delta;
+
+	if(!anscache_usable(q, qend))
+		return 0;
+	/* the key for the store, if this is a miss */
+	q->wildcard_key = wildcard;
+	q->wildcard_zone = zone;
+	q->wildcard_cover = cover;
+	limit = (uint32_t)(q->maxlen - q->reserved_space);
+	hash = anscache_wildcard_hash(q, wildcard, cover, limit);
+	e = &cache->wctable[hash % cache->size];
+	if(!e->data || e->hash != hash || e->wildcard != wildcard ||
+		e->cover != cover || e->limit != limit ||
+		e->qtype != q->qtype || e->qclass != q->qclass ||
+		e->dnssec_ok != (q->edns.dnssec_ok?1:0))
+		return 0;
+	/* the answer has to fit after this question */
+	if(qend + e->answer_len > limit ||
+		buffer_remaining(q->packet) < e->answer_len)
+		return 0;
+	if(anscache_zone_expired(e->wildcard_zone) ||
+		anscache_zone_expired(e->zone))
+		return 0;
+
+	p = buffer_current(q->packet);
+	memmove(p, e->data, e->answer_len);
+	/* the pointer to the query name stays, the others move */
+	delta = (long)qend - (long)e->qend;
+	pos = e->data + e->answer_len;
+	for(i=0; i<e->pointers; i++) {
+		uint16_t at;
+		memmove(&at, pos + i*sizeof(uint16_t), sizeof(at));
+		ptr = read_uint16(p + at) & 0x3fff;
+		if(ptr > QHEADERSZ) {
+			if((long)ptr + delta > 0x3fff)
+				return 0;
+			write_uint16(p + at, (uint16_t)(0xc000 |
+				((long)ptr + delta)));
+		}
+	}
+	buffer_skip(q->packet, e->answer_len);
+	FLAGS_SET(q->packet, (e->flags & ~0x0100U) |
+		(FLAGS(q->packet) & 0x0100U));
+	ANCOUNT_SET(q->packet, e->ancount);
+	NSCOUNT_SET(q->packet, e->nscount);
+	ARCOUNT_SET(q->packet, e->arcount);
+	q->zone = e->zone;
+	q->delegation_domain = NULL;
+#ifdef RATELIMIT
+	q->wildcard_domain = wildcard;
+#endif
+	return 1;
+}
+
+/** find the compression pointers in a domain name in the packet, at
+ * pos, that ends before end.  Returns the position after the name, or 0
+ * on a parse failure or too many pointers. */
+static size_t
+anscache_name_pointers(uint8_t* pkt, size_t pos, size_t end, size_t qend,
+	uint16_t* ptrs, size_t* num)
+{
+	while(pos < end) {
+		uint8_t c = pkt[pos];
+		if((c&0xc0) == 0xc0) {
+			if(pos+2 > end || *num >= ANSCACHE_MAX_POINTERS)
+				return 0;
+			ptrs[(*num)++] = (uint16_t)(pos - qend);
+			return pos+2;
+		}
+		if((c&0xc0) != 0)
+			return 0;
+		pos += 1 + c;
+		if(c == 0)
+			return pos;
+	}
+	return 0;
+}
+
+/** find the compression pointers in the answer of the packet, between
+ * qend and end.  Returns false if the RRs cannot be parsed. */
+static int
+anscache_pointers(uint8_t* pkt, size_t qend, size_t end, size_t rrs,
+	uint16_t* ptrs, size_t* num)
+{
+	size_t pos = qend, rdata, rdlen, j;
+	const rrtype_descriptor_type* desc;
+	uint16_t type;
+	*num = 0;
+	while(rrs--) {
+		if(!(pos = anscache_name_pointers(pkt, pos, end, qend, ptrs,
+			num)) || pos + 10 > end)
+			return 0;
+		type = read_uint16(pkt + pos);
+		rdlen = read_uint16(pkt + pos + 8);
+		rdata = pos + 10;
+		if(rdata + rdlen > end)
+			return 0;
+		/* the positions in the rdata count from its start */
+		desc = rrtype_descriptor_by_type(type);
+		pos = 0;
+		for(j=0; j<desc->maximum && pos < rdlen; j++) {
+			if(desc->wireformat[j] == RDATA_WF_COMPRESSED_DNAME ||
+				desc->wireformat[j] ==
+				RDATA_WF_UNCOMPRESSED_DNAME) {
+				if(!(pos = anscache_name_pointers(pkt,
+					rdata + pos, rdata + rdlen, qend,
+					ptrs, num)))
+					return 0;
+				pos -= rdata;
+			} else {
+				pos += rdata_field_length(type, j, pkt + rdata,
+					pos, rdlen);
+			}
+		}
+		pos = rdata + rdlen;
+	}
+	return pos == end;
+}
+
+/** store the answer synthesized from the wildcard by its key */
+static void
+anscache_store_wildcard(struct anscache* cache, struct query* q, size_t qend,
+	size_t answer_len)
+{
+	uint16_t ptrs[ANSCACHE_MAX_POINTERS];
+	size_t num;
+	uint32_t limit, hash;
+	struct anscache_wildcard* e;
+	/* a truncated answer depends on the length of the query name */
+	if(TC(q->packet) || qend > 0xffff)
+		return;
+	if(!anscache_pointers(buffer_begin(q->packet), qend,
+		qend + answer_len, (size_t)ANCOUNT(q->packet) +
+		NSCOUNT(q->packet) + ARCOUNT(q->packet), ptrs, &num))
+		return;
+	limit = (uint32_t)(q->maxlen - q->reserved_space);
+	hash = anscache_wildcard_hash(q, q->wildcard_key, q->wildcard_cover,
+		limit);
+	e = &cache->wctable[hash % cache->size];
+
+	free(e->data);
+	e->data = (uint8_t*)xalloc(answer_len + num*sizeof(uint16_t));
+	memmove(e->data, buffer_at(q->packet, qend), answer_len);
+	memmove(e->data + answer_len, ptrs, num*sizeof(uint16_t));
+	e->wildcard = q->wildcard_key;
+	e->cover = q->wildcard_cover;
+	e->wildcard_zone = q->wildcard_zone;
+	e->zone = q->zone;
+	e->hash = hash;
+	e->limit = limit;
+	e->qend = (uint16_t)qend;
+	e->answer_len = (uint16_t)answer_len;
+	e->pointers = (uint16_t)num;
+	e->qtype = q->qtype;
+	e->qclass = q->qclass;
+	e->flags = FLAGS(q->packet);
+	e->ancount = ANCOUNT(q->packet);
+	e->nscount = NSCOUNT(q->packet);
+	e->arcount = ARCOUNT(q->packet);
+	e->dnssec_ok = (q->edns.dnssec_ok?1:0);
+}
+
+void
+anscache_store(struct anscache* cache, struct query* q, size_t qend)
+{
+	size_t answer_len = buffer_position(q->packet) - qend;
+	uint32_t limit, hash;
+	struct anscache_entry* e;
+	if(!anscache_usable(q, qend) || answer_len > ANSCACHE_MAX_ANSWER)
+		return;
+	/* a zone that could not be read from the db can be there for
+	 * the next query */
+	if(RCODE(q->packet) == RCODE_SERVFAIL)
+		return;
+	limit = (uint32_t)(q->maxlen - q->reserved_space);
+	hash = anscache_hash(q, limit);
+	e = &cache->table[hash % cache->size];
+
+	/* replace the previous contents of the slot */
+	free(e->data);
+	e->data = (uint8_t*)xalloc(q->qname->name_size + answer_len);
+	memmove(e->data, dname_name(q->qname), q->qname->name_size);
+	memmove(e->data + q->qname->name_size, buffer_at(q->packet, qend),
+		answer_len);
+	e->zone = q->zone;
+	e->delegation_domain = q->delegation_domain;
+#ifdef RATELIMIT
+	e->wildcard_domain = q->wildcard_domain;
+#endif
+	e->hash = hash;
+	e->limit = limit;
+	e->qname_len = q->qname->name_size;
+	e->answer_len = (uint16_t)answer_len;
+	e->qtype = q->qtype;
+	e->qclass = q->qclass;
+	e->flags = FLAGS(q->packet);
+	e->ancount = ANCOUNT(q->packet);
+	e->nscount = NSCOUNT(q->packet);
+	e->arcount = ARCOUNT(q->packet);
+	e->dnssec_ok = (q->edns.dnssec_ok?1:0);
+
+	if(q->wildcard_synth)
+		anscache_store_wildcard(cache, q, qend, answer_len);
+}
+
+void
+anscache_flush(struct anscache* cache)
+{
+	size_t i;
+	for(i=0; i<cache->size; i++) {
+		free(cache->table[i].data);
+		cache->table[i].data = NULL;
+		free(cache->wctable[i].data);
+		cache->wctable[i].data = NULL;
+	}
+}
@@ -0,0 +1,83 @@
+/* anscache.h - wireformat answer cache for the server processes.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+#ifndef ANSCACHE_H
+#define ANSCACHE_H
+#include "query.h"
+
+/** largest answer (after the question section) that is stored */
+#define ANSCACHE_MAX_ANSWER 4096
+
+struct anscache_entry;
+struct anscache_wildcard;
+
+/**
+ * Answer cache of one server process.  It holds the encoded answer
+ * sections for recently answered questions, so that a repeated question
+ * does not need a lookup and dname compression again.
+ * A reload forks new server processes, that start with an empty cache;
+ * a zone transfer that is applied in place flushes the cache.
+ * The answers synthesized from a wildcard are also kept by the wildcard
+ * and the denial that covers the query name, so the other names below
+ * the wildcard are answered from them too.
+ */
+struct anscache {
+	/* hashtable of entries, direct mapped */
+	struct anscache_entry* table;
+	/* hashtable of the wildcard answers, direct mapped */
+	struct anscache_wildcard* wctable;
+	/* number of entries in each table */
+	size_t size;
+};
+
+/**
+ * Create the answer cache with the given number of entries.
+ * Allocated in the region, the stored answers are freed with the region.
+ */
+struct anscache* anscache_create(region_type* region, size_t size);
+
+/**
+ * Lookup the question (and EDNS DO bit, and maximum answer size) of the
+ * query.  Call after query_prepare_response.  On a hit the cached answer
+ * is written into the packet and the query zone is set, returns true.
+ */
+int anscache_lookup(struct anscache* cache, struct query* q);
+
+/**
+ * Store the answer in the packet for the query, after answer_query.
+ * The question section ends at qend in the packet.  An answer that is
+ * synthesized from the wildcard of anscache_lookup_wildcard is stored
+ * for that key too.
+ */
+void anscache_store(struct anscache* cache, struct query* q, size_t qend);
+
+/**
+ * Lookup the answer synthesized from the wildcard for the query, a name
+ * below the wildcard that is not in the zone.  Call in answer_query,
+ * after the lookup in the database.  The key is the wildcard, the domain
+ * of the NSEC or NSEC3 that covers the query name for the DO bit, or NULL,
+ * and the query type, DO bit and maximum answer size.  The compression
+ * pointers of the stored answer are moved for the length of the query
+ * name.  The key is kept in the query, for anscache_store.
+ * @param cache: the answer cache.
+ * @param q: the query, after query_prepare_response.
+ * @param zone: the zone of the wildcard.
+ * @param wildcard: the wildcard domain.
+ * @param cover: the domain of the denial of the query name, or NULL.
+ * @return true on a hit, the answer is in the packet.
+ */
+int anscache_lookup_wildcard(struct anscache* cache, struct query* q,
+	zone_type* zone, domain_type* wildcard, domain_type* cover);
+
+/**
+ * Remove all the answers, after a zone has been changed by the server
+ * process itself.  An answer can hold the data of other zones than its
+ * own, such as the target of a CNAME, so the answers of every zone go.
+ */
+void anscache_flush(struct anscache* cache);
+
+#endif /* ANSCACHE_H */
@@ -10,12 +10,28 @@
 #include "config.h"
 
 #include "axfr.h"
+#include "ixfr.h"
+#include "axfrcache.h"
 #include "dns.h"
 #include "packet.h"
 #include "options.h"
 
 #define AXFR_TSIG_SIGN_EVERY_NTH	96	/* tsig sign every N packets. */
 
+/*
+ * Write the next packet of the AXFR from the cache, as it was encoded
+ * for an earlier AXFR of the zone.  Returns the number of RRs.
+ */
+static uint16_t
+query_axfr_cached(struct query *query)
+{
+	if(axfrcache_get(query->axfr_cache, &query->axfr_cache_pos, query)) {
+		query->tsig_sign_it = 1; /* sign last packet */
+		query->axfr_is_done = 1;
+	}
+	return ANCOUNT(query->packet);
+}
+
 query_state_type
 query_axfr(struct nsd *nsd, struct query *query)
 {
@@ -24,9 +40,12 @@ query_axfr(struct nsd *nsd, struct query *query)
 	int exact;
 	int added;
 	uint16_t total_added = 0;
+	size_t start;
 
 	if (query->axfr_is_done)
 		return QUERY_PROCESSED;
+	if (query->ixfr_data)
+		return query_ixfr(nsd, query);
 
 	if (query->maxlen > AXFR_MAX_MESSAGE_LEN)
 		query->maxlen = AXFR_MAX_MESSAGE_LEN;
@@ -62,6 +81,11 @@ query_axfr(struct nsd *nsd, struct query *query)
 			RCODE_SET(query->packet, RCODE_NOTAUTH);
 			return QUERY_PROCESSED;
 		}
+		if(!namedb_read_lazy_zone(nsd->db, query->axfr_zone)) {
+			/* the zone cannot be read from the db now */
+			RCODE_SET(query->packet, RCODE_SERVFAIL);
+			return QUERY_PROCESSED;
+		}
 		ZTATUP(nsd, query->axfr_zone, raxfr);
 
 		query->axfr_current_domain = qdomain;
@@ -71,6 +95,21 @@ query_axfr(struct nsd *nsd, struct query *query)
 			query->tsig_sign_it = 1; /* sign first packet in stream */
 		}
 
+		start = buffer_position(query->packet);
+		if(nsd->axfrcache) {
+			uint32_t serial = zone_soa_serial(query->axfr_zone);
+			query->axfr_cache = axfrcache_lookup(nsd->axfrcache,
+				query->axfr_zone, serial, query);
+			if(query->axfr_cache) {
+				query->axfr_cache_pos = 0;
+				total_added = query_axfr_cached(query);
+				goto return_answer;
+			}
+			query->axfr_cache = axfrcache_start(nsd->axfrcache,
+				query->axfr_zone, serial, query);
+			query->axfr_cache_store = (query->axfr_cache != NULL);
+		}
+
 		query_add_compression_domain(query, qdomain, QHEADERSZ);
 
 		assert(query->axfr_zone->soa_rrset->rr_count == 1);
@@ -92,6 +131,11 @@ query_axfr(struct nsd *nsd, struct query *query)
 		buffer_set_limit(query->packet, QHEADERSZ);
 		QDCOUNT_SET(query->packet, 0);
 		query_prepare_response(query);
+		start = buffer_position(query->packet);
+		if(query->axfr_cache && !query->axfr_cache_store) {
+			total_added = query_axfr_cached(query);
+			goto return_answer;
+		}
 	}
 
 	/* Add zone RRs until answer is full.  */
@@ -149,6 +193,12 @@ return_answer:
 	ANCOUNT_SET(query->packet, total_added);
 	NSCOUNT_SET(query->packet, 0);
 	ARCOUNT_SET(query->packet, 0);
+	if(query->axfr_cache_store && !axfrcache_add(nsd->axfrcache,
+		query->axfr_cache, query, start, query->axfr_is_done)) {
+		/* too large for the cache */
+		query->axfr_cache = NULL;
+		query->axfr_cache_store = 0;
+	}
 
 	/* check if it needs tsig signatures */
 	if(query->tsig.status == TSIG_OK) {
@@ -160,45 +210,68 @@ return_answer:
 	return QUERY_IN_AXFR;
 }
 
+/*
+ * Check the provide-xfr acl of the zone for the transfer request.
+ * Returns the zone options, or NULL with the rcode set if refused.
+ */
+static zone_options_t*
+xfr_acl_check(struct nsd *nsd, struct query *q)
+{
+	acl_options_t *acl = NULL;
+	zone_options_t* zone_opt;
+	zone_opt = zone_options_find(nsd->options, q->qname);
+	if(!zone_opt ||
+	   acl_check_incoming(zone_opt->pattern->provide_xfr, q, &acl)==-1)
+	{
+		if (verbosity >= 2) {
+			char a[128];
+			addr2str(&q->addr, a, sizeof(a));
+			VERBOSITY(2, (LOG_INFO, "%s for %s from %s refused, %s",
+				q->qtype==TYPE_IXFR?"ixfr":"axfr",
+				dname_to_string(q->qname, NULL), a, acl?"blocked":"no acl matches"));
+		}
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "axfr refused, %s",
+			acl?"blocked":"no acl matches"));
+		if (!zone_opt) {
+			RCODE_SET(q->packet, RCODE_NOTAUTH);
+		} else {
+			RCODE_SET(q->packet, RCODE_REFUSE);
+		}
+		return NULL;
+	}
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "axfr admitted acl %s %s",
+		acl->ip_address_spec, acl->key_name?acl->key_name:"NOKEY"));
+	return zone_opt;
+}
+
 /*
  * Answer if this is an AXFR or IXFR query.
  */
 query_state_type
 answer_axfr_ixfr(struct nsd *nsd, struct query *q)
 {
-	acl_options_t *acl = NULL;
+	zone_options_t* zone_opt;
 	/* Is it AXFR? */
 	switch (q->qtype) {
 	case TYPE_AXFR:
 		if (q->tcp) {
-			zone_options_t* zone_opt;
-			zone_opt = zone_options_find(nsd->options, q->qname);
-			if(!zone_opt ||
-			   acl_check_incoming(zone_opt->pattern->provide_xfr, q, &acl)==-1)
-			{
-				if (verbosity >= 2) {
-					char a[128];
-					addr2str(&q->addr, a, sizeof(a));
-					VERBOSITY(2, (LOG_INFO, "axfr for %s from %s refused, %s",
-						dname_to_string(q->qname, NULL), a, acl?"blocked":"no acl matches"));
-				}
-				DEBUG(DEBUG_XFRD,1, (LOG_INFO, "axfr refused, %s",
-					acl?"blocked":"no acl matches"));
-				if (!zone_opt) {
-					RCODE_SET(q->packet, RCODE_NOTAUTH);
-				} else {
-					RCODE_SET(q->packet, RCODE_REFUSE);
-				}
+			if(!xfr_acl_check(nsd, q))
 				return QUERY_PROCESSED;
-			}
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "axfr admitted acl %s %s",
-				acl->ip_address_spec, acl->key_name?acl->key_name:"NOKEY"));
 			return query_axfr(nsd, q);
 		}
-		/** Fallthrough: AXFR over UDP queries are discarded. */
-	case TYPE_IXFR:
+		/* AXFR over UDP is not implemented */
 		RCODE_SET(q->packet, RCODE_IMPL);
 		return QUERY_PROCESSED;
+	case TYPE_IXFR:
+		zone_opt = zone_options_find(nsd->options, q->qname);
+		if(!zone_opt || !zone_opt->pattern->store_ixfr) {
+			/* no IXFR versions are stored for the zone */
+			RCODE_SET(q->packet, RCODE_IMPL);
+			return QUERY_PROCESSED;
+		}
+		if(!xfr_acl_check(nsd, q))
+			return QUERY_PROCESSED;
+		return query_ixfr(nsd, q);
 	default:
 		return QUERY_DISCARDED;
 	}
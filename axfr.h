@@ -14,10 +14,12 @@
 #include "query.h"
 
 /*
- * For optimal compression AXFR response packets are limited in size
- * to MAX_COMPRESSION_OFFSET.
+ * AXFR response packets are filled up to the maximum message size.  Only
+ * the names in the first MAX_COMPRESSION_OFFSET bytes can be pointed to,
+ * the names after that are compressed against them, and so a message
+ * carries more RRs, with fewer messages and TSIG signatures per zone.
  */
-#define AXFR_MAX_MESSAGE_LEN MAX_COMPRESSION_OFFSET
+#define AXFR_MAX_MESSAGE_LEN MAX_PACKET_SIZE
 
 query_state_type answer_axfr_ixfr(struct nsd *nsd, struct query *q);
 query_state_type query_axfr(struct nsd *nsd, struct query *query);
@@ -0,0 +1,186 @@
+/*
+ * axfrcache.c - cache of encoded AXFR streams for the server processes.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include <string.h>
+#include "axfrcache.h"
+#include "packet.h"
+#include "util.h"
+
+/** size of the length and ANCOUNT in front of a stored packet */
+#define AXFRCACHE_PACKET_HDR 4
+
+/** A stored AXFR stream */
+struct axfrcache_entry {
+	struct axfrcache_entry* next;
+	zone_type* zone;
+	uint32_t serial;
+	/* the query that stores the stream, NULL when it is complete */
+	struct query* builder;
+	/* the packets, every packet is the length and the ANCOUNT (in
+	 * network order), followed by the answer part of the packet */
+	uint8_t* data;
+	size_t len;
+	size_t capacity;
+	/* position of the answer in the first packet, after the question,
+	 * the compression pointers in the packets depend on it */
+	size_t start;
+	/* length of the largest packet, with header and question */
+	size_t maxpacket;
+};
+
+static void
+axfrcache_entry_delete(struct axfrcache* cache, struct axfrcache_entry* e)
+{
+	struct axfrcache_entry** p = &cache->list;
+	while(*p) {
+		if(*p == e) {
+			*p = e->next;
+			break;
+		}
+		p = &(*p)->next;
+	}
+	cache->size -= e->capacity;
+	free(e->data);
+	free(e);
+}
+
+static void
+axfrcache_cleanup(void* arg)
+{
+	struct axfrcache* cache = (struct axfrcache*)arg;
+	while(cache->list)
+		axfrcache_entry_delete(cache, cache->list);
+}
+
+struct axfrcache*
+axfrcache_create(region_type* region, size_t max)
+{
+	struct axfrcache* cache = (struct axfrcache*)region_alloc_zero(region,
+		sizeof(*cache));
+	cache->max = max;
+	region_add_cleanup(region, axfrcache_cleanup, cache);
+	return cache;
+}
+
+struct axfrcache_entry*
+axfrcache_lookup(struct axfrcache* cache, zone_type* zone, uint32_t serial,
+	struct query* q)
+{
+	struct axfrcache_entry* e;
+	for(e = cache->list; e; e = e->next) {
+		if(e->zone != zone || e->serial != serial || e->builder)
+			continue;
+		/* the question must be the same length, and the packets must
+		 * fit next to the EDNS and TSIG of this query */
+		if(e->start != buffer_position(q->packet) ||
+			e->maxpacket + q->reserved_space > q->maxlen)
+			return NULL;
+		return e;
+	}
+	return NULL;
+}
+
+struct axfrcache_entry*
+axfrcache_start(struct axfrcache* cache, zone_type* zone, uint32_t serial,
+	struct query* q)
+{
+	struct axfrcache_entry* e, *next;
+	for(e = cache->list; e; e = next) {
+		next = e->next;
+		if(e->zone != zone)
+			continue;
+		if(e->builder)
+			return NULL;
+		/* an older serial of the zone, that was not flushed */
+		if(e->serial != serial)
+			axfrcache_entry_delete(cache, e);
+	}
+	if(cache->size >= cache->max)
+		return NULL;
+	e = (struct axfrcache_entry*)xalloc_zero(sizeof(*e));
+	e->zone = zone;
+	e->serial = serial;
+	e->builder = q;
+	e->start = buffer_position(q->packet);
+	e->next = cache->list;
+	cache->list = e;
+	return e;
+}
+
+int
+axfrcache_add(struct axfrcache* cache, struct axfrcache_entry* e,
+	struct query* q, size_t start, int done)
+{
+	size_t pktlen = buffer_position(q->packet) - start;
+	size_t need = e->len + AXFRCACHE_PACKET_HDR + pktlen;
+	assert(e->builder == q);
+	if(need > e->capacity) {
+		size_t newcap = e->capacity?e->capacity*2:16384;
+		while(newcap < need)
+			newcap *= 2;
+		if(cache->size - e->capacity + newcap > cache->max) {
+			axfrcache_entry_delete(cache, e);
+			return 0;
+		}
+		e->data = (uint8_t*)xrealloc(e->data, newcap);
+		cache->size += newcap - e->capacity;
+		e->capacity = newcap;
+	}
+	write_uint16(e->data + e->len, (uint16_t)pktlen);
+	write_uint16(e->data + e->len + 2, ANCOUNT(q->packet));
+	memmove(e->data + e->len + AXFRCACHE_PACKET_HDR,
+		buffer_at(q->packet, start), pktlen);
+	e->len = need;
+	if(buffer_position(q->packet) > e->maxpacket)
+		e->maxpacket = buffer_position(q->packet);
+	if(done) {
+		/* give the unused space back */
+		e->data = (uint8_t*)xrealloc(e->data, e->len);
+		cache->size -= e->capacity - e->len;
+		e->capacity = e->len;
+		e->builder = NULL;
+	}
+	return 1;
+}
+
+int
+axfrcache_get(struct axfrcache_entry* e, size_t* pos, struct query* q)
+{
+	uint16_t pktlen;
+	assert(*pos + AXFRCACHE_PACKET_HDR <= e->len);
+	pktlen = read_uint16(e->data + *pos);
+	ANCOUNT_SET(q->packet, read_uint16(e->data + *pos + 2));
+	buffer_write(q->packet, e->data + *pos + AXFRCACHE_PACKET_HDR, pktlen);
+	*pos += AXFRCACHE_PACKET_HDR + pktlen;
+	return *pos >= e->len;
+}
+
+void
+axfrcache_abort(struct axfrcache* cache, struct query* q)
+{
+	struct axfrcache_entry* e;
+	for(e = cache->list; e; e = e->next) {
+		if(e->builder == q) {
+			axfrcache_entry_delete(cache, e);
+			return;
+		}
+	}
+}
+
+void
+axfrcache_flush_zone(struct axfrcache* cache, zone_type* zone)
+{
+	struct axfrcache_entry* e, *next;
+	for(e = cache->list; e; e = next) {
+		next = e->next;
+		if(e->zone == zone)
+			axfrcache_entry_delete(cache, e);
+	}
+}
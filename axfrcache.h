@@ -0,0 +1,80 @@
+/* axfrcache.h - cache of encoded AXFR streams for the server processes.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+#ifndef AXFRCACHE_H
+#define AXFRCACHE_H
+#include "query.h"
+
+struct axfrcache_entry;
+
+/**
+ * AXFR stream cache of one server process.  The first AXFR of a zone
+ * serial stores the packets it sends, without the header and question,
+ * and the transfers that follow send the stored packets again, without
+ * the walk over the zone and the dname compression.  TSIG and EDNS are
+ * added per connection, after the stored packet.
+ * A reload forks new server processes, that start with an empty cache;
+ * a zone transfer that is applied in place flushes the zone.
+ */
+struct axfrcache {
+	/* list of entries */
+	struct axfrcache_entry* list;
+	/* bytes stored in the entries, and the maximum */
+	size_t size;
+	size_t max;
+};
+
+/**
+ * Create the AXFR cache that stores at most max bytes.
+ * Allocated in the region, the entries are freed with the region.
+ */
+struct axfrcache* axfrcache_create(region_type* region, size_t max);
+
+/**
+ * Find the complete stream for the zone with the serial, that fits in
+ * the packets of the query, or NULL.  Call at the start of the AXFR,
+ * with the packet positioned after the question.
+ */
+struct axfrcache_entry* axfrcache_lookup(struct axfrcache* cache,
+	zone_type* zone, uint32_t serial, struct query* q);
+
+/**
+ * Start to store the stream for the zone with the serial, that the
+ * query sends.  Returns NULL if it is already started by another query,
+ * or the cache is full.  Call with the packet positioned after the
+ * question.
+ */
+struct axfrcache_entry* axfrcache_start(struct axfrcache* cache,
+	zone_type* zone, uint32_t serial, struct query* q);
+
+/**
+ * Store the packet of the query, the answer part from position start.
+ * If done, the stream is complete.  Returns false if the stream became
+ * too large, and it is removed from the cache.
+ */
+int axfrcache_add(struct axfrcache* cache, struct axfrcache_entry* e,
+	struct query* q, size_t start, int done);
+
+/**
+ * Write the next stored packet at *pos into the query packet, after
+ * the question if there is one, and set ANCOUNT.  Returns true if this
+ * was the last packet.
+ */
+int axfrcache_get(struct axfrcache_entry* e, size_t* pos, struct query* q);
+
+/**
+ * The query is done, remove the stream it was storing, if incomplete.
+ */
+void axfrcache_abort(struct axfrcache* cache, struct query* q);
+
+/**
+ * Remove the stream of the zone, after the zone has been changed by
+ * the server process itself.
+ */
+void axfrcache_flush_zone(struct axfrcache* cache, zone_type* zone);
+
+#endif /* AXFRCACHE_H */
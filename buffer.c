@@ -10,6 +10,7 @@
 #include "config.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "buffer.h"
 
@@ -129,3 +130,26 @@ buffer_printf(buffer_type *buffer, const char *format, ...)
 	buffer->_position += written;
 	return written;
 }
+
+void
+buffer_print_str(buffer_type *buffer, const char *str)
+{
+	size_t len = strlen(str);
+	buffer_invariant(buffer);
+	buffer_reserve(buffer, len + 1);
+	memcpy(buffer_current(buffer), str, len + 1);
+	buffer->_position += len;
+}
+
+void
+buffer_print_u32(buffer_type *buffer, uint32_t value)
+{
+	char buf[11];
+	char* p = buf + sizeof(buf);
+	*--p = 0;
+	do {
+		*--p = '0' + (value % 10);
+		value /= 10;
+	} while(value);
+	buffer_print_str(buffer, p);
+}
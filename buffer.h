@@ -382,4 +382,12 @@ buffer_read_u32(buffer_type *buffer)
 int buffer_printf(buffer_type *buffer, const char *format, ...)
 	ATTR_FORMAT(printf, 2, 3);
 
+/*
+ * Like buffer_printf with "%s" and "%u", without the format parsing
+ * of vsnprintf.  Increases the capacity if required, and the buffer's
+ * position is set to the terminating '\0'.
+ */
+void buffer_print_str(buffer_type *buffer, const char *str);
+void buffer_print_u32(buffer_type *buffer, uint32_t value);
+
 #endif /* _BUFFER_H_ */
@@ -0,0 +1,219 @@
+/*
+ * catalog.c -- catalog zones, the member zones are provisioned from them.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * A zone with catalog-member-pattern is a catalog zone (RFC 9432) that
+ * this server consumes.  When the reload has read or transferred it, the
+ * member zones, the PTR targets of <unique-id>.zones.<catalog>, are put
+ * in a task for xfrd.  xfrd compares them with the zones of the member
+ * pattern in the zonelist, and adds and deletes the difference in one
+ * batch, so the changes of the catalog take one reload.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <strings.h>
+#include "catalog.h"
+#include "namedb.h"
+#include "difffile.h"
+#include "options.h"
+#include "xfrd.h"
+#include "xfrd-notify.h"
+#include "xfrd-watch.h"
+#include "nsd.h"
+#include "util.h"
+
+/* is the label of dname at index, counted from the root, equal to s */
+static int
+catalog_label_is(const dname_type* dname, uint8_t index, const char* s)
+{
+	const uint8_t* label = dname_label(dname, index);
+	size_t len = strlen(s);
+	return label_length(label) == len &&
+		strncasecmp((const char*)label_data(label), s, len) == 0;
+}
+
+/* does the TXT rrset have the text "2", the schema version */
+static int
+catalog_version_2(rrset_type* rrset)
+{
+	uint16_t i;
+	for(i=0; i<rrset->rr_count; i++) {
+		uint8_t* wire = rr_rdata_wire(&rrset->rrs[i]);
+		if(rrset->rrs[i].rdlength == 2 && wire[0] == 1 &&
+			wire[1] == '2')
+			return 1;
+	}
+	return 0;
+}
+
+void
+catalog_task_members(udb_base* udb, udb_ptr* last, zone_type* zone)
+{
+	const dname_type* apex, *dname, *member;
+	struct zone_batch batch;
+	domain_type* d;
+	rrset_type* rrset;
+	int version = 0;
+
+	if(!zone->opts || !zone->opts->pattern->catalog_member_pattern)
+		return;
+	if(!zone->soa_rrset || zone->is_lazy)
+		return;
+	apex = domain_dname(zone->apex);
+	memset(&batch, 0, sizeof(batch));
+	for(d = domain_next(zone->apex); d && domain_is_subdomain(d,
+		zone->apex); d = domain_next(d)) {
+		dname = domain_dname(d);
+		if(dname->label_count == apex->label_count+1 &&
+			catalog_label_is(dname, apex->label_count, "version")) {
+			if((rrset = domain_find_rrset(d, zone, TYPE_TXT)))
+				version = catalog_version_2(rrset);
+		} else if(dname->label_count == apex->label_count+2 &&
+			catalog_label_is(dname, apex->label_count, "zones")) {
+			if(!(rrset = domain_find_rrset(d, zone, TYPE_PTR)))
+				continue;
+			if(rrset->rr_count != 1) {
+				log_msg(LOG_WARNING, "catalog %s: member %s "
+					"has more than one PTR, ignored",
+					zone->opts->name, domain_to_string(d));
+				continue;
+			}
+			member = domain_dname(rr_rdata_domains(
+				&rrset->rrs[0])[0]);
+			zone_batch_add(&batch, member,
+				dname_total_size(member));
+			batch.num++;
+		}
+	}
+	if(!version) {
+		log_msg(LOG_ERR, "catalog %s: no version.%s TXT \"2\", the "
+			"member zones are not changed", zone->opts->name,
+			zone->opts->name);
+	} else {
+		task_new_catalog(udb, last, apex, batch.data, batch.len,
+			batch.num);
+	}
+	free(batch.data);
+}
+
+/* a zone of the member pattern that is no longer in the catalog */
+struct catalog_gone {
+	struct catalog_gone* next;
+	zone_options_t* zone;
+};
+
+void
+catalog_process_members(xfrd_state_t* xfrd, struct task_list_d* task)
+{
+	nsd_options_t* opt = xfrd->nsd->options;
+	zone_options_t* catalog, *zopt;
+	pattern_options_t* pat;
+	struct zone_batch add, del;
+	struct catalog_gone* gone = NULL, *g;
+	region_type* region;
+	rbtree_t* members;
+	rbnode_t* n;
+	const dname_type* dname;
+	uint8_t* p;
+	uint64_t i;
+
+	/* the catalog could be deleted, or reconfigured, since the reload
+	 * read it */
+	catalog = zone_options_find(opt, task->zname);
+	if(!catalog || !catalog->pattern->catalog_member_pattern)
+		return;
+	pat = pattern_options_find(opt,
+		catalog->pattern->catalog_member_pattern);
+	if(!pat) {
+		log_msg(LOG_ERR, "catalog %s: member pattern %s does not "
+			"exist", catalog->name,
+			catalog->pattern->catalog_member_pattern);
+		return;
+	}
+
+	/* the members, the dnames after the name of the catalog */
+	region = region_create(xalloc, free);
+	members = rbtree_create(region,
+		(int (*)(const void *, const void *)) dname_compare);
+	p = (uint8_t*)task->zname + dname_total_size(task->zname);
+	for(i=0; i<task->yesno; i++) {
+		n = (rbnode_t*)region_alloc_zero(region, sizeof(*n));
+		n->key = p;
+		p += dname_total_size((const dname_type*)p);
+		/* a duplicate member is the same zone */
+		(void)rbtree_insert(members, n);
+	}
+
+	memset(&add, 0, sizeof(add));
+	memset(&del, 0, sizeof(del));
+	zone_list_batch(opt);
+	RBTREE_FOR(zopt, zone_options_t*, opt->zone_options) {
+		if(zopt->part_of_config || zopt->pattern != pat ||
+			rbtree_search(members, zopt->node.key))
+			continue;
+		g = (struct catalog_gone*)region_alloc(region, sizeof(*g));
+		g->zone = zopt;
+		g->next = gone;
+		gone = g;
+	}
+	for(g = gone; g; g = g->next) {
+		dname = (const dname_type*)g->zone->node.key;
+		/* the task is made before the zone options are deleted */
+		zone_batch_add(&del, dname, dname_total_size(dname));
+		del.num++;
+		if(zone_is_slave(g->zone))
+			xfrd_del_slave_zone(xfrd, dname);
+		xfrd_del_notify(xfrd, dname);
+		zone_list_del(opt, g->zone);
+	}
+	RBTREE_FOR(n, rbnode_t*, members) {
+		const char* name;
+		uint32_t zonestatid;
+		dname = (const dname_type*)n->key;
+		if((zopt = zone_options_find(opt, dname))) {
+			if(zopt->pattern != pat)
+				log_msg(LOG_WARNING, "catalog %s: member %s "
+					"exists with pattern %s, ignored",
+					catalog->name, zopt->name,
+					zopt->pattern->pname);
+			continue;
+		}
+		name = dname_to_string(dname, NULL);
+		if(!(zopt = zone_list_add(opt, name, pat->pname))) {
+			log_msg(LOG_ERR, "catalog %s: could not add zonelist "
+				"entry for %s", catalog->name, name);
+			continue;
+		}
+		zonestatid = getzonestatid(opt, zopt);
+		zone_batch_add(&add, &zonestatid, sizeof(zonestatid));
+		zone_batch_add(&add, zopt->name, strlen(zopt->name)+1);
+		zone_batch_add(&add, pat->pname, strlen(pat->pname)+1);
+		add.num++;
+		init_notify_send(xfrd->notify_zones, xfrd->region, zopt);
+		xfrd_watch_zone(xfrd, zopt);
+		if(zone_is_slave(zopt))
+			xfrd_init_slave_zone(xfrd, zopt);
+	}
+	zone_list_flush(opt);
+
+	if(del.num != 0)
+		task_new_del_zones(xfrd->nsd->task[xfrd->nsd->mytask],
+			xfrd->last_task, del.data, del.len, del.num);
+	if(add.num != 0) {
+		task_new_add_zones(xfrd->nsd->task[xfrd->nsd->mytask],
+			xfrd->last_task, add.data, add.len, add.num);
+		xfrd_zonestat_inc_ifneeded(xfrd);
+	}
+	if(add.num != 0 || del.num != 0) {
+		VERBOSITY(1, (LOG_INFO, "catalog %s: added %d, removed %d "
+			"zones", catalog->name, (int)add.num, (int)del.num));
+		xfrd_set_reload_now(xfrd);
+	}
+	free(add.data);
+	free(del.data);
+	region_destroy(region);
+}
@@ -0,0 +1,42 @@
+/*
+ * catalog.h -- catalog zones, the member zones are provisioned from them.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+struct udb_base;
+struct udb_ptr;
+struct zone;
+struct xfrd_state;
+struct task_list_d;
+
+/**
+ * In reload, after the zone is read or transferred: if it is a catalog
+ * zone, with catalog-member-pattern, put the list of its member zones in
+ * a task for xfrd.  A catalog without the version 2 record is logged and
+ * its members are not changed.
+ * @param udb: the task udb, with the results for xfrd.
+ * @param last: the last task.
+ * @param zone: the zone that changed.
+ */
+void catalog_task_members(struct udb_base* udb, struct udb_ptr* last,
+	struct zone* zone);
+
+/**
+ * In xfrd, add the member zones that are new with the member pattern, and
+ * delete the zones of the member pattern that are no longer in the
+ * catalog.  The zonelist is written once, and one reload adds and
+ * deletes them, like nsd-control addzones and delzones.
+ * @param xfrd: xfrd, with the options and the tasks for the reload.
+ * @param task: the catalog task from the reload.
+ */
+void catalog_process_members(struct xfrd_state* xfrd,
+	struct task_list_d* task);
+
+#endif /* CATALOG_H */
@@ -19,6 +19,7 @@
 #include "options.h"
 #include "util.h"
 #include "dname.h"
+#include "edns.h"
 #include "tsig.h"
 #include "rrl.h"
 #include "configyyrename.h"
@@ -41,6 +42,7 @@ extern config_parser_state_t* cfg_parser;
 %}
 %union {
 	char*	str;
+	struct cpu_option* cpu;
 }
 
 %token SPACE LETTER NEWLINE COMMENT COLON ANY ZONESTR
@@ -67,7 +69,39 @@ extern config_parser_state_t* cfg_parser;
 %token VAR_RRL_IPV4_PREFIX_LENGTH VAR_RRL_IPV6_PREFIX_LENGTH
 %token VAR_RRL_WHITELIST_RATELIMIT VAR_RRL_WHITELIST
 %token VAR_ZONEFILES_CHECK VAR_ZONEFILES_WRITE VAR_LOG_TIME_ASCII
-%token VAR_ROUND_ROBIN VAR_ZONESTATS
+%token VAR_ROUND_ROBIN VAR_ZONESTATS VAR_REUSEPORT VAR_TCP_REUSEPORT
+%token VAR_ANSWER_CACHE_SIZE VAR_CPU_AFFINITY VAR_XFRD_CPU_AFFINITY
+%token <str> VAR_SERVER_CPU_AFFINITY
+%token VAR_ZONEFILES_LOAD_WORKERS VAR_RELOAD_IN_PLACE VAR_ZONE_REGIONS
+%token VAR_STORE_IXFR VAR_IXFR_NUMBER VAR_IXFR_SIZE VAR_AXFR_CACHE_SIZE
+%token VAR_SERVER_THREADS
+%token VAR_XDP_INTERFACE VAR_NAME_HASH_INDEX VAR_LAZY_ZONE_LOAD
+%token VAR_DATABASE_PUBLISH VAR_DATABASE_READONLY VAR_NSEC3_SNAPSHOT
+%token VAR_XFRDFILE_TEXT VAR_XFRD_TCP_MAX VAR_XFRD_TCP_MASTER_MAX
+%token VAR_XFRD_STREAM_APPLY VAR_ZONEFILES_WATCH VAR_ZONEFILES_WRITE_WORKERS
+%token VAR_XFRD_UDP_MAX VAR_HUGEPAGES VAR_RELOAD_PREFAULT
+%token VAR_NUMA_REPLICATE VAR_RRL_FILE VAR_RRL_ADAPTIVE
+%token VAR_METRICS_ENABLE VAR_METRICS_INTERFACE VAR_METRICS_PORT
+%token VAR_METRICS_PATH VAR_LOG_ASYNC
+%token VAR_XFR_OUT_WORKERS VAR_XFR_OUT_NICE VAR_XFR_OUT_RATE
+%token VAR_TCP_DEFER_ACCEPT VAR_TCP_FASTOPEN
+%token VAR_TLS_SERVICE_KEY VAR_TLS_SERVICE_PEM VAR_TLS_PORT
+%token VAR_UDP_BATCH_SIZE VAR_UDP_BUSY_POLL VAR_UDP_GRO VAR_UDP_GSO
+%token VAR_UDP_WILDCARD
+%token VAR_UDP_PREFETCH
+%token VAR_UDP_DROP_STATS VAR_UDP_RCVBUF_MAX VAR_STALL_MONITOR
+%token VAR_LATENCY_STATS VAR_ZONE_CPU_SAMPLE VAR_REGION_PROFILE
+%token VAR_DNSTAP_ENABLE VAR_DNSTAP_SOCKET_PATH VAR_DNSTAP_FILE
+%token VAR_DNSTAP_LOG_AUTH_QUERY_MESSAGES VAR_DNSTAP_LOG_AUTH_RESPONSE_MESSAGES
+%token VAR_DNSTAP_SAMPLE VAR_DNSTAP_RING_SIZE
+%token VAR_HEAVY_HITTERS
+%token VAR_NSEC3_CACHE_SIZE
+%token VAR_RDATA_SHARING
+%token VAR_MINIMAL_RESPONSES VAR_MINIMAL_ANY
+%token VAR_PROGRESSIVE_START VAR_LOAD_PRIORITY VAR_CATALOG_MEMBER_PATTERN
+%token VAR_ANSWER_COOKIE VAR_COOKIE_SECRET VAR_OVERLOAD_ACTION
+%token VAR_OVERLOAD_ALLOW VAR_UDP_FILTER VAR_UDP_FILTER_DENY
+%type <cpu> cpus
 
 %%
 toplevelvars: /* empty */ | toplevelvars toplevelvar ;
@@ -96,7 +130,38 @@ content_server: server_ip_address | server_ip_transparent | server_debug_mode |
 	server_rrl_size | server_rrl_ratelimit | server_rrl_slip | 
 	server_rrl_ipv4_prefix_length | server_rrl_ipv6_prefix_length | server_rrl_whitelist_ratelimit |
 	server_zonefiles_check | server_do_ip4 | server_do_ip6 |
-	server_zonefiles_write | server_log_time_ascii | server_round_robin;
+	server_zonefiles_write | server_log_time_ascii | server_round_robin |
+	server_reuseport | server_tcp_reuseport | server_answer_cache_size | server_axfr_cache_size |
+	server_cpu_affinity |
+	server_service_cpu_affinity | server_xfrd_cpu_affinity |
+	server_zonefiles_load_workers | server_zonefiles_write_workers |
+	server_progressive_start | server_reload_in_place |
+	server_zone_regions | server_server_threads | server_xdp_interface |
+	server_name_hash_index | server_lazy_zone_load | server_xfrdfile_text |
+	server_database_publish | server_database_readonly |
+	server_nsec3_snapshot |
+	server_xfrd_tcp_max | server_xfrd_tcp_master_max |
+	server_xfrd_stream_apply | server_zonefiles_watch |
+	server_xfrd_udp_max | server_hugepages | server_reload_prefault |
+	server_numa_replicate | server_rrl_file | server_rrl_adaptive |
+	server_metrics_enable | server_metrics_interface |
+	server_metrics_port | server_metrics_path | server_log_async |
+	server_xfr_out_workers | server_xfr_out_nice | server_xfr_out_rate |
+	server_tcp_defer_accept | server_tcp_fastopen |
+	server_tls_service_key | server_tls_service_pem | server_tls_port |
+	server_udp_batch_size | server_udp_busy_poll | server_udp_gro |
+	server_udp_gso | server_udp_wildcard | server_udp_prefetch |
+	server_udp_drop_stats | server_udp_rcvbuf_max | server_stall_monitor |
+	server_latency_stats | server_zone_cpu_sample | server_region_profile |
+	server_dnstap_enable |
+	server_dnstap_socket_path | server_dnstap_file |
+	server_dnstap_log_auth_query_messages |
+	server_dnstap_log_auth_response_messages | server_dnstap_sample |
+	server_dnstap_ring_size | server_heavy_hitters |
+	server_nsec3_cache_size | server_rdata_sharing |
+	server_minimal_responses | server_minimal_any |
+	server_answer_cookie | server_cookie_secret | server_overload_action |
+	server_overload_allow | server_udp_filter | server_udp_filter_deny;
 server_ip_address: VAR_IP_ADDRESS STRING 
 	{ 
 		OUTYY(("P(server_ip_address:%s)\n", $2)); 
@@ -236,6 +301,78 @@ server_nsid: VAR_NSID STRING
 		}
 	}
 	;
+server_answer_cookie: VAR_ANSWER_COOKIE STRING
+	{
+		OUTYY(("P(server_answer_cookie:%s)\n", $2));
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->answer_cookie = (strcmp($2, "yes")==0);
+	}
+	;
+server_overload_action: VAR_OVERLOAD_ACTION STRING
+	{
+		OUTYY(("P(server_overload_action:%s)\n", $2));
+		if(strcmp($2, "no") == 0)
+			cfg_parser->opt->overload_action = 0;
+		else if(strcmp($2, "tc") == 0)
+			cfg_parser->opt->overload_action = OVERLOAD_TC;
+		else if(strcmp($2, "drop") == 0)
+			cfg_parser->opt->overload_action = OVERLOAD_DROP;
+		else	yyerror("overload-action: expected no, tc or drop.");
+	}
+	;
+server_overload_allow: VAR_OVERLOAD_ALLOW STRING
+	{
+		acl_options_t* acl = parse_acl_info(cfg_parser->opt->region,
+			$2, "NOKEY");
+		OUTYY(("P(server_overload_allow:%s)\n", $2));
+		if(acl->port != 0)
+			yyerror("overload-allow: expected an address or range "
+				"without a port.");
+		if(cfg_parser->opt->overload_allow) {
+			acl_options_t* last = cfg_parser->opt->overload_allow;
+			while(last->next)
+				last = last->next;
+			last->next = acl;
+		} else	cfg_parser->opt->overload_allow = acl;
+	}
+	;
+server_udp_filter: VAR_UDP_FILTER STRING
+	{
+		OUTYY(("P(server_udp_filter:%s)\n", $2));
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->udp_filter = (strcmp($2, "yes")==0);
+	}
+	;
+server_udp_filter_deny: VAR_UDP_FILTER_DENY STRING
+	{
+		acl_options_t* acl = parse_acl_info(cfg_parser->opt->region,
+			$2, "NOKEY");
+		OUTYY(("P(server_udp_filter_deny:%s)\n", $2));
+		if(acl->port != 0)
+			yyerror("udp-filter-deny: expected an address or range "
+				"without a port.");
+		if(cfg_parser->opt->udp_filter_deny) {
+			acl_options_t* last = cfg_parser->opt->udp_filter_deny;
+			while(last->next)
+				last = last->next;
+			last->next = acl;
+		} else	cfg_parser->opt->udp_filter_deny = acl;
+	}
+	;
+server_cookie_secret: VAR_COOKIE_SECRET STRING
+	{
+		uint8_t secret[COOKIE_SECRET_LEN];
+		OUTYY(("P(server_cookie_secret:%s)\n", $2));
+		if(strlen($2) != COOKIE_SECRET_LEN*2 ||
+			hex_pton($2, secret, sizeof(secret)) !=
+			COOKIE_SECRET_LEN)
+			yyerror("cookie-secret: expected 32 hex digits.");
+		else cfg_parser->opt->cookie_secret = region_strdup(
+			cfg_parser->opt->region, $2);
+	}
+	;
 server_logfile: VAR_LOGFILE STRING
 	{ 
 		OUTYY(("P(server_logfile:%s)\n", $2)); 
@@ -264,6 +401,522 @@ server_round_robin: VAR_ROUND_ROBIN STRING
 		}
 	}
 	;
+server_reuseport: VAR_REUSEPORT STRING 
+	{ 
+		OUTYY(("P(server_reuseport:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->reuseport = (strcmp($2, "yes")==0);
+	}
+	;
+server_tcp_reuseport: VAR_TCP_REUSEPORT STRING
+	{
+		OUTYY(("P(server_tcp_reuseport:%s)\n", $2));
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->tcp_reuseport = (strcmp($2, "yes")==0);
+	}
+	;
+server_tcp_defer_accept: VAR_TCP_DEFER_ACCEPT STRING 
+	{ 
+		OUTYY(("P(server_tcp_defer_accept:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->tcp_defer_accept = (strcmp($2, "yes")==0);
+	}
+	;
+server_tcp_fastopen: VAR_TCP_FASTOPEN STRING 
+	{ 
+		OUTYY(("P(server_tcp_fastopen:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->tcp_fastopen = (strcmp($2, "yes")==0);
+	}
+	;
+server_tls_service_key: VAR_TLS_SERVICE_KEY STRING
+	{ 
+		OUTYY(("P(server_tls_service_key:%s)\n", $2)); 
+		cfg_parser->opt->tls_service_key = region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
+server_tls_service_pem: VAR_TLS_SERVICE_PEM STRING
+	{ 
+		OUTYY(("P(server_tls_service_pem:%s)\n", $2)); 
+		cfg_parser->opt->tls_service_pem = region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
+server_tls_port: VAR_TLS_PORT STRING
+	{ 
+		OUTYY(("P(server_tls_port:%s)\n", $2)); 
+		if(atoi($2) <= 0 || atoi($2) > 65535)
+			yyerror("port number expected");
+		else cfg_parser->opt->tls_port = region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
+server_udp_batch_size: VAR_UDP_BATCH_SIZE STRING
+	{ 
+		OUTYY(("P(server_udp_batch_size:%s)\n", $2)); 
+		if(atoi($2) <= 0 || atoi($2) > 1024)
+			yyerror("number from 1 to 1024 expected");
+		else cfg_parser->opt->udp_batch_size = atoi($2);
+	}
+	;
+server_udp_busy_poll: VAR_UDP_BUSY_POLL STRING
+	{ 
+		OUTYY(("P(server_udp_busy_poll:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->udp_busy_poll = atoi($2);
+	}
+	;
+server_udp_drop_stats: VAR_UDP_DROP_STATS STRING
+	{
+		OUTYY(("P(server_udp_drop_stats:%s)\n", $2));
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->udp_drop_stats = (strcmp($2, "yes")==0);
+	}
+	;
+server_udp_rcvbuf_max: VAR_UDP_RCVBUF_MAX STRING
+	{
+		OUTYY(("P(server_udp_rcvbuf_max:%s)\n", $2));
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else if(atoi($2) < 0)
+			yyerror("udp-rcvbuf-max: expected a number >= 0");
+		else cfg_parser->opt->udp_rcvbuf_max = atoi($2);
+	}
+	;
+server_stall_monitor: VAR_STALL_MONITOR STRING
+	{
+		OUTYY(("P(server_stall_monitor:%s)\n", $2));
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else if(atoi($2) < 0)
+			yyerror("stall-monitor: expected a number >= 0");
+		else cfg_parser->opt->stall_monitor = atoi($2);
+	}
+	;
+server_udp_gro: VAR_UDP_GRO STRING 
+	{ 
+		OUTYY(("P(server_udp_gro:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->udp_gro = (strcmp($2, "yes")==0);
+	}
+	;
+server_udp_gso: VAR_UDP_GSO STRING 
+	{ 
+		OUTYY(("P(server_udp_gso:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->udp_gso = (strcmp($2, "yes")==0);
+	}
+	;
+server_udp_wildcard: VAR_UDP_WILDCARD STRING 
+	{ 
+		OUTYY(("P(server_udp_wildcard:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->udp_wildcard = (strcmp($2, "yes")==0);
+	}
+	;
+server_udp_prefetch: VAR_UDP_PREFETCH STRING 
+	{ 
+		OUTYY(("P(server_udp_prefetch:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->udp_prefetch = (strcmp($2, "yes")==0);
+	}
+	;
+server_latency_stats: VAR_LATENCY_STATS STRING 
+	{ 
+		OUTYY(("P(server_latency_stats:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->latency_stats = (strcmp($2, "yes")==0);
+	}
+	;
+server_region_profile: VAR_REGION_PROFILE STRING
+	{ 
+		OUTYY(("P(server_region_profile:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->region_profile = (strcmp($2, "yes")==0);
+	}
+	;
+server_zone_cpu_sample: VAR_ZONE_CPU_SAMPLE STRING
+	{ 
+		OUTYY(("P(server_zone_cpu_sample:%s)\n", $2)); 
+		if(atoi($2) < 0)
+			yyerror("number expected");
+		else cfg_parser->opt->zone_cpu_sample = atoi($2);
+	}
+	;
+server_dnstap_enable: VAR_DNSTAP_ENABLE STRING 
+	{ 
+		OUTYY(("P(server_dnstap_enable:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->dnstap_enable = (strcmp($2, "yes")==0);
+	}
+	;
+server_dnstap_socket_path: VAR_DNSTAP_SOCKET_PATH STRING
+	{ 
+		OUTYY(("P(server_dnstap_socket_path:%s)\n", $2)); 
+		cfg_parser->opt->dnstap_socket_path = region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
+server_dnstap_file: VAR_DNSTAP_FILE STRING
+	{ 
+		OUTYY(("P(server_dnstap_file:%s)\n", $2)); 
+		cfg_parser->opt->dnstap_file = region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
+server_dnstap_log_auth_query_messages: VAR_DNSTAP_LOG_AUTH_QUERY_MESSAGES STRING 
+	{ 
+		OUTYY(("P(server_dnstap_log_auth_query_messages:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->dnstap_log_auth_query_messages = (strcmp($2, "yes")==0);
+	}
+	;
+server_dnstap_log_auth_response_messages: VAR_DNSTAP_LOG_AUTH_RESPONSE_MESSAGES STRING 
+	{ 
+		OUTYY(("P(server_dnstap_log_auth_response_messages:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->dnstap_log_auth_response_messages = (strcmp($2, "yes")==0);
+	}
+	;
+server_dnstap_sample: VAR_DNSTAP_SAMPLE STRING
+	{ 
+		OUTYY(("P(server_dnstap_sample:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number larger than 0 expected");
+		else cfg_parser->opt->dnstap_sample = atoi($2);
+	}
+	;
+server_dnstap_ring_size: VAR_DNSTAP_RING_SIZE STRING
+	{ 
+		OUTYY(("P(server_dnstap_ring_size:%s)\n", $2)); 
+		if(atoi($2) < 16 || atoi($2) > 1048576)
+			yyerror("number from 16 to 1048576 expected");
+		else cfg_parser->opt->dnstap_ring_size = atoi($2);
+	}
+	;
+server_heavy_hitters: VAR_HEAVY_HITTERS STRING
+	{ 
+		OUTYY(("P(server_heavy_hitters:%s)\n", $2)); 
+		if((atoi($2) == 0 && strcmp($2, "0") != 0) ||
+			atoi($2) < 0 || atoi($2) > 1048576)
+			yyerror("number from 0 to 1048576 expected");
+		else cfg_parser->opt->heavy_hitters = atoi($2);
+	}
+	;
+server_nsec3_cache_size: VAR_NSEC3_CACHE_SIZE STRING
+	{ 
+		OUTYY(("P(server_nsec3_cache_size:%s)\n", $2)); 
+		if((atoi($2) == 0 && strcmp($2, "0") != 0) ||
+			atoi($2) < 0 || atoi($2) > 16777216)
+			yyerror("number from 0 to 16777216 expected");
+		else cfg_parser->opt->nsec3_cache_size = atoi($2);
+	}
+	;
+server_answer_cache_size: VAR_ANSWER_CACHE_SIZE STRING
+	{ 
+		OUTYY(("P(server_answer_cache_size:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->answer_cache_size = atoi($2);
+	}
+	;
+server_axfr_cache_size: VAR_AXFR_CACHE_SIZE STRING
+	{ 
+		OUTYY(("P(server_axfr_cache_size:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->axfr_cache_size = atoi($2);
+	}
+	;
+server_zonefiles_load_workers: VAR_ZONEFILES_LOAD_WORKERS STRING
+	{ 
+		OUTYY(("P(server_zonefiles_load_workers:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->zonefiles_load_workers = atoi($2);
+	}
+	;
+server_zonefiles_write_workers: VAR_ZONEFILES_WRITE_WORKERS STRING
+	{ 
+		OUTYY(("P(server_zonefiles_write_workers:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->zonefiles_write_workers = atoi($2);
+	}
+	;
+server_progressive_start: VAR_PROGRESSIVE_START STRING
+	{
+		OUTYY(("P(server_progressive_start:%s)\n", $2));
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->progressive_start = (strcmp($2, "yes")==0);
+	}
+	;
+server_reload_in_place: VAR_RELOAD_IN_PLACE STRING 
+	{ 
+		OUTYY(("P(server_reload_in_place:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->reload_in_place = (strcmp($2, "yes")==0);
+	}
+	;
+server_reload_prefault: VAR_RELOAD_PREFAULT STRING 
+	{ 
+		OUTYY(("P(server_reload_prefault:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->reload_prefault = (strcmp($2, "yes")==0);
+	}
+	;
+server_zone_regions: VAR_ZONE_REGIONS STRING 
+	{ 
+		OUTYY(("P(server_zone_regions:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->zone_regions = (strcmp($2, "yes")==0);
+	}
+	;
+server_hugepages: VAR_HUGEPAGES STRING 
+	{ 
+		OUTYY(("P(server_hugepages:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->hugepages = (strcmp($2, "yes")==0);
+	}
+	;
+server_numa_replicate: VAR_NUMA_REPLICATE STRING 
+	{ 
+		OUTYY(("P(server_numa_replicate:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->numa_replicate = (strcmp($2, "yes")==0);
+	}
+	;
+server_metrics_enable: VAR_METRICS_ENABLE STRING 
+	{ 
+		OUTYY(("P(server_metrics_enable:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->metrics_enable = (strcmp($2, "yes")==0);
+	}
+	;
+server_metrics_interface: VAR_METRICS_INTERFACE STRING
+	{
+		ip_address_option_t* o = (ip_address_option_t*)region_alloc(
+			cfg_parser->opt->region, sizeof(ip_address_option_t));
+		OUTYY(("P(server_metrics_interface:%s)\n", $2));
+		o->next = cfg_parser->opt->metrics_interface;
+		cfg_parser->opt->metrics_interface = o;
+		o->address = region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
+server_metrics_port: VAR_METRICS_PORT STRING
+	{
+		OUTYY(("P(server_metrics_port:%s)\n", $2));
+		if(atoi($2) <= 0 || atoi($2) > 65535)
+			yyerror("metrics port number expected");
+		else cfg_parser->opt->metrics_port = atoi($2);
+	}
+	;
+server_metrics_path: VAR_METRICS_PATH STRING
+	{
+		OUTYY(("P(server_metrics_path:%s)\n", $2));
+		if($2[0] != '/')
+			yyerror("metrics path must start with /");
+		else cfg_parser->opt->metrics_path = region_strdup(
+			cfg_parser->opt->region, $2);
+	}
+	;
+server_log_async: VAR_LOG_ASYNC STRING 
+	{ 
+		OUTYY(("P(server_log_async:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->log_async = (strcmp($2, "yes")==0);
+	}
+	;
+server_xfr_out_workers: VAR_XFR_OUT_WORKERS STRING
+	{
+		OUTYY(("P(server_xfr_out_workers:%s)\n", $2));
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else if(atoi($2) < 0 || atoi($2) > 64)
+			yyerror("xfr-out-workers must be 0 to 64");
+		else cfg_parser->opt->xfr_out_workers = atoi($2);
+	}
+	;
+server_xfr_out_nice: VAR_XFR_OUT_NICE STRING
+	{
+		OUTYY(("P(server_xfr_out_nice:%s)\n", $2));
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else if(atoi($2) < 0 || atoi($2) > 19)
+			yyerror("xfr-out-nice must be 0 to 19");
+		else cfg_parser->opt->xfr_out_nice = atoi($2);
+	}
+	;
+server_xfr_out_rate: VAR_XFR_OUT_RATE STRING
+	{
+		OUTYY(("P(server_xfr_out_rate:%s)\n", $2));
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else if(atoi($2) < 0)
+			yyerror("xfr-out-rate must not be negative");
+		else cfg_parser->opt->xfr_out_rate = atoi($2);
+	}
+	;
+server_server_threads: VAR_SERVER_THREADS STRING 
+	{ 
+		OUTYY(("P(server_server_threads:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->server_threads = (strcmp($2, "yes")==0);
+	}
+	;
+server_name_hash_index: VAR_NAME_HASH_INDEX STRING 
+	{ 
+		OUTYY(("P(server_name_hash_index:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->name_hash_index = (strcmp($2, "yes")==0);
+	}
+	;
+server_minimal_responses: VAR_MINIMAL_RESPONSES STRING 
+	{ 
+		OUTYY(("P(server_minimal_responses:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->minimal_responses = (strcmp($2, "yes")==0);
+	}
+	;
+server_minimal_any: VAR_MINIMAL_ANY STRING 
+	{ 
+		OUTYY(("P(server_minimal_any:%s)\n", $2)); 
+		if(strcmp($2, "hinfo") == 0)
+			cfg_parser->opt->minimal_any = MINIMAL_ANY_HINFO;
+		else if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes, no or hinfo.");
+		else cfg_parser->opt->minimal_any = (strcmp($2, "yes")==0);
+	}
+	;
+server_rdata_sharing: VAR_RDATA_SHARING STRING 
+	{ 
+		OUTYY(("P(server_rdata_sharing:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->rdata_sharing = (strcmp($2, "yes")==0);
+	}
+	;
+server_lazy_zone_load: VAR_LAZY_ZONE_LOAD STRING 
+	{ 
+		OUTYY(("P(server_lazy_zone_load:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->lazy_zone_load = (strcmp($2, "yes")==0);
+	}
+	;
+server_database_publish: VAR_DATABASE_PUBLISH STRING
+	{
+		OUTYY(("P(server_database_publish:%s)\n", $2));
+		if($2[0] == 0)
+			cfg_parser->opt->database_publish = NULL;
+		else cfg_parser->opt->database_publish = region_strdup(
+			cfg_parser->opt->region, $2);
+	}
+	;
+server_nsec3_snapshot: VAR_NSEC3_SNAPSHOT STRING
+	{
+		OUTYY(("P(server_nsec3_snapshot:%s)\n", $2));
+		if($2[0] == 0)
+			cfg_parser->opt->nsec3_snapshot = NULL;
+		else cfg_parser->opt->nsec3_snapshot = region_strdup(
+			cfg_parser->opt->region, $2);
+	}
+	;
+server_database_readonly: VAR_DATABASE_READONLY STRING
+	{
+		OUTYY(("P(server_database_readonly:%s)\n", $2));
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->database_readonly = (strcmp($2, "yes")==0);
+	}
+	;
+server_xfrdfile_text: VAR_XFRDFILE_TEXT STRING 
+	{ 
+		OUTYY(("P(server_xfrdfile_text:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->xfrdfile_text = (strcmp($2, "yes")==0);
+	}
+	;
+server_xdp_interface: VAR_XDP_INTERFACE STRING
+	{ 
+		OUTYY(("P(server_xdp_interface:%s)\n", $2)); 
+		cfg_parser->opt->xdp_interface = region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
+server_cpu_affinity: VAR_CPU_AFFINITY cpus
+	{ 
+		OUTYY(("P(server_cpu_affinity)\n")); 
+		cfg_parser->opt->cpu_affinity = $2;
+	}
+	;
+server_service_cpu_affinity: VAR_SERVER_CPU_AFFINITY cpus
+	{ 
+		cpu_map_option_t** m = &cfg_parser->opt->service_cpu_affinity;
+		OUTYY(("P(server_service_cpu_affinity:%s)\n", $1)); 
+		while(*m)
+			m = &(*m)->next;
+		*m = (cpu_map_option_t*)region_alloc(cfg_parser->opt->region,
+			sizeof(cpu_map_option_t));
+		/* the keyword is server-N-cpu-affinity: */
+		(*m)->service = atoi($1 + strlen("server-"));
+		(*m)->cpus = $2;
+		(*m)->next = NULL;
+	}
+	;
+server_xfrd_cpu_affinity: VAR_XFRD_CPU_AFFINITY cpus
+	{ 
+		OUTYY(("P(server_xfrd_cpu_affinity)\n")); 
+		cfg_parser->opt->xfrd_cpu_affinity = $2;
+	}
+	;
+cpus: STRING
+	{
+		OUTYY(("P(cpu:%s)\n", $1));
+		if(atoi($1) == 0 && strcmp($1, "0") != 0)
+			yyerror("cpu number expected");
+		$$ = (cpu_option_t*)region_alloc(cfg_parser->opt->region,
+			sizeof(cpu_option_t));
+		$$->cpu = atoi($1);
+		$$->next = NULL;
+	}
+	| cpus STRING
+	{
+		cpu_option_t* c;
+		OUTYY(("P(cpu:%s)\n", $2));
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("cpu number expected");
+		for(c = $1; c->next; c = c->next)
+			;
+		c->next = (cpu_option_t*)region_alloc(cfg_parser->opt->region,
+			sizeof(cpu_option_t));
+		c->next->cpu = atoi($2);
+		c->next->next = NULL;
+		$$ = $1;
+	}
+	;
 server_server_count: VAR_SERVER_COUNT STRING
 	{ 
 		OUTYY(("P(server_server_count:%s)\n", $2)); 
@@ -350,6 +1003,38 @@ server_xfrd_reload_timeout: VAR_XFRD_RELOAD_TIMEOUT STRING
 		cfg_parser->opt->xfrd_reload_timeout = atoi($2);
 	}
 	;
+server_xfrd_stream_apply: VAR_XFRD_STREAM_APPLY STRING
+	{ 
+		OUTYY(("P(server_xfrd_stream_apply:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->xfrd_stream_apply = (strcmp($2, "yes")==0);
+	}
+	;
+server_xfrd_tcp_max: VAR_XFRD_TCP_MAX STRING
+	{ 
+		OUTYY(("P(server_xfrd_tcp_max:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number greater than zero expected");
+		else cfg_parser->opt->xfrd_tcp_max = atoi($2);
+	}
+	;
+server_xfrd_tcp_master_max: VAR_XFRD_TCP_MASTER_MAX STRING
+	{ 
+		OUTYY(("P(server_xfrd_tcp_master_max:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->xfrd_tcp_master_max = atoi($2);
+	}
+	;
+server_xfrd_udp_max: VAR_XFRD_UDP_MAX STRING
+	{ 
+		OUTYY(("P(server_xfrd_udp_max:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number greater than zero expected");
+		else cfg_parser->opt->xfrd_udp_max = atoi($2);
+	}
+	;
 server_tcp_query_count: VAR_TCP_QUERY_COUNT STRING
 	{ 
 		OUTYY(("P(server_tcp_query_count:%s)\n", $2)); 
@@ -438,6 +1123,24 @@ server_rrl_whitelist_ratelimit: VAR_RRL_WHITELIST_RATELIMIT STRING
 #endif
 	}
 	;
+server_rrl_adaptive: VAR_RRL_ADAPTIVE STRING
+	{ 
+		OUTYY(("P(server_rrl_adaptive:%s)\n", $2)); 
+#ifdef RATELIMIT
+		if(atoi($2) < 0)
+			yyerror("number equal or greater than zero expected");
+		cfg_parser->opt->rrl_adaptive = atoi($2);
+#endif
+	}
+	;
+server_rrl_file: VAR_RRL_FILE STRING
+	{ 
+		OUTYY(("P(server_rrl_file:%s)\n", $2)); 
+#ifdef RATELIMIT
+		cfg_parser->opt->rrl_file = region_strdup(cfg_parser->opt->region, $2);
+#endif
+	}
+	;
 server_zonefiles_check: VAR_ZONEFILES_CHECK STRING 
 	{ 
 		OUTYY(("P(server_zonefiles_check:%s)\n", $2)); 
@@ -446,6 +1149,14 @@ server_zonefiles_check: VAR_ZONEFILES_CHECK STRING
 		else cfg_parser->opt->zonefiles_check = (strcmp($2, "yes")==0);
 	}
 	;
+server_zonefiles_watch: VAR_ZONEFILES_WATCH STRING
+	{ 
+		OUTYY(("P(server_zonefiles_watch:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->zonefiles_watch = (strcmp($2, "yes")==0);
+	}
+	;
 server_zonefiles_write: VAR_ZONEFILES_WRITE STRING 
 	{ 
 		OUTYY(("P(server_zonefiles_write:%s)\n", $2)); 
@@ -536,7 +1247,8 @@ patternstart: VAR_PATTERN
 		if(cfg_parser->current_pattern) {
 			if(!cfg_parser->current_pattern->pname) 
 				c_error("previous pattern has no name");
-			else {
+			else if(!cfg_parser->opt->zones_skip ||
+				!cfg_parser->current_pattern->implicit) {
 				if(!nsd_options_insert_pattern(cfg_parser->opt, 
 					cfg_parser->current_pattern))
 					c_error_msg("duplicate pattern %s",
@@ -557,7 +1269,9 @@ content_pattern: pattern_name | zone_config_item;
 zone_config_item: zone_zonefile | zone_allow_notify | zone_request_xfr |
 	zone_notify | zone_notify_retry | zone_provide_xfr | 
 	zone_outgoing_interface | zone_allow_axfr_fallback | include_pattern |
-	zone_rrl_whitelist | zone_zonestats;
+	zone_rrl_whitelist | zone_zonestats | zone_store_ixfr |
+	zone_ixfr_number | zone_ixfr_size | zone_load_priority |
+	zone_catalog_member_pattern;
 pattern_name: VAR_NAME STRING
 	{ 
 		OUTYY(("P(pattern_name:%s)\n", $2)); 
@@ -577,6 +1291,7 @@ include_pattern: VAR_INCLUDEPATTERN STRING
 		assert(cfg_parser->current_pattern);
 #endif
 		config_apply_pattern($2);
+		region_recycle(cfg_parser->opt->region, $2, strlen($2)+1);
 	}
 	;
 
@@ -587,7 +1302,7 @@ zonestart: VAR_ZONE
 		if(cfg_parser->current_zone) {
 			if(!cfg_parser->current_zone->name) 
 				c_error("previous zone has no name");
-			else {
+			else if(!cfg_parser->opt->zones_skip) {
 				if(!nsd_options_insert_zone(cfg_parser->opt, 
 					cfg_parser->current_zone))
 					c_error("duplicate zone");
@@ -598,7 +1313,8 @@ zonestart: VAR_ZONE
 		if(cfg_parser->current_pattern) {
 			if(!cfg_parser->current_pattern->pname) 
 				c_error("previous pattern has no name");
-			else {
+			else if(!cfg_parser->opt->zones_skip ||
+				!cfg_parser->current_pattern->implicit) {
 				if(!nsd_options_insert_pattern(cfg_parser->opt, 
 					cfg_parser->current_pattern))
 					c_error_msg("duplicate pattern %s",
@@ -628,7 +1344,8 @@ zone_name: VAR_NAME STRING
 		assert(cfg_parser->current_zone);
 		assert(cfg_parser->current_pattern);
 #endif
-		cfg_parser->current_zone->name = region_strdup(cfg_parser->opt->region, $2);
+		/* the token is a copy in the region already */
+		cfg_parser->current_zone->name = $2;
 		s = (char*)region_alloc(cfg_parser->opt->region,
 			strlen($2)+strlen(PATTERN_IMPLICIT_MARKER)+1);
 		memmove(s, PATTERN_IMPLICIT_MARKER,
@@ -646,7 +1363,7 @@ zone_zonefile: VAR_ZONEFILE STRING
 #ifndef NDEBUG
 		assert(cfg_parser->current_pattern);
 #endif
-		cfg_parser->current_pattern->zonefile = region_strdup(cfg_parser->opt->region, $2);
+		cfg_parser->current_pattern->zonefile = $2;
 	}
 	;
 zone_zonestats: VAR_ZONESTATS STRING
@@ -658,6 +1375,16 @@ zone_zonestats: VAR_ZONESTATS STRING
 		cfg_parser->current_pattern->zonestats = region_strdup(cfg_parser->opt->region, $2);
 	}
 	;
+zone_catalog_member_pattern: VAR_CATALOG_MEMBER_PATTERN STRING
+	{ 
+		OUTYY(("P(catalog_member_pattern:%s)\n", $2)); 
+#ifndef NDEBUG
+		assert(cfg_parser->current_pattern);
+#endif
+		cfg_parser->current_pattern->catalog_member_pattern =
+			region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
 zone_allow_notify: VAR_ALLOW_NOTIFY STRING STRING
 	{ 
 		acl_options_t* acl = parse_acl_info(cfg_parser->opt->region, $2, $3);
@@ -770,6 +1497,50 @@ zone_allow_axfr_fallback: VAR_ALLOW_AXFR_FALLBACK STRING
 		}
 	}
 	;
+zone_store_ixfr: VAR_STORE_IXFR STRING
+	{ 
+		OUTYY(("P(store_ixfr:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else {
+			cfg_parser->current_pattern->store_ixfr = (strcmp($2, "yes")==0);
+			cfg_parser->current_pattern->store_ixfr_is_default = 0;
+		}
+	}
+	;
+zone_ixfr_number: VAR_IXFR_NUMBER STRING
+	{ 
+		OUTYY(("P(ixfr_number:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else {
+			cfg_parser->current_pattern->ixfr_number = atoi($2);
+			cfg_parser->current_pattern->ixfr_number_is_default = 0;
+		}
+	}
+	;
+zone_load_priority: VAR_LOAD_PRIORITY STRING
+	{ 
+		OUTYY(("P(load_priority:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else {
+			cfg_parser->current_pattern->load_priority = atoi($2);
+			cfg_parser->current_pattern->load_priority_is_default = 0;
+		}
+	}
+	;
+zone_ixfr_size: VAR_IXFR_SIZE STRING
+	{ 
+		OUTYY(("P(ixfr_size:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else {
+			cfg_parser->current_pattern->ixfr_size = atoi($2);
+			cfg_parser->current_pattern->ixfr_size_is_default = 0;
+		}
+	}
+	;
 zone_rrl_whitelist: VAR_RRL_WHITELIST STRING
 	{ 
 		OUTYY(("P(zone_rrl_whitelist:%s)\n", $2)); 
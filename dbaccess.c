@@ -11,6 +11,13 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS   MAP_ANON
+#endif
+#endif /* HAVE_MMAP */
 
 #include <errno.h>
 #include <stdlib.h>
@@ -30,6 +37,11 @@
 #include "nsec3.h"
 #include "difffile.h"
 #include "nsd.h"
+#include "ixfr.h"
+#include "catalog.h"
+
+/* the address space that is mapped for nsd.db to grow into */
+#define NAMEDB_UDB_RESERVE ((uint64_t)16*1024*1024*1024)
 
 static time_t udb_time = 0;
 static unsigned long udb_rrsets = 0;
@@ -44,11 +56,42 @@ namedb_close(struct namedb* db)
 			udb_base_free(db->udb);
 			db->udb = NULL;
 		}
+#ifdef NSEC3
+		nsec3_snapshot_close(db->nsec3_snap);
+		db->nsec3_snap = NULL;
+#endif
 		zonec_desetup_parser();
 		region_destroy(db->region);
 	}
 }
 
+size_t
+namedb_get_mem(struct namedb* db)
+{
+	size_t s = region_get_mem(db->region);
+	struct radnode* n;
+	if(!db->zone_regions)
+		return s;
+	for(n = radix_first(db->zonetree); n; n = radix_next(n))
+		s += region_get_mem(((zone_type*)n->elem)->region);
+	return s;
+}
+
+size_t
+namedb_get_slab(struct namedb* db, size_t* used)
+{
+	size_t s = region_get_slab_mem(db->region);
+	struct radnode* n;
+	*used = region_get_slab_used(db->region);
+	if(!db->zone_regions)
+		return s;
+	for(n = radix_first(db->zonetree); n; n = radix_next(n)) {
+		s += region_get_slab_mem(((zone_type*)n->elem)->region);
+		*used += region_get_slab_used(((zone_type*)n->elem)->region);
+	}
+	return s;
+}
+
 void
 namedb_close_udb(struct namedb* db)
 {
@@ -74,22 +117,25 @@ apex_rrset_checks(namedb_type* db, rrset_type* rrset, domain_type* domain)
 
 		/* BUG #103 add another soa with a tweaked ttl */
 		if(zone->soa_nx_rrset == 0) {
-			zone->soa_nx_rrset = region_alloc(db->region,
+			zone->soa_nx_rrset = region_alloc(zone->region,
 				sizeof(rrset_type));
 			zone->soa_nx_rrset->rr_count = 1;
+			zone->soa_nx_rrset->type = TYPE_SOA;
 			zone->soa_nx_rrset->next = 0;
 			zone->soa_nx_rrset->zone = zone;
-			zone->soa_nx_rrset->rrs = region_alloc(db->region,
+			zone->soa_nx_rrset->rrs = region_alloc(zone->region,
 				sizeof(rr_type));
 		}
 		memcpy(zone->soa_nx_rrset->rrs, rrset->rrs, sizeof(rr_type));
+		rrset_wire_min_update(zone->soa_nx_rrset);
 
 		/* check the ttl and MINIMUM value and set accordinly */
-		memcpy(&soa_minimum, rdata_atom_data(rrset->rrs->rdatas[6]),
-				rdata_atom_size(rrset->rrs->rdatas[6]));
+		memcpy(&soa_minimum, rr_rdata_field(rrset->rrs, 6, NULL),
+				sizeof(soa_minimum));
 		if (rrset->rrs->ttl > ntohl(soa_minimum)) {
 			zone->soa_nx_rrset->rrs[0].ttl = ntohl(soa_minimum);
 		}
+		zone_soa_nx_wire_update(zone);
 	} else if (rrset_rrtype(rrset) == TYPE_NS) {
 		zone->ns_rrset = rrset;
 	} else if (rrset_rrtype(rrset) == TYPE_RRSIG) {
@@ -104,7 +150,8 @@ apex_rrset_checks(namedb_type* db, rrset_type* rrset, domain_type* domain)
 
 /** read rr */
 static void
-read_rr(namedb_type* db, rr_type* rr, udb_ptr* urr, domain_type* domain)
+read_rr(namedb_type* db, region_type* region, rr_type* rr, udb_ptr* urr,
+	domain_type* domain)
 {
 	buffer_type buffer;
 	ssize_t c;
@@ -115,15 +162,16 @@ read_rr(namedb_type* db, rr_type* rr, udb_ptr* urr, domain_type* domain)
 	rr->ttl = RR(urr)->ttl;
 
 	buffer_create_from(&buffer, RR(urr)->wire, RR(urr)->len);
-	c = rdata_wireformat_to_rdata_atoms(db->region, db->domains,
-		rr->type, RR(urr)->len, &buffer, &rr->rdatas);
+	c = rdata_wireformat_to_rdata(region, db->domains, RR(urr)->len,
+		&buffer, rr);
 	if(c == -1) {
 		/* safe on error */
+		rr->rdata = NULL;
+		rr->rdlength = 0;
 		rr->rdata_count = 0;
-		rr->rdatas = NULL;
-		return;
-	}
-	rr->rdata_count = c;
+		rr->rdata_domains = 0;
+		rr->rdata_shared = 0;
+	} else	rr_share_rdata(db, region, rr);
 }
 
 /** calculate rr count */
@@ -149,40 +197,39 @@ read_rrset(udb_base* udb, namedb_type* db, zone_type* zone,
 	rrset_type* rrset;
 	udb_ptr urr;
 	unsigned i;
+	int tag;
 	assert(udb_ptr_get_type(urrset) == udb_chunk_type_rrset);
 	/* if no RRs, do not create anything (robust) */
 	if(RRSET(urrset)->rrs.data == 0)
 		return;
-	rrset = (rrset_type *) region_alloc(db->region, sizeof(rrset_type));
+	tag = region_set_tag(zone->region, REGION_TAG_RRSETS);
+	rrset = (rrset_type *) region_alloc(zone->region, sizeof(rrset_type));
 	rrset->zone = zone;
 	rrset->rr_count = calculate_rr_count(udb, urrset);
 	rrset->rrs = (rr_type *) region_alloc_array(
-		db->region, rrset->rr_count, sizeof(rr_type));
+		zone->region, rrset->rr_count, sizeof(rr_type));
+	(void)region_set_tag(zone->region, tag);
 	/* add the RRs */
 	udb_ptr_new(&urr, udb, &RRSET(urrset)->rrs);
 	for(i=0; i<rrset->rr_count; i++) {
-		read_rr(db, &rrset->rrs[i], &urr, domain);
+		read_rr(db, zone->region, &rrset->rrs[i], &urr, domain);
 		udb_ptr_set_rptr(&urr, udb, &RR(&urr)->next);
 	}
 	udb_ptr_unlink(&urr, udb);
+	rrset->type = rrset->rrs[0].type;
+	rrset_wire_min_update(rrset);
 	domain_add_rrset(domain, rrset);
+	zone_mem_rrset(zone, domain, rrset, 1);
 	if(domain == zone->apex)
 		apex_rrset_checks(db, rrset, domain);
 }
 
-/** read one elem from db, of type domain_d */
-static void read_node_elem(udb_base* udb, namedb_type* db, 
-	region_type* dname_region, zone_type* zone, struct domain_d* d)
+/** read the rrsets of one elem from db, of type domain_d */
+static void read_node_rrsets(udb_base* udb, namedb_type* db,
+	zone_type* zone, domain_type* domain, struct domain_d* d)
 {
-	const dname_type* dname;
-	domain_type* domain;
 	udb_ptr urrset;
 
-	dname = dname_make(dname_region, d->name, 0);
-	if(!dname) return;
-	domain = domain_table_insert(db->domains, dname);
-	assert(domain); /* domain_table_insert should always return non-NULL */
-
 	/* add rrsets */
 	udb_ptr_init(&urrset, udb);
 	udb_ptr_set_rptr(&urrset, udb, &d->rrsets);
@@ -197,20 +244,24 @@ static void read_node_elem(udb_base* udb, namedb_type* db,
 				(int)(udb_rrsets*((unsigned long)100)/udb_rrset_count)));
 		}
 	}
-	region_free_all(dname_region);
 	udb_ptr_unlink(&urrset, udb);
 }
 
 /** recurse read radix from disk. This radix tree is by domain name, so max of
  * 256 depth, and thus the stack usage is small. */
-static void read_zone_recurse(udb_base* udb, namedb_type* db,
-	region_type* dname_region, zone_type* zone, struct udb_radnode_d* node)
+static void read_zone_recurse(udb_base* udb, struct udb_radnode_d* node,
+	struct domain_d*** list, size_t* num, size_t* max)
 {
 	if(node->elem.data) {
 		/* pre-order process of node->elem, for radix tree this is
 		 * also in-order processing (identical to order tree_next()) */
-		read_node_elem(udb, db, dname_region, zone, (struct domain_d*)
-			(udb->base + node->elem.data));
+		if(*num == *max) {
+			*max *= 2;
+			*list = (struct domain_d**)xrealloc(*list,
+				(*max)*sizeof(struct domain_d*));
+		}
+		(*list)[(*num)++] = (struct domain_d*)(udb->base +
+			node->elem.data);
 	}
 	if(node->lookup.data) {
 		uint16_t i;
@@ -221,27 +272,108 @@ static void read_zone_recurse(udb_base* udb, namedb_type* db,
 		 * the radix-key, it has it stored */
 		for(i=0; i<a->len; i++) {
 			if(a->array[i].node.data) {
-				read_zone_recurse(udb, db, dname_region, zone,
-					(struct udb_radnode_d*)(udb->base +
-						a->array[i].node.data));
+				read_zone_recurse(udb, (struct udb_radnode_d*)
+					(udb->base + a->array[i].node.data),
+					list, num, max);
 			}
 		}
 	}
 }
 
-/** read zone data */
+/** read zone data, without the apex rrsets if skip_apex, those have been
+ * read for the lazy zone */
 static void
 read_zone_data(udb_base* udb, namedb_type* db, region_type* dname_region,
-	udb_ptr* z, zone_type* zone)
+	udb_ptr* z, zone_type* zone, int skip_apex)
 {
 	udb_ptr dtree;
+	struct domain_d** list;
+	const dname_type** dnames;
+	domain_type** domains;
+	size_t num = 0, max, i, j;
 	/* recursively read domains, we only read so ptrs stay valid */
 	udb_ptr_new(&dtree, udb, &ZONE(z)->domains);
+	max = (size_t)RADTREE(&dtree)->count+1;
+	list = (struct domain_d**)xalloc_array_zero(max,
+		sizeof(struct domain_d*));
 	if(RADTREE(&dtree)->root.data)
-		read_zone_recurse(udb, db, dname_region, zone,
-			(struct udb_radnode_d*)
-			(udb->base + RADTREE(&dtree)->root.data));
+		read_zone_recurse(udb, (struct udb_radnode_d*)
+			(udb->base + RADTREE(&dtree)->root.data),
+			&list, &num, &max);
 	udb_ptr_unlink(&dtree, udb);
+
+	/* the names are in canonical order, they are put in the domain
+	 * table in one go, and then the rrsets are read */
+	dnames = (const dname_type**)xalloc_array_zero(num+1,
+		sizeof(dname_type*));
+	domains = (domain_type**)xalloc_array_zero(num+1,
+		sizeof(domain_type*));
+	for(i=0, j=0; i<num; i++) {
+		if((dnames[j] = dname_make(dname_region, list[i]->name, 0)))
+			list[j++] = list[i];
+	}
+	num = j;
+	if(!domain_table_bulk_insert(db->domains, zone->apex, dnames, num,
+		domains)) {
+		for(i=0; i<num; i++) {
+			domains[i] = domain_table_insert(db->domains,
+				dnames[i]);
+			assert(domains[i]); /* does not return NULL */
+		}
+	}
+	region_free_all(dname_region);
+	for(i=0; i<num; i++) {
+		if(skip_apex && domains[i] == zone->apex)
+			continue;
+		read_node_rrsets(udb, db, zone, domains[i], list[i]);
+	}
+	free(list);
+	free(dnames);
+	free(domains);
+}
+
+#ifdef HAVE_MMAP
+/** read the apex rrsets of a lazy zone */
+static void
+read_zone_apex(udb_base* udb, namedb_type* db, udb_ptr* z, zone_type* zone)
+{
+	const dname_type* dname = domain_dname(zone->apex);
+	udb_ptr d;
+	if(!udb_domain_find(udb, z, dname_name(dname), dname->name_size, &d))
+		return;
+	read_node_rrsets(udb, db, zone, zone->apex, DOMAIN(&d));
+	udb_ptr_unlink(&d, udb);
+}
+#endif /* HAVE_MMAP */
+
+/** create a region for the database or zone data */
+static region_type*
+namedb_region_create(void)
+{
+#ifdef USE_MMAP_ALLOC
+	return region_create_custom(mmap_alloc, mmap_free,
+		MMAP_ALLOC_CHUNK_SIZE, MMAP_ALLOC_LARGE_OBJECT_SIZE,
+		MMAP_ALLOC_INITIAL_CLEANUP_SIZE, 1);
+#else /* !USE_MMAP_ALLOC */
+	return region_create_custom(xalloc, free, DEFAULT_CHUNK_SIZE,
+		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+#endif /* !USE_MMAP_ALLOC */
+}
+
+/** create the region for the database on huge pages */
+static region_type*
+namedb_region_create_huge(void)
+{
+	return region_create_custom(hugepage_alloc, hugepage_free,
+		HUGEPAGE_ALLOC_CHUNK_SIZE, HUGEPAGE_ALLOC_CHUNK_SIZE / 8,
+		DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+}
+
+/** cleanup routine for a zone region, when the db region is destroyed */
+static void
+zone_region_cleanup(void* arg)
+{
+	region_destroy((region_type*)arg);
 }
 
 /** create a zone */
@@ -251,6 +383,17 @@ namedb_zone_create(namedb_type* db, const dname_type* dname,
 {
 	zone_type* zone = (zone_type *) region_alloc(db->region,
 		sizeof(zone_type));
+	if(db->zone_regions) {
+		/* the zone data is on pages of its own, so that a change
+		 * to the zone only copies those pages in forked processes */
+		zone->region = namedb_region_create();
+		region_add_cleanup(db->region, zone_region_cleanup,
+			zone->region);
+		if(db->profile && !region_set_profile(zone->region,
+			db->profile))
+			log_msg(LOG_ERR, "could not count the memory of the "
+				"zone region");
+	} else	zone->region = db->region;
 	zone->node = radname_insert(db->zonetree, dname_name(dname),
 		dname->name_size, zone);
 	assert(zone->node);
@@ -259,7 +402,9 @@ namedb_zone_create(namedb_type* db, const dname_type* dname,
 	zone->apex->is_apex = 1;
 	zone->soa_rrset = NULL;
 	zone->soa_nx_rrset = NULL;
+	zone->soa_nx_wire = NULL;
 	zone->ns_rrset = NULL;
+	zone->ixfr = NULL;
 #ifdef NSEC3
 	zone->nsec3_param = NULL;
 	zone->nsec3_last = NULL;
@@ -267,15 +412,18 @@ namedb_zone_create(namedb_type* db, const dname_type* dname,
 	zone->hashtree = NULL;
 	zone->wchashtree = NULL;
 	zone->dshashtree = NULL;
+	zone->nsec3_index = NULL;
 #endif
 	zone->opts = zo;
 	zone->filename = NULL;
 	zone->logstr = NULL;
 	zone->mtime = 0;
 	zone->zonestatid = 0;
+	memset(&zone->mem, 0, sizeof(zone->mem));
 	zone->is_secure = 0;
 	zone->is_changed = 0;
 	zone->is_ok = 1;
+	zone->is_lazy = 0;
 	return zone;
 }
 
@@ -297,12 +445,26 @@ namedb_zone_delete(namedb_type* db, zone_type* zone)
 
 	/* soa_rrset is freed when the SOA was deleted */
 	if(zone->soa_nx_rrset) {
-		region_recycle(db->region, zone->soa_nx_rrset->rrs,
+		region_recycle(zone->region, zone->soa_nx_rrset->rrs,
 			sizeof(rr_type));
-		region_recycle(db->region, zone->soa_nx_rrset,
+		region_recycle(zone->region, zone->soa_nx_rrset,
 			sizeof(rrset_type));
 	}
+	if(zone->soa_nx_wire)
+		region_recycle(zone->region, zone->soa_nx_wire,
+			sizeof(struct soa_nx_wire) + zone->soa_nx_wire->len);
+	if(zone->ixfr) {
+		zone_ixfr_clear(zone);
+		region_recycle(zone->region, zone->ixfr,
+			sizeof(struct zone_ixfr));
+	}
+	if(zone->region != db->region) {
+		region_remove_cleanup(db->region, zone_region_cleanup,
+			zone->region);
+		region_destroy(zone->region);
+	}
 #ifdef NSEC3
+	nsec3_index_clear(zone);
 	hash_tree_delete(db->region, zone->nsec3tree);
 	hash_tree_delete(db->region, zone->hashtree);
 	hash_tree_delete(db->region, zone->wchashtree);
@@ -328,6 +490,13 @@ read_zone(udb_base* udb, namedb_type* db, nsd_options_t* opt,
 	zone_options_t* zo = dname?zone_options_find(opt, dname):NULL;
 	zone_type* zone;
 	if(!dname) return;
+	if(!zo && udb->readonly) {
+		/* the image is for the other nsd as well */
+		VERBOSITY(2, (LOG_INFO, "zone %s is not configured, skipped",
+			dname_to_string(dname, NULL)));
+		region_free_all(dname_region);
+		return;
+	}
 	if(!zo) {
 		/* deleted from the options, remove it from the nsd.db too */
 		VERBOSITY(2, (LOG_WARNING, "zone %s is deleted",
@@ -341,14 +510,76 @@ read_zone(udb_base* udb, namedb_type* db, nsd_options_t* opt,
 	udb_rrset_count = ZONE(z)->rrset_count;
 	zone = namedb_zone_create(db, dname, zo);
 	region_free_all(dname_region);
-	read_zone_data(udb, db, dname_region, z, zone);
 	zone->is_changed = (ZONE(z)->is_changed != 0);
+	if(db->lazy_zones) {
+		/* the SOA is there for the soainfo and the zone transfers,
+		 * the rest is read when the zone is used */
+		read_zone_apex(udb, db, z, zone);
+		zone->is_lazy = 1;
+		return;
+	}
+	read_zone_data(udb, db, dname_region, z, zone, 0);
 #ifdef NSEC3
 	prehash_zone_complete(db, zone);
 #endif
 }
 #endif /* HAVE_MMAP */
 
+#ifdef HAVE_MMAP
+/** read the rest of a lazy zone from the udb */
+static int
+read_lazy_zone(namedb_type* db, zone_type* zone)
+{
+	udb_base* udb;
+	region_type* dname_region;
+	udb_ptr z;
+	if(!(udb = namedb_udb_read_start(db))) {
+		VERBOSITY(3, (LOG_INFO, "zone %s not read, db is busy",
+			domain_to_string(zone->apex)));
+		return 0;
+	}
+	if(!udb_zone_search(udb, &z, dname_name(domain_dname(zone->apex)),
+		domain_dname(zone->apex)->name_size)) {
+		namedb_udb_read_end(db, udb);
+		return 0;
+	}
+	dname_region = region_create(xalloc, free);
+	udb_rrsets = 0;
+	udb_rrset_count = ZONE(&z)->rrset_count;
+	udb_time = time(NULL);
+	read_zone_data(udb, db, dname_region, &z, zone, 1);
+	region_destroy(dname_region);
+	udb_ptr_unlink(&z, udb);
+	zone->is_lazy = 0;
+#ifdef NSEC3
+	prehash_zone_complete(db, zone);
+#endif
+	namedb_udb_read_end(db, udb);
+	VERBOSITY(2, (LOG_INFO, "zone %s read from db",
+		domain_to_string(zone->apex)));
+	return 1;
+}
+#endif /* HAVE_MMAP */
+
+void
+namedb_lock_udb(namedb_type* db)
+{
+	/* a read-only image does not change */
+	if(!db->lazy_zones || !db->udb || db->udb->readonly)
+		return;
+	if(db->udb_locked++ == 0)
+		(void)udb_base_lock(db->udb, 1);
+}
+
+void
+namedb_unlock_udb(namedb_type* db)
+{
+	if(!db->lazy_zones || !db->udb || db->udb_locked == 0)
+		return;
+	if(--db->udb_locked == 0)
+		udb_base_unlock(db->udb);
+}
+
 #ifdef HAVE_MMAP
 /** read zones from nsd.db */
 static void
@@ -374,6 +605,34 @@ read_zones(udb_base* udb, namedb_type* db, nsd_options_t* opt,
 #endif /* HAVE_MMAP */
 
 #ifdef HAVE_MMAP
+/** open the read-only image that another nsd published, it is not
+ * created anew, or fail */
+static int
+try_read_udb_readonly(namedb_type* db, const char* filename,
+	nsd_options_t* opt)
+{
+	region_type* dname_region;
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1) {
+		log_msg(LOG_ERR, "%s: %s", filename, strerror(errno));
+		return 0;
+	}
+	if(!(db->udb=udb_base_create_fd(filename, fd, &namedb_walkfunc,
+		NULL)))
+		return 0;
+	if(udb_base_get_userflags(db->udb) != 0) {
+		log_msg(LOG_ERR, "%s was published in the middle of an update",
+			filename);
+		udb_base_free(db->udb);
+		db->udb = NULL;
+		return 0;
+	}
+	dname_region = region_create(xalloc, free);
+	read_zones(db->udb, db, opt, dname_region);
+	region_destroy(dname_region);
+	return 1;
+}
+
 /** try to read the udb file or fail */
 static int
 try_read_udb(namedb_type* db, int fd, const char* filename,
@@ -424,16 +683,43 @@ namedb_open (const char* filename, nsd_options_t* opt)
 	region_type* db_region;
 	int fd;
 
-#ifdef USE_MMAP_ALLOC
-	db_region = region_create_custom(mmap_alloc, mmap_free, MMAP_ALLOC_CHUNK_SIZE,
-		MMAP_ALLOC_LARGE_OBJECT_SIZE, MMAP_ALLOC_INITIAL_CLEANUP_SIZE, 1);
-#else /* !USE_MMAP_ALLOC */
-	db_region = region_create_custom(xalloc, free, DEFAULT_CHUNK_SIZE,
-		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE, 1);
-#endif /* !USE_MMAP_ALLOC */
+	if(opt && opt->hugepages)
+		db_region = namedb_region_create_huge();
+	else	db_region = namedb_region_create();
 	db = (namedb_type *) region_alloc(db_region, sizeof(struct namedb));
 	db->region = db_region;
+	db->profile = NULL;
+	if(opt && opt->region_profile) {
+		db->profile = (struct region_tag_stat*)region_alloc_array_zero(
+			db_region, REGION_TAG_COUNT,
+			sizeof(struct region_tag_stat));
+		if(!db->profile || !region_set_profile(db_region,
+			db->profile)) {
+			log_msg(LOG_ERR, "could not count the memory of the "
+				"database");
+			db->profile = NULL;
+		}
+	}
+	db->zone_regions = (opt?opt->zone_regions:0);
+	/* the server threads share the domain table, they cannot add
+	 * a zone to it while the others answer queries */
+	db->lazy_zones = (opt?opt->lazy_zone_load && !opt->server_threads:0);
+	db->udb_read = NULL;
+	db->udb_locked = 0;
+#ifdef HAVE_MMAP
+	db->read_lazy_zone = &read_lazy_zone;
+#else
+	db->read_lazy_zone = NULL;
+#endif
 	db->domains = domain_table_create(db->region);
+	if(opt && opt->name_hash_index)
+		domain_table_hash_enable(db->domains);
+	db->rdata_table = NULL;
+	if(opt && opt->rdata_sharing)
+		namedb_rdata_table_enable(db);
+	/* opened when the first NSEC3 zone is precompiled */
+	db->nsec3_snap = NULL;
+	db->nsec3_snap_file = (opt?opt->nsec3_snapshot:NULL);
 	db->zonetree = radix_tree_create(db->region);
 	db->diff_skip = 0;
 	db->diff_pos = 0;
@@ -460,6 +746,14 @@ namedb_open (const char* filename, nsd_options_t* opt)
 	return db;
 #else /* HAVE_MMAP */
 
+	if(opt && opt->database_readonly) {
+		if(!try_read_udb_readonly(db, filename, opt)) {
+			region_destroy(db_region);
+			return NULL;
+		}
+		return db;
+	}
+
 	/* attempt to open, if does not exist, create a new one */
 	fd = open(filename, O_RDWR);
 	if(fd == -1) {
@@ -486,10 +780,36 @@ namedb_open (const char* filename, nsd_options_t* opt)
 			return NULL;
 		}
 	}
+	if(opt && opt->hugepages)
+		udb_base_hugepages(db->udb);
+	/* the file grows into the room after it, the servers that read
+	 * the lazy zones do not have to map it again */
+	(void)udb_base_reserve(db->udb, NAMEDB_UDB_RESERVE);
 	return db;
 #endif /* HAVE_MMAP */
 }
 
+struct namedb*
+namedb_reopen(struct namedb* old, const char* filename, nsd_options_t* opt)
+{
+	namedb_type* db;
+	/* the zone parser is set up for one database at a time */
+	zonec_desetup_parser();
+	if(!(db = namedb_open(filename, opt))) {
+		zonec_setup_parser(old);
+		return NULL;
+	}
+	if(old->udb) {
+		udb_base_free(old->udb);
+		old->udb = NULL;
+	}
+#ifdef NSEC3
+	nsec3_snapshot_close(old->nsec3_snap);
+#endif
+	region_destroy(old->region);
+	return db;
+}
+
 /** the the file mtime stat (or nonexist or error) */
 static int
 file_get_mtime(const char* file, time_t* mtime, int* nonexist)
@@ -505,26 +825,21 @@ file_get_mtime(const char* file, time_t* mtime, int* nonexist)
 	return 1;
 }
 
-void
-namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
-	udb_ptr* last_task)
+/** see if the zonefile has to be read, returns 1 if so and sets the mtime.
+ * returns 0 if not modified, and -1 if the file could not be accessed */
+static int
+zonefile_needs_read(struct nsd* nsd, struct zone* zone, const char* fname,
+	time_t* mtime)
 {
-	time_t mtime = 0;
 	int nonexist = 0;
-	unsigned int errors;
-	const char* fname;
-	if(!nsd->db || !zone || !zone->opts || !zone->opts->pattern->zonefile)
-		return;
-	fname = config_make_zonefile(zone->opts, nsd);
-	if(!file_get_mtime(fname, &mtime, &nonexist)) {
+	if(!file_get_mtime(fname, mtime, &nonexist)) {
 		if(nonexist) {
 			VERBOSITY(2, (LOG_INFO, "zonefile %s does not exist",
 				fname));
 		} else
 			log_msg(LOG_ERR, "zonefile %s: %s",
 				fname, strerror(errno));
-		if(taskudb) task_new_soainfo(taskudb, last_task, zone, 0);
-		return;
+		return -1;
 	} else {
 		const char* zone_fname = zone->filename;
 		time_t zone_mtime = zone->mtime;
@@ -540,102 +855,147 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 		 * see if the file is newer than the zone transfer
 		 * (regardless if this is a different file), because the
 		 * zone transfer is a different content source too */
-		if(!zone_fname && zone_mtime >= mtime) {
+		if(!zone_fname && zone_mtime >= *mtime) {
 			VERBOSITY(3, (LOG_INFO, "zonefile %s is older than "
 				"zone transfer in memory", fname));
-			return;
+			return 0;
 
 		/* if zone_fname, then the file was acquired from reading it,
 		 * and see if filename changed or mtime newer to read it */
 		} else if(zone_fname && fname &&
-		   strcmp(zone_fname, fname) == 0 && zone_mtime >= mtime) {
+		   strcmp(zone_fname, fname) == 0 && zone_mtime >= *mtime) {
 			VERBOSITY(3, (LOG_INFO, "zonefile %s is not modified",
 				fname));
-			return;
+			return 0;
 		}
 	}
+	return 1;
+}
 
-	assert(parser);
-	/* wipe zone from memory */
+/** wipe zone contents from memory */
+static void
+zonefile_wipe(namedb_type* db, struct zone* zone)
+{
+	/* the zone is read anew */
+	zone->is_lazy = 0;
 #ifdef NSEC3
 	nsec3_hash_tree_clear(zone);
 #endif
-	delete_zone_rrs(nsd->db, zone);
+	delete_zone_rrs(db, zone);
 #ifdef NSEC3
-	nsec3_clear_precompile(nsd->db, zone);
+	nsec3_clear_precompile(db, zone);
 	zone->nsec3_param = NULL;
 #endif /* NSEC3 */
+}
+
+/** the zonefile had errors, revert to the stored version of the zone.
+ * returns 0 if the zone contents are lost (and soainfo has been sent) */
+static int
+zonefile_read_failed(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
+	udb_ptr* last_task)
+{
+	/* wipe (partial) zone from memory */
+	zone->is_ok = 1;
+	zonefile_wipe(nsd->db, zone);
+	if(nsd->db->udb) {
+		region_type* dname_region;
+		udb_ptr z;
+		/* see if we can revert to the udb stored version */
+		if(!udb_zone_search(nsd->db->udb, &z, dname_name(domain_dname(
+			zone->apex)), domain_dname(zone->apex)->name_size)) {
+			/* tell that zone contents has been lost */
+			if(taskudb) task_new_soainfo(taskudb, last_task, zone, 0);
+			return 0;
+		}
+		/* read from udb */
+		dname_region = region_create(xalloc, free);
+		udb_rrsets = 0;
+		udb_rrset_count = ZONE(&z)->rrset_count;
+		udb_time = time(NULL);
+		read_zone_data(nsd->db->udb, nsd->db, dname_region, &z, zone,
+			0);
+		region_destroy(dname_region);
+		udb_ptr_unlink(&z, nsd->db->udb);
+	} else {
+		if(zone->filename)
+			region_recycle(nsd->db->region, zone->filename,
+				strlen(zone->filename)+1);
+		zone->filename = NULL;
+		if(zone->logstr)
+			region_recycle(nsd->db->region, zone->logstr,
+				strlen(zone->logstr)+1);
+		zone->logstr = NULL;
+	}
+	return 1;
+}
+
+/** the zonefile has been read into memory, store it */
+static void
+zonefile_read_ok(struct nsd* nsd, struct zone* zone, time_t mtime,
+	const char* fname)
+{
+	VERBOSITY(1, (LOG_INFO, "zone %s read with success",
+		zone->opts->name));
+	zone->is_ok = 1;
+	zone->is_changed = 0;
+	/* store zone into udb */
+	if(nsd->db->udb) {
+		if(!write_zone_to_udb(nsd->db->udb, zone, mtime, fname)) {
+			log_msg(LOG_ERR, "failed to store zone in db");
+		} else {
+			VERBOSITY(2, (LOG_INFO, "zone %s written to db",
+				zone->opts->name));
+		}
+	} else {
+		zone->mtime = mtime;
+		if(zone->filename)
+			region_recycle(nsd->db->region, zone->filename,
+				strlen(zone->filename)+1);
+		zone->filename = region_strdup(nsd->db->region, fname);
+		if(zone->logstr)
+			region_recycle(nsd->db->region, zone->logstr,
+				strlen(zone->logstr)+1);
+		zone->logstr = NULL;
+	}
+}
+
+void
+namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
+	udb_ptr* last_task)
+{
+	time_t mtime = 0;
+	unsigned int errors;
+	const char* fname;
+	int r;
+	if(!nsd->db || !zone || !zone->opts || !zone->opts->pattern->zonefile)
+		return;
+	fname = config_make_zonefile(zone->opts, nsd);
+	if((r=zonefile_needs_read(nsd, zone, fname, &mtime)) != 1) {
+		if(r == -1 && taskudb)
+			task_new_soainfo(taskudb, last_task, zone, 0);
+		return;
+	}
+
+	assert(parser);
+	/* wipe zone from memory */
+	zonefile_wipe(nsd->db, zone);
 	errors = zonec_read(zone->opts->name, fname, zone);
 	if(errors > 0) {
 		log_msg(LOG_ERR, "zone %s file %s read with %u errors",
 			zone->opts->name, fname, errors);
-		/* wipe (partial) zone from memory */
-		zone->is_ok = 1;
-#ifdef NSEC3
-		nsec3_hash_tree_clear(zone);
-#endif
-		delete_zone_rrs(nsd->db, zone);
-#ifdef NSEC3
-		nsec3_clear_precompile(nsd->db, zone);
-		zone->nsec3_param = NULL;
-#endif /* NSEC3 */
-		if(nsd->db->udb) {
-			region_type* dname_region;
-			udb_ptr z;
-			/* see if we can revert to the udb stored version */
-			if(!udb_zone_search(nsd->db->udb, &z, dname_name(domain_dname(
-				zone->apex)), domain_dname(zone->apex)->name_size)) {
-				/* tell that zone contents has been lost */
-				if(taskudb) task_new_soainfo(taskudb, last_task, zone, 0);
-				return;
-			}
-			/* read from udb */
-			dname_region = region_create(xalloc, free);
-			udb_rrsets = 0;
-			udb_rrset_count = ZONE(&z)->rrset_count;
-			udb_time = time(NULL);
-			read_zone_data(nsd->db->udb, nsd->db, dname_region, &z, zone);
-			region_destroy(dname_region);
-			udb_ptr_unlink(&z, nsd->db->udb);
-		} else {
-			if(zone->filename)
-				region_recycle(nsd->db->region, zone->filename,
-					strlen(zone->filename)+1);
-			zone->filename = NULL;
-			if(zone->logstr)
-				region_recycle(nsd->db->region, zone->logstr,
-					strlen(zone->logstr)+1);
-			zone->logstr = NULL;
-		}
+		if(!zonefile_read_failed(nsd, zone, taskudb, last_task))
+			return;
 	} else {
-		VERBOSITY(1, (LOG_INFO, "zone %s read with success",
-			zone->opts->name));
-		zone->is_ok = 1;
-		zone->is_changed = 0;
-		/* store zone into udb */
-		if(nsd->db->udb) {
-			if(!write_zone_to_udb(nsd->db->udb, zone, mtime, fname)) {
-				log_msg(LOG_ERR, "failed to store zone in db");
-			} else {
-				VERBOSITY(2, (LOG_INFO, "zone %s written to db",
-					zone->opts->name));
-			}
-		} else {
-			zone->mtime = mtime;
-			if(zone->filename)
-				region_recycle(nsd->db->region, zone->filename,
-					strlen(zone->filename)+1);
-			zone->filename = region_strdup(nsd->db->region, fname);
-			if(zone->logstr)
-				region_recycle(nsd->db->region, zone->logstr,
-					strlen(zone->logstr)+1);
-			zone->logstr = NULL;
-		}
+		zonefile_read_ok(nsd, zone, mtime, fname);
 	}
-	if(taskudb) task_new_soainfo(taskudb, last_task, zone, 0);
 #ifdef NSEC3
 	prehash_zone_complete(nsd->db, zone);
 #endif
+	/* after the prehash, the soainfo has the nsec3 memory */
+	if(taskudb) {
+		task_new_soainfo(taskudb, last_task, zone, 0);
+		catalog_task_members(taskudb, last_task, zone);
+	}
 }
 
 void namedb_check_zonefile(struct nsd* nsd, udb_base* taskudb,
@@ -651,10 +1011,216 @@ void namedb_check_zonefile(struct nsd* nsd, udb_base* taskudb,
 	namedb_read_zonefile(nsd, zone, taskudb, last_task);
 }
 
+#ifdef HAVE_MMAP
+/** a zonefile that is read by a zone load worker */
+struct zone_load_job {
+	/* the zone in the main database */
+	zone_type* zone;
+	/* the zonefile and its mtime */
+	char* fname;
+	time_t mtime;
+};
+
+/** result of a zone load job, in shared memory */
+#define ZONE_LOAD_TODO 0 /* not done, read it again */
+#define ZONE_LOAD_OK 1 /* stored in the udb of the worker */
+#define ZONE_LOAD_FAIL 2 /* zonefile has errors */
+
+/** the udb file of a zone load worker */
+static void
+zone_load_dbfile(struct nsd* nsd, int w, char* buf, size_t len)
+{
+	snprintf(buf, len, "%snsd-xfr-%d/nsd.%u.load.%d",
+		nsd->options->xfrdir, (int)nsd->pid, (unsigned)getpid(), w);
+}
+
+/** zone load worker process, reads every workers-th zonefile from the
+ * jobs, and stores it in its own udb.  Does not return. */
+static void
+zone_load_worker(struct nsd* nsd, struct zone_load_job* jobs, size_t num,
+	uint8_t* result, int w, int workers, const char* dbfile)
+{
+	namedb_type* db;
+	size_t i;
+	/* the worker has its own database and parser */
+	if(!(db = namedb_open(dbfile, nsd->options)) || !db->udb) {
+		log_msg(LOG_ERR, "zone load worker: could not create %s",
+			dbfile);
+		_exit(1);
+	}
+	for(i=(size_t)w; i<num; i+=(size_t)workers) {
+		zone_type* zone = namedb_zone_create(db,
+			domain_dname(jobs[i].zone->apex), jobs[i].zone->opts);
+		unsigned int errors = zonec_read(zone->opts->name,
+			jobs[i].fname, zone);
+		if(errors > 0) {
+			log_msg(LOG_ERR, "zone %s file %s read with %u errors",
+				zone->opts->name, jobs[i].fname, errors);
+			result[i] = ZONE_LOAD_FAIL;
+		} else if(!write_zone_to_udb(db->udb, zone, jobs[i].mtime,
+			jobs[i].fname)) {
+			log_msg(LOG_ERR, "zone load worker: failed to store "
+				"zone %s", zone->opts->name);
+		} else {
+			result[i] = ZONE_LOAD_OK;
+		}
+		/* the zone is kept in the udb, free the memory */
+		zonefile_wipe(db, zone);
+		if(nsd->signal_hint_shutdown) break;
+	}
+	udb_base_close(db->udb);
+	/* not the atexit handlers and stdio buffers of the parent */
+	_exit(0);
+}
+
+/** read the zonefiles with a number of zone load worker processes, that
+ * parse the zonefiles and store them in a udb file each, and then read
+ * the zones from those into the database.  Zones that a worker did not
+ * read are read like namedb_read_zonefile does */
+static void
+namedb_check_zonefiles_workers(struct nsd* nsd, nsd_options_t* opt,
+	int workers)
+{
+	region_type* region = region_create(xalloc, free);
+	region_type* dname_region;
+	struct zone_load_job* jobs;
+	zone_options_t* zo;
+	uint8_t* result;
+	pid_t* pids;
+	size_t num = 0, i;
+	char dbfile[1024];
+	int w;
+
+	/* find the zonefiles that have to be read */
+	jobs = (struct zone_load_job*)region_alloc_array(region,
+		opt->zone_options->count, sizeof(*jobs));
+	RBTREE_FOR(zo, zone_options_t*, opt->zone_options) {
+		const dname_type* dname = (const dname_type*)zo->node.key;
+		zone_type* zone = namedb_find_zone(nsd->db, dname);
+		const char* fname;
+		time_t mtime = 0;
+		if(!zone)
+			zone = namedb_zone_create(nsd->db, dname, zo);
+		if(!zone->opts->pattern->zonefile)
+			continue;
+		fname = config_make_zonefile(zone->opts, nsd);
+		if(zonefile_needs_read(nsd, zone, fname, &mtime) != 1)
+			continue;
+		jobs[num].zone = zone;
+		jobs[num].fname = region_strdup(region, fname);
+		jobs[num].mtime = mtime;
+		num++;
+	}
+	if((size_t)workers > num)
+		workers = (int)num;
+	if(workers < 2) {
+		for(i=0; i<num; i++)
+			namedb_read_zonefile(nsd, jobs[i].zone, NULL, NULL);
+		region_destroy(region);
+		return;
+	}
+	result = (uint8_t*)mmap(NULL, num, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(result == MAP_FAILED) {
+		log_msg(LOG_ERR, "zone load: mmap failed: %s", strerror(errno));
+		for(i=0; i<num; i++)
+			namedb_read_zonefile(nsd, jobs[i].zone, NULL, NULL);
+		region_destroy(region);
+		return;
+	}
+	memset(result, ZONE_LOAD_TODO, num);
+	VERBOSITY(1, (LOG_INFO, "reading %u zonefiles with %d workers",
+		(unsigned)num, workers));
+
+	/* start the workers */
+	pids = (pid_t*)region_alloc_array(region, workers, sizeof(pid_t));
+	for(w=0; w<workers; w++) {
+		zone_load_dbfile(nsd, w, dbfile, sizeof(dbfile));
+		unlink(dbfile);
+		switch((pids[w] = fork())) {
+		case -1:
+			/* its zones are read below */
+			log_msg(LOG_ERR, "zone load: fork failed: %s",
+				strerror(errno));
+			break;
+		case 0:
+			zone_load_worker(nsd, jobs, num, result, w, workers,
+				dbfile);
+			break;
+		default:
+			break;
+		}
+	}
+
+	/* wait for the workers and read their zones into the database */
+	dname_region = region_create(xalloc, free);
+	for(w=0; w<workers; w++) {
+		udb_base* udb = NULL;
+		zone_load_dbfile(nsd, w, dbfile, sizeof(dbfile));
+		if(pids[w] != -1) {
+			int status;
+			while(waitpid(pids[w], &status, 0) == -1) {
+				if(errno != EINTR) {
+					log_msg(LOG_ERR, "zone load: waitpid: "
+						"%s", strerror(errno));
+					break;
+				}
+			}
+			udb = udb_base_create_read(dbfile, &namedb_walkfunc,
+				NULL);
+		}
+		for(i=(size_t)w; i<num; i+=(size_t)workers) {
+			zone_type* zone = jobs[i].zone;
+			udb_ptr z;
+			if(result[i] == ZONE_LOAD_OK && udb &&
+				udb_zone_search(udb, &z, dname_name(
+				domain_dname(zone->apex)),
+				domain_dname(zone->apex)->name_size)) {
+				zonefile_wipe(nsd->db, zone);
+				udb_rrsets = 0;
+				udb_rrset_count = ZONE(&z)->rrset_count;
+				udb_time = time(NULL);
+				read_zone_data(udb, nsd->db, dname_region, &z,
+					zone, 0);
+				udb_ptr_unlink(&z, udb);
+				zonefile_read_ok(nsd, zone, jobs[i].mtime,
+					jobs[i].fname);
+			} else if(result[i] == ZONE_LOAD_FAIL) {
+				/* the worker has logged the errors */
+				if(!zonefile_read_failed(nsd, zone, NULL, NULL))
+					continue;
+			} else {
+				if(!nsd->signal_hint_shutdown)
+					namedb_read_zonefile(nsd, zone, NULL,
+						NULL);
+				continue;
+			}
+#ifdef NSEC3
+			prehash_zone_complete(nsd->db, zone);
+#endif
+		}
+		if(udb)
+			udb_base_free(udb);
+		unlink(dbfile);
+	}
+	region_destroy(dname_region);
+	munmap(result, num);
+	region_destroy(region);
+}
+#endif /* HAVE_MMAP */
+
 void namedb_check_zonefiles(struct nsd* nsd, nsd_options_t* opt,
 	udb_base* taskudb, udb_ptr* last_task)
 {
 	zone_options_t* zo;
+#ifdef HAVE_MMAP
+	/* at startup, the zones may be read by worker processes */
+	if(!taskudb && opt->zonefiles_load_workers > 1) {
+		namedb_check_zonefiles_workers(nsd, opt,
+			opt->zonefiles_load_workers);
+		return;
+	}
+#endif
 	/* check all zones in opt, create if not exist in main db */
 	RBTREE_FOR(zo, zone_options_t*, opt->zone_options) {
 		namedb_check_zonefile(nsd, taskudb, last_task, zo);
@@ -11,6 +11,10 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -23,44 +27,45 @@
 #include "udbzone.h"
 #include "options.h"
 #include "nsd.h"
+#include "rdata.h"
 
 /* pathname directory separator character */
 #define PATHSEP '/'
-
-/** add an rdata (uncompressed) to the destination */
-static size_t
-add_rdata(rr_type* rr, unsigned i, uint8_t* buf, size_t buflen)
-{
-	switch(rdata_atom_wireformat_type(rr->type, i)) {
-		case RDATA_WF_COMPRESSED_DNAME:
-		case RDATA_WF_UNCOMPRESSED_DNAME:
-		{
-			const dname_type* dname = domain_dname(
-				rdata_atom_domain(rr->rdatas[i]));
-			if(dname->name_size > buflen)
-				return 0;
-			memmove(buf, dname_name(dname), dname->name_size);
-			return dname->name_size;
-		}
-		default:
-			break;
-	}
-	if(rdata_atom_size(rr->rdatas[i]) > buflen)
-		return 0;
-	memmove(buf, rdata_atom_data(rr->rdatas[i]),
-		rdata_atom_size(rr->rdatas[i]));
-	return rdata_atom_size(rr->rdatas[i]);
-}
+/* stdio buffer size of a zone file that is written */
+#define ZONEFILE_WRITE_BUFSZ (256*1024)
 
 /* marshal rdata into buffer, must be MAX_RDLENGTH in size */
 size_t
 rr_marshal_rdata(rr_type* rr, uint8_t* rdata, size_t sz)
 {
-	size_t len = 0;
+	size_t len = 0, pos = 0, d = 0;
+	uint8_t* wire;
 	unsigned i;
 	assert(rr);
+	wire = rr_rdata_wire(rr);
+	if(rr->rdata_domains == 0 && rr->rdlength <= sz) {
+		memmove(rdata, wire, rr->rdlength);
+		return rr->rdlength;
+	}
 	for(i=0; i<rr->rdata_count; i++) {
-		len += add_rdata(rr, i, rdata+len, sz-len);
+		const uint8_t* src;
+		size_t n;
+		if(rdata_atom_is_domain(rr->type, i)) {
+			const dname_type* dname = domain_dname(
+				rr_rdata_domains(rr)[d++]);
+			src = dname_name(dname);
+			n = dname->name_size;
+		} else {
+			src = wire+pos;
+			n = rdata_field_length(rr->type, i, wire, pos,
+				rr->rdlength);
+			pos += n;
+		}
+		/* a field that does not fit is left out */
+		if(n > sz-len)
+			continue;
+		memmove(rdata+len, src, n);
+		len += n;
 	}
 	return len;
 }
@@ -84,13 +89,7 @@ udb_write_rr(udb_base* udb, udb_ptr* z, rr_type* rr)
 {
 	/* marshal the rdata (uncompressed) into a buffer */
 	uint8_t rdata[MAX_RDLENGTH];
-	size_t rdatalen = 0;
-	unsigned i;
-	assert(rr);
-	for(i=0; i<rr->rdata_count; i++) {
-		rdatalen += add_rdata(rr, i, rdata+rdatalen,
-			sizeof(rdata)-rdatalen);
-	}
+	size_t rdatalen = rr_marshal_rdata(rr, rdata, sizeof(rdata));
 	assert(udb);
 	return udb_zone_add_rr(udb, z, dname_name(domain_dname(rr->owner)),
 		domain_dname(rr->owner)->name_size, rr->type, rr->klass,
@@ -254,6 +253,8 @@ write_to_zonefile(zone_type* zone, const char* filename, const char* logs)
 			zone->opts->name, filename, strerror(errno));
 		return 0;
 	}
+	/* a large buffer, the file is written in a few large writes */
+	(void)setvbuf(out, NULL, _IOFBF, ZONEFILE_WRITE_BUFSZ);
 	if(!print_header(zone, out, &now, logs)) {
 		fclose(out);
 		log_msg(LOG_ERR, "There was an error printing "
@@ -324,89 +325,262 @@ create_path_components(const char* path, int* notexist)
 	return 1;
 }
 
-void
-namedb_write_zonefile(struct nsd* nsd, zone_options_t* zopt)
+/* the zone of zopt if its zone file has to be written, the file name
+ * and the log string are returned in zfile and logs */
+static zone_type*
+zonefile_write_needed(struct nsd* nsd, zone_options_t* zopt, char* zfile,
+	size_t zfilelen, char* logs, size_t logslen)
 {
-	const char* zfile;
 	int notexist = 0;
 	zone_type* zone;
 	/* if no zone exists, it has no contents or it has no zonefile
 	 * configured, then no need to write data to disk */
 	if(!zopt->pattern->zonefile)
-		return;
+		return NULL;
 	zone = namedb_find_zone(nsd->db, (const dname_type*)zopt->node.key);
 	if(!zone || !zone->apex || !zone->soa_rrset)
-		return;
+		return NULL;
+	/* the zonefile is written from the zone in memory */
+	if(!namedb_read_lazy_zone(nsd->db, zone)) {
+		log_msg(LOG_ERR, "could not read zone %s from the db, not "
+			"writing zonefile", zopt->name);
+		return NULL;
+	}
 	/* write if file does not exist, or if changed */
 	/* so, determine filename, create directory components, check exist*/
-	zfile = config_make_zonefile(zopt, nsd);
+	strlcpy(zfile, config_make_zonefile(zopt, nsd), zfilelen);
 	if(!create_path_components(zfile, &notexist)) {
 		log_msg(LOG_ERR, "could not write zone %s to file %s because "
 			"the path could not be created", zopt->name, zfile);
-		return;
+		return NULL;
 	}
 
 	/* if not changed, do not write. */
-	if(notexist || zone->is_changed) {
-		char logs[4096];
-		char bakfile[4096];
+	if(!notexist && !zone->is_changed)
+		return NULL;
+	logs[0] = 0;
+	if(nsd->db->udb) {
 		udb_ptr zudb;
-		if(nsd->db->udb) {
-			if(!udb_zone_search(nsd->db->udb, &zudb,
-				dname_name(domain_dname(zone->apex)),
-				domain_dname(zone->apex)->name_size))
-				return; /* zone does not exist in db */
-		}
-		/* write to zfile~ first, then rename if that works */
-		snprintf(bakfile, sizeof(bakfile), "%s~", zfile);
-		if(nsd->db->udb && ZONE(&zudb)->log_str.data) {
+		if(!udb_zone_search(nsd->db->udb, &zudb,
+			dname_name(domain_dname(zone->apex)),
+			domain_dname(zone->apex)->name_size))
+			return NULL; /* zone does not exist in db */
+		if(ZONE(&zudb)->log_str.data) {
 			udb_ptr s;
 			udb_ptr_new(&s, nsd->db->udb, &ZONE(&zudb)->log_str);
-			strlcpy(logs, (char*)udb_ptr_data(&s), sizeof(logs));
+			strlcpy(logs, (char*)udb_ptr_data(&s), logslen);
 			udb_ptr_unlink(&s, nsd->db->udb);
-		} else if(zone->logstr) {
-			strlcpy(logs, zone->logstr, sizeof(logs));
-		} else logs[0] = 0;
-		VERBOSITY(1, (LOG_INFO, "writing zone %s to file %s",
-			zone->opts->name, zfile));
-		if(!write_to_zonefile(zone, bakfile, logs)) {
-			if(nsd->db->udb)
-				udb_ptr_unlink(&zudb, nsd->db->udb);
-			(void)unlink(bakfile); /* delete failed file */
-			return; /* error already printed */
 		}
-		if(rename(bakfile, zfile) == -1) {
-			log_msg(LOG_ERR, "rename(%s to %s) failed: %s",
-				bakfile, zfile, strerror(errno));
-			if(nsd->db->udb)
-				udb_ptr_unlink(&zudb, nsd->db->udb);
-			(void)unlink(bakfile); /* delete failed file */
+		udb_ptr_unlink(&zudb, nsd->db->udb);
+	}
+	if(logs[0] == 0 && zone->logstr)
+		strlcpy(logs, zone->logstr, logslen);
+	return zone;
+}
+
+/* write the zone to zfile~ first, then rename if that works */
+static int
+zonefile_write(zone_type* zone, const char* zfile, const char* logs)
+{
+	char bakfile[4096];
+	snprintf(bakfile, sizeof(bakfile), "%s~", zfile);
+	VERBOSITY(1, (LOG_INFO, "writing zone %s to file %s",
+		zone->opts->name, zfile));
+	if(!write_to_zonefile(zone, bakfile, logs)) {
+		(void)unlink(bakfile); /* delete failed file */
+		return 0; /* error already printed */
+	}
+	if(rename(bakfile, zfile) == -1) {
+		log_msg(LOG_ERR, "rename(%s to %s) failed: %s",
+			bakfile, zfile, strerror(errno));
+		(void)unlink(bakfile); /* delete failed file */
+		return 0;
+	}
+	return 1;
+}
+
+/* the zone file is written, the zone is no longer changed */
+static void
+zonefile_write_done(struct nsd* nsd, zone_type* zone, const char* zfile)
+{
+	zone->is_changed = 0;
+	if(nsd->db->udb) {
+		udb_ptr zudb;
+		if(!udb_zone_search(nsd->db->udb, &zudb,
+			dname_name(domain_dname(zone->apex)),
+			domain_dname(zone->apex)->name_size))
 			return;
+		ZONE(&zudb)->mtime = (uint64_t)time(0);
+		ZONE(&zudb)->is_changed = 0;
+		udb_zone_set_log_str(nsd->db->udb, &zudb, NULL);
+		udb_ptr_unlink(&zudb, nsd->db->udb);
+	} else {
+		zone->mtime = time(0);
+		if(zone->filename)
+			region_recycle(nsd->db->region, zone->filename,
+				strlen(zone->filename)+1);
+		zone->filename = region_strdup(nsd->db->region, zfile);
+		if(zone->logstr)
+			region_recycle(nsd->db->region, zone->logstr,
+				strlen(zone->logstr)+1);
+		zone->logstr = NULL;
+	}
+}
+
+void
+namedb_write_zonefile(struct nsd* nsd, zone_options_t* zopt)
+{
+	char zfile[4096];
+	char logs[4096];
+	zone_type* zone = zonefile_write_needed(nsd, zopt, zfile,
+		sizeof(zfile), logs, sizeof(logs));
+	if(!zone)
+		return;
+	if(zonefile_write(zone, zfile, logs))
+		zonefile_write_done(nsd, zone, zfile);
+}
+
+#ifdef HAVE_MMAP
+#define ZONE_WRITE_TODO 0 /* not done, write it again */
+#define ZONE_WRITE_OK 1 /* written and renamed by the worker */
+#define ZONE_WRITE_FAIL 2 /* the worker has logged the error */
+
+/** a zonefile that a worker writes */
+struct zone_write_job {
+	zone_type* zone;
+	char* zfile;
+	char* logs;
+};
+
+/** zone write worker process, writes every workers-th zone file,
+ * from the copy of the database that the fork gives it */
+static void
+zone_write_worker(struct nsd* nsd, struct zone_write_job* jobs, size_t num,
+	uint8_t* result, int w, int workers)
+{
+	size_t i;
+	for(i=(size_t)w; i<num; i+=(size_t)workers) {
+		result[i] = zonefile_write(jobs[i].zone, jobs[i].zfile,
+			jobs[i].logs)?ZONE_WRITE_OK:ZONE_WRITE_FAIL;
+		if(nsd->signal_hint_shutdown) break;
+	}
+	exit(0);
+}
+
+/** write the zonefiles with a number of worker processes, the zones
+ * are marked as written when the workers are done.  Zones that a
+ * worker did not write are written like namedb_write_zonefile does */
+static void
+namedb_write_zonefiles_workers(struct nsd* nsd, nsd_options_t* options,
+	int workers)
+{
+	region_type* region = region_create(xalloc, free);
+	struct zone_write_job* jobs;
+	zone_options_t* zo;
+	uint8_t* result;
+	pid_t* pids;
+	size_t i, num = 0;
+	int w;
+	char zfile[4096];
+	char logs[4096];
+
+	jobs = (struct zone_write_job*)region_alloc_array(region,
+		options->zone_options->count, sizeof(*jobs));
+	RBTREE_FOR(zo, zone_options_t*, options->zone_options) {
+		zone_type* zone = zonefile_write_needed(nsd, zo, zfile,
+			sizeof(zfile), logs, sizeof(logs));
+		if(!zone)
+			continue;
+		jobs[num].zone = zone;
+		jobs[num].zfile = region_strdup(region, zfile);
+		jobs[num].logs = region_strdup(region, logs);
+		num++;
+	}
+	if((size_t)workers > num)
+		workers = (int)num;
+	result = NULL;
+	if(workers >= 2) {
+		result = (uint8_t*)mmap(NULL, num, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if(result == MAP_FAILED) {
+			log_msg(LOG_ERR, "zone write: mmap failed: %s",
+				strerror(errno));
+			result = NULL;
 		}
-		zone->is_changed = 0;
-		if(nsd->db->udb) {
-			ZONE(&zudb)->mtime = (uint64_t)time(0);
-			ZONE(&zudb)->is_changed = 0;
-			udb_zone_set_log_str(nsd->db->udb, &zudb, NULL);
-			udb_ptr_unlink(&zudb, nsd->db->udb);
-		} else {
-			zone->mtime = time(0);
-			if(zone->filename)
-				region_recycle(nsd->db->region, zone->filename,
-					strlen(zone->filename)+1);
-			zone->filename = region_strdup(nsd->db->region, zfile);
-			if(zone->logstr)
-				region_recycle(nsd->db->region, zone->logstr,
-					strlen(zone->logstr)+1);
-			zone->logstr = NULL;
+	}
+	if(!result) {
+		for(i=0; i<num; i++)
+			if(zonefile_write(jobs[i].zone, jobs[i].zfile,
+				jobs[i].logs))
+				zonefile_write_done(nsd, jobs[i].zone,
+					jobs[i].zfile);
+		region_destroy(region);
+		return;
+	}
+	memset(result, ZONE_WRITE_TODO, num);
+	VERBOSITY(1, (LOG_INFO, "writing %u zonefiles with %d workers",
+		(unsigned)num, workers));
+
+	/* start the workers */
+	pids = (pid_t*)region_alloc_array(region, workers, sizeof(pid_t));
+	for(w=0; w<workers; w++) {
+		switch((pids[w] = fork())) {
+		case -1:
+			/* its zones are written below */
+			log_msg(LOG_ERR, "zone write: fork failed: %s",
+				strerror(errno));
+			break;
+		case 0:
+			zone_write_worker(nsd, jobs, num, result, w, workers);
+			break;
+		default:
+			break;
 		}
 	}
+
+	/* wait for the workers and mark their zones as written */
+	for(w=0; w<workers; w++) {
+		if(pids[w] != -1) {
+			int status;
+			while(waitpid(pids[w], &status, 0) == -1) {
+				/* ECHILD if a signal handler reaped it,
+				 * the results are in the shared memory */
+				if(errno != EINTR) {
+					if(errno != ECHILD)
+						log_msg(LOG_ERR, "zone write: "
+							"waitpid: %s",
+							strerror(errno));
+					break;
+				}
+			}
+		}
+		for(i=(size_t)w; i<num; i+=(size_t)workers) {
+			if(result[i] == ZONE_WRITE_OK ||
+				(result[i] == ZONE_WRITE_TODO &&
+				!nsd->signal_hint_shutdown &&
+				zonefile_write(jobs[i].zone, jobs[i].zfile,
+				jobs[i].logs)))
+				zonefile_write_done(nsd, jobs[i].zone,
+					jobs[i].zfile);
+		}
+	}
+	munmap(result, num);
+	region_destroy(region);
 }
+#endif /* HAVE_MMAP */
 
 void
 namedb_write_zonefiles(struct nsd* nsd, nsd_options_t* options)
 {
 	zone_options_t* zo;
+#ifdef HAVE_MMAP
+	/* the zone files may be written by worker processes */
+	if(options->zonefiles_write_workers > 1) {
+		namedb_write_zonefiles_workers(nsd, options,
+			options->zonefiles_write_workers);
+		return;
+	}
+#endif
 	RBTREE_FOR(zo, zone_options_t*, options->zone_options) {
 		namedb_write_zonefile(nsd, zo);
 	}
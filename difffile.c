@@ -13,7 +13,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "difffile.h"
+#include "catalog.h"
 #include "xfrd-disk.h"
 #include "util.h"
 #include "packet.h"
@@ -23,6 +26,7 @@
 #include "nsec3.h"
 #include "nsd.h"
 #include "rrl.h"
+#include "ixfr.h"
 
 static int
 write_64(FILE *out, uint64_t val)
@@ -202,19 +206,10 @@ diff_read_str(FILE* in, char* buf, size_t len)
 }
 
 static void
-add_rdata_to_recyclebin(namedb_type* db, rr_type* rr)
+add_rdata_to_recyclebin(namedb_type* db, region_type* region, rr_type* rr)
 {
-	/* add rdatas to recycle bin. */
-	size_t i;
-	for(i=0; i<rr->rdata_count; i++)
-	{
-		if(!rdata_atom_is_domain(rr->type, i))
-			region_recycle(db->region, rr->rdatas[i].data,
-				rdata_atom_size(rr->rdatas[i])
-				+ sizeof(uint16_t));
-	}
-	region_recycle(db->region, rr->rdatas,
-		sizeof(rdata_atom_type)*rr->rdata_count);
+	/* add rdata to recycle bin, or release the shared copy */
+	rr_release_rdata(db, region, rr);
 }
 
 /* this routine determines if below a domain there exist names with
@@ -266,7 +261,7 @@ rrset_zero_nonexist_check(domain_type* domain, domain_type* ce)
 static void
 rrset_delete(namedb_type* db, domain_type* domain, rrset_type* rrset)
 {
-	int i;
+	int i, tag;
 	/* find previous */
 	rrset_type** pp = &domain->rrsets;
 	while(*pp && *pp != rrset) {
@@ -276,7 +271,9 @@ rrset_delete(namedb_type* db, domain_type* domain, rrset_type* rrset)
 		/* rrset does not exist for domain */
 		return;
 	}
+	zone_mem_rrset(rrset->zone, domain, rrset, 0);
 	*pp = rrset->next;
+	domain_rrset_types_update(domain);
 
 	DEBUG(DEBUG_XFRD,2, (LOG_INFO, "delete rrset of %s type %s",
 		domain_to_string(domain),
@@ -299,72 +296,50 @@ rrset_delete(namedb_type* db, domain_type* domain, rrset_type* rrset)
 	}
 	/* recycle the memory space of the rrset */
 	for (i = 0; i < rrset->rr_count; ++i)
-		add_rdata_to_recyclebin(db, &rrset->rrs[i]);
-	region_recycle(db->region, rrset->rrs,
+		add_rdata_to_recyclebin(db, rrset->zone->region, &rrset->rrs[i]);
+	tag = region_set_tag(rrset->zone->region, REGION_TAG_RRSETS);
+	region_recycle(rrset->zone->region, rrset->rrs,
 		sizeof(rr_type) * rrset->rr_count);
 	rrset->rr_count = 0;
-	region_recycle(db->region, rrset, sizeof(rrset_type));
+	region_recycle(rrset->zone->region, rrset, sizeof(rrset_type));
+	(void)region_set_tag(rrset->zone->region, tag);
 }
 
 static int
-rdatas_equal(rdata_atom_type *a, rdata_atom_type *b, int num, uint16_t type,
-	int* rdnum, char** reason)
+rdatas_equal(rr_type *a, rr_type *b, int* rdnum, char** reason)
 {
-	int k, start, end;
-	start = 0;
-	end = num;
+	size_t k;
 	/**
 	 * SOA RDATA comparisons in XFR are more lenient,
 	 * only serial rdata is checked.
 	 **/
-	if (type == TYPE_SOA) {
-		start = 2;
-		end = 3;
-	}
-	for(k = start; k < end; k++)
-	{
-		if(rdata_atom_is_domain(type, k)) {
-			if(dname_compare(domain_dname(a[k].domain),
-				domain_dname(b[k].domain))!=0) {
-				*rdnum = k;
-				*reason = "dname data";
-				return 0;
-			}
-		} else if(rdata_atom_is_literal_domain(type, k)) {
-			/* literal dname, but compare case insensitive */
-			if(a[k].data[0] != b[k].data[0]) {
-				*rdnum = k;
-				*reason = "literal dname len";
-				return 0; /* uncompressed len must be equal*/
-			}
-			if(!dname_equal_nocase((uint8_t*)(a[k].data+1),
-				(uint8_t*)(b[k].data+1), a[k].data[0])) {
-				*rdnum = k;
-				*reason = "literal dname data";
-				return 0;
-			}
-		} else {
-			/* check length */
-			if(a[k].data[0] != b[k].data[0]) {
-				*rdnum = k;
-				*reason = "rdata len";
-				return 0;
-			}
-			/* check data */
-			if(memcmp(a[k].data+1, b[k].data+1, a[k].data[0])!=0) {
-				*rdnum = k;
-				*reason = "rdata data";
-				return 0;
-			}
+	if (a->type == TYPE_SOA) {
+		if(a->rdata_count < 3 || b->rdata_count < 3)
+			return 1;
+		if(memcmp(rr_rdata_field(a, 2, NULL),
+			rr_rdata_field(b, 2, NULL), sizeof(uint32_t)) != 0) {
+			*rdnum = 2;
+			*reason = "rdata data";
+			return 0;
 		}
+		return 1;
+	}
+	if(!rdata_equal(a, b, &k)) {
+		*rdnum = (int)k;
+		if(rdata_atom_is_domain(a->type, k))
+			*reason = "dname data";
+		else if(rdata_atom_is_literal_domain(a->type, k))
+			*reason = "literal dname data";
+		else	*reason = "rdata data";
+		return 0;
 	}
 	return 1;
 }
 
 static void
-debug_find_rr_num(rrset_type* rrset, uint16_t type, uint16_t klass,
-	rdata_atom_type *rdatas, ssize_t rdata_num)
+debug_find_rr_num(rrset_type* rrset, rr_type* rr)
 {
+	uint16_t type = rr->type, klass = rr->klass;
 	int i, rd;
 	char* reason = "";
 
@@ -384,16 +359,15 @@ debug_find_rr_num(rrset_type* rrset, uint16_t type, uint16_t klass,
 				klass, i,
 				rrset->rrs[i].klass);
 		}
-		if (rrset->rrs[i].rdata_count != rdata_num) {
+		if (rrset->rrs[i].rdata_count != rr->rdata_count) {
 			log_msg(LOG_WARNING, "diff: RR <%s, %s> rdlen %u "
 				"does not match RR num %d rdlen %d",
 				dname_to_string(rrset->rrs[i].owner->dname,0),
 				rrtype_to_string(type),
-				(unsigned) rdata_num, i,
+				(unsigned) rr->rdata_count, i,
 				(unsigned) rrset->rrs[i].rdata_count);
 		}
-		if (!rdatas_equal(rdatas, rrset->rrs[i].rdatas, rdata_num, type,
-			&rd, &reason)) {
+		if (!rdatas_equal(rr, &rrset->rrs[i], &rd, &reason)) {
 			log_msg(LOG_WARNING, "diff: RR <%s, %s> rdata element "
 				"%d differs from RR num %d rdata (%s)",
 				dname_to_string(rrset->rrs[i].owner->dname,0),
@@ -404,29 +378,194 @@ debug_find_rr_num(rrset_type* rrset, uint16_t type, uint16_t klass,
 }
 
 static int
-find_rr_num(rrset_type* rrset, uint16_t type, uint16_t klass,
-	rdata_atom_type *rdatas, ssize_t rdata_num, int add)
+find_rr_num(rrset_type* rrset, rr_type* rr, int add)
 {
 	int i, rd;
 	char* reason;
 
 	for(i=0; i < rrset->rr_count; ++i) {
-		if(rrset->rrs[i].type == type &&
-		   rrset->rrs[i].klass == klass &&
-		   rrset->rrs[i].rdata_count == rdata_num &&
-		   rdatas_equal(rdatas, rrset->rrs[i].rdatas, rdata_num, type,
-			&rd, &reason))
+		if(rrset->rrs[i].type == rr->type &&
+		   rrset->rrs[i].klass == rr->klass &&
+		   rrset->rrs[i].rdata_count == rr->rdata_count &&
+		   rdatas_equal(rr, &rrset->rrs[i], &rd, &reason))
 		{
 			return i;
 		}
 	}
         /* this is odd. Log why rr cannot be found. */
 	if (!add) {
-		debug_find_rr_num(rrset, type, klass, rdatas, rdata_num);
+		debug_find_rr_num(rrset, rr);
 	}
 	return -1;
 }
 
+/* the kinds of udb changes that wait for diff_udb_flush */
+#define UDB_DEFER_ADD 1
+#define UDB_DEFER_DEL 2
+#define UDB_DEFER_CLEAR 3
+#define UDB_DEFER_ZONE 4
+
+/** a change of the udb that is written after the reload */
+struct udb_defer_op {
+	struct udb_defer_op* next;
+	int kind;
+	/* the zone, shared by the changes of the same zone in a row */
+	const dname_type* zone;
+	/* the RR, the rdata is marshalled like in the udb */
+	uint8_t* owner;
+	size_t owner_len;
+	uint16_t type, klass;
+	uint32_t ttl;
+	uint8_t* rdata;
+	size_t rdata_len;
+	/* UDB_DEFER_ZONE: the end time and the log of the transfer */
+	uint64_t mtime;
+	char* log;
+};
+
+/** the udb changes of the zone transfers of the reload, in order */
+static struct udb_defer {
+	/* the changes are kept, not written */
+	int on;
+	region_type* region;
+	struct udb_defer_op* first, *last;
+	size_t count;
+} udb_defer;
+
+void
+diff_udb_defer(int on)
+{
+	udb_defer.on = on;
+}
+
+int
+diff_udb_pending(void)
+{
+	return udb_defer.first != NULL;
+}
+
+/** append a change of the zone, NULL if the udb is written right away */
+static struct udb_defer_op*
+udb_defer_add(namedb_type* db, int kind, zone_type* zone)
+{
+	const dname_type* apex = domain_dname(zone->apex);
+	struct udb_defer_op* op;
+	if(!udb_defer.on || !db->udb)
+		return NULL;
+	if(!udb_defer.region)
+		udb_defer.region = region_create(xalloc, free);
+	op = (struct udb_defer_op*)region_alloc_zero(udb_defer.region,
+		sizeof(*op));
+	op->kind = kind;
+	if(udb_defer.last && dname_compare(udb_defer.last->zone, apex) == 0)
+		op->zone = udb_defer.last->zone;
+	else	op->zone = dname_copy(udb_defer.region, apex);
+	if(udb_defer.last)
+		udb_defer.last->next = op;
+	else	udb_defer.first = op;
+	udb_defer.last = op;
+	udb_defer.count++;
+	return op;
+}
+
+/** append the add or delete of an RR, 0 if it is written right away */
+static int
+udb_defer_rr(namedb_type* db, int kind, zone_type* zone, rr_type* rr)
+{
+	uint8_t rdata[MAX_RDLENGTH];
+	const dname_type* owner = domain_dname(rr->owner);
+	struct udb_defer_op* op = udb_defer_add(db, kind, zone);
+	if(!op)
+		return 0;
+	op->owner = (uint8_t*)region_alloc_init(udb_defer.region,
+		dname_name(owner), owner->name_size);
+	op->owner_len = owner->name_size;
+	op->type = rr->type;
+	op->klass = rr->klass;
+	op->ttl = rr->ttl;
+	op->rdata_len = rr_marshal_rdata(rr, rdata, sizeof(rdata));
+	if(op->rdata_len)
+		op->rdata = (uint8_t*)region_alloc_init(udb_defer.region,
+			rdata, op->rdata_len);
+	return 1;
+}
+
+size_t
+diff_udb_flush(namedb_type* db)
+{
+	udb_base* udb = db->udb;
+	size_t count = udb_defer.count;
+	const dname_type* zone = NULL;
+	struct udb_defer_op* op;
+	uint64_t flags;
+	udb_ptr z;
+	int ok = 1;
+	if(!udb_defer.first)
+		return 0;
+	if(udb) {
+		namedb_lock_udb(db);
+		/* dirty until all of it is written, in reload it may be
+		 * dirty already for the transfer that is applied */
+		flags = udb_base_get_userflags(udb);
+		udb_base_set_userflags(udb, 1);
+		udb_ptr_init(&z, udb);
+		for(op = udb_defer.first; op && ok; op = op->next) {
+			if(op->zone != zone) {
+				zone = op->zone;
+				udb_ptr_unlink(&z, udb);
+				if(!udb_zone_search(udb, &z, dname_name(zone),
+					zone->name_size) &&
+				   !udb_zone_create(udb, &z, dname_name(zone),
+					zone->name_size)) {
+					log_msg(LOG_ERR, "could not udb_create_zone "
+						"%s, disk space full?",
+						dname_to_string(zone, NULL));
+					ok = 0;
+					break;
+				}
+			}
+			switch(op->kind) {
+			case UDB_DEFER_ADD:
+				if(!udb_zone_add_rr(udb, &z, op->owner,
+					op->owner_len, op->type, op->klass,
+					op->ttl, op->rdata, op->rdata_len)) {
+					log_msg(LOG_ERR, "could not add RR to "
+						"nsd.db, disk-space?");
+					ok = 0;
+				}
+				break;
+			case UDB_DEFER_DEL:
+				udb_zone_del_rr(udb, &z, op->owner,
+					op->owner_len, op->type, op->klass,
+					op->rdata, op->rdata_len);
+				break;
+			case UDB_DEFER_CLEAR:
+				udb_zone_clear(udb, &z);
+				break;
+			case UDB_DEFER_ZONE:
+				ZONE(&z)->is_changed = 1;
+				ZONE(&z)->mtime = op->mtime;
+				udb_zone_set_log_str(udb, &z, op->log);
+				udb_zone_set_file_str(udb, &z, NULL);
+				break;
+			}
+		}
+		udb_ptr_unlink(&z, udb);
+		/* if it failed the udb stays dirty, and it is made anew from
+		 * the zone files at the next start */
+		if(ok)
+			udb_base_set_userflags(udb, flags);
+		udb_base_sync(udb, 0);
+		namedb_unlock_udb(db);
+	}
+	region_destroy(udb_defer.region);
+	udb_defer.region = NULL;
+	udb_defer.first = NULL;
+	udb_defer.last = NULL;
+	udb_defer.count = 0;
+	return count;
+}
+
 #ifdef NSEC3
 /* see if nsec3 deletion triggers need action */
 static void
@@ -451,6 +590,7 @@ nsec3_delete_rr_trigger(namedb_type* db, rr_type* rr, zone_type* zone,
 		/* unlink from the nsec3tree */
 		zone_del_domain_in_hash_tree(zone->nsec3tree,
 			&rr->owner->nsec3->nsec3_node);
+		nsec3_index_del(zone, rr->owner);
 		/* add previous NSEC3 to the prehash list */
 		if(prev && prev != rr->owner)
 			prehash_add(db->domains, prev);
@@ -461,7 +601,9 @@ nsec3_delete_rr_trigger(namedb_type* db, rr_type* rr, zone_type* zone,
 	else if(rr->type == TYPE_NSEC3PARAM && rr == zone->nsec3_param) {
 		/* clear trees, wipe hashes, wipe precompile */
 		nsec3_clear_precompile(db, zone);
-		/* pick up new nsec3param (from udb, or avoid deleted rr) */
+		/* pick up new nsec3param (from udb, or avoid deleted rr),
+		 * the udb has to have the changes that wait */
+		(void)diff_udb_flush(db);
 		nsec3_find_zone_param(db, zone, udbz, rr);
 		/* if no more NSEC3, done */
 		if(!zone->nsec3_param)
@@ -564,6 +706,7 @@ nsec3_add_rr_trigger(namedb_type* db, rr_type* rr, zone_type* zone,
 		prehash_add(db->domains, rr->owner);
 	} else if(!zone->nsec3_param && rr->type == TYPE_NSEC3PARAM) {
 		/* see if this means NSEC3 chain can be used */
+		(void)diff_udb_flush(db);
 		nsec3_find_zone_param(db, zone, udbz, NULL);
 		if(!zone->nsec3_param)
 			return;
@@ -604,14 +747,12 @@ static void
 rr_lower_usage(namedb_type* db, rr_type* rr)
 {
 	unsigned i;
-	for(i=0; i<rr->rdata_count; i++) {
-		if(rdata_atom_is_domain(rr->type, i)) {
-			assert(rdata_atom_domain(rr->rdatas[i])->usage > 0);
-			rdata_atom_domain(rr->rdatas[i])->usage --;
-			if(rdata_atom_domain(rr->rdatas[i])->usage == 0)
-				domain_table_deldomain(db,
-					rdata_atom_domain(rr->rdatas[i]));
-		}
+	for(i=0; i<rr->rdata_domains; i++) {
+		domain_type* d = rr_rdata_domains(rr)[i];
+		assert(d->usage > 0);
+		d->usage --;
+		if(d->usage == 0)
+			domain_table_deldomain(db, d);
 	}
 }
 
@@ -649,21 +790,22 @@ delete_RR(namedb_type* db, const dname_type* dname,
 	} else {
 		/* find the RR in the rrset */
 		domain_table_type *temptable;
-		rdata_atom_type *rdatas;
-		ssize_t rdata_num;
+		rr_type rr;
 		int rrnum;
 		temptable = domain_table_create(temp_region);
+		memset(&rr, 0, sizeof(rr));
+		rr.type = type;
+		rr.klass = klass;
 		/* This will ensure that the dnames in rdata are
 		 * normalized, conform RFC 4035, section 6.2
 		 */
-		rdata_num = rdata_wireformat_to_rdata_atoms(
-			temp_region, temptable, type, rdatalen, packet, &rdatas);
-		if(rdata_num == -1) {
+		if(rdata_wireformat_to_rdata(temp_region, temptable, rdatalen,
+			packet, &rr) == -1) {
 			log_msg(LOG_ERR, "diff: bad rdata for %s",
 				dname_to_string(dname,0));
 			return 0;
 		}
-		rrnum = find_rr_num(rrset, type, klass, rdatas, rdata_num, 0);
+		rrnum = find_rr_num(rrset, &rr, 0);
 		if(rrnum == -1 && type == TYPE_SOA && domain == zone->apex
 			&& rrset->rr_count != 0)
 			rrnum = 0; /* replace existing SOA if no match */
@@ -674,7 +816,8 @@ delete_RR(namedb_type* db, const dname_type* dname,
 			return 1; /* not fatal error */
 		}
 		/* delete the normalized RR from the udb */
-		if(db->udb)
+		if(db->udb && !udb_defer_rr(db, UDB_DEFER_DEL, zone,
+			&rrset->rrs[rrnum]))
 			udb_del_rr(db->udb, udbz, &rrset->rrs[rrnum]);
 #ifdef NSEC3
 		/* process triggers for RR deletions */
@@ -697,19 +840,23 @@ delete_RR(namedb_type* db, const dname_type* dname,
 		} else {
 			/* swap out the bad RR and decrease the count */
 			rr_type* rrs_orig = rrset->rrs;
-			add_rdata_to_recyclebin(db, &rrset->rrs[rrnum]);
+			int tag;
+			zone_mem_rr(zone, &rrset->rrs[rrnum], 0);
+			add_rdata_to_recyclebin(db, zone->region, &rrset->rrs[rrnum]);
 			if(rrnum < rrset->rr_count-1)
 				rrset->rrs[rrnum] = rrset->rrs[rrset->rr_count-1];
 			memset(&rrset->rrs[rrset->rr_count-1], 0, sizeof(rr_type));
 			/* realloc the rrs array one smaller */
-			rrset->rrs = region_alloc_array_init(db->region, rrs_orig,
+			tag = region_set_tag(zone->region, REGION_TAG_RRSETS);
+			rrset->rrs = region_alloc_array_init(zone->region, rrs_orig,
 				(rrset->rr_count-1), sizeof(rr_type));
 			if(!rrset->rrs) {
 				log_msg(LOG_ERR, "out of memory, %s:%d", __FILE__, __LINE__);
 				exit(1);
 			}
-			region_recycle(db->region, rrs_orig,
+			region_recycle(zone->region, rrs_orig,
 				sizeof(rr_type) * rrset->rr_count);
+			(void)region_set_tag(zone->region, tag);
 #ifdef NSEC3
 			if(type == TYPE_NSEC3PARAM && zone->nsec3_param) {
 				/* fixup nsec3_param pointer to same RR */
@@ -728,6 +875,7 @@ delete_RR(namedb_type* db, const dname_type* dname,
 			}
 #endif /* NSEC3 */
 			rrset->rr_count --;
+			rrset_wire_min_update(rrset);
 #ifdef NSEC3
 			/* for type nsec3, the domain may have become a
 			 * 'normal' domain with its remaining data now */
@@ -744,24 +892,30 @@ int
 add_RR(namedb_type* db, const dname_type* dname,
 	uint16_t type, uint16_t klass, uint32_t ttl,
 	buffer_type* packet, size_t rdatalen, zone_type *zone, udb_ptr* udbz,
-	int* softfail)
+	int* softfail, struct domain_cursor* cursor)
 {
 	domain_type* domain;
 	rrset_type* rrset;
-	rdata_atom_type *rdatas;
+	rr_type rr;
 	rr_type *rrs_old;
-	ssize_t rdata_num;
-	int rrnum;
+	int rrnum, tag;
 	int rrset_added = 0;
-	domain = domain_table_find(db->domains, dname);
-	if(!domain) {
-		/* create the domain */
-		domain = domain_table_insert(db->domains, dname);
+	if(cursor) {
+		domain = domain_table_insert_cursor(db->domains, cursor,
+			dname);
+	} else {
+		domain = domain_table_find(db->domains, dname);
+		if(!domain) {
+			/* create the domain */
+			domain = domain_table_insert(db->domains, dname);
+		}
 	}
 	rrset = domain_find_rrset(domain, zone, type);
 	if(!rrset) {
 		/* create the rrset */
-		rrset = region_alloc(db->region, sizeof(rrset_type));
+		tag = region_set_tag(zone->region, REGION_TAG_RRSETS);
+		rrset = region_alloc(zone->region, sizeof(rrset_type));
+		(void)region_set_tag(zone->region, tag);
 		if(!rrset) {
 			log_msg(LOG_ERR, "out of memory, %s:%d", __FILE__, __LINE__);
 			exit(1);
@@ -769,25 +923,33 @@ add_RR(namedb_type* db, const dname_type* dname,
 		rrset->zone = zone;
 		rrset->rrs = 0;
 		rrset->rr_count = 0;
+		rrset->type = type;
+		rrset->wire_min = 0;
 		domain_add_rrset(domain, rrset);
+		zone_mem_rrset(zone, domain, rrset, 1);
 		rrset_added = 1;
 	}
 
 	/* dnames in rdata are normalized, conform RFC 4035,
 	 * Section 6.2
 	 */
-	rdata_num = rdata_wireformat_to_rdata_atoms(
-		db->region, db->domains, type, rdatalen, packet, &rdatas);
-	if(rdata_num == -1) {
+	rr.owner = domain;
+	rr.ttl = ttl;
+	rr.type = type;
+	rr.klass = klass;
+	if(rdata_wireformat_to_rdata(zone->region, db->domains, rdatalen,
+		packet, &rr) == -1) {
 		log_msg(LOG_ERR, "diff: bad rdata for %s",
 			dname_to_string(dname,0));
 		return 0;
 	}
-	rrnum = find_rr_num(rrset, type, klass, rdatas, rdata_num, 1);
+	rrnum = find_rr_num(rrset, &rr, 1);
 	if(rrnum != -1) {
 		DEBUG(DEBUG_XFRD, 2, (LOG_ERR, "diff: RR <%s, %s> already exists",
 			dname_to_string(dname,0), rrtype_to_string(type)));
 		/* ignore already existing RR: lenient accepting of messages */
+		rr_lower_usage(db, &rr);
+		add_rdata_to_recyclebin(db, zone->region, &rr);
 		*softfail = 1;
 		return 1;
 	}
@@ -796,10 +958,12 @@ add_RR(namedb_type* db, const dname_type* dname,
 			dname_to_string(dname,0));
 		return 0;
 	}
+	rr_share_rdata(db, zone->region, &rr);
 
 	/* re-alloc the rrs and add the new */
 	rrs_old = rrset->rrs;
-	rrset->rrs = region_alloc_array(db->region,
+	tag = region_set_tag(zone->region, REGION_TAG_RRSETS);
+	rrset->rrs = region_alloc_array(zone->region,
 		(rrset->rr_count+1), sizeof(rr_type));
 	if(!rrset->rrs) {
 		log_msg(LOG_ERR, "out of memory, %s:%d", __FILE__, __LINE__);
@@ -807,15 +971,13 @@ add_RR(namedb_type* db, const dname_type* dname,
 	}
 	if(rrs_old)
 		memcpy(rrset->rrs, rrs_old, rrset->rr_count * sizeof(rr_type));
-	region_recycle(db->region, rrs_old, sizeof(rr_type) * rrset->rr_count);
+	region_recycle(zone->region, rrs_old, sizeof(rr_type) * rrset->rr_count);
+	(void)region_set_tag(zone->region, tag);
 	rrset->rr_count ++;
 
-	rrset->rrs[rrset->rr_count - 1].owner = domain;
-	rrset->rrs[rrset->rr_count - 1].rdatas = rdatas;
-	rrset->rrs[rrset->rr_count - 1].ttl = ttl;
-	rrset->rrs[rrset->rr_count - 1].type = type;
-	rrset->rrs[rrset->rr_count - 1].klass = klass;
-	rrset->rrs[rrset->rr_count - 1].rdata_count = rdata_num;
+	rrset->rrs[rrset->rr_count - 1] = rr;
+	rrset_wire_min_update(rrset);
+	zone_mem_rr(zone, &rrset->rrs[rrset->rr_count - 1], 1);
 
 	/* see if it is a SOA */
 	if(domain == zone->apex) {
@@ -834,7 +996,8 @@ add_RR(namedb_type* db, const dname_type* dname,
 	}
 
 	/* write the just-normalized RR to the udb */
-	if(db->udb) {
+	if(db->udb && !udb_defer_rr(db, UDB_DEFER_ADD, zone,
+		&rrset->rrs[rrset->rr_count - 1])) {
 		if(!udb_write_rr(db->udb, udbz, &rrset->rrs[rrset->rr_count - 1])) {
 			log_msg(LOG_ERR, "could not add RR to nsd.db, disk-space?");
 			return 0;
@@ -943,12 +1106,15 @@ delete_zone_rrs(namedb_type* db, zone_type* zone)
 	}
 
 	DEBUG(DEBUG_XFRD, 1, (LOG_INFO, "axfrdel: recyclebin holds %lu bytes",
-		(unsigned long) region_get_recycle_size(db->region)));
+		(unsigned long) region_get_recycle_size(zone->region)));
 #ifndef NDEBUG
 	if(nsd_debug_level >= 2)
-		region_log_stats(db->region);
+		region_log_stats(zone->region);
 #endif
 
+	/* the stored IXFR versions do not lead to the new contents */
+	zone_ixfr_clear(zone);
+
 	assert(zone->soa_rrset == 0);
 	/* keep zone->soa_nx_rrset alloced: it is reused */
 	assert(zone->ns_rrset == 0);
@@ -961,7 +1127,7 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 	nsd_options_t* opt, uint32_t seq_nr, uint32_t seq_total,
 	int* is_axfr, int* delete_mode, int* rr_count,
 	udb_ptr* udbz, struct zone** zone_res, const char* patname, int* bytes,
-	int* softfail)
+	int* softfail, struct ixfr_store* ixfr_store)
 {
 	uint32_t msglen, checklen, pkttype;
 	int qcount, ancount, counter;
@@ -971,6 +1137,9 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 	uint16_t rrlen;
 	const dname_type *dname_zone, *dname;
 	zone_type* zone_db;
+	/* the owners of an AXFR come in canonical order, mostly */
+	struct domain_cursor cursor;
+	cursor.last = NULL;
 
 	/* note that errors could not really happen due to format of the
 	 * packet since xfrd has checked all dnames and RRs before commit,
@@ -1133,7 +1302,9 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 			nsec3_hash_tree_clear(zone_db);
 #endif
 			delete_zone_rrs(db, zone_db);
-			if(db->udb)
+			cursor.last = NULL;
+			if(db->udb && !udb_defer_add(db, UDB_DEFER_CLEAR,
+				zone_db))
 				udb_zone_clear(db->udb, udbz);
 #ifdef NSEC3
 			nsec3_clear_precompile(db, zone_db);
@@ -1164,7 +1335,8 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 				nsec3_hash_tree_clear(zone_db);
 #endif
 				delete_zone_rrs(db, zone_db);
-				if(db->udb)
+				if(db->udb && !udb_defer_add(db,
+					UDB_DEFER_CLEAR, zone_db))
 					udb_zone_clear(db->udb, udbz);
 #ifdef NSEC3
 				nsec3_clear_precompile(db, zone_db);
@@ -1172,6 +1344,7 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 #endif /* NSEC3 */
 				*delete_mode = 0;
 				*is_axfr = 1;
+				cursor.last = NULL;
 			}
 			/* must have stuff in memory for a successful IXFR,
 			 * the serial number of the SOA has been checked
@@ -1199,6 +1372,12 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 			buffer_skip(packet, rrlen);
 			continue;
 		}
+		if(ixfr_store && !*is_axfr && !(type == TYPE_SOA &&
+			counter==ancount-1 && seq_nr == seq_total-1)) {
+			/* the final SOA is not stored, it is the zone SOA */
+			ixfr_store_add_rr(ixfr_store, dname, type, klass, ttl,
+				packet, rrlen);
+		}
 
 		DEBUG(DEBUG_XFRD,2, (LOG_INFO, "xfr %s RR dname is %s type %s",
 			*delete_mode?"del":"add",
@@ -1214,12 +1393,14 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 				region_destroy(region);
 				return 0;
 			}
+			/* the domain of the last owner can be deleted */
+			cursor.last = NULL;
 		}
 		else
 		{
 			/* add this rr */
 			if(!add_RR(db, dname, type, klass, ttl, packet,
-				rrlen, zone_db, udbz, softfail)) {
+				rrlen, zone_db, udbz, softfail, &cursor)) {
 				region_destroy(region);
 				return 0;
 			}
@@ -1243,8 +1424,8 @@ check_for_bad_serial(namedb_type* db, const char* zone_str, uint32_t old_serial)
 	if(zone && zone->apex == domain && zone->soa_rrset && old_serial)
 	{
 		uint32_t memserial;
-		memcpy(&memserial, rdata_atom_data(zone->soa_rrset->rrs[0].rdatas[2]),
-			sizeof(uint32_t));
+		memcpy(&memserial, rr_rdata_field(&zone->soa_rrset->rrs[0],
+			2, NULL), sizeof(uint32_t));
 		if(old_serial != ntohl(memserial)) {
 			region_destroy(region);
 			return 1;
@@ -1254,6 +1435,105 @@ check_for_bad_serial(namedb_type* db, const char* zone_str, uint32_t old_serial)
 	return 0;
 }
 
+/* seconds that a streamed transfer file may not grow, before the
+ * transfer is taken to be aborted */
+#define XFR_STREAM_TIMEOUT 120
+
+/* a transfer file that xfrd is still writing, for xfrd-stream-apply */
+struct diff_stream {
+	off_t size;		/* size of the file at the last look */
+	time_t grown;		/* when the file last grew */
+	unsigned delay;		/* usecs to sleep before the next look */
+};
+
+/* the reload can apply a file that is not committed yet, the changes go
+ * to its own copy of the zones, that is dropped if it quits */
+static int
+diff_stream_allowed(struct nsd* nsd, udb_base* taskudb)
+{
+	return nsd->options->xfrd_stream_apply && taskudb != NULL &&
+		nsd->db->udb == NULL;
+}
+
+/* look at the size of the file, returns 0 if xfrd has removed it, or
+ * it did not grow for XFR_STREAM_TIMEOUT */
+static int
+diff_stream_look(FILE* in, struct diff_stream* s)
+{
+	struct stat st;
+	if(fstat(fileno(in), &st) == -1 || st.st_nlink == 0)
+		return 0;
+	if(st.st_size != s->size) {
+		s->size = st.st_size;
+		s->grown = time(NULL);
+		s->delay = 1000;
+	} else if(time(NULL) - s->grown > XFR_STREAM_TIMEOUT)
+		return 0;
+	return 1;
+}
+
+static void
+diff_stream_sleep(struct diff_stream* s)
+{
+	usleep(s->delay);
+	if(s->delay < 100000)
+		s->delay *= 2;
+}
+
+/* read the 32bit value at the offset, without the stdio buffer of in */
+static int
+diff_stream_read_32(FILE* in, off_t offset, uint32_t* result)
+{
+	if(pread(fileno(in), result, sizeof(*result), offset) !=
+		(ssize_t)sizeof(*result))
+		return 0;
+	*result = ntohl(*result);
+	return 1;
+}
+
+/*
+ * Wait until part seq_nr, at the position of in, is in the file, and it
+ * is known if it is the last part.  Returns the number of parts once xfrd
+ * has committed the file, seq_nr+2 if the next part has started, or 0 if
+ * the transfer was aborted.  xfrd writes the commit in the header before
+ * it appends the log string, so bytes after a part are a next part while
+ * the header is not committed.
+ */
+static uint32_t
+diff_stream_wait_part(FILE* in, struct diff_stream* s, uint32_t seq_nr)
+{
+	off_t pos = ftello(in);
+	uint8_t committed;
+	uint32_t num_parts, len;
+	while(diff_stream_look(in, s)) {
+		if(pread(fileno(in), &committed, 1, 4) != 1 ||
+			!diff_stream_read_32(in, 5, &num_parts))
+			return 0;
+		if(committed)
+			return num_parts;
+		if(s->size >= pos + 8 && diff_stream_read_32(in, pos+4, &len)
+			&& s->size > pos + 12 + (off_t)len)
+			return seq_nr+2;
+		diff_stream_sleep(s);
+	}
+	return 0;
+}
+
+/* wait until the log string after the parts is in the file */
+static int
+diff_stream_wait_log(FILE* in, struct diff_stream* s)
+{
+	off_t pos = ftello(in);
+	uint32_t len;
+	while(diff_stream_look(in, s)) {
+		if(s->size >= pos + 4 && diff_stream_read_32(in, pos, &len)
+			&& s->size >= pos + 4 + (off_t)len)
+			return 1;
+		diff_stream_sleep(s);
+	}
+	return 0;
+}
+
 static int
 apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 	nsd_options_t* opt, udb_base* taskudb, udb_ptr* last_task,
@@ -1269,6 +1549,8 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 	uint8_t committed;
 	uint32_t i;
 	int num_bytes = 0;
+	int stream = 0;
+	struct diff_stream s;
 
 	/* read zone name and serial */
 	if(!diff_read_32(in, &type)) {
@@ -1304,6 +1586,17 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 			zone_buf, dname_to_string(zonedb->apex->dname,0));
 		return 0;
 	}
+	if(!committed && diff_stream_allowed(nsd, taskudb)) {
+		/* xfrd is still receiving it, the parts are applied as they
+		 * are written to the file */
+		VERBOSITY(2, (LOG_INFO, "apply transfer of %s while it is "
+			"received", zone_buf));
+		stream = 1;
+		memset(&s, 0, sizeof(s));
+		s.size = -1;
+		committed = 1;
+		num_parts = 1;
+	}
 	if(!committed) {
 		log_msg(LOG_ERR, "diff file %s was not committed", zone_buf);
 		return 0;
@@ -1317,12 +1610,19 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 			"skipping diff file commit with bad serial"));
 		return 1;
 	}
+	/* the changes are made to the zone in memory, read all of it */
+	if(!namedb_read_lazy_zone(nsd->db, zonedb)) {
+		log_msg(LOG_ERR, "could not read zone %s from the db",
+			zone_buf);
+		return 0;
+	}
 
 	if(committed)
 	{
 		int is_axfr=0, delete_mode=0, rr_count=0, softfail=0;
 		const dname_type* apex = zonedb->apex->dname;
 		udb_ptr z;
+		struct ixfr_store ixfr_store_mem, *ixfr_store;
 
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "processing xfr: %s", zone_buf));
 		if(nsd->db->udb) {
@@ -1346,40 +1646,90 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 			/* set the udb dirty until we are finished applying changes */
 			udb_base_set_userflags(nsd->db->udb, 1);
 		}
+		ixfr_store = ixfr_store_start(zonedb, &ixfr_store_mem,
+			old_serial, new_serial);
 		/* read and apply all of the parts */
 		for(i=0; i<num_parts; i++) {
 			int ret;
+			if(stream) {
+				num_parts = diff_stream_wait_part(in, &s, i);
+				if(num_parts == 0) {
+					/* the changes to the zone cannot be
+					 * undone, the old database stays */
+					log_msg(LOG_ERR, "transfer of %s was "
+						"aborted while it was applied, "
+						"the reload quits", zone_buf);
+					exit(1);
+				}
+				clearerr(in);
+			}
 			DEBUG(DEBUG_XFRD,2, (LOG_INFO, "processing xfr: apply part %d", (int)i));
 			ret = apply_ixfr(nsd->db, in, zone_buf, new_serial, opt,
 				i, num_parts, &is_axfr, &delete_mode,
 				&rr_count, (nsd->db->udb?&z:NULL), &zonedb,
-				patname_buf, &num_bytes, &softfail);
+				patname_buf, &num_bytes, &softfail, ixfr_store);
 			if(ret == 0) {
 				log_msg(LOG_ERR, "bad ixfr packet part %d in diff file for %s", (int)i, zone_buf);
-				xfrd_unlink_xfrfile(nsd, xfrfilenr);
+				if(taskudb)
+					xfrd_unlink_xfrfile(nsd, xfrfilenr);
 				/* the udb is still dirty, it is bad */
 				exit(1);
 			} else if(ret == 2) {
+				if(ixfr_store)
+					ixfr_store_cancel(ixfr_store);
 				break;
 			}
 		}
+		if(ixfr_store) {
+			if(is_axfr || softfail) {
+				/* no diff, or the zone differs from the
+				 * master, versions up to now are not usable */
+				ixfr_store_cancel(ixfr_store);
+				zone_ixfr_clear(zonedb);
+			} else	ixfr_store_finish(ixfr_store);
+		}
 		if(nsd->db->udb)
 			udb_base_set_userflags(nsd->db->udb, 0);
 		/* read the final log_str: but do not fail on it */
+		if(stream && i == num_parts) {
+			uint32_t end_1;
+			if(!diff_stream_wait_log(in, &s))
+				log_msg(LOG_ERR, "transfer %s file was removed "
+					"before its log", zone_buf);
+			clearerr(in);
+			/* the end time that xfrd wrote at the commit */
+			if(pread(fileno(in), &time_end_0, sizeof(time_end_0),
+				9) == (ssize_t)sizeof(time_end_0) &&
+				diff_stream_read_32(in, 17, &end_1))
+				time_end_1 = end_1;
+		}
 		if(!diff_read_str(in, log_buf, sizeof(log_buf))) {
 			log_msg(LOG_ERR, "could not read log for transfer %s",
 				zone_buf);
 			snprintf(log_buf, sizeof(log_buf), "error reading log");
 		}
 #ifdef NSEC3
-		if(zonedb) prehash_zone(nsd->db, zonedb);
+		if(zonedb) {
+			uint64_t t = latency_clock();
+			prehash_zone(nsd->db, zonedb);
+			nsd->reload_timing.phase[RELOAD_PHASE_PREHASH] +=
+				latency_clock() - t;
+		}
 #endif /* NSEC3 */
 		zonedb->is_changed = 1;
 		if(nsd->db->udb) {
-			ZONE(&z)->is_changed = 1;
-			ZONE(&z)->mtime = time_end_0;
-			udb_zone_set_log_str(nsd->db->udb, &z, log_buf);
-			udb_zone_set_file_str(nsd->db->udb, &z, NULL);
+			struct udb_defer_op* op = udb_defer_add(nsd->db,
+				UDB_DEFER_ZONE, zonedb);
+			if(op) {
+				op->mtime = time_end_0;
+				op->log = region_strdup(udb_defer.region,
+					log_buf);
+			} else {
+				ZONE(&z)->is_changed = 1;
+				ZONE(&z)->mtime = time_end_0;
+				udb_zone_set_log_str(nsd->db->udb, &z, log_buf);
+				udb_zone_set_file_str(nsd->db->udb, &z, NULL);
+			}
 			udb_ptr_unlink(&z, nsd->db->udb);
 		} else {
 			zonedb->mtime = time_end_0;
@@ -1399,12 +1749,12 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 				"starting AXFR. Transfer %s", zone_buf, log_buf);
 			/* add/del failures in IXFR, get an AXFR */
 			task_new_soainfo(taskudb, last_task, zonedb, 1);
-		} else {
-			if(taskudb)
-				task_new_soainfo(taskudb, last_task, zonedb, 0);
+		} else if(taskudb) {
+			task_new_soainfo(taskudb, last_task, zonedb, 0);
+			catalog_task_members(taskudb, last_task, zonedb);
 		}
 
-		if(1 <= verbosity) {
+		if(1 <= verbosity && taskudb) {
 			double elapsed = (double)(time_end_0 - time_start_0)+
 				(double)((double)time_end_1
 				-(double)time_start_1) / 1000000.0;
@@ -1442,6 +1792,7 @@ task_create_new_elem(struct udb_base* udb, udb_ptr* last, udb_ptr* e,
 	TASKLIST(e)->size = sz;
 	TASKLIST(e)->oldserial = 0;
 	TASKLIST(e)->newserial = 0;
+	TASKLIST(e)->xfrflags = 0;
 	TASKLIST(e)->yesno = 0;
 
 	if(zname) {
@@ -1457,6 +1808,7 @@ void task_new_soainfo(struct udb_base* udb, udb_ptr* last, struct zone* z,
 	udb_ptr e;
 	size_t sz;
 	const dname_type* apex, *ns, *em;
+	struct zone_mem_stat mem;
 	if(!z || !z->apex || !domain_dname(z->apex))
 		return; /* safety check */
 
@@ -1465,12 +1817,11 @@ void task_new_soainfo(struct udb_base* udb, udb_ptr* last, struct zone* z,
 	apex = domain_dname(z->apex);
 	sz = sizeof(struct task_list_d) + dname_total_size(apex);
 	if(z->soa_rrset && !gone) {
-		ns = domain_dname(rdata_atom_domain(
-			z->soa_rrset->rrs[0].rdatas[0]));
-		em = domain_dname(rdata_atom_domain(
-			z->soa_rrset->rrs[0].rdatas[1]));
+		ns = domain_dname(rr_rdata_domain(&z->soa_rrset->rrs[0], 0));
+		em = domain_dname(rr_rdata_domain(&z->soa_rrset->rrs[0], 1));
 		sz += sizeof(uint32_t)*6 + sizeof(uint8_t)*2
-			+ ns->name_size + em->name_size;
+			+ ns->name_size + em->name_size
+			+ sizeof(struct zone_mem_stat);
 	} else {
 		ns = 0;
 		em = 0;
@@ -1497,20 +1848,13 @@ void task_new_soainfo(struct udb_base* udb, udb_ptr* last, struct zone* z,
 		p += sizeof(uint8_t);
 		memmove(p, dname_name(em), em->name_size);
 		p += em->name_size;
-		memmove(p, rdata_atom_data(z->soa_rrset->rrs[0].rdatas[2]),
-			sizeof(uint32_t));
-		p += sizeof(uint32_t);
-		memmove(p, rdata_atom_data(z->soa_rrset->rrs[0].rdatas[3]),
-			sizeof(uint32_t));
-		p += sizeof(uint32_t);
-		memmove(p, rdata_atom_data(z->soa_rrset->rrs[0].rdatas[4]),
-			sizeof(uint32_t));
-		p += sizeof(uint32_t);
-		memmove(p, rdata_atom_data(z->soa_rrset->rrs[0].rdatas[5]),
-			sizeof(uint32_t));
-		p += sizeof(uint32_t);
-		memmove(p, rdata_atom_data(z->soa_rrset->rrs[0].rdatas[6]),
-			sizeof(uint32_t));
+		/* serial, refresh, retry, expire and minimum */
+		memmove(p, rr_rdata_field(&z->soa_rrset->rrs[0], 2, NULL),
+			5*sizeof(uint32_t));
+		p += 5*sizeof(uint32_t);
+		/* the memory use of the zone, for zonestatus */
+		zone_get_mem_stat(z, &mem);
+		memmove(p, &mem, sizeof(mem));
 	}
 	udb_ptr_unlink(&e, udb);
 }
@@ -1527,7 +1871,9 @@ void task_remap(struct udb_base* taskudb)
 {
 	DEBUG(DEBUG_IPC,1, (LOG_INFO, "task remap %s size %d",
 		taskudb->fname, (int)taskudb->glob_data->fsize));
-	udb_base_remap_process(taskudb);
+	/* only when the other process has grown the file */
+	if(taskudb->glob_data->fsize != taskudb->base_size)
+		udb_base_remap_process(taskudb);
 }
 
 void task_clear(struct udb_base* taskudb)
@@ -1609,7 +1955,7 @@ void task_new_set_verbosity(udb_base* udb, udb_ptr* last, int v)
 
 #ifdef BIND8_STATS
 void* task_new_stat_info(udb_base* udb, udb_ptr* last, struct nsdst* stat,
-	size_t child_count)
+	size_t child_count, int stat_idx)
 {
 	void* p;
 	udb_ptr e;
@@ -1620,6 +1966,7 @@ void* task_new_stat_info(udb_base* udb, udb_ptr* last, struct nsdst* stat,
 		return NULL;
 	}
 	TASKLIST(&e)->task_type = task_stat_info;
+	TASKLIST(&e)->yesno = (uint64_t)stat_idx;
 	p = TASKLIST(&e)->zname;
 	memcpy(p, stat, sizeof(*stat));
 	udb_ptr_unlink(&e, udb);
@@ -1663,6 +2010,73 @@ task_new_del_zone(udb_base* udb, udb_ptr* last, const dname_type* dname)
 	udb_ptr_unlink(&e, udb);
 }
 
+/* one task for a batch of zones, the records are in data */
+static void
+task_new_zones(udb_base* udb, udb_ptr* last, int type, const uint8_t* data,
+	size_t len, size_t num)
+{
+	udb_ptr e;
+	if(!task_create_new_elem(udb, last, &e, sizeof(struct task_list_d)+
+		len, NULL)) {
+		log_msg(LOG_ERR, "tasklist: out of space, cannot add %s of "
+			"%u zones", type==task_add_zones?"addzones":"delzones",
+			(unsigned)num);
+		return;
+	}
+	TASKLIST(&e)->task_type = type;
+	TASKLIST(&e)->yesno = num;
+	memmove(TASKLIST(&e)->zname, data, len);
+	udb_ptr_unlink(&e, udb);
+}
+
+void
+task_new_add_zones(udb_base* udb, udb_ptr* last, const uint8_t* data,
+	size_t len, size_t num)
+{
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add task addzones %u", (unsigned)num));
+	task_new_zones(udb, last, task_add_zones, data, len, num);
+}
+
+void
+task_new_del_zones(udb_base* udb, udb_ptr* last, const uint8_t* data,
+	size_t len, size_t num)
+{
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add task delzones %u", (unsigned)num));
+	task_new_zones(udb, last, task_del_zones, data, len, num);
+}
+
+void
+task_new_catalog(udb_base* udb, udb_ptr* last, const dname_type* zone,
+	const uint8_t* data, size_t len, size_t num)
+{
+	udb_ptr e;
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add task catalog %u", (unsigned)num));
+	if(!task_create_new_elem(udb, last, &e, sizeof(struct task_list_d)+
+		dname_total_size(zone)+len, zone)) {
+		log_msg(LOG_ERR, "tasklist: out of space, cannot add catalog "
+			"of %u zones", (unsigned)num);
+		return;
+	}
+	TASKLIST(&e)->task_type = task_catalog;
+	TASKLIST(&e)->yesno = num;
+	if(len)
+		memmove(((uint8_t*)TASKLIST(&e)->zname)+dname_total_size(zone),
+			data, len);
+	udb_ptr_unlink(&e, udb);
+}
+
+void
+zone_batch_add(struct zone_batch* batch, const void* d, size_t len)
+{
+	if(batch->len + len > batch->cap) {
+		while(batch->len + len > batch->cap)
+			batch->cap = (batch->cap?batch->cap*2:4096);
+		batch->data = (uint8_t*)xrealloc(batch->data, batch->cap);
+	}
+	memmove(batch->data + batch->len, d, len);
+	batch->len += len;
+}
+
 void task_new_add_key(udb_base* udb, udb_ptr* last, key_options_t* key)
 {
 	char* p;
@@ -1777,9 +2191,25 @@ void task_new_zonestat_inc(udb_base* udb, udb_ptr* last, unsigned sz)
 	udb_ptr_unlink(&e, udb);
 }
 
+void task_new_reload_timing(udb_base* udb, udb_ptr* last,
+	struct reload_timing* rt)
+{
+	udb_ptr e;
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add task reload_timing"));
+	if(!task_create_new_elem(udb, last, &e, sizeof(struct task_list_d)+
+		sizeof(*rt), NULL)) {
+		log_msg(LOG_ERR, "tasklist: out of space, cannot add r_t");
+		return;
+	}
+	TASKLIST(&e)->task_type = task_reload_timing;
+	memcpy(TASKLIST(&e)->zname, rt, sizeof(*rt));
+	udb_ptr_unlink(&e, udb);
+}
+
 int
 task_new_apply_xfr(udb_base* udb, udb_ptr* last, const dname_type* dname,
-	uint32_t old_serial, uint32_t new_serial, uint64_t filenumber)
+	uint32_t old_serial, uint32_t new_serial, uint64_t filenumber,
+	int is_axfr)
 {
 	udb_ptr e;
 	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add task apply_xfr"));
@@ -1791,6 +2221,7 @@ task_new_apply_xfr(udb_base* udb, udb_ptr* last, const dname_type* dname,
 	TASKLIST(&e)->oldserial = old_serial;
 	TASKLIST(&e)->newserial = new_serial;
 	TASKLIST(&e)->yesno = filenumber;
+	TASKLIST(&e)->xfrflags = is_axfr?TASK_XFR_AXFR:0;
 	TASKLIST(&e)->task_type = task_apply_xfr;
 	udb_ptr_unlink(&e, udb);
 	return 1;
@@ -1858,14 +2289,14 @@ task_process_writezones(struct nsd* nsd, struct task_list_d* task)
 	}
 }
 
+/* add the zone, the names may be in the task udb, that can be remapped
+ * when the zonefile is read */
 static void
-task_process_add_zone(struct nsd* nsd, udb_base* udb, udb_ptr* last_task,
-	struct task_list_d* task)
+add_zone_in_reload(struct nsd* nsd, udb_base* udb, udb_ptr* last_task,
+	const char* zname, const char* pname, unsigned zonestatid)
 {
 	zone_type* z;
 	const dname_type* zdname;
-	const char* zname = (const char*)task->zname;
-	const char* pname = zname + strlen(zname)+1;
 	DEBUG(DEBUG_IPC,1, (LOG_INFO, "addzone task %s %s", zname, pname));
 	zdname = dname_parse(nsd->db->region, zname);
 	if(!zdname) {
@@ -1880,7 +2311,7 @@ task_process_add_zone(struct nsd* nsd, udb_base* udb, udb_ptr* last_task,
 		log_msg(LOG_ERR, "can not add zone %s %s", zname, pname);
 		return;
 	}
-	z->zonestatid = (unsigned)task->yesno;
+	z->zonestatid = zonestatid;
 	/* if zone is empty, attempt to read the zonefile from disk (if any) */
 	if(!z->soa_rrset && z->opts->pattern->zonefile) {
 		namedb_read_zonefile(nsd, z, udb, last_task);
@@ -1888,13 +2319,47 @@ task_process_add_zone(struct nsd* nsd, udb_base* udb, udb_ptr* last_task,
 }
 
 static void
-task_process_del_zone(struct nsd* nsd, struct task_list_d* task)
+task_process_add_zone(struct nsd* nsd, udb_base* udb, udb_ptr* last_task,
+	struct task_list_d* task)
+{
+	const char* zname = (const char*)task->zname;
+	const char* pname = zname + strlen(zname)+1;
+	add_zone_in_reload(nsd, udb, last_task, zname, pname,
+		(unsigned)task->yesno);
+}
+
+static void
+task_process_add_zones(struct nsd* nsd, udb_base* udb, udb_ptr* last_task,
+	udb_ptr* task)
+{
+	size_t off = 0, i, num = (size_t)TASKLIST(task)->yesno;
+	size_t len = TASKLIST(task)->size - sizeof(struct task_list_d);
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "addzones task %u", (unsigned)num));
+	for(i=0; i<num && off+sizeof(uint32_t) < len; i++) {
+		/* the task pointer is relocated if the udb is remapped */
+		const char* zname = (const char*)TASKLIST(task)->zname + off;
+		const char* pname;
+		uint32_t zonestatid;
+		size_t zlen, plen;
+		memmove(&zonestatid, zname, sizeof(zonestatid));
+		zname += sizeof(zonestatid);
+		zlen = strlen(zname);
+		pname = zname + zlen + 1;
+		plen = strlen(pname);
+		off += sizeof(zonestatid) + zlen + 1 + plen + 1;
+		add_zone_in_reload(nsd, udb, last_task, zname, pname,
+			(unsigned)zonestatid);
+	}
+}
+
+static void
+del_zone_in_reload(struct nsd* nsd, const dname_type* dname)
 {
 	zone_type* zone;
 	zone_options_t* zopt;
 	DEBUG(DEBUG_IPC,1, (LOG_INFO, "delzone task %s", dname_to_string(
-		task->zname, NULL)));
-	zone = namedb_find_zone(nsd->db, task->zname);
+		dname, NULL)));
+	zone = namedb_find_zone(nsd->db, dname);
 	if(!zone)
 		return;
 
@@ -1904,8 +2369,8 @@ task_process_del_zone(struct nsd* nsd, struct task_list_d* task)
 	delete_zone_rrs(nsd->db, zone);
 	if(nsd->db->udb) {
 		udb_ptr udbz;
-		if(udb_zone_search(nsd->db->udb, &udbz, dname_name(task->zname),
-			task->zname->name_size)) {
+		if(udb_zone_search(nsd->db->udb, &udbz, dname_name(dname),
+			dname->name_size)) {
 			udb_zone_delete(nsd->db->udb, &udbz);
 			udb_ptr_unlink(&udbz, nsd->db->udb);
 		}
@@ -1922,6 +2387,27 @@ task_process_del_zone(struct nsd* nsd, struct task_list_d* task)
 	zone_options_delete(nsd->options, zopt);
 }
 
+static void
+task_process_del_zone(struct nsd* nsd, struct task_list_d* task)
+{
+	del_zone_in_reload(nsd, task->zname);
+}
+
+static void
+task_process_del_zones(struct nsd* nsd, struct task_list_d* task)
+{
+	size_t off = 0, i, num = (size_t)task->yesno;
+	size_t len = task->size - sizeof(struct task_list_d);
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "delzones task %u", (unsigned)num));
+	/* deletion adds no tasks, the udb is not remapped */
+	for(i=0; i<num && off < len; i++) {
+		const dname_type* dname = (const dname_type*)
+			((uint8_t*)task->zname + off);
+		off += dname_total_size(dname);
+		del_zone_in_reload(nsd, dname);
+	}
+}
+
 static void
 task_process_add_key(struct nsd* nsd, struct task_list_d* task)
 {
@@ -1999,8 +2485,18 @@ task_process_apply_xfr(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
 	 * appends soa_info which may remap and change the pointer. */
 	zone_type* zone;
 	FILE* df;
+	uint64_t start = latency_clock();
 	DEBUG(DEBUG_IPC,1, (LOG_INFO, "applyxfr task %s", dname_to_string(
 		TASKLIST(task)->zname, NULL)));
+	if((TASKLIST(task)->xfrflags&TASK_XFR_SKIP)) {
+		/* an AXFR later in the tasklist replaces the zone */
+		VERBOSITY(2, (LOG_INFO, "zone %s serial %u is not applied, "
+			"a later AXFR replaces it", dname_to_string(
+			TASKLIST(task)->zname, NULL),
+			(unsigned)TASKLIST(task)->newserial));
+		xfrd_unlink_xfrfile(nsd, TASKLIST(task)->yesno);
+		return;
+	}
 	zone = namedb_find_zone(nsd->db, TASKLIST(task)->zname);
 	if(!zone) {
 		/* assume the zone has been deleted and a zone transfer was
@@ -2027,12 +2523,134 @@ task_process_apply_xfr(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
 
 	fclose(df);
 	xfrd_unlink_xfrfile(nsd, TASKLIST(task)->yesno);
+	reload_timing_zone(nsd, TASKLIST(task)->zname, latency_clock()-start);
 }
 
 
+int
+diff_xfrfile_committed(FILE* df)
+{
+	uint8_t committed;
+	if(pread(fileno(df), &committed, 1, 4) != 1)
+		return 0;
+	return committed != 0;
+}
+
+int
+diff_apply_xfrfile(struct nsd* nsd, zone_type* zone, uint64_t xfrfilenr)
+{
+	int ret;
+	FILE* df = xfrd_open_xfrfile(nsd, xfrfilenr, "r");
+	if(!df)
+		return 0;
+	ret = apply_ixfr_for_zone(nsd, zone, df, nsd->options, NULL, NULL,
+		xfrfilenr);
+	fclose(df);
+	return ret;
+}
+
+/* the last AXFR of a zone in the tasklist */
+struct task_last_axfr {
+	rbnode_t node;
+	/* the position of the task in the tasklist */
+	size_t num;
+};
+
+void
+task_coalesce_xfr(udb_base* udb, udb_ptr* task)
+{
+	region_type* temp = region_create(xalloc, free);
+	rbtree_t* last = rbtree_create(temp,
+		(int (*)(const void *, const void *)) dname_compare);
+	struct task_last_axfr* a;
+	udb_ptr t;
+	size_t num;
+	udb_ptr_init(&t, udb);
+
+	/* find the last committed AXFR of every zone */
+	udb_ptr_set_ptr(&t, udb, task);
+	for(num = 0; !udb_ptr_is_null(&t); num++) {
+		if(TASKLIST(&t)->task_type == task_apply_xfr &&
+			(TASKLIST(&t)->xfrflags&TASK_XFR_AXFR)) {
+			a = (struct task_last_axfr*)rbtree_search(last,
+				TASKLIST(&t)->zname);
+			if(!a) {
+				a = (struct task_last_axfr*)region_alloc(temp,
+					sizeof(*a));
+				a->node.key = dname_copy(temp,
+					TASKLIST(&t)->zname);
+				rbtree_insert(last, &a->node);
+			}
+			a->num = num;
+		}
+		udb_ptr_set_rptr(&t, udb, &TASKLIST(&t)->next);
+	}
+
+	/* the transfers before it are not applied, the zone never goes
+	 * through their versions */
+	if(last->count != 0) {
+		udb_ptr_set_ptr(&t, udb, task);
+		for(num = 0; !udb_ptr_is_null(&t); num++) {
+			if(TASKLIST(&t)->task_type == task_apply_xfr &&
+				(a = (struct task_last_axfr*)rbtree_search(last,
+				TASKLIST(&t)->zname)) && num < a->num)
+				TASKLIST(&t)->xfrflags |= TASK_XFR_SKIP;
+			udb_ptr_set_rptr(&t, udb, &TASKLIST(&t)->next);
+		}
+	}
+	udb_ptr_unlink(&t, udb);
+	region_destroy(temp);
+}
+
+/* bytes of xfr files that the reload reads ahead, a batch of large
+ * transfers does not push the zone data out of the page cache */
+#define XFR_PREFETCH_MAX (256*1024*1024)
+
+void
+task_prefetch_xfr(struct nsd* nsd, udb_base* udb, udb_ptr* task)
+{
+	udb_ptr t;
+	off_t total = 0;
+	udb_ptr_init(&t, udb);
+	udb_ptr_set_ptr(&t, udb, task);
+	while(!udb_ptr_is_null(&t) && total < XFR_PREFETCH_MAX) {
+		if(TASKLIST(&t)->task_type == task_apply_xfr &&
+			!(TASKLIST(&t)->xfrflags&TASK_XFR_SKIP))
+			total += xfrd_prefetch_xfrfile(nsd,
+				TASKLIST(&t)->yesno);
+		udb_ptr_set_rptr(&t, udb, &TASKLIST(&t)->next);
+	}
+	udb_ptr_unlink(&t, udb);
+}
+
+/** the tasks that change the nsd.db */
+static int
+task_changes_db(int type)
+{
+	return type == task_check_zonefiles || type == task_write_zonefiles ||
+		type == task_add_zone || type == task_del_zone ||
+		type == task_add_zones || type == task_del_zones ||
+		type == task_apply_xfr;
+}
+
 void task_process_in_reload(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
         udb_ptr* task)
 {
+	if(nsd->db->udb && nsd->db->udb->readonly &&
+		task_changes_db(TASKLIST(task)->task_type)) {
+		/* the nsd that publishes the image does this */
+		VERBOSITY(2, (LOG_INFO, "task %d ignored, the database is "
+			"read-only", (int)TASKLIST(task)->task_type));
+		if(TASKLIST(task)->task_type == task_apply_xfr)
+			xfrd_unlink_xfrfile(nsd, TASKLIST(task)->yesno);
+		udb_ptr_free_space(task, udb, TASKLIST(task)->size);
+		return;
+	}
+	/* the task works on the udb, the changes of the zone transfers
+	 * before it are written first */
+	if(task_changes_db(TASKLIST(task)->task_type) &&
+		TASKLIST(task)->task_type != task_apply_xfr)
+		(void)diff_udb_flush(nsd->db);
 	switch(TASKLIST(task)->task_type) {
 	case task_expire:
 		task_process_expire(nsd->db, TASKLIST(task));
@@ -2052,6 +2670,12 @@ void task_process_in_reload(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
 	case task_del_zone:
 		task_process_del_zone(nsd, TASKLIST(task));
 		break;
+	case task_add_zones:
+		task_process_add_zones(nsd, udb, last_task, task);
+		break;
+	case task_del_zones:
+		task_process_del_zones(nsd, TASKLIST(task));
+		break;
 	case task_add_key:
 		task_process_add_key(nsd, TASKLIST(task));
 		break;
@@ -15,6 +15,7 @@
 #include "udb.h"
 struct nsd;
 struct nsdst;
+struct reload_timing;
 
 #define DIFF_PART_XXFR ('X'<<24 | 'X'<<16 | 'F'<<8 | 'R')
 #define DIFF_PART_XFRF ('X'<<24 | 'F'<<16 | 'R'<<8 | 'F')
@@ -47,11 +48,23 @@ int delete_RR(namedb_type* db, const dname_type* dname,
 	uint16_t type, uint16_t klass,
 	buffer_type* packet, size_t rdatalen, zone_type *zone,
 	region_type* temp_region, struct udb_ptr* udbz, int* softfail);
-/* add an RR */
+/* add an RR, the owner is inserted with the cursor if it is not NULL */
 int add_RR(namedb_type* db, const dname_type* dname,
 	uint16_t type, uint16_t klass, uint32_t ttl,
 	buffer_type* packet, size_t rdatalen, zone_type *zone,
-	struct udb_ptr* udbz, int* softfail);
+	struct udb_ptr* udbz, int* softfail, struct domain_cursor* cursor);
+
+/*
+ * Write-behind of the udb.  While it is on, the RR changes of the zone
+ * transfers are made in memory and kept in a list, diff_udb_flush writes
+ * them to the udb in order, with one sync.  Reload turns it on for the
+ * tasks and flushes after the new servers run.
+ */
+void diff_udb_defer(int on);
+/* true if there are changes that are not in the udb yet */
+int diff_udb_pending(void);
+/* write the changes to the udb, returns the number of changes */
+size_t diff_udb_flush(namedb_type* db);
 
 /* task udb structure */
 struct task_list_d {
@@ -88,19 +101,40 @@ struct task_list_d {
 		/** options change */
 		task_opt_change,
 		/** zonestat increment */
-		task_zonestat_inc
+		task_zonestat_inc,
+		/** the timing of the phases of the reload */
+		task_reload_timing,
+		/** add a batch of zones, from addzones */
+		task_add_zones,
+		/** delete a batch of zones, from delzones */
+		task_del_zones,
+		/** the member zones of a catalog zone, for xfrd */
+		task_catalog
 	} task_type;
 	uint32_t size; /* size of this struct */
 
-	/** soainfo: zonename dname, soaRR wireform */
+	/** soainfo: zonename dname, soaRR wireform, zone_mem_stat */
 	/** expire: zonename, boolyesno */
-	/** apply_xfr: zonename, serials, yesno is filenamecounter */
+	/** apply_xfr: zonename, serials, yesno is filenamecounter,
+	 *  xfrflags */
+	/** stat_info: yesno is the stat_map block of the new servers */
+	/** reload_timing: the struct reload_timing */
+	/** add_zones: yesno is the count, uint32 zonestatid, zname, pname */
+	/** del_zones: yesno is the count, the dnames after another */
+	/** catalog: zonename of the catalog, yesno is the count, the
+	 *  dnames of the members after it */
 	uint32_t oldserial, newserial;
+	/** apply_xfr: TASK_XFR_AXFR and TASK_XFR_SKIP */
+	uint32_t xfrflags;
 	/** general variable.  for some used to see if zname is present. */
 	uint64_t yesno;
 	struct dname zname[0];
 };
 #define TASKLIST(ptr) ((struct task_list_d*)UDB_PTR(ptr))
+/** the xfr file of the apply_xfr task holds an AXFR, it is committed */
+#define TASK_XFR_AXFR 0x1
+/** a later AXFR in the tasklist replaces the zone, the task is skipped */
+#define TASK_XFR_SKIP 0x2
 /** create udb for tasks */
 struct udb_base* task_file_create(const char* file);
 void task_remap(udb_base* udb);
@@ -110,7 +144,7 @@ void task_new_soainfo(udb_base* udb, udb_ptr* last, struct zone* z, int gone);
 void task_new_expire(udb_base* udb, udb_ptr* last,
 	const struct dname* z, int expired);
 void* task_new_stat_info(udb_base* udb, udb_ptr* last, struct nsdst* stat,
-	size_t child_count);
+	size_t child_count, int stat_idx);
 void task_new_check_zonefiles(udb_base* udb, udb_ptr* last,
 	const dname_type* zone);
 void task_new_write_zonefiles(udb_base* udb, udb_ptr* last,
@@ -119,16 +153,49 @@ void task_new_set_verbosity(udb_base* udb, udb_ptr* last, int v);
 void task_new_add_zone(udb_base* udb, udb_ptr* last, const char* zone,
 	const char* pattern, unsigned zonestatid);
 void task_new_del_zone(udb_base* udb, udb_ptr* last, const dname_type* dname);
+void task_new_add_zones(udb_base* udb, udb_ptr* last, const uint8_t* data,
+	size_t len, size_t num);
+void task_new_del_zones(udb_base* udb, udb_ptr* last, const uint8_t* data,
+	size_t len, size_t num);
+void task_new_catalog(udb_base* udb, udb_ptr* last, const dname_type* zone,
+	const uint8_t* data, size_t len, size_t num);
+
+/** the records of the zones of a batch task, for addzones, delzones and
+ * the catalog members */
+struct zone_batch {
+	/** the task records */
+	uint8_t* data;
+	/** length and allocated size of data */
+	size_t len, cap;
+	/** number of zones */
+	size_t num;
+};
+/** append a record to the batch */
+void zone_batch_add(struct zone_batch* batch, const void* d, size_t len);
 void task_new_add_key(udb_base* udb, udb_ptr* last, key_options_t* key);
 void task_new_del_key(udb_base* udb, udb_ptr* last, const char* name);
 void task_new_add_pattern(udb_base* udb, udb_ptr* last, pattern_options_t* p);
 void task_new_del_pattern(udb_base* udb, udb_ptr* last, const char* name);
 void task_new_opt_change(udb_base* udb, udb_ptr* last, nsd_options_t* opt);
 void task_new_zonestat_inc(udb_base* udb, udb_ptr* last, unsigned sz);
+void task_new_reload_timing(udb_base* udb, udb_ptr* last,
+	struct reload_timing* rt);
 int task_new_apply_xfr(udb_base* udb, udb_ptr* last, const dname_type* zone,
-	uint32_t old_serial, uint32_t new_serial, uint64_t filenumber);
+	uint32_t old_serial, uint32_t new_serial, uint64_t filenumber,
+	int is_axfr);
 void task_process_in_reload(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
 	udb_ptr* task);
+/* skip the apply_xfr tasks from task onwards that are followed by an
+ * AXFR of the same zone */
+void task_coalesce_xfr(udb_base* udb, udb_ptr* task);
+/* start to read the xfr files of the apply_xfr tasks from task onwards */
+void task_prefetch_xfr(struct nsd* nsd, udb_base* udb, udb_ptr* task);
 void task_process_expire(namedb_type* db, struct task_list_d* task);
+/* apply the xfr file to the zone, without results for xfrd and without
+ * removing the file, for the server processes. returns false on failure */
+int diff_apply_xfrfile(struct nsd* nsd, zone_type* zone, uint64_t xfrfilenr);
+/* true if xfrd has committed the xfr file, false while it is still
+ * receiving the transfer, with xfrd-stream-apply */
+int diff_xfrfile_committed(FILE* df);
 
 #endif /* DIFFFILE_H */
@@ -17,11 +17,97 @@
 #include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "dns.h"
 #include "dname.h"
 #include "query.h"
 
+/* the range of characters that DNAME_NORMALIZE changes */
+#if defined(NAMEDB_UPPERCASE) || defined(USE_NAMEDB_UPPERCASE)
+#define DNAME_FOLD_FIRST 'a'
+#define DNAME_FOLD_LAST 'z'
+#else
+#define DNAME_FOLD_FIRST 'A'
+#define DNAME_FOLD_LAST 'Z'
+#endif
+/* the byte x in all 8 bytes of a word */
+#define DNAME_BYTES8(x) (((uint64_t)(x)) * (uint64_t)0x0101010101010101ULL)
+
+/* load 8 bytes, unaligned */
+static inline uint64_t
+load_word(const uint8_t* p)
+{
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+/*
+ * Normalize the 8 characters in the word, like DNAME_NORMALIZE, all at
+ * once.  The top bit of a byte is set in the sums when it is at or past
+ * the start and end of the range; bytes over 0x7f are never changed.
+ */
+static inline uint64_t
+word_normalize(uint64_t w)
+{
+	uint64_t low = w & DNAME_BYTES8(0x7f);
+	uint64_t in = (low + DNAME_BYTES8(0x80 - DNAME_FOLD_FIRST))
+		& ~(low + DNAME_BYTES8(0x80 - DNAME_FOLD_LAST - 1))
+		& ~w & DNAME_BYTES8(0x80);
+	return w ^ (in >> 2);
+}
+
+/* see if len bytes at a and b are equal, after DNAME_NORMALIZE */
+static int
+data_equal_nocase(const uint8_t* a, const uint8_t* b, size_t len)
+{
+#ifdef __SSE2__
+	const __m128i first = _mm_set1_epi8(DNAME_FOLD_FIRST - 1);
+	const __m128i last = _mm_set1_epi8(DNAME_FOLD_LAST + 1);
+	const __m128i fold = _mm_set1_epi8(0x20);
+	while(len >= 16) {
+		/* the signed compares leave out the bytes over 0x7f */
+		__m128i x = _mm_loadu_si128((const __m128i*)a);
+		__m128i y = _mm_loadu_si128((const __m128i*)b);
+		x = _mm_xor_si128(x, _mm_and_si128(fold, _mm_and_si128(
+			_mm_cmpgt_epi8(x, first), _mm_cmpgt_epi8(last, x))));
+		y = _mm_xor_si128(y, _mm_and_si128(fold, _mm_and_si128(
+			_mm_cmpgt_epi8(y, first), _mm_cmpgt_epi8(last, y))));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+			return 0;
+		a += 16;
+		b += 16;
+		len -= 16;
+	}
+#endif /* __SSE2__ */
+	while(len >= sizeof(uint64_t)) {
+		if(word_normalize(load_word(a)) != word_normalize(load_word(b)))
+			return 0;
+		a += sizeof(uint64_t);
+		b += sizeof(uint64_t);
+		len -= sizeof(uint64_t);
+	}
+	while(len > 0) {
+		if(DNAME_NORMALIZE(*a++) != DNAME_NORMALIZE(*b++))
+			return 0;
+		len--;
+	}
+	return 1;
+}
+
+/* see if the labels are equal, the length byte and the characters, in
+ * one memcmp; the ordering of label_compare is only needed when not */
+static inline int
+label_equal(const uint8_t *left, const uint8_t *right)
+{
+	assert(label_is_normal(left));
+	assert(label_is_normal(right));
+	return memcmp(left, right, (size_t)label_length(left) + 1) == 0;
+}
+
 const dname_type *
 dname_make(region_type *region, const uint8_t *name, int normalize)
 {
@@ -294,8 +380,7 @@ dname_is_subdomain(const dname_type *left, const dname_type *right)
 		return 0;
 
 	for (i = 1; i < right->label_count; ++i) {
-		if (label_compare(dname_label(left, i),
-				  dname_label(right, i)) != 0)
+		if (!label_equal(dname_label(left, i), dname_label(right, i)))
 			return 0;
 	}
 
@@ -375,8 +460,7 @@ dname_label_match_count(const dname_type *left, const dname_type *right)
 	assert(right);
 
 	for (i = 1; i < left->label_count && i < right->label_count; ++i) {
-		if (label_compare(dname_label(left, i),
-				  dname_label(right, i)) != 0)
+		if (!label_equal(dname_label(left, i), dname_label(right, i)))
 		{
 			return i;
 		}
@@ -388,7 +472,7 @@ dname_label_match_count(const dname_type *left, const dname_type *right)
 const char *
 dname_to_string(const dname_type *dname, const dname_type *origin)
 {
-	static char buf[MAXDOMAINLEN * 5];
+	static NSD_THREAD_LOCAL char buf[MAXDOMAINLEN * 5];
 	size_t i;
 	size_t labels_to_convert = dname->label_count - 1;
 	int absolute = 1;
@@ -504,7 +588,7 @@ dname_replace(region_type* region,
 
 char* wirelabel2str(const uint8_t* label)
 {
-	static char buf[MAXDOMAINLEN*5+3];
+	static NSD_THREAD_LOCAL char buf[MAXDOMAINLEN*5+3];
 	char* p = buf;
 	uint8_t lablen;
 	lablen = *label++;
@@ -526,7 +610,7 @@ char* wirelabel2str(const uint8_t* label)
 
 char* wiredname2str(const uint8_t* dname)
 {
-	static char buf[MAXDOMAINLEN*5+3];
+	static NSD_THREAD_LOCAL char buf[MAXDOMAINLEN*5+3];
 	char* p = buf;
 	uint8_t lablen;
 	if(*dname == 0) {
@@ -556,23 +640,18 @@ char* wiredname2str(const uint8_t* dname)
 
 int dname_equal_nocase(uint8_t* a, uint8_t* b, uint16_t len)
 {
-	uint8_t i, lablen;
-	while(len > 0) {
-		/* check labellen */
-		if(*a != *b)
-			return 0;
-		lablen = *a++;
-		b++;
-		len--;
-		/* malformed or compression ptr; we stop scanning */
-		if((lablen & 0xc0) || len < lablen)
-			return (memcmp(a, b, len) == 0);
-		/* check the label, lowercased */
-		for(i=0; i<lablen; i++) {
-			if(DNAME_NORMALIZE((unsigned char)*a++) != DNAME_NORMALIZE((unsigned char)*b++))
-				return 0;
-		}
-		len -= lablen;
+	/* the length bytes are below 0x40 and not changed by the case
+	 * folding, so the labels are compared in one go, up to the end
+	 * of the name or a malformed label or compression ptr */
+	uint16_t end = 0;
+	while(end < len) {
+		uint8_t lablen = a[end];
+		if((lablen & 0xc0) || len - end - 1 < lablen)
+			break;
+		end += 1 + lablen;
 	}
-	return 1;
+	if(!data_equal_nocase(a, b, end))
+		return 0;
+	/* we stop scanning, the rest must be equal */
+	return (memcmp(a+end, b+end, len-end) == 0);
 }
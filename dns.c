@@ -778,7 +778,7 @@ rrtype_descriptor_by_name(const char *name)
 const char *
 rrtype_to_string(uint16_t rrtype)
 {
-	static char buf[20];
+	static NSD_THREAD_LOCAL char buf[20];
 	rrtype_descriptor_type *descriptor = rrtype_descriptor_by_type(rrtype);
 	if (descriptor->name) {
 		return descriptor->name;
@@ -907,7 +907,7 @@ rrtype_from_string(const char *name)
 const char *
 rrclass_to_string(uint16_t rrclass)
 {
-	static char buf[20];
+	static NSD_THREAD_LOCAL char buf[20];
 	lookup_table_type *entry = lookup_by_id(dns_rrclasses, rrclass);
 	if (entry) {
 		assert(strlen(entry->name) < sizeof(buf));
@@ -0,0 +1,578 @@
+/*
+ * dnstap.c -- dnstap logging of queries and answers.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#ifdef USE_DNSTAP
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef USE_MINI_EVENT
+#  ifdef HAVE_EVENT_H
+#    include <event.h>
+#  else
+#    include <event2/event.h>
+#    include "event2/event_struct.h"
+#    include "event2/event_compat.h"
+#  endif
+#else
+#  include "mini_event.h"
+#endif
+#include "dnstap.h"
+#include "nsd.h"
+#include "query.h"
+#include "options.h"
+#include "util.h"
+
+/* the content type of the frame stream */
+#define DT_CONTENT_TYPE "protobuf:dnstap.Dnstap"
+/* frame streams control frames and fields */
+#define FSTRM_CONTROL_ACCEPT 1
+#define FSTRM_CONTROL_START 2
+#define FSTRM_CONTROL_STOP 3
+#define FSTRM_CONTROL_READY 4
+#define FSTRM_CONTROL_FIELD_CONTENT_TYPE 1
+/* dnstap protobuf values */
+#define DNSTAP_TYPE_MESSAGE 1
+#define DNSTAP_FAMILY_INET 1
+#define DNSTAP_FAMILY_INET6 2
+#define DNSTAP_PROTOCOL_UDP 1
+#define DNSTAP_PROTOCOL_TCP 2
+
+/* msec between the times that xfrd empties the rings */
+#define DT_WRITE_MSEC 100
+/* seconds before a failed socket is connected again */
+#define DT_RECONNECT 5
+/* the output buffer holds many frames, it is written at once */
+#define DT_OUT_SIZE 65536
+/* longest identity and version that are sent */
+#define DT_ID_MAX 255
+/* largest frame of a record, the message and the other fields */
+#define DT_FRAME_MAX (DNSTAP_MSG_MAX + 2*DT_ID_MAX + 128)
+
+/* states of the output */
+#define DT_CLOSED 0
+#define DT_WAIT_ACCEPT 1
+#define DT_RUNNING 2
+
+struct dt_writer {
+	struct nsd* nsd;
+	int fd;
+	int state;
+	/* when the socket is connected again */
+	time_t retry;
+	struct event timer;
+	struct event_base* base;
+	/* frames that are not written yet, from out_pos to out_len */
+	uint8_t* out;
+	size_t out_pos, out_len;
+	/* the ACCEPT frame that is read from the socket */
+	uint8_t in[256];
+	size_t in_len;
+	/* dropped records that were logged, and when */
+	uint64_t dropped;
+	time_t dropped_logged;
+	const char* id;
+	size_t id_len;
+	const char* version;
+	size_t version_len;
+};
+
+/* bytes of a ring with n records */
+static size_t
+dt_ring_bytes(size_t n)
+{
+	return (offsetof(struct dt_ring, rec) + n*sizeof(struct dt_record)
+		+ 63) & ~((size_t)63);
+}
+
+void
+dt_alloc(struct nsd* nsd)
+{
+#ifdef HAVE_MMAP
+	size_t n = 16, sz;
+	int i;
+#endif
+	nsd->dt_map[0] = NULL;
+	nsd->dt_map[1] = NULL;
+	nsd->dt_idx = 0;
+	nsd->dt_ring = NULL;
+	if(!nsd->options->dnstap_enable)
+		return;
+	if(!nsd->options->dnstap_socket_path && !nsd->options->dnstap_file) {
+		log_msg(LOG_ERR, "dnstap: no dnstap-socket-path or "
+			"dnstap-file, nothing is logged");
+		return;
+	}
+#ifdef HAVE_MMAP
+	while(n < (size_t)nsd->options->dnstap_ring_size)
+		n <<= 1;
+	nsd->dt_size = n;
+	sz = dt_ring_bytes(n)*(nsd->child_count?nsd->child_count:1);
+	/* anonymous shared memory, zeroed, like the stat_map it is
+	 * inherited by xfrd and the server processes */
+	for(i=0; i<2; i++) {
+		nsd->dt_map[i] = (char*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if(nsd->dt_map[i] == MAP_FAILED) {
+			log_msg(LOG_ERR, "dnstap: mmap failed: %s",
+				strerror(errno));
+			nsd->dt_map[i] = NULL;
+			if(i == 1) {
+				munmap(nsd->dt_map[0], sz);
+				nsd->dt_map[0] = NULL;
+			}
+			return;
+		}
+	}
+#else
+	log_msg(LOG_ERR, "dnstap: no mmap, dnstap is not available");
+#endif /* HAVE_MMAP */
+}
+
+struct dt_ring*
+dt_ring(struct nsd* nsd, int idx, size_t num)
+{
+	return (struct dt_ring*)(nsd->dt_map[idx] +
+		num*dt_ring_bytes(nsd->dt_size));
+}
+
+/* put the packet of the query in the ring, as type */
+static void
+dt_put(struct nsd* nsd, struct query* q, int type)
+{
+	struct dt_ring* r = nsd->dt_ring;
+	uint64_t head = r->head;
+	struct dt_record* rec;
+	size_t len = buffer_limit(q->packet);
+	struct sockaddr* sa = (struct sockaddr*)&q->addr;
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+#else
+	struct timeval tv;
+#endif
+
+	if(head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >=
+		nsd->dt_size) {
+		/* full, the server does not wait for xfrd */
+		__atomic_store_n(&r->dropped, r->dropped+1, __ATOMIC_RELAXED);
+		return;
+	}
+	rec = &r->rec[head & (nsd->dt_size-1)];
+#ifdef HAVE_CLOCK_GETTIME
+	if(clock_gettime(CLOCK_REALTIME, &ts) != 0)
+		memset(&ts, 0, sizeof(ts));
+	rec->sec = (uint64_t)ts.tv_sec;
+	rec->nsec = (uint32_t)ts.tv_nsec;
+#else
+	if(gettimeofday(&tv, NULL) != 0)
+		memset(&tv, 0, sizeof(tv));
+	rec->sec = (uint64_t)tv.tv_sec;
+	rec->nsec = (uint32_t)tv.tv_usec*1000;
+#endif
+	rec->type = (uint8_t)type;
+	rec->tcp = (uint8_t)q->tcp;
+	rec->family = (uint8_t)sa->sa_family;
+#ifdef INET6
+	if(sa->sa_family == AF_INET6) {
+		struct sockaddr_in6* s6 = (struct sockaddr_in6*)sa;
+		memcpy(rec->addr, &s6->sin6_addr, 16);
+		rec->port = ntohs(s6->sin6_port);
+	} else
+#endif
+	{
+		struct sockaddr_in* s4 = (struct sockaddr_in*)sa;
+		rec->family = AF_INET;
+		memcpy(rec->addr, &s4->sin_addr, 4);
+		rec->port = ntohs(s4->sin_port);
+	}
+	if(len <= DNSTAP_MSG_MAX) {
+		memcpy(rec->msg, buffer_begin(q->packet), len);
+		rec->len = (uint16_t)len;
+	} else	rec->len = 0;
+	__atomic_store_n(&r->head, head+1, __ATOMIC_RELEASE);
+}
+
+void
+dt_query(struct nsd* nsd, struct query* q)
+{
+	struct dt_ring* r = nsd->dt_ring;
+	if(r->sample > 0) {
+		r->sample--;
+		return;
+	}
+	if(nsd->options->dnstap_sample > 1)
+		r->sample = (uint32_t)nsd->options->dnstap_sample - 1;
+	q->dnstap = 1;
+	if(nsd->options->dnstap_log_auth_query_messages)
+		dt_put(nsd, q, DNSTAP_AUTH_QUERY);
+}
+
+void
+dt_response(struct nsd* nsd, struct query* q)
+{
+	/* once, also if the answer is an AXFR of many packets */
+	q->dnstap = 0;
+	if(nsd->options->dnstap_log_auth_response_messages)
+		dt_put(nsd, q, DNSTAP_AUTH_RESPONSE);
+}
+
+/* protobuf encoding, p has room for the field */
+static uint8_t*
+pb_varint(uint8_t* p, uint64_t v)
+{
+	while(v >= 0x80) {
+		*p++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static uint8_t*
+pb_uint(uint8_t* p, int field, uint64_t v)
+{
+	p = pb_varint(p, (uint64_t)(field<<3));
+	return pb_varint(p, v);
+}
+
+static uint8_t*
+pb_fixed32(uint8_t* p, int field, uint32_t v)
+{
+	p = pb_varint(p, (uint64_t)((field<<3) | 5));
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v>>8);
+	p[2] = (uint8_t)(v>>16);
+	p[3] = (uint8_t)(v>>24);
+	return p+4;
+}
+
+static uint8_t*
+pb_bytes(uint8_t* p, int field, const void* d, size_t len)
+{
+	p = pb_varint(p, (uint64_t)((field<<3) | 2));
+	p = pb_varint(p, (uint64_t)len);
+	memcpy(p, d, len);
+	return p+len;
+}
+
+/* encode the record as a frame at p, returns the length of the frame */
+static size_t
+dt_encode(struct dt_writer* dt, struct dt_record* rec, uint8_t* p)
+{
+	uint8_t msg[DNSTAP_MSG_MAX + 128];
+	uint8_t* m = msg;
+	uint8_t* f = p + 4;
+	int query = (rec->type == DNSTAP_AUTH_QUERY);
+
+	/* the Message */
+	m = pb_uint(m, 1, rec->type);
+	m = pb_uint(m, 2, rec->family == AF_INET?DNSTAP_FAMILY_INET:
+		DNSTAP_FAMILY_INET6);
+	m = pb_uint(m, 3, rec->tcp?DNSTAP_PROTOCOL_TCP:DNSTAP_PROTOCOL_UDP);
+	m = pb_bytes(m, 4, rec->addr, rec->family == AF_INET?4:16);
+	m = pb_uint(m, 6, rec->port);
+	m = pb_uint(m, query?8:12, rec->sec);
+	m = pb_fixed32(m, query?9:13, rec->nsec);
+	if(rec->len)
+		m = pb_bytes(m, query?10:14, rec->msg, rec->len);
+
+	/* the Dnstap around it */
+	if(dt->id_len)
+		f = pb_bytes(f, 1, dt->id, dt->id_len);
+	f = pb_bytes(f, 2, dt->version, dt->version_len);
+	f = pb_bytes(f, 14, msg, (size_t)(m - msg));
+	f = pb_uint(f, 15, DNSTAP_TYPE_MESSAGE);
+	write_uint32(p, (uint32_t)(f - p - 4));
+	return (size_t)(f - p);
+}
+
+/* append a control frame, with the content type if content */
+static void
+dt_control(struct dt_writer* dt, uint32_t type, int content)
+{
+	uint8_t* p = dt->out + dt->out_len;
+	size_t ctlen = strlen(DT_CONTENT_TYPE);
+	size_t len = 4 + (content?8+ctlen:0);
+	write_uint32(p, 0); /* escape, this is a control frame */
+	write_uint32(p+4, (uint32_t)len);
+	write_uint32(p+8, type);
+	if(content) {
+		write_uint32(p+12, FSTRM_CONTROL_FIELD_CONTENT_TYPE);
+		write_uint32(p+16, (uint32_t)ctlen);
+		memcpy(p+20, DT_CONTENT_TYPE, ctlen);
+	}
+	dt->out_len += 8 + len;
+}
+
+static void
+dt_fail(struct dt_writer* dt)
+{
+	if(dt->fd != -1)
+		close(dt->fd);
+	dt->fd = -1;
+	dt->state = DT_CLOSED;
+	dt->out_pos = 0;
+	dt->out_len = 0;
+	dt->in_len = 0;
+	dt->retry = time(NULL) + DT_RECONNECT;
+}
+
+/* write the output, returns false if it is not all written */
+static int
+dt_flush(struct dt_writer* dt)
+{
+	while(dt->out_pos < dt->out_len) {
+		ssize_t r = write(dt->fd, dt->out + dt->out_pos,
+			dt->out_len - dt->out_pos);
+		if(r == -1) {
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			log_msg(LOG_ERR, "dnstap: write failed: %s",
+				strerror(errno));
+			dt_fail(dt);
+			return 0;
+		}
+		dt->out_pos += (size_t)r;
+	}
+	dt->out_pos = 0;
+	dt->out_len = 0;
+	return 1;
+}
+
+/* connect to dnstap-socket-path and send READY */
+static void
+dt_connect(struct dt_writer* dt)
+{
+	const char* path = dt->nsd->options->dnstap_socket_path;
+	struct sockaddr_un addr;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		log_msg(LOG_ERR, "dnstap: socket path too long: %s", path);
+		dt->retry = (time_t)-1;
+		return;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+	if((dt->fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		log_msg(LOG_ERR, "dnstap: socket failed: %s", strerror(errno));
+		dt_fail(dt);
+		return;
+	}
+	if(connect(dt->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		VERBOSITY(2, (LOG_INFO, "dnstap: connect %s failed: %s",
+			path, strerror(errno)));
+		dt_fail(dt);
+		return;
+	}
+	if(fcntl(dt->fd, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "dnstap: fcntl failed: %s", strerror(errno));
+		dt_fail(dt);
+		return;
+	}
+	dt_control(dt, FSTRM_CONTROL_READY, 1);
+	dt->state = DT_WAIT_ACCEPT;
+	dt_flush(dt);
+}
+
+/* read the ACCEPT of the collector, then send START */
+static void
+dt_read_accept(struct dt_writer* dt)
+{
+	ssize_t r = read(dt->fd, dt->in + dt->in_len,
+		sizeof(dt->in) - dt->in_len);
+	uint32_t len;
+	if(r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+		errno == EINTR))
+		return;
+	if(r <= 0) {
+		log_msg(LOG_ERR, "dnstap: read failed: %s",
+			r==0?"closed":strerror(errno));
+		dt_fail(dt);
+		return;
+	}
+	dt->in_len += (size_t)r;
+	if(dt->in_len < 12)
+		return;
+	len = read_uint32(dt->in+4);
+	if(read_uint32(dt->in) != 0 || len < 4 || len > sizeof(dt->in)-8) {
+		log_msg(LOG_ERR, "dnstap: bad control frame from collector");
+		dt_fail(dt);
+		return;
+	}
+	if(dt->in_len < 8 + len)
+		return;
+	if(read_uint32(dt->in+8) != FSTRM_CONTROL_ACCEPT) {
+		log_msg(LOG_ERR, "dnstap: collector did not accept");
+		dt_fail(dt);
+		return;
+	}
+	dt->in_len = 0;
+	dt_control(dt, FSTRM_CONTROL_START, 1);
+	dt->state = DT_RUNNING;
+	VERBOSITY(1, (LOG_INFO, "dnstap: connected to %s",
+		dt->nsd->options->dnstap_socket_path));
+}
+
+/* encode the records of one ring, returns false if the output is full */
+static int
+dt_drain_ring(struct dt_writer* dt, struct dt_ring* r)
+{
+	uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = r->tail;
+	int ok = 1;
+	while(tail < head) {
+		if(dt->out_len + DT_FRAME_MAX > DT_OUT_SIZE) {
+			__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+			if(!dt_flush(dt)) {
+				ok = 0;
+				break;
+			}
+		}
+		dt->out_len += dt_encode(dt,
+			&r->rec[tail & (dt->nsd->dt_size-1)],
+			dt->out + dt->out_len);
+		tail++;
+	}
+	/* the server can use the records again */
+	__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	return ok;
+}
+
+/* write out what the servers put in the rings */
+static void
+dt_drain(struct dt_writer* dt)
+{
+	struct nsd* nsd = dt->nsd;
+	size_t n = nsd->child_count?nsd->child_count:1, i;
+	uint64_t dropped = 0;
+	int idx;
+	if(!dt_flush(dt))
+		return;
+	for(idx=0; idx<2; idx++) {
+		for(i=0; i<n; i++) {
+			struct dt_ring* r = dt_ring(nsd, idx, i);
+			dropped += __atomic_load_n(&r->dropped,
+				__ATOMIC_RELAXED);
+			if(dt->state == DT_RUNNING && !dt_drain_ring(dt, r))
+				return;
+		}
+	}
+	if(dt->state == DT_RUNNING)
+		dt_flush(dt);
+	if(dropped > dt->dropped && time(NULL) >= dt->dropped_logged + 60) {
+		log_msg(LOG_WARNING, "dnstap: %u records dropped, the "
+			"output is too slow", (unsigned)(dropped - dt->dropped));
+		dt->dropped = dropped;
+		dt->dropped_logged = time(NULL);
+	}
+}
+
+static void dt_timer_set(struct dt_writer* dt);
+
+static void
+dt_handle_timer(int ATTR_UNUSED(fd), short event, void* arg)
+{
+	struct dt_writer* dt = (struct dt_writer*)arg;
+	(void)event;
+	if(dt->state == DT_CLOSED && dt->nsd->options->dnstap_socket_path &&
+		dt->retry != (time_t)-1 && time(NULL) >= dt->retry)
+		dt_connect(dt);
+	if(dt->state == DT_WAIT_ACCEPT && dt_flush(dt))
+		dt_read_accept(dt);
+	if(dt->state == DT_RUNNING)
+		dt_drain(dt);
+	dt_timer_set(dt);
+}
+
+static void
+dt_timer_set(struct dt_writer* dt)
+{
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = DT_WRITE_MSEC*1000;
+	event_set(&dt->timer, -1, EV_TIMEOUT, dt_handle_timer, dt);
+	if(event_base_set(dt->base, &dt->timer) != 0)
+		log_msg(LOG_ERR, "dnstap timer: event_base_set failed");
+	if(event_add(&dt->timer, &tv) != 0)
+		log_msg(LOG_ERR, "dnstap timer: event_add failed");
+}
+
+struct dt_writer*
+dt_writer_create(region_type* region, struct nsd* nsd,
+	struct event_base* base)
+{
+	struct dt_writer* dt;
+	const char* file = nsd->options->dnstap_file;
+	if(!nsd->dt_map[0] || !nsd->dt_map[1])
+		return NULL;
+	dt = (struct dt_writer*)region_alloc_zero(region, sizeof(*dt));
+	dt->nsd = nsd;
+	dt->fd = -1;
+	dt->base = base;
+	dt->out = (uint8_t*)region_alloc(region, DT_OUT_SIZE);
+	dt->id = nsd->identity?nsd->identity:"";
+	dt->id_len = strlen(dt->id);
+	if(dt->id_len > DT_ID_MAX)
+		dt->id_len = DT_ID_MAX;
+	dt->version = "nsd " PACKAGE_VERSION;
+	dt->version_len = strlen(dt->version);
+
+	if(nsd->options->dnstap_socket_path) {
+		dt_connect(dt);
+	} else {
+		/* a file has no handshake, it is a new stream every start */
+		dt->fd = open(file, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if(dt->fd == -1) {
+			log_msg(LOG_ERR, "dnstap: cannot open %s: %s", file,
+				strerror(errno));
+			dt->retry = (time_t)-1;
+		} else {
+			dt_control(dt, FSTRM_CONTROL_START, 1);
+			dt->state = DT_RUNNING;
+		}
+	}
+	dt_timer_set(dt);
+	return dt;
+}
+
+void
+dt_writer_close(struct dt_writer* dt)
+{
+	if(!dt)
+		return;
+	event_del(&dt->timer);
+	if(dt->state != DT_RUNNING) {
+		dt_fail(dt);
+		return;
+	}
+	/* the last records, and STOP, written out with a blocking fd */
+	if(dt->nsd->options->dnstap_socket_path)
+		(void)fcntl(dt->fd, F_SETFL, 0);
+	dt_drain(dt);
+	if(dt->state == DT_RUNNING) {
+		dt_control(dt, FSTRM_CONTROL_STOP, 0);
+		dt_flush(dt);
+	}
+	dt_fail(dt);
+}
+
+#endif /* USE_DNSTAP */
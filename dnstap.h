@@ -0,0 +1,93 @@
+/*
+ * dnstap.h -- dnstap logging of queries and answers.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef DNSTAP_H
+#define DNSTAP_H
+
+#ifdef USE_DNSTAP
+struct nsd;
+struct query;
+struct event_base;
+struct region;
+
+/** largest message that is logged, the message is left out if longer */
+#define DNSTAP_MSG_MAX 1232
+
+/** record types, the dnstap Message.Type values */
+#define DNSTAP_AUTH_QUERY 1
+#define DNSTAP_AUTH_RESPONSE 2
+
+/** A query or answer in the ring, filled in by the server */
+struct dt_record {
+	uint64_t sec;
+	uint32_t nsec;
+	/* length of msg, 0 if the message was too long */
+	uint16_t len;
+	/* port of the client */
+	uint16_t port;
+	uint8_t type;
+	uint8_t tcp;
+	/* AF_INET or AF_INET6, and the address of the client */
+	uint8_t family;
+	uint8_t addr[16];
+	uint8_t msg[DNSTAP_MSG_MAX];
+};
+
+/**
+ * The ring of a server, in shared memory.  The server is the only
+ * writer of head, and xfrd is the only writer of tail.  Records from
+ * tail up to head are filled in and not yet written out.  The server
+ * does not wait for xfrd, if the ring is full the record is dropped.
+ */
+struct dt_ring {
+	uint64_t head;
+	/* records dropped because the ring was full */
+	uint64_t dropped;
+	/* the server logs one in dnstap-sample queries, counts down */
+	uint32_t sample;
+	uint8_t pad1[64 - 2*sizeof(uint64_t) - sizeof(uint32_t)];
+	uint64_t tail;
+	uint8_t pad2[64 - sizeof(uint64_t)];
+	struct dt_record rec[1];
+};
+
+/** The dnstap output of xfrd, that empties the rings */
+struct dt_writer;
+
+/**
+ * Allocate the rings for the servers, in two blocks like the stat_map,
+ * the new servers after a reload use the other block.  Before the fork
+ * of xfrd.  Does nothing if dnstap-enable is off.
+ */
+void dt_alloc(struct nsd* nsd);
+
+/** The ring of server num in block idx */
+struct dt_ring* dt_ring(struct nsd* nsd, int idx, size_t num);
+
+/**
+ * Put the query in the ring, if it is sampled, before it is answered.
+ * Marks the query, so that the answer is logged too.
+ */
+void dt_query(struct nsd* nsd, struct query* q);
+
+/** Put the answer in the ring, for a query that dt_query marked */
+void dt_response(struct nsd* nsd, struct query* q);
+
+/**
+ * Create the writer in xfrd, it opens dnstap-socket-path or
+ * dnstap-file, and empties the rings on a timer.
+ */
+struct dt_writer* dt_writer_create(struct region* region, struct nsd* nsd,
+	struct event_base* base);
+
+/** Write out what is in the rings, and close the output */
+void dt_writer_close(struct dt_writer* dt);
+
+#endif /* USE_DNSTAP */
+#endif /* DNSTAP_H */
@@ -55,6 +55,9 @@ edns_init_record(edns_record_type *edns)
 	edns->maxlen = 0;
 	edns->dnssec_ok = 0;
 	edns->nsid = 0;
+	edns->cookie_status = COOKIE_NOT_PRESENT;
+	edns->cookie_len = 0;
+	edns->keepalive = 0;
 }
 
 int
@@ -67,7 +70,9 @@ edns_parse_record(edns_record_type *edns, buffer_type *packet)
 	uint8_t  opt_version;
 	uint16_t opt_flags;
 	uint16_t opt_rdlen;
-	uint16_t opt_nsid;
+	uint16_t opt_code;
+	uint16_t opt_len;
+	size_t   opt_end;
 
 	edns->position = buffer_position(packet);
 
@@ -94,13 +99,36 @@ edns_parse_record(edns_record_type *edns, buffer_type *packet)
 		return 1;
 	}
 
-	if (opt_rdlen > 0) {
-		/* there is more to come, read opt code
-		 * should be NSID - there are no others */
-		opt_nsid = buffer_read_u16(packet);
-		edns->nsid = (opt_nsid == NSID_CODE);
-		/* extra check for the value */
+	if (!buffer_available(packet, opt_rdlen))
+		return 0;
+	opt_end = buffer_position(packet) + opt_rdlen;
+	while (buffer_position(packet) + OPT_HDR <= opt_end) {
+		opt_code = buffer_read_u16(packet);
+		opt_len = buffer_read_u16(packet);
+		if (buffer_position(packet) + opt_len > opt_end)
+			return 0;
+		if (opt_code == NSID_CODE) {
+			edns->nsid = 1;
+		} else if (opt_code == COOKIE_CODE) {
+			/* only a client cookie, or with a server cookie of
+			 * 8 to 32 bytes, else it is malformed (FORMERR) */
+			if (opt_len != COOKIE_CLIENT_LEN &&
+				(opt_len < COOKIE_CLIENT_LEN + 8 ||
+				opt_len > COOKIE_MAX_LEN))
+				return 0;
+			buffer_read(packet, edns->cookie, opt_len);
+			edns->cookie_len = opt_len;
+			edns->cookie_status = COOKIE_UNVERIFIED;
+			continue;
+		} else if (opt_code == KEEPALIVE_CODE) {
+			/* the query has no timeout */
+			if (opt_len != 0)
+				return 0;
+			edns->keepalive = 1;
+		}
+		buffer_skip(packet, opt_len);
 	}
+	buffer_set_position(packet, opt_end);
 
 	edns->status = EDNS_OK;
 	edns->maxlen = opt_class;
@@ -111,6 +139,120 @@ edns_parse_record(edns_record_type *edns, buffer_type *packet)
 size_t
 edns_reserved_space(edns_record_type *edns)
 {
+	size_t space = OPT_LEN + OPT_RDATA;
 	/* MIEK; when a pkt is too large?? */
-	return edns->status == EDNS_NOT_PRESENT ? 0 : (OPT_LEN + OPT_RDATA);
+	if (edns->status == EDNS_NOT_PRESENT)
+		return 0;
+	/* the cookie and keepalive options of the answer */
+	if (edns->cookie_status != COOKIE_NOT_PRESENT)
+		space += OPT_HDR + COOKIE_CLIENT_LEN + COOKIE_SERVER_LEN;
+	if (edns->keepalive)
+		space += OPT_HDR + KEEPALIVE_LEN;
+	return space;
+}
+
+#define SIP_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND do { \
+	v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+	v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+	} while(0)
+
+static uint64_t
+sip_u64(const uint8_t *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+		((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+		((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+/* SipHash-2-4 of the data with the 16 byte key, to out in little endian */
+static void
+siphash24(const uint8_t *data, size_t len, const uint8_t *key, uint8_t *out)
+{
+	uint64_t k0 = sip_u64(key), k1 = sip_u64(key + 8), m, b;
+	uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+	size_t i, left = len & 7;
+	for (i = 0; i + 8 <= len; i += 8) {
+		m = sip_u64(data + i);
+		v3 ^= m;
+		SIP_ROUND;
+		SIP_ROUND;
+		v0 ^= m;
+	}
+	b = ((uint64_t)len) << 56;
+	while (left > 0) {
+		left--;
+		b |= ((uint64_t)data[i + left]) << (8 * left);
+	}
+	v3 ^= b;
+	SIP_ROUND;
+	SIP_ROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIP_ROUND;
+	SIP_ROUND;
+	SIP_ROUND;
+	SIP_ROUND;
+	b = v0 ^ v1 ^ v2 ^ v3;
+	for (i = 0; i < 8; i++)
+		out[i] = (uint8_t)(b >> (8 * i));
+}
+
+/* the hash of the server cookie, over the client cookie, the version,
+ * reserved and timestamp of the server cookie and the client address */
+static void
+edns_cookie_hash(const uint8_t *cookie, const uint8_t *secret,
+	const uint8_t *addr, size_t addrlen, uint8_t *out)
+{
+	uint8_t buf[COOKIE_CLIENT_LEN + 8 + 16];
+	memcpy(buf, cookie, COOKIE_CLIENT_LEN + 8);
+	memcpy(buf + COOKIE_CLIENT_LEN + 8, addr, addrlen);
+	siphash24(buf, COOKIE_CLIENT_LEN + 8 + addrlen, secret, out);
+}
+
+void
+edns_cookie_verify(edns_record_type *edns, const uint8_t *secret,
+	const uint8_t *addr, size_t addrlen, uint32_t now)
+{
+	uint8_t hash[8];
+	uint32_t stamp;
+	if (edns->cookie_status != COOKIE_UNVERIFIED ||
+		edns->cookie_len == COOKIE_CLIENT_LEN)
+		return;
+	edns->cookie_status = COOKIE_INVALID;
+	/* version 1, reserved 0 */
+	if (edns->cookie_len != COOKIE_CLIENT_LEN + COOKIE_SERVER_LEN ||
+		edns->cookie[COOKIE_CLIENT_LEN] != 1)
+		return;
+	stamp = read_uint32(edns->cookie + COOKIE_CLIENT_LEN + 4);
+	/* at most an hour old, and 5 minutes in the future, in serial
+	 * number arithmetic */
+	if ((int32_t)(now - stamp) > 3600 || (int32_t)(stamp - now) > 300)
+		return;
+	edns_cookie_hash(edns->cookie, secret, addr, addrlen, hash);
+	if (memcmp(hash, edns->cookie + COOKIE_CLIENT_LEN + 8, 8) == 0)
+		edns->cookie_status = COOKIE_VALID;
+}
+
+void
+edns_cookie_create(edns_record_type *edns, const uint8_t *secret,
+	const uint8_t *addr, size_t addrlen, uint32_t now)
+{
+	uint8_t *server = edns->cookie + COOKIE_CLIENT_LEN;
+	if (edns->cookie_status == COOKIE_VALID &&
+		(int32_t)(now - read_uint32(server + 4)) < 1800)
+		return;
+	server[0] = 1;
+	server[1] = 0;
+	server[2] = 0;
+	server[3] = 0;
+	write_uint32(server + 4, now);
+	edns_cookie_hash(edns->cookie, secret, addr, addrlen, server + 8);
+	edns->cookie_len = COOKIE_CLIENT_LEN + COOKIE_SERVER_LEN;
 }
@@ -16,6 +16,13 @@
 #define OPT_RDATA 2                     /* holds the rdata length comes after OPT_LEN */
 #define OPT_HDR 4U                      /* NSID opt header length */
 #define NSID_CODE       3               /* nsid option code */
+#define COOKIE_CODE     10              /* cookie option code, RFC 7873 */
+#define COOKIE_CLIENT_LEN 8             /* length of the client cookie */
+#define COOKIE_SERVER_LEN 16            /* our server cookie, RFC 9018 */
+#define COOKIE_MAX_LEN  40              /* client and longest server cookie */
+#define COOKIE_SECRET_LEN 16            /* the siphash key of the cookies */
+#define KEEPALIVE_CODE  11              /* edns-tcp-keepalive, RFC 7828 */
+#define KEEPALIVE_LEN   2               /* the timeout in the answer */
 #define DNSSEC_OK_MASK  0x8000U         /* do bit mask */
 
 struct edns_data
@@ -37,6 +44,17 @@ enum edns_status
 };
 typedef enum edns_status edns_status_type;
 
+enum cookie_status
+{
+	COOKIE_NOT_PRESENT,
+	/* the cookie is not checked yet, or there is only a client cookie */
+	COOKIE_UNVERIFIED,
+	/* the server cookie is not ours, too old, or another secret */
+	COOKIE_INVALID,
+	COOKIE_VALID
+};
+typedef enum cookie_status cookie_status_type;
+
 struct edns_record
 {
 	edns_status_type status;
@@ -44,6 +62,12 @@ struct edns_record
 	size_t           maxlen;
 	int              dnssec_ok;
 	int              nsid;
+	/* the cookie option, client cookie and server cookie */
+	cookie_status_type cookie_status;
+	size_t           cookie_len;
+	uint8_t          cookie[COOKIE_MAX_LEN];
+	/* the edns-tcp-keepalive option is in the query */
+	int              keepalive;
 };
 typedef struct edns_record edns_record_type;
 
@@ -59,4 +83,20 @@ size_t edns_reserved_space(edns_record_type *data);
 
 void edns_init_nsid(edns_data_type *data, uint16_t nsid_len);
 
+/*
+ * Check the server cookie in the record, made with the secret for the
+ * client address (4 or 16 bytes) at most an hour before now, and set
+ * its cookie_status.
+ */
+void edns_cookie_verify(edns_record_type *data, const uint8_t *secret,
+	const uint8_t *addr, size_t addrlen, uint32_t now);
+
+/*
+ * Put a new server cookie (RFC 9018) after the client cookie in the
+ * record, for the answer, unless the valid one is less than half an hour
+ * old.
+ */
+void edns_cookie_create(edns_record_type *data, const uint8_t *secret,
+	const uint8_t *addr, size_t addrlen, uint32_t now);
+
 #endif /* _EDNS_H_ */
@@ -0,0 +1,137 @@
+/*
+ * hash.c -- keyed hash for the hash tables of the servers.
+ *
+ * Copyright (c) 2026, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * The mixing is that of wyhash (final version 4) by Wang Yi, that is in
+ * the public domain: 64 bit multiplications with a 128 bit result, that
+ * the compilers turn into one instruction on 64 bit cpus.  The names and
+ * addresses that the servers hash are short, for them it takes less
+ * instructions than lookup3, that mixes 12 bytes at a time in 32 bit
+ * rounds.  The key is random, so that a flood of queries cannot be made
+ * to fall in the same buckets.
+ */
+
+#include "config.h"
+#include <string.h>
+#include "hash.h"
+
+static const uint64_t hash_p[4] = {
+	0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+	0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static uint64_t hash_key = 0;
+
+void
+hash_set_key(uint64_t key)
+{
+	hash_key = key;
+}
+
+uint64_t
+hash_get_key(void)
+{
+	return hash_key;
+}
+
+/* the 128 bit product of a and b, the low half in a, the high in b */
+static void
+hash_mum(uint64_t* a, uint64_t* b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = *a;
+	r *= *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r>>64);
+#else
+	uint64_t ha = *a>>32, hb = *b>>32, la = (uint32_t)*a,
+		lb = (uint32_t)*b, hi, lo;
+	uint64_t rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb,
+		t = rl + (rm0<<32), c = t < rl;
+	lo = t + (rm1<<32);
+	c += lo < t;
+	hi = rh + (rm0>>32) + (rm1>>32) + c;
+	*a = lo;
+	*b = hi;
+#endif
+}
+
+static uint64_t
+hash_mix(uint64_t a, uint64_t b)
+{
+	hash_mum(&a, &b);
+	return a^b;
+}
+
+static uint64_t
+hash_r8(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint64_t
+hash_r4(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* 1 to 3 bytes */
+static uint64_t
+hash_r3(const uint8_t* p, size_t len)
+{
+	return (((uint64_t)p[0])<<16) | (((uint64_t)p[len>>1])<<8) |
+		p[len-1];
+}
+
+uint64_t
+hash_bytes(const void* data, size_t len, uint64_t seed)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	uint64_t a, b;
+	seed ^= hash_mix(seed ^ hash_key ^ hash_p[0], hash_p[1]);
+	if(len <= 16) {
+		if(len >= 4) {
+			a = (hash_r4(p)<<32) | hash_r4(p+((len>>3)<<2));
+			b = (hash_r4(p+len-4)<<32) |
+				hash_r4(p+len-4-((len>>3)<<2));
+		} else if(len > 0) {
+			a = hash_r3(p, len);
+			b = 0;
+		} else	a = b = 0;
+	} else {
+		size_t i = len;
+		if(i > 48) {
+			uint64_t s1 = seed, s2 = seed;
+			do {
+				seed = hash_mix(hash_r8(p)^hash_p[1],
+					hash_r8(p+8)^seed);
+				s1 = hash_mix(hash_r8(p+16)^hash_p[2],
+					hash_r8(p+24)^s1);
+				s2 = hash_mix(hash_r8(p+32)^hash_p[3],
+					hash_r8(p+40)^s2);
+				p += 48;
+				i -= 48;
+			} while(i > 48);
+			seed ^= s1^s2;
+		}
+		while(i > 16) {
+			seed = hash_mix(hash_r8(p)^hash_p[1],
+				hash_r8(p+8)^seed);
+			p += 16;
+			i -= 16;
+		}
+		a = hash_r8(p+i-16);
+		b = hash_r8(p+i-8);
+	}
+	a ^= hash_p[1];
+	b ^= seed;
+	hash_mum(&a, &b);
+	return hash_mix(a^hash_p[0]^(uint64_t)len, b^hash_p[1]);
+}
@@ -0,0 +1,38 @@
+/*
+ * hash.h -- keyed hash for the hash tables of the servers.
+ *
+ * Copyright (c) 2026, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+/**
+ * Set the key of the hash, random, in main before the fork of the
+ * servers, so that the processes that share a table hash the same.
+ * @param key: the key
+ */
+void hash_set_key(uint64_t key);
+
+/**
+ * Get the key of the hash, to store it with a table that is kept over a
+ * restart.
+ * @return: the key
+ */
+uint64_t hash_get_key(void);
+
+/**
+ * Hash the data with the key, for short keys like names and addresses.
+ * Not for hashes that are kept on disk over a restart, unless the key is
+ * kept as well; the result also depends on the endianness.
+ * @param data: the data
+ * @param len: length of the data in bytes
+ * @param seed: the previous hash, or an arbitrary value
+ * @return: 64 bit hash value
+ */
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed);
+
+#endif /* HASH_H */
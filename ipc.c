@@ -12,6 +12,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "ipc.h"
 #include "buffer.h"
 #include "xfrd-tcp.h"
@@ -20,6 +24,10 @@
 #include "xfrd.h"
 #include "xfrd-notify.h"
 #include "difffile.h"
+#include "packet.h"
+
+/* the number of notifies xfrd reads from the children in one go */
+#define XFRD_NOTIFY_BATCH 64
 
 /* attempt to send NSD_STATS command to child fd */
 static void send_stat_to_child(struct main_ipc_handler_data* data, int fd);
@@ -30,7 +38,7 @@ static void xfrd_send_quit_req(xfrd_state_t* xfrd);
 /* perform read part of handle ipc for xfrd */
 static void xfrd_handle_ipc_read(struct event* handler, xfrd_state_t* xfrd);
 
-static void
+void
 ipc_child_quit(struct nsd* nsd)
 {
 	/* call shutdown and quit routines */
@@ -38,6 +46,7 @@ ipc_child_quit(struct nsd* nsd)
 #ifdef	BIND8_STATS
 	bind8_stats(nsd);
 #endif /* BIND8_STATS */
+	server_thread_quit(nsd);
 
 #if 0 /* OS collects memory pages */
 	event_base_free(event_base);
@@ -79,12 +88,17 @@ child_handle_parent_command(int fd, short event, void* arg)
 		break;
 	case NSD_QUIT_CHILD:
 		/* close our listening sockets and ack */
-		server_close_all_sockets(data->nsd->udp, data->nsd->ifs);
-		server_close_all_sockets(data->nsd->tcp, data->nsd->ifs);
+		server_close_listening_sockets(data->nsd);
 		/* mode == NSD_QUIT_CHILD */
 		(void)write(fd, &mode, sizeof(mode));
 		ipc_child_quit(data->nsd);
 		break;
+	case NSD_APPLY_XFR:
+		server_child_apply_xfr(data->nsd, fd);
+		break;
+	case NSD_QUIT_DRAIN:
+		server_child_drain(data->nsd);
+		break;
 	case NSD_QUIT_WITH_STATS:
 #ifdef BIND8_STATS
 		DEBUG(DEBUG_IPC, 2, (LOG_INFO, "quit QUIT_WITH_STATS"));
@@ -219,7 +233,7 @@ send_quit_to_child(struct main_ipc_handler_data* data, int fd)
 static void
 child_is_done(struct nsd* nsd, int fd)
 {
-	size_t i;
+	size_t i, j;
 	if(fd != -1) close(fd);
 	for(i=0; i<nsd->child_count; ++i)
 		if(nsd->children[i].child_fd == fd) {
@@ -230,14 +244,26 @@ child_is_done(struct nsd* nsd, int fd)
 					(int)nsd->children[i].pid));
 				nsd->children[i].has_exited = 1;
 			} else {
-				log_msg(LOG_WARNING,
-				       "server %d died unexpectedly, restarting",
-				       (int)nsd->children[i].pid);
+				/* pid -1 is an other thread of a server
+				 * process that is already restarted */
+				if(nsd->children[i].pid != -1)
+					log_msg(LOG_WARNING,
+					       "server %d died unexpectedly, restarting",
+					       (int)nsd->children[i].pid);
 				/* this child is now going to be re-forked as
 				 * a subprocess of this server-main, and if a
 				 * reload is in progress the other children
 				 * are subprocesses of reload.  Until the
 				 * reload is done and they are all reforked. */
+				/* with server-threads, the other threads of
+				 * the process are restarted with it, in one
+				 * new process */
+				for(j=0; nsd->server_threads &&
+					j<nsd->child_count; ++j)
+					if(j != i && nsd->children[j].pid ==
+						nsd->children[i].pid &&
+						!nsd->children[j].need_to_exit)
+						nsd->children[j].pid = -1;
 				nsd->children[i].pid = -1;
 				nsd->restart_children = 1;
 			}
@@ -268,13 +294,36 @@ stats_add(struct nsdst* total, struct nsdst* s)
 	total->wrongzone += s->wrongzone;
 	total->txerr += s->txerr;
 	total->rxerr += s->rxerr;
+	total->rxq_drops += s->rxq_drops;
+	for(i=0; i<STALL_HANDLERS; i++)
+		total->stall[i] += s->stall[i];
+	if(s->loop_lag_max > total->loop_lag_max)
+		total->loop_lag_max = s->loop_lag_max;
 	total->edns += s->edns;
 	total->ednserr += s->ednserr;
 	total->raxfr += s->raxfr;
 	total->nona += s->nona;
+	total->rrl_slip += s->rrl_slip;
+	total->rrl_discard += s->rrl_discard;
+	total->overload_tc += s->overload_tc;
+	total->overload_drop += s->overload_drop;
+	total->arena_overflow += s->arena_overflow;
+	total->db_remap += s->db_remap;
+	total->nsec3_cache_hit += s->nsec3_cache_hit;
+	total->nsec3_cache_miss += s->nsec3_cache_miss;
+	total->nsec3_cache_evict += s->nsec3_cache_evict;
+	for(i=0; i<sizeof(total->latency)/sizeof(stc_t); i++)
+		(&total->latency[0][0][0])[i] += (&s->latency[0][0][0])[i];
+	for(i=0; i<sizeof(total->latency_nsec)/sizeof(uint64_t); i++)
+		(&total->latency_nsec[0][0][0])[i] +=
+			(&s->latency_nsec[0][0][0])[i];
 
 	total->db_disk = s->db_disk;
 	total->db_mem = s->db_mem;
+	total->db_slab = s->db_slab;
+	total->db_slab_used = s->db_slab_used;
+	total->db_disk_free = s->db_disk_free;
+	memcpy(total->db_tag, s->db_tag, sizeof(total->db_tag));
 }
 
 /** subtract stats from total */
@@ -299,12 +348,93 @@ stats_subtract(struct nsdst* total, struct nsdst* s)
 	total->wrongzone -= s->wrongzone;
 	total->txerr -= s->txerr;
 	total->rxerr -= s->rxerr;
+	total->rxq_drops -= s->rxq_drops;
+	for(i=0; i<STALL_HANDLERS; i++)
+		total->stall[i] -= s->stall[i];
 	total->edns -= s->edns;
 	total->ednserr -= s->ednserr;
 	total->raxfr -= s->raxfr;
 	total->nona -= s->nona;
+	total->rrl_slip -= s->rrl_slip;
+	total->rrl_discard -= s->rrl_discard;
+	total->overload_tc -= s->overload_tc;
+	total->overload_drop -= s->overload_drop;
+	total->arena_overflow -= s->arena_overflow;
+	total->db_remap -= s->db_remap;
+	total->nsec3_cache_hit -= s->nsec3_cache_hit;
+	total->nsec3_cache_miss -= s->nsec3_cache_miss;
+	total->nsec3_cache_evict -= s->nsec3_cache_evict;
+	for(i=0; i<sizeof(total->latency)/sizeof(stc_t); i++)
+		(&total->latency[0][0][0])[i] -= (&s->latency[0][0][0])[i];
+	for(i=0; i<sizeof(total->latency_nsec)/sizeof(uint64_t); i++)
+		(&total->latency_nsec[0][0][0])[i] -=
+			(&s->latency_nsec[0][0][0])[i];
+}
+
+void
+stats_live(struct nsd* nsd, struct nsdst* st)
+{
+	size_t i;
+	memcpy(st, &nsd->st, sizeof(*st));
+	if(!nsd->stat_map[nsd->stat_idx])
+		return;
+	for(i=0; i<nsd->child_count; i++)
+		stats_add(st, STAT_SLOT(nsd, nsd->stat_idx, i));
+	/* stats_add copies the database sizes */
+	st->db_disk = nsd->st.db_disk;
+	st->db_mem = nsd->st.db_mem;
+	st->db_slab = nsd->st.db_slab;
+	st->db_slab_used = nsd->st.db_slab_used;
+	st->db_disk_free = nsd->st.db_disk_free;
+	memcpy(st->db_tag, nsd->st.db_tag, sizeof(st->db_tag));
 }
 
+#ifdef USE_ZONE_STATS
+/* add the zone stats of a zone to the stat block, the qtypes above 255
+ * are in the qtype[256] of the stat block, like in the server stats */
+static void
+zonestat_add(struct nsdst* st, struct zonestat* z, uint64_t* other,
+	uint64_t* cpu)
+{
+	size_t i;
+	for(i=0; i<ZONESTAT_QTYPES && z->qtype[i]; i++) {
+		uint16_t t = (uint16_t)(z->qtype[i]>>48);
+		st->qtype[t<=255?t:256] += (stc_t)(z->qtype[i]&
+			(((uint64_t)1<<48)-1));
+	}
+	*other += z->qtype_other;
+	for(i=0; i<LASTELEM(z->qclass)+1; i++)
+		st->qclass[i] += (stc_t)z->qclass[i];
+	for(i=0; i<LASTELEM(z->rcode)+1; i++)
+		st->rcode[i] += (stc_t)z->rcode[i];
+	for(i=0; i<LASTELEM(z->opcode)+1; i++)
+		st->opcode[i] += (stc_t)z->opcode[i];
+	st->qudp += (stc_t)z->qudp;
+	st->qudp6 += (stc_t)z->qudp6;
+	st->ctcp += (stc_t)z->ctcp;
+	st->ctcp6 += (stc_t)z->ctcp6;
+	st->dropped += (stc_t)z->dropped;
+	st->truncated += (stc_t)z->truncated;
+	st->txerr += (stc_t)z->txerr;
+	st->nona += (stc_t)z->nona;
+	st->edns += (stc_t)z->edns;
+	st->ednserr += (stc_t)z->ednserr;
+	st->raxfr += (stc_t)z->raxfr;
+	for(i=0; i<ZONESTAT_CPU; i++)
+		cpu[i] += z->cpu[i];
+}
+
+void
+zonestat_sum(struct nsdst* st, uint64_t* other, uint64_t* cpu,
+	struct zonestat** blocks, size_t shards, size_t id)
+{
+	size_t b, s;
+	for(b=0; b<2; b++)
+		for(s=0; s<shards; s++)
+			zonestat_add(st, &blocks[b][id*shards+s], other, cpu);
+}
+#endif /* USE_ZONE_STATS */
+
 #define FINAL_STATS_TIMEOUT 10 /* seconds */
 static void
 read_child_stats(struct nsd* nsd, struct nsd_child* child, int fd)
@@ -469,6 +599,10 @@ parent_handle_child_command(netio_type *ATTR_UNUSED(netio),
 	case NSD_REAP_CHILDREN:
 		data->nsd->signal_hint_child = 1;
 		break;
+	case NSD_APPLY_XFR:
+		/* the child has applied the zone transfers */
+		data->child->wait_apply_xfr = 0;
+		break;
 	case NSD_PASS_TO_XFRD:
 		/* set mode for handle_child_command; echo to xfrd. */
 		data->forward_mode = 1;
@@ -482,6 +616,36 @@ parent_handle_child_command(netio_type *ATTR_UNUSED(netio),
 	}
 }
 
+int
+ipc_send_notify(struct nsd* nsd, buffer_type* packet, int acl_num,
+	int acl_xfr)
+{
+	uint32_t acl[2];
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	if(nsd->notify_fd == -1)
+		return 0;
+	/* one datagram, the packet and then the acl numbers */
+	acl[0] = htonl(acl_num);
+	acl[1] = htonl(acl_xfr);
+	iov[0].iov_base = buffer_begin(packet);
+	iov[0].iov_len = buffer_limit(packet);
+	iov[1].iov_base = acl;
+	iov[1].iov_len = sizeof(acl);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	if(sendmsg(nsd->notify_fd, &msg, MSG_DONTWAIT) == -1) {
+		if(errno != EAGAIN && errno != EWOULDBLOCK &&
+			errno != ENOBUFS && errno != EINTR)
+			log_msg(LOG_ERR, "error in IPC notify server2xfrd, %s",
+				strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
 void
 parent_check_all_children_exited(struct nsd* nsd)
 {
@@ -574,6 +738,8 @@ xfrd_send_reload_req(xfrd_state_t* xfrd)
 	assert(udb_base_get_userdata(xfrd->nsd->task[xfrd->nsd->mytask])->data == 0);
 
 	xfrd_prepare_zones_for_reload();
+	if(xfrd->progressive == XFRD_PROGRESSIVE_QUEUED)
+		xfrd->progressive = XFRD_PROGRESSIVE_SENT;
 	xfrd->reload_cmd_last_sent = xfrd_time();
 	xfrd->need_to_send_reload = 0;
 	xfrd->can_send_reload = 0;
@@ -670,6 +836,82 @@ xfrd_handle_ipc(int ATTR_UNUSED(fd), short event, void* arg)
 
 }
 
+/* the zone and serial of a notify, to find the duplicates in a batch */
+struct notify_key {
+	uint32_t serial;
+	int have_serial;
+	size_t len;
+	uint8_t name[MAXDOMAINLEN];
+};
+
+/* get the key of the notify in the packet, false if it is malformed */
+static int
+notify_key_get(buffer_type* packet, struct notify_key* key)
+{
+	uint16_t qtype, qclass;
+	size_t i;
+
+	buffer_set_position(packet, QHEADERSZ);
+	if(!packet_read_query_section(packet, key->name, &qtype, &qclass))
+		return 0;
+	key->len = buffer_position(packet) - QHEADERSZ - 2*sizeof(uint16_t);
+	/* the label lengths are smaller than 'A' */
+	for(i=0; i<key->len; i++)
+		key->name[i] = tolower((unsigned char)key->name[i]);
+	key->have_serial = packet_find_notify_serial(packet, &key->serial);
+	return 1;
+}
+
+void
+xfrd_handle_ipc_notify(int fd, short event, void* arg)
+{
+	xfrd_state_t* xfrd = (xfrd_state_t*)arg;
+	buffer_type* packet = xfrd->notify_pass;
+	struct notify_key keys[XFRD_NOTIFY_BATCH];
+	uint32_t acl_num, acl_xfr;
+	ssize_t len;
+	int i, j, num = 0;
+
+	if(!(event & EV_READ))
+		return;
+	for(i=0; i<XFRD_NOTIFY_BATCH; i++) {
+		buffer_clear(packet);
+		len = recv(fd, buffer_begin(packet), buffer_capacity(packet), 0);
+		if(len == -1) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR)
+				log_msg(LOG_ERR, "xfrd: error in read notify "
+					"ipc: %s", strerror(errno));
+			return;
+		}
+		if(len < (ssize_t)(QHEADERSZ + 2*sizeof(uint32_t)))
+			continue;
+		len -= 2*sizeof(uint32_t);
+		acl_num = read_uint32(buffer_at(packet, len));
+		acl_xfr = read_uint32(buffer_at(packet, len+sizeof(uint32_t)));
+		buffer_set_limit(packet, len);
+		if(!notify_key_get(packet, &keys[num]))
+			continue; /* drop bad packet */
+		for(j=0; j<num; j++) {
+			if(keys[j].len == keys[num].len &&
+				keys[j].have_serial == keys[num].have_serial &&
+				(!keys[j].have_serial ||
+				keys[j].serial == keys[num].serial) &&
+				memcmp(keys[j].name, keys[num].name,
+				keys[num].len) == 0)
+				break;
+		}
+		if(j < num) {
+			DEBUG(DEBUG_IPC,2, (LOG_INFO, "xfrd: drop duplicate "
+				"notify"));
+			continue;
+		}
+		num++;
+		buffer_set_position(packet, 0);
+		xfrd_handle_passed_packet(packet, (int)acl_num, (int)acl_xfr);
+	}
+}
+
 static void
 xfrd_handle_ipc_read(struct event* handler, xfrd_state_t* xfrd)
 {
@@ -759,6 +1001,9 @@ xfrd_handle_ipc_read(struct event* handler, xfrd_state_t* xfrd)
 		ipc_xfrd_set_listening(xfrd, EV_PERSIST|EV_READ|EV_WRITE);
 		xfrd_reopen_logfile();
 		xfrd_check_failed_updates();
+		/* those zone files are read, queue the next ones */
+		if(xfrd->progressive == XFRD_PROGRESSIVE_SENT)
+			xfrd_progressive_next(xfrd, 0);
 		break;
 	case NSD_PASS_TO_XFRD:
 		DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: ipc recv PASS_TO_XFRD"));
@@ -17,6 +17,7 @@ struct nsd_child;
 struct xfrd_tcp;
 struct xfrd_state;
 struct nsdst;
+struct zonestat;
 struct event;
 
 /*
@@ -78,12 +79,33 @@ void parent_handle_child_command(netio_type *netio,
  */
 void child_handle_parent_command(int fd, short event, void* arg);
 
+/*
+ * The server (child) quits, with its statistics.  Does not return.
+ */
+void ipc_child_quit(struct nsd* nsd);
+
 /*
  * Routine used by xfrd
  * Handle interprocess communication with parent process, read and write.
  */
 void xfrd_handle_ipc(int fd, short event, void* arg);
 
+/*
+ * Routine used by server_child.
+ * Pass a notify that passed the acl straight to xfrd, on nsd->notify_fd.
+ * Returns 0 if that would block or there is no socket, then the caller
+ * passes it through the parent with NSD_PASS_TO_XFRD.
+ */
+int ipc_send_notify(struct nsd* nsd, struct buffer* packet, int acl_num,
+	int acl_xfr);
+
+/*
+ * Routine used by xfrd
+ * Read the notifies that the children pass, a batch at a time, and handle
+ * the notifies for the same zone and serial in the batch once.
+ */
+void xfrd_handle_ipc_notify(int fd, short event, void* arg);
+
 /* check if all children have exited in an orderly fashion and set mode */
 void parent_check_all_children_exited(struct nsd* nsd);
 
@@ -91,6 +113,14 @@ void parent_check_all_children_exited(struct nsd* nsd);
 void stats_add(struct nsdst* total, struct nsdst* s);
 /** subtract stats from total */
 void stats_subtract(struct nsdst* total, struct nsdst* s);
+/** the counters of the quit servers and the ones that the running servers
+ * publish in the stat_map added up */
+void stats_live(struct nsd* nsd, struct nsdst* st);
+/** add the shards of zonestat id of the two blocks to the stat block, the
+ * qtypes without a slot are added to other, and the cpu counters to the
+ * ZONESTAT_CPU elements of cpu */
+void zonestat_sum(struct nsdst* st, uint64_t* other, uint64_t* cpu,
+	struct zonestat** blocks, size_t shards, size_t id);
 
 /** set event to listen to given mode, no timeout, must be added already */
 void ipc_xfrd_set_listening(struct xfrd_state* xfrd, short mode);
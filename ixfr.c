@@ -0,0 +1,375 @@
+/*
+ * ixfr.c -- storing IXFR versions and generating IXFR responses.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include "ixfr.h"
+#include "axfr.h"
+#include "dns.h"
+#include "packet.h"
+#include "options.h"
+#include "rdata.h"
+
+#define IXFR_TSIG_SIGN_EVERY_NTH	96	/* tsig sign every N packets. */
+
+uint32_t
+zone_soa_serial(zone_type* zone)
+{
+	uint32_t serial;
+	memcpy(&serial, rr_rdata_field(&zone->soa_rrset->rrs[0], 2, NULL),
+		sizeof(serial));
+	return ntohl(serial);
+}
+
+/** make space for len more bytes in the store, false if too large */
+static int
+ixfr_store_reserve(struct ixfr_store* store, size_t len)
+{
+	if(store->len + len > store->zone->opts->pattern->ixfr_size) {
+		VERBOSITY(2, (LOG_INFO, "zone %s IXFR to serial %u is larger "
+			"than ixfr-size, not stored",
+			domain_to_string(store->zone->apex),
+			(unsigned)store->newserial));
+		return 0;
+	}
+	if(store->len + len > store->capacity) {
+		size_t c = store->capacity?store->capacity*2:4096;
+		while(c < store->len + len)
+			c *= 2;
+		store->data = (uint8_t*)xrealloc(store->data, c);
+		store->capacity = c;
+	}
+	return 1;
+}
+
+/** remove the oldest stored version of the zone */
+static void
+zone_ixfr_pop(zone_type* zone)
+{
+	struct zone_ixfr* ixfr = zone->ixfr;
+	struct ixfr_data* d = ixfr->first;
+	ixfr->first = d->next;
+	if(!ixfr->first)
+		ixfr->last = NULL;
+	ixfr->count--;
+	ixfr->size -= d->len;
+	region_recycle(zone->region, d->rrs, d->len);
+	region_recycle(zone->region, d, sizeof(*d));
+}
+
+struct ixfr_store*
+ixfr_store_start(zone_type* zone, struct ixfr_store* store,
+	uint32_t oldserial, uint32_t newserial)
+{
+	if(!zone->opts || !zone->opts->pattern->store_ixfr ||
+		zone->opts->pattern->ixfr_number == 0) {
+		/* the option could have been turned off */
+		zone_ixfr_clear(zone);
+		return NULL;
+	}
+	memset(store, 0, sizeof(*store));
+	store->zone = zone;
+	store->oldserial = oldserial;
+	store->newserial = newserial;
+	return store;
+}
+
+void
+ixfr_store_add_rr(struct ixfr_store* store, const dname_type* owner,
+	uint16_t type, uint16_t klass, uint32_t ttl, buffer_type* packet,
+	uint16_t rdlen)
+{
+	region_type* temp;
+	domain_table_type* owners;
+	rdata_atom_type* rdatas;
+	ssize_t rdata_num, i;
+	size_t pos = buffer_position(packet), len = 0;
+
+	if(store->cancelled)
+		return;
+	/* the dnames in the rdata could be compressed in the packet,
+	 * parse the rdata and store it uncompressed */
+	temp = region_create(xalloc, free);
+	owners = domain_table_create(temp);
+	rdata_num = rdata_wireformat_to_rdata_atoms(temp, owners, type,
+		rdlen, packet, &rdatas);
+	buffer_set_position(packet, pos);
+	if(rdata_num == -1) {
+		ixfr_store_cancel(store);
+		region_destroy(temp);
+		return;
+	}
+	for(i=0; i<rdata_num; i++) {
+		if(rdata_atom_is_domain(type, i))
+			len += domain_dname(rdata_atom_domain(rdatas[i]))->
+				name_size;
+		else	len += rdata_atom_size(rdatas[i]);
+	}
+	if(len > MAX_RDLENGTH || !ixfr_store_reserve(store,
+		owner->name_size + 10 + len)) {
+		ixfr_store_cancel(store);
+		region_destroy(temp);
+		return;
+	}
+	memmove(store->data+store->len, dname_name(owner), owner->name_size);
+	store->len += owner->name_size;
+	write_uint16(store->data+store->len, type);
+	write_uint16(store->data+store->len+2, klass);
+	write_uint32(store->data+store->len+4, ttl);
+	write_uint16(store->data+store->len+8, len);
+	store->len += 10;
+	for(i=0; i<rdata_num; i++) {
+		if(rdata_atom_is_domain(type, i)) {
+			const dname_type* dname = domain_dname(
+				rdata_atom_domain(rdatas[i]));
+			memmove(store->data+store->len, dname_name(dname),
+				dname->name_size);
+			store->len += dname->name_size;
+		} else {
+			memmove(store->data+store->len,
+				rdata_atom_data(rdatas[i]),
+				rdata_atom_size(rdatas[i]));
+			store->len += rdata_atom_size(rdatas[i]);
+		}
+	}
+	region_destroy(temp);
+}
+
+void
+ixfr_store_cancel(struct ixfr_store* store)
+{
+	store->cancelled = 1;
+	free(store->data);
+	store->data = NULL;
+	store->len = 0;
+	store->capacity = 0;
+}
+
+void
+ixfr_store_finish(struct ixfr_store* store)
+{
+	zone_type* zone = store->zone;
+	pattern_options_t* p = zone->opts->pattern;
+	struct ixfr_data* d;
+	if(store->cancelled)
+		return;
+	if(!zone->ixfr) {
+		zone->ixfr = (struct zone_ixfr*)region_alloc_zero(zone->region,
+			sizeof(struct zone_ixfr));
+	}
+	/* the versions must follow each other */
+	if(zone->ixfr->last && zone->ixfr->last->newserial != store->oldserial)
+		zone_ixfr_clear(zone);
+	while(zone->ixfr->first && (zone->ixfr->count+1 > p->ixfr_number ||
+		zone->ixfr->size + store->len > p->ixfr_size))
+		zone_ixfr_pop(zone);
+
+	d = (struct ixfr_data*)region_alloc(zone->region, sizeof(*d));
+	d->next = NULL;
+	d->oldserial = store->oldserial;
+	d->newserial = store->newserial;
+	d->rrs = (uint8_t*)region_alloc_init(zone->region, store->data,
+		store->len);
+	d->len = store->len;
+	if(zone->ixfr->last)
+		zone->ixfr->last->next = d;
+	else	zone->ixfr->first = d;
+	zone->ixfr->last = d;
+	zone->ixfr->count++;
+	zone->ixfr->size += d->len;
+	free(store->data);
+	store->data = NULL;
+	VERBOSITY(3, (LOG_INFO, "zone %s stored IXFR %u to %u, %u versions "
+		"of %u bytes", domain_to_string(zone->apex),
+		(unsigned)d->oldserial, (unsigned)d->newserial,
+		(unsigned)zone->ixfr->count, (unsigned)zone->ixfr->size));
+}
+
+void
+zone_ixfr_clear(zone_type* zone)
+{
+	if(!zone->ixfr)
+		return;
+	while(zone->ixfr->first)
+		zone_ixfr_pop(zone);
+}
+
+/** length of the uncompressed RR at the start of the data */
+static size_t
+ixfr_rr_length(uint8_t* data)
+{
+	size_t len = 0;
+	while(data[len] != 0)
+		len += data[len]+1;
+	len++;
+	return len + 10 + read_uint16(data+len+8);
+}
+
+/** answer with only the SOA of the zone, the client uses TCP or has
+ * the current version */
+static query_state_type
+ixfr_answer_soa(struct query *query, zone_type* zone)
+{
+	query_add_compression_domain(query, zone->apex, QHEADERSZ);
+	if(!packet_encode_rr(query, zone->apex, &zone->soa_rrset->rrs[0],
+		zone->soa_rrset->rrs[0].ttl)) {
+		RCODE_SET(query->packet, RCODE_SERVFAIL);
+		return QUERY_PROCESSED;
+	}
+	AA_SET(query->packet);
+	ANCOUNT_SET(query->packet, 1);
+	NSCOUNT_SET(query->packet, 0);
+	ARCOUNT_SET(query->packet, 0);
+	query_clear_compression_tables(query);
+	return QUERY_PROCESSED;
+}
+
+/** find the version that starts at the serial of the client, the
+ * versions follow each other up to the current serial */
+static struct ixfr_data*
+ixfr_find_version(zone_type* zone, uint32_t serial, uint32_t current)
+{
+	struct ixfr_data* d;
+	if(!zone->ixfr || !zone->ixfr->last ||
+		zone->ixfr->last->newserial != current)
+		return NULL;
+	for(d = zone->ixfr->first; d; d = d->next) {
+		if(d->oldserial == serial)
+			return d;
+	}
+	return NULL;
+}
+
+query_state_type
+query_ixfr(struct nsd *nsd, struct query *query)
+{
+	uint16_t total_added = 0;
+	int first = 0;
+
+	if (query->axfr_is_done)
+		return QUERY_PROCESSED;
+
+	if (query->maxlen > AXFR_MAX_MESSAGE_LEN)
+		query->maxlen = AXFR_MAX_MESSAGE_LEN;
+
+	if (query->ixfr_data == NULL) {
+		zone_type* zone;
+		uint32_t current;
+		struct ixfr_data* d;
+		/* Start IXFR.  */
+		zone = namedb_find_zone(nsd->db, query->qname);
+		if(!zone || !zone->soa_rrset) {
+			/* No SOA no transfer */
+			RCODE_SET(query->packet, RCODE_NOTAUTH);
+			return QUERY_PROCESSED;
+		}
+		current = zone_soa_serial(zone);
+		if(query->ixfr_have_serial &&
+			compare_serial(query->ixfr_serial, current) >= 0) {
+			/* the client is up to date */
+			return ixfr_answer_soa(query, zone);
+		}
+		if(!query->tcp) {
+			/* RFC 1995, the client then tries with TCP */
+			return ixfr_answer_soa(query, zone);
+		}
+		if(!query->ixfr_have_serial || !(d = ixfr_find_version(zone,
+			query->ixfr_serial, current))) {
+			VERBOSITY(2, (LOG_INFO, "ixfr for %s from serial %u, "
+				"not stored, sending axfr",
+				dname_to_string(query->qname, NULL),
+				(unsigned)query->ixfr_serial));
+			return query_axfr(nsd, query);
+		}
+		query->axfr_zone = zone;
+		query->ixfr_data = d;
+		query->ixfr_pos = 0;
+		first = 1;
+	}
+
+	assert(!query_overflow(query));
+	/* only keep running values for most packets */
+	query->tsig_prepare_it = 0;
+	query->tsig_update_it = 1;
+	if(query->tsig_sign_it) {
+		/* prepare for next updates */
+		query->tsig_prepare_it = 1;
+		query->tsig_sign_it = 0;
+	}
+
+	if (first) {
+		/* first packet, starts with the SOA of the new version */
+		if(query->tsig.status == TSIG_OK) {
+			query->tsig_sign_it = 1; /* sign first packet in stream */
+		}
+		query_add_compression_domain(query, query->axfr_zone->apex,
+			QHEADERSZ);
+		if(!packet_encode_rr(query, query->axfr_zone->apex,
+			&query->axfr_zone->soa_rrset->rrs[0],
+			query->axfr_zone->soa_rrset->rrs[0].ttl)) {
+			RCODE_SET(query->packet, RCODE_SERVFAIL);
+			return QUERY_PROCESSED;
+		}
+		++total_added;
+	} else {
+		/*
+		 * Query name and EDNS need not be repeated after the
+		 * first response packet.
+		 */
+		query->edns.status = EDNS_NOT_PRESENT;
+		buffer_set_limit(query->packet, QHEADERSZ);
+		QDCOUNT_SET(query->packet, 0);
+		query_prepare_response(query);
+	}
+
+	/* Add the RRs of the versions until the answer is full.  */
+	while(query->ixfr_data) {
+		struct ixfr_data* d = query->ixfr_data;
+		while(query->ixfr_pos < d->len) {
+			size_t len = ixfr_rr_length(d->rrs+query->ixfr_pos);
+			if(buffer_position(query->packet) + len >
+				(size_t)(query->maxlen - query->reserved_space)
+				&& total_added > 0)
+				goto return_answer;
+			buffer_write(query->packet, d->rrs+query->ixfr_pos, len);
+			query->ixfr_pos += len;
+			++total_added;
+		}
+		/* the last version stays, until the final SOA is added */
+		if(!d->next)
+			break;
+		query->ixfr_data = d->next;
+		query->ixfr_pos = 0;
+	}
+
+	/* Add terminating SOA RR.  */
+	if(packet_encode_rr(query, query->axfr_zone->apex,
+		&query->axfr_zone->soa_rrset->rrs[0],
+		query->axfr_zone->soa_rrset->rrs[0].ttl)) {
+		++total_added;
+		query->tsig_sign_it = 1; /* sign last packet */
+		query->axfr_is_done = 1;
+	}
+
+return_answer:
+	AA_SET(query->packet);
+	ANCOUNT_SET(query->packet, total_added);
+	NSCOUNT_SET(query->packet, 0);
+	ARCOUNT_SET(query->packet, 0);
+
+	/* check if it needs tsig signatures */
+	if(query->tsig.status == TSIG_OK) {
+		if(query->tsig.updates_since_last_prepare >= IXFR_TSIG_SIGN_EVERY_NTH) {
+			query->tsig_sign_it = 1;
+		}
+	}
+	query_clear_compression_tables(query);
+	return QUERY_IN_AXFR;
+}
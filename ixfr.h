@@ -0,0 +1,99 @@
+/*
+ * ixfr.h -- storing IXFR versions and generating IXFR responses.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef _IXFR_H_
+#define _IXFR_H_
+
+#include "nsd.h"
+#include "query.h"
+
+/*
+ * A stored version of the zone: the RRs of the IXFR from oldserial to
+ * newserial, without the SOA RR that starts and the SOA RR that ends
+ * the transfer.  That is the old SOA, the deleted RRs, the new SOA and
+ * the added RRs, and the same for every further step in the transfer.
+ * The RRs are in uncompressed wireformat.
+ */
+struct ixfr_data {
+	/* the next (newer) version, or NULL */
+	struct ixfr_data* next;
+	uint32_t oldserial;
+	uint32_t newserial;
+	/* the RRs, and their length in bytes */
+	uint8_t* rrs;
+	size_t len;
+};
+
+/*
+ * The stored versions of a zone, allocated in the zone region.
+ */
+struct zone_ixfr {
+	/* the oldest version and the newest version */
+	struct ixfr_data* first;
+	struct ixfr_data* last;
+	/* number of versions and total length of their RRs */
+	uint32_t count;
+	size_t size;
+};
+
+/*
+ * An IXFR that is stored while it is applied to the zone.
+ */
+struct ixfr_store {
+	struct zone* zone;
+	uint32_t oldserial;
+	uint32_t newserial;
+	/* the RRs so far, malloced */
+	uint8_t* data;
+	size_t len;
+	size_t capacity;
+	/* the transfer is not stored, too large or not an IXFR */
+	int cancelled;
+};
+
+/*
+ * Start to store an IXFR from oldserial to newserial for the zone, in
+ * the storage given by the caller.  Returns NULL if the zone does not
+ * store IXFRs.
+ */
+struct ixfr_store* ixfr_store_start(struct zone* zone,
+	struct ixfr_store* store, uint32_t oldserial, uint32_t newserial);
+
+/*
+ * Add an RR of the transfer.  The packet is positioned at the rdata,
+ * of rdlen bytes, the position is not changed.
+ */
+void ixfr_store_add_rr(struct ixfr_store* store, const dname_type* owner,
+	uint16_t type, uint16_t klass, uint32_t ttl, buffer_type* packet,
+	uint16_t rdlen);
+
+/* Do not store the transfer, it was not a (clean) IXFR. */
+void ixfr_store_cancel(struct ixfr_store* store);
+
+/*
+ * Add the stored transfer as the newest version of the zone, and
+ * remove older versions to keep within ixfr-number and ixfr-size.
+ * Frees the storage of the store.
+ */
+void ixfr_store_finish(struct ixfr_store* store);
+
+/* The serial number of the SOA of the zone. */
+uint32_t zone_soa_serial(struct zone* zone);
+
+/* Remove the stored versions of the zone. */
+void zone_ixfr_clear(struct zone* zone);
+
+/*
+ * Answer the IXFR query, from the stored versions of the zone, or with
+ * an AXFR if the versions do not go back to the serial of the client.
+ * Also continues the transfer for the next packets.
+ */
+query_state_type query_ixfr(struct nsd *nsd, struct query *query);
+
+#endif /* _IXFR_H_ */
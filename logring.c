@@ -0,0 +1,353 @@
+/*
+ * logring.c -- the log messages of the servers, written out by xfrd.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * With log-async the server processes do not write to the logfile or
+ * syslog themselves.  A message is put in the ring of the process, in
+ * shared memory, and xfrd writes it out on a timer, with the pid and
+ * the time of the server.  A slow disk or a backed up syslog then makes
+ * xfrd wait, not the servers: when the ring is full the message is
+ * dropped, and the number of dropped messages is logged later.  A
+ * message that a server repeats is written once, and then how many
+ * times it was repeated.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef USE_MINI_EVENT
+#  ifdef HAVE_EVENT_H
+#    include <event.h>
+#  else
+#    include <event2/event.h>
+#    include "event2/event_struct.h"
+#    include "event2/event_compat.h"
+#  endif
+#else
+#  include "mini_event.h"
+#endif
+#include "logring.h"
+#include "nsd.h"
+#include "options.h"
+#include "util.h"
+
+/* msec between the times that xfrd empties the rings */
+#define LOGRING_WRITE_MSEC 100
+/* seconds after which the count of a repeated message is logged */
+#define LOGRING_REPEAT_SECS 10
+/* seconds that a reserved slot may stay unfilled, before it is taken to
+ * be from a server that died while it logged, and is skipped */
+#define LOGRING_STUCK_SECS 5
+
+/* what xfrd knows of a ring, for the repeated messages */
+struct logring_last {
+	char msg[MAXSYSLOGMSGLEN];
+	int priority;
+	pid_t pid;
+	/* times msg was repeated since it was written, and the time of
+	 * the first repeat */
+	uint64_t repeat;
+	struct timeval since;
+	/* when the slot at head was found reserved but not filled in */
+	time_t stuck;
+};
+
+struct logring_writer {
+	struct nsd* nsd;
+	struct event timer;
+	struct event_base* base;
+	/* the rings of both blocks, block 0 first */
+	size_t num;
+	struct logring_last* last;
+	/* dropped messages that were logged, and when */
+	uint64_t dropped;
+	time_t dropped_logged;
+};
+
+#if defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS)
+/* the ring that this server process logs to */
+static struct logring* logring_mine = NULL;
+
+/* bytes of a ring */
+static size_t
+logring_bytes(void)
+{
+	return (sizeof(struct logring) + 63) & ~((size_t)63);
+}
+
+static struct logring*
+logring_get(struct nsd* nsd, int idx, size_t num)
+{
+	return (struct logring*)(nsd->log_map[idx] + num*logring_bytes());
+}
+#endif
+
+void
+logring_alloc(struct nsd* nsd)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS)
+	size_t n = nsd->child_count?nsd->child_count:1, sz, j, k;
+	int i;
+#endif
+	nsd->log_map[0] = NULL;
+	nsd->log_map[1] = NULL;
+	nsd->log_idx = 0;
+	if(!nsd->options->log_async)
+		return;
+#if defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS)
+	sz = logring_bytes()*n;
+	/* anonymous shared memory, zeroed, like the stat_map it is
+	 * inherited by xfrd and the server processes */
+	for(i=0; i<2; i++) {
+		nsd->log_map[i] = (char*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if(nsd->log_map[i] == MAP_FAILED) {
+			log_msg(LOG_ERR, "log-async: mmap failed: %s",
+				strerror(errno));
+			nsd->log_map[i] = NULL;
+			if(i == 1) {
+				munmap(nsd->log_map[0], sz);
+				nsd->log_map[0] = NULL;
+			}
+			return;
+		}
+		/* every slot is free at its own position */
+		for(j=0; j<n; j++) {
+			struct logring* r = logring_get(nsd, i, j);
+			for(k=0; k<LOGRING_SLOTS; k++)
+				r->slot[k].seq = k;
+		}
+	}
+#else
+	log_msg(LOG_WARNING, "log-async: not supported on this system, the "
+		"servers log themselves");
+#endif
+}
+
+void
+logring_switch(struct nsd* nsd)
+{
+	/* the rings are not cleared, xfrd continues at their head */
+	nsd->log_idx = 1 - nsd->log_idx;
+}
+
+#if defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS)
+/* the log function of the servers, puts the message in the ring */
+static void
+logring_log(int priority, const char* message)
+{
+	struct logring* r = logring_mine;
+	struct logring_slot* s;
+	struct timeval tv;
+	uint64_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED), seq;
+	for(;;) {
+		s = &r->slot[pos % LOGRING_SLOTS];
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if(seq == pos) {
+			/* free, reserve it, or pos is the new tail */
+			if(__atomic_compare_exchange_n(&r->tail, &pos, pos+1,
+				0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if(seq < pos) {
+			/* full, the server does not wait for xfrd */
+			__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			/* another thread took it */
+			pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		}
+	}
+	if(gettimeofday(&tv, NULL) != 0)
+		memset(&tv, 0, sizeof(tv));
+	s->sec = (int64_t)tv.tv_sec;
+	s->usec = (int32_t)tv.tv_usec;
+	s->pid = (int32_t)getpid();
+	s->priority = (int32_t)priority;
+	strlcpy(s->msg, message, sizeof(s->msg));
+	__atomic_store_n(&s->seq, pos+1, __ATOMIC_RELEASE);
+}
+#endif
+
+void
+logring_attach(struct nsd* nsd, size_t num)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS)
+	/* the threads share the log function of the process */
+	if(!nsd->log_map[nsd->log_idx] || logring_mine)
+		return;
+	logring_mine = logring_get(nsd, nsd->log_idx, num);
+	log_set_log_function(logring_log);
+#else
+	(void)nsd;
+	(void)num;
+#endif
+}
+
+#if defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS)
+/* log how often the last message of the ring was repeated */
+static void
+logring_repeated(struct logring_last* last)
+{
+	char buf[64];
+	if(last->repeat == 0)
+		return;
+	snprintf(buf, sizeof(buf), "last message repeated %llu times",
+		(unsigned long long)last->repeat);
+	log_msg_origin(last->priority, last->pid, &last->since, buf);
+	last->repeat = 0;
+}
+
+/* write out a message, or count it if it repeats the last one */
+static void
+logring_write(struct logring_last* last, struct logring_slot* s)
+{
+	struct timeval tv;
+	tv.tv_sec = (time_t)s->sec;
+	tv.tv_usec = (suseconds_t)s->usec;
+	s->msg[sizeof(s->msg)-1] = 0;
+	if(last->pid == (pid_t)s->pid && last->priority == s->priority &&
+		strcmp(last->msg, s->msg) == 0) {
+		if(last->repeat++ == 0)
+			last->since = tv;
+		return;
+	}
+	logring_repeated(last);
+	log_msg_origin(s->priority, (pid_t)s->pid, &tv, s->msg);
+	memcpy(last->msg, s->msg, sizeof(last->msg));
+	last->priority = s->priority;
+	last->pid = (pid_t)s->pid;
+}
+
+/* write out the messages of one ring */
+static void
+logring_drain_ring(struct logring* r, struct logring_last* last, time_t now)
+{
+	uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	uint64_t head = r->head;
+	while(head < tail) {
+		struct logring_slot* s = &r->slot[head % LOGRING_SLOTS];
+		if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != head+1) {
+			/* reserved, and not filled in yet */
+			if(last->stuck == 0) {
+				last->stuck = now;
+				break;
+			}
+			if(now - last->stuck < LOGRING_STUCK_SECS)
+				break;
+			log_msg(LOG_WARNING, "log-async: skipped a message "
+				"that a server did not finish");
+		} else	logring_write(last, s);
+		last->stuck = 0;
+		/* the slot is free for the next time around */
+		__atomic_store_n(&s->seq, head+LOGRING_SLOTS,
+			__ATOMIC_RELEASE);
+		head++;
+	}
+	__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+	if(last->repeat != 0 && now - last->since.tv_sec >=
+		LOGRING_REPEAT_SECS)
+		logring_repeated(last);
+}
+
+/* write out what the servers put in the rings */
+static void
+logring_drain(struct logring_writer* w)
+{
+	struct nsd* nsd = w->nsd;
+	size_t n = w->num/2, i;
+	uint64_t dropped = 0;
+	time_t now = time(NULL);
+	int idx;
+	for(idx=0; idx<2; idx++) {
+		for(i=0; i<n; i++) {
+			struct logring* r = logring_get(nsd, idx, i);
+			dropped += __atomic_load_n(&r->dropped,
+				__ATOMIC_RELAXED);
+			logring_drain_ring(r, &w->last[idx*n + i], now);
+		}
+	}
+	if(dropped > w->dropped && now >= w->dropped_logged + 60) {
+		log_msg(LOG_WARNING, "log-async: %u messages of the servers "
+			"dropped, the log is too slow",
+			(unsigned)(dropped - w->dropped));
+		w->dropped = dropped;
+		w->dropped_logged = now;
+	}
+}
+
+static void logring_timer_set(struct logring_writer* w);
+
+static void
+logring_handle_timer(int ATTR_UNUSED(fd), short event, void* arg)
+{
+	struct logring_writer* w = (struct logring_writer*)arg;
+	(void)event;
+	logring_drain(w);
+	logring_timer_set(w);
+}
+
+static void
+logring_timer_set(struct logring_writer* w)
+{
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = LOGRING_WRITE_MSEC*1000;
+	event_set(&w->timer, -1, EV_TIMEOUT, logring_handle_timer, w);
+	if(event_base_set(w->base, &w->timer) != 0)
+		log_msg(LOG_ERR, "log-async timer: event_base_set failed");
+	if(event_add(&w->timer, &tv) != 0)
+		log_msg(LOG_ERR, "log-async timer: event_add failed");
+}
+#endif /* HAVE_MMAP && HAVE_ATOMIC_BUILTINS */
+
+struct logring_writer*
+logring_writer_create(region_type* region, struct nsd* nsd,
+	struct event_base* base)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS)
+	struct logring_writer* w;
+	if(!nsd->log_map[0] || !nsd->log_map[1])
+		return NULL;
+	w = (struct logring_writer*)region_alloc_zero(region, sizeof(*w));
+	w->nsd = nsd;
+	w->base = base;
+	w->num = 2*(nsd->child_count?nsd->child_count:1);
+	w->last = (struct logring_last*)region_alloc_array(region, w->num,
+		sizeof(*w->last));
+	memset(w->last, 0, w->num*sizeof(*w->last));
+	logring_timer_set(w);
+	return w;
+#else
+	(void)region;
+	(void)nsd;
+	(void)base;
+	return NULL;
+#endif
+}
+
+void
+logring_writer_close(struct logring_writer* w)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS)
+	size_t i;
+	if(!w)
+		return;
+	event_del(&w->timer);
+	logring_drain(w);
+	for(i=0; i<w->num; i++)
+		logring_repeated(&w->last[i]);
+#else
+	(void)w;
+#endif
+}
@@ -0,0 +1,80 @@
+/*
+ * logring.h -- the log messages of the servers, written out by xfrd.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef LOGRING_H
+#define LOGRING_H
+
+struct nsd;
+struct event_base;
+struct region;
+
+/** messages in the ring of a server process */
+#define LOGRING_SLOTS 128
+
+/**
+ * A message in the ring.  seq is the position of the slot when it is
+ * free, and the position plus one when the message is filled in.
+ */
+struct logring_slot {
+	uint64_t seq;
+	/* the time the server logged it */
+	int64_t sec;
+	int32_t usec;
+	int32_t pid;
+	int32_t priority;
+	char msg[MAXSYSLOGMSGLEN];
+};
+
+/**
+ * The ring of a server process, in shared memory.  The threads of the
+ * process reserve a slot by moving tail with compare and swap, and then
+ * fill it in; xfrd is the only reader and the only writer of head.  The
+ * server does not wait for xfrd, if the ring is full the message is
+ * dropped.
+ */
+struct logring {
+	uint64_t tail;
+	/* messages dropped because the ring was full */
+	uint64_t dropped;
+	uint8_t pad1[64 - 2*sizeof(uint64_t)];
+	uint64_t head;
+	uint8_t pad2[64 - sizeof(uint64_t)];
+	struct logring_slot slot[LOGRING_SLOTS];
+};
+
+/** The log output of xfrd, that empties the rings */
+struct logring_writer;
+
+/**
+ * Allocate the rings for the servers, in two blocks like the stat_map,
+ * the new servers after a reload use the other block.  Before the fork
+ * of xfrd.  Does nothing if log-async is off.
+ */
+void logring_alloc(struct nsd* nsd);
+
+/** Switch to the other block for the servers forked after a reload */
+void logring_switch(struct nsd* nsd);
+
+/**
+ * Log to the ring of server num from now on, in the server process.
+ * The threads of a process all log to the ring of the first of them.
+ */
+void logring_attach(struct nsd* nsd, size_t num);
+
+/**
+ * Create the writer in xfrd, it empties the rings on a timer and logs
+ * the messages with the pid and time of the server.
+ */
+struct logring_writer* logring_writer_create(struct region* region,
+	struct nsd* nsd, struct event_base* base);
+
+/** Write out what is in the rings, and stop the timer */
+void logring_writer_close(struct logring_writer* w);
+
+#endif /* LOGRING_H */
@@ -73,6 +73,12 @@ hash_set_raninit(uint32_t v)
 	raninit = v;
 }
 
+uint32_t
+hash_get_raninit(void)
+{
+	return raninit;
+}
+
 /*
  * My best guess at if you are big-endian or little-endian.  This may
  * need adjustment.
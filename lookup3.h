@@ -68,4 +68,11 @@ uint32_t hashlittle(const void *k, size_t length, uint32_t initval);
  */
 void hash_set_raninit(uint32_t v);
 
+/**
+ * Get the randomisation initial value, to store it with hashes that
+ * are kept over a restart.
+ * @return: the value
+ */
+uint32_t hash_get_raninit(void);
+
 #endif /* UTIL_STORAGE_LOOKUP3_H */
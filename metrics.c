@@ -0,0 +1,724 @@
+/*
+ * metrics.c - serve the statistics over HTTP in the OpenMetrics format.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * xfrd listens on the metrics-interface addresses, and answers a GET of
+ * the metrics-path with the counters of the servers, that it adds up from
+ * the stat_map that they publish in, and the zone statistics from the
+ * mmapped zonestat arrays.  A scrape does not reload, fork or use TLS.
+ * The HTTP is minimal: one request per connection, and it is closed after
+ * the answer.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "metrics.h"
+#include "xfrd.h"
+#include "options.h"
+#include "nsd.h"
+#include "ipc.h"
+#include "query.h"
+#include "buffer.h"
+#include "util.h"
+
+/* connections that are served at the same time */
+#define METRICS_MAX_CONN 16
+/* seconds a connection has to send the request and read the answer */
+#define METRICS_TIMEOUT 10
+/* the longest request, with its headers, that is read */
+#define METRICS_REQ_MAX 2048
+/* listen() backlog, a few scrapers */
+#define METRICS_BACKLOG 16
+
+/* a listening socket */
+struct metrics_listen {
+	struct metrics_listen* next;
+	struct event ev;
+	int event_added;
+	int fd;
+};
+
+/* an HTTP connection, that reads the request and then writes the answer */
+struct metrics_conn {
+	struct metrics_conn* next, *prev;
+	struct daemon_metrics* m;
+	struct event ev;
+	int event_added;
+	int fd;
+	/* the request, until the empty line */
+	char req[METRICS_REQ_MAX];
+	size_t reqlen;
+	/* the answer, NULL while reading, with the region it is in */
+	region_type* region;
+	buffer_type* out;
+};
+
+struct daemon_metrics {
+	struct xfrd_state* xfrd;
+	struct metrics_listen* listen;
+	struct metrics_conn* conns;
+	int active;
+	struct timeval boot_time;
+};
+
+static void metrics_conn_callback(int fd, short event, void* arg);
+
+/* open a listening socket on the address and port */
+static int
+metrics_open(struct daemon_metrics* m, const char* ip, int port,
+	int noproto_is_err)
+{
+	struct addrinfo hints, *res;
+	struct metrics_listen* l;
+	char portstr[16];
+	int fd, r, on = 1;
+	snprintf(portstr, sizeof(portstr), "%d", port);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+	if((r = getaddrinfo(ip, portstr, &hints, &res)) != 0 || !res) {
+		log_msg(LOG_ERR, "metrics interface %s@%s getaddrinfo: %s",
+			ip, portstr, gai_strerror(r));
+		return 0;
+	}
+	if((fd = socket(res->ai_family, res->ai_socktype, 0)) == -1) {
+		int noproto = (errno == EAFNOSUPPORT);
+		freeaddrinfo(res);
+		if(noproto && !noproto_is_err)
+			return 1; /* no IPv6 on this host, the default */
+		log_msg(LOG_ERR, "metrics interface %s: socket: %s", ip,
+			strerror(errno));
+		return 0;
+	}
+#ifdef SO_REUSEADDR
+	if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on,
+		(socklen_t)sizeof(on)) < 0)
+		log_msg(LOG_ERR, "metrics: setsockopt(SO_REUSEADDR): %s",
+			strerror(errno));
+#endif
+#if defined(INET6) && defined(IPV6_V6ONLY)
+	if(res->ai_family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6,
+		IPV6_V6ONLY, &on, (socklen_t)sizeof(on)) < 0)
+		log_msg(LOG_ERR, "metrics: setsockopt(IPV6_V6ONLY): %s",
+			strerror(errno));
+#endif
+	(void)on;
+	if(bind(fd, res->ai_addr, res->ai_addrlen) == -1) {
+		log_msg(LOG_ERR, "metrics interface %s@%s: bind: %s", ip,
+			portstr, strerror(errno));
+		freeaddrinfo(res);
+		close(fd);
+		return 0;
+	}
+	freeaddrinfo(res);
+	if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+		log_msg(LOG_ERR, "metrics: fcntl: %s", strerror(errno));
+	if(listen(fd, METRICS_BACKLOG) == -1) {
+		log_msg(LOG_ERR, "metrics interface %s: listen: %s", ip,
+			strerror(errno));
+		close(fd);
+		return 0;
+	}
+	l = (struct metrics_listen*)xalloc_zero(sizeof(*l));
+	l->fd = fd;
+	l->next = m->listen;
+	m->listen = l;
+	return 1;
+}
+
+struct daemon_metrics*
+daemon_metrics_create(struct nsd_options* cfg)
+{
+	struct daemon_metrics* m = (struct daemon_metrics*)xalloc_zero(
+		sizeof(*m));
+	assert(cfg->metrics_enable);
+	if(cfg->metrics_interface) {
+		ip_address_option_t* p;
+		for(p = cfg->metrics_interface; p; p = p->next) {
+			if(!metrics_open(m, p->address, cfg->metrics_port, 1)) {
+				daemon_metrics_delete(m);
+				return NULL;
+			}
+		}
+	} else {
+		/* the default is localhost */
+		if((cfg->do_ip6 && !metrics_open(m, "::1", cfg->metrics_port,
+			0)) || (cfg->do_ip4 && !metrics_open(m, "127.0.0.1",
+			cfg->metrics_port, 1))) {
+			daemon_metrics_delete(m);
+			return NULL;
+		}
+	}
+	if(gettimeofday(&m->boot_time, NULL) == -1)
+		log_msg(LOG_ERR, "gettimeofday: %s", strerror(errno));
+	return m;
+}
+
+/* close and free the connection */
+static void
+metrics_conn_close(struct metrics_conn* c)
+{
+	struct daemon_metrics* m = c->m;
+	if(c->prev) c->prev->next = c->next;
+	else	m->conns = c->next;
+	if(c->next) c->next->prev = c->prev;
+	m->active--;
+	if(c->event_added)
+		event_del(&c->ev);
+	close(c->fd);
+	if(c->region)
+		region_destroy(c->region);
+	free(c);
+}
+
+void
+daemon_metrics_close(struct daemon_metrics* m)
+{
+	struct metrics_listen* l, *nl;
+	if(!m) return;
+	for(l = m->listen; l; l = nl) {
+		nl = l->next;
+		if(l->event_added)
+			event_del(&l->ev);
+		close(l->fd);
+		free(l);
+	}
+	m->listen = NULL;
+	while(m->conns)
+		metrics_conn_close(m->conns);
+}
+
+void
+daemon_metrics_delete(struct daemon_metrics* m)
+{
+	if(!m) return;
+	daemon_metrics_close(m);
+	free(m);
+}
+
+#ifdef USE_ZONE_STATS
+/* print a label value, with the quote, backslash and newline escaped */
+static void
+metrics_label(buffer_type* b, const char* s)
+{
+	for(; *s; s++) {
+		if(*s == '"' || *s == '\\')
+			buffer_printf(b, "\\%c", *s);
+		else if(*s == '\n')
+			buffer_printf(b, "\\n");
+		else	buffer_printf(b, "%c", *s);
+	}
+}
+#endif /* USE_ZONE_STATS */
+
+/* print the TYPE and HELP of a metric family */
+static void
+metrics_family(buffer_type* b, const char* name, const char* type,
+	const char* help)
+{
+	buffer_printf(b, "# TYPE %s %s\n# HELP %s %s\n", name, type, name,
+		help);
+}
+
+/* print a counter family of one sample */
+static void
+metrics_counter(buffer_type* b, const char* name, const char* help,
+	uint64_t x)
+{
+	metrics_family(b, name, "counter", help);
+	buffer_printf(b, "%s_total %llu\n", name, (unsigned long long)x);
+}
+
+/* print a gauge family of one sample */
+static void
+metrics_gauge(buffer_type* b, const char* name, const char* help,
+	uint64_t x)
+{
+	metrics_family(b, name, "gauge", help);
+	buffer_printf(b, "%s %llu\n", name, (unsigned long long)x);
+}
+
+static const char* opcode_str[] = {"QUERY", "IQUERY", "STATUS", "OTHER",
+	"NOTIFY", "UPDATE"};
+static const char* rcode_str[] = {"NOERROR", "FORMERR", "SERVFAIL",
+	"NXDOMAIN", "NOTIMP", "REFUSED", "YXDOMAIN", "YXRRSET", "NXRRSET",
+	"NOTAUTH", "NOTZONE", "RCODE11", "RCODE12", "RCODE13", "RCODE14",
+	"RCODE15", "BADVERS"};
+
+/* print the counters by qtype, opcode, class, rcode and transport */
+static void
+metrics_block(buffer_type* b, struct nsdst* st)
+{
+	size_t i;
+	metrics_family(b, "nsd_queries_by_type", "counter",
+		"Queries by query type.");
+	for(i=0; i<=256; i++) {
+		if(st->qtype[i] == 0)
+			continue;
+		buffer_printf(b, "nsd_queries_by_type_total{type=\"%s\"} %lu\n",
+			i==256?"other":rrtype_to_string(i),
+			(unsigned long)st->qtype[i]);
+	}
+	metrics_family(b, "nsd_queries_by_opcode", "counter",
+		"Queries by opcode.");
+	for(i=0; i<6; i++) {
+		if(st->opcode[i] == 0 && i != OPCODE_QUERY)
+			continue;
+		buffer_printf(b, "nsd_queries_by_opcode_total{opcode=\"%s\"} "
+			"%lu\n", opcode_str[i], (unsigned long)st->opcode[i]);
+	}
+	metrics_family(b, "nsd_queries_by_class", "counter",
+		"Queries by query class.");
+	for(i=0; i<4; i++) {
+		if(st->qclass[i] == 0 && i != CLASS_IN)
+			continue;
+		buffer_printf(b, "nsd_queries_by_class_total{class=\"%s\"} "
+			"%lu\n", rrclass_to_string(i),
+			(unsigned long)st->qclass[i]);
+	}
+	metrics_family(b, "nsd_answers_by_rcode", "counter",
+		"Answers by rcode.");
+	for(i=0; i<17; i++) {
+		if(st->rcode[i] == 0 && i > RCODE_REFUSE)
+			continue;
+		buffer_printf(b, "nsd_answers_by_rcode_total{rcode=\"%s\"} "
+			"%lu\n", rcode_str[i], (unsigned long)st->rcode[i]);
+	}
+	metrics_family(b, "nsd_queries_by_transport", "counter",
+		"Queries over UDP, and TCP connections, for IPv4 and IPv6.");
+	buffer_printf(b, "nsd_queries_by_transport_total{transport=\"udp\"} "
+		"%lu\n", (unsigned long)st->qudp);
+	buffer_printf(b, "nsd_queries_by_transport_total{transport=\"udp6\"} "
+		"%lu\n", (unsigned long)st->qudp6);
+	buffer_printf(b, "nsd_queries_by_transport_total{transport=\"tcp\"} "
+		"%lu\n", (unsigned long)st->ctcp);
+	buffer_printf(b, "nsd_queries_by_transport_total{transport=\"tcp6\"} "
+		"%lu\n", (unsigned long)st->ctcp6);
+}
+
+/* print the latency histograms, with latency-stats */
+static void
+metrics_latency(buffer_type* b, struct nsdst* st)
+{
+	const char* protostr[] = {"udp", "tcp"};
+	const char* classstr[] = {"positive", "referral", "nodata",
+		"nxdomain", "nsec3", "axfr", "other"};
+	const char* stagestr[] = {"parse", "lookup", "encode"};
+	int t, c, k;
+	metrics_family(b, "nsd_query_latency_seconds", "histogram",
+		"Time from the receipt of the query to the answer.");
+	for(t=0; t<2; t++) {
+		for(c=0; c<LATENCY_CLASSES; c++) {
+			stc_t* h = st->latency[c][t];
+			uint64_t sum = 0, nsec = 0;
+			for(k=0; k<LATENCY_BUCKETS; k++) {
+				sum += h[k];
+				buffer_printf(b, "nsd_query_latency_seconds_bucket"
+					"{transport=\"%s\",class=\"%s\",le=",
+					protostr[t], classstr[c]);
+				if(k == LATENCY_BUCKETS-1)
+					buffer_printf(b, "\"+Inf\"} %llu\n",
+						(unsigned long long)sum);
+				else	buffer_printf(b, "\"%.9f\"} %llu\n",
+						(double)query_latency_bucket_start(
+						k+1)/1e9, (unsigned long long)sum);
+			}
+			for(k=0; k<3; k++)
+				nsec += st->latency_nsec[c][t][k];
+			buffer_printf(b, "nsd_query_latency_seconds_count"
+				"{transport=\"%s\",class=\"%s\"} %llu\n",
+				protostr[t], classstr[c],
+				(unsigned long long)sum);
+			buffer_printf(b, "nsd_query_latency_seconds_sum"
+				"{transport=\"%s\",class=\"%s\"} %.9f\n",
+				protostr[t], classstr[c], (double)nsec/1e9);
+		}
+	}
+	metrics_family(b, "nsd_query_latency_stage_seconds", "counter",
+		"Time spent in the parse, lookup and encode of the queries.");
+	for(t=0; t<2; t++) {
+		for(c=0; c<LATENCY_CLASSES; c++) {
+			for(k=0; k<3; k++)
+				buffer_printf(b, "nsd_query_latency_stage_"
+					"seconds_total{transport=\"%s\",class="
+					"\"%s\",stage=\"%s\"} %.9f\n",
+					protostr[t], classstr[c], stagestr[k],
+					(double)st->latency_nsec[c][t][k]/1e9);
+		}
+	}
+}
+
+#ifdef USE_ZONE_STATS
+/* print the zone statistics, one label value per zonestats group */
+static void
+metrics_zonestats(buffer_type* b, struct xfrd_state* xfrd)
+{
+	struct zonestatname* n;
+	struct nsdst* st = (struct nsdst*)xalloc(sizeof(*st));
+	size_t i;
+	metrics_family(b, "nsd_zone_queries_by_type", "counter",
+		"Queries of the zonestats group by query type.");
+	metrics_family(b, "nsd_zone_answers_by_rcode", "counter",
+		"Answers of the zonestats group by rcode.");
+	metrics_family(b, "nsd_zone_queries", "counter",
+		"Queries of the zonestats group.");
+	metrics_family(b, "nsd_zone_queries_dropped", "counter",
+		"Queries of the zonestats group that were dropped.");
+	metrics_family(b, "nsd_zone_answers_truncated", "counter",
+		"Answers of the zonestats group with the TC flag.");
+	if(xfrd->nsd->options->zone_cpu_sample)
+		metrics_family(b, "nsd_zone_cpu_seconds", "counter",
+			"Estimated time the servers spent on the queries "
+			"(query) and the transfer messages (axfr) of the "
+			"zonestats group.");
+	RBTREE_FOR(n, struct zonestatname*, xfrd->nsd->options->zonestatnames){
+		char* name = (char*)n->node.key;
+		uint64_t other = 0, cpu[ZONESTAT_CPU];
+		if(n->id >= xfrd->zonestat_safe || name == NULL || name[0]==0)
+			continue;
+		memset(st, 0, sizeof(*st));
+		memset(cpu, 0, sizeof(cpu));
+		zonestat_sum(st, &other, cpu, xfrd->nsd->zonestat,
+			xfrd->nsd->zonestatshards, n->id);
+		st->qtype[256] += other;
+		for(i=0; i<=256; i++) {
+			if(st->qtype[i] == 0)
+				continue;
+			buffer_printf(b, "nsd_zone_queries_by_type_total{zone=\"");
+			metrics_label(b, name);
+			buffer_printf(b, "\",type=\"%s\"} %lu\n",
+				i==256?"other":rrtype_to_string(i),
+				(unsigned long)st->qtype[i]);
+		}
+		for(i=0; i<17; i++) {
+			if(st->rcode[i] == 0)
+				continue;
+			buffer_printf(b, "nsd_zone_answers_by_rcode_total{zone=\"");
+			metrics_label(b, name);
+			buffer_printf(b, "\",rcode=\"%s\"} %lu\n", rcode_str[i],
+				(unsigned long)st->rcode[i]);
+		}
+		buffer_printf(b, "nsd_zone_queries_total{zone=\"");
+		metrics_label(b, name);
+		buffer_printf(b, "\"} %lu\n", (unsigned long)(st->qudp +
+			st->qudp6 + st->ctcp + st->ctcp6));
+		buffer_printf(b, "nsd_zone_queries_dropped_total{zone=\"");
+		metrics_label(b, name);
+		buffer_printf(b, "\"} %lu\n", (unsigned long)st->dropped);
+		buffer_printf(b, "nsd_zone_answers_truncated_total{zone=\"");
+		metrics_label(b, name);
+		buffer_printf(b, "\"} %lu\n", (unsigned long)st->truncated);
+		if(!xfrd->nsd->options->zone_cpu_sample)
+			continue;
+		buffer_printf(b, "nsd_zone_cpu_seconds_total{zone=\"");
+		metrics_label(b, name);
+		buffer_printf(b, "\",kind=\"query\"} %.6f\n",
+			(double)cpu[ZONESTAT_CPU_QUERY]/1e9);
+		buffer_printf(b, "nsd_zone_cpu_seconds_total{zone=\"");
+		metrics_label(b, name);
+		buffer_printf(b, "\",kind=\"axfr\"} %.6f\n",
+			(double)cpu[ZONESTAT_CPU_AXFR]/1e9);
+	}
+	free(st);
+}
+#endif /* USE_ZONE_STATS */
+
+/* print the metrics to the buffer */
+static void
+metrics_print(struct daemon_metrics* m, buffer_type* b)
+{
+	struct xfrd_state* xfrd = m->xfrd;
+	struct nsd* nsd = xfrd->nsd;
+	struct nsdst* st = (struct nsdst*)xalloc(sizeof(*st));
+	struct timeval now;
+	size_t i;
+	uint64_t total = 0;
+
+	stats_live(nsd, st);
+	metrics_family(b, "nsd_server_queries", "counter",
+		"Queries served by the server process.");
+	for(i=0; i<nsd->child_count; i++) {
+		uint64_t q = nsd->children[i].query_count;
+		if(nsd->stat_map[nsd->stat_idx]) {
+			struct nsdst* s = STAT_SLOT(nsd, nsd->stat_idx, i);
+			q += s->qudp + s->qudp6 + s->ctcp + s->ctcp6;
+		}
+		buffer_printf(b, "nsd_server_queries_total{server=\"%d\"} "
+			"%llu\n", (int)i, (unsigned long long)q);
+		total += q;
+	}
+	metrics_counter(b, "nsd_queries", "Queries served.", total);
+	metrics_block(b, st);
+	metrics_counter(b, "nsd_answers_without_aa",
+		"Answers without the AA flag.", st->nona);
+	metrics_counter(b, "nsd_answers_truncated",
+		"Answers with the TC flag.", st->truncated);
+	metrics_counter(b, "nsd_queries_dropped", "Queries dropped.",
+		st->dropped);
+	metrics_counter(b, "nsd_queries_wrongzone",
+		"Queries for zones that are not served.", st->wrongzone);
+	metrics_counter(b, "nsd_queries_edns", "Queries with EDNS.",
+		st->edns);
+	metrics_counter(b, "nsd_queries_edns_error",
+		"Queries with an EDNS error.", st->ednserr);
+	metrics_counter(b, "nsd_axfr_requests", "AXFR requests served.",
+		st->raxfr);
+	metrics_counter(b, "nsd_rx_errors", "Receive errors.", st->rxerr);
+	if(nsd->options->udp_drop_stats)
+		metrics_counter(b, "nsd_udp_rxq_drops", "Queries that the "
+			"kernel dropped, the receive buffer was full.",
+			st->rxq_drops);
+	if(nsd->options->stall_monitor) {
+		metrics_family(b, "nsd_stalls", "counter",
+			"Handlers and event loops that ran longer than "
+			"stall-monitor.");
+		buffer_printf(b, "nsd_stalls_total{handler=\"loop\"} %lu\n"
+			"nsd_stalls_total{handler=\"udp\"} %lu\n"
+			"nsd_stalls_total{handler=\"tcp_read\"} %lu\n"
+			"nsd_stalls_total{handler=\"tcp_write\"} %lu\n",
+			(unsigned long)st->stall[STALL_LOOP],
+			(unsigned long)st->stall[STALL_UDP],
+			(unsigned long)st->stall[STALL_TCP_READ],
+			(unsigned long)st->stall[STALL_TCP_WRITE]);
+	}
+	metrics_counter(b, "nsd_tx_errors", "Transmit errors.", st->txerr);
+	metrics_counter(b, "nsd_arena_overflows",
+		"Queries larger than the arena.", st->arena_overflow);
+	metrics_counter(b, "nsd_db_remaps",
+		"Times a server mapped the database again.", st->db_remap);
+	metrics_family(b, "nsd_nsec3_cache", "counter",
+		"Lookups in the cache of NSEC3 hashes.");
+	buffer_printf(b, "nsd_nsec3_cache_total{result=\"hit\"} %lu\n"
+		"nsd_nsec3_cache_total{result=\"miss\"} %lu\n"
+		"nsd_nsec3_cache_total{result=\"evict\"} %lu\n",
+		(unsigned long)st->nsec3_cache_hit,
+		(unsigned long)st->nsec3_cache_miss,
+		(unsigned long)st->nsec3_cache_evict);
+#ifdef RATELIMIT
+	metrics_family(b, "nsd_ratelimited", "counter",
+		"Rate limited answers, sent truncated or discarded.");
+	buffer_printf(b, "nsd_ratelimited_total{action=\"slip\"} %lu\n"
+		"nsd_ratelimited_total{action=\"discard\"} %lu\n",
+		(unsigned long)st->rrl_slip, (unsigned long)st->rrl_discard);
+#endif
+	if(nsd->options->overload_action) {
+		metrics_family(b, "nsd_overload_shed", "counter",
+			"Queries shed in overload, sent truncated or discarded.");
+		buffer_printf(b, "nsd_overload_shed_total{action=\"tc\"} %lu\n"
+			"nsd_overload_shed_total{action=\"drop\"} %lu\n",
+			(unsigned long)st->overload_tc,
+			(unsigned long)st->overload_drop);
+	}
+	if(nsd->options->latency_stats)
+		metrics_latency(b, st);
+
+	metrics_gauge(b, "nsd_db_disk_bytes", "Size of the database file.",
+		nsd->st.db_disk);
+	metrics_gauge(b, "nsd_db_disk_free_bytes",
+		"Free space in the database file.", nsd->st.db_disk_free);
+	metrics_gauge(b, "nsd_db_mem_bytes", "Size of the database in memory.",
+		nsd->st.db_mem);
+	metrics_gauge(b, "nsd_db_slab_bytes",
+		"Size of the slabs of the database.", nsd->st.db_slab);
+	metrics_gauge(b, "nsd_db_slab_used_bytes",
+		"Used part of the slabs of the database.",
+		nsd->st.db_slab_used);
+	metrics_gauge(b, "nsd_xfrd_mem_bytes", "Memory of xfrd.",
+		region_get_mem(xfrd->region));
+	metrics_gauge(b, "nsd_config_mem_bytes", "Memory of the config.",
+		region_get_mem(nsd->options->region));
+	metrics_family(b, "nsd_zones", "gauge", "Zones served.");
+	buffer_printf(b, "nsd_zones{type=\"primary\"} %u\n"
+		"nsd_zones{type=\"secondary\"} %u\n",
+		(unsigned)(xfrd->notify_zones->count - xfrd->zones->count),
+		(unsigned)xfrd->zones->count);
+	if(gettimeofday(&now, NULL) == -1)
+		log_msg(LOG_ERR, "gettimeofday: %s", strerror(errno));
+	metrics_gauge(b, "nsd_uptime_seconds", "Time since the start.",
+		(uint64_t)(now.tv_sec - m->boot_time.tv_sec));
+#ifdef USE_ZONE_STATS
+	metrics_zonestats(b, xfrd);
+#endif
+	buffer_printf(b, "# EOF\n");
+	free(st);
+}
+
+/* make the answer to the request, in c->out */
+static void
+metrics_answer(struct metrics_conn* c)
+{
+	char* method = c->req, *path, *end;
+	const char* status = "200 OK";
+	int head = 0;
+	buffer_type* body;
+	c->region = region_create(xalloc, free);
+	c->out = buffer_create(c->region, 1024);
+	body = buffer_create(c->region, 65536);
+	/* the request line: GET /path HTTP/1.1 */
+	if((path = strchr(method, ' ')) != NULL) {
+		*path++ = 0;
+		if((end = strpbrk(path, " ?\r\n")) != NULL)
+			*end = 0;
+	}
+	if(!path || (strcmp(method, "GET") != 0 && strcmp(method,
+		"HEAD") != 0)) {
+		status = "400 Bad Request";
+		buffer_printf(body, "bad request\n");
+	} else if(strcmp(path, c->m->xfrd->nsd->options->metrics_path) != 0) {
+		status = "404 Not Found";
+		buffer_printf(body, "not found, the metrics are at %s\n",
+			c->m->xfrd->nsd->options->metrics_path);
+	} else {
+		head = (strcmp(method, "HEAD") == 0);
+		metrics_print(c->m, body);
+	}
+	buffer_flip(body);
+	buffer_printf(c->out, "HTTP/1.1 %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %u\r\n"
+		"Connection: close\r\n\r\n", status,
+		status[0]=='2'?"application/openmetrics-text; version=1.0.0; "
+		"charset=utf-8":"text/plain", (unsigned)buffer_limit(body));
+	if(!head) {
+		buffer_reserve(c->out, buffer_limit(body));
+		buffer_write(c->out, buffer_begin(body), buffer_limit(body));
+	}
+	buffer_flip(c->out);
+}
+
+/* read the request, or write the answer */
+static void
+metrics_conn_callback(int fd, short event, void* arg)
+{
+	struct metrics_conn* c = (struct metrics_conn*)arg;
+	struct timeval tv;
+	ssize_t r;
+	if((event&EV_TIMEOUT)) {
+		VERBOSITY(3, (LOG_INFO, "metrics connection timed out"));
+		metrics_conn_close(c);
+		return;
+	}
+	if(!c->out) {
+		r = read(fd, c->req+c->reqlen, sizeof(c->req)-1-c->reqlen);
+		if(r == -1 && (errno == EINTR || errno == EAGAIN ||
+			errno == EWOULDBLOCK))
+			return;
+		if(r <= 0) {
+			metrics_conn_close(c);
+			return;
+		}
+		c->reqlen += (size_t)r;
+		c->req[c->reqlen] = 0;
+		if(!strstr(c->req, "\r\n\r\n") && !strstr(c->req, "\n\n")) {
+			if(c->reqlen >= sizeof(c->req)-1) {
+				VERBOSITY(2, (LOG_INFO, "metrics request "
+					"too long"));
+				metrics_conn_close(c);
+			}
+			return;
+		}
+		metrics_answer(c);
+		/* write the answer when the socket can take it */
+		event_del(&c->ev);
+		event_set(&c->ev, fd, EV_PERSIST|EV_TIMEOUT|EV_WRITE,
+			metrics_conn_callback, c);
+		if(event_base_set(c->m->xfrd->event_base, &c->ev) != 0)
+			log_msg(LOG_ERR, "metrics: cannot set event_base");
+		tv.tv_sec = METRICS_TIMEOUT;
+		tv.tv_usec = 0;
+		if(event_add(&c->ev, &tv) != 0) {
+			log_msg(LOG_ERR, "metrics: cannot add event");
+			c->event_added = 0;
+			metrics_conn_close(c);
+		}
+		return;
+	}
+	r = write(fd, buffer_current(c->out), buffer_remaining(c->out));
+	if(r == -1 && (errno == EINTR || errno == EAGAIN ||
+		errno == EWOULDBLOCK))
+		return;
+	if(r == -1) {
+		VERBOSITY(2, (LOG_INFO, "metrics write: %s", strerror(errno)));
+		metrics_conn_close(c);
+		return;
+	}
+	buffer_skip(c->out, r);
+	if(buffer_remaining(c->out) == 0)
+		metrics_conn_close(c);
+}
+
+/* accept a connection */
+static void
+metrics_accept_callback(int fd, short event, void* arg)
+{
+	struct daemon_metrics* m = (struct daemon_metrics*)arg;
+	struct metrics_conn* c;
+	struct timeval tv;
+	int newfd;
+	if(!(event&EV_READ))
+		return;
+	if((newfd = accept(fd, NULL, NULL)) == -1) {
+		if(errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK
+#ifdef ECONNABORTED
+			&& errno != ECONNABORTED
+#endif
+			)
+			log_msg(LOG_ERR, "metrics accept: %s", strerror(errno));
+		return;
+	}
+	if(m->active >= METRICS_MAX_CONN) {
+		VERBOSITY(2, (LOG_INFO, "metrics: too many connections"));
+		close(newfd);
+		return;
+	}
+	if(fcntl(newfd, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "metrics: fcntl: %s", strerror(errno));
+		close(newfd);
+		return;
+	}
+	c = (struct metrics_conn*)xalloc_zero(sizeof(*c));
+	c->m = m;
+	c->fd = newfd;
+	tv.tv_sec = METRICS_TIMEOUT;
+	tv.tv_usec = 0;
+	event_set(&c->ev, newfd, EV_PERSIST|EV_TIMEOUT|EV_READ,
+		metrics_conn_callback, c);
+	if(event_base_set(m->xfrd->event_base, &c->ev) != 0 ||
+		event_add(&c->ev, &tv) != 0) {
+		log_msg(LOG_ERR, "metrics: cannot add event");
+		close(newfd);
+		free(c);
+		return;
+	}
+	c->event_added = 1;
+	c->next = m->conns;
+	if(c->next) c->next->prev = c;
+	m->conns = c;
+	m->active++;
+}
+
+void
+daemon_metrics_attach(struct daemon_metrics* m, struct xfrd_state* xfrd)
+{
+	struct metrics_listen* l;
+	if(!m) return;
+	m->xfrd = xfrd;
+	for(l = m->listen; l; l = l->next) {
+		event_set(&l->ev, l->fd, EV_PERSIST|EV_READ,
+			metrics_accept_callback, m);
+		if(event_base_set(xfrd->event_base, &l->ev) != 0)
+			log_msg(LOG_ERR, "metrics: cannot set event_base");
+		if(event_add(&l->ev, NULL) != 0)
+			log_msg(LOG_ERR, "metrics: cannot add event");
+		else	l->event_added = 1;
+	}
+}
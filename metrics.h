@@ -0,0 +1,43 @@
+/*
+ * metrics.h - serve the statistics over HTTP in the OpenMetrics format.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+struct xfrd_state;
+struct nsd_options;
+
+/* private, defined in metrics.c */
+struct daemon_metrics;
+
+/*
+ * Create the metrics state and open the listening sockets on the
+ * metrics-interface addresses, before the privileges are dropped.
+ * @param cfg: the options.
+ * @return new state, or NULL on failure.
+ */
+struct daemon_metrics* daemon_metrics_create(struct nsd_options* cfg);
+
+/* close the listening sockets and the connections, and delete */
+void daemon_metrics_delete(struct daemon_metrics* m);
+
+/* close the listening sockets and the connections, in the processes
+ * that do not serve the metrics */
+void daemon_metrics_close(struct daemon_metrics* m);
+
+/*
+ * Serve the metrics in xfrd, from the counters that the servers share and
+ * the totals of xfrd, without a reload or a fork for every scrape.
+ * @param m: the state.
+ * @param xfrd: the process that serves, the listeners are attached to
+ *	its event base.
+ */
+void daemon_metrics_attach(struct daemon_metrics* m, struct xfrd_state* xfrd);
+
+#endif /* METRICS_H */
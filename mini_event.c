@@ -37,7 +37,7 @@
 /**
  * \file
  * fake libevent implementation. Less broad in functionality, and only
- * supports select(2).
+ * supports epoll(7) and select(2).
  */
 
 #include "config.h"
@@ -58,6 +58,10 @@
 #include <signal.h>
 #include "mini_event.h"
 #include "util.h"
+#ifdef MINI_EVENT_EPOLL
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
 
 /** compare events in tree, based on timevalue, ptr for uniqueness */
 int
@@ -102,6 +106,9 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 	if(!base)
 		return NULL;
 	memset(base, 0, sizeof(*base));
+#ifdef MINI_EVENT_EPOLL
+	base->epfd = -1;
+#endif
 	base->region = region_create(xalloc, free);
 	if(!base->region) {
 		free(base);
@@ -119,7 +126,7 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 		return NULL;
 	}
 	base->capfd = MAX_FDS;
-#ifdef FD_SETSIZE
+#if defined(FD_SETSIZE) && !defined(MINI_EVENT_EPOLL)
 	if((int)FD_SETSIZE < base->capfd)
 		base->capfd = (int)FD_SETSIZE;
 #endif
@@ -129,6 +136,20 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 		event_base_free(base);
 		return NULL;
 	}
+#ifdef MINI_EVENT_EPOLL
+	base->epfd = epoll_create(MAX_FDS);
+	if(base->epfd == -1) {
+		event_base_free(base);
+		return NULL;
+	}
+	base->evs = (struct epoll_event*)calloc(MINI_EVENT_EPOLL_BATCH,
+		sizeof(struct epoll_event));
+	base->fdready = (unsigned char*)calloc((size_t)base->capfd, 1);
+	if(!base->evs || !base->fdready) {
+		event_base_free(base);
+		return NULL;
+	}
+#endif
 	base->signals = (struct event**)calloc(MAX_SIG, sizeof(struct event*));
 	if(!base->signals) {
 		event_base_free(base);
@@ -148,11 +169,15 @@ event_get_version(void)
 	return "mini-event-"PACKAGE_VERSION;
 }
 
-/** get polling method, select */
+/** get polling method, epoll or select */
 const char *
 event_get_method(void)
 {
+#ifdef MINI_EVENT_EPOLL
+	return "epoll";
+#else
 	return "select";
+#endif
 }
 
 /** call timeouts handlers, and return how long to wait for next one or -1 */
@@ -194,6 +219,56 @@ handle_timeouts(struct event_base* base, struct timeval* now,
 	return tofired;
 }
 
+#ifdef MINI_EVENT_EPOLL
+/** call epoll_wait and callbacks for that */
+static int
+handle_select(struct event_base* base, struct timeval* wait)
+{
+	int ret, i, timeout = -1;
+
+#ifndef S_SPLINT_S
+	if(wait->tv_sec!=(time_t)-1) {
+		/* round up, the timeouts only fire when their time is past */
+		timeout = (int)wait->tv_sec*1000 + (int)(wait->tv_usec+999)/1000;
+	}
+#endif
+	if((ret = epoll_wait(base->epfd, base->evs, MINI_EVENT_EPOLL_BATCH,
+		timeout)) == -1) {
+		ret = errno;
+		if(settime(base) < 0)
+			return -1;
+		errno = ret;
+		if(ret == EAGAIN || ret == EINTR)
+			return 0;
+		return -1;
+	}
+	if(settime(base) < 0)
+		return -1;
+
+	/* mark them first, a callback that deletes an event for a later
+	 * fd in the list clears the mark, and that fd is then skipped */
+	for(i=0; i<ret; i++)
+		base->fdready[base->evs[i].data.fd] = 1;
+	for(i=0; i<ret; i++) {
+		int fd = base->evs[i].data.fd;
+		uint32_t r = base->evs[i].events;
+		short bits = 0;
+		if(!base->fds[fd] || !base->fdready[fd])
+			continue;
+		base->fdready[fd] = 0;
+		if((r&(EPOLLIN|EPOLLHUP|EPOLLERR)))
+			bits |= EV_READ;
+		if((r&(EPOLLOUT|EPOLLHUP|EPOLLERR)))
+			bits |= EV_WRITE;
+		bits &= base->fds[fd]->ev_flags;
+		if(bits) {
+			(*base->fds[fd]->ev_callback)(base->fds[fd]->ev_fd,
+				bits, base->fds[fd]->ev_arg);
+		}
+	}
+	return 0;
+}
+#else /* !MINI_EVENT_EPOLL */
 /** call select and callbacks for that */
 static int
 handle_select(struct event_base* base, struct timeval* wait)
@@ -244,6 +319,7 @@ handle_select(struct event_base* base, struct timeval* wait)
 	}
 	return 0;
 }
+#endif /* MINI_EVENT_EPOLL */
 
 /** run select once */
 int
@@ -310,6 +386,12 @@ event_base_free(struct event_base* base)
 		free(base->fds);
 	if(base->signals)
 		free(base->signals);
+#ifdef MINI_EVENT_EPOLL
+	if(base->epfd != -1)
+		close(base->epfd);
+	free(base->evs);
+	free(base->fdready);
+#endif
 	region_destroy(base->region);
 	free(base);
 }
@@ -336,12 +418,72 @@ event_base_set(struct event_base* base, struct event* ev)
 	return 0;
 }
 
+#ifdef MINI_EVENT_EPOLL
+/** grow the fds arrays so that fd fits in them */
+static int
+grow_fds(struct event_base* base, int fd)
+{
+	int cap = base->capfd;
+	struct event** fds;
+	unsigned char* fdready;
+	while(cap <= fd)
+		cap *= 2;
+	fds = (struct event**)realloc(base->fds, (size_t)cap *
+		sizeof(struct event*));
+	if(!fds)
+		return 0;
+	memset(fds+base->capfd, 0, (size_t)(cap-base->capfd) *
+		sizeof(struct event*));
+	base->fds = fds;
+	fdready = (unsigned char*)realloc(base->fdready, (size_t)cap);
+	if(!fdready)
+		return 0;
+	memset(fdready+base->capfd, 0, (size_t)(cap-base->capfd));
+	base->fdready = fdready;
+	base->capfd = cap;
+	return 1;
+}
+
+/** register the fd of the event with epoll */
+static int
+epoll_add_fd(struct event* ev)
+{
+	struct epoll_event e;
+	memset(&e, 0, sizeof(e));
+	if(ev->ev_flags&EV_READ)
+		e.events |= EPOLLIN;
+	if(ev->ev_flags&EV_WRITE)
+		e.events |= EPOLLOUT;
+	e.data.fd = ev->ev_fd;
+	if(epoll_ctl(ev->ev_base->epfd, EPOLL_CTL_ADD, ev->ev_fd, &e) == 0)
+		return 1;
+	/* another event for this fd was not deleted, take it over */
+	if(errno == EEXIST && epoll_ctl(ev->ev_base->epfd, EPOLL_CTL_MOD,
+		ev->ev_fd, &e) == 0)
+		return 1;
+	return 0;
+}
+#endif /* MINI_EVENT_EPOLL */
+
 /* add event to make it active, you may not change it with event_set anymore */
 int
 event_add(struct event* ev, struct timeval* tv)
 {
 	if(ev->added)
 		event_del(ev);
+#ifdef MINI_EVENT_EPOLL
+	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd &&
+		!grow_fds(ev->ev_base, ev->ev_fd))
+		return -1;
+	if( (ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
+		if(!epoll_add_fd(ev))
+			return -1;
+		ev->ev_base->fds[ev->ev_fd] = ev;
+		ev->ev_base->fdready[ev->ev_fd] = 0;
+		if(ev->ev_fd > ev->ev_base->maxfd)
+			ev->ev_base->maxfd = ev->ev_fd;
+	}
+#else
 	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd)
 		return -1;
 	if( (ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
@@ -357,6 +499,7 @@ event_add(struct event* ev, struct timeval* tv)
 		if(ev->ev_fd > ev->ev_base->maxfd)
 			ev->ev_base->maxfd = ev->ev_fd;
 	}
+#endif /* MINI_EVENT_EPOLL */
 	if(tv && (ev->ev_flags&EV_TIMEOUT)) {
 #ifndef S_SPLINT_S
 		struct timeval* now = ev->ev_base->time_tv;
@@ -381,6 +524,18 @@ event_del(struct event* ev)
 		return -1;
 	if((ev->ev_flags&EV_TIMEOUT))
 		(void)rbtree_delete(ev->ev_base->times, &ev->node);
+#ifdef MINI_EVENT_EPOLL
+	if((ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1 &&
+		ev->ev_base->fds[ev->ev_fd] == ev) {
+		struct epoll_event e;
+		memset(&e, 0, sizeof(e));
+		/* fails if the fd is already closed, that removed it */
+		(void)epoll_ctl(ev->ev_base->epfd, EPOLL_CTL_DEL, ev->ev_fd,
+			&e);
+		ev->ev_base->fds[ev->ev_fd] = NULL;
+		ev->ev_base->fdready[ev->ev_fd] = 0;
+	}
+#else
 	if((ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
 		ev->ev_base->fds[ev->ev_fd] = NULL;
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->reads);
@@ -388,6 +543,7 @@ event_del(struct event* ev)
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->ready);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->content);
 	}
+#endif /* MINI_EVENT_EPOLL */
 	ev->added = 0;
 	return 0;
 }
@@ -36,14 +36,16 @@
 /**
  * \file
  * This file implements part of the event(3) libevent api.
- * The back end is only select. Max number of fds is limited.
+ * The back end is epoll where the system has it, otherwise select.
+ * With select the max number of fds is limited.
  * Max number of signals is limited, one handler per signal only.
  * And one handler per fd.
  *
- * Although limited to select() and a max (1024) open fds, it
- * is efficient:
+ * With select() limited to a max (1024) open fds, it is efficient:
  * o dispatch call caches fd_sets to use. 
  * o handler calling takes time ~ to the number of fds.
+ * With epoll the fds array grows as needed, and handler calling takes
+ * time ~ to the number of ready fds.  It is level triggered, like select.
  * o timeouts are stored in a redblack tree, sorted, so take log(n).
  * Timeouts are only accurate to the second (no subsecond accuracy).
  * To avoid cpu hogging, fractional timeouts are rounded up to a whole second.
@@ -78,6 +80,14 @@ struct region;
 /** max number of signals to support */
 #define MAX_SIG 32
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE)
+/** use epoll as the back end */
+#define MINI_EVENT_EPOLL 1
+/** max number of ready fds fetched per epoll_wait call */
+#define MINI_EVENT_EPOLL_BATCH 256
+struct epoll_event;
+#endif
+
 /** event base */
 struct event_base
 {
@@ -109,6 +119,15 @@ struct event_base
 	struct timeval* time_tv;
 	/** region for allocation */
 	struct region* region;
+#ifdef MINI_EVENT_EPOLL
+	/** epoll file descriptor */
+	int epfd;
+	/** array of MINI_EVENT_EPOLL_BATCH for epoll_wait results */
+	struct epoll_event* evs;
+	/** array of 0 - capfd, fd was reported ready in this round and
+	 * was not deleted since (like the ready fdset for select) */
+	unsigned char* fdready;
+#endif
 };
 
 /**
@@ -19,6 +19,7 @@
 
 #include "namedb.h"
 #include "nsec3.h"
+#include "udb.h"
 
 static domain_type *
 allocate_domain_info(domain_table_type* table,
@@ -26,31 +27,37 @@ allocate_domain_info(domain_table_type* table,
 		     domain_type* parent)
 {
 	domain_type *result;
+	int tag;
 
 	assert(table);
 	assert(dname);
 	assert(parent);
 
+	tag = region_set_tag(table->region, REGION_TAG_DOMAINS);
 	result = (domain_type *) region_alloc(table->region,
 					      sizeof(domain_type));
 	result->dname = dname_partial_copy(
 		table->region, dname, domain_dname(parent)->label_count + 1);
+	(void)region_set_tag(table->region, tag);
 	result->parent = parent;
 	result->wildcard_child_closest_match = result;
 	result->rrsets = NULL;
+	result->rrset_types = 0;
 	result->usage = 0;
 #ifdef NSEC3
 	result->nsec3 = NULL;
 #endif
 	result->is_existing = 0;
 	result->is_apex = 0;
-	assert(table->numlist_last); /* it exists because root exists */
+	assert(table->numlist_count); /* it exists because root exists */
 	/* push this domain at the end of the numlist */
-	result->number = table->numlist_last->number+1;
-	result->numlist_next = NULL;
-	result->numlist_prev = table->numlist_last;
-	table->numlist_last->numlist_next = result;
-	table->numlist_last = result;
+	if(table->numlist_count+1 >= table->numlist_size) {
+		table->numlist_size *= 2;
+		table->numlist = (domain_type**)xrealloc(table->numlist,
+			table->numlist_size*sizeof(domain_type*));
+	}
+	result->number = ++table->numlist_count;
+	table->numlist[result->number] = result;
 
 	return result;
 }
@@ -59,10 +66,13 @@ allocate_domain_info(domain_table_type* table,
 void
 allocate_domain_nsec3(domain_table_type* table, domain_type* result)
 {
+	int tag;
 	if(result->nsec3)
 		return;
+	tag = region_set_tag(table->region, REGION_TAG_NSEC3);
 	result->nsec3 = (struct nsec3_domain_data*) region_alloc(table->region,
 		sizeof(struct nsec3_domain_data));
+	(void)region_set_tag(table->region, tag);
 	result->nsec3->nsec3_cover = NULL;
 	result->nsec3->nsec3_wcard_child_cover = NULL;
 	result->nsec3->nsec3_ds_parent_cover = NULL;
@@ -84,54 +94,38 @@ allocate_domain_nsec3(domain_table_type* table, domain_type* result)
 static void
 numlist_make_last(domain_table_type* table, domain_type* domain)
 {
-	size_t sw;
-	domain_type* last = table->numlist_last;
+	uint32_t sw;
+	domain_type* last = table->numlist[table->numlist_count];
 	if(domain == last)
 		return;
-	/* swap numbers with the last element */
+	/* swap numbers and places with the last element */
 	sw = domain->number;
 	domain->number = last->number;
 	last->number = sw;
-	/* swap list position with the last element */
-	assert(domain->numlist_next);
-	assert(last->numlist_prev);
-	if(domain->numlist_next != last) {
-		/* case 1: there are nodes between domain .. last */
-		domain_type* span_start = domain->numlist_next;
-		domain_type* span_end = last->numlist_prev;
-		/* these assignments walk the new list from start to end */
-		if(domain->numlist_prev)
-			domain->numlist_prev->numlist_next = last;
-		last->numlist_prev = domain->numlist_prev;
-		last->numlist_next = span_start;
-		span_start->numlist_prev = last;
-		span_end->numlist_next = domain;
-		domain->numlist_prev = span_end;
-		domain->numlist_next = NULL;
-	} else {
-		/* case 2: domain and last are neighbors */
-		/* these assignments walk the new list from start to end */
-		if(domain->numlist_prev)
-			domain->numlist_prev->numlist_next = last;
-		last->numlist_prev = domain->numlist_prev;
-		last->numlist_next = domain;
-		domain->numlist_prev = last;
-		domain->numlist_next = NULL;
-	}
-	table->numlist_last = domain;
+	table->numlist[last->number] = last;
+	table->numlist[domain->number] = domain;
 }
 
 /** pop the biggest domain off the numlist */
 static domain_type*
 numlist_pop_last(domain_table_type* table)
 {
-	domain_type* d = table->numlist_last;
-	table->numlist_last = table->numlist_last->numlist_prev;
-	if(table->numlist_last)
-		table->numlist_last->numlist_next = NULL;
+	domain_type* d = table->numlist[table->numlist_count];
+	table->numlist[table->numlist_count--] = NULL;
 	return d;
 }
 
+/** free the numlist when the region of the table is freed */
+static void
+numlist_cleanup(void* arg)
+{
+	domain_table_type* table = (domain_table_type*)arg;
+	free(table->numlist);
+	table->numlist = NULL;
+	table->numlist_count = 0;
+	table->numlist_size = 0;
+}
+
 /** see if a domain is eligible to be deleted, and thus is not used */
 static int
 domain_can_be_deleted(domain_type* domain)
@@ -210,10 +204,131 @@ prehash_del(domain_table_type* table, domain_type* domain)
 }
 #endif /* NSEC3 */
 
+/** initial number of slots of the domain hash index */
+#define DOMAIN_HASH_START_SIZE 1024
+/** initial number of entries of the numlist of a domain table */
+#define DOMAIN_NUMLIST_START_SIZE 1024
+/** sets bit 0x20 in every byte of a word */
+#define DOMAIN_HASH_FOLD 0x2020202020202020ULL
+/** odd multiplier that mixes the words of the name */
+#define DOMAIN_HASH_MUL 0x9e3779b97f4a7c15ULL
+
+/** hash of the name, without case: bit 0x20 is set in every byte, that
+ * folds the letters, the bytes that it makes equal otherwise are told
+ * apart by the compare of the names */
+static uint32_t
+domain_hash_wire(const uint8_t* p, size_t len)
+{
+	uint64_t h = len, w;
+	while(len > 0) {
+		size_t n = (len < 8 ? len : 8);
+		w = 0;
+		memcpy(&w, p, n);
+		h = (h ^ (w | DOMAIN_HASH_FOLD)) * DOMAIN_HASH_MUL;
+		h ^= h >> 32;
+		p += n;
+		len -= n;
+	}
+	return (uint32_t)((h * DOMAIN_HASH_MUL) >> 32);
+}
+
+static uint32_t
+domain_hash_name(const dname_type* dname)
+{
+	return domain_hash_wire(dname_name(dname), dname->name_size);
+}
+
+/** find the domain with the name, or NULL */
+static domain_type*
+domain_hash_find(struct domain_hash* h, const dname_type* dname)
+{
+	uint32_t hash = domain_hash_name(dname);
+	size_t mask = h->size - 1;
+	size_t i = hash & mask;
+	while(h->slots[i].domain) {
+		const dname_type* d = domain_dname(h->slots[i].domain);
+		/* most queries have the case of the zone data, try memcmp */
+		if(h->slots[i].hash == hash && d->name_size == dname->name_size
+			&& (memcmp(dname_name(d), dname_name(dname),
+			d->name_size) == 0 ||
+			dname_equal_nocase((uint8_t*)dname_name(d),
+			(uint8_t*)dname_name(dname), d->name_size)))
+			return h->slots[i].domain;
+		i = (i+1) & mask;
+	}
+	return NULL;
+}
+
+/** put the domain in the first free slot from its hash */
+static void
+domain_hash_put(struct domain_hash* h, uint32_t hash, domain_type* domain)
+{
+	size_t mask = h->size - 1;
+	size_t i = hash & mask;
+	while(h->slots[i].domain)
+		i = (i+1) & mask;
+	h->slots[i].hash = hash;
+	h->slots[i].domain = domain;
+	h->count++;
+}
+
+/** add the domain, doubles the size when the index gets half full */
+static void
+domain_hash_add(domain_table_type* table, domain_type* domain)
+{
+	struct domain_hash* h = table->hash;
+	if((h->count+1)*2 > h->size) {
+		struct domain_hash_slot* old = h->slots;
+		size_t oldsize = h->size, i;
+		h->slots = (struct domain_hash_slot*)region_alloc_array_zero(
+			table->region, oldsize*2,
+			sizeof(struct domain_hash_slot));
+		h->size = oldsize*2;
+		h->count = 0;
+		for(i=0; i<oldsize; i++)
+			if(old[i].domain)
+				domain_hash_put(h, old[i].hash, old[i].domain);
+		region_recycle(table->region, old,
+			oldsize*sizeof(struct domain_hash_slot));
+	}
+	domain_hash_put(h, domain_hash_name(domain_dname(domain)), domain);
+}
+
+/** remove the domain, the slots after it that are not at their home
+ * position are shifted back, so that the probe sequences stay intact */
+static void
+domain_hash_del(struct domain_hash* h, domain_type* domain)
+{
+	size_t mask = h->size - 1;
+	size_t i = domain_hash_name(domain_dname(domain)) & mask, j;
+	while(h->slots[i].domain != domain) {
+		if(!h->slots[i].domain)
+			return;
+		i = (i+1) & mask;
+	}
+	j = i;
+	for(;;) {
+		size_t home;
+		j = (j+1) & mask;
+		if(!h->slots[j].domain)
+			break;
+		home = h->slots[j].hash & mask;
+		/* can move to i if i is between home and j */
+		if(((j - home) & mask) >= ((j - i) & mask)) {
+			h->slots[i] = h->slots[j];
+			i = j;
+		}
+	}
+	h->slots[i].domain = NULL;
+	h->slots[i].hash = 0;
+	h->count--;
+}
+
 /** perform domain name deletion */
 static void
 do_deldomain(namedb_type* db, domain_type* domain)
 {
+	int tag;
 	assert(domain && domain->parent); /* exists and not root */
 	/* first adjust the number list so that domain is the last one */
 	numlist_make_last(db->domains, domain);
@@ -227,9 +342,12 @@ do_deldomain(namedb_type* db, domain_type* domain)
 
 	/* see if nsec3-nodes are used */
 	if(domain->nsec3) {
-		if(domain->nsec3->nsec3_node.key)
-			zone_del_domain_in_hash_tree(nsec3_tree_zone(db, domain)
-				->nsec3tree, &domain->nsec3->nsec3_node);
+		if(domain->nsec3->nsec3_node.key) {
+			zone_type* z = nsec3_tree_zone(db, domain);
+			zone_del_domain_in_hash_tree(z->nsec3tree,
+				&domain->nsec3->nsec3_node);
+			nsec3_index_del(z, domain);
+		}
 		if(domain->nsec3->hash_node.key)
 			zone_del_domain_in_hash_tree(nsec3_tree_zone(db, domain)
 				->hashtree, &domain->nsec3->hash_node);
@@ -239,8 +357,10 @@ do_deldomain(namedb_type* db, domain_type* domain)
 		if(domain->nsec3->dshash_node.key)
 			zone_del_domain_in_hash_tree(nsec3_tree_dszone(db, domain)
 				->dshashtree, &domain->nsec3->dshash_node);
+		tag = region_set_tag(db->domains->region, REGION_TAG_NSEC3);
 		region_recycle(db->domains->region, domain->nsec3,
 			sizeof(struct nsec3_domain_data));
+		(void)region_set_tag(db->domains->region, tag);
 	}
 #endif /* NSEC3 */
 
@@ -252,20 +372,26 @@ do_deldomain(namedb_type* db, domain_type* domain)
 			domain_previous_existing_child(domain);
 
 	/* actual removal */
+	if(db->domains->hash)
+		domain_hash_del(db->domains->hash, domain);
 	radix_delete(db->domains->nametree, domain->rnode);
+	tag = region_set_tag(db->domains->region, REGION_TAG_DOMAINS);
 	region_recycle(db->domains->region, (dname_type*)domain->dname,
 		dname_total_size(domain->dname));
 	region_recycle(db->domains->region, domain, sizeof(domain_type));
+	(void)region_set_tag(db->domains->region, tag);
 }
 
 void
 domain_table_deldomain(namedb_type* db, domain_type* domain)
 {
+	domain_type* parent;
 	while(domain_can_be_deleted(domain)) {
+		parent = domain->parent;
 		/* delete it */
 		do_deldomain(db, domain);
 		/* test parent */
-		domain = domain->parent;
+		domain = parent;
 	}
 }
 
@@ -317,12 +443,11 @@ domain_table_create(region_type* region)
 	root->parent = NULL;
 	root->wildcard_child_closest_match = root;
 	root->rrsets = NULL;
+	root->rrset_types = 0;
 	root->number = 1; /* 0 is used for after header */
 	root->usage = 1; /* do not delete root, ever */
 	root->is_existing = 0;
 	root->is_apex = 0;
-	root->numlist_prev = NULL;
-	root->numlist_next = NULL;
 #ifdef NSEC3
 	root->nsec3 = NULL;
 #endif
@@ -335,19 +460,138 @@ domain_table_create(region_type* region)
 		root->dname->name_size, root);
 
 	result->root = root;
-	result->numlist_last = root;
+	result->numlist_size = DOMAIN_NUMLIST_START_SIZE;
+	result->numlist = (domain_type**)xalloc_array_zero(
+		result->numlist_size, sizeof(domain_type*));
+	result->numlist[1] = root;
+	result->numlist_count = 1;
+	region_add_cleanup(region, numlist_cleanup, result);
 #ifdef NSEC3
 	result->prehash_list = NULL;
 #endif
+	result->hash = NULL;
 
 	return result;
 }
 
+void
+domain_table_hash_enable(domain_table_type* table)
+{
+	uint32_t i;
+	if(table->hash)
+		return;
+	table->hash = (struct domain_hash*)region_alloc(table->region,
+		sizeof(struct domain_hash));
+	table->hash->size = DOMAIN_HASH_START_SIZE;
+	table->hash->count = 0;
+	table->hash->slots = (struct domain_hash_slot*)region_alloc_array_zero(
+		table->region, table->hash->size,
+		sizeof(struct domain_hash_slot));
+	for(i = 1; i <= table->numlist_count; i++)
+		domain_hash_add(table, table->numlist[i]);
+}
+
+int
+domain_table_prefetch_start(domain_table_type* table,
+	struct domain_prefetch* p, const uint8_t* name, size_t max)
+{
+	size_t len = 0;
+	p->slot = NULL;
+	p->domain = NULL;
+	p->active = 0;
+	/* the name is in the packet, check it before it is hashed */
+	while(len < max && name[len] != 0) {
+		if((name[len] & 0xc0))
+			return 0;
+		len += name[len] + 1;
+	}
+	if(len >= max || len+1 > MAXDOMAINLEN)
+		return 0;
+	p->name = name;
+	p->namelen = len+1;
+	if(table->hash) {
+		p->hash = domain_hash_wire(name, p->namelen);
+		p->slot = &table->hash->slots[p->hash & (table->hash->size-1)];
+		PREFETCH(p->slot);
+		p->active = 1;
+	} else {
+		p->active = radname_prefetch_start(table->nametree, &p->rad,
+			name, p->namelen);
+	}
+	return p->active;
+}
+
+int
+domain_table_prefetch_step(domain_table_type* table,
+	struct domain_prefetch* p)
+{
+	if(p->domain) {
+		/* the lookup compares the name, the answer reads the rrsets */
+		PREFETCH(p->domain->dname);
+		PREFETCH(p->domain->rrsets);
+		p->domain = NULL;
+		p->active = 0;
+	} else if(p->slot) {
+		/* the probes after the slot are mostly in its cache line */
+		size_t mask = table->hash->size - 1;
+		size_t i = p->slot - table->hash->slots;
+		p->slot = NULL;
+		while(table->hash->slots[i].domain &&
+			table->hash->slots[i].hash != p->hash)
+			i = (i+1) & mask;
+		if((p->domain = table->hash->slots[i].domain) != NULL) {
+			PREFETCH(p->domain);
+			p->active = 1;
+		} else {
+			p->active = radname_prefetch_start(table->nametree,
+				&p->rad, p->name, p->namelen);
+		}
+	} else {
+		p->active = radix_prefetch_step(&p->rad);
+	}
+	return p->active;
+}
+
+void
+domain_prefault(domain_type* domain)
+{
+	/* the reads must not be optimized away */
+	volatile uint8_t sink = 0;
+	rrset_type* rrset;
+	uint16_t i;
+	uint8_t j;
+	sink ^= dname_name(domain_dname(domain))[0];
+	for(rrset = domain->rrsets; rrset; rrset = rrset->next) {
+		sink ^= (uint8_t)rrset->zone->is_secure;
+		for(i=0; i<rrset->rr_count; i++) {
+			rr_type* rr = &rrset->rrs[i];
+			if(rr_rdata_size(rr) > 0)
+				sink ^= *(uint8_t*)rr->rdata;
+			/* the names in the answer, and their glue */
+			for(j=0; j<rr->rdata_domains; j++) {
+				domain_type* d = rr_rdata_domains(rr)[j];
+				sink ^= dname_name(domain_dname(d))[0];
+				sink ^= (uint8_t)(d->rrsets != NULL);
+			}
+		}
+	}
+	(void)sink;
+}
+
 int
 domain_table_search(domain_table_type *table,
 		   const dname_type   *dname,
 		   domain_type       **closest_match,
 		   domain_type       **closest_encloser)
+{
+	return domain_table_search_key(table, dname, NULL, 0, closest_match,
+		closest_encloser);
+}
+
+int
+domain_table_search_key(domain_table_type* table, const dname_type* dname,
+	const uint8_t* key, radstrlen_t keylen, domain_type** closest_match,
+	domain_type** closest_encloser)
 {
 	int exact;
 	uint8_t label_match_count;
@@ -357,8 +601,21 @@ domain_table_search(domain_table_type *table,
 	assert(closest_match);
 	assert(closest_encloser);
 
-	exact = radname_find_less_equal(table->nametree, dname_name(dname),
-		dname->name_size, (struct radnode**)closest_match);
+	if(table->hash) {
+		domain_type* d = domain_hash_find(table->hash, dname);
+		if(d) {
+			*closest_match = d;
+			*closest_encloser = d;
+			return 1;
+		}
+	}
+
+	if(key)
+		exact = radix_find_less_equal(table->nametree, (uint8_t*)key,
+			keylen, (struct radnode**)closest_match);
+	else	exact = radname_find_less_equal(table->nametree,
+			dname_name(dname), dname->name_size,
+			(struct radnode**)closest_match);
 	*closest_match = (domain_type*)((*(struct radnode**)closest_match)->elem);
 	assert(*closest_match);
 
@@ -392,6 +649,46 @@ domain_table_find(domain_table_type* table,
 }
 
 
+/*
+ * If the newly added domain name is larger than the parent's current
+ * wildcard_child_closest_match but smaller or equal to the wildcard
+ * domain name, update the parent's wildcard_child_closest_match field.
+ */
+static void
+domain_wildcard_child_update(domain_type* parent, domain_type* result)
+{
+	if (label_compare(dname_name(domain_dname(result)),
+			  (const uint8_t *) "\001*") <= 0
+	    && dname_compare(domain_dname(result),
+			     domain_dname(parent->wildcard_child_closest_match)) > 0)
+	{
+		parent->wildcard_child_closest_match = result;
+	}
+}
+
+/* insert the name and its parents that are not there yet below the
+ * closest encloser, the radix tree is searched from the node of it */
+static domain_type*
+domain_table_insert_below(domain_table_type* table,
+	domain_type* closest_encloser, const dname_type* dname)
+{
+	domain_type* result;
+	assert(domain_dname(closest_encloser)->label_count < dname->label_count);
+	do {
+		result = allocate_domain_info(table, dname, closest_encloser);
+		result->rnode = radname_insert_below(table->nametree,
+			closest_encloser->rnode,
+			domain_dname(closest_encloser)->name_size,
+			dname_name(result->dname), result->dname->name_size,
+			result);
+		if(table->hash)
+			domain_hash_add(table, result);
+		domain_wildcard_child_update(closest_encloser, result);
+		closest_encloser = result;
+	} while (domain_dname(closest_encloser)->label_count < dname->label_count);
+	return result;
+}
+
 domain_type *
 domain_table_insert(domain_table_type* table,
 		    const dname_type* dname)
@@ -409,40 +706,121 @@ domain_table_insert(domain_table_type* table,
 	if (exact) {
 		result = closest_encloser;
 	} else {
-		assert(domain_dname(closest_encloser)->label_count < dname->label_count);
-
-		/* Insert new node(s).  */
-		do {
-			result = allocate_domain_info(table,
-						      dname,
-						      closest_encloser);
-			result->rnode = radname_insert(table->nametree,
-				dname_name(result->dname),
-				result->dname->name_size, result);
-
-			/*
-			 * If the newly added domain name is larger
-			 * than the parent's current
-			 * wildcard_child_closest_match but smaller or
-			 * equal to the wildcard domain name, update
-			 * the parent's wildcard_child_closest_match
-			 * field.
-			 */
-			if (label_compare(dname_name(domain_dname(result)),
-					  (const uint8_t *) "\001*") <= 0
-			    && dname_compare(domain_dname(result),
-					     domain_dname(closest_encloser->wildcard_child_closest_match)) > 0)
-			{
-				closest_encloser->wildcard_child_closest_match
-					= result;
-			}
-			closest_encloser = result;
-		} while (domain_dname(closest_encloser)->label_count < dname->label_count);
+		result = domain_table_insert_below(table, closest_encloser,
+			dname);
 	}
 
 	return result;
 }
 
+domain_type*
+domain_table_insert_cursor(domain_table_type* table,
+	struct domain_cursor* cursor, const dname_type* dname)
+{
+	domain_type* last = cursor->last, *next, *encloser;
+	uint8_t label_match_count;
+	int c;
+
+	if(!last || (c = dname_compare(dname, domain_dname(last))) < 0 ||
+		((next = domain_next(last)) != NULL &&
+		dname_compare(domain_dname(next), dname) <= 0)) {
+		cursor->last = domain_table_insert(table, dname);
+		return cursor->last;
+	}
+	if(c == 0)
+		return last;
+
+	/* there is no name between last and the new name, so the names
+	 * that enclose the new name, and are there, enclose last too */
+	label_match_count = dname_label_match_count(domain_dname(last), dname);
+	encloser = last;
+	while(domain_dname(encloser)->label_count > label_match_count)
+		encloser = encloser->parent;
+	cursor->last = domain_table_insert_below(table, encloser, dname);
+	return cursor->last;
+}
+
+int
+domain_table_bulk_insert(domain_table_type* table, domain_type* apex,
+	const dname_type** dnames, size_t num, domain_type** result)
+{
+	region_type* tmp;
+	domain_type* last = apex, *d, *next = domain_next(apex);
+	uint8_t** keys;
+	radstrlen_t* lens, apexlen;
+	domain_type** domains;
+	struct radnode** nodes;
+	size_t i, cnt = 0, max = num+1;
+	uint8_t buf[MAXDOMAINLEN*2];
+	int ok;
+
+	/* there must be no names below the apex yet, and the names must be
+	 * sorted, so that every name is the closest encloser of the names
+	 * after it, or a parent of it is */
+	if(next && domain_is_subdomain(next, apex))
+		return 0;
+	for(i=0; i<num; i++) {
+		if(!dname_is_subdomain(dnames[i], domain_dname(apex)) ||
+			(i > 0 && dname_compare(dnames[i-1], dnames[i]) >= 0))
+			return 0;
+	}
+	apexlen = sizeof(buf);
+	radname_d2r(buf, &apexlen, dname_name(domain_dname(apex)),
+		domain_dname(apex)->name_size);
+
+	tmp = region_create(xalloc, free);
+	keys = (uint8_t**)xalloc_array_zero(max, sizeof(uint8_t*));
+	lens = (radstrlen_t*)xalloc_array_zero(max, sizeof(radstrlen_t));
+	domains = (domain_type**)xalloc_array_zero(max, sizeof(domain_type*));
+	for(i=0; i<num; i++) {
+		while(!dname_is_subdomain(dnames[i], domain_dname(last)))
+			last = last->parent;
+		/* create the name, and its parents that are not there yet,
+		 * in the order of the tree */
+		while(domain_dname(last)->label_count <
+			dnames[i]->label_count) {
+			d = allocate_domain_info(table, dnames[i], last);
+			if(table->hash)
+				domain_hash_add(table, d);
+			domain_wildcard_child_update(last, d);
+			if(cnt == max) {
+				max *= 2;
+				keys = (uint8_t**)xrealloc(keys,
+					max*sizeof(uint8_t*));
+				lens = (radstrlen_t*)xrealloc(lens,
+					max*sizeof(radstrlen_t));
+				domains = (domain_type**)xrealloc(domains,
+					max*sizeof(domain_type*));
+			}
+			lens[cnt] = sizeof(buf);
+			radname_d2r(buf, &lens[cnt], dname_name(d->dname),
+				d->dname->name_size);
+			keys[cnt] = (uint8_t*)region_alloc_init(tmp, buf,
+				lens[cnt]);
+			domains[cnt++] = d;
+			last = d;
+		}
+		result[i] = last;
+	}
+	nodes = (struct radnode**)xalloc_array_zero(cnt+1,
+		sizeof(struct radnode*));
+	ok = radix_bulk_insert(table->nametree, apex->rnode, apexlen, keys,
+		lens, (void**)domains, nodes, cnt);
+	for(i=0; i<cnt; i++) {
+		if(ok)
+			domains[i]->rnode = nodes[i];
+		else	domains[i]->rnode = radname_insert(table->nametree,
+				dname_name(domains[i]->dname),
+				domains[i]->dname->name_size, domains[i]);
+	}
+	free(nodes);
+	free(keys);
+	free(lens);
+	free(domains);
+	region_destroy(tmp);
+	return 1;
+}
+
 domain_type *domain_previous_existing_child(domain_type* domain)
 {
 	domain_type* parent = domain->parent;
@@ -469,6 +847,7 @@ domain_add_rrset(domain_type* domain, rrset_type* rrset)
 	*p = rrset;
 	rrset->next = 0;
 #endif
+	domain->rrset_types |= rrset_type_bit(rrset->type);
 
 	while (domain && !domain->is_existing) {
 		domain->is_existing = 1;
@@ -485,21 +864,281 @@ domain_add_rrset(domain_type* domain, rrset_type* rrset)
 	}
 }
 
+void
+zone_mem_rr(zone_type* zone, rr_type* rr, int add)
+{
+	size_t rd = rr_rdata_size(rr);
+	if(add) {
+		zone->mem.rrsets += sizeof(rr_type);
+		zone->mem.rdata += rd;
+	} else {
+		zone->mem.rrsets -= sizeof(rr_type);
+		zone->mem.rdata -= rd;
+	}
+}
+
+/** initial number of buckets of the rdata table */
+#define RDATA_TABLE_START_SIZE 1024
+
+static uint32_t
+rdata_hash(const uint8_t* p, size_t len)
+{
+	uint64_t h = len, w;
+	while(len > 0) {
+		size_t n = (len < 8 ? len : 8);
+		w = 0;
+		memcpy(&w, p, n);
+		h = (h ^ w) * DOMAIN_HASH_MUL;
+		h ^= h >> 32;
+		p += n;
+		len -= n;
+	}
+	return (uint32_t)((h * DOMAIN_HASH_MUL) >> 32);
+}
+
+void
+namedb_rdata_table_enable(struct namedb* db)
+{
+	if(db->rdata_table)
+		return;
+	db->rdata_table = (struct rdata_table*)region_alloc(db->region,
+		sizeof(struct rdata_table));
+	db->rdata_table->size = RDATA_TABLE_START_SIZE;
+	db->rdata_table->count = 0;
+	db->rdata_table->buckets = (struct rdata_share**)
+		region_alloc_array_zero(db->region, db->rdata_table->size,
+		sizeof(struct rdata_share*));
+}
+
+static void
+rdata_table_grow(struct namedb* db, struct rdata_table* t)
+{
+	struct rdata_share** old = t->buckets;
+	struct rdata_share* s, *next;
+	size_t oldsize = t->size, i;
+	t->buckets = (struct rdata_share**)region_alloc_array_zero(db->region,
+		oldsize*2, sizeof(struct rdata_share*));
+	t->size = oldsize*2;
+	for(i=0; i<oldsize; i++) {
+		for(s = old[i]; s; s = next) {
+			next = s->next;
+			s->next = t->buckets[s->hash & (t->size-1)];
+			t->buckets[s->hash & (t->size-1)] = s;
+		}
+	}
+	region_recycle(db->region, old, oldsize*sizeof(struct rdata_share*));
+}
+
+void
+rr_share_rdata(struct namedb* db, region_type* region, rr_type* rr)
+{
+	struct rdata_table* t = db->rdata_table;
+	struct rdata_share* s;
+	size_t size = rr_rdata_size(rr);
+	uint32_t h;
+	int dbtag, tag;
+	if(!t || !rr->rdata || rr->rdata_shared)
+		return;
+	dbtag = region_set_tag(db->region, REGION_TAG_RDATA);
+	h = rdata_hash((uint8_t*)rr->rdata, size);
+	for(s = t->buckets[h & (t->size-1)]; s; s = s->next) {
+		if(s->hash == h && s->size == size &&
+			memcmp(s+1, rr->rdata, size) == 0)
+			break;
+	}
+	if(s) {
+		s->refs++;
+	} else {
+		if(t->count+1 > t->size)
+			rdata_table_grow(db, t);
+		s = (struct rdata_share*)region_alloc(db->region,
+			sizeof(*s) + size);
+		memcpy(s+1, rr->rdata, size);
+		s->hash = h;
+		s->refs = 1;
+		s->size = size;
+		s->next = t->buckets[h & (t->size-1)];
+		t->buckets[h & (t->size-1)] = s;
+		t->count++;
+	}
+	tag = region_set_tag(region, REGION_TAG_RDATA);
+	region_recycle(region, rr->rdata, size);
+	(void)region_set_tag(region, tag);
+	(void)region_set_tag(db->region, dbtag);
+	rr->rdata = s+1;
+	rr->rdata_shared = 1;
+}
+
+void
+rr_release_rdata(struct namedb* db, region_type* region, rr_type* rr)
+{
+	struct rdata_table* t = db->rdata_table;
+	struct rdata_share* s, **p;
+	int tag;
+	if(!rr->rdata_shared) {
+		tag = region_set_tag(region, REGION_TAG_RDATA);
+		region_recycle(region, rr->rdata, rr_rdata_size(rr));
+		(void)region_set_tag(region, tag);
+		return;
+	}
+	/* the domains in the rdata can be deleted already, the copy is
+	 * found with the hash in its header */
+	s = ((struct rdata_share*)rr->rdata) - 1;
+	assert(t && s->refs > 0);
+	if(--s->refs > 0)
+		return;
+	for(p = &t->buckets[s->hash & (t->size-1)]; *p; p = &(*p)->next) {
+		if(*p == s) {
+			*p = s->next;
+			break;
+		}
+	}
+	t->count--;
+	tag = region_set_tag(db->region, REGION_TAG_RDATA);
+	region_recycle(db->region, s, sizeof(*s) + s->size);
+	(void)region_set_tag(db->region, tag);
+}
+
+void
+zone_mem_rrset(zone_type* zone, domain_type* domain, rrset_type* rrset,
+	int add)
+{
+	rrset_type* r;
+	int n = 0;
+	uint16_t i;
+	for(r = domain->rrsets; r; r = r->next)
+		if(r->zone == zone)
+			n++;
+	if(n == 1) {
+		size_t d = sizeof(domain_type) + sizeof(domain_type*) +
+			dname_total_size(domain_dname(domain));
+		if(add) {
+			zone->mem.domains += d;
+			zone->mem.domain_count++;
+		} else {
+			zone->mem.domains -= d;
+			zone->mem.domain_count--;
+		}
+	}
+	if(add)
+		zone->mem.rrsets += sizeof(rrset_type);
+	else	zone->mem.rrsets -= sizeof(rrset_type);
+	for(i=0; i<rrset->rr_count; i++)
+		zone_mem_rr(zone, &rrset->rrs[i], add);
+}
+
+void
+zone_get_mem_stat(zone_type* zone, struct zone_mem_stat* mem)
+{
+	*mem = zone->mem;
+#ifdef NSEC3
+	/* every domain with precompiled data is in the hash tree */
+	if(zone->hashtree)
+		mem->nsec3 = zone->hashtree->count *
+			sizeof(struct nsec3_domain_data);
+#endif
+}
+
+
+void
+rrset_wire_min_update(rrset_type* rrset)
+{
+	/* a name is at least one byte, the root label or the first byte
+	 * of a compression pointer */
+	uint64_t size = 0;
+	uint16_t i;
+	for(i = 0; i < rrset->rr_count; i++)
+		size += 1 + 10 + rrset->rrs[i].rdlength +
+			rrset->rrs[i].rdata_domains;
+	rrset->wire_min = (size > 0xffffffff ? 0xffffffff : (uint32_t)size);
+}
+
+/* write the name at p, a name below the apex ends in a pointer to the
+ * apex, that is noted in w; returns the end of the name */
+static uint8_t*
+soa_nx_wire_dname(uint8_t* p, struct soa_nx_wire* w, uint8_t* start,
+	const dname_type* name, const dname_type* apex)
+{
+	if(!dname_is_subdomain(name, apex)) {
+		memcpy(p, dname_name(name), name->name_size);
+		return p + name->name_size;
+	}
+	memcpy(p, dname_name(name), name->name_size - apex->name_size);
+	p += name->name_size - apex->name_size;
+	w->ptr[w->ptr_count++] = (uint16_t)(p - start);
+	write_uint16(p, 0xc000);
+	return p + sizeof(uint16_t);
+}
+
+void
+zone_soa_nx_wire_update(zone_type* zone)
+{
+	/* the owner pointer, type, class, ttl and rdlength, the names
+	 * and serial to minimum */
+	uint8_t buf[2 + 10 + 2*MAXDOMAINLEN + 20];
+	const dname_type* apex = domain_dname(zone->apex);
+	rr_type* rr = zone->soa_nx_rrset->rrs;
+	struct soa_nx_wire w;
+	uint8_t* p = buf;
+	uint8_t* rdata;
+
+	if(zone->soa_nx_wire) {
+		region_recycle(zone->region, zone->soa_nx_wire,
+			sizeof(struct soa_nx_wire) + zone->soa_nx_wire->len);
+		zone->soa_nx_wire = NULL;
+	}
+	/* the root zone and an SOA that is not in the usual form use the
+	 * encoder */
+	if(apex->label_count == 1 || rr->rdata_domains != 2 ||
+		rr->rdlength != 20)
+		return;
+	memset(&w, 0, sizeof(w));
+	w.ptr[w.ptr_count++] = 0;
+	write_uint16(p, 0xc000);
+	write_uint16(p + 2, TYPE_SOA);
+	write_uint16(p + 4, rr->klass);
+	write_uint32(p + 6, rr->ttl);
+	rdata = p + 12;
+	p = soa_nx_wire_dname(rdata, &w, buf,
+		domain_dname(rr_rdata_domains(rr)[0]), apex);
+	p = soa_nx_wire_dname(p, &w, buf,
+		domain_dname(rr_rdata_domains(rr)[1]), apex);
+	memcpy(p, rr_rdata_wire(rr), rr->rdlength);
+	p += rr->rdlength;
+	write_uint16(rdata - sizeof(uint16_t), (uint16_t)(p - rdata));
+
+	w.len = (uint16_t)(p - buf);
+	zone->soa_nx_wire = (struct soa_nx_wire*)region_alloc(zone->region,
+		sizeof(struct soa_nx_wire) + w.len);
+	w.data = (uint8_t*)(zone->soa_nx_wire + 1);
+	memcpy(w.data, buf, w.len);
+	*zone->soa_nx_wire = w;
+}
 
 rrset_type *
 domain_find_rrset(domain_type* domain, zone_type* zone, uint16_t type)
 {
-	rrset_type* result = domain->rrsets;
+	rrset_type* result;
 
-	while (result) {
-		if (result->zone == zone && rrset_rrtype(result) == type) {
+	if (!(domain->rrset_types & rrset_type_bit(type)))
+		return NULL;
+	for (result = domain->rrsets; result; result = result->next) {
+		if (result->type == type && result->zone == zone) {
 			return result;
 		}
-		result = result->next;
 	}
 	return NULL;
 }
 
+void
+domain_rrset_types_update(domain_type* domain)
+{
+	rrset_type* rrset;
+	domain->rrset_types = 0;
+	for (rrset = domain->rrsets; rrset; rrset = rrset->next)
+		domain->rrset_types |= rrset_type_bit(rrset->type);
+}
+
 rrset_type *
 domain_find_any_rrset(domain_type* domain, zone_type* zone)
 {
@@ -588,6 +1227,37 @@ domain_wildcard_child(domain_type* domain)
 	}
 }
 
+struct udb_base*
+namedb_udb_read_start(namedb_type* db)
+{
+	udb_base* udb = (db->udb?db->udb:db->udb_read);
+	if(!udb)
+		return NULL;
+	/* the reload process holds the write lock itself */
+	if(db->udb_locked)
+		return udb;
+	/* another process may be changing the udb, the lock is not
+	 * waited for */
+	if(!udb_base_lock(udb, 0))
+		return NULL;
+	if(udb_base_get_userflags(udb) != 0) {
+		/* an update of the udb has not completed */
+		udb_base_unlock(udb);
+		return NULL;
+	}
+	/* it may have grown or shrunk since the fork */
+	if(udb->glob_data->fsize != udb->base_size)
+		udb_base_remap_process(udb);
+	return udb;
+}
+
+void
+namedb_udb_read_end(namedb_type* db, udb_base* udb)
+{
+	if(!db->udb_locked)
+		udb_base_unlock(udb);
+}
+
 int
 zone_is_secure(zone_type* zone)
 {
@@ -600,9 +1270,9 @@ rr_rrsig_type_covered(rr_type* rr)
 {
 	assert(rr->type == TYPE_RRSIG);
 	assert(rr->rdata_count > 0);
-	assert(rdata_atom_size(rr->rdatas[0]) == sizeof(uint16_t));
+	assert(rr->rdlength >= sizeof(uint16_t));
 
-	return ntohs(* (uint16_t *) rdata_atom_data(rr->rdatas[0]));
+	return read_uint16(rr_rdata_wire(rr));
 }
 
 zone_type *
@@ -645,3 +1315,12 @@ namedb_lookup(struct namedb* db,
 	return domain_table_search(
 		db->domains, dname, closest_match, closest_encloser);
 }
+
+int
+namedb_lookup_key(struct namedb* db, const dname_type* dname,
+	const uint8_t* key, radstrlen_t keylen, domain_type** closest_match,
+	domain_type** closest_encloser)
+{
+	return domain_table_search_key(db->domains, dname, key, keylen,
+		closest_match, closest_encloser);
+}
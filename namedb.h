@@ -39,13 +39,57 @@ struct domain_table
 	region_type* region;
 	struct radtree *nametree;
 	domain_type* root;
-	/* ptr to biggest domain.number and last in list.
-	 * the root is the lowest and first in the list. */
-	domain_type *numlist_last;
+	/* the domains by domain.number, the numbers are 1..numlist_count
+	 * without holes, the root is number 1, numlist[0] is not used.
+	 * The array is allocated with malloc, numlist_size entries. */
+	domain_type** numlist;
+	uint32_t numlist_count;
+	uint32_t numlist_size;
 #ifdef NSEC3
 	/* the prehash list, start of the list */
 	domain_type* prehash_list;
 #endif /* NSEC3 */
+	/* hash index of the names for exact matches, NULL if not used */
+	struct domain_hash* hash;
+};
+
+/* slot of the domain hash index, domain is NULL if the slot is free */
+struct domain_hash_slot
+{
+	uint32_t hash;
+	domain_type* domain;
+};
+
+/*
+ * Hash index of the domain names, with open addressing and linear
+ * probing.  The hash ignores the case of the name, the size is a power
+ * of two and the index is at most half full.
+ */
+struct domain_hash
+{
+	size_t size;
+	size_t count;
+	struct domain_hash_slot* slots;
+};
+
+/*
+ * Prefetch of the lookup of a name, for a batch of queries.  With the
+ * hash index the slot and then the domain are prefetched, a name that is
+ * not in the index, and the tables without it, walk the radix tree.
+ */
+struct domain_prefetch
+{
+	/* the name, in the packet */
+	const uint8_t* name;
+	size_t namelen;
+	/* the slot of the index that is prefetched, or NULL */
+	struct domain_hash_slot* slot;
+	/* the domain that is prefetched, or NULL */
+	domain_type* domain;
+	uint32_t hash;
+	/* true while there is more to prefetch */
+	int active;
+	struct radprefetch rad;
 };
 
 #ifdef NSEC3
@@ -94,10 +138,10 @@ struct domain
 #ifdef NSEC3
 	struct nsec3_domain_data* nsec3;
 #endif
-	/* double-linked list sorted by domain.number */
-	domain_type* numlist_prev, *numlist_next;
-	size_t     number; /* Unique domain name number.  */
-	size_t     usage; /* number of ptrs to this from RRs(in rdata) and
+	/* Unique domain name number, the index in the table numlist, the
+	 * numbers stay 32 bit so that the domain fits in a cache line.  */
+	uint32_t   number;
+	uint32_t   usage; /* number of ptrs to this from RRs(in rdata) and
 			     from zone-apex pointers, also the root has one
 			     more to make sure it cannot be deleted. */
 
@@ -106,6 +150,38 @@ struct domain
 	 */
 	unsigned     is_existing : 1;
 	unsigned     is_apex : 1;
+	/* the rrset_type_bit of the types of the rrsets, of all zones */
+	uint16_t     rrset_types;
+};
+
+/* memory in use by the data of a zone, in bytes */
+struct zone_mem_stat {
+	/* the owner names, domain_type, numlist entry and dname, and
+	 * their number */
+	uint64_t domains;
+	uint64_t domain_count;
+	/* rrset_type and the rr_type arrays */
+	uint64_t rrsets;
+	/* the rdata of the rrs */
+	uint64_t rdata;
+	/* NSEC3 precompiled data of the domains */
+	uint64_t nsec3;
+};
+
+/*
+ * The SOA of soa_nx_rrset encoded for the authority section of NXDOMAIN
+ * and NODATA answers, it does not depend on the query name.  The owner
+ * and the names in the rdata below the apex are compressed with pointers
+ * to the apex, those are written with the offset of the apex in the
+ * packet, at the positions in ptr.
+ */
+struct soa_nx_wire {
+	/* the length of data, and the size of the allocation */
+	uint16_t len;
+	uint8_t  ptr_count;
+	uint16_t ptr[3];
+	/* the encoded RR, after the struct */
+	uint8_t* data;
 };
 
 struct zone
@@ -114,7 +190,13 @@ struct zone
 	domain_type* apex;
 	rrset_type*  soa_rrset;
 	rrset_type*  soa_nx_rrset; /* see bug #103 */
+	struct soa_nx_wire* soa_nx_wire; /* soa_nx_rrset encoded, or NULL */
 	rrset_type*  ns_rrset;
+	/* the rrsets and rdata of the zone, the db region, or with
+	 * zone-regions a region of this zone only */
+	region_type* region;
+	/* stored IXFR versions, in the zone region, or NULL */
+	struct zone_ixfr* ixfr;
 #ifdef NSEC3
 	rr_type* nsec3_param; /* NSEC3PARAM RR of chain in use or NULL */
 	domain_type* nsec3_last; /* last domain with nsec3, wraps */
@@ -123,25 +205,40 @@ struct zone
 	rbtree_t* hashtree; /* tree, hashed NSEC3precompiled domains */
 	rbtree_t* wchashtree; /* tree, wildcard hashed domains */
 	rbtree_t* dshashtree; /* tree, ds-parent-hash domains */
+	struct nsec3_index* nsec3_index; /* nsec3tree lookups, or NULL */
 #endif
 	struct zone_options* opts;
 	char*        filename; /* set if read from file, which file */
 	char*        logstr; /* set for zone xfer, the log string */
 	time_t       mtime; /* time of last modification */
 	unsigned     zonestatid; /* array index for zone stats */
+	/* kept up to date when rrsets and rrs are added and removed,
+	 * except nsec3, see zone_get_mem_stat */
+	struct zone_mem_stat mem;
 	unsigned     is_secure : 1; /* zone uses DNSSEC */
 	unsigned     is_ok : 1; /* zone has not expired. */
 	unsigned     is_changed : 1; /* zone was changed by AXFR */
+	unsigned     is_lazy : 1; /* only the apex is read from the udb */
 };
 
-/* a RR in DNS */
+/*
+ * A RR in DNS.  The rdata is one block, that starts with the pointers to
+ * the domains of the compressed and uncompressed dname fields, and then
+ * has the other fields in wire format, in the order of the fields.
+ */
 struct rr {
 	domain_type*     owner;
-	rdata_atom_type* rdatas;
+	void*            rdata;
 	uint32_t         ttl;
 	uint16_t         type;
 	uint16_t         klass;
-	uint16_t         rdata_count;
+	/* length of the wire format part of the rdata */
+	uint16_t         rdlength;
+	/* number of rdata fields, and of domain pointers */
+	uint8_t          rdata_count;
+	uint8_t          rdata_domains;
+	/* the rdata is a shared copy, in the rdata table of the namedb */
+	uint8_t          rdata_shared;
 };
 
 /*
@@ -154,9 +251,16 @@ struct rrset
 	zone_type*  zone;
 	rr_type*    rrs;
 	uint16_t    rr_count;
+	/* the type of the rrs, so a walk of the rrsets does not read them */
+	uint16_t    type;
+	/* the least size of the rrs in a packet, with every name compressed,
+	 * see rrset_wire_min_update; 0 if not known */
+	uint32_t    wire_min;
 };
 
 /*
+ * The rdata atoms are used for the fields of an RR while it is parsed,
+ * they are packed into the rdata of the rr_type when it is stored.
  * The field used is based on the wireformat the atom is stored in.
  * The allowed wireformats are defined by the rdata_wireformat_type
  * enumeration.
@@ -175,6 +279,33 @@ union rdata_atom
  */
 domain_table_type *domain_table_create(region_type *region);
 
+/*
+ * Keep a hash index of the names in the domain table, exact matches are
+ * looked up in it and do not walk the radix tree.
+ */
+void domain_table_hash_enable(domain_table_type* table);
+
+/*
+ * Start the prefetch of the lookup of the name in the packet, of at most
+ * max bytes.  Returns false if the name is not valid or there is nothing
+ * to prefetch.
+ */
+int domain_table_prefetch_start(domain_table_type* table,
+	struct domain_prefetch* p, const uint8_t* name, size_t max);
+
+/*
+ * Take the next step of the prefetch, the memory of the previous step is
+ * read.  Returns false when the prefetch is done.
+ */
+int domain_table_prefetch_step(domain_table_type* table,
+	struct domain_prefetch* p);
+
+/*
+ * Read the domain, its RRsets and RRs, and the domains that the rdata
+ * points to, so that their pages are in memory.
+ */
+void domain_prefault(domain_type* domain);
+
 /*
  * Search the domain table for a match and the closest encloser.
  */
@@ -183,6 +314,15 @@ int domain_table_search(domain_table_type* table,
 			domain_type      **closest_match,
 			domain_type      **closest_encloser);
 
+/*
+ * Search like domain_table_search, with the radname of the dname (see
+ * radname_d2r) that the caller has made, so it is not converted again.
+ * key can be NULL, then the dname is converted.
+ */
+int domain_table_search_key(domain_table_type* table,
+	const dname_type* dname, const uint8_t* key, radstrlen_t keylen,
+	domain_type** closest_match, domain_type** closest_encloser);
+
 /*
  * The number of domains stored in the table (minimum is one for the
  * root domain).
@@ -210,6 +350,35 @@ domain_type* domain_table_find(domain_table_type* table,
 domain_type *domain_table_insert(domain_table_type *table,
 				 const dname_type  *dname);
 
+/*
+ * Insert cursor for names that mostly come in canonical order, like the
+ * owner names of a zone file or a zone transfer.  It holds the name that
+ * was inserted last, start with last NULL.  The domain of last must not
+ * be deleted while the cursor is used, set it to NULL then.
+ */
+struct domain_cursor {
+	domain_type* last;
+};
+
+/*
+ * Insert the domain name like domain_table_insert.  If the name comes
+ * after the last one of the cursor, and before the next name in the
+ * table, the closest encloser is a parent of the last one, and the radix
+ * tree is searched from there.  Otherwise the table is searched.
+ */
+domain_type* domain_table_insert_cursor(domain_table_type* table,
+	struct domain_cursor* cursor, const dname_type* dname);
+
+/*
+ * Insert the domain names, sorted in canonical order, below the apex,
+ * like domain_table_insert does for every one of them, but the radix tree
+ * is filled in one go.  There must be no names below the apex in the
+ * table yet.  The domains are returned in result.  Returns false, without
+ * changes, if the names cannot be inserted like that.
+ */
+int domain_table_bulk_insert(domain_table_type* table, domain_type* apex,
+	const dname_type** dnames, size_t num, domain_type** result);
+
 /* put domain into nsec3 hash space tree */
 void zone_add_domain_in_hash_tree(region_type* region, rbtree_t** tree,
 	int (*cmpf)(const void*, const void*), domain_type* domain,
@@ -228,8 +397,23 @@ int domain_is_prehash(domain_table_type* table, domain_type* domain);
  */
 void domain_add_rrset(domain_type* domain, rrset_type* rrset);
 
+/*
+ * Account the memory of an rrset, with its rrs, that has been added to
+ * the domain (add is true) or is about to be removed from it, in the
+ * zone of the rrset.  The owner name counts for the first rrset of the
+ * zone at the domain.
+ */
+void zone_mem_rrset(zone_type* zone, domain_type* domain, rrset_type* rrset,
+	int add);
+/* account the memory of an rr added to or removed from an rrset */
+void zone_mem_rr(zone_type* zone, rr_type* rr, int add);
+/* get the memory use of the zone, with the NSEC3 precompile data */
+void zone_get_mem_stat(zone_type* zone, struct zone_mem_stat* mem);
+
 rrset_type* domain_find_rrset(domain_type* domain, zone_type* zone, uint16_t type);
 rrset_type* domain_find_any_rrset(domain_type* domain, zone_type* zone);
+/* set the rrset_types of the domain again, after an rrset is removed */
+void domain_rrset_types_update(domain_type* domain);
 
 zone_type* domain_find_zone(namedb_type* db, domain_type* domain);
 zone_type* domain_find_parent_zone(zone_type* zone);
@@ -288,8 +472,74 @@ struct namedb
 	/* if diff_skip=1, diff_pos contains the nsd.diff place to continue */
 	uint8_t		  diff_skip;
 	off_t		  diff_pos;
+	/* the zones allocate their data in their own region */
+	int		  zone_regions;
+	/* the zones are read from the udb when they are first used */
+	int		  lazy_zones;
+	/* the udb of a server process, that only reads lazy zones from it */
+	struct udb_base*   udb_read;
+	/* the udb is locked against the lazy zone reads of the servers */
+	int		  udb_locked;
+	/* reads the rest of a lazy zone, set by namedb_open */
+	int (*read_lazy_zone)(struct namedb* db, zone_type* zone);
+	/* the shared rdata of the zones, NULL if not used */
+	struct rdata_table* rdata_table;
+	/* the NSEC3 hashes of the last run, for the prehash, or NULL, and
+	 * the file of it while it is not opened yet */
+	struct nsec3_snapshot* nsec3_snap;
+	const char* nsec3_snap_file;
+	/* with region-profile, the memory of the database and the zone
+	 * regions per tag, in the database region, or NULL */
+	struct region_tag_stat* profile;
 };
 
+/*
+ * A shared copy of rdata, the identical rdata of RRs in all the zones is
+ * stored once, in the namedb region.  The domain pointers are part of
+ * the bytes, the zones share the domain table.  The rdata follows the
+ * header.
+ */
+struct rdata_share
+{
+	struct rdata_share* next;
+	uint32_t hash;
+	uint32_t refs;
+	size_t size;
+};
+
+/* hash table of the shared rdata, with chains, the size is a power of
+ * two and the table has at most one entry per bucket */
+struct rdata_table
+{
+	size_t size;
+	size_t count;
+	struct rdata_share** buckets;
+};
+
+/* share the rdata of the RRs that are added, for the rdata-sharing option */
+void namedb_rdata_table_enable(struct namedb* db);
+/* make the rdata of the rr a shared copy, the rdata in region is recycled.
+ * Does nothing if the rdata table is not used. */
+void rr_share_rdata(struct namedb* db, region_type* region, rr_type* rr);
+/* release the rdata of the rr, that is recycled in region or, if it is
+ * shared, dereferenced */
+void rr_release_rdata(struct namedb* db, region_type* region, rr_type* rr);
+
+/* set the wire_min of the rrset, after its rrs are changed */
+void rrset_wire_min_update(rrset_type* rrset);
+/* encode the soa_nx_wire of the zone, after its soa_nx_rrset is set */
+void zone_soa_nx_wire_update(zone_type* zone);
+
+/* read the rest of a lazy zone from the udb, returns false if it cannot
+ * be read now */
+static inline int namedb_read_lazy_zone(struct namedb* db, zone_type* zone)
+{ return !zone->is_lazy || (db->read_lazy_zone && db->read_lazy_zone(db,
+	zone)); }
+/* lock the udb of the process to read lazy zone data from it, returns NULL
+ * if it cannot be read now.  namedb_udb_read_end unlocks it again. */
+struct udb_base* namedb_udb_read_start(struct namedb* db);
+void namedb_udb_read_end(struct namedb* db, struct udb_base* udb);
+
 static inline int rdata_atom_is_domain(uint16_t type, size_t index);
 static inline int rdata_atom_is_literal_domain(uint16_t type, size_t index);
 
@@ -311,6 +561,43 @@ rdata_atom_data(rdata_atom_type atom)
 	return (uint8_t *) (atom.data + 1);
 }
 
+/* the domains in the rdata of the RR */
+static inline domain_type **
+rr_rdata_domains(rr_type* rr)
+{
+	return (domain_type **) rr->rdata;
+}
+
+/* the wire format of the rdata fields that are not domain pointers */
+static inline uint8_t *
+rr_rdata_wire(rr_type* rr)
+{
+	return (uint8_t *) rr->rdata + rr->rdata_domains*sizeof(domain_type*);
+}
+
+/* size of the rdata block of the RR */
+static inline size_t
+rr_rdata_size(rr_type* rr)
+{
+	return rr->rdata_domains*sizeof(domain_type*) + rr->rdlength;
+}
+
+/* the domain of rdata field index, a compressed or uncompressed dname */
+static inline domain_type *
+rr_rdata_domain(rr_type* rr, size_t index)
+{
+	const rrtype_descriptor_type *descriptor
+		= rrtype_descriptor_by_type(rr->type);
+	size_t i, n = 0;
+	assert(rdata_atom_is_domain(rr->type, index));
+	for(i=0; i<index; i++) {
+		if(descriptor->wireformat[i] == RDATA_WF_COMPRESSED_DNAME ||
+		   descriptor->wireformat[i] == RDATA_WF_UNCOMPRESSED_DNAME)
+			n++;
+	}
+	return rr_rdata_domains(rr)[n];
+}
+
 
 /* Find the zone for the specified dname in DB. */
 zone_type *namedb_find_zone(namedb_type *db, const dname_type *dname);
@@ -335,10 +622,25 @@ int namedb_lookup (struct namedb* db,
 		   const dname_type* dname,
 		   domain_type     **closest_match,
 		   domain_type     **closest_encloser);
+/* lookup with the radname of the dname, of keylen, that is made already */
+int namedb_lookup_key(struct namedb* db, const dname_type* dname,
+	const uint8_t* key, radstrlen_t keylen, domain_type** closest_match,
+	domain_type** closest_encloser);
 /* pass number of children (to alloc in dirty array */
 struct namedb *namedb_open(const char *filename, struct nsd_options* opt);
 void namedb_close_udb(struct namedb* db);
+/* lock the udb against lazy zone reads while it is changed */
+void namedb_lock_udb(struct namedb* db);
+void namedb_unlock_udb(struct namedb* db);
 void namedb_close(struct namedb* db);
+/* open the database file again, for the new copy of a database-readonly
+ * image, and close old.  Returns NULL and keeps old if it fails. */
+struct namedb* namedb_reopen(struct namedb* old, const char* filename,
+	struct nsd_options* opt);
+/* memory in use by the database, including the zone regions */
+size_t namedb_get_mem(struct namedb* db);
+/* memory in the slabs of the database, and the bytes in use in them */
+size_t namedb_get_slab(struct namedb* db, size_t* used);
 void namedb_check_zonefiles(struct nsd* nsd, struct nsd_options* opt,
 	struct udb_base* taskudb, struct udb_ptr* last_task);
 void namedb_check_zonefile(struct nsd* nsd, struct udb_base* taskudb,
@@ -389,7 +691,37 @@ rrset_rrtype(rrset_type* rrset)
 {
 	assert(rrset);
 	assert(rrset->rr_count > 0);
-	return rrset->rrs[0].type;
+	assert(rrset->type == rrset->rrs[0].type);
+	return rrset->type;
+}
+
+/*
+ * The bit of the type in domain.rrset_types.  The types that queries
+ * and answers look up most have a bit of their own, the other types
+ * share the last bit.  A type whose bit is not set is not at the domain,
+ * and the rrsets are not walked.
+ */
+static inline uint16_t
+rrset_type_bit(uint16_t type)
+{
+	switch(type) {
+	case TYPE_SOA:		return 0x0001;
+	case TYPE_NS:		return 0x0002;
+	case TYPE_A:		return 0x0004;
+	case TYPE_AAAA:		return 0x0008;
+	case TYPE_DS:		return 0x0010;
+	case TYPE_CNAME:	return 0x0020;
+	case TYPE_RRSIG:	return 0x0040;
+	case TYPE_DNAME:	return 0x0080;
+	case TYPE_MX:		return 0x0100;
+	case TYPE_TXT:		return 0x0200;
+	case TYPE_NSEC:		return 0x0400;
+	case TYPE_NSEC3:	return 0x0800;
+	case TYPE_DNSKEY:	return 0x1000;
+	case TYPE_PTR:		return 0x2000;
+	case TYPE_SRV:		return 0x4000;
+	default:		return 0x8000;
+	}
 }
 
 static inline uint16_t
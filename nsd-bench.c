@@ -0,0 +1,733 @@
+/*
+ * nsd-bench.c -- replay queries against the query engine of nsd.
+ *
+ * Copyright (c) 2026, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#if defined(HAVE_PTHREAD) && defined(USE_SERVER_THREADS)
+#include <pthread.h>
+#endif
+
+#include "nsd.h"
+#include "tsig.h"
+#include "options.h"
+#include "namedb.h"
+#include "query.h"
+#include "packet.h"
+#include "dname.h"
+#include "util.h"
+#ifdef RATELIMIT
+#include "rrl.h"
+#endif
+
+static void error(const char *format, ...) ATTR_FORMAT(printf, 1, 2);
+struct nsd nsd;
+
+/* one query to replay, in wire format, with the source address */
+struct bench_query {
+	uint8_t* wire;
+	size_t len;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+};
+
+/* the kind of answer, the statistics are kept for every kind */
+enum bench_type {
+	BENCH_ANSWER = 0,
+	BENCH_NODATA,
+	BENCH_NXDOMAIN,
+	BENCH_REFERRAL,
+	BENCH_ERROR,
+	BENCH_DROPPED,
+	BENCH_TYPES
+};
+static const char* bench_type_names[BENCH_TYPES] = {
+	"answer", "nodata", "nxdomain", "referral", "error", "dropped"
+};
+
+/* the latency histogram has a bucket for every power of two nsec */
+#define BENCH_HIST 40
+
+/* the results of one thread */
+struct bench_stats {
+	uint64_t count[BENCH_TYPES];
+	uint64_t nsec[BENCH_TYPES];
+	uint64_t cycles[BENCH_TYPES];
+	uint64_t hist[BENCH_HIST];
+};
+
+/* the work of one thread */
+struct bench_thread {
+	int num;
+	struct nsd nsd;
+	struct bench_stats stats;
+};
+
+static struct bench_query* bench_queries = NULL;
+static size_t bench_num = 0, bench_max = 0;
+static int bench_rounds = 1;
+static int bench_tcp = 0;
+#ifdef RATELIMIT
+static int bench_rrl = 0;
+#endif
+static int bench_threads = 1;
+
+/*
+ * Print the help text.
+ *
+ */
+static void
+usage (void)
+{
+	fprintf(stderr, "Usage: nsd-bench [-c configfile] [-n rounds] "
+		"[-t threads] [-D] [-T] [-r] queryfile\n");
+	fprintf(stderr, "Replays the queries against the zones of the "
+		"config, with the query code of nsd.\n");
+	fprintf(stderr, "queryfile is a pcap file with the queries to port "
+		"53, or a text file with\n");
+	fprintf(stderr, "one query per line: name [class] type\n");
+	fprintf(stderr, "-n rounds	replay the queries this many times\n");
+	fprintf(stderr, "-t threads	replay with this many threads\n");
+	fprintf(stderr, "-D		set the EDNS DO bit in the text queries\n");
+	fprintf(stderr, "-T		answer as for TCP\n");
+	fprintf(stderr, "-r		apply rate limiting, as for UDP\n");
+	fprintf(stderr, "Version %s. Report bugs to <%s>.\n",
+		PACKAGE_VERSION, PACKAGE_BUGREPORT);
+}
+
+/*
+ * Something went wrong, give error messages and exit.
+ *
+ */
+static void
+error(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	log_vmsg(LOG_ERR, format, args);
+	va_end(args);
+	exit(1);
+}
+
+/* nanoseconds of a monotonic clock */
+static uint64_t
+bench_nsec(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+	{
+		struct timeval tv;
+		if(gettimeofday(&tv, NULL) != 0)
+			return 0;
+		return (uint64_t)tv.tv_sec*1000000000 +
+			(uint64_t)tv.tv_usec*1000;
+	}
+}
+
+/* the cycle counter, 0 where there is none */
+static uint64_t
+bench_cycles(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	uint32_t lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+/* add a query to the list */
+static void
+bench_add(const uint8_t* wire, size_t len, struct sockaddr* addr,
+	socklen_t addrlen)
+{
+	struct bench_query* b;
+	if(len < QHEADERSZ || len > UDP_MAX_MESSAGE_LEN)
+		return;
+	if(bench_num == bench_max) {
+		bench_max = bench_max?bench_max*2:1024;
+		bench_queries = (struct bench_query*)xrealloc(bench_queries,
+			bench_max*sizeof(*bench_queries));
+	}
+	b = &bench_queries[bench_num++];
+	b->wire = (uint8_t*)xalloc(len);
+	memcpy(b->wire, wire, len);
+	b->len = len;
+	memset(&b->addr, 0, sizeof(b->addr));
+	memcpy(&b->addr, addr, addrlen);
+	b->addrlen = addrlen;
+}
+
+/* the source of the text queries, from the documentation prefix */
+static void
+bench_text_addr(struct sockaddr_in* sa, size_t n)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sin_family = AF_INET;
+	sa->sin_port = htons(53000);
+	/* spread over 192.0.2.0/24, rate limiting sees different sources */
+	sa->sin_addr.s_addr = htonl(0xc0000200 | (uint32_t)(n&0xff));
+}
+
+/* parse a text query line, name [class] type */
+static void
+bench_text_line(char* line, int withdo, int lineno)
+{
+	uint8_t dname[MAXDOMAINLEN];
+	uint8_t wire[QHEADERSZ + MAXDOMAINLEN + 4 + 11];
+	char* tok[3];
+	int n = 0, dlen;
+	uint16_t t, c = CLASS_IN;
+	size_t len;
+	struct sockaddr_in sa;
+	buffer_type buf;
+	char* s = strtok(line, " \t\n");
+
+	while(s && n < 3) {
+		tok[n++] = s;
+		s = strtok(NULL, " \t\n");
+	}
+	if(n == 0 || tok[0][0] == '#')
+		return;
+	if(n < 2 || s)
+		error("line %d: expected name [class] type", lineno);
+	if((dlen = dname_parse_wire(dname, tok[0])) == 0)
+		error("line %d: cannot parse name %s", lineno, tok[0]);
+	if(n == 3 && !(c = rrclass_from_string(tok[1])))
+		error("line %d: bad class %s", lineno, tok[1]);
+	if(!(t = rrtype_from_string(tok[n-1])))
+		error("line %d: bad type %s", lineno, tok[n-1]);
+
+	buffer_create_from(&buf, wire, sizeof(wire));
+	buffer_clear(&buf);
+	memset(wire, 0, QHEADERSZ);
+	ID_SET(&buf, (uint16_t)lineno);
+	QDCOUNT_SET(&buf, 1);
+	buffer_skip(&buf, QHEADERSZ);
+	buffer_write(&buf, dname, dlen);
+	buffer_write_u16(&buf, t);
+	buffer_write_u16(&buf, c);
+	if(withdo) {
+		ARCOUNT_SET(&buf, 1);
+		buffer_write_u8(&buf, 0);
+		buffer_write_u16(&buf, TYPE_OPT);
+		buffer_write_u16(&buf, 4096);
+		buffer_write_u8(&buf, 0); /* rcode */
+		buffer_write_u8(&buf, 0); /* version */
+		buffer_write_u16(&buf, 0x8000); /* DO flag */
+		buffer_write_u16(&buf, 0);
+	}
+	len = buffer_position(&buf);
+	bench_text_addr(&sa, bench_num);
+	bench_add(wire, len, (struct sockaddr*)&sa, sizeof(sa));
+}
+
+/* read a text query file */
+static void
+bench_read_text(FILE* in, int withdo)
+{
+	char line[1024];
+	int lineno = 0;
+	while(fgets(line, sizeof(line), in)) {
+		lineno++;
+		bench_text_line(line, withdo, lineno);
+	}
+}
+
+/* pcap file header values */
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_LINK_NULL 0
+#define PCAP_LINK_ETHERNET 1
+#define PCAP_LINK_RAW 101
+#define PCAP_LINK_RAW_BSD 12
+#define PCAP_LINK_LINUX_SLL 113
+
+/* a 32 bit value of the pcap file, that can be in either byte order */
+static uint32_t
+pcap_u32(const uint8_t* p, int swap)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	if(swap)
+		v = ((v&0xff)<<24) | ((v&0xff00)<<8) | ((v>>8)&0xff00) |
+			(v>>24);
+	return v;
+}
+
+/* take the DNS query from the IP packet, if it is UDP to port 53 */
+static void
+bench_pcap_ip(const uint8_t* p, size_t len)
+{
+	const uint8_t* udp;
+	size_t udplen;
+	if(len < 1)
+		return;
+	if((p[0]>>4) == 4) {
+		struct sockaddr_in sa;
+		size_t hl = (p[0]&0x0f)*4;
+		if(len < 20 || hl < 20 || len < hl + 8 || p[9] != 17)
+			return;
+		/* fragments cannot be replayed */
+		if((read_uint16(p+6) & 0x3fff) != 0)
+			return;
+		udp = p + hl;
+		udplen = len - hl;
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family = AF_INET;
+		memcpy(&sa.sin_addr, p+12, 4);
+		memcpy(&sa.sin_port, udp, 2);
+		if(read_uint16(udp+2) != 53)
+			return;
+		if(udplen > read_uint16(udp+4) && read_uint16(udp+4) >= 8)
+			udplen = read_uint16(udp+4);
+		/* the QR bit is set in replies */
+		if(udplen < 8 + QHEADERSZ || (udp[8+2] & 0x80))
+			return;
+		bench_add(udp+8, udplen-8, (struct sockaddr*)&sa, sizeof(sa));
+#ifdef INET6
+	} else if((p[0]>>4) == 6) {
+		struct sockaddr_in6 sa;
+		/* no extension headers */
+		if(len < 40 + 8 || p[6] != 17)
+			return;
+		udp = p + 40;
+		udplen = len - 40;
+		memset(&sa, 0, sizeof(sa));
+		sa.sin6_family = AF_INET6;
+		memcpy(&sa.sin6_addr, p+8, 16);
+		memcpy(&sa.sin6_port, udp, 2);
+		if(read_uint16(udp+2) != 53)
+			return;
+		if(udplen > read_uint16(udp+4) && read_uint16(udp+4) >= 8)
+			udplen = read_uint16(udp+4);
+		if(udplen < 8 + QHEADERSZ || (udp[8+2] & 0x80))
+			return;
+		bench_add(udp+8, udplen-8, (struct sockaddr*)&sa, sizeof(sa));
+#endif /* INET6 */
+	}
+}
+
+/* read a pcap file, the queries to port 53 over UDP are replayed */
+static void
+bench_read_pcap(FILE* in, const uint8_t* hdr)
+{
+	uint8_t rec[16];
+	uint8_t* pkt;
+	uint32_t link, snaplen, incl;
+	int swap = (pcap_u32(hdr, 0) != PCAP_MAGIC &&
+		pcap_u32(hdr, 0) != PCAP_MAGIC_NSEC);
+
+	snaplen = pcap_u32(hdr+16, swap);
+	link = pcap_u32(hdr+20, swap);
+	if(snaplen == 0 || snaplen > 262144)
+		snaplen = 262144;
+	pkt = (uint8_t*)xalloc(snaplen);
+	while(fread(rec, sizeof(rec), 1, in) == 1) {
+		const uint8_t* p = pkt;
+		size_t len;
+		incl = pcap_u32(rec+8, swap);
+		if(incl > snaplen)
+			error("pcap record of %u bytes, larger than snaplen",
+				(unsigned)incl);
+		if(fread(pkt, 1, incl, in) != incl)
+			break;
+		len = incl;
+		switch(link) {
+		case PCAP_LINK_ETHERNET:
+		{
+			uint16_t et;
+			if(len < 14)
+				continue;
+			et = read_uint16(p+12);
+			p += 14; len -= 14;
+			/* a VLAN tag */
+			if(et == 0x8100 && len >= 4) {
+				et = read_uint16(p+2);
+				p += 4; len -= 4;
+			}
+			if(et != 0x0800 && et != 0x86dd)
+				continue;
+			break;
+		}
+		case PCAP_LINK_LINUX_SLL:
+			if(len < 16)
+				continue;
+			p += 16; len -= 16;
+			break;
+		case PCAP_LINK_NULL:
+			if(len < 4)
+				continue;
+			p += 4; len -= 4;
+			break;
+		case PCAP_LINK_RAW:
+		case PCAP_LINK_RAW_BSD:
+			break;
+		default:
+			error("pcap link type %u is not supported",
+				(unsigned)link);
+		}
+		bench_pcap_ip(p, len);
+	}
+	free(pkt);
+}
+
+/* read the queries from the file, pcap or text */
+static void
+bench_read(const char* fname, int withdo)
+{
+	uint8_t hdr[24];
+	FILE* in = fopen(fname, "r");
+	if(!in)
+		error("cannot open %s: %s", fname, strerror(errno));
+	if(fread(hdr, sizeof(hdr), 1, in) == 1 &&
+		(pcap_u32(hdr, 0) == PCAP_MAGIC ||
+		pcap_u32(hdr, 1) == PCAP_MAGIC ||
+		pcap_u32(hdr, 0) == PCAP_MAGIC_NSEC ||
+		pcap_u32(hdr, 1) == PCAP_MAGIC_NSEC)) {
+		bench_read_pcap(in, hdr);
+	} else {
+		rewind(in);
+		bench_read_text(in, withdo);
+	}
+	fclose(in);
+	if(bench_num == 0)
+		error("no queries in %s", fname);
+}
+
+/* the kind of answer in the packet */
+static enum bench_type
+bench_classify(buffer_type* packet)
+{
+	switch(RCODE(packet)) {
+	case RCODE_OK:
+		if(ANCOUNT(packet) > 0)
+			return BENCH_ANSWER;
+		if(!AA(packet) && NSCOUNT(packet) > 0)
+			return BENCH_REFERRAL;
+		return BENCH_NODATA;
+	case RCODE_NXDOMAIN:
+		return BENCH_NXDOMAIN;
+	default:
+		return BENCH_ERROR;
+	}
+}
+
+/* answer one query, like the server does */
+static enum bench_type
+bench_answer(struct nsd* n, query_type* q, struct bench_query* b)
+{
+	query_state_type r;
+	query_reset(q, bench_tcp?TCP_MAX_MESSAGE_LEN:UDP_MAX_MESSAGE_LEN,
+		bench_tcp);
+	memcpy(&q->addr, &b->addr, b->addrlen);
+	q->addrlen = b->addrlen;
+	buffer_write(q->packet, b->wire, b->len);
+	buffer_flip(q->packet);
+	r = query_process(q, n);
+#ifdef RATELIMIT
+	if(r != QUERY_DISCARDED && bench_rrl && !bench_tcp &&
+		rrl_process_query(q))
+		r = rrl_slip(q);
+#endif
+	if(r == QUERY_DISCARDED)
+		return BENCH_DROPPED;
+	query_add_optional(q, n);
+	buffer_flip(q->packet);
+	return bench_classify(q->packet);
+}
+
+/* replay the queries, every thread starts at another place in the list */
+static void*
+bench_run(void* arg)
+{
+	struct bench_thread* t = (struct bench_thread*)arg;
+	region_type* region = region_create(xalloc, free);
+	query_type* q = query_create(region);
+	size_t start = bench_num * (size_t)t->num / (size_t)bench_threads;
+	size_t i, j;
+	int round;
+
+#ifdef RATELIMIT
+	if(bench_rrl) {
+		/* the limits in effect are per thread */
+		rrl_init();
+		rrl_set_adaptive(nsd.options->rrl_adaptive);
+	}
+#endif
+	for(round = 0; round < bench_rounds; round++) {
+		for(i = 0; i < bench_num; i++) {
+			uint64_t t0, t1, c0, c1, ns;
+			enum bench_type k;
+			int h = 0;
+			j = (start + i) % bench_num;
+			t0 = bench_nsec();
+			c0 = bench_cycles();
+			k = bench_answer(&t->nsd, q, &bench_queries[j]);
+			c1 = bench_cycles();
+			t1 = bench_nsec();
+			ns = t1 - t0;
+			t->stats.count[k]++;
+			t->stats.nsec[k] += ns;
+			t->stats.cycles[k] += c1 - c0;
+			while(ns > 1 && h < BENCH_HIST-1) {
+				ns >>= 1;
+				h++;
+			}
+			t->stats.hist[h]++;
+		}
+	}
+	region_destroy(region);
+	return NULL;
+}
+
+/* the latency below which the fraction of the queries is */
+static uint64_t
+bench_percentile(struct bench_stats* s, uint64_t total, double f)
+{
+	uint64_t sum = 0;
+	int h;
+	for(h = 0; h < BENCH_HIST; h++) {
+		sum += s->hist[h];
+		if((double)sum >= f * (double)total)
+			return ((uint64_t)1) << (h+1);
+	}
+	return ((uint64_t)1) << BENCH_HIST;
+}
+
+/* print the results of the threads together */
+static void
+bench_report(struct bench_thread* threads, uint64_t wall)
+{
+	struct bench_stats s;
+	uint64_t total = 0;
+	int i, k, h;
+
+	memset(&s, 0, sizeof(s));
+	for(i = 0; i < bench_threads; i++) {
+		for(k = 0; k < BENCH_TYPES; k++) {
+			s.count[k] += threads[i].stats.count[k];
+			s.nsec[k] += threads[i].stats.nsec[k];
+			s.cycles[k] += threads[i].stats.cycles[k];
+		}
+		for(h = 0; h < BENCH_HIST; h++)
+			s.hist[h] += threads[i].stats.hist[h];
+	}
+	for(k = 0; k < BENCH_TYPES; k++)
+		total += s.count[k];
+
+	printf("%llu queries in %.3f sec with %d thread%s: %.0f qps\n",
+		(unsigned long long)total, (double)wall/1e9, bench_threads,
+		bench_threads==1?"":"s",
+		wall?(double)total*1e9/(double)wall:0.);
+	printf("\n%-10s %12s %10s %12s\n", "type", "queries", "nsec/q",
+		"cycles/q");
+	for(k = 0; k < BENCH_TYPES; k++) {
+		if(s.count[k] == 0)
+			continue;
+		printf("%-10s %12llu %10.0f %12.0f\n", bench_type_names[k],
+			(unsigned long long)s.count[k],
+			(double)s.nsec[k]/(double)s.count[k],
+			(double)s.cycles[k]/(double)s.count[k]);
+	}
+	printf("\nlatency (nsec)          queries\n");
+	for(h = 0; h < BENCH_HIST; h++) {
+		if(s.hist[h] == 0)
+			continue;
+		printf("%10llu - %-10llu %12llu %6.2f%%\n",
+			(unsigned long long)(h?((uint64_t)1)<<h:0),
+			(unsigned long long)(((uint64_t)1)<<(h+1)),
+			(unsigned long long)s.hist[h],
+			100.*(double)s.hist[h]/(double)total);
+	}
+	printf("\np50 < %llu nsec, p99 < %llu nsec, p99.9 < %llu nsec\n",
+		(unsigned long long)bench_percentile(&s, total, 0.5),
+		(unsigned long long)bench_percentile(&s, total, 0.99),
+		(unsigned long long)bench_percentile(&s, total, 0.999));
+}
+
+/* load the zones of the config into memory */
+static void
+bench_setup(const char* configfile)
+{
+	nsd.options = nsd_options_create(region_create_custom(xalloc, free,
+		DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+		DEFAULT_INITIAL_CLEANUP_SIZE, 1));
+	tsig_init(nsd.options->region);
+	if(!parse_options_file(nsd.options, configfile, NULL, NULL)) {
+		error("could not read config: %s\n", configfile);
+	}
+	if(!parse_zone_list_file(nsd.options)) {
+		error("could not read zonelist file %s\n",
+			nsd.options->zonelistfile);
+	}
+	if (verbosity == 0)
+		verbosity = nsd.options->verbosity;
+	nsd.region = region_create(xalloc, free);
+	nsd.ipv4_edns_size = nsd.options->ipv4_edns_size;
+	nsd.ipv6_edns_size = nsd.options->ipv6_edns_size;
+	edns_init_data(&nsd.edns_ipv4, nsd.options->ipv4_edns_size);
+#if defined(INET6)
+	edns_init_data(&nsd.edns_ipv6, nsd.options->ipv6_edns_size);
+#endif
+	if(nsd.options->zonesdir && nsd.options->zonesdir[0]) {
+		if(chdir(nsd.options->zonesdir)) {
+			error("cannot chdir to '%s': %s",
+				nsd.options->zonesdir, strerror(errno));
+		}
+	}
+#ifdef RATELIMIT
+	if(bench_rrl)
+		rrl_mmap_init(nsd.options->rrl_size,
+			nsd.options->rrl_ratelimit,
+			nsd.options->rrl_whitelist_ratelimit,
+			nsd.options->rrl_slip,
+			nsd.options->rrl_ipv4_prefix_length,
+			nsd.options->rrl_ipv6_prefix_length, NULL);
+#endif
+	/* the zones are read into memory, the database file is not used */
+	nsd.options->database = "";
+	nsd.db = namedb_open("", nsd.options);
+	if(!nsd.db)
+		error("cannot open the database: %s", strerror(errno));
+	namedb_check_zonefiles(&nsd, nsd.options, NULL, NULL);
+}
+
+/* dummy functions to link */
+struct nsd;
+int writepid(struct nsd * ATTR_UNUSED(nsd))
+{
+	        return 0;
+}
+void unlinkpid(const char * ATTR_UNUSED(file))
+{
+}
+void bind8_stats(struct nsd * ATTR_UNUSED(nsd))
+{
+}
+
+void sig_handler(int ATTR_UNUSED(sig))
+{
+}
+
+extern char *optarg;
+extern int optind;
+
+int
+main(int argc, char *argv[])
+{
+	/* Scratch variables... */
+	int c, i, withdo = 0;
+	const char *configfile = CONFIGFILE;
+	struct bench_thread* threads;
+	uint64_t start;
+	memset(&nsd, 0, sizeof(nsd));
+
+	log_init("nsd-bench");
+
+	/* Parse the command line... */
+	while ((c = getopt(argc, argv, "c:n:t:DThr")) != -1) {
+		switch (c) {
+		case 'c':
+			configfile = optarg;
+			break;
+		case 'n':
+			bench_rounds = atoi(optarg);
+			if(bench_rounds <= 0)
+				error("-n needs a number greater than zero");
+			break;
+		case 't':
+			bench_threads = atoi(optarg);
+			if(bench_threads <= 0)
+				error("-t needs a number greater than zero");
+			break;
+		case 'D':
+			withdo = 1;
+			break;
+		case 'T':
+			bench_tcp = 1;
+			break;
+		case 'r':
+#ifdef RATELIMIT
+			bench_rrl = 1;
+#else
+			error("-r: rate limiting is not enabled in this build");
+#endif
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		case '?':
+		default:
+			usage();
+			exit(1);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	/* Commandline parse error */
+	if (argc != 1) {
+		usage();
+		exit(1);
+	}
+#if !defined(HAVE_PTHREAD) || !defined(USE_SERVER_THREADS)
+	if(bench_threads > 1) {
+		log_msg(LOG_WARNING, "no thread support in this build, "
+			"using one thread");
+		bench_threads = 1;
+	}
+#endif
+
+	packet_init();
+	bench_read(argv[0], withdo);
+	bench_setup(configfile);
+
+	threads = (struct bench_thread*)xalloc_array_zero(bench_threads,
+		sizeof(*threads));
+	for(i = 0; i < bench_threads; i++) {
+		threads[i].num = i;
+		/* every thread writes its own statistics in its copy */
+		memcpy(&threads[i].nsd, &nsd, sizeof(nsd));
+	}
+	start = bench_nsec();
+#if defined(HAVE_PTHREAD) && defined(USE_SERVER_THREADS)
+	if(bench_threads > 1) {
+		pthread_t* tid = (pthread_t*)xalloc_array_zero(bench_threads,
+			sizeof(*tid));
+		for(i = 0; i < bench_threads; i++) {
+			int r = pthread_create(&tid[i], NULL, bench_run,
+				&threads[i]);
+			if(r != 0)
+				error("pthread_create: %s", strerror(r));
+		}
+		for(i = 0; i < bench_threads; i++)
+			(void)pthread_join(tid[i], NULL);
+		free(tid);
+	} else
+#endif
+	(void)bench_run(&threads[0]);
+	bench_report(threads, bench_nsec() - start);
+
+	free(threads);
+	exit(0);
+}
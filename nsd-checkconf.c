@@ -53,6 +53,12 @@ extern int optind;
 		return;					\
 	}
 
+#define ZONE_GET_INT(NAME, VAR, PATTERN) 			\
+	if (strcasecmp(#NAME, (VAR)) == 0) { 		\
+		printf("%d\n", (int) PATTERN->NAME); 	\
+		return;					\
+	}
+
 #define ZONE_GET_RRL(NAME, VAR, PATTERN) 			\
 	if (strcasecmp(#NAME, (VAR)) == 0) { 		\
 		zone_print_rrl_whitelist("", PATTERN->NAME);	\
@@ -160,6 +166,19 @@ print_string_var(const char* varname, const char* value)
 	}
 }
 
+static void
+print_cpu_affinity(const char* varname, cpu_option_t* cpus)
+{
+	if (!cpus) {
+		printf("\t#%s\n", varname);
+		return;
+	}
+	printf("\t%s", varname);
+	for(; cpus; cpus = cpus->next)
+		printf(" %d", cpus->cpu);
+	printf("\n");
+}
+
 static void
 quote(const char *v)
 {
@@ -304,8 +323,13 @@ config_print_zone(nsd_options_t* opt, const char* k, int s, const char *o,
 		ZONE_GET_ACL(notify, o, zone->pattern);
 		ZONE_GET_BIN(notify_retry, o, zone->pattern);
 		ZONE_GET_STR(zonestats, o, zone->pattern);
+		ZONE_GET_STR(catalog_member_pattern, o, zone->pattern);
 		ZONE_GET_OUTGOING(outgoing_interface, o, zone->pattern);
 		ZONE_GET_BIN(allow_axfr_fallback, o, zone->pattern);
+		ZONE_GET_BIN(store_ixfr, o, zone->pattern);
+		ZONE_GET_INT(ixfr_number, o, zone->pattern);
+		ZONE_GET_INT(ixfr_size, o, zone->pattern);
+		ZONE_GET_INT(load_priority, o, zone->pattern);
 #ifdef RATELIMIT
 		ZONE_GET_RRL(rrl_whitelist, o, zone->pattern);
 #endif
@@ -329,8 +353,13 @@ config_print_zone(nsd_options_t* opt, const char* k, int s, const char *o,
 		ZONE_GET_ACL(notify, o, p);
 		ZONE_GET_BIN(notify_retry, o, p);
 		ZONE_GET_STR(zonestats, o, p);
+		ZONE_GET_STR(catalog_member_pattern, o, p);
 		ZONE_GET_OUTGOING(outgoing_interface, o, p);
 		ZONE_GET_BIN(allow_axfr_fallback, o, p);
+		ZONE_GET_BIN(store_ixfr, o, p);
+		ZONE_GET_INT(ixfr_number, o, p);
+		ZONE_GET_INT(ixfr_size, o, p);
+		ZONE_GET_INT(load_priority, o, p);
 #ifdef RATELIMIT
 		ZONE_GET_RRL(rrl_whitelist, o, p);
 #endif
@@ -345,19 +374,85 @@ config_print_zone(nsd_options_t* opt, const char* k, int s, const char *o,
 		SERV_GET_BIN(do_ip4, o);
 		SERV_GET_BIN(do_ip6, o);
 		SERV_GET_BIN(hide_version, o);
+		SERV_GET_BIN(answer_cookie, o);
+		SERV_GET_BIN(udp_filter, o);
+		if (strcasecmp("overload_action", o) == 0) {
+			printf("%s\n", opt->overload_action == OVERLOAD_TC ? "tc" :
+				(opt->overload_action == OVERLOAD_DROP ? "drop" : "no"));
+			return;
+		}
+		SERV_GET_BIN(minimal_responses, o);
+		if (strcasecmp("minimal_any", o) == 0) {
+			printf("%s\n", opt->minimal_any == MINIMAL_ANY_HINFO ?
+				"hinfo" : (opt->minimal_any?"yes":"no"));
+			return;
+		}
 		SERV_GET_BIN(zonefiles_check, o);
+		SERV_GET_BIN(zonefiles_watch, o);
 		SERV_GET_BIN(log_time_ascii, o);
 		SERV_GET_BIN(round_robin, o);
+		SERV_GET_BIN(reuseport, o);
+		SERV_GET_BIN(tcp_reuseport, o);
+		SERV_GET_BIN(tcp_defer_accept, o);
+		SERV_GET_BIN(tcp_fastopen, o);
+		SERV_GET_BIN(udp_gro, o);
+		SERV_GET_BIN(udp_gso, o);
+		SERV_GET_BIN(udp_wildcard, o);
+		SERV_GET_BIN(udp_prefetch, o);
+		SERV_GET_BIN(udp_drop_stats, o);
+		SERV_GET_BIN(latency_stats, o);
+		SERV_GET_BIN(region_profile, o);
+		SERV_GET_INT(zone_cpu_sample, o);
+		SERV_GET_BIN(dnstap_enable, o);
+		SERV_GET_BIN(dnstap_log_auth_query_messages, o);
+		SERV_GET_BIN(dnstap_log_auth_response_messages, o);
+		SERV_GET_INT(dnstap_sample, o);
+		SERV_GET_INT(dnstap_ring_size, o);
+		SERV_GET_INT(heavy_hitters, o);
+		SERV_GET_INT(nsec3_cache_size, o);
+		SERV_GET_INT(answer_cache_size, o);
+		SERV_GET_INT(axfr_cache_size, o);
+		SERV_GET_INT(zonefiles_load_workers, o);
+		SERV_GET_INT(zonefiles_write_workers, o);
+		SERV_GET_BIN(progressive_start, o);
+		SERV_GET_BIN(reload_in_place, o);
+		SERV_GET_BIN(reload_prefault, o);
+		SERV_GET_BIN(zone_regions, o);
+		SERV_GET_BIN(name_hash_index, o);
+		SERV_GET_BIN(rdata_sharing, o);
+		SERV_GET_BIN(hugepages, o);
+		SERV_GET_BIN(numa_replicate, o);
+		SERV_GET_BIN(metrics_enable, o);
+		SERV_GET_IP(metrics_interface, metrics_interface, o);
+		SERV_GET_INT(metrics_port, o);
+		SERV_GET_STR(metrics_path, o);
+		SERV_GET_BIN(log_async, o);
+		SERV_GET_INT(xfr_out_workers, o);
+		SERV_GET_INT(xfr_out_nice, o);
+		SERV_GET_INT(xfr_out_rate, o);
+		SERV_GET_BIN(lazy_zone_load, o);
+		SERV_GET_BIN(database_readonly, o);
+		SERV_GET_BIN(xfrdfile_text, o);
+		SERV_GET_BIN(server_threads, o);
+		SERV_GET_STR(xdp_interface, o);
+		SERV_GET_STR(tls_service_key, o);
+		SERV_GET_STR(tls_service_pem, o);
+		SERV_GET_STR(tls_port, o);
+		SERV_GET_STR(dnstap_socket_path, o);
+		SERV_GET_STR(dnstap_file, o);
 		/* str */
 		SERV_GET_PATH(final, database, o);
 		SERV_GET_STR(identity, o);
 		SERV_GET_STR(nsid, o);
+		SERV_GET_STR(cookie_secret, o);
 		SERV_GET_PATH(final, logfile, o);
 		SERV_GET_PATH(final, pidfile, o);
 		SERV_GET_STR(chroot, o);
 		SERV_GET_STR(username, o);
 		SERV_GET_PATH(final, zonesdir, o);
 		SERV_GET_PATH(final, xfrdfile, o);
+		SERV_GET_STR(database_publish, o);
+		SERV_GET_STR(nsec3_snapshot, o);
 		SERV_GET_PATH(final, xfrdir, o);
 		SERV_GET_PATH(final, zonelistfile, o);
 		SERV_GET_STR(port, o);
@@ -370,6 +465,14 @@ config_print_zone(nsd_options_t* opt, const char* k, int s, const char *o,
 		SERV_GET_INT(ipv6_edns_size, o);
 		SERV_GET_INT(statistics, o);
 		SERV_GET_INT(xfrd_reload_timeout, o);
+		SERV_GET_INT(xfrd_tcp_max, o);
+		SERV_GET_BIN(xfrd_stream_apply, o);
+		SERV_GET_INT(xfrd_tcp_master_max, o);
+		SERV_GET_INT(xfrd_udp_max, o);
+		SERV_GET_INT(udp_batch_size, o);
+		SERV_GET_INT(udp_busy_poll, o);
+		SERV_GET_INT(udp_rcvbuf_max, o);
+		SERV_GET_INT(stall_monitor, o);
 		SERV_GET_INT(verbosity, o);
 #ifdef RATELIMIT
 		SERV_GET_INT(rrl_size, o);
@@ -378,6 +481,8 @@ config_print_zone(nsd_options_t* opt, const char* k, int s, const char *o,
 		SERV_GET_INT(rrl_ipv4_prefix_length, o);
 		SERV_GET_INT(rrl_ipv6_prefix_length, o);
 		SERV_GET_INT(rrl_whitelist_ratelimit, o);
+		SERV_GET_PATH(final, rrl_file, o);
+		SERV_GET_INT(rrl_adaptive, o);
 #endif
 		SERV_GET_INT(zonefiles_write, o);
 		/* remote control */
@@ -422,16 +527,28 @@ static void print_zone_content_elems(pattern_options_t* pat)
 	print_acl("provide-xfr:", pat->provide_xfr);
 	if(pat->zonestats)
 		print_string_var("zonestats:", pat->zonestats);
+	if(pat->catalog_member_pattern)
+		print_string_var("catalog-member-pattern:",
+			pat->catalog_member_pattern);
 	print_acl_ips("outgoing-interface:", pat->outgoing_interface);
 	if(!pat->allow_axfr_fallback_is_default)
 		printf("\tallow-axfr-fallback: %s\n",
 			pat->allow_axfr_fallback?"yes":"no");
+	if(!pat->store_ixfr_is_default)
+		printf("\tstore-ixfr: %s\n", pat->store_ixfr?"yes":"no");
+	if(!pat->ixfr_number_is_default)
+		printf("\tixfr-number: %u\n", (unsigned)pat->ixfr_number);
+	if(!pat->ixfr_size_is_default)
+		printf("\tixfr-size: %u\n", (unsigned)pat->ixfr_size);
+	if(!pat->load_priority_is_default)
+		printf("\tload-priority: %u\n", (unsigned)pat->load_priority);
 }
 
 void
 config_test_print_server(nsd_options_t* opt)
 {
 	ip_address_option_t* ip;
+	cpu_map_option_t* cpumap;
 	key_options_t* key;
 	zone_options_t* zone;
 	pattern_options_t* pat;
@@ -443,9 +560,19 @@ config_test_print_server(nsd_options_t* opt)
 	printf("\tdo-ip4: %s\n", opt->do_ip4?"yes":"no");
 	printf("\tdo-ip6: %s\n", opt->do_ip6?"yes":"no");
 	printf("\thide-version: %s\n", opt->hide_version?"yes":"no");
+	printf("\tminimal-responses: %s\n", opt->minimal_responses?"yes":"no");
+	printf("\tminimal-any: %s\n", opt->minimal_any == MINIMAL_ANY_HINFO ?
+		"hinfo" : (opt->minimal_any?"yes":"no"));
 	print_string_var("database:", opt->database);
 	print_string_var("identity:", opt->identity);
 	print_string_var("nsid:", opt->nsid);
+	printf("\tanswer-cookie: %s\n", opt->answer_cookie?"yes":"no");
+	print_string_var("cookie-secret:", opt->cookie_secret);
+	printf("\toverload-action: %s\n", opt->overload_action == OVERLOAD_TC ?
+		"tc" : (opt->overload_action == OVERLOAD_DROP ? "drop" : "no"));
+	print_acl_ips("overload-allow:", opt->overload_allow);
+	printf("\tudp-filter: %s\n", opt->udp_filter?"yes":"no");
+	print_acl_ips("udp-filter-deny:", opt->udp_filter_deny);
 	print_string_var("logfile:", opt->logfile);
 	printf("\tserver_count: %d\n", opt->server_count);
 	printf("\ttcp_count: %d\n", opt->tcp_count);
@@ -460,11 +587,81 @@ config_test_print_server(nsd_options_t* opt)
 	print_string_var("username:", opt->username);
 	print_string_var("zonesdir:", opt->zonesdir);
 	print_string_var("xfrdfile:", opt->xfrdfile);
+	print_string_var("database-publish:", opt->database_publish);
+	print_string_var("nsec3-snapshot:", opt->nsec3_snapshot);
 	print_string_var("zonelistfile:", opt->zonelistfile);
 	print_string_var("xfrdir:", opt->xfrdir);
 	printf("\txfrd_reload_timeout: %d\n", opt->xfrd_reload_timeout);
+	printf("\txfrd-tcp-max: %d\n", opt->xfrd_tcp_max);
+	printf("\txfrd-stream-apply: %s\n", opt->xfrd_stream_apply?"yes":"no");
+	printf("\txfrd-tcp-master-max: %d\n", opt->xfrd_tcp_master_max);
+	printf("\txfrd-udp-max: %d\n", opt->xfrd_udp_max);
+	printf("\tudp-batch-size: %d\n", opt->udp_batch_size);
+	printf("\tudp-busy-poll: %d\n", opt->udp_busy_poll);
+	printf("\tudp-gro: %s\n", opt->udp_gro?"yes":"no");
+	printf("\tudp-gso: %s\n", opt->udp_gso?"yes":"no");
+	printf("\tudp-wildcard: %s\n", opt->udp_wildcard?"yes":"no");
+	printf("\tudp-prefetch: %s\n", opt->udp_prefetch?"yes":"no");
+	printf("\tudp-drop-stats: %s\n", opt->udp_drop_stats?"yes":"no");
+	printf("\tudp-rcvbuf-max: %d\n", opt->udp_rcvbuf_max);
+	printf("\tstall-monitor: %d\n", opt->stall_monitor);
+	printf("\tlatency-stats: %s\n", opt->latency_stats?"yes":"no");
+	printf("\tregion-profile: %s\n", opt->region_profile?"yes":"no");
+	printf("\tzone-cpu-sample: %d\n", opt->zone_cpu_sample);
+	printf("\tdnstap-enable: %s\n", opt->dnstap_enable?"yes":"no");
+	print_string_var("dnstap-socket-path:", opt->dnstap_socket_path);
+	print_string_var("dnstap-file:", opt->dnstap_file);
+	printf("\tdnstap-log-auth-query-messages: %s\n",
+		opt->dnstap_log_auth_query_messages?"yes":"no");
+	printf("\tdnstap-log-auth-response-messages: %s\n",
+		opt->dnstap_log_auth_response_messages?"yes":"no");
+	printf("\tdnstap-sample: %d\n", opt->dnstap_sample);
+	printf("\tdnstap-ring-size: %d\n", opt->dnstap_ring_size);
+	printf("\theavy-hitters: %d\n", opt->heavy_hitters);
 	printf("\tlog-time-ascii: %s\n", opt->log_time_ascii?"yes":"no");
 	printf("\tround-robin: %s\n", opt->round_robin?"yes":"no");
+	printf("\treuseport: %s\n", opt->reuseport?"yes":"no");
+	printf("\ttcp-reuseport: %s\n", opt->tcp_reuseport?"yes":"no");
+	printf("\ttcp-defer-accept: %s\n", opt->tcp_defer_accept?"yes":"no");
+	printf("\ttcp-fastopen: %s\n", opt->tcp_fastopen?"yes":"no");
+	printf("\tnsec3-cache-size: %d\n", (int)opt->nsec3_cache_size);
+	printf("\tanswer-cache-size: %d\n", (int)opt->answer_cache_size);
+	printf("\taxfr-cache-size: %d\n", (int)opt->axfr_cache_size);
+	print_cpu_affinity("cpu-affinity:", opt->cpu_affinity);
+	for(cpumap = opt->service_cpu_affinity; cpumap; cpumap = cpumap->next) {
+		char nm[64];
+		snprintf(nm, sizeof(nm), "server-%d-cpu-affinity:",
+			cpumap->service);
+		print_cpu_affinity(nm, cpumap->cpus);
+	}
+	print_cpu_affinity("xfrd-cpu-affinity:", opt->xfrd_cpu_affinity);
+	printf("\tzonefiles-load-workers: %d\n", opt->zonefiles_load_workers);
+	printf("\tzonefiles-write-workers: %d\n", opt->zonefiles_write_workers);
+	printf("\tprogressive-start: %s\n", opt->progressive_start?"yes":"no");
+	printf("\treload-in-place: %s\n", opt->reload_in_place?"yes":"no");
+	printf("\treload-prefault: %s\n", opt->reload_prefault?"yes":"no");
+	printf("\tzone-regions: %s\n", opt->zone_regions?"yes":"no");
+	printf("\tname-hash-index: %s\n", opt->name_hash_index?"yes":"no");
+	printf("\trdata-sharing: %s\n", opt->rdata_sharing?"yes":"no");
+	printf("\thugepages: %s\n", opt->hugepages?"yes":"no");
+	printf("\tnuma-replicate: %s\n", opt->numa_replicate?"yes":"no");
+	printf("\tmetrics-enable: %s\n", opt->metrics_enable?"yes":"no");
+	for(ip = opt->metrics_interface; ip; ip=ip->next)
+		print_string_var("metrics-interface:", ip->address);
+	printf("\tmetrics-port: %d\n", opt->metrics_port);
+	print_string_var("metrics-path:", opt->metrics_path);
+	printf("\tlog-async: %s\n", opt->log_async?"yes":"no");
+	printf("\txfr-out-workers: %d\n", opt->xfr_out_workers);
+	printf("\txfr-out-nice: %d\n", opt->xfr_out_nice);
+	printf("\txfr-out-rate: %d\n", opt->xfr_out_rate);
+	printf("\tlazy-zone-load: %s\n", opt->lazy_zone_load?"yes":"no");
+	printf("\tdatabase-readonly: %s\n", opt->database_readonly?"yes":"no");
+	printf("\txfrdfile-text: %s\n", opt->xfrdfile_text?"yes":"no");
+	printf("\tserver-threads: %s\n", opt->server_threads?"yes":"no");
+	print_string_var("xdp-interface:", opt->xdp_interface);
+	print_string_var("tls-service-key:", opt->tls_service_key);
+	print_string_var("tls-service-pem:", opt->tls_service_pem);
+	print_string_var("tls-port:", opt->tls_port);
 	printf("\tverbosity: %d\n", opt->verbosity);
 	for(ip = opt->ip_addresses; ip; ip=ip->next)
 	{
@@ -477,8 +674,11 @@ config_test_print_server(nsd_options_t* opt)
 	printf("\trrl-ipv4-prefix-length: %d\n", (int)opt->rrl_ipv4_prefix_length);
 	printf("\trrl-ipv6-prefix-length: %d\n", (int)opt->rrl_ipv6_prefix_length);
 	printf("\trrl-whitelist-ratelimit: %d\n", (int)opt->rrl_whitelist_ratelimit);
+	print_string_var("rrl-file:", opt->rrl_file);
+	printf("\trrl-adaptive: %d\n", (int)opt->rrl_adaptive);
 #endif
 	printf("\tzonefiles-check: %s\n", opt->zonefiles_check?"yes":"no");
+	printf("\tzonefiles-watch: %s\n", opt->zonefiles_watch?"yes":"no");
 	printf("\tzonefiles-write: %d\n", opt->zonefiles_write);
 
 	printf("\nremote-control:\n");
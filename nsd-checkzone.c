@@ -10,12 +10,15 @@
 #include "config.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "nsd.h"
 #include "options.h"
@@ -24,6 +27,73 @@
 
 static void error(const char *format, ...) ATTR_FORMAT(printf, 1, 2);
 struct nsd nsd;
+/* check the zones in one pass, without loading them */
+static int stream_mode = 0;
+
+/* the records for the glue check are sorted on disk, in runs of this
+ * size that are sorted in memory */
+#define GLUE_RUN_SIZE (4*1024*1024)
+/* the kinds of glue records, the names with an address sort first */
+#define GLUE_HAS_ADDRESS 0
+#define GLUE_NEEDS_ADDRESS 1
+/* the read buffer for a run, when the runs are merged */
+#define GLUE_READ_SIZE 8192
+
+/*
+ * The names in the zone that have an A or AAAA record, and the NS
+ * targets in the zone that need one.  A record is the lowercase name,
+ * the kind and, for a target, the owner of the NS.  The records are
+ * written in sorted runs to a temporary file, and merged after the parse.
+ */
+struct glue_sort {
+	FILE* file;
+	/* the records of the current run */
+	uint8_t* buf;
+	size_t buf_used;
+	uint8_t** recs;
+	size_t num, max;
+	/* the start positions of the runs in the file, and the end */
+	off_t* runs;
+	size_t num_runs;
+	/* the number of NS targets that need an address */
+	size_t need;
+};
+
+/* a run that is read for the merge */
+struct glue_run {
+	/* position in the file of the next read, and the end of the run */
+	off_t pos, end;
+	/* the data that is read, and the current record in it */
+	uint8_t buf[GLUE_READ_SIZE];
+	size_t len, at;
+};
+
+/* the state of the streaming check of a zone */
+struct stream_check {
+	zone_type* zone;
+	/* for the owner name of the previous RR */
+	region_type* region;
+	const dname_type* owner;
+	/* the types at the owner name, with the number of RRs and the
+	 * TTL of the first */
+	uint16_t* types;
+	uint16_t* counts;
+	uint32_t* ttls;
+	size_t num_types, max_types;
+	/* the target of the CNAME and DNAME at the owner, duplicates of
+	 * them are not counted */
+	const dname_type* cname;
+	const dname_type* dname;
+	/* the owner has an address, it is in the glue sort */
+	int has_address;
+	/* the names below it have an error already */
+	int below_dname;
+	/* the last DNAME owner, for the names below it */
+	region_type* dname_region;
+	const dname_type* dname_owner;
+	size_t soa_count, apex_ns, unsorted;
+	struct glue_sort glue;
+};
 
 /*
  * Print the help text.
@@ -32,7 +102,10 @@ struct nsd nsd;
 static void
 usage (void)
 {
-	fprintf(stderr, "Usage: nsd-checkzone <zone name> <zone file>\n");
+	fprintf(stderr, "Usage: nsd-checkzone [-s] [-j num] <zone name> <zone file> "
+		"[<zone name> <zone file> ...]\n");
+	fprintf(stderr, "-j num		check the zones with num processes.\n");
+	fprintf(stderr, "-s		check in one pass, with bounded memory.\n");
 	fprintf(stderr, "Version %s. Report bugs to <%s>.\n",
 		PACKAGE_VERSION, PACKAGE_BUGREPORT);
 }
@@ -51,7 +124,412 @@ error(const char *format, ...)
 	exit(1);
 }
 
+/* length of the glue record, or 0 if it is longer than avail */
+static size_t
+glue_rec_len(const uint8_t* p, size_t avail)
+{
+	size_t len;
+	if(avail < 1 || avail < (size_t)1 + p[0] + 2)
+		return 0;
+	len = (size_t)1 + p[0] + 2 + p[1 + p[0] + 1];
+	return len <= avail ? len : 0;
+}
+
+/* compare glue records, by name and then kind */
+static int
+glue_rec_cmp(const uint8_t* a, const uint8_t* b)
+{
+	size_t len = a[0] < b[0] ? a[0] : b[0];
+	int c = memcmp(a+1, b+1, len);
+	if(c != 0)
+		return c;
+	if(a[0] != b[0])
+		return a[0] < b[0] ? -1 : 1;
+	return (int)a[1+a[0]] - (int)b[1+b[0]];
+}
+
+static int
+glue_rec_qsort_cmp(const void* a, const void* b)
+{
+	return glue_rec_cmp(*(uint8_t* const*)a, *(uint8_t* const*)b);
+}
+
+/* sort the records of the current run and write them to the file */
+static void
+glue_sort_flush(struct glue_sort* gs)
+{
+	size_t i;
+	if(gs->num == 0)
+		return;
+	if(!gs->file && !(gs->file = tmpfile()))
+		error("cannot create temporary file: %s", strerror(errno));
+	qsort(gs->recs, gs->num, sizeof(uint8_t*), glue_rec_qsort_cmp);
+	gs->runs = (off_t*)xrealloc(gs->runs, (gs->num_runs+2)*sizeof(off_t));
+	gs->runs[gs->num_runs] = ftello(gs->file);
+	for(i=0; i<gs->num; i++) {
+		if(fwrite(gs->recs[i], glue_rec_len(gs->recs[i], GLUE_RUN_SIZE),
+			1, gs->file) != 1)
+			error("cannot write temporary file: %s",
+				strerror(errno));
+	}
+	gs->num_runs++;
+	gs->runs[gs->num_runs] = ftello(gs->file);
+	gs->buf_used = 0;
+	gs->num = 0;
+}
+
+/* add a glue record for the name, with the owner of the NS */
+static void
+glue_sort_add(struct glue_sort* gs, const dname_type* name, uint8_t kind,
+	const dname_type* ns)
+{
+	size_t i, len = (size_t)1 + name->name_size + 2 +
+		(ns?ns->name_size:0);
+	uint8_t* p;
+	if(gs->buf_used + len > GLUE_RUN_SIZE)
+		glue_sort_flush(gs);
+	if(!gs->buf)
+		gs->buf = (uint8_t*)xalloc(GLUE_RUN_SIZE);
+	if(gs->num == gs->max) {
+		gs->max = gs->max?gs->max*2:1024;
+		gs->recs = (uint8_t**)xrealloc(gs->recs,
+			gs->max*sizeof(uint8_t*));
+	}
+	p = gs->buf + gs->buf_used;
+	p[0] = (uint8_t)name->name_size;
+	for(i=0; i<name->name_size; i++)
+		p[1+i] = (uint8_t)tolower((unsigned char)dname_name(name)[i]);
+	p[1+name->name_size] = kind;
+	p[1+name->name_size+1] = (uint8_t)(ns?ns->name_size:0);
+	if(ns)
+		memmove(p+1+name->name_size+2, dname_name(ns), ns->name_size);
+	gs->recs[gs->num++] = p;
+	gs->buf_used += len;
+	if(kind == GLUE_NEEDS_ADDRESS)
+		gs->need++;
+}
+
+/* the current record of the run, NULL at the end of the run */
+static uint8_t*
+glue_run_rec(struct glue_run* r, int fd)
+{
+	ssize_t n;
+	size_t want;
+	if(glue_rec_len(r->buf + r->at, r->len - r->at))
+		return r->buf + r->at;
+	/* read more of the run after the part that is left */
+	memmove(r->buf, r->buf + r->at, r->len - r->at);
+	r->len -= r->at;
+	r->at = 0;
+	want = sizeof(r->buf) - r->len;
+	if((off_t)want > r->end - r->pos)
+		want = (size_t)(r->end - r->pos);
+	if(want == 0)
+		return NULL;
+	n = pread(fd, r->buf + r->len, want, r->pos);
+	if(n <= 0)
+		error("cannot read temporary file: %s", n==0?"end of file":
+			strerror(errno));
+	r->len += n;
+	r->pos += n;
+	if(!glue_rec_len(r->buf, r->len))
+		error("bad record in temporary file");
+	return r->buf;
+}
+
+/* move the run at heap position i down, to its place in the heap */
+static void
+glue_heap_down(struct glue_run** heap, size_t num, size_t i)
+{
+	while(2*i+1 < num) {
+		size_t c = 2*i+1;
+		struct glue_run* t;
+		if(c+1 < num && glue_rec_cmp(heap[c+1]->buf + heap[c+1]->at,
+			heap[c]->buf + heap[c]->at) < 0)
+			c++;
+		if(glue_rec_cmp(heap[i]->buf + heap[i]->at,
+			heap[c]->buf + heap[c]->at) <= 0)
+			break;
+		t = heap[i]; heap[i] = heap[c]; heap[c] = t;
+		i = c;
+	}
+}
+
+/* merge the runs, and report the NS targets without an address */
+static void
+glue_sort_check(struct glue_sort* gs, const char* name)
+{
+	struct glue_run* runs, **heap;
+	size_t i, num = 0, missing = 0;
+	uint8_t last[1+MAXDOMAINLEN];
+	region_type* region;
+	int fd;
+
+	if(gs->need == 0)
+		return;
+	glue_sort_flush(gs);
+	if(fflush(gs->file) != 0)
+		error("cannot write temporary file: %s", strerror(errno));
+	fd = fileno(gs->file);
+	region = region_create(xalloc, free);
+	runs = (struct glue_run*)xalloc_array_zero(gs->num_runs,
+		sizeof(*runs));
+	heap = (struct glue_run**)xalloc_array_zero(gs->num_runs,
+		sizeof(*heap));
+	for(i=0; i<gs->num_runs; i++) {
+		runs[i].pos = gs->runs[i];
+		runs[i].end = gs->runs[i+1];
+		if(glue_run_rec(&runs[i], fd))
+			heap[num++] = &runs[i];
+	}
+	for(i=num; i>0; i--)
+		glue_heap_down(heap, num, i-1);
+	last[0] = 0;
+	while(num > 0) {
+		struct glue_run* r = heap[0];
+		uint8_t* p = r->buf + r->at;
+		if(p[1+p[0]] == GLUE_HAS_ADDRESS) {
+			memmove(last, p, 1+p[0]);
+		} else if(last[0] != p[0] || memcmp(last+1, p+1, p[0]) != 0) {
+			const dname_type* target = dname_make(region, p+1, 0);
+			const dname_type* ns = dname_make(region,
+				p+1+p[0]+2, 0);
+			if(target && ns) {
+				/* the string of the dname is a static buffer */
+				char tstr[MAXDOMAINLEN*5];
+				strlcpy(tstr, dname_to_string(target, NULL),
+					sizeof(tstr));
+				log_msg(LOG_WARNING, "zone %s: NS %s of %s has "
+					"no A or AAAA in the zone", name, tstr,
+					dname_to_string(ns, NULL));
+			}
+			missing++;
+			region_free_all(region);
+		}
+		r->at += glue_rec_len(p, r->len - r->at);
+		if(!glue_run_rec(r, fd))
+			heap[0] = heap[--num];
+		glue_heap_down(heap, num, 0);
+	}
+	if(missing)
+		log_msg(LOG_WARNING, "zone %s: %u NS targets in the zone have "
+			"no address", name, (unsigned)missing);
+	free(runs);
+	free(heap);
+	region_destroy(region);
+}
+
+static void
+glue_sort_free(struct glue_sort* gs)
+{
+	if(gs->file)
+		fclose(gs->file);
+	free(gs->buf);
+	free(gs->recs);
+	free(gs->runs);
+}
+
+/* the index of the type at the owner name, it is added if needed */
+static size_t
+stream_type(struct stream_check* sc, uint16_t type, uint32_t ttl)
+{
+	size_t i;
+	for(i=0; i<sc->num_types; i++)
+		if(sc->types[i] == type)
+			return i;
+	if(sc->num_types == sc->max_types) {
+		sc->max_types = sc->max_types?sc->max_types*2:8;
+		sc->types = (uint16_t*)xrealloc(sc->types,
+			sc->max_types*sizeof(uint16_t));
+		sc->counts = (uint16_t*)xrealloc(sc->counts,
+			sc->max_types*sizeof(uint16_t));
+		sc->ttls = (uint32_t*)xrealloc(sc->ttls,
+			sc->max_types*sizeof(uint32_t));
+	}
+	sc->types[i] = type;
+	sc->counts[i] = 0;
+	sc->ttls[i] = ttl;
+	sc->num_types++;
+	return i;
+}
+
+/* is there a type at the owner name that is not allowed with a CNAME */
+static int
+stream_has_non_cname(struct stream_check* sc)
+{
+	size_t i;
+	for(i=0; i<sc->num_types; i++) {
+		if(sc->types[i] != TYPE_CNAME && sc->types[i] != TYPE_RRSIG &&
+			sc->types[i] != TYPE_NXT && sc->types[i] != TYPE_SIG &&
+			sc->types[i] != TYPE_NSEC && sc->types[i] != TYPE_NSEC3)
+			return 1;
+	}
+	return 0;
+}
+
+/* the RR has a new owner name, the checks of the previous one are done */
+static void
+stream_new_owner(struct stream_check* sc, const dname_type* dname)
+{
+	if(sc->owner && dname_compare(dname, sc->owner) < 0) {
+		/* the checks at a name are for its RRs that are together */
+		if(sc->unsorted++ == 0)
+			zc_warning_prev_line("%s is not in canonical order, the "
+				"checks of names are for the RRs that are "
+				"together", dname_to_string(dname, NULL));
+	}
+	region_free_all(sc->region);
+	sc->owner = dname_copy(sc->region, dname);
+	sc->num_types = 0;
+	sc->cname = NULL;
+	sc->dname = NULL;
+	sc->has_address = 0;
+	sc->below_dname = 0;
+	if(sc->dname_owner && !dname_is_subdomain(dname, sc->dname_owner)) {
+		region_free_all(sc->dname_region);
+		sc->dname_owner = NULL;
+	}
+}
+
+/* check an RR of the zone, in the order of the zone file */
 static void
+stream_check_rr(rr_type* rr, void* arg)
+{
+	struct stream_check* sc = (struct stream_check*)arg;
+	zone_type* zone = sc->zone;
+	const dname_type* dname = domain_dname(rr->owner);
+	const dname_type* target;
+	size_t t;
+
+	if(!sc->owner || dname_compare(dname, sc->owner) != 0)
+		stream_new_owner(sc, dname);
+
+	/* nothing is allowed below a DNAME, but the NSEC3 hashes */
+	if(sc->dname_owner && !sc->below_dname &&
+		dname_compare(dname, sc->dname_owner) != 0 &&
+		rr->type != TYPE_NSEC3 && rr->type != TYPE_RRSIG) {
+		zc_error_prev_line("DNAME at %s has data below it. This is "
+			"not allowed (rfc 2672).",
+			dname_to_string(sc->dname_owner, NULL));
+		sc->below_dname = 1;
+	}
+
+	t = stream_type(sc, rr->type, rr->ttl);
+	if(rr->type == TYPE_CNAME || rr->type == TYPE_DNAME) {
+		const dname_type** prev = rr->type == TYPE_CNAME ?
+			&sc->cname : &sc->dname;
+		target = domain_dname(rr_rdata_domains(rr)[0]);
+		/* a duplicate RR is discarded */
+		if(*prev && dname_compare(*prev, target) == 0)
+			return;
+		if(!*prev)
+			*prev = dname_copy(sc->region, target);
+	}
+	if(sc->counts[t] != 0 && rr->type != TYPE_RRSIG &&
+		sc->ttls[t] != rr->ttl)
+		zc_warning_prev_line("TTL does not match the TTL of the RRset");
+	if(sc->counts[t] < 65535)
+		sc->counts[t]++;
+
+	switch(rr->type) {
+	case TYPE_SOA:
+		if(sc->soa_count++ != 0)
+			zc_error_prev_line("this SOA record was already "
+				"encountered");
+		break;
+	case TYPE_NS:
+		if(rr->owner == zone->apex)
+			sc->apex_ns++;
+		/* a target in the zone needs an address in the zone */
+		target = domain_dname(rr_rdata_domains(rr)[0]);
+		if(dname_is_subdomain(target, domain_dname(zone->apex)))
+			glue_sort_add(&sc->glue, target, GLUE_NEEDS_ADDRESS,
+				dname);
+		break;
+	case TYPE_A:
+	case TYPE_AAAA:
+		if(!sc->has_address) {
+			glue_sort_add(&sc->glue, dname, GLUE_HAS_ADDRESS,
+				NULL);
+			sc->has_address = 1;
+		}
+		break;
+	case TYPE_DNAME:
+		if(!sc->dname_owner || dname_compare(dname,
+			sc->dname_owner) != 0) {
+			region_free_all(sc->dname_region);
+			sc->dname_owner = dname_copy(sc->dname_region, dname);
+		}
+		break;
+	default:
+		break;
+	}
+
+	if(rr->type == TYPE_DNAME && sc->counts[t] > 1)
+		zc_error_prev_line("multiple DNAMEs at the same name");
+	if(rr->type == TYPE_CNAME && sc->counts[t] > 1)
+		zc_error_prev_line("multiple CNAMEs at the same name");
+	if((rr->type == TYPE_DNAME && sc->cname) ||
+		(rr->type == TYPE_CNAME && sc->dname))
+		zc_error_prev_line("DNAME and CNAME at the same name");
+	if(sc->cname && stream_has_non_cname(sc))
+		zc_error_prev_line("CNAME and other data at the same name");
+}
+
+/* check a zone in one pass, the memory does not grow with the zone.
+ * returns 0 if the zone is ok */
+static int
+check_zone_stream(struct nsd* nsd, const char* name, const char* fname)
+{
+	const dname_type* dname;
+	zone_options_t* zo;
+	struct stream_check sc;
+	unsigned errors;
+
+	nsd->db = namedb_open("", nsd->options);
+	dname = dname_parse(nsd->options->region, name);
+	if(!dname)
+		error("cannot parse zone name '%s'", name);
+	zo = zone_options_create(nsd->options->region);
+	memset(zo, 0, sizeof(*zo));
+	zo->node.key = dname;
+	zo->name = name;
+	memset(&sc, 0, sizeof(sc));
+	sc.zone = namedb_zone_create(nsd->db, dname, zo);
+	sc.region = region_create(xalloc, free);
+	sc.dname_region = region_create(xalloc, free);
+
+	(void)zonec_read_stream(name, fname, sc.zone, stream_check_rr, &sc);
+	if(sc.soa_count == 0)
+		zc_error("zone configured as '%s' has no SOA record.", name);
+	if(sc.apex_ns == 0)
+		zc_warning("zone %s has no NS records at the apex", name);
+	glue_sort_check(&sc.glue, name);
+	if(sc.unsorted)
+		zc_warning("zone %s: %u names are not in canonical order, the "
+			"checks at a name and below a DNAME are for the RRs "
+			"that are together, use nsd-checkzone without -s to "
+			"check them", name, (unsigned)sc.unsorted);
+	errors = parser->errors;
+	if(errors > 0) {
+		printf("zone %s file %s has %u errors\n", name, fname, errors);
+	} else {
+		printf("zone %s is ok\n", name);
+	}
+
+	glue_sort_free(&sc.glue);
+	free(sc.types);
+	free(sc.counts);
+	free(sc.ttls);
+	region_destroy(sc.region);
+	region_destroy(sc.dname_region);
+	namedb_close(nsd->db);
+	nsd->db = NULL;
+	return errors > 0;
+}
+
+/* check a zone, returns 0 if the zone is ok */
+static int
 check_zone(struct nsd* nsd, const char* name, const char* fname)
 {
 	const dname_type* dname;
@@ -59,6 +537,9 @@ check_zone(struct nsd* nsd, const char* name, const char* fname)
 	zone_type* zone;
 	unsigned errors;
 
+	if(stream_mode)
+		return check_zone_stream(nsd, name, fname);
+
 	/* init*/
 	nsd->db = namedb_open("", nsd->options);
 	dname = dname_parse(nsd->options->region, name);
@@ -76,10 +557,64 @@ check_zone(struct nsd* nsd, const char* name, const char* fname)
 	errors = zonec_read(name, fname, zone);
 	if(errors > 0) {
 		printf("zone %s file %s has %u errors\n", name, fname, errors);
-		exit(1);
+	} else {
+		printf("zone %s is ok\n", name);
 	}
-	printf("zone %s is ok\n", name);
 	namedb_close(nsd->db);
+	nsd->db = NULL;
+	return errors > 0;
+}
+
+/* check every num-th zone starting at zone w, returns number of failures */
+static int
+check_zones(struct nsd* nsd, char* argv[], int count, int w, int num)
+{
+	int i, failed = 0;
+	for(i=w; i<count; i+=num) {
+		failed += check_zone(nsd, argv[i*2], argv[i*2+1]);
+	}
+	return failed;
+}
+
+/* check the zones with num processes, each checks a share of the zones.
+ * returns the number of processes that had failures */
+static int
+check_zones_parallel(struct nsd* nsd, char* argv[], int count, int num)
+{
+	pid_t* pids;
+	int w, failed = 0;
+	if(num > count)
+		num = count;
+	pids = (pid_t*)xalloc_array_zero(num, sizeof(pid_t));
+	fflush(stdout);
+	for(w=0; w<num; w++) {
+		switch((pids[w] = fork())) {
+		case -1:
+			log_msg(LOG_ERR, "fork failed: %s", strerror(errno));
+			failed += check_zones(nsd, argv, count, w, num)?1:0;
+			break;
+		case 0:
+			exit(check_zones(nsd, argv, count, w, num)?1:0);
+		default:
+			break;
+		}
+	}
+	for(w=0; w<num; w++) {
+		int status;
+		if(pids[w] == -1)
+			continue;
+		while(waitpid(pids[w], &status, 0) == -1) {
+			if(errno != EINTR) {
+				log_msg(LOG_ERR, "waitpid: %s", strerror(errno));
+				status = 1;
+				break;
+			}
+		}
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+	}
+	free(pids);
+	return failed;
 }
 
 /* dummy functions to link */
@@ -105,18 +640,30 @@ int
 main(int argc, char *argv[])
 {
 	/* Scratch variables... */
-	int c;
+	int c, failed;
+	int num = 1;
 	struct nsd nsd;
 	memset(&nsd, 0, sizeof(nsd));
 
 	log_init("nsd-checkzone");
 
 	/* Parse the command line... */
-	while ((c = getopt(argc, argv, "h")) != -1) {
+	while ((c = getopt(argc, argv, "hj:s")) != -1) {
 		switch (c) {
 		case 'h':
 			usage();
 			exit(0);
+		case 'j':
+			num = atoi(optarg);
+			if(num < 1) {
+				fprintf(stderr, "-j needs a positive number.\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 's':
+			stream_mode = 1;
+			break;
 		case '?':
 		default:
 			usage();
@@ -127,7 +674,7 @@ main(int argc, char *argv[])
 	argv += optind;
 
 	/* Commandline parse error */
-	if (argc != 2) {
+	if (argc < 2 || argc % 2 != 0) {
 		fprintf(stderr, "wrong number of arguments.\n");
 		usage();
 		exit(1);
@@ -139,9 +686,11 @@ main(int argc, char *argv[])
 	if (verbosity == 0)
 		verbosity = nsd.options->verbosity;
 
-	check_zone(&nsd, argv[0], argv[1]);
+	if(num > 1)
+		failed = check_zones_parallel(&nsd, argv, argc/2, num);
+	else	failed = check_zones(&nsd, argv, argc/2, 0, 1);
 	region_destroy(nsd.options->region);
 	/* yylex_destroy(); but, not available in all versions of flex */
 
-	exit(0);
+	exit(failed?1:0);
 }
@@ -45,6 +45,7 @@
 #ifdef HAVE_SSL
 
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <string.h>
 #ifdef HAVE_OPENSSL_SSL_H
@@ -71,6 +72,7 @@ usage()
 	printf("Options:\n");
 	printf("  -c file	config file, default is %s\n", CONFIGFILE);
 	printf("  -s ip[@port]	server address, if omitted config is used.\n");
+	printf("  -s /path	local control socket, without SSL.\n");
 	printf("  -h		show this usage help.\n");
 	printf("Commands:\n");
 	printf("  start				start server; runs nsd(8)\n");
@@ -82,6 +84,8 @@ usage()
 	printf("  status			display status of server\n");
 	printf("  stats				print statistics\n");
 	printf("  stats_noreset			peek at statistics\n");
+	printf("  stats_stream [<sec>]		print the increase of the counters every\n");
+	printf("				sec seconds (default 10), until interrupted\n");
 	printf("  addzone <name> <pattern>	add a new zone\n");
 	printf("  delzone <name>		remove a zone\n");
 	printf("  addzones			add zone list on stdin {name space pat newline}\n");
@@ -91,7 +95,10 @@ usage()
 	printf("  transfer [<zone>]		try to update slave zones to newer serial\n");
 	printf("  force_transfer [<zone>]	update slave zones with AXFR, no serial check\n");
 	printf("  zonestatus [<zone>]		print state, serial, activity\n");
+	printf("  zonestatus [state=<s>] [since=<t>] [offset=<n>] [count=<n>]\n");
+	printf("				only zones in state, changed since\n");
 	printf("  serverpid			get pid of server process\n");
+	printf("  top [qname|client|zone] [<n>]	most queried names, clients, zones\n");
 	printf("  verbosity <number>		change logging detail\n");
 	exit(1);
 }
@@ -166,6 +173,34 @@ contact_server(const char* svr, nsd_options_t* cfg, int statuscmd)
 			strcmp(svr, "::") == 0)
 			svr = "::1";
 	}
+	if(svr[0] == '/') {
+		/* local socket */
+		struct sockaddr_un usock;
+		if(strlen(svr) >= sizeof(usock.sun_path)) {
+			fprintf(stderr, "socket path too long: %s\n", svr);
+			exit(1);
+		}
+		memset(&usock, 0, sizeof(usock));
+		usock.sun_family = AF_UNIX;
+		strlcpy(usock.sun_path, svr, sizeof(usock.sun_path));
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd == -1) {
+			fprintf(stderr, "socket: %s\n", strerror(errno));
+			exit(1);
+		}
+		if(connect(fd, (struct sockaddr*)&usock,
+			(socklen_t)sizeof(usock)) < 0) {
+			fprintf(stderr, "error: connect (%s): %s\n", svr,
+				strerror(errno));
+			if((errno == ECONNREFUSED || errno == ENOENT) &&
+				statuscmd) {
+				printf("nsd is stopped\n");
+				exit(3);
+			}
+			exit(1);
+		}
+		return fd;
+	}
 	if(strchr(svr, '@')) {
 		char* ps = strchr(svr, '@');
 		*ps++ = 0;
@@ -251,23 +286,69 @@ setup_ssl(SSL_CTX* ctx, int fd)
 	return ssl;
 }
 
+/** write to the server, over SSL, or to the local socket if ssl is NULL */
+static void
+remote_write(SSL* ssl, int fd, const char* buf, size_t len)
+{
+	ssize_t r;
+	if(ssl) {
+		if(SSL_write(ssl, buf, (int)len) <= 0)
+			ssl_err("could not SSL_write");
+		return;
+	}
+	while(len > 0) {
+		if((r = write(fd, buf, len)) == -1) {
+			if(errno == EINTR)
+				continue;
+			fprintf(stderr, "error: could not write: %s\n",
+				strerror(errno));
+			exit(1);
+		}
+		buf += r;
+		len -= (size_t)r;
+	}
+}
+
+/** read from the server, returns the length or 0 on EOF */
+static int
+remote_read(SSL* ssl, int fd, char* buf, size_t len)
+{
+	int r;
+	if(ssl) {
+		ERR_clear_error();
+		if((r = SSL_read(ssl, buf, (int)len)) <= 0) {
+			if(SSL_get_error(ssl, r) == SSL_ERROR_ZERO_RETURN) {
+				/* EOF */
+				return 0;
+			}
+			ssl_err("could not SSL_read");
+		}
+		return r;
+	}
+	while((r = (int)read(fd, buf, len)) == -1 && errno == EINTR)
+		;
+	if(r == -1) {
+		fprintf(stderr, "error: could not read: %s\n", strerror(errno));
+		exit(1);
+	}
+	return r;
+}
+
 /** send stdin to server */
 static void
-send_file(SSL* ssl, FILE* in, char* buf, size_t sz)
+send_file(SSL* ssl, int fd, FILE* in, char* buf, size_t sz)
 {
 	char e[] = {0x04, 0x0a};
 	while(fgets(buf, (int)sz, in)) {
-		if(SSL_write(ssl, buf, (int)strlen(buf)) <= 0)
-			ssl_err("could not SSL_write contents");
+		remote_write(ssl, fd, buf, strlen(buf));
 	}
 	/* send end-of-file marker */
-	if(SSL_write(ssl, e, (int)sizeof(e)) <= 0)
-		ssl_err("could not SSL_write end-of-file marker");
+	remote_write(ssl, fd, e, sizeof(e));
 }
 
 /** send command and display result */
 static int
-go_cmd(SSL* ssl, int argc, char* argv[])
+go_cmd(SSL* ssl, int fd, int argc, char* argv[])
 {
 	char pre[10];
 	const char* space=" ";
@@ -276,34 +357,26 @@ go_cmd(SSL* ssl, int argc, char* argv[])
 	int r, i;
 	char buf[1024];
 	snprintf(pre, sizeof(pre), "NSDCT%d ", NSD_CONTROL_VERSION);
-	if(SSL_write(ssl, pre, (int)strlen(pre)) <= 0)
-		ssl_err("could not SSL_write");
+	remote_write(ssl, fd, pre, strlen(pre));
 	for(i=0; i<argc; i++) {
-		if(SSL_write(ssl, space, (int)strlen(space)) <= 0)
-			ssl_err("could not SSL_write");
-		if(SSL_write(ssl, argv[i], (int)strlen(argv[i])) <= 0)
-			ssl_err("could not SSL_write");
+		remote_write(ssl, fd, space, strlen(space));
+		remote_write(ssl, fd, argv[i], strlen(argv[i]));
 	}
-	if(SSL_write(ssl, newline, (int)strlen(newline)) <= 0)
-		ssl_err("could not SSL_write");
+	remote_write(ssl, fd, newline, strlen(newline));
 
 	/* send contents to server */
 	if(argc == 1 && (strcmp(argv[0], "addzones") == 0 ||
 		strcmp(argv[0], "delzones") == 0)) {
-		send_file(ssl, stdin, buf, sizeof(buf));
+		send_file(ssl, fd, stdin, buf, sizeof(buf));
 	}
 
 	while(1) {
-		ERR_clear_error();
-		if((r = SSL_read(ssl, buf, (int)sizeof(buf)-1)) <= 0) {
-			if(SSL_get_error(ssl, r) == SSL_ERROR_ZERO_RETURN) {
-				/* EOF */
-				break;
-			}
-			ssl_err("could not SSL_read");
-		}
+		if((r = remote_read(ssl, fd, buf, sizeof(buf)-1)) == 0)
+			break;
 		buf[r] = 0;
 		printf("%s", buf);
+		/* for stats_stream, show the lines as they arrive */
+		fflush(stdout);
 		if(first_line && strncmp(buf, "error", 5) == 0)
 			was_error = 1;
 		first_line = 0;
@@ -317,8 +390,9 @@ go(const char* cfgfile, char* svr, int argc, char* argv[])
 {
 	nsd_options_t* opt;
 	int fd, ret;
-	SSL_CTX* ctx;
-	SSL* ssl;
+	SSL_CTX* ctx = NULL;
+	SSL* ssl = NULL;
+	const char* path;
 
 	/* read config */
 	if(!(opt = nsd_options_create(region_create(xalloc, free)))) {
@@ -326,24 +400,33 @@ go(const char* cfgfile, char* svr, int argc, char* argv[])
 		exit(1);
 	}
 	tsig_init(opt->region);
+	/* only the server and remote-control settings are used */
+	opt->zones_skip = 1;
 	if(!parse_options_file(opt, cfgfile, NULL, NULL)) {
 		fprintf(stderr, "could not read config file\n");
 		exit(1);
 	}
 	if(!opt->control_enable)
 		fprintf(stderr, "warning: control-enable is 'no' in the config file.\n");
-	ctx = setup_ctx(opt);
+	/* a local socket does not use SSL */
+	path = svr?svr:(opt->control_interface?
+		opt->control_interface->address:"");
+	if(path[0] != '/')
+		ctx = setup_ctx(opt);
 
 	/* contact server */
 	fd = contact_server(svr, opt, argc>0&&strcmp(argv[0],"status")==0);
-	ssl = setup_ssl(ctx, fd);
+	if(ctx)
+		ssl = setup_ssl(ctx, fd);
 
 	/* send command */
-	ret = go_cmd(ssl, argc, argv);
+	ret = go_cmd(ssl, fd, argc, argv);
 
-	SSL_free(ssl);
+	if(ssl)
+		SSL_free(ssl);
 	close(fd);
-	SSL_CTX_free(ctx);
+	if(ctx)
+		SSL_CTX_free(ctx);
 	region_destroy(opt->region);
 	return ret;
 }
@@ -16,6 +16,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include "nsd.h"
 #include "tsig.h"
@@ -28,6 +29,11 @@
 static void error(const char *format, ...) ATTR_FORMAT(printf, 1, 2);
 struct nsd nsd;
 
+/* with -s, the bytes read from the start of a zonefile to estimate the
+ * memory of the whole zone */
+#define SAMPLE_SIZE (1024*1024)
+static int sample_mode = 0;
+
 /*
  * Print the help text.
  *
@@ -35,7 +41,9 @@ struct nsd nsd;
 static void
 usage (void)
 {
-	fprintf(stderr, "Usage: nsd-mem [-c configfile]\n");
+	fprintf(stderr, "Usage: nsd-mem [-s] [-c configfile]\n");
+	fprintf(stderr, "-s	estimate from the first %d kb of every zonefile\n",
+		SAMPLE_SIZE/1024);
 	fprintf(stderr, "Version %s. Report bugs to <%s>.\n",
 		PACKAGE_VERSION, PACKAGE_BUGREPORT);
 }
@@ -67,6 +75,11 @@ struct zone_mem {
 
 	/* count of number of domains */
 	size_t domaincount;
+
+	/* the zone data, names, rrsets, rdata, nsec3 */
+	struct zone_mem_stat stat;
+	/* the database per tag of the allocator */
+	struct region_tag_stat tags[REGION_TAG_COUNT];
 };
 
 /* total memory structure */
@@ -82,13 +95,13 @@ struct tot_mem {
 
 	/* count of number of domains */
 	size_t domaincount;
+	/* the database and the options per tag of the allocator */
+	struct region_tag_stat tags[REGION_TAG_COUNT];
 
 	/* options data */
 	size_t opt_data;
 	/* unused in options region */
 	size_t opt_unused;
-	/* dname compression table */
-	size_t compresstable;
 #ifdef RATELIMIT
 	/* size of rrl tables */
 	size_t rrl;
@@ -101,16 +114,105 @@ struct tot_mem {
 };
 
 static void
-account_zone(struct namedb* db, struct zone_mem* zmem)
+account_zone(struct namedb* db, zone_type* zone, struct zone_mem* zmem)
 {
-	zmem->data = region_get_mem(db->region);
+	zmem->data = namedb_get_mem(db);
 	zmem->data_unused = region_get_mem_unused(db->region);
+	if(zone->region != db->region)
+		zmem->data_unused += region_get_mem_unused(zone->region);
 	if(db->udb) {
 		zmem->udb_data = (size_t)db->udb->alloc->disk->stat_data;
 		zmem->udb_overhead = (size_t)(db->udb->alloc->disk->stat_alloc -
 			db->udb->alloc->disk->stat_data);
 	}
 	zmem->domaincount = db->domains->nametree->count;
+	zone_get_mem_stat(zone, &zmem->stat);
+	if(db->profile)
+		memcpy(zmem->tags, db->profile, sizeof(zmem->tags));
+}
+
+/* scale the accounting of a sample of the zonefile to the whole file,
+ * base is the memory of the database before the zone was read */
+static void
+scale_zone(struct zone_mem* zmem, size_t base, double f)
+{
+	int i;
+	if(zmem->data > base)
+		zmem->data = base + (size_t)((zmem->data - base) * f);
+	zmem->data_unused = (size_t)(zmem->data_unused * f);
+	zmem->udb_data = (size_t)(zmem->udb_data * f);
+	zmem->udb_overhead = (size_t)(zmem->udb_overhead * f);
+	zmem->domaincount = (size_t)(zmem->domaincount * f);
+	zmem->stat.domains = (uint64_t)(zmem->stat.domains * f);
+	zmem->stat.domain_count = (uint64_t)(zmem->stat.domain_count * f);
+	zmem->stat.rrsets = (uint64_t)(zmem->stat.rrsets * f);
+	zmem->stat.rdata = (uint64_t)(zmem->stat.rdata * f);
+	zmem->stat.nsec3 = (uint64_t)(zmem->stat.nsec3 * f);
+	for(i=0; i<REGION_TAG_COUNT; i++) {
+		zmem->tags[i].bytes = (size_t)(zmem->tags[i].bytes * f);
+		zmem->tags[i].high = (size_t)(zmem->tags[i].high * f);
+		zmem->tags[i].allocs = (size_t)(zmem->tags[i].allocs * f);
+		zmem->tags[i].recycles = (size_t)(zmem->tags[i].recycles * f);
+		zmem->tags[i].recycle_hit = (size_t)(zmem->tags[i].recycle_hit
+			* f);
+		zmem->tags[i].recycle_miss = (size_t)(
+			zmem->tags[i].recycle_miss * f);
+	}
+}
+
+/*
+ * Copy the start of the zonefile to sf, up to max bytes, and not into
+ * a record that continues over lines in parentheses.  Returns the bytes
+ * copied, or 0 if the file is small enough to be read completely.
+ */
+static size_t
+sample_zonefile(const char* fname, const char* sf, size_t max, size_t* total)
+{
+	FILE* in, *out;
+	struct stat st;
+	char buf[4096];
+	size_t len = 0, cut = 0;
+	int paren = 0, quote = 0, comment = 0;
+	if(stat(fname, &st) != 0 || (size_t)st.st_size <= max)
+		return 0;
+	*total = (size_t)st.st_size;
+	if(!(in = fopen(fname, "r")))
+		return 0;
+	if(!(out = fopen(sf, "w")))
+		error("cannot create %s: %s", sf, strerror(errno));
+	while(len < max && fgets(buf, sizeof(buf), in)) {
+		size_t i, n = strlen(buf);
+		if(len + n > max)
+			break;
+		for(i=0; i<n; i++) {
+			if(comment) {
+				if(buf[i] == '\n')
+					comment = 0;
+			} else if(quote) {
+				if(buf[i] == '\\' && i+1<n)
+					i++;
+				else if(buf[i] == '"')
+					quote = 0;
+			} else if(buf[i] == ';')
+				comment = 1;
+			else if(buf[i] == '"')
+				quote = 1;
+			else if(buf[i] == '(')
+				paren++;
+			else if(buf[i] == ')' && paren > 0)
+				paren--;
+		}
+		if(fwrite(buf, 1, n, out) != n)
+			error("cannot write %s: %s", sf, strerror(errno));
+		len += n;
+		if(paren == 0 && n > 0 && buf[n-1] == '\n')
+			cut = len;
+	}
+	fclose(in);
+	if(fflush(out) != 0 || ftruncate(fileno(out), (off_t)cut) != 0)
+		error("cannot write %s: %s", sf, strerror(errno));
+	fclose(out);
+	return cut;
 }
 
 static void
@@ -134,6 +236,10 @@ print_zone_mem(struct zone_mem* z)
 {
 	pretty_mem(z->data, "zone data");
 	pretty_mem(z->data_unused, "zone unused space (due to alignment)");
+	pretty_mem(z->stat.domains, "  of which names");
+	pretty_mem(z->stat.rrsets, "  of which rrsets");
+	pretty_mem(z->stat.rdata, "  of which rdata");
+	pretty_mem(z->stat.nsec3, "  of which nsec3 precompile");
 	pretty_mem(z->udb_data, "data in nsd.db");
 	pretty_mem(z->udb_overhead, "overhead in nsd.db");
 }
@@ -143,9 +249,8 @@ account_total(nsd_options_t* opt, struct tot_mem* t)
 {
 	t->opt_data = region_get_mem(opt->region);
 	t->opt_unused = region_get_mem_unused(opt->region);
-	t->compresstable = sizeof(uint16_t) *
-		(t->domaincount + 1 + EXTRA_DOMAIN_NUMBERS);
-	t->compresstable *= opt->server_count;
+	if(opt->profile)
+		region_tag_stat_add(t->tags, opt->profile);
 
 #ifdef RATELIMIT
 #define SIZE_RRL_BUCKET (8 + 4 + 4 + 4 + 4 + 2)
@@ -153,14 +258,34 @@ account_total(nsd_options_t* opt, struct tot_mem* t)
 	t->rrl *= opt->server_count;
 #endif
 
-	t->ram = t->data + t->data_unused + t->opt_data + t->opt_unused +
-		t->compresstable;
+	t->ram = t->data + t->data_unused + t->opt_data + t->opt_unused;
 #ifdef RATELIMIT
 	t->ram += t->rrl;
 #endif
 	t->disk = t->udb_data + t->udb_overhead;
 }
 
+/* the memory per tag of the allocator, the bytes in use and the most
+ * in use, the allocations and how many of them were recycled memory */
+static void
+print_tag_mem(struct region_tag_stat* tags)
+{
+	int i;
+	char s[128];
+	printf("\nper subsystem\n");
+	for(i=0; i<REGION_TAG_COUNT; i++) {
+		if(tags[i].allocs == 0)
+			continue;
+		snprintf(s, sizeof(s), "%s (high %llu, %llu allocs, "
+			"recycle %llu hit %llu miss)", region_tag_name(i),
+			(unsigned long long)tags[i].high,
+			(unsigned long long)tags[i].allocs,
+			(unsigned long long)tags[i].recycle_hit,
+			(unsigned long long)tags[i].recycle_miss);
+		pretty_mem(tags[i].bytes, s);
+	}
+}
+
 static void
 print_tot_mem(struct tot_mem* t)
 {
@@ -169,12 +294,12 @@ print_tot_mem(struct tot_mem* t)
 	pretty_mem(t->data_unused, "unused space (due to alignment)");
 	pretty_mem(t->opt_data, "options");
 	pretty_mem(t->opt_unused, "options unused space (due to alignment)");
-	pretty_mem(t->compresstable, "name table (depends on servercount)");
 #ifdef RATELIMIT
 	pretty_mem(t->rrl, "RRL table (depends on servercount)");
 #endif
 	pretty_mem(t->udb_data, "data in nsd.db");
 	pretty_mem(t->udb_overhead, "overhead in nsd.db");
+	print_tag_mem(t->tags);
 	printf("\nsummary\n");
 
 	pretty_mem(t->ram, "ram usage (excl space for buffers)");
@@ -189,6 +314,7 @@ add_mem(struct tot_mem* t, struct zone_mem* z)
 	t->udb_data += z->udb_data;
 	t->udb_overhead += z->udb_overhead;
 	t->domaincount += z->domaincount;
+	region_tag_stat_add(t->tags, z->tags);
 }
 
 static void
@@ -202,6 +328,9 @@ check_zone_mem(const char* tf, const char* df, zone_options_t* zo,
 	struct udb_base* taskudb;
 	udb_ptr last_task;
 	struct zone_mem zmem;
+	char sf[512];
+	const char* zonefile = zo->pattern->zonefile;
+	size_t base, sampled = 0, total = 0;
 
 	printf("zone %s\n", zo->name);
 
@@ -213,12 +342,29 @@ check_zone_mem(const char* tf, const char* df, zone_options_t* zo,
 	zone = namedb_zone_create(db, dname, zo);
 	taskudb = udb_base_create_new(tf, &namedb_walkfunc, NULL);
 	udb_ptr_init(&last_task, taskudb);
-
-	/* read the zone */
+	base = namedb_get_mem(db);
+
+	/* read the zone, or the start of it */
+	if(sample_mode && zonefile) {
+		snprintf(sf, sizeof(sf), "./nsd-mem-sample-%u.zone",
+			(unsigned)getpid());
+		sampled = sample_zonefile(config_make_zonefile(zo, &nsd), sf,
+			SAMPLE_SIZE, &total);
+		if(sampled)
+			zo->pattern->zonefile = sf;
+	}
 	namedb_read_zonefile(&nsd, zone, taskudb, &last_task);
+	zo->pattern->zonefile = zonefile;
+	if(sampled)
+		unlink(sf);
 
 	/* account the memory for this zone */
-	account_zone(db, &zmem);
+	account_zone(db, zone, &zmem);
+	if(sampled) {
+		printf("estimate from %u of %u zonefile bytes\n",
+			(unsigned)sampled, (unsigned)total);
+		scale_zone(&zmem, base, (double)total / (double)sampled);
+	}
 
 	/* pretty print the memory for this zone */
 	print_zone_mem(&zmem);
@@ -297,12 +443,15 @@ main(int argc, char *argv[])
 	log_init("nsd-mem");
 
 	/* Parse the command line... */
-	while ((c = getopt(argc, argv, "c:h"
+	while ((c = getopt(argc, argv, "c:hs"
 		)) != -1) {
 		switch (c) {
 		case 'c':
 			configfile = optarg;
 			break;
+		case 's':
+			sample_mode = 1;
+			break;
 		case 'h':
 			usage();
 			exit(0);
@@ -335,6 +484,9 @@ main(int argc, char *argv[])
 	}
 	if (verbosity == 0)
 		verbosity = nsd.options->verbosity;
+	/* count the memory per tag of the allocator */
+	nsd.options->region_profile = 1;
+	nsd_options_profile(nsd.options);
 
 #ifdef HAVE_CHROOT
 	if(nsd.chrootdir == 0) nsd.chrootdir = nsd.options->chroot;
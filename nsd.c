@@ -42,9 +42,15 @@
 
 #include "nsd.h"
 #include "options.h"
+#include "packet.h"
 #include "tsig.h"
 #include "remote.h"
+#include "metrics.h"
 #include "xfrd-disk.h"
+#include "dnstap.h"
+#include "topk.h"
+#include "logring.h"
+#include "stall.h"
 
 /* The server handler... */
 struct nsd nsd;
@@ -612,6 +618,8 @@ main(int argc, char *argv[])
 		error("could not read zonelist file %s\n",
 			nsd.options->zonelistfile);
 	}
+	if(nsd.options->region_profile)
+		nsd_options_profile(nsd.options);
 	if(nsd.options->do_ip4 && !nsd.options->do_ip6) {
 		for (i = 0; i < MAX_INTERFACES; ++i) {
 			hints[i].ai_family = AF_INET;
@@ -674,6 +682,51 @@ main(int argc, char *argv[])
 	if(nsd.maximum_tcp_count == 0) {
 		nsd.maximum_tcp_count = nsd.options->tcp_count;
 	}
+	if(nsd.options->reuseport && nsd.child_count > 1) {
+#ifdef SO_REUSEPORT
+		nsd.reuseport = nsd.child_count;
+#else
+		log_msg(LOG_WARNING, "reuseport: no SO_REUSEPORT on this "
+			"system, the servers share the UDP sockets");
+#endif /* SO_REUSEPORT */
+	}
+	if(nsd.options->tcp_reuseport && nsd.child_count > 1) {
+#ifdef SO_REUSEPORT
+		nsd.tcp_reuseport = nsd.child_count;
+#else
+		log_msg(LOG_WARNING, "tcp-reuseport: no SO_REUSEPORT on this "
+			"system, the servers share the TCP sockets");
+#endif /* SO_REUSEPORT */
+	}
+	if(nsd.options->server_threads && nsd.child_count > 1) {
+#ifdef USE_SERVER_THREADS
+		nsd.server_threads = 1;
+		if(nsd.options->reload_in_place) {
+			/* the threads share the database */
+			log_msg(LOG_WARNING, "reload-in-place: is not used "
+				"with server-threads");
+			nsd.options->reload_in_place = 0;
+		}
+#else
+		log_msg(LOG_WARNING, "server-threads: no thread support in "
+			"this build, the servers are processes");
+#endif /* USE_SERVER_THREADS */
+	}
+#ifndef USE_XDP
+	if(nsd.options->xdp_interface)
+		log_msg(LOG_WARNING, "xdp-interface: no AF_XDP support in "
+			"this build, the normal sockets answer all queries");
+#endif
+	if(nsd.options->xfr_out_workers > 0) {
+		if(nsd.server_threads)
+			log_msg(LOG_WARNING, "xfr-out-workers: is not used "
+				"with server-threads");
+		else {
+			/* after the reuseport servers, they have no UDP */
+			nsd.xfrout_count = nsd.options->xfr_out_workers;
+			nsd.child_count += nsd.xfrout_count;
+		}
+	}
 	nsd.tcp_timeout = nsd.options->tcp_timeout;
 	nsd.tcp_query_count = nsd.options->tcp_query_count;
 	nsd.ipv4_edns_size = nsd.options->ipv4_edns_size;
@@ -751,11 +804,33 @@ main(int argc, char *argv[])
 		nsd.children[i].child_fd = -1;
 		nsd.children[i].parent_fd = -1;
 		nsd.children[i].handler = NULL;
+		nsd.children[i].udp = NULL;
+		nsd.children[i].tcp = NULL;
+		nsd.children[i].xfrout_fd = -1;
 		nsd.children[i].need_to_send_STATS = 0;
 		nsd.children[i].need_to_send_QUIT = 0;
 		nsd.children[i].need_to_exit = 0;
 		nsd.children[i].has_exited = 0;
 	}
+	if(nsd.xfrout_count > 0) {
+		nsd.xfrout_fd = (int*)region_alloc_array(nsd.region,
+			nsd.xfrout_count, sizeof(int));
+		for (i = 0; i < nsd.xfrout_count; ++i) {
+			struct nsd_child* c = &nsd.children[nsd.child_count -
+				nsd.xfrout_count + i];
+			int sv[2];
+			if(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == -1)
+				error("xfr-out-workers: socketpair: %s",
+					strerror(errno));
+			if(fcntl(sv[0], F_SETFL, O_NONBLOCK) == -1 ||
+				fcntl(sv[1], F_SETFL, O_NONBLOCK) == -1)
+				error("xfr-out-workers: fcntl: %s",
+					strerror(errno));
+			c->kind = NSD_SERVER_XFR;
+			c->xfrout_fd = sv[1];
+			nsd.xfrout_fd[i] = sv[0];
+		}
+	}
 
 	nsd.this_child = NULL;
 
@@ -884,6 +959,16 @@ main(int argc, char *argv[])
 		} else if (!file_inside_chroot(nsd.options->xfrdfile, nsd.chrootdir)) {
 			error("xfrdfile %s is not relative to %s: chroot not possible",
 				nsd.options->xfrdfile, nsd.chrootdir);
+		} else if (nsd.options->database_publish &&
+			!file_inside_chroot(nsd.options->database_publish,
+			nsd.chrootdir)) {
+			error("database-publish %s is not relative to %s: chroot not possible",
+				nsd.options->database_publish, nsd.chrootdir);
+		} else if (nsd.options->nsec3_snapshot &&
+			!file_inside_chroot(nsd.options->nsec3_snapshot,
+			nsd.chrootdir)) {
+			error("nsec3-snapshot %s is not relative to %s: chroot not possible",
+				nsd.options->nsec3_snapshot, nsd.chrootdir);
 		} else if (!file_inside_chroot(nsd.options->zonelistfile, nsd.chrootdir)) {
 			error("zonelistfile %s is not relative to %s: chroot not possible",
 				nsd.options->zonelistfile, nsd.chrootdir);
@@ -946,6 +1031,8 @@ main(int argc, char *argv[])
 	nsd.signal_hint_statsusr = 0;
 	nsd.quit_sync_done = 0;
 
+	packet_init();
+
 	/* Initialize the server... */
 	if (server_init(&nsd) != 0) {
 		error("server initialization failed, %s could "
@@ -954,8 +1041,31 @@ main(int argc, char *argv[])
 #if defined(HAVE_SSL)
 	if(nsd.options->control_enable) {
 		/* read ssl keys while superuser and outside chroot */
+		ip_address_option_t* p;
 		if(!(nsd.rc = daemon_remote_create(nsd.options)))
 			error("could not perform remote control setup");
+		/* the local control sockets are for the nsd user and group */
+		for(p = nsd.options->control_interface; p; p = p->next) {
+			if(p->address[0] != '/' || !nsd.uid || !nsd.gid)
+				continue;
+			if(chown(p->address, nsd.uid, nsd.gid) != 0)
+				log_msg(LOG_ERR, "cannot chown %s to %u.%u: %s",
+					p->address, (unsigned)nsd.uid,
+					(unsigned)nsd.gid, strerror(errno));
+		}
+	}
+	if(nsd.options->metrics_enable) {
+		/* open the ports while superuser */
+		if(!(nsd.metrics = daemon_metrics_create(nsd.options)))
+			error("could not open the metrics ports");
+	}
+	if(nsd.options->tls_service_key && nsd.options->tls_service_key[0]
+	   && nsd.options->tls_service_pem && nsd.options->tls_service_pem[0]) {
+		/* the servers share it, and its session ticket keys */
+		if(!(nsd.tls_ctx = server_tls_ctx_create(&nsd,
+			nsd.options->tls_service_key,
+			nsd.options->tls_service_pem)))
+			error("could not set up tls SSL_CTX");
 	}
 #endif /* HAVE_SSL */
 
@@ -1029,6 +1139,12 @@ main(int argc, char *argv[])
 			nsd.dbfile += l;
 		if (nsd.options->xfrdfile[0] == '/')
 			nsd.options->xfrdfile += l;
+		if (nsd.options->database_publish &&
+			nsd.options->database_publish[0] == '/')
+			nsd.options->database_publish += l;
+		if (nsd.options->nsec3_snapshot &&
+			nsd.options->nsec3_snapshot[0] == '/')
+			nsd.options->nsec3_snapshot += l;
 		if (nsd.options->zonelistfile[0] == '/')
 			nsd.options->zonelistfile += l;
 		if (nsd.options->xfrdir[0] == '/')
@@ -1113,6 +1229,18 @@ main(int argc, char *argv[])
 	server_zonestat_alloc(&nsd);
 #endif /* USE_ZONE_STATS */
 
+	/* before xfrd is started and the database is read, so the database
+	 * is allocated near the configured cpus */
+	server_set_cpu_affinity(nsd.options->cpu_affinity, "nsd");
+#ifdef BIND8_STATS
+	server_stat_alloc(&nsd);
+#endif
+#ifdef USE_DNSTAP
+	dt_alloc(&nsd);
+#endif
+	topk_alloc(&nsd);
+	logring_alloc(&nsd);
+	stall_alloc(&nsd);
 	if(nsd.server_kind == NSD_SERVER_MAIN) {
 		server_prepare_xfrd(&nsd);
 		/* xfrd forks this before reading database, so it does not get
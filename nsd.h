@@ -16,8 +16,17 @@
 #include "edns.h"
 struct netio_handler;
 struct nsd_options;
+struct anscache;
+struct axfrcache;
+struct nsd_xdp;
+struct dt_ring;
+struct topk_entry;
+struct dname;
+struct zone;
+struct cpu_option;
 struct udb_base;
 struct daemon_remote;
+struct daemon_metrics;
 
 /* The NSD runtime states and NSD ipc command values */
 #define	NSD_RUN	0
@@ -31,6 +40,8 @@ struct daemon_remote;
  * then network packet contents.  packet is a notify(acl checked), or
  * xfr reply from a master(acl checked).
  * followed by u32(acl number that matched from notify/xfr acl).
+ * The servers pass notifies straight to xfrd on notify_fd, and use this
+ * only when that would block.
  */
 #define NSD_PASS_TO_XFRD 6
 /*
@@ -59,11 +70,24 @@ struct daemon_remote;
  * port53 is free when all of nsd's processes have exited at shutdown time
  */
 #define NSD_QUIT_CHILD 11
+/*
+ * APPLY_XFR is sent to the children by reload-in-place, followed by the
+ * zone transfers to apply.  The child echoes it when it is done.
+ */
+#define NSD_APPLY_XFR 12
+/*
+ * QUIT_DRAIN is sent to the old servers after a reload.  They stop
+ * reading UDP and accepting TCP, that the new servers do, and quit when
+ * their TCP connections are done, or after the tcp-timeout.
+ */
+#define NSD_QUIT_DRAIN 13
 
 #define NSD_SERVER_MAIN 0x0U
 #define NSD_SERVER_UDP  0x1U
 #define NSD_SERVER_TCP  0x2U
 #define NSD_SERVER_BOTH (NSD_SERVER_UDP | NSD_SERVER_TCP)
+/* an xfr-out worker, it sends the AXFRs that the servers hand it */
+#define NSD_SERVER_XFR  0x4U
 
 #ifdef INET6
 #define DEFAULT_AI_FAMILY AF_UNSPEC
@@ -82,6 +106,22 @@ typedef	unsigned long stc_t;
 				nsd->st.stc[LASTELEM(nsd->st.stc)]++ */
 
 #define	STATUP2(nsd, stc, i) nsd->st.stc[(i) <= (LASTELEM(nsd->st.stc) - 1) ? i : LASTELEM(nsd->st.stc)]++
+
+/* answer classes of the latency statistics, see query_latency_class */
+#define LATENCY_POSITIVE	0
+#define LATENCY_REFERRAL	1
+#define LATENCY_NODATA		2
+#define LATENCY_NXDOMAIN	3
+#define LATENCY_NSEC3		4	/* NODATA or NXDOMAIN with NSEC3 */
+#define LATENCY_AXFR		5	/* AXFR and IXFR */
+#define LATENCY_OTHER		6	/* errors, CHAOS, NOTIFY */
+#define LATENCY_CLASSES		7
+/* log-linear histogram buckets, see query_latency_bucket */
+#define LATENCY_BUCKETS		40
+/* stages of the latency_nsec sums */
+#define LATENCY_PARSE		0
+#define LATENCY_LOOKUP		1
+#define LATENCY_ENCODE		2
 #else	/* BIND8_STATS */
 
 #define	STATUP(nsd, stc) /* Nothing */
@@ -89,25 +129,122 @@ typedef	unsigned long stc_t;
 
 #endif /* BIND8_STATS */
 
+/* the handlers that stall-monitor times, STALL_LOOP is the event loop */
+#define STALL_LOOP		0
+#define STALL_UDP		1
+#define STALL_TCP_READ		2
+#define STALL_TCP_WRITE		3
+#define STALL_HANDLERS		4
+
 #ifdef USE_ZONE_STATS
+/* number of qtypes of a zone that have a counter of their own */
+#define ZONESTAT_QTYPES 10
+/* the cpu counters of a zone, with zone-cpu-sample */
+#define ZONESTAT_CPU_QUERY	0	/* nsec of the queries, scaled up */
+#define ZONESTAT_CPU_AXFR	1	/* nsec of the AXFR and IXFR messages
+					   after the first */
+#define ZONESTAT_CPU_SAMPLES	2	/* number of timed queries */
+#define ZONESTAT_CPU		3
+/*
+ * The statistics of a zone in one server process.  Only the counters
+ * that are kept per zone, not all of struct nsdst, and the qtypes in a
+ * few slots that are taken by the qtypes in the order they are queried;
+ * the qtypes after that are counted together.  A multiple of the cache
+ * line, so that the servers do not write to the same lines.
+ */
+struct zonestat {
+	/* the qtype in the upper 16 bits and the count in the lower 48,
+	 * 0 if the slot is not used */
+	uint64_t qtype[ZONESTAT_QTYPES];
+	uint64_t qtype_other;
+	uint64_t qclass[4];
+	uint64_t rcode[17], opcode[6];
+	uint64_t qudp, qudp6, ctcp, ctcp6;
+	uint64_t dropped, truncated, txerr;
+	uint64_t edns, ednserr, raxfr, nona;
+	uint64_t cpu[ZONESTAT_CPU];
+	uint64_t pad[4];
+};
+
+/* count the qtype in its slot, the server is the only writer */
+static inline int
+zonestat_qtype(struct zonestat* z, uint16_t qtype)
+{
+	int i;
+	for(i=0; i<ZONESTAT_QTYPES; i++) {
+		if(z->qtype[i] == 0) {
+			z->qtype[i] = (((uint64_t)qtype)<<48) | 1;
+			return 1;
+		}
+		if((z->qtype[i]>>48) == qtype) {
+			z->qtype[i]++;
+			return 1;
+		}
+	}
+	z->qtype_other++;
+	return 0;
+}
+
+/* the zone stats of the zone of this server, every server process has a
+ * shard of its own, that are added up when they are printed */
+#define ZONESTAT(nsd, zone) (&(nsd)->zonestatnow[(size_t)(zone)->zonestatid \
+	* (nsd)->zonestatshards + (nsd)->zonestatshard])
+/* bytes of the zone stats of num zones, of all the servers */
+#define ZONESTAT_SIZE(nsd, num) \
+	(sizeof(struct zonestat)*(num)*(nsd)->zonestatshards)
 /* increment zone statistic, checks if zone-nonNULL and zone array bounds */
 #define ZTATUP(nsd, zone, stc) ( \
 	(zone && zone->zonestatid < nsd->zonestatsizenow) ? \
-		nsd->zonestatnow[zone->zonestatid].stc++ \
+		ZONESTAT(nsd, zone)->stc++ \
 		: 0)
 #define	ZTATUP2(nsd, zone, stc, i) ( \
 	(zone && zone->zonestatid < nsd->zonestatsizenow) ? \
-		(nsd->zonestatnow[zone->zonestatid].stc[(i) <= (LASTELEM(nsd->zonestatnow[zone->zonestatid].stc) - 1) ? i : LASTELEM(nsd->zonestatnow[zone->zonestatid].stc)]++ ) \
+		(ZONESTAT(nsd, zone)->stc[(i) <= (LASTELEM(ZONESTAT(nsd, zone)->stc) - 1) ? i : LASTELEM(ZONESTAT(nsd, zone)->stc)]++ ) \
+		: 0)
+#define ZTATUP_QTYPE(nsd, zone, qtype) ( \
+	(zone && zone->zonestatid < nsd->zonestatsizenow) ? \
+		zonestat_qtype(ZONESTAT(nsd, zone), (qtype)) \
 		: 0)
 #else /* USE_ZONE_STATS */
 #define	ZTATUP(nsd, zone, stc) /* Nothing */
 #define	ZTATUP2(nsd, zone, stc, i) /* Nothing */
+#define	ZTATUP_QTYPE(nsd, zone, qtype) /* Nothing */
 #endif /* USE_ZONE_STATS */
 
+/* phases of a reload, timed in struct reload_timing */
+#define RELOAD_PHASE_TASKS	0 /* the tasks from xfrd */
+#define RELOAD_PHASE_APPLY	1 /* zone transfers, part of the tasks */
+#define RELOAD_PHASE_PREHASH	2 /* NSEC3 prehash, part of apply */
+#define RELOAD_PHASE_COMPACT	3 /* udb compaction */
+#define RELOAD_PHASE_SYNC	4 /* udb sync to disk */
+#define RELOAD_PHASE_FORK	5 /* start of the new servers */
+#define RELOAD_PHASE_QUITSYNC	6 /* the old main quits */
+#define RELOAD_PHASE_STATS	7 /* statistics from the old main */
+#define RELOAD_PHASES		8
+/* zones with the longest apply time that are kept */
+#define RELOAD_SLOW_ZONES	5
+
+/* the time spent in the phases of the last reload, sent to xfrd */
+struct reload_timing {
+	/* when the reload started, seconds since the epoch */
+	uint64_t start;
+	/* nsec of the whole reload, and of the phases */
+	uint64_t total;
+	uint64_t phase[RELOAD_PHASES];
+	/* zone transfers that were applied */
+	uint32_t zones;
+	/* the slowest zones, longest first, their nsec and apex (wire) */
+	uint64_t slow_nsec[RELOAD_SLOW_ZONES];
+	uint8_t slow_zone[RELOAD_SLOW_ZONES][MAXDOMAINLEN];
+};
+
 struct nsd_socket
 {
 	struct addrinfo	*	addr;
 	int			s;
+	/* with udp-drop-stats, the number of queries that the kernel
+	 * dropped on the UDP socket, in shared memory, or NULL */
+	uint32_t*		rxq_drops;
 };
 
 struct nsd_child
@@ -135,12 +272,31 @@ struct nsd_child
 	 */
 	uint8_t need_to_send_STATS, need_to_send_QUIT;
 	uint8_t need_to_exit, has_exited;
+	/* reload-in-place waits for the child to apply zone transfers */
+	uint8_t wait_apply_xfr;
 
 	/*
 	 * The handler for handling the commands from the child.
 	 */
 	struct netio_handler* handler;
 
+	/*
+	 * With reuseport, the UDP sockets this child serves, one for
+	 * every interface.  NULL if it serves the shared nsd->udp sockets.
+	 */
+	struct nsd_socket* udp;
+	/*
+	 * With tcp-reuseport, the TCP sockets this child accepts on.  NULL
+	 * if it accepts on the shared nsd->tcp sockets.
+	 */
+	struct nsd_socket* tcp;
+
+	/*
+	 * For an xfr-out worker, the socket it receives the connections
+	 * on from the servers, -1 for the servers.
+	 */
+	int xfrout_fd;
+
 #ifdef	BIND8_STATS
 	stc_t query_count;
 #endif
@@ -182,7 +338,14 @@ struct	nsd
 	struct udb_base* task[2];
 	int mytask; /* the base used by this process */
 	struct netio_handler* xfrd_listener;
+	/* datagram socket that takes the notifies that passed the acl from
+	 * the servers straight to xfrd, or -1 */
+	int notify_fd;
 	struct daemon_remote* rc;
+	/* the metrics HTTP listener, served by xfrd, or NULL */
+	struct daemon_metrics* metrics;
+	/* DNS over TLS context for the tls-port interfaces, or NULL */
+	void* tls_ctx;
 
 	/* Configuration */
 	const char		*dbfile;
@@ -196,6 +359,8 @@ struct	nsd
 	const char		*identity;
 	uint16_t		nsid_len;
 	unsigned char   *nsid;
+	/* the siphash key of the server cookies */
+	uint8_t			cookie_secret[COOKIE_SECRET_LEN];
 	uint8_t 		file_rotation_ok;
 
 	/* number of interfaces, ifs < MAX_INTERFACES */
@@ -207,6 +372,22 @@ struct	nsd
 
 	/* UDP specific configuration */
 	struct nsd_socket udp[MAX_INTERFACES];
+	/* number of children with their own SO_REUSEPORT UDP socket set,
+	 * or 0 if all children share the nsd->udp sockets */
+	size_t reuseport;
+	/* number of children with their own SO_REUSEPORT TCP listening
+	 * sockets, or 0 if all children accept on the nsd->tcp sockets */
+	size_t tcp_reuseport;
+	/* with udp-wildcard, the sorted keys of the ip-addresses that the
+	 * queries to the wildcard UDP sockets are answered for, or NULL */
+	uint8_t* udp_wild_keys;
+	size_t udp_wild_count;
+	/* the children are threads of one server process, server-threads */
+	int server_threads;
+	/* the xfr-out workers are the last xfrout_count children, the
+	 * servers send the AXFR connections to them over xfrout_fd */
+	size_t xfrout_count;
+	int* xfrout_fd;
 
 	edns_data_type edns_ipv4;
 #if defined(INET6)
@@ -220,6 +401,43 @@ struct	nsd
 	size_t ipv4_edns_size;
 	size_t ipv6_edns_size;
 
+	/* answer cache of this server process, NULL if not used */
+	struct anscache* anscache;
+	/* AXFR stream cache of this server process, NULL if not used */
+	struct axfrcache* axfrcache;
+	/* AF_XDP sockets on the xdp-interface, NULL if not used */
+	struct nsd_xdp* xdp;
+#ifdef USE_DNSTAP
+	/* dnstap rings of the servers, two blocks like the stat_map,
+	 * NULL if dnstap is off.  dt_size records per ring. */
+	char* dt_map[2];
+	size_t dt_size;
+	/* block of dt_map for the next servers that are forked */
+	int dt_idx;
+	/* ring of this server process, NULL if dnstap is off */
+	struct dt_ring* dt_ring;
+#endif
+	/* log rings of the servers, two blocks like the stat_map, NULL if
+	 * log-async is off */
+	char* log_map[2];
+	/* block of log_map for the next servers that are forked */
+	int log_idx;
+	/* heavy hitter tables of the servers, two blocks like the stat_map,
+	 * NULL if heavy-hitters is 0.  top_size entries per table. */
+	char* top_map[2];
+	size_t top_size;
+	/* block of top_map for the next servers that are forked */
+	int top_idx;
+	/* tables of this server process, NULL if not used */
+	struct topk_entry* top;
+	/* heartbeats of the servers for stall-monitor, two blocks like the
+	 * stat_map, NULL if it is off */
+	char* stall_map[2];
+	/* block of stall_map for the next servers that are forked */
+	int stall_idx;
+	/* the time of the phases of the reload, in the reload process */
+	struct reload_timing reload_timing;
+
 #ifdef	BIND8_STATS
 
 	struct nsdst {
@@ -232,12 +450,41 @@ struct	nsd
 		stc_t	rcode[17], opcode[6]; /* Rcodes & opcodes */
 		/* Dropped, truncated, queries for nonconfigured zone, tx errors */
 		stc_t	dropped, truncated, wrongzone, txerr, rxerr;
+		/* dropped by the kernel, the receive buffer was full */
+		stc_t	rxq_drops;
+		/* with stall-monitor, the handlers that ran too long, per
+		 * handler, and the largest lag of the event loop in usec */
+		stc_t	stall[STALL_HANDLERS];
+		uint64_t loop_lag_max;
 		stc_t 	edns, ednserr, raxfr, nona;
+		/* rate limited answers, sent truncated or discarded */
+		stc_t	rrl_slip, rrl_discard;
+		/* with rrl-adaptive, the limits in effect in the server, in
+		 * qps, not added up */
+		uint32_t rrl_limit, rrl_whitelist_limit;
+		/* queries shed in overload, sent truncated or discarded */
+		stc_t	overload_tc, overload_drop;
+		stc_t	arena_overflow;	/* queries larger than the arena */
+		/* the server mapped nsd.db again, it changed size */
+		stc_t	db_remap;
+		/* the cache of hashes of the names proven not to exist */
+		stc_t	nsec3_cache_hit, nsec3_cache_miss, nsec3_cache_evict;
+		/* with latency-stats, per answer class and udp(0), tcp(1)
+		 * the latency histogram and the nsec in the stages */
+		stc_t	latency[LATENCY_CLASSES][2][LATENCY_BUCKETS];
+		uint64_t latency_nsec[LATENCY_CLASSES][2][3];
 		uint64_t db_disk, db_mem;
+		uint64_t db_slab, db_slab_used;
+		uint64_t db_disk_free; /* free space inside nsd.db */
+		/* with region-profile, the memory per tag of the database,
+		 * copied like the sizes, and of the server, from its slot */
+		struct region_tag_stat db_tag[REGION_TAG_COUNT];
+		struct region_tag_stat mem_tag[REGION_TAG_COUNT];
 	} st;
-	/* per zone stats, each an array per zone-stat-idx, stats per zone is
-	 * add of [0][zoneidx] and [1][zoneidx]. */
-	struct nsdst* zonestat[2];
+	/* per zone stats, each an array per zone-stat-idx with a shard per
+	 * server, stats per zone is the add of the shards of
+	 * [0][zoneidx] and [1][zoneidx]. */
+	struct zonestat* zonestat[2];
 	/* fd for zonestat mapping (otherwise mmaps cannot be shared between
 	 * processes and resized) */
 	int zonestatfd[2];
@@ -245,8 +492,18 @@ struct	nsd
 	char* zonestatfname[2];
 	/* size of the mmapped zone stat array (number of array entries) */
 	size_t zonestatsize[2], zonestatdesired, zonestatsizenow;
+	/* the number of shards of a zone, and the shard of this server */
+	size_t zonestatshards, zonestatshard;
 	/* current zonestat array to use */
-	struct nsdst* zonestatnow;
+	struct zonestat* zonestatnow;
+	/* shared (mmap) statistics of the server processes, two blocks
+	 * of child_count slots, the new children after a reload use the
+	 * other block.  NULL if not available. */
+	char* stat_map[2];
+	/* block of stat_map in use by the current server processes */
+	int stat_idx;
+	/* slot where this server process publishes its st, or NULL */
+	struct nsdst* stat_slot;
 #endif /* BIND8_STATS */
 
 	struct nsd_options* options;
@@ -268,12 +525,40 @@ void server_main(struct nsd *nsd);
 void server_child(struct nsd *nsd);
 void server_shutdown(struct nsd *nsd);
 void server_close_all_sockets(struct nsd_socket sockets[], size_t n);
+/* close the UDP and TCP sockets this server listens on */
+void server_close_listening_sockets(struct nsd *nsd);
+/* with server-threads, end this server thread if others keep running */
+void server_thread_quit(struct nsd *nsd);
+/* close the reuseport UDP sockets of the children, except the set keep */
+void server_close_reuseport_sockets(struct nsd *nsd, struct nsd_socket* keep);
+/* close the reuseport TCP sockets of the children, except the set keep */
+void server_close_reuseport_tcp(struct nsd *nsd, struct nsd_socket* keep);
 struct event_base* nsd_child_event_base(void);
+/* name of the reload phase, for the log and nsd-control status */
+const char* reload_phase_name(int phase);
+/* add the apply time of a zone to the reload timing */
+void reload_timing_zone(struct nsd* nsd, const struct dname* zone,
+	uint64_t nsec);
+#ifdef HAVE_SSL
+/* create the DNS over TLS context with the key and certificate files */
+void* server_tls_ctx_create(struct nsd* nsd, const char* keyfile,
+	const char* pemfile);
+#endif
+/* bind this process to the cpus in the list, no change if NULL */
+void server_set_cpu_affinity(struct cpu_option* cpus, const char* who);
 /* extra domain numbers for temporary domains */
 #define EXTRA_DOMAIN_NUMBERS 1024
 #define SLOW_ACCEPT_TIMEOUT 2 /* in seconds */
 /* allocate zonestat structures */
 void server_zonestat_alloc(struct nsd* nsd);
+/* size of a slot in the stat_map, whole cache lines so that the
+ * servers do not write to the same cache line */
+#define STAT_SLOT_SIZE ((sizeof(struct nsdst)+63)&~((size_t)63))
+/* allocate the shared statistics map of the server processes */
+void server_stat_alloc(struct nsd* nsd);
+/* the statistics slot of server process num in block idx of stat_map */
+#define STAT_SLOT(nsd, idx, num) \
+	((struct nsdst*)((nsd)->stat_map[(idx)] + (num)*STAT_SLOT_SIZE))
 /* remap the mmaps for zonestat isx, to bytesize sz.  Caller has to set
  * the zonestatsize */
 void zonestat_remap(struct nsd* nsd, int idx, size_t sz);
@@ -284,5 +569,12 @@ void server_start_xfrd(struct nsd *nsd, int del_db, int reload_active);
 /* send SOA serial numbers to xfrd */
 void server_send_soa_xfrd(struct nsd *nsd, int shortsoa);
 ssize_t block_read(struct nsd* nsd, int s, void* p, ssize_t sz, int timeout);
+/* apply the zone transfers that reload-in-place sends, in a child */
+void server_child_apply_xfr(struct nsd* nsd, int fd);
+/* apply the zone transfer to the database of this process, and flush the
+ * caches of its answers, returns false on failure */
+int server_apply_xfr(struct nsd* nsd, struct zone* zone, uint64_t xfrfilenr);
+/* the server drains its TCP connections and quits, for NSD_QUIT_DRAIN */
+void server_child_drain(struct nsd* nsd);
 
 #endif	/* _NSD_H_ */
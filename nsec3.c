@@ -10,6 +10,18 @@
 #ifdef NSEC3
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
 
 #include "nsec3.h"
 #include "iterated_hash.h"
@@ -18,9 +30,31 @@
 #include "answer.h"
 #include "udbzone.h"
 #include "options.h"
+#include "rdata.h"
+#include "lookup3.h"
+#include "util.h"
 
 #define NSEC3_RDATA_BITMAP 5
 
+/* a hash of a name that is proven not to exist, in the cache */
+struct nsec3_cache_entry {
+	/* zone of the name, NULL if the entry is empty */
+	zone_type* zone;
+	uint8_t hash[NSEC3_HASH_LEN];
+	uint8_t len;
+	uint8_t name[MAXDOMAINLEN];
+};
+
+/* the cache of the server, direct mapped on the name */
+static NSD_THREAD_LOCAL struct nsec3_cache_entry* nsec3_cache = NULL;
+static NSD_THREAD_LOCAL size_t nsec3_cache_size = 0;
+#ifdef BIND8_STATS
+static NSD_THREAD_LOCAL struct nsdst* nsec3_cache_st = NULL;
+#define NSEC3_CACHE_STATUP(stc) nsec3_cache_st->stc++
+#else
+#define NSEC3_CACHE_STATUP(stc) /* nothing */
+#endif
+
 /* compare nsec3 hashes in nsec3 tree */
 static int
 cmp_hash_tree(const void* x, const void* y)
@@ -78,6 +112,7 @@ void nsec3_zone_trees_create(struct region* region, zone_type* zone)
 
 void nsec3_hash_tree_clear(struct zone* zone)
 {
+	nsec3_index_clear(zone);
 	hash_tree_clear(zone->nsec3tree);
 	hash_tree_clear(zone->hashtree);
 	hash_tree_clear(zone->wchashtree);
@@ -90,9 +125,11 @@ detect_nsec3_params(rr_type* nsec3_apex,
 {
 	assert(salt && salt_len && iter);
 	assert(nsec3_apex);
-	*salt_len = rdata_atom_data(nsec3_apex->rdatas[3])[0];
-	*salt = (unsigned char*)(rdata_atom_data(nsec3_apex->rdatas[3])+1);
-	*iter = read_uint16(rdata_atom_data(nsec3_apex->rdatas[2]));
+	/* the algorithm, flags, iterations and salt are the start of the
+	 * wire format */
+	*salt_len = rr_rdata_wire(nsec3_apex)[4];
+	*salt = (unsigned char*)(rr_rdata_wire(nsec3_apex)+5);
+	*iter = read_uint16(rr_rdata_wire(nsec3_apex)+2);
 }
 
 const dname_type *
@@ -119,6 +156,60 @@ nsec3_hash_and_store(zone_type* zone, const dname_type* dname, uint8_t* store)
 		dname_name(dname), dname->name_size, nsec3_iterations);
 }
 
+void
+nsec3_cache_init(struct nsd* nsd, size_t size)
+{
+	size_t n = 1;
+	if(size == 0)
+		return;
+	while(n < size)
+		n <<= 1;
+	nsec3_cache = (struct nsec3_cache_entry*)xalloc_array_zero(n,
+		sizeof(*nsec3_cache));
+	nsec3_cache_size = n;
+#ifdef BIND8_STATS
+	nsec3_cache_st = &nsd->st;
+#else
+	(void)nsd;
+#endif
+}
+
+void
+nsec3_cache_flush_zone(zone_type* zone)
+{
+	size_t i;
+	for(i=0; i<nsec3_cache_size; i++)
+		if(nsec3_cache[i].zone == zone)
+			nsec3_cache[i].zone = NULL;
+}
+
+/* hash the name, or get the hash from the cache */
+static void
+nsec3_cache_hash(zone_type* zone, const dname_type* dname, uint8_t* store)
+{
+	struct nsec3_cache_entry* e;
+	if(!nsec3_cache) {
+		nsec3_hash_and_store(zone, dname, store);
+		return;
+	}
+	e = &nsec3_cache[hashlittle(dname_name(dname), dname->name_size,
+		(uint32_t)(size_t)zone) & (nsec3_cache_size-1)];
+	if(e->zone == zone && e->len == dname->name_size &&
+		memcmp(e->name, dname_name(dname), e->len) == 0) {
+		NSEC3_CACHE_STATUP(nsec3_cache_hit);
+		memmove(store, e->hash, NSEC3_HASH_LEN);
+		return;
+	}
+	NSEC3_CACHE_STATUP(nsec3_cache_miss);
+	if(e->zone)
+		NSEC3_CACHE_STATUP(nsec3_cache_evict);
+	nsec3_hash_and_store(zone, dname, store);
+	e->zone = zone;
+	e->len = dname->name_size;
+	memmove(e->name, dname_name(dname), e->len);
+	memmove(e->hash, store, NSEC3_HASH_LEN);
+}
+
 #define STORE_HASH(x,y) memmove(domain->nsec3->x,y,NSEC3_HASH_LEN); domain->nsec3->have_##x =1;
 
 /** find hash or create it and store it */
@@ -154,11 +245,16 @@ nsec3_lookup_hash_ds(zone_type* zone, const dname_type* dname,
 static int
 nsec3_has_soa(rr_type* rr)
 {
-	if(rdata_atom_size(rr->rdatas[NSEC3_RDATA_BITMAP]) >= 3 && /* has types in bitmap */
-		rdata_atom_data(rr->rdatas[NSEC3_RDATA_BITMAP])[0] == 0 && /* first window = 0, */
+	uint16_t len;
+	uint8_t* bitmap;
+	if(rr->rdata_count <= NSEC3_RDATA_BITMAP)
+		return 0;
+	bitmap = rr_rdata_field(rr, NSEC3_RDATA_BITMAP, &len);
+	if(len >= 3 && /* has types in bitmap */
+		bitmap[0] == 0 && /* first window = 0, */
 		/* [1]: bitmap length must be >= 1 */
 		/* [2]: bit[6] = SOA, thus mask first bitmap octet with 0x02 */
-		rdata_atom_data(rr->rdatas[NSEC3_RDATA_BITMAP])[2]&0x02) { /* SOA bit set */
+		bitmap[2]&0x02) { /* SOA bit set */
 		return 1;
 	}
 	return 0;
@@ -226,16 +322,12 @@ udb_zone_find_nsec3param(udb_base* udb, udb_ptr* uz, struct zone* z)
 	/* find matching NSEC3PARAM RR in memory */
 	for(i=0; i<rrset->rr_count; i++) {
 		/* if this RR matches the udb RR then we are done */
-		rdata_atom_type* rd = rrset->rrs[i].rdatas;
+		/* alg, flags, iterations, salt length and salt */
+		uint8_t* rd = rr_rdata_wire(&rrset->rrs[i]);
 		if(rrset->rrs[i].rdata_count < 4) continue;
-		if(RR(&urr)->wire[0] == rdata_atom_data(rd[0])[0] && /*alg*/
-		   RR(&urr)->wire[1] == rdata_atom_data(rd[1])[0] && /*flg*/
-		   RR(&urr)->wire[2] == rdata_atom_data(rd[2])[0] && /*iter*/
-		   RR(&urr)->wire[3] == rdata_atom_data(rd[2])[1] &&
-		   RR(&urr)->wire[4] == rdata_atom_data(rd[3])[0] && /*slen*/
+		if(RR(&urr)->wire[4] == rd[4] && /*slen*/
 		   RR(&urr)->len >= 5 + RR(&urr)->wire[4] &&
-		   memcmp(RR(&urr)->wire+5, rdata_atom_data(rd[3])+1,
-			rdata_atom_data(rd[3])[0]) == 0) {
+		   memcmp(RR(&urr)->wire, rd, 5 + rd[4]) == 0) {
 			udb_ptr_unlink(&urr, udb);
 			return &rrset->rrs[i];
 		}
@@ -253,24 +345,21 @@ db_find_nsec3param(struct zone* z, struct rr* avoid_rr)
 		return NULL;
 	/* find first nsec3param we can support (SHA1, no flags) */
 	for(i=0; i<rrset->rr_count; i++) {
-		rdata_atom_type* rd = rrset->rrs[i].rdatas;
+		uint8_t* rd = rr_rdata_wire(&rrset->rrs[i]);
 		/* do not use the RR that is going to be deleted (in IXFR) */
 		if(&rrset->rrs[i] == avoid_rr) continue;
 		if(rrset->rrs[i].rdata_count < 4) continue;
-		if(rdata_atom_data(rd[0])[0] == NSEC3_SHA1_HASH &&
-			rdata_atom_data(rd[1])[0] == 0) {
+		if(rd[0] == NSEC3_SHA1_HASH && rd[1] == 0) {
 			if(2 <= verbosity) {
 				char str[MAX_RDLENGTH*2+16];
 				char* p;
 				p = str+snprintf(str, sizeof(str), "%u %u %u ",
-					(unsigned)rdata_atom_data(rd[0])[0],
-					(unsigned)rdata_atom_data(rd[1])[0],
-					(unsigned)read_uint16(rdata_atom_data(rd[2])));
-				if(rdata_atom_data(rd[3])[0] == 0)
+					(unsigned)rd[0], (unsigned)rd[1],
+					(unsigned)read_uint16(rd+2));
+				if(rd[4] == 0)
 					*p++ = '-';
 				else {
-					p += hex_ntop(rdata_atom_data(rd[3])+1,
-						rdata_atom_data(rd[3])[0], p,
+					p += hex_ntop(rd+5, rd[4], p,
 						sizeof(str)-strlen(str)-1);
 				}
 				*p = 0;
@@ -297,19 +386,13 @@ nsec3_find_zone_param(struct namedb* db, struct zone* zone, udb_ptr* z,
 
 /* check params ok for one RR */
 static int
-nsec3_rdata_params_ok(rdata_atom_type* prd, rdata_atom_type* rd)
+nsec3_rdata_params_ok(uint8_t* prd, uint8_t* rd)
 {
-	return (rdata_atom_data(rd[0])[0] ==
-		rdata_atom_data(prd[0])[0] && /* hash algo */
-	   rdata_atom_data(rd[2])[0] ==
-		rdata_atom_data(prd[2])[0] && /* iterations 0 */
-	   rdata_atom_data(rd[2])[1] ==
-		rdata_atom_data(prd[2])[1] && /* iterations 1 */
-	   rdata_atom_data(rd[3])[0] ==
-		rdata_atom_data(prd[3])[0] && /* salt length */
-	   memcmp(rdata_atom_data(rd[3])+1,
-		rdata_atom_data(prd[3])+1, rdata_atom_data(rd[3])[0])
-		== 0 );
+	return (rd[0] == prd[0] && /* hash algo */
+	   rd[2] == prd[2] && /* iterations 0 */
+	   rd[3] == prd[3] && /* iterations 1 */
+	   rd[4] == prd[4] && /* salt length */
+	   memcmp(rd+5, prd+5, rd[4]) == 0 );
 }
 
 int
@@ -317,7 +400,8 @@ nsec3_rr_uses_params(rr_type* rr, zone_type* zone)
 {
 	if(!rr || rr->rdata_count < 4)
 		return 0;
-	return nsec3_rdata_params_ok(zone->nsec3_param->rdatas, rr->rdatas);
+	return nsec3_rdata_params_ok(rr_rdata_wire(zone->nsec3_param),
+		rr_rdata_wire(rr));
 }
 
 int
@@ -359,6 +443,7 @@ nsec3_clear_precompile(struct namedb* db, zone_type* zone)
 	/* clear prehash items (there must not be items for other zones) */
 	prehash_clear(db->domains);
 	/* clear trees */
+	nsec3_index_clear(zone);
 	hash_tree_clear(zone->nsec3tree);
 	hash_tree_clear(zone->hashtree);
 	hash_tree_clear(zone->wchashtree);
@@ -454,6 +539,257 @@ nsec3_tree_dszone(namedb_type* db, domain_type* d)
 	return nsec3_tree_zone(db, d);
 }
 
+/** the first 64 bits of the hash in the b32 label of the domain, false
+ * if the label is not a hash in lowercase, that sorts in hash order like
+ * the hashes of the lookups */
+static int
+nsec3_label_prefix(domain_type* domain, uint64_t* prefix)
+{
+	const uint8_t* wire = dname_name(domain_dname(domain));
+	uint64_t v = 0;
+	int i, d;
+	if(wire[0] != 32)
+		return 0;
+	/* 12 characters of 5 bits and 4 bits of the 13th */
+	for(i=1; i<=13; i++) {
+		if(wire[i] >= '0' && wire[i] <= '9')
+			d = wire[i] - '0';
+		else if(wire[i] >= 'a' && wire[i] <= 'v')
+			d = wire[i] - 'a' + 10;
+		else	return 0;
+		if(i < 13)
+			v = (v<<5) | (uint64_t)d;
+		else	v = (v<<4) | (uint64_t)(d>>1);
+	}
+	*prefix = v;
+	return 1;
+}
+
+/** the number of added domains the index keeps, and of deleted ones,
+ * before the layout is built again, with 1/64 of the entries added */
+#define NSEC3_INDEX_DELTA_MIN 64
+
+/* state of the fill of the layout from the nsec3tree */
+struct nsec3_index_fill {
+	rbnode_t* node;
+	uint64_t prev;
+	int ok;
+};
+
+/** fill the subtree at k of the layout, in order, from the tree nodes */
+static void
+nsec3_index_fill(struct nsec3_index_entry* layout, size_t count, size_t k,
+	struct nsec3_index_fill* f)
+{
+	uint64_t p;
+	if(k > count || !f->ok)
+		return;
+	nsec3_index_fill(layout, count, 2*k, f);
+	if(!f->ok)
+		return;
+	if(!nsec3_label_prefix((domain_type*)f->node->key, &p) ||
+		p < f->prev) {
+		f->ok = 0;
+		return;
+	}
+	layout[k].prefix = p;
+	layout[k].domain = (domain_type*)f->node->key;
+	f->prev = p;
+	f->node = rbtree_next(f->node);
+	nsec3_index_fill(layout, count, 2*k+1, f);
+}
+
+void
+nsec3_index_build(region_type* region, zone_type* zone)
+{
+	struct nsec3_index* x;
+	struct nsec3_index_fill f;
+	int tag;
+	nsec3_index_clear(zone);
+	if(!zone->nsec3tree || zone->nsec3tree->count == 0)
+		return;
+	tag = region_set_tag(region, REGION_TAG_NSEC3);
+	x = (struct nsec3_index*)region_alloc(region, sizeof(*x));
+	x->region = region;
+	x->count = zone->nsec3tree->count;
+	x->deleted = 0;
+	x->layout = (struct nsec3_index_entry*)region_alloc_array(region,
+		x->count+1, sizeof(struct nsec3_index_entry));
+	x->delta_count = 0;
+	x->delta_max = NSEC3_INDEX_DELTA_MIN + x->count/64;
+	x->delta = (domain_type**)region_alloc_array(region, x->delta_max,
+		sizeof(domain_type*));
+	(void)region_set_tag(region, tag);
+	f.node = rbtree_first(zone->nsec3tree);
+	f.prev = 0;
+	f.ok = 1;
+	nsec3_index_fill(x->layout, x->count, 1, &f);
+	zone->nsec3_index = x;
+	if(!f.ok)
+		nsec3_index_clear(zone);
+}
+
+void
+nsec3_index_clear(zone_type* zone)
+{
+	struct nsec3_index* x = zone->nsec3_index;
+	region_type* region;
+	int tag;
+	if(!x)
+		return;
+	region = x->region;
+	tag = region_set_tag(region, REGION_TAG_NSEC3);
+	region_recycle(region, x->layout, (x->count+1)*
+		sizeof(struct nsec3_index_entry));
+	region_recycle(region, x->delta, x->delta_max*sizeof(domain_type*));
+	region_recycle(region, x, sizeof(*x));
+	(void)region_set_tag(region, tag);
+	zone->nsec3_index = NULL;
+}
+
+/** if the entry sorts before or equal to the key */
+static int
+nsec3_index_le(struct nsec3_index_entry* e, uint64_t prefix, domain_type* key)
+{
+	if(e->prefix != prefix)
+		return e->prefix < prefix;
+	/* a deleted entry has a prefix that no other entry has */
+	return !e->domain || cmp_nsec3_tree(e->domain, key) <= 0;
+}
+
+/** the last entry before or equal to the key, 0 if there is none */
+static size_t
+nsec3_index_search(struct nsec3_index* x, uint64_t prefix, domain_type* key)
+{
+	size_t k = 1;
+	while(k <= x->count) {
+		/* start the load of the entries four levels down */
+		if(16*k <= x->count)
+			PREFETCH(&x->layout[16*k]);
+		k = 2*k + nsec3_index_le(&x->layout[k], prefix, key);
+	}
+	/* the entry is where the search last went right */
+	while((k&1) == 0)
+		k >>= 1;
+	return k >> 1;
+}
+
+/** the entry before k in sorted order, 0 if there is none */
+static size_t
+nsec3_index_prev(struct nsec3_index* x, size_t k)
+{
+	if(2*k <= x->count) {
+		k = 2*k;
+		while(2*k+1 <= x->count)
+			k = 2*k+1;
+		return k;
+	}
+	while((k&1) == 0)
+		k >>= 1;
+	return k >> 1;
+}
+
+/** the entry after k in sorted order, 0 if there is none */
+static size_t
+nsec3_index_next(struct nsec3_index* x, size_t k)
+{
+	if(2*k+1 <= x->count) {
+		k = 2*k+1;
+		while(2*k <= x->count)
+			k = 2*k;
+		return k;
+	}
+	while(k > 1 && (k&1) == 1)
+		k >>= 1;
+	return k >> 1;
+}
+
+/** nsec3_find_cover in the index */
+static int
+nsec3_index_find(zone_type* zone, uint8_t* hash, domain_type* key,
+	domain_type** result)
+{
+	struct nsec3_index* x = zone->nsec3_index;
+	domain_type* best = NULL;
+	uint64_t prefix = 0;
+	size_t k, lo = 0, hi = x->delta_count, mid;
+	for(k=0; k<sizeof(prefix); k++)
+		prefix = (prefix<<8) | hash[k];
+	k = nsec3_index_search(x, prefix, key);
+	while(k != 0 && !x->layout[k].domain)
+		k = nsec3_index_prev(x, k);
+	if(k != 0)
+		best = x->layout[k].domain;
+	/* the last added domain before or equal to the key */
+	while(lo < hi) {
+		mid = (lo+hi)/2;
+		if(cmp_nsec3_tree(x->delta[mid], key) <= 0)
+			lo = mid+1;
+		else	hi = mid;
+	}
+	if(lo > 0 && (!best || cmp_nsec3_tree(x->delta[lo-1], best) > 0))
+		best = x->delta[lo-1];
+	if(!best) {
+		*result = zone->nsec3_last;
+		return 0;
+	}
+	*result = best;
+	return cmp_nsec3_tree(best, key) == 0;
+}
+
+void
+nsec3_index_add(zone_type* zone, domain_type* domain)
+{
+	struct nsec3_index* x = zone->nsec3_index;
+	size_t i;
+	if(!x)
+		return;
+	if(x->delta_count == x->delta_max) {
+		nsec3_index_build(x->region, zone);
+		return;
+	}
+	i = x->delta_count++;
+	while(i > 0 && cmp_nsec3_tree(x->delta[i-1], domain) > 0) {
+		x->delta[i] = x->delta[i-1];
+		i--;
+	}
+	x->delta[i] = domain;
+}
+
+void
+nsec3_index_del(zone_type* zone, domain_type* domain)
+{
+	struct nsec3_index* x = zone->nsec3_index;
+	uint64_t p;
+	size_t i, k, prev, next;
+	if(!x)
+		return;
+	for(i=0; i<x->delta_count; i++) {
+		if(x->delta[i] == domain) {
+			memmove(&x->delta[i], &x->delta[i+1],
+				(x->delta_count-i-1)*sizeof(domain_type*));
+			x->delta_count--;
+			return;
+		}
+	}
+	if(x->deleted < x->delta_max && nsec3_label_prefix(domain, &p)) {
+		k = nsec3_index_search(x, p, domain);
+		prev = (k?nsec3_index_prev(x, k):0);
+		next = (k?nsec3_index_next(x, k):0);
+		/* the search treats a deleted entry as less than a name with
+		 * the same prefix, that must then be the only one */
+		if(k != 0 && x->layout[k].domain == domain &&
+			(prev == 0 || x->layout[prev].prefix != p) &&
+			(next == 0 || x->layout[next].prefix != p)) {
+			x->layout[k].domain = NULL;
+			x->deleted++;
+			return;
+		}
+	}
+	/* the domain is no longer in the nsec3tree */
+	nsec3_index_build(x->region, zone);
+}
+
 int
 nsec3_find_cover(zone_type* zone, uint8_t* hash, size_t hashlen,
 	domain_type** result)
@@ -475,6 +811,8 @@ nsec3_find_cover(zone_type* zone, uint8_t* hash, size_t hashlen,
 	assert(result);
 	assert(zone->nsec3_param && zone->nsec3tree);
 
+	if(zone->nsec3_index && hashlen >= sizeof(uint64_t))
+		return nsec3_index_find(zone, hash, &d, result);
 	exact = rbtree_find_less_equal(zone->nsec3tree, &d, &r);
 	if(r) {
 		*result = (domain_type*)r->key;
@@ -562,12 +900,494 @@ nsec3_precompile_nsec3rr(namedb_type* db, struct domain* domain,
 	/* add into nsec3tree */
 	zone_add_domain_in_hash_tree(db->region, &zone->nsec3tree,
 		cmp_nsec3_tree, domain, &domain->nsec3->nsec3_node);
+	nsec3_index_add(zone, domain);
 	/* fixup the last in the zone */
 	if(rbtree_last(zone->nsec3tree)->key == domain) {
 		zone->nsec3_last = domain;
 	}
 }
 
+/* a domain that gets its hashes in nsec3_precompile_newparam */
+struct nsec3_hash_job {
+	domain_type* domain;
+	/* the hash and wildcard hash, and the ds parent hash */
+	int hash, dshash;
+	/* the hashes came from the nsec3 snapshot */
+	int cached;
+};
+
+/* a slice of the jobs for a hash thread */
+struct nsec3_hash_slice {
+	zone_type* zone;
+	struct nsec3_hash_job* jobs;
+	size_t num;
+#ifdef HAVE_PTHREAD
+	pthread_t thr;
+	int started;
+#endif
+};
+
+/* at most this many threads, and at least this many jobs for each */
+#define NSEC3_HASH_THREADS_MAX 8
+#define NSEC3_HASH_THREAD_MIN 1024
+
+/** calculate the hashes of a slice of the jobs, it only writes the
+ * hashes of the domains of the slice, so slices can run in parallel */
+static void*
+nsec3_hash_slice_run(void* arg)
+{
+	struct nsec3_hash_slice* sl = (struct nsec3_hash_slice*)arg;
+	const unsigned char* salt = NULL;
+	int saltlen = 0, iter = 0;
+	uint8_t wc[MAXDOMAINLEN+2];
+	size_t i;
+	detect_nsec3_params(sl->zone->nsec3_param, &salt, &saltlen, &iter);
+	for(i=0; i<sl->num; i++) {
+		domain_type* d = sl->jobs[i].domain;
+		const dname_type* dname = domain_dname(d);
+		if(sl->jobs[i].cached)
+			continue;
+		if(sl->jobs[i].hash && dname->name_size+2 <= MAXDOMAINLEN) {
+			iterated_hash(d->nsec3->nsec3_hash, salt, saltlen,
+				dname_name(dname), dname->name_size, iter);
+			d->nsec3->have_nsec3_hash = 1;
+			/* the wildcard label in front of the name */
+			wc[0] = 1;
+			wc[1] = '*';
+			memcpy(wc+2, dname_name(dname), dname->name_size);
+			iterated_hash(d->nsec3->nsec3_wc_hash, salt, saltlen,
+				wc, dname->name_size+2, iter);
+			d->nsec3->have_nsec3_wc_hash = 1;
+		}
+		if(sl->jobs[i].dshash) {
+			iterated_hash(d->nsec3->nsec3_ds_parent_hash, salt,
+				saltlen, dname_name(dname), dname->name_size,
+				iter);
+			d->nsec3->have_nsec3_ds_parent_hash = 1;
+		}
+	}
+	return NULL;
+}
+
+/** calculate the hashes of the jobs, with threads on the cpus if the
+ * zone is large enough */
+static void
+nsec3_hash_jobs(zone_type* zone, struct nsec3_hash_job* jobs, size_t num)
+{
+	struct nsec3_hash_slice sl[NSEC3_HASH_THREADS_MAX];
+	size_t i, n = 1;
+#ifdef HAVE_PTHREAD
+	sigset_t sigs, oldsigs;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(cpus > 1)
+		n = (size_t)cpus;
+	if(n > NSEC3_HASH_THREADS_MAX)
+		n = NSEC3_HASH_THREADS_MAX;
+	if(n > num/NSEC3_HASH_THREAD_MIN)
+		n = num/NSEC3_HASH_THREAD_MIN;
+	if(n < 1)
+		n = 1;
+#endif
+	for(i=0; i<n; i++) {
+		sl[i].zone = zone;
+		sl[i].jobs = jobs + num*i/n;
+		sl[i].num = num*(i+1)/n - num*i/n;
+	}
+#ifdef HAVE_PTHREAD
+	/* the signals stay with the main thread */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_SETMASK, &sigs, &oldsigs);
+	for(i=1; i<n; i++)
+		sl[i].started = (pthread_create(&sl[i].thr, NULL,
+			nsec3_hash_slice_run, &sl[i]) == 0);
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+#endif
+	(void)nsec3_hash_slice_run(&sl[0]);
+#ifdef HAVE_PTHREAD
+	for(i=1; i<n; i++) {
+		if(sl[i].started)
+			pthread_join(sl[i].thr, NULL);
+		/* if the thread could not be started, do it here */
+		else	(void)nsec3_hash_slice_run(&sl[i]);
+	}
+#endif
+}
+
+/* compare the nodes of the domains, for qsort, by the compare function of
+ * the tree they go in */
+static int
+cmp_nsec3_node(const void* x, const void* y)
+{
+	return cmp_nsec3_tree((*(rbnode_t* const*)x)->key,
+		(*(rbnode_t* const*)y)->key);
+}
+
+static int
+cmp_hash_node(const void* x, const void* y)
+{
+	return cmp_hash_tree((*(rbnode_t* const*)x)->key,
+		(*(rbnode_t* const*)y)->key);
+}
+
+static int
+cmp_wchash_node(const void* x, const void* y)
+{
+	return cmp_wchash_tree((*(rbnode_t* const*)x)->key,
+		(*(rbnode_t* const*)y)->key);
+}
+
+static int
+cmp_dshash_node(const void* x, const void* y)
+{
+	return cmp_dshash_tree((*(rbnode_t* const*)x)->key,
+		(*(rbnode_t* const*)y)->key);
+}
+
+/** put the domain in the node and the node in the list */
+static void
+nsec3_list_node(rbnode_t** list, size_t* num, domain_type* domain,
+	rbnode_t* node)
+{
+	memset(node, 0, sizeof(rbnode_t));
+	node->key = domain;
+	list[(*num)++] = node;
+}
+
+/** find the cover of the hash, like nsec3_find_cover, for hashes in
+ * ascending order: the walk continues in the nsec3tree at r, after
+ * the cover of the previous hash, prev */
+static int
+nsec3_walk_cover(zone_type* zone, rbnode_t** r, rbnode_t** prev,
+	uint8_t* hash, domain_type** result)
+{
+	domain_type d;
+	uint8_t n[48];
+	b32_ntop(hash, NSEC3_HASH_LEN, (char*)(n+5), sizeof(n)-5);
+	d.dname = (dname_type*)n;
+	n[0] = 34; /* name_size */
+	n[1] = 2; /* label_count */
+	n[2] = 0; /* label_offset[0] */
+	n[3] = 0; /* label_offset[1] */
+	n[4] = 32; /* label-size[0] */
+	while(*r != RBTREE_NULL && cmp_nsec3_tree((*r)->key, &d) <= 0) {
+		*prev = *r;
+		*r = rbtree_next(*r);
+	}
+	if(!*prev) {
+		*result = zone->nsec3_last;
+		return 0;
+	}
+	*result = (domain_type*)(*prev)->key;
+	return cmp_nsec3_tree((*prev)->key, &d) == 0;
+}
+
+/* the file of the snapshot starts with the magic and the entry size */
+#define NSEC3_SNAP_MAGIC "NSD3SNP1"
+/* a zone in the snapshot: the apex name length and name, padded to 8,
+ * then this, then count entries */
+struct nsec3_snap_zone {
+	uint32_t serial;
+	/* hash of the salt and iterations */
+	uint32_t param;
+	uint64_t count;
+};
+/* the hashes of a domain, in the order of the domains in the zone */
+struct nsec3_snap_entry {
+	/* hash of the name */
+	uint32_t namehash;
+	/* 1: hash and wildcard hash, 2: ds parent hash */
+	uint8_t flags;
+	uint8_t pad[3];
+	uint8_t hash[NSEC3_HASH_LEN];
+	uint8_t wc_hash[NSEC3_HASH_LEN];
+	uint8_t ds_hash[NSEC3_HASH_LEN];
+};
+
+struct nsec3_snapshot {
+	uint8_t* map;
+	size_t size;
+	region_type* region;
+	/* the zone records in the map, by apex name */
+	struct radtree* zones;
+};
+
+/* FNV-1a of the data; not hashlittle, that has a random initial value
+ * with ratelimits, and the snapshot is kept over a restart */
+static uint32_t
+nsec3_snap_hash(const uint8_t* data, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+	for(i=0; i<len; i++) {
+		h ^= data[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/* padded size of the apex name of a zone record */
+static size_t
+nsec3_snap_namelen(size_t len)
+{
+	return (1+len+7) & ~((size_t)7);
+}
+
+static uint32_t
+nsec3_snap_param(zone_type* zone)
+{
+	const unsigned char* salt = NULL;
+	int saltlen = 0, iter = 0;
+	uint8_t buf[2+255];
+	detect_nsec3_params(zone->nsec3_param, &salt, &saltlen, &iter);
+	buf[0] = (uint8_t)(iter>>8);
+	buf[1] = (uint8_t)iter;
+	memcpy(buf+2, salt, (size_t)saltlen);
+	return nsec3_snap_hash(buf, 2+(size_t)saltlen);
+}
+
+static uint32_t
+nsec3_snap_serial(zone_type* zone)
+{
+	uint32_t serial;
+	memcpy(&serial, rr_rdata_field(&zone->soa_rrset->rrs[0], 2, NULL),
+		sizeof(serial));
+	return ntohl(serial);
+}
+
+struct nsec3_snapshot*
+nsec3_snapshot_open(const char* fname)
+{
+#ifdef HAVE_MMAP
+	struct nsec3_snapshot* snap;
+	struct stat st;
+	size_t pos, len;
+	uint32_t esz;
+	int fd = open(fname, O_RDONLY);
+	if(fd == -1) {
+		if(errno != ENOENT)
+			log_msg(LOG_ERR, "nsec3-snapshot %s: %s", fname,
+				strerror(errno));
+		return NULL;
+	}
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < 16) {
+		close(fd);
+		return NULL;
+	}
+	snap = (struct nsec3_snapshot*)xalloc_zero(sizeof(*snap));
+	snap->size = (size_t)st.st_size;
+	snap->map = (uint8_t*)mmap(NULL, snap->size, PROT_READ, MAP_SHARED,
+		fd, 0);
+	close(fd);
+	if(snap->map == MAP_FAILED) {
+		log_msg(LOG_ERR, "nsec3-snapshot %s: mmap: %s", fname,
+			strerror(errno));
+		free(snap);
+		return NULL;
+	}
+	memcpy(&esz, snap->map+8, sizeof(esz));
+	if(memcmp(snap->map, NSEC3_SNAP_MAGIC, 8) != 0 ||
+		esz != sizeof(struct nsec3_snap_entry)) {
+		log_msg(LOG_WARNING, "nsec3-snapshot %s: not a snapshot of "
+			"this version, it is not used", fname);
+		nsec3_snapshot_close(snap);
+		return NULL;
+	}
+	snap->region = region_create(xalloc, free);
+	snap->zones = radix_tree_create(snap->region);
+	pos = 16;
+	while(pos < snap->size) {
+		struct nsec3_snap_zone z;
+		len = snap->map[pos];
+		if(pos + nsec3_snap_namelen(len) + sizeof(z) > snap->size)
+			break;
+		memcpy(&z, snap->map+pos+nsec3_snap_namelen(len), sizeof(z));
+		if(z.count > (snap->size - pos - nsec3_snap_namelen(len) -
+			sizeof(z)) / sizeof(struct nsec3_snap_entry))
+			break;
+		if(!radix_insert(snap->zones, snap->map+pos+1,
+			(radstrlen_t)len, snap->map+pos))
+			break;
+		pos += nsec3_snap_namelen(len) + sizeof(z) +
+			z.count*sizeof(struct nsec3_snap_entry);
+	}
+	if(pos != snap->size)
+		log_msg(LOG_WARNING, "nsec3-snapshot %s is truncated", fname);
+	VERBOSITY(2, (LOG_INFO, "nsec3-snapshot %s has %u zones", fname,
+		(unsigned)snap->zones->count));
+	return snap;
+#else
+	(void)fname;
+	return NULL;
+#endif
+}
+
+void
+nsec3_snapshot_close(struct nsec3_snapshot* snap)
+{
+	if(!snap)
+		return;
+#ifdef HAVE_MMAP
+	munmap(snap->map, snap->size);
+#endif
+	if(snap->region)
+		region_destroy(snap->region);
+	free(snap);
+}
+
+/* the hashes of the jobs that are the same in the snapshot */
+static void
+nsec3_snapshot_fill(namedb_type* db, zone_type* zone,
+	struct nsec3_hash_job* jobs, size_t num)
+{
+	const dname_type* apex = domain_dname(zone->apex);
+	struct nsec3_snap_zone z;
+	struct nsec3_snap_entry e;
+	struct radnode* n;
+	uint8_t* p;
+	size_t i, found = 0;
+	if(db->nsec3_snap_file) {
+		db->nsec3_snap = nsec3_snapshot_open(db->nsec3_snap_file);
+		db->nsec3_snap_file = NULL;
+	}
+	if(!db->nsec3_snap || !(n = radix_search(db->nsec3_snap->zones,
+		(uint8_t*)dname_name(apex), (radstrlen_t)apex->name_size)))
+		return;
+	p = (uint8_t*)n->elem;
+	memcpy(&z, p+nsec3_snap_namelen(p[0]), sizeof(z));
+	if(z.serial != nsec3_snap_serial(zone) ||
+		z.param != nsec3_snap_param(zone) || z.count != num)
+		return;
+	p += nsec3_snap_namelen(p[0]) + sizeof(z);
+	for(i=0; i<num; i++, p += sizeof(e)) {
+		domain_type* d = jobs[i].domain;
+		const dname_type* dname = domain_dname(d);
+		memcpy(&e, p, sizeof(e));
+		if(e.namehash != nsec3_snap_hash(dname_name(dname),
+			dname->name_size) ||
+			(jobs[i].hash && !(e.flags&1)) ||
+			(jobs[i].dshash && !(e.flags&2)))
+			continue;
+		if(jobs[i].hash) {
+			memcpy(d->nsec3->nsec3_hash, e.hash, NSEC3_HASH_LEN);
+			memcpy(d->nsec3->nsec3_wc_hash, e.wc_hash,
+				NSEC3_HASH_LEN);
+			d->nsec3->have_nsec3_hash = 1;
+			d->nsec3->have_nsec3_wc_hash = 1;
+		}
+		if(jobs[i].dshash) {
+			memcpy(d->nsec3->nsec3_ds_parent_hash, e.ds_hash,
+				NSEC3_HASH_LEN);
+			d->nsec3->have_nsec3_ds_parent_hash = 1;
+		}
+		jobs[i].cached = 1;
+		found++;
+	}
+	VERBOSITY(2, (LOG_INFO, "nsec3 %s: %u of %u hashes from the snapshot",
+		zone->opts->name, (unsigned)found, (unsigned)num));
+}
+
+/* write the zone record of a precompiled zone */
+static int
+nsec3_snapshot_write_zone(FILE* out, zone_type* zone)
+{
+	const dname_type* apex = domain_dname(zone->apex);
+	uint8_t name[1+MAXDOMAINLEN+8];
+	struct nsec3_snap_zone z;
+	struct nsec3_snap_entry e;
+	domain_type* walk;
+	memset(name, 0, sizeof(name));
+	name[0] = (uint8_t)apex->name_size;
+	memcpy(name+1, dname_name(apex), apex->name_size);
+	memset(&z, 0, sizeof(z));
+	z.serial = nsec3_snap_serial(zone);
+	z.param = nsec3_snap_param(zone);
+	/* the same domains, in the same order, as the jobs of the
+	 * precompile of the zone */
+	for(walk=zone->apex; walk && domain_is_subdomain(walk, zone->apex);
+		walk = domain_next(walk))
+		if(nsec3_condition_hash(walk, zone) ||
+			nsec3_condition_dshash(walk, zone))
+			z.count++;
+	if(!fwrite(name, nsec3_snap_namelen(apex->name_size), 1, out) ||
+		!fwrite(&z, sizeof(z), 1, out))
+		return 0;
+	for(walk=zone->apex; walk && domain_is_subdomain(walk, zone->apex);
+		walk = domain_next(walk)) {
+		if(!nsec3_condition_hash(walk, zone) &&
+			!nsec3_condition_dshash(walk, zone))
+			continue;
+		memset(&e, 0, sizeof(e));
+		e.namehash = nsec3_snap_hash(dname_name(domain_dname(walk)),
+			domain_dname(walk)->name_size);
+		if(walk->nsec3 && walk->nsec3->have_nsec3_hash &&
+			walk->nsec3->have_nsec3_wc_hash) {
+			memcpy(e.hash, walk->nsec3->nsec3_hash, NSEC3_HASH_LEN);
+			memcpy(e.wc_hash, walk->nsec3->nsec3_wc_hash,
+				NSEC3_HASH_LEN);
+			e.flags |= 1;
+		}
+		if(walk->nsec3 && walk->nsec3->have_nsec3_ds_parent_hash) {
+			memcpy(e.ds_hash, walk->nsec3->nsec3_ds_parent_hash,
+				NSEC3_HASH_LEN);
+			e.flags |= 2;
+		}
+		if(!fwrite(&e, sizeof(e), 1, out))
+			return 0;
+	}
+	return 1;
+}
+
+int
+nsec3_snapshot_write(namedb_type* db, const char* fname)
+{
+	char tmp[1024];
+	uint8_t head[16];
+	uint32_t esz = sizeof(struct nsec3_snap_entry);
+	struct radnode* n;
+	unsigned num = 0;
+	FILE* out;
+	snprintf(tmp, sizeof(tmp), "%s.%u", fname, (unsigned)getpid());
+	if(!(out = fopen(tmp, "w"))) {
+		log_msg(LOG_ERR, "nsec3-snapshot %s: %s", tmp, strerror(errno));
+		return 0;
+	}
+	memset(head, 0, sizeof(head));
+	memcpy(head, NSEC3_SNAP_MAGIC, 8);
+	memcpy(head+8, &esz, sizeof(esz));
+	if(!fwrite(head, sizeof(head), 1, out))
+		goto fail;
+	for(n=radix_first(db->zonetree); n; n=radix_next(n)) {
+		zone_type* zone = (zone_type*)n->elem;
+		/* a lazy zone is not precompiled */
+		if(!zone->nsec3_param || zone->is_lazy || !zone->soa_rrset)
+			continue;
+		if(!nsec3_snapshot_write_zone(out, zone))
+			goto fail;
+		num++;
+	}
+	if(fflush(out) != 0 || fsync(fileno(out)) != 0)
+		goto fail;
+	if(fclose(out) != 0) {
+		out = NULL;
+		goto fail;
+	}
+	if(rename(tmp, fname) != 0) {
+		log_msg(LOG_ERR, "nsec3-snapshot rename %s: %s", fname,
+			strerror(errno));
+		unlink(tmp);
+		return 0;
+	}
+	VERBOSITY(1, (LOG_INFO, "nsec3-snapshot %s written, %u zones", fname,
+		num));
+	return 1;
+fail:
+	log_msg(LOG_ERR, "nsec3-snapshot %s: %s", tmp, strerror(errno));
+	if(out)
+		fclose(out);
+	unlink(tmp);
+	return 0;
+}
+
 void
 nsec3_precompile_newparam(namedb_type* db, zone_type* zone)
 {
@@ -575,32 +1395,106 @@ nsec3_precompile_newparam(namedb_type* db, zone_type* zone)
 	domain_type* walk;
 	time_t s = time(NULL);
 	unsigned long n = 0, c = 0;
+	struct nsec3_hash_job* jobs;
+	rbnode_t** list[4];
+	size_t num = 0, cnt[4], i, j;
+	rbnode_t* r, *prev;
+	int exact;
 
-	/* add nsec3s of chain to nsec3tree */
 	for(walk=zone->apex; walk && domain_is_subdomain(walk, zone->apex);
-		walk = domain_next(walk)) {
+		walk = domain_next(walk))
 		n++;
-		if(nsec3_in_chain_count(walk, zone) != 0) {
-			nsec3_precompile_nsec3rr(db, walk, zone);
-		}
+	/* the domains to hash, the hashes are calculated first, so that
+	 * it can be done in parallel.  The trees are then built from the
+	 * sorted nodes, and the covers are found by walking the nsec3tree
+	 * along the sorted hashes, instead of a lookup for every hash */
+	jobs = (struct nsec3_hash_job*)xalloc_array_zero(n+1,
+		sizeof(struct nsec3_hash_job));
+	for(i=0; i<4; i++) {
+		list[i] = (rbnode_t**)xalloc_array_zero(n+1, sizeof(rbnode_t*));
+		cnt[i] = 0;
 	}
-	/* hash and precompile zone */
+	nsec3_zone_trees_create(db->region, zone);
 	for(walk=zone->apex; walk && domain_is_subdomain(walk, zone->apex);
 		walk = domain_next(walk)) {
-		if(nsec3_condition_hash(walk, zone)) {
-			nsec3_precompile_domain(db, walk, zone, tmpregion);
-			region_free_all(tmpregion);
+		/* nsec3s of chain to nsec3tree */
+		if(nsec3_in_chain_count(walk, zone) != 0) {
+			allocate_domain_nsec3(db->domains, walk);
+			nsec3_list_node(list[0], &cnt[0], walk,
+				&walk->nsec3->nsec3_node);
+		}
+		jobs[num].hash = nsec3_condition_hash(walk, zone);
+		jobs[num].dshash = nsec3_condition_dshash(walk, zone);
+		if(jobs[num].hash || jobs[num].dshash) {
+			allocate_domain_nsec3(db->domains, walk);
+			jobs[num++].domain = walk;
+		}
+	}
+	qsort(list[0], cnt[0], sizeof(rbnode_t*), cmp_nsec3_node);
+	rbtree_bulk_build(zone->nsec3tree, list[0], cnt[0]);
+	if(zone->nsec3tree->count != 0)
+		zone->nsec3_last = (domain_type*)rbtree_last(
+			zone->nsec3tree)->key;
+	nsec3_snapshot_fill(db, zone, jobs, num);
+	nsec3_hash_jobs(zone, jobs, num);
+	for(i=0; i<num; i++) {
+		walk = jobs[i].domain;
+		if(jobs[i].hash) {
+			/* hashes the slices could not do, too long names */
+			nsec3_lookup_hash_and_wc(zone, domain_dname(walk),
+				walk, tmpregion);
+			nsec3_list_node(list[1], &cnt[1], walk,
+				&walk->nsec3->hash_node);
+			nsec3_list_node(list[2], &cnt[2], walk,
+				&walk->nsec3->wchash_node);
 		}
-		if(nsec3_condition_dshash(walk, zone))
-			nsec3_precompile_domain_ds(db, walk, zone);
-		if(++c % ZONEC_PCT_COUNT == 0 && time(NULL) > s + ZONEC_PCT_TIME) {
-			s = time(NULL);
-			VERBOSITY(1, (LOG_INFO, "nsec3 %s %d %%",
-				zone->opts->name,
-				(int)(c*((unsigned long)100)/n)));
+		if(jobs[i].dshash) {
+			nsec3_lookup_hash_ds(zone, domain_dname(walk), walk);
+			nsec3_list_node(list[3], &cnt[3], walk,
+				&walk->nsec3->dshash_node);
 		}
 	}
+	free(jobs);
 	region_destroy(tmpregion);
+	/* the covers, before the build of the tree drops equal hashes */
+	for(i=1; i<4; i++) {
+		qsort(list[i], cnt[i], sizeof(rbnode_t*), i==1?cmp_hash_node:
+			(i==2?cmp_wchash_node:cmp_dshash_node));
+		r = rbtree_first(zone->nsec3tree);
+		prev = NULL;
+		for(j=0; j<cnt[i]; j++) {
+			walk = (domain_type*)list[i][j]->key;
+			if(i == 1) {
+				exact = nsec3_walk_cover(zone, &r, &prev,
+					walk->nsec3->nsec3_hash,
+					&walk->nsec3->nsec3_cover);
+				walk->nsec3->nsec3_is_exact = exact;
+			} else if(i == 2) {
+				(void)nsec3_walk_cover(zone, &r, &prev,
+					walk->nsec3->nsec3_wc_hash,
+					&walk->nsec3->nsec3_wcard_child_cover);
+			} else {
+				exact = nsec3_walk_cover(zone, &r, &prev,
+					walk->nsec3->nsec3_ds_parent_hash,
+					&walk->nsec3->nsec3_ds_parent_cover);
+				walk->nsec3->nsec3_ds_parent_is_exact = exact;
+			}
+			if(++c % ZONEC_PCT_COUNT == 0 &&
+				time(NULL) > s + ZONEC_PCT_TIME) {
+				s = time(NULL);
+				VERBOSITY(1, (LOG_INFO, "nsec3 %s %d %%",
+					zone->opts->name, (int)(c*
+					((unsigned long)100)/
+					(cnt[1]+cnt[2]+cnt[3]))));
+			}
+		}
+	}
+	rbtree_bulk_build(zone->hashtree, list[1], cnt[1]);
+	rbtree_bulk_build(zone->wchashtree, list[2], cnt[2]);
+	rbtree_bulk_build(zone->dshashtree, list[3], cnt[3]);
+	for(i=0; i<4; i++)
+		free(list[i]);
+	nsec3_index_build(db->region, zone);
 }
 
 void
@@ -826,27 +1720,21 @@ nsec3_add_rrset(struct query* query, struct answer* answer,
 	}
 }
 
-/* this routine does hashing at query-time. slow. */
+/* this routine does hashing at query-time. slow, the hash of a name
+ * that is queried again is in the cache. */
 static void
 nsec3_add_nonexist_proof(struct query* query, struct answer* answer,
         struct domain* encloser, const dname_type* qname)
 {
-	uint8_t hash[NSEC3_HASH_LEN];
-	const dname_type* to_prove;
 	domain_type* cover=0;
 	assert(encloser);
-	/* if query=a.b.c.d encloser=c.d. then proof needed for b.c.d. */
-	/* if query=a.b.c.d encloser=*.c.d. then proof needed for b.c.d. */
-	to_prove = dname_partial_copy(query->region, qname,
-		dname_label_match_count(qname, domain_dname(encloser))+1);
-	/* generate proof that one label below closest encloser does not exist */
-	nsec3_hash_and_store(query->zone, to_prove, hash);
-	if(nsec3_find_cover(query->zone, hash, sizeof(hash), &cover))
+	if(!nsec3_find_nonexist_cover(query, query->zone, encloser, qname,
+		&cover))
 	{
 		/* exact match, hash collision */
 		/* the hashed name of the query corresponds to an existing name. */
 		log_msg(LOG_ERR, "nsec3 hash collision for name=%s",
-			dname_to_string(to_prove, NULL));
+			dname_to_string(qname, NULL));
 		RCODE_SET(query->packet, RCODE_SERVFAIL);
 		return;
 	}
@@ -857,6 +1745,22 @@ nsec3_add_nonexist_proof(struct query* query, struct answer* answer,
 	}
 }
 
+int
+nsec3_find_nonexist_cover(struct query* query, struct zone* zone,
+	struct domain* encloser, const dname_type* qname,
+	struct domain** cover)
+{
+	uint8_t hash[NSEC3_HASH_LEN];
+	const dname_type* to_prove;
+	/* if query=a.b.c.d encloser=c.d. then proof needed for b.c.d. */
+	/* if query=a.b.c.d encloser=*.c.d. then proof needed for b.c.d. */
+	to_prove = dname_partial_copy(query->region, qname,
+		dname_label_match_count(qname, domain_dname(encloser))+1);
+	/* generate proof that one label below closest encloser does not exist */
+	nsec3_cache_hash(zone, to_prove, hash);
+	return !nsec3_find_cover(zone, hash, sizeof(hash), cover);
+}
+
 static void
 nsec3_add_closest_encloser_proof(
 	struct query* query, struct answer* answer,
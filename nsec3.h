@@ -19,6 +19,7 @@ struct namedb;
 struct query;
 struct answer;
 struct rr;
+struct nsd;
 
 /*
  * calculate prehash information for zone.
@@ -29,6 +30,19 @@ void prehash_zone(struct namedb* db, struct zone* zone);
  */
 void prehash_zone_complete(struct namedb* db, struct zone* zone);
 
+/*
+ * Create the cache of the hashes of names that are proven not to exist,
+ * for this server process or thread, with size entries.  A flood of
+ * queries for the same names is hashed once.  The hits, misses and
+ * evictions are counted in the statistics of nsd.
+ */
+void nsec3_cache_init(struct nsd* nsd, size_t size);
+/*
+ * Remove the hashes of the zone from the cache, when a zone transfer is
+ * applied in the server process.
+ */
+void nsec3_cache_flush_zone(struct zone* zone);
+
 /*
  * finds nsec3 that covers the given domain hash.
  * returns true if the find is exact.
@@ -36,6 +50,52 @@ void prehash_zone_complete(struct namedb* db, struct zone* zone);
 int nsec3_find_cover(struct zone* zone, uint8_t* hash, size_t hashlen,
 	struct domain** result);
 
+/*
+ * finds the nsec3 that covers the name one label below the encloser on
+ * the way to qname, that proves the name does not exist.
+ * returns false on a hash collision, the name exists.
+ */
+int nsec3_find_nonexist_cover(struct query* query, struct zone* zone,
+	struct domain* encloser, const struct dname* qname,
+	struct domain** cover);
+
+/* entry of the NSEC3 index, the domain is NULL if it was deleted */
+struct nsec3_index_entry {
+	/* the first 64 bits of the hash in the owner name */
+	uint64_t prefix;
+	struct domain* domain;
+};
+
+/*
+ * The nsec3tree of a zone, frozen in an array in Eytzinger order: entry
+ * k has its children at 2k and 2k+1, and the first levels of a search
+ * are in a few cache lines.  The names are only compared if the hash
+ * prefixes are equal.  The NSEC3s added later are in a small sorted
+ * delta list and deleted ones are marked, until the layout is built
+ * again from the nsec3tree, that stays complete.
+ */
+struct nsec3_index {
+	struct region* region;
+	/* entries of the layout, at 1..count */
+	size_t count;
+	size_t deleted;
+	struct nsec3_index_entry* layout;
+	/* the added domains, sorted */
+	struct domain** delta;
+	size_t delta_count;
+	size_t delta_max;
+};
+
+/* build the index of the nsec3tree of the zone, allocated in region.
+ * No index is made if the names in the tree are not in hash order. */
+void nsec3_index_build(struct region* region, struct zone* zone);
+/* remove the index of the zone */
+void nsec3_index_clear(struct zone* zone);
+/* the domain was added to the nsec3tree */
+void nsec3_index_add(struct zone* zone, struct domain* domain);
+/* the domain was removed from the nsec3tree */
+void nsec3_index_del(struct zone* zone, struct domain* domain);
+
 /*
  * _answer_ Routines used to add the correct nsec3 record to a query answer.
  * cnames etc may have been followed, hence original name.
@@ -104,6 +164,19 @@ void nsec3_precompile_nsec3rr(struct namedb* db, struct domain* domain,
 	struct zone* zone);
 /* precompile entire zone, assumes all is null at start */
 void nsec3_precompile_newparam(struct namedb* db, struct zone* zone);
+
+/*
+ * The NSEC3 hashes of the zones, written by nsec3_snapshot_write at
+ * shutdown and mapped at the next start, see nsec3-snapshot.  A zone
+ * uses the hashes if its SOA serial and NSEC3 parameters are the same,
+ * every hash is checked against the name it is for.
+ */
+struct nsec3_snapshot;
+/* map the file, NULL if it does not exist or is not a snapshot */
+struct nsec3_snapshot* nsec3_snapshot_open(const char* fname);
+void nsec3_snapshot_close(struct nsec3_snapshot* snap);
+/* write the hashes of the zones that are precompiled, 0 on failure */
+int nsec3_snapshot_write(struct namedb* db, const char* fname);
 /* create b32.zone for a hash, allocated in the region */
 const struct dname* nsec3_b32_create(struct region* region, struct zone* zone,
 	unsigned char* hash);
@@ -40,9 +40,12 @@ nsd_options_create(region_type* region)
 	nsd_options_t* opt;
 	opt = (nsd_options_t*)region_alloc(region, sizeof(nsd_options_t));
 	opt->region = region;
+	(void)region_set_tag(region, REGION_TAG_OPTIONS);
 	opt->zone_options = rbtree_create(region,
 		(int (*)(const void *, const void *)) dname_compare);
 	opt->configfile = NULL;
+	opt->zonelist_batch = 0;
+	opt->zones_skip = 0;
 	opt->zonestatnames = rbtree_create(opt->region, rbtree_strcmp);
 	opt->patterns = rbtree_create(region, rbtree_strcmp);
 	opt->keys = rbtree_create(region, rbtree_strcmp);
@@ -51,14 +54,81 @@ nsd_options_create(region_type* region)
 	opt->debug_mode = 0;
 	opt->verbosity = 0;
 	opt->hide_version = 0;
+	opt->minimal_responses = 0;
+	opt->minimal_any = 0;
 	opt->do_ip4 = 1;
 	opt->do_ip6 = 1;
 	opt->database = DBFILE;
 	opt->identity = 0;
 	opt->nsid = 0;
+	opt->answer_cookie = 0;
+	opt->cookie_secret = NULL;
+	opt->overload_action = 0;
+	opt->overload_allow = NULL;
+	opt->udp_filter = 0;
+	opt->udp_filter_deny = NULL;
 	opt->logfile = 0;
 	opt->log_time_ascii = 1;
 	opt->round_robin = 0; /* also packet.h::round_robin */
+	opt->reuseport = 0;
+	opt->tcp_reuseport = 0;
+	opt->tcp_defer_accept = 0;
+	opt->tcp_fastopen = 0;
+	opt->tls_service_key = NULL;
+	opt->tls_service_pem = NULL;
+	opt->tls_port = TLS_PORT;
+	opt->udp_batch_size = 100;
+	opt->udp_busy_poll = 0;
+	opt->udp_gro = 0;
+	opt->udp_gso = 0;
+	opt->udp_wildcard = 0;
+	opt->udp_prefetch = 1;
+	opt->udp_drop_stats = 0;
+	opt->udp_rcvbuf_max = 0;
+	opt->stall_monitor = 0;
+	opt->latency_stats = 0;
+	opt->region_profile = 0;
+	opt->profile = NULL;
+	opt->zone_cpu_sample = 0;
+	opt->dnstap_enable = 0;
+	opt->dnstap_socket_path = NULL;
+	opt->dnstap_file = NULL;
+	opt->dnstap_log_auth_query_messages = 1;
+	opt->dnstap_log_auth_response_messages = 1;
+	opt->dnstap_sample = 1;
+	opt->dnstap_ring_size = 1024;
+	opt->heavy_hitters = 0;
+	opt->nsec3_cache_size = 1024;
+	opt->answer_cache_size = 0;
+	opt->axfr_cache_size = 0;
+	opt->cpu_affinity = NULL;
+	opt->service_cpu_affinity = NULL;
+	opt->xfrd_cpu_affinity = NULL;
+	opt->zonefiles_load_workers = 0;
+	opt->zonefiles_write_workers = 0;
+	opt->progressive_start = 0;
+	opt->reload_in_place = 0;
+	opt->reload_prefault = 0;
+	opt->server_threads = 0;
+	opt->xdp_interface = NULL;
+	opt->zone_regions = 0;
+	opt->name_hash_index = 0;
+	opt->rdata_sharing = 0;
+	opt->hugepages = 0;
+	opt->numa_replicate = 0;
+	opt->metrics_enable = 0;
+	opt->metrics_interface = NULL;
+	opt->metrics_port = NSD_METRICS_PORT;
+	opt->metrics_path = "/metrics";
+	opt->log_async = 0;
+	opt->xfr_out_workers = 0;
+	opt->xfr_out_nice = 10;
+	opt->xfr_out_rate = 0;
+	opt->lazy_zone_load = 0;
+	opt->database_publish = NULL;
+	opt->database_readonly = 0;
+	opt->nsec3_snapshot = NULL;
+	opt->xfrdfile_text = 0;
 	opt->server_count = 1;
 	opt->tcp_count = 100;
 	opt->tcp_query_count = 0;
@@ -82,12 +152,19 @@ nsd_options_create(region_type* region)
 	opt->rrl_ipv4_prefix_length = RRL_IPV4_PREFIX_LENGTH;
 	opt->rrl_ipv6_prefix_length = RRL_IPV6_PREFIX_LENGTH;
 	opt->rrl_whitelist_ratelimit = RRL_WLIST_LIMIT/2;
+	opt->rrl_file = "";
+	opt->rrl_adaptive = 0;
 #endif
 	opt->zonefiles_check = 1;
+	opt->zonefiles_watch = 0;
 	if(opt->database == NULL || opt->database[0] == 0)
 		opt->zonefiles_write = ZONEFILES_WRITE_INTERVAL;
 	else	opt->zonefiles_write = 0;
 	opt->xfrd_reload_timeout = 1;
+	opt->xfrd_stream_apply = 0;
+	opt->xfrd_tcp_max = 32;
+	opt->xfrd_tcp_master_max = 0;
+	opt->xfrd_udp_max = 64;
 	opt->control_enable = 0;
 	opt->control_interface = NULL;
 	opt->control_port = NSD_CONTROL_PORT;
@@ -98,6 +175,17 @@ nsd_options_create(region_type* region)
 	return opt;
 }
 
+void
+nsd_options_profile(nsd_options_t* opt)
+{
+	opt->profile = (struct region_tag_stat*)region_alloc_array_zero(
+		opt->region, REGION_TAG_COUNT, sizeof(struct region_tag_stat));
+	if(!opt->profile || !region_set_profile(opt->region, opt->profile)) {
+		log_msg(LOG_ERR, "could not count the memory of the options");
+		opt->profile = NULL;
+	}
+}
+
 int
 nsd_options_insert_zone(nsd_options_t* opt, zone_options_t* zone)
 {
@@ -122,13 +210,36 @@ nsd_options_insert_pattern(nsd_options_t* opt, pattern_options_t* pat)
 	return 1;
 }
 
+/* find the keys of the acl list.  The zones that include a pattern have
+ * copies of its acls, so the last key that is found is tried first */
+static void
+acl_list_find_keys(nsd_options_t* opt, pattern_options_t* pat,
+	acl_options_t* list, key_options_t** last)
+{
+	acl_options_t* acl;
+	for(acl=list; acl; acl=acl->next)
+	{
+		if(acl->nokey || acl->blocked)
+			continue;
+		if(*last && strcmp((*last)->name, acl->key_name) == 0) {
+			acl->key_options = *last;
+			continue;
+		}
+		acl->key_options = key_options_find(opt, acl->key_name);
+		if(!acl->key_options)
+			c_error_msg("key %s in pattern %s could not be found",
+				acl->key_name, pat->pname);
+		else	*last = acl->key_options;
+	}
+}
+
 int
 parse_options_file(nsd_options_t* opt, const char* file,
 	void (*err)(void*,const char*), void* err_arg)
 {
 	FILE *in = 0;
 	pattern_options_t* pat;
-	acl_options_t* acl;
+	key_options_t* key = NULL;
 
 	if(!cfg_parser) {
 		cfg_parser = (config_parser_state_t*)region_alloc(
@@ -174,7 +285,8 @@ parse_options_file(nsd_options_t* opt, const char* file,
 	if(cfg_parser->current_pattern) {
 		if(!cfg_parser->current_pattern->pname)
 			c_error("last pattern has no name");
-		else {
+		else if(!opt->zones_skip ||
+			!cfg_parser->current_pattern->implicit) {
 			if(!nsd_options_insert_pattern(cfg_parser->opt,
 				cfg_parser->current_pattern))
 				c_error("duplicate pattern");
@@ -183,7 +295,7 @@ parse_options_file(nsd_options_t* opt, const char* file,
 	if(cfg_parser->current_zone) {
 		if(!cfg_parser->current_zone->name)
 			c_error("last zone has no name");
-		else {
+		else if(!opt->zones_skip) {
 			if(!nsd_options_insert_zone(opt,
 				cfg_parser->current_zone))
 				c_error("duplicate zone");
@@ -204,42 +316,13 @@ parse_options_file(nsd_options_t* opt, const char* file,
 	RBTREE_FOR(pat, pattern_options_t*, opt->patterns)
 	{
 		/* lookup keys for acls */
-		for(acl=pat->allow_notify; acl; acl=acl->next)
-		{
-			if(acl->nokey || acl->blocked)
-				continue;
-			acl->key_options = key_options_find(opt, acl->key_name);
-			if(!acl->key_options)
-				c_error_msg("key %s in pattern %s could not be found",
-					acl->key_name, pat->pname);
-		}
-		for(acl=pat->notify; acl; acl=acl->next)
-		{
-			if(acl->nokey || acl->blocked)
-				continue;
-			acl->key_options = key_options_find(opt, acl->key_name);
-			if(!acl->key_options)
-				c_error_msg("key %s in pattern %s could not be found",
-					acl->key_name, pat->pname);
-		}
-		for(acl=pat->request_xfr; acl; acl=acl->next)
-		{
-			if(acl->nokey || acl->blocked)
-				continue;
-			acl->key_options = key_options_find(opt, acl->key_name);
-			if(!acl->key_options)
-				c_error_msg("key %s in pattern %s could not be found",
-					acl->key_name, pat->pname);
-		}
-		for(acl=pat->provide_xfr; acl; acl=acl->next)
-		{
-			if(acl->nokey || acl->blocked)
-				continue;
-			acl->key_options = key_options_find(opt, acl->key_name);
-			if(!acl->key_options)
-				c_error_msg("key %s in pattern %s could not be found",
-					acl->key_name, pat->pname);
-		}
+		acl_list_find_keys(opt, pat, pat->allow_notify, &key);
+		acl_list_find_keys(opt, pat, pat->notify, &key);
+		acl_list_find_keys(opt, pat, pat->request_xfr, &key);
+		acl_list_find_keys(opt, pat, pat->provide_xfr, &key);
+		/* the lists that are checked for every notify and xfr */
+		acl_list_index(opt->region, pat->allow_notify);
+		acl_list_index(opt->region, pat->provide_xfr);
 	}
 
 	if(cfg_parser->errors > 0)
@@ -312,33 +395,58 @@ zone_list_free_insert(nsd_options_t* opt, int linesize, off_t off)
 	opt->zonefree_number++;
 }
 
-zone_options_t*
-zone_list_zone_insert(nsd_options_t* opt, const char* nm, const char* patnm,
-	int linesize, off_t off)
+/* insert the zone with the pattern, that has been looked up */
+static zone_options_t*
+zone_list_zone_insert_pat(nsd_options_t* opt, const char* nm,
+	const char* patnm, pattern_options_t* pat, int linesize, off_t off)
 {
-	pattern_options_t* pat = pattern_options_find(opt, patnm);
 	zone_options_t* zone;
+	const dname_type* dname;
+	size_t dsize, nsize = strlen(nm)+1;
 	if(!pat) {
 		log_msg(LOG_ERR, "pattern does not exist for zone %s "
 			"pattern %s", nm, patnm);
 		return NULL;
 	}
-	zone = zone_options_create(opt->region);
+	dname = dname_parse(opt->region, nm);
+	if(!dname) {
+		log_msg(LOG_ERR, "bad domain name '%s' pattern %s", nm, patnm);
+		return NULL;
+	}
+	/* there can be a million zones in the zonelist, the struct, the
+	 * key and the name are one allocation, without the alignment and
+	 * overhead of three */
+	dsize = dname_total_size(dname);
+	zone = (zone_options_t*)region_alloc(opt->region,
+		sizeof(*zone) + dsize + nsize);
+	zone->node = *RBTREE_NULL;
+	zone->node.key = (uint8_t*)zone + sizeof(*zone);
+	memcpy((uint8_t*)zone + sizeof(*zone), dname, dsize);
+	region_recycle(opt->region, (void*)dname, dsize);
+	zone->name = (char*)zone + sizeof(*zone) + dsize;
+	memcpy((char*)zone->name, nm, nsize);
 	zone->part_of_config = 0;
-	zone->name = region_strdup(opt->region, nm);
+	zone->names_inline = 1;
 	zone->linesize = linesize;
 	zone->off = off;
 	zone->pattern = pat;
-	if(!nsd_options_insert_zone(opt, zone)) {
-		log_msg(LOG_ERR, "bad domain name or duplicate zone '%s' "
-			"pattern %s", nm, patnm);
-		region_recycle(opt->region, (void*)zone->name, strlen(nm)+1);
-		region_recycle(opt->region, zone, sizeof(*zone));
+	if(!rbtree_insert(opt->zone_options, (rbnode_t*)zone)) {
+		log_msg(LOG_ERR, "duplicate zone '%s' pattern %s", nm, patnm);
+		region_recycle(opt->region, zone, sizeof(*zone) + dsize +
+			nsize);
 		return NULL;
 	}
 	return zone;
 }
 
+zone_options_t*
+zone_list_zone_insert(nsd_options_t* opt, const char* nm, const char* patnm,
+	int linesize, off_t off)
+{
+	return zone_list_zone_insert_pat(opt, nm, patnm,
+		pattern_options_find(opt, patnm), linesize, off);
+}
+
 int
 parse_zone_list_file(nsd_options_t* opt)
 {
@@ -350,6 +458,11 @@ parse_zone_list_file(nsd_options_t* opt)
 	add rutabaga.uk config
 	*/
 	char buf[1024];
+	/* offset of the line in buf, counted, not asked with ftello for
+	 * every line.  And the pattern of the previous zone, the zones
+	 * added after another mostly have the same pattern */
+	off_t off;
+	pattern_options_t* pat = NULL;
 	
 	/* create empty data structures */
 	opt->zonefree = rbtree_create(opt->region, comp_zonebucket);
@@ -376,9 +489,12 @@ parse_zone_list_file(nsd_options_t* opt)
 		opt->zonelist = NULL;
 		return 0;
 	}
+	off = (off_t)strlen(ZONELIST_HEADER);
 
 	/* read entries in file */
 	while(fgets(buf, sizeof(buf), opt->zonelist)) {
+		off_t lineoff = off;
+		off += strlen(buf);
 		/* skip comments and empty lines */
 		if(buf[0] == 0 || buf[0] == '\n' || buf[0] == '#')
 			continue;
@@ -401,15 +517,17 @@ parse_zone_list_file(nsd_options_t* opt)
 			if(linesize && buf[linesize-1] == '\n')
 				buf[linesize-1] = 0;
 
+			if(!pat || strcmp(pat->pname, patnm) != 0)
+				pat = pattern_options_find(opt, patnm);
+
 			/* store offset and line size for zone entry */
 			/* and create zone entry in zonetree */
-			(void)zone_list_zone_insert(opt, nm, patnm, linesize,
-				ftello(opt->zonelist)-linesize);
+			(void)zone_list_zone_insert_pat(opt, nm, patnm, pat,
+				linesize, lineoff);
 		} else if(strncmp(buf, "del ", 4) == 0) {
 			/* store offset and line size for deleted entry */
 			int linesize = strlen(buf);
-			zone_list_free_insert(opt, linesize,
-				ftello(opt->zonelist)-linesize);
+			zone_list_free_insert(opt, linesize, lineoff);
 		} else {
 			log_msg(LOG_WARNING, "bad data in %s, '%s'", opt->zonelistfile,
 				buf);
@@ -424,6 +542,12 @@ void
 zone_options_delete(nsd_options_t* opt, zone_options_t* zone)
 {
 	rbtree_delete(opt->zone_options, zone->node.key);
+	if(zone->names_inline) {
+		region_recycle(opt->region, zone, sizeof(*zone) +
+			dname_total_size((dname_type*)zone->node.key) +
+			strlen(zone->name)+1);
+		return;
+	}
 	region_recycle(opt->region, (void*)zone->node.key, dname_total_size(
 		(dname_type*)zone->node.key));
 	region_recycle(opt->region, zone, sizeof(*zone));
@@ -483,7 +607,7 @@ zone_list_add(nsd_options_t* opt, const char* zname, const char* pname)
 		opt->zonelist_off = ftello(opt->zonelist);
 		if(opt->zonelist_off == -1)
 			log_msg(LOG_ERR, "ftello(%s): %s", opt->zonelistfile, strerror(errno));
-		if(fflush(opt->zonelist) != 0) {
+		if(!opt->zonelist_batch && fflush(opt->zonelist) != 0) {
 			log_msg(LOG_ERR, "fflush %s: %s", opt->zonelistfile, strerror(errno));
 		}
 		return zone;
@@ -493,7 +617,10 @@ zone_list_add(nsd_options_t* opt, const char* zname, const char* pname)
 	if(!b || b->list == NULL) {
 		/* no empty place, append to file */
 		zone->off = opt->zonelist_off;
-		if(fseeko(opt->zonelist, zone->off, SEEK_SET) == -1) {
+		/* in a batch the file is often at the end already, and the
+		 * seek would write out the buffer for every zone */
+		if((!opt->zonelist_batch || ftello(opt->zonelist) != zone->off)
+			&& fseeko(opt->zonelist, zone->off, SEEK_SET) == -1) {
 			log_msg(LOG_ERR, "fseeko(%s): %s", opt->zonelistfile, strerror(errno));
 			log_msg(LOG_ERR, "zone %s could not be added", zname);
 			zone_options_delete(opt, zone);
@@ -511,7 +638,7 @@ zone_list_add(nsd_options_t* opt, const char* zname, const char* pname)
 			return NULL;
 		}
 		opt->zonelist_off += linesize;
-		if(fflush(opt->zonelist) != 0) {
+		if(!opt->zonelist_batch && fflush(opt->zonelist) != 0) {
 			log_msg(LOG_ERR, "fflush %s: %s", opt->zonelistfile, strerror(errno));
 		}
 		return zone;
@@ -536,7 +663,7 @@ zone_list_add(nsd_options_t* opt, const char* zname, const char* pname)
 		zone_options_delete(opt, zone);
 		return NULL;
 	}
-	if(fflush(opt->zonelist) != 0) {
+	if(!opt->zonelist_batch && fflush(opt->zonelist) != 0) {
 		log_msg(LOG_ERR, "fflush %s: %s", opt->zonelistfile, strerror(errno));
 	}
 
@@ -566,6 +693,8 @@ zone_list_del(nsd_options_t* opt, zone_options_t* zone)
 	/* remove zone_options_t */
 	zone_options_delete(opt, zone);
 
+	if(opt->zonelist_batch)
+		return;
 	/* see if we need to compact: it is going to halve the zonelist */
 	if(opt->zonefree_number > opt->zone_options->count) {
 		zone_list_compact(opt);
@@ -575,6 +704,28 @@ zone_list_del(nsd_options_t* opt, zone_options_t* zone)
 		}
 	}
 }
+
+void
+zone_list_batch(nsd_options_t* opt)
+{
+	opt->zonelist_batch = 1;
+}
+
+void
+zone_list_flush(nsd_options_t* opt)
+{
+	opt->zonelist_batch = 0;
+	if(!opt->zonelist)
+		return;
+	if(opt->zonefree_number > opt->zone_options->count) {
+		zone_list_compact(opt);
+	} else {
+		if(fflush(opt->zonelist) != 0) {
+			log_msg(LOG_ERR, "fflush %s: %s", opt->zonelistfile, strerror(errno));
+		}
+	}
+}
+
 /* postorder delete of zonelist free space tree */
 static void
 delbucket(region_type* region, struct zonelist_bucket* b)
@@ -733,6 +884,7 @@ zone_options_create(region_type* region)
 	zone->name = 0;
 	zone->pattern = 0;
 	zone->part_of_config = 0;
+	zone->names_inline = 0;
 	return zone;
 }
 
@@ -780,6 +932,7 @@ pattern_options_create(region_type* region)
 	p->pname = 0;
 	p->zonefile = 0;
 	p->zonestats = 0;
+	p->catalog_member_pattern = NULL;
 	p->allow_notify = 0;
 	p->request_xfr = 0;
 	p->notify = 0;
@@ -789,6 +942,14 @@ pattern_options_create(region_type* region)
 	p->notify_retry_is_default = 1;
 	p->allow_axfr_fallback = 1;
 	p->allow_axfr_fallback_is_default = 1;
+	p->store_ixfr = 0;
+	p->store_ixfr_is_default = 1;
+	p->ixfr_number = 5;
+	p->ixfr_number_is_default = 1;
+	p->ixfr_size = 1048576;
+	p->ixfr_size_is_default = 1;
+	p->load_priority = 0;
+	p->load_priority_is_default = 1;
 	p->implicit = 0;
 	p->xfrd_flags = 0;
 #ifdef RATELIMIT
@@ -797,6 +958,8 @@ pattern_options_create(region_type* region)
 	return p;
 }
 
+static void acl_index_delete(region_type* region, struct acl_index* index);
+
 static void
 acl_delete(region_type* region, acl_options_t* acl)
 {
@@ -806,6 +969,8 @@ acl_delete(region_type* region, acl_options_t* acl)
 	if(acl->key_name)
 		region_recycle(region, (void*)acl->key_name,
 			strlen(acl->key_name)+1);
+	if(acl->index)
+		acl_index_delete(region, acl->index);
 	/* key_options is a convenience pointer, not owned by the acl */
 	region_recycle(region, acl, sizeof(*acl));
 }
@@ -838,6 +1003,9 @@ pattern_options_remove(nsd_options_t* opt, const char* name)
 	if(p->zonestats)
 		region_recycle(opt->region, (void*)p->zonestats,
 			strlen(p->zonestats)+1);
+	if(p->catalog_member_pattern)
+		region_recycle(opt->region, (void*)p->catalog_member_pattern,
+			strlen(p->catalog_member_pattern)+1);
 	acl_list_delete(opt->region, p->allow_notify);
 	acl_list_delete(opt->region, p->request_xfr);
 	acl_list_delete(opt->region, p->notify);
@@ -862,6 +1030,7 @@ copy_acl(region_type* region, acl_options_t* a)
 		b->key_name = region_strdup(region, a->key_name);
 	b->next = NULL;
 	b->key_options = NULL;
+	b->index = NULL;
 	return b;
 }
 
@@ -887,7 +1056,7 @@ copy_acl_list(nsd_options_t* opt, acl_options_t* a)
 	return blist;
 }
 
-static void
+void
 copy_changed_acl(nsd_options_t* opt, acl_options_t** orig,
 	acl_options_t* anew)
 {
@@ -906,6 +1075,14 @@ copy_pat_fixed(region_type* region, pattern_options_t* orig,
 		p->allow_axfr_fallback_is_default;
 	orig->notify_retry = p->notify_retry;
 	orig->notify_retry_is_default = p->notify_retry_is_default;
+	orig->store_ixfr = p->store_ixfr;
+	orig->store_ixfr_is_default = p->store_ixfr_is_default;
+	orig->ixfr_number = p->ixfr_number;
+	orig->ixfr_number_is_default = p->ixfr_number_is_default;
+	orig->ixfr_size = p->ixfr_size;
+	orig->ixfr_size_is_default = p->ixfr_size_is_default;
+	orig->load_priority = p->load_priority;
+	orig->load_priority_is_default = p->load_priority_is_default;
 	orig->implicit = p->implicit;
 	if(p->zonefile)
 		orig->zonefile = region_strdup(region, p->zonefile);
@@ -913,6 +1090,10 @@ copy_pat_fixed(region_type* region, pattern_options_t* orig,
 	if(p->zonestats)
 		orig->zonestats = region_strdup(region, p->zonestats);
 	else orig->zonestats = NULL;
+	if(p->catalog_member_pattern)
+		orig->catalog_member_pattern = region_strdup(region,
+			p->catalog_member_pattern);
+	else orig->catalog_member_pattern = NULL;
 #ifdef RATELIMIT
 	orig->rrl_whitelist = p->rrl_whitelist;
 #endif
@@ -943,6 +1124,10 @@ pattern_options_add_modify(nsd_options_t* opt, pattern_options_t* p)
 		if(orig->zonestats)
 			region_recycle(opt->region, (char*)orig->zonestats,
 				strlen(orig->zonestats)+1);
+		if(orig->catalog_member_pattern)
+			region_recycle(opt->region,
+				(char*)orig->catalog_member_pattern,
+				strlen(orig->catalog_member_pattern)+1);
 		copy_pat_fixed(opt->region, orig, p);
 		copy_changed_acl(opt, &orig->allow_notify, p->allow_notify);
 		copy_changed_acl(opt, &orig->request_xfr, p->request_xfr);
@@ -951,6 +1136,8 @@ pattern_options_add_modify(nsd_options_t* opt, pattern_options_t* p)
 		copy_changed_acl(opt, &orig->outgoing_interface,
 			p->outgoing_interface);
 	}
+	acl_list_index(opt->region, orig->allow_notify);
+	acl_list_index(opt->region, orig->provide_xfr);
 }
 
 pattern_options_t*
@@ -973,12 +1160,31 @@ pattern_options_equal(pattern_options_t* p, pattern_options_t* q)
 	else if(p->zonestats && q->zonestats) {
 		if(strcmp(p->zonestats, q->zonestats) != 0) return 0;
 	}
+	if(!p->catalog_member_pattern && q->catalog_member_pattern) return 0;
+	else if(p->catalog_member_pattern && !q->catalog_member_pattern)
+		return 0;
+	else if(p->catalog_member_pattern && q->catalog_member_pattern) {
+		if(strcmp(p->catalog_member_pattern,
+			q->catalog_member_pattern) != 0) return 0;
+	}
 	if(!booleq(p->allow_axfr_fallback, q->allow_axfr_fallback)) return 0;
 	if(!booleq(p->allow_axfr_fallback_is_default,
 		q->allow_axfr_fallback_is_default)) return 0;
 	if(p->notify_retry != q->notify_retry) return 0;
 	if(!booleq(p->notify_retry_is_default,
 		q->notify_retry_is_default)) return 0;
+	if(!booleq(p->store_ixfr, q->store_ixfr)) return 0;
+	if(!booleq(p->store_ixfr_is_default,
+		q->store_ixfr_is_default)) return 0;
+	if(p->ixfr_number != q->ixfr_number) return 0;
+	if(!booleq(p->ixfr_number_is_default,
+		q->ixfr_number_is_default)) return 0;
+	if(p->ixfr_size != q->ixfr_size) return 0;
+	if(!booleq(p->ixfr_size_is_default,
+		q->ixfr_size_is_default)) return 0;
+	if(p->load_priority != q->load_priority) return 0;
+	if(!booleq(p->load_priority_is_default,
+		q->load_priority_is_default)) return 0;
 	if(!booleq(p->implicit, q->implicit)) return 0;
 	if(!acl_list_equal(p->allow_notify, q->allow_notify)) return 0;
 	if(!acl_list_equal(p->request_xfr, q->request_xfr)) return 0;
@@ -1005,6 +1211,19 @@ unmarshal_u8(struct buffer* b)
 	return buffer_read_u8(b);
 }
 
+static void
+marshal_u32(struct buffer* b, uint32_t v)
+{
+	buffer_reserve(b, 4);
+	buffer_write_u32(b, v);
+}
+
+static uint32_t
+unmarshal_u32(struct buffer* b)
+{
+	return buffer_read_u32(b);
+}
+
 #ifdef RATELIMIT
 static void
 marshal_u16(struct buffer* b, uint16_t v)
@@ -1062,6 +1281,7 @@ unmarshal_acl(region_type* r, struct buffer* b)
 	buffer_read(b, acl, sizeof(*acl));
 	acl->next = NULL;
 	acl->key_options = NULL;
+	acl->index = NULL;
 	acl->ip_address_spec = unmarshal_str(r, b);
 	acl->key_name = unmarshal_str(r, b);
 	return acl;
@@ -1099,6 +1319,7 @@ pattern_options_marshal(struct buffer* b, pattern_options_t* p)
 	marshal_str(b, p->pname);
 	marshal_str(b, p->zonefile);
 	marshal_str(b, p->zonestats);
+	marshal_str(b, p->catalog_member_pattern);
 #ifdef RATELIMIT
 	marshal_u16(b, p->rrl_whitelist);
 #endif
@@ -1106,6 +1327,14 @@ pattern_options_marshal(struct buffer* b, pattern_options_t* p)
 	marshal_u8(b, p->allow_axfr_fallback_is_default);
 	marshal_u8(b, p->notify_retry);
 	marshal_u8(b, p->notify_retry_is_default);
+	marshal_u8(b, p->store_ixfr);
+	marshal_u8(b, p->store_ixfr_is_default);
+	marshal_u32(b, p->ixfr_number);
+	marshal_u8(b, p->ixfr_number_is_default);
+	marshal_u32(b, p->ixfr_size);
+	marshal_u8(b, p->ixfr_size_is_default);
+	marshal_u32(b, p->load_priority);
+	marshal_u8(b, p->load_priority_is_default);
 	marshal_u8(b, p->implicit);
 	marshal_acl_list(b, p->allow_notify);
 	marshal_acl_list(b, p->request_xfr);
@@ -1121,6 +1350,7 @@ pattern_options_unmarshal(region_type* r, struct buffer* b)
 	p->pname = unmarshal_str(r, b);
 	p->zonefile = unmarshal_str(r, b);
 	p->zonestats = unmarshal_str(r, b);
+	p->catalog_member_pattern = unmarshal_str(r, b);
 #ifdef RATELIMIT
 	p->rrl_whitelist = unmarshal_u16(b);
 #endif
@@ -1128,6 +1358,14 @@ pattern_options_unmarshal(region_type* r, struct buffer* b)
 	p->allow_axfr_fallback_is_default = unmarshal_u8(b);
 	p->notify_retry = unmarshal_u8(b);
 	p->notify_retry_is_default = unmarshal_u8(b);
+	p->store_ixfr = unmarshal_u8(b);
+	p->store_ixfr_is_default = unmarshal_u8(b);
+	p->ixfr_number = unmarshal_u32(b);
+	p->ixfr_number_is_default = unmarshal_u8(b);
+	p->ixfr_size = unmarshal_u32(b);
+	p->ixfr_size_is_default = unmarshal_u8(b);
+	p->load_priority = unmarshal_u32(b);
+	p->load_priority_is_default = unmarshal_u8(b);
 	p->implicit = unmarshal_u8(b);
 	p->allow_notify = unmarshal_acl_list(r, b);
 	p->request_xfr = unmarshal_acl_list(r, b);
@@ -1167,6 +1405,7 @@ key_options_desetup(region_type* region, key_options_t* key)
 	if(!key->tsig_key)
 		return;
 	/* name stays the same */
+	tsig_key_clear_context(key->tsig_key);
 	if(key->tsig_key->data) {
 		/* wipe secret! */
 		memset(key->tsig_key->data, 0xdd, key->tsig_key->size);
@@ -1197,6 +1436,8 @@ key_options_setup(region_type* region, key_options_t* key)
 		}
 		key->tsig_key->size = 0;
 		key->tsig_key->data = NULL;
+		key->tsig_key->key_context = NULL;
+		key->tsig_key->key_algorithm = NULL;
 	}
 	size = b64_pton(key->secret, data, sizeof(data));
 	if(size == -1) {
@@ -1267,6 +1508,244 @@ key_options_add_modify(nsd_options_t* opt, key_options_t* key)
 	}
 }
 
+/* lists shorter than this are scanned, that is as fast as the trie */
+#define ACL_INDEX_MIN 8
+
+/* an acl element in the trie, with its number in the list */
+struct acl_entry {
+	struct acl_entry* next;
+	acl_options_t* acl;
+	int number;
+};
+
+/* trie node, for the first len bits of addr.  The entries are the
+ * elements whose address range is inside this prefix, but not inside
+ * a longer prefix of the trie: subnets end at their prefix length,
+ * masks at their first zero bit and ranges at the words that min and
+ * max have in common. */
+struct acl_node {
+	struct acl_node* child[2];
+	struct acl_entry* entries;
+	uint8_t addr[16];
+	uint8_t len;
+};
+
+struct acl_index {
+	struct acl_node* v4;
+	struct acl_node* v6;
+};
+
+/* the bit at position i of the address */
+static int
+acl_bit(const uint8_t* a, unsigned i)
+{
+	return (a[i/8] >> (7 - (i%8))) & 1;
+}
+
+/* the number of leading bits that are the same, at most max */
+static unsigned
+acl_common_bits(const uint8_t* a, const uint8_t* b, unsigned max)
+{
+	unsigned i = 0;
+	while(i < max && a[i/8] == b[i/8])
+		i += 8;
+	while(i < max && acl_bit(a, i) == acl_bit(b, i))
+		i++;
+	return i<max?i:max;
+}
+
+/* the prefix length under which the address range of the acl is */
+static unsigned
+acl_prefix_len(acl_options_t* acl, unsigned bits)
+{
+	const uint8_t* a = (const uint8_t*)&acl->addr;
+	const uint8_t* m = (const uint8_t*)&acl->range_mask;
+	unsigned i = 0;
+	switch(acl->rangetype) {
+	case acl_range_mask:
+	case acl_range_subnet:
+		while(i < bits && acl_bit(m, i))
+			i++;
+		return i;
+	case acl_range_minmax:
+		/* acl_addr_match_range compares host order words, so only
+		 * the words that min and max have in common are a prefix */
+		while(i < bits && memcmp(a+i/8, m+i/8, 4) == 0)
+			i += 32;
+		return i;
+	case acl_range_single:
+	default:
+		return bits;
+	}
+}
+
+static struct acl_node*
+acl_node_create(region_type* region, const uint8_t* addr, unsigned len)
+{
+	struct acl_node* n = (struct acl_node*)region_alloc_zero(region,
+		sizeof(*n));
+	memcpy(n->addr, addr, (len+7)/8);
+	if(len%8)
+		n->addr[len/8] &= (uint8_t)(0xff << (8 - len%8));
+	n->len = (uint8_t)len;
+	return n;
+}
+
+static void
+acl_node_insert(region_type* region, struct acl_node* n, acl_options_t* acl,
+	int number, unsigned bits)
+{
+	const uint8_t* addr = (const uint8_t*)&acl->addr;
+	unsigned plen = acl_prefix_len(acl, bits);
+	struct acl_entry* e = (struct acl_entry*)region_alloc(region,
+		sizeof(*e));
+	e->acl = acl;
+	e->number = number;
+	while(plen != n->len) {
+		int b = acl_bit(addr, n->len);
+		struct acl_node* c = n->child[b];
+		unsigned common;
+		if(!c) {
+			n->child[b] = acl_node_create(region, addr, plen);
+			n = n->child[b];
+			break;
+		}
+		common = acl_common_bits(addr, c->addr,
+			plen<c->len?plen:c->len);
+		if(common < c->len) {
+			/* split the edge to c */
+			struct acl_node* s = acl_node_create(region, addr,
+				common);
+			s->child[acl_bit(c->addr, common)] = c;
+			n->child[b] = s;
+			c = s;
+		}
+		n = c;
+	}
+	e->next = n->entries;
+	n->entries = e;
+}
+
+static void
+acl_node_delete(region_type* region, struct acl_node* n)
+{
+	struct acl_entry* e, *enext;
+	if(!n)
+		return;
+	acl_node_delete(region, n->child[0]);
+	acl_node_delete(region, n->child[1]);
+	for(e = n->entries; e; e = enext) {
+		enext = e->next;
+		region_recycle(region, e, sizeof(*e));
+	}
+	region_recycle(region, n, sizeof(*n));
+}
+
+static void
+acl_index_delete(region_type* region, struct acl_index* index)
+{
+	acl_node_delete(region, index->v4);
+	acl_node_delete(region, index->v6);
+	region_recycle(region, index, sizeof(*index));
+}
+
+void
+acl_list_index(region_type* region, acl_options_t* list)
+{
+	acl_options_t* acl;
+	uint8_t zero[16];
+	int number = 0;
+	if(!list || list->index)
+		return;
+	for(acl = list; acl; acl = acl->next)
+		number++;
+	if(number < ACL_INDEX_MIN)
+		return;
+	memset(zero, 0, sizeof(zero));
+	list->index = (struct acl_index*)region_alloc(region,
+		sizeof(struct acl_index));
+	list->index->v4 = acl_node_create(region, zero, 0);
+	list->index->v6 = acl_node_create(region, zero, 0);
+	for(acl = list, number = 0; acl; acl = acl->next, number++) {
+		if(acl->is_ipv6) {
+#ifdef INET6
+			acl_node_insert(region, list->index->v6, acl, number,
+				128);
+#endif
+		} else {
+			acl_node_insert(region, list->index->v4, acl, number,
+				32);
+		}
+	}
+}
+
+/* acl_check_incoming with the trie: the entries of the nodes on the
+ * path of the address are the only ones whose address can match */
+static int
+acl_check_index(struct acl_index* index, struct query* q,
+	acl_options_t** reason)
+{
+	struct acl_node* n;
+	const uint8_t* addr;
+	unsigned bits;
+	int found_match = -1, found_blocked = -1;
+	acl_options_t* match = NULL, *blocked = NULL;
+
+	if(((struct sockaddr*)&q->addr)->sa_family == AF_INET) {
+		n = index->v4;
+		addr = (const uint8_t*)&((struct sockaddr_in*)&q->addr)->
+			sin_addr;
+		bits = 32;
+#ifdef INET6
+	} else if(((struct sockaddr*)&q->addr)->sa_family == AF_INET6) {
+		n = index->v6;
+		addr = (const uint8_t*)&((struct sockaddr_in6*)&q->addr)->
+			sin6_addr;
+		bits = 128;
+#endif
+	} else {
+		if(reason)
+			*reason = NULL;
+		return -1;
+	}
+
+	while(n && acl_common_bits(addr, n->addr, n->len) == n->len) {
+		struct acl_entry* e;
+		for(e = n->entries; e; e = e->next) {
+			/* only an earlier element changes the outcome */
+			if(e->acl->blocked) {
+				if(found_blocked != -1 &&
+					e->number > found_blocked)
+					continue;
+			} else if(found_match != -1 &&
+				e->number > found_match)
+				continue;
+			if(!acl_addr_matches(e->acl, q) ||
+				!acl_key_matches(e->acl, q))
+				continue;
+			if(e->acl->blocked) {
+				found_blocked = e->number;
+				blocked = e->acl;
+			} else {
+				found_match = e->number;
+				match = e->acl;
+			}
+		}
+		if(n->len >= bits)
+			break;
+		n = n->child[acl_bit(addr, n->len)];
+	}
+
+	if(found_blocked != -1) {
+		if(reason)
+			*reason = blocked;
+		return -1;
+	}
+	if(reason)
+		*reason = match;
+	return found_match;
+}
+
 int
 acl_check_incoming(acl_options_t* acl, struct query* q,
 	acl_options_t** reason)
@@ -1279,6 +1758,8 @@ acl_check_incoming(acl_options_t* acl, struct query* q,
 	int number = 0;
 	acl_options_t* match = 0;
 
+	if(acl && acl->index)
+		return acl_check_index(acl->index, q, reason);
 	if(reason)
 		*reason = NULL;
 
@@ -1618,6 +2099,18 @@ config_cook_string(zone_options_t* zone, const char* input)
 	return f;
 }
 
+int
+options_remote_is_address(nsd_options_t* cfg)
+{
+	ip_address_option_t* p;
+	if(!cfg->control_interface)
+		return 1; /* the default is localhost */
+	for(p = cfg->control_interface; p; p = p->next)
+		if(p->address && p->address[0] != '/')
+			return 1;
+	return 0;
+}
+
 const char*
 config_make_zonefile(zone_options_t* zone, struct nsd* nsd)
 {
@@ -1751,6 +2244,7 @@ parse_acl_info(region_type* region, char* ip, const char* key)
 	acl->ixfr_disabled = 0;
 	acl->bad_xfr_count = 0;
 	acl->key_options = 0;
+	acl->index = NULL;
 	acl->is_ipv6 = 0;
 	acl->port = 0;
 	memset(&acl->addr, 0, sizeof(union acl_addr_storage));
@@ -1828,6 +2322,10 @@ config_apply_pattern(const char* name)
 		c_error_msg("could not find pattern %s", name);
 		return;
 	}
+	/* the zone is not stored, so its settings are not needed */
+	if(cfg_parser->opt->zones_skip && cfg_parser->current_zone &&
+		a == cfg_parser->current_zone->pattern)
+		return;
 
 	/* apply settings */
 	if(pat->zonefile)
@@ -1836,6 +2334,9 @@ config_apply_pattern(const char* name)
 	if(pat->zonestats)
 		a->zonestats = region_strdup(cfg_parser->opt->region,
 			pat->zonestats);
+	if(pat->catalog_member_pattern)
+		a->catalog_member_pattern = region_strdup(
+			cfg_parser->opt->region, pat->catalog_member_pattern);
 	if(!pat->allow_axfr_fallback_is_default) {
 		a->allow_axfr_fallback = pat->allow_axfr_fallback;
 		a->allow_axfr_fallback_is_default = 0;
@@ -1844,6 +2345,22 @@ config_apply_pattern(const char* name)
 		a->notify_retry = pat->notify_retry;
 		a->notify_retry_is_default = 0;
 	}
+	if(!pat->store_ixfr_is_default) {
+		a->store_ixfr = pat->store_ixfr;
+		a->store_ixfr_is_default = 0;
+	}
+	if(!pat->ixfr_number_is_default) {
+		a->ixfr_number = pat->ixfr_number;
+		a->ixfr_number_is_default = 0;
+	}
+	if(!pat->ixfr_size_is_default) {
+		a->ixfr_size = pat->ixfr_size;
+		a->ixfr_size_is_default = 0;
+	}
+	if(!pat->load_priority_is_default) {
+		a->load_priority = pat->load_priority;
+		a->load_priority_is_default = 0;
+	}
 #ifdef RATELIMIT
 	a->rrl_whitelist |= pat->rrl_whitelist;
 #endif
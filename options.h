@@ -24,9 +24,17 @@ typedef struct nsd_options nsd_options_t;
 typedef struct pattern_options pattern_options_t;
 typedef struct zone_options zone_options_t;
 typedef struct ipaddress_option ip_address_option_t;
+typedef struct cpu_option cpu_option_t;
+typedef struct cpu_map_option cpu_map_option_t;
 typedef struct acl_options acl_options_t;
 typedef struct key_options key_options_t;
 typedef struct config_parser_state config_parser_state_t;
+/* minimal-any: hinfo, the other values are yes (1) and no (0) */
+#define MINIMAL_ANY_HINFO 2
+/* overload-action: tc or drop */
+#define OVERLOAD_TC 1
+#define OVERLOAD_DROP 2
+
 /*
  * Options global for nsd.
  */
@@ -46,6 +54,12 @@ struct nsd_options {
 	FILE* zonelist;
 	/* last offset in file (or 0 if none) */
 	off_t zonelist_off;
+	/* if set, the zonelist is not flushed or compacted for every zone,
+	 * but once at zone_list_flush, for addzones and delzones */
+	int zonelist_batch;
+	/* if set, the zone: clauses are parsed for errors but not stored,
+	 * for the tools that only use the server settings */
+	int zones_skip;
 
 	/* tree of zonestat names and their id values, entries are struct
 	 * zonestatname with malloced key=stringname. The number of items
@@ -63,6 +77,10 @@ struct nsd_options {
 	int debug_mode;
 	int verbosity;
 	int hide_version;
+	/** leave out the additional data that is not needed */
+	int minimal_responses;
+	/** answer ANY with one RRset, or a HINFO (MINIMAL_ANY_HINFO) */
+	int minimal_any;
 	int do_ip4;
 	int do_ip6;
 	const char* database;
@@ -84,11 +102,151 @@ struct nsd_options {
 	const char* xfrdir;
 	const char* zonelistfile;
 	const char* nsid;
+	/** answer DNS cookies, and do not ratelimit valid ones */
+	int answer_cookie;
+	/** the secret of the server cookies in hex, NULL for random */
+	const char* cookie_secret;
+	/** in overload, the queries of the other sources get TC or are
+	 * dropped, 0 is off */
+	int overload_action;
+	/** the sources that are answered in overload */
+	acl_options_t* overload_allow;
+	/** the socket filter on the UDP sockets drops bad packets */
+	int udp_filter;
+	/** the sources that the socket filter drops */
+	acl_options_t* udp_filter_deny;
 	int xfrd_reload_timeout;
+	/** the reload applies a transfer while xfrd receives it */
+	int xfrd_stream_apply;
+	/** max number of tcp connections xfrd uses for zone transfers */
+	int xfrd_tcp_max;
+	/** max number of those connections to one master, 0 is no limit */
+	int xfrd_tcp_master_max;
+	/** max number of udp sockets xfrd uses for ixfr (soa) queries */
+	int xfrd_udp_max;
 	int zonefiles_check;
+	/** xfrd watches the zone files and queues the changed ones */
+	int zonefiles_watch;
 	int zonefiles_write;
 	int log_time_ascii;
 	int round_robin;
+	int reuseport;
+	/** every server its own SO_REUSEPORT TCP listening sockets */
+	int tcp_reuseport;
+	/** TCP_DEFER_ACCEPT on the TCP sockets */
+	int tcp_defer_accept;
+	/** TCP_FASTOPEN on the TCP sockets */
+	int tcp_fastopen;
+	/** DNS over TLS key and certificate files, NULL if not used */
+	const char* tls_service_key;
+	const char* tls_service_pem;
+	/** the interfaces with this port number serve DNS over TLS */
+	const char* tls_port;
+	/** number of UDP queries received per event */
+	int udp_batch_size;
+	/** SO_BUSY_POLL usecs for the UDP sockets, 0 is off */
+	int udp_busy_poll;
+	/** UDP_GRO on receive, UDP_SEGMENT on send for the UDP sockets */
+	int udp_gro;
+	int udp_gso;
+	/** one wildcard UDP socket per family and port for the ip-addresses */
+	int udp_wildcard;
+	/** prefetch the name lookups of a UDP batch before the answers */
+	int udp_prefetch;
+	/** count the queries that the kernel drops on the UDP sockets */
+	int udp_drop_stats;
+	/** grow the UDP receive buffers up to this size when queries are
+	 * dropped, 0 is off */
+	int udp_rcvbuf_max;
+	/** msec that a handler or the event loop of a server may take before
+	 * it is counted and logged as a stall, 0 is off */
+	int stall_monitor;
+	/** latency histograms per answer class in the statistics */
+	int latency_stats;
+	/** count the memory of the regions per subsystem, for the stats */
+	int region_profile;
+	/** with region_profile, the counters of the options region */
+	struct region_tag_stat* profile;
+	/** one in zone_cpu_sample queries is timed for its zonestats group,
+	 * 0 is off */
+	int zone_cpu_sample;
+	/** dnstap logging, to the socket or else the file */
+	int dnstap_enable;
+	const char* dnstap_socket_path;
+	const char* dnstap_file;
+	int dnstap_log_auth_query_messages;
+	int dnstap_log_auth_response_messages;
+	/** one in dnstap_sample queries is logged */
+	int dnstap_sample;
+	/** records in the dnstap ring of a server */
+	int dnstap_ring_size;
+	/** entries in the heavy hitter tables of a server, 0 is off */
+	int heavy_hitters;
+	/** entries in the cache of NSEC3 hashes of a server, 0 is off */
+	size_t nsec3_cache_size;
+	/** number of entries in the answer cache per server, 0 is off */
+	size_t answer_cache_size;
+	/** bytes of AXFR streams cached per server, 0 is off */
+	size_t axfr_cache_size;
+	/** cpus that nsd runs on, or NULL for no affinity */
+	cpu_option_t* cpu_affinity;
+	/** cpus for specific server processes, server-N-cpu-affinity */
+	cpu_map_option_t* service_cpu_affinity;
+	/** cpus for xfrd, or NULL to use the cpu-affinity set */
+	cpu_option_t* xfrd_cpu_affinity;
+	/** number of processes that read zonefiles at startup, 0 is off */
+	int zonefiles_load_workers;
+	/** number of processes that write zonefiles, 0 is off */
+	int zonefiles_write_workers;
+	/** start the servers before the zone files are read, the reloads
+	 * read them by load-priority */
+	int progressive_start;
+	/** apply small zone transfers in the running server processes */
+	int reload_in_place;
+	/** fault in the hot data before the new servers are forked */
+	int reload_prefault;
+	/** allocate the data of every zone in a region of its own */
+	int zone_regions;
+	/** keep a hash index of the domain names for exact matches */
+	int name_hash_index;
+	/** store identical rdata of the zones once */
+	int rdata_sharing;
+	/** allocate the database memory on huge pages */
+	int hugepages;
+	/** servers copy the database pages of other numa nodes */
+	int numa_replicate;
+	/** serve the statistics over HTTP in the OpenMetrics format */
+	int metrics_enable;
+	/** the addresses and port of the metrics HTTP listener */
+	ip_address_option_t* metrics_interface;
+	int metrics_port;
+	/** the HTTP path of the metrics */
+	const char* metrics_path;
+	/** the servers log through xfrd, and do not wait for the log */
+	int log_async;
+	/** processes that send the AXFRs, that the servers hand them */
+	int xfr_out_workers;
+	/** the nice value of the xfr-out workers */
+	int xfr_out_nice;
+	/** kbytes per second that an xfr-out worker sends, 0 no limit */
+	int xfr_out_rate;
+	/** read the zones from the nsd.db when they are first queried */
+	int lazy_zone_load;
+	/** after a load or reload, write a copy of the nsd.db to this file
+	 * for the nsd instances that use it read-only, NULL is off */
+	const char* database_publish;
+	/** the database is a copy that another nsd published, map it
+	 * read-only and open the new copy at reload */
+	int database_readonly;
+	/** file with the NSEC3 hashes, written at exit and used to
+	 * precompile the zones at the next start, NULL is off */
+	const char* nsec3_snapshot;
+	/** write the xfrdfile as text instead of binary */
+	int xfrdfile_text;
+	/** run the servers as threads of one server process */
+	int server_threads;
+	/** interface for the AF_XDP UDP fast path, or NULL */
+	const char* xdp_interface;
 
         /** remote control section. enable toggle. */
 	int control_enable;
@@ -117,6 +275,11 @@ struct nsd_options {
 	size_t rrl_ipv6_prefix_length;
 	/** max qps for whitelisted queries, 0 is nolimit */
 	size_t rrl_whitelist_ratelimit;
+	/** file that keeps the rates over a restart, "" is off */
+	const char* rrl_file;
+	/** the limits go up to this factor when the server has room,
+	 * 0 or 1 is off */
+	size_t rrl_adaptive;
 #endif
 
 	region_type* region;
@@ -127,6 +290,19 @@ struct ipaddress_option {
 	char* address;
 };
 
+/* a cpu number in a cpu-affinity list */
+struct cpu_option {
+	cpu_option_t* next;
+	int cpu;
+};
+
+/* the cpus for one server process, counted from 1 */
+struct cpu_map_option {
+	cpu_map_option_t* next;
+	int service;
+	cpu_option_t* cpus;
+};
+
 /*
  * Pattern of zone options, used to contain options for zone(s).
  */
@@ -140,6 +316,9 @@ struct pattern_options {
 	acl_options_t* provide_xfr;
 	acl_options_t* outgoing_interface;
 	const char* zonestats;
+	/* the zone is a catalog zone, its member zones are added with
+	 * this pattern, NULL if not a catalog */
+	const char* catalog_member_pattern;
 #ifdef RATELIMIT
 	uint16_t rrl_whitelist; /* bitmap with rrl types */
 #endif
@@ -147,6 +326,18 @@ struct pattern_options {
 	uint8_t allow_axfr_fallback_is_default;
 	uint8_t notify_retry;
 	uint8_t notify_retry_is_default;
+	/* keep a journal of the IXFRs applied, to serve IXFR from */
+	uint8_t store_ixfr;
+	uint8_t store_ixfr_is_default;
+	/* the journal holds at most this many versions and bytes */
+	uint32_t ixfr_number;
+	uint8_t ixfr_number_is_default;
+	uint32_t ixfr_size;
+	uint8_t ixfr_size_is_default;
+	/* with progressive-start the zones of a higher priority are
+	 * read first */
+	uint32_t load_priority;
+	uint8_t load_priority_is_default;
 	uint8_t implicit; /* pattern is implicit, part_of_config zone used */
 	uint8_t xfrd_flags;
 };
@@ -162,14 +353,17 @@ struct zone_options {
 
 	/* is apex of the zone */
 	const char* name;
-	/* if not part of config, the offset and linesize of zonelist entry */
-	off_t off;
-	int linesize;
 	/* pattern for the zone options, if zone is part_of_config, this is
 	 * a anonymous pattern created in-place */
 	pattern_options_t* pattern;
+	/* if not part of config, the offset and linesize of zonelist entry */
+	off_t off;
+	int linesize;
 	/* zone is fixed into the main config, not in zonelist, cannot delete */
 	uint8_t part_of_config;
+	/* the apex dname and the name are allocated after this struct, in
+	 * one region allocation, for the zones of the zonelist */
+	uint8_t names_inline;
 };
 
 union acl_addr_storage {
@@ -211,6 +405,9 @@ struct acl_options {
 	uint8_t blocked;
 	const char* key_name;
 	key_options_t* key_options;
+
+	/* compiled lookup for the list, only on the first element */
+	struct acl_index* index;
 };
 
 /*
@@ -271,6 +468,9 @@ extern config_parser_state_t* cfg_parser;
 
 /* region will be put in nsd_options struct. Returns empty options struct. */
 nsd_options_t* nsd_options_create(region_type* region);
+/* with region-profile, count the memory of the options region from now,
+ * the memory it has is counted as options */
+void nsd_options_profile(nsd_options_t* opt);
 /* the number of zones that are configured */
 static inline size_t nsd_options_num_zones(nsd_options_t* opt)
 { return opt->zone_options->count; }
@@ -310,6 +510,10 @@ zone_options_t* zone_list_zone_insert(nsd_options_t* opt, const char* nm,
 	const char* patnm, int linesize, off_t off);
 void zone_list_del(nsd_options_t* opt, zone_options_t* zone);
 void zone_list_compact(nsd_options_t* opt);
+/* start a batch of zone_list_add and zone_list_del calls */
+void zone_list_batch(nsd_options_t* opt);
+/* end the batch, compact the zonelist if needed and flush it */
+void zone_list_flush(nsd_options_t* opt);
 void zone_list_close(nsd_options_t* opt);
 
 /* create zonestat name tree , for initially created zones */
@@ -319,6 +523,9 @@ void options_zonestatnames_create(nsd_options_t* opt);
 unsigned getzonestatid(nsd_options_t* opt, zone_options_t* zopt);
 /* create string, same options as zonefile but no chroot changes */
 const char* config_cook_string(zone_options_t* zone, const char* input);
+/* true if the remote control listens on an IP address, and needs the SSL
+ * keys, false if the control-interfaces are all local socket paths */
+int options_remote_is_address(nsd_options_t* cfg);
 
 #if defined(HAVE_SSL)
 /* tsig must be inited, adds all keys in options to tsig. */
@@ -330,6 +537,9 @@ void key_options_tsig_add(nsd_options_t* opt);
 /* the reason why (the acl) is returned too (or NULL) */
 int acl_check_incoming(acl_options_t* acl, struct query* q,
 	acl_options_t** reason);
+/* compile the list into a prefix trie, that acl_check_incoming uses,
+ * if it is long enough.  The list must not change afterwards. */
+void acl_list_index(region_type* region, acl_options_t* list);
 int acl_addr_matches_host(acl_options_t* acl, acl_options_t* host);
 int acl_addr_matches(acl_options_t* acl, struct query* q);
 int acl_key_matches(acl_options_t* acl, struct query* q);
@@ -343,6 +553,9 @@ acl_options_t* acl_find_num(acl_options_t* acl, int num);
 
 /* see if two acl lists are the same (same elements in same order, or empty) */
 int acl_list_equal(acl_options_t* p, acl_options_t* q);
+/* replace the acl list of opt with a copy of anew, if it differs */
+void copy_changed_acl(nsd_options_t* opt, acl_options_t** orig,
+	acl_options_t* anew);
 /* see if two acl are the same */
 int acl_equal(acl_options_t* p, acl_options_t* q);
 
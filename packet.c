@@ -17,7 +17,105 @@
 
 int round_robin = 0;
 
-static void
+/* most domain names in the rdata of a type with a layout */
+#define RR_LAYOUT_DNAMES 4
+
+/*
+ * Where the domain names are in the wire format of the rdata, for the
+ * types whose fields before the last name have a fixed length: NS,
+ * CNAME, SOA, MX, SRV and the like.  The encoder copies the wire format
+ * up to each name, without a look at the other fields.  Made from the
+ * rrtype descriptors by packet_init; count is 0 for the types without
+ * names, or where a name follows a field of variable length.
+ */
+struct rr_layout {
+	uint8_t count;
+	uint8_t compressed[RR_LAYOUT_DNAMES];
+	uint16_t offset[RR_LAYOUT_DNAMES];
+};
+static struct rr_layout rr_layouts[RRTYPE_DESCRIPTORS_LENGTH];
+
+/* the length of a field of the wire format that has a fixed length, 0
+ * if it has a variable length */
+static size_t
+rr_layout_field_length(uint8_t wireformat)
+{
+	switch (wireformat) {
+	case RDATA_WF_BYTE:
+		return sizeof(uint8_t);
+	case RDATA_WF_SHORT:
+		return sizeof(uint16_t);
+	case RDATA_WF_LONG:
+		return sizeof(uint32_t);
+	case RDATA_WF_A:
+		return sizeof(in_addr_t);
+	case RDATA_WF_AAAA:
+		return IP6ADDRLEN;
+	case RDATA_WF_ILNP64:
+		return IP6ADDRLEN/2;
+	case RDATA_WF_EUI48:
+		return EUI48ADDRLEN;
+	case RDATA_WF_EUI64:
+		return EUI64ADDRLEN;
+	default:
+		return 0;
+	}
+}
+
+void
+packet_init(void)
+{
+	uint16_t t;
+	for (t = 0; t < RRTYPE_DESCRIPTORS_LENGTH; ++t) {
+		const rrtype_descriptor_type *desc =
+			rrtype_descriptor_by_type(t);
+		struct rr_layout l;
+		size_t pos = 0, len;
+		uint32_t i;
+		memset(&l, 0, sizeof(l));
+		for (i = 0; i < desc->maximum; ++i) {
+			uint8_t wf = desc->wireformat[i];
+			if (wf == RDATA_WF_COMPRESSED_DNAME ||
+				wf == RDATA_WF_UNCOMPRESSED_DNAME) {
+				if (l.count == RR_LAYOUT_DNAMES)
+					break;
+				l.compressed[l.count] =
+					(wf == RDATA_WF_COMPRESSED_DNAME);
+				l.offset[l.count++] = (uint16_t)pos;
+			} else if ((len = rr_layout_field_length(wf)) != 0) {
+				pos += len;
+			} else {
+				break;
+			}
+		}
+		/* a name after a field of variable length, or after the
+		 * last name that fits, is encoded by the descriptor */
+		for (; i < desc->maximum; ++i) {
+			if (desc->wireformat[i] == RDATA_WF_COMPRESSED_DNAME ||
+				desc->wireformat[i] == RDATA_WF_UNCOMPRESSED_DNAME)
+				l.count = 0;
+		}
+		rr_layouts[t] = l;
+	}
+}
+
+/* the layout of the rdata of the RR, or NULL if the names are found
+ * with the descriptor */
+static const struct rr_layout*
+rr_layout(const rr_type *rr)
+{
+	const struct rr_layout *l;
+	if (rr->type >= RRTYPE_DESCRIPTORS_LENGTH)
+		return NULL;
+	l = &rr_layouts[rr->type];
+	/* an RR with fewer fields than the type has not got all names */
+	if (l->count == 0 || l->count != rr->rdata_domains ||
+		l->offset[l->count-1] > rr->rdlength)
+		return NULL;
+	return l;
+}
+
+void
 encode_dname(query_type *q, domain_type *domain)
 {
 	while (domain->parent && query_get_dname_offset(q, domain) == 0) {
@@ -45,6 +143,112 @@ encode_dname(query_type *q, domain_type *domain)
 	}
 }
 
+/*
+ * Like encode_dname, but write at p without the buffer checks, the
+ * caller has made sure that the name fits.  Returns the end of the name.
+ */
+static uint8_t*
+encode_dname_unchecked(query_type *q, domain_type *domain, uint8_t *p)
+{
+	uint8_t *begin = buffer_begin(q->packet);
+	while (domain->parent && query_get_dname_offset(q, domain) == 0) {
+		const uint8_t *label = dname_name(domain_dname(domain));
+		size_t len = label_length(label) + 1U;
+		query_put_dname_offset(q, domain, (uint16_t)(p - begin));
+		memcpy(p, label, len);
+		p += len;
+		domain = domain->parent;
+	}
+	if (domain->parent) {
+		assert(query_get_dname_offset(q, domain) <= MAX_COMPRESSION_OFFSET);
+		write_uint16(p, 0xc000 | query_get_dname_offset(q, domain));
+		p += sizeof(uint16_t);
+	} else {
+		*p++ = 0;
+	}
+	return p;
+}
+
+/*
+ * Encode the RR when it is known to fit in the packet.  The writes go
+ * straight to the packet memory, and the position is set once at the end.
+ */
+static void
+packet_encode_rr_unchecked(query_type *q, domain_type *owner, rr_type *rr,
+	uint32_t ttl)
+{
+	uint8_t *p, *rdata;
+	uint16_t j;
+	const struct rr_layout *l;
+
+	p = encode_dname_unchecked(q, owner, buffer_current(q->packet));
+	write_uint16(p, rr->type);
+	write_uint16(p + 2, rr->klass);
+	write_uint32(p + 4, ttl);
+	/* the rdlength is at p + 8 */
+	rdata = p + 10;
+
+	if (rr->rdata_domains == 0) {
+		memcpy(rdata, rr_rdata_wire(rr), rr->rdlength);
+		p = rdata + rr->rdlength;
+	} else if ((l = rr_layout(rr)) != NULL) {
+		domain_type **d = rr_rdata_domains(rr);
+		uint8_t *wire = rr_rdata_wire(rr);
+		uint16_t start = 0;
+		uint8_t k;
+		p = rdata;
+		for (k = 0; k < l->count; ++k) {
+			memcpy(p, wire+start, l->offset[k]-start);
+			p += l->offset[k]-start;
+			start = l->offset[k];
+			if (l->compressed[k]) {
+				p = encode_dname_unchecked(q, d[k], p);
+			} else {
+				const dname_type *dname = domain_dname(d[k]);
+				memcpy(p, dname_name(dname), dname->name_size);
+				p += dname->name_size;
+			}
+		}
+		memcpy(p, wire+start, rr->rdlength-start);
+		p += rr->rdlength-start;
+	} else {
+		/* write the wire format between the domain names */
+		domain_type **d = rr_rdata_domains(rr);
+		uint8_t *wire = rr_rdata_wire(rr);
+		size_t pos = 0, start = 0;
+		p = rdata;
+		for (j = 0; j < rr->rdata_count; ++j) {
+			switch (rdata_atom_wireformat_type(rr->type, j)) {
+			case RDATA_WF_COMPRESSED_DNAME:
+				memcpy(p, wire+start, pos-start);
+				p += pos-start;
+				start = pos;
+				p = encode_dname_unchecked(q, *d++, p);
+				break;
+			case RDATA_WF_UNCOMPRESSED_DNAME:
+			{
+				const dname_type *dname = domain_dname(*d++);
+				memcpy(p, wire+start, pos-start);
+				p += pos-start;
+				start = pos;
+				memcpy(p, dname_name(dname), dname->name_size);
+				p += dname->name_size;
+				break;
+			}
+			default:
+				pos += rdata_field_length(rr->type, j, wire,
+					pos, rr->rdlength);
+				break;
+			}
+		}
+		memcpy(p, wire+start, rr->rdlength-start);
+		p += rr->rdlength-start;
+	}
+
+	write_uint16(rdata - sizeof(uint16_t), (uint16_t)(p - rdata));
+	buffer_set_position(q->packet, (size_t)(p - buffer_begin(q->packet)));
+}
+
 int
 packet_encode_rr(query_type *q, domain_type *owner, rr_type *rr, uint32_t ttl)
 {
@@ -52,11 +256,24 @@ packet_encode_rr(query_type *q, domain_type *owner, rr_type *rr, uint32_t ttl)
 	uint16_t rdlength = 0;
 	size_t rdlength_pos;
 	uint16_t j;
+	const struct rr_layout *l;
 
 	assert(q);
 	assert(owner);
 	assert(rr);
 
+	/*
+	 * The encoded RR is at most the owner name, the fixed fields, the
+	 * rdata and every domain name in it uncompressed.  If that fits,
+	 * the RR is written without checks and cannot be truncated.
+	 */
+	if (buffer_position(q->packet) + domain_dname(owner)->name_size
+		+ 10 + rr->rdlength + (size_t)rr->rdata_domains * MAXDOMAINLEN
+		<= q->maxlen - q->reserved_space) {
+		packet_encode_rr_unchecked(q, owner, rr, ttl);
+		return 1;
+	}
+
 	/*
 	 * If the record does not in fit in the packet the packet size
 	 * will be restored to the mark.
@@ -72,25 +289,53 @@ packet_encode_rr(query_type *q, domain_type *owner, rr_type *rr, uint32_t ttl)
 	rdlength_pos = buffer_position(q->packet);
 	buffer_skip(q->packet, sizeof(rdlength));
 
-	for (j = 0; j < rr->rdata_count; ++j) {
-		switch (rdata_atom_wireformat_type(rr->type, j)) {
-		case RDATA_WF_COMPRESSED_DNAME:
-			encode_dname(q, rdata_atom_domain(rr->rdatas[j]));
-			break;
-		case RDATA_WF_UNCOMPRESSED_DNAME:
-		{
-			const dname_type *dname = domain_dname(
-				rdata_atom_domain(rr->rdatas[j]));
-			buffer_write(q->packet,
-				     dname_name(dname), dname->name_size);
-			break;
+	if (rr->rdata_domains == 0) {
+		buffer_write(q->packet, rr_rdata_wire(rr), rr->rdlength);
+	} else if ((l = rr_layout(rr)) != NULL) {
+		domain_type **d = rr_rdata_domains(rr);
+		uint8_t *wire = rr_rdata_wire(rr);
+		uint16_t start = 0;
+		uint8_t k;
+		for (k = 0; k < l->count; ++k) {
+			buffer_write(q->packet, wire+start, l->offset[k]-start);
+			start = l->offset[k];
+			if (l->compressed[k]) {
+				encode_dname(q, d[k]);
+			} else {
+				const dname_type *dname = domain_dname(d[k]);
+				buffer_write(q->packet,
+					     dname_name(dname), dname->name_size);
+			}
 		}
-		default:
-			buffer_write(q->packet,
-				     rdata_atom_data(rr->rdatas[j]),
-				     rdata_atom_size(rr->rdatas[j]));
-			break;
+		buffer_write(q->packet, wire+start, rr->rdlength-start);
+	} else {
+		/* write the wire format between the domain names */
+		domain_type **d = rr_rdata_domains(rr);
+		uint8_t *wire = rr_rdata_wire(rr);
+		size_t pos = 0, start = 0;
+		for (j = 0; j < rr->rdata_count; ++j) {
+			switch (rdata_atom_wireformat_type(rr->type, j)) {
+			case RDATA_WF_COMPRESSED_DNAME:
+				buffer_write(q->packet, wire+start, pos-start);
+				start = pos;
+				encode_dname(q, *d++);
+				break;
+			case RDATA_WF_UNCOMPRESSED_DNAME:
+			{
+				const dname_type *dname = domain_dname(*d++);
+				buffer_write(q->packet, wire+start, pos-start);
+				start = pos;
+				buffer_write(q->packet,
+					     dname_name(dname), dname->name_size);
+				break;
+			}
+			default:
+				pos += rdata_field_length(rr->type, j, wire,
+					pos, rr->rdlength);
+				break;
+			}
 		}
+		buffer_write(q->packet, wire+start, rr->rdlength-start);
 	}
 
 	if (!query_overflow(q)) {
@@ -106,6 +351,31 @@ packet_encode_rr(query_type *q, domain_type *owner, rr_type *rr, uint32_t ttl)
 	}
 }
 
+/*
+ * Write the SOA of soa_nx_rrset from the soa_nx_wire of the zone, with
+ * the pointers to the apex set to where the apex is in the packet.
+ * Returns 0 if the apex is not in the packet yet, or if the RR does not
+ * fit, then it is encoded as usual.
+ */
+static int
+packet_encode_soa_nx(query_type *q, zone_type *zone)
+{
+	struct soa_nx_wire *w = zone->soa_nx_wire;
+	uint16_t apex = query_get_dname_offset(q, zone->apex);
+	uint8_t *p;
+	uint8_t i;
+
+	if (apex == 0 || buffer_position(q->packet) + w->len
+		> q->maxlen - q->reserved_space)
+		return 0;
+	p = buffer_current(q->packet);
+	memcpy(p, w->data, w->len);
+	for (i = 0; i < w->ptr_count; ++i)
+		write_uint16(p + w->ptr[i], 0xc000 | apex);
+	buffer_skip(q->packet, w->len);
+	return 1;
+}
+
 int
 packet_encode_rrset(query_type *query,
 		    domain_type *owner,
@@ -132,7 +402,7 @@ packet_encode_rrset(query_type *query,
 				section == AUTHORITY_SECTION ||
 				section == OPTIONAL_AUTHORITY_SECTION);
 #endif
-	static int round_robin_off = 0;
+	static NSD_THREAD_LOCAL int round_robin_off = 0;
 	int do_robin = (round_robin && section == ANSWER_SECTION &&
 		query->qtype != TYPE_AXFR && query->qtype != TYPE_IXFR);
 	uint16_t start;
@@ -140,8 +410,30 @@ packet_encode_rrset(query_type *query,
 
 	assert(rrset->rr_count > 0);
 
+	/* the SOA of NXDOMAIN and NODATA, without an RRSIG */
+	if (rrset->zone && rrset == rrset->zone->soa_nx_rrset &&
+	    rrset->zone->soa_nx_wire &&
+	    !(query->edns.dnssec_ok && zone_is_secure(rrset->zone)) &&
+	    packet_encode_soa_nx(query, rrset->zone))
+		return 1;
+
 	truncation_mark = buffer_position(query->packet);
 
+	/*
+	 * If the rrs do not fit with every name compressed, the rrset is
+	 * truncated before any of it is encoded.
+	 */
+	if (truncation_mark + rrset->wire_min
+		> query->maxlen - query->reserved_space) {
+#ifdef MINIMAL_RESPONSES
+		if (!query->tcp && minimize_response)
+			*done = 1;
+#endif
+		if (truncate_rrset)
+			TC_SET(query->packet);
+		return 0;
+	}
+
 	if(do_robin && rrset->rr_count)
 		start = (uint16_t)(round_robin_off++ % rrset->rr_count);
 	else	start = 0;
@@ -264,8 +556,6 @@ packet_read_rr(region_type *region, domain_table_type *owners,
 {
 	const dname_type *owner;
 	uint16_t rdlength;
-	ssize_t rdata_count;
-	rdata_atom_type *rdatas;
 	rr_type *result = (rr_type *) region_alloc(region, sizeof(rr_type));
 
 	owner = dname_make_from_packet(region, packet, 1, 1);
@@ -279,8 +569,11 @@ packet_read_rr(region_type *region, domain_table_type *owners,
 
 	if (question_section) {
 		result->ttl = 0;
+		result->rdata = NULL;
+		result->rdlength = 0;
 		result->rdata_count = 0;
-		result->rdatas = NULL;
+		result->rdata_domains = 0;
+		result->rdata_shared = 0;
 		return result;
 	} else if (!buffer_available(packet, sizeof(uint32_t) + sizeof(uint16_t))) {
 		return NULL;
@@ -293,13 +586,10 @@ packet_read_rr(region_type *region, domain_table_type *owners,
 		return NULL;
 	}
 
-	rdata_count = rdata_wireformat_to_rdata_atoms(
-		region, owners, result->type, rdlength, packet, &rdatas);
-	if (rdata_count == -1) {
+	if (rdata_wireformat_to_rdata(region, owners, rdlength, packet,
+		result) == -1) {
 		return NULL;
 	}
-	result->rdata_count = rdata_count;
-	result->rdatas = rdatas;
 
 	return result;
 }
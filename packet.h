@@ -138,7 +138,7 @@ struct query;
 #define	QIOBUFSZ		(MAX_PACKET_SIZE + MAX_RR_SIZE)
 
 #define	MAXRRSPP		10240    /* Maximum number of rr's per packet */
-#define MAX_COMPRESSED_DNAMES	MAXRRSPP /* Maximum number of compressed domains. */
+#define MAX_COMPRESSED_DNAMES	2048     /* Maximum number of compressed domains. */
 #define MAX_COMPRESSION_OFFSET  16383	 /* Compression pointers are 14 bit. */
 #define IPV4_MINIMAL_RESPONSE_SIZE 1480	 /* Recommended minimal edns size for IPv4 */
 #define IPV6_MINIMAL_RESPONSE_SIZE 1220	 /* Recommended minimal edns size for IPv6 */
@@ -146,6 +146,19 @@ struct query;
 /* use round robin rotation */
 extern int round_robin;
 
+/*
+ * Make the tables of the RR encoder from the rrtype descriptors.  Call
+ * once at the start, before the server processes are made; without it
+ * the RRs are encoded with the descriptors.
+ */
+void packet_init(void);
+
+/*
+ * Encode the name of DOMAIN into QUERY, compressed with the names that
+ * are already in the packet.
+ */
+void encode_dname(struct query *q, domain_type *domain);
+
 /*
  * Encode RR with OWNER as owner name into QUERY.  Returns the number
  * of RRs successfully encoded.
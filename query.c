@@ -26,9 +26,11 @@
 #include <netdb.h>
 
 #include "answer.h"
+#include "anscache.h"
 #include "axfr.h"
 #include "dns.h"
 #include "dname.h"
+#include "ipc.h"
 #include "nsd.h"
 #include "namedb.h"
 #include "query.h"
@@ -36,6 +38,8 @@
 #include "options.h"
 #include "nsec3.h"
 #include "tsig.h"
+#include "udbanswer.h"
+#include "usdt.h"
 
 /* [Bug #253] Adding unnecessary NS RRset may lead to undesired truncation.
  * This function determines if the final response packet needs the NS RRset
@@ -66,9 +70,14 @@ static void answer_lookup_zone(struct nsd *nsd, struct query *q,
 			       domain_type *closest_encloser,
 			       const dname_type *qname);
 
+static int answer_read_lazy_zone(struct nsd *nsd, struct query *q,
+				 domain_type *closest_encloser);
+
 void
 query_put_dname_offset(struct query *q, domain_type *domain, uint16_t offset)
 {
+	uint32_t number;
+	size_t i;
 	assert(q);
 	assert(domain);
 	assert(domain->number > 0);
@@ -78,19 +87,30 @@ query_put_dname_offset(struct query *q, domain_type *domain, uint16_t offset)
 	if (q->compressed_dname_count >= MAX_COMPRESSED_DNAMES)
 		return;
 
-	q->compressed_dname_offsets[domain->number] = offset;
-	q->compressed_dnames[q->compressed_dname_count] = domain;
+	number = (uint32_t)domain->number;
+	i = COMPRESSION_TABLE_HASH(number);
+	while (q->compressed_dname_table[i].offset != 0) {
+		/* already in the table, the earlier offset works as well */
+		if (q->compressed_dname_table[i].number == number)
+			return;
+		i = (i + 1) & (COMPRESSION_TABLE_SIZE - 1);
+	}
+	q->compressed_dname_table[i].number = number;
+	q->compressed_dname_table[i].offset = offset;
+	q->compressed_dnames[q->compressed_dname_count] = (uint16_t)i;
 	++q->compressed_dname_count;
 }
 
 void
 query_clear_dname_offsets(struct query *q, size_t max_offset)
 {
+	/* the slots are emptied in the reverse order of filling them, so
+	 * the lookup of the ones that remain is not cut short */
 	while (q->compressed_dname_count > 0
-	       && (q->compressed_dname_offsets[q->compressed_dnames[q->compressed_dname_count - 1]->number]
+	       && (q->compressed_dname_table[q->compressed_dnames[q->compressed_dname_count - 1]].offset
 		   >= max_offset))
 	{
-		q->compressed_dname_offsets[q->compressed_dnames[q->compressed_dname_count - 1]->number] = 0;
+		q->compressed_dname_table[q->compressed_dnames[q->compressed_dname_count - 1]].offset = 0;
 		--q->compressed_dname_count;
 	}
 }
@@ -101,8 +121,7 @@ query_clear_compression_tables(struct query *q)
 	uint16_t i;
 
 	for (i = 0; i < q->compressed_dname_count; ++i) {
-		assert(q->compressed_dnames);
-		q->compressed_dname_offsets[q->compressed_dnames[i]->number] = 0;
+		q->compressed_dname_table[q->compressed_dnames[i]].offset = 0;
 	}
 	q->compressed_dname_count = 0;
 }
@@ -164,18 +183,20 @@ query_cleanup(void *data)
 }
 
 query_type *
-query_create(region_type *region, uint16_t *compressed_dname_offsets,
-	size_t compressed_dname_size)
+query_create(region_type *region)
 {
+	/* most of the query is the compression table, it is counted as
+	 * that for region-profile */
+	int tag = region_set_tag(region, REGION_TAG_COMPRESSION);
 	query_type *query
 		= (query_type *) region_alloc_zero(region, sizeof(query_type));
-	/* create region with large block size, because the initial chunk
-	   saves many mallocs in the server */
-	query->region = region_create_custom(xalloc, free, 16384, 16384/8, 32, 0);
-	query->compressed_dname_offsets = compressed_dname_offsets;
+	(void)region_set_tag(region, tag);
+	/* the region is an arena, every allocation that fits goes in the
+	   initial chunk, so that answering a query does not malloc */
+	query->region = region_create_custom(xalloc, free, QUERY_ARENA_SIZE,
+		QUERY_ARENA_SIZE, 32, 0);
 	query->packet = buffer_create(region, QIOBUFSZ);
 	region_add_cleanup(region, query_cleanup, query);
-	query->compressed_dname_offsets_size = compressed_dname_size;
 	tsig_create_record(&query->tsig, region);
 	query->tsig_prepare_it = 1;
 	query->tsig_update_it = 1;
@@ -187,9 +208,10 @@ void
 query_reset(query_type *q, size_t maxlen, int is_tcp)
 {
 	/*
-	 * As long as less than 4Kb (region block size) has been used,
-	 * this call to free_all is free, the block is saved for re-use,
-	 * so no malloc() or free() calls are done.
+	 * As long as less than QUERY_ARENA_SIZE has been used, this call
+	 * to free_all is free, the block is saved for re-use, so no
+	 * malloc() or free() calls are done.  The server counts the
+	 * queries that overflowed it in arena_overflow.
 	 * at present use of the region is for:
 	 *   o query qname dname_type (255 max).
 	 *   o wildcard expansion domain_type (7*ptr+u32+2bytes)+(5*ptr nsec3)
@@ -209,6 +231,7 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	q->tsig_sign_it = 1;
 	q->tcp = is_tcp;
 	q->qname = NULL;
+	q->qname_radkey = NULL;
 	q->qtype = 0;
 	q->qclass = 0;
 	q->zone = NULL;
@@ -216,7 +239,7 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	q->cname_count = 0;
 	q->delegation_domain = NULL;
 	q->delegation_rrset = NULL;
-	q->compressed_dname_count = 0;
+	query_clear_compression_tables(q);
 	q->number_temporary_domains = 0;
 
 	q->axfr_is_done = 0;
@@ -224,9 +247,27 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	q->axfr_current_domain = NULL;
 	q->axfr_current_rrset = NULL;
 	q->axfr_current_rr = 0;
+	q->ixfr_serial = 0;
+	q->ixfr_have_serial = 0;
+	q->ixfr_data = NULL;
+	q->ixfr_pos = 0;
+	q->axfr_cache = NULL;
+	q->axfr_cache_store = 0;
+	q->axfr_cache_pos = 0;
+	q->lat_start = 0;
+	q->lat_parse = 0;
+	q->lat_lookup = 0;
+	q->shed = 0;
 
 #ifdef RATELIMIT
 	q->wildcard_domain = NULL;
+#endif
+	q->wildcard_key = NULL;
+	q->wildcard_zone = NULL;
+	q->wildcard_cover = NULL;
+	q->wildcard_synth = 0;
+#ifdef USE_DNSTAP
+	q->dnstap = 0;
 #endif
 }
 
@@ -234,13 +275,14 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 static domain_type*
 query_get_tempdomain(struct query *q)
 {
-	static domain_type d[EXTRA_DOMAIN_NUMBERS];
+	static NSD_THREAD_LOCAL domain_type d[EXTRA_DOMAIN_NUMBERS];
 	if(q->number_temporary_domains >= EXTRA_DOMAIN_NUMBERS)
 		return 0;
 	q->number_temporary_domains ++;
 	memset(&d[q->number_temporary_domains-1], 0, sizeof(domain_type));
-	d[q->number_temporary_domains-1].number = q->compressed_dname_offsets_size +
-		q->number_temporary_domains - 1;
+	/* numbered at the top, above the numbers of the domains in the db */
+	d[q->number_temporary_domains-1].number = (uint32_t)0xffffffff -
+		q->number_temporary_domains + 1;
 	return &d[q->number_temporary_domains-1];
 }
 
@@ -277,23 +319,155 @@ query_addtxt(struct query  *q,
 /*
  * Parse the question section of a query.  The normalized query name
  * is stored in QUERY->name, the class in QUERY->klass, and the type
- * in QUERY->type.
+ * in QUERY->type.  In one pass over the name in the packet, it is
+ * checked, lowercased, and written as the radname for the lookup.  The
+ * labels are in reverse order in the radname, it is written from the
+ * end of the key buffer.
  */
 static int
 process_query_section(query_type *query)
 {
-	uint8_t qnamebuf[MAXDOMAINLEN];
+	uint8_t name[MAXDOMAINLEN];
+	uint8_t offsets[MAXDOMAINLEN/2 + 1];
+	uint8_t *key = query->qname_key + sizeof(query->qname_key);
+	dname_type *dname = (dname_type *) query->qname_buf;
+	const uint8_t *src;
+	size_t avail, pos = 0, i;
+	uint8_t count = 0, len, c;
 
 	buffer_set_position(query->packet, QHEADERSZ);
-	/* Lets parse the query name and convert it to lower case.  */
-	if(!packet_read_query_section(query->packet, qnamebuf,
-		&query->qtype, &query->qclass))
+	src = buffer_current(query->packet);
+	avail = buffer_remaining(query->packet);
+	while (1) {
+		/* no pointers, in the packet and not longer than MAXDOMAINLEN */
+		if (pos >= avail)
+			return 0;
+		len = src[pos];
+		if ((len & 0xc0) || pos + len + 1 > MAXDOMAINLEN ||
+			pos + len + 1 > avail)
+			return 0;
+		offsets[count++] = (uint8_t) pos;
+		name[pos] = len;
+		if (len == 0)
+			break;
+		key -= len + (count > 1);
+		if (count > 1)
+			key[len] = 0;
+		for (i = 1; i <= len; i++) {
+			c = src[pos + i];
+			name[pos + i] = DNAME_NORMALIZE(c);
+			key[i - 1] = radname_char(c);
+		}
+		pos += len + 1;
+	}
+	pos++;
+	if (pos + 2*sizeof(uint16_t) > avail)
 		return 0;
-	query->qname = dname_make(query->region, qnamebuf, 1);
+
+	/* the label offsets of a dname are from the root label back */
+	dname->name_size = (uint8_t) pos;
+	dname->label_count = count;
+	for (i = 0; i < count; i++)
+		((uint8_t *) dname_label_offsets(dname))[i] =
+			offsets[count - i - 1];
+	memcpy((uint8_t *) dname_name(dname), name, pos);
+	query->qname = dname;
+	query->qname_radkey = key;
+	query->qname_radlen = (radstrlen_t) (query->qname_key +
+		sizeof(query->qname_key) - key);
+
+	buffer_skip(query->packet, pos);
+	query->qtype = buffer_read_u16(query->packet);
+	query->qclass = buffer_read_u16(query->packet);
 	query->opcode = OPCODE(query->packet);
 	return 1;
 }
 
+/*
+ * Read the serial of the SOA record in the authority section of an IXFR
+ * query, into QUERY->ixfr_serial.  The packet position is not changed.
+ */
+static void
+process_ixfr_soa(query_type *query)
+{
+	size_t pos = buffer_position(query->packet);
+	uint16_t type, rdlen;
+	if(!packet_skip_dname(query->packet) ||
+		!buffer_available(query->packet, 10)) {
+		buffer_set_position(query->packet, pos);
+		return;
+	}
+	type = buffer_read_u16(query->packet);
+	buffer_skip(query->packet, 6); /* class, ttl */
+	rdlen = buffer_read_u16(query->packet);
+	if(type == TYPE_SOA && buffer_available(query->packet, rdlen) &&
+		packet_skip_dname(query->packet) /* skip prim_ns */ &&
+		packet_skip_dname(query->packet) /* skip email */ &&
+		buffer_available(query->packet, 4)) {
+		query->ixfr_serial = buffer_read_u32(query->packet);
+		query->ixfr_have_serial = 1;
+	}
+	buffer_set_position(query->packet, pos);
+}
+
+/*
+ * Check the layout of the additional section in one pass over it,
+ * before the records are parsed: an OPT record with the root as owner,
+ * a TSIG record, or both, in any order.  The offsets of the records are
+ * returned, 0 if the record is not there, and the end of the section.
+ * Returns 0 if the section is malformed or has other records, then the
+ * query gets FORMERR without the parse of the OPT and TSIG records, and
+ * garbage costs no allocations.
+ */
+static int
+query_scan_additional(query_type *q, size_t *opt, size_t *tsig,
+	size_t *end)
+{
+	const uint8_t *p = buffer_begin(q->packet);
+	size_t pos = buffer_position(q->packet), lim = buffer_limit(q->packet);
+	size_t start;
+	uint16_t i, arcount = ARCOUNT(q->packet), type, klass, rdlen;
+
+	*opt = 0;
+	*tsig = 0;
+	if (arcount > 2)
+		return 0;
+	for (i = 0; i < arcount; i++) {
+		start = pos;
+		/* the owner, it can end in a compression pointer */
+		while (1) {
+			if (pos >= lim)
+				return 0;
+			if ((p[pos] & 0xc0) == 0xc0) {
+				pos += 2;
+				break;
+			}
+			if ((p[pos] & 0xc0) != 0)
+				return 0;
+			if (p[pos] == 0) {
+				pos++;
+				break;
+			}
+			pos += p[pos] + 1;
+		}
+		if (pos + 10 > lim)
+			return 0;
+		type = read_uint16(p + pos);
+		klass = read_uint16(p + pos + 2);
+		rdlen = read_uint16(p + pos + 8);
+		pos += 10;
+		if (pos + rdlen > lim)
+			return 0;
+		pos += rdlen;
+		if (type == TYPE_TSIG && klass == CLASS_ANY && !*tsig)
+			*tsig = start;
+		else if (type == TYPE_OPT && p[start] == 0 && !*opt)
+			*opt = start;
+		else	return 0;
+	}
+	*end = pos;
+	return 1;
+}
 
 /*
  * Process an optional EDNS OPT record.  Sets QUERY->EDNS to 0 if
@@ -303,6 +477,57 @@ process_query_section(query_type *query)
  *
  * Return NSD_RC_FORMAT on failure, NSD_RC_OK on success.
  */
+/*
+ * Checks the server cookie of the query, or makes the one for the
+ * answer, with the client address.
+ */
+static void
+query_cookie(nsd_type* nsd, struct query *q, int create)
+{
+	const uint8_t* addr;
+	size_t addrlen;
+	uint32_t now = (uint32_t)time(NULL);
+#ifdef INET6
+	if (q->addr.ss_family == AF_INET6) {
+		addr = (const uint8_t*)&((struct sockaddr_in6*)&q->addr)->
+			sin6_addr;
+		addrlen = 16;
+	} else {
+		addr = (const uint8_t*)&((struct sockaddr_in*)&q->addr)->
+			sin_addr;
+		addrlen = 4;
+	}
+#else
+	addr = (const uint8_t*)&q->addr.sin_addr;
+	addrlen = 4;
+#endif
+	if (create)
+		edns_cookie_create(&q->edns, nsd->cookie_secret, addr,
+			addrlen, now);
+	else	edns_cookie_verify(&q->edns, nsd->cookie_secret, addr,
+			addrlen, now);
+}
+
+/*
+ * Sheds the query in overload, before the lookup: an empty truncated
+ * answer, with the server cookie, or no answer.
+ */
+static query_state_type
+query_shed(struct query *q, nsd_type* nsd)
+{
+	if (nsd->options->overload_action == OVERLOAD_DROP) {
+		STATUP(nsd, overload_drop);
+		return QUERY_DISCARDED;
+	}
+	STATUP(nsd, overload_tc);
+	query_prepare_response(q);
+	TC_SET(q->packet);
+	ANCOUNT_SET(q->packet, 0);
+	NSCOUNT_SET(q->packet, 0);
+	ARCOUNT_SET(q->packet, 0);
+	return QUERY_PROCESSED;
+}
+
 static nsd_rc_type
 process_edns(nsd_type* nsd, struct query *q)
 {
@@ -343,6 +568,12 @@ process_edns(nsd_type* nsd, struct query *q)
 #endif
 		}
 
+		if (q->edns.cookie_status != COOKIE_NOT_PRESENT) {
+			if (nsd->options->answer_cookie)
+				query_cookie(nsd, q, 0);
+			else	q->edns.cookie_status = COOKIE_NOT_PRESENT;
+		}
+
 		/* Strip the OPT resource record off... */
 		buffer_set_position(q->packet, q->edns.position);
 		buffer_set_limit(q->packet, q->edns.position);
@@ -441,15 +672,18 @@ answer_notify(struct nsd* nsd, struct query *query)
 		sz = buffer_limit(query->packet);
 		if(buffer_limit(query->packet) > MAX_PACKET_SIZE)
 			return query_error(query, NSD_RC_SERVFAIL);
-		/* forward to xfrd for processing
+		/* forward to xfrd for processing, straight to xfrd, or
+		   through the parent if that would block.
 		   Note. Blocking IPC I/O, but acl is OK. */
 		sz = htons(sz);
-		if(!write_socket(s, &mode, sizeof(mode)) ||
+		if(!ipc_send_notify(nsd, query->packet, acl_num,
+			acl_num_xfr) && (
+			!write_socket(s, &mode, sizeof(mode)) ||
 			!write_socket(s, &sz, sizeof(sz)) ||
 			!write_socket(s, buffer_begin(query->packet),
 				buffer_limit(query->packet)) ||
 			!write_socket(s, &acl_send, sizeof(acl_send)) ||
-			!write_socket(s, &acl_xfr, sizeof(acl_xfr))) {
+			!write_socket(s, &acl_xfr, sizeof(acl_xfr)))) {
 			log_msg(LOG_ERR, "error in IPC notify server2main, %s",
 				strerror(errno));
 			return query_error(query, NSD_RC_SERVFAIL);
@@ -613,7 +847,7 @@ add_additional_rrsets(struct query *query, answer_type *answer,
 
 	for (i = 0; i < master_rrset->rr_count; ++i) {
 		int j;
-		domain_type *additional = rdata_atom_domain(master_rrset->rrs[i].rdatas[rdata_index]);
+		domain_type *additional = rr_rdata_domain(&master_rrset->rrs[i], rdata_index);
 		domain_type *match = additional;
 
 		assert(additional);
@@ -638,6 +872,7 @@ add_additional_rrsets(struct query *query, answer_type *answer,
 			temp->parent = match;
 			temp->wildcard_child_closest_match = temp;
 			temp->rrsets = wildcard_child->rrsets;
+			temp->rrset_types = wildcard_child->rrset_types;
 			temp->is_existing = wildcard_child->is_existing;
 			additional = temp;
 		}
@@ -678,6 +913,10 @@ add_rrset(struct query   *query,
 	assert(rrset_rrclass(rrset) == CLASS_IN);
 
 	result = answer_add_rrset(answer, section, owner, rrset);
+	/* only the glue of a referral is needed */
+	if (query->minimal && !(section == AUTHORITY_SECTION &&
+		rrset_rrtype(rrset) == TYPE_NS))
+		return result;
 	switch (rrset_rrtype(rrset)) {
 	case TYPE_NS:
 		add_additional_rrsets(query, answer, rrset, 0, 1,
@@ -704,6 +943,32 @@ add_rrset(struct query   *query,
 }
 
 
+/* the HINFO of RFC 8482 for ANY queries, with the TTL of the RRset that
+ * it replaces */
+static rrset_type*
+query_synthesize_hinfo(struct query* q, rrset_type* orig)
+{
+	static const uint8_t hinfo[] = "\007RFC8482";
+	rrset_type* rrset = (rrset_type*) region_alloc(q->region,
+		sizeof(rrset_type));
+	memset(rrset, 0, sizeof(rrset_type));
+	rrset->zone = q->zone;
+	rrset->rr_count = 1;
+	rrset->type = TYPE_HINFO;
+	rrset->rrs = (rr_type*) region_alloc(q->region, sizeof(rr_type));
+	memset(rrset->rrs, 0, sizeof(rr_type));
+	rrset->rrs->owner = orig->rrs[0].owner;
+	rrset->rrs->ttl = orig->rrs[0].ttl;
+	rrset->rrs->type = TYPE_HINFO;
+	rrset->rrs->klass = CLASS_IN;
+	rrset->rrs->rdata_count = 2;
+	/* the CPU is RFC8482 and the OS is empty */
+	rrset->rrs->rdlength = sizeof(hinfo);
+	rrset->rrs->rdata = region_alloc_init(q->region, hinfo,
+		sizeof(hinfo));
+	return rrset;
+}
+
 /* returns 0 on error, or the domain number for to_name.
    from_name is changes to to_name by the DNAME rr.
    DNAME rr is from src to dest.
@@ -770,6 +1035,7 @@ query_synthesize_cname(struct query* q, struct answer* answer, const dname_type*
 	memset(rrset, 0, sizeof(rrset_type));
 	rrset->zone = q->zone;
 	rrset->rr_count = 1;
+	rrset->type = TYPE_CNAME;
 	rrset->rrs = (rr_type*) region_alloc(q->region, sizeof(rr_type));
 	memset(rrset->rrs, 0, sizeof(rr_type));
 	rrset->rrs->owner = cname_domain;
@@ -777,9 +1043,9 @@ query_synthesize_cname(struct query* q, struct answer* answer, const dname_type*
 	rrset->rrs->type = TYPE_CNAME;
 	rrset->rrs->klass = CLASS_IN;
 	rrset->rrs->rdata_count = 1;
-	rrset->rrs->rdatas = (rdata_atom_type*)region_alloc(q->region,
-		sizeof(rdata_atom_type));
-	rrset->rrs->rdatas->domain = cname_dest;
+	rrset->rrs->rdata_domains = 1;
+	rrset->rrs->rdata = region_alloc(q->region, sizeof(domain_type*));
+	rr_rdata_domains(rrset->rrs)[0] = cname_dest;
 
 	if(!add_rrset(q, answer, ANSWER_SECTION, cname_domain, rrset)) {
 		log_msg(LOG_ERR, "could not add synthesized CNAME rrset to packet");
@@ -894,7 +1160,28 @@ answer_domain(struct nsd* nsd, struct query *q, answer_type *answer,
 {
 	rrset_type *rrset;
 
-	if (q->qtype == TYPE_ANY) {
+	if (q->qtype == TYPE_ANY && nsd->options->minimal_any) {
+		/* RFC 8482, answer with one RRset of the name, or with a
+		 * synthesized HINFO, the RRSIG of the RRset is added for
+		 * DNSSEC */
+		for (rrset = domain_find_any_rrset(domain, q->zone); rrset;
+			rrset = rrset->next) {
+			uint16_t t = rrset_rrtype(rrset);
+			if (rrset->zone == q->zone && t != TYPE_RRSIG &&
+				t != TYPE_NSEC && t != TYPE_NSEC3)
+				break;
+		}
+		if (!rrset) {
+			answer_nodata(q, answer, original);
+			return;
+		}
+		/* the HINFO cannot be signed, a signed RRset is returned
+		 * for DNSSEC */
+		if (nsd->options->minimal_any == MINIMAL_ANY_HINFO &&
+			!(q->edns.dnssec_ok && zone_is_secure(q->zone)))
+			rrset = query_synthesize_hinfo(q, rrset);
+		add_rrset(q, answer, ANSWER_SECTION, domain, rrset);
+	} else if (q->qtype == TYPE_ANY) {
 		int added = 0;
 		for (rrset = domain_find_any_rrset(domain, q->zone); rrset; rrset = rrset->next) {
 			if (rrset->zone == q->zone
@@ -937,11 +1224,12 @@ answer_domain(struct nsd* nsd, struct query *q, answer_type *answer,
 		assert(rrset->rr_count > 0);
 		if (added) {
 			/* only process first CNAME record */
-			domain_type *closest_match = rdata_atom_domain(rrset->rrs[0].rdatas[0]);
+			domain_type *closest_match = rr_rdata_domain(&rrset->rrs[0], 0);
 			domain_type *closest_encloser = closest_match;
 			zone_type* origzone = q->zone;
 			++q->cname_count;
 
+			(void)answer_read_lazy_zone(nsd, q, closest_match);
 			while (!closest_encloser->is_existing)
 				closest_encloser = closest_encloser->parent;
 
@@ -957,7 +1245,8 @@ answer_domain(struct nsd* nsd, struct query *q, answer_type *answer,
 		return;
 	}
 
-	if (q->qclass != CLASS_ANY && q->zone->ns_rrset && answer_needs_ns(q)) {
+	if (q->qclass != CLASS_ANY && q->zone->ns_rrset && answer_needs_ns(q)
+		&& !q->minimal) {
 		add_rrset(q, answer, OPTIONAL_AUTHORITY_SECTION, q->zone->apex,
 			  q->zone->ns_rrset);
 	}
@@ -1000,7 +1289,7 @@ answer_authoritative(struct nsd   *nsd,
 	} else if ((rrset=domain_find_rrset(closest_encloser, q->zone, TYPE_DNAME))) {
 		/* process DNAME */
 		const dname_type* name = qname;
-		domain_type *dest = rdata_atom_domain(rrset->rrs[0].rdatas[0]);
+		domain_type *dest = rr_rdata_domain(&rrset->rrs[0], 0);
 		int added;
 		assert(rrset->rr_count > 0);
 		if(domain_number != 0) /* we followed CNAMEs or DNAMEs */
@@ -1026,6 +1315,8 @@ answer_authoritative(struct nsd   *nsd,
 			DEBUG(DEBUG_QUERY,2, (LOG_INFO, "->result is %s", dname_to_string(newname, NULL)));
 			/* follow the DNAME */
 			exact = namedb_lookup(nsd->db, newname, &closest_match, &closest_encloser);
+			if (answer_read_lazy_zone(nsd, q, closest_encloser))
+				exact = namedb_lookup(nsd->db, newname, &closest_match, &closest_encloser);
 			/* synthesize CNAME record */
 			newnum = query_synthesize_cname(q, answer, name, newname,
 				src, closest_encloser, &closest_match, rrset->rrs[0].ttl);
@@ -1052,6 +1343,10 @@ answer_authoritative(struct nsd   *nsd,
 #ifdef RATELIMIT
 		q->wildcard_domain = wildcard_child;
 #endif
+		/* the answer for the query name is synthesized, it can be
+		 * stored by the wildcard key */
+		if (domain_number == 0 && wildcard_child == q->wildcard_key)
+			q->wildcard_synth = 1;
 
 		match = (domain_type *) region_alloc(q->region,
 						     sizeof(domain_type));
@@ -1061,6 +1356,7 @@ answer_authoritative(struct nsd   *nsd,
 		match->wildcard_child_closest_match = match;
 		match->number = domain_number;
 		match->rrsets = wildcard_child->rrsets;
+		match->rrset_types = wildcard_child->rrset_types;
 		match->is_existing = wildcard_child->is_existing;
 #ifdef NSEC3
 		match->nsec3 = wildcard_child->nsec3;
@@ -1146,13 +1442,14 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 	domain_type *closest_encloser, const dname_type *qname)
 {
 	q->zone = domain_find_zone(nsd->db, closest_encloser);
+	NSD_PROBE3(lookup__zone, q, dname_name(qname), q->zone);
 	if (!q->zone) {
 		/* no zone for this */
 		if(q->cname_count == 0)
 			RCODE_SET(q->packet, RCODE_REFUSE);
 		return;
 	}
-	if(!q->zone->apex || !q->zone->soa_rrset) {
+	if(!q->zone->apex || !q->zone->soa_rrset || q->zone->is_lazy) {
 		/* zone is configured but not loaded */
 		if(q->cname_count == 0)
 			RCODE_SET(q->packet, RCODE_SERVFAIL);
@@ -1170,6 +1467,17 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 		 * authoritative for the parent zone.
 		 */
 		zone_type *zone = domain_find_parent_zone(q->zone);
+		if (!zone && nsd->db->lazy_zones && q->zone->apex->parent) {
+			/* the parent zone, with the delegation, could not
+			 * be read */
+			zone = domain_find_zone(nsd->db, q->zone->apex->parent);
+			if (zone && zone->is_lazy) {
+				if(q->cname_count == 0)
+					RCODE_SET(q->packet, RCODE_SERVFAIL);
+				return;
+			}
+			zone = NULL;
+		}
 		if (zone)
 			q->zone = zone;
 	}
@@ -1214,6 +1522,71 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 	}
 }
 
+/*
+ * Read the zone of the closest encloser from the database if it is a
+ * lazy zone, and the parent zone for a DS query at its apex.  Returns
+ * true if a zone was read, the names that it adds change the lookup.
+ */
+static int
+answer_read_lazy_zone(struct nsd *nsd, struct query *q,
+	domain_type *closest_encloser)
+{
+	zone_type *zone;
+	int read = 0;
+	if (!nsd->db->lazy_zones)
+		return 0;
+	zone = domain_find_zone(nsd->db, closest_encloser);
+	if (!zone)
+		return 0;
+	if (zone->is_lazy && namedb_read_lazy_zone(nsd->db, zone))
+		read = 1;
+	if (q->qtype == TYPE_DS && closest_encloser == zone->apex &&
+		zone->apex->parent) {
+		/* the delegation is not there while the parent is lazy */
+		zone = domain_find_zone(nsd->db, zone->apex->parent);
+		if (zone && zone->is_lazy &&
+			namedb_read_lazy_zone(nsd->db, zone))
+			read = 1;
+	}
+	return read;
+}
+
+/*
+ * Answer from the answer cache, for a query name that is below a
+ * wildcard.  The key is the wildcard and the denial that covers the
+ * query name, so the other names below the wildcard share the answer.
+ */
+static int
+answer_wildcard_cached(struct nsd *nsd, struct query *q,
+	domain_type *closest_match, domain_type *closest_encloser)
+{
+	domain_type *wildcard = domain_wildcard_child(closest_encloser);
+	domain_type *cover = NULL;
+	rrset_type *nsec_rrset;
+	zone_type *zone;
+
+	if (!wildcard)
+		return 0;
+	zone = domain_find_zone(nsd->db, closest_encloser);
+	if (!zone || !zone->apex || !zone->soa_rrset || zone->is_lazy)
+		return 0;
+	if (q->edns.dnssec_ok) {
+#ifdef NSEC3
+		if (zone->nsec3_param) {
+			/* a hash collision is answered with SERVFAIL */
+			if (!nsec3_find_nonexist_cover(q, zone, wildcard,
+				q->qname, &cover))
+				return 0;
+		} else
+#endif
+		if (zone_is_secure(zone))
+			cover = find_covering_nsec(closest_match, zone,
+				&nsec_rrset);
+	}
+	return anscache_lookup_wildcard(nsd->anscache, q, zone, wildcard,
+		cover);
+}
+
 static void
 answer_query(struct nsd *nsd, struct query *q)
 {
@@ -1224,8 +1597,20 @@ answer_query(struct nsd *nsd, struct query *q)
 	answer_type answer;
 
 	answer_init(&answer);
-
-	exact = namedb_lookup(nsd->db, q->qname, &closest_match, &closest_encloser);
+	q->minimal = nsd->options->minimal_responses;
+
+	exact = namedb_lookup_key(nsd->db, q->qname, q->qname_radkey,
+		q->qname_radlen, &closest_match, &closest_encloser);
+	if (nsd->db->lazy_zones &&
+		udb_answer_query(nsd, q, closest_encloser)) {
+		ZTATUP2(nsd, q->zone, opcode, q->opcode);
+		ZTATUP_QTYPE(nsd, q->zone, q->qtype);
+		ZTATUP2(nsd, q->zone, qclass, q->qclass);
+		return;
+	}
+	if (answer_read_lazy_zone(nsd, q, closest_encloser))
+		exact = namedb_lookup_key(nsd->db, q->qname, q->qname_radkey,
+			q->qname_radlen, &closest_match, &closest_encloser);
 	if (!closest_encloser->is_existing) {
 		exact = 0;
 		while (closest_encloser != NULL && !closest_encloser->is_existing)
@@ -1235,15 +1620,24 @@ answer_query(struct nsd *nsd, struct query *q)
 		RCODE_SET(q->packet, RCODE_SERVFAIL);
 		return;
 	}
+	if (nsd->anscache && !exact && answer_wildcard_cached(nsd, q,
+		closest_match, closest_encloser)) {
+		ZTATUP2(nsd, q->zone, opcode, q->opcode);
+		ZTATUP_QTYPE(nsd, q->zone, q->qtype);
+		ZTATUP2(nsd, q->zone, qclass, q->qclass);
+		return;
+	}
 
 	answer_lookup_zone(nsd, q, &answer, 0, exact, closest_match,
 		closest_encloser, q->qname);
 	ZTATUP2(nsd, q->zone, opcode, q->opcode);
-	ZTATUP2(nsd, q->zone, qtype, q->qtype);
+	ZTATUP_QTYPE(nsd, q->zone, q->qtype);
 	ZTATUP2(nsd, q->zone, qclass, q->qclass);
 
 	offset = dname_label_offsets(q->qname)[domain_dname(closest_encloser)->label_count - 1] + QHEADERSZ;
 	query_add_compression_domain(q, closest_encloser, offset);
+	if (q->lat_start)
+		q->lat_lookup = latency_clock();
 	encode_answer(q, &answer);
 	query_clear_compression_tables(q);
 }
@@ -1277,13 +1671,13 @@ query_prepare_response(query_type *q)
  * Processes the query.
  *
  */
-query_state_type
-query_process(query_type *q, nsd_type *nsd)
+static query_state_type
+query_process_packet(query_type *q, nsd_type *nsd)
 {
 	/* The query... */
 	nsd_rc_type rc;
 	query_state_type query_state;
-	uint16_t arcount;
+	size_t ixfr_qend = 0, opt, tsig, end;
 
 	/* Sanity checks */
 	if (buffer_limit(q->packet) < QHEADERSZ) {
@@ -1328,44 +1722,40 @@ query_process(query_type *q, nsd_type *nsd)
 	}
 	if(q->qtype==TYPE_IXFR && NSCOUNT(q->packet) > 0) {
 		int i; /* skip ixfr soa information data here */
+		ixfr_qend = buffer_position(q->packet);
+		process_ixfr_soa(q);
 		for(i=0; i< NSCOUNT(q->packet); i++)
 			if(!packet_skip_rr(q->packet, 0))
 				return query_formerr(q);
 	}
 
-	arcount = ARCOUNT(q->packet);
-	if (arcount > 0) {
+	if (ARCOUNT(q->packet) > 0) {
 		/* According to draft-ietf-dnsext-rfc2671bis-edns0-10:
 		 * "The placement flexibility for the OPT RR does not
 		 * override the need for the TSIG or SIG(0) RRs to be
 		 * the last in the additional section whenever they are
 		 * present."
-		 * So we should not have to check for TSIG RR before
-		 * OPT RR. Keep the code for backwards compatibility.
+		 * So we should not have to accept a TSIG RR before the
+		 * OPT RR. Keep it for backwards compatibility.
 		 */
-
-		/* see if tsig is before edns record */
-		if (!tsig_parse_rr(&q->tsig, q->packet))
-			return query_formerr(q);
-		if(q->tsig.status != TSIG_NOT_PRESENT)
-			--arcount;
-	}
-	/* See if there is an OPT RR. */
-	if (arcount > 0) {
-		if (edns_parse_record(&q->edns, q->packet))
-			--arcount;
-	}
-	/* See if there is a TSIG RR. */
-	if (arcount > 0 && q->tsig.status == TSIG_NOT_PRESENT) {
-		/* see if tsig is after the edns record */
-		if (!tsig_parse_rr(&q->tsig, q->packet))
+		if (!query_scan_additional(q, &opt, &tsig, &end))
 			return query_formerr(q);
-		if(q->tsig.status != TSIG_NOT_PRESENT)
-			--arcount;
-	}
-	/* If more RRs left in Add. Section, FORMERR. */
-	if (arcount > 0) {
-		return query_formerr(q);
+		/* only the records that are there are parsed */
+		if (tsig) {
+			buffer_set_position(q->packet, tsig);
+			if (!tsig_parse_rr(&q->tsig, q->packet) ||
+				q->tsig.status == TSIG_NOT_PRESENT)
+				return query_formerr(q);
+		}
+		if (opt) {
+			buffer_set_position(q->packet, opt);
+			if (!edns_parse_record(&q->edns, q->packet))
+				return query_formerr(q);
+			/* edns-tcp-keepalive is not sent over UDP (RFC 7828) */
+			if (q->edns.keepalive && !q->tcp)
+				return query_formerr(q);
+		}
+		buffer_set_position(q->packet, end);
 	}
 
 	/* Do we have any trailing garbage? */
@@ -1390,7 +1780,16 @@ query_process(query_type *q, nsd_type *nsd)
 		 * Thus RCODE = NOERROR = NSD_RC_OK. */
 		return query_error(q, NSD_RC_OK);
 	}
+	if (ixfr_qend) {
+		/* Strip the IXFR authority section, it is not answered */
+		buffer_set_limit(q->packet, ixfr_qend);
+		NSCOUNT_SET(q->packet, 0);
+	}
+	if (q->shed && q->edns.cookie_status != COOKIE_VALID)
+		return query_shed(q, nsd);
 
+	if (q->lat_start)
+		q->lat_parse = latency_clock();
 	query_prepare_response(q);
 
 	if (q->qclass != CLASS_IN && q->qclass != CLASS_ANY) {
@@ -1406,11 +1805,93 @@ query_process(query_type *q, nsd_type *nsd)
 		return query_state;
 	}
 
+	if (nsd->anscache) {
+		/* The question section ends here, the answer is appended. */
+		size_t qend = buffer_position(q->packet);
+		if (anscache_lookup(nsd->anscache, q)) {
+			ZTATUP2(nsd, q->zone, opcode, q->opcode);
+			ZTATUP_QTYPE(nsd, q->zone, q->qtype);
+			ZTATUP2(nsd, q->zone, qclass, q->qclass);
+			return QUERY_PROCESSED;
+		}
+		answer_query(nsd, q);
+		anscache_store(nsd->anscache, q, qend);
+		return QUERY_PROCESSED;
+	}
+
 	answer_query(nsd, q);
 
 	return QUERY_PROCESSED;
 }
 
+/*
+ * Processes the query, between the query-start and query-done probes.
+ *
+ */
+query_state_type
+query_process(query_type *q, nsd_type *nsd)
+{
+	query_state_type r;
+	NSD_PROBE2(query__start, q, buffer_limit(q->packet));
+	r = query_process_packet(q, nsd);
+	NSD_PROBE3(query__done, q, r,
+		r == QUERY_DISCARDED ? -1 : (int)RCODE(q->packet));
+	return r;
+}
+
+long
+query_tcp_idle_msec(struct nsd *nsd)
+{
+	int max = nsd->maximum_tcp_count, cur = nsd->current_tcp_count;
+	long msec = (long)nsd->tcp_timeout * 1000;
+	if(max > 1 && cur > max/2) {
+		msec = msec * (max - cur) / (max - max/2);
+		if(msec < TCP_TIMEOUT_MIN_MSEC)
+			msec = TCP_TIMEOUT_MIN_MSEC;
+	}
+	return msec;
+}
+
+/*
+ * The options of the OPT record of the answer, with a cookie or the
+ * edns-tcp-keepalive timeout, that is in units of 100 msec.
+ */
+static void
+query_add_edns_options(query_type *q, nsd_type *nsd, struct edns_data *edns)
+{
+	int nsid = (nsd->nsid_len > 0 && q->edns.nsid == 1 &&
+		!query_overflow_nsid(q, nsd->nsid_len));
+	size_t rdlen = 0;
+	long timeout = 0;
+	if (nsid)
+		rdlen += OPT_HDR + nsd->nsid_len;
+	if (q->edns.cookie_status != COOKIE_NOT_PRESENT) {
+		query_cookie(nsd, q, 1);
+		rdlen += OPT_HDR + q->edns.cookie_len;
+	}
+	if (q->edns.keepalive) {
+		timeout = query_tcp_idle_msec(nsd) / 100;
+		if (timeout > 0xffff)
+			timeout = 0xffff;
+		rdlen += OPT_HDR + KEEPALIVE_LEN;
+	}
+	buffer_write_u16(q->packet, rdlen);
+	if (nsid) {
+		buffer_write(q->packet, edns->nsid, OPT_HDR);
+		buffer_write(q->packet, nsd->nsid, nsd->nsid_len);
+	}
+	if (q->edns.cookie_status != COOKIE_NOT_PRESENT) {
+		buffer_write_u16(q->packet, COOKIE_CODE);
+		buffer_write_u16(q->packet, q->edns.cookie_len);
+		buffer_write(q->packet, q->edns.cookie, q->edns.cookie_len);
+	}
+	if (q->edns.keepalive) {
+		buffer_write_u16(q->packet, KEEPALIVE_CODE);
+		buffer_write_u16(q->packet, KEEPALIVE_LEN);
+		buffer_write_u16(q->packet, (uint16_t)timeout);
+	}
+}
+
 void
 query_add_optional(query_type *q, nsd_type *nsd)
 {
@@ -1430,7 +1911,11 @@ query_add_optional(query_type *q, nsd_type *nsd)
 		if (q->edns.dnssec_ok)	edns->ok[7] = 0x80;
 		else			edns->ok[7] = 0x00;
 		buffer_write(q->packet, edns->ok, OPT_LEN);
-		if (nsd->nsid_len > 0 && q->edns.nsid == 1 &&
+		if (q->edns.cookie_status != COOKIE_NOT_PRESENT ||
+			q->edns.keepalive) {
+			/* the space of the cookie and keepalive is reserved */
+			query_add_edns_options(q, nsd, edns);
+		} else if (nsd->nsid_len > 0 && q->edns.nsid == 1 &&
 				!query_overflow_nsid(q, nsd->nsid_len)) {
 			/* rdata length */
 			buffer_write(q->packet, edns->rdata_nsid, OPT_RDATA);
@@ -1478,3 +1963,71 @@ query_add_optional(query_type *q, nsd_type *nsd)
 		}
 	}
 }
+
+#ifdef BIND8_STATS
+int
+query_latency_bucket(uint64_t nsec)
+{
+	int e = 0, b;
+	if(nsec < 512)
+		return 0;
+	while((nsec>>e) > 1)
+		e++;
+	/* two buckets per power of two from 2^9, split on the next bit */
+	b = 1 + (e-9)*2 + (int)((nsec>>(e-1))&1);
+	if(b >= LATENCY_BUCKETS)
+		return LATENCY_BUCKETS-1;
+	return b;
+}
+
+uint64_t
+query_latency_bucket_start(int b)
+{
+	int e;
+	if(b <= 0)
+		return 0;
+	e = 9 + (b-1)/2;
+	return ((uint64_t)1<<e) + ((b-1)%2)*((uint64_t)1<<(e-1));
+}
+
+int
+query_latency_class(query_type* q)
+{
+	int rcode = RCODE(q->packet);
+	if(OPCODE(q->packet) != OPCODE_QUERY || q->qclass == CLASS_CH)
+		return LATENCY_OTHER;
+	if(q->qtype == TYPE_AXFR || q->qtype == TYPE_IXFR)
+		return rcode == RCODE_OK?LATENCY_AXFR:LATENCY_OTHER;
+	if(rcode == RCODE_OK && ANCOUNT(q->packet) > 0)
+		return LATENCY_POSITIVE;
+	if(rcode == RCODE_OK && !AA(q->packet) && NSCOUNT(q->packet) > 0)
+		return LATENCY_REFERRAL;
+	if(rcode != RCODE_OK && rcode != RCODE_NXDOMAIN)
+		return LATENCY_OTHER;
+#ifdef NSEC3
+	if(q->edns.dnssec_ok && q->zone && q->zone->nsec3_param)
+		return LATENCY_NSEC3;
+#endif
+	return rcode == RCODE_OK?LATENCY_NODATA:LATENCY_NXDOMAIN;
+}
+
+void
+query_latency(struct nsd* nsd, query_type* q, uint64_t now)
+{
+	/* a stage that did not happen takes no time */
+	uint64_t parse = q->lat_parse?q->lat_parse:now;
+	uint64_t lookup = q->lat_lookup?q->lat_lookup:parse;
+	int c = query_latency_class(q), t = (q->tcp?1:0);
+	if(now < q->lat_start)
+		now = q->lat_start;
+	if(parse < q->lat_start)
+		parse = q->lat_start;
+	if(lookup < parse)
+		lookup = parse;
+	nsd->st.latency[c][t][query_latency_bucket(now - q->lat_start)]++;
+	nsd->st.latency_nsec[c][t][LATENCY_PARSE] += parse - q->lat_start;
+	nsd->st.latency_nsec[c][t][LATENCY_LOOKUP] += lookup - parse;
+	nsd->st.latency_nsec[c][t][LATENCY_ENCODE] += now - lookup;
+	q->lat_start = 0;
+}
+#endif /* BIND8_STATS */
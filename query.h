@@ -25,11 +25,38 @@ enum query_state {
 };
 typedef enum query_state query_state_type;
 
+/*
+ * Size of the arena of a query, the region that is bump allocated for
+ * the query name, the expanded wildcard domains and the synthesized
+ * CNAMEs of an answer.  It holds a wildcard domain for all MAXRRSPP
+ * rrsets of an answer, and the names.  The pages that are not used are
+ * not touched, so most of it costs address space and no memory.
+ */
+#define QUERY_ARENA_SIZE (MAXRRSPP * sizeof(domain_type) + 65536)
+
+/*
+ * Number of slots in the dname compression table of a query, a power of
+ * two that is twice MAX_COMPRESSED_DNAMES, so that the lookups stay short.
+ */
+#define COMPRESSION_TABLE_BITS 12
+#define COMPRESSION_TABLE_SIZE (1 << COMPRESSION_TABLE_BITS)
+
+/* A slot in the dname compression table, offset 0 is an empty slot */
+struct compressed_dname {
+	uint32_t number;
+	uint16_t offset;
+};
+
+/* The slot to start the lookup of a domain number in the table */
+#define COMPRESSION_TABLE_HASH(number) \
+	((((uint32_t)(number)) * 2654435761U) >> (32 - COMPRESSION_TABLE_BITS))
+
 /* Query as we pass it around */
 typedef struct query query_type;
 struct query {
 	/*
-	 * Memory region freed whenever the query is reset.
+	 * Memory region freed whenever the query is reset, allocations
+	 * are in one chunk of QUERY_ARENA_SIZE.
 	 */
 	region_type *region;
 
@@ -66,8 +93,17 @@ struct query {
 
 	buffer_type *packet;
 
-	/* Normalized query domain name.  */
+	/*
+	 * Normalized query domain name, in qname_buf.  The radname of the
+	 * name, for the lookup in the radix tree, is at the end of
+	 * qname_key, from qname_radkey on.
+	 */
 	const dname_type *qname;
+	uint8_t qname_buf[sizeof(dname_type) + MAXDOMAINLEN/2 + 1 +
+		MAXDOMAINLEN];
+	uint8_t qname_key[MAXDOMAINLEN];
+	const uint8_t *qname_radkey;
+	radstrlen_t qname_radlen;
 
 	/* Query type and class in host byte order.  */
 	uint16_t qtype;
@@ -94,16 +130,20 @@ struct query {
 	 */
 	int cname_count;
 
-	/* Used for dname compression.  */
-	uint16_t     compressed_dname_count;
-	domain_type *compressed_dnames[MAXRRSPP];
+	/* leave out the additional data that is not needed, set from the
+	 * minimal-responses option for the answer */
+	int minimal;
 
-	 /*
-	  * Indexed by domain->number, index 0 is reserved for the
-	  * query name when generated from a wildcard record.
-	  */
-	uint16_t    *compressed_dname_offsets;
-	size_t compressed_dname_offsets_size;
+	/*
+	 * Used for dname compression.  The table is an open addressing
+	 * hash on the domain number, compressed_dnames holds the slots
+	 * that are in use in the order they were filled, so that they can
+	 * be emptied again.  Number 0 is the query name when generated from
+	 * a wildcard record, it is not in the table.
+	 */
+	uint16_t     compressed_dname_count;
+	uint16_t     compressed_dnames[MAX_COMPRESSED_DNAMES];
+	struct compressed_dname compressed_dname_table[COMPRESSION_TABLE_SIZE];
 
 	/* number of temporary domains used for the query */
 	size_t number_temporary_domains;
@@ -117,9 +157,50 @@ struct query {
 	rrset_type  *axfr_current_rrset;
 	uint16_t     axfr_current_rr;
 
+	/*
+	 * Used for IXFR processing, the serial of the client, and the
+	 * stored version and offset in it that is sent next.
+	 */
+	uint32_t     ixfr_serial;
+	int          ixfr_have_serial;
+	struct ixfr_data *ixfr_data;
+	size_t       ixfr_pos;
+
+	/*
+	 * The AXFR stream in the cache, that this AXFR stores (if
+	 * axfr_cache_store) or sends, and the offset that is sent next.
+	 */
+	struct axfrcache_entry *axfr_cache;
+	int          axfr_cache_store;
+	size_t       axfr_cache_pos;
+
+	/*
+	 * With latency-stats, the latency_clock() when the query was
+	 * received, and when the parse and the lookup were done.  0 if
+	 * the query is not timed, or the stage did not happen.
+	 */
+	uint64_t     lat_start;
+	uint64_t     lat_parse;
+	uint64_t     lat_lookup;
+
+	/* the server is in overload and the source is not in
+	 * overload-allow, without a valid cookie the query is shed */
+	int          shed;
+
 #ifdef RATELIMIT
 	/* if we encountered a wildcard, its domain */
 	domain_type *wildcard_domain;
+#endif
+	/* the wildcard answer cache key of the query name, the wildcard,
+	 * its zone and the covering denial; and if the answer is
+	 * synthesized from that wildcard */
+	domain_type *wildcard_key;
+	zone_type   *wildcard_zone;
+	domain_type *wildcard_cover;
+	int          wildcard_synth;
+#ifdef USE_DNSTAP
+	/* the query is logged with dnstap, the answer is logged too */
+	int dnstap;
 #endif
 };
 
@@ -142,7 +223,16 @@ void query_put_dname_offset(struct query *query,
 static inline
 uint16_t query_get_dname_offset(struct query *query, domain_type *domain)
 {
-	return query->compressed_dname_offsets[domain->number];
+	uint32_t number = (uint32_t)domain->number;
+	size_t i = COMPRESSION_TABLE_HASH(number);
+	if (number == 0)
+		return QHEADERSZ;
+	while (query->compressed_dname_table[i].offset != 0) {
+		if (query->compressed_dname_table[i].number == number)
+			return query->compressed_dname_table[i].offset;
+		i = (i + 1) & (COMPRESSION_TABLE_SIZE - 1);
+	}
+	return 0;
 }
 
 /*
@@ -170,9 +260,7 @@ void query_add_compression_domain(struct query *query,
 /*
  * Create a new query structure.
  */
-query_type *query_create(region_type *region,
-			 uint16_t *compressed_dname_offsets,
-			 size_t compressed_dname_size);
+query_type *query_create(region_type *region);
 
 /*
  * Reset a query structure so it is ready for receiving and processing
@@ -204,6 +292,34 @@ void query_add_optional(query_type *q, nsd_type *nsd);
  */
 query_state_type query_error(query_type *q, nsd_rc_type rcode);
 
+#ifdef BIND8_STATS
+/*
+ * Latency statistics, with latency-stats.  The histogram bucket of a
+ * latency in nsec: 0 below 512 nsec, then two buckets for every power
+ * of two, the last bucket holds everything larger.
+ */
+int query_latency_bucket(uint64_t nsec);
+/* the smallest latency in nsec that falls in the bucket */
+uint64_t query_latency_bucket_start(int b);
+/* the LATENCY_ answer class of the answered query */
+int query_latency_class(query_type *q);
+/*
+ * Account the latency of the query that was received at q->lat_start,
+ * now is the latency_clock() when the answer was sent.
+ */
+void query_latency(struct nsd *nsd, query_type *q, uint64_t now);
+#endif /* BIND8_STATS */
+
+/* The shortest idle timeout, in msec, when the connections are full */
+#define TCP_TIMEOUT_MIN_MSEC 200
+/*
+ * The idle timeout of a TCP connection in msec.  When more than half of
+ * the connections are in use, it shrinks with the free connections, to
+ * TCP_TIMEOUT_MIN_MSEC when they are all in use.  It is advertised with
+ * edns-tcp-keepalive.
+ */
+long query_tcp_idle_msec(struct nsd *nsd);
+
 static inline int
 query_overflow(query_type *q)
 {
@@ -0,0 +1,460 @@
+/*
+ * radrcu.c -- radix tree for binary strings with lock free readers.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * The readers follow the edges from the root without a lock.  A node is
+ * never changed once it is in the tree: the writer copies the nodes on
+ * the path from the root to the change, and swaps the root pointer, the
+ * readers see the old tree or the new one.  The old nodes are kept on a
+ * list with the epoch of the change.  A reader stores the epoch in its
+ * slot when it enters, and a node is freed when every reader in the tree
+ * entered after the node was replaced.
+ *
+ * The root store and the load of the reader slots by the writer, and the
+ * slot store and the root load by the reader, are sequentially
+ * consistent, so that a reader that the writer does not see in its slot
+ * sees the new root.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "radrcu.h"
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#define rcu_load(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define rcu_store(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#else
+/* without the atomic builtins, use it from one thread only */
+#define rcu_load(p) (*(p))
+#define rcu_store(p, v) (*(p) = (v))
+#endif
+
+/** a node on the path of a change, with its copy */
+struct radrcu_path {
+	/** the node in the tree */
+	struct radrcu_node* node;
+	/** the edge that the path takes to the next node */
+	unsigned idx;
+	/** the copy of the node, or NULL */
+	struct radrcu_node* fresh;
+};
+
+struct radrcu_tree*
+radrcu_tree_create(size_t num_readers)
+{
+	struct radrcu_tree* rt = (struct radrcu_tree*)calloc(1, sizeof(*rt));
+	if(!rt)
+		return NULL;
+	rt->root = (struct radrcu_node*)calloc(1, sizeof(*rt->root));
+	rt->readers = (struct radrcu_reader*)calloc(
+		num_readers?num_readers:1, sizeof(*rt->readers));
+	if(!rt->root || !rt->readers) {
+		free(rt->root);
+		free(rt->readers);
+		free(rt);
+		return NULL;
+	}
+	rt->num_readers = num_readers;
+	rt->epoch = 1;
+	return rt;
+}
+
+/** free the node and the nodes below it */
+static void
+radrcu_del_postorder(struct radrcu_node* n)
+{
+	unsigned i;
+	for(i=0; i<n->len; i++)
+		radrcu_del_postorder(n->edge[i].node);
+	free(n);
+}
+
+void
+radrcu_tree_delete(struct radrcu_tree* rt)
+{
+	struct radrcu_node* n, *next;
+	if(!rt)
+		return;
+	radrcu_del_postorder(rt->root);
+	for(n = rt->retired; n; n = next) {
+		next = n->retired_next;
+		free(n);
+	}
+	free(rt->readers);
+	free(rt);
+}
+
+void
+radrcu_read_lock(struct radrcu_tree* rt, size_t reader)
+{
+	rcu_store(&rt->readers[reader].epoch, rcu_load(&rt->epoch));
+}
+
+void
+radrcu_read_unlock(struct radrcu_tree* rt, size_t reader)
+{
+	rcu_store(&rt->readers[reader].epoch, (uint64_t)0);
+}
+
+/** the index of the edge for the byte, or where it would be inserted */
+static unsigned
+radrcu_edge_find(struct radrcu_node* n, uint8_t byte, int* found)
+{
+	unsigned lo = 0, hi = n->len, mid;
+	while(lo < hi) {
+		mid = (lo+hi)/2;
+		if(n->edge[mid].byte < byte)
+			lo = mid+1;
+		else	hi = mid;
+	}
+	*found = (lo < n->len && n->edge[lo].byte == byte);
+	return lo;
+}
+
+/** number of bytes in common for the two strings */
+static radstrlen_t
+radrcu_common(const uint8_t* x, radstrlen_t xlen, const uint8_t* y,
+	radstrlen_t ylen)
+{
+	radstrlen_t i, max = ((xlen<ylen)?xlen:ylen);
+	for(i=0; i<max; i++) {
+		if(x[i] != y[i])
+			return i;
+	}
+	return max;
+}
+
+static void
+radrcu_edge_set(struct radrcu_edge* e, uint8_t byte, const uint8_t* str,
+	size_t len, struct radrcu_node* node)
+{
+	e->byte = byte;
+	e->str = (uint8_t*)str;
+	e->len = (radstrlen_t)len;
+	e->node = node;
+}
+
+/**
+ * Make a node with the element and the edges of a, m and b, in that
+ * order.  The strings of the edges are copied into the node.
+ * @return the node or NULL on alloc failure.
+ */
+static struct radrcu_node*
+radrcu_node_build(void* elem, struct radrcu_edge* a, unsigned an,
+	struct radrcu_edge* m, unsigned mn, struct radrcu_edge* b, unsigned bn)
+{
+	struct radrcu_edge* from[3];
+	unsigned num[3], i, j, k = 0;
+	size_t strs = 0;
+	struct radrcu_node* n;
+	uint8_t* s;
+	from[0] = a; num[0] = an;
+	from[1] = m; num[1] = mn;
+	from[2] = b; num[2] = bn;
+	for(j=0; j<3; j++)
+		for(i=0; i<num[j]; i++)
+			strs += from[j][i].len;
+	n = (struct radrcu_node*)malloc(sizeof(*n) + (an+mn+bn)*
+		sizeof(struct radrcu_edge) + strs);
+	if(!n)
+		return NULL;
+	n->elem = elem;
+	n->len = (uint16_t)(an+mn+bn);
+	n->edge = (struct radrcu_edge*)(n+1);
+	n->retired_epoch = 0;
+	n->retired_next = NULL;
+	s = (uint8_t*)(n->edge + n->len);
+	for(j=0; j<3; j++) {
+		for(i=0; i<num[j]; i++) {
+			struct radrcu_edge* e = &from[j][i];
+			if(e->len)
+				memcpy(s, e->str, e->len);
+			radrcu_edge_set(&n->edge[k++], e->byte, s, e->len,
+				e->node);
+			s += e->len;
+		}
+	}
+	return n;
+}
+
+/** put the replaced node on the list, with the epoch of the change */
+static void
+radrcu_retire(struct radrcu_tree* rt, struct radrcu_node* n)
+{
+	n->retired_epoch = rt->epoch;
+	n->retired_next = rt->retired;
+	rt->retired = n;
+	rt->retired_count++;
+}
+
+/**
+ * Copy the path up to the root, c is the copy of the last node, at
+ * path[depth], and publish the new root.  With merge, a copy without an
+ * element and without edges is removed from its parent, and with one
+ * edge it is merged into the edge of its parent.
+ * @return false on alloc failure, nothing is changed.
+ */
+static int
+radrcu_path_copy(struct radrcu_tree* rt, struct radrcu_path* path,
+	unsigned depth, struct radrcu_node* c, int merge)
+{
+	unsigned d = depth, i;
+	path[d].fresh = c;
+	while(d > 0) {
+		struct radrcu_node* p = path[d-1].node, *np;
+		struct radrcu_edge e, *pe;
+		uint8_t* tmp;
+		size_t l;
+		i = path[d-1].idx;
+		pe = &p->edge[i];
+		if(merge && !c->elem && c->len == 0) {
+			np = radrcu_node_build(p->elem, p->edge, i, NULL, 0,
+				p->edge+i+1, p->len-i-1);
+		} else if(merge && !c->elem && c->len == 1) {
+			l = (size_t)pe->len + 1 + c->edge[0].len;
+			np = NULL;
+			if((tmp = (uint8_t*)malloc(l))) {
+				memcpy(tmp, pe->str, pe->len);
+				tmp[pe->len] = c->edge[0].byte;
+				memcpy(tmp+pe->len+1, c->edge[0].str,
+					c->edge[0].len);
+				radrcu_edge_set(&e, pe->byte, tmp, l,
+					c->edge[0].node);
+				np = radrcu_node_build(p->elem, p->edge, i,
+					&e, 1, p->edge+i+1, p->len-i-1);
+				free(tmp);
+			}
+		} else {
+			radrcu_edge_set(&e, pe->byte, pe->str, pe->len, c);
+			np = radrcu_node_build(p->elem, p->edge, i, &e, 1,
+				p->edge+i+1, p->len-i-1);
+		}
+		if(!np) {
+			for(i=d; i<=depth; i++)
+				free(path[i].fresh);
+			return 0;
+		}
+		if(np->len != p->len || np->edge[i].node != c) {
+			/* c is removed or merged, it was never published */
+			free(c);
+			path[d].fresh = NULL;
+		}
+		d--;
+		path[d].fresh = np;
+		c = np;
+	}
+	/* the readers that enter from now on see the new tree */
+	rcu_store(&rt->root, c);
+	for(d=0; d<=depth; d++)
+		radrcu_retire(rt, path[d].node);
+	rcu_store(&rt->epoch, rt->epoch+1);
+	return 1;
+}
+
+void*
+radrcu_search(struct radrcu_tree* rt, const uint8_t* k, radstrlen_t len)
+{
+	struct radrcu_node* n = rcu_load(&rt->root);
+	struct radrcu_edge* e;
+	radstrlen_t pos = 0;
+	unsigned i;
+	int found;
+	while(pos < len) {
+		i = radrcu_edge_find(n, k[pos], &found);
+		if(!found)
+			return NULL;
+		e = &n->edge[i];
+		if(e->len > len-pos-1 || memcmp(e->str, k+pos+1, e->len) != 0)
+			return NULL;
+		pos += 1+e->len;
+		n = e->node;
+	}
+	return n->elem;
+}
+
+int
+radrcu_insert(struct radrcu_tree* rt, const uint8_t* k, radstrlen_t len,
+	void* elem)
+{
+	struct radrcu_node* n = rt->root, *c = NULL, *leaf = NULL, *mid = NULL;
+	struct radrcu_path* path;
+	struct radrcu_edge e[2], *ne;
+	unsigned depth = 0, i;
+	radstrlen_t pos = 0, common;
+	int found;
+
+	if(!elem)
+		return 0;
+	path = (struct radrcu_path*)malloc(sizeof(*path)*((size_t)len+1));
+	if(!path)
+		return 0;
+	while(1) {
+		path[depth].node = n;
+		if(pos == len) {
+			if(n->elem) {
+				/* duplicate */
+				free(path);
+				return 0;
+			}
+			c = radrcu_node_build(elem, n->edge, n->len, NULL, 0,
+				NULL, 0);
+			break;
+		}
+		i = radrcu_edge_find(n, k[pos], &found);
+		if(!found) {
+			if(!(leaf = radrcu_node_build(elem, NULL, 0, NULL, 0,
+				NULL, 0)))
+				break;
+			radrcu_edge_set(&e[0], k[pos], k+pos+1, len-pos-1, leaf);
+			c = radrcu_node_build(n->elem, n->edge, i, e, 1,
+				n->edge+i, n->len-i);
+			break;
+		}
+		ne = &n->edge[i];
+		common = radrcu_common(ne->str, ne->len, k+pos+1, len-pos-1);
+		if(common == ne->len) {
+			path[depth++].idx = i;
+			pos += 1+common;
+			n = ne->node;
+			continue;
+		}
+		/* split the edge, the middle node has the common part */
+		radrcu_edge_set(&e[0], ne->str[common], ne->str+common+1,
+			ne->len-common-1, ne->node);
+		if(pos+1+common == len) {
+			mid = radrcu_node_build(elem, e, 1, NULL, 0, NULL, 0);
+		} else {
+			if(!(leaf = radrcu_node_build(elem, NULL, 0, NULL, 0,
+				NULL, 0)))
+				break;
+			radrcu_edge_set(&e[1], k[pos+1+common],
+				k+pos+2+common, len-pos-2-common, leaf);
+			if(e[1].byte < e[0].byte)
+				mid = radrcu_node_build(NULL, e+1, 1, e, 1,
+					NULL, 0);
+			else	mid = radrcu_node_build(NULL, e, 2, NULL, 0,
+					NULL, 0);
+		}
+		if(!mid)
+			break;
+		radrcu_edge_set(&e[0], ne->byte, ne->str, common, mid);
+		c = radrcu_node_build(n->elem, n->edge, i, e, 1, n->edge+i+1,
+			n->len-i-1);
+		break;
+	}
+	/* path_copy frees c on failure */
+	if(!c || !radrcu_path_copy(rt, path, depth, c, 0)) {
+		free(mid);
+		free(leaf);
+		free(path);
+		return 0;
+	}
+	rt->count++;
+	free(path);
+	return 1;
+}
+
+void*
+radrcu_remove(struct radrcu_tree* rt, const uint8_t* k, radstrlen_t len)
+{
+	struct radrcu_node* n = rt->root, *c;
+	struct radrcu_path* path;
+	struct radrcu_edge* e;
+	unsigned depth = 0, i;
+	radstrlen_t pos = 0;
+	int found;
+	void* elem;
+
+	path = (struct radrcu_path*)malloc(sizeof(*path)*((size_t)len+1));
+	if(!path)
+		return NULL;
+	while(1) {
+		path[depth].node = n;
+		if(pos == len)
+			break;
+		i = radrcu_edge_find(n, k[pos], &found);
+		e = &n->edge[i];
+		if(!found || e->len > len-pos-1 ||
+			memcmp(e->str, k+pos+1, e->len) != 0) {
+			free(path);
+			return NULL;
+		}
+		path[depth++].idx = i;
+		pos += 1+e->len;
+		n = e->node;
+	}
+	if(!(elem = n->elem) || !(c = radrcu_node_build(NULL, n->edge,
+		n->len, NULL, 0, NULL, 0))) {
+		free(path);
+		return NULL;
+	}
+	/* path_copy frees c on failure */
+	if(!radrcu_path_copy(rt, path, depth, c, 1)) {
+		free(path);
+		return NULL;
+	}
+	rt->count--;
+	free(path);
+	return elem;
+}
+
+size_t
+radrcu_reclaim(struct radrcu_tree* rt)
+{
+	uint64_t min = (uint64_t)-1, epoch;
+	struct radrcu_node** p, *n, *next;
+	size_t i;
+	for(i=0; i<rt->num_readers; i++) {
+		epoch = rcu_load(&rt->readers[i].epoch);
+		if(epoch != 0 && epoch < min)
+			min = epoch;
+	}
+	/* the list is newest first, the epochs go down */
+	for(p = &rt->retired; *p && (*p)->retired_epoch >= min;
+		p = &(*p)->retired_next)
+		;
+	for(n = *p; n; n = next) {
+		next = n->retired_next;
+		free(n);
+		rt->retired_count--;
+	}
+	*p = NULL;
+	return rt->retired_count;
+}
+
+void*
+radrcu_name_search(struct radrcu_tree* rt, const uint8_t* d, size_t max)
+{
+	uint8_t radname[300];
+	radstrlen_t len = (radstrlen_t)sizeof(radname);
+	if(max > sizeof(radname))
+		return NULL; /* too long */
+	radname_d2r(radname, &len, d, max);
+	return radrcu_search(rt, radname, len);
+}
+
+int
+radrcu_name_insert(struct radrcu_tree* rt, const uint8_t* d, size_t max,
+	void* elem)
+{
+	uint8_t radname[300];
+	radstrlen_t len = (radstrlen_t)sizeof(radname);
+	if(max > sizeof(radname))
+		return 0; /* too long */
+	radname_d2r(radname, &len, d, max);
+	return radrcu_insert(rt, radname, len, elem);
+}
+
+void*
+radrcu_name_remove(struct radrcu_tree* rt, const uint8_t* d, size_t max)
+{
+	uint8_t radname[300];
+	radstrlen_t len = (radstrlen_t)sizeof(radname);
+	if(max > sizeof(radname))
+		return NULL; /* too long */
+	radname_d2r(radname, &len, d, max);
+	return radrcu_remove(rt, radname, len);
+}
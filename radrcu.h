@@ -0,0 +1,159 @@
+/*
+ * radrcu -- radix tree for binary strings with lock free readers.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+#ifndef RADRCU_H
+#define RADRCU_H
+#include "radtree.h"
+
+/**
+ * A node of the tree.  A node is not changed after it is published; the
+ * writer makes copies of the nodes on the path of the change and then
+ * swaps the root.  The edges, and their strings, are allocated with the
+ * node, in one block.
+ */
+struct radrcu_node {
+	/** the element of the key up to this node, or NULL */
+	void* elem;
+	/** the edges, sorted by byte */
+	struct radrcu_edge* edge;
+	/** number of edges */
+	uint16_t len;
+	/** epoch when the node was replaced, for the writer */
+	uint64_t retired_epoch;
+	/** next in the list of replaced nodes, for the writer */
+	struct radrcu_node* retired_next;
+};
+
+/** an edge to a child node, for the byte and the string after it */
+struct radrcu_edge {
+	/** the child node */
+	struct radrcu_node* node;
+	/** the additional string after the byte */
+	uint8_t* str;
+	/** length of str */
+	radstrlen_t len;
+	/** the byte that selects the edge */
+	uint8_t byte;
+};
+
+/**
+ * The slot of a reader thread, on a cache line of its own.  The epoch is
+ * 0 when the reader is outside the tree.
+ */
+struct radrcu_reader {
+	uint64_t epoch;
+	uint8_t pad[64 - sizeof(uint64_t)];
+};
+
+/**
+ * The tree.  Any number of reader threads search it without a lock, with
+ * radrcu_read_lock and unlock around the searches and the use of the
+ * elements.  One writer at a time changes it, the caller serializes the
+ * writers.  The nodes a change replaces are freed by radrcu_reclaim
+ * after a grace period, when every reader that could see them has left.
+ */
+struct radrcu_tree {
+	/** the root node, it is always there, also for an empty tree */
+	struct radrcu_node* root;
+	/** number of elements */
+	size_t count;
+	/** the epoch, it goes up with every change */
+	uint64_t epoch;
+	/** the replaced nodes, the oldest last */
+	struct radrcu_node* retired;
+	/** number of replaced nodes that are not freed */
+	size_t retired_count;
+	/** the reader slots */
+	struct radrcu_reader* readers;
+	size_t num_readers;
+};
+
+/**
+ * Create a new tree.
+ * @param num_readers: the number of reader slots.
+ * @return new tree or NULL on alloc failure.
+ */
+struct radrcu_tree* radrcu_tree_create(size_t num_readers);
+
+/**
+ * Delete the tree, with the replaced nodes.  There must be no readers.
+ * The elements are not freed.
+ * @param rt: the tree.
+ */
+void radrcu_tree_delete(struct radrcu_tree* rt);
+
+/**
+ * Enter the tree, before searches, in a reader thread.  The nodes that
+ * are reachable stay, until radrcu_read_unlock.
+ * @param rt: the tree.
+ * @param reader: the slot of the thread, smaller than num_readers.
+ */
+void radrcu_read_lock(struct radrcu_tree* rt, size_t reader);
+
+/**
+ * Leave the tree, after the searches.
+ * @param rt: the tree.
+ * @param reader: the slot of the thread.
+ */
+void radrcu_read_unlock(struct radrcu_tree* rt, size_t reader);
+
+/**
+ * Find element in tree, by a reader or the writer.
+ * @param rt: the tree.
+ * @param k: key string.
+ * @param len: length of key.
+ * @return the element or NULL if not found.
+ */
+void* radrcu_search(struct radrcu_tree* rt, const uint8_t* k,
+	radstrlen_t len);
+
+/**
+ * Insert element in the tree, by the writer.  The readers see it after
+ * the return.
+ * @param rt: the tree.
+ * @param k: key string.
+ * @param len: length of key.
+ * @param elem: the element, not NULL.
+ * @return false on alloc failure or duplicate entry.
+ */
+int radrcu_insert(struct radrcu_tree* rt, const uint8_t* k, radstrlen_t len,
+	void* elem);
+
+/**
+ * Remove element from the tree, by the writer.  Readers can still use
+ * it until a grace period has passed, see radrcu_reclaim.
+ * @param rt: the tree.
+ * @param k: key string.
+ * @param len: length of key.
+ * @return the element that is removed, or NULL if not found or on alloc
+ *	failure.
+ */
+void* radrcu_remove(struct radrcu_tree* rt, const uint8_t* k,
+	radstrlen_t len);
+
+/**
+ * Free the replaced nodes that no reader can see anymore, by the writer.
+ * Does not wait for readers.
+ * @param rt: the tree.
+ * @return the number of replaced nodes that are not freed yet.
+ */
+size_t radrcu_reclaim(struct radrcu_tree* rt);
+
+/** radrcu_search with a domain name, no compression pointers */
+void* radrcu_name_search(struct radrcu_tree* rt, const uint8_t* d,
+	size_t max);
+
+/** radrcu_insert with a domain name, false on parse error */
+int radrcu_name_insert(struct radrcu_tree* rt, const uint8_t* d, size_t max,
+	void* elem);
+
+/** radrcu_remove with a domain name */
+void* radrcu_name_remove(struct radrcu_tree* rt, const uint8_t* d,
+	size_t max);
+
+#endif /* RADRCU_H */
@@ -31,6 +31,70 @@ void radix_tree_init(struct radtree* rt)
 	rt->count = 0;
 }
 
+/** make space for an additional string of len bytes in the edge, inline
+ * or allocated.  The old string must have been freed.
+ * returns the storage for the string, or NULL on alloc failure. */
+static uint8_t*
+radsel_str_alloc(struct region* region, struct radsel* r, radstrlen_t len)
+{
+	uint8_t* s;
+	if(len <= RADSEL_INLINE) {
+		r->len = len;
+		return r->str;
+	}
+	s = (uint8_t*)region_alloc(region, sizeof(uint8_t)*len);
+	if(!s)
+		return NULL; /* out of memory */
+	memcpy(r->str, &s, sizeof(s));
+	r->len = len;
+	return s;
+}
+
+/** set the additional string of the edge to a copy of len bytes at s */
+static int
+radsel_str_set(struct region* region, struct radsel* r, uint8_t* s,
+	radstrlen_t len)
+{
+	uint8_t* d = radsel_str_alloc(region, r, len);
+	if(!d)
+		return 0; /* out of memory */
+	memmove(d, s, len);
+	return 1;
+}
+
+/** free the additional string of the edge, if it was allocated */
+static void
+radsel_str_free(struct region* region, struct radsel* r)
+{
+	if(r->len > RADSEL_INLINE)
+		region_recycle(region, radsel_str(r), r->len);
+	r->len = 0;
+}
+
+/** point the edge to node n, with a copy of the lookup array of n */
+static void
+radsel_set_node(struct radsel* r, struct radnode* n)
+{
+	r->node = n;
+	if(n) {
+		r->node_array = n->array;
+		r->node_offset = n->offset;
+		r->node_len = n->len;
+	} else {
+		r->node_array = NULL;
+		r->node_offset = 0;
+		r->node_len = 0;
+	}
+}
+
+/** the lookup array of n has changed, update the copy in the parent */
+static void
+radnode_array_changed(struct radnode* n)
+{
+	if(n->parent)
+		radsel_set_node(&n->parent->array[n->pidx], n);
+}
+
 /** delete radnodes in postorder recursion */
 static void radnode_del_postorder(struct region* region, struct radnode* n)
 {
@@ -38,7 +102,7 @@ static void radnode_del_postorder(struct region* region, struct radnode* n)
 	if(!n) return;
 	for(i=0; i<n->len; i++) {
 		radnode_del_postorder(region, n->array[i].node);
-		region_recycle(region, n->array[i].str, n->array[i].len);
+		radsel_str_free(region, &n->array[i]);
 	}
 	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
 	region_recycle(region, n, sizeof(*n));
@@ -136,13 +200,12 @@ radnode_find_prev_from_idx(struct radnode* n, unsigned from)
  * 	exact match has been found.  If == 0 then a "" match was found.
  * @return false if no prefix found, not even the root "" prefix.
  */
-static int radix_find_prefix_node(struct radtree* rt, uint8_t* k,
-	radstrlen_t len, struct radnode** result, radstrlen_t* respos)
+static int radix_find_prefix_node(struct radnode* n, radstrlen_t pos,
+	uint8_t* k, radstrlen_t len, struct radnode** result,
+	radstrlen_t* respos)
 {
-	struct radnode* n = rt->root;
-	radstrlen_t pos = 0;
 	uint8_t byte;
-	*respos = 0;
+	*respos = pos;
 	*result = n;
 	if(!n) return 0;
 	while(n) {
@@ -163,7 +226,7 @@ static int radix_find_prefix_node(struct radtree* rt, uint8_t* k,
 			if(pos+n->array[byte].len > len) {
 				return 1;
 			}
-			if(memcmp(&k[pos], n->array[byte].str,
+			if(memcmp(&k[pos], radsel_str(&n->array[byte]),
 				n->array[byte].len) != 0) {
 				return 1;
 			}
@@ -254,6 +317,7 @@ radnode_array_space(struct region* region, struct radnode* n, uint8_t byte)
 		/* grow length */
 		n->len += need;
 	}
+	radnode_array_changed(n);
 	return 1;
 }
 
@@ -262,12 +326,7 @@ static int
 radsel_str_create(struct region* region, struct radsel* r, uint8_t* k,
 	radstrlen_t pos, radstrlen_t len)
 {
-	r->str = (uint8_t*)region_alloc(region, sizeof(uint8_t)*(len-pos));
-	if(!r->str)
-		return 0; /* out of memory */
-	memmove(r->str, k+pos, len-pos);
-	r->len = len-pos;
-	return 1;
+	return radsel_str_set(region, r, k+pos, len-pos);
 }
 
 /** see if one byte string p is a prefix of another x (equality is true) */
@@ -309,18 +368,13 @@ bstr_common_ext(uint8_t* x, radstrlen_t xlen, uint8_t* y, radstrlen_t ylen)
 }
 
 /** allocate remainder from prefixes for a split:
- * plen: len prefix, l: longer bstring, llen: length of l. */
+ * plen: len prefix, l: longer bstring, llen: length of l,
+ * s: the edge that gets the string. */
 static int
 radsel_prefix_remainder(struct region* region, radstrlen_t plen,
-	uint8_t* l, radstrlen_t llen,
-	uint8_t** s, radstrlen_t* slen)
+	uint8_t* l, radstrlen_t llen, struct radsel* s)
 {
-	*slen = llen - plen;
-	*s = (uint8_t*)region_alloc(region, (*slen)*sizeof(uint8_t));
-	if(!*s)
-		return 0;
-	memmove(*s, l+plen, llen-plen);
-	return 1;
+	return radsel_str_set(region, s, l+plen, llen-plen);
 }
 
 /** radsel create a split when two nodes have shared prefix.
@@ -338,9 +392,12 @@ radsel_split(struct region* region, struct radsel* r, uint8_t* k,
 {
 	uint8_t* addstr = k+pos;
 	radstrlen_t addlen = len-pos;
-	if(bstr_is_prefix(addstr, addlen, r->str, r->len)) {
-		uint8_t* split_str=NULL, *dupstr=NULL;
-		radstrlen_t split_len=0;
+	/* the string of r, it is changed last */
+	uint8_t* rstr = radsel_str(r);
+	if(bstr_is_prefix(addstr, addlen, rstr, r->len)) {
+		struct radsel split, dup;
+		memset(&split, 0, sizeof(split));
+		memset(&dup, 0, sizeof(dup));
 		/* 'add' is a prefix of r.node */
 		/* also for empty addstr */
 		/* set it up so that the 'add' node has r.node as child */
@@ -351,40 +408,35 @@ radsel_split(struct region* region, struct radsel* r, uint8_t* k,
 		assert(addlen < r->len);
 		if(r->len-addlen > 1) {
 			/* shift one because a char is in the lookup array */
-			if(!radsel_prefix_remainder(region, addlen+1, r->str,
-				r->len, &split_str, &split_len))
+			if(!radsel_prefix_remainder(region, addlen+1, rstr,
+				r->len, &split))
 				return 0;
 		}
 		if(addlen != 0) {
-			dupstr = (uint8_t*)region_alloc(region,
-				addlen*sizeof(uint8_t));
-			if(!dupstr) {
-				region_recycle(region, split_str, split_len);
+			if(!radsel_str_set(region, &dup, addstr, addlen)) {
+				radsel_str_free(region, &split);
 				return 0;
 			}
-			memcpy(dupstr, addstr, addlen);
 		}
-		if(!radnode_array_space(region, add, r->str[addlen])) {
-			region_recycle(region, split_str, split_len);
-			region_recycle(region, dupstr, addlen);
+		if(!radnode_array_space(region, add, rstr[addlen])) {
+			radsel_str_free(region, &split);
+			radsel_str_free(region, &dup);
 			return 0;
 		}
 		/* alloc succeeded, now link it in */
 		add->parent = r->node->parent;
 		add->pidx = r->node->pidx;
-		add->array[0].node = r->node;
-		add->array[0].str = split_str;
-		add->array[0].len = split_len;
+		radsel_set_node(&split, r->node);
+		add->array[0] = split;
 		r->node->parent = add;
 		r->node->pidx = 0;
 
-		r->node = add;
-		region_recycle(region, r->str, r->len);
-		r->str = dupstr;
-		r->len = addlen;
-	} else if(bstr_is_prefix(r->str, r->len, addstr, addlen)) {
-		uint8_t* split_str = NULL;
-		radstrlen_t split_len = 0;
+		radsel_str_free(region, r);
+		radsel_set_node(&dup, add);
+		*r = dup;
+	} else if(bstr_is_prefix(rstr, r->len, addstr, addlen)) {
+		struct radsel split;
+		memset(&split, 0, sizeof(split));
 		/* r.node is a prefix of 'add' */
 		/* set it up so that the 'r.node' has 'add' as child */
 		/* and basically, r.node is already completely fine,
@@ -394,28 +446,30 @@ radsel_split(struct region* region, struct radsel* r, uint8_t* k,
 		if(addlen-r->len > 1) {
 			/* shift one because a character goes into array */
 			if(!radsel_prefix_remainder(region, r->len+1, addstr,
-				addlen, &split_str, &split_len))
+				addlen, &split))
 				return 0;
 		}
 		if(!radnode_array_space(region, r->node, addstr[r->len])) {
-			region_recycle(region, split_str, split_len);
+			radsel_str_free(region, &split);
 			return 0;
 		}
 		/* alloc succeeded, now link it in */
 		add->parent = r->node;
 		add->pidx = addstr[r->len] - r->node->offset;
-		r->node->array[add->pidx].node = add;
-		r->node->array[add->pidx].str = split_str;
-		r->node->array[add->pidx].len = split_len;
+		radsel_set_node(&split, add);
+		r->node->array[add->pidx] = split;
 	} else {
 		/* okay we need to create a new node that chooses between 
 		 * the nodes 'add' and r.node
 		 * We do this so that r.node stays the same pointer for its
 		 * key name. */
 		struct radnode* com;
-		uint8_t* common_str=NULL, *s1_str=NULL, *s2_str=NULL;
-		radstrlen_t common_len, s1_len=0, s2_len=0;
-		common_len = bstr_common(r->str, r->len, addstr, addlen);
+		struct radsel common, s1, s2;
+		radstrlen_t common_len;
+		memset(&common, 0, sizeof(common));
+		memset(&s1, 0, sizeof(s1));
+		memset(&s2, 0, sizeof(s2));
+		common_len = bstr_common(rstr, r->len, addstr, addlen);
 		assert(common_len < r->len);
 		assert(common_len < addlen);
 
@@ -427,41 +481,39 @@ radsel_split(struct region* region, struct radsel* r, uint8_t* k,
 		if(r->len-common_len > 1) {
 			/* shift by one char because it goes in lookup array */
 			if(!radsel_prefix_remainder(region, common_len+1,
-				r->str, r->len, &s1_str, &s1_len)) {
+				rstr, r->len, &s1)) {
 				region_recycle(region, com, sizeof(*com));
 				return 0;
 			}
 		}
 		if(addlen-common_len > 1) {
 			if(!radsel_prefix_remainder(region, common_len+1,
-				addstr, addlen, &s2_str, &s2_len)) {
+				addstr, addlen, &s2)) {
 				region_recycle(region, com, sizeof(*com));
-				region_recycle(region, s1_str, s1_len);
+				radsel_str_free(region, &s1);
 				return 0;
 			}
 		}
 
 		/* create the shared prefix to go in r */
 		if(common_len > 0) {
-			common_str = (uint8_t*)region_alloc(region,
-				common_len*sizeof(uint8_t));
-			if(!common_str) {
+			if(!radsel_str_set(region, &common, addstr,
+				common_len)) {
 				region_recycle(region, com, sizeof(*com));
-				region_recycle(region, s1_str, s1_len);
-				region_recycle(region, s2_str, s2_len);
+				radsel_str_free(region, &s1);
+				radsel_str_free(region, &s2);
 				return 0;
 			}
-			memcpy(common_str, addstr, common_len);
 		}
 
 		/* make space in the common node array */
-		if(!radnode_array_space(region, com, r->str[common_len]) ||
+		if(!radnode_array_space(region, com, rstr[common_len]) ||
 			!radnode_array_space(region, com, addstr[common_len])) {
 			region_recycle(region, com->array, com->capacity*sizeof(struct radsel));
 			region_recycle(region, com, sizeof(*com));
-			region_recycle(region, common_str, common_len);
-			region_recycle(region, s1_str, s1_len);
-			region_recycle(region, s2_str, s2_len);
+			radsel_str_free(region, &common);
+			radsel_str_free(region, &s1);
+			radsel_str_free(region, &s2);
 			return 0;
 		}
 
@@ -469,25 +521,24 @@ radsel_split(struct region* region, struct radsel* r, uint8_t* k,
 		com->parent = r->node->parent;
 		com->pidx = r->node->pidx;
 		r->node->parent = com;
-		r->node->pidx = r->str[common_len]-com->offset;
+		r->node->pidx = rstr[common_len]-com->offset;
 		add->parent = com;
 		add->pidx = addstr[common_len]-com->offset;
-		com->array[r->node->pidx].node = r->node;
-		com->array[r->node->pidx].str = s1_str;
-		com->array[r->node->pidx].len = s1_len;
-		com->array[add->pidx].node = add;
-		com->array[add->pidx].str = s2_str;
-		com->array[add->pidx].len = s2_len;
-		region_recycle(region, r->str, r->len);
-		r->str = common_str;
-		r->len = common_len;
-		r->node = com;
+		radsel_set_node(&s1, r->node);
+		com->array[r->node->pidx] = s1;
+		radsel_set_node(&s2, add);
+		com->array[add->pidx] = s2;
+		radsel_str_free(region, r);
+		radsel_set_node(&common, com);
+		*r = common;
 	}
 	return 1;
 }
 
-struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
-        void* elem)
+/** insert, the search for the place starts at node start, at startpos */
+static struct radnode* radix_insert_from(struct radtree* rt,
+	struct radnode* start, radstrlen_t startpos, uint8_t* k,
+	radstrlen_t len, void* elem)
 {
 	struct radnode* n;
 	radstrlen_t pos = 0;
@@ -498,7 +549,7 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
 	add->elem = elem;
 
 	/* find out where to add it */
-	if(!radix_find_prefix_node(rt, k, len, &n, &pos)) {
+	if(!radix_find_prefix_node(start, startpos, k, len, &n, &pos)) {
 		/* new root */
 		assert(rt->root == NULL);
 		if(len == 0) {
@@ -517,10 +568,10 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
 			}
 			add->parent = n;
 			add->pidx = 0;
-			n->array[0].node = add;
+			radsel_set_node(&n->array[0], add);
 			if(len > 1) {
 				if(!radsel_prefix_remainder(rt->region, 1, k, len,
-					&n->array[0].str, &n->array[0].len)) {
+					&n->array[0])) {
 					region_recycle(rt->region, n->array,
 						n->capacity*sizeof(struct radsel));
 					region_recycle(rt->region, n, sizeof(*n));
@@ -566,7 +617,7 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
 			/* insert the new node in the new bucket */
 			add->parent = n;
 			add->pidx = byte;
-			n->array[byte].node = add;
+			radsel_set_node(&n->array[byte], add);
 		/* so a bucket exists and byte falls in it */
 		} else if(n->array[byte-n->offset].node == NULL) {
 			/* use existing bucket */
@@ -582,7 +633,7 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
 			/* insert the new node in the new bucket */
 			add->parent = n;
 			add->pidx = byte;
-			n->array[byte].node = add;
+			radsel_set_node(&n->array[byte], add);
 		} else {
 			/* use bucket but it has a shared prefix,
 			 * split that out and create a new intermediate
@@ -601,14 +652,153 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
 	return add;
 }
 
+struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
+        void* elem)
+{
+	return radix_insert_from(rt, rt->root, 0, k, len, elem);
+}
+
+struct radnode* radix_insert_below(struct radtree* rt, struct radnode* n,
+	radstrlen_t pos, uint8_t* k, radstrlen_t len, void* elem)
+{
+	assert(n && pos <= len);
+	return radix_insert_from(rt, n, pos, k, len, elem);
+}
+
+static struct radnode* radix_bulk_sub(struct region* region, uint8_t** k,
+	radstrlen_t* l, void** elem, struct radnode** nodes, size_t num,
+	radstrlen_t pos, struct radnode* parent, uint8_t pidx);
+
+/** add the sorted keys, that are longer than pos, below node n, in the
+ * array of n that has space for them, and no edges yet for them */
+static int
+radix_bulk_children(struct region* region, struct radnode* n, uint8_t** k,
+	radstrlen_t* l, void** elem, struct radnode** nodes, size_t num,
+	radstrlen_t pos)
+{
+	size_t i = 0, j;
+	while(i < num) {
+		uint8_t byte = k[i][pos];
+		struct radsel* r = &n->array[byte - n->offset];
+		struct radnode* c;
+		radstrlen_t common;
+		/* the keys that continue with the byte, the bytes they have
+		 * in common are those of the first and the last of them */
+		for(j=i+1; j<num && k[j][pos] == byte; j++)
+			;
+		common = bstr_common(k[i]+pos+1, l[i]-pos-1, k[j-1]+pos+1,
+			l[j-1]-pos-1);
+		if(common > 0 && !radsel_str_set(region, r, k[i]+pos+1,
+			common))
+			return 0;
+		c = radix_bulk_sub(region, k+i, l+i, elem+i, nodes?nodes+i:NULL,
+			j-i, pos+1+common, n, byte - n->offset);
+		if(!c) {
+			radsel_str_free(region, r);
+			return 0;
+		}
+		radsel_set_node(r, c);
+		i = j;
+	}
+	return 1;
+}
+
+/** build the subtree for the sorted keys, that have the first pos bytes
+ * in common, the node is allocated before its children, and the arrays
+ * are exactly as long as needed */
+static struct radnode*
+radix_bulk_sub(struct region* region, uint8_t** k, radstrlen_t* l,
+	void** elem, struct radnode** nodes, size_t num, radstrlen_t pos,
+	struct radnode* parent, uint8_t pidx)
+{
+	struct radnode* n = (struct radnode*)region_alloc_zero(region,
+		sizeof(*n));
+	size_t i = 0;
+	if(!n) return NULL;
+	n->parent = parent;
+	n->pidx = pidx;
+	if(l[0] == pos) {
+		/* the key ends at this node */
+		n->elem = elem[0];
+		if(nodes) nodes[0] = n;
+		i = 1;
+	}
+	if(i == num)
+		return n;
+	n->offset = k[i][pos];
+	n->len = (uint16_t)(k[num-1][pos] - n->offset) + 1;
+	n->capacity = n->len;
+	n->array = (struct radsel*)region_alloc_array(region, n->len,
+		sizeof(struct radsel));
+	if(!n->array) {
+		region_recycle(region, n, sizeof(*n));
+		return NULL;
+	}
+	memset(n->array, 0, n->len*sizeof(struct radsel));
+	if(!radix_bulk_children(region, n, k+i, l+i, elem+i,
+		nodes?nodes+i:NULL, num-i, pos)) {
+		radnode_del_postorder(region, n);
+		return NULL;
+	}
+	return n;
+}
+
+int radix_tree_bulk_load(struct radtree* rt, uint8_t** k, radstrlen_t* len,
+	void** elem, struct radnode** nodes, size_t num)
+{
+	assert(rt->root == NULL && rt->count == 0);
+	if(num == 0)
+		return 1;
+	rt->root = radix_bulk_sub(rt->region, k, len, elem, nodes, num, 0,
+		NULL, 0);
+	if(!rt->root)
+		return 0;
+	rt->count = num;
+	return 1;
+}
+
+int radix_bulk_insert(struct radtree* rt, struct radnode* n, radstrlen_t pos,
+	uint8_t** k, radstrlen_t* len, void** elem, struct radnode** nodes,
+	size_t num)
+{
+	size_t i;
+	if(num == 0)
+		return 1;
+	/* the edges for the keys must be free */
+	for(i=0; i<num; i++) {
+		uint8_t byte = k[i][pos];
+		assert(len[i] > pos);
+		if(byte >= n->offset && byte - n->offset < n->len &&
+			n->array[byte - n->offset].node)
+			return 0;
+		while(i+1 < num && k[i+1][pos] == byte)
+			i++;
+	}
+	if(!radnode_array_space(rt->region, n, k[0][pos]) ||
+		!radnode_array_space(rt->region, n, k[num-1][pos]))
+		return 0;
+	if(!radix_bulk_children(rt->region, n, k, len, elem, nodes, num,
+		pos)) {
+		/* remove the edges that were added, they were free */
+		for(i=0; i<num; i++) {
+			struct radsel* r = &n->array[k[i][pos] - n->offset];
+			radnode_del_postorder(rt->region, r->node);
+			radsel_str_free(rt->region, r);
+			memset(r, 0, sizeof(*r));
+		}
+		return 0;
+	}
+	rt->count += num;
+	return 1;
+}
+
 /** Delete a radnode */
 static void radnode_delete(struct region* region, struct radnode* n)
 {
 	unsigned i;
 	if(!n) return;
 	for(i=0; i<n->len; i++) {
-		/* safe to free NULL str */
-		region_recycle(region, n->array[i].str, n->array[i].len);
+		radsel_str_free(region, &n->array[i]);
 	}
 	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
 	region_recycle(region, n, sizeof(*n));
@@ -619,8 +809,8 @@ static int
 radnode_cleanup_onechild(struct region* region, struct radnode* n,
 	struct radnode* par)
 {
-	uint8_t* join;
-	radstrlen_t joinlen;
+	struct radsel join;
+	uint8_t* j;
 	uint8_t pidx = n->pidx;
 	struct radnode* child = n->array[0].node;
 	/* node had one child, merge them into the parent. */
@@ -628,24 +818,23 @@ radnode_cleanup_onechild(struct region* region, struct radnode* n,
 
 	/* at parent, append child->str to array str */
 	assert(pidx < par->len);
-	joinlen = par->array[pidx].len + n->array[0].len + 1;
-	join = (uint8_t*)region_alloc(region, joinlen*sizeof(uint8_t));
-	if(!join) {
+	memset(&join, 0, sizeof(join));
+	j = radsel_str_alloc(region, &join, par->array[pidx].len +
+		n->array[0].len + 1);
+	if(!j) {
 		/* cleanup failed due to out of memory */
 		/* the tree is inefficient, with node n still existing */
 		return 0;
 	}
-	/* we know that .str and join are malloced, thus aligned */
-	memcpy(join, par->array[pidx].str, par->array[pidx].len);
+	memcpy(j, radsel_str(&par->array[pidx]), par->array[pidx].len);
 	/* the array lookup is gone, put its character in the lookup string*/
-	join[par->array[pidx].len] = child->pidx + n->offset;
-	/* but join+len may not be aligned */
-	memmove(join+par->array[pidx].len+1, n->array[0].str, n->array[0].len);
-	region_recycle(region, par->array[pidx].str, par->array[pidx].len);
-	par->array[pidx].str = join;
-	par->array[pidx].len = joinlen;
+	j[par->array[pidx].len] = child->pidx + n->offset;
+	memcpy(j+par->array[pidx].len+1, radsel_str(&n->array[0]),
+		n->array[0].len);
+	radsel_str_free(region, &par->array[pidx]);
 	/* and set the node to our child. */
-	par->array[pidx].node = child;
+	radsel_set_node(&join, child);
+	par->array[pidx] = join;
 	child->parent = par;
 	child->pidx = pidx;
 	/* we are unlinked, delete our node */
@@ -663,6 +852,7 @@ radnode_array_clean_all(struct region* region, struct radnode* n)
 	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
 	n->array = NULL;
 	n->capacity = 0;
+	radnode_array_changed(n);
 }
 
 /** see if capacity can be reduced for the given node array */
@@ -677,6 +867,7 @@ radnode_array_reduce_if_needed(struct region* region, struct radnode* n)
 		region_recycle(region, n->array, n->capacity*sizeof(*a));
 		n->array = a;
 		n->capacity = n->len;
+		radnode_array_changed(n);
 	}
 }
 
@@ -705,6 +896,7 @@ radnode_array_clean_front(struct region* region, struct radnode* n)
 	for(idx=0; idx<n->len; idx++)
 		if(n->array[idx].node)
 			n->array[idx].node->pidx = idx;
+	radnode_array_changed(n);
 	/* see if capacity can be reduced */
 	radnode_array_reduce_if_needed(region, n);
 }
@@ -727,6 +919,7 @@ radnode_array_clean_end(struct region* region, struct radnode* n)
 	}
 	assert(shuf < n->len);
 	n->len -= shuf;
+	radnode_array_changed(n);
 	/* array elements can stay where they are */
 	/* see if capacity can be reduced */
 	radnode_array_reduce_if_needed(region, n);
@@ -745,10 +938,8 @@ radnode_cleanup_leaf(struct region* region, struct radnode* n,
 
 	/* set parent+idx entry to NULL str and node.*/
 	assert(pidx < par->len);
-	region_recycle(region, par->array[pidx].str, par->array[pidx].len);
-	par->array[pidx].str = NULL;
-	par->array[pidx].len = 0;
-	par->array[pidx].node = NULL;
+	radsel_str_free(region, &par->array[pidx]);
+	radsel_set_node(&par->array[pidx], NULL);
 
 	/* see if par offset or len must be adjusted */
 	if(par->len == 1) {
@@ -814,28 +1005,40 @@ void radix_delete(struct radtree* rt, struct radnode* n)
 struct radnode* radix_search(struct radtree* rt, uint8_t* k, radstrlen_t len)
 {
 	struct radnode* n = rt->root;
+	struct radsel* a, *r;
+	uint8_t offset;
+	uint16_t alen;
 	radstrlen_t pos = 0;
 	uint8_t byte;
+	if(!n)
+		return NULL;
+	/* walk the arrays, using the copies in the edges */
+	a = n->array;
+	offset = n->offset;
+	alen = n->len;
 	while(n) {
 		if(pos == len)
 			return n->elem?n:NULL;
 		byte = k[pos];
-		if(byte < n->offset)
+		if(byte < offset)
 			return NULL;
-		byte -= n->offset;
-		if(byte >= n->len)
+		byte -= offset;
+		if(byte >= alen)
 			return NULL;
 		pos++;
-		if(n->array[byte].len != 0) {
+		r = &a[byte];
+		if(r->len != 0) {
 			/* must match additional string */
-			if(pos+n->array[byte].len > len)
+			if(pos+r->len > len)
 				return NULL; /* no match */
-			if(memcmp(&k[pos], n->array[byte].str,
-				n->array[byte].len) != 0)
+			if(memcmp(&k[pos], radsel_str(r), r->len) != 0)
 				return NULL; /* no match */
-			pos += n->array[byte].len;
+			pos += r->len;
 		}
-		n = n->array[byte].node;
+		n = r->node;
+		a = r->node_array;
+		offset = r->node_offset;
+		alen = r->node_len;
 	}
 	return NULL;
 }
@@ -853,6 +1056,9 @@ int radix_find_less_equal(struct radtree* rt, uint8_t* k, radstrlen_t len,
         struct radnode** result)
 {
 	struct radnode* n = rt->root;
+	struct radsel* a, *s;
+	uint8_t offset;
+	uint16_t alen;
 	radstrlen_t pos = 0;
 	uint8_t byte;
 	int r;
@@ -861,15 +1067,19 @@ int radix_find_less_equal(struct radtree* rt, uint8_t* k, radstrlen_t len,
 		*result = NULL;
 		return 0;
 	}
+	/* walk the arrays, using the copies in the edges */
+	a = n->array;
+	offset = n->offset;
+	alen = n->len;
 	while(pos < len) {
 		byte = k[pos];
-		if(byte < n->offset) {
+		if(byte < offset) {
 			/* so the previous is the element itself */
 			/* or something before this element */
 			return ret_self_or_prev(n, result);
 		}
-		byte -= n->offset;
-		if(byte >= n->len) {
+		byte -= offset;
+		if(byte >= alen) {
 			/* so, the previous is the last of array, or itself */
 			/* or something before this element */
 			if((*result=radnode_last_in_subtree_incl_self(n))==0)
@@ -877,7 +1087,8 @@ int radix_find_less_equal(struct radtree* rt, uint8_t* k, radstrlen_t len,
 			return 0;
 		}
 		pos++;
-		if(!n->array[byte].node) {
+		s = &a[byte];
+		if(!s->node) {
 			/* no match */
 			/* Find an entry in arrays from byte-1 to 0 */
 			*result = radnode_find_prev_from_idx(n, byte);
@@ -886,44 +1097,47 @@ int radix_find_less_equal(struct radtree* rt, uint8_t* k, radstrlen_t len,
 			/* this entry or something before it */
 			return ret_self_or_prev(n, result);
 		}
-		if(n->array[byte].len != 0) {
+		if(s->len != 0) {
 			/* must match additional string */
-			if(pos+n->array[byte].len > len) {
+			if(pos+s->len > len) {
 				/* the additional string is longer than key*/
-				if( (memcmp(&k[pos], n->array[byte].str,
+				if( (memcmp(&k[pos], radsel_str(s),
 					len-pos)) <= 0) {
 				  /* and the key is before this node */
-				  *result = radix_prev(n->array[byte].node);
+				  *result = radix_prev(s->node);
 				} else {
 					/* the key is after the additional
 					 * string, thus everything in that
 					 * subtree is smaller. */
-				  	*result=radnode_last_in_subtree_incl_self(n->array[byte].node);
+				  	*result=radnode_last_in_subtree_incl_self(s->node);
 					/* if somehow that is NULL,
 					 * then we have an inefficient tree:
 					 * byte+1 is larger than us, so find
 					 * something in byte-1 and before */
 					if(!*result)
-						*result = radix_prev(n->array[byte].node);
+						*result = radix_prev(s->node);
 				}
 				return 0; /* no match */
 			}
-			if( (r=memcmp(&k[pos], n->array[byte].str,
-				n->array[byte].len)) < 0) {
-				*result = radix_prev(n->array[byte].node);
+			if( (r=memcmp(&k[pos], radsel_str(s),
+				s->len)) < 0) {
+				*result = radix_prev(s->node);
 				return 0; /* no match */
 			} else if(r > 0) {
 				/* the key is larger than the additional
 				 * string, thus everything in that subtree
 				 * is smaller */
-				*result=radnode_last_in_subtree_incl_self(n->array[byte].node);
+				*result=radnode_last_in_subtree_incl_self(s->node);
 				/* if we have an inefficient tree */
-				if(!*result) *result = radix_prev(n->array[byte].node);
+				if(!*result) *result = radix_prev(s->node);
 				return 0; /* no match */
 			}
-			pos += n->array[byte].len;
+			pos += s->len;
 		}
-		n = n->array[byte].node;
+		n = s->node;
+		a = s->node_array;
+		offset = s->node_offset;
+		alen = s->node_len;
 	}
 	if(n->elem) {
 		/* exact match */
@@ -1003,9 +1217,7 @@ struct radnode* radix_prev(struct radnode* n)
 /** convert one character from domain-name to radname */
 static uint8_t char_d2r(uint8_t c)
 {
-	if(c < 'A') return c+1; /* make space for 00 */
-	else if(c <= 'Z') return c-'A'+'a'; /* lowercase */
-	else return c;
+	return radname_char(c);
 }
 
 /** convert one character from radname to domain-name (still lowercased) */
@@ -1169,6 +1381,20 @@ radname_insert(struct radtree* rt, const uint8_t* d, size_t max, void* elem)
 	return radix_insert(rt, radname, len, elem);
 }
 
+struct radnode*
+radname_insert_below(struct radtree* rt, struct radnode* n, size_t nlen,
+	const uint8_t* d, size_t max, void* elem)
+{
+	uint8_t radname[300];
+	radstrlen_t len = (radstrlen_t)sizeof(radname);
+	if(max > sizeof(radname))
+		return NULL; /* too long */
+	radname_d2r(radname, &len, d, max);
+	/* the radname of n is nlen-2 long, and empty for the root */
+	return radix_insert_below(rt, n, (radstrlen_t)(nlen>1?nlen-2:0),
+		radname, len, elem);
+}
+
 /** delete by domain name */
 void
 radname_delete(struct radtree* rt, const uint8_t* d, size_t max)
@@ -1178,6 +1404,47 @@ radname_delete(struct radtree* rt, const uint8_t* d, size_t max)
 	if(n) radix_delete(rt, n);
 }
 
+int radname_prefetch_start(struct radtree* rt, struct radprefetch* p,
+	const uint8_t* d, size_t max)
+{
+	struct radnode* n = rt->root;
+	if(!n || !n->array)
+		return 0;
+	radname_d2r(p->key, &p->keylen, d, max);
+	p->pos = 0;
+	p->array = n->array;
+	p->len = n->len;
+	p->offset = n->offset;
+	if(p->keylen == 0 || p->key[0] < p->offset ||
+		p->key[0] - p->offset >= p->len)
+		return 0;
+	PREFETCH(&p->array[p->key[0] - p->offset]);
+	return 1;
+}
+
+int radix_prefetch_step(struct radprefetch* p)
+{
+	struct radsel* s = &p->array[p->key[p->pos] - p->offset];
+	uint8_t byte;
+	if(!s->node)
+		return 0;
+	/* skip the additional string, the lookup compares it */
+	p->pos += 1 + s->len;
+	p->array = s->node_array;
+	p->len = s->node_len;
+	p->offset = s->node_offset;
+	if(p->pos < p->keylen && p->array) {
+		byte = p->key[p->pos];
+		if(byte >= p->offset && byte - p->offset < p->len) {
+			PREFETCH(&p->array[byte - p->offset]);
+			return 1;
+		}
+	}
+	/* the key ends at this node, or it is the closest match */
+	PREFETCH(s->node);
+	return 0;
+}
+
 /* search for exact match of domain name, converted to radname in tree */
 struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 	size_t max)
@@ -1186,6 +1453,9 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 	const uint8_t* labstart[130];
 	unsigned int lab, dpos, lpos;
 	struct radnode* n = rt->root;
+	struct radsel* a, *r;
+	uint8_t offset;
+	uint16_t alen;
 	uint8_t byte;
 	radstrlen_t i;
 	uint8_t b;
@@ -1218,6 +1488,12 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 	/* start processing at the last label */
 	lab-=1;
 	lpos = 0;
+	if(!n)
+		return NULL;
+	/* walk the arrays, using the copies in the edges */
+	a = n->array;
+	offset = n->offset;
+	alen = n->len;
 	while(n) {
 		/* fetch next byte this label */
 		if(lpos < *labstart[lab])
@@ -1232,15 +1508,17 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 			byte = 0;
 		}
 		/* find that byte in the array */
-		if(byte < n->offset)
+		if(byte < offset)
 			return NULL;
-		byte -= n->offset;
-		if(byte >= n->len)
+		byte -= offset;
+		if(byte >= alen)
 			return NULL;
-		if(n->array[byte].len != 0) {
+		r = &a[byte];
+		if(r->len != 0) {
 			/* must match additional string */
+			uint8_t* str = radsel_str(r);
 			/* see how many bytes we need and start matching them*/
-			for(i=0; i<n->array[byte].len; i++) {
+			for(i=0; i<r->len; i++) {
 				/* next byte to match */
 				if(lpos < *labstart[lab])
 					b = char_d2r(labstart[lab][++lpos]);
@@ -1254,11 +1532,14 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 					lab--;
 					b = 0;
 				}
-				if(n->array[byte].str[i] != b)
+				if(str[i] != b)
 					return NULL; /* not matched */
 			}
 		}
-		n = n->array[byte].node;
+		n = r->node;
+		a = r->node_array;
+		offset = r->node_offset;
+		alen = r->node_len;
 	}
 	return NULL;
 }
@@ -1271,6 +1552,9 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 	const uint8_t* labstart[130];
 	unsigned int lab, dpos, lpos;
 	struct radnode* n = rt->root;
+	struct radsel* a, *r;
+	uint8_t offset;
+	uint16_t alen;
 	uint8_t byte;
 	radstrlen_t i;
 	uint8_t b;
@@ -1320,6 +1604,10 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 	/* start processing at the last label */
 	lab-=1;
 	lpos = 0;
+	/* walk the arrays, using the copies in the edges */
+	a = n->array;
+	offset = n->offset;
+	alen = n->len;
 	while(1) {
 		/* fetch next byte this label */
 		if(lpos < *labstart[lab])
@@ -1344,12 +1632,12 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 			byte = 0;
 		}
 		/* find that byte in the array */
-		if(byte < n->offset)
+		if(byte < offset)
 			/* so the previous is the element itself */
 			/* or something before this element */
 			return ret_self_or_prev(n, result);
-		byte -= n->offset;
-		if(byte >= n->len) {
+		byte -= offset;
+		if(byte >= alen) {
 			/* so, the previous is the last of array, or itself */
 			/* or something before this element */
 			*result = radnode_last_in_subtree_incl_self(n);
@@ -1357,7 +1645,8 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 				*result = radix_prev(n);
 			return 0;
 		}
-		if(!n->array[byte].node) {
+		r = &a[byte];
+		if(!r->node) {
 			/* no match */
 			/* Find an entry in arrays from byte-1 to 0 */
 			*result = radnode_find_prev_from_idx(n, byte);
@@ -1366,10 +1655,11 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 			/* this entry or something before it */
 			return ret_self_or_prev(n, result);
 		}
-		if(n->array[byte].len != 0) {
+		if(r->len != 0) {
 			/* must match additional string */
+			uint8_t* str = radsel_str(r);
 			/* see how many bytes we need and start matching them*/
-			for(i=0; i<n->array[byte].len; i++) {
+			for(i=0; i<r->len; i++) {
 				/* next byte to match */
 				if(lpos < *labstart[lab])
 					b = char_d2r(labstart[lab][++lpos]);
@@ -1380,7 +1670,7 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 						/* dname ended, thus before
 						 * this array element */
 						*result =radix_prev(
-							n->array[byte].node);
+							r->node);
 						return 0; 
 					}
 					/* next label, search for byte 00 */
@@ -1388,24 +1678,27 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 					lab--;
 					b = 0;
 				}
-				if(b < n->array[byte].str[i]) {
+				if(b < str[i]) {
 					*result =radix_prev(
-						n->array[byte].node);
+						r->node);
 					return 0; 
-				} else if(b > n->array[byte].str[i]) {
+				} else if(b > str[i]) {
 					/* the key is after the additional,
 					 * so everything in its subtree is
 					 * smaller */
-					*result = radnode_last_in_subtree_incl_self(n->array[byte].node);
+					*result = radnode_last_in_subtree_incl_self(r->node);
 					/* if that is NULL, we have an
 					 * inefficient tree, find in byte-1*/
 					if(!*result)
-						*result = radix_prev(n->array[byte].node);
+						*result = radix_prev(r->node);
 					return 0;
 				}
 			}
 		}
-		n = n->array[byte].node;
+		n = r->node;
+		a = r->node_array;
+		offset = r->node_offset;
+		alen = r->node_len;
 	}
 	/* ENOTREACH */
 	return 0;
@@ -5,6 +5,7 @@
  */
 #ifndef RADTREE_H
 #define RADTREE_H
+#include <string.h>
 
 struct radnode;
 struct region;
@@ -32,7 +33,8 @@ struct radtree {
 
 /**
  * A radix tree lookup node.
- * The array is malloced separately from the radnode.
+ * The array is malloced separately from the radnode.  The edge in the
+ * parent has a copy of the offset, len and array.
  */
 struct radnode {
 	/** data element associated with the binary string up to this node */
@@ -51,18 +53,48 @@ struct radnode {
 	struct radsel* array; 
 };
 
+/**
+ * Number of bytes of the additional string of an edge that are stored in
+ * the radsel itself.  Longer strings are allocated, and the radsel holds
+ * the pointer to them.
+ */
+#define RADSEL_INLINE 11
+
 /**
  * radix select edge in array
+ * The lookup array of the node that the edge points to is copied in the
+ * edge, a lookup follows the edges from array to array and visits the
+ * radnode at the end, for the element.  The additional string is in the
+ * edge too, if it is short, so a step costs one fetch from memory.
  */
 struct radsel {
-	/** additional string after the selection-byte for this edge. */
-	uint8_t* str;
-	/** length of the additional string for this edge */
-	radstrlen_t len;
 	/** node that deals with byte+str */
 	struct radnode* node;
+	/** the lookup array of the node, copy of node->array */
+	struct radsel* node_array;
+	/** length of the additional string for this edge */
+	radstrlen_t len;
+	/** length of the lookup array of the node, copy of node->len */
+	uint16_t node_len;
+	/** offset of the lookup array of the node, copy of node->offset */
+	uint8_t node_offset;
+	/** additional string after the selection-byte for this edge.
+	 * If len > RADSEL_INLINE, it holds a pointer to the string, use
+	 * radsel_str() to get the bytes. */
+	uint8_t str[RADSEL_INLINE];
 };
 
+/** the additional string after the selection-byte for the edge */
+static inline uint8_t*
+radsel_str(struct radsel* r)
+{
+	uint8_t* s;
+	if(r->len <= RADSEL_INLINE)
+		return r->str;
+	memcpy(&s, r->str, sizeof(s));
+	return s;
+}
+
 /**
  * Create new radix tree
  * @param region: where to allocate the tree.
@@ -102,6 +134,55 @@ void radix_tree_delete(struct radtree* rt);
 struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
 	void* elem);
 
+/**
+ * Insert element like radix_insert, the search for the place starts at
+ * node n, whose key is the first pos bytes of the key, instead of at the
+ * root.
+ * @param rt: the radix tree.
+ * @param n: the node to start at.
+ * @param pos: length of the key of n.
+ * @param key: key string, that starts with the key of n.
+ * @param len: length of key.
+ * @param elem: pointer to element data.
+ * @return NULL on failure, like radix_insert.
+ */
+struct radnode* radix_insert_below(struct radtree* rt, struct radnode* n,
+	radstrlen_t pos, uint8_t* k, radstrlen_t len, void* elem);
+
+/**
+ * Fill an empty radix tree with elements, faster than radix_insert of
+ * them one by one.  Every node and lookup array is allocated once, in the
+ * order of the keys, and the lookup arrays have no spare capacity.
+ * @param rt: the radix tree, it must be empty.
+ * @param k: the key strings, sorted in ascending order, no duplicates.
+ * @param len: the lengths of the keys.
+ * @param elem: the elements for the keys.
+ * @param nodes: if not NULL, the radix node of each element is set in it.
+ * @param num: number of elements.
+ * @return false on alloc failure, the tree is then empty.
+ */
+int radix_tree_bulk_load(struct radtree* rt, uint8_t** k, radstrlen_t* len,
+	void** elem, struct radnode** nodes, size_t num);
+
+/**
+ * Insert elements with sorted keys below a node, like radix_tree_bulk_load.
+ * @param rt: the radix tree.
+ * @param n: the node, its key is the first pos bytes of the keys.
+ * @param pos: length of the key of n.
+ * @param k: the key strings, sorted in ascending order, no duplicates,
+ *	longer than pos.  The lookup array of n can have no edges yet
+ *	for the bytes after pos of the keys.
+ * @param len: the lengths of the keys.
+ * @param elem: the elements for the keys.
+ * @param nodes: if not NULL, the radix node of each element is set in it.
+ * @param num: number of elements.
+ * @return false on alloc failure or if there are edges for the keys
+ *	already, the elements are then not added.
+ */
+int radix_bulk_insert(struct radtree* rt, struct radnode* n, radstrlen_t pos,
+	uint8_t** k, radstrlen_t* len, void** elem, struct radnode** nodes,
+	size_t num);
+
 /**
  * Delete element from radix tree.
  * @param rt: the radix tree.
@@ -167,6 +248,18 @@ struct radnode* radix_prev(struct radnode* n);
  *	for(node=radix_first(tree); node; node=radix_next(node))
 */
 
+/**
+ * Convert one character of a domain name to the radname, lowercased,
+ * and the bytes before 'A' moved up one to make space for the 00 that
+ * ends a label.
+ */
+static inline uint8_t radname_char(uint8_t c)
+{
+	if(c < 'A') return c+1;
+	else if(c <= 'Z') return c-'A'+'a';
+	else return c;
+}
+
 /**
  * Create a binary string to represent a domain name
  * @param k: string buffer to store into
@@ -226,6 +319,20 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 struct radnode* radname_insert(struct radtree* rt, const uint8_t* d,
 	size_t max, void* elem);
 
+/**
+ * Insert radix element by domain name below the node of a parent domain,
+ * like radix_insert_below.
+ * @param rt: the radix tree.
+ * @param n: the radix node of a parent domain of d.
+ * @param nlen: the length of the domain name of n.
+ * @param d: domain name, no compression pointers.
+ * @param max: max length from d.
+ * @param elem: the element pointer to insert.
+ * @return NULL on failure, like radname_insert.
+ */
+struct radnode* radname_insert_below(struct radtree* rt, struct radnode* n,
+	size_t nlen, const uint8_t* d, size_t max, void* elem);
+
 /**
  * Delete element by domain name from radix tree.
  * @param rt: the radix tree.
@@ -234,6 +341,45 @@ struct radnode* radname_insert(struct radtree* rt, const uint8_t* d,
  */
 void radname_delete(struct radtree* rt, const uint8_t* d, size_t max);
 
+/**
+ * State of a prefetch of the path of a key in the tree.  The lookups of
+ * a batch start a walk each, and the walks are stepped together one
+ * edge at a time, so the cache misses of the lookups overlap.  The walk
+ * follows the first byte of every edge, it is a hint, the lookup itself
+ * compares the key.
+ */
+struct radprefetch {
+	/** the lookup array of the node that is reached */
+	struct radsel* array;
+	/** length and offset of that array */
+	uint16_t len;
+	uint8_t offset;
+	/** position in the key and length of the key */
+	radstrlen_t pos, keylen;
+	/** the radname of the key */
+	uint8_t key[256];
+};
+
+/**
+ * Start a prefetch of the path of the domain name, the name must be
+ * valid, no compression pointers.  The first edge is prefetched.
+ * @param rt: the radix tree.
+ * @param p: the state of the walk.
+ * @param d: domain name.
+ * @param max: length of the domain name.
+ * @return false if there is nothing more to prefetch.
+ */
+int radname_prefetch_start(struct radtree* rt, struct radprefetch* p,
+	const uint8_t* d, size_t max);
+
+/**
+ * Take the edge that was prefetched, and prefetch the next one, or the
+ * node of the key at the end.
+ * @param p: the state of the walk.
+ * @return false if there is nothing more to prefetch.
+ */
+int radix_prefetch_step(struct radprefetch* p);
+
 /** number of bytes in common in strings */
 radstrlen_t bstr_common_ext(uint8_t* x, radstrlen_t xlen, uint8_t* y,
 	radstrlen_t ylen);
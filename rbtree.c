@@ -551,3 +551,45 @@ rbtree_previous(rbnode_t *node)
 	}
 	return node;
 }
+
+/** build the subtree of the sorted nodes, the nodes at depth red are
+ * red and the others black */
+static rbnode_t*
+rbtree_bulk_sub(rbnode_t** nodes, size_t num, rbnode_t* parent, int depth,
+	int red)
+{
+	size_t mid = num/2;
+	rbnode_t* node;
+	if(num == 0)
+		return RBTREE_NULL;
+	node = nodes[mid];
+	node->parent = parent;
+	node->color = (depth == red)?RED:BLACK;
+	node->left = rbtree_bulk_sub(nodes, mid, node, depth+1, red);
+	node->right = rbtree_bulk_sub(nodes+mid+1, num-mid-1, node, depth+1,
+		red);
+	return node;
+}
+
+void
+rbtree_bulk_build(rbtree_t *rbtree, rbnode_t **nodes, size_t num)
+{
+	size_t i, j;
+	int depth = 0;
+	assert(rbtree->count == 0);
+	/* drop duplicates, like rbtree_insert would */
+	for(i=0, j=0; i<num; i++) {
+		if(j > 0 && rbtree->cmp(nodes[j-1]->key, nodes[i]->key) == 0)
+			continue;
+		nodes[j++] = nodes[i];
+	}
+	num = j;
+	/* the split in the middle fills every level, except the last one
+	 * if num+1 is not a power of two; the nodes on that level are red */
+	for(i=num; i>1; i/=2)
+		depth++;
+	if(((num+1) & num) == 0)
+		depth = -1;
+	rbtree->root = rbtree_bulk_sub(nodes, num, RBTREE_NULL, 0, depth);
+	rbtree->count = num;
+}
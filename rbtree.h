@@ -60,6 +60,10 @@ rbnode_t *rbtree_first(rbtree_t *rbtree);
 rbnode_t *rbtree_last(rbtree_t *rbtree);
 rbnode_t *rbtree_next(rbnode_t *rbtree);
 rbnode_t *rbtree_previous(rbnode_t *rbtree);
+/* fill the empty tree with the nodes, sorted by key, faster than inserting
+ * them one by one.  Of nodes with equal keys only the first is put in the
+ * tree, and the array is changed. */
+void rbtree_bulk_build(rbtree_t *rbtree, rbnode_t **nodes, size_t num);
 
 #define	RBTREE_WALK(rbtree, k, d) \
 	for((rbtree)->_node = rbtree_first(rbtree);\
@@ -65,25 +65,23 @@ lookup_table_type dns_algorithms[] = {
 };
 
 typedef int (*rdata_to_string_type)(buffer_type *output,
-				    rdata_atom_type rdata,
+				    rdata_field_type rdata,
 				    rr_type *rr);
 
 static int
-rdata_dname_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_dname_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	buffer_printf(output,
-		      "%s",
-		      dname_to_string(domain_dname(rdata_atom_domain(rdata)),
-				      NULL));
+	buffer_print_str(output,
+		dname_to_string(domain_dname(rdata.domain), NULL));
 	return 1;
 }
 
 static int
-rdata_dns_name_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_dns_name_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	const uint8_t *data = rdata_atom_data(rdata);
+	const uint8_t *data = rdata.data;
 	size_t offset = 0;
 	uint8_t length = data[offset];
 	size_t i;
@@ -117,10 +115,10 @@ rdata_dns_name_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_text_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_text_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	const uint8_t *data = rdata_atom_data(rdata);
+	const uint8_t *data = rdata.data;
 	uint8_t length = data[0];
 	size_t i;
 
@@ -141,12 +139,12 @@ rdata_text_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_texts_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_texts_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	uint16_t pos = 0;
-	const uint8_t *data = rdata_atom_data(rdata);
-	uint16_t length = rdata_atom_size(rdata);
+	const uint8_t *data = rdata.data;
+	uint16_t length = rdata.size;
 	size_t i;
 
 	while (pos < length && pos + data[pos] < length) {
@@ -169,11 +167,11 @@ rdata_texts_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_long_text_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_long_text_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	const uint8_t *data = rdata_atom_data(rdata);
-	uint16_t length = rdata_atom_size(rdata);
+	const uint8_t *data = rdata.data;
+	uint16_t length = rdata.size;
 	size_t i;
 
 	buffer_printf(output, "\"");
@@ -193,10 +191,10 @@ rdata_long_text_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_tag_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_tag_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	const uint8_t *data = rdata_atom_data(rdata);
+	const uint8_t *data = rdata.data;
 	uint8_t length = data[0];
 	size_t i;
 	for (i = 1; i <= length; ++i) {
@@ -209,63 +207,63 @@ rdata_tag_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_byte_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_byte_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint8_t data = *rdata_atom_data(rdata);
-	buffer_printf(output, "%lu", (unsigned long) data);
+	uint8_t data = *rdata.data;
+	buffer_print_u32(output, data);
 	return 1;
 }
 
 static int
-rdata_short_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_short_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint16_t data = read_uint16(rdata_atom_data(rdata));
-	buffer_printf(output, "%lu", (unsigned long) data);
+	uint16_t data = read_uint16(rdata.data);
+	buffer_print_u32(output, data);
 	return 1;
 }
 
 static int
-rdata_long_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_long_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint32_t data = read_uint32(rdata_atom_data(rdata));
-	buffer_printf(output, "%lu", (unsigned long) data);
+	uint32_t data = read_uint32(rdata.data);
+	buffer_print_u32(output, data);
 	return 1;
 }
 
 static int
-rdata_a_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_a_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	int result = 0;
 	char str[200];
-	if (inet_ntop(AF_INET, rdata_atom_data(rdata), str, sizeof(str))) {
-		buffer_printf(output, "%s", str);
+	if (inet_ntop(AF_INET, rdata.data, str, sizeof(str))) {
+		buffer_print_str(output, str);
 		result = 1;
 	}
 	return result;
 }
 
 static int
-rdata_aaaa_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_aaaa_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	int result = 0;
 	char str[200];
-	if (inet_ntop(AF_INET6, rdata_atom_data(rdata), str, sizeof(str))) {
-		buffer_printf(output, "%s", str);
+	if (inet_ntop(AF_INET6, rdata.data, str, sizeof(str))) {
+		buffer_print_str(output, str);
 		result = 1;
 	}
 	return result;
 }
 
 static int
-rdata_ilnp64_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_ilnp64_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint8_t* data = rdata_atom_data(rdata);
+	uint8_t* data = rdata.data;
 	uint16_t a1 = read_uint16(data);
 	uint16_t a2 = read_uint16(data+2);
 	uint16_t a3 = read_uint16(data+4);
@@ -276,10 +274,10 @@ rdata_ilnp64_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_eui48_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_eui48_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint8_t* data = rdata_atom_data(rdata);
+	uint8_t* data = rdata.data;
 	uint8_t a1 = data[0];
 	uint8_t a2 = data[1];
 	uint8_t a3 = data[2];
@@ -293,10 +291,10 @@ rdata_eui48_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_eui64_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_eui64_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint8_t* data = rdata_atom_data(rdata);
+	uint8_t* data = rdata.data;
 	uint8_t a1 = data[0];
 	uint8_t a2 = data[1];
 	uint8_t a3 = data[2];
@@ -312,32 +310,32 @@ rdata_eui64_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_rrtype_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_rrtype_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint16_t type = read_uint16(rdata_atom_data(rdata));
-	buffer_printf(output, "%s", rrtype_to_string(type));
+	uint16_t type = read_uint16(rdata.data);
+	buffer_print_str(output, rrtype_to_string(type));
 	return 1;
 }
 
 static int
-rdata_algorithm_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_algorithm_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint8_t id = *rdata_atom_data(rdata);
+	uint8_t id = *rdata.data;
 	buffer_printf(output, "%u", (unsigned) id);
 	return 1;
 }
 
 static int
-rdata_certificate_type_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_certificate_type_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint16_t id = read_uint16(rdata_atom_data(rdata));
+	uint16_t id = read_uint16(rdata.data);
 	lookup_table_type *type
 		= lookup_by_id(dns_certificate_types, id);
 	if (type) {
-		buffer_printf(output, "%s", type->name);
+		buffer_print_str(output, type->name);
 	} else {
 		buffer_printf(output, "%u", (unsigned) id);
 	}
@@ -345,42 +343,42 @@ rdata_certificate_type_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_period_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_period_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	uint32_t period = read_uint32(rdata_atom_data(rdata));
-	buffer_printf(output, "%lu", (unsigned long) period);
+	uint32_t period = read_uint32(rdata.data);
+	buffer_print_u32(output, period);
 	return 1;
 }
 
 static int
-rdata_time_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_time_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	int result = 0;
-	time_t time = (time_t) read_uint32(rdata_atom_data(rdata));
+	time_t time = (time_t) read_uint32(rdata.data);
 	struct tm *tm = gmtime(&time);
 	char buf[15];
 	if (strftime(buf, sizeof(buf), "%Y%m%d%H%M%S", tm)) {
-		buffer_printf(output, "%s", buf);
+		buffer_print_str(output, buf);
 		result = 1;
 	}
 	return result;
 }
 
 static int
-rdata_base32_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_base32_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	int length;
-	size_t size = rdata_atom_size(rdata);
+	size_t size = rdata.size;
 	if(size == 0) {
 		buffer_write(output, "-", 1);
 		return 1;
 	}
 	size -= 1; /* remove length byte from count */
 	buffer_reserve(output, size * 2 + 1);
-	length = b32_ntop(rdata_atom_data(rdata)+1, size,
+	length = b32_ntop(rdata.data+1, size,
 			  (char *) buffer_current(output), size * 2);
 	if (length > 0) {
 		buffer_skip(output, length);
@@ -389,15 +387,15 @@ rdata_base32_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_base64_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_base64_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	int length;
-	size_t size = rdata_atom_size(rdata);
+	size_t size = rdata.size;
 	if(size == 0)
 		return 1;
 	buffer_reserve(output, size * 2 + 1);
-	length = b64_ntop(rdata_atom_data(rdata), size,
+	length = b64_ntop(rdata.data, size,
 			  (char *) buffer_current(output), size * 2);
 	if (length > 0) {
 		buffer_skip(output, length);
@@ -423,44 +421,44 @@ hex_to_string(buffer_type *output, const uint8_t *data, size_t size)
 }
 
 static int
-rdata_hex_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_hex_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	hex_to_string(output, rdata_atom_data(rdata), rdata_atom_size(rdata));
+	hex_to_string(output, rdata.data, rdata.size);
 	return 1;
 }
 
 static int
-rdata_hexlen_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_hexlen_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	if(rdata_atom_size(rdata) <= 1) {
+	if(rdata.size <= 1) {
 		/* NSEC3 salt hex can be empty */
 		buffer_printf(output, "-");
 		return 1;
 	}
-	hex_to_string(output, rdata_atom_data(rdata)+1, rdata_atom_size(rdata)-1);
+	hex_to_string(output, rdata.data+1, rdata.size-1);
 	return 1;
 }
 
 static int
-rdata_nsap_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_nsap_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	buffer_printf(output, "0x");
-	hex_to_string(output, rdata_atom_data(rdata), rdata_atom_size(rdata));
+	hex_to_string(output, rdata.data, rdata.size);
 	return 1;
 }
 
 static int
-rdata_apl_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_apl_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	int result = 0;
 	buffer_type packet;
 
 	buffer_create_from(
-		&packet, rdata_atom_data(rdata), rdata_atom_size(rdata));
+		&packet, rdata.data, rdata.size);
 
 	if (buffer_available(&packet, 4)) {
 		uint16_t address_family = buffer_read_u16(&packet);
@@ -493,14 +491,14 @@ rdata_apl_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_services_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_services_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	int result = 0;
 	buffer_type packet;
 
 	buffer_create_from(
-		&packet, rdata_atom_data(rdata), rdata_atom_size(rdata));
+		&packet, rdata.data, rdata.size);
 
 	if (buffer_available(&packet, 1)) {
 		uint8_t protocol_number = buffer_read_u8(&packet);
@@ -511,7 +509,7 @@ rdata_services_to_string(buffer_type *output, rdata_atom_type rdata,
 		if (proto) {
 			int i;
 
-			buffer_printf(output, "%s", proto->p_name);
+			buffer_print_str(output, proto->p_name);
 
 			for (i = 0; i < bitmap_size * 8; ++i) {
 				if (get_bit(bitmap, i)) {
@@ -531,9 +529,9 @@ rdata_services_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_ipsecgateway_to_string(buffer_type *output, rdata_atom_type rdata, rr_type* rr)
+rdata_ipsecgateway_to_string(buffer_type *output, rdata_field_type rdata, rr_type* rr)
 {
-	int gateway_type = rdata_atom_data(rr->rdatas[1])[0];
+	int gateway_type = rr_rdata_field(rr, 1, NULL)[0];
 	switch(gateway_type) {
 	case IPSECKEY_NOGATEWAY:
 		buffer_printf(output, ".");
@@ -548,12 +546,12 @@ rdata_ipsecgateway_to_string(buffer_type *output, rdata_atom_type rdata, rr_type
 		{
 			region_type* temp = region_create(xalloc, free);
 			const dname_type* d = dname_make(temp,
-				rdata_atom_data(rdata), 0);
+				rdata.data, 0);
 			if(!d) {
 				region_destroy(temp);
 				return 0;
 			}
-			buffer_printf(output, "%s", dname_to_string(d, NULL));
+			buffer_print_str(output, dname_to_string(d, NULL));
 			region_destroy(temp);
 		}
 		break;
@@ -564,12 +562,12 @@ rdata_ipsecgateway_to_string(buffer_type *output, rdata_atom_type rdata, rr_type
 }
 
 static int
-rdata_nxt_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_nxt_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	size_t i;
-	uint8_t *bitmap = rdata_atom_data(rdata);
-	size_t bitmap_size = rdata_atom_size(rdata);
+	uint8_t *bitmap = rdata.data;
+	size_t bitmap_size = rdata.size;
 
 	for (i = 0; i < bitmap_size * 8; ++i) {
 		if (get_bit(bitmap, i)) {
@@ -583,7 +581,7 @@ rdata_nxt_to_string(buffer_type *output, rdata_atom_type rdata,
 }
 
 static int
-rdata_nsec_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_nsec_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	size_t saved_position = buffer_position(output);
@@ -591,7 +589,7 @@ rdata_nsec_to_string(buffer_type *output, rdata_atom_type rdata,
 	int insert_space = 0;
 
 	buffer_create_from(
-		&packet, rdata_atom_data(rdata), rdata_atom_size(rdata));
+		&packet, rdata.data, rdata.size);
 
 	while (buffer_available(&packet, 2)) {
 		uint8_t window = buffer_read_u8(&packet);
@@ -622,7 +620,7 @@ rdata_nsec_to_string(buffer_type *output, rdata_atom_type rdata,
 
 static int
 rdata_loc_to_string(buffer_type *ATTR_UNUSED(output),
-		    rdata_atom_type ATTR_UNUSED(rdata),
+		    rdata_field_type ATTR_UNUSED(rdata),
 		    rr_type* ATTR_UNUSED(rr))
 {
 	/*
@@ -633,12 +631,12 @@ rdata_loc_to_string(buffer_type *ATTR_UNUSED(output),
 }
 
 static int
-rdata_unknown_to_string(buffer_type *output, rdata_atom_type rdata,
+rdata_unknown_to_string(buffer_type *output, rdata_field_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
- 	uint16_t size = rdata_atom_size(rdata);
+ 	uint16_t size = rdata.size;
  	buffer_printf(output, "\\# %lu ", (unsigned long) size);
-	hex_to_string(output, rdata_atom_data(rdata), size);
+	hex_to_string(output, rdata.data, size);
 	return 1;
 }
 
@@ -677,25 +675,28 @@ static rdata_to_string_type rdata_to_string_table[RDATA_ZF_UNKNOWN + 1] = {
 };
 
 int
-rdata_atom_to_string(buffer_type *output, rdata_zoneformat_type type,
-		     rdata_atom_type rdata, rr_type* record)
+rdata_field_to_string(buffer_type *output, rdata_zoneformat_type type,
+		      rdata_field_type rdata, rr_type* record)
 {
 	return rdata_to_string_table[type](output, rdata, record);
 }
 
-ssize_t
-rdata_wireformat_to_rdata_atoms(region_type *region,
-				domain_table_type *owners,
-				uint16_t rrtype,
-				uint16_t data_size,
-				buffer_type *packet,
-				rdata_atom_type **rdatas)
+/*
+ * Split the wireformat RDATA into the rdata atoms in TEMP_RDATAS, with
+ * the data in REGION, and the domain names parsed in TEMP_REGION.
+ */
+static ssize_t
+rdata_wireformat_to_temp_atoms(region_type *region,
+			       region_type *temp_region,
+			       domain_table_type *owners,
+			       uint16_t rrtype,
+			       uint16_t data_size,
+			       buffer_type *packet,
+			       rdata_atom_type *temp_rdatas)
 {
 	size_t end = buffer_position(packet) + data_size;
 	size_t i;
-	rdata_atom_type temp_rdatas[MAXRDATALEN];
 	rrtype_descriptor_type *descriptor = rrtype_descriptor_by_type(rrtype);
-	region_type *temp_region;
 
 	assert(descriptor->maximum <= MAXRDATALEN);
 
@@ -703,8 +704,6 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 		return -1;
 	}
 
-	temp_region = region_create(xalloc, free);
-
 	for (i = 0; i < descriptor->maximum; ++i) {
 		int is_domain = 0;
 		int is_normalized = 0;
@@ -804,7 +803,6 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 				temp_region, packet, 1, is_normalized);
 			if (!dname || buffer_position(packet) > end) {
 				/* Error in domain name.  */
-				region_destroy(temp_region);
 				return -1;
 			}
 			if(is_wirestore) {
@@ -822,7 +820,6 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 			if (buffer_position(packet) + length > end) {
 				if (required) {
 					/* Truncated RDATA.  */
-					region_destroy(temp_region);
 					return -1;
 				} else {
 					break;
@@ -841,52 +838,281 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 
 	if (buffer_position(packet) < end) {
 		/* Trailing garbage.  */
-		region_destroy(temp_region);
 		return -1;
 	}
+	return (ssize_t)i;
+}
 
-	*rdatas = (rdata_atom_type *) region_alloc_array_init(
-		region, temp_rdatas, i, sizeof(rdata_atom_type));
+ssize_t
+rdata_wireformat_to_rdata_atoms(region_type *region,
+				domain_table_type *owners,
+				uint16_t rrtype,
+				uint16_t data_size,
+				buffer_type *packet,
+				rdata_atom_type **rdatas)
+{
+	rdata_atom_type temp_rdatas[MAXRDATALEN];
+	region_type *temp_region = region_create(xalloc, free);
+	ssize_t count = rdata_wireformat_to_temp_atoms(region, temp_region,
+		owners, rrtype, data_size, packet, temp_rdatas);
+	if (count != -1) {
+		*rdatas = (rdata_atom_type *) region_alloc_array_init(
+			region, temp_rdatas, count, sizeof(rdata_atom_type));
+	}
 	region_destroy(temp_region);
-	return (ssize_t)i;
+	return count;
 }
 
-size_t
-rdata_maximum_wireformat_size(rrtype_descriptor_type *descriptor,
-			      size_t rdata_count,
-			      rdata_atom_type *rdatas)
+ssize_t
+rdata_wireformat_to_rdata(region_type *region,
+			  domain_table_type *owners,
+			  uint16_t data_size,
+			  buffer_type *packet,
+			  rr_type *rr)
 {
-	size_t result = 0;
-	size_t i;
+	rdata_atom_type temp_rdatas[MAXRDATALEN];
+	region_type *temp_region = region_create(xalloc, free);
+	ssize_t count = rdata_wireformat_to_temp_atoms(temp_region,
+		temp_region, owners, rr->type, data_size, packet, temp_rdatas);
+	if (count != -1 &&
+	    !rdata_atoms_to_rdata(region, rr, count, temp_rdatas)) {
+		count = -1;
+	}
+	region_destroy(temp_region);
+	return count;
+}
+
+int
+rdata_atoms_to_rdata(region_type *region, rr_type *rr, size_t rdata_count,
+		     rdata_atom_type *rdatas)
+{
+	size_t i, domains = 0, length = 0;
+	domain_type **d;
+	uint8_t *wire;
+	int tag;
+
+	assert(rdata_count <= MAXRDATALEN);
 	for (i = 0; i < rdata_count; ++i) {
-		if (rdata_atom_is_domain(descriptor->type, i)) {
-			result += domain_dname(rdata_atom_domain(rdatas[i]))->name_size;
+		if (rdata_atom_is_domain(rr->type, i)) {
+			domains++;
 		} else {
-			result += rdata_atom_size(rdatas[i]);
+			length += rdata_atom_size(rdatas[i]);
 		}
 	}
-	return result;
+	if (length > MAX_RDLENGTH) {
+		return 0;
+	}
+	rr->rdata_count = rdata_count;
+	rr->rdata_domains = domains;
+	rr->rdlength = length;
+	rr->rdata_shared = 0;
+	if (domains == 0 && length == 0) {
+		rr->rdata = NULL;
+		return 1;
+	}
+	tag = region_set_tag(region, REGION_TAG_RDATA);
+	rr->rdata = region_alloc(region, rr_rdata_size(rr));
+	(void)region_set_tag(region, tag);
+	d = rr_rdata_domains(rr);
+	wire = rr_rdata_wire(rr);
+	for (i = 0; i < rdata_count; ++i) {
+		if (rdata_atom_is_domain(rr->type, i)) {
+			*d++ = rdata_atom_domain(rdatas[i]);
+		} else {
+			memcpy(wire, rdata_atom_data(rdatas[i]),
+				rdata_atom_size(rdatas[i]));
+			wire += rdata_atom_size(rdatas[i]);
+		}
+	}
+	return 1;
+}
+
+/* length of the wire format dname at POS, that ends before END */
+static size_t
+rdata_dname_length(const uint8_t *wire, size_t pos, size_t end)
+{
+	size_t p = pos;
+	while (p < end) {
+		uint8_t len = wire[p];
+		p += 1 + len;
+		if (len == 0)
+			break;
+	}
+	return (p < end ? p : end) - pos;
+}
+
+size_t
+rdata_field_length(uint16_t rrtype, size_t index, const uint8_t *wire,
+		   size_t pos, size_t end)
+{
+	size_t length = 0;
+
+	switch (rdata_atom_wireformat_type(rrtype, index)) {
+	case RDATA_WF_COMPRESSED_DNAME:
+	case RDATA_WF_UNCOMPRESSED_DNAME:
+		return 0;
+	case RDATA_WF_LITERAL_DNAME:
+		return rdata_dname_length(wire, pos, end);
+	case RDATA_WF_BYTE:
+		length = sizeof(uint8_t);
+		break;
+	case RDATA_WF_SHORT:
+		length = sizeof(uint16_t);
+		break;
+	case RDATA_WF_LONG:
+		length = sizeof(uint32_t);
+		break;
+	case RDATA_WF_TEXTS:
+	case RDATA_WF_LONG_TEXT:
+	case RDATA_WF_BINARY:
+		length = end - pos;
+		break;
+	case RDATA_WF_TEXT:
+	case RDATA_WF_BINARYWITHLENGTH:
+		/* Length is stored in the first byte.  */
+		length = 1;
+		if (pos < end) {
+			length += wire[pos];
+		}
+		break;
+	case RDATA_WF_A:
+		length = sizeof(in_addr_t);
+		break;
+	case RDATA_WF_AAAA:
+		length = IP6ADDRLEN;
+		break;
+	case RDATA_WF_ILNP64:
+		length = IP6ADDRLEN/2;
+		break;
+	case RDATA_WF_EUI48:
+		length = EUI48ADDRLEN;
+		break;
+	case RDATA_WF_EUI64:
+		length = EUI64ADDRLEN;
+		break;
+	case RDATA_WF_APL:
+		length = (sizeof(uint16_t)    /* address family */
+			  + sizeof(uint8_t)   /* prefix */
+			  + sizeof(uint8_t)); /* length */
+		if (pos + length <= end) {
+			/* Mask out negation bit.  */
+			length += (wire[pos + length - 1] & APL_LENGTH_MASK);
+		}
+		break;
+	case RDATA_WF_IPSECGATEWAY:
+		/* the gateway type is the second field */
+		switch (end > 1 ? wire[1] : IPSECKEY_NOGATEWAY) {
+		default:
+		case IPSECKEY_NOGATEWAY:
+			length = 0;
+			break;
+		case IPSECKEY_IP4:
+			length = IP4ADDRLEN;
+			break;
+		case IPSECKEY_IP6:
+			length = IP6ADDRLEN;
+			break;
+		case IPSECKEY_DNAME:
+			return rdata_dname_length(wire, pos, end);
+		}
+		break;
+	}
+	if (pos + length > end) {
+		length = end - pos;
+	}
+	return length;
+}
+
+uint8_t *
+rr_rdata_field(rr_type *rr, size_t index, uint16_t *len)
+{
+	uint8_t *wire = rr_rdata_wire(rr);
+	size_t i, pos = 0;
+	assert(index < rr->rdata_count);
+	assert(!rdata_atom_is_domain(rr->type, index));
+	for (i = 0; i < index; ++i) {
+		pos += rdata_field_length(rr->type, i, wire, pos,
+			rr->rdlength);
+	}
+	if (len) {
+		*len = rdata_field_length(rr->type, index, wire, pos,
+			rr->rdlength);
+	}
+	return wire + pos;
 }
 
 int
-rdata_atoms_to_unknown_string(buffer_type *output,
-			      rrtype_descriptor_type *descriptor,
-			      size_t rdata_count,
-			      rdata_atom_type *rdatas)
+rdata_equal(rr_type *a, rr_type *b, size_t *index)
 {
+	uint8_t *wa = rr_rdata_wire(a), *wb = rr_rdata_wire(b);
+	size_t i, d = 0, pa = 0, pb = 0;
+
+	assert(a->type == b->type);
+	for (i = 0; i < a->rdata_count && i < b->rdata_count; ++i) {
+		size_t la, lb;
+		switch (rdata_atom_wireformat_type(a->type, i)) {
+		case RDATA_WF_COMPRESSED_DNAME:
+		case RDATA_WF_UNCOMPRESSED_DNAME:
+			if (rr_rdata_domains(a)[d] != rr_rdata_domains(b)[d] &&
+			    dname_compare(domain_dname(rr_rdata_domains(a)[d]),
+			    domain_dname(rr_rdata_domains(b)[d])) != 0)
+				goto differ;
+			d++;
+			continue;
+		default:
+			break;
+		}
+		la = rdata_field_length(a->type, i, wa, pa, a->rdlength);
+		lb = rdata_field_length(b->type, i, wb, pb, b->rdlength);
+		if (la != lb)
+			goto differ;
+		if (rdata_atom_is_literal_domain(a->type, i)) {
+			if (!dname_equal_nocase(wa + pa, wb + pb, la))
+				goto differ;
+		} else if (memcmp(wa + pa, wb + pb, la) != 0) {
+			goto differ;
+		}
+		pa += la;
+		pb += lb;
+	}
+	if (a->rdata_count == b->rdata_count)
+		return 1;
+differ:
+	if (index)
+		*index = i;
+	return 0;
+}
+
+size_t
+rr_rdata_wireformat_size(rr_type *rr)
+{
+	size_t result = rr->rdlength;
 	size_t i;
-	size_t size =
-		rdata_maximum_wireformat_size(descriptor, rdata_count, rdatas);
-	buffer_printf(output, " \\# %lu ", (unsigned long) size);
-	for (i = 0; i < rdata_count; ++i) {
-		if (rdata_atom_is_domain(descriptor->type, i)) {
+	for (i = 0; i < rr->rdata_domains; ++i) {
+		result += domain_dname(rr_rdata_domains(rr)[i])->name_size;
+	}
+	return result;
+}
+
+
+int
+rdata_to_unknown_string(buffer_type *output, rr_type *rr)
+{
+	uint8_t *wire = rr_rdata_wire(rr);
+	size_t i, d = 0, pos = 0;
+	buffer_printf(output, " \\# %lu ",
+		(unsigned long) rr_rdata_wireformat_size(rr));
+	for (i = 0; i < rr->rdata_count; ++i) {
+		if (rdata_atom_is_domain(rr->type, i)) {
 			const dname_type *dname =
-				domain_dname(rdata_atom_domain(rdatas[i]));
+				domain_dname(rr_rdata_domains(rr)[d++]);
 			hex_to_string(
 				output, dname_name(dname), dname->name_size);
 		} else {
-			hex_to_string(output, rdata_atom_data(rdatas[i]),
-				rdata_atom_size(rdatas[i]));
+			size_t length = rdata_field_length(rr->type, i, wire,
+				pos, rr->rdlength);
+			hex_to_string(output, wire + pos, length);
+			pos += length;
 		}
 	}
 	return 1;
@@ -896,31 +1122,42 @@ int
 print_rdata(buffer_type *output, rrtype_descriptor_type *descriptor,
 	    rr_type *record)
 {
-	size_t i;
+	size_t i, d = 0, pos = 0;
 	size_t saved_position = buffer_position(output);
+	uint8_t *wire = rr_rdata_wire(record);
 
 	for (i = 0; i < record->rdata_count; ++i) {
+		rdata_field_type field;
 		if (i == 0) {
-			buffer_printf(output, "\t");
+			buffer_print_str(output, "\t");
 		} else if (descriptor->type == TYPE_SOA && i == 2) {
-			buffer_printf(output, " (\n\t\t");
+			buffer_print_str(output, " (\n\t\t");
+		} else {
+			buffer_print_str(output, " ");
+		}
+		if (rdata_atom_is_domain(record->type, i)) {
+			field.domain = rr_rdata_domains(record)[d++];
+			field.data = NULL;
+			field.size = 0;
 		} else {
-			buffer_printf(output, " ");
+			field.domain = NULL;
+			field.data = wire + pos;
+			field.size = rdata_field_length(record->type, i, wire,
+				pos, record->rdlength);
+			pos += field.size;
 		}
-		if (!rdata_atom_to_string(
+		if (!rdata_field_to_string(
 			    output,
 			    (rdata_zoneformat_type) descriptor->zoneformat[i],
-			    record->rdatas[i], record))
+			    field, record))
 		{
 			buffer_set_position(output, saved_position);
 			return 0;
 		}
 	}
 	if (descriptor->type == TYPE_SOA) {
-		buffer_printf(output, " )");
+		buffer_print_str(output, " )");
 	}
 
 	return 1;
 }
-
-
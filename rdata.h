@@ -20,8 +20,17 @@
 extern lookup_table_type dns_certificate_types[];
 extern lookup_table_type dns_algorithms[];
 
-int rdata_atom_to_string(buffer_type *output, rdata_zoneformat_type type,
-			 rdata_atom_type rdata, rr_type *rr);
+/* a field of the rdata of an RR, for the conversion to text */
+typedef struct rdata_field {
+	/* the domain of a compressed or uncompressed dname field */
+	domain_type *domain;
+	/* the wire format of the other fields */
+	uint8_t *data;
+	uint16_t size;
+} rdata_field_type;
+
+int rdata_field_to_string(buffer_type *output, rdata_zoneformat_type type,
+			  rdata_field_type rdata, rr_type *rr);
 
 /*
  * Split the wireformat RDATA into an array of rdata atoms. Domain
@@ -39,17 +48,54 @@ ssize_t rdata_wireformat_to_rdata_atoms(region_type *region,
 					rdata_atom_type **rdatas);
 
 /*
- * Calculate the maximum size of the rdata assuming domain names are
- * not compressed.
+ * Parse the wireformat RDATA into the rdata of the RR, allocated in
+ * REGION.  Domain names are inserted into the OWNERS table.  The type of
+ * the RR must be set.  Returns the number of rdata fields, or -1 on
+ * failure.
+ */
+ssize_t rdata_wireformat_to_rdata(region_type *region,
+				  domain_table_type *owners,
+				  uint16_t rdata_size,
+				  buffer_type *packet,
+				  rr_type *rr);
+
+/*
+ * Pack the rdata atoms into the rdata of the RR, allocated in REGION.
+ * The type of the RR must be set.  Returns 0 if the fields that are not
+ * domain pointers are longer than MAX_RDLENGTH.
+ */
+int rdata_atoms_to_rdata(region_type *region, rr_type *rr,
+			 size_t rdata_count, rdata_atom_type *rdatas);
+
+/*
+ * The length of rdata field INDEX of an RR of type RRTYPE, that starts
+ * at POS in the wire format part WIRE of the rdata that ends at END.
+ * Zero for the domain pointer fields.
+ */
+size_t rdata_field_length(uint16_t rrtype, size_t index, const uint8_t *wire,
+			  size_t pos, size_t end);
+
+/*
+ * The wire format of rdata field INDEX of the RR, that is not a domain
+ * pointer, and its length in LEN if not NULL.
+ */
+uint8_t *rr_rdata_field(rr_type *rr, size_t index, uint16_t *len);
+
+/*
+ * Compare the rdata of two RRs of the same type.  The domain names and
+ * the literal domain names are compared without regard to case.  Returns
+ * true if equal, and otherwise the first field that differs in INDEX if
+ * not NULL.
+ */
+int rdata_equal(rr_type *a, rr_type *b, size_t *index);
+
+/*
+ * Calculate the size of the rdata assuming domain names are not
+ * compressed.
  */
-size_t rdata_maximum_wireformat_size(rrtype_descriptor_type *descriptor,
-				     size_t rdata_count,
-				     rdata_atom_type *rdatas);
+size_t rr_rdata_wireformat_size(rr_type *rr);
 
-int rdata_atoms_to_unknown_string(buffer_type *out,
-				  rrtype_descriptor_type *descriptor,
-				  size_t rdata_count,
-				  rdata_atom_type *rdatas);
+int rdata_to_unknown_string(buffer_type *out, rr_type *rr);
 
 /* print rdata to a text string (as for a zone file) returns 0
   on a failure (bufpos is reset to original position).
@@ -9,9 +9,12 @@
 
 #include "config.h"
 
+#include <sys/types.h>
+#include <sys/mman.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "region-allocator.h"
 #include "util.h"
@@ -44,6 +47,58 @@ struct recycle_elem {
 struct large_elem {
 	struct large_elem* next;
 	struct large_elem* prev;
+	/* the size of the object after the header */
+	size_t size;
+};
+
+/*
+ * The small objects of a recycling region are allocated from slabs, a
+ * slab holds objects of one size.  A recycled object goes on the free
+ * list of its slab, and a slab that becomes empty gives its pages back
+ * to the OS, and can be used for another size.  The pages of the
+ * unused slabs are given back in batches, so that objects that are
+ * freed and allocated again do not page in and out all the time.  The slabs are
+ * allocated in groups, a group that is empty is freed.
+ */
+#define REGION_SLAB_SIZE 4096
+/* the first group of a region is small, the next ones double in size */
+#define REGION_SLAB_GROUP_MIN 4
+#define REGION_SLAB_GROUP_MAX 64
+
+struct region_slab_group;
+
+/* at the start of a slab, the objects follow */
+struct region_slab {
+	/* in the list of slabs with free objects of its size */
+	struct region_slab* next;
+	struct region_slab* prev;
+	struct region_slab_group* group;
+	struct recycle_elem* free;
+	/* objects in use, and objects handed out from the slab so far */
+	uint32_t used;
+	uint32_t carved;
+	/* object size, and the number of objects in the slab */
+	uint32_t size;
+	uint32_t capacity;
+};
+#define REGION_SLAB_HEADER REGION_ALIGN_UP(sizeof(struct region_slab), \
+	ALIGNMENT)
+
+struct region_slab_group {
+	/* in the list of all groups, and in the list of groups with
+	 * unused slabs */
+	struct region_slab_group* next;
+	struct region_slab_group* prev;
+	struct region_slab_group* avail_next;
+	struct region_slab_group* avail_prev;
+	/* the first slab, aligned to REGION_SLAB_SIZE in the block */
+	char* base;
+	uint32_t num;
+	/* stack with the numbers of the unused slabs */
+	uint32_t num_unused;
+	uint8_t unused[REGION_SLAB_GROUP_MAX];
+	/* bit i is set if unused slab i still has its pages */
+	uint64_t dirty;
 };
 
 struct region
@@ -76,8 +131,37 @@ struct region
 	struct recycle_elem** recycle_bin;
 	/* amount of memory in recycle storage */
 	size_t		recycle_size;
+
+	/* if not NULL the small objects up to slab_max bytes are in
+	 * slabs.  Array [i] is the list of slabs with free objects of
+	 * size i*ALIGNMENT. */
+	struct region_slab** slab_partial;
+	size_t		slab_max;
+	struct region_slab_group* slab_groups;
+	struct region_slab_group* slab_avail;
+	size_t		slab_group_next;
+	/* slabs in use, and the bytes of the objects in them */
+	size_t		slab_count;
+	size_t		slab_used;
+	/* unused slabs that still have their pages */
+	size_t		slab_dirty;
+	/* number of times an empty slab went back to the OS */
+	size_t		slab_released;
+
+	/* the tag the allocations are counted for, and with profiling
+	 * the counters per tag, and the bytes of this region per tag */
+	int		tag;
+	struct region_tag_stat* profile;
+	size_t*		profile_bytes;
 };
 
+static void region_recycle_object(region_type *region, void *block,
+	size_t size);
+
+static const char* region_tag_names[REGION_TAG_COUNT] = { "other",
+	"domains", "rrsets", "rdata", "nsec3", "compression", "tcp",
+	"options" };
+
 
 static region_type *
 alloc_region_base(void *(*allocator)(size_t size),
@@ -95,6 +179,18 @@ alloc_region_base(void *(*allocator)(size_t size),
 	result->recycle_bin = NULL;
 	result->recycle_size = 0;
 	result->large_list = NULL;
+	result->slab_partial = NULL;
+	result->slab_max = 0;
+	result->slab_groups = NULL;
+	result->slab_avail = NULL;
+	result->slab_group_next = REGION_SLAB_GROUP_MIN;
+	result->slab_count = 0;
+	result->slab_used = 0;
+	result->slab_dirty = 0;
+	result->slab_released = 0;
+	result->tag = REGION_TAG_OTHER;
+	result->profile = NULL;
+	result->profile_bytes = NULL;
 
 	result->allocated = 0;
 	result->data = NULL;
@@ -170,10 +266,247 @@ region_type *region_create_custom(void *(*allocator)(size_t),
 		}
 		memset(result->recycle_bin, 0, sizeof(struct recycle_elem*)
 			* result->large_object_size);
+		/* at least 8 objects in a slab */
+		result->slab_max = ((REGION_SLAB_SIZE - REGION_SLAB_HEADER)
+			/ 8) & ~(ALIGNMENT-1);
+		if(result->slab_max >= result->large_object_size)
+			result->slab_max = result->large_object_size - 1;
+		result->slab_partial = allocator(sizeof(struct region_slab*)
+			* (result->slab_max/ALIGNMENT + 1));
+		if(!result->slab_partial) {
+			region_destroy(result);
+			return NULL;
+		}
+		memset(result->slab_partial, 0, sizeof(struct region_slab*)
+			* (result->slab_max/ALIGNMENT + 1));
+	}
+	return result;
+}
+
+/** remove slab from the list of slabs with free objects */
+static void
+slab_partial_unlink(region_type* region, struct region_slab* s)
+{
+	if(s->prev)
+		s->prev->next = s->next;
+	else	region->slab_partial[s->size/ALIGNMENT] = s->next;
+	if(s->next)
+		s->next->prev = s->prev;
+}
+
+/** add slab to the list of slabs with free objects */
+static void
+slab_partial_link(region_type* region, struct region_slab* s)
+{
+	struct region_slab** list = &region->slab_partial[s->size/ALIGNMENT];
+	s->prev = NULL;
+	s->next = *list;
+	if(*list)
+		(*list)->prev = s;
+	*list = s;
+}
+
+/** remove group from the list of groups with unused slabs */
+static void
+slab_avail_unlink(region_type* region, struct region_slab_group* g)
+{
+	if(g->avail_prev)
+		g->avail_prev->avail_next = g->avail_next;
+	else	region->slab_avail = g->avail_next;
+	if(g->avail_next)
+		g->avail_next->avail_prev = g->avail_prev;
+}
+
+/** add group to the list of groups with unused slabs */
+static void
+slab_avail_link(region_type* region, struct region_slab_group* g)
+{
+	g->avail_prev = NULL;
+	g->avail_next = region->slab_avail;
+	if(region->slab_avail)
+		region->slab_avail->avail_prev = g;
+	region->slab_avail = g;
+}
+
+/** allocate a new group of slabs, the group header is before the slabs
+ * in the same block */
+static struct region_slab_group*
+slab_group_create(region_type* region)
+{
+	size_t num = region->slab_group_next;
+	char* mem = region->allocator(sizeof(struct region_slab_group)
+		+ (num+1)*REGION_SLAB_SIZE);
+	struct region_slab_group* g = (struct region_slab_group*)mem;
+	size_t i;
+	if(!mem)
+		return NULL;
+	g->base = (char*)REGION_ALIGN_UP((size_t)(mem +
+		sizeof(struct region_slab_group)), REGION_SLAB_SIZE);
+	g->num = num;
+	g->num_unused = num;
+	g->dirty = 0;
+	for(i=0; i<num; i++)
+		g->unused[i] = (uint8_t)(num-1-i);
+	g->prev = NULL;
+	g->next = region->slab_groups;
+	if(region->slab_groups)
+		region->slab_groups->prev = g;
+	region->slab_groups = g;
+	slab_avail_link(region, g);
+	if(region->slab_group_next < REGION_SLAB_GROUP_MAX)
+		region->slab_group_next *= 2;
+	return g;
+}
+
+/** take an unused slab for objects of size */
+static struct region_slab*
+slab_create(region_type* region, size_t size)
+{
+	struct region_slab_group* g = region->slab_avail;
+	struct region_slab* s;
+	size_t i;
+	if(!g && !(g = slab_group_create(region)))
+		return NULL;
+	i = g->unused[--g->num_unused];
+	if(g->dirty & ((uint64_t)1<<i)) {
+		g->dirty &= ~((uint64_t)1<<i);
+		region->slab_dirty--;
+	}
+	s = (struct region_slab*)(g->base + i*REGION_SLAB_SIZE);
+	if(g->num_unused == 0)
+		slab_avail_unlink(region, g);
+	s->group = g;
+	s->free = NULL;
+	s->used = 0;
+	s->carved = 0;
+	s->size = size;
+	s->capacity = (REGION_SLAB_SIZE - REGION_SLAB_HEADER) / size;
+	slab_partial_link(region, s);
+	region->slab_count++;
+	return s;
+}
+
+/** give the pages of the unused slabs back to the OS */
+static void
+slab_purge(region_type* region)
+{
+	struct region_slab_group* g;
+	static long pagesize = 0;
+	size_t i, j;
+	if(pagesize == 0)
+		pagesize = sysconf(_SC_PAGESIZE);
+	for(g = region->slab_avail; g; g = g->avail_next) {
+		/* a run of dirty slabs in one call */
+		for(i=0; i<g->num; i=j+1) {
+			j = i;
+			while(j<g->num && (g->dirty & ((uint64_t)1<<j)))
+				j++;
+			if(j == i)
+				continue;
+			region->slab_released += j-i;
+#ifdef MADV_DONTNEED
+			if(pagesize > 0 && REGION_SLAB_SIZE % pagesize == 0)
+				(void)madvise(g->base + i*REGION_SLAB_SIZE,
+					(j-i)*REGION_SLAB_SIZE, MADV_DONTNEED);
+#endif
+		}
+		g->dirty = 0;
+	}
+	region->slab_dirty = 0;
+}
+
+/** give an empty slab back to its group, an empty group is freed */
+static void
+slab_delete(region_type* region, struct region_slab* s)
+{
+	struct region_slab_group* g = s->group;
+	size_t i = ((char*)s - g->base) / REGION_SLAB_SIZE;
+	slab_partial_unlink(region, s);
+	region->slab_count--;
+	if(g->num_unused == 0)
+		slab_avail_link(region, g);
+	g->unused[g->num_unused++] = (uint8_t)i;
+	if(g->num_unused == g->num) {
+		/* the group is empty */
+		for(i=0; i<g->num; i++)
+			if(g->dirty & ((uint64_t)1<<i))
+				region->slab_dirty--;
+		slab_avail_unlink(region, g);
+		if(g->prev)
+			g->prev->next = g->next;
+		else	region->slab_groups = g->next;
+		if(g->next)
+			g->next->prev = g->prev;
+		region->deallocator(g);
+		region->slab_released++;
+		return;
 	}
+	g->dirty |= ((uint64_t)1<<i);
+	region->slab_dirty++;
+	if(region->slab_dirty > region->slab_count/8 + 16)
+		slab_purge(region);
+}
+
+/** allocate an object of aligned size from the slabs */
+static void*
+slab_alloc(region_type* region, size_t size)
+{
+	struct region_slab* s = region->slab_partial[size/ALIGNMENT];
+	void* result;
+	if(!s && !(s = slab_create(region, size)))
+		return NULL;
+	if(s->free) {
+		result = s->free;
+		s->free = s->free->next;
+	} else {
+		result = (char*)s + REGION_SLAB_HEADER + s->carved*size;
+		s->carved++;
+	}
+	s->used++;
+	if(!s->free && s->carved == s->capacity)
+		slab_partial_unlink(region, s);
+	region->slab_used += size;
 	return result;
 }
 
+/** put an object back in its slab, returns the size of the object */
+static size_t
+slab_free(region_type* region, void* block)
+{
+	struct region_slab* s = (struct region_slab*)((size_t)block &
+		~((size_t)REGION_SLAB_SIZE-1));
+	struct recycle_elem* elem = (struct recycle_elem*)block;
+	size_t size = s->size;
+	if(!s->free && s->carved == s->capacity)
+		slab_partial_link(region, s);
+	elem->next = s->free;
+	s->free = elem;
+	s->used--;
+	region->slab_used -= size;
+	if(s->used == 0)
+		slab_delete(region, s);
+	return size;
+}
+
+/** free all slabs of the region */
+static void
+slab_free_all(region_type* region)
+{
+	struct region_slab_group* g = region->slab_groups, *ng;
+	while(g) {
+		ng = g->next;
+		region->deallocator(g);
+		g = ng;
+	}
+	region->slab_groups = NULL;
+	region->slab_avail = NULL;
+	memset(region->slab_partial, 0, sizeof(struct region_slab*)
+		* (region->slab_max/ALIGNMENT + 1));
+	region->slab_count = 0;
+	region->slab_used = 0;
+	region->slab_dirty = 0;
+}
+
 
 void
 region_destroy(region_type *region)
@@ -189,6 +522,10 @@ region_destroy(region_type *region)
 	deallocator(region->initial_data);
 	if(region->recycle_bin)
 		deallocator(region->recycle_bin);
+	if(region->slab_partial)
+		deallocator(region->slab_partial);
+	if(region->profile_bytes)
+		deallocator(region->profile_bytes);
 	if(region->large_list) {
 		struct large_elem* p = region->large_list, *np;
 		while(p) {
@@ -242,8 +579,8 @@ region_remove_cleanup(region_type *region, void (*action)(void *), void *data)
 	}
 }
 
-void *
-region_alloc(region_type *region, size_t size)
+static void *
+region_alloc_object(region_type *region, size_t size)
 {
 	size_t aligned_size;
 	void *result;
@@ -259,6 +596,7 @@ region_alloc(region_type *region, size_t size)
 			return NULL;
 		((struct large_elem*)result)->prev = NULL;
 		((struct large_elem*)result)->next = region->large_list;
+		((struct large_elem*)result)->size = size;
 		if(region->large_list)
 			region->large_list->prev = (struct large_elem*)result;
 		region->large_list = (struct large_elem*)result;
@@ -269,6 +607,16 @@ region_alloc(region_type *region, size_t size)
 		return result + sizeof(struct large_elem);
 	}
 
+	if (region->slab_partial && aligned_size <= region->slab_max) {
+		result = slab_alloc(region, aligned_size);
+		if (!result)
+			return NULL;
+		region->total_allocated += aligned_size;
+		region->unused_space += aligned_size - size;
+		++region->small_objects;
+		return result;
+	}
+
 	if (region->recycle_bin && region->recycle_bin[aligned_size]) {
 		result = (void*)region->recycle_bin[aligned_size];
 		region->recycle_bin[aligned_size] = region->recycle_bin[aligned_size]->next;
@@ -284,11 +632,13 @@ region_alloc(region_type *region, size_t size)
 			return NULL;
 
 		wasted = (region->chunk_size - region->allocated) & (~(ALIGNMENT-1));
-		if(wasted >= ALIGNMENT) {
+		if(wasted >= ALIGNMENT && !(region->slab_partial &&
+			wasted <= region->slab_max)) {
 			/* put wasted part in recycle bin for later use */
 			region->total_allocated += wasted;
 			++region->small_objects;
-			region_recycle(region, region->data+region->allocated, wasted);
+			region_recycle_object(region,
+				region->data+region->allocated, wasted);
 			region->allocated += wasted;
 		}
 		++region->chunk_count;
@@ -315,6 +665,82 @@ region_alloc(region_type *region, size_t size)
 	return result;
 }
 
+/** the bytes that an object of size takes, as the profile counts them */
+static size_t
+region_profile_size(region_type *region, size_t size)
+{
+	size_t aligned_size;
+	if (size == 0) {
+		size = 1;
+	}
+	aligned_size = REGION_ALIGN_UP(size, ALIGNMENT);
+	if (aligned_size >= region->large_object_size)
+		return size;
+	return aligned_size;
+}
+
+/** count bytes that are taken from the region for the tag */
+static void
+region_profile_add(region_type *region, int tag, size_t bytes)
+{
+	struct region_tag_stat* st = &region->profile[tag];
+	region->profile_bytes[tag] += bytes;
+	st->bytes += bytes;
+	if(st->bytes > st->high)
+		st->high = st->bytes;
+}
+
+/** count bytes that are given back to the region for the tag, an object
+ * that was taken with another tag does not make it wrap around */
+static void
+region_profile_sub(region_type *region, int tag, size_t bytes)
+{
+	struct region_tag_stat* st = &region->profile[tag];
+	if(bytes > region->profile_bytes[tag])
+		bytes = region->profile_bytes[tag];
+	region->profile_bytes[tag] -= bytes;
+	st->bytes -= (bytes > st->bytes ? st->bytes : bytes);
+}
+
+/** region_alloc, and count the object for the tag */
+static void *
+region_alloc_profile(region_type *region, size_t size)
+{
+	size_t bytes = region_profile_size(region, size);
+	size_t aligned_size = REGION_ALIGN_UP((size?size:1), ALIGNMENT);
+	struct region_tag_stat* st = &region->profile[region->tag];
+	int hit = 0;
+	void* result;
+	if(aligned_size >= region->large_object_size) {
+		/* large objects are not recycled */
+	} else if(region->slab_partial && aligned_size <= region->slab_max) {
+		struct region_slab* s =
+			region->slab_partial[aligned_size/ALIGNMENT];
+		hit = (s && s->free);
+	} else if(region->recycle_bin) {
+		hit = (region->recycle_bin[aligned_size] != NULL);
+	}
+	result = region_alloc_object(region, size);
+	if(!result)
+		return NULL;
+	region_profile_add(region, region->tag, bytes);
+	st->allocs++;
+	if(region->recycle_bin) {
+		if(hit)
+			st->recycle_hit++;
+		else	st->recycle_miss++;
+	}
+	return result;
+}
+
+void *
+region_alloc(region_type *region, size_t size)
+{
+	if(region->profile)
+		return region_alloc_profile(region, size);
+	return region_alloc_object(region, size);
+}
+
 void *
 region_alloc_init(region_type *region, const void *init, size_t size)
 {
@@ -374,6 +800,13 @@ region_free_all(region_type *region)
 	assert(region);
 	assert(region->cleanups);
 
+	/* before the cleanups, the array can be in memory of the region */
+	if(region->profile) {
+		for(i=0; i<REGION_TAG_COUNT; i++)
+			region_profile_sub(region, (int)i,
+				region->profile_bytes[i]);
+	}
+
 	i = region->cleanup_count;
 	while (i > 0) {
 		--i;
@@ -386,6 +819,8 @@ region_free_all(region_type *region)
 			* region->large_object_size);
 		region->recycle_size = 0;
 	}
+	if(region->slab_partial)
+		slab_free_all(region);
 
 	if(region->large_list) {
 		struct large_elem* p = region->large_list, *np;
@@ -418,6 +853,19 @@ region_strdup(region_type *region, const char *string)
 
 void
 region_recycle(region_type *region, void *block, size_t size)
+{
+	if(!block || !region->recycle_bin)
+		return;
+	if(region->profile) {
+		region_profile_sub(region, region->tag,
+			region_profile_size(region, size));
+		region->profile[region->tag].recycles++;
+	}
+	region_recycle_object(region, block, size);
+}
+
+static void
+region_recycle_object(region_type *region, void *block, size_t size)
 {
 	size_t aligned_size;
 
@@ -429,7 +877,15 @@ region_recycle(region_type *region, void *block, size_t size)
 	}
 	aligned_size = REGION_ALIGN_UP(size, ALIGNMENT);
 
-	if(aligned_size < region->large_object_size) {
+	if(region->slab_partial && aligned_size <= region->slab_max) {
+		/* the slab knows the size */
+		aligned_size = slab_free(region, block);
+		assert(aligned_size >= size);
+		region->total_allocated -= aligned_size;
+		region->unused_space -= aligned_size - size;
+		--region->small_objects;
+		return;
+	} else if(aligned_size < region->large_object_size) {
 		struct recycle_elem* elem = (struct recycle_elem*)block;
 		/* we rely on the fact that ALIGNMENT is void* so the next will fit */
 		assert(aligned_size >= sizeof(struct recycle_elem));
@@ -467,6 +923,27 @@ region_recycle(region_type *region, void *block, size_t size)
 	}
 }
 
+void
+region_walk_blocks(region_type* region,
+	void (*func)(void* block, size_t size, void* arg), void* arg)
+{
+	struct region_slab_group* g;
+	struct large_elem* l;
+	size_t i;
+	if(region->initial_data)
+		func(region->initial_data, region->chunk_size, arg);
+	/* the other chunks are freed by a cleanup with the deallocator */
+	for(i=0; i<region->cleanup_count; i++) {
+		if(region->cleanups[i].action == region->deallocator)
+			func(region->cleanups[i].data, region->chunk_size, arg);
+	}
+	for(g = region->slab_groups; g; g = g->next)
+		func(g, sizeof(struct region_slab_group) +
+			(g->num+1)*REGION_SLAB_SIZE, arg);
+	for(l = region->large_list; l; l = l->next)
+		func(l, sizeof(struct large_elem) + l->size, arg);
+}
+
 void
 region_dump_stats(region_type *region, FILE *out)
 {
@@ -479,6 +956,20 @@ region_dump_stats(region_type *region, FILE *out)
 		(unsigned long) region->chunk_count,
 		(unsigned long) region->cleanup_count,
 		(unsigned long) region->recycle_size);
+	if(region->slab_partial)
+		fprintf(out, ", %lu slabs of %lu bytes, %lu in use, %lu released",
+			(unsigned long) region->slab_count,
+			(unsigned long) REGION_SLAB_SIZE,
+			(unsigned long) region->slab_used,
+			(unsigned long) region->slab_released);
+	if(region->profile) {
+		/* the bytes of the region per tag */
+		int t;
+		for(t=0; t<REGION_TAG_COUNT; t++)
+			if(region->profile_bytes[t])
+				fprintf(out, ", %s %lu", region_tag_names[t],
+					(unsigned long)region->profile_bytes[t]);
+	}
 	if(1 && region->recycle_bin) {
 		/* print details of the recycle bin */
 		size_t i;
@@ -510,6 +1001,21 @@ size_t region_get_mem_unused(region_type* region)
 	return region->unused_space;
 }
 
+int region_overflowed(region_type* region)
+{
+	return region->chunk_count > 1 || region->large_list != NULL;
+}
+
+size_t region_get_slab_mem(region_type* region)
+{
+	return region->slab_count * REGION_SLAB_SIZE;
+}
+
+size_t region_get_slab_used(region_type* region)
+{
+	return region->slab_used;
+}
+
 /* debug routine */
 void
 region_log_stats(region_type *region)
@@ -529,6 +1035,29 @@ region_log_stats(region_type *region)
 	len = strlen(str);
 	str+=len;
 	strl-=len;
+	if(region->slab_partial) {
+		snprintf(str, strl, ", %lu slabs of %lu bytes, %lu in use, "
+			"%lu released",
+			(unsigned long) region->slab_count,
+			(unsigned long) REGION_SLAB_SIZE,
+			(unsigned long) region->slab_used,
+			(unsigned long) region->slab_released);
+		len = strlen(str);
+		str+=len;
+		strl-=len;
+	}
+	if(region->profile) {
+		int t;
+		for(t=0; t<REGION_TAG_COUNT; t++) {
+			if(!region->profile_bytes[t])
+				continue;
+			snprintf(str, strl, ", %s %lu", region_tag_names[t],
+				(unsigned long)region->profile_bytes[t]);
+			len = strlen(str);
+			str+=len;
+			strl-=len;
+		}
+	}
 	if(1 && region->recycle_bin) {
 		/* print details of the recycle bin */
 		size_t i;
@@ -549,3 +1078,62 @@ region_log_stats(region_type *region)
 	}
 	log_msg(LOG_INFO, "memory: %s", buf);
 }
+
+const char*
+region_tag_name(int tag)
+{
+	if(tag < 0 || tag >= REGION_TAG_COUNT)
+		return "unknown";
+	return region_tag_names[tag];
+}
+
+int
+region_set_tag(region_type* region, int tag)
+{
+	int old = region->tag;
+	assert(tag >= 0 && tag < REGION_TAG_COUNT);
+	region->tag = tag;
+	return old;
+}
+
+int
+region_set_profile(region_type* region, struct region_tag_stat* stats)
+{
+	size_t i;
+	if(region->profile) {
+		for(i=0; i<REGION_TAG_COUNT; i++)
+			region_profile_sub(region, (int)i,
+				region->profile_bytes[i]);
+		region->profile = NULL;
+	}
+	if(!stats)
+		return 1;
+	if(!region->profile_bytes) {
+		region->profile_bytes = (size_t*)region->allocator(
+			sizeof(size_t)*REGION_TAG_COUNT);
+		if(!region->profile_bytes)
+			return 0;
+	}
+	memset(region->profile_bytes, 0, sizeof(size_t)*REGION_TAG_COUNT);
+	region->profile = stats;
+	/* what is in use now, it was allocated before the counting */
+	region_profile_add(region, region->tag, region->total_allocated);
+	stats[region->tag].allocs += region->small_objects +
+		region->large_objects;
+	return 1;
+}
+
+void
+region_tag_stat_add(struct region_tag_stat* dest,
+	struct region_tag_stat* src)
+{
+	int i;
+	for(i=0; i<REGION_TAG_COUNT; i++) {
+		dest[i].bytes += src[i].bytes;
+		dest[i].high += src[i].high;
+		dest[i].allocs += src[i].allocs;
+		dest[i].recycles += src[i].recycles;
+		dest[i].recycle_hit += src[i].recycle_hit;
+		dest[i].recycle_miss += src[i].recycle_miss;
+	}
+}
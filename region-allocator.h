@@ -50,6 +50,8 @@ region_type *region_create(void *(*allocator)(size_t),
  * initial_cleanup_size is the number of prealloced ptrs for cleanups.
  * The cleanups are in a growing array, and it must start larger than zero.
  * If recycle is true, environmentally friendly memory recycling is be enabled.
+ * The small objects are then allocated from slabs of objects of one
+ * size, and empty slabs are given back to the OS.
  */
 region_type *region_create_custom(void *(*allocator)(size_t),
 				  void (*deallocator)(void *),
@@ -146,8 +148,76 @@ size_t region_get_recycle_size(region_type* region);
 size_t region_get_mem(region_type* region);
 /* get size of region memory unused */
 size_t region_get_mem_unused(region_type* region);
+/* get size of memory in slabs, and the part of it used by objects, the
+ * difference is the fragmentation of the slabs */
+size_t region_get_slab_mem(region_type* region);
+size_t region_get_slab_used(region_type* region);
+/* true if the allocations since region_free_all did not fit in the
+ * initial chunk and more memory was allocated for them */
+int region_overflowed(region_type* region);
+
+/*
+ * Call func with the start and size of every block of memory that the
+ * region has from its allocator: the chunks, the slab groups and the
+ * large objects.
+ */
+void region_walk_blocks(region_type* region,
+	void (*func)(void* block, size_t size, void* arg), void* arg);
 
 /* Debug print REGION statistics to LOG. */
 void region_log_stats(region_type *region);
 
+/*
+ * The subsystems that the memory of a region is counted for, with
+ * profiling.  The tag of a region is OTHER, unless it is changed with
+ * region_set_tag; regions that hold the data of several subsystems
+ * change it around the allocations.
+ */
+#define REGION_TAG_OTHER	0
+#define REGION_TAG_DOMAINS	1
+#define REGION_TAG_RRSETS	2
+#define REGION_TAG_RDATA	3
+#define REGION_TAG_NSEC3	4
+#define REGION_TAG_COMPRESSION	5
+#define REGION_TAG_TCP		6
+#define REGION_TAG_OPTIONS	7
+#define REGION_TAG_COUNT	8
+
+/* the counters of a tag, for one or more regions */
+struct region_tag_stat {
+	/* bytes of the objects in use, and the most there were in use */
+	size_t bytes;
+	size_t high;
+	/* number of allocations and recycles */
+	size_t allocs;
+	size_t recycles;
+	/* allocations in recycling regions that took an object from the
+	 * recycle bin or a slab free list, and those that took new memory */
+	size_t recycle_hit;
+	size_t recycle_miss;
+};
+
+/* the name of the tag, like "rrsets" */
+const char* region_tag_name(int tag);
+
+/*
+ * Set the tag that the allocations and recycles that follow are counted
+ * for.  Returns the previous tag, to set it back.
+ */
+int region_set_tag(region_type* region, int tag);
+
+/*
+ * Count the allocations of REGION per tag, in STATS, an array of
+ * REGION_TAG_COUNT elements, or stop counting with NULL.  The memory
+ * the region already has is counted for its current tag.  Regions that
+ * are used by the same thread can share the array.  When the region is
+ * freed its bytes are taken from the array, but the other counters stay.
+ * Returns 0 on alloc failure.
+ */
+int region_set_profile(region_type* region, struct region_tag_stat* stats);
+
+/* add the counters of the tags in SRC to DEST, for a sum of arrays */
+void region_tag_stat_add(struct region_tag_stat* dest,
+	struct region_tag_stat* src);
+
 #endif /* _REGION_ALLOCATOR_H_ */
@@ -58,6 +58,8 @@
 #include <unistd.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #ifndef USE_MINI_EVENT
 #  ifdef HAVE_EVENT_H
 #    include <event.h>
@@ -74,10 +76,14 @@
 #include "xfrd.h"
 #include "xfrd-notify.h"
 #include "xfrd-tcp.h"
+#include "xfrd-watch.h"
 #include "nsd.h"
 #include "options.h"
 #include "difffile.h"
 #include "ipc.h"
+#include "query.h"
+#include "topk.h"
+#include "udpfilter.h"
 
 #ifdef HAVE_SYS_TYPES_H
 #  include <sys/types.h>
@@ -97,6 +103,18 @@
  * it omits zeroes for types that have no acronym and unused-rcodes */
 const int inhibit_zero = 1;
 
+/**
+ * a control connection, over SSL, or plain over a local socket, then
+ * ssl is NULL.
+ */
+struct remote_stream {
+	/** the ssl state, or NULL */
+	SSL* ssl;
+	/** the file descriptor */
+	int fd;
+};
+typedef struct remote_stream RES;
+
 /**
  * a busy control command connection, SSL state
  * Defined here to keep the definition private, and keep SSL out of the .h
@@ -112,8 +130,8 @@ struct rc_state {
 	struct timeval tval;
 	/** in the handshake part */
 	enum { rc_none, rc_hs_read, rc_hs_write } shake_state;
-	/** the ssl state */
-	SSL* ssl;
+	/** the ssl state, or the local socket */
+	RES res;
 	/** the rc this is part of */
 	struct daemon_remote* rc;
 	/** stats list next item */
@@ -121,7 +139,44 @@ struct rc_state {
 	/** stats list indicator (0 is not part of stats list, 1 is stats,
 	 * 2 is stats_noreset. */
 	int in_stats_list;
+	/** with stats_stream, the counters that were printed last, and
+	 * when, the connection stays open, NULL if not a stream */
+	struct nsdst* stream_last;
+	struct timeval stream_time;
+	/** with zonestatus for all zones, the walk over the zones that is
+	 * printed a chunk at a time, NULL if not busy */
+	struct zonestatus_walk* zonestatus;
+};
+
+/** the states that zonestatus prints, for the state= filter */
+#define ZONESTATUS_MASTER	0x01
+#define ZONESTATUS_OK		0x02
+#define ZONESTATUS_EXPIRED	0x04
+#define ZONESTATUS_REFRESHING	0x08
+#define ZONESTATUS_ALL		0x0f
+/** the number of zones zonestatus looks at before it returns to the
+ * event loop, so that timers and transfers keep going */
+#define ZONESTATUS_CHUNK	1000
+
+/**
+ * zonestatus of all zones, with the filters.  The walk continues at the
+ * zone after next, that is a copy, because the zone can be deleted
+ * between the chunks.
+ */
+struct zonestatus_walk {
+	/** the zone to continue with, malloced, NULL at the start */
+	dname_type* next;
+	/** the states to print, ZONESTATUS_ bits */
+	int states;
+	/** print the zones that acquired a serial at or after this time,
+	 * or 0 for all zones */
+	time_t since;
+	/** the number of matching zones to skip */
+	size_t offset;
+	/** the number of zones to print, or 0 for all */
+	size_t count;
 };
+static void zonestatus_walk_delete(struct zonestatus_walk* w);
 
 /**
  * list of events for accepting connections
@@ -130,6 +185,10 @@ struct acceptlist {
 	struct acceptlist* next;
 	int event_added;
 	struct event c;
+	/** the rc this is part of */
+	struct daemon_remote* rc;
+	/** a local socket, the connections do not use SSL */
+	int local;
 };
 
 /**
@@ -156,11 +215,11 @@ struct daemon_remote {
 
 /** 
  * Print fixed line of text over ssl connection in blocking mode
- * @param ssl: print to
+ * @param ssl: print to, ssl or the local socket
  * @param text: the text.
  * @return false on connection failure.
  */
-static int ssl_print_text(SSL* ssl, const char* text);
+static int ssl_print_text(RES* ssl, const char* text);
 
 /** 
  * printf style printing to the ssl connection
@@ -168,7 +227,7 @@ static int ssl_print_text(SSL* ssl, const char* text);
  * @param format: printf style format string.
  * @return success or false on a network failure.
  */
-static int ssl_printf(SSL* ssl, const char* format, ...)
+static int ssl_printf(RES* ssl, const char* format, ...)
         ATTR_FORMAT(printf, 2, 3);
 
 /**
@@ -179,7 +238,7 @@ static int ssl_printf(SSL* ssl, const char* format, ...)
  * @param max: size of buffer.
  * @return false on connection failure.
  */
-static int ssl_read_line(SSL* ssl, char* buf, size_t max);
+static int ssl_read_line(RES* ssl, char* buf, size_t max);
 
 /** perform the accept of a new remote control connection */
 static void
@@ -193,21 +252,6 @@ remote_control_callback(int fd, short event, void* arg);
 /** ---- end of private defines ---- **/
 
 
-/** log ssl crypto err */
-static void
-log_crypto_err(const char* str)
-{
-	/* error:[error code]:[library name]:[function name]:[reason string] */
-	char buf[128];
-	unsigned long e;
-	ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
-	log_msg(LOG_ERR, "%s crypto %s", str, buf);
-	while( (e=ERR_get_error()) ) {
-		ERR_error_string_n(e, buf, sizeof(buf));
-		log_msg(LOG_ERR, "and additionally crypto %s", buf);
-	}
-}
-
 #ifdef BIND8_STATS
 /** subtract timers and the values do not overflow or become negative */
 static void
@@ -236,6 +280,19 @@ daemon_remote_create(nsd_options_t* cfg)
 	rc->max_active = 10;
 	assert(cfg->control_enable);
 
+	if(!options_remote_is_address(cfg)) {
+		/* only local sockets, no SSL keys are needed */
+		if(!daemon_remote_open_ports(rc, cfg)) {
+			log_msg(LOG_ERR, "could not open remote control port");
+			daemon_remote_delete(rc);
+			return NULL;
+		}
+		if(gettimeofday(&rc->boot_time, NULL) == -1)
+			log_msg(LOG_ERR, "gettimeofday: %s", strerror(errno));
+		rc->stats_time = rc->boot_time;
+		return rc;
+	}
+
 	/* init SSL library */
 	ERR_load_crypto_strings();
 	ERR_load_SSL_strings();
@@ -337,9 +394,11 @@ void daemon_remote_close(struct daemon_remote* rc)
 		np = p->next;
 		if(p->event_added)
 			event_del(&p->c);
-		if(p->ssl)
-			SSL_free(p->ssl);
+		if(p->res.ssl)
+			SSL_free(p->res.ssl);
 		close(p->c.ev_fd);
+		free(p->stream_last);
+		zonestatus_walk_delete(p->zonestatus);
 		free(p);
 		p = np;
 	}
@@ -409,6 +468,66 @@ create_tcp_accept_sock(struct addrinfo* addr, int* noproto)
 	return s;
 }
 
+/**
+ * Add and open a local control socket, the connections to it are not
+ * encrypted and not authenticated, the file permissions are the access
+ * control.
+ * @param rc: rc with result list.
+ * @param path: the socket file.
+ * @return false on failure.
+ */
+static int
+add_open_local(struct daemon_remote* rc, const char* path)
+{
+	struct sockaddr_un addr;
+	struct acceptlist* hl;
+	int fd;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		log_msg(LOG_ERR, "control interface %s: path too long", path);
+		return 0;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+	if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		log_msg(LOG_ERR, "control interface %s: socket: %s", path,
+			strerror(errno));
+		return 0;
+	}
+	/* a socket left over from a previous run */
+	(void)unlink(path);
+	if(bind(fd, (struct sockaddr*)&addr, (socklen_t)sizeof(addr)) == -1) {
+		log_msg(LOG_ERR, "control interface %s: bind: %s", path,
+			strerror(errno));
+		close(fd);
+		return 0;
+	}
+	/* the owner and the group can connect, the group is set to that
+	 * of the nsd user after the privileges are known */
+	if(chmod(path, 0660) == -1)
+		log_msg(LOG_ERR, "control interface %s: chmod: %s", path,
+			strerror(errno));
+	if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "control interface %s: fcntl: %s", path,
+			strerror(errno));
+	}
+	if(listen(fd, TCP_BACKLOG_REMOTE) == -1) {
+		log_msg(LOG_ERR, "control interface %s: listen: %s", path,
+			strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	hl = (struct acceptlist*)xalloc_zero(sizeof(*hl));
+	hl->next = rc->accept_list;
+	rc->accept_list = hl;
+
+	hl->c.ev_fd = fd;
+	hl->event_added = 0;
+	hl->local = 1;
+	return 1;
+}
+
 /**
  * Add and open a new control port
  * @param rc: rc with result list.
@@ -475,7 +594,11 @@ daemon_remote_open_ports(struct daemon_remote* rc, nsd_options_t* cfg)
 	if(cfg->control_interface) {
 		ip_address_option_t* p;
 		for(p = cfg->control_interface; p; p = p->next) {
-			if(!add_open(rc, p->address, cfg->control_port, 1)) {
+			if(p->address[0] == '/') {
+				if(!add_open_local(rc, p->address))
+					return 0;
+			} else if(!add_open(rc, p->address, cfg->control_port,
+				1)) {
 				return 0;
 			}
 		}
@@ -502,8 +625,9 @@ daemon_remote_attach(struct daemon_remote* rc, struct xfrd_state* xfrd)
 	for(p = rc->accept_list; p; p = p->next) {
 		/* add event */
 		fd = p->c.ev_fd;
+		p->rc = rc;
 		event_set(&p->c, fd, EV_PERSIST|EV_READ, remote_accept_callback,
-			rc);
+			p);
 		if(event_base_set(xfrd->event_base, &p->c) != 0)
 			log_msg(LOG_ERR, "remote: cannot set event_base");
 		if(event_add(&p->c, NULL) != 0)
@@ -515,7 +639,8 @@ daemon_remote_attach(struct daemon_remote* rc, struct xfrd_state* xfrd)
 static void
 remote_accept_callback(int fd, short event, void* arg)
 {
-	struct daemon_remote *rc = (struct daemon_remote*)arg;
+	struct acceptlist* al = (struct acceptlist*)arg;
+	struct daemon_remote *rc = al->rc;
 #ifdef INET6
 	struct sockaddr_storage addr;
 #else
@@ -584,6 +709,14 @@ remote_accept_callback(int fd, short event, void* arg)
 	}
 	n->event_added = 1;
 
+	n->res.fd = newfd;
+	if(al->local) {
+		/* no SSL over the local socket */
+		VERBOSITY(2, (LOG_INFO, "new local control connection"));
+		n->shake_state = rc_none;
+		n->res.ssl = NULL;
+		goto add_busy;
+	}
 	if(2 <= verbosity) {
 		char s[128];
 		addr2str(&addr, s, sizeof(s));
@@ -591,23 +724,24 @@ remote_accept_callback(int fd, short event, void* arg)
 	}
 
 	n->shake_state = rc_hs_read;
-	n->ssl = SSL_new(rc->ctx);
-	if(!n->ssl) {
+	n->res.ssl = SSL_new(rc->ctx);
+	if(!n->res.ssl) {
 		log_crypto_err("could not SSL_new");
 		event_del(&n->c);
 		free(n);
 		goto close_exit;
 	}
-	SSL_set_accept_state(n->ssl);
-        (void)SSL_set_mode(n->ssl, SSL_MODE_AUTO_RETRY);
-	if(!SSL_set_fd(n->ssl, newfd)) {
+	SSL_set_accept_state(n->res.ssl);
+        (void)SSL_set_mode(n->res.ssl, SSL_MODE_AUTO_RETRY);
+	if(!SSL_set_fd(n->res.ssl, newfd)) {
 		log_crypto_err("could not SSL_set_fd");
 		event_del(&n->c);
-		SSL_free(n->ssl);
+		SSL_free(n->res.ssl);
 		free(n);
 		goto close_exit;
 	}
 
+add_busy:
 	n->rc = rc;
 	n->stats_next = NULL;
 	n->in_stats_list = 0;
@@ -654,20 +788,70 @@ clean_point(struct daemon_remote* rc, struct rc_state* s)
 	rc->active --;
 	if(s->event_added)
 		event_del(&s->c);
-	if(s->ssl) {
-		SSL_shutdown(s->ssl);
-		SSL_free(s->ssl);
+	if(s->res.ssl) {
+		SSL_shutdown(s->res.ssl);
+		SSL_free(s->res.ssl);
 	}
 	close(s->c.ev_fd);
+	free(s->stream_last);
+	zonestatus_walk_delete(s->zonestatus);
 	free(s);
 }
 
+/** write to the local socket, false on failure */
+static int
+local_write(int fd, const char* buf, size_t len)
+{
+	ssize_t r;
+	while(len > 0) {
+		if((r = write(fd, buf, len)) == -1) {
+			if(errno == EINTR)
+				continue;
+			VERBOSITY(2, (LOG_WARNING, "could not write to local "
+				"control connection: %s", strerror(errno)));
+			return 0;
+		}
+		buf += r;
+		len -= (size_t)r;
+	}
+	return 1;
+}
+
+/** read from the control connection, returns the length, 0 on EOF, and
+ * -1 on failure */
+static int
+res_read(RES* res, char* buf, int len)
+{
+	int r;
+	if(!res->ssl) {
+		while((r = (int)read(res->fd, buf, (size_t)len)) == -1 &&
+			errno == EINTR)
+			;
+		if(r == -1)
+			log_msg(LOG_ERR, "could not read local control "
+				"connection: %s", strerror(errno));
+		return r;
+	}
+	ERR_clear_error();
+	if((r=SSL_read(res->ssl, buf, len)) <= 0) {
+		if(SSL_get_error(res->ssl, r) == SSL_ERROR_ZERO_RETURN)
+			return 0;
+		log_crypto_err("could not SSL_read");
+		return -1;
+	}
+	return r;
+}
+
 static int
-ssl_print_text(SSL* ssl, const char* text)
+ssl_print_text(RES* res, const char* text)
 {
 	int r;
-	if(!ssl) 
+	SSL* ssl;
+	if(!res) 
 		return 0;
+	if(!res->ssl)
+		return local_write(res->fd, text, strlen(text));
+	ssl = res->ssl;
 	ERR_clear_error();
 	if((r=SSL_write(ssl, text, (int)strlen(text))) <= 0) {
 		if(SSL_get_error(ssl, r) == SSL_ERROR_ZERO_RETURN) {
@@ -683,7 +867,7 @@ ssl_print_text(SSL* ssl, const char* text)
 
 /** print text over the ssl connection */
 static int
-ssl_print_vmsg(SSL* ssl, const char* format, va_list args)
+ssl_print_vmsg(RES* ssl, const char* format, va_list args)
 {
 	char msg[1024];
 	vsnprintf(msg, sizeof(msg), format, args);
@@ -692,7 +876,7 @@ ssl_print_vmsg(SSL* ssl, const char* format, va_list args)
 
 /** printf style printing to the ssl connection */
 static int
-ssl_printf(SSL* ssl, const char* format, ...)
+ssl_printf(RES* ssl, const char* format, ...)
 {
 	va_list args;
 	int ret;
@@ -703,20 +887,18 @@ ssl_printf(SSL* ssl, const char* format, ...)
 }
 
 static int
-ssl_read_line(SSL* ssl, char* buf, size_t max)
+ssl_read_line(RES* ssl, char* buf, size_t max)
 {
 	int r;
 	size_t len = 0;
 	if(!ssl)
 		return 0;
 	while(len < max) {
-		ERR_clear_error();
-		if((r=SSL_read(ssl, buf+len, 1)) <= 0) {
-			if(SSL_get_error(ssl, r) == SSL_ERROR_ZERO_RETURN) {
+		if((r=res_read(ssl, buf+len, 1)) <= 0) {
+			if(r == 0) {
 				buf[len] = 0;
 				return 1;
 			}
-			log_crypto_err("could not SSL_read");
 			return 0;
 		}
 		if(buf[len] == '\n') {
@@ -743,14 +925,14 @@ skipwhite(char* str)
 
 /** send the OK to the control client */
 static void
-send_ok(SSL* ssl)
+send_ok(RES* ssl)
 {
 	(void)ssl_printf(ssl, "ok\n");
 }
 
 /** get zone argument (if any) or NULL, false on error */
 static int
-get_zone_arg(SSL* ssl, xfrd_state_t* xfrd, char* arg,
+get_zone_arg(RES* ssl, xfrd_state_t* xfrd, char* arg,
 	zone_options_t** zo)
 {
 	const dname_type* dname;
@@ -776,7 +958,7 @@ get_zone_arg(SSL* ssl, xfrd_state_t* xfrd, char* arg,
 
 /** do the stop command */
 static void
-do_stop(SSL* ssl, xfrd_state_t* xfrd)
+do_stop(RES* ssl, xfrd_state_t* xfrd)
 {
 	xfrd->need_to_send_shutdown = 1;
 
@@ -789,7 +971,7 @@ do_stop(SSL* ssl, xfrd_state_t* xfrd)
 
 /** do the log_reopen command, it only needs reload_now */
 static void
-do_log_reopen(SSL* ssl, xfrd_state_t* xfrd)
+do_log_reopen(RES* ssl, xfrd_state_t* xfrd)
 {
 	xfrd_set_reload_now(xfrd);
 	send_ok(ssl);
@@ -797,7 +979,7 @@ do_log_reopen(SSL* ssl, xfrd_state_t* xfrd)
 
 /** do the reload command */
 static void
-do_reload(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+do_reload(RES* ssl, xfrd_state_t* xfrd, char* arg)
 {
 	zone_options_t* zo;
 	if(!get_zone_arg(ssl, xfrd, arg, &zo))
@@ -810,7 +992,7 @@ do_reload(SSL* ssl, xfrd_state_t* xfrd, char* arg)
 
 /** do the write command */
 static void
-do_write(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+do_write(RES* ssl, xfrd_state_t* xfrd, char* arg)
 {
 	zone_options_t* zo;
 	if(!get_zone_arg(ssl, xfrd, arg, &zo))
@@ -823,7 +1005,7 @@ do_write(SSL* ssl, xfrd_state_t* xfrd, char* arg)
 
 /** do the notify command */
 static void
-do_notify(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+do_notify(RES* ssl, xfrd_state_t* xfrd, char* arg)
 {
 	zone_options_t* zo;
 	if(!get_zone_arg(ssl, xfrd, arg, &zo))
@@ -848,7 +1030,7 @@ do_notify(SSL* ssl, xfrd_state_t* xfrd, char* arg)
 
 /** do the transfer command */
 static void
-do_transfer(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+do_transfer(RES* ssl, xfrd_state_t* xfrd, char* arg)
 {
 	zone_options_t* zo;
 	xfrd_zone_t* zone;
@@ -889,7 +1071,7 @@ force_transfer_zone(xfrd_zone_t* zone)
 
 /** do the force transfer command */
 static void
-do_force_transfer(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+do_force_transfer(RES* ssl, xfrd_state_t* xfrd, char* arg)
 {
 	zone_options_t* zo;
 	xfrd_zone_t* zone;
@@ -913,7 +1095,7 @@ do_force_transfer(SSL* ssl, xfrd_state_t* xfrd, char* arg)
 }
 
 static int
-print_soa_status(SSL* ssl, const char* str, xfrd_soa_t* soa, time_t acq)
+print_soa_status(RES* ssl, const char* str, xfrd_soa_t* soa, time_t acq)
 {
 	if(acq) {
 		if(!ssl_printf(ssl, "	%s: \"%u since %s\"\n", str,
@@ -926,9 +1108,54 @@ print_soa_status(SSL* ssl, const char* str, xfrd_soa_t* soa, time_t acq)
 	return 1;
 }
 
+#ifdef USE_ZONE_STATS
+/** print the cpu counters of a zonestats group, returns 0 on error */
+static int
+zonestat_print_cpu(RES* ssl, const char* n, const char* d, uint64_t* cpu)
+{
+	return ssl_printf(ssl, "%s%scpu.query=%llu.%6.6llu\n", n, d,
+		(unsigned long long)(cpu[ZONESTAT_CPU_QUERY]/1000000000),
+		(unsigned long long)(cpu[ZONESTAT_CPU_QUERY]%1000000000)/1000)
+		&& ssl_printf(ssl, "%s%scpu.axfr=%llu.%6.6llu\n", n, d,
+		(unsigned long long)(cpu[ZONESTAT_CPU_AXFR]/1000000000),
+		(unsigned long long)(cpu[ZONESTAT_CPU_AXFR]%1000000000)/1000)
+		&& ssl_printf(ssl, "%s%scpu.samples=%llu\n", n, d,
+		(unsigned long long)cpu[ZONESTAT_CPU_SAMPLES]);
+}
+
+/** print the cpu time of the zonestats group of the zone, in zonestatus,
+ * since the start; returns 0 on error */
+static int
+print_zonestatus_cpu(RES* ssl, xfrd_state_t* xfrd, zone_options_t* zo)
+{
+	struct zonestatname* n;
+	struct nsdst st;
+	uint64_t other = 0, cpu[ZONESTAT_CPU];
+	const char* statname;
+	if(!zo->pattern->zonestats || zo->pattern->zonestats[0]==0)
+		return 1;
+	statname = config_cook_string(zo, zo->pattern->zonestats);
+	n = (struct zonestatname*)rbtree_search(
+		xfrd->nsd->options->zonestatnames, statname);
+	if(!n || n->id >= xfrd->zonestat_safe)
+		return 1;
+	memset(&st, 0, sizeof(st));
+	memset(cpu, 0, sizeof(cpu));
+	zonestat_sum(&st, &other, cpu, xfrd->nsd->zonestat,
+		xfrd->nsd->zonestatshards, n->id);
+	return ssl_printf(ssl, "	zonestats: %s\n", statname) &&
+		ssl_printf(ssl, "	cpu-query: %llu.%6.6llu\n",
+		(unsigned long long)(cpu[ZONESTAT_CPU_QUERY]/1000000000),
+		(unsigned long long)(cpu[ZONESTAT_CPU_QUERY]%1000000000)/1000)
+		&& ssl_printf(ssl, "	cpu-axfr: %llu.%6.6llu\n",
+		(unsigned long long)(cpu[ZONESTAT_CPU_AXFR]/1000000000),
+		(unsigned long long)(cpu[ZONESTAT_CPU_AXFR]%1000000000)/1000);
+}
+#endif /* USE_ZONE_STATS */
+
 /** print zonestatus for one domain */
 static int
-print_zonestatus(SSL* ssl, xfrd_state_t* xfrd, zone_options_t* zo)
+print_zonestatus(RES* ssl, xfrd_state_t* xfrd, zone_options_t* zo)
 {
 	xfrd_zone_t* xz = (xfrd_zone_t*)rbtree_search(xfrd->zones,
 		(const dname_type*)zo->node.key);
@@ -940,15 +1167,41 @@ print_zonestatus(SSL* ssl, xfrd_state_t* xfrd, zone_options_t* zo)
 		if(!ssl_printf(ssl, "	pattern: %s\n", zo->pattern->pname))
 			return 0;
 	}
+#ifdef USE_ZONE_STATS
+	if(xfrd->nsd->options->zone_cpu_sample &&
+		!print_zonestatus_cpu(ssl, xfrd, zo))
+		return 0;
+#endif
 	if(nz) {
 		if(nz->is_waiting) {
 			if(!ssl_printf(ssl, "	notify: \"waiting-for-fd\"\n"))
 				return 0;
 		} else if(nz->notify_send_enable) {
-			if(!ssl_printf(ssl, "	notify: \"sent try %d "
-				"to %s with serial %u\"\n", nz->notify_retry,
-				nz->notify_current->ip_address_spec,
-				(unsigned)ntohl(nz->current_soa->serial)))
+			int i;
+			for(i=0; i<nz->pkts_num; i++) {
+				if(!nz->pkts[i].dest)
+					continue;
+				if(!ssl_printf(ssl, "	notify: \"sent try %d "
+					"to %s with serial %u\"\n",
+					nz->pkts[i].notify_retry,
+					nz->pkts[i].dest->ip_address_spec,
+					(unsigned)ntohl(nz->current_soa->serial)))
+					return 0;
+			}
+		}
+		if(nz->mem.domain_count != 0) {
+			struct zone_mem_stat* m = &nz->mem;
+			if(!ssl_printf(ssl, "	domains: %llu\n",
+				(unsigned long long)m->domain_count))
+				return 0;
+			if(!ssl_printf(ssl, "	memory: \"%llu bytes: names "
+				"%llu rrsets %llu rdata %llu nsec3 %llu\"\n",
+				(unsigned long long)(m->domains + m->rrsets +
+				m->rdata + m->nsec3),
+				(unsigned long long)m->domains,
+				(unsigned long long)m->rrsets,
+				(unsigned long long)m->rdata,
+				(unsigned long long)m->nsec3))
 				return 0;
 		}
 	}
@@ -996,26 +1249,182 @@ print_zonestatus(SSL* ssl, xfrd_state_t* xfrd, zone_options_t* zo)
 	return 1;
 }
 
+/** parse the filters of zonestatus, false on a syntax error */
+static int
+zonestatus_parse(RES* ssl, char* arg, struct zonestatus_walk* w)
+{
+	static const char* states[] = { "master", "ok", "expired",
+		"refreshing" };
+	char* p = skipwhite(arg), *e, *v;
+	int i;
+	w->states = 0;
+	while(*p) {
+		for(e = p; *e && !isspace((unsigned char)*e); e++)
+			;
+		if(*e)
+			*e++ = 0;
+		if(!(v = strchr(p, '=')) || v[1] == 0) {
+			(void)ssl_printf(ssl, "error in zonestatus syntax: "
+				"%s\n", p);
+			return 0;
+		}
+		*v++ = 0;
+		if(strcmp(p, "state") == 0) {
+			for(i=0; i<4; i++) {
+				if(strcmp(v, states[i]) == 0)
+					break;
+			}
+			if(i == 4) {
+				(void)ssl_printf(ssl, "error unknown zone "
+					"state %s\n", v);
+				return 0;
+			}
+			w->states |= (1<<i);
+		} else if(strcmp(p, "since") == 0 && isdigit((unsigned char)*v)) {
+			w->since = (time_t)atoll(v);
+		} else if(strcmp(p, "offset") == 0 &&
+			isdigit((unsigned char)*v)) {
+			w->offset = (size_t)atoll(v);
+		} else if(strcmp(p, "count") == 0 &&
+			isdigit((unsigned char)*v)) {
+			w->count = (size_t)atoll(v);
+		} else {
+			(void)ssl_printf(ssl, "error in zonestatus syntax: "
+				"%s=%s\n", p, v);
+			return 0;
+		}
+		p = skipwhite(e);
+	}
+	if(!w->states)
+		w->states = ZONESTATUS_ALL;
+	return 1;
+}
+
+/** free the zonestatus walk */
+static void
+zonestatus_walk_delete(struct zonestatus_walk* w)
+{
+	if(!w)
+		return;
+	free(w->next);
+	free(w);
+}
+
+/** see if the zone passes the zonestatus filters */
+static int
+zonestatus_match(xfrd_state_t* xfrd, struct zonestatus_walk* w,
+	zone_options_t* zo)
+{
+	xfrd_zone_t* xz;
+	int state;
+	if(w->states == ZONESTATUS_ALL && !w->since)
+		return 1;
+	xz = (xfrd_zone_t*)rbtree_search(xfrd->zones,
+		(const dname_type*)zo->node.key);
+	if(!xz)
+		/* xfrd does not know when a master zone changed */
+		return (w->states & ZONESTATUS_MASTER) && !w->since;
+	if(xz->state == xfrd_zone_ok)
+		state = ZONESTATUS_OK;
+	else if(xz->state == xfrd_zone_expired)
+		state = ZONESTATUS_EXPIRED;
+	else	state = ZONESTATUS_REFRESHING;
+	if(!(w->states & state))
+		return 0;
+	return !w->since || xz->soa_nsd_acquired >= w->since ||
+		xz->soa_disk_acquired >= w->since ||
+		xz->soa_notified_acquired >= w->since;
+}
+
+/** print the next chunk of the zonestatus walk, false when it is done */
+static int
+zonestatus_chunk(RES* ssl, xfrd_state_t* xfrd, struct zonestatus_walk* w)
+{
+	rbtree_t* tree = xfrd->nsd->options->zone_options;
+	rbnode_t* n;
+	size_t i;
+	if(!w->next) {
+		n = rbtree_first(tree);
+	} else {
+		if(!rbtree_find_less_equal(tree, w->next, &n))
+			n = n?rbtree_next(n):rbtree_first(tree);
+		free(w->next);
+		w->next = NULL;
+	}
+	for(i=0; n != RBTREE_NULL; n = rbtree_next(n), i++) {
+		zone_options_t* zo = (zone_options_t*)n;
+		if(i == ZONESTATUS_CHUNK) {
+			const dname_type* d = (const dname_type*)n->key;
+			w->next = (dname_type*)xalloc(dname_total_size(d));
+			memcpy(w->next, d, dname_total_size(d));
+			return 1;
+		}
+		if(!zonestatus_match(xfrd, w, zo))
+			continue;
+		if(w->offset) {
+			w->offset--;
+			continue;
+		}
+		if(!print_zonestatus(ssl, xfrd, zo))
+			return 0;
+		if(w->count && --w->count == 0)
+			return 0;
+	}
+	return 0;
+}
+
+/** the socket can take the next chunk of zonestatus */
+static void
+remote_zonestatus_callback(int ATTR_UNUSED(fd), short event, void* arg)
+{
+	struct rc_state* s = (struct rc_state*)arg;
+	if(!(event&EV_WRITE))
+		return;
+	if(!zonestatus_chunk(&s->res, s->rc->xfrd, s->zonestatus)) {
+		VERBOSITY(3, (LOG_INFO, "remote control operation completed"));
+		clean_point(s->rc, s);
+	}
+}
+
 /** do the zonestatus command */
 static void
-do_zonestatus(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+do_zonestatus(struct daemon_remote* rc, char* arg, struct rc_state* rs)
 {
+	xfrd_state_t* xfrd = rc->xfrd;
+	RES* ssl = &rs->res;
 	zone_options_t* zo;
-	if(!get_zone_arg(ssl, xfrd, arg, &zo))
-		return;
-	if(zo) (void)print_zonestatus(ssl, xfrd, zo);
-	else {
-		RBTREE_FOR(zo, zone_options_t*,
-			xfrd->nsd->options->zone_options) {
-			if(!print_zonestatus(ssl, xfrd, zo))
-				return;
+	struct zonestatus_walk* w;
+	if(!strchr(arg, '=')) {
+		if(!get_zone_arg(ssl, xfrd, arg, &zo))
+			return;
+		if(zo) {
+			(void)print_zonestatus(ssl, xfrd, zo);
+			return;
 		}
 	}
+	w = (struct zonestatus_walk*)xalloc_zero(sizeof(*w));
+	if(!zonestatus_parse(ssl, arg, w) ||
+		!zonestatus_chunk(ssl, xfrd, w)) {
+		zonestatus_walk_delete(w);
+		return;
+	}
+	/* continue with the next chunk from the event loop, when the
+	 * socket can take it */
+	rs->zonestatus = w;
+	if(rs->event_added)
+		event_del(&rs->c);
+	event_set(&rs->c, rs->c.ev_fd, EV_PERSIST|EV_WRITE,
+		remote_zonestatus_callback, rs);
+	if(event_base_set(xfrd->event_base, &rs->c) != 0)
+		log_msg(LOG_ERR, "remote zonestatus: cannot set event_base");
+	if(event_add(&rs->c, NULL) != 0)
+		log_msg(LOG_ERR, "remote zonestatus: cannot add event");
+	rs->event_added = 1;
 }
 
 /** do the verbosity command */
 static void
-do_verbosity(SSL* ssl, char* str)
+do_verbosity(RES* ssl, char* str)
 {
 	int val = atoi(str);
 	if(strcmp(str, "") == 0) {
@@ -1035,7 +1444,7 @@ do_verbosity(SSL* ssl, char* str)
 
 /** find second argument, modifies string */
 static int
-find_arg2(SSL* ssl, char* arg, char** arg2)
+find_arg2(RES* ssl, char* arg, char** arg2)
 {
 	char* as = strrchr(arg, ' ');
 	if(as) {
@@ -1051,9 +1460,34 @@ find_arg2(SSL* ssl, char* arg, char** arg2)
 	return 0;
 }
 
+/** print the timing of the last reload */
+static void
+print_reload_timing(RES* ssl, struct reload_timing* rt)
+{
+	int i;
+	if(!rt)
+		return;
+	if(!ssl_printf(ssl, "reload-start: %llu\n",
+		(unsigned long long)rt->start))
+		return;
+	if(!ssl_printf(ssl, "reload-time: %.6f\n", (double)rt->total/1e9))
+		return;
+	if(!ssl_printf(ssl, "reload-zones: %u\n", (unsigned)rt->zones))
+		return;
+	for(i=0; i<RELOAD_PHASES; i++)
+		if(!ssl_printf(ssl, "reload-%s: %.6f\n", reload_phase_name(i),
+			(double)rt->phase[i]/1e9))
+			return;
+	for(i=0; i<RELOAD_SLOW_ZONES && rt->slow_nsec[i]; i++)
+		if(!ssl_printf(ssl, "reload-slow-zone: %s %.6f\n",
+			wiredname2str(rt->slow_zone[i]),
+			(double)rt->slow_nsec[i]/1e9))
+			return;
+}
+
 /** do the status command */
 static void
-do_status(SSL* ssl, xfrd_state_t* xfrd)
+do_status(RES* ssl, xfrd_state_t* xfrd)
 {
 	if(!ssl_printf(ssl, "version: %s\n", PACKAGE_VERSION))
 		return;
@@ -1063,16 +1497,52 @@ do_status(SSL* ssl, xfrd_state_t* xfrd)
 	if(!ssl_printf(ssl, "ratelimit: %d\n",
 		(int)xfrd->nsd->options->rrl_ratelimit))
 		return;
-#else
-	(void)xfrd;
 #endif
+	print_reload_timing(ssl, xfrd->reload_timing);
 }
 
+#ifdef BIND8_STATS
+static void print_stats(RES* ssl, xfrd_state_t* xfrd, struct timeval* now,
+	int clear, int live);
+static int print_stats_stream(struct rc_state* s, struct timeval* now);
+
+/** the stats_stream interval passed, or the client closed */
+static void
+remote_stream_callback(int ATTR_UNUSED(fd), short event, void* arg)
+{
+	struct rc_state* s = (struct rc_state*)arg;
+	struct timeval now;
+	if((event&EV_READ)) {
+		/* the client has nothing to say, it closed the connection */
+		VERBOSITY(3, (LOG_INFO, "remote control stats_stream closed"));
+		clean_point(s->rc, s);
+		return;
+	}
+	if(gettimeofday(&now, NULL) == -1)
+		log_msg(LOG_ERR, "gettimeofday: %s", strerror(errno));
+	if(!print_stats_stream(s, &now)) {
+		/* closed, or it does not read fast enough */
+		VERBOSITY(2, (LOG_INFO, "remote control stats_stream failed"));
+		clean_point(s->rc, s);
+	}
+}
+#endif /* BIND8_STATS */
+
 /** do the stats command */
 static void
 do_stats(struct daemon_remote* rc, int peek, struct rc_state* rs)
 {
 #ifdef BIND8_STATS
+	if(peek && rc->xfrd->nsd->stat_map[rc->xfrd->nsd->stat_idx]) {
+		/* the servers publish their counters in shared memory,
+		 * there is no need to reload to fetch them */
+		struct timeval now;
+		if(gettimeofday(&now, NULL) == -1)
+			log_msg(LOG_ERR, "gettimeofday: %s", strerror(errno));
+		print_stats(&rs->res, rc->xfrd, &now, 0, 1);
+		VERBOSITY(3, (LOG_INFO, "remote control stats printed"));
+		return;
+	}
 	/* queue up to get stats after a reload is done (to gather statistics
 	 * from the servers) */
 	assert(!rs->in_stats_list);
@@ -1087,27 +1557,64 @@ do_stats(struct daemon_remote* rc, int peek, struct rc_state* rs)
 	xfrd_set_reload_now(xfrd);
 #else
 	(void)rc; (void)peek;
-	(void)ssl_printf(rs->ssl, "error no stats enabled at compile time\n");
+	(void)ssl_printf(&rs->res, "error no stats enabled at compile time\n");
 #endif /* BIND8_STATS */
 }
 
-/** see if we have more zonestatistics entries and it has to be incremented */
+/** do the stats_stream command, the connection stays open and gets the
+ * increase of the counters every interval, until the client closes */
 static void
-zonestat_inc_ifneeded(xfrd_state_t* xfrd)
+do_stats_stream(struct daemon_remote* rc, char* arg, struct rc_state* rs)
 {
-#ifdef USE_ZONE_STATS
-	if(xfrd->nsd->options->zonestatnames->count != xfrd->zonestat_safe)
-		task_new_zonestat_inc(xfrd->nsd->task[xfrd->nsd->mytask],
-			xfrd->last_task, 
-			xfrd->nsd->options->zonestatnames->count);
+#ifdef BIND8_STATS
+	int sec = 10;
+	if(*arg) {
+		sec = atoi(arg);
+		if(sec <= 0) {
+			(void)ssl_printf(&rs->res, "error expected interval in "
+				"seconds, not '%s'\n", arg);
+			return;
+		}
+	}
+	if(!rc->xfrd->nsd->stat_map[rc->xfrd->nsd->stat_idx]) {
+		/* without the shared counters, every interval would need
+		 * a reload to fetch them */
+		(void)ssl_printf(&rs->res, "error stats_stream needs the "
+			"servers to share their counters\n");
+		return;
+	}
+	rs->stream_last = (struct nsdst*)xalloc(sizeof(struct nsdst));
+	stats_live(rc->xfrd->nsd, rs->stream_last);
+	if(gettimeofday(&rs->stream_time, NULL) == -1)
+		log_msg(LOG_ERR, "gettimeofday: %s", strerror(errno));
+	/* xfrd does not wait for a client that does not read, the socket
+	 * buffer holds the lines of an interval */
+	if(fcntl(rs->c.ev_fd, F_SETFL, O_NONBLOCK) == -1)
+		log_msg(LOG_ERR, "cannot fcntl rc: %s", strerror(errno));
+	if(rs->event_added)
+		event_del(&rs->c);
+	rs->tval.tv_sec = sec;
+	rs->tval.tv_usec = 0;
+	event_set(&rs->c, rs->c.ev_fd, EV_PERSIST|EV_TIMEOUT|EV_READ,
+		remote_stream_callback, rs);
+	if(event_base_set(rc->xfrd->event_base, &rs->c) != 0)
+		log_msg(LOG_ERR, "remote stats_stream: cannot set event_base");
+	if(event_add(&rs->c, &rs->tval) != 0)
+		log_msg(LOG_ERR, "remote stats_stream: cannot add event");
+	rs->event_added = 1;
+	VERBOSITY(3, (LOG_INFO, "remote control stats_stream every %d "
+		"seconds", sec));
 #else
-	(void)xfrd;
-#endif /* USE_ZONE_STATS */
+	(void)rc; (void)arg;
+	(void)ssl_printf(&rs->res, "error no stats enabled at compile time\n");
+#endif /* BIND8_STATS */
 }
 
-/** perform the addzone command for one zone */
+/** perform the addzone command for one zone, the task is put in the
+ * batch if there is one, and not scheduled */
 static int
-perform_addzone(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+perform_addzone(RES* ssl, xfrd_state_t* xfrd, char* arg,
+	struct zone_batch* batch)
 {
 	const dname_type* dname;
 	zone_options_t* zopt;
@@ -1153,14 +1660,24 @@ perform_addzone(SSL* ssl, xfrd_state_t* xfrd, char* arg)
 		(void)ssl_printf(ssl, "error could not add zonelist entry\n");
 		return 0;
 	}
-	/* make addzone task and schedule reload */
-	task_new_add_zone(xfrd->nsd->task[xfrd->nsd->mytask],
-		xfrd->last_task, arg, arg2,
-		getzonestatid(xfrd->nsd->options, zopt));
-	zonestat_inc_ifneeded(xfrd);
-	xfrd_set_reload_now(xfrd);
+	if(batch) {
+		uint32_t zonestatid = getzonestatid(xfrd->nsd->options, zopt);
+		zone_batch_add(batch, &zonestatid, sizeof(zonestatid));
+		zone_batch_add(batch, arg, strlen(arg)+1);
+		zone_batch_add(batch, arg2, strlen(arg2)+1);
+		batch->num++;
+	} else {
+		/* make addzone task and schedule reload */
+		task_new_add_zone(xfrd->nsd->task[xfrd->nsd->mytask],
+			xfrd->last_task, arg, arg2,
+			getzonestatid(xfrd->nsd->options, zopt));
+		xfrd_zonestat_inc_ifneeded(xfrd);
+		xfrd_set_reload_now(xfrd);
+	}
 	/* add to xfrd - notify (for master and slaves) */
 	init_notify_send(xfrd->notify_zones, xfrd->region, zopt);
+	/* watch the zone file */
+	xfrd_watch_zone(xfrd, zopt);
 	/* add to xfrd - slave */
 	if(zone_is_slave(zopt)) {
 		xfrd_init_slave_zone(xfrd, zopt);
@@ -1168,9 +1685,11 @@ perform_addzone(SSL* ssl, xfrd_state_t* xfrd, char* arg)
 	return 1;
 }
 
-/** perform the delzone command for one zone */
+/** perform the delzone command for one zone, the task is put in the
+ * batch if there is one */
 static int
-perform_delzone(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+perform_delzone(RES* ssl, xfrd_state_t* xfrd, char* arg,
+	struct zone_batch* batch)
 {
 	const dname_type* dname;
 	zone_options_t* zopt;
@@ -1203,9 +1722,14 @@ perform_delzone(SSL* ssl, xfrd_state_t* xfrd, char* arg)
 	}
 
 	/* create deletion task */
-	task_new_del_zone(xfrd->nsd->task[xfrd->nsd->mytask],
-		xfrd->last_task, dname);
-	xfrd_set_reload_now(xfrd);
+	if(batch) {
+		zone_batch_add(batch, dname, dname_total_size(dname));
+		batch->num++;
+	} else {
+		task_new_del_zone(xfrd->nsd->task[xfrd->nsd->mytask],
+			xfrd->last_task, dname);
+		xfrd_set_reload_now(xfrd);
+	}
 	/* delete it in xfrd */
 	if(zone_is_slave(zopt)) {
 		xfrd_del_slave_zone(xfrd, dname);
@@ -1220,64 +1744,98 @@ perform_delzone(SSL* ssl, xfrd_state_t* xfrd, char* arg)
 
 /** do the addzone command */
 static void
-do_addzone(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+do_addzone(RES* ssl, xfrd_state_t* xfrd, char* arg)
 {
-	if(!perform_addzone(ssl, xfrd, arg))
+	if(!perform_addzone(ssl, xfrd, arg, NULL))
 		return;
 	send_ok(ssl);
 }
 
 /** do the delzone command */
 static void
-do_delzone(SSL* ssl, xfrd_state_t* xfrd, char* arg)
+do_delzone(RES* ssl, xfrd_state_t* xfrd, char* arg)
 {
-	if(!perform_delzone(ssl, xfrd, arg))
+	if(!perform_delzone(ssl, xfrd, arg, NULL))
 		return;
 	send_ok(ssl);
 }
 
-/** do the addzones command */
+/** do the addzones command, the zonelist is written once and one task
+ * adds the zones in the reload */
 static void
-do_addzones(SSL* ssl, xfrd_state_t* xfrd)
+do_addzones(RES* ssl, xfrd_state_t* xfrd)
 {
 	char buf[2048];
-	int num = 0;
+	int num = 0, ok = 1;
+	struct zone_batch batch;
+	memset(&batch, 0, sizeof(batch));
+	zone_list_batch(xfrd->nsd->options);
 	while(ssl_read_line(ssl, buf, sizeof(buf))) {
 		if(buf[0] == 0x04 && buf[1] == 0)
 			break; /* end of transmission */
-		if(!perform_addzone(ssl, xfrd, buf)) {
+		if(!perform_addzone(ssl, xfrd, buf, &batch)) {
 			if(!ssl_printf(ssl, "error for input line '%s'\n", 
-				buf))
-				return;
+				buf)) {
+				ok = 0;
+				break;
+			}
 		} else {
-			if(!ssl_printf(ssl, "added: %s\n", buf))
-				return;
+			if(!ssl_printf(ssl, "added: %s\n", buf)) {
+				ok = 0;
+				break;
+			}
 			num++;
 		}
 	}
-	(void)ssl_printf(ssl, "added %d zones\n", num);
+	/* the zones that are added are scheduled, also if the connection
+	 * failed halfway */
+	zone_list_flush(xfrd->nsd->options);
+	if(batch.num != 0) {
+		task_new_add_zones(xfrd->nsd->task[xfrd->nsd->mytask],
+			xfrd->last_task, batch.data, batch.len, batch.num);
+		xfrd_zonestat_inc_ifneeded(xfrd);
+		xfrd_set_reload_now(xfrd);
+	}
+	free(batch.data);
+	if(ok)
+		(void)ssl_printf(ssl, "added %d zones\n", num);
 }
 
-/** do the delzones command */
+/** do the delzones command, with one task for the zones */
 static void
-do_delzones(SSL* ssl, xfrd_state_t* xfrd)
+do_delzones(RES* ssl, xfrd_state_t* xfrd)
 {
 	char buf[2048];
-	int num = 0;
+	int num = 0, ok = 1;
+	struct zone_batch batch;
+	memset(&batch, 0, sizeof(batch));
+	zone_list_batch(xfrd->nsd->options);
 	while(ssl_read_line(ssl, buf, sizeof(buf))) {
 		if(buf[0] == 0x04 && buf[1] == 0)
 			break; /* end of transmission */
-		if(!perform_delzone(ssl, xfrd, buf)) {
+		if(!perform_delzone(ssl, xfrd, buf, &batch)) {
 			if(!ssl_printf(ssl, "error for input line '%s'\n", 
-				buf))
-				return;
+				buf)) {
+				ok = 0;
+				break;
+			}
 		} else {
-			if(!ssl_printf(ssl, "removed: %s\n", buf))
-				return;
+			if(!ssl_printf(ssl, "removed: %s\n", buf)) {
+				ok = 0;
+				break;
+			}
 			num++;
 		}
 	}
-	(void)ssl_printf(ssl, "deleted %d zones\n", num);
+	zone_list_flush(xfrd->nsd->options);
+	if(batch.num != 0) {
+		task_new_del_zones(xfrd->nsd->task[xfrd->nsd->mytask],
+			xfrd->last_task, batch.data, batch.len, batch.num);
+		xfrd_set_reload_now(xfrd);
+	}
+	free(batch.data);
+	if(ok)
+		(void)ssl_printf(ssl, "deleted %d zones\n", num);
 }
 
 
@@ -1401,6 +1959,8 @@ add_cfgzone(xfrd_state_t* xfrd, const char* pname)
 	xfrd_set_reload_now(xfrd);
 	/* add to xfrd - notify (for master and slaves) */
 	init_notify_send(xfrd->notify_zones, xfrd->region, zopt);
+	/* watch the zone file */
+	xfrd_watch_zone(xfrd, zopt);
 	/* add to xfrd - slave */
 	if(zone_is_slave(zopt)) {
 		xfrd_init_slave_zone(xfrd, zopt);
@@ -1619,6 +2179,33 @@ repat_options_changed(xfrd_state_t* xfrd, nsd_options_t* newopt)
 static void
 repat_options(xfrd_state_t* xfrd, nsd_options_t* newopt)
 {
+	/* the transfer connections are xfrd's own, no reload needed */
+	if(xfrd->nsd->options->xfrd_tcp_master_max !=
+		newopt->xfrd_tcp_master_max) {
+		xfrd->nsd->options->xfrd_tcp_master_max =
+			newopt->xfrd_tcp_master_max;
+		xfrd->tcp_set->tcp_master_max = newopt->xfrd_tcp_master_max;
+	}
+	if(xfrd->nsd->options->xfrd_udp_max != newopt->xfrd_udp_max) {
+		xfrd->nsd->options->xfrd_udp_max = newopt->xfrd_udp_max;
+		xfrd_udp_start_waiting();
+	}
+	if(xfrd->nsd->options->xfrd_tcp_max != newopt->xfrd_tcp_max) {
+		xfrd->nsd->options->xfrd_tcp_max = newopt->xfrd_tcp_max;
+		xfrd_tcp_set_max(xfrd->tcp_set, xfrd->region,
+			newopt->xfrd_tcp_max);
+	}
+	/* the UDP sockets of the servers are open in xfrd too, the filter
+	 * is replaced for them without a reload */
+	if(xfrd->nsd->options->udp_filter != newopt->udp_filter ||
+		!acl_list_equal(xfrd->nsd->options->udp_filter_deny,
+		newopt->udp_filter_deny)) {
+		xfrd->nsd->options->udp_filter = newopt->udp_filter;
+		copy_changed_acl(xfrd->nsd->options,
+			&xfrd->nsd->options->udp_filter_deny,
+			newopt->udp_filter_deny);
+		udp_filter_attach(xfrd->nsd, xfrd->nsd->options);
+	}
 	if(repat_options_changed(xfrd, newopt)) {
 		/* update our options */
 #ifdef RATELIMIT
@@ -1637,7 +2224,7 @@ repat_options(xfrd_state_t* xfrd, nsd_options_t* newopt)
 static void
 print_ssl_cfg_err(void* arg, const char* str)
 {
-	SSL** ssl = (SSL**)arg;
+	RES** ssl = (RES**)arg;
 	if(!*ssl) return;
 	if(!ssl_printf(*ssl, "%s", str))
 		*ssl = NULL; /* failed, stop printing */
@@ -1645,7 +2232,7 @@ print_ssl_cfg_err(void* arg, const char* str)
 
 /** do the repattern command: reread config file and apply keys, patterns */
 static void
-do_repattern(SSL* ssl, xfrd_state_t* xfrd)
+do_repattern(RES* ssl, xfrd_state_t* xfrd)
 {
 	region_type* region = region_create(xalloc, free);
 	nsd_options_t* opt;
@@ -1678,14 +2265,14 @@ do_repattern(SSL* ssl, xfrd_state_t* xfrd)
 	repat_keys(xfrd, opt);
 	repat_patterns(xfrd, opt);
 	repat_options(xfrd, opt);
-	zonestat_inc_ifneeded(xfrd);
+	xfrd_zonestat_inc_ifneeded(xfrd);
 	send_ok(ssl);
 	region_destroy(region);
 }
 
 /** do the serverpid command: printout pid of server process */
 static void
-do_serverpid(SSL* ssl, xfrd_state_t* xfrd)
+do_serverpid(RES* ssl, xfrd_state_t* xfrd)
 {
 	(void)ssl_printf(ssl, "%u\n", (unsigned)xfrd->reload_pid);
 }
@@ -1697,9 +2284,64 @@ cmdcmp(char* p, const char* cmd, size_t len)
 	return strncmp(p,cmd,len)==0 && (p[len]==0||p[len]==' '||p[len]=='\t');
 }
 
+/** print the heavy hitters of a table, num of them */
+static int
+print_top(RES* ssl, xfrd_state_t* xfrd, int table, const char* name,
+	size_t num)
+{
+	size_t i, n;
+	char buf[MAXDOMAINLEN*5+32];
+	struct topk_entry* top = topk_merge(xfrd->nsd, table, &n);
+	for(i=0; i<n && i<num; i++) {
+		topk_key2str(table, &top[i], buf, sizeof(buf));
+		if(!ssl_printf(ssl, "%s.%d=%s %llu %llu\n", name, (int)i+1,
+			buf, (unsigned long long)top[i].count,
+			(unsigned long long)top[i].err)) {
+			free(top);
+			return 0;
+		}
+	}
+	free(top);
+	return 1;
+}
+
+/** do the top command: the heavy hitters of the servers */
+static void
+do_top(RES* ssl, xfrd_state_t* xfrd, char* arg)
+{
+	static const char* names[TOPK_TABLES] = { "qname", "client", "zone" };
+	int table = -1, i;
+	size_t num = 10;
+	if(!xfrd->nsd->top_map[0]) {
+		(void)ssl_printf(ssl, "error heavy-hitters is not enabled\n");
+		return;
+	}
+	for(i=0; i<TOPK_TABLES; i++) {
+		if(cmdcmp(arg, names[i], strlen(names[i]))) {
+			table = i;
+			arg = skipwhite(arg+strlen(names[i]));
+			break;
+		}
+	}
+	if(*arg) {
+		num = (size_t)atoi(arg);
+		if(num == 0) {
+			(void)ssl_printf(ssl, "error in top syntax: %s\n",
+				arg);
+			return;
+		}
+	}
+	for(i=0; i<TOPK_TABLES; i++) {
+		if(table != -1 && table != i)
+			continue;
+		if(!print_top(ssl, xfrd, i, names[i], num))
+			return;
+	}
+}
+
 /** execute a remote control command */
 static void
-execute_cmd(struct daemon_remote* rc, SSL* ssl, char* cmd, struct rc_state* rs)
+execute_cmd(struct daemon_remote* rc, RES* ssl, char* cmd, struct rc_state* rs)
 {
 	char* p = skipwhite(cmd);
 	/* compare command */
@@ -1713,6 +2355,8 @@ execute_cmd(struct daemon_remote* rc, SSL* ssl, char* cmd, struct rc_state* rs)
 		do_status(ssl, rc->xfrd);
 	} else if(cmdcmp(p, "stats_noreset", 13)) {
 		do_stats(rc, 1, rs);
+	} else if(cmdcmp(p, "stats_stream", 12)) {
+		do_stats_stream(rc, skipwhite(p+12), rs);
 	} else if(cmdcmp(p, "stats", 5)) {
 		do_stats(rc, 0, rs);
 	} else if(cmdcmp(p, "log_reopen", 10)) {
@@ -1732,7 +2376,7 @@ execute_cmd(struct daemon_remote* rc, SSL* ssl, char* cmd, struct rc_state* rs)
 	} else if(cmdcmp(p, "force_transfer", 14)) {
 		do_force_transfer(ssl, rc->xfrd, skipwhite(p+14));
 	} else if(cmdcmp(p, "zonestatus", 10)) {
-		do_zonestatus(ssl, rc->xfrd, skipwhite(p+10));
+		do_zonestatus(rc, skipwhite(p+10), rs);
 	} else if(cmdcmp(p, "verbosity", 9)) {
 		do_verbosity(ssl, skipwhite(p+9));
 	} else if(cmdcmp(p, "repattern", 9)) {
@@ -1741,6 +2385,8 @@ execute_cmd(struct daemon_remote* rc, SSL* ssl, char* cmd, struct rc_state* rs)
 		do_repattern(ssl, rc->xfrd);
 	} else if(cmdcmp(p, "serverpid", 9)) {
 		do_serverpid(ssl, rc->xfrd);
+	} else if(cmdcmp(p, "top", 3)) {
+		do_top(ssl, rc->xfrd, skipwhite(p+3));
 	} else {
 		(void)ssl_printf(ssl, "error unknown command '%s'\n", p);
 	}
@@ -1748,7 +2394,7 @@ execute_cmd(struct daemon_remote* rc, SSL* ssl, char* cmd, struct rc_state* rs)
 
 /** handle remote control request */
 static void
-handle_req(struct daemon_remote* rc, struct rc_state* s, SSL* ssl)
+handle_req(struct daemon_remote* rc, struct rc_state* s, RES* ssl)
 {
 	int r;
 	char pre[10];
@@ -1759,12 +2405,14 @@ handle_req(struct daemon_remote* rc, struct rc_state* s, SSL* ssl)
 	}
 
 	/* try to read magic UBCT[version]_space_ string */
-	ERR_clear_error();
-	if((r=SSL_read(ssl, magic, (int)sizeof(magic)-1)) <= 0) {
-		if(SSL_get_error(ssl, r) == SSL_ERROR_ZERO_RETURN)
-			return;
-		log_crypto_err("could not SSL_read");
+	if((r=res_read(ssl, magic, (int)sizeof(magic)-1)) <= 0)
 		return;
+	if(!ssl->ssl && r < 7) {
+		/* the local socket may return a short read */
+		int r2 = res_read(ssl, magic+r, 7-r);
+		if(r2 <= 0)
+			return;
+		r += r2;
 	}
 	magic[7] = 0;
 	if( r != 7 || strncmp(magic, "NSDCT", 5) != 0) {
@@ -1801,11 +2449,16 @@ remote_control_callback(int fd, short event, void* arg)
 		clean_point(rc, s);
 		return;
 	}
+	if(!s->res.ssl) {
+		/* local socket, the file permissions are the
+		 * authentication */
+		goto handle;
+	}
 	/* (continue to) setup the SSL connection */
 	ERR_clear_error();
-	r = SSL_do_handshake(s->ssl);
+	r = SSL_do_handshake(s->res.ssl);
 	if(r != 1) {
-		int r2 = SSL_get_error(s->ssl, r);
+		int r2 = SSL_get_error(s->res.ssl, r);
 		if(r2 == SSL_ERROR_WANT_READ) {
 			if(s->shake_state == rc_hs_read) {
 				/* try again later */
@@ -1845,8 +2498,8 @@ remote_control_callback(int fd, short event, void* arg)
 	s->shake_state = rc_none;
 
 	/* once handshake has completed, check authentication */
-	if(SSL_get_verify_result(s->ssl) == X509_V_OK) {
-		X509* x = SSL_get_peer_certificate(s->ssl);
+	if(SSL_get_verify_result(s->res.ssl) == X509_V_OK) {
+		X509* x = SSL_get_peer_certificate(s->res.ssl);
 		if(!x) {
 			VERBOSITY(2, (LOG_INFO, "remote control connection "
 				"provided no client certificate"));
@@ -1863,9 +2516,10 @@ remote_control_callback(int fd, short event, void* arg)
 	}
 
 	/* if OK start to actually handle the request */
-	handle_req(rc, s, s->ssl);
+handle:
+	handle_req(rc, s, &s->res);
 
-	if(!s->in_stats_list) {
+	if(!s->in_stats_list && !s->stream_last && !s->zonestatus) {
 		VERBOSITY(3, (LOG_INFO, "remote control operation completed"));
 		clean_point(rc, s);
 	}
@@ -1887,7 +2541,7 @@ opcode2str(int o)
 
 /** print long number */
 static int
-print_longnum(SSL* ssl, char* desc, uint64_t x)
+print_longnum(RES* ssl, char* desc, uint64_t x)
 {
 	if(x > (uint64_t)1024*1024*1024) {
 		/* more than a Gb */
@@ -1902,7 +2556,7 @@ print_longnum(SSL* ssl, char* desc, uint64_t x)
 
 /* print one block of statistics.  n is name and d is delimiter */
 static void
-print_stat_block(SSL* ssl, char* n, char* d, struct nsdst* st)
+print_stat_block(RES* ssl, char* n, char* d, struct nsdst* st)
 {
 	const char* rcstr[] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN",
 	    "NOTIMP", "REFUSED", "YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH",
@@ -1974,10 +2628,34 @@ print_stat_block(SSL* ssl, char* n, char* d, struct nsdst* st)
 		(unsigned)st->nona))
 		return;
 
+	/* arena_overflow */
+	if(!ssl_printf(ssl, "%s%snum.arena_overflow=%u\n", n, d,
+		(unsigned)st->arena_overflow))
+		return;
+
+	/* db_remap */
+	if(!ssl_printf(ssl, "%s%snum.db_remap=%u\n", n, d,
+		(unsigned)st->db_remap))
+		return;
+
+	/* nsec3 cache */
+	if(!ssl_printf(ssl, "%s%snum.nsec3_cache.hit=%u\n"
+		"%s%snum.nsec3_cache.miss=%u\n"
+		"%s%snum.nsec3_cache.evict=%u\n",
+		n, d, (unsigned)st->nsec3_cache_hit,
+		n, d, (unsigned)st->nsec3_cache_miss,
+		n, d, (unsigned)st->nsec3_cache_evict))
+		return;
+
 	/* rxerr */
 	if(!ssl_printf(ssl, "%s%snum.rxerr=%u\n", n, d, (unsigned)st->rxerr))
 		return;
 
+	/* queries that the kernel dropped, the zone stats do not have them */
+	if(n[0] == 0 && !ssl_printf(ssl, "num.rxq_drops=%u\n",
+		(unsigned)st->rxq_drops))
+		return;
+
 	/* txerr */
 	if(!ssl_printf(ssl, "%s%snum.txerr=%u\n", n, d, (unsigned)st->txerr))
 		return;
@@ -1986,6 +2664,17 @@ print_stat_block(SSL* ssl, char* n, char* d, struct nsdst* st)
 	if(!ssl_printf(ssl, "%s%snum.raxfr=%u\n", n, d, (unsigned)st->raxfr))
 		return;
 
+#ifdef RATELIMIT
+	/* rate limited answers, the zone stats do not count them */
+	if(n[0] == 0 && !ssl_printf(ssl, "num.rrl.slip=%u\nnum.rrl.discard="
+		"%u\n", (unsigned)st->rrl_slip, (unsigned)st->rrl_discard))
+		return;
+#endif
+	/* queries shed in overload */
+	if(n[0] == 0 && !ssl_printf(ssl, "num.overload.tc=%u\nnum.overload.drop=%u\n",
+		(unsigned)st->overload_tc, (unsigned)st->overload_drop))
+		return;
+
 	/* truncated */
 	if(!ssl_printf(ssl, "%s%snum.truncated=%u\n", n, d,
 		(unsigned)st->truncated))
@@ -1997,24 +2686,112 @@ print_stat_block(SSL* ssl, char* n, char* d, struct nsdst* st)
 		return;
 }
 
-#ifdef USE_ZONE_STATS
+/* the latency in nsec below which the fraction (in 1/1000) of the
+ * count queries in the histogram h is, the end of that bucket */
+static uint64_t
+latency_percentile(stc_t* h, stc_t count, unsigned frac)
+{
+	stc_t sum = 0, want = (stc_t)(((uint64_t)count*frac + 999)/1000);
+	int b;
+	for(b=0; b<LATENCY_BUCKETS-1; b++) {
+		sum += h[b];
+		if(sum >= want)
+			return query_latency_bucket_start(b+1);
+	}
+	return query_latency_bucket_start(LATENCY_BUCKETS-1);
+}
+
+/* print the latency histogram of one answer class, if it has answers */
+static int
+print_latency_class(RES* ssl, struct nsdst* st, int t, int c)
+{
+	const char* protostr[] = {"udp", "tcp"};
+	const char* classstr[] = {"positive", "referral", "nodata",
+		"nxdomain", "nsec3", "axfr", "other"};
+	stc_t* h = st->latency[c][t];
+	stc_t count = 0;
+	char n[32], desc[64];
+	int b;
+	for(b=0; b<LATENCY_BUCKETS; b++)
+		count += h[b];
+	if(count == 0)
+		return 1;
+	snprintf(n, sizeof(n), "latency.%s.%s.", protostr[t], classstr[c]);
+	if(!ssl_printf(ssl, "%squeries=%u\n", n, (unsigned)count))
+		return 0;
+	snprintf(desc, sizeof(desc), "%sparse_nsec=", n);
+	if(!print_longnum(ssl, desc, st->latency_nsec[c][t][LATENCY_PARSE]))
+		return 0;
+	snprintf(desc, sizeof(desc), "%slookup_nsec=", n);
+	if(!print_longnum(ssl, desc, st->latency_nsec[c][t][LATENCY_LOOKUP]))
+		return 0;
+	snprintf(desc, sizeof(desc), "%sencode_nsec=", n);
+	if(!print_longnum(ssl, desc, st->latency_nsec[c][t][LATENCY_ENCODE]))
+		return 0;
+	snprintf(desc, sizeof(desc), "%sp50_nsec=", n);
+	if(!print_longnum(ssl, desc, latency_percentile(h, count, 500)))
+		return 0;
+	snprintf(desc, sizeof(desc), "%sp99_nsec=", n);
+	if(!print_longnum(ssl, desc, latency_percentile(h, count, 990)))
+		return 0;
+	snprintf(desc, sizeof(desc), "%sp999_nsec=", n);
+	if(!print_longnum(ssl, desc, latency_percentile(h, count, 999)))
+		return 0;
+	/* the buckets by the nsec they start at */
+	for(b=0; b<LATENCY_BUCKETS; b++) {
+		if(h[b] == 0)
+			continue;
+		if(!ssl_printf(ssl, "%shist.%u=%u\n", n,
+			(unsigned)query_latency_bucket_start(b), (unsigned)h[b]))
+			return 0;
+	}
+	return 1;
+}
+
+/* print the latency histograms, with latency-stats */
+static void
+print_latency(RES* ssl, struct nsdst* st)
+{
+	int c, t;
+	for(t=0; t<2; t++) {
+		for(c=0; c<LATENCY_CLASSES; c++) {
+			if(!print_latency_class(ssl, st, t, c))
+				return;
+		}
+	}
+}
+
+/* print the stalls of the handlers, with stall-monitor */
 static void
-resize_zonestat(xfrd_state_t* xfrd, size_t num)
+print_stall(RES* ssl, struct nsdst* st)
 {
-	struct nsdst** a = xalloc_array_zero(num, sizeof(struct nsdst*));
-	if(xfrd->zonestat_clear_num != 0)
-		memcpy(a, xfrd->zonestat_clear, xfrd->zonestat_clear_num
-			* sizeof(struct nsdst*));
-	free(xfrd->zonestat_clear);
-	xfrd->zonestat_clear = a;
-	xfrd->zonestat_clear_num = num;
+	static const char* names[STALL_HANDLERS] = {
+		"loop", "udp", "tcp_read", "tcp_write"
+	};
+	int i;
+	for(i=0; i<STALL_HANDLERS; i++) {
+		if(!ssl_printf(ssl, "num.stall.%s=%u\n", names[i],
+			(unsigned)st->stall[i]))
+			return;
+	}
 }
 
+#ifdef USE_ZONE_STATS
 static void
-zonestat_print(SSL* ssl, xfrd_state_t* xfrd, int clear)
+zonestat_print(RES* ssl, xfrd_state_t* xfrd, int clear)
 {
 	struct zonestatname* n;
 	struct nsdst stat0, stat1;
+	uint64_t other0, other1, cpu0[ZONESTAT_CPU], cpu1[ZONESTAT_CPU];
+	struct zonestat* keep[2] = {NULL, NULL};
+	size_t shards = xfrd->nsd->zonestatshards, num = 0, i;
+	if(clear) {
+		/* the new snapshot, of the zones as they are printed */
+		num = xfrd->zonestat_safe;
+		for(i=0; i<2; i++)
+			keep[i] = (struct zonestat*)xalloc_array_zero(
+				num*shards, sizeof(struct zonestat));
+	}
 	RBTREE_FOR(n, struct zonestatname*, xfrd->nsd->options->zonestatnames){
 		char* name = (char*)n->node.key;
 		if(n->id >= xfrd->zonestat_safe)
@@ -2025,57 +2802,175 @@ zonestat_print(SSL* ssl, xfrd_state_t* xfrd, int clear)
 		/* the statistics are stored in two blocks, during reload
 		 * the newly forked processes get the other block to use,
 		 * these blocks are mmapped and are currently in use to
-		 * add statistics to */
-		memcpy(&stat0, &xfrd->nsd->zonestat[0][n->id], sizeof(stat0));
-		memcpy(&stat1, &xfrd->nsd->zonestat[1][n->id], sizeof(stat1));
-		stats_add(&stat0, &stat1);
-		
-		/* save a copy of current (cumulative) stats in stat1 */
-		memcpy(&stat1, &stat0, sizeof(stat1));
+		 * add statistics to, with a shard for every server */
+		memset(&stat0, 0, sizeof(stat0));
+		other0 = 0;
+		memset(cpu0, 0, sizeof(cpu0));
+		zonestat_sum(&stat0, &other0, cpu0, xfrd->nsd->zonestat,
+			shards, n->id);
 		/* subtract last total of stats that was 'cleared' */
-		if(n->id < xfrd->zonestat_clear_num &&
-			xfrd->zonestat_clear[n->id])
-			stats_subtract(&stat0, xfrd->zonestat_clear[n->id]);
+		if(n->id < xfrd->zonestat_clear_num) {
+			memset(&stat1, 0, sizeof(stat1));
+			other1 = 0;
+			memset(cpu1, 0, sizeof(cpu1));
+			zonestat_sum(&stat1, &other1, cpu1,
+				xfrd->zonestat_clear, shards, n->id);
+			stats_subtract(&stat0, &stat1);
+			other0 -= other1;
+			for(i=0; i<ZONESTAT_CPU; i++)
+				cpu0[i] -= cpu1[i];
+		}
 		if(clear) {
-			/* extend storage array if needed */
-			if(n->id >= xfrd->zonestat_clear_num) {
-				if(n->id+1 < xfrd->nsd->options->zonestatnames->count)
-					resize_zonestat(xfrd, xfrd->nsd->options->zonestatnames->count);
-				else
-					resize_zonestat(xfrd, n->id+1);
-			}
-			if(!xfrd->zonestat_clear[n->id])
-				xfrd->zonestat_clear[n->id] = xalloc(
-					sizeof(struct nsdst));
-			/* store last total of stats */
-			memcpy(xfrd->zonestat_clear[n->id], &stat1,
-				sizeof(struct nsdst));
+			/* store last total of stats, the servers may have
+			 * counted more since they were added up, that is
+			 * printed the next time */
+			for(i=0; i<2; i++)
+				memcpy(&keep[i][n->id*shards],
+					&xfrd->nsd->zonestat[i][n->id*shards],
+					sizeof(struct zonestat)*shards);
 		}
 
 		/* stat0 contains the details that we want to print */
 		if(!ssl_printf(ssl, "%s%snum.queries=%u\n", name, ".",
 			(unsigned)(stat0.qudp + stat0.qudp6 + stat0.ctcp +
 				stat0.ctcp6)))
-			return;
+			break;
 		print_stat_block(ssl, name, ".", &stat0);
+		/* the qtypes after the first ZONESTAT_QTYPES of a server */
+		if(other0 != 0 && !ssl_printf(ssl, "%s%snum.type.other=%lu\n",
+			name, ".", (unsigned long)other0))
+			break;
+		/* the estimated time spent on the zones, with
+		 * zone-cpu-sample */
+		if(xfrd->nsd->options->zone_cpu_sample &&
+			!zonestat_print_cpu(ssl, name, ".", cpu0))
+			break;
+	}
+	if(clear) {
+		for(i=0; i<2; i++) {
+			free(xfrd->zonestat_clear[i]);
+			xfrd->zonestat_clear[i] = keep[i];
+		}
+		xfrd->zonestat_clear_num = num;
 	}
 }
 #endif /* USE_ZONE_STATS */
 
+/** print the queries that the kernel dropped per UDP socket, with
+ * reuseport per socket of a server, returns 0 on a write error */
+static int
+print_rxq_drops(RES* ssl, struct nsd* nsd)
+{
+	size_t sets = nsd->reuseport?nsd->reuseport:1, c, i;
+	for(c=0; c<sets; c++) {
+		struct nsd_socket* socks = (c==0?nsd->udp:nsd->children[c].udp);
+		for(i=0; i<nsd->ifs; i++) {
+			unsigned drops;
+			if(!socks || !socks[i].rxq_drops)
+				continue;
+			drops = (unsigned)*socks[i].rxq_drops;
+			if(nsd->reuseport) {
+				if(!ssl_printf(ssl, "udp%d.server%d.rxq_drops="
+					"%u\n", (int)i, (int)c, drops))
+					return 0;
+			} else if(!ssl_printf(ssl, "udp%d.rxq_drops=%u\n",
+				(int)i, drops))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/** print the memory per tag, with region-profile, of the database, the
+ * running servers, if live, and the options, returns 0 on a write error */
+static int
+print_region_profile(RES* ssl, xfrd_state_t* xfrd, struct nsdst* st,
+	int live)
+{
+	struct region_tag_stat tags[REGION_TAG_COUNT];
+	size_t i;
+	int t;
+	memset(tags, 0, sizeof(tags));
+	region_tag_stat_add(tags, st->db_tag);
+	for(i=0; live && i<xfrd->nsd->child_count; i++)
+		region_tag_stat_add(tags, STAT_SLOT(xfrd->nsd,
+			xfrd->nsd->stat_idx, i)->mem_tag);
+	if(xfrd->nsd->options->profile)
+		region_tag_stat_add(tags, xfrd->nsd->options->profile);
+	for(t=0; t<REGION_TAG_COUNT; t++) {
+		const char* n = region_tag_name(t);
+		if(!ssl_printf(ssl, "mem.%s.bytes=%llu\n", n,
+			(unsigned long long)tags[t].bytes) ||
+		   !ssl_printf(ssl, "mem.%s.high=%llu\n", n,
+			(unsigned long long)tags[t].high) ||
+		   !ssl_printf(ssl, "mem.%s.allocs=%llu\n", n,
+			(unsigned long long)tags[t].allocs) ||
+		   !ssl_printf(ssl, "mem.%s.recycles=%llu\n", n,
+			(unsigned long long)tags[t].recycles) ||
+		   !ssl_printf(ssl, "mem.%s.recycle_hit=%llu\n", n,
+			(unsigned long long)tags[t].recycle_hit) ||
+		   !ssl_printf(ssl, "mem.%s.recycle_miss=%llu\n", n,
+			(unsigned long long)tags[t].recycle_miss))
+			return 0;
+	}
+	return 1;
+}
+
+/** print the statistics, if live, add the counters that the running
+ * servers published in the stat_map to the totals of the quit servers */
 static void
-print_stats(SSL* ssl, xfrd_state_t* xfrd, struct timeval* now, int clear)
+print_stats(RES* ssl, xfrd_state_t* xfrd, struct timeval* now, int clear,
+	int live)
 {
 	size_t i;
 	stc_t total = 0;
 	struct timeval elapsed, uptime;
+	struct nsdst st;
 
+	memcpy(&st, &xfrd->nsd->st, sizeof(st));
 	/* per CPU and total */
 	for(i=0; i<xfrd->nsd->child_count; i++) {
+		stc_t q = xfrd->nsd->children[i].query_count;
+		if(live) {
+			struct nsdst* s = STAT_SLOT(xfrd->nsd,
+				xfrd->nsd->stat_idx, i);
+			q += s->qudp + s->qudp6 + s->ctcp + s->ctcp6;
+			stats_add(&st, s);
+		}
 		if(!ssl_printf(ssl, "server%d.queries=%u\n", (int)i,
-			(unsigned)xfrd->nsd->children[i].query_count))
+			(unsigned)q))
+			return;
+		if(live && xfrd->nsd->options->udp_drop_stats &&
+			!ssl_printf(ssl, "server%d.rxq_drops=%u\n", (int)i,
+			(unsigned)STAT_SLOT(xfrd->nsd, xfrd->nsd->stat_idx,
+			i)->rxq_drops))
+			return;
+		if(live && xfrd->nsd->options->stall_monitor &&
+			!ssl_printf(ssl, "server%d.loop_lag_max=%llu\n", (int)i,
+			(unsigned long long)STAT_SLOT(xfrd->nsd,
+			xfrd->nsd->stat_idx, i)->loop_lag_max))
+			return;
+#ifdef RATELIMIT
+		if(live && xfrd->nsd->options->rrl_adaptive > 1 &&
+			(!ssl_printf(ssl, "server%d.rrl.limit=%u\n", (int)i,
+			(unsigned)STAT_SLOT(xfrd->nsd, xfrd->nsd->stat_idx,
+			i)->rrl_limit) ||
+			!ssl_printf(ssl, "server%d.rrl.whitelist_limit=%u\n",
+			(int)i, (unsigned)STAT_SLOT(xfrd->nsd,
+			xfrd->nsd->stat_idx, i)->rrl_whitelist_limit)))
 			return;
-		total += xfrd->nsd->children[i].query_count;
+#endif
+		total += q;
 	}
+	if(!print_rxq_drops(ssl, xfrd->nsd))
+		return;
+	/* stats_add copies the database sizes */
+	st.db_disk = xfrd->nsd->st.db_disk;
+	st.db_mem = xfrd->nsd->st.db_mem;
+	st.db_slab = xfrd->nsd->st.db_slab;
+	st.db_slab_used = xfrd->nsd->st.db_slab_used;
+	st.db_disk_free = xfrd->nsd->st.db_disk_free;
+	memcpy(st.db_tag, xfrd->nsd->st.db_tag, sizeof(st.db_tag));
 	if(!ssl_printf(ssl, "num.queries=%u\n", (unsigned)total))
 		return;
 
@@ -2092,8 +2987,16 @@ print_stats(SSL* ssl, xfrd_state_t* xfrd, struct timeval* now, int clear)
 	/* mem info, database on disksize */
 	if(!print_longnum(ssl, "size.db.disk=", xfrd->nsd->st.db_disk))
 		return;
+	if(!print_longnum(ssl, "size.db.disk.free=",
+		xfrd->nsd->st.db_disk_free))
+		return;
 	if(!print_longnum(ssl, "size.db.mem=", xfrd->nsd->st.db_mem))
 		return;
+	if(!print_longnum(ssl, "size.db.slab=", xfrd->nsd->st.db_slab))
+		return;
+	if(!print_longnum(ssl, "size.db.slab.used=",
+		xfrd->nsd->st.db_slab_used))
+		return;
 	if(!print_longnum(ssl, "size.xfrd.mem=", region_get_mem(xfrd->region)))
 		return;
 	if(!print_longnum(ssl, "size.config.disk=", 
@@ -2102,7 +3005,14 @@ print_stats(SSL* ssl, xfrd_state_t* xfrd, struct timeval* now, int clear)
 	if(!print_longnum(ssl, "size.config.mem=", region_get_mem(
 		xfrd->nsd->options->region)))
 		return;
-	print_stat_block(ssl, "", "", &xfrd->nsd->st);
+	if(xfrd->nsd->options->region_profile &&
+		!print_region_profile(ssl, xfrd, &st, live))
+		return;
+	print_stat_block(ssl, "", "", &st);
+	if(xfrd->nsd->options->latency_stats)
+		print_latency(ssl, &st);
+	if(xfrd->nsd->options->stall_monitor)
+		print_stall(ssl, &st);
 
 	/* zone statistics */
 	if(!ssl_printf(ssl, "zone.master=%u\n",
@@ -2117,21 +3027,67 @@ print_stats(SSL* ssl, xfrd_state_t* xfrd, struct timeval* now, int clear)
 #endif
 }
 
+/** print the increase of the counters since the last time, for a
+ * stats_stream, returns false on failure */
+static int
+print_stats_stream(struct rc_state* s, struct timeval* now)
+{
+	xfrd_state_t* xfrd = s->rc->xfrd;
+	struct timeval elapsed;
+	struct nsdst st, cur;
+	stats_live(xfrd->nsd, &cur);
+	memcpy(&st, &cur, sizeof(st));
+	stats_subtract(&st, s->stream_last);
+	memcpy(s->stream_last, &cur, sizeof(cur));
+	timeval_subtract(&elapsed, now, &s->stream_time);
+	s->stream_time = *now;
+
+	if(!ssl_printf(&s->res, "time.now=%u.%6.6u\n",
+		(unsigned)now->tv_sec, (unsigned)now->tv_usec))
+		return 0;
+	if(!ssl_printf(&s->res, "time.elapsed=%u.%6.6u\n",
+		(unsigned)elapsed.tv_sec, (unsigned)elapsed.tv_usec))
+		return 0;
+	if(!ssl_printf(&s->res, "num.queries=%u\n", (unsigned)(st.qudp +
+		st.qudp6 + st.ctcp + st.ctcp6)))
+		return 0;
+	print_stat_block(&s->res, "", "", &st);
+	if(xfrd->nsd->options->latency_stats)
+		print_latency(&s->res, &st);
+	/* an empty line ends the block of an interval */
+	return ssl_printf(&s->res, "\n");
+}
+
 static void
 clear_stats(xfrd_state_t* xfrd)
 {
 	size_t i;
+	struct rc_state* s;
 	uint64_t dbd = xfrd->nsd->st.db_disk;
 	uint64_t dbm = xfrd->nsd->st.db_mem;
+	uint64_t dbs = xfrd->nsd->st.db_slab;
+	uint64_t dbsu = xfrd->nsd->st.db_slab_used;
+	uint64_t dbdf = xfrd->nsd->st.db_disk_free;
+	struct region_tag_stat dbtag[REGION_TAG_COUNT];
+	memcpy(dbtag, xfrd->nsd->st.db_tag, sizeof(dbtag));
 	for(i=0; i<xfrd->nsd->child_count; i++) {
 		xfrd->nsd->children[i].query_count = 0;
 	}
+	/* the streams print the increase, that continues from the counters
+	 * that remain after the clear */
+	for(s = xfrd->nsd->rc->busy_list; s; s = s->next)
+		if(s->stream_last)
+			stats_subtract(s->stream_last, &xfrd->nsd->st);
 	memset(&xfrd->nsd->st, 0, sizeof(struct nsdst));
 	/* zonestats are cleared by storing the cumulative value that
 	 * was last printed in the zonestat_clear array, and subtracting
 	 * that before the next stats printout */
 	xfrd->nsd->st.db_disk = dbd;
 	xfrd->nsd->st.db_mem = dbm;
+	xfrd->nsd->st.db_slab = dbs;
+	xfrd->nsd->st.db_slab_used = dbsu;
+	xfrd->nsd->st.db_disk_free = dbdf;
+	memcpy(xfrd->nsd->st.db_tag, dbtag, sizeof(dbtag));
 }
 
 void
@@ -2145,7 +3101,7 @@ daemon_remote_process_stats(struct daemon_remote* rc)
 	/* pop one and give it stats */
 	while((s = rc->stats_list)) {
 		assert(s->in_stats_list);
-		print_stats(s->ssl, rc->xfrd, &now, (s->in_stats_list == 1));
+		print_stats(&s->res, rc->xfrd, &now, (s->in_stats_list == 1), 0);
 		if(s->in_stats_list == 1) {
 			clear_stats(rc->xfrd);
 			rc->stats_time = now;
@@ -6,10 +6,14 @@
  */
 #include "config.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "rrl.h"
 #include "util.h"
-#include "lookup3.h"
+#include "hash.h"
 #include "options.h"
+#include "usdt.h"
 
 #ifdef RATELIMIT
 
@@ -21,51 +25,165 @@
 #endif /* HAVE_MMAP */
 
 
+/** size of a cache line, a bucket fills one */
+#define RRL_CACHE_LINE 64
+/** number of buckets, from the hash position on, that a rate can use */
+#define RRL_PROBES 4
+
 /**
  * The rate limiting data structure bucket, this represents one rate of
  * packets from a single source.
  * Smoothed average rates.
+ * The table is shared by the server processes, the bucket is updated
+ * with atomic operations, without locks, and has a cache line of its own.
  */
 struct rrl_bucket {
-	/* the source netmask */
+	/* the key of the source, type and name, from the full hash and the
+	 * source and flags, 0 if the bucket is unused.  Claimed with CAS. */
+	uint64_t key;
+	/* timestamp in the upper half, and the counter for queries arrived
+	 * in that second in the lower half, updated together.  The rate is
+	 * from one timestep before the timestamp. */
+	uint64_t count;
+	/* the source netmask, for the log messages */
 	uint64_t source;
 	/* rate, in queries per second, which due to rate=r(t)+r(t-1)/2 is
 	 * equal to double the queries per second */
 	uint32_t rate;
-	/* the full hash */
-	uint32_t hash;
-	/* counter for queries arrived in this second */
-	uint32_t counter;
-	/* timestamp, which time is the time of the counter, the rate is from
-	 * one timestep before that. */
-	int32_t stamp;
-	/* flags for the source mask and type */
+	/* flags for the source mask and type, for the log messages */
 	uint16_t flags;
+	uint8_t pad[RRL_CACHE_LINE - 3*sizeof(uint64_t) - sizeof(uint32_t)
+		- sizeof(uint16_t)];
 };
 
-/* the (global) array of RRL buckets */
-static struct rrl_bucket* rrl_array = NULL;
+#ifdef HAVE_ATOMIC_BUILTINS
+#define rrl_load(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define rrl_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define rrl_add(p, v) __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define rrl_cas(p, old, v) __atomic_compare_exchange_n((p), &(old), (v), 0, \
+	__ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+/* the servers can lose each others updates, the rates are then lower */
+#define rrl_load(p) (*(p))
+#define rrl_store(p, v) (*(p) = (v))
+#define rrl_add(p, v) (*(p) += (v))
+#define rrl_cas(p, old, v) (*(p) == (old) ? (*(p) = (v), 1) : \
+	((old) = *(p), 0))
+#endif
+
+/* the (global) array of RRL buckets, shared by the servers; every
+ * server thread sets it in rrl_init */
+static NSD_THREAD_LOCAL struct rrl_bucket* rrl_array = NULL;
 static size_t rrl_array_size = RRL_BUCKETS;
-static uint32_t rrl_ratelimit = RRL_LIMIT; /* 2x qps */
+static NSD_THREAD_LOCAL uint32_t rrl_ratelimit = RRL_LIMIT; /* 2x qps */
 static uint8_t rrl_slip_ratio = RRL_SLIP;
 static uint8_t rrl_ipv4_prefixlen = RRL_IPV4_PREFIX_LENGTH;
 static uint8_t rrl_ipv6_prefixlen = RRL_IPV6_PREFIX_LENGTH;
 static uint64_t rrl_ipv6_mask; /* max prefixlen 64 */
-static uint32_t rrl_whitelist_ratelimit = RRL_WLIST_LIMIT; /* 2x qps */
+static NSD_THREAD_LOCAL uint32_t rrl_whitelist_ratelimit = RRL_WLIST_LIMIT; /* 2x qps */
+/* with rrl-adaptive, the configured limits that the ones above are scaled
+ * up from, the largest factor, and the smoothed load of this server.
+ * The scaled limits and the load are per server thread, every thread
+ * sets them up in rrl_set_adaptive */
+static uint32_t rrl_base_ratelimit = RRL_LIMIT;
+static uint32_t rrl_base_whitelist_ratelimit = RRL_WLIST_LIMIT;
+static NSD_THREAD_LOCAL uint32_t rrl_adaptive = 0;
+static NSD_THREAD_LOCAL uint32_t rrl_load_avg = RRL_LOAD_HIGH;
+
+/* the mmap shared by the children (saved between reloads) */
+static struct rrl_bucket* rrl_map = NULL;
+
+/** the start of the rrl file, the buckets follow it */
+struct rrl_file_header {
+	uint32_t magic;
+	/* changes with the layout of the buckets */
+	uint32_t version;
+	uint32_t bucket_size;
+	uint32_t unused;
+	uint64_t buckets;
+	/* the hash key that the keys in the buckets are made with */
+	uint64_t key;
+	uint8_t pad[RRL_CACHE_LINE - 4*sizeof(uint32_t) - 2*sizeof(uint64_t)];
+};
+#define RRL_FILE_MAGIC 0x4e53526c /* NSRl */
+#define RRL_FILE_VERSION 2
 
-/* the array of mmaps for the children (saved between reloads) */
-static void** rrl_maps = NULL;
-static size_t rrl_maps_num = 0;
+#ifdef HAVE_MMAP
+/** map the buckets from the file, the rates in it are used if they have
+ * the layout and number of buckets of this table. NULL on failure. */
+static struct rrl_bucket* rrl_file_map(const char* file)
+{
+	struct rrl_file_header* h;
+	size_t len = sizeof(*h) + sizeof(struct rrl_bucket)*rrl_array_size;
+	struct stat st;
+	int fd = open(file, O_RDWR|O_CREAT, 0600);
+	if(fd == -1) {
+		log_msg(LOG_ERR, "rrl: cannot open %s: %s", file,
+			strerror(errno));
+		return NULL;
+	}
+	if(fstat(fd, &st) == -1 || ((size_t)st.st_size != len &&
+		(ftruncate(fd, 0) == -1 || ftruncate(fd, len) == -1))) {
+		log_msg(LOG_ERR, "rrl: cannot size %s: %s", file,
+			strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	h = (struct rrl_file_header*)mmap(NULL, len, PROT_READ|PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	if((void*)h == MAP_FAILED) {
+		log_msg(LOG_ERR, "rrl: mmap %s failed: %s", file,
+			strerror(errno));
+		return NULL;
+	}
+	if(h->magic == RRL_FILE_MAGIC && h->version == RRL_FILE_VERSION &&
+		h->bucket_size == sizeof(struct rrl_bucket) &&
+		h->buckets == (uint64_t)rrl_array_size) {
+		/* the keys of the buckets are found with the same hashes */
+		hash_set_key(h->key);
+		VERBOSITY(1, (LOG_INFO, "rrl: the rates are read from %s",
+			file));
+	} else {
+		if(h->magic != 0)
+			VERBOSITY(1, (LOG_INFO, "rrl: %s is of another "
+				"version or rrl-size, it is cleared", file));
+		memset(h, 0, len);
+		h->magic = RRL_FILE_MAGIC;
+		h->version = RRL_FILE_VERSION;
+		h->bucket_size = sizeof(struct rrl_bucket);
+		h->key = hash_get_key();
+		h->buckets = (uint64_t)rrl_array_size;
+	}
+	return (struct rrl_bucket*)(h+1);
+}
+#endif /* HAVE_MMAP */
 
-void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
-	size_t plf, size_t pls)
+/** set the limits in effect from the configured limits and the load */
+static void rrl_scale(void)
+{
+	/* the factor, in 1/RRL_LOAD_FULL */
+	uint64_t f = RRL_LOAD_FULL;
+	if(rrl_adaptive > 1) {
+		if(rrl_load_avg <= RRL_LOAD_LOW)
+			f = (uint64_t)rrl_adaptive*RRL_LOAD_FULL;
+		else if(rrl_load_avg < RRL_LOAD_HIGH)
+			f += (uint64_t)(rrl_adaptive-1)*RRL_LOAD_FULL*
+				(RRL_LOAD_HIGH-rrl_load_avg)/
+				(RRL_LOAD_HIGH-RRL_LOAD_LOW);
+	}
+	rrl_ratelimit = (uint32_t)(rrl_base_ratelimit*f/RRL_LOAD_FULL);
+	rrl_whitelist_ratelimit = (uint32_t)(rrl_base_whitelist_ratelimit*f/
+		RRL_LOAD_FULL);
+}
+
+void rrl_mmap_init(size_t numbuck, size_t lm, size_t wlm, size_t sm,
+	size_t plf, size_t pls, const char* file)
 {
-#ifdef HAVE_MMAP
-	size_t i;
-#endif
 	if(numbuck != 0)
 		rrl_array_size = numbuck;
 	rrl_ratelimit = lm*2;
+	rrl_base_ratelimit = lm*2;
 	rrl_slip_ratio = sm;
 	rrl_ipv4_prefixlen = plf;
 	rrl_ipv6_prefixlen = pls;
@@ -76,45 +194,69 @@ void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
 			(((uint64_t)0xffffffff)<<32);
 	}
 	rrl_whitelist_ratelimit = wlm*2;
+	rrl_base_whitelist_ratelimit = wlm*2;
+	rrl_scale();
 #ifdef HAVE_MMAP
+	/* the file keeps the rates over a restart of nsd */
+	if(file && file[0] && (rrl_map = rrl_file_map(file)) != NULL)
+		return;
 	/* allocate the ratelimit hashtable in a memory map so it is
-	 * preserved across reforks (every child its own table) */
-	rrl_maps_num = (size_t)numch;
-	rrl_maps = (void**)xmallocarray(rrl_maps_num, sizeof(void*));
-	for(i=0; i<rrl_maps_num; i++) {
-		rrl_maps[i] = mmap(NULL,
-			sizeof(struct rrl_bucket)*rrl_array_size,
-			PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
-		if(rrl_maps[i] == MAP_FAILED) {
-			log_msg(LOG_ERR, "rrl: mmap failed: %s",
-				strerror(errno));
-			exit(1);
-		}
-		memset(rrl_maps[i], 0,
-			sizeof(struct rrl_bucket)*rrl_array_size);
+	 * preserved across reforks, and the children count the same rates.
+	 * The anonymous map starts zeroed, all buckets unused. */
+	rrl_map = (struct rrl_bucket*)mmap(NULL,
+		sizeof(struct rrl_bucket)*rrl_array_size,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if((void*)rrl_map == MAP_FAILED) {
+		log_msg(LOG_ERR, "rrl: mmap failed: %s",
+			strerror(errno));
+		exit(1);
 	}
 #else
-	(void)numch;
-	rrl_maps_num = 0;
-	rrl_maps = NULL;
+	(void)file;
+	rrl_map = NULL;
 #endif
 }
 
 void rrl_set_limit(size_t lm, size_t wlm, size_t sm)
 {
-	rrl_ratelimit = lm*2;
-	rrl_whitelist_ratelimit = wlm*2;
+	rrl_base_ratelimit = lm*2;
+	rrl_base_whitelist_ratelimit = wlm*2;
 	rrl_slip_ratio = sm;
+	rrl_scale();
 }
 
-void rrl_init(size_t ch)
+void rrl_set_adaptive(size_t factor)
 {
-	if(!rrl_maps || ch >= rrl_maps_num)
-	    rrl_array = xalloc_array_zero(sizeof(struct rrl_bucket),
-	    	rrl_array_size);
-#ifdef HAVE_MMAP
-	else rrl_array = (struct rrl_bucket*)rrl_maps[ch];
-#endif
+	rrl_adaptive = (uint32_t)factor;
+	rrl_load_avg = RRL_LOAD_HIGH;
+	rrl_scale();
+}
+
+void rrl_adapt(uint32_t load)
+{
+	if(rrl_adaptive <= 1)
+		return;
+	if(load > RRL_LOAD_FULL)
+		load = RRL_LOAD_FULL;
+	/* moving average over about 16 batches */
+	rrl_load_avg = rrl_load_avg - rrl_load_avg/16 + load/16;
+	rrl_scale();
+}
+
+void rrl_get_limits(uint32_t* lm, uint32_t* wlm)
+{
+	*lm = rrl_ratelimit/2;
+	*wlm = rrl_whitelist_ratelimit/2;
+}
+
+void rrl_init(void)
+{
+	/* without the map every child counts its own rates */
+	if(!rrl_map) {
+		if(!rrl_array)
+			rrl_array = xalloc_array_zero(sizeof(struct rrl_bucket),
+				rrl_array_size);
+	} else	rrl_array = rrl_map;
 }
 
 /** return the source netblock of the query, this is the genuine source
@@ -145,7 +287,7 @@ static uint64_t rrl_get_source(query_type* query, uint16_t* c2)
 /** debug source to string */
 static const char* rrlsource2str(uint64_t s, uint16_t c2)
 {
-	static char buf[64];
+	static NSD_THREAD_LOCAL char buf[64];
 	struct in_addr a4;
 #ifdef INET6
 	if(c2) {
@@ -156,7 +298,7 @@ static const char* rrlsource2str(uint64_t s, uint16_t c2)
 		if(!inet_ntop(AF_INET6, &a6, buf, sizeof(buf)))
 			strlcpy(buf, "[ip6 ntop failed]", sizeof(buf));
 		else {
-			static char prefix[4];
+			static NSD_THREAD_LOCAL char prefix[4];
 			snprintf(prefix, sizeof(prefix), "/%d", rrl_ipv6_prefixlen);
 			strlcat(buf, &prefix[0], sizeof(buf));
 		}
@@ -170,7 +312,7 @@ static const char* rrlsource2str(uint64_t s, uint16_t c2)
 	if(!inet_ntop(AF_INET, &a4, buf, sizeof(buf)))
 		strlcpy(buf, "[ip4 ntop failed]", sizeof(buf));
 	else {
-		static char prefix[4];
+		static NSD_THREAD_LOCAL char prefix[4];
 		snprintf(prefix, sizeof(prefix), "/%d", rrl_ipv4_prefixlen);
 		strlcat(buf, &prefix[0], sizeof(buf));
 	}
@@ -283,7 +425,6 @@ static void examine_query(query_type* query, uint32_t* hash, uint64_t* source,
 	/* size with 16 bytes to spare */
 	uint8_t buf[MAXDOMAINLEN + sizeof(*source) + sizeof(c) + 16];
 	const uint8_t* dname = NULL; size_t dname_len = 0;
-	uint32_t r = 0x267fcd16;
 
 	*source = rrl_get_source(query, &c2);
 	c = rrl_classify(query, &dname, &dname_len);
@@ -301,24 +442,26 @@ static void examine_query(query_type* query, uint32_t* hash, uint64_t* source,
 	/* and hash it */
 	if(dname && dname_len <= MAXDOMAINLEN) {
 		memmove(buf+sizeof(*source)+sizeof(c), dname, dname_len);
-		*hash = hashlittle(buf, sizeof(*source)+sizeof(c)+dname_len, r);
+		*hash = (uint32_t)hash_bytes(buf,
+			sizeof(*source)+sizeof(c)+dname_len, 0);
 	} else
-		*hash = hashlittle(buf, sizeof(*source)+sizeof(c), r);
+		*hash = (uint32_t)hash_bytes(buf, sizeof(*source)+sizeof(c), 0);
 }
 
-/* age the bucket because elapsed time steps have gone by */
-static void rrl_attenuate_bucket(struct rrl_bucket* b, int32_t elapsed)
+/* age the rate because elapsed time steps have gone by, with counter
+ * queries in the first of them */
+static uint32_t rrl_attenuate_rate(uint32_t rate, uint32_t counter,
+	int32_t elapsed)
 {
-	if(elapsed > 16) {
-		b->rate = 0;
-	} else {
-		/* divide rate /2 for every elapsed time step, because
-		 * the counters in the inbetween steps were 0 */
-		/* r(t) = 0 + 0/2 + 0/4 + .. + oldrate/2^dt */
-		b->rate >>= elapsed;
-		/* we know that elapsed >= 2 */
-		b->rate += (b->counter>>(elapsed-1));
-	}
+	if(elapsed > 16)
+		return 0;
+	/* divide rate /2 for every elapsed time step, because
+	 * the counters in the inbetween steps were 0 */
+	/* r(t) = 0 + 0/2 + 0/4 + .. + oldrate/2^dt */
+	rate >>= elapsed;
+	/* we know that elapsed >= 2 */
+	rate += (counter>>(elapsed-1));
+	return rate;
 }
 
 /** log a message about ratelimits */
@@ -350,79 +493,146 @@ used_to_block(uint32_t rate, uint32_t counter, uint32_t lm)
 	return rate >= lm || counter+rate/2 >= lm;
 }
 
-/** update the rate in a ratelimit bucket, return actual rate */
-uint32_t rrl_update(query_type* query, uint32_t hash, uint64_t source,
-	uint16_t flags, int32_t now, uint32_t lm)
+/** the timestamp and counter in the count of a bucket */
+#define RRL_COUNT(stamp, counter) ((((uint64_t)(uint32_t)(stamp))<<32) | \
+	(uint32_t)(counter))
+#define RRL_STAMP(count) ((int32_t)(uint32_t)((count)>>32))
+#define RRL_COUNTER(count) ((uint32_t)(count))
+
+/** the key of the bucket for the rate, never 0 */
+static uint64_t rrl_key(uint32_t hash, uint64_t source, uint16_t flags)
 {
-	struct rrl_bucket* b = &rrl_array[hash % rrl_array_size];
+	uint8_t buf[sizeof(source)+sizeof(flags)];
+	memmove(buf, &source, sizeof(source));
+	memmove(buf+sizeof(source), &flags, sizeof(flags));
+	return (((uint64_t)hash)<<32) | (uint32_t)hash_bytes(buf, sizeof(buf),
+		hash) | 1;
+}
 
-	DEBUG(DEBUG_QUERY, 1, (LOG_INFO, "source %llx hash %x oldrate %d oldcount %d stamp %d",
-		(long long unsigned)source, hash, b->rate, b->counter, b->stamp));
-
-	/* check if different source */
-	if(b->source != source || b->flags != flags || b->hash != hash) {
-		/* initialise */
-		/* potentially the wrong limit here, used lower nonwhitelim */
-		if(verbosity >= 1 &&
-			used_to_block(b->rate, b->counter, rrl_ratelimit)) {
+/** find the bucket for the key, or claim one for it, in the probe
+ * sequence from the hash position.  Returns NULL if the rate has
+ * no bucket, if another server took the bucket at the same time. */
+static struct rrl_bucket* rrl_lookup(query_type* query, uint32_t hash,
+	uint64_t key, uint64_t source, uint16_t flags, int32_t now,
+	int* created)
+{
+	struct rrl_bucket* b, *victim = NULL;
+	uint64_t k, vk = 0;
+	size_t i;
+	*created = 0;
+	for(i=0; i<RRL_PROBES; i++) {
+		b = &rrl_array[(hash + i) % rrl_array_size];
+		k = rrl_load(&b->key);
+		if(k == key)
+			return b;
+		if(k == 0) {
+			if(!victim || vk != 0) {
+				victim = b;
+				vk = 0;
+			}
+		} else if(!victim || (vk != 0 && RRL_STAMP(rrl_load(
+			&b->count)) - RRL_STAMP(rrl_load(&victim->count)) < 0)) {
+			/* the oldest one is replaced */
+			victim = b;
+			vk = k;
+		}
+	}
+	/* initialise */
+	b = victim;
+	if(!rrl_cas(&b->key, vk, key))
+		return (vk == key)?b:NULL;
+	/* potentially the wrong limit here, used lower nonwhitelim */
+	if(vk != 0 && verbosity >= 1) {
+		uint64_t c = rrl_load(&b->count);
+		uint32_t rate = rrl_load(&b->rate);
+		if(rate >= rrl_ratelimit ||
+			RRL_COUNTER(c)+rate/2 >= rrl_ratelimit) {
 			char address[128];
 			addr2str(&query->addr, address, sizeof(address));
-			log_msg(LOG_INFO, "ratelimit unblock ~ type %s target %s query %s %s (%s collision)",
+			log_msg(LOG_INFO, "ratelimit unblock ~ type %s target %s query %s %s (bucket collision)",
 				rrltype2str(b->flags),
 				rrlsource2str(b->source, b->flags),
-				address, rrtype_to_string(query->qtype),
-				(b->hash!=hash?"bucket":"hash"));
+				address, rrtype_to_string(query->qtype));
 		}
-		b->hash = hash;
-		b->source = source;
-		b->flags = flags;
-		b->counter = 1;
-		b->rate = 0;
-		b->stamp = now;
-		return 1;
 	}
-	/* this is the same source */
+	b->source = source;
+	b->flags = flags;
+	rrl_store(&b->rate, 0);
+	rrl_store(&b->count, RRL_COUNT(now, 1));
+	*created = 1;
+	return b;
+}
 
-	/* check if old, zero or smooth it */
-	/* circular arith for time */
-	if(now - b->stamp == 1) {
-		/* very busy bucket and time just stepped one step */
-		int oldblock = used_to_block(b->rate, b->counter, lm);
-		b->rate = b->rate/2 + b->counter;
-		if(oldblock && b->rate < lm)
-			rrl_msg(query, "unblock");
-		b->counter = 1;
-		b->stamp = now;
-	} else if(now - b->stamp > 0) {
-		/* older bucket */
-		int olderblock = used_to_block(b->rate, b->counter, lm);
-		rrl_attenuate_bucket(b, now - b->stamp);
-		if(olderblock && b->rate < lm)
-			rrl_msg(query, "unblock");
-		b->counter = 1;
-		b->stamp = now;
-	} else if(now != b->stamp) {
-		/* robust, timestamp from the future */
-		if(used_to_block(b->rate, b->counter, lm))
-			rrl_msg(query, "unblock");
-		b->rate = 0;
-		b->counter = 1;
-		b->stamp = now;
-	} else {
-		/* bucket is from the current timestep, update counter */
-		b->counter ++;
+/** update the rate in a ratelimit bucket, return actual rate */
+uint32_t rrl_update(query_type* query, uint32_t hash, uint64_t source,
+	uint16_t flags, int32_t now, uint32_t lm)
+{
+	uint64_t key = rrl_key(hash, source, flags);
+	uint64_t c;
+	uint32_t rate, counter;
+	int created;
+	struct rrl_bucket* b = rrl_lookup(query, hash, key, source, flags,
+		now, &created);
+	if(!b || created)
+		return 1;
 
-		/* log what is blocked for operational debugging */
-		if(b->counter + b->rate/2 == lm && b->rate < lm)
-			rrl_msg(query, "block");
+	/* this is the same source */
+	c = rrl_load(&b->count);
+	DEBUG(DEBUG_QUERY, 1, (LOG_INFO, "source %llx hash %x oldrate %d oldcount %d stamp %d",
+		(long long unsigned)source, hash, (int)rrl_load(&b->rate),
+		(int)RRL_COUNTER(c), (int)RRL_STAMP(c)));
+	for(;;) {
+		int32_t stamp = RRL_STAMP(c);
+		if(now == stamp) {
+			/* bucket is from the current timestep, update counter;
+			 * if another server stepped the time in between, the
+			 * query counts in the new timestep */
+			counter = RRL_COUNTER(rrl_add(&b->count, 1));
+			rate = rrl_load(&b->rate);
+
+			/* log what is blocked for operational debugging */
+			if(counter + rate/2 == lm && rate < lm)
+				rrl_msg(query, "block");
+			break;
+		}
+		/* the server that steps the time sets the rate */
+		if(!rrl_cas(&b->count, c, RRL_COUNT(now, 1)))
+			continue;
+		counter = 1;
+		rate = rrl_load(&b->rate);
+		/* check if old, zero or smooth it */
+		/* circular arith for time */
+		if(now - stamp == 1) {
+			/* very busy bucket and time just stepped one step */
+			int oldblock = used_to_block(rate, RRL_COUNTER(c), lm);
+			rate = rate/2 + RRL_COUNTER(c);
+			if(oldblock && rate < lm)
+				rrl_msg(query, "unblock");
+		} else if(now - stamp > 0) {
+			/* older bucket */
+			int olderblock = used_to_block(rate, RRL_COUNTER(c),
+				lm);
+			rate = rrl_attenuate_rate(rate, RRL_COUNTER(c),
+				now - stamp);
+			if(olderblock && rate < lm)
+				rrl_msg(query, "unblock");
+		} else {
+			/* robust, timestamp from the future */
+			if(used_to_block(rate, RRL_COUNTER(c), lm))
+				rrl_msg(query, "unblock");
+			rate = 0;
+		}
+		rrl_store(&b->rate, rate);
+		break;
 	}
 
 	/* return max from current rate and projected next-value for rate */
 	/* so that if the rate increases suddenly very high, it is
 	 * stopped halfway into the time step */
-	if(b->counter > b->rate/2)
-		return b->counter + b->rate/2;
-	return b->rate;
+	if(counter > rate/2)
+		rate = counter + rate/2;
+	NSD_PROBE3(rrl__update, hash, source, rate);
+	return rate;
 }
 
 int rrl_process_query(query_type* query)
@@ -435,6 +645,9 @@ int rrl_process_query(query_type* query)
 	uint16_t flags;
 	if(rrl_ratelimit == 0 && rrl_whitelist_ratelimit == 0)
 		return 0;
+	/* a valid server cookie shows that the source is not spoofed */
+	if(query->edns.cookie_status == COOKIE_VALID)
+		return 0;
 
 	/* examine query */
 	examine_query(query, &hash, &source, &flags, &lm);
@@ -37,19 +37,29 @@ enum rrl_type {
 #define RRL_IPV6_PREFIX_LENGTH 64
 /** default whitelist rrl limit, in 2x qps, default is thus 2000 qps */
 #define RRL_WLIST_LIMIT 4000
+/** the load of a server for rrl-adaptive when its UDP batches are full */
+#define RRL_LOAD_FULL 1024
+/** with rrl-adaptive, below this load the limits are raised the most,
+ * from this load on they are the configured limits */
+#define RRL_LOAD_LOW (RRL_LOAD_FULL/4)
+#define RRL_LOAD_HIGH (RRL_LOAD_FULL*3/4)
 
 /**
- * Initialize for n children (optional, otherwise no mmaps used)
+ * Initialize the table shared by the children (optional, otherwise no
+ * mmap used and every child has its own table).
  * ratelimits lm and wlm are in qps (this routines x2s them for internal use).
  * plf and pls are in prefix lengths.
+ * If file is not NULL or "", the table is mapped from that file, and the
+ * rates in it are used if it has the same version and size.  That sets
+ * the hash secret to the one of the file.
  */
-void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
-	size_t plf, size_t pls);
+void rrl_mmap_init(size_t numbuck, size_t lm, size_t wlm, size_t sm,
+	size_t plf, size_t pls, const char* file);
 
 /**
  * Initialize rate limiting (for this child server process)
  */
-void rrl_init(size_t ch);
+void rrl_init(void);
 
 /**
  * Process query that happens, the query structure contains the
@@ -75,4 +85,20 @@ uint32_t rrl_update(query_type* query, uint32_t hash, uint64_t source,
 /** set the rate limit counters, pass variables in qps */
 void rrl_set_limit(size_t lm, size_t wlm, size_t sm);
 
+/**
+ * Set rrl-adaptive, the limits in effect are up to factor times the
+ * configured limits when the server has room, 0 or 1 is off.  They start
+ * at the configured limits.
+ */
+void rrl_set_adaptive(size_t factor);
+
+/**
+ * With rrl-adaptive, account the load of this server, from 0 to
+ * RRL_LOAD_FULL, and set the limits in effect from the smoothed load.
+ */
+void rrl_adapt(uint32_t load);
+
+/** the limits in effect in this server, in qps */
+void rrl_get_limits(uint32_t* lm, uint32_t* wlm);
+
 #endif /* RRL_H */
@@ -12,10 +12,17 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
 
 #include <netinet/in.h>
+#ifdef HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+#ifdef HAVE_NETINET_UDP_H
+#include <netinet/udp.h>
+#endif
 #include <arpa/inet.h>
 
 #include <assert.h>
@@ -35,8 +42,30 @@
 #endif
 #ifdef HAVE_MMAP
 #include <sys/mman.h>
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS   MAP_ANON
+#endif
 #endif /* HAVE_MMAP */
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+#ifdef HAVE_SYS_CPUSET_H
+#include <sys/cpuset.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+#ifdef USE_SERVER_THREADS
+#include <pthread.h>
+#endif
 #include <openssl/rand.h>
+#ifdef HAVE_SSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
 #ifndef USE_MINI_EVENT
 #  ifdef HAVE_EVENT_H
 #    include <event.h>
@@ -60,8 +89,19 @@
 #include "ipc.h"
 #include "udb.h"
 #include "remote.h"
+#include "metrics.h"
 #include "lookup3.h"
+#include "hash.h"
 #include "rrl.h"
+#include "anscache.h"
+#include "axfrcache.h"
+#include "xdp.h"
+#include "dnstap.h"
+#include "topk.h"
+#include "logring.h"
+#include "stall.h"
+#include "udpfilter.h"
+#include "usdt.h"
 
 #define RELOAD_SYNC_TIMEOUT 25 /* seconds */
 
@@ -80,6 +120,8 @@ struct tcp_accept_handler_data {
 	struct nsd_socket  *socket;
 	int event_added;
 	struct event       event;
+	/* the connections on this socket use DNS over TLS */
+	int tls;
 };
 
 /*
@@ -87,20 +129,129 @@ struct tcp_accept_handler_data {
  * when the number of TCP connection drops below the maximum
  * number of TCP connections.
  */
-static size_t		tcp_accept_handler_count;
-static struct tcp_accept_handler_data*	tcp_accept_handlers;
+static NSD_THREAD_LOCAL size_t		tcp_accept_handler_count;
+static NSD_THREAD_LOCAL struct tcp_accept_handler_data*	tcp_accept_handlers;
+
+static NSD_THREAD_LOCAL struct event slowaccept_event;
+static NSD_THREAD_LOCAL int slowaccept;
+
+/*
+ * The UDP handlers and the parent command handler of the server, that
+ * are removed when the server drains after a reload.  While it drains,
+ * no TCP connections are accepted and the connections are closed after
+ * their answers.
+ */
+static NSD_THREAD_LOCAL struct event* udp_handlers;
+static NSD_THREAD_LOCAL struct event* parent_cmd_handler;
+static NSD_THREAD_LOCAL int server_draining;
+static NSD_THREAD_LOCAL struct event drain_timeout_event;
+
+/*
+ * Number of TCP connections in this server process that are sending an
+ * AXFR, their query holds on to the domains of the zone.
+ */
+static NSD_THREAD_LOCAL int tcp_axfr_count;
+
+/*
+ * With xfr-out-workers, the worker that a server sends the next AXFR
+ * connection to.  In a worker, the event of the socket the connections
+ * come in on, and the pacing of the transfers: the xfr-out-rate in
+ * bytes per second, 0 if not paced, the bytes that may be sent now,
+ * and when they were counted.
+ */
+static NSD_THREAD_LOCAL size_t xfrout_next;
+static NSD_THREAD_LOCAL struct event xfrout_event;
+static NSD_THREAD_LOCAL uint64_t xfrout_rate;
+static NSD_THREAD_LOCAL int64_t xfrout_tokens;
+static NSD_THREAD_LOCAL struct timeval xfrout_last;
 
-static struct event slowaccept_event;
-static int slowaccept;
+#ifdef USE_ZONE_STATS
+/* queries since the last one that was timed, with zone-cpu-sample */
+static NSD_THREAD_LOCAL int zone_cpu_count;
+#endif
 
 #ifndef NONBLOCKING_IS_BROKEN
-#  define NUM_RECV_PER_SELECT 100
+/* Number of UDP queries received per event, the udp-batch-size */
+static NSD_THREAD_LOCAL int udp_batch_size = 100;
+/* Max number of batches read per event, with a full batch or busy-poll */
+#  define UDP_BATCH_ROUNDS 16
+#endif
+/* With overload-action, the server does not keep up with the queries */
+static NSD_THREAD_LOCAL int udp_overload = 0;
+
+#if (!defined(NONBLOCKING_IS_BROKEN) && (defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)))
+/* Full batches in a row after which the server is in overload */
+#  define OVERLOAD_FULL_BATCHES 4
+static NSD_THREAD_LOCAL int udp_full_batches = 0;
+/* udp_batch_size entries, allocated when the server starts */
+NSD_THREAD_LOCAL struct mmsghdr *msgs;
+NSD_THREAD_LOCAL struct iovec *iovecs;
+NSD_THREAD_LOCAL struct query **queries;
+#endif
+
+#if (!defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG))
+/* udp_batch_size control buffers of udp_cmsg_space for msgs, for the
+ * UDP_GRO segment size and the destination address, NULL if not used */
+static NSD_THREAD_LOCAL uint8_t *udp_cmsgs;
+static NSD_THREAD_LOCAL size_t udp_cmsg_space;
+#  ifdef IP_PKTINFO
+/* udp-wildcard, one UDP socket per family and port for the ip-addresses */
+#    define UDP_WILDCARD 1
+/* Length of the key of an address, the family, the port and the address */
+#    define UDP_WILD_KEY_LEN 19
+/* Size of the control message with the destination address */
+#    ifdef INET6
+#      define UDP_PKTINFO_CMSG_SPACE CMSG_SPACE(sizeof(struct in6_pktinfo))
+#    else
+#      define UDP_PKTINFO_CMSG_SPACE CMSG_SPACE(sizeof(struct in_pktinfo))
+#    endif
+#  endif
+#  if defined(SO_RXQ_OVFL) && defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS)
+/* Size of the control message with the number of dropped queries */
+#    define UDP_RXQ_OVFL_CMSG_SPACE CMSG_SPACE(sizeof(uint32_t))
+/* Seconds in a row with dropped queries after which the server logs that
+ * it cannot keep up, and the seconds between those warnings */
+#    define UDP_DROP_ALERT_SECS 10
+#    define UDP_DROP_ALERT_INTERVAL 60
+/* The last second in which queries were dropped, the start of the
+ * seconds in a row with drops, the last warning and buffer growth */
+static NSD_THREAD_LOCAL time_t udp_drop_last, udp_drop_run;
+static NSD_THREAD_LOCAL time_t udp_drop_alerted, udp_rcvbuf_grown;
+#  endif
+#  ifdef UDP_GRO
+/* Size of the control message with the UDP_GRO segment size */
+#    define UDP_GRO_CMSG_SPACE CMSG_SPACE(sizeof(int))
+/* The query for the segments after the first of a UDP_GRO datagram */
+static NSD_THREAD_LOCAL struct query *udp_gro_query;
+#  endif
+#  ifdef UDP_SEGMENT
+/* Largest answer sent with UDP_SEGMENT, it fits the IPv6 minimum MTU */
+#    define UDP_GSO_MAX_SIZE 1232
+/* Max number of answers in one UDP_SEGMENT datagram */
+#    define UDP_GSO_MAX_SEGS 64
+/* Answers to the same client are sent with UDP_SEGMENT, from udp-gso */
+static NSD_THREAD_LOCAL int udp_gso;
+#  endif
+#  ifdef HAVE_BUILTIN_PREFETCH
+/* Max steps of the prefetch of the lookups of a batch, edges in the tree */
+#    define UDP_PREFETCH_STEPS 8
+/* udp_batch_size prefetch states, NULL if udp-prefetch is off */
+static NSD_THREAD_LOCAL struct domain_prefetch *udp_prefetch;
+#  endif
 #endif
 
-#if (!defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG))
-struct mmsghdr msgs[NUM_RECV_PER_SELECT];
-struct iovec iovecs[NUM_RECV_PER_SELECT];
-struct query *queries[NUM_RECV_PER_SELECT];
+#ifdef HAVE_SSL
+/*
+ * The state of a DNS over TLS connection, if it waits for the
+ * handshake, or if a read or write waits for the other event.
+ */
+enum tls_shake_state {
+	tls_hs_none = 0,	/* handshake done, nothing waits */
+	tls_hs_read,		/* the handshake waits until readable */
+	tls_hs_write,		/* the handshake waits until writable */
+	tls_hs_read_event,	/* SSL_read waits until writable */
+	tls_hs_write_event	/* SSL_write waits until readable */
+};
 #endif
 
 /*
@@ -159,7 +310,110 @@ struct tcp_handler_data
 	 * The number of queries handled by this specific TCP connection.
 	 */
 	int					query_count;
+
+	/*
+	 * Data read from the connection that is not used yet, from the
+	 * position to the limit.  Pipelined queries are read together.
+	 * in_full is set if the last read filled the buffer, so that
+	 * there may be more to read.
+	 */
+	buffer_type*		in;
+	int					in_full;
+
+	/*
+	 * The answers, with their length, that are written together.
+	 * If write_packet is set, the answer in the query packet is
+	 * written after them, this is used for AXFR and large answers.
+	 */
+	buffer_type*		out;
+	int					write_packet;
+
+	/*
+	 * Set while the connection is corked, during an AXFR, so the
+	 * messages fill the TCP segments.
+	 */
+	int					corked;
+
+	/*
+	 * Next in the list of free handlers, once the connection is
+	 * closed.
+	 */
+	struct tcp_handler_data*	next_free;
+
+	/*
+	 * The list of open connections, the one that became idle last
+	 * is first.  A connection is idle when its answers are written
+	 * and it waits for the next query.  When the connections are
+	 * full, the one that is idle longest is closed for a new one.
+	 */
+	struct tcp_handler_data*	lru_prev, *lru_next;
+	int					idle;
+
+#ifdef HAVE_SSL
+	/*
+	 * The TLS connection for DNS over TLS, NULL for plain TCP, and
+	 * the state of its handshake and of reads and writes.
+	 */
+	SSL*				tls;
+	enum tls_shake_state	shake_state;
+#endif
+};
+
+/* Max number of connections accepted per event on a TCP socket */
+#define TCP_ACCEPT_BATCH 16
+
+/* Size of the read buffer of a TCP connection, for pipelined queries */
+#define TCP_READ_BUFFER_SIZE 4096
+/* Size of the buffer for the answers that are written together */
+#define TCP_WRITE_BUFFER_SIZE 32768
+/* Max number of AXFR messages written per write event on a connection */
+#define TCP_AXFR_WRITE_BATCH 8
+
+/*
+ * A connection that a server hands to an xfr-out worker, with the fd in
+ * the control message.  It is followed by len bytes that the server has
+ * read from the connection: the AXFR query, with its length, and the
+ * pipelined data after it.
+ */
+struct xfrout_handoff {
+#ifdef INET6
+	struct sockaddr_storage addr;
+#else
+	struct sockaddr_in addr;
+#endif
+	socklen_t addrlen;
+	uint32_t len;
 };
+/* The burst of an xfr-out worker, that is sent at once, in seconds of
+ * the xfr-out-rate, and at least a full packet */
+#define XFROUT_BURST_DIV 10
+#define XFROUT_BURST_MIN (2*(MAX_PACKET_SIZE+2))
+
+/*
+ * The handlers of closed TCP connections, with their region and query,
+ * kept for the next connections so that accept does not malloc.  At
+ * most maximum_tcp_count are kept.  The server fills the list with
+ * maximum_tcp_count handlers when it starts.
+ */
+static NSD_THREAD_LOCAL struct tcp_handler_data* tcp_handler_free = NULL;
+static NSD_THREAD_LOCAL int tcp_handler_free_count = 0;
+
+#ifdef BIND8_STATS
+/*
+ * With region-profile, the memory of the server region and the TCP
+ * handlers of this server per tag, published in the stat slot.
+ */
+static NSD_THREAD_LOCAL struct region_tag_stat server_profile[
+	REGION_TAG_COUNT];
+static NSD_THREAD_LOCAL int server_profiling = 0;
+#endif
+
+/* The open connections, see lru_prev, and the number that is idle */
+static NSD_THREAD_LOCAL struct tcp_handler_data* tcp_lru_first = NULL;
+static NSD_THREAD_LOCAL struct tcp_handler_data* tcp_lru_last = NULL;
+static NSD_THREAD_LOCAL int tcp_idle_count = 0;
+/* set if the accept handlers are off because the connections are full */
+static NSD_THREAD_LOCAL int tcp_accept_full = 0;
 
 /*
  * Handle incoming queries on the UDP server sockets.
@@ -191,12 +445,26 @@ static void handle_tcp_reading(int fd, short event, void* arg);
  */
 static void handle_tcp_writing(int fd, short event, void* arg);
 
+/*
+ * Handle the AXFR connections that a server hands to this xfr-out
+ * worker, with the query and the rest that the server has read.
+ */
+static void handle_xfrout(int fd, short event, void* arg);
+
+/*
+ * Fill the free list of TCP handlers up to num handlers, so that the
+ * first connections do not allocate either.
+ */
+static void tcp_handler_fill(int num);
+
 /*
  * Send all children the quit nonblocking, then close pipe.
  */
 static void send_children_quit(struct nsd* nsd);
 /* same, for shutdown time, waits for child to exit to avoid restart issues */
 static void send_children_quit_and_wait(struct nsd* nsd);
+/* same, after a reload, the children drain their TCP connections */
+static void send_children_drain(struct nsd* nsd);
 
 /* set childrens flags to send NSD_STATS to them */
 #ifdef BIND8_STATS
@@ -208,18 +476,17 @@ static void set_children_stats(struct nsd* nsd);
  */
 static void configure_handler_event_types(short event_types);
 
-static uint16_t *compressed_dname_offsets = 0;
-static uint32_t compression_table_capacity = 0;
-static uint32_t compression_table_size = 0;
-
 /*
  * Remove the specified pid from the list of child pids.  Returns -1 if
  * the pid is not in the list, child_num otherwise.  The field is set to 0.
+ * With server-threads, all the children in the process are removed, and
+ * the first is returned.
  */
 static int
 delete_child_pid(struct nsd *nsd, pid_t pid)
 {
 	size_t i;
+	int first = -1;
 	for (i = 0; i < nsd->child_count; ++i) {
 		if (nsd->children[i].pid == pid) {
 			nsd->children[i].pid = 0;
@@ -230,11 +497,341 @@ delete_child_pid(struct nsd *nsd, pid_t pid)
 				if(nsd->children[i].handler)
 					nsd->children[i].handler->fd = -1;
 			}
-			return i;
+			if(first == -1)
+				first = i;
+			if(!nsd->server_threads)
+				break;
+		}
+	}
+	return first;
+}
+
+/* bind the calling process or thread to the cpus, who is for the log */
+void
+server_set_cpu_affinity(struct cpu_option* cpus, const char* who)
+{
+#if defined(HAVE_SCHED_SETAFFINITY) || defined(HAVE_CPUSET_SETAFFINITY)
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t set;
+#else
+	cpuset_t set;
+#endif
+	struct cpu_option* c;
+	if(!cpus)
+		return;
+	CPU_ZERO(&set);
+	for(c = cpus; c; c = c->next) {
+		if(c->cpu < 0 || c->cpu >= CPU_SETSIZE) {
+			log_msg(LOG_ERR, "%s: cpu %d out of range", who, c->cpu);
+			continue;
+		}
+		CPU_SET(c->cpu, &set);
+	}
+#ifdef HAVE_SCHED_SETAFFINITY
+	if(sched_setaffinity(0, sizeof(set), &set) == -1)
+#else
+	if(cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1,
+		sizeof(set), &set) == -1)
+#endif
+		log_msg(LOG_ERR, "%s: cannot set cpu affinity: %s", who,
+			strerror(errno));
+#else
+	if(cpus)
+		log_msg(LOG_WARNING, "%s: cpu affinity is not supported on "
+			"this system", who);
+#endif
+}
+
+/* the cpus configured for server process number i, or NULL */
+static struct cpu_option*
+server_cpu_affinity(struct nsd* nsd, size_t i)
+{
+	cpu_map_option_t* m;
+	for(m = nsd->options->service_cpu_affinity; m; m = m->next)
+		if(m->service == (int)i+1)
+			return m->cpus;
+	return NULL;
+}
+
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_move_pages) && defined(SYS_getcpu)
+/* number of pages that the node is asked of in one call */
+#define NUMA_PAGES_BATCH 1024
+
+struct numa_replicate {
+	int node;
+	long pagesize;
+	size_t copied;
+};
+
+/* copy the pages of the block that are on another node */
+static void
+numa_replicate_block(void* block, size_t size, void* arg)
+{
+	struct numa_replicate* r = (struct numa_replicate*)arg;
+	void* pages[NUMA_PAGES_BATCH];
+	int status[NUMA_PAGES_BATCH];
+	uintptr_t p = (uintptr_t)block & ~(uintptr_t)(r->pagesize-1);
+	uintptr_t end = (uintptr_t)block + size;
+	size_t n, i;
+	while(p < end) {
+		for(n=0; n<NUMA_PAGES_BATCH && p < end; n++, p += r->pagesize)
+			pages[n] = (void*)p;
+		/* without nodes, move_pages returns the node of the pages */
+		if(syscall(SYS_move_pages, 0, (unsigned long)n, pages, NULL,
+			status, 0) != 0)
+			return;
+		for(i=0; i<n; i++) {
+			/* the first page can start before the block */
+			volatile uint8_t* b = (uint8_t*)(i==0 &&
+				(void*)pages[0] < block ? block : pages[i]);
+			if(status[i] < 0 || status[i] == r->node)
+				continue;
+			/* the page is shared with the reload process, the
+			 * write makes the kernel copy it, on this node */
+			*b = *b;
+			r->copied++;
+		}
+	}
+}
+
+/*
+ * Copy the pages of the database that are on another numa node than
+ * this server, after it is bound to its cpus.
+ */
+static void
+server_numa_replicate(struct nsd* nsd)
+{
+	struct numa_replicate r;
+	unsigned cpu, node;
+	struct radnode* n;
+	if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+		log_msg(LOG_ERR, "numa-replicate: getcpu: %s", strerror(errno));
+		return;
+	}
+	r.node = (int)node;
+	r.pagesize = sysconf(_SC_PAGESIZE);
+	r.copied = 0;
+	if(r.pagesize <= 0)
+		return;
+	region_walk_blocks(nsd->db->region, numa_replicate_block, &r);
+	for(n=radix_first(nsd->db->zonetree); n; n=radix_next(n)) {
+		zone_type* zone = (zone_type*)n->elem;
+		if(zone->region != nsd->db->region)
+			region_walk_blocks(zone->region, numa_replicate_block,
+				&r);
+	}
+	VERBOSITY(2, (LOG_INFO, "server %d copied %d pages of the database "
+		"to numa node %d", (int)getpid(), (int)r.copied, r.node));
+}
+#else
+static void
+server_numa_replicate(struct nsd* ATTR_UNUSED(nsd))
+{
+}
+#endif /* HAVE_SYS_SYSCALL_H && SYS_move_pages && SYS_getcpu */
+
+/* the server main watches the command channel of child number i */
+static void
+parent_watch_child(struct nsd *nsd, region_type* region, netio_type* netio,
+	int* xfrd_sock_p, size_t i)
+{
+	struct main_ipc_handler_data *ipc_data;
+
+	close(nsd->children[i].parent_fd);
+	nsd->children[i].parent_fd = -1;
+	if (fcntl(nsd->children[i].child_fd, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "cannot fcntl pipe: %s", strerror(errno));
+	}
+	if(!nsd->children[i].handler)
+	{
+		ipc_data = (struct main_ipc_handler_data*) region_alloc(
+			region, sizeof(struct main_ipc_handler_data));
+		ipc_data->nsd = nsd;
+		ipc_data->child = &nsd->children[i];
+		ipc_data->child_num = i;
+		ipc_data->xfrd_sock = xfrd_sock_p;
+		ipc_data->packet = buffer_create(region, QIOBUFSZ);
+		ipc_data->forward_mode = 0;
+		ipc_data->got_bytes = 0;
+		ipc_data->total_bytes = 0;
+		ipc_data->acl_num = 0;
+		nsd->children[i].handler = (struct netio_handler*) region_alloc(
+			region, sizeof(struct netio_handler));
+		nsd->children[i].handler->fd = nsd->children[i].child_fd;
+		nsd->children[i].handler->timeout = NULL;
+		nsd->children[i].handler->user_data = ipc_data;
+		nsd->children[i].handler->event_types = NETIO_EVENT_READ;
+		nsd->children[i].handler->event_handler = parent_handle_child_command;
+		netio_add_handler(netio, nsd->children[i].handler);
+	}
+	/* clear any ongoing ipc */
+	ipc_data = (struct main_ipc_handler_data*)
+		nsd->children[i].handler->user_data;
+	ipc_data->forward_mode = 0;
+	/* restart - update fd */
+	nsd->children[i].handler->fd = nsd->children[i].child_fd;
+}
+
+/* setup of a freshly forked server process */
+static void
+child_process_init(struct nsd *nsd, int* xfrd_sock_p)
+{
+	/* the child need not be able to access the
+	 * nsd.db file, other than to read the lazy zones */
+	if(nsd->db->lazy_zones) {
+		nsd->db->udb_read = nsd->db->udb;
+		nsd->db->udb = NULL;
+		nsd->db->udb_read->remap_count = 0;
+		/* map the file in before the first query reads it */
+		if(nsd->options->reload_prefault)
+			udb_base_prefault(nsd->db->udb_read, 1);
+	} else	namedb_close_udb(nsd->db);
+	nsd->pid = 0;
+	/* remove signal flags inherited from parent
+	   the parent will handle them. */
+	nsd->signal_hint_reload_hup = 0;
+	nsd->signal_hint_reload = 0;
+	nsd->signal_hint_child = 0;
+	nsd->signal_hint_quit = 0;
+	nsd->signal_hint_shutdown = 0;
+	nsd->signal_hint_stats = 0;
+	nsd->signal_hint_statsusr = 0;
+	close(*xfrd_sock_p);
+}
+
+/* make nsd the server for child number i */
+static void
+child_server_init(struct nsd *nsd, size_t i)
+{
+	nsd->child_count = 0;
+	nsd->server_kind = nsd->children[i].kind;
+	nsd->this_child = &nsd->children[i];
+	close(nsd->this_child->child_fd);
+	nsd->this_child->child_fd = -1;
+	if (fcntl(nsd->this_child->parent_fd, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "cannot fcntl pipe: %s", strerror(errno));
+	}
+#ifdef BIND8_STATS
+	if(nsd->stat_map[nsd->stat_idx])
+		nsd->stat_slot = STAT_SLOT(nsd, nsd->stat_idx, i);
+#endif
+#ifdef USE_DNSTAP
+	if(nsd->dt_map[nsd->dt_idx])
+		nsd->dt_ring = dt_ring(nsd, nsd->dt_idx, i);
+#endif
+	if(nsd->top_map[nsd->top_idx])
+		nsd->top = topk_tables(nsd, nsd->top_idx, i);
+	logring_attach(nsd, i);
+	stall_attach(nsd, i);
+#ifdef USE_ZONE_STATS
+	nsd->zonestatshard = i % nsd->zonestatshards;
+#endif
+}
+
+#ifdef USE_SERVER_THREADS
+/* number of server threads that run in this server process */
+static int server_threads_running = 0;
+/* the listening sockets of the process have been closed */
+static int server_threads_closed = 0;
+static pthread_mutex_t server_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void*
+server_thread_start(void* arg)
+{
+	struct nsd* nsd = (struct nsd*)arg;
+	server_set_cpu_affinity(server_cpu_affinity(nsd,
+		nsd->this_child - nsd->children), "server");
+	server_child(nsd);
+	/* NOTREACH */
+	return NULL;
+}
+
+/*
+ * Run the children that are not running as threads of a new server
+ * process.  The first one is the main thread of the process, that
+ * handles the signals; the others get a copy of the nsd struct.
+ */
+static int
+restart_child_threads(struct nsd *nsd, region_type* region, netio_type* netio,
+	int* xfrd_sock_p)
+{
+	size_t i, first = nsd->child_count;
+	int sv[2], err;
+	sigset_t sigs, oldsigs;
+	pid_t pid;
+
+	for (i = 0; i < nsd->child_count; ++i) {
+		if (nsd->children[i].pid > 0)
+			continue;
+		if (nsd->children[i].child_fd != -1)
+			close(nsd->children[i].child_fd);
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+			log_msg(LOG_ERR, "socketpair: %s", strerror(errno));
+			return -1;
+		}
+		nsd->children[i].child_fd = sv[0];
+		nsd->children[i].parent_fd = sv[1];
+		if (first == nsd->child_count)
+			first = i;
+	}
+	if (first == nsd->child_count)
+		return 0;
+
+	pid = fork();
+	switch (pid) {
+	default: /* SERVER MAIN */
+		for (i = first; i < nsd->child_count; ++i) {
+			if (nsd->children[i].pid > 0)
+				continue;
+			nsd->children[i].pid = pid;
+			parent_watch_child(nsd, region, netio, xfrd_sock_p, i);
+		}
+		return 0;
+	case 0: /* CHILD */
+		child_process_init(nsd, xfrd_sock_p);
+		server_threads_running = 1;
+		sigfillset(&sigs);
+		pthread_sigmask(SIG_SETMASK, &sigs, &oldsigs);
+		for (i = first+1; i < nsd->child_count; ++i) {
+			struct nsd* t;
+			pthread_t thr;
+			if (nsd->children[i].pid > 0)
+				continue;
+			t = (struct nsd*)xalloc(sizeof(*t));
+			memcpy(t, nsd, sizeof(*t));
+			child_server_init(t, i);
+			pthread_mutex_lock(&server_threads_lock);
+			server_threads_running++;
+			pthread_mutex_unlock(&server_threads_lock);
+			if ((err = pthread_create(&thr, NULL,
+				server_thread_start, t)) != 0) {
+				log_msg(LOG_ERR, "cannot start server thread: "
+					"%s", strerror(err));
+				pthread_mutex_lock(&server_threads_lock);
+				server_threads_running--;
+				pthread_mutex_unlock(&server_threads_lock);
+				/* the server main sees the closed channel,
+				 * and restarts it */
+				close(t->this_child->parent_fd);
+				free(t);
+				continue;
+			}
+			pthread_detach(thr);
 		}
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+		child_server_init(nsd, first);
+		server_set_cpu_affinity(server_cpu_affinity(nsd, first),
+			"server");
+		server_child(nsd);
+		/* NOTREACH */
+		exit(0);
+	case -1:
+		log_msg(LOG_ERR, "fork failed: %s", strerror(errno));
+		return -1;
 	}
-	return -1;
+	return 0;
 }
+#endif /* USE_SERVER_THREADS */
 
 /*
  * Restart child servers if necessary.
@@ -243,10 +840,13 @@ static int
 restart_child_servers(struct nsd *nsd, region_type* region, netio_type* netio,
 	int* xfrd_sock_p)
 {
-	struct main_ipc_handler_data *ipc_data;
 	size_t i;
 	int sv[2];
 
+#ifdef USE_SERVER_THREADS
+	if (nsd->server_threads)
+		return restart_child_threads(nsd, region, netio, xfrd_sock_p);
+#endif
 	/* Fork the child processes... */
 	for (i = 0; i < nsd->child_count; ++i) {
 		if (nsd->children[i].pid <= 0) {
@@ -262,63 +862,17 @@ restart_child_servers(struct nsd *nsd, region_type* region, netio_type* netio,
 			nsd->children[i].pid = fork();
 			switch (nsd->children[i].pid) {
 			default: /* SERVER MAIN */
-				close(nsd->children[i].parent_fd);
-				nsd->children[i].parent_fd = -1;
-				if (fcntl(nsd->children[i].child_fd, F_SETFL, O_NONBLOCK) == -1) {
-					log_msg(LOG_ERR, "cannot fcntl pipe: %s", strerror(errno));
-				}
-				if(!nsd->children[i].handler)
-				{
-					ipc_data = (struct main_ipc_handler_data*) region_alloc(
-						region, sizeof(struct main_ipc_handler_data));
-					ipc_data->nsd = nsd;
-					ipc_data->child = &nsd->children[i];
-					ipc_data->child_num = i;
-					ipc_data->xfrd_sock = xfrd_sock_p;
-					ipc_data->packet = buffer_create(region, QIOBUFSZ);
-					ipc_data->forward_mode = 0;
-					ipc_data->got_bytes = 0;
-					ipc_data->total_bytes = 0;
-					ipc_data->acl_num = 0;
-					nsd->children[i].handler = (struct netio_handler*) region_alloc(
-						region, sizeof(struct netio_handler));
-					nsd->children[i].handler->fd = nsd->children[i].child_fd;
-					nsd->children[i].handler->timeout = NULL;
-					nsd->children[i].handler->user_data = ipc_data;
-					nsd->children[i].handler->event_types = NETIO_EVENT_READ;
-					nsd->children[i].handler->event_handler = parent_handle_child_command;
-					netio_add_handler(netio, nsd->children[i].handler);
-				}
-				/* clear any ongoing ipc */
-				ipc_data = (struct main_ipc_handler_data*)
-					nsd->children[i].handler->user_data;
-				ipc_data->forward_mode = 0;
-				/* restart - update fd */
-				nsd->children[i].handler->fd = nsd->children[i].child_fd;
+				parent_watch_child(nsd, region, netio,
+					xfrd_sock_p, i);
 				break;
 			case 0: /* CHILD */
-				/* the child need not be able to access the
-				 * nsd.db file */
-				namedb_close_udb(nsd->db);
-				nsd->pid = 0;
-				nsd->child_count = 0;
-				nsd->server_kind = nsd->children[i].kind;
-				nsd->this_child = &nsd->children[i];
-				/* remove signal flags inherited from parent
-				   the parent will handle them. */
-				nsd->signal_hint_reload_hup = 0;
-				nsd->signal_hint_reload = 0;
-				nsd->signal_hint_child = 0;
-				nsd->signal_hint_quit = 0;
-				nsd->signal_hint_shutdown = 0;
-				nsd->signal_hint_stats = 0;
-				nsd->signal_hint_statsusr = 0;
-				close(*xfrd_sock_p);
-				close(nsd->this_child->child_fd);
-				nsd->this_child->child_fd = -1;
-				if (fcntl(nsd->this_child->parent_fd, F_SETFL, O_NONBLOCK) == -1) {
-					log_msg(LOG_ERR, "cannot fcntl pipe: %s", strerror(errno));
-				}
+				child_process_init(nsd, xfrd_sock_p);
+				child_server_init(nsd, i);
+				server_set_cpu_affinity(server_cpu_affinity(nsd, i),
+					"server");
+				if(nsd->options->numa_replicate &&
+					!nsd->server_threads)
+					server_numa_replicate(nsd);
 				server_child(nsd);
 				/* NOTREACH */
 				exit(0);
@@ -352,16 +906,33 @@ zonestatid_tree_set(struct nsd* nsd)
 	}
 }
 
+/* write the nsd.db as the image for the database-readonly instances */
+static void
+server_db_publish(struct nsd* nsd)
+{
+	if(!nsd->options->database_publish || !nsd->db->udb ||
+		nsd->db->udb->readonly)
+		return;
+	if(udb_base_publish(nsd->db->udb, nsd->options->database_publish))
+		VERBOSITY(2, (LOG_INFO, "published the database to %s",
+			nsd->options->database_publish));
+}
+
 #ifdef USE_ZONE_STATS
 void
 server_zonestat_alloc(struct nsd* nsd)
 {
 	size_t num = (nsd->options->zonestatnames->count==0?1:
 			nsd->options->zonestatnames->count);
-	size_t sz = sizeof(struct nsdst)*num;
+	size_t sz;
 	char tmpfile[256];
 	uint8_t z = 0;
 
+	/* a shard per server, the server-count does not change on reload */
+	nsd->zonestatshards = (nsd->child_count?nsd->child_count:1);
+	nsd->zonestatshard = 0;
+	sz = ZONESTAT_SIZE(nsd, num);
+
 	/* file names */
 	nsd->zonestatfname[0] = 0;
 	nsd->zonestatfname[1] = 0;
@@ -409,7 +980,7 @@ server_zonestat_alloc(struct nsd* nsd)
 			nsd->zonestatfname[1], strerror(errno));
 		exit(1);
 	}
-	nsd->zonestat[0] = (struct nsdst*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
+	nsd->zonestat[0] = (struct zonestat*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
 		MAP_SHARED, nsd->zonestatfd[0], 0);
 	if(nsd->zonestat[0] == MAP_FAILED) {
 		log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
@@ -417,7 +988,7 @@ server_zonestat_alloc(struct nsd* nsd)
 		unlink(nsd->zonestatfname[1]);
 		exit(1);
 	}
-	nsd->zonestat[1] = (struct nsdst*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
+	nsd->zonestat[1] = (struct zonestat*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
 		MAP_SHARED, nsd->zonestatfd[1], 0);
 	if(nsd->zonestat[1] == MAP_FAILED) {
 		log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
@@ -440,8 +1011,8 @@ zonestat_remap(struct nsd* nsd, int idx, size_t sz)
 {
 #ifdef HAVE_MMAP
 #ifdef MREMAP_MAYMOVE
-	nsd->zonestat[idx] = (struct nsdst*)mremap(nsd->zonestat[idx],
-		sizeof(struct nsdst)*nsd->zonestatsize[idx], sz,
+	nsd->zonestat[idx] = (struct zonestat*)mremap(nsd->zonestat[idx],
+		ZONESTAT_SIZE(nsd, nsd->zonestatsize[idx]), sz,
 		MREMAP_MAYMOVE);
 	if(nsd->zonestat[idx] == MAP_FAILED) {
 		log_msg(LOG_ERR, "mremap failed: %s", strerror(errno));
@@ -449,12 +1020,12 @@ zonestat_remap(struct nsd* nsd, int idx, size_t sz)
 	}
 #else /* !HAVE MREMAP */
 	if(msync(nsd->zonestat[idx],
-		sizeof(struct nsdst)*nsd->zonestatsize[idx], MS_ASYNC) != 0)
+		ZONESTAT_SIZE(nsd, nsd->zonestatsize[idx]), MS_ASYNC) != 0)
 		log_msg(LOG_ERR, "msync failed: %s", strerror(errno));
 	if(munmap(nsd->zonestat[idx],
-		sizeof(struct nsdst)*nsd->zonestatsize[idx]) != 0)
+		ZONESTAT_SIZE(nsd, nsd->zonestatsize[idx])) != 0)
 		log_msg(LOG_ERR, "munmap failed: %s", strerror(errno));
-	nsd->zonestat[idx] = (struct nsdst*)mmap(NULL, sz,
+	nsd->zonestat[idx] = (struct zonestat*)mmap(NULL, sz,
 		PROT_READ|PROT_WRITE, MAP_SHARED, nsd->zonestatfd[idx], 0);
 	if(nsd->zonestat[idx] == MAP_FAILED) {
 		log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
@@ -477,7 +1048,7 @@ server_zonestat_realloc(struct nsd* nsd)
 		idx = 1;
 	if(nsd->zonestatsize[idx] == nsd->zonestatdesired)
 		return;
-	sz = sizeof(struct nsdst)*nsd->zonestatdesired;
+	sz = ZONESTAT_SIZE(nsd, nsd->zonestatdesired);
 	if(lseek(nsd->zonestatfd[idx], (off_t)sz-1, SEEK_SET) == -1) {
 		log_msg(LOG_ERR, "lseek %s: %s", nsd->zonestatfname[idx],
 			strerror(errno));
@@ -491,9 +1062,9 @@ server_zonestat_realloc(struct nsd* nsd)
 	zonestat_remap(nsd, idx, sz);
 	/* zero the newly allocated region */
 	if(nsd->zonestatdesired > nsd->zonestatsize[idx]) {
-		memset(((char*)nsd->zonestat[idx])+sizeof(struct nsdst) *
-			nsd->zonestatsize[idx], 0, sizeof(struct nsdst) *
-			(nsd->zonestatdesired - nsd->zonestatsize[idx]));
+		memset(((char*)nsd->zonestat[idx])+ZONESTAT_SIZE(nsd,
+			nsd->zonestatsize[idx]), 0, ZONESTAT_SIZE(nsd,
+			nsd->zonestatdesired - nsd->zonestatsize[idx]));
 	}
 	nsd->zonestatsize[idx] = nsd->zonestatdesired;
 #endif /* HAVE_MMAP */
@@ -515,79 +1086,179 @@ server_zonestat_switch(struct nsd* nsd)
 }
 #endif /* USE_ZONE_STATS */
 
+#ifdef BIND8_STATS
+void
+server_stat_alloc(struct nsd* nsd)
+{
+#ifdef HAVE_MMAP
+	size_t sz = STAT_SLOT_SIZE*(nsd->child_count?nsd->child_count:1);
+	int i;
+	/* anonymous shared memory, it is inherited by xfrd and by all the
+	 * server processes that are forked later, also after reloads */
+	for(i=0; i<2; i++) {
+		nsd->stat_map[i] = (char*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if(nsd->stat_map[i] == MAP_FAILED) {
+			log_msg(LOG_ERR, "stat: mmap failed: %s",
+				strerror(errno));
+			nsd->stat_map[i] = NULL;
+			if(i == 1) {
+				munmap(nsd->stat_map[0], sz);
+				nsd->stat_map[0] = NULL;
+			}
+			return;
+		}
+		memset(nsd->stat_map[i], 0, sz);
+	}
+#else
+	nsd->stat_map[0] = NULL;
+	nsd->stat_map[1] = NULL;
+#endif /* HAVE_MMAP */
+	nsd->stat_idx = 0;
+}
+
+/* switchover to the other block of the stat_map for the new children,
+ * its previous users have quit at the reload before this one.  The old
+ * children report their final statistics to xfrd, and xfrd switches to
+ * the new block when they are added. */
 static void
-cleanup_dname_compression_tables(void *ptr)
+server_stat_switch(struct nsd* nsd)
 {
-	free(ptr);
-	compressed_dname_offsets = NULL;
-	compression_table_capacity = 0;
+	nsd->stat_idx = 1 - nsd->stat_idx;
+	if(nsd->stat_map[nsd->stat_idx])
+		memset(nsd->stat_map[nsd->stat_idx], 0,
+			STAT_SLOT_SIZE*(nsd->child_count?nsd->child_count:1));
 }
+#endif /* BIND8_STATS */
 
+#ifdef UDP_WILDCARD
+/* the key of an address, to look up the destination of a query */
 static void
-initialize_dname_compression_tables(struct nsd *nsd)
+udp_wild_key(uint8_t* key, int family, const void* port, const void* addr)
 {
-	size_t needed = domain_table_count(nsd->db->domains) + 1;
-	needed += EXTRA_DOMAIN_NUMBERS;
-	if(compression_table_capacity < needed) {
-		if(compressed_dname_offsets) {
-			region_remove_cleanup(nsd->db->region,
-				cleanup_dname_compression_tables,
-				compressed_dname_offsets);
-			free(compressed_dname_offsets);
-		}
-		compressed_dname_offsets = (uint16_t *) xmallocarray(
-			needed, sizeof(uint16_t));
-		region_add_cleanup(nsd->db->region, cleanup_dname_compression_tables,
-			compressed_dname_offsets);
-		compression_table_capacity = needed;
-		compression_table_size=domain_table_count(nsd->db->domains)+1;
+	memset(key, 0, UDP_WILD_KEY_LEN);
+	key[0] = (family == AF_INET ? 4 : 6);
+	memcpy(key+1, port, 2);
+	memcpy(key+3, addr, (family == AF_INET ? 4 : 16));
+}
+
+/* the key of the address and port of the ip-address */
+static void
+udp_wild_addr_key(uint8_t* key, struct addrinfo* ai)
+{
+#ifdef INET6
+	if (ai->ai_family == AF_INET6) {
+		struct sockaddr_in6* a = (struct sockaddr_in6*)ai->ai_addr;
+		udp_wild_key(key, AF_INET6, &a->sin6_port, &a->sin6_addr);
+		return;
 	}
-	memset(compressed_dname_offsets, 0, needed * sizeof(uint16_t));
-	compressed_dname_offsets[0] = QHEADERSZ; /* The original query name */
+#endif
+	udp_wild_key(key, AF_INET, &((struct sockaddr_in*)ai->ai_addr)->
+		sin_port, &((struct sockaddr_in*)ai->ai_addr)->sin_addr);
+}
+
+static int
+udp_wild_key_cmp(const void* a, const void* b)
+{
+	return memcmp(a, b, UDP_WILD_KEY_LEN);
 }
 
 /*
- * Initialize the server, create and bind the sockets.
- *
+ * The sorted keys of the ip-addresses, that the destination of the
+ * queries on the wildcard sockets is checked against.
  */
-int
-server_init(struct nsd *nsd)
+static void
+server_udp_wildcard_setup(struct nsd* nsd)
 {
 	size_t i;
-#if defined(SO_REUSEADDR) || (defined(INET6) && (defined(IPV6_V6ONLY) || defined(IPV6_USE_MIN_MTU) || defined(IPV6_MTU) || defined(IP_TRANSPARENT)))
-	int on = 1;
-#endif
-
-	/* UDP */
-
-	/* Make a socket... */
+	nsd->udp_wild_keys = (uint8_t*)region_alloc_array(nsd->region,
+		nsd->ifs, UDP_WILD_KEY_LEN);
+	nsd->udp_wild_count = 0;
 	for (i = 0; i < nsd->ifs; i++) {
-		if (!nsd->udp[i].addr) {
-			nsd->udp[i].s = -1;
+		if (!nsd->udp[i].addr)
 			continue;
-		}
-		if ((nsd->udp[i].s = socket(nsd->udp[i].addr->ai_family, nsd->udp[i].addr->ai_socktype, 0)) == -1) {
-#if defined(INET6)
-			if (nsd->udp[i].addr->ai_family == AF_INET6 &&
-				errno == EAFNOSUPPORT && nsd->grab_ip6_optional) {
-				log_msg(LOG_WARNING, "fallback to UDP4, no IPv6: not supported");
-				continue;
-			}
-#endif /* INET6 */
-			log_msg(LOG_ERR, "can't create a socket: %s", strerror(errno));
-			return -1;
-		}
-
-#if defined(SO_RCVBUF) || defined(SO_SNDBUF)
-	if(1) {
-	int rcv = 1*1024*1024;
-	int snd = 1*1024*1024;
+		udp_wild_addr_key(nsd->udp_wild_keys +
+			nsd->udp_wild_count*UDP_WILD_KEY_LEN, nsd->udp[i].addr);
+		nsd->udp_wild_count++;
+	}
+	qsort(nsd->udp_wild_keys, nsd->udp_wild_count, UDP_WILD_KEY_LEN,
+		udp_wild_key_cmp);
+}
 
-#ifdef SO_RCVBUF
-#  ifdef SO_RCVBUFFORCE
-	if(setsockopt(nsd->udp[i].s, SOL_SOCKET, SO_RCVBUFFORCE, (void*)&rcv,
-		(socklen_t)sizeof(rcv)) < 0) {
-		if(errno != EPERM && errno != ENOBUFS) {
+/* the ip-address has the family and port of an earlier one, and uses
+ * its wildcard socket */
+static int
+udp_wild_shared(struct nsd* nsd, size_t i)
+{
+	uint8_t key[UDP_WILD_KEY_LEN], prev[UDP_WILD_KEY_LEN];
+	size_t j;
+	udp_wild_addr_key(key, nsd->udp[i].addr);
+	for (j = 0; j < i; j++) {
+		if (!nsd->udp[j].addr)
+			continue;
+		udp_wild_addr_key(prev, nsd->udp[j].addr);
+		if (memcmp(key, prev, 3) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* the destination of the query, in key, is one of the ip-addresses, or
+ * an ip-address is the wildcard address itself */
+static int
+udp_wild_match(struct nsd* nsd, uint8_t* key)
+{
+	if (bsearch(key, nsd->udp_wild_keys, nsd->udp_wild_count,
+		UDP_WILD_KEY_LEN, udp_wild_key_cmp))
+		return 1;
+	memset(key+3, 0, UDP_WILD_KEY_LEN-3);
+	return bsearch(key, nsd->udp_wild_keys, nsd->udp_wild_count,
+		UDP_WILD_KEY_LEN, udp_wild_key_cmp) != NULL;
+}
+#endif /* UDP_WILDCARD */
+
+/*
+ * Create and bind one UDP socket for the address in sock.
+ * Returns -1 on failure.
+ */
+static int
+server_init_udp_socket(struct nsd *nsd, struct nsd_socket *sock)
+{
+#if defined(SO_REUSEADDR) || defined(SO_REUSEPORT) || (defined(INET6) && (defined(IPV6_V6ONLY) || defined(IPV6_USE_MIN_MTU) || defined(IPV6_MTU) || defined(IP_TRANSPARENT)))
+	int on = 1;
+#endif
+	struct sockaddr* bind_sa;
+#ifdef UDP_WILDCARD
+	struct sockaddr_storage bind_addr;
+#endif
+
+	if (!sock->addr) {
+		sock->s = -1;
+		return 0;
+	}
+	bind_sa = (struct sockaddr*)sock->addr->ai_addr;
+	if ((sock->s = socket(sock->addr->ai_family, sock->addr->ai_socktype, 0)) == -1) {
+#if defined(INET6)
+		if (sock->addr->ai_family == AF_INET6 &&
+			errno == EAFNOSUPPORT && nsd->grab_ip6_optional) {
+			log_msg(LOG_WARNING, "fallback to UDP4, no IPv6: not supported");
+			return 0;
+		}
+#endif /* INET6 */
+		log_msg(LOG_ERR, "can't create a socket: %s", strerror(errno));
+		return -1;
+	}
+
+#if defined(SO_RCVBUF) || defined(SO_SNDBUF)
+	if(1) {
+	int rcv = 1*1024*1024;
+	int snd = 1*1024*1024;
+
+#ifdef SO_RCVBUF
+#  ifdef SO_RCVBUFFORCE
+	if(setsockopt(sock->s, SOL_SOCKET, SO_RCVBUFFORCE, (void*)&rcv,
+		(socklen_t)sizeof(rcv)) < 0) {
+		if(errno != EPERM && errno != ENOBUFS) {
 			log_msg(LOG_ERR, "setsockopt(..., SO_RCVBUFFORCE, "
                                         "...) failed: %s", strerror(errno));
 			return -1;
@@ -595,7 +1266,7 @@ server_init(struct nsd *nsd)
 #  else
 	if(1) {
 #  endif /* SO_RCVBUFFORCE */
-		if(setsockopt(nsd->udp[i].s, SOL_SOCKET, SO_RCVBUF, (void*)&rcv,
+		if(setsockopt(sock->s, SOL_SOCKET, SO_RCVBUF, (void*)&rcv,
 			 (socklen_t)sizeof(rcv)) < 0) {
 			if(errno != ENOBUFS && errno != ENOSYS) {
 				log_msg(LOG_ERR, "setsockopt(..., SO_RCVBUF, "
@@ -608,7 +1279,7 @@ server_init(struct nsd *nsd)
 
 #ifdef SO_SNDBUF
 #  ifdef SO_SNDBUFFORCE
-	if(setsockopt(nsd->udp[i].s, SOL_SOCKET, SO_SNDBUFFORCE, (void*)&snd,
+	if(setsockopt(sock->s, SOL_SOCKET, SO_SNDBUFFORCE, (void*)&snd,
 		(socklen_t)sizeof(snd)) < 0) {
 		if(errno != EPERM && errno != ENOBUFS) {
 			log_msg(LOG_ERR, "setsockopt(..., SO_SNDBUFFORCE, "
@@ -618,7 +1289,7 @@ server_init(struct nsd *nsd)
 #  else
 	if(1) {
 #  endif /* SO_SNDBUFFORCE */
-		if(setsockopt(nsd->udp[i].s, SOL_SOCKET, SO_SNDBUF, (void*)&snd,
+		if(setsockopt(sock->s, SOL_SOCKET, SO_SNDBUF, (void*)&snd,
 			 (socklen_t)sizeof(snd)) < 0) {
 			if(errno != ENOBUFS && errno != ENOSYS) {
 				log_msg(LOG_ERR, "setsockopt(..., SO_SNDBUF, "
@@ -633,187 +1304,456 @@ server_init(struct nsd *nsd)
 #endif /* defined(SO_RCVBUF) || defined(SO_SNDBUF) */
 
 #if defined(INET6)
-		if (nsd->udp[i].addr->ai_family == AF_INET6) {
+	if (sock->addr->ai_family == AF_INET6) {
 # if defined(IPV6_V6ONLY)
-			if (setsockopt(nsd->udp[i].s,
-				       IPPROTO_IPV6, IPV6_V6ONLY,
-				       &on, sizeof(on)) < 0)
-			{
-				log_msg(LOG_ERR, "setsockopt(..., IPV6_V6ONLY, ...) failed: %s",
-					strerror(errno));
-				return -1;
-			}
+		if (setsockopt(sock->s,
+			       IPPROTO_IPV6, IPV6_V6ONLY,
+			       &on, sizeof(on)) < 0)
+		{
+			log_msg(LOG_ERR, "setsockopt(..., IPV6_V6ONLY, ...) failed: %s",
+				strerror(errno));
+			return -1;
+		}
 # endif
 # if defined(IPV6_USE_MIN_MTU)
-			/*
-			 * There is no fragmentation of IPv6 datagrams
-			 * during forwarding in the network. Therefore
-			 * we do not send UDP datagrams larger than
-			 * the minimum IPv6 MTU of 1280 octets. The
-			 * EDNS0 message length can be larger if the
-			 * network stack supports IPV6_USE_MIN_MTU.
-			 */
-			if (setsockopt(nsd->udp[i].s,
-				       IPPROTO_IPV6, IPV6_USE_MIN_MTU,
-				       &on, sizeof(on)) < 0)
-			{
-				log_msg(LOG_ERR, "setsockopt(..., IPV6_USE_MIN_MTU, ...) failed: %s",
-					strerror(errno));
-				return -1;
-			}
+		/*
+		 * There is no fragmentation of IPv6 datagrams
+		 * during forwarding in the network. Therefore
+		 * we do not send UDP datagrams larger than
+		 * the minimum IPv6 MTU of 1280 octets. The
+		 * EDNS0 message length can be larger if the
+		 * network stack supports IPV6_USE_MIN_MTU.
+		 */
+		if (setsockopt(sock->s,
+			       IPPROTO_IPV6, IPV6_USE_MIN_MTU,
+			       &on, sizeof(on)) < 0)
+		{
+			log_msg(LOG_ERR, "setsockopt(..., IPV6_USE_MIN_MTU, ...) failed: %s",
+				strerror(errno));
+			return -1;
+		}
 # elif defined(IPV6_MTU)
-			/*
-			 * On Linux, PMTUD is disabled by default for datagrams
-			 * so set the MTU equal to the MIN MTU to get the same.
-			 */
-			on = IPV6_MIN_MTU;
-			if (setsockopt(nsd->udp[i].s, IPPROTO_IPV6, IPV6_MTU, 
-				&on, sizeof(on)) < 0)
-			{
-				log_msg(LOG_ERR, "setsockopt(..., IPV6_MTU, ...) failed: %s",
-					strerror(errno));
-				return -1;
-			}
-			on = 1;
-# endif
+		/*
+		 * On Linux, PMTUD is disabled by default for datagrams
+		 * so set the MTU equal to the MIN MTU to get the same.
+		 */
+		on = IPV6_MIN_MTU;
+		if (setsockopt(sock->s, IPPROTO_IPV6, IPV6_MTU, 
+			&on, sizeof(on)) < 0)
+		{
+			log_msg(LOG_ERR, "setsockopt(..., IPV6_MTU, ...) failed: %s",
+				strerror(errno));
+			return -1;
 		}
+		on = 1;
+# endif
+	}
 #endif
 #if defined(AF_INET)
-		if (nsd->udp[i].addr->ai_family == AF_INET) {
+	if (sock->addr->ai_family == AF_INET) {
 #  if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_DONT)
-			int action = IP_PMTUDISC_DONT;
-			if (setsockopt(nsd->udp[i].s, IPPROTO_IP, 
-				IP_MTU_DISCOVER, &action, sizeof(action)) < 0)
-			{
-				log_msg(LOG_ERR, "setsockopt(..., IP_MTU_DISCOVER, IP_PMTUDISC_DONT...) failed: %s",
-					strerror(errno));
-				return -1;
-			}
+		int action = IP_PMTUDISC_DONT;
+		if (setsockopt(sock->s, IPPROTO_IP, 
+			IP_MTU_DISCOVER, &action, sizeof(action)) < 0)
+		{
+			log_msg(LOG_ERR, "setsockopt(..., IP_MTU_DISCOVER, IP_PMTUDISC_DONT...) failed: %s",
+				strerror(errno));
+			return -1;
+		}
 #  elif defined(IP_DONTFRAG)
-			int off = 0;
-			if (setsockopt(nsd->udp[i].s, IPPROTO_IP, IP_DONTFRAG,
-				&off, sizeof(off)) < 0)
-			{
-				log_msg(LOG_ERR, "setsockopt(..., IP_DONTFRAG, ...) failed: %s",
-					strerror(errno));
-				return -1;
-			}
+		int off = 0;
+		if (setsockopt(sock->s, IPPROTO_IP, IP_DONTFRAG,
+			&off, sizeof(off)) < 0)
+		{
+			log_msg(LOG_ERR, "setsockopt(..., IP_DONTFRAG, ...) failed: %s",
+				strerror(errno));
+			return -1;
+		}
 #  endif
+	}
+#endif
+	/* set it nonblocking */
+	/* otherwise, on OSes with thundering herd problems, the
+	   UDP recv could block NSD after select returns readable. */
+	if (fcntl(sock->s, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "cannot fcntl udp: %s", strerror(errno));
+	}
+
+	if (nsd->options->udp_gro) {
+#if defined(UDP_GRO) && defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+		/* receive the datagrams of a client together */
+		int gro = 1;
+		if (setsockopt(sock->s, IPPROTO_UDP, UDP_GRO, &gro,
+			sizeof(gro)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., UDP_GRO, ...) "
+				"failed: %s", strerror(errno));
 		}
 #endif
-		/* set it nonblocking */
-		/* otherwise, on OSes with thundering herd problems, the
-		   UDP recv could block NSD after select returns readable. */
-		if (fcntl(nsd->udp[i].s, F_SETFL, O_NONBLOCK) == -1) {
-			log_msg(LOG_ERR, "cannot fcntl udp: %s", strerror(errno));
+	}
+
+	if (nsd->options->udp_drop_stats) {
+#ifdef UDP_RXQ_OVFL_CMSG_SPACE
+		/* the kernel tells the number of dropped queries */
+		int ovfl = 1;
+		if (setsockopt(sock->s, SOL_SOCKET, SO_RXQ_OVFL, &ovfl,
+			sizeof(ovfl)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., SO_RXQ_OVFL, ...) "
+				"failed: %s", strerror(errno));
 		}
+#endif
+	}
 
-		/* Bind it... */
-		if (nsd->options->ip_transparent) {
-#ifdef IP_TRANSPARENT
-			if (setsockopt(nsd->udp[i].s, IPPROTO_IP, IP_TRANSPARENT, &on, sizeof(on)) < 0) {
-				log_msg(LOG_ERR, "setsockopt(...,IP_TRANSPARENT, ...) failed for udp: %s",
-					strerror(errno));
-			}
-#endif /* IP_TRANSPARENT */
+	if (nsd->options->udp_busy_poll > 0) {
+#ifdef SO_BUSY_POLL
+		/* poll the device queue for the usecs when it is empty */
+		int usec = nsd->options->udp_busy_poll;
+		if (setsockopt(sock->s, SOL_SOCKET, SO_BUSY_POLL, &usec,
+			sizeof(usec)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., SO_BUSY_POLL, ...) "
+				"failed: %s", strerror(errno));
 		}
+#endif /* SO_BUSY_POLL */
+	}
 
-		if (bind(nsd->udp[i].s, (struct sockaddr *) nsd->udp[i].addr->ai_addr, nsd->udp[i].addr->ai_addrlen) != 0) {
-			log_msg(LOG_ERR, "can't bind udp socket: %s", strerror(errno));
+#ifdef SO_REUSEPORT
+	if (nsd->reuseport && setsockopt(sock->s, SOL_SOCKET, SO_REUSEPORT,
+		&on, sizeof(on)) < 0) {
+		if(errno != ENOPROTOOPT) {
+			log_msg(LOG_ERR, "setsockopt(..., SO_REUSEPORT, ...) "
+				"failed: %s", strerror(errno));
 			return -1;
 		}
+		/* the kernel does not support it, share the socket */
+		log_msg(LOG_WARNING, "setsockopt(..., SO_REUSEPORT, ...) "
+			"not supported, the servers share the UDP sockets");
+		nsd->reuseport = 0;
 	}
+#endif /* SO_REUSEPORT */
 
-	/* TCP */
+#ifdef UDP_WILDCARD
+	if (nsd->udp_wild_keys) {
+		/* receive the destination address of the queries */
+		int pktinfo = 1;
+		int r;
+#ifdef INET6
+		if (sock->addr->ai_family == AF_INET6)
+			r = setsockopt(sock->s, IPPROTO_IPV6, IPV6_RECVPKTINFO,
+				&pktinfo, sizeof(pktinfo));
+		else
+#endif
+			r = setsockopt(sock->s, IPPROTO_IP, IP_PKTINFO,
+				&pktinfo, sizeof(pktinfo));
+		if (r < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., PKTINFO, ...) "
+				"failed: %s", strerror(errno));
+			return -1;
+		}
+		/* the wildcard address, with the port of the ip-address */
+		memset(&bind_addr, 0, sizeof(bind_addr));
+		memcpy(&bind_addr, sock->addr->ai_addr, sock->addr->ai_addrlen);
+#ifdef INET6
+		if (sock->addr->ai_family == AF_INET6) {
+			struct sockaddr_in6* a = (struct sockaddr_in6*)&bind_addr;
+			a->sin6_addr = in6addr_any;
+			a->sin6_flowinfo = 0;
+			a->sin6_scope_id = 0;
+		} else
+#endif
+			((struct sockaddr_in*)&bind_addr)->sin_addr.s_addr =
+				htonl(INADDR_ANY);
+		bind_sa = (struct sockaddr*)&bind_addr;
+	}
+#endif /* UDP_WILDCARD */
 
-	/* Make a socket... */
-	for (i = 0; i < nsd->ifs; i++) {
-		if (!nsd->tcp[i].addr) {
-			nsd->tcp[i].s = -1;
-			continue;
+	/* Bind it... */
+	if (nsd->options->ip_transparent) {
+#ifdef IP_TRANSPARENT
+		if (setsockopt(sock->s, IPPROTO_IP, IP_TRANSPARENT, &on, sizeof(on)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(...,IP_TRANSPARENT, ...) failed for udp: %s",
+				strerror(errno));
 		}
-		if ((nsd->tcp[i].s = socket(nsd->tcp[i].addr->ai_family, nsd->tcp[i].addr->ai_socktype, 0)) == -1) {
+#endif /* IP_TRANSPARENT */
+	}
+
+	if (bind(sock->s, bind_sa, sock->addr->ai_addrlen) != 0) {
+		log_msg(LOG_ERR, "can't bind udp socket: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Create, bind and listen on one TCP socket for the address in sock.
+ * Returns -1 on failure.
+ */
+static int
+server_init_tcp_socket(struct nsd *nsd, struct nsd_socket *sock)
+{
+#if defined(SO_REUSEADDR) || defined(SO_REUSEPORT) || (defined(INET6) && (defined(IPV6_V6ONLY) || defined(IPV6_USE_MIN_MTU) || defined(IPV6_MTU) || defined(IP_TRANSPARENT)))
+	int on = 1;
+#endif
+
+	if (!sock->addr) {
+		sock->s = -1;
+		return 0;
+	}
+	if ((sock->s = socket(sock->addr->ai_family, sock->addr->ai_socktype, 0)) == -1) {
 #if defined(INET6)
-			if (nsd->tcp[i].addr->ai_family == AF_INET6 &&
-				errno == EAFNOSUPPORT && nsd->grab_ip6_optional) {
-				log_msg(LOG_WARNING, "fallback to TCP4, no IPv6: not supported");
-				continue;
-			}
-#endif /* INET6 */
-			log_msg(LOG_ERR, "can't create a socket: %s", strerror(errno));
-			return -1;
+		if (sock->addr->ai_family == AF_INET6 &&
+			errno == EAFNOSUPPORT && nsd->grab_ip6_optional) {
+			log_msg(LOG_WARNING, "fallback to TCP4, no IPv6: not supported");
+			return 0;
 		}
+#endif /* INET6 */
+		log_msg(LOG_ERR, "can't create a socket: %s", strerror(errno));
+		return -1;
+	}
 
 #ifdef	SO_REUSEADDR
-		if (setsockopt(nsd->tcp[i].s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
-			log_msg(LOG_ERR, "setsockopt(..., SO_REUSEADDR, ...) failed: %s", strerror(errno));
-		}
+	if (setsockopt(sock->s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+		log_msg(LOG_ERR, "setsockopt(..., SO_REUSEADDR, ...) failed: %s", strerror(errno));
+	}
 #endif /* SO_REUSEADDR */
 
+#ifdef SO_REUSEPORT
+	if (nsd->tcp_reuseport && setsockopt(sock->s, SOL_SOCKET, SO_REUSEPORT,
+		&on, sizeof(on)) < 0) {
+		if(errno != ENOPROTOOPT) {
+			log_msg(LOG_ERR, "setsockopt(..., SO_REUSEPORT, ...) "
+				"failed: %s", strerror(errno));
+			return -1;
+		}
+		/* the kernel does not support it, share the socket */
+		log_msg(LOG_WARNING, "setsockopt(..., SO_REUSEPORT, ...) "
+			"not supported, the servers share the TCP sockets");
+		nsd->tcp_reuseport = 0;
+	}
+#endif /* SO_REUSEPORT */
+
 #if defined(INET6)
-		if (nsd->tcp[i].addr->ai_family == AF_INET6) {
+	if (sock->addr->ai_family == AF_INET6) {
 # if defined(IPV6_V6ONLY)
-			if (setsockopt(nsd->tcp[i].s, IPPROTO_IPV6, IPV6_V6ONLY,
-				&on, sizeof(on)) < 0) {
-				log_msg(LOG_ERR, "setsockopt(..., IPV6_V6ONLY, ...) failed: %s", strerror(errno));
-				return -1;
-			}
+		if (setsockopt(sock->s, IPPROTO_IPV6, IPV6_V6ONLY,
+			&on, sizeof(on)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., IPV6_V6ONLY, ...) failed: %s", strerror(errno));
+			return -1;
+		}
 # endif
 # if defined(IPV6_USE_MIN_MTU)
-			/*
-			 * Use minimum MTU to minimize delays learning working
-			 * PMTU when communicating through a tunnel.
-			 */
-			if (setsockopt(nsd->tcp[i].s,
-				       IPPROTO_IPV6, IPV6_USE_MIN_MTU,
-				       &on, sizeof(on)) < 0) {
-				log_msg(LOG_ERR, "setsockopt(..., IPV6_USE_MIN_MTU, ...) failed: %s", strerror(errno));
-				return -1;
-			}
+		/*
+		 * Use minimum MTU to minimize delays learning working
+		 * PMTU when communicating through a tunnel.
+		 */
+		if (setsockopt(sock->s,
+			       IPPROTO_IPV6, IPV6_USE_MIN_MTU,
+			       &on, sizeof(on)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., IPV6_USE_MIN_MTU, ...) failed: %s", strerror(errno));
+			return -1;
+		}
 # elif defined(IPV6_MTU)
-			/*
-			 * On Linux, PMTUD is disabled by default for datagrams
-			 * so set the MTU equal to the MIN MTU to get the same.
-			 */
-			on = IPV6_MIN_MTU;
-			if (setsockopt(nsd->tcp[i].s, IPPROTO_IPV6, IPV6_MTU,
-				&on, sizeof(on)) < 0) {
-				log_msg(LOG_ERR, "setsockopt(..., IPV6_MTU, ...) failed: %s", strerror(errno));
-				return -1;
-			}
-			on = 1;
-# endif
+		/*
+		 * On Linux, PMTUD is disabled by default for datagrams
+		 * so set the MTU equal to the MIN MTU to get the same.
+		 */
+		on = IPV6_MIN_MTU;
+		if (setsockopt(sock->s, IPPROTO_IPV6, IPV6_MTU,
+			&on, sizeof(on)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., IPV6_MTU, ...) failed: %s", strerror(errno));
+			return -1;
 		}
+		on = 1;
+# endif
+	}
 #endif
-		/* set it nonblocking */
-		/* (StevensUNP p463), if tcp listening socket is blocking, then
-		   it may block in accept, even if select() says readable. */
-		if (fcntl(nsd->tcp[i].s, F_SETFL, O_NONBLOCK) == -1) {
-			log_msg(LOG_ERR, "cannot fcntl tcp: %s", strerror(errno));
+	/* set it nonblocking */
+	/* (StevensUNP p463), if tcp listening socket is blocking, then
+	   it may block in accept, even if select() says readable. */
+	if (fcntl(sock->s, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "cannot fcntl tcp: %s", strerror(errno));
+	}
+
+	if (nsd->options->tcp_defer_accept) {
+#ifdef TCP_DEFER_ACCEPT
+		/* wake up accept only when the query has arrived */
+		int secs = nsd->tcp_timeout;
+		if (setsockopt(sock->s, IPPROTO_TCP,
+			TCP_DEFER_ACCEPT, &secs, sizeof(secs)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., TCP_DEFER_ACCEPT, ...) failed: %s", strerror(errno));
 		}
+#endif /* TCP_DEFER_ACCEPT */
+	}
+	if (nsd->options->tcp_fastopen) {
+#ifdef TCP_FASTOPEN
+		/* the query can arrive with the SYN */
+		int qlen = nsd->maximum_tcp_count;
+		if (setsockopt(sock->s, IPPROTO_TCP,
+			TCP_FASTOPEN, &qlen, sizeof(qlen)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., TCP_FASTOPEN, ...) failed: %s", strerror(errno));
+		}
+#endif /* TCP_FASTOPEN */
+	}
 
-		/* Bind it... */
-		if (nsd->options->ip_transparent) {
+	/* Bind it... */
+	if (nsd->options->ip_transparent) {
 #ifdef IP_TRANSPARENT
-			if (setsockopt(nsd->tcp[i].s, IPPROTO_IP, IP_TRANSPARENT, &on, sizeof(on)) < 0) {
-				log_msg(LOG_ERR, "setsockopt(...,IP_TRANSPARENT, ...) failed for tcp: %s",
-					strerror(errno));
-			}
+		if (setsockopt(sock->s, IPPROTO_IP, IP_TRANSPARENT, &on, sizeof(on)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(...,IP_TRANSPARENT, ...) failed for tcp: %s",
+				strerror(errno));
+		}
 #endif /* IP_TRANSPARENT */
+	}
+
+	if (bind(sock->s, (struct sockaddr *) sock->addr->ai_addr, sock->addr->ai_addrlen) != 0) {
+		log_msg(LOG_ERR, "can't bind tcp socket: %s", strerror(errno));
+		return -1;
+	}
+
+	/* Listen to it... */
+	if (listen(sock->s, TCP_BACKLOG) == -1) {
+		log_msg(LOG_ERR, "can't listen: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Initialize the server, create and bind the sockets.
+ *
+ */
+#ifdef UDP_RXQ_OVFL_CMSG_SPACE
+/*
+ * The numbers of dropped queries of the UDP sockets, in shared memory.
+ * The servers that read a socket count every drop once, the first that
+ * sees it, and xfrd prints them per socket.
+ */
+static void
+server_udp_drops_setup(struct nsd *nsd)
+{
+	size_t sets = nsd->reuseport?nsd->reuseport:1, c, i;
+	uint32_t* map = (uint32_t*)mmap(NULL, sets*nsd->ifs*sizeof(uint32_t),
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		log_msg(LOG_ERR, "udp-drop-stats: mmap failed: %s",
+			strerror(errno));
+		return;
+	}
+	memset(map, 0, sets*nsd->ifs*sizeof(uint32_t));
+	for (c = 0; c < sets; c++) {
+		struct nsd_socket* socks = (c==0?nsd->udp:nsd->children[c].udp);
+		for (i = 0; i < nsd->ifs; i++) {
+			if (socks[i].s != -1)
+				socks[i].rxq_drops = &map[c*nsd->ifs + i];
 		}
+	}
+}
+#endif /* UDP_RXQ_OVFL_CMSG_SPACE */
 
-		if (bind(nsd->tcp[i].s, (struct sockaddr *) nsd->tcp[i].addr->ai_addr, nsd->tcp[i].addr->ai_addrlen) != 0) {
-			log_msg(LOG_ERR, "can't bind tcp socket: %s", strerror(errno));
+int
+server_init(struct nsd *nsd)
+{
+	size_t i;
+
+	/* UDP */
+
+	if (nsd->options->udp_wildcard) {
+#ifdef UDP_WILDCARD
+		server_udp_wildcard_setup(nsd);
+#else
+		log_msg(LOG_WARNING, "udp-wildcard: not supported on this "
+			"system, the ip-addresses get their own UDP sockets");
+#endif
+	}
+
+	/* Make a socket... */
+	for (i = 0; i < nsd->ifs; i++) {
+#ifdef UDP_WILDCARD
+		/* the ip-address uses the wildcard socket of an earlier one */
+		if (nsd->udp_wild_keys && nsd->udp[i].addr &&
+			udp_wild_shared(nsd, i)) {
+			nsd->udp[i].s = -1;
+			continue;
+		}
+#endif
+		if(server_init_udp_socket(nsd, &nsd->udp[i]) == -1)
 			return -1;
+	}
+
+	/* With reuseport, every server gets its own socket set; the
+	 * first server uses the nsd->udp sockets themselves. */
+	if(nsd->reuseport) {
+		size_t c;
+		nsd->children[0].udp = nsd->udp;
+		for(c = 1; c < nsd->reuseport; c++) {
+			nsd->children[c].udp = (struct nsd_socket*)
+				region_alloc_array(nsd->region, nsd->ifs,
+				sizeof(struct nsd_socket));
+			for (i = 0; i < nsd->ifs; i++) {
+				/* the addrinfo is shared with nsd->udp */
+				nsd->children[c].udp[i].addr = nsd->udp[i].addr;
+				nsd->children[c].udp[i].rxq_drops = NULL;
+				if(nsd->udp[i].s == -1) {
+					nsd->children[c].udp[i].s = -1;
+					continue;
+				}
+				if(server_init_udp_socket(nsd,
+					&nsd->children[c].udp[i]) == -1)
+					return -1;
+			}
 		}
+	}
+
+	if (nsd->options->udp_filter)
+		udp_filter_attach(nsd, nsd->options);
 
-		/* Listen to it... */
-		if (listen(nsd->tcp[i].s, TCP_BACKLOG) == -1) {
-			log_msg(LOG_ERR, "can't listen: %s", strerror(errno));
+	if (nsd->options->udp_drop_stats) {
+#ifdef UDP_RXQ_OVFL_CMSG_SPACE
+		server_udp_drops_setup(nsd);
+#else
+		log_msg(LOG_WARNING, "udp-drop-stats: not supported on this "
+			"system");
+#endif
+	}
+
+	/* TCP */
+
+	/* Make a socket... */
+	for (i = 0; i < nsd->ifs; i++) {
+		if(server_init_tcp_socket(nsd, &nsd->tcp[i]) == -1)
 			return -1;
+	}
+
+	/* With tcp-reuseport, every server gets its own listening sockets,
+	 * the kernel spreads the connections over them; the first server
+	 * uses the nsd->tcp sockets themselves. */
+	if(nsd->tcp_reuseport) {
+		size_t c;
+		nsd->children[0].tcp = nsd->tcp;
+		for(c = 1; c < nsd->tcp_reuseport; c++) {
+			nsd->children[c].tcp = (struct nsd_socket*)
+				region_alloc_array(nsd->region, nsd->ifs,
+				sizeof(struct nsd_socket));
+			for (i = 0; i < nsd->ifs; i++) {
+				/* the addrinfo is shared with nsd->tcp */
+				nsd->children[c].tcp[i].addr = nsd->tcp[i].addr;
+				nsd->children[c].tcp[i].rxq_drops = NULL;
+				if(nsd->tcp[i].s == -1) {
+					nsd->children[c].tcp[i].s = -1;
+					continue;
+				}
+				if(server_init_tcp_socket(nsd,
+					&nsd->children[c].tcp[i]) == -1)
+					return -1;
+			}
 		}
 	}
 
+#ifdef USE_XDP
+	/* with root privileges, the servers inherit the AF_XDP sockets */
+	if(nsd->options->xdp_interface && xdp_init(nsd) != 0)
+		log_msg(LOG_ERR, "xdp-interface %s not used, the normal "
+			"sockets answer all queries",
+			nsd->options->xdp_interface);
+#endif
 	return 0;
 }
 
@@ -821,26 +1761,72 @@ server_init(struct nsd *nsd)
  * Prepare the server for take off.
  *
  */
-int
-server_prepare(struct nsd *nsd)
+/* set the secrets of the hashes, the servers inherit them */
+static void
+server_hash_keys(void)
 {
-#ifdef RATELIMIT
-	/* set secret modifier for hashing (udb ptr buckets and rate limits) */
 #ifdef HAVE_ARC4RANDOM
+	hash_set_key((((uint64_t)arc4random())<<32) | arc4random());
+#ifdef RATELIMIT
+	/* set secret modifier for hashing (udb ptr buckets) */
 	hash_set_raninit(arc4random());
+#endif
 #else
-	uint32_t v = getpid() ^ time(NULL);
-	srandom((unsigned long)v);
+	uint64_t key = (((uint64_t)getpid())<<32) ^ (uint64_t)time(NULL);
+#ifdef RATELIMIT
+	uint32_t v;
+#endif
+	srandom((unsigned long)key);
+	if(!RAND_status() || RAND_bytes((unsigned char*)&key,
+		sizeof(key)) <= 0)
+		key ^= (((uint64_t)random())<<32) ^ (uint64_t)random();
+	hash_set_key(key);
+#ifdef RATELIMIT
 	if(RAND_status() && RAND_bytes((unsigned char*)&v, sizeof(v)) > 0)
 		hash_set_raninit(v);
 	else	hash_set_raninit(random());
 #endif
-	rrl_mmap_init(nsd->child_count, nsd->options->rrl_size,
+#endif /* HAVE_ARC4RANDOM */
+}
+
+/* the secret of the server cookies, from cookie-secret or random, the
+ * servers inherit it */
+static void
+server_cookie_secret(struct nsd *nsd)
+{
+	size_t i;
+	if(nsd->options->cookie_secret) {
+		(void)hex_pton(nsd->options->cookie_secret,
+			nsd->cookie_secret, sizeof(nsd->cookie_secret));
+		return;
+	}
+#ifdef HAVE_ARC4RANDOM
+	for(i=0; i<sizeof(nsd->cookie_secret); i++)
+		nsd->cookie_secret[i] = (uint8_t)arc4random();
+#else
+	if(RAND_status() && RAND_bytes(nsd->cookie_secret,
+		sizeof(nsd->cookie_secret)) > 0)
+		return;
+	for(i=0; i<sizeof(nsd->cookie_secret); i++)
+		nsd->cookie_secret[i] = (uint8_t)random();
+#endif
+}
+
+int
+server_prepare(struct nsd *nsd)
+{
+	/* the rate limits and the answer caches hash with the key */
+	server_hash_keys();
+	if(nsd->options->answer_cookie)
+		server_cookie_secret(nsd);
+#ifdef RATELIMIT
+	rrl_mmap_init(nsd->options->rrl_size,
 		nsd->options->rrl_ratelimit,
 		nsd->options->rrl_whitelist_ratelimit,
 		nsd->options->rrl_slip,
 		nsd->options->rrl_ipv4_prefix_length,
-		nsd->options->rrl_ipv6_prefix_length);
+		nsd->options->rrl_ipv6_prefix_length,
+		nsd->options->rrl_file);
 #endif /* RATELIMIT */
 
 	/* Open the database... */
@@ -859,13 +1845,25 @@ server_prepare(struct nsd *nsd)
 	/* check if zone files have been modified */
 	/* NULL for taskudb because we send soainfo in a moment, batched up,
 	 * for all zones */
-	if(nsd->options->zonefiles_check || (nsd->options->database == NULL ||
-		nsd->options->database[0] == 0))
+	/* with progressive-start xfrd has them read after the servers
+	 * are started */
+	if(((nsd->options->zonefiles_check && !nsd->options->database_readonly)
+		|| (nsd->options->database == NULL ||
+		nsd->options->database[0] == 0)) &&
+		!nsd->options->progressive_start)
 		namedb_check_zonefiles(nsd, nsd->options, NULL, NULL);
 	zonestatid_tree_set(nsd);
-
-	compression_table_capacity = 0;
-	initialize_dname_compression_tables(nsd);
+	server_db_publish(nsd);
+#ifdef NSEC3
+	/* the lazy zones of the servers use the nsec3 snapshot later on */
+	if(!nsd->db->lazy_zones) {
+		nsec3_snapshot_close(nsd->db->nsec3_snap);
+		nsd->db->nsec3_snap = NULL;
+		nsd->db->nsec3_snap_file = NULL;
+	}
+#endif
+	if(nsd->options->hugepages)
+		hugepage_log_use();
 
 #ifdef	BIND8_STATS
 	/* Initialize times... */
@@ -908,6 +1906,91 @@ server_close_all_sockets(struct nsd_socket sockets[], size_t n)
 	}
 }
 
+void
+server_close_reuseport_sockets(struct nsd *nsd, struct nsd_socket* keep)
+{
+	size_t c, i;
+
+	/* The addrinfo is shared with nsd->udp, it is not freed here. */
+	for (c = 0; c < nsd->reuseport; ++c) {
+		struct nsd_socket* sockets = nsd->children[c].udp;
+		if (!sockets || sockets == keep)
+			continue;
+		for (i = 0; i < nsd->ifs; ++i) {
+			if (sockets[i].s != -1) {
+				close(sockets[i].s);
+				sockets[i].s = -1;
+			}
+		}
+	}
+}
+
+void
+server_close_reuseport_tcp(struct nsd *nsd, struct nsd_socket* keep)
+{
+	size_t c, i;
+
+	/* The addrinfo is shared with nsd->tcp, it is not freed here. */
+	for (c = 0; c < nsd->tcp_reuseport; ++c) {
+		struct nsd_socket* sockets = nsd->children[c].tcp;
+		if (!sockets || sockets == keep)
+			continue;
+		for (i = 0; i < nsd->ifs; ++i) {
+			if (sockets[i].s != -1) {
+				close(sockets[i].s);
+				sockets[i].s = -1;
+			}
+		}
+	}
+}
+
+void
+server_close_listening_sockets(struct nsd *nsd)
+{
+#ifdef USE_SERVER_THREADS
+	/* the threads of the process share the sockets, every thread has
+	 * a copy of the nsd->udp and nsd->tcp arrays; close them once */
+	if(nsd->server_threads && nsd->this_child) {
+		pthread_mutex_lock(&server_threads_lock);
+		if(!server_threads_closed) {
+			server_close_reuseport_sockets(nsd, nsd->udp);
+			server_close_reuseport_tcp(nsd, nsd->tcp);
+			server_close_all_sockets(nsd->udp, nsd->ifs);
+			server_close_all_sockets(nsd->tcp, nsd->ifs);
+			server_threads_closed = 1;
+		}
+		pthread_mutex_unlock(&server_threads_lock);
+		return;
+	}
+#endif
+	server_close_reuseport_sockets(nsd, nsd->udp);
+	server_close_reuseport_tcp(nsd, nsd->tcp);
+	server_close_all_sockets(nsd->udp, nsd->ifs);
+	server_close_all_sockets(nsd->tcp, nsd->ifs);
+}
+
+void
+server_thread_quit(struct nsd *nsd)
+{
+#ifdef USE_SERVER_THREADS
+	int last;
+	if(!nsd->server_threads || !nsd->this_child)
+		return;
+	pthread_mutex_lock(&server_threads_lock);
+	last = (--server_threads_running <= 0);
+	pthread_mutex_unlock(&server_threads_lock);
+	if(last)
+		return; /* the last thread shuts down the process */
+	if(nsd->this_child->parent_fd != -1) {
+		close(nsd->this_child->parent_fd);
+		nsd->this_child->parent_fd = -1;
+	}
+	pthread_exit(NULL);
+#else
+	(void)nsd;
+#endif
+}
+
 /*
  * Close the sockets, shutdown the server and exit.
  * Does not return.
@@ -918,8 +2001,7 @@ server_shutdown(struct nsd *nsd)
 {
 	size_t i;
 
-	server_close_all_sockets(nsd->udp, nsd->ifs);
-	server_close_all_sockets(nsd->tcp, nsd->ifs);
+	server_close_listening_sockets(nsd);
 	/* CHILD: close command channel to parent */
 	if(nsd->this_child && nsd->this_child->parent_fd != -1)
 	{
@@ -941,6 +2023,7 @@ server_shutdown(struct nsd *nsd)
 #ifdef HAVE_SSL
 	daemon_remote_delete(nsd->rc); /* ssl-delete secret keys */
 #endif
+	daemon_metrics_delete(nsd->metrics);
 
 #if 0 /* OS collects memory pages */
 	nsd_options_destroy(nsd->options);
@@ -987,6 +2070,7 @@ server_prepare_xfrd(struct nsd* nsd)
 	nsd->xfrd_listener->user_data = (struct ipc_handler_conn_data*)
 		region_alloc(nsd->region, sizeof(struct ipc_handler_conn_data));
 	nsd->xfrd_listener->fd = -1;
+	nsd->notify_fd = -1;
 	((struct ipc_handler_conn_data*)nsd->xfrd_listener->user_data)->nsd =
 		nsd;
 	((struct ipc_handler_conn_data*)nsd->xfrd_listener->user_data)->conn =
@@ -999,10 +2083,14 @@ server_start_xfrd(struct nsd *nsd, int del_db, int reload_active)
 {
 	pid_t pid;
 	int sockets[2] = {0,0};
+	int notify[2] = {-1,-1};
 	struct ipc_handler_conn_data *data;
 
 	if(nsd->xfrd_listener->fd != -1)
 		close(nsd->xfrd_listener->fd);
+	if(nsd->notify_fd != -1)
+		close(nsd->notify_fd);
+	nsd->notify_fd = -1;
 	if(del_db) {
 		/* recreate taskdb that xfrd was using, it may be corrupt */
 		/* we (or reload) use nsd->mytask, and xfrd uses the other */
@@ -1020,10 +2108,22 @@ server_start_xfrd(struct nsd *nsd, int del_db, int reload_active)
 		log_msg(LOG_ERR, "startxfrd failed on socketpair: %s", strerror(errno));
 		return;
 	}
+	/* the servers pass notifies to xfrd on this, without it they go
+	 * through server_main */
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, notify) == -1) {
+		log_msg(LOG_ERR, "startxfrd: no socketpair for notifies: %s",
+			strerror(errno));
+		notify[0] = -1;
+		notify[1] = -1;
+	}
 	pid = fork();
 	switch (pid) {
 	case -1:
 		log_msg(LOG_ERR, "fork xfrd failed: %s", strerror(errno));
+		if(notify[0] != -1) {
+			close(notify[0]);
+			close(notify[1]);
+		}
 		break;
 	default:
 		/* PARENT: close first socket, use second one */
@@ -1031,10 +2131,19 @@ server_start_xfrd(struct nsd *nsd, int del_db, int reload_active)
 		if (fcntl(sockets[1], F_SETFL, O_NONBLOCK) == -1) {
 			log_msg(LOG_ERR, "cannot fcntl pipe: %s", strerror(errno));
 		}
+		if(notify[0] != -1) {
+			close(notify[0]);
+			if(fcntl(notify[1], F_SETFL, O_NONBLOCK) == -1) {
+				log_msg(LOG_ERR, "cannot fcntl notify socket: "
+					"%s", strerror(errno));
+			}
+			nsd->notify_fd = notify[1];
+		}
 		if(del_db) xfrd_free_namedb(nsd);
 		/* use other task than I am using, since if xfrd died and is
 		 * restarted, the reload is using nsd->mytask */
 		nsd->mytask = 1 - nsd->mytask;
+		server_set_cpu_affinity(nsd->options->xfrd_cpu_affinity, "xfrd");
 		xfrd_init(sockets[1], nsd, del_db, reload_active, pid);
 		/* ENOTREACH */
 		break;
@@ -1045,15 +2154,99 @@ server_start_xfrd(struct nsd *nsd, int del_db, int reload_active)
 			log_msg(LOG_ERR, "cannot fcntl pipe: %s", strerror(errno));
 		}
 		nsd->xfrd_listener->fd = sockets[0];
+		/* the servers that are forked from here write on it */
+		if(notify[1] != -1)
+			close(notify[1]);
+		nsd->notify_fd = notify[0];
 		break;
 	}
-	/* server-parent only */
-	nsd->xfrd_listener->timeout = NULL;
-	nsd->xfrd_listener->event_types = NETIO_EVENT_READ;
-	nsd->xfrd_listener->event_handler = parent_handle_xfrd_command;
-	/* clear ongoing ipc reads */
-	data = (struct ipc_handler_conn_data *) nsd->xfrd_listener->user_data;
-	data->conn->is_reading = 0;
+	/* server-parent only */
+	nsd->xfrd_listener->timeout = NULL;
+	nsd->xfrd_listener->event_types = NETIO_EVENT_READ;
+	nsd->xfrd_listener->event_handler = parent_handle_xfrd_command;
+	/* clear ongoing ipc reads */
+	data = (struct ipc_handler_conn_data *) nsd->xfrd_listener->user_data;
+	data->conn->is_reading = 0;
+}
+
+/*
+ * Read the data that the new servers answer from first, before they are
+ * forked, so that they share those pages in memory with the reload.
+ * The zone apexes, and then the most queried names of the heavy-hitters
+ * tables, the most counted first.
+ */
+static void
+server_prefault(struct nsd* nsd)
+{
+	region_type* region = region_create(xalloc, free);
+	domain_type *closest_match, *closest_encloser;
+	struct topk_entry* top;
+	struct radnode* n;
+	size_t i, num = 0, names = 0;
+
+	/* the servers read the lazy zones from the nsd.db file */
+	if(nsd->db->lazy_zones)
+		udb_base_prefault(nsd->db->udb, 0);
+	for(n=radix_first(nsd->db->zonetree); n; n=radix_next(n)) {
+		zone_type* zone = (zone_type*)n->elem;
+		if(zone->apex)
+			domain_prefault(zone->apex);
+	}
+	top = topk_merge(nsd, TOPK_QNAME, &num);
+	for(i=0; i<num; i++) {
+		const dname_type* dname;
+		if(!topk_name_ok(top[i].key, top[i].len))
+			continue;
+		dname = dname_make(region, top[i].key, 1);
+		if(!dname)
+			continue;
+		/* a name that does not exist is answered from the encloser */
+		(void)namedb_lookup(nsd->db, dname, &closest_match,
+			&closest_encloser);
+		if(closest_match)
+			domain_prefault(closest_match);
+		if(closest_encloser && closest_encloser != closest_match)
+			domain_prefault(closest_encloser);
+		region_free_all(region);
+		names++;
+	}
+	free(top);
+	region_destroy(region);
+	VERBOSITY(2, (LOG_INFO, "reload: prefaulted %d zone apexes and %d "
+		"query names", (int)nsd->db->zonetree->count, (int)names));
+}
+
+/*
+ * With database-readonly, open the image that is published now, if it is
+ * another file than the one in use.  The servers that are running keep
+ * the old image mapped.  xfrd gets the SOAs of the new image.
+ */
+static void
+reload_db_image(struct nsd* nsd, udb_ptr* last_task)
+{
+	struct namedb* db;
+	struct stat now, cur;
+	struct radnode* n;
+	if(stat(nsd->dbfile, &now) != 0) {
+		log_msg(LOG_ERR, "%s: %s, the image in use is kept",
+			nsd->dbfile, strerror(errno));
+		return;
+	}
+	if(fstat(nsd->db->udb->fd, &cur) == 0 && cur.st_dev == now.st_dev &&
+		cur.st_ino == now.st_ino)
+		return;
+	if(!(db = namedb_reopen(nsd->db, nsd->dbfile, nsd->options))) {
+		log_msg(LOG_ERR, "could not open the new image %s, the image "
+			"in use is kept", nsd->dbfile);
+		return;
+	}
+	nsd->db = db;
+	zonestatid_tree_set(nsd);
+	for(n=radix_first(nsd->db->zonetree); n; n=radix_next(n))
+		task_new_soainfo(nsd->task[nsd->mytask], last_task,
+			(zone_type*)n->elem, 0);
+	VERBOSITY(1, (LOG_INFO, "opened the new image %s, %d zones",
+		nsd->dbfile, (int)nsd->db->zonetree->count));
 }
 
 /** add all soainfo to taskdb */
@@ -1090,11 +2283,14 @@ server_send_soa_xfrd(struct nsd* nsd, int shortsoa)
 		if(nsd->signal_hint_shutdown) {
 		shutdown:
 			log_msg(LOG_WARNING, "signal received, shutting down...");
+			server_close_reuseport_sockets(nsd, nsd->udp);
+			server_close_reuseport_tcp(nsd, nsd->tcp);
 			server_close_all_sockets(nsd->udp, nsd->ifs);
 			server_close_all_sockets(nsd->tcp, nsd->ifs);
 #ifdef HAVE_SSL
 			daemon_remote_close(nsd->rc);
 #endif
+			daemon_metrics_close(nsd->metrics);
 			/* Unlink it if possible... */
 			unlinkpid(nsd->pidfile);
 			unlink(nsd->task[0]->fname);
@@ -1218,6 +2414,8 @@ block_read(struct nsd* nsd, int s, void* p, ssize_t sz, int timeout)
 	return total;
 }
 
+/* process the tasks from xfrd, cmdsocket is -1 if there is no old main
+ * to follow when it quits */
 static void
 reload_process_tasks(struct nsd* nsd, udb_ptr* last_task, int cmdsocket)
 {
@@ -1227,6 +2425,10 @@ reload_process_tasks(struct nsd* nsd, udb_ptr* last_task, int cmdsocket)
 	udb_ptr_init(&next, u);
 	udb_ptr_new(&t, u, udb_base_get_userdata(u));
 	udb_base_set_userdata(u, 0);
+	/* a zone that gets an AXFR skips the transfers queued before it,
+	 * the disk reads the transfers while the first ones are applied */
+	task_coalesce_xfr(u, &t);
+	task_prefetch_xfr(nsd, u, &t);
 	while(!udb_ptr_is_null(&t)) {
 		/* store next in list so this one can be deleted or reused */
 		udb_ptr_set_rptr(&next, u, &TASKLIST(&t)->next);
@@ -1240,7 +2442,8 @@ reload_process_tasks(struct nsd* nsd, udb_ptr* last_task, int cmdsocket)
 		udb_ptr_set_ptr(&t, u, &next);
 
 		/* if the parent has quit, we must quit too, poll the fd for cmds */
-		if(block_read(nsd, cmdsocket, &cmd, sizeof(cmd), 0) == sizeof(cmd)) {
+		if(cmdsocket != -1 && block_read(nsd, cmdsocket, &cmd,
+			sizeof(cmd), 0) == sizeof(cmd)) {
 			DEBUG(DEBUG_IPC,1, (LOG_INFO, "reload: ipc command from main %d", (int)cmd));
 			if(cmd == NSD_QUIT) {
 				DEBUG(DEBUG_IPC,1, (LOG_INFO, "reload: quit to follow nsd"));
@@ -1286,16 +2489,21 @@ reload_do_stats(int cmdfd, struct nsd* nsd, udb_ptr* last)
 {
 	struct nsdst s;
 	stc_t* p;
-	size_t i;
+	size_t i, slab_used;
 	if(block_read(nsd, cmdfd, &s, sizeof(s),
 		RELOAD_SYNC_TIMEOUT) != sizeof(s)) {
 		log_msg(LOG_ERR, "could not read stats from oldpar");
 		return;
 	}
 	s.db_disk = (nsd->db->udb?nsd->db->udb->base_size:0);
-	s.db_mem = region_get_mem(nsd->db->region);
+	s.db_disk_free = (nsd->db->udb?nsd->db->udb->alloc->disk->stat_free:0);
+	s.db_mem = namedb_get_mem(nsd->db);
+	s.db_slab = namedb_get_slab(nsd->db, &slab_used);
+	s.db_slab_used = slab_used;
+	if(nsd->db->profile)
+		memcpy(s.db_tag, nsd->db->profile, sizeof(s.db_tag));
 	p = (stc_t*)task_new_stat_info(nsd->task[nsd->mytask], last, &s,
-		nsd->child_count);
+		nsd->child_count, nsd->stat_idx);
 	if(!p) return;
 	for(i=0; i<nsd->child_count; i++) {
 		if(block_read(nsd, cmdfd, p++, sizeof(stc_t), 1)!=sizeof(stc_t))
@@ -1304,6 +2512,67 @@ reload_do_stats(int cmdfd, struct nsd* nsd, udb_ptr* last)
 }
 #endif /* BIND8_STATS */
 
+const char*
+reload_phase_name(int phase)
+{
+	static const char* names[RELOAD_PHASES] = { "tasks", "apply",
+		"prehash", "compact", "sync", "fork", "quitsync", "stats" };
+	if(phase < 0 || phase >= RELOAD_PHASES)
+		return "unknown";
+	return names[phase];
+}
+
+void
+reload_timing_zone(struct nsd* nsd, const struct dname* zone, uint64_t nsec)
+{
+	struct reload_timing* rt = &nsd->reload_timing;
+	int i, j;
+	rt->phase[RELOAD_PHASE_APPLY] += nsec;
+	rt->zones++;
+	/* keep the slowest zones, in order */
+	for(i=0; i<RELOAD_SLOW_ZONES; i++)
+		if(nsec > rt->slow_nsec[i])
+			break;
+	if(i == RELOAD_SLOW_ZONES)
+		return;
+	for(j=RELOAD_SLOW_ZONES-1; j>i; j--) {
+		rt->slow_nsec[j] = rt->slow_nsec[j-1];
+		memcpy(rt->slow_zone[j], rt->slow_zone[j-1], MAXDOMAINLEN);
+	}
+	rt->slow_nsec[i] = nsec;
+	memcpy(rt->slow_zone[i], dname_name(zone), zone->name_size);
+}
+
+/* the phase ended, add the time since *t to it and start the next */
+static void
+reload_phase(struct nsd* nsd, int phase, uint64_t* t)
+{
+	uint64_t now = latency_clock();
+	nsd->reload_timing.phase[phase] += now - *t;
+	*t = now;
+}
+
+/* log the timing of the reload, the phases and the slowest zone */
+static void
+reload_timing_log(struct nsd* nsd)
+{
+	struct reload_timing* rt = &nsd->reload_timing;
+	char buf[512];
+	size_t len = 0;
+	int i;
+	if(verbosity < 1)
+		return;
+	for(i=0; i<RELOAD_PHASES && len < sizeof(buf); i++)
+		len += snprintf(buf+len, sizeof(buf)-len, " %s %.3f",
+			reload_phase_name(i), (double)rt->phase[i]/1e9);
+	VERBOSITY(1, (LOG_INFO, "reload: %.3f seconds, %u zone transfers,%s",
+		(double)rt->total/1e9, (unsigned)rt->zones, buf));
+	if(rt->slow_nsec[0])
+		VERBOSITY(1, (LOG_INFO, "reload: slowest zone %s applied in "
+			"%.3f seconds", wiredname2str(rt->slow_zone[0]),
+			(double)rt->slow_nsec[0]/1e9));
+}
+
 /*
  * Reload the database, stop parent, re-fork children and continue.
  * as server_main.
@@ -1317,18 +2586,38 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	int ret;
 	udb_ptr last_task;
 	struct sigaction old_sigchld, ign_sigchld;
+	uint64_t start = latency_clock(), t = start;
 	/* ignore SIGCHLD from the previous server_main that used this pid */
 	memset(&ign_sigchld, 0, sizeof(ign_sigchld));
 	ign_sigchld.sa_handler = SIG_IGN;
 	sigaction(SIGCHLD, &ign_sigchld, &old_sigchld);
+	NSD_PROBE(reload__start);
+	memset(&nsd->reload_timing, 0, sizeof(nsd->reload_timing));
+	nsd->reload_timing.start = (uint64_t)time(NULL);
 
 	/* see what tasks we got from xfrd */
 	task_remap(nsd->task[nsd->mytask]);
 	udb_ptr_init(&last_task, nsd->task[nsd->mytask]);
+	/* the servers do not read lazy zones while the udb changes */
+	namedb_lock_udb(nsd->db);
 	udb_compact_inhibited(nsd->db->udb, 1);
+	/* the zone transfers change the udb after the new servers run */
+	diff_udb_defer(1);
 	reload_process_tasks(nsd, &last_task, cmdsocket);
+	diff_udb_defer(0);
 	udb_compact_inhibited(nsd->db->udb, 0);
+	NSD_PROBE(reload__tasks);
+	reload_phase(nsd, RELOAD_PHASE_TASKS, &t);
+	/* a reload moves a part of the data, the next reload goes on */
+	udb_compact_limit(nsd->db->udb, UDB_COMPACT_STEP);
 	udb_compact(nsd->db->udb);
+	reload_phase(nsd, RELOAD_PHASE_COMPACT, &t);
+	if(nsd->db->udb) {
+		VERBOSITY(2, (LOG_INFO, "nsd.db is %llu bytes, %llu in use, "
+			"%llu free", (unsigned long long)nsd->db->udb->base_size,
+			(unsigned long long)nsd->db->udb->alloc->disk->stat_data,
+			(unsigned long long)nsd->db->udb->alloc->disk->stat_free));
+	}
 
 #ifndef NDEBUG
 	if(nsd_debug_level >= 1)
@@ -1336,19 +2625,34 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 #endif /* NDEBUG */
 	/* sync to disk (if needed) */
 	udb_base_sync(nsd->db->udb, 0);
-
-	initialize_dname_compression_tables(nsd);
+	namedb_unlock_udb(nsd->db);
+	if(nsd->db->udb && nsd->db->udb->readonly)
+		reload_db_image(nsd, &last_task);
+	else if(!diff_udb_pending())
+		server_db_publish(nsd);
+	reload_phase(nsd, RELOAD_PHASE_SYNC, &t);
 
 #ifdef BIND8_STATS
 	/* Restart dumping stats if required.  */
 	time(&nsd->st.boot);
 	set_bind8_alarm(nsd);
+	server_stat_switch(nsd);
+#endif
+#ifdef USE_DNSTAP
+	/* the new servers use the other rings, xfrd empties both */
+	nsd->dt_idx = 1 - nsd->dt_idx;
 #endif
+	topk_switch(nsd);
+	logring_switch(nsd);
+	stall_switch(nsd);
 #ifdef USE_ZONE_STATS
 	server_zonestat_realloc(nsd); /* realloc for new children */
 	server_zonestat_switch(nsd);
 #endif
 
+	if(nsd->options->reload_prefault)
+		server_prefault(nsd);
+
 	/* listen for the signals of failed children again */
 	sigaction(SIGCHLD, &old_sigchld, NULL);
 	/* Start new child processes */
@@ -1357,6 +2661,8 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 		send_children_quit(nsd);
 		exit(1);
 	}
+	NSD_PROBE1(reload__fork, nsd->child_count);
+	reload_phase(nsd, RELOAD_PHASE_FORK, &t);
 
 	/* if the parent has quit, we must quit too, poll the fd for cmds */
 	if(block_read(nsd, cmdsocket, &cmd, sizeof(cmd), 0) == sizeof(cmd)) {
@@ -1395,9 +2701,15 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 		exit(1);
 	}
 	assert(ret==-1 || ret == 0 || cmd == NSD_RELOAD);
+	reload_phase(nsd, RELOAD_PHASE_QUITSYNC, &t);
 #ifdef BIND8_STATS
 	reload_do_stats(cmdsocket, nsd, &last_task);
+	reload_phase(nsd, RELOAD_PHASE_STATS, &t);
 #endif
+	nsd->reload_timing.total = t - start;
+	reload_timing_log(nsd);
+	task_new_reload_timing(nsd->task[nsd->mytask], &last_task,
+		&nsd->reload_timing);
 	udb_ptr_unlink(&last_task, nsd->task[nsd->mytask]);
 	task_process_sync(nsd->task[nsd->mytask]);
 #ifdef USE_ZONE_STATS
@@ -1417,12 +2729,329 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 			strerror(errno));
 	}
 
+	/* the new servers answer from memory, now the udb gets the
+	 * changes of the zone transfers, with one sync for all of them */
+	if(diff_udb_pending()) {
+		size_t num = diff_udb_flush(nsd->db);
+		VERBOSITY(2, (LOG_INFO, "wrote %u changes to nsd.db after "
+			"the reload", (unsigned)num));
+		server_db_publish(nsd);
+	}
+
 	/* try to reopen file */
 	if (nsd->file_rotation_ok)
 		log_reopen(nsd->log_filename, 1);
+	NSD_PROBE(reload__done);
 	/* exit reload, continue as new server_main */
 }
 
+/* largest total size of the zone transfer files that reload-in-place
+ * applies in the running servers, larger transfers fork new servers */
+#define RELOAD_IN_PLACE_MAX (1024*1024)
+
+/*
+ * Count the tasks from xfrd, if they are all zone transfers for existing
+ * zones, that together are small enough for reload-in-place.
+ * Returns 0 if a normal reload is needed.
+ */
+static uint32_t
+reload_in_place_count(struct nsd* nsd)
+{
+	udb_base* u = nsd->task[nsd->mytask];
+	uint32_t num = 0;
+	off_t total = 0;
+	udb_ptr t;
+	if(nsd->db->udb)
+		return 0;
+	udb_ptr_new(&t, u, udb_base_get_userdata(u));
+	while(!udb_ptr_is_null(&t)) {
+		struct stat st;
+		FILE* df;
+		if(TASKLIST(&t)->task_type != task_apply_xfr ||
+			!namedb_find_zone(nsd->db, TASKLIST(&t)->zname)) {
+			num = 0;
+			break;
+		}
+		df = xfrd_open_xfrfile(nsd, TASKLIST(&t)->yesno, "r");
+		if(!df) {
+			num = 0;
+			break;
+		}
+		if(fstat(fileno(df), &st) == 0)
+			total += st.st_size;
+		else	total = RELOAD_IN_PLACE_MAX+1;
+		/* a transfer that is still received is streamed by a reload */
+		if(!diff_xfrfile_committed(df))
+			total = RELOAD_IN_PLACE_MAX+1;
+		fclose(df);
+		if(total > RELOAD_IN_PLACE_MAX) {
+			num = 0;
+			break;
+		}
+		num++;
+		udb_ptr_set_rptr(&t, u, &TASKLIST(&t)->next);
+	}
+	udb_ptr_unlink(&t, u);
+	return num;
+}
+
+/*
+ * Apply the zone transfers in the task list to a copy of the database in
+ * a forked process.  An error in a transfer makes the apply exit, that
+ * must not happen in the main process or the running servers, so they
+ * apply the transfers in place only after this check.
+ * Returns true if the transfers apply.
+ */
+static int
+reload_in_place_check(struct nsd* nsd)
+{
+	udb_base* u = nsd->task[nsd->mytask];
+	udb_ptr t;
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	switch(pid) {
+	case -1:
+		log_msg(LOG_ERR, "reload in place: fork failed: %s",
+			strerror(errno));
+		return 0;
+	case 0:
+		/* CHILD, the changes go to its own copy of the database */
+		udb_ptr_new(&t, u, udb_base_get_userdata(u));
+		while(!udb_ptr_is_null(&t)) {
+			zone_type* zone = namedb_find_zone(nsd->db,
+				TASKLIST(&t)->zname);
+			if(!zone || !diff_apply_xfrfile(nsd, zone,
+				TASKLIST(&t)->yesno))
+				_exit(1);
+			udb_ptr_set_rptr(&t, u, &TASKLIST(&t)->next);
+		}
+		/* not the atexit handlers and stdio buffers of the parent */
+		_exit(0);
+	default:
+		break;
+	}
+	while(waitpid(pid, &status, 0) == -1) {
+		if(errno != EINTR) {
+			log_msg(LOG_ERR, "reload in place: waitpid(%d): %s",
+				(int)pid, strerror(errno));
+			return 0;
+		}
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* send the zone transfers in the task list to a child */
+static int
+reload_in_place_send(struct nsd* nsd, int fd, uint32_t num)
+{
+	sig_atomic_t cmd = NSD_APPLY_XFR;
+	udb_base* u = nsd->task[nsd->mytask];
+	int r;
+	udb_ptr t;
+	if(!write_socket(fd, &cmd, sizeof(cmd)) ||
+		!write_socket(fd, &nsd->pid, sizeof(nsd->pid)) ||
+		!write_socket(fd, &num, sizeof(num)))
+		return 0;
+	r = 1;
+	udb_ptr_new(&t, u, udb_base_get_userdata(u));
+	while(r && !udb_ptr_is_null(&t)) {
+		uint64_t nr = TASKLIST(&t)->yesno;
+		uint32_t len = (uint32_t)dname_total_size(TASKLIST(&t)->zname);
+		if(!write_socket(fd, &nr, sizeof(nr)) ||
+			!write_socket(fd, &len, sizeof(len)) ||
+			!write_socket(fd, TASKLIST(&t)->zname, len))
+			r = 0;
+		udb_ptr_set_rptr(&t, u, &TASKLIST(&t)->next);
+	}
+	udb_ptr_unlink(&t, u);
+	return r;
+}
+
+/*
+ * Reload without forking, for reload-in-place.  The children apply the
+ * zone transfers to their copy of the database and keep running, then
+ * the main process applies them to its own copy, that is used to fork
+ * servers later on, and reports the results to xfrd.
+ * Returns false if a normal reload is needed.
+ */
+static int
+server_reload_in_place(struct nsd* nsd, netio_type* netio)
+{
+	sig_atomic_t cmd = NSD_RELOAD_DONE;
+	struct timespec timeout_spec;
+	udb_ptr last_task;
+	time_t end;
+	int waiting;
+	uint32_t num;
+	pid_t mypid;
+	size_t i;
+
+	task_remap(nsd->task[nsd->mytask]);
+	if((num = reload_in_place_count(nsd)) == 0)
+		return 0;
+	if(!reload_in_place_check(nsd)) {
+		log_msg(LOG_WARNING, "the zone transfers could not be applied "
+			"in place, they are applied with a reload");
+		return 0;
+	}
+	VERBOSITY(2, (LOG_INFO, "reload in place of %u zone transfers",
+		(unsigned)num));
+	for(i=0; i<nsd->child_count; i++) {
+		if(nsd->children[i].pid <= 0 || nsd->children[i].child_fd == -1)
+			continue;
+		if(!reload_in_place_send(nsd, nsd->children[i].child_fd, num)) {
+			log_msg(LOG_ERR, "could not send zone transfers to "
+				"server %d: %s", (int)nsd->children[i].pid,
+				strerror(errno));
+			kill(nsd->children[i].pid, SIGTERM);
+			continue;
+		}
+		nsd->children[i].wait_apply_xfr = 1;
+	}
+
+	/* the acks arrive on the child handlers, that also forward
+	 * notifies to xfrd in the meantime */
+	end = time(NULL) + RELOAD_SYNC_TIMEOUT;
+	do {
+		waiting = 0;
+		for(i=0; i<nsd->child_count; i++)
+			if(nsd->children[i].wait_apply_xfr &&
+				nsd->children[i].child_fd != -1)
+				waiting = 1;
+		if(!waiting || time(NULL) >= end)
+			break;
+		timeout_spec.tv_sec = 1;
+		timeout_spec.tv_nsec = 0;
+		if(netio_dispatch(netio, &timeout_spec, 0) == -1 &&
+			errno != EINTR)
+			log_msg(LOG_ERR, "netio_dispatch failed: %s",
+				strerror(errno));
+	} while(1);
+	for(i=0; i<nsd->child_count; i++) {
+		if(nsd->children[i].wait_apply_xfr &&
+			nsd->children[i].child_fd != -1) {
+			/* it is restarted with the new data by server_main */
+			log_msg(LOG_WARNING, "server %d did not apply the zone "
+				"transfers, restarting", (int)nsd->children[i].pid);
+			kill(nsd->children[i].pid, SIGTERM);
+		}
+		nsd->children[i].wait_apply_xfr = 0;
+	}
+
+	/* process the tasks for our copy and the results for xfrd */
+	udb_ptr_init(&last_task, nsd->task[nsd->mytask]);
+	namedb_lock_udb(nsd->db);
+	reload_process_tasks(nsd, &last_task, -1);
+	namedb_unlock_udb(nsd->db);
+	udb_ptr_unlink(&last_task, nsd->task[nsd->mytask]);
+	task_process_sync(nsd->task[nsd->mytask]);
+
+	/* the same reply as when a reload process has failed, this leaves
+	 * the task list with xfrd and there are no new servers to sync */
+	if(!write_socket(nsd->xfrd_listener->fd, &cmd, sizeof(cmd))) {
+		log_msg(LOG_ERR, "problems sending reload_done xfrd: %s",
+			strerror(errno));
+	}
+	mypid = getpid();
+	if(!write_socket(nsd->xfrd_listener->fd, &mypid, sizeof(mypid))) {
+		log_msg(LOG_ERR, "problems sending reloadpid to xfrd: %s",
+			strerror(errno));
+	}
+	return 1;
+}
+
+int
+server_apply_xfr(struct nsd* nsd, zone_type* zone, uint64_t xfrfilenr)
+{
+	/* an answer can hold the data of another zone, the target of a
+	 * CNAME, so all of the answers are flushed */
+	if(nsd->anscache)
+		anscache_flush(nsd->anscache);
+	if(nsd->axfrcache)
+		axfrcache_flush_zone(nsd->axfrcache, zone);
+#ifdef NSEC3
+	/* the NSEC3 parameters can change */
+	nsec3_cache_flush_zone(zone);
+#endif
+	return diff_apply_xfrfile(nsd, zone, xfrfilenr);
+}
+
+/*
+ * Apply the zone transfers from reload-in-place to the database of this
+ * server process.  The main process has checked that they apply.  If it
+ * cannot do that, it exits and server_main restarts it with the new
+ * database.
+ */
+void
+server_child_apply_xfr(struct nsd* nsd, int fd)
+{
+	sig_atomic_t cmd = NSD_APPLY_XFR;
+	region_type* region = region_create(xalloc, free);
+	uint64_t* nrs;
+	dname_type** names;
+	uint32_t num, i;
+	pid_t pid, mainpid;
+
+	if(block_read(nsd, fd, &mainpid, sizeof(mainpid), RELOAD_SYNC_TIMEOUT)
+		!= sizeof(mainpid) ||
+	   block_read(nsd, fd, &num, sizeof(num), RELOAD_SYNC_TIMEOUT) !=
+		sizeof(num)) {
+		log_msg(LOG_ERR, "server %d could not read zone transfers",
+			(int)getpid());
+		exit(1);
+	}
+	nrs = (uint64_t*)region_alloc_array(region, num, sizeof(*nrs));
+	names = (dname_type**)region_alloc_array(region, num, sizeof(*names));
+	for(i=0; i<num; i++) {
+		uint32_t len;
+		if(block_read(nsd, fd, &nrs[i], sizeof(nrs[i]),
+			RELOAD_SYNC_TIMEOUT) != sizeof(nrs[i]) ||
+		   block_read(nsd, fd, &len, sizeof(len),
+			RELOAD_SYNC_TIMEOUT) != sizeof(len) ||
+		   len < sizeof(dname_type) || len > 4096) {
+			log_msg(LOG_ERR, "server %d could not read zone "
+				"transfers", (int)getpid());
+			exit(1);
+		}
+		names[i] = (dname_type*)region_alloc(region, len);
+		if(block_read(nsd, fd, names[i], len, RELOAD_SYNC_TIMEOUT) !=
+			(ssize_t)len) {
+			log_msg(LOG_ERR, "server %d could not read zone "
+				"transfers", (int)getpid());
+			exit(1);
+		}
+	}
+	if(tcp_axfr_count > 0) {
+		/* running AXFRs refer to the domains that would change */
+		VERBOSITY(2, (LOG_INFO, "server %d has AXFR in progress, "
+			"restarts for the zone transfers", (int)getpid()));
+		exit(0);
+	}
+
+	/* the xfr files are in the tempdir of the main process */
+	pid = nsd->pid;
+	nsd->pid = mainpid;
+	for(i=0; i<num; i++) {
+		zone_type* zone = namedb_find_zone(nsd->db, names[i]);
+		if(!zone)
+			continue;
+		if(!server_apply_xfr(nsd, zone, nrs[i])) {
+			log_msg(LOG_ERR, "server %d could not apply the zone "
+				"transfer for %s", (int)getpid(),
+				dname_to_string(names[i], NULL));
+			exit(1);
+		}
+	}
+	nsd->pid = pid;
+	region_destroy(region);
+	if(!write_socket(fd, &cmd, sizeof(cmd))) {
+		log_msg(LOG_ERR, "cannot write apply ack to parent: %s",
+			strerror(errno));
+	}
+}
+
 /*
  * Get the mode depending on the signal hints that have been received.
  * Multiple signal hints can be received and will be handled in turn.
@@ -1564,8 +3193,9 @@ server_main(struct nsd *nsd)
 			if (nsd->mode != NSD_RUN)
 				break;
 
-			/* timeout to collect processes. In case no sigchild happens. */
-			timeout_spec.tv_sec = 60;
+			/* timeout to collect processes. In case no sigchild happens.
+			 * With stall-monitor, to check the servers every second. */
+			timeout_spec.tv_sec = nsd->options->stall_monitor?1:60;
 			timeout_spec.tv_nsec = 0;
 
 			/* listen on ports, timeout for collecting terminated children */
@@ -1574,6 +3204,7 @@ server_main(struct nsd *nsd)
 					log_msg(LOG_ERR, "netio_dispatch failed: %s", strerror(errno));
 				}
 			}
+			stall_check(nsd);
 			if(nsd->restart_children) {
 				restart_child_servers(nsd, server_region, netio,
 					&nsd->xfrd_listener->fd);
@@ -1630,6 +3261,9 @@ server_main(struct nsd *nsd)
 
 			/* switch the mytask to keep track of who owns task*/
 			nsd->mytask = 1 - nsd->mytask;
+			if(nsd->options->reload_in_place &&
+				server_reload_in_place(nsd, netio))
+				break;
 			if (socketpair(AF_UNIX, SOCK_STREAM, 0, reload_sockets) == -1) {
 				log_msg(LOG_ERR, "reload failed on socketpair: %s", strerror(errno));
 				reload_pid = -1;
@@ -1709,7 +3343,11 @@ server_main(struct nsd *nsd)
 			}
 			DEBUG(DEBUG_IPC,1, (LOG_INFO, "server_main: shutdown sequence"));
 			/* only quit children after xfrd has acked */
-			send_children_quit(nsd);
+			if(reload_listener.fd != -1) {
+				/* the new servers have started, the old ones
+				 * finish their TCP connections */
+				send_children_drain(nsd);
+			} else	send_children_quit(nsd);
 
 #if 0 /* OS collects memory pages */
 			region_destroy(server_region);
@@ -1739,11 +3377,14 @@ server_main(struct nsd *nsd)
 	log_msg(LOG_WARNING, "signal received, shutting down...");
 
 	/* close opened ports to avoid race with restart of nsd */
+	server_close_reuseport_sockets(nsd, nsd->udp);
+	server_close_reuseport_tcp(nsd, nsd->tcp);
 	server_close_all_sockets(nsd->udp, nsd->ifs);
 	server_close_all_sockets(nsd->tcp, nsd->ifs);
 #ifdef HAVE_SSL
 	daemon_remote_close(nsd->rc);
 #endif
+	daemon_metrics_close(nsd->metrics);
 	send_children_quit_and_wait(nsd);
 
 	/* Unlink it if possible... */
@@ -1796,42 +3437,290 @@ server_main(struct nsd *nsd)
 	/* write the nsd.db to disk, wait for it to complete */
 	udb_base_sync(nsd->db->udb, 1);
 	udb_base_close(nsd->db->udb);
+#ifdef NSEC3
+	if(nsd->options->nsec3_snapshot)
+		(void)nsec3_snapshot_write(nsd->db, nsd->options->nsec3_snapshot);
+#endif
 	server_shutdown(nsd);
 }
 
+#ifdef USE_ZONE_STATS
+/* add the time since start to the cpu counter i of the zone of the query,
+ * scale is the number of queries that the timed one stands for */
+static void
+zone_cpu_add(struct nsd *nsd, struct query *query, int i, uint64_t start,
+	uint64_t scale)
+{
+	/* transfers are answered from the axfr_zone */
+	zone_type* zone = query->axfr_zone?query->axfr_zone:query->zone;
+	uint64_t now = latency_clock();
+	if(!zone || zone->zonestatid >= nsd->zonestatsizenow || now < start)
+		return;
+	ZONESTAT(nsd, zone)->cpu[i] += (now - start)*scale;
+	if(i == ZONESTAT_CPU_QUERY)
+		ZONESTAT(nsd, zone)->cpu[ZONESTAT_CPU_SAMPLES]++;
+}
+#endif /* USE_ZONE_STATS */
+
+/* process the query, and count it if it did not fit in its arena */
+static query_state_type
+server_process_query_arena(struct nsd *nsd, struct query *query)
+{
+	query_state_type r;
+#ifdef USE_ZONE_STATS
+	uint64_t start = 0;
+	if(nsd->options->zone_cpu_sample && ++zone_cpu_count >=
+		nsd->options->zone_cpu_sample) {
+		zone_cpu_count = 0;
+		start = latency_clock();
+	}
+#endif
+	r = query_process(query, nsd);
+#ifdef USE_ZONE_STATS
+	if(start)
+		zone_cpu_add(nsd, query, ZONESTAT_CPU_QUERY, start,
+			(uint64_t)nsd->options->zone_cpu_sample);
+#endif
+#ifdef BIND8_STATS
+	if(region_overflowed(query->region))
+		STATUP(nsd, arena_overflow);
+#endif
+	if(nsd->top && r != QUERY_DISCARDED)
+		topk_query(nsd, query);
+	return r;
+}
+
 static query_state_type
 server_process_query(struct nsd *nsd, struct query *query)
 {
-	return query_process(query, nsd);
+	return server_process_query_arena(nsd, query);
+}
+
+#if (!defined(NONBLOCKING_IS_BROKEN) && (defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)))
+/*
+ * With overload-action, the fill of the received batch tells if the
+ * server keeps up, a full batch leaves queries in the socket buffer.
+ * After a few full batches in a row the server is in overload, until a
+ * batch is at most half full.
+ */
+static void
+udp_overload_batch(struct nsd *nsd, int batch)
+{
+#ifdef RATELIMIT
+	/* the fill of the batch is the load of the server */
+	if(nsd->options->rrl_adaptive > 1) {
+		rrl_adapt((uint32_t)(batch*RRL_LOAD_FULL/udp_batch_size));
+#ifdef BIND8_STATS
+		rrl_get_limits(&nsd->st.rrl_limit,
+			&nsd->st.rrl_whitelist_limit);
+#endif
+	}
+#endif
+	if(!nsd->options->overload_action)
+		return;
+	if(batch >= udp_batch_size) {
+		if(udp_full_batches < OVERLOAD_FULL_BATCHES)
+			udp_full_batches++;
+	} else if(batch <= udp_batch_size/2)
+		udp_full_batches = 0;
+	udp_overload = (udp_full_batches >= OVERLOAD_FULL_BATCHES);
+}
+#endif /* !NONBLOCKING_IS_BROKEN && (HAVE_RECVMMSG || HAVE_SENDMMSG) */
+
+/*
+ * In overload, or when the event loop lags with stall-monitor, the
+ * queries of the sources that are not in overload-allow are shed, unless
+ * they have a valid cookie, that is checked when the query is parsed.
+ */
+static void
+udp_overload_mark(struct nsd *nsd, struct query *query)
+{
+	acl_options_t* acl;
+	if(!nsd->options->overload_action || !(udp_overload || stall_lagging))
+		return;
+	for(acl = nsd->options->overload_allow; acl; acl = acl->next) {
+		if(acl_addr_matches(acl, query))
+			return;
+	}
+	query->shed = 1;
 }
 
 static query_state_type
 server_process_query_udp(struct nsd *nsd, struct query *query)
 {
+	udp_overload_mark(nsd, query);
 #ifdef RATELIMIT
-	if(query_process(query, nsd) != QUERY_DISCARDED) {
-		if(rrl_process_query(query))
-			return rrl_slip(query);
-		else	return QUERY_PROCESSED;
+	if(server_process_query_arena(nsd, query) != QUERY_DISCARDED) {
+		if(rrl_process_query(query)) {
+			query_state_type r = rrl_slip(query);
+			if(r == QUERY_DISCARDED)
+				STATUP(nsd, rrl_discard);
+			else	STATUP(nsd, rrl_slip);
+			return r;
+		} else	return QUERY_PROCESSED;
 	}
 	return QUERY_DISCARDED;
 #else
-	return query_process(query, nsd);
+	return server_process_query_arena(nsd, query);
 #endif
 }
 
+#ifdef USE_XDP
+/*
+ * Data for the AF_XDP socket handler of a server.
+ */
+struct xdp_handler_data
+{
+	struct nsd        *nsd;
+	struct xdp_socket *xs;
+	query_type        *query;
+	struct event       event;
+	struct event       timer;
+};
+
+/* answer a query from the AF_XDP socket, like handle_udp */
+static size_t
+server_xdp_query(void* arg, uint8_t* data, size_t len, size_t max,
+	struct sockaddr_storage* addr, socklen_t addrlen)
+{
+	struct xdp_handler_data* d = (struct xdp_handler_data*)arg;
+	struct nsd* nsd = d->nsd;
+	struct query* q = d->query;
+	size_t ipv4_edns_size = nsd->ipv4_edns_size;
+#if defined(INET6)
+	size_t ipv6_edns_size = nsd->ipv6_edns_size;
+#endif
+	query_state_type r;
+
+	query_reset(q, UDP_MAX_MESSAGE_LEN, 0);
+	if(len > buffer_remaining(q->packet))
+		return 0;
+	memcpy(&q->addr, addr, addrlen);
+	q->addrlen = addrlen;
+	buffer_write(q->packet, data, len);
+	buffer_flip(q->packet);
+#ifdef BIND8_STATS
+	if(addr->ss_family == AF_INET) {
+		STATUP(nsd, qudp);
+	} else if(addr->ss_family == AF_INET6) {
+		STATUP(nsd, qudp6);
+	}
+#endif
+
+	/* the answer must fit in the frame, it is not fragmented */
+	if(nsd->ipv4_edns_size > max)
+		nsd->ipv4_edns_size = max;
+#if defined(INET6)
+	if(nsd->ipv6_edns_size > max)
+		nsd->ipv6_edns_size = max;
+#endif
+	r = server_process_query_udp(nsd, q);
+	nsd->ipv4_edns_size = ipv4_edns_size;
+#if defined(INET6)
+	nsd->ipv6_edns_size = ipv6_edns_size;
+#endif
+	if(r == QUERY_DISCARDED) {
+		STATUP(nsd, dropped);
+		ZTATUP(nsd, q->zone, dropped);
+		return 0;
+	}
+	if (RCODE(q->packet) == RCODE_OK && !AA(q->packet)) {
+		STATUP(nsd, nona);
+		ZTATUP(nsd, q->zone, nona);
+	}
+#ifdef USE_ZONE_STATS
+	if(addr->ss_family == AF_INET) {
+		ZTATUP(nsd, q->zone, qudp);
+	} else if(addr->ss_family == AF_INET6) {
+		ZTATUP(nsd, q->zone, qudp6);
+	}
+#endif
+	query_add_optional(q, nsd);
+	buffer_flip(q->packet);
+	if(buffer_remaining(q->packet) > max) {
+		STATUP(nsd, dropped);
+		ZTATUP(nsd, q->zone, dropped);
+		return 0;
+	}
+#ifdef BIND8_STATS
+	STATUP2(nsd, rcode, RCODE(q->packet));
+	ZTATUP2(nsd, q->zone, rcode, RCODE(q->packet));
+	if (TC(q->packet)) {
+		STATUP(nsd, truncated);
+		ZTATUP(nsd, q->zone, truncated);
+	}
+#endif /* BIND8_STATS */
+	memcpy(data, buffer_begin(q->packet), buffer_remaining(q->packet));
+	return buffer_remaining(q->packet);
+}
+
+static void
+handle_xdp(int ATTR_UNUSED(fd), short event, void* arg)
+{
+	struct xdp_handler_data* d = (struct xdp_handler_data*)arg;
+	if (!(event & EV_READ)) {
+		return;
+	}
+	xdp_socket_handle(d->nsd->xdp, d->xs, server_xdp_query, d);
+}
+
+/* serve the socket when the server that this one replaces has quit */
+static void
+handle_xdp_lock(int ATTR_UNUSED(fd), short ATTR_UNUSED(event), void* arg)
+{
+	struct xdp_handler_data* d = (struct xdp_handler_data*)arg;
+	struct timeval tv;
+	if(xdp_socket_lock(d->nsd->xdp, d->xs)) {
+		if(event_add(&d->event, NULL) != 0)
+			log_msg(LOG_ERR, "nsd xdp: event_add failed");
+		return;
+	}
+	tv.tv_sec = 0;
+	tv.tv_usec = 50000;
+	if(event_add(&d->timer, &tv) != 0)
+		log_msg(LOG_ERR, "nsd xdp: event_add failed");
+}
+
+static void
+server_xdp_start(struct nsd* nsd, region_type* region,
+	struct event_base* event_base)
+{
+	size_t n = nsd->this_child - nsd->children;
+	struct xdp_handler_data* d;
+	if(n >= nsd->xdp->num)
+		return;
+	d = (struct xdp_handler_data*)region_alloc_zero(region, sizeof(*d));
+	d->nsd = nsd;
+	d->xs = &nsd->xdp->socks[n];
+	d->query = query_create(region);
+	event_set(&d->event, d->xs->fd, EV_PERSIST|EV_READ, handle_xdp, d);
+	if(event_base_set(event_base, &d->event) != 0)
+		log_msg(LOG_ERR, "nsd xdp: event_base_set failed");
+	event_set(&d->timer, -1, EV_TIMEOUT, handle_xdp_lock, d);
+	if(event_base_set(event_base, &d->timer) != 0)
+		log_msg(LOG_ERR, "nsd xdp: event_base_set failed");
+	handle_xdp_lock(-1, 0, d);
+}
+#endif /* USE_XDP */
+
 struct event_base*
 nsd_child_event_base(void)
 {
 	struct event_base* base;
 #ifdef USE_MINI_EVENT
-	static time_t secs;
-	static struct timeval now;
+	static NSD_THREAD_LOCAL time_t secs;
+	static NSD_THREAD_LOCAL struct timeval now;
 	base = event_init(&secs, &now);
 #else
 #  if defined(HAVE_EV_LOOP) || defined(HAVE_EV_DEFAULT_LOOP)
 	/* libev */
+#    ifdef USE_SERVER_THREADS
+	/* there is one default loop per process, every thread makes its
+	 * own loop */
+	base = (struct event_base *)ev_loop_new(EVFLAG_AUTO);
+#    else
 	base = (struct event_base *)ev_default_loop(EVFLAG_AUTO);
+#    endif
 #  else
 	/* libevent */
 #    ifdef HAVE_EVENT_BASE_NEW
@@ -1841,12 +3730,128 @@ nsd_child_event_base(void)
 #    endif
 #  endif
 #endif
-	return base;
+	return base;
+}
+
+#ifdef HAVE_SSL
+/*
+ * Create the SSL context for DNS over TLS.  It is created before the
+ * servers fork, so that they share the session ticket keys and a client
+ * can resume its session with any of them.
+ */
+void*
+server_tls_ctx_create(struct nsd* ATTR_UNUSED(nsd), const char* keyfile,
+	const char* pemfile)
+{
+	SSL_CTX* ctx;
+	unsigned long opts = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3;
+#ifdef SSL_OP_NO_TLSv1
+	opts |= SSL_OP_NO_TLSv1;
+#endif
+#ifdef SSL_OP_NO_TLSv1_1
+	opts |= SSL_OP_NO_TLSv1_1;
+#endif
+#ifdef SSL_OP_NO_RENEGOTIATION
+	opts |= SSL_OP_NO_RENEGOTIATION;
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+	/* the kernel does the record encryption, if it can */
+	opts |= SSL_OP_ENABLE_KTLS;
+#endif
+
+	ERR_load_crypto_strings();
+	ERR_load_SSL_strings();
+	OpenSSL_add_all_algorithms();
+	(void)SSL_library_init();
+
+	if(!(ctx = SSL_CTX_new(SSLv23_server_method()))) {
+		log_crypto_err("could not SSL_CTX_new");
+		return NULL;
+	}
+	/* DNS over TLS uses TLS 1.2 or later, RFC 8310 */
+	if((SSL_CTX_set_options(ctx, opts) & opts) != opts) {
+		log_crypto_err("could not set SSL_CTX options");
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+	if(!SSL_CTX_use_certificate_chain_file(ctx, pemfile)) {
+		log_msg(LOG_ERR, "error for cert file: %s", pemfile);
+		log_crypto_err("error in SSL_CTX use_certificate_chain_file");
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+	if(!SSL_CTX_use_PrivateKey_file(ctx, keyfile, SSL_FILETYPE_PEM)) {
+		log_msg(LOG_ERR, "error for private key file: %s", keyfile);
+		log_crypto_err("error in SSL_CTX use_PrivateKey_file");
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+	if(!SSL_CTX_check_private_key(ctx)) {
+		log_msg(LOG_ERR, "error for key file: %s", keyfile);
+		log_crypto_err("error in SSL_CTX check_private_key");
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+	/* resume sessions from the cache, and from tickets */
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	(void)SSL_CTX_set_session_id_context(ctx, (const unsigned char*)"nsd",
+		3);
+	/* writes continue after a partial write, and the buffers of idle
+	 * connections are freed */
+	(void)SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+		SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+	return ctx;
+}
+#endif /* HAVE_SSL */
+
+/* see if the TCP socket is on the tls-port, and serves DNS over TLS */
+static int
+server_tls_socket(struct nsd* nsd, struct nsd_socket* sock)
+{
+	int port;
+	struct sockaddr* sa;
+	if(!nsd->tls_ctx || !nsd->options->tls_port || !sock->addr)
+		return 0;
+	port = atoi(nsd->options->tls_port);
+	sa = sock->addr->ai_addr;
+	if(sa->sa_family == AF_INET)
+		return ntohs(((struct sockaddr_in*)sa)->sin_port) == port;
+#ifdef INET6
+	if(sa->sa_family == AF_INET6)
+		return ntohs(((struct sockaddr_in6*)sa)->sin6_port) == port;
+#endif
+	return 0;
 }
 
 /*
  * Serve DNS requests.
  */
+/*
+ * Start the xfr-out worker, it gets the AXFR connections from the servers
+ * over its socketpair, at a lower priority than the servers.
+ */
+static void
+server_xfrout_start(struct nsd* nsd, struct event_base* event_base)
+{
+#ifdef HAVE_SETPRIORITY
+	if (nsd->options->xfr_out_nice != 0 && setpriority(PRIO_PROCESS, 0,
+		nsd->options->xfr_out_nice) == -1)
+		log_msg(LOG_WARNING, "xfr-out: setpriority failed: %s",
+			strerror(errno));
+#endif
+	xfrout_rate = (uint64_t)nsd->options->xfr_out_rate * 1024;
+	xfrout_tokens = 0;
+	if (gettimeofday(&xfrout_last, NULL) == -1)
+		memset(&xfrout_last, 0, sizeof(xfrout_last));
+	tcp_handler_fill(nsd->maximum_tcp_count);
+	event_set(&xfrout_event, nsd->this_child->xfrout_fd,
+		EV_PERSIST|EV_READ, handle_xfrout, nsd);
+	if(event_base_set(event_base, &xfrout_event) != 0)
+		log_msg(LOG_ERR, "xfr-out: event_base_set failed");
+	if(event_add(&xfrout_event, NULL) != 0)
+		log_msg(LOG_ERR, "xfr-out: event_add failed");
+}
+
 void
 server_child(struct nsd *nsd)
 {
@@ -1854,25 +3859,60 @@ server_child(struct nsd *nsd)
 	region_type *server_region = region_create(xalloc, free);
 	struct event_base* event_base = nsd_child_event_base();
 	query_type *udp_query;
+	struct nsd_socket *udp_sockets = nsd->udp;
+	struct nsd_socket *tcp_sockets = nsd->tcp;
 	sig_atomic_t mode;
 
 	if(!event_base) {
 		log_msg(LOG_ERR, "nsd server could not create event base");
 		exit(1);
 	}
+#ifdef BIND8_STATS
+	memset(server_profile, 0, sizeof(server_profile));
+	server_profiling = (nsd->options->region_profile &&
+		region_set_profile(server_region, server_profile));
+#endif
 
 #ifdef RATELIMIT
-	rrl_init((nsd->this_child - nsd->children)/sizeof(nsd->children[0]));
+	rrl_init();
+	rrl_set_adaptive(nsd->options->rrl_adaptive);
+#ifdef BIND8_STATS
+	rrl_get_limits(&nsd->st.rrl_limit, &nsd->st.rrl_whitelist_limit);
 #endif
+#endif
+#ifdef NSEC3
+	nsec3_cache_init(nsd, nsd->options->nsec3_cache_size);
+#endif
+	/* the rotation of round-robin would be frozen by the cache */
+	if(nsd->options->answer_cache_size > 0 && !nsd->options->round_robin)
+		nsd->anscache = anscache_create(server_region,
+			nsd->options->answer_cache_size);
+	if(nsd->options->axfr_cache_size > 0)
+		nsd->axfrcache = axfrcache_create(server_region,
+			nsd->options->axfr_cache_size);
 
 	assert(nsd->server_kind != NSD_SERVER_MAIN);
 	DEBUG(DEBUG_IPC, 2, (LOG_INFO, "child process started"));
 
 	if (!(nsd->server_kind & NSD_SERVER_TCP)) {
+		server_close_reuseport_tcp(nsd, NULL);
 		server_close_all_sockets(nsd->tcp, nsd->ifs);
+	} else if (nsd->this_child && nsd->this_child->tcp) {
+		/* accept on our own reuseport sockets */
+		tcp_sockets = nsd->this_child->tcp;
+		if(!nsd->server_threads)
+			server_close_reuseport_tcp(nsd, tcp_sockets);
 	}
 	if (!(nsd->server_kind & NSD_SERVER_UDP)) {
+		server_close_reuseport_sockets(nsd, NULL);
 		server_close_all_sockets(nsd->udp, nsd->ifs);
+	} else if (nsd->this_child && nsd->this_child->udp) {
+		/* serve our own reuseport sockets, the other children
+		 * serve theirs */
+		udp_sockets = nsd->this_child->udp;
+		/* the threads of the process serve the others */
+		if(!nsd->server_threads)
+			server_close_reuseport_sockets(nsd, udp_sockets);
 	}
 
 	if (nsd->this_child && nsd->this_child->parent_fd != -1) {
@@ -1891,18 +3931,24 @@ server_child(struct nsd *nsd)
 			log_msg(LOG_ERR, "nsd ipcchild: event_base_set failed");
 		if(event_add(handler, NULL) != 0)
 			log_msg(LOG_ERR, "nsd ipcchild: event_add failed");
+		parent_cmd_handler = handler;
 	}
 
 	if (nsd->server_kind & NSD_SERVER_UDP) {
-#if (defined(NONBLOCKING_IS_BROKEN) || !defined(HAVE_RECVMMSG))
-		udp_query = query_create(server_region,
-			compressed_dname_offsets, compression_table_size);
+#if (defined(NONBLOCKING_IS_BROKEN) || (!defined(HAVE_RECVMMSG) && !defined(HAVE_SENDMMSG)))
+		udp_query = query_create(server_region);
 #else
 		udp_query = NULL;
-		memset(msgs, 0, sizeof(msgs));
-		for (i = 0; i < NUM_RECV_PER_SELECT; i++) {
-			queries[i] = query_create(server_region,
-				compressed_dname_offsets, compression_table_size);
+		udp_batch_size = nsd->options->udp_batch_size;
+		msgs = (struct mmsghdr*)region_alloc_array(server_region,
+			udp_batch_size, sizeof(*msgs));
+		iovecs = (struct iovec*)region_alloc_array(server_region,
+			udp_batch_size, sizeof(*iovecs));
+		queries = (struct query**)region_alloc_array(server_region,
+			udp_batch_size, sizeof(*queries));
+		memset(msgs, 0, sizeof(*msgs)*udp_batch_size);
+		for (i = 0; i < udp_batch_size; i++) {
+			queries[i] = query_create(server_region);
 			query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
 			iovecs[i].iov_base          = buffer_begin(queries[i]->packet);
 			iovecs[i].iov_len           = buffer_remaining(queries[i]->packet);;
@@ -1911,27 +3957,75 @@ server_child(struct nsd *nsd)
 			msgs[i].msg_hdr.msg_name    = &queries[i]->addr;
 			msgs[i].msg_hdr.msg_namelen = queries[i]->addrlen;
 		}
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+		udp_cmsg_space = 0;
+#  ifdef UDP_GRO
+		if (nsd->options->udp_gro) {
+			udp_cmsg_space += UDP_GRO_CMSG_SPACE;
+			udp_gro_query = query_create(server_region);
+		}
+#  endif
+#  ifdef UDP_WILDCARD
+		if (nsd->udp_wild_keys)
+			udp_cmsg_space += UDP_PKTINFO_CMSG_SPACE;
+#  endif
+#  ifdef UDP_RXQ_OVFL_CMSG_SPACE
+		if (nsd->options->udp_drop_stats)
+			udp_cmsg_space += UDP_RXQ_OVFL_CMSG_SPACE;
+#  endif
+		if (udp_cmsg_space) {
+			udp_cmsgs = (uint8_t*)region_alloc_array(
+				server_region, udp_batch_size, udp_cmsg_space);
+			for (i = 0; i < udp_batch_size; i++) {
+				msgs[i].msg_hdr.msg_control = udp_cmsgs +
+					i*udp_cmsg_space;
+				msgs[i].msg_hdr.msg_controllen =
+					udp_cmsg_space;
+			}
+		}
+#  ifdef UDP_SEGMENT
+		udp_gso = nsd->options->udp_gso;
+#  endif
+#  ifdef HAVE_BUILTIN_PREFETCH
+		if (nsd->options->udp_prefetch)
+			udp_prefetch = (struct domain_prefetch*)region_alloc_array(
+				server_region, udp_batch_size,
+				sizeof(*udp_prefetch));
+#  endif
+#endif /* HAVE_RECVMMSG && HAVE_SENDMMSG */
 #endif
+		udp_handlers = (struct event*) region_alloc_array(
+			server_region, nsd->ifs, sizeof(*udp_handlers));
 		for (i = 0; i < nsd->ifs; ++i) {
 			struct udp_handler_data *data;
 			struct event *handler;
 
+			if (udp_sockets[i].s == -1) {
+				/* it uses the wildcard socket of another
+				 * ip-address, or its family is not there */
+				memset(&udp_handlers[i], 0,
+					sizeof(udp_handlers[i]));
+				continue;
+			}
 			data = (struct udp_handler_data *) region_alloc(
 				server_region,
 				sizeof(struct udp_handler_data));
 			data->query = udp_query;
 			data->nsd = nsd;
-			data->socket = &nsd->udp[i];
+			data->socket = &udp_sockets[i];
 
-			handler = (struct event*) region_alloc(
-				server_region, sizeof(*handler));
-			event_set(handler, nsd->udp[i].s, EV_PERSIST|EV_READ,
+			handler = &udp_handlers[i];
+			event_set(handler, udp_sockets[i].s, EV_PERSIST|EV_READ,
 				handle_udp, data);
 			if(event_base_set(event_base, handler) != 0)
 				log_msg(LOG_ERR, "nsd udp: event_base_set failed");
 			if(event_add(handler, NULL) != 0)
 				log_msg(LOG_ERR, "nsd udp: event_add failed");
 		}
+#ifdef USE_XDP
+		if(nsd->xdp && nsd->this_child)
+			server_xdp_start(nsd, server_region, event_base);
+#endif
 	}
 
 	/*
@@ -1944,13 +4038,15 @@ server_child(struct nsd *nsd)
 		region_alloc_array(server_region,
 		nsd->ifs, sizeof(*tcp_accept_handlers));
 	if (nsd->server_kind & NSD_SERVER_TCP) {
+		tcp_handler_fill(nsd->maximum_tcp_count);
 		for (i = 0; i < nsd->ifs; ++i) {
 			struct event *handler = &tcp_accept_handlers[i].event;
 			struct tcp_accept_handler_data* data =
 				&tcp_accept_handlers[i];
 			data->nsd = nsd;
-			data->socket = &nsd->tcp[i];
-			event_set(handler, nsd->tcp[i].s, EV_PERSIST|EV_READ,
+			data->socket = &tcp_sockets[i];
+			data->tls = server_tls_socket(nsd, &tcp_sockets[i]);
+			event_set(handler, tcp_sockets[i].s, EV_PERSIST|EV_READ,
 				handle_tcp_accept, data);
 			if(event_base_set(event_base, handler) != 0)
 				log_msg(LOG_ERR, "nsd tcp: event_base_set failed");
@@ -1960,6 +4056,10 @@ server_child(struct nsd *nsd)
 		}
 	} else tcp_accept_handler_count = 0;
 
+	if (nsd->server_kind & NSD_SERVER_XFR)
+		server_xfrout_start(nsd, event_base);
+	stall_start(event_base);
+
 	/* The main loop... */
 	while ((mode = nsd->mode) != NSD_QUIT) {
 		if(mode == NSD_RUN) nsd->mode = mode = server_signal_mode(nsd);
@@ -2001,6 +4101,21 @@ server_child(struct nsd *nsd)
 					break;
 				}
 			}
+			STALL_MARK(STALL_LOOP);
+#ifdef BIND8_STATS
+			/* publish the counters, for stats_noreset */
+			if(nsd->db->udb_read)
+				nsd->st.db_remap =
+					nsd->db->udb_read->remap_count;
+			if(server_profiling)
+				memcpy(nsd->st.mem_tag, server_profile,
+					sizeof(nsd->st.mem_tag));
+			if(nsd->stat_slot)
+				memcpy(nsd->stat_slot, &nsd->st, sizeof(nsd->st));
+#endif
+			/* the last TCP connection of the old server is done */
+			if(server_draining && nsd->current_tcp_count == 0)
+				ipc_child_quit(nsd);
 		} else if(mode == NSD_QUIT) {
 			/* ignore here, quit */
 		} else {
@@ -2021,18 +4136,378 @@ server_child(struct nsd *nsd)
 	server_shutdown(nsd);
 }
 
+#if defined(BIND8_STATS) && defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN)
+/* account the latency of the first count queries, that were sent */
+static void
+udp_latency(struct nsd* nsd, int count)
+{
+	uint64_t now = latency_clock();
+	int i;
+	for(i=0; i<count; i++) {
+		if(queries[i]->lat_start)
+			query_latency(nsd, queries[i], now);
+	}
+}
+#endif /* BIND8_STATS && HAVE_SENDMMSG && !NONBLOCKING_IS_BROKEN */
+
 #if defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG)
+#ifdef UDP_RXQ_OVFL_CMSG_SPACE
+/* double the receive buffer of the UDP socket, up to udp-rcvbuf-max */
+static void
+udp_rcvbuf_grow(struct nsd *nsd, int fd)
+{
+	int size;
+	socklen_t len = sizeof(size);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0)
+		return;
+	/* the kernel reports twice the size that was set, setting the
+	 * reported size doubles it */
+	if (size / 2 >= nsd->options->udp_rcvbuf_max)
+		return;
+	if (size > nsd->options->udp_rcvbuf_max)
+		size = nsd->options->udp_rcvbuf_max;
+#ifdef SO_RCVBUFFORCE
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+		sizeof(size)) < 0)
+#endif
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+		log_msg(LOG_ERR, "setsockopt(..., SO_RCVBUF, ...) failed: %s",
+			strerror(errno));
+		return;
+	}
+	VERBOSITY(1, (LOG_INFO, "queries dropped, the udp receive buffer "
+		"is grown to %d bytes", size));
+}
+
+/*
+ * The kernel dropped queries on the socket, drops is the total number
+ * for the socket.  The server that sees the new total first counts the
+ * increase, the others that read the socket do not.
+ */
+static void
+udp_rxq_drops(struct udp_handler_data *data, uint32_t drops)
+{
+	uint32_t* total = data->socket->rxq_drops;
+	uint32_t seen;
+	time_t now;
+
+	if (!total)
+		return;
+	seen = __atomic_load_n(total, __ATOMIC_RELAXED);
+	do {
+		if (drops <= seen)
+			return;
+	} while (!__atomic_compare_exchange_n(total, &seen, drops, 0,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#ifdef BIND8_STATS
+	data->nsd->st.rxq_drops += drops - seen;
+#endif
+
+	now = time(NULL);
+	if (now > udp_drop_last + 1)
+		udp_drop_run = now;
+	udp_drop_last = now;
+	if (now - udp_drop_run >= UDP_DROP_ALERT_SECS &&
+		now - udp_drop_alerted >= UDP_DROP_ALERT_INTERVAL) {
+		log_msg(LOG_WARNING, "the kernel dropped queries for %d "
+			"seconds, the server cannot keep up, %u dropped on the "
+			"socket", (int)(now - udp_drop_run), (unsigned)drops);
+		udp_drop_alerted = now;
+	}
+	if (data->nsd->options->udp_rcvbuf_max > 0 &&
+		now != udp_rcvbuf_grown) {
+		udp_rcvbuf_grown = now;
+		udp_rcvbuf_grow(data->nsd, data->socket->s);
+	}
+}
+#endif /* UDP_RXQ_OVFL_CMSG_SPACE */
+
+/*
+ * Read the control messages of the received datagram, returns the
+ * UDP_GRO segment size, or 0.  With udp-wildcard the destination of the
+ * query is checked, and is put in the control message as the source of
+ * the answer; returns -1 if the query is not for an ip-address.
+ */
+static int
+udp_recv_cmsgs(struct udp_handler_data *data, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	int size = 0;
+#ifdef UDP_WILDCARD
+	uint8_t key[UDP_WILD_KEY_LEN];
+	struct in_pktinfo pi4;
+#ifdef INET6
+	struct in6_pktinfo pi6;
+#endif
+	int family = 0;
+#endif
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+#ifdef UDP_GRO
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+			memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+#endif
+#ifdef UDP_RXQ_OVFL_CMSG_SPACE
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+			cmsg->cmsg_type == SO_RXQ_OVFL) {
+			uint32_t drops;
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+			udp_rxq_drops(data, drops);
+		}
+#endif
+#ifdef UDP_WILDCARD
+		if (cmsg->cmsg_level == IPPROTO_IP &&
+			cmsg->cmsg_type == IP_PKTINFO) {
+			memcpy(&pi4, CMSG_DATA(cmsg), sizeof(pi4));
+			family = AF_INET;
+		}
+#ifdef INET6
+		if (cmsg->cmsg_level == IPPROTO_IPV6 &&
+			cmsg->cmsg_type == IPV6_PKTINFO) {
+			memcpy(&pi6, CMSG_DATA(cmsg), sizeof(pi6));
+			family = AF_INET6;
+		}
+#endif
+#endif /* UDP_WILDCARD */
+	}
+	/* the received control messages are not sent with the answer */
+	msg->msg_controllen = 0;
+
+#ifdef UDP_WILDCARD
+	if (data->nsd->udp_wild_keys) {
+		struct sockaddr* sa = data->socket->addr->ai_addr;
+#ifdef INET6
+		if (family == AF_INET6) {
+			udp_wild_key(key, AF_INET6,
+				&((struct sockaddr_in6*)sa)->sin6_port,
+				&pi6.ipi6_addr);
+			if (!udp_wild_match(data->nsd, key))
+				return -1;
+			/* the interface stays, for link-local addresses */
+			msg->msg_controllen = CMSG_SPACE(sizeof(pi6));
+			cmsg = CMSG_FIRSTHDR(msg);
+			cmsg->cmsg_level = IPPROTO_IPV6;
+			cmsg->cmsg_type = IPV6_PKTINFO;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(pi6));
+			memcpy(CMSG_DATA(cmsg), &pi6, sizeof(pi6));
+		} else
+#endif
+		if (family == AF_INET) {
+			udp_wild_key(key, AF_INET,
+				&((struct sockaddr_in*)sa)->sin_port,
+				&pi4.ipi_addr);
+			if (!udp_wild_match(data->nsd, key))
+				return -1;
+			/* the route picks the interface for the address */
+			pi4.ipi_spec_dst = pi4.ipi_addr;
+			pi4.ipi_ifindex = 0;
+			msg->msg_controllen = CMSG_SPACE(sizeof(pi4));
+			cmsg = CMSG_FIRSTHDR(msg);
+			cmsg->cmsg_level = IPPROTO_IP;
+			cmsg->cmsg_type = IP_PKTINFO;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(pi4));
+			memcpy(CMSG_DATA(cmsg), &pi4, sizeof(pi4));
+		} else {
+			/* without the destination, the source is not known */
+			return -1;
+		}
+	}
+#else
+	(void)data;
+#endif /* UDP_WILDCARD */
+	return size;
+}
+
+#ifdef UDP_GRO
+/*
+ * The datagram holds more queries from the same client, that UDP_GRO
+ * has put together.  The queries after the first are answered one by
+ * one with sendmsg, from the source address in the control message of
+ * msg, before the first is answered in place.
+ */
+static void
+udp_gro_split(struct udp_handler_data *data, int fd, struct msghdr *msg,
+	struct query *q, int received, int size)
+{
+	struct query *sq = udp_gro_query;
+	socklen_t addrlen = msg->msg_namelen;
+	struct msghdr smsg;
+	struct iovec iov;
+	int off, len;
+
+	for (off = size; off < received; off += size) {
+		len = (received - off < size) ? received - off : size;
+		query_reset(sq, UDP_MAX_MESSAGE_LEN, 0);
+		memcpy(&sq->addr, &q->addr, addrlen);
+		sq->addrlen = addrlen;
+		buffer_write(sq->packet, buffer_at(q->packet, off), len);
+		buffer_flip(sq->packet);
+
+		/* Account... */
+		if (data->socket->addr->ai_family == AF_INET) {
+			STATUP(data->nsd, qudp);
+		} else if (data->socket->addr->ai_family == AF_INET6) {
+			STATUP(data->nsd, qudp6);
+		}
+
+		/* Process and answer the query... */
+		if (server_process_query_udp(data->nsd, sq) == QUERY_DISCARDED) {
+			STATUP(data->nsd, dropped);
+			ZTATUP(data->nsd, sq->zone, dropped);
+			continue;
+		}
+		if (RCODE(sq->packet) == RCODE_OK && !AA(sq->packet)) {
+			STATUP(data->nsd, nona);
+			ZTATUP(data->nsd, sq->zone, nona);
+		}
+		query_add_optional(sq, data->nsd);
+		buffer_flip(sq->packet);
+#ifdef BIND8_STATS
+		STATUP2(data->nsd, rcode, RCODE(sq->packet));
+		ZTATUP2(data->nsd, sq->zone, rcode, RCODE(sq->packet));
+		if (TC(sq->packet)) {
+			STATUP(data->nsd, truncated);
+			ZTATUP(data->nsd, sq->zone, truncated);
+		}
+#endif /* BIND8_STATS */
+		iov.iov_base = buffer_begin(sq->packet);
+		iov.iov_len = buffer_remaining(sq->packet);
+		memset(&smsg, 0, sizeof(smsg));
+		smsg.msg_name = &sq->addr;
+		smsg.msg_namelen = sq->addrlen;
+		smsg.msg_iov = &iov;
+		smsg.msg_iovlen = 1;
+		if (msg->msg_controllen > 0) {
+			smsg.msg_control = msg->msg_control;
+			smsg.msg_controllen = msg->msg_controllen;
+		}
+		if (sendmsg(fd, &smsg, 0) == -1) {
+			log_msg(LOG_ERR, "sendmsg failed: %s", strerror(errno));
+			STATUP(data->nsd, txerr);
+		}
+	}
+}
+#endif /* UDP_GRO */
+
+#ifdef UDP_SEGMENT
+/*
+ * The number of answers from i on, to the same client and of the same
+ * size, that can be sent as one UDP_SEGMENT datagram.
+ */
+static int
+udp_gso_run(int i, int count)
+{
+	size_t len = iovecs[i].iov_len;
+	socklen_t alen = msgs[i].msg_hdr.msg_namelen;
+	size_t clen = msgs[i].msg_hdr.msg_controllen;
+	int n = 1;
+	if (len > UDP_GSO_MAX_SIZE)
+		return 1;
+	while (i+n < count && n < UDP_GSO_MAX_SEGS &&
+		iovecs[i+n].iov_len == len &&
+		msgs[i+n].msg_hdr.msg_namelen == alen &&
+		memcmp(&queries[i]->addr, &queries[i+n]->addr, alen) == 0 &&
+		msgs[i+n].msg_hdr.msg_controllen == clen &&
+		(clen == 0 || memcmp(msgs[i].msg_hdr.msg_control,
+		msgs[i+n].msg_hdr.msg_control, clen) == 0))
+		n++;
+	return n;
+}
+
+/*
+ * Send the n answers from i on with one sendmsg, the kernel splits them
+ * in datagrams of the UDP_SEGMENT size.  The iovecs of the answers are
+ * next to each other, so they are sent without a copy.  The source
+ * address for udp-wildcard follows the UDP_SEGMENT control message.
+ */
+static int
+udp_gso_send(int fd, int i, int n)
+{
+	struct msghdr msg = msgs[i].msg_hdr;
+	union {
+		struct cmsghdr hdr;
+		uint8_t buf[CMSG_SPACE(sizeof(uint16_t))
+#ifdef UDP_WILDCARD
+			+ UDP_PKTINFO_CMSG_SPACE
+#endif
+			];
+	} control;
+	struct cmsghdr *cmsg;
+	uint16_t size = (uint16_t)iovecs[i].iov_len;
+
+	assert(msg.msg_iov == &iovecs[i]);
+	memset(&control, 0, sizeof(control));
+	msg.msg_iovlen = n;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(size));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(size));
+	memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+#ifdef UDP_WILDCARD
+	if (msgs[i].msg_hdr.msg_controllen > 0) {
+		assert(msgs[i].msg_hdr.msg_controllen <= UDP_PKTINFO_CMSG_SPACE);
+		memcpy(control.buf + CMSG_SPACE(sizeof(size)),
+			msgs[i].msg_hdr.msg_control,
+			msgs[i].msg_hdr.msg_controllen);
+		msg.msg_controllen += msgs[i].msg_hdr.msg_controllen;
+	}
+#endif
+	return (sendmsg(fd, &msg, 0) == -1) ? -1 : 0;
+}
+#endif /* UDP_SEGMENT */
+
+#ifdef HAVE_BUILTIN_PREFETCH
+/*
+ * Prefetch the lookups of the query names of the batch.  The lookups
+ * are stepped together, one level at a time, so that the cache misses
+ * of the queries overlap, instead of one after the other when every
+ * query is answered in turn.  The answers find the names in the cache.
+ */
+static void
+udp_prefetch_batch(struct nsd *nsd, int count)
+{
+	domain_table_type *table = nsd->db->domains;
+	int i, step, active = 0;
+
+	for (i = 0; i < count; i++) {
+		int len = (int)msgs[i].msg_len;
+		if (len > QHEADERSZ && domain_table_prefetch_start(table,
+			&udp_prefetch[i], buffer_at(queries[i]->packet,
+			QHEADERSZ), len - QHEADERSZ))
+			active = 1;
+		else	udp_prefetch[i].active = 0;
+	}
+	for (step = 0; active && step < UDP_PREFETCH_STEPS; step++) {
+		active = 0;
+		for (i = 0; i < count; i++) {
+			if (udp_prefetch[i].active &&
+				domain_table_prefetch_step(table,
+				&udp_prefetch[i]))
+				active = 1;
+		}
+	}
+}
+#endif /* HAVE_BUILTIN_PREFETCH */
+
 static void
 handle_udp(int fd, short event, void* arg)
 {
 	struct udp_handler_data *data = (struct udp_handler_data *) arg;
-	int received, sent, recvcount, i;
+	int received, sent, recvcount, i, batch, rounds = 0;
 	struct query *q;
+#ifdef BIND8_STATS
+	uint64_t lat = 0;
+#endif
 
 	if (!(event & EV_READ)) {
 		return;
 	}
-	recvcount = recvmmsg(fd, msgs, NUM_RECV_PER_SELECT, 0, NULL);
+	STALL_MARK(STALL_UDP);
+next_batch:
+	recvcount = recvmmsg(fd, msgs, udp_batch_size, 0, NULL);
 	/* this printf strangely gave a performance increase on Linux */
 	/* printf("recvcount %d \n", recvcount); */
 	if (recvcount == -1) {
@@ -2044,6 +4519,17 @@ handle_udp(int fd, short event, void* arg)
 		/* Simply no data available */
 		return;
 	}
+	batch = recvcount;
+	udp_overload_batch(data->nsd, batch);
+#ifdef BIND8_STATS
+	/* one clock read for the batch, they were received together */
+	if (data->nsd->options->latency_stats)
+		lat = latency_clock();
+#endif
+#ifdef HAVE_BUILTIN_PREFETCH
+	if (udp_prefetch && recvcount > 1)
+		udp_prefetch_batch(data->nsd, recvcount);
+#endif
 	for (i = 0; i < recvcount; i++) {
 	loopstart:
 		received = msgs[i].msg_len;
@@ -2057,6 +4543,22 @@ handle_udp(int fd, short event, void* arg)
 			iovecs[i].iov_len = buffer_remaining(q->packet);
 			goto swap_drop;
 		}
+		if (udp_cmsgs) {
+			int size = udp_recv_cmsgs(data, &msgs[i].msg_hdr);
+			if (size == -1) {
+				/* not to one of the ip-addresses */
+				query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
+				iovecs[i].iov_len = buffer_remaining(q->packet);
+				goto swap_drop;
+			}
+#ifdef UDP_GRO
+			if (size > 0 && received > size) {
+				udp_gro_split(data, fd, &msgs[i].msg_hdr, q,
+					received, size);
+				received = size;
+			}
+#endif /* UDP_GRO */
+		}
 
 		/* Account... */
 #ifdef BIND8_STATS
@@ -2065,10 +4567,15 @@ handle_udp(int fd, short event, void* arg)
 		} else if (data->socket->addr->ai_family == AF_INET6) {
 			STATUP(data->nsd, qudp6);
 		}
+		q->lat_start = lat;
 #endif
 
 		buffer_skip(q->packet, received);
 		buffer_flip(q->packet);
+#ifdef USE_DNSTAP
+		if (data->nsd->dt_ring)
+			dt_query(data->nsd, q);
+#endif
 
 		/* Process and answer the query... */
 		if (server_process_query_udp(data->nsd, q) != QUERY_DISCARDED) {
@@ -2090,6 +4597,10 @@ handle_udp(int fd, short event, void* arg)
 
 			buffer_flip(q->packet);
 			iovecs[i].iov_len = buffer_remaining(q->packet);
+#ifdef USE_DNSTAP
+			if (q->dnstap)
+				dt_response(data->nsd, q);
+#endif
 #ifdef BIND8_STATS
 			/* Account the rcode & TC... */
 			STATUP2(data->nsd, rcode, RCODE(q->packet));
@@ -2125,27 +4636,194 @@ handle_udp(int fd, short event, void* arg)
 
 	/* send until all are sent */
 	i = 0;
-	while(i<recvcount) {
-		sent = sendmmsg(fd, &msgs[i], recvcount-i, 0);
+	while(i<recvcount) {
+		int n = recvcount-i;
+#ifdef UDP_SEGMENT
+		if(udp_gso) {
+			int j = udp_gso_run(i, recvcount);
+			if(j > 1) {
+				if(udp_gso_send(fd, i, j) == 0) {
+					i += j;
+					continue;
+				}
+				if(errno == EINVAL || errno == EIO
+#ifdef ENOPROTOOPT
+					|| errno == ENOPROTOOPT
+#endif
+					) {
+					/* not supported here, stop trying */
+					log_msg(LOG_ERR, "sendmsg with UDP_SEGMENT "
+						"failed: %s, udp-gso turned off",
+						strerror(errno));
+					udp_gso = 0;
+				}
+				n = j;
+			} else {
+				/* send up to the next run of answers */
+				for(j = i+1; j<recvcount &&
+					udp_gso_run(j, recvcount) == 1; j++)
+					;
+				n = j-i;
+			}
+		}
+#endif /* UDP_SEGMENT */
+		sent = sendmmsg(fd, &msgs[i], n, 0);
+		if(sent == -1) {
+			const char* es = strerror(errno);
+			char a[48];
+			addr2str(&queries[i]->addr, a, sizeof(a));
+			log_msg(LOG_ERR, "sendmmsg [0]=%s count=%d failed: %s", a, (int)(recvcount-i), es);
+#ifdef BIND8_STATS
+			data->nsd->st.txerr += recvcount-i;
+#endif /* BIND8_STATS */
+			break;
+		}
+		i += sent;
+	}
+#ifdef BIND8_STATS
+	if (lat)
+		udp_latency(data->nsd, i);
+#endif
+	for(i=0; i<recvcount; i++) {
+		query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
+		iovecs[i].iov_len = buffer_remaining(queries[i]->packet);
+	}
+	/* room for the control messages of the next receive, also for the
+	 * dropped queries after recvcount */
+	if (udp_cmsgs) {
+		for(i=0; i<batch; i++)
+			msgs[i].msg_hdr.msg_controllen = udp_cmsg_space;
+	}
+
+	/*
+	 * A full batch means more queries are waiting, and with busy-poll
+	 * the socket is read while queries keep arriving, without a trip
+	 * through the event loop.  The rounds are limited, so that the
+	 * other sockets are served too.
+	 */
+	if (++rounds < UDP_BATCH_ROUNDS && (batch == udp_batch_size ||
+		data->nsd->options->udp_busy_poll > 0))
+		goto next_batch;
+}
+
+#elif defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN)
+/*
+ * No recvmmsg, but sendmmsg is available.  The queries are received one
+ * by one, the answers are collected and sent with a single sendmmsg.
+ */
+static void
+handle_udp(int fd, short event, void* arg)
+{
+	struct udp_handler_data *data = (struct udp_handler_data *) arg;
+	int received, sent, count = 0, i;
+	struct query *q;
+
+	if (!(event & EV_READ)) {
+		return;
+	}
+	STALL_MARK(STALL_UDP);
+	while (count < udp_batch_size) {
+		q = queries[count];
+		query_reset(q, UDP_MAX_MESSAGE_LEN, 0);
+		received = recvfrom(fd,
+				    buffer_begin(q->packet),
+				    buffer_remaining(q->packet),
+				    0,
+				    (struct sockaddr *)&q->addr,
+				    &q->addrlen);
+		if (received == -1) {
+			if (errno != EAGAIN && errno != EINTR) {
+				log_msg(LOG_ERR, "recvfrom failed: %s", strerror(errno));
+				STATUP(data->nsd, rxerr);
+				/* No zone statup */
+			}
+			break;
+		}
+
+		/* Account... */
+		if (data->socket->addr->ai_family == AF_INET) {
+			STATUP(data->nsd, qudp);
+		} else if (data->socket->addr->ai_family == AF_INET6) {
+			STATUP(data->nsd, qudp6);
+		}
+#ifdef BIND8_STATS
+		if (data->nsd->options->latency_stats)
+			q->lat_start = latency_clock();
+#endif
+
+		buffer_skip(q->packet, received);
+		buffer_flip(q->packet);
+#ifdef USE_DNSTAP
+		if (data->nsd->dt_ring)
+			dt_query(data->nsd, q);
+#endif
+
+		/* Process and answer the query... */
+		if (server_process_query_udp(data->nsd, q) == QUERY_DISCARDED) {
+			/* the slot is used again for the next query */
+			STATUP(data->nsd, dropped);
+			ZTATUP(data->nsd, q->zone, dropped);
+			continue;
+		}
+		if (RCODE(q->packet) == RCODE_OK && !AA(q->packet)) {
+			STATUP(data->nsd, nona);
+			ZTATUP(data->nsd, q->zone, nona);
+		}
+
+#ifdef USE_ZONE_STATS
+		if (data->socket->addr->ai_family == AF_INET) {
+			ZTATUP(data->nsd, q->zone, qudp);
+		} else if (data->socket->addr->ai_family == AF_INET6) {
+			ZTATUP(data->nsd, q->zone, qudp6);
+		}
+#endif
+
+		/* Add EDNS0 and TSIG info if necessary.  */
+		query_add_optional(q, data->nsd);
+
+		buffer_flip(q->packet);
+		iovecs[count].iov_len = buffer_remaining(q->packet);
+		msgs[count].msg_hdr.msg_namelen = q->addrlen;
+#ifdef USE_DNSTAP
+		if (q->dnstap)
+			dt_response(data->nsd, q);
+#endif
+#ifdef BIND8_STATS
+		/* Account the rcode & TC... */
+		STATUP2(data->nsd, rcode, RCODE(q->packet));
+		ZTATUP2(data->nsd, q->zone, rcode, RCODE(q->packet));
+		if (TC(q->packet)) {
+			STATUP(data->nsd, truncated);
+			ZTATUP(data->nsd, q->zone, truncated);
+		}
+#endif /* BIND8_STATS */
+		count++;
+	}
+
+	udp_overload_batch(data->nsd, count);
+	/* send until all are sent */
+	i = 0;
+	while(i<count) {
+		sent = sendmmsg(fd, &msgs[i], count-i, 0);
 		if(sent == -1) {
 			const char* es = strerror(errno);
 			char a[48];
 			addr2str(&queries[i]->addr, a, sizeof(a));
-			log_msg(LOG_ERR, "sendmmsg [0]=%s count=%d failed: %s", a, (int)(recvcount-i), es);
+			log_msg(LOG_ERR, "sendmmsg [0]=%s count=%d failed: %s", a, (int)(count-i), es);
 #ifdef BIND8_STATS
-			data->nsd->st.txerr += recvcount-i;
+			data->nsd->st.txerr += count-i;
 #endif /* BIND8_STATS */
 			break;
 		}
 		i += sent;
 	}
-	for(i=0; i<recvcount; i++) {
-		query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
-		iovecs[i].iov_len = buffer_remaining(queries[i]->packet);
-	}
+#ifdef BIND8_STATS
+	if (data->nsd->options->latency_stats)
+		udp_latency(data->nsd, i);
+#endif
 }
 
-#else /* defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG) */
+#else /* defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN) */
 
 static void
 handle_udp(int fd, short event, void* arg)
@@ -2166,9 +4844,10 @@ handle_udp(int fd, short event, void* arg)
 	if (!(event & EV_READ)) {
 		return;
 	}
+	STALL_MARK(STALL_UDP);
 #ifndef NONBLOCKING_IS_BROKEN
 #ifdef HAVE_RECVMMSG
-	recvcount = recvmmsg(fd, msgs, NUM_RECV_PER_SELECT, 0, NULL);
+	recvcount = recvmmsg(fd, msgs, udp_batch_size, 0, NULL);
 	/* this printf strangely gave a performance increase on Linux */
 	/* printf("recvcount %d \n", recvcount); */
 	if (recvcount == -1) {
@@ -2180,6 +4859,7 @@ handle_udp(int fd, short event, void* arg)
 		/* Simply no data available */
 		return;
 	}
+	udp_overload_batch(data->nsd, recvcount);
 	for (i = 0; i < recvcount; i++) {
 		received = msgs[i].msg_len;
 		msgs[i].msg_hdr.msg_namelen = queries[i]->addrlen;
@@ -2193,7 +4873,7 @@ handle_udp(int fd, short event, void* arg)
 		}
 		q = queries[i];
 #else
-	for(i=0; i<NUM_RECV_PER_SELECT; i++) {
+	for(i=0; i<udp_batch_size; i++) {
 #endif /* HAVE_RECVMMSG */
 #endif /* NONBLOCKING_IS_BROKEN */
 
@@ -2223,9 +4903,17 @@ handle_udp(int fd, short event, void* arg)
 		} else if (data->socket->addr->ai_family == AF_INET6) {
 			STATUP(data->nsd, qudp6);
 		}
+#ifdef BIND8_STATS
+		if (data->nsd->options->latency_stats)
+			q->lat_start = latency_clock();
+#endif
 
 		buffer_skip(q->packet, received);
 		buffer_flip(q->packet);
+#ifdef USE_DNSTAP
+		if (data->nsd->dt_ring)
+			dt_query(data->nsd, q);
+#endif
 
 		/* Process and answer the query... */
 		if (server_process_query_udp(data->nsd, q) != QUERY_DISCARDED) {
@@ -2246,6 +4934,10 @@ handle_udp(int fd, short event, void* arg)
 			query_add_optional(q, data->nsd);
 
 			buffer_flip(q->packet);
+#ifdef USE_DNSTAP
+			if (q->dnstap)
+				dt_response(data->nsd, q);
+#endif
 
 			sent = sendto(fd,
 				      buffer_begin(q->packet),
@@ -2271,6 +4963,9 @@ handle_udp(int fd, short event, void* arg)
 					STATUP(data->nsd, truncated);
 					ZTATUP(data->nsd, q->zone, truncated);
 				}
+				if (q->lat_start)
+					query_latency(data->nsd, q,
+						latency_clock());
 #endif /* BIND8_STATS */
 			}
 		} else {
@@ -2284,44 +4979,502 @@ handle_udp(int fd, short event, void* arg)
 	}
 #endif
 }
-#endif /* defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG) */
+#endif /* defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN) */
+
+
+/* create a handler with its region and query, for a TCP connection */
+static struct tcp_handler_data*
+tcp_handler_create(void)
+{
+	region_type* tcp_region = region_create(xalloc, free);
+	struct tcp_handler_data* tcp_data;
+	(void)region_set_tag(tcp_region, REGION_TAG_TCP);
+#ifdef BIND8_STATS
+	if(server_profiling)
+		(void)region_set_profile(tcp_region, server_profile);
+#endif
+	tcp_data = (struct tcp_handler_data *)
+		region_alloc(tcp_region, sizeof(struct tcp_handler_data));
+	tcp_data->region = tcp_region;
+	tcp_data->query = query_create(tcp_region);
+	tcp_data->in = buffer_create(tcp_region, TCP_READ_BUFFER_SIZE);
+	tcp_data->out = buffer_create(tcp_region, TCP_WRITE_BUFFER_SIZE);
+	return tcp_data;
+}
+
+/* put handlers on the free list until it has num */
+static void
+tcp_handler_fill(int num)
+{
+	while(tcp_handler_free_count < num) {
+		struct tcp_handler_data* tcp_data = tcp_handler_create();
+		tcp_data->next_free = tcp_handler_free;
+		tcp_handler_free = tcp_data;
+		tcp_handler_free_count++;
+	}
+}
+
+/* take the connection out of the list of open connections */
+static void
+tcp_lru_remove(struct tcp_handler_data* data)
+{
+	if(data->lru_prev)
+		data->lru_prev->lru_next = data->lru_next;
+	else	tcp_lru_first = data->lru_next;
+	if(data->lru_next)
+		data->lru_next->lru_prev = data->lru_prev;
+	else	tcp_lru_last = data->lru_prev;
+	data->lru_prev = NULL;
+	data->lru_next = NULL;
+}
+
+/* put the connection first in the list of open connections */
+static void
+tcp_lru_front(struct tcp_handler_data* data)
+{
+	data->lru_prev = NULL;
+	data->lru_next = tcp_lru_first;
+	if(tcp_lru_first)
+		tcp_lru_first->lru_prev = data;
+	else	tcp_lru_last = data;
+	tcp_lru_first = data;
+}
+
+/* mark the connection idle, waiting for a next query, or busy */
+static void
+tcp_set_idle(struct tcp_handler_data* data, int idle)
+{
+	if(idle) {
+		tcp_lru_remove(data);
+		tcp_lru_front(data);
+		if(!data->idle)
+			tcp_idle_count++;
+		data->idle = 1;
+		/* a new connection can take the place of this one */
+		if(tcp_accept_full && !slowaccept) {
+			configure_handler_event_types(EV_READ|EV_PERSIST);
+			tcp_accept_full = 0;
+		}
+	} else if(data->idle) {
+		tcp_idle_count--;
+		data->idle = 0;
+	}
+}
 
+/*
+ * The timeout for a connection that waits for a query, the one that
+ * edns-tcp-keepalive advertises.
+ */
+static void
+tcp_idle_timeout(struct nsd* nsd, struct timeval* tv)
+{
+	long msec = query_tcp_idle_msec(nsd);
+	tv->tv_sec = msec / 1000;
+	tv->tv_usec = (msec % 1000) * 1000;
+}
 
 static void
 cleanup_tcp_handler(struct tcp_handler_data* data)
 {
 	event_del(&data->event);
+#ifdef HAVE_SSL
+	if(data->tls) {
+		/* best effort close_notify, the socket does not block */
+		if(data->shake_state == tls_hs_none)
+			(void)SSL_shutdown(data->tls);
+		SSL_free(data->tls);
+		data->tls = NULL;
+	}
+#endif
 	close(data->event.ev_fd);
+	tcp_set_idle(data, 0);
+	tcp_lru_remove(data);
 
 	/*
 	 * Enable the TCP accept handlers when the current number of
 	 * TCP connections is about to drop below the maximum number
 	 * of TCP connections.
 	 */
-	if (slowaccept || data->nsd->current_tcp_count == data->nsd->maximum_tcp_count) {
+	if (slowaccept || tcp_accept_full) {
 		configure_handler_event_types(EV_READ|EV_PERSIST);
 		slowaccept = 0;
+		tcp_accept_full = 0;
 	}
 	--data->nsd->current_tcp_count;
 	assert(data->nsd->current_tcp_count >= 0);
+	if (data->query_state == QUERY_IN_AXFR) {
+		tcp_axfr_count--;
+		/* an incomplete stream cannot be sent to others */
+		if(data->nsd->axfrcache)
+			axfrcache_abort(data->nsd->axfrcache, data->query);
+	}
 
+	if(tcp_handler_free_count < data->nsd->maximum_tcp_count) {
+		data->next_free = tcp_handler_free;
+		tcp_handler_free = data;
+		tcp_handler_free_count++;
+		return;
+	}
 	region_destroy(data->region);
 }
 
+#ifdef HAVE_SSL
+/* install the read or write event for the TCP connection */
+static void
+tcp_handler_set_event(struct tcp_handler_data* data, int fd, short bits,
+	void (*cb)(int, short, void*))
+{
+	struct timeval timeout;
+	struct event_base* ev_base = data->event.ev_base;
+	if((bits&EV_READ))
+		tcp_idle_timeout(data->nsd, &timeout);
+	else {
+		timeout.tv_sec = data->nsd->tcp_timeout;
+		timeout.tv_usec = 0L;
+	}
+	event_del(&data->event);
+	event_set(&data->event, fd, EV_PERSIST | bits | EV_TIMEOUT, cb, data);
+	if(event_base_set(ev_base, &data->event) != 0)
+		log_msg(LOG_ERR, "event base set tcp failed");
+	if(event_add(&data->event, &timeout) != 0)
+		log_msg(LOG_ERR, "event add tcp failed");
+}
+
+/*
+ * Continue the TLS handshake.  Returns 1 when it is done, 0 if it waits
+ * for the socket, and -1 if it failed and the connection is cleaned up.
+ */
+static int
+tls_handshake(struct tcp_handler_data* data, int fd)
+{
+	int r;
+	ERR_clear_error();
+	if((r = SSL_do_handshake(data->tls)) == 1) {
+		data->shake_state = tls_hs_none;
+		return 1;
+	}
+	switch(SSL_get_error(data->tls, r)) {
+	case SSL_ERROR_WANT_READ:
+		if(data->shake_state != tls_hs_read)
+			tcp_handler_set_event(data, fd, EV_READ,
+				handle_tcp_reading);
+		data->shake_state = tls_hs_read;
+		return 0;
+	case SSL_ERROR_WANT_WRITE:
+		if(data->shake_state != tls_hs_write)
+			tcp_handler_set_event(data, fd, EV_WRITE,
+				handle_tcp_writing);
+		data->shake_state = tls_hs_write;
+		return 0;
+	default:
+		if(verbosity >= 3)
+			log_crypto_err("tls handshake failed");
+		/* no close_notify for a failed handshake */
+		data->shake_state = tls_hs_read;
+		cleanup_tcp_handler(data);
+		return -1;
+	}
+}
+#endif /* HAVE_SSL */
+
+/*
+ * Read from the connection, like read(2).  For TLS, a read that waits
+ * for the socket to become writable installs the write handler, and
+ * fails with EAGAIN.
+ */
+static ssize_t
+tcp_conn_read(struct tcp_handler_data* data, int fd, void* buf, size_t len)
+{
+#ifdef HAVE_SSL
+	if(data->tls) {
+		int r;
+		ERR_clear_error();
+		if((r = SSL_read(data->tls, buf, (int)len)) > 0)
+			return r;
+		switch(SSL_get_error(data->tls, r)) {
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+		case SSL_ERROR_WANT_READ:
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_WANT_WRITE:
+			data->shake_state = tls_hs_read_event;
+			tcp_handler_set_event(data, fd, EV_WRITE,
+				handle_tcp_writing);
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_SYSCALL:
+			if(r == 0)
+				return 0;
+			return -1;
+		default:
+			if(verbosity >= 3)
+				log_crypto_err("could not SSL_read");
+			errno = ECONNRESET;
+			return -1;
+		}
+	}
+#else
+	(void)data;
+#endif /* HAVE_SSL */
+	return read(fd, buf, len);
+}
+
+/*
+ * Write to the connection, like write(2).  For TLS, a write that waits
+ * for the socket to become readable installs the read handler, and
+ * fails with EAGAIN.
+ */
+static ssize_t
+tcp_conn_write(struct tcp_handler_data* data, int fd, const void* buf,
+	size_t len)
+{
+#ifdef HAVE_SSL
+	if(data->tls) {
+		int r;
+		ERR_clear_error();
+		if((r = SSL_write(data->tls, buf, (int)len)) > 0)
+			return r;
+		switch(SSL_get_error(data->tls, r)) {
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_WANT_READ:
+			data->shake_state = tls_hs_write_event;
+			tcp_handler_set_event(data, fd, EV_READ,
+				handle_tcp_reading);
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_SYSCALL:
+			if(r == 0)
+				errno = EPIPE;
+			return -1;
+		default:
+			if(verbosity >= 3)
+				log_crypto_err("could not SSL_write");
+			errno = EPIPE;
+			return -1;
+		}
+	}
+#else
+	(void)data;
+#endif /* HAVE_SSL */
+	return write(fd, buf, len);
+}
+
+/* see if the connection has read data that is not taken from it yet */
+static int
+tcp_conn_pending(struct tcp_handler_data* data)
+{
+#ifdef HAVE_SSL
+	if(data->tls)
+		return SSL_pending(data->tls) > 0;
+#else
+	(void)data;
+#endif
+	return 0;
+}
+
+/*
+ * Read from the TCP connection into the read buffer, that is empty.
+ * Returns 1 if data was read, 0 if the read would block or the other
+ * side closed while answers still have to be written, and -1 if the
+ * connection is closed and cleaned up.
+ */
+static int
+tcp_read_in(struct tcp_handler_data* data, int fd)
+{
+	ssize_t received;
+
+	buffer_clear(data->in);
+	received = tcp_conn_read(data, fd, buffer_begin(data->in),
+		buffer_capacity(data->in));
+	if (received <= 0)
+		buffer_set_limit(data->in, 0);
+	data->in_full = 0;
+	if (received == -1) {
+		if (errno == EAGAIN || errno == EINTR) {
+			/*
+			 * Read would block, wait until more
+			 * data is available.
+			 */
+			return 0;
+		} else {
+			char buf[48];
+			addr2str(&data->query->addr, buf, sizeof(buf));
+#ifdef ECONNRESET
+			if (verbosity >= 2 || errno != ECONNRESET)
+#endif /* ECONNRESET */
+			log_msg(LOG_ERR, "failed reading from %s tcp: %s", buf, strerror(errno));
+			cleanup_tcp_handler(data);
+			return -1;
+		}
+	} else if (received == 0) {
+		/* EOF, but write the answers first */
+		if (buffer_position(data->out) > 0)
+			return 0;
+		cleanup_tcp_handler(data);
+		return -1;
+	}
+	buffer_set_limit(data->in, (size_t)received);
+	data->in_full = ((size_t)received == buffer_capacity(data->in) ||
+		tcp_conn_pending(data));
+	return 1;
+}
+
+/*
+ * Cork the connection while an AXFR is written, so that the lengths and
+ * the messages go out in full TCP segments, and uncork it when the
+ * transfer is done, to send the rest.
+ */
+static void
+tcp_set_cork(struct tcp_handler_data* data, int fd, int on)
+{
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+	if (data->corked == on)
+		return;
+#ifdef TCP_CORK
+	if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == -1) {
+#else
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NOPUSH, &on, sizeof(on)) == -1) {
+#endif
+		VERBOSITY(3, (LOG_INFO, "setsockopt(..., TCP_CORK, ...) "
+			"failed: %s", strerror(errno)));
+		return;
+	}
+	data->corked = on;
+#else
+	(void)data;
+	(void)fd;
+	(void)on;
+#endif
+}
+
+/* see if the query that is read into the packet is an AXFR request */
+static int
+tcp_query_is_axfr(struct query* q)
+{
+	uint8_t* d = buffer_begin(q->packet);
+	size_t len = q->tcplen, i = QHEADERSZ;
+
+	if (len < QHEADERSZ + 5 || (d[2] & 0x80) ||
+		((d[2] >> 3) & 0x0f) != OPCODE_QUERY || read_uint16(d + 4) != 1)
+		return 0;
+	while (i < len && d[i] != 0) {
+		/* the qname is not compressed */
+		if ((d[i] & 0xc0))
+			return 0;
+		i += d[i] + 1;
+	}
+	i++;
+	return i + 4 <= len && read_uint16(d + i) == TYPE_AXFR;
+}
+
+/*
+ * Pass the connection, with the AXFR query that is read and what came
+ * after it, to an xfr-out worker.  Returns 1 if a worker took it, the
+ * connection is cleaned up here then, or 0 if this server answers it:
+ * for TLS, when answers are not written yet, or the workers are busy.
+ */
+static int
+tcp_xfrout_handoff(struct tcp_handler_data* data, int fd)
+{
+	struct nsd* nsd = data->nsd;
+	struct query* q = data->query;
+	struct xfrout_handoff h;
+	uint16_t tcplen = htons(q->tcplen);
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg;
+	struct iovec iov[4];
+	struct cmsghdr* cmsg;
+	size_t i, w;
+
+#ifdef HAVE_SSL
+	if (data->tls)
+		return 0;
+#endif
+	if (buffer_position(data->out) > 0)
+		return 0;
+	if (sizeof(tcplen) + q->tcplen + buffer_remaining(data->in) >
+		TCP_READ_BUFFER_SIZE)
+		return 0;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(&h.addr, &q->addr, q->addrlen);
+	h.addrlen = q->addrlen;
+	h.len = sizeof(tcplen) + q->tcplen + buffer_remaining(data->in);
+	iov[0].iov_base = &h;
+	iov[0].iov_len = sizeof(h);
+	iov[1].iov_base = &tcplen;
+	iov[1].iov_len = sizeof(tcplen);
+	iov[2].iov_base = buffer_begin(q->packet);
+	iov[2].iov_len = q->tcplen;
+	iov[3].iov_base = buffer_current(data->in);
+	iov[3].iov_len = buffer_remaining(data->in);
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 4;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	for (i = 0; i < nsd->xfrout_count; i++) {
+		w = (xfrout_next + i) % nsd->xfrout_count;
+		if (sendmsg(nsd->xfrout_fd[w], &msg, 0) != -1) {
+			xfrout_next = w + 1;
+			cleanup_tcp_handler(data);
+			return 1;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR
+			&& errno != ENOBUFS)
+			log_msg(LOG_ERR, "xfr-out: sendmsg to worker failed: %s",
+				strerror(errno));
+	}
+	return 0;
+}
+
 static void
 handle_tcp_reading(int fd, short event, void* arg)
 {
 	struct tcp_handler_data *data = (struct tcp_handler_data *) arg;
-	ssize_t received;
 	struct event_base* ev_base;
 	struct timeval timeout;
+	int did_read = 0;
+	size_t n;
 
+	STALL_MARK(STALL_TCP_READ);
 	if ((event & EV_TIMEOUT)) {
 		/* Connection timed out.  */
 		cleanup_tcp_handler(data);
 		return;
 	}
 
+#ifdef HAVE_SSL
+	if (data->tls && data->shake_state != tls_hs_none) {
+		if (data->shake_state == tls_hs_write_event) {
+			/* the answers are written further */
+			data->shake_state = tls_hs_none;
+			tcp_handler_set_event(data, fd, EV_WRITE,
+				handle_tcp_writing);
+			handle_tcp_writing(fd, EV_WRITE, data);
+			return;
+		}
+		if (data->shake_state == tls_hs_read_event)
+			data->shake_state = tls_hs_none;
+		else if (tls_handshake(data, fd) != 1)
+			return;
+	}
+#endif /* HAVE_SSL */
+
 	if (data->nsd->tcp_query_count > 0 &&
 		data->query_count >= data->nsd->tcp_query_count) {
 		/* No more queries allowed on this tcp connection.  */
@@ -2330,174 +5483,206 @@ handle_tcp_reading(int fd, short event, void* arg)
 	}
 
 	assert((event & EV_READ));
-
-	if (data->bytes_transmitted == 0) {
-		query_reset(data->query, TCP_MAX_MESSAGE_LEN, 1);
-	}
+	tcp_set_idle(data, 0);
 
 	/*
-	 * Check if we received the leading packet length bytes yet.
+	 * Answer every complete query that is read.  The answers are
+	 * collected in the write buffer, and written together when no
+	 * more queries are available.
 	 */
-	if (data->bytes_transmitted < sizeof(uint16_t)) {
-		received = read(fd,
-				(char *) &data->query->tcplen
-				+ data->bytes_transmitted,
-				sizeof(uint16_t) - data->bytes_transmitted);
-		if (received == -1) {
-			if (errno == EAGAIN || errno == EINTR) {
-				/*
-				 * Read would block, wait until more
-				 * data is available.
-				 */
-				return;
-			} else {
-				char buf[48];
-				addr2str(&data->query->addr, buf, sizeof(buf));
-#ifdef ECONNRESET
-				if (verbosity >= 2 || errno != ECONNRESET)
-#endif /* ECONNRESET */
-				log_msg(LOG_ERR, "failed reading from %s tcp: %s", buf, strerror(errno));
-				cleanup_tcp_handler(data);
-				return;
-			}
-		} else if (received == 0) {
-			/* EOF */
-			cleanup_tcp_handler(data);
-			return;
+	for (;;) {
+		if (data->nsd->tcp_query_count > 0 &&
+			data->query_count >= data->nsd->tcp_query_count)
+			break;
+
+		if (data->bytes_transmitted == 0) {
+			query_reset(data->query, TCP_MAX_MESSAGE_LEN, 1);
 		}
 
-		data->bytes_transmitted += received;
-		if (data->bytes_transmitted < sizeof(uint16_t)) {
+		if (buffer_remaining(data->in) == 0) {
+			int r;
 			/*
-			 * Not done with the tcplen yet, wait for more
-			 * data to become available.
+			 * A short read has emptied the socket buffer, do
+			 * not read again until the answers are written.
 			 */
-			return;
+			if (did_read && !data->in_full)
+				break;
+			if ((r = tcp_read_in(data, fd)) == -1)
+				return;
+			if (r == 0)
+				break;
+			did_read = 1;
 		}
 
-		assert(data->bytes_transmitted == sizeof(uint16_t));
-
-		data->query->tcplen = ntohs(data->query->tcplen);
-
 		/*
-		 * Minimum query size is:
-		 *
-		 *     Size of the header (12)
-		 *   + Root domain name   (1)
-		 *   + Query class        (2)
-		 *   + Query type         (2)
+		 * Check if we received the leading packet length bytes yet.
 		 */
-		if (data->query->tcplen < QHEADERSZ + 1 + sizeof(uint16_t) + sizeof(uint16_t)) {
-			VERBOSITY(2, (LOG_WARNING, "packet too small, dropping tcp connection"));
-			cleanup_tcp_handler(data);
-			return;
-		}
+		if (data->bytes_transmitted < sizeof(uint16_t)) {
+			while (data->bytes_transmitted < sizeof(uint16_t) &&
+				buffer_remaining(data->in) > 0) {
+				((uint8_t*)&data->query->tcplen)
+					[data->bytes_transmitted++] =
+					buffer_read_u8(data->in);
+			}
+			if (data->bytes_transmitted < sizeof(uint16_t)) {
+				/*
+				 * Not done with the tcplen yet, wait for more
+				 * data to become available.
+				 */
+				continue;
+			}
 
-		if (data->query->tcplen > data->query->maxlen) {
-			VERBOSITY(2, (LOG_WARNING, "insufficient tcp buffer, dropping connection"));
-			cleanup_tcp_handler(data);
-			return;
-		}
+			data->query->tcplen = ntohs(data->query->tcplen);
 
-		buffer_set_limit(data->query->packet, data->query->tcplen);
-	}
+			/*
+			 * Minimum query size is:
+			 *
+			 *     Size of the header (12)
+			 *   + Root domain name   (1)
+			 *   + Query class        (2)
+			 *   + Query type         (2)
+			 */
+			if (data->query->tcplen < QHEADERSZ + 1 + sizeof(uint16_t) + sizeof(uint16_t)) {
+				VERBOSITY(2, (LOG_WARNING, "packet too small, dropping tcp connection"));
+				cleanup_tcp_handler(data);
+				return;
+			}
 
-	assert(buffer_remaining(data->query->packet) > 0);
+			if (data->query->tcplen > data->query->maxlen) {
+				VERBOSITY(2, (LOG_WARNING, "insufficient tcp buffer, dropping connection"));
+				cleanup_tcp_handler(data);
+				return;
+			}
 
-	/* Read the (remaining) query data.  */
-	received = read(fd,
-			buffer_current(data->query->packet),
-			buffer_remaining(data->query->packet));
-	if (received == -1) {
-		if (errno == EAGAIN || errno == EINTR) {
+			buffer_set_limit(data->query->packet, data->query->tcplen);
+		}
+
+		/* Take the (remaining) query data from the read buffer.  */
+		n = buffer_remaining(data->query->packet);
+		if (n > buffer_remaining(data->in))
+			n = buffer_remaining(data->in);
+		buffer_write(data->query->packet, buffer_current(data->in), n);
+		buffer_skip(data->in, n);
+		data->bytes_transmitted += n;
+		if (buffer_remaining(data->query->packet) > 0) {
 			/*
-			 * Read would block, wait until more data is
-			 * available.
+			 * Message not yet complete, wait for more data to
+			 * become available.
 			 */
-			return;
-		} else {
-			char buf[48];
-			addr2str(&data->query->addr, buf, sizeof(buf));
-#ifdef ECONNRESET
-			if (verbosity >= 2 || errno != ECONNRESET)
-#endif /* ECONNRESET */
-			log_msg(LOG_ERR, "failed reading from %s tcp: %s", buf, strerror(errno));
-			cleanup_tcp_handler(data);
-			return;
+			continue;
 		}
-	} else if (received == 0) {
-		/* EOF */
-		cleanup_tcp_handler(data);
-		return;
-	}
 
-	data->bytes_transmitted += received;
-	buffer_skip(data->query->packet, received);
-	if (buffer_remaining(data->query->packet) > 0) {
-		/*
-		 * Message not yet complete, wait for more data to
-		 * become available.
-		 */
-		return;
-	}
+		assert(buffer_position(data->query->packet) == data->query->tcplen);
 
-	assert(buffer_position(data->query->packet) == data->query->tcplen);
+		/* the xfr-out workers send the zone transfers */
+		if (data->nsd->xfrout_count > 0 &&
+			!(data->nsd->server_kind & NSD_SERVER_XFR) &&
+			tcp_query_is_axfr(data->query) &&
+			tcp_xfrout_handoff(data, fd))
+			return;
 
-	/* Account... */
+		/* Account... */
 #ifdef BIND8_STATS
 #ifndef INET6
-	STATUP(data->nsd, ctcp);
-#else
-	if (data->query->addr.ss_family == AF_INET) {
 		STATUP(data->nsd, ctcp);
-	} else if (data->query->addr.ss_family == AF_INET6) {
-		STATUP(data->nsd, ctcp6);
-	}
+#else
+		if (data->query->addr.ss_family == AF_INET) {
+			STATUP(data->nsd, ctcp);
+		} else if (data->query->addr.ss_family == AF_INET6) {
+			STATUP(data->nsd, ctcp6);
+		}
 #endif
 #endif /* BIND8_STATS */
 
-	/* We have a complete query, process it.  */
+		/* We have a complete query, process it.  */
 
-	/* tcp-query-count: handle query counter ++ */
-	data->query_count++;
+		/* tcp-query-count: handle query counter ++ */
+		data->query_count++;
 
-	buffer_flip(data->query->packet);
-	data->query_state = server_process_query(data->nsd, data->query);
-	if (data->query_state == QUERY_DISCARDED) {
-		/* Drop the packet and the entire connection... */
-		STATUP(data->nsd, dropped);
-		ZTATUP(data->nsd, data->query->zone, dropped);
-		cleanup_tcp_handler(data);
-		return;
-	}
+		buffer_flip(data->query->packet);
+#ifdef BIND8_STATS
+		if (data->nsd->options->latency_stats)
+			data->query->lat_start = latency_clock();
+#endif
+#ifdef USE_DNSTAP
+		if (data->nsd->dt_ring)
+			dt_query(data->nsd, data->query);
+#endif
+		data->query_state = server_process_query(data->nsd, data->query);
+		if (data->query_state == QUERY_DISCARDED) {
+			/* Drop the packet and the entire connection... */
+			STATUP(data->nsd, dropped);
+			ZTATUP(data->nsd, data->query->zone, dropped);
+			cleanup_tcp_handler(data);
+			return;
+		}
+		if (data->query_state == QUERY_IN_AXFR) {
+			tcp_axfr_count++;
+			tcp_set_cork(data, fd, 1);
+		}
 
 #ifdef BIND8_STATS
-	if (RCODE(data->query->packet) == RCODE_OK
-	    && !AA(data->query->packet))
-	{
-		STATUP(data->nsd, nona);
-		ZTATUP(data->nsd, data->query->zone, nona);
-	}
+		if (RCODE(data->query->packet) == RCODE_OK
+		    && !AA(data->query->packet))
+		{
+			STATUP(data->nsd, nona);
+			ZTATUP(data->nsd, data->query->zone, nona);
+		}
 #endif /* BIND8_STATS */
 
 #ifdef USE_ZONE_STATS
 #ifndef INET6
-	ZTATUP(data->nsd, data->query->zone, ctcp);
-#else
-	if (data->query->addr.ss_family == AF_INET) {
 		ZTATUP(data->nsd, data->query->zone, ctcp);
-	} else if (data->query->addr.ss_family == AF_INET6) {
-		ZTATUP(data->nsd, data->query->zone, ctcp6);
-	}
+#else
+		if (data->query->addr.ss_family == AF_INET) {
+			ZTATUP(data->nsd, data->query->zone, ctcp);
+		} else if (data->query->addr.ss_family == AF_INET6) {
+			ZTATUP(data->nsd, data->query->zone, ctcp6);
+		}
 #endif
 #endif /* USE_ZONE_STATS */
 
-	query_add_optional(data->query, data->nsd);
+		query_add_optional(data->query, data->nsd);
+
+		/* Collect the answer in the write buffer.  */
+		buffer_flip(data->query->packet);
+		data->query->tcplen = buffer_remaining(data->query->packet);
+		data->bytes_transmitted = 0;
+#ifdef USE_DNSTAP
+		if (data->query->dnstap)
+			dt_response(data->nsd, data->query);
+#endif
+#ifdef BIND8_STATS
+		/* the answer is done, the write is shared with the others,
+		 * an AXFR is accounted when the last packet is made */
+		if (data->query->lat_start &&
+			data->query_state != QUERY_IN_AXFR)
+			query_latency(data->nsd, data->query, latency_clock());
+#endif
+		if (data->query_state == QUERY_IN_AXFR ||
+			buffer_remaining(data->out) < sizeof(uint16_t)
+			+ data->query->tcplen) {
+			/*
+			 * Write it from the query packet, after the
+			 * answers that are collected already.
+			 */
+			data->write_packet = 1;
+			break;
+		}
+		buffer_write_u16(data->out, data->query->tcplen);
+		buffer_write(data->out, buffer_begin(data->query->packet),
+			data->query->tcplen);
+	}
+
+	if (buffer_position(data->out) == 0 && !data->write_packet) {
+		/* Nothing to write, wait for more data.  */
+		if (data->bytes_transmitted == 0 && data->query_count > 0)
+			tcp_set_idle(data, 1);
+		return;
+	}
 
 	/* Switch to the tcp write handler.  */
-	buffer_flip(data->query->packet);
-	data->query->tcplen = buffer_remaining(data->query->packet);
-	data->bytes_transmitted = 0;
+	buffer_flip(data->out);
 
 	timeout.tv_sec = data->nsd->tcp_timeout;
 	timeout.tv_usec = 0L;
@@ -2514,6 +5699,71 @@ handle_tcp_reading(int fd, short event, void* arg)
 	handle_tcp_writing(fd, EV_WRITE, data);
 }
 
+/* the paced packet of the zone transfer may be written now */
+static void
+handle_tcp_paced(int fd, short event, void* arg)
+{
+	struct tcp_handler_data* data = (struct tcp_handler_data*)arg;
+	struct event_base* ev_base = data->event.ev_base;
+	struct timeval timeout;
+
+	(void)event;
+	timeout.tv_sec = data->nsd->tcp_timeout;
+	timeout.tv_usec = 0L;
+	event_del(&data->event);
+	event_set(&data->event, fd, EV_PERSIST | EV_WRITE | EV_TIMEOUT,
+		handle_tcp_writing, data);
+	if(event_base_set(ev_base, &data->event) != 0)
+		log_msg(LOG_ERR, "event base set tcpw failed");
+	if(event_add(&data->event, &timeout) != 0)
+		log_msg(LOG_ERR, "event add tcpw failed");
+	handle_tcp_writing(fd, EV_WRITE, data);
+}
+
+/*
+ * Count the next packet of the zone transfer against the xfr-out-rate,
+ * the transfers of the worker share it.  Returns 0 if the packet can be
+ * written now, or 1 if the connection waits until it may be written.
+ */
+static int
+tcp_xfrout_pace(struct tcp_handler_data* data, int fd)
+{
+	int64_t burst = (int64_t)(xfrout_rate / XFROUT_BURST_DIV), usec;
+	struct event_base* ev_base;
+	struct timeval now, tv;
+
+	if (burst < XFROUT_BURST_MIN)
+		burst = XFROUT_BURST_MIN;
+	if (gettimeofday(&now, NULL) == -1)
+		return 0;
+	usec = (int64_t)(now.tv_sec - xfrout_last.tv_sec) * 1000000 +
+		(now.tv_usec - xfrout_last.tv_usec);
+	if (usec < 0)
+		usec = 0;
+	else if (usec > 1000000)
+		usec = 1000000;
+	xfrout_last = now;
+	xfrout_tokens += (int64_t)xfrout_rate * usec / 1000000;
+	if (xfrout_tokens > burst)
+		xfrout_tokens = burst;
+	xfrout_tokens -= (int64_t)(data->query->tcplen + sizeof(uint16_t));
+	if (xfrout_tokens >= 0)
+		return 0;
+
+	/* wait until the tokens are back */
+	usec = -xfrout_tokens * 1000000 / (int64_t)xfrout_rate + 1;
+	tv.tv_sec = usec / 1000000;
+	tv.tv_usec = usec % 1000000;
+	ev_base = data->event.ev_base;
+	event_del(&data->event);
+	event_set(&data->event, fd, EV_TIMEOUT, handle_tcp_paced, data);
+	if(event_base_set(ev_base, &data->event) != 0)
+		log_msg(LOG_ERR, "event base set tcp paced failed");
+	if(event_add(&data->event, &tv) != 0)
+		log_msg(LOG_ERR, "event add tcp paced failed");
+	return 1;
+}
+
 static void
 handle_tcp_writing(int fd, short event, void* arg)
 {
@@ -2522,7 +5772,9 @@ handle_tcp_writing(int fd, short event, void* arg)
 	struct query *q = data->query;
 	struct timeval timeout;
 	struct event_base* ev_base;
+	int batch = 0;
 
+	STALL_MARK(STALL_TCP_WRITE);
 	if ((event & EV_TIMEOUT)) {
 		/* Connection timed out.  */
 		cleanup_tcp_handler(data);
@@ -2531,16 +5783,86 @@ handle_tcp_writing(int fd, short event, void* arg)
 
 	assert((event & EV_WRITE));
 
+#ifdef HAVE_SSL
+	if (data->tls && data->shake_state != tls_hs_none) {
+		if (data->shake_state != tls_hs_read_event) {
+			/* the handshake is done, wait for the queries */
+			if (tls_handshake(data, fd) != 1)
+				return;
+			tcp_handler_set_event(data, fd, EV_READ,
+				handle_tcp_reading);
+			handle_tcp_reading(fd, EV_READ, data);
+			return;
+		}
+		/* the read that waited for this event can continue */
+		data->shake_state = tls_hs_none;
+		if (buffer_remaining(data->out) == 0 && !data->write_packet) {
+			tcp_handler_set_event(data, fd, EV_READ,
+				handle_tcp_reading);
+			handle_tcp_reading(fd, EV_READ, data);
+			return;
+		}
+	}
+#endif /* HAVE_SSL */
+
+	if (buffer_remaining(data->out) > 0) {
+		/* Writing the collected answers.  */
+		sent = tcp_conn_write(data, fd, buffer_current(data->out),
+			buffer_remaining(data->out));
+		if (sent == -1) {
+			if (errno == EAGAIN || errno == EINTR) {
+				/*
+				 * Write would block, wait until
+				 * socket becomes writable again.
+				 */
+				return;
+			} else {
+#ifdef ECONNRESET
+				if(verbosity >= 2 || errno != ECONNRESET)
+#endif /* ECONNRESET */
+#ifdef EPIPE
+				  if(verbosity >= 2 || errno != EPIPE)
+#endif /* EPIPE 'broken pipe' */
+				    log_msg(LOG_ERR, "failed writing to tcp: %s", strerror(errno));
+				cleanup_tcp_handler(data);
+				return;
+			}
+		}
+		buffer_skip(data->out, sent);
+		if (buffer_remaining(data->out) > 0) {
+			/*
+			 * Writing not complete, wait until socket
+			 * becomes writable again.
+			 */
+			return;
+		}
+		buffer_clear(data->out);
+		if (!data->write_packet) {
+			/* the read of a next query may be partly done */
+			goto answers_written;
+		}
+	}
+
+next_packet:
 	if (data->bytes_transmitted < sizeof(q->tcplen)) {
 		/* Writing the response packet length.  */
 		uint16_t n_tcplen = htons(q->tcplen);
+#ifdef HAVE_SSL
+		if (data->tls)
+			sent = tcp_conn_write(data, fd,
+				(const char *) &n_tcplen + data->bytes_transmitted,
+				sizeof(n_tcplen) - data->bytes_transmitted);
+		else
+#endif /* HAVE_SSL */
 #ifdef HAVE_WRITEV
+		{
 		struct iovec iov[2];
 		iov[0].iov_base = (uint8_t*)&n_tcplen + data->bytes_transmitted;
 		iov[0].iov_len = sizeof(n_tcplen) - data->bytes_transmitted; 
 		iov[1].iov_base = buffer_begin(q->packet);
 		iov[1].iov_len = buffer_limit(q->packet);
 		sent = writev(fd, iov, 2);
+		}
 #else /* HAVE_WRITEV */
 		sent = write(fd,
 			     (const char *) &n_tcplen + data->bytes_transmitted,
@@ -2576,13 +5898,18 @@ handle_tcp_writing(int fd, short event, void* arg)
 		}
 
 #ifdef HAVE_WRITEV
+#ifdef HAVE_SSL
+		if (!data->tls)
+#endif
+		{
 		sent -= sizeof(n_tcplen);
 		/* handle potential 'packet done' code */
 		goto packet_could_be_done;
+		}
 #endif
  	}
  
-	sent = write(fd,
+	sent = tcp_conn_write(data, fd,
 		     buffer_current(q->packet),
 		     buffer_remaining(q->packet));
 	if (sent == -1) {
@@ -2621,9 +5948,25 @@ handle_tcp_writing(int fd, short event, void* arg)
 	assert(data->bytes_transmitted == q->tcplen + sizeof(q->tcplen));
 
 	if (data->query_state == QUERY_IN_AXFR) {
+#ifdef USE_ZONE_STATS
+		uint64_t start = data->nsd->options->zone_cpu_sample?
+			latency_clock():0;
+#endif
 		/* Continue processing AXFR and writing back results.  */
 		buffer_clear(q->packet);
 		data->query_state = query_axfr(data->nsd, q);
+#ifdef USE_ZONE_STATS
+		if(start)
+			zone_cpu_add(data->nsd, q, ZONESTAT_CPU_AXFR, start, 1);
+#endif
+		if (data->query_state != QUERY_IN_AXFR) {
+			tcp_axfr_count--;
+			tcp_set_cork(data, fd, 0);
+#ifdef BIND8_STATS
+			if (q->lat_start)
+				query_latency(data->nsd, q, latency_clock());
+#endif
+		}
 		if (data->query_state != QUERY_PROCESSED) {
 			query_add_optional(data->query, data->nsd);
 
@@ -2631,6 +5974,13 @@ handle_tcp_writing(int fd, short event, void* arg)
 			buffer_flip(q->packet);
 			q->tcplen = buffer_remaining(q->packet);
 			data->bytes_transmitted = 0;
+			/* the xfr-out worker paces the transfers */
+			if (xfrout_rate && tcp_xfrout_pace(data, fd))
+				return;
+			/* write the next messages now, while the socket
+			 * takes them */
+			if (++batch < TCP_AXFR_WRITE_BATCH)
+				goto next_packet;
 			/* Reset timeout.  */
 			timeout.tv_sec = data->nsd->tcp_timeout;
 			timeout.tv_usec = 0L;
@@ -2651,20 +6001,26 @@ handle_tcp_writing(int fd, short event, void* arg)
 		}
 	}
 
+	data->write_packet = 0;
+	data->bytes_transmitted = 0;
+
+answers_written:
 	/*
 	 * Done sending, wait for the next request to arrive on the
 	 * TCP socket by installing the TCP read handler.
 	 */
-	if (data->nsd->tcp_query_count > 0 &&
-		data->query_count >= data->nsd->tcp_query_count) {
+	if ((data->nsd->tcp_query_count > 0 &&
+		data->query_count >= data->nsd->tcp_query_count) ||
+		server_draining) {
 
+#ifdef HAVE_SSL
+		if (data->tls)
+			(void)SSL_shutdown(data->tls);
+#endif
 		(void) shutdown(fd, SHUT_WR);
 	}
 
-	data->bytes_transmitted = 0;
-
-	timeout.tv_sec = data->nsd->tcp_timeout;
-	timeout.tv_usec = 0L;
+	tcp_idle_timeout(data->nsd, &timeout);
 	ev_base = data->event.ev_base;
 	event_del(&data->event);
 	event_set(&data->event, fd, EV_PERSIST | EV_READ | EV_TIMEOUT,
@@ -2673,6 +6029,11 @@ handle_tcp_writing(int fd, short event, void* arg)
 		log_msg(LOG_ERR, "event base set tcpw failed");
 	if(event_add(&data->event, &timeout) != 0)
 		log_msg(LOG_ERR, "event add tcpw failed");
+	/* answer the queries that are in the read buffer already */
+	if (buffer_remaining(data->in) > 0 || tcp_conn_pending(data))
+		handle_tcp_reading(fd, EV_READ, data);
+	else if (data->bytes_transmitted == 0)
+		tcp_set_idle(data, 1);
 }
 
 
@@ -2686,38 +6047,201 @@ handle_slowaccept_timeout(int ATTR_UNUSED(fd), short ATTR_UNUSED(event),
 	}
 }
 
+static void
+handle_drain_timeout(int ATTR_UNUSED(fd), short ATTR_UNUSED(event),
+	void* arg)
+{
+	struct nsd* nsd = (struct nsd*)arg;
+	VERBOSITY(3, (LOG_INFO, "drain timeout, close %d tcp connections",
+		nsd->current_tcp_count));
+	ipc_child_quit(nsd);
+}
+
+void
+server_child_drain(struct nsd* nsd)
+{
+	struct tcp_handler_data* p, *prev;
+	struct timeval tv;
+	size_t i;
+#ifdef USE_XDP
+	/* the new server binds to the xdp queues of this one */
+	if(nsd->xdp) {
+		ipc_child_quit(nsd);
+		return;
+	}
+#endif
+	/* the parent has closed the channel, and the new servers read the
+	 * UDP sockets and accept the TCP connections */
+	if(parent_cmd_handler)
+		event_del(parent_cmd_handler);
+	for(i = 0; udp_handlers && i < nsd->ifs; i++)
+		event_del(&udp_handlers[i]);
+	if(slowaccept) {
+		event_del(&slowaccept_event);
+		slowaccept = 0;
+	}
+	if(nsd->server_kind & NSD_SERVER_XFR)
+		event_del(&xfrout_event);
+	configure_handler_event_types(0);
+	server_draining = 1;
+
+	/* close the idle connections, the others after their answer */
+	for(p = tcp_lru_last; p; p = prev) {
+		prev = p->lru_prev;
+		if(p->idle)
+			cleanup_tcp_handler(p);
+	}
+	if(nsd->current_tcp_count == 0 || !parent_cmd_handler) {
+		ipc_child_quit(nsd);
+		return;
+	}
+	VERBOSITY(3, (LOG_INFO, "server drains %d tcp connections",
+		nsd->current_tcp_count));
+	tv.tv_sec = nsd->tcp_timeout;
+	tv.tv_usec = 0;
+	event_set(&drain_timeout_event, -1, EV_TIMEOUT, handle_drain_timeout,
+		nsd);
+	if(event_base_set(parent_cmd_handler->ev_base, &drain_timeout_event)
+		!= 0)
+		log_msg(LOG_ERR, "nsd drain: event_base_set failed");
+	if(event_add(&drain_timeout_event, &tv) != 0)
+		log_msg(LOG_ERR, "nsd drain: event_add failed");
+}
+
+/* close the connection that is idle longest, returns 0 if none is idle */
+static int
+tcp_evict_idle(void)
+{
+	struct tcp_handler_data* p;
+	for(p = tcp_lru_last; p; p = p->lru_prev) {
+		if(p->idle) {
+			VERBOSITY(3, (LOG_INFO, "tcp connections full, "
+				"close the longest idle connection"));
+			cleanup_tcp_handler(p);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Set up the handler of a new TCP connection on socket s, that reads
+ * its queries.  Returns NULL if that failed, s is closed then.
+ */
+static struct tcp_handler_data*
+tcp_conn_create(struct nsd* nsd, struct event_base* base, int s, int tls,
+	void* addr, socklen_t addrlen)
+{
+	struct tcp_handler_data *tcp_data;
+	region_type *tcp_region;
+	struct timeval timeout;
+
+	/*
+	 * This region is deallocated when the TCP connection is
+	 * closed by the TCP handler, or kept with the handler for reuse.
+	 */
+	if(tcp_handler_free) {
+		tcp_data = tcp_handler_free;
+		tcp_handler_free = tcp_data->next_free;
+		tcp_handler_free_count--;
+		tcp_region = tcp_data->region;
+	} else {
+		tcp_data = tcp_handler_create();
+		tcp_region = tcp_data->region;
+	}
+	tcp_data->next_free = NULL;
+	tcp_data->nsd = nsd;
+	tcp_data->query_count = 0;
+
+	tcp_data->query_state = QUERY_PROCESSED;
+	tcp_data->bytes_transmitted = 0;
+	buffer_clear(tcp_data->in);
+	buffer_set_limit(tcp_data->in, 0);
+	tcp_data->in_full = 0;
+	buffer_clear(tcp_data->out);
+	tcp_data->write_packet = 0;
+	tcp_data->corked = 0;
+	tcp_data->idle = 0;
+#ifdef HAVE_SSL
+	tcp_data->tls = NULL;
+	tcp_data->shake_state = tls_hs_none;
+	if (tls) {
+		if (!(tcp_data->tls = SSL_new((SSL_CTX*)nsd->tls_ctx))) {
+			log_crypto_err("could not SSL_new");
+			close(s);
+			region_destroy(tcp_region);
+			return NULL;
+		}
+		if (!SSL_set_fd(tcp_data->tls, s)) {
+			log_crypto_err("could not SSL_set_fd");
+			SSL_free(tcp_data->tls);
+			close(s);
+			region_destroy(tcp_region);
+			return NULL;
+		}
+		SSL_set_accept_state(tcp_data->tls);
+		tcp_data->shake_state = tls_hs_read;
+	}
+#else
+	(void)tls;
+#endif /* HAVE_SSL */
+	memcpy(&tcp_data->query->addr, addr, addrlen);
+	tcp_data->query->addrlen = addrlen;
+
+	tcp_idle_timeout(nsd, &timeout);
+
+	event_set(&tcp_data->event, s, EV_PERSIST | EV_READ | EV_TIMEOUT,
+		handle_tcp_reading, tcp_data);
+	if(event_base_set(base, &tcp_data->event) != 0) {
+		log_msg(LOG_ERR, "cannot set tcp event base");
+		close(s);
+		region_destroy(tcp_region);
+		return NULL;
+	}
+	if(event_add(&tcp_data->event, &timeout) != 0) {
+		log_msg(LOG_ERR, "cannot add tcp to event base");
+		close(s);
+		region_destroy(tcp_region);
+		return NULL;
+	}
+
+	tcp_lru_front(tcp_data);
+
+	++nsd->current_tcp_count;
+	return tcp_data;
+}
+
 /*
  * Handle an incoming TCP connection.  The connection is accepted and
  * a new TCP reader event handler is added.  The TCP handler
  * is responsible for cleanup when the connection is closed.
+ * Returns 0 if there was no connection to accept, or no more may be
+ * accepted now.
  */
-static void
-handle_tcp_accept(int fd, short event, void* arg)
+static int
+tcp_accept_one(struct tcp_accept_handler_data *data, int fd)
 {
-	struct tcp_accept_handler_data *data
-		= (struct tcp_accept_handler_data *) arg;
 	int s;
-	struct tcp_handler_data *tcp_data;
-	region_type *tcp_region;
 #ifdef INET6
 	struct sockaddr_storage addr;
 #else
 	struct sockaddr_in addr;
 #endif
 	socklen_t addrlen;
-	struct timeval timeout;
-
-	if (!(event & EV_READ)) {
-		return;
-	}
 
 	if (data->nsd->current_tcp_count >= data->nsd->maximum_tcp_count) {
-		return;
+		/* make room, close the connection that is idle longest */
+		if (!tcp_evict_idle())
+			return 0;
 	}
 
 	/* Accept it... */
 	addrlen = sizeof(addr);
+#ifdef HAVE_ACCEPT4
+	s = accept4(fd, (struct sockaddr *) &addr, &addrlen, SOCK_NONBLOCK);
+#else
 	s = accept(fd, (struct sockaddr *) &addr, &addrlen);
+#endif
 	if (s == -1) {
 		/**
 		 * EMFILE and ENFILE is a signal that the limit of open
@@ -2751,59 +6275,132 @@ handle_tcp_accept(int fd, short event, void* arg)
 			) {
 			log_msg(LOG_ERR, "accept failed: %s", strerror(errno));
 		}
-		return;
+		return 0;
 	}
 
+#ifndef HAVE_ACCEPT4
 	if (fcntl(s, F_SETFL, O_NONBLOCK) == -1) {
 		log_msg(LOG_ERR, "fcntl failed: %s", strerror(errno));
 		close(s);
-		return;
+		return 0;
 	}
+#endif
+
+	if (!tcp_conn_create(data->nsd, data->event.ev_base, s, data->tls,
+		&addr, addrlen))
+		return 0;
 
 	/*
-	 * This region is deallocated when the TCP connection is
-	 * closed by the TCP handler.
+	 * Stop accepting connections when the maximum number of
+	 * simultaneous TCP connections is reached, and no idle
+	 * connection can make room.
 	 */
-	tcp_region = region_create(xalloc, free);
-	tcp_data = (struct tcp_handler_data *) region_alloc(
-		tcp_region, sizeof(struct tcp_handler_data));
-	tcp_data->region = tcp_region;
-	tcp_data->query = query_create(tcp_region, compressed_dname_offsets,
-		compression_table_size);
-	tcp_data->nsd = data->nsd;
-	tcp_data->query_count = 0;
-
-	tcp_data->query_state = QUERY_PROCESSED;
-	tcp_data->bytes_transmitted = 0;
-	memcpy(&tcp_data->query->addr, &addr, addrlen);
-	tcp_data->query->addrlen = addrlen;
+	if (data->nsd->current_tcp_count == data->nsd->maximum_tcp_count &&
+		tcp_idle_count == 0) {
+		configure_handler_event_types(0);
+		tcp_accept_full = 1;
+		return 0;
+	}
+	return 1;
+}
 
-	timeout.tv_sec = data->nsd->tcp_timeout;
-	timeout.tv_usec = 0;
+static void
+handle_tcp_accept(int fd, short event, void* arg)
+{
+	struct tcp_accept_handler_data *data
+		= (struct tcp_accept_handler_data *) arg;
+	int i;
 
-	event_set(&tcp_data->event, s, EV_PERSIST | EV_READ | EV_TIMEOUT,
-		handle_tcp_reading, tcp_data);
-	if(event_base_set(data->event.ev_base, &tcp_data->event) != 0) {
-		log_msg(LOG_ERR, "cannot set tcp event base");
-		close(s);
-		region_destroy(tcp_region);
+	if (!(event & EV_READ)) {
 		return;
 	}
-	if(event_add(&tcp_data->event, &timeout) != 0) {
-		log_msg(LOG_ERR, "cannot add tcp to event base");
-		close(s);
-		region_destroy(tcp_region);
+
+	/* Accept the waiting connections, up to a batch per event.  */
+	for (i = 0; i < TCP_ACCEPT_BATCH; i++) {
+		if (!tcp_accept_one(data, fd))
+			break;
+	}
+}
+
+/*
+ * Handle the AXFR connections that the servers pass to the xfr-out
+ * worker.  The query that the server read is put in the buffer of the
+ * connection, and the transfer starts as if it was read here.
+ */
+static void
+handle_xfrout(int fd, short event, void* arg)
+{
+	struct nsd* nsd = (struct nsd*)arg;
+	struct tcp_handler_data* data;
+	struct xfrout_handoff h;
+	uint8_t buf[TCP_READ_BUFFER_SIZE];
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg;
+	struct iovec iov[2];
+	struct cmsghdr* cmsg;
+	ssize_t r;
+	int i, s;
+
+	if (!(event & EV_READ)) {
 		return;
 	}
 
-	/*
-	 * Keep track of the total number of TCP handlers installed so
-	 * we can stop accepting connections when the maximum number
-	 * of simultaneous TCP connections is reached.
-	 */
-	++data->nsd->current_tcp_count;
-	if (data->nsd->current_tcp_count == data->nsd->maximum_tcp_count) {
-		configure_handler_event_types(0);
+	for (i = 0; i < TCP_ACCEPT_BATCH; i++) {
+		memset(&msg, 0, sizeof(msg));
+		iov[0].iov_base = &h;
+		iov[0].iov_len = sizeof(h);
+		iov[1].iov_base = buf;
+		iov[1].iov_len = sizeof(buf);
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		r = recvmsg(fd, &msg, 0);
+		if (r == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR)
+				log_msg(LOG_ERR, "xfr-out: recvmsg failed: %s",
+					strerror(errno));
+			return;
+		}
+		s = -1;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+				cmsg->cmsg_type == SCM_RIGHTS &&
+				cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))
+				memcpy(&s, CMSG_DATA(cmsg), sizeof(int));
+		}
+		if (s == -1) {
+			log_msg(LOG_ERR, "xfr-out: handoff without connection");
+			continue;
+		}
+		if ((size_t)r < sizeof(h) || (msg.msg_flags &
+			(MSG_TRUNC|MSG_CTRUNC)) || h.len != (size_t)r - sizeof(h) ||
+			h.addrlen > sizeof(h.addr)) {
+			log_msg(LOG_ERR, "xfr-out: bad connection handoff");
+			close(s);
+			continue;
+		}
+		if (nsd->current_tcp_count >= nsd->maximum_tcp_count &&
+			!tcp_evict_idle()) {
+			VERBOSITY(2, (LOG_WARNING, "xfr-out: tcp connections "
+				"full, AXFR connection closed"));
+			close(s);
+			continue;
+		}
+		data = tcp_conn_create(nsd, xfrout_event.ev_base, s, 0,
+			&h.addr, h.addrlen);
+		if (!data)
+			continue;
+		buffer_clear(data->in);
+		buffer_write(data->in, buf, h.len);
+		buffer_flip(data->in);
+		data->in_full = 1;
+		handle_tcp_reading(s, EV_READ, data);
 	}
 }
 
@@ -2849,6 +6446,13 @@ send_children_quit_and_wait(struct nsd* nsd)
 	send_children_command(nsd, NSD_QUIT_CHILD, 3);
 }
 
+static void
+send_children_drain(struct nsd* nsd)
+{
+	DEBUG(DEBUG_IPC, 1, (LOG_INFO, "send children drain"));
+	send_children_command(nsd, NSD_QUIT_DRAIN, 0);
+}
+
 #ifdef BIND8_STATS
 static void
 set_children_stats(struct nsd* nsd)
@@ -2868,6 +6472,10 @@ configure_handler_event_types(short event_types)
 {
 	size_t i;
 
+	/* a draining server accepts no connections, also not when its
+	 * connections drop below the maximum */
+	if(event_types && server_draining)
+		return;
 	for (i = 0; i < tcp_accept_handler_count; ++i) {
 		struct event* handler = &tcp_accept_handlers[i].event;
 		if(event_types) {
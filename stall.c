@@ -0,0 +1,250 @@
+/*
+ * stall.c -- event loop lag and stalls of the server processes.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * With stall-monitor the server processes time their UDP and TCP
+ * handlers, and a timer measures how late the event loop comes back to
+ * it.  A handler that runs longer than stall-monitor msec, the queries
+ * waiting on the server meanwhile, is counted per handler and logged.
+ * The timer is the heartbeat of the server in shared memory, main checks
+ * it and logs a server that is stuck while it is, with its handler.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+#endif
+#include <errno.h>
+#include <string.h>
+#ifndef USE_MINI_EVENT
+#  ifdef HAVE_EVENT_H
+#    include <event.h>
+#  else
+#    include <event2/event.h>
+#    include "event2/event_struct.h"
+#    include "event2/event_compat.h"
+#  endif
+#else
+#  include "mini_event.h"
+#endif
+#include "nsd.h"
+#include "stall.h"
+#include "options.h"
+#include "util.h"
+
+/* msec between the warnings of a server about its slow handlers */
+#define STALL_LOG_MSEC 10000
+/* bounds of the msec between the runs of the timer */
+#define STALL_TICK_MIN_MSEC 10
+#define STALL_TICK_MAX_MSEC 1000
+
+NSD_THREAD_LOCAL struct stall_beat* stall_beat = NULL;
+NSD_THREAD_LOCAL int stall_lagging = 0;
+static NSD_THREAD_LOCAL struct nsd* stall_nsd;
+/* nsec of stall-monitor, and between the runs of the timer */
+static NSD_THREAD_LOCAL uint64_t stall_threshold, stall_interval;
+/* the handler that runs, and since when */
+static NSD_THREAD_LOCAL int stall_handler;
+static NSD_THREAD_LOCAL uint64_t stall_since;
+/* when the timer should run, and the last warning */
+static NSD_THREAD_LOCAL uint64_t stall_due, stall_logged;
+static NSD_THREAD_LOCAL struct event stall_timer;
+static NSD_THREAD_LOCAL struct event_base* stall_base;
+
+static const char* stall_names[STALL_HANDLERS] = {
+	"event loop", "handle_udp", "handle_tcp_reading", "handle_tcp_writing"
+};
+
+/* nsec between the runs of the timer, half of stall-monitor */
+static uint64_t
+stall_tick(struct nsd* nsd)
+{
+	uint64_t msec = (uint64_t)nsd->options->stall_monitor / 2;
+	if(msec < STALL_TICK_MIN_MSEC)
+		msec = STALL_TICK_MIN_MSEC;
+	if(msec > STALL_TICK_MAX_MSEC)
+		msec = STALL_TICK_MAX_MSEC;
+	return msec*1000000;
+}
+
+static struct stall_beat*
+stall_get(struct nsd* nsd, int idx, size_t num)
+{
+	return (struct stall_beat*)(nsd->stall_map[idx] +
+		num*sizeof(struct stall_beat));
+}
+
+void
+stall_alloc(struct nsd* nsd)
+{
+#ifdef HAVE_MMAP
+	size_t sz = sizeof(struct stall_beat)*
+		(nsd->child_count?nsd->child_count:1);
+	int i;
+#endif
+	nsd->stall_map[0] = NULL;
+	nsd->stall_map[1] = NULL;
+	nsd->stall_idx = 0;
+	if(nsd->options->stall_monitor == 0)
+		return;
+#ifdef HAVE_MMAP
+	/* anonymous shared memory, zeroed, like the stat_map it is
+	 * inherited by the server processes */
+	for(i=0; i<2; i++) {
+		nsd->stall_map[i] = (char*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if(nsd->stall_map[i] == MAP_FAILED) {
+			log_msg(LOG_ERR, "stall-monitor: mmap failed: %s",
+				strerror(errno));
+			nsd->stall_map[i] = NULL;
+			if(i == 1) {
+				munmap(nsd->stall_map[0], sz);
+				nsd->stall_map[0] = NULL;
+			}
+			return;
+		}
+	}
+#else
+	log_msg(LOG_ERR, "stall-monitor: no mmap, the servers are not "
+		"monitored");
+#endif /* HAVE_MMAP */
+}
+
+void
+stall_switch(struct nsd* nsd)
+{
+	/* the servers before the previous reload have quit, the beats of
+	 * the servers that quit at this reload are not checked anymore */
+	nsd->stall_idx = 1 - nsd->stall_idx;
+	if(nsd->stall_map[nsd->stall_idx])
+		memset(nsd->stall_map[nsd->stall_idx], 0,
+			sizeof(struct stall_beat)*
+			(nsd->child_count?nsd->child_count:1));
+}
+
+void
+stall_attach(struct nsd* nsd, size_t num)
+{
+	if(!nsd->stall_map[nsd->stall_idx])
+		return;
+	stall_nsd = nsd;
+	stall_beat = stall_get(nsd, nsd->stall_idx, num);
+	stall_threshold = (uint64_t)nsd->options->stall_monitor*1000000;
+	stall_interval = stall_tick(nsd);
+	stall_handler = STALL_LOOP;
+}
+
+/* the handler that started at stall_since ended at now */
+static void
+stall_done(uint64_t now)
+{
+	uint64_t t = now - stall_since;
+	if(t < stall_threshold)
+		return;
+#ifdef BIND8_STATS
+	stall_nsd->st.stall[stall_handler]++;
+#endif
+	if(now - stall_logged >= (uint64_t)STALL_LOG_MSEC*1000000 ||
+		stall_logged == 0) {
+		log_msg(LOG_WARNING, "%s ran for %u msec, the queries to this "
+			"server waited", stall_names[stall_handler],
+			(unsigned)(t/1000000));
+		stall_logged = now;
+	}
+}
+
+void
+stall_mark(int handler)
+{
+	uint64_t now = latency_clock();
+	if(stall_handler != STALL_LOOP)
+		stall_done(now);
+	stall_handler = handler;
+	stall_since = now;
+	stall_beat->start = now;
+	stall_beat->handler = (uint64_t)handler;
+}
+
+static void stall_timer_set(void);
+
+static void
+stall_handle_timer(int ATTR_UNUSED(fd), short event, void* arg)
+{
+	uint64_t now = latency_clock(), lag = 0;
+	(void)event;
+	(void)arg;
+	if(now > stall_due)
+		lag = now - stall_due;
+	stall_lagging = (lag >= stall_threshold);
+#ifdef BIND8_STATS
+	if(lag/1000 > stall_nsd->st.loop_lag_max)
+		stall_nsd->st.loop_lag_max = lag/1000;
+	if(lag >= stall_threshold)
+		stall_nsd->st.stall[STALL_LOOP]++;
+#endif
+	stall_beat->tick = now;
+	stall_timer_set();
+}
+
+static void
+stall_timer_set(void)
+{
+	struct timeval tv;
+	tv.tv_sec = (time_t)(stall_interval/1000000000);
+	tv.tv_usec = (suseconds_t)((stall_interval%1000000000)/1000);
+	stall_due = latency_clock() + stall_interval;
+	event_set(&stall_timer, -1, EV_TIMEOUT, stall_handle_timer, NULL);
+	if(event_base_set(stall_base, &stall_timer) != 0)
+		log_msg(LOG_ERR, "stall-monitor: event_base_set failed");
+	if(event_add(&stall_timer, &tv) != 0)
+		log_msg(LOG_ERR, "stall-monitor: event_add failed");
+}
+
+void
+stall_start(struct event_base* base)
+{
+	if(!stall_beat)
+		return;
+	stall_base = base;
+	stall_beat->tick = latency_clock();
+	stall_timer_set();
+}
+
+void
+stall_check(struct nsd* nsd)
+{
+	uint64_t now, limit;
+	size_t i;
+	if(!nsd->stall_map[nsd->stall_idx])
+		return;
+	now = latency_clock();
+	limit = (uint64_t)nsd->options->stall_monitor*1000000 +
+		stall_tick(nsd);
+	for(i=0; i<nsd->child_count; i++) {
+		struct stall_beat* b = stall_get(nsd, nsd->stall_idx, i);
+		uint64_t tick = b->tick, handler = b->handler;
+		if(nsd->children[i].pid <= 0 || nsd->children[i].need_to_exit
+			|| tick == 0 || tick == b->reported ||
+			now < tick + limit)
+			continue;
+		if(handler != STALL_LOOP && handler < STALL_HANDLERS)
+			log_msg(LOG_WARNING, "server %d (pid %d) is stalled, its "
+				"event loop did not run for %u msec, in %s for %u "
+				"msec", (int)i, (int)nsd->children[i].pid,
+				(unsigned)((now-tick)/1000000),
+				stall_names[handler],
+				(unsigned)((now-b->start)/1000000));
+		else	log_msg(LOG_WARNING, "server %d (pid %d) is stalled, its "
+				"event loop did not run for %u msec", (int)i,
+				(int)nsd->children[i].pid,
+				(unsigned)((now-tick)/1000000));
+		b->reported = tick;
+	}
+}
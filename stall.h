@@ -0,0 +1,66 @@
+/*
+ * stall.h -- event loop lag and stalls of the server processes.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef STALL_H
+#define STALL_H
+
+struct nsd;
+struct event_base;
+
+/**
+ * The heartbeat of a server, in shared memory.  The server writes it,
+ * main reads it to see if the server is stuck.  One cache line.
+ */
+struct stall_beat {
+	/* latency_clock() of the last run of the timer of the server */
+	uint64_t tick;
+	/* the handler that runs, STALL_LOOP between handlers, and the
+	 * latency_clock() when it started */
+	uint64_t handler;
+	uint64_t start;
+	/* the tick for which main logged the stall, written by main */
+	uint64_t reported;
+	uint8_t pad[64 - 4*sizeof(uint64_t)];
+};
+
+/** the beat of this server (thread), NULL if stall-monitor is off */
+extern NSD_THREAD_LOCAL struct stall_beat* stall_beat;
+
+/** the last run of the timer was stall-monitor or more late, the server
+ * is overloaded */
+extern NSD_THREAD_LOCAL int stall_lagging;
+
+/** mark the start of a handler, it ends when the next starts */
+#define STALL_MARK(h) do { if(stall_beat) stall_mark(h); } while(0)
+
+/**
+ * Allocate the beats of the servers, in two blocks like the stat_map,
+ * the new servers after a reload use the other block.  Does nothing if
+ * stall-monitor is 0.
+ */
+void stall_alloc(struct nsd* nsd);
+
+/** Switch to the other block for the servers forked after a reload */
+void stall_switch(struct nsd* nsd);
+
+/** Use the beat of server num, in the server process or thread */
+void stall_attach(struct nsd* nsd, size_t num);
+
+/** Start the timer that measures the event loop lag of the server */
+void stall_start(struct event_base* base);
+
+/** The server starts the handler, STALL_LOOP when it returns to the
+ * event loop.  The time of the previous handler is checked. */
+void stall_mark(int handler);
+
+/** In main, log the servers whose event loop has not run for longer
+ * than stall-monitor */
+void stall_check(struct nsd* nsd);
+
+#endif /* STALL_H */
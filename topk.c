@@ -0,0 +1,310 @@
+/*
+ * topk.c -- heavy hitter tables of the query names, clients and zones.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * Every server counts its queries in three tables in shared memory,
+ * for the qname, the client prefix and the (zone, qtype).  A table is
+ * set associative, a key hashes to one set of TOPK_WAYS entries, and
+ * within the set the space-saving algorithm keeps the keys: a key that
+ * is not in the set takes the place of the entry with the lowest count,
+ * and continues from that count.  The update is O(1) and the memory is
+ * fixed, the heavy hitters stay in the table and the rare keys are
+ * replaced.  nsd-control top merges the tables of the servers.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nsd.h"
+#include "query.h"
+#include "topk.h"
+#include "options.h"
+#include "lookup3.h"
+#include "util.h"
+
+/* hash seed of the keys */
+#define TOPK_SEED 0x5bd1e995
+/* times that a reader tries an entry that the server is changing */
+#define TOPK_RETRY 4
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#define topk_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define topk_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define topk_fence() __atomic_thread_fence(__ATOMIC_ACQ_REL)
+#else
+/* without the barriers a reader can see a key that is being replaced,
+ * the key is checked before it is printed */
+#define topk_load(p) (*(volatile uint32_t*)(p))
+#define topk_store(p, v) (*(volatile uint32_t*)(p) = (v))
+#define topk_fence() /* nothing */
+#endif
+
+/* bytes of the tables of a server */
+static size_t
+topk_bytes(size_t size)
+{
+	return (TOPK_TABLES*size*sizeof(struct topk_entry) + 63)
+		& ~((size_t)63);
+}
+
+void
+topk_alloc(struct nsd* nsd)
+{
+#ifdef HAVE_MMAP
+	size_t n = TOPK_WAYS, sz;
+	int i;
+#endif
+	nsd->top_map[0] = NULL;
+	nsd->top_map[1] = NULL;
+	nsd->top_idx = 0;
+	nsd->top_size = 0;
+	nsd->top = NULL;
+	if(nsd->options->heavy_hitters == 0)
+		return;
+#ifdef HAVE_MMAP
+	/* a power of two of sets */
+	while(n < (size_t)nsd->options->heavy_hitters)
+		n <<= 1;
+	sz = topk_bytes(n)*(nsd->child_count?nsd->child_count:1);
+	/* anonymous shared memory, zeroed, like the stat_map it is
+	 * inherited by xfrd and the server processes */
+	for(i=0; i<2; i++) {
+		nsd->top_map[i] = (char*)mmap(NULL, sz, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if(nsd->top_map[i] == MAP_FAILED) {
+			log_msg(LOG_ERR, "heavy-hitters: mmap failed: %s",
+				strerror(errno));
+			nsd->top_map[i] = NULL;
+			if(i == 1) {
+				munmap(nsd->top_map[0], sz);
+				nsd->top_map[0] = NULL;
+			}
+			return;
+		}
+	}
+	nsd->top_size = n;
+#else
+	log_msg(LOG_ERR, "heavy-hitters: no mmap, the tables are not "
+		"available");
+#endif /* HAVE_MMAP */
+}
+
+void
+topk_switch(struct nsd* nsd)
+{
+	/* the servers before the previous reload have quit, their block
+	 * is cleared for the new servers.  The counts of the servers
+	 * that quit at this reload stay in the other block. */
+	nsd->top_idx = 1 - nsd->top_idx;
+	if(nsd->top_map[nsd->top_idx])
+		memset(nsd->top_map[nsd->top_idx], 0, topk_bytes(
+			nsd->top_size)*(nsd->child_count?nsd->child_count:1));
+}
+
+struct topk_entry*
+topk_tables(struct nsd* nsd, int idx, size_t num)
+{
+	return (struct topk_entry*)(nsd->top_map[idx] +
+		num*topk_bytes(nsd->top_size));
+}
+
+void
+topk_update(struct topk_entry* table, size_t size, const uint8_t* key,
+	size_t len)
+{
+	uint32_t h = hashlittle(key, len, TOPK_SEED);
+	struct topk_entry* set = table + (h & (size/TOPK_WAYS - 1))*TOPK_WAYS;
+	struct topk_entry* min = set;
+	uint64_t c;
+	uint32_t seq;
+	int i;
+	for(i=0; i<TOPK_WAYS; i++) {
+		struct topk_entry* e = &set[i];
+		if(e->hash == h && e->len == len &&
+			memcmp(e->key, key, len) == 0) {
+			e->count++;
+			return;
+		}
+		if(e->count < min->count)
+			min = e;
+	}
+	/* replace the entry with the lowest count */
+	c = min->count;
+	seq = min->seq;
+	topk_store(&min->seq, seq+1);
+	topk_fence();
+	memcpy(min->key, key, len);
+	min->len = (uint16_t)len;
+	min->hash = h;
+	min->err = c;
+	min->count = c+1;
+	topk_store(&min->seq, seq+2);
+}
+
+void
+topk_query(struct nsd* nsd, struct query* q)
+{
+	struct topk_entry* t = nsd->top;
+	size_t size = nsd->top_size;
+	uint8_t key[TOPK_KEY_MAX];
+	if(!q->qname)
+		return;
+	topk_update(t + TOPK_QNAME*size, size, dname_name(q->qname),
+		q->qname->name_size);
+
+	/* the client prefix, the family and the masked address */
+#ifdef INET6
+	if(q->addr.ss_family == AF_INET6) {
+		struct sockaddr_in6* a = (struct sockaddr_in6*)&q->addr;
+		key[0] = 6;
+		memset(key+1, 0, 16);
+		memcpy(key+1, &a->sin6_addr, TOPK_IPV6_PREFIX/8);
+		topk_update(t + TOPK_CLIENT*size, size, key, 17);
+	} else
+#endif
+	{
+		struct sockaddr_in* a = (struct sockaddr_in*)&q->addr;
+		key[0] = 4;
+		memset(key+1, 0, 4);
+		memcpy(key+1, &a->sin_addr, TOPK_IPV4_PREFIX/8);
+		topk_update(t + TOPK_CLIENT*size, size, key, 5);
+	}
+
+	/* the qtype and the zone, for queries that have a zone */
+	if(q->zone && q->zone->apex) {
+		const dname_type* apex = domain_dname(q->zone->apex);
+		key[0] = (q->qtype>>8);
+		key[1] = (q->qtype&0xff);
+		memcpy(key+2, dname_name(apex), apex->name_size);
+		topk_update(t + TOPK_ZONE*size, size, key, 2+apex->name_size);
+	}
+}
+
+/* copy the entry, if the server is not replacing its key */
+static int
+topk_read(struct topk_entry* e, struct topk_entry* copy)
+{
+	int i;
+	for(i=0; i<TOPK_RETRY; i++) {
+		uint32_t seq = topk_load(&e->seq);
+		if((seq&1))
+			continue;
+		memcpy(copy, e, sizeof(*copy));
+		topk_fence();
+		if(topk_load(&e->seq) == seq)
+			return copy->count != 0 && copy->len <= TOPK_KEY_MAX;
+	}
+	return 0;
+}
+
+static int
+topk_cmp_key(const void* a, const void* b)
+{
+	const struct topk_entry* x = (const struct topk_entry*)a;
+	const struct topk_entry* y = (const struct topk_entry*)b;
+	if(x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	if(x->len != y->len)
+		return x->len < y->len ? -1 : 1;
+	return memcmp(x->key, y->key, x->len);
+}
+
+static int
+topk_cmp_count(const void* a, const void* b)
+{
+	const struct topk_entry* x = (const struct topk_entry*)a;
+	const struct topk_entry* y = (const struct topk_entry*)b;
+	if(x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+	return topk_cmp_key(a, b);
+}
+
+struct topk_entry*
+topk_merge(struct nsd* nsd, int table, size_t* num)
+{
+	size_t children = nsd->child_count?nsd->child_count:1;
+	size_t i, j, n = 0;
+	int idx;
+	struct topk_entry* all;
+	*num = 0;
+	if(!nsd->top_map[0] || !nsd->top_map[1])
+		return NULL;
+	all = (struct topk_entry*)xalloc_array_zero(
+		2*children*nsd->top_size, sizeof(struct topk_entry));
+	for(idx=0; idx<2; idx++) {
+		for(i=0; i<children; i++) {
+			struct topk_entry* t = topk_tables(nsd, idx, i) +
+				table*nsd->top_size;
+			for(j=0; j<nsd->top_size; j++)
+				if(topk_read(&t[j], &all[n]))
+					n++;
+		}
+	}
+	/* sum the counts of the same key */
+	qsort(all, n, sizeof(*all), topk_cmp_key);
+	j = 0;
+	for(i=0; i<n; i++) {
+		if(j > 0 && topk_cmp_key(&all[j-1], &all[i]) == 0) {
+			all[j-1].count += all[i].count;
+			all[j-1].err += all[i].err;
+			continue;
+		}
+		if(i != j)
+			memcpy(&all[j], &all[i], sizeof(*all));
+		j++;
+	}
+	qsort(all, j, sizeof(*all), topk_cmp_count);
+	*num = j;
+	return all;
+}
+
+int
+topk_name_ok(const uint8_t* name, size_t len)
+{
+	size_t i = 0;
+	while(i < len) {
+		if(name[i] == 0)
+			return i+1 == len;
+		if(name[i] > MAXLABELLEN)
+			return 0;
+		i += name[i]+1;
+	}
+	return 0;
+}
+
+void
+topk_key2str(int table, struct topk_entry* e, char* buf, size_t len)
+{
+	char a[INET6_ADDRSTRLEN];
+	if(table == TOPK_QNAME) {
+		if(topk_name_ok(e->key, e->len))
+			snprintf(buf, len, "%s", wiredname2str(e->key));
+		else	snprintf(buf, len, "?");
+	} else if(table == TOPK_CLIENT) {
+		if(e->len == 5 && e->key[0] == 4 &&
+			inet_ntop(AF_INET, e->key+1, a, sizeof(a)))
+			snprintf(buf, len, "%s/%d", a, TOPK_IPV4_PREFIX);
+#ifdef INET6
+		else if(e->len == 17 && e->key[0] == 6 &&
+			inet_ntop(AF_INET6, e->key+1, a, sizeof(a)))
+			snprintf(buf, len, "%s/%d", a, TOPK_IPV6_PREFIX);
+#endif
+		else	snprintf(buf, len, "?");
+	} else {
+		if(e->len > 2 && topk_name_ok(e->key+2, e->len-2))
+			snprintf(buf, len, "%s %s", wiredname2str(e->key+2),
+				rrtype_to_string((e->key[0]<<8) | e->key[1]));
+		else	snprintf(buf, len, "?");
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ * topk.h -- heavy hitter tables of the query names, clients and zones.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef TOPK_H
+#define TOPK_H
+
+struct nsd;
+struct query;
+
+/** the tables, keyed on the qname, client prefix and (zone, qtype) */
+#define TOPK_QNAME 0
+#define TOPK_CLIENT 1
+#define TOPK_ZONE 2
+#define TOPK_TABLES 3
+
+/** entries in a set, a key is counted in one set of the table */
+#define TOPK_WAYS 4
+/** longest key, the qtype and the zone name */
+#define TOPK_KEY_MAX (2+MAXDOMAINLEN)
+/** the client prefixes that are counted */
+#define TOPK_IPV4_PREFIX 24
+#define TOPK_IPV6_PREFIX 56
+
+/**
+ * An entry of a table.  The server is the only writer, and changes seq
+ * to odd while it replaces the key, so that readers skip the entry.
+ * The count of a key that replaced another starts at the count of the
+ * entry it replaced, that overcount is in err (space-saving).
+ */
+struct topk_entry {
+	uint32_t seq;
+	uint32_t hash;
+	uint64_t count;
+	uint64_t err;
+	uint16_t len;
+	uint8_t key[TOPK_KEY_MAX];
+};
+
+/**
+ * Allocate the tables of the servers, in two blocks like the stat_map,
+ * the new servers after a reload use the other block.  Before the fork
+ * of xfrd.  Does nothing if heavy-hitters is 0.
+ */
+void topk_alloc(struct nsd* nsd);
+
+/** Switch to the other block for the servers forked after a reload */
+void topk_switch(struct nsd* nsd);
+
+/** The tables of server num in block idx, TOPK_TABLES after another */
+struct topk_entry* topk_tables(struct nsd* nsd, int idx, size_t num);
+
+/** Count the key in the table of size entries, in O(1) */
+void topk_update(struct topk_entry* table, size_t size, const uint8_t* key,
+	size_t len);
+
+/** Count the query in the tables of this server, after it is answered */
+void topk_query(struct nsd* nsd, struct query* q);
+
+/**
+ * Merge the table of all the servers, the current and the previous
+ * ones, the keys are summed.  Returns an array sorted on count, that
+ * the caller frees, with the number of keys in num.  NULL if off.
+ */
+struct topk_entry* topk_merge(struct nsd* nsd, int table, size_t* num);
+
+/** Check that the key of a TOPK_QNAME entry holds a name of len bytes */
+int topk_name_ok(const uint8_t* name, size_t len);
+
+/** Print the key of an entry of the table in buf */
+void topk_key2str(int table, struct topk_entry* e, char* buf, size_t len);
+
+#endif /* TOPK_H */
@@ -0,0 +1,335 @@
+/*
+	test anscache.h
+*/
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tpkg/cutest/cutest.h"
+#include "anscache.h"
+#include "difffile.h"
+#include "options.h"
+#include "packet.h"
+#include "xfrd-disk.h"
+
+static void anscache_1(CuTest *tc);
+static void anscache_2(CuTest *tc);
+static void anscache_3(CuTest *tc);
+
+CuSuite* reg_cutest_anscache(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, anscache_1);
+	SUITE_ADD_TEST(suite, anscache_2);
+	SUITE_ADD_TEST(suite, anscache_3);
+	return suite;
+}
+
+/* write the header and question for qname A into the query */
+static void
+anscache_qname(query_type* q, uint16_t id, uint16_t flags,
+	const uint8_t* qname, size_t len)
+{
+	query_reset(q, 512, 0);
+	buffer_write_u16(q->packet, id);
+	buffer_write_u16(q->packet, flags);
+	buffer_write_u16(q->packet, 1);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_write(q->packet, qname, len);
+	buffer_write_u16(q->packet, TYPE_A);
+	buffer_write_u16(q->packet, CLASS_IN);
+	q->qname = dname_make(q->region, qname, 1);
+	q->qtype = TYPE_A;
+	q->qclass = CLASS_IN;
+}
+
+/* write the header and question for www.example.com A into the query */
+static void
+anscache_question(query_type* q, uint16_t id, uint16_t flags)
+{
+	static const uint8_t qname[] = "\003www\007example\003com";
+	anscache_qname(q, id, flags, qname, sizeof(qname));
+}
+
+static void anscache_1(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct anscache* cache = anscache_create(region, 16);
+	query_type* q = query_create(region);
+	uint8_t answer[] = { 0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0x0e, 0x10,
+		0, 4, 192, 0, 2, 1 };
+	size_t qend;
+	zone_type* zone = (zone_type*)region_alloc_zero(region,
+		sizeof(zone_type));
+
+	/* empty cache */
+	anscache_question(q, 0x1234, 0x8100);
+	CuAssert(tc, "anscache miss", !anscache_lookup(cache, q));
+
+	/* store an answer */
+	qend = buffer_position(q->packet);
+	buffer_write(q->packet, answer, sizeof(answer));
+	FLAGS_SET(q->packet, 0x8500);
+	ANCOUNT_SET(q->packet, 1);
+	q->zone = zone;
+	anscache_store(cache, q, qend);
+
+	/* lookup with another id, without RD */
+	anscache_question(q, 0x4321, 0x8000);
+	CuAssert(tc, "anscache hit", anscache_lookup(cache, q));
+	CuAssert(tc, "anscache id", ID(q->packet) == 0x4321);
+	CuAssert(tc, "anscache flags", FLAGS(q->packet) == 0x8400);
+	CuAssert(tc, "anscache ancount", ANCOUNT(q->packet) == 1);
+	CuAssert(tc, "anscache zone", q->zone == zone);
+	CuAssert(tc, "anscache len",
+		buffer_position(q->packet) == qend + sizeof(answer));
+	CuAssert(tc, "anscache data", memcmp(buffer_at(q->packet, qend),
+		answer, sizeof(answer)) == 0);
+
+	/* the DO bit and the answer size are part of the key */
+	anscache_question(q, 0x4321, 0x8000);
+	q->edns.dnssec_ok = 1;
+	CuAssert(tc, "anscache DO miss", !anscache_lookup(cache, q));
+	anscache_question(q, 0x4321, 0x8000);
+	q->maxlen = 1232;
+	CuAssert(tc, "anscache size miss", !anscache_lookup(cache, q));
+	anscache_question(q, 0x4321, 0x8000);
+	q->qtype = TYPE_AAAA;
+	CuAssert(tc, "anscache qtype miss", !anscache_lookup(cache, q));
+
+	/* a flush removes the answers */
+	anscache_flush(cache);
+	anscache_question(q, 0x4321, 0x8000);
+	CuAssert(tc, "anscache flushed", !anscache_lookup(cache, q));
+
+	region_destroy(region);
+}
+
+static void anscache_2(CuTest *tc)
+{
+	static const uint8_t qname1[] = "\001a\007example\003com";
+	static const uint8_t qname2[] = "\006longer\007example\003com";
+	region_type* region = region_create(xalloc, free);
+	struct anscache* cache = anscache_create(region, 16);
+	query_type* q = query_create(region);
+	/* a.example.com CNAME www.example.com, and the A of
+	 * www.example.com, with pointers to the query name, to the
+	 * example.com in the question and to the CNAME target */
+	uint8_t answer[] = { 0xc0, 0x0c, 0, 5, 0, 1, 0, 0, 0x0e, 0x10,
+		0, 6, 3, 'w', 'w', 'w', 0xc0, 0x0e,
+		0xc0, 0x2b, 0, 1, 0, 1, 0, 0, 0x0e, 0x10,
+		0, 4, 192, 0, 2, 1 };
+	size_t qend, delta = sizeof(qname2) - sizeof(qname1);
+	uint8_t* p;
+	zone_type* zone = (zone_type*)region_alloc_zero(region,
+		sizeof(zone_type));
+	domain_type* wildcard = (domain_type*)region_alloc_zero(region,
+		sizeof(domain_type));
+	domain_type* cover = (domain_type*)region_alloc_zero(region,
+		sizeof(domain_type));
+
+	/* empty cache, the miss sets the key */
+	anscache_qname(q, 0x1234, 0x0100, qname1, sizeof(qname1));
+	CuAssert(tc, "wildcard miss", !anscache_lookup_wildcard(cache, q,
+		zone, wildcard, cover));
+	CuAssert(tc, "wildcard key", q->wildcard_key == wildcard &&
+		q->wildcard_cover == cover && q->wildcard_zone == zone);
+
+	/* store the answer synthesized from the wildcard */
+	qend = buffer_position(q->packet);
+	buffer_write(q->packet, answer, sizeof(answer));
+	FLAGS_SET(q->packet, 0x8500);
+	ANCOUNT_SET(q->packet, 2);
+	q->zone = zone;
+	q->wildcard_synth = 1;
+	anscache_store(cache, q, qend);
+
+	/* another name below the wildcard, with the same cover */
+	anscache_qname(q, 0x4321, 0x0000, qname2, sizeof(qname2));
+	CuAssert(tc, "wildcard hit", anscache_lookup_wildcard(cache, q,
+		zone, wildcard, cover));
+	CuAssert(tc, "wildcard flags", FLAGS(q->packet) == 0x8400);
+	CuAssert(tc, "wildcard ancount", ANCOUNT(q->packet) == 2);
+	CuAssert(tc, "wildcard zone", q->zone == zone);
+	CuAssert(tc, "wildcard len", buffer_position(q->packet) ==
+		qend + delta + sizeof(answer));
+	p = buffer_at(q->packet, qend + delta);
+	CuAssert(tc, "wildcard owner", p[0] == 0xc0 && p[1] == 0x0c);
+	CuAssert(tc, "wildcard qname suffix",
+		p[16] == 0xc0 && p[17] == 0x0e + delta);
+	CuAssert(tc, "wildcard target",
+		p[18] == 0xc0 && p[19] == 0x2b + delta);
+	CuAssert(tc, "wildcard rdata", memcmp(p+20, answer+20,
+		sizeof(answer)-20) == 0);
+
+	/* a name that is covered by another NSEC or NSEC3 */
+	anscache_qname(q, 0x4321, 0x0000, qname2, sizeof(qname2));
+	CuAssert(tc, "wildcard cover miss", !anscache_lookup_wildcard(cache,
+		q, zone, wildcard, NULL));
+
+	/* a flush removes the answers */
+	anscache_flush(cache);
+	anscache_qname(q, 0x4321, 0x0000, qname2, sizeof(qname2));
+	CuAssert(tc, "wildcard flushed", !anscache_lookup_wildcard(cache, q,
+		zone, wildcard, cover));
+
+	region_destroy(region);
+}
+
+/* create the zone, with its options */
+static zone_type*
+anscache_zone(struct nsd* nsd, const char* name)
+{
+	zone_options_t* zo = zone_options_create(nsd->region);
+	memset(zo, 0, sizeof(*zo));
+	zo->name = region_strdup(nsd->region, name);
+	zo->pattern = pattern_options_create(nsd->region);
+	zo->pattern->pname = zo->name;
+	if(!nsd_options_insert_zone(nsd->options, zo)) {
+		printf("cannot insert zone %s\n", name);
+		exit(1);
+	}
+	return namedb_zone_create(nsd->db, (const dname_type*)zo->node.key,
+		zo);
+}
+
+/* append an RR to the xfr packet */
+static void
+anscache_xfr_rr(buffer_type* p, const uint8_t* owner, size_t ownerlen,
+	uint16_t type, const uint8_t* rdata, size_t rdlen)
+{
+	buffer_write(p, owner, ownerlen);
+	buffer_write_u16(p, type);
+	buffer_write_u16(p, CLASS_IN);
+	buffer_write_u32(p, 3600);
+	buffer_write_u16(p, rdlen);
+	buffer_write(p, rdata, rdlen);
+}
+
+/* write an AXFR of the zone, with the SOA, NS and the RR, to the xfr file
+ * and apply it like reload-in-place does in the servers */
+static void
+anscache_axfr(CuTest* tc, struct nsd* nsd, zone_type* zone, uint64_t nr,
+	uint32_t serial, const uint8_t* owner, size_t ownerlen,
+	uint16_t type, const uint8_t* rdata, size_t rdlen)
+{
+	region_type* region = region_create(xalloc, free);
+	buffer_type* p = buffer_create(region, 512);
+	const dname_type* apex = domain_dname(zone->apex);
+	char name[MAXDOMAINLEN*5];
+	uint8_t soa[22];
+
+	/* the root as the mname and rname, the serial and the timers */
+	memset(soa, 0, sizeof(soa));
+	write_uint32(soa+2, serial);
+	snprintf(name, sizeof(name), "%s", dname_to_string(apex, NULL));
+	buffer_clear(p);
+	buffer_write_u16(p, 0);
+	buffer_write_u16(p, 0x8400);
+	buffer_write_u16(p, 0);
+	buffer_write_u16(p, 4);
+	buffer_write_u16(p, 0);
+	buffer_write_u16(p, 0);
+	anscache_xfr_rr(p, dname_name(apex), apex->name_size, TYPE_SOA, soa,
+		sizeof(soa));
+	anscache_xfr_rr(p, dname_name(apex), apex->name_size, TYPE_NS,
+		dname_name(apex), apex->name_size);
+	anscache_xfr_rr(p, owner, ownerlen, type, rdata, rdlen);
+	anscache_xfr_rr(p, dname_name(apex), apex->name_size, TYPE_SOA, soa,
+		sizeof(soa));
+	buffer_flip(p);
+	diff_write_packet(name, zone->opts->pattern->pname, serial-1, serial,
+		0, buffer_begin(p), buffer_limit(p), nsd, nr);
+	diff_write_commit(name, serial-1, serial, 1, 1, "anscache test", nsd,
+		nr);
+	CuAssert(tc, "apply xfr", server_apply_xfr(nsd, zone, nr));
+	xfrd_unlink_xfrfile(nsd, nr);
+	region_destroy(region);
+}
+
+/* answer the query for qname A, returns true if the answer has two RRs
+ * and the address */
+static int
+anscache_answer(struct nsd* nsd, query_type* q, const uint8_t* qname,
+	size_t len, const uint8_t* addr)
+{
+	size_t i;
+	query_reset(q, 512, 0);
+	buffer_write_u16(q->packet, 0x1234);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 1);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_write(q->packet, qname, len);
+	buffer_write_u16(q->packet, TYPE_A);
+	buffer_write_u16(q->packet, CLASS_IN);
+	buffer_flip(q->packet);
+	if(query_process(q, nsd) == QUERY_DISCARDED)
+		return 0;
+	buffer_flip(q->packet);
+	if(RCODE(q->packet) != RCODE_OK || ANCOUNT(q->packet) != 2)
+		return 0;
+	for(i=QHEADERSZ; i+4 <= buffer_limit(q->packet); i++)
+		if(memcmp(buffer_at(q->packet, i), addr, 4) == 0)
+			return 1;
+	return 0;
+}
+
+/* a transfer that is applied in place removes the cached answers that
+ * hold its data, also a CNAME from another zone */
+static void anscache_3(CuTest *tc)
+{
+	static const uint8_t a_com[] = "\001a\007example\003com";
+	static const uint8_t www_net[] = "\003www\007example\003net";
+	static const uint8_t addr1[] = { 192, 0, 2, 1 };
+	static const uint8_t addr2[] = { 192, 0, 2, 2 };
+	region_type* region = region_create(xalloc, free);
+	struct nsd nsd;
+	zone_type *com, *net;
+	query_type* q;
+
+	memset(&nsd, 0, sizeof(nsd));
+	nsd.region = region;
+	nsd.pid = getpid();
+	nsd.options = nsd_options_create(region);
+	nsd.options->xfrdir = "/tmp/";
+	edns_init_data(&nsd.edns_ipv4, nsd.options->ipv4_edns_size);
+	nsd.db = namedb_open("", nsd.options);
+	com = anscache_zone(&nsd, "example.com.");
+	net = anscache_zone(&nsd, "example.net.");
+	anscache_axfr(tc, &nsd, com, 1, 1, a_com, sizeof(a_com), TYPE_CNAME,
+		www_net, sizeof(www_net));
+	anscache_axfr(tc, &nsd, net, 2, 1, www_net, sizeof(www_net), TYPE_A,
+		addr1, sizeof(addr1));
+	nsd.anscache = anscache_create(region, 64);
+	q = query_create(region);
+
+	/* the answer follows the CNAME into example.net, and is cached
+	 * for example.com */
+	CuAssert(tc, "cname answer", anscache_answer(&nsd, q, a_com,
+		sizeof(a_com), addr1));
+	anscache_qname(q, 0x4321, 0x0000, a_com, sizeof(a_com));
+	CuAssert(tc, "cname cached", anscache_lookup(nsd.anscache, q));
+
+	/* a transfer of example.net changes the answer */
+	anscache_axfr(tc, &nsd, net, 3, 2, www_net, sizeof(www_net), TYPE_A,
+		addr2, sizeof(addr2));
+	CuAssert(tc, "cname new answer", anscache_answer(&nsd, q, a_com,
+		sizeof(a_com), addr2));
+	CuAssert(tc, "cname new cached", anscache_answer(&nsd, q, a_com,
+		sizeof(a_com), addr2));
+
+	xfrd_del_tempdir(&nsd);
+	namedb_close(nsd.db);
+	region_destroy(region);
+}
@@ -0,0 +1,128 @@
+/*
+	test axfrcache.h
+*/
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "tpkg/cutest/cutest.h"
+#include "axfrcache.h"
+#include "packet.h"
+
+static void axfrcache_1(CuTest *tc);
+
+CuSuite* reg_cutest_axfrcache(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, axfrcache_1);
+	return suite;
+}
+
+/* write the header and, for the first packet, the question for
+ * example.com AXFR into the query */
+static void
+axfrcache_packet(query_type* q, int first)
+{
+	static const uint8_t qname[] = "\007example\003com";
+	if(first) {
+		query_reset(q, 16384, 1);
+		buffer_write_u16(q->packet, 0x1234);
+		buffer_write_u16(q->packet, 0x8400);
+		buffer_write_u16(q->packet, 1);
+		buffer_write_u16(q->packet, 0);
+		buffer_write_u16(q->packet, 0);
+		buffer_write_u16(q->packet, 0);
+		buffer_write(q->packet, qname, sizeof(qname));
+		buffer_write_u16(q->packet, TYPE_AXFR);
+		buffer_write_u16(q->packet, CLASS_IN);
+	} else {
+		buffer_set_position(q->packet, QHEADERSZ);
+	}
+}
+
+static void axfrcache_1(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct axfrcache* cache = axfrcache_create(region, 100000);
+	query_type* q = query_create(region);
+	query_type* q2 = query_create(region);
+	uint8_t rr1[] = { 0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0x0e, 0x10,
+		0, 4, 192, 0, 2, 1 };
+	uint8_t rr2[] = { 0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0x0e, 0x10,
+		0, 4, 192, 0, 2, 2 };
+	struct axfrcache_entry* e;
+	size_t start, pos = 0;
+	zone_type* zone = (zone_type*)region_alloc_zero(region,
+		sizeof(zone_type));
+
+	/* store a stream of two packets */
+	axfrcache_packet(q, 1);
+	start = buffer_position(q->packet);
+	CuAssert(tc, "axfrcache miss", !axfrcache_lookup(cache, zone, 1, q));
+	e = axfrcache_start(cache, zone, 1, q);
+	CuAssert(tc, "axfrcache start", e != NULL);
+	axfrcache_packet(q2, 1);
+	CuAssert(tc, "axfrcache one builder", !axfrcache_start(cache, zone,
+		1, q2));
+	CuAssert(tc, "axfrcache incomplete", !axfrcache_lookup(cache, zone,
+		1, q2));
+	buffer_write(q->packet, rr1, sizeof(rr1));
+	ANCOUNT_SET(q->packet, 1);
+	CuAssert(tc, "axfrcache add", axfrcache_add(cache, e, q, start, 0));
+	axfrcache_packet(q, 0);
+	buffer_write(q->packet, rr1, sizeof(rr1));
+	buffer_write(q->packet, rr2, sizeof(rr2));
+	ANCOUNT_SET(q->packet, 2);
+	CuAssert(tc, "axfrcache add", axfrcache_add(cache, e, q, QHEADERSZ, 1));
+
+	/* and send it again */
+	axfrcache_packet(q2, 1);
+	CuAssert(tc, "axfrcache serial miss", !axfrcache_lookup(cache, zone,
+		2, q2));
+	CuAssert(tc, "axfrcache hit", axfrcache_lookup(cache, zone, 1, q2)
+		== e);
+	CuAssert(tc, "axfrcache first", !axfrcache_get(e, &pos, q2));
+	CuAssert(tc, "axfrcache first ancount", ANCOUNT(q2->packet) == 1);
+	CuAssert(tc, "axfrcache first data", buffer_position(q2->packet) ==
+		start + sizeof(rr1) && memcmp(buffer_at(q2->packet, start),
+		rr1, sizeof(rr1)) == 0);
+	axfrcache_packet(q2, 0);
+	CuAssert(tc, "axfrcache last", axfrcache_get(e, &pos, q2));
+	CuAssert(tc, "axfrcache last ancount", ANCOUNT(q2->packet) == 2);
+	CuAssert(tc, "axfrcache last data", buffer_position(q2->packet) ==
+		QHEADERSZ + sizeof(rr1) + sizeof(rr2) && memcmp(buffer_at(
+		q2->packet, QHEADERSZ + sizeof(rr1)), rr2, sizeof(rr2)) == 0);
+
+	/* packets that do not fit next to the TSIG are not sent */
+	axfrcache_packet(q2, 1);
+	q2->reserved_space = 16384;
+	CuAssert(tc, "axfrcache no space", !axfrcache_lookup(cache, zone,
+		1, q2));
+
+	/* an incomplete stream is removed when the query is done */
+	axfrcache_flush_zone(cache, zone);
+	CuAssert(tc, "axfrcache flushed", cache->list == NULL &&
+		cache->size == 0);
+	axfrcache_packet(q, 1);
+	e = axfrcache_start(cache, zone, 2, q);
+	CuAssert(tc, "axfrcache start", e != NULL);
+	axfrcache_abort(cache, q);
+	CuAssert(tc, "axfrcache abort", cache->list == NULL);
+
+	/* a stream larger than the cache is not stored */
+	cache->max = 1000;
+	axfrcache_packet(q, 1);
+	e = axfrcache_start(cache, zone, 2, q);
+	buffer_write(q->packet, rr1, sizeof(rr1));
+	CuAssert(tc, "axfrcache full", !axfrcache_add(cache, e, q, start, 0));
+	CuAssert(tc, "axfrcache full removed", cache->list == NULL &&
+		cache->size == 0);
+
+	region_destroy(region);
+}
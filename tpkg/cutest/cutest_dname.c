@@ -8,6 +8,7 @@
 #include <string.h>
 #endif
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "tpkg/cutest/cutest.h"
@@ -15,11 +16,13 @@
 #include "dname.h"
 
 static void dname_1(CuTest *tc);
+static void dname_2(CuTest *tc);
 
 CuSuite* reg_cutest_dname(void)
 {
 	CuSuite* suite = CuSuiteNew();
 	SUITE_ADD_TEST(suite, dname_1);
+	SUITE_ADD_TEST(suite, dname_2);
 	return suite;
 }
 
@@ -110,3 +113,85 @@ dname_1(CuTest *tc)
 
 	region_destroy(region);
 }
+
+/* compare the names the slow way, label by label */
+static int
+equal_nocase_ref(uint8_t* a, uint8_t* b, uint16_t len)
+{
+	uint8_t i, lablen;
+	while(len > 0) {
+		if(*a != *b)
+			return 0;
+		lablen = *a++;
+		b++;
+		len--;
+		if((lablen & 0xc0) || len < lablen)
+			return (memcmp(a, b, len) == 0);
+		for(i=0; i<lablen; i++) {
+			if(DNAME_NORMALIZE(*a++) != DNAME_NORMALIZE(*b++))
+				return 0;
+		}
+		len -= lablen;
+	}
+	return 1;
+}
+
+static void
+dname_2(CuTest *tc)
+{
+	/* test the comparisons, that work on many bytes at once */
+	region_type* region = region_create(xalloc, free);
+	const char* chars = "aAzZ09-_@[`{\x7f\x80\xc1\xe1\xfa";
+	uint8_t a[300], b[300];
+	int i, j;
+	const dname_type* n1 = dname_parse(region,
+		"abcdefghijklmnopqrstuvwxyz0123456789.example.com.");
+	const dname_type* n2 = dname_parse(region,
+		"abcdefghijklmnopqrstuvwxyz0123456780.example.com.");
+	const dname_type* n3 = dname_parse(region,
+		"abcdefghijklmnopqrstuvwxyz0123456789.xample.com.");
+
+	CuAssert(tc, "dname compare equal", dname_compare(n1,
+		dname_parse(region, "abcdefghijklmnopqrstuvwxyz0123456789."
+		"example.com.")) == 0);
+	CuAssert(tc, "dname compare last char", dname_compare(n1, n2) > 0);
+	CuAssert(tc, "dname compare label", dname_compare(n1, n3) < 0);
+	CuAssert(tc, "dname compare parent", dname_compare(n1,
+		dname_parse(region, "example.com.")) > 0);
+	CuAssert(tc, "dname match count", dname_label_match_count(n1, n2) == 3);
+	CuAssert(tc, "dname match count", dname_label_match_count(n1, n3) == 2);
+	CuAssert(tc, "dname subdomain", dname_is_subdomain(n1,
+		dname_parse(region, "example.com.")));
+	CuAssert(tc, "dname not subdomain", !dname_is_subdomain(n1,
+		dname_parse(region, "xample.com.")));
+
+	/* random names, with labels of all lengths, that differ in case
+	 * or in a character, against the label by label compare */
+	for(i=0; i<10000; i++) {
+		uint16_t len = 0;
+		while(len < 200) {
+			uint8_t lablen = random()%64;
+			if(len + 1 + lablen > 255)
+				break;
+			a[len++] = lablen;
+			for(j=0; j<lablen; j++)
+				a[len++] = chars[random()%strlen(chars)];
+			if(random()%8 == 0)
+				break;
+		}
+		if(random()%4 == 0)
+			a[len++] = 0;
+		else if(random()%4 == 0)
+			a[len++] = 0xc0 | (random()%2);
+		memcpy(b, a, len);
+		for(j=0; j<len; j++) {
+			if(random()%3 == 0 && b[j] >= 'a' && b[j] <= 'z')
+				b[j] -= 0x20;
+		}
+		if(random()%2 == 0)
+			b[random()%len] ^= 1<<(random()%8);
+		CuAssert(tc, "dname equal nocase", dname_equal_nocase(a, b, len)
+			== equal_nocase_ref(a, b, len));
+	}
+	region_destroy(region);
+}
@@ -13,14 +13,20 @@
 #include "tpkg/cutest/cutest.h"
 #include "region-allocator.h"
 #include "dns.h"
+#include "edns.h"
+#include "util.h"
 
 static void dns_1(CuTest *tc);
+static void dns_2(CuTest *tc);
+static void dns_3(CuTest *tc);
 
 CuSuite* reg_cutest_dns(void)
 {
         CuSuite* suite = CuSuiteNew();
 
 	SUITE_ADD_TEST(suite, dns_1);
+	SUITE_ADD_TEST(suite, dns_2);
+	SUITE_ADD_TEST(suite, dns_3);
 	return suite;
 }
 
@@ -39,3 +45,84 @@ static void dns_1(CuTest *tc)
 	d = rrtype_descriptor_by_type(TYPE_NSEC3);
 	CuAssert(tc, "dns rrtype descriptor: type nsec3", d->type == TYPE_NSEC3);
 }
+
+static void dns_2(CuTest *tc)
+{
+	/* the server cookie of the example in RFC 9018 appendix A.1 */
+	uint8_t secret[COOKIE_SECRET_LEN], addr[4] = {198, 51, 100, 100};
+	uint8_t expect[COOKIE_SERVER_LEN];
+	/* an OPT record with the client cookie */
+	uint8_t opt[] = {0, 0, 41, 0x10, 0, 0, 0, 0, 0, 0, 12,
+		0, 10, 0, 8, 0x24, 0x64, 0xc4, 0xab, 0xcf, 0x10, 0xc9, 0x57};
+	region_type* region = region_create(xalloc, free);
+	buffer_type* packet = buffer_create(region, 512);
+	edns_record_type edns;
+	uint32_t stamp = 1559731985;
+
+	hex_pton("e5e973e5a6b2a43f48e7dc849e37bfcf", secret, sizeof(secret));
+	hex_pton("010000005cf79f111f8130c3eee29480", expect, sizeof(expect));
+	buffer_write(packet, opt, sizeof(opt));
+	buffer_flip(packet);
+	edns_init_record(&edns);
+	CuAssert(tc, "cookie parse", edns_parse_record(&edns, packet));
+	CuAssert(tc, "cookie parse end", buffer_remaining(packet) == 0);
+	CuAssert(tc, "cookie client", edns.cookie_status ==
+		COOKIE_UNVERIFIED && edns.cookie_len == COOKIE_CLIENT_LEN);
+	edns_cookie_verify(&edns, secret, addr, sizeof(addr), stamp);
+	CuAssert(tc, "cookie only client", edns.cookie_status ==
+		COOKIE_UNVERIFIED);
+	edns_cookie_create(&edns, secret, addr, sizeof(addr), stamp);
+	CuAssert(tc, "cookie create", edns.cookie_len == COOKIE_CLIENT_LEN +
+		COOKIE_SERVER_LEN && memcmp(edns.cookie+COOKIE_CLIENT_LEN,
+		expect, COOKIE_SERVER_LEN) == 0);
+
+	/* the cookie comes back, valid for an hour from that address */
+	edns.cookie_status = COOKIE_UNVERIFIED;
+	edns_cookie_verify(&edns, secret, addr, sizeof(addr), stamp+3000);
+	CuAssert(tc, "cookie valid", edns.cookie_status == COOKIE_VALID);
+	edns.cookie_status = COOKIE_UNVERIFIED;
+	edns_cookie_verify(&edns, secret, addr, sizeof(addr), stamp+3700);
+	CuAssert(tc, "cookie expired", edns.cookie_status == COOKIE_INVALID);
+	addr[3]++;
+	edns.cookie_status = COOKIE_UNVERIFIED;
+	edns_cookie_verify(&edns, secret, addr, sizeof(addr), stamp);
+	CuAssert(tc, "cookie address", edns.cookie_status == COOKIE_INVALID);
+
+	/* a cookie of the wrong length is a FORMERR */
+	opt[10] = 11;
+	opt[14] = 7;
+	buffer_clear(packet);
+	buffer_write(packet, opt, sizeof(opt)-1);
+	buffer_flip(packet);
+	edns_init_record(&edns);
+	CuAssert(tc, "cookie malformed", !edns_parse_record(&edns, packet));
+	region_destroy(region);
+}
+
+static void dns_3(CuTest *tc)
+{
+	/* an OPT record with the edns-tcp-keepalive option, no timeout */
+	uint8_t opt[] = {0, 0, 41, 0x10, 0, 0, 0, 0, 0, 0, 4,
+		0, 11, 0, 0, 0, 0};
+	region_type* region = region_create(xalloc, free);
+	buffer_type* packet = buffer_create(region, 512);
+	edns_record_type edns;
+
+	buffer_write(packet, opt, sizeof(opt)-2);
+	buffer_flip(packet);
+	edns_init_record(&edns);
+	CuAssert(tc, "keepalive parse", edns_parse_record(&edns, packet));
+	CuAssert(tc, "keepalive", edns.keepalive == 1);
+	CuAssert(tc, "keepalive space", edns_reserved_space(&edns) ==
+		OPT_LEN + OPT_RDATA + OPT_HDR + KEEPALIVE_LEN);
+
+	/* a query with a timeout is a FORMERR */
+	opt[10] = 6;
+	opt[14] = 2;
+	buffer_clear(packet);
+	buffer_write(packet, opt, sizeof(opt));
+	buffer_flip(packet);
+	edns_init_record(&edns);
+	CuAssert(tc, "keepalive malformed", !edns_parse_record(&edns, packet));
+	region_destroy(region);
+}
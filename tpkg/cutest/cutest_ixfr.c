@@ -0,0 +1,105 @@
+/*
+	test ixfr.h
+*/
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "tpkg/cutest/cutest.h"
+#include "ixfr.h"
+#include "options.h"
+#include "packet.h"
+
+static void ixfr_1(CuTest *tc);
+
+CuSuite* reg_cutest_ixfr(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, ixfr_1);
+	return suite;
+}
+
+/* store a version from oldserial to newserial with one A RR */
+static void
+ixfr_store_version(zone_type* zone, const dname_type* owner,
+	uint32_t oldserial, uint32_t newserial)
+{
+	static const uint8_t rdata[] = { 192, 0, 2, 1 };
+	region_type* region = region_create(xalloc, free);
+	buffer_type* packet = buffer_create(region, 64);
+	struct ixfr_store store_mem, *store;
+
+	buffer_write(packet, rdata, sizeof(rdata));
+	buffer_flip(packet);
+	store = ixfr_store_start(zone, &store_mem, oldserial, newserial);
+	if(store) {
+		ixfr_store_add_rr(store, owner, TYPE_A, CLASS_IN, 3600, packet,
+			sizeof(rdata));
+		ixfr_store_finish(store);
+	}
+	region_destroy(region);
+}
+
+static void ixfr_1(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	zone_type* zone = (zone_type*)region_alloc_zero(region,
+		sizeof(zone_type));
+	zone_options_t* zo = (zone_options_t*)region_alloc_zero(region,
+		sizeof(zone_options_t));
+	const dname_type* owner = dname_parse(region, "www.example.com.");
+	size_t rrlen = owner->name_size + 10 + 4;
+
+	zo->pattern = pattern_options_create(region);
+	zone->opts = zo;
+	zone->region = region;
+
+	/* nothing is stored without store-ixfr */
+	ixfr_store_version(zone, owner, 1, 2);
+	CuAssert(tc, "ixfr not stored", zone->ixfr == NULL);
+
+	/* versions are added, and the oldest removed after ixfr-number */
+	zo->pattern->store_ixfr = 1;
+	zo->pattern->ixfr_number = 2;
+	ixfr_store_version(zone, owner, 1, 2);
+	CuAssert(tc, "ixfr stored", zone->ixfr && zone->ixfr->count == 1);
+	CuAssert(tc, "ixfr len", zone->ixfr->first->len == rrlen);
+	CuAssert(tc, "ixfr owner", memcmp(zone->ixfr->first->rrs,
+		dname_name(owner), owner->name_size) == 0);
+	CuAssert(tc, "ixfr rdlength", read_uint16(zone->ixfr->first->rrs +
+		owner->name_size + 8) == 4);
+	ixfr_store_version(zone, owner, 2, 3);
+	ixfr_store_version(zone, owner, 3, 4);
+	CuAssert(tc, "ixfr number", zone->ixfr->count == 2);
+	CuAssert(tc, "ixfr first", zone->ixfr->first->oldserial == 2);
+	CuAssert(tc, "ixfr last", zone->ixfr->last->newserial == 4);
+	CuAssert(tc, "ixfr size", zone->ixfr->size == 2*rrlen);
+
+	/* a version that does not follow the last one replaces them */
+	ixfr_store_version(zone, owner, 10, 11);
+	CuAssert(tc, "ixfr gap", zone->ixfr->count == 1 &&
+		zone->ixfr->first->oldserial == 10);
+
+	/* a version larger than ixfr-size is not stored, and older
+	 * versions are removed to make space */
+	zo->pattern->ixfr_size = rrlen-1;
+	ixfr_store_version(zone, owner, 11, 12);
+	CuAssert(tc, "ixfr too large", zone->ixfr->count == 1 &&
+		zone->ixfr->last->newserial == 11);
+	zo->pattern->ixfr_size = rrlen;
+	ixfr_store_version(zone, owner, 11, 12);
+	CuAssert(tc, "ixfr size prune", zone->ixfr->count == 1 &&
+		zone->ixfr->first->oldserial == 11);
+
+	zone_ixfr_clear(zone);
+	CuAssert(tc, "ixfr clear", zone->ixfr->count == 0 &&
+		zone->ixfr->first == NULL && zone->ixfr->size == 0);
+
+	region_destroy(region);
+}
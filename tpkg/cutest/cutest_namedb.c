@@ -25,9 +25,17 @@
 
 static void namedb_1(CuTest *tc);
 static void namedb_2(CuTest *tc);
+static void namedb_5(CuTest *tc);
+static void namedb_6(CuTest *tc);
+static void namedb_7(CuTest *tc);
+static void namedb_8(CuTest *tc);
+static void namedb_10(CuTest *tc);
+static void namedb_11(CuTest *tc);
+static void namedb_12(CuTest *tc);
 #ifdef NSEC3
 static void namedb_3(CuTest *tc);
 static void namedb_4(CuTest *tc);
+static void namedb_9(CuTest *tc);
 #endif /* NSEC3 */
 static int v = 0; /* verbosity */
 
@@ -40,9 +48,17 @@ CuSuite* reg_cutest_namedb(void)
 
 	SUITE_ADD_TEST(suite, namedb_1);
 	SUITE_ADD_TEST(suite, namedb_2);
+	SUITE_ADD_TEST(suite, namedb_5);
+	SUITE_ADD_TEST(suite, namedb_6);
+	SUITE_ADD_TEST(suite, namedb_7);
+	SUITE_ADD_TEST(suite, namedb_8);
+	SUITE_ADD_TEST(suite, namedb_10);
+	SUITE_ADD_TEST(suite, namedb_11);
+	SUITE_ADD_TEST(suite, namedb_12);
 #ifdef NSEC3
 	SUITE_ADD_TEST(suite, namedb_3);
 	SUITE_ADD_TEST(suite, namedb_4);
+	SUITE_ADD_TEST(suite, namedb_9);
 #endif /* NSEC3 */
 	return suite;
 }
@@ -418,16 +434,9 @@ usage_for_rr(rr_type* rr, size_t* usage)
 {
 	unsigned i;
 	domain_type* d;
-	for(i=0; i<rr->rdata_count; i++) {
-		switch(rdata_atom_wireformat_type(rr->type, i)) {
-		case RDATA_WF_COMPRESSED_DNAME:
-		case RDATA_WF_UNCOMPRESSED_DNAME:
-			d = rdata_atom_domain(rr->rdatas[i]);
-			usage[d->number] ++;
-			break;
-		default:
-			break;
-		}
+	for(i=0; i<rr->rdata_domains; i++) {
+		d = rr_rdata_domains(rr)[i];
+		usage[d->number] ++;
 	}
 }
 
@@ -447,28 +456,21 @@ usage_for_rrsets(rrset_type* list, size_t* usage)
 static void
 check_numlist(CuTest* tc, domain_table_type* table)
 {
-	domain_type* d = table->root, *prevd = NULL;
-	size_t num = 1;
+	domain_type* d = table->root;
+	uint32_t num;
 	/* first is root at number 1 */
 	CuAssertTrue(tc, d != NULL);
-	CuAssertTrue(tc, d->number == num);
+	CuAssertTrue(tc, d->number == 1);
+	CuAssertTrue(tc, table->numlist[1] == d);
 	CuAssertTrue(tc, domain_dname(d)->label_count == 1);
-	while(d) {
-		/* check number */
+	for(num = 1; num <= table->numlist_count; num++) {
+		/* check number and place in the array */
+		d = table->numlist[num];
+		CuAssertTrue(tc, d != NULL);
 		CuAssertTrue(tc, d->number == num);
-		/* check list structure */
-		CuAssertTrue(tc, d->numlist_prev == prevd);
-		if(d->numlist_next) {
-			CuAssertTrue(tc, d == d->numlist_next->numlist_prev);
-		} else {
-			CuAssertTrue(tc, d == table->numlist_last);
-		}
-
-		num++;
-		prevd = d;
-		d = d->numlist_next;
 	}
-	CuAssertTrue(tc, table->numlist_last->number == table->nametree->count);
+	CuAssertTrue(tc, table->numlist_count < table->numlist_size);
+	CuAssertTrue(tc, table->numlist_count == table->nametree->count);
 }
 
 /* walk domains and check them */
@@ -542,6 +544,47 @@ check_walkdomains(CuTest* tc, namedb_type* db)
 	free(usage);
 }
 
+/* check that the memory accounting of the zones adds up */
+static void
+check_zonemem(CuTest* tc, namedb_type* db)
+{
+	struct radnode* n;
+	for(n = radix_first(db->zonetree); n; n = radix_next(n)) {
+		zone_type* z = (zone_type*)n->elem;
+		struct zone_mem_stat m;
+		domain_type* d;
+		rrset_type* rrset;
+		int i;
+		memset(&m, 0, sizeof(m));
+		for(d=db->domains->root; d; d=domain_next(d)) {
+			int owner = 0;
+			for(rrset = d->rrsets; rrset; rrset = rrset->next) {
+				if(rrset->zone != z)
+					continue;
+				owner = 1;
+				m.rrsets += sizeof(rrset_type) +
+					rrset->rr_count*sizeof(rr_type);
+				for(i=0; i<rrset->rr_count; i++) {
+					rr_type* rr = &rrset->rrs[i];
+					m.rdata += rr->rdata_domains*
+						sizeof(domain_type*) +
+						rr->rdlength;
+				}
+			}
+			if(owner) {
+				m.domain_count++;
+				m.domains += sizeof(domain_type) +
+					sizeof(domain_type*) +
+					dname_total_size(domain_dname(d));
+			}
+		}
+		CuAssertTrue(tc, z->mem.domain_count == m.domain_count);
+		CuAssertTrue(tc, z->mem.domains == m.domains);
+		CuAssertTrue(tc, z->mem.rrsets == m.rrsets);
+		CuAssertTrue(tc, z->mem.rdata == m.rdata);
+	}
+}
+
 /* check namedb invariants */
 static void
 check_namedb(CuTest *tc, namedb_type* db)
@@ -550,6 +593,8 @@ check_namedb(CuTest *tc, namedb_type* db)
 	check_walkzones(tc, db);
 	/* check domaintree */
 	check_walkdomains(tc, db);
+	/* check zone memory accounting */
+	check_zonemem(tc, db);
 }
 
 /* parse string into parts */
@@ -567,6 +612,7 @@ parse_rr_str(region_type* temp, zone_type* zone, char* str,
 	tempzone->apex = domain_table_insert(temptable,
 		domain_dname(zone->apex));
 	tempzone->opts = zone->opts;
+	tempzone->region = temp;
 
 	if(zonec_parse_string(temp, temptable, tempzone, str, &parsed,
 		&num_rrs)) {
@@ -613,7 +659,7 @@ add_str(namedb_type* db, zone_type* zone, udb_ptr* udbz, char* str)
 	rdatalen = rr_marshal_rdata(rr, rdata, sizeof(rdata));
 	buffer_create_from(&databuffer, rdata, rdatalen);
 	if(!add_RR(db, domain_dname(rr->owner), rr->type, rr->klass, rr->ttl,
-		&databuffer, rdatalen, zone, udbz, &softfail)) {
+		&databuffer, rdatalen, zone, udbz, &softfail, NULL)) {
 		printf("cannot add RR: %s\n", str);
 		exit(1);
 	}
@@ -860,6 +906,427 @@ static void namedb_2(CuTest *tc)
 	region_destroy(region);
 }
 
+/* check that the hash index, and the lookup with the radname, find what
+ * the radix tree finds */
+static void
+check_hash_lookup(CuTest* tc, domain_table_type* table, const char* str)
+{
+	region_type* region = region_create(xalloc, free);
+	const dname_type* dname = dname_parse(region, str);
+	struct domain_hash* hash = table->hash;
+	domain_type *m1, *e1, *m2, *e2, *m3, *e3;
+	uint8_t key[MAXDOMAINLEN];
+	radstrlen_t keylen = sizeof(key);
+	int x1, x2, x3;
+	x1 = domain_table_search(table, dname, &m1, &e1);
+	table->hash = NULL;
+	x2 = domain_table_search(table, dname, &m2, &e2);
+	radname_d2r(key, &keylen, dname_name(dname), dname->name_size);
+	x3 = domain_table_search_key(table, dname, key, keylen, &m3, &e3);
+	table->hash = hash;
+	CuAssertTrue(tc, x1 == x2);
+	CuAssertTrue(tc, e1 == e2);
+	CuAssertTrue(tc, x2 == x3);
+	CuAssertTrue(tc, m2 == m3 && e2 == e3);
+	if(x1)
+		CuAssertTrue(tc, m1 == m2);
+	region_destroy(region);
+}
+
+/* check that the prefetch of the name stops, and that it finds the
+ * domain in the hash index */
+static void
+check_prefetch(CuTest* tc, domain_table_type* table, const char* str)
+{
+	region_type* region = region_create(xalloc, free);
+	const dname_type* dname = dname_parse(region, str);
+	domain_type* d = domain_table_find(table, dname);
+	struct domain_prefetch p;
+	int steps = 0;
+	if(domain_table_prefetch_start(table, &p, dname_name(dname),
+		dname->name_size)) {
+		if(table->hash && d) {
+			CuAssertTrue(tc, domain_table_prefetch_step(table, &p));
+			CuAssertTrue(tc, p.domain == d);
+		}
+		while(p.active && steps++ < 256)
+			(void)domain_table_prefetch_step(table, &p);
+	}
+	CuAssertTrue(tc, steps < 256);
+	/* the name has to end in the packet */
+	CuAssertTrue(tc, !domain_table_prefetch_start(table, &p,
+		dname_name(dname), dname->name_size-1));
+	region_destroy(region);
+}
+
+/* test _5 : the name hash index, with growth, deletes and case */
+static void namedb_5(CuTest *tc)
+{
+	region_type* region;
+	namedb_type db;
+	char buf[64];
+	int i;
+	if(v) printf("test 5 namedb start\n");
+	region = region_create(xalloc, free);
+	memset(&db, 0, sizeof(db));
+	db.region = region;
+	db.domains = domain_table_create(region);
+	domain_table_insert(db.domains, dname_parse(region, "example.org."));
+	domain_table_hash_enable(db.domains);
+	for(i=0; i<3000; i++) {
+		snprintf(buf, sizeof(buf), "h%d.s%d.example.org.", i, i%7);
+		domain_table_insert(db.domains, dname_parse(region, buf));
+	}
+	CuAssertTrue(tc, db.domains->hash->count ==
+		domain_table_count(db.domains));
+	/* delete every third name, and the empty parents */
+	for(i=0; i<3000; i+=3) {
+		domain_type* d;
+		snprintf(buf, sizeof(buf), "h%d.s%d.example.org.", i, i%7);
+		d = domain_table_find(db.domains, dname_parse(region, buf));
+		CuAssertTrue(tc, d != NULL);
+		domain_table_deldomain(&db, d);
+	}
+	CuAssertTrue(tc, db.domains->hash->count ==
+		domain_table_count(db.domains));
+	for(i=0; i<3000; i++) {
+		snprintf(buf, sizeof(buf), "h%d.s%d.example.org.", i, i%7);
+		check_hash_lookup(tc, db.domains, buf);
+		snprintf(buf, sizeof(buf), "H%d.S%d.Example.ORG.", i, i%7);
+		check_hash_lookup(tc, db.domains, buf);
+		snprintf(buf, sizeof(buf), "x.h%d.s%d.example.org.", i, i%7);
+		check_hash_lookup(tc, db.domains, buf);
+		if(i%100 == 1) {
+			struct domain_hash* hash = db.domains->hash;
+			check_prefetch(tc, db.domains, buf);
+			snprintf(buf, sizeof(buf), "H%d.S%d.Example.ORG.",
+				i, i%7);
+			check_prefetch(tc, db.domains, buf);
+			db.domains->hash = NULL;
+			check_prefetch(tc, db.domains, buf);
+			db.domains->hash = hash;
+		}
+	}
+	check_hash_lookup(tc, db.domains, ".");
+	check_hash_lookup(tc, db.domains, "s3.EXAMPLE.org.");
+	check_hash_lookup(tc, db.domains, "nothere.");
+	check_prefetch(tc, db.domains, ".");
+	check_prefetch(tc, db.domains, "nothere.");
+	if(v) printf("test 5 namedb end\n");
+	region_destroy(region);
+}
+
+/** add an rrset of the type, without rrs, to the domain */
+static rrset_type*
+add_test_rrset(region_type* region, domain_type* d, zone_type* z,
+	uint16_t type)
+{
+	rrset_type* rrset = (rrset_type*)region_alloc_zero(region,
+		sizeof(rrset_type));
+	rrset->zone = z;
+	rrset->type = type;
+	domain_add_rrset(d, rrset);
+	return rrset;
+}
+
+/* test _7 : the rrset types of a domain, for two zones at a zone cut */
+static void namedb_7(CuTest *tc)
+{
+	region_type* region;
+	domain_table_type* table;
+	zone_type z1, z2;
+	domain_type* d;
+	rrset_type *a, *ns1, *ns2, *srv;
+	if(v) printf("test 7 namedb start\n");
+	region = region_create(xalloc, free);
+	table = domain_table_create(region);
+	d = domain_table_insert(table, dname_parse(region, "sub.example.org."));
+	CuAssertTrue(tc, d->rrset_types == 0);
+	a = add_test_rrset(region, d, &z2, TYPE_A);
+	ns1 = add_test_rrset(region, d, &z1, TYPE_NS);
+	ns2 = add_test_rrset(region, d, &z2, TYPE_NS);
+	srv = add_test_rrset(region, d, &z2, TYPE_SRV);
+	CuAssertTrue(tc, domain_find_rrset(d, &z2, TYPE_A) == a);
+	CuAssertTrue(tc, domain_find_rrset(d, &z1, TYPE_A) == NULL);
+	CuAssertTrue(tc, domain_find_rrset(d, &z1, TYPE_NS) == ns1);
+	CuAssertTrue(tc, domain_find_rrset(d, &z2, TYPE_NS) == ns2);
+	CuAssertTrue(tc, domain_find_rrset(d, &z2, TYPE_SRV) == srv);
+	CuAssertTrue(tc, domain_find_rrset(d, &z2, TYPE_AAAA) == NULL);
+	CuAssertTrue(tc, domain_find_rrset(d, &z2, TYPE_NAPTR) == NULL);
+	CuAssertTrue(tc, !(d->rrset_types & rrset_type_bit(TYPE_AAAA)));
+	/* remove the A rrset, like rrset_delete */
+	d->rrsets = a->next;
+	domain_rrset_types_update(d);
+	CuAssertTrue(tc, !(d->rrset_types & rrset_type_bit(TYPE_A)));
+	CuAssertTrue(tc, domain_find_rrset(d, &z2, TYPE_A) == NULL);
+	CuAssertTrue(tc, domain_find_rrset(d, &z2, TYPE_NS) == ns2);
+	CuAssertTrue(tc, domain_find_rrset(d, &z2, TYPE_SRV) == srv);
+	if(v) printf("test 7 namedb end\n");
+	region_destroy(region);
+}
+
+/** make an rr with rdata of a domain pointer and a number */
+static void
+make_test_rr(region_type* region, rr_type* rr, domain_type* d, uint32_t n)
+{
+	memset(rr, 0, sizeof(*rr));
+	rr->type = TYPE_MX;
+	rr->rdata_count = 2;
+	rr->rdata_domains = 1;
+	rr->rdlength = sizeof(n);
+	rr->rdata = region_alloc(region, rr_rdata_size(rr));
+	rr_rdata_domains(rr)[0] = d;
+	memcpy(rr_rdata_wire(rr), &n, sizeof(n));
+}
+
+/* test _8 : the shared rdata of rrs */
+static void namedb_8(CuTest *tc)
+{
+	region_type* region, *zregion;
+	namedb_type db;
+	domain_table_type* table;
+	domain_type* d;
+	rr_type r1, r2, r3, many[3000];
+	uint32_t i;
+	if(v) printf("test 8 namedb start\n");
+	region = region_create(xalloc, free);
+	zregion = region_create(xalloc, free);
+	memset(&db, 0, sizeof(db));
+	db.region = region;
+	table = domain_table_create(region);
+	d = domain_table_insert(table, dname_parse(region, "mx.example.org."));
+
+	/* without the table the rdata is not shared */
+	make_test_rr(zregion, &r1, d, 10);
+	rr_share_rdata(&db, zregion, &r1);
+	CuAssertTrue(tc, !r1.rdata_shared);
+	rr_release_rdata(&db, zregion, &r1);
+
+	namedb_rdata_table_enable(&db);
+	make_test_rr(zregion, &r1, d, 10);
+	make_test_rr(zregion, &r2, d, 10);
+	make_test_rr(zregion, &r3, d, 20);
+	rr_share_rdata(&db, zregion, &r1);
+	rr_share_rdata(&db, zregion, &r2);
+	rr_share_rdata(&db, zregion, &r3);
+	CuAssertTrue(tc, r1.rdata_shared && r2.rdata_shared && r3.rdata_shared);
+	CuAssertTrue(tc, r1.rdata == r2.rdata);
+	CuAssertTrue(tc, r1.rdata != r3.rdata);
+	CuAssertTrue(tc, rr_rdata_domains(&r2)[0] == d);
+	CuAssertTrue(tc, db.rdata_table->count == 2);
+	rr_release_rdata(&db, zregion, &r1);
+	CuAssertTrue(tc, db.rdata_table->count == 2);
+	rr_release_rdata(&db, zregion, &r2);
+	CuAssertTrue(tc, db.rdata_table->count == 1);
+
+	/* the table grows and the copies are found after it */
+	for(i=0; i<3000; i++) {
+		make_test_rr(zregion, &many[i], d, 1000+i);
+		rr_share_rdata(&db, zregion, &many[i]);
+	}
+	CuAssertTrue(tc, db.rdata_table->count == 3001);
+	CuAssertTrue(tc, db.rdata_table->size >= 3001);
+	make_test_rr(zregion, &r1, d, 1000+2500);
+	rr_share_rdata(&db, zregion, &r1);
+	CuAssertTrue(tc, r1.rdata == many[2500].rdata);
+	rr_release_rdata(&db, zregion, &r1);
+	for(i=0; i<3000; i++)
+		rr_release_rdata(&db, zregion, &many[i]);
+	rr_release_rdata(&db, zregion, &r3);
+	CuAssertTrue(tc, db.rdata_table->count == 0);
+	if(v) printf("test 8 namedb end\n");
+	region_destroy(zregion);
+	region_destroy(region);
+}
+
+/** compare dnames for qsort */
+static int
+cmp_dname_ptr(const void* a, const void* b)
+{
+	return dname_compare(*(const dname_type* const*)a,
+		*(const dname_type* const*)b);
+}
+
+/* test the bulk insert of sorted names in the domain table */
+static void namedb_6(CuTest *tc)
+{
+	region_type* region;
+	domain_table_type* t1, *t2;
+	domain_type* apex, *d1, *d2, *res[600];
+	const dname_type* dnames[600];
+	char buf[64];
+	size_t num;
+	int i;
+	if(v) printf("test 6 namedb start\n");
+	region = region_create(xalloc, free);
+	t1 = domain_table_create(region);
+	t2 = domain_table_create(region);
+	domain_table_hash_enable(t2);
+	domain_table_insert(t1, dname_parse(region, "example.org."));
+	apex = domain_table_insert(t2, dname_parse(region, "example.org."));
+	domain_table_insert(t2, dname_parse(region, "zz.org."));
+	/* wildcards and empty nonterminals */
+	for(i=0; i<600; i++) {
+		if(i%5 == 0)
+			snprintf(buf, sizeof(buf), "*.s%d.example.org.", i%13);
+		else if(i%5 == 1)
+			snprintf(buf, sizeof(buf), "a.b.h%d.example.org.", i);
+		else	snprintf(buf, sizeof(buf), "h%d.s%d.example.org.",
+				i, i%13);
+		dnames[i] = dname_parse(region, buf);
+		domain_table_insert(t1, dnames[i]);
+	}
+	qsort(dnames, 600, sizeof(dnames[0]), cmp_dname_ptr);
+	/* the names have to be unique */
+	CuAssertTrue(tc, !domain_table_bulk_insert(t2, apex, dnames, 600,
+		res));
+	for(i=0, num=0; i<600; i++) {
+		if(num > 0 && dname_compare(dnames[num-1], dnames[i]) == 0)
+			continue;
+		dnames[num++] = dnames[i];
+	}
+	CuAssertTrue(tc, domain_table_bulk_insert(t2, apex, dnames, num,
+		res));
+	/* and there must be no names below the apex yet */
+	CuAssertTrue(tc, !domain_table_bulk_insert(t2, apex, dnames, num,
+		res));
+	CuAssertTrue(tc, domain_table_count(t1)+1 == domain_table_count(t2));
+	CuAssertTrue(tc, t2->hash->count == domain_table_count(t2));
+	for(i=0; i<(int)num; i++)
+		CuAssertTrue(tc, res[i] == domain_table_find(t2, dnames[i]));
+	/* the same tree as with domain_table_insert */
+	d2 = domain_table_find(t2, domain_dname(apex));
+	for(d1 = domain_table_find(t1, domain_dname(apex)); d1;
+		d1 = domain_next(d1), d2 = domain_next(d2)) {
+		CuAssertTrue(tc, d2 != NULL);
+		CuAssertTrue(tc, dname_compare(domain_dname(d1),
+			domain_dname(d2)) == 0);
+		CuAssertTrue(tc, dname_compare(domain_dname(d1->parent),
+			domain_dname(d2->parent)) == 0);
+		CuAssertTrue(tc, dname_compare(domain_dname(
+			d1->wildcard_child_closest_match), domain_dname(
+			d2->wildcard_child_closest_match)) == 0);
+		CuAssertTrue(tc, domain_table_find(t2, domain_dname(d2))
+			== d2);
+	}
+	CuAssertTrue(tc, d2 && domain_next(d2) == NULL &&
+		strcmp(domain_to_string(d2), "zz.org.") == 0);
+	if(v) printf("test 6 namedb end\n");
+	region_destroy(region);
+}
+
+/* test the insert cursor, with names in order and out of order */
+static void namedb_11(CuTest *tc)
+{
+	region_type* region;
+	domain_table_type* t1, *t2;
+	struct domain_cursor cursor;
+	domain_type* d1, *d2;
+	const dname_type* dnames[300];
+	char buf[64];
+	int i;
+	if(v) printf("test 11 namedb start\n");
+	region = region_create(xalloc, free);
+	t1 = domain_table_create(region);
+	t2 = domain_table_create(region);
+	domain_table_insert(t1, dname_parse(region, "example.org."));
+	domain_table_insert(t2, dname_parse(region, "example.org."));
+	for(i=0; i<300; i++) {
+		if(i%5 == 0)
+			snprintf(buf, sizeof(buf), "*.s%d.example.org.", i%13);
+		else if(i%5 == 1)
+			snprintf(buf, sizeof(buf), "a.b.h%d.example.org.", i);
+		else	snprintf(buf, sizeof(buf), "h%d.s%d.example.org.",
+				i, i%13);
+		dnames[i] = dname_parse(region, buf);
+		domain_table_insert(t1, dnames[i]);
+	}
+	qsort(dnames, 300, sizeof(dnames[0]), cmp_dname_ptr);
+	/* in order, with duplicates, and every seventh name is followed
+	 * by one from further on, like the names in the rdata */
+	cursor.last = NULL;
+	for(i=0; i<300; i++) {
+		d2 = domain_table_insert_cursor(t2, &cursor, dnames[i]);
+		CuAssertTrue(tc, dname_compare(domain_dname(d2), dnames[i])
+			== 0);
+		CuAssertTrue(tc, cursor.last == d2);
+		if(i%7 == 0 && i+40 < 300)
+			(void)domain_table_insert(t2, dnames[i+40]);
+	}
+	/* out of order, the names are there already */
+	for(i=299; i>=0; i-=3)
+		CuAssertTrue(tc, domain_table_insert_cursor(t2, &cursor,
+			dnames[i]) == domain_table_find(t2, dnames[i]));
+	CuAssertTrue(tc, domain_table_count(t1) == domain_table_count(t2));
+	/* the same tree as with domain_table_insert */
+	for(d1 = t1->root, d2 = t2->root; d1;
+		d1 = domain_next(d1), d2 = domain_next(d2)) {
+		CuAssertTrue(tc, d2 != NULL);
+		CuAssertTrue(tc, dname_compare(domain_dname(d1),
+			domain_dname(d2)) == 0);
+		if(d1->parent)
+			CuAssertTrue(tc, dname_compare(domain_dname(
+				d1->parent), domain_dname(d2->parent)) == 0);
+		CuAssertTrue(tc, dname_compare(domain_dname(
+			d1->wildcard_child_closest_match), domain_dname(
+			d2->wildcard_child_closest_match)) == 0);
+		CuAssertTrue(tc, domain_table_find(t2, domain_dname(d2))
+			== d2);
+	}
+	CuAssertTrue(tc, d2 == NULL);
+	if(v) printf("test 11 namedb end\n");
+	region_destroy(region);
+}
+
+/* test the write-behind of the udb, the changes are written at the flush */
+static void namedb_12(CuTest *tc)
+{
+	region_type* region;
+	namedb_type* db;
+	zone_type* zone;
+	udb_ptr udbz;
+	uint64_t count;
+	if(v) printf("test 12 namedb start\n");
+	region = region_create(xalloc, free);
+	db = create_and_read_db(tc, region, "example.org.",
+		"example.org. IN SOA ns.example.org. hostmaster.example.org. 2011041200 28800 7200 604800 3600\n"
+		"example.org. IN NS ns.example.com.\n"
+		"www.example.org. IN A 1.2.3.4\n"
+	);
+	zone = find_zone(db, "example.org");
+	if(!udb_zone_search(db->udb, &udbz,
+		dname_name(domain_dname(zone->apex)),
+		domain_dname(zone->apex)->name_size)) {
+		printf("cannot find udbzone\n");
+		exit(1);
+	}
+	count = ZONE(&udbz)->rr_count;
+	diff_udb_defer(1);
+	add_str(db, zone, &udbz, "added.example.org. IN A 1.2.3.5\n");
+	add_str(db, zone, &udbz, "zoop.example.org. IN MX 5 www.example.org.\n");
+	del_str(db, zone, &udbz, "www.example.org. IN A 1.2.3.4\n");
+	diff_udb_defer(0);
+	/* the zone in memory has changed, the udb not yet */
+	check_namedb(tc, db);
+	CuAssertTrue(tc, diff_udb_pending());
+	CuAssertTrue(tc, ZONE(&udbz)->rr_count == count);
+	CuAssertTrue(tc, diff_udb_flush(db) == 3);
+	CuAssertTrue(tc, !diff_udb_pending());
+	CuAssertTrue(tc, ZONE(&udbz)->rr_count == count+1);
+	CuAssertTrue(tc, udb_base_get_userflags(db->udb) == 0);
+	/* and with nothing that waits, it is written right away */
+	add_str(db, zone, &udbz, "more.example.org. IN A 1.2.3.6\n");
+	CuAssertTrue(tc, !diff_udb_pending());
+	CuAssertTrue(tc, ZONE(&udbz)->rr_count == count+2);
+	CuAssertTrue(tc, diff_udb_flush(db) == 0);
+	udb_ptr_unlink(&udbz, db->udb);
+
+	if(v) printf("test 12 namedb end\n");
+	unlink(db->udb->fname);
+	namedb_close(db);
+	region_destroy(region);
+}
+
 #ifdef NSEC3
 /* test the namedb, and add, remove items from it */
 static void
@@ -1756,3 +2223,148 @@ static void namedb_4(CuTest *tc)
 	region_destroy(region);
 }
 #endif /* NSEC3 */
+
+#ifdef NSEC3
+/** add an NSEC3 name for a random hash to the nsec3tree of the zone */
+static domain_type*
+add_test_nsec3(region_type* region, namedb_type* db, zone_type* zone)
+{
+	uint8_t hash[NSEC3_HASH_LEN];
+	char buf[128];
+	size_t i;
+	domain_type* d;
+	for(i=0; i<sizeof(hash); i++)
+		hash[i] = (uint8_t)random();
+	b32_ntop(hash, sizeof(hash), buf, sizeof(buf));
+	strlcpy(buf+32, ".example.org.", sizeof(buf)-32);
+	d = domain_table_insert(db->domains, dname_parse(region, buf));
+	if(d->nsec3 && d->nsec3->nsec3_node.key)
+		return d;
+	nsec3_precompile_nsec3rr(db, d, zone);
+	return d;
+}
+
+/** check that the index finds the covers that the nsec3tree finds */
+static void
+check_nsec3_index(CuTest* tc, zone_type* zone, domain_type** names,
+	size_t num)
+{
+	struct nsec3_index* x = zone->nsec3_index;
+	uint8_t hash[NSEC3_HASH_LEN+1];
+	domain_type* r1, *r2;
+	int e1, e2;
+	size_t i, j;
+	CuAssertTrue(tc, x != NULL);
+	for(i=0; i<1000+num; i++) {
+		if(i < num) {
+			/* the hash of a name in the tree */
+			(void)b32_pton((char*)dname_name(domain_dname(
+				names[i]))+1, hash, sizeof(hash));
+		} else {
+			for(j=0; j<NSEC3_HASH_LEN; j++)
+				hash[j] = (uint8_t)random();
+		}
+		zone->nsec3_index = NULL;
+		e1 = nsec3_find_cover(zone, hash, NSEC3_HASH_LEN, &r1);
+		zone->nsec3_index = x;
+		e2 = nsec3_find_cover(zone, hash, NSEC3_HASH_LEN, &r2);
+		CuAssertTrue(tc, r1 == r2);
+		CuAssertTrue(tc, e1 == e2);
+		CuAssertTrue(tc, i >= num || e2);
+	}
+}
+
+/* test _9 : the index of the nsec3tree, with added and deleted names */
+static void namedb_9(CuTest *tc)
+{
+	region_type* region;
+	namedb_type db;
+	zone_type zone;
+	rr_type param;
+	domain_type* names[1200];
+	size_t i, num = 0;
+	if(v) printf("test 9 namedb start\n");
+	region = region_create(xalloc, free);
+	memset(&db, 0, sizeof(db));
+	memset(&zone, 0, sizeof(zone));
+	db.region = region;
+	db.domains = domain_table_create(region);
+	zone.apex = domain_table_insert(db.domains,
+		dname_parse(region, "example.org."));
+	zone.nsec3_param = &param;
+	nsec3_zone_trees_create(region, &zone);
+	for(i=0; i<1000; i++)
+		names[num++] = add_test_nsec3(region, &db, &zone);
+	nsec3_index_build(region, &zone);
+	CuAssertTrue(tc, zone.nsec3_index &&
+		zone.nsec3_index->count == zone.nsec3tree->count);
+	check_nsec3_index(tc, &zone, names, num);
+
+	/* names in the delta and deleted names */
+	for(i=0; i<50; i++)
+		names[num++] = add_test_nsec3(region, &db, &zone);
+	CuAssertTrue(tc, zone.nsec3_index->delta_count == 50);
+	for(i=0; i<60; i++) {
+		domain_type* d = names[i*7];
+		zone_del_domain_in_hash_tree(zone.nsec3tree,
+			&d->nsec3->nsec3_node);
+		nsec3_index_del(&zone, d);
+		names[i*7] = names[--num];
+	}
+	CuAssertTrue(tc, zone.nsec3_index->deleted > 0);
+	check_nsec3_index(tc, &zone, names, num);
+
+	/* the layout is built again when the delta is full */
+	for(i=0; i<100; i++)
+		names[num++] = add_test_nsec3(region, &db, &zone);
+	CuAssertTrue(tc, zone.nsec3_index->delta_count < 100);
+	check_nsec3_index(tc, &zone, names, num);
+	nsec3_index_clear(&zone);
+	CuAssertTrue(tc, zone.nsec3_index == NULL);
+	if(v) printf("test 9 namedb end\n");
+	region_destroy(region);
+}
+#endif /* NSEC3 */
+
+/* test _10 : the transfers before an AXFR of the zone are skipped */
+static void namedb_10(CuTest *tc)
+{
+	/* zone, is_axfr and if the task is skipped */
+	static const struct { const char* z; int axfr, skip; } t[] = {
+		{ "a.example.", 0, 1 },
+		{ "b.example.", 1, 0 },
+		{ "a.example.", 1, 1 },
+		{ "c.example.", 0, 0 },
+		{ "a.example.", 0, 1 },
+		{ "a.example.", 1, 0 },
+		{ "a.example.", 0, 0 },
+		{ "b.example.", 0, 0 }
+	};
+	char* fname = udbtest_get_temp_file("tasks.udb");
+	region_type* region = region_create(xalloc, free);
+	udb_base* udb = task_file_create(fname);
+	udb_ptr last, p;
+	size_t i;
+	if(v) printf("test 10 namedb start\n");
+	CuAssertTrue(tc, udb != NULL);
+	udb_ptr_init(&last, udb);
+	for(i=0; i<sizeof(t)/sizeof(t[0]); i++)
+		CuAssertTrue(tc, task_new_apply_xfr(udb, &last,
+			dname_parse(region, t[i].z), 1, 2, i, t[i].axfr));
+	udb_ptr_unlink(&last, udb);
+
+	udb_ptr_new(&p, udb, udb_base_get_userdata(udb));
+	task_coalesce_xfr(udb, &p);
+	for(i=0; !udb_ptr_is_null(&p); i++) {
+		CuAssertTrue(tc, TASKLIST(&p)->yesno == i);
+		CuAssertTrue(tc, ((TASKLIST(&p)->xfrflags&TASK_XFR_SKIP)!=0)
+			== t[i].skip);
+		udb_ptr_set_rptr(&p, udb, &TASKLIST(&p)->next);
+	}
+	CuAssertTrue(tc, i == sizeof(t)/sizeof(t[0]));
+	udb_ptr_unlink(&p, udb);
+	udb_base_free(udb);
+	unlink(fname);
+	region_destroy(region);
+	if(v) printf("test 10 namedb end\n");
+}
@@ -17,6 +17,7 @@
 #include "util.h"
 #include "dname.h"
 #include "nsd.h"
+#include "query.h"
 
 static void acl_1(CuTest *tc);
 static void acl_2(CuTest *tc);
@@ -24,6 +25,7 @@ static void acl_3(CuTest *tc);
 static void acl_4(CuTest *tc);
 static void acl_5(CuTest *tc);
 static void acl_6(CuTest *tc);
+static void acl_7(CuTest *tc);
 static void replace_1(CuTest *tc);
 static void replace_2(CuTest *tc);
 static void zonelist_1(CuTest *tc);
@@ -38,6 +40,7 @@ CuSuite* reg_cutest_options(void)
 	SUITE_ADD_TEST(suite, acl_4); /* parse_acl_range_type */
 	SUITE_ADD_TEST(suite, acl_5); /* parse_acl_range_subnet */
 	SUITE_ADD_TEST(suite, acl_6); /* acl_same_host */
+	SUITE_ADD_TEST(suite, acl_7); /* acl_list_index */
 	SUITE_ADD_TEST(suite, replace_1); /* replace_str */
 	SUITE_ADD_TEST(suite, replace_2); /* make_zonefile */
 	SUITE_ADD_TEST(suite, zonelist_1); /* zonelist */
@@ -483,6 +486,15 @@ static void zonelist_1(CuTest *tc)
 	check_zonelist_file(tc, opt, "# NSD zone list\n# name pattern\n"
 		"add example.com master\n" "del bar.nl slave\n"
 		"add zoink.com slave\n");
+	/* the offsets of the lines that are read */
+	RBTREE_FOR(z1, zone_options_t*, opt->zone_options) {
+		if(strcmp(z1->name, "example.com") == 0)
+			CuAssertTrue(tc, z1->off == (off_t)31 &&
+				z1->linesize == 23);
+		else	CuAssertTrue(tc, z1->off == (off_t)71 &&
+				z1->linesize == 20);
+	}
+	CuAssertTrue(tc, opt->zonelist_off == (off_t)91);
 	zone_list_compact(opt);
 	/* check contents of zonelist file */
 	check_zonelist_file(tc, opt, "# NSD zone list\n# name pattern\n"
@@ -500,3 +512,91 @@ static void zonelist_1(CuTest *tc)
 	region_destroy(region);
 	unlink(zname);
 }
+
+/* check acl_check_incoming with and without the index of the list */
+static void acl_7_chk(CuTest *tc, acl_options_t* list, const char* ip,
+	unsigned port)
+{
+	struct query q;
+	struct acl_index* index = list->index;
+	acl_options_t* r1, *r2;
+	int n1, n2;
+	memset(&q, 0, sizeof(q));
+	q.tsig.status = TSIG_NOT_PRESENT;
+	if(strchr(ip, ':')) {
+#ifdef INET6
+		struct sockaddr_in6* sa = (struct sockaddr_in6*)&q.addr;
+		sa->sin6_family = AF_INET6;
+		sa->sin6_port = htons(port);
+		CuAssert(tc, "acl_7 addr",
+			inet_pton(AF_INET6, ip, &sa->sin6_addr) == 1);
+#else
+		return;
+#endif
+	} else {
+		struct sockaddr_in* sa = (struct sockaddr_in*)&q.addr;
+		sa->sin_family = AF_INET;
+		sa->sin_port = htons(port);
+		CuAssert(tc, "acl_7 addr",
+			inet_pton(AF_INET, ip, &sa->sin_addr) == 1);
+	}
+	n1 = acl_check_incoming(list, &q, &r1);
+	list->index = NULL;
+	n2 = acl_check_incoming(list, &q, &r2);
+	list->index = index;
+	if(n1 != n2 || r1 != r2)
+		printf("acl_7 %s@%u: index %d, list %d\n", ip, port, n1, n2);
+	CuAssert(tc, "acl_7 same number", n1 == n2);
+	CuAssert(tc, "acl_7 same reason", r1 == r2);
+}
+
+static void acl_7(CuTest *tc)
+{
+	/* acl_list_index */
+	region_type* region = region_create(xalloc, free);
+	static const char* spec[][2] = {
+		{"10.0.0.0/8", "NOKEY"},
+		{"10.1.2.3", "BLOCKED"},
+		{"10.1.0.0/16", "NOKEY"},
+		{"192.0.2.0&255.255.255.0", "NOKEY"},
+		{"192.0.2.10-192.0.2.20", "BLOCKED"},
+		{"192.0.2.5", "somekey"},
+		{"198.51.100.0/24@5353", "NOKEY"},
+		{"10.255.0.1-10.255.0.200", "NOKEY"},
+		{"10.0.7.0&255.0.255.0", "NOKEY"},
+		{"203.0.113.7", "NOKEY"},
+		{"203.0.113.7", "BLOCKED"},
+		{"172.16.0.0/12", "BLOCKED"},
+		{"2001:db8::/32", "NOKEY"},
+		{"2001:db8::1", "BLOCKED"},
+		{"2001:db8:1::-2001:db8:1::ff", "NOKEY"},
+		{"fe80::/10", "NOKEY"},
+		{"0.0.0.0/0", "somekey"},
+		{NULL, NULL}
+	};
+	static const char* addr[] = { "10.0.0.1", "10.1.2.3", "10.1.2.4",
+		"10.2.7.9", "11.0.7.9", "192.0.2.1", "192.0.2.5", "192.0.2.10",
+		"192.0.2.20", "192.0.2.21", "198.51.100.1", "10.255.0.1",
+		"10.255.0.200", "10.255.0.201", "203.0.113.7", "203.0.113.8",
+		"172.20.1.1", "172.32.0.1", "8.8.8.8", "0.0.0.0",
+		"255.255.255.255", "2001:db8::1", "2001:db8::2",
+		"2001:db8:1::80", "2001:db8:1::100", "2001:db9::1", "fe80::1",
+		"fec0::1", "::", NULL };
+	acl_options_t* list = NULL, *last = NULL, *acl;
+	int i;
+
+	for(i=0; spec[i][0]; i++) {
+		acl = parse_acl_info(region, region_strdup(region, spec[i][0]),
+			spec[i][1]);
+		if(last) last->next = acl;
+		else list = acl;
+		last = acl;
+	}
+	acl_list_index(region, list);
+	CuAssert(tc, "acl_7 index", list->index != NULL);
+	for(i=0; addr[i]; i++) {
+		acl_7_chk(tc, list, addr[i], 53);
+		acl_7_chk(tc, list, addr[i], 5353);
+	}
+	region_destroy(region);
+}
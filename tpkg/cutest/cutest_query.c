@@ -0,0 +1,528 @@
+/*
+	test the dname compression table in query.h, and RR encoding,
+	and the heavy hitter tables that count the queries
+*/
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "tpkg/cutest/cutest.h"
+#include "query.h"
+#include "packet.h"
+#include "topk.h"
+
+static void query_compression_1(CuTest *tc);
+static void query_encode_rr_1(CuTest *tc);
+static void query_encode_rrset_1(CuTest *tc);
+static void query_encode_soa_nx_1(CuTest *tc);
+static void query_encode_layout_1(CuTest *tc);
+static void query_topk_1(CuTest *tc);
+#ifdef BIND8_STATS
+static void query_latency_1(CuTest *tc);
+#endif
+
+CuSuite* reg_cutest_query(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, query_compression_1);
+	SUITE_ADD_TEST(suite, query_encode_rr_1);
+	SUITE_ADD_TEST(suite, query_encode_rrset_1);
+	SUITE_ADD_TEST(suite, query_encode_soa_nx_1);
+	SUITE_ADD_TEST(suite, query_encode_layout_1);
+	SUITE_ADD_TEST(suite, query_topk_1);
+#ifdef BIND8_STATS
+	SUITE_ADD_TEST(suite, query_latency_1);
+#endif
+	return suite;
+}
+
+/* more domains than fit in the table, numbered like a big db */
+#define TEST_DOMAINS (MAX_COMPRESSED_DNAMES + 100)
+
+static void query_compression_1(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	query_type* q = query_create(region);
+	domain_type* d = (domain_type*)xalloc_array_zero(TEST_DOMAINS,
+		sizeof(domain_type));
+	domain_type qname;
+	size_t i;
+
+	for(i = 0; i < TEST_DOMAINS; i++)
+		d[i].number = 1000000 + 7*i;
+	memset(&qname, 0, sizeof(qname));
+	query_reset(q, 512, 0);
+
+	/* number 0 is the query name, all others start out absent */
+	CuAssert(tc, "compress qname", query_get_dname_offset(q, &qname)
+		== QHEADERSZ);
+	for(i = 0; i < TEST_DOMAINS; i++)
+		CuAssert(tc, "compress empty", query_get_dname_offset(q, &d[i])
+			== 0);
+
+	/* entries past the compression limits are not stored */
+	query_put_dname_offset(q, &d[0], MAX_COMPRESSION_OFFSET+1);
+	CuAssert(tc, "compress offset", query_get_dname_offset(q, &d[0]) == 0);
+	for(i = 0; i < TEST_DOMAINS; i++)
+		query_put_dname_offset(q, &d[i], QHEADERSZ + 2*i);
+	CuAssert(tc, "compress count", q->compressed_dname_count
+		== MAX_COMPRESSED_DNAMES);
+	for(i = 0; i < TEST_DOMAINS; i++)
+		CuAssert(tc, "compress get", query_get_dname_offset(q, &d[i])
+			== (i < MAX_COMPRESSED_DNAMES ? QHEADERSZ + 2*i : 0));
+
+	/* a second put keeps the first offset */
+	query_put_dname_offset(q, &d[5], 1000);
+	CuAssert(tc, "compress again", query_get_dname_offset(q, &d[5])
+		== QHEADERSZ + 10);
+
+	/* truncation removes the names after the offset */
+	query_clear_dname_offsets(q, QHEADERSZ + 200);
+	CuAssert(tc, "compress truncate", q->compressed_dname_count == 100);
+	for(i = 0; i < TEST_DOMAINS; i++)
+		CuAssert(tc, "compress truncated",
+			query_get_dname_offset(q, &d[i])
+			== (i < 100 ? QHEADERSZ + 2*i : 0));
+	query_put_dname_offset(q, &d[TEST_DOMAINS-1], QHEADERSZ + 200);
+	CuAssert(tc, "compress readd", query_get_dname_offset(q,
+		&d[TEST_DOMAINS-1]) == QHEADERSZ + 200);
+
+	/* the next query starts with an empty table */
+	query_reset(q, 512, 0);
+	CuAssert(tc, "compress reset", q->compressed_dname_count == 0);
+	for(i = 0; i < TEST_DOMAINS; i++)
+		CuAssert(tc, "compress reset get",
+			query_get_dname_offset(q, &d[i]) == 0);
+	CuAssert(tc, "compress reset qname", query_get_dname_offset(q, &qname)
+		== QHEADERSZ);
+
+	free(d);
+	region_destroy(region);
+}
+
+/* encode two MX RRs, that fit in maxlen, and return the length */
+static size_t encode_two_mx(query_type* q, size_t maxlen,
+	domain_type* owner, rr_type* rr)
+{
+	query_reset(q, maxlen, 0);
+	buffer_set_position(q->packet, QHEADERSZ);
+	if(!packet_encode_rr(q, owner, rr, 3600))
+		return 0;
+	if(!packet_encode_rr(q, owner, rr, 3600))
+		return 0;
+	return buffer_position(q->packet);
+}
+
+/* the unchecked encoder, used when the RR surely fits, writes the same
+ * packet as the checked one, and truncation still works */
+static void query_encode_rr_1(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	domain_table_type* table = domain_table_create(region);
+	query_type* q = query_create(region);
+	domain_type* owner = domain_table_insert(table,
+		dname_parse(region, "www.example.com."));
+	domain_type* exchange = domain_table_insert(table,
+		dname_parse(region, "mail.example.com."));
+	uint8_t rdata[sizeof(domain_type*) + sizeof(uint16_t)];
+	uint8_t first[128];
+	rr_type rr;
+	size_t len, len2;
+
+	/* MX 10 mail.example.com. */
+	memcpy(rdata, &exchange, sizeof(exchange));
+	write_uint16(rdata + sizeof(exchange), 10);
+	memset(&rr, 0, sizeof(rr));
+	rr.owner = owner;
+	rr.rdata = rdata;
+	rr.type = TYPE_MX;
+	rr.klass = CLASS_IN;
+	rr.rdlength = sizeof(uint16_t);
+	rr.rdata_count = 2;
+	rr.rdata_domains = 1;
+
+	/* room for the worst case, the unchecked encoder is used */
+	len = encode_two_mx(q, 512, owner, &rr);
+	/* owner 17, fixed 10, pref 2, mail + pointer 7, then
+	 * pointer 2, fixed 10, pref 2, pointer 2 */
+	CuAssert(tc, "encode len", len == QHEADERSZ + 36 + 16);
+	CuAssert(tc, "encode first", len <= QHEADERSZ + sizeof(first));
+	memcpy(first, buffer_at(q->packet, QHEADERSZ), len - QHEADERSZ);
+	CuAssert(tc, "encode rdlength", read_uint16(first + 25) == 9);
+	CuAssert(tc, "encode pointer", read_uint16(first + 36 + 14)
+		== (0xc000 | (QHEADERSZ + 29)));
+
+	/* just enough room, the checked encoder is used */
+	len2 = encode_two_mx(q, len, owner, &rr);
+	CuAssert(tc, "encode checked len", len2 == len);
+	CuAssert(tc, "encode checked same", memcmp(first,
+		buffer_at(q->packet, QHEADERSZ), len - QHEADERSZ) == 0);
+
+	/* the second RR does not fit, it is removed again */
+	CuAssert(tc, "encode truncate", encode_two_mx(q, len-1, owner, &rr)
+		== 0);
+	CuAssert(tc, "encode truncate pos", buffer_position(q->packet)
+		== QHEADERSZ + 36);
+
+	region_destroy(region);
+}
+
+/* encode the rrset in the answer section, in maxlen, returns the number
+ * of rrs that are added */
+static int encode_rrset(query_type* q, size_t maxlen, domain_type* owner,
+	rrset_type* rrset)
+{
+	int done = 0;
+	query_reset(q, maxlen, 0);
+	/* the flags, TC is set by the encode */
+	memset(buffer_begin(q->packet), 0, QHEADERSZ);
+	buffer_set_position(q->packet, QHEADERSZ);
+	return packet_encode_rrset(q, owner, rrset, ANSWER_SECTION, maxlen,
+		&done);
+}
+
+/* an rrset that cannot fit, by its wire_min, is truncated before it
+ * is encoded, one that may fit is encoded and truncated if needed */
+static void query_encode_rrset_1(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	domain_table_type* table = domain_table_create(region);
+	query_type* q = query_create(region);
+	domain_type* owner = domain_table_insert(table,
+		dname_parse(region, "www.example.com."));
+	domain_type* exchange = domain_table_insert(table,
+		dname_parse(region, "mail.example.com."));
+	uint8_t rdata[sizeof(domain_type*) + sizeof(uint16_t)];
+	rr_type rrs[2];
+	rrset_type rrset;
+
+	/* two times MX 10 mail.example.com. */
+	memcpy(rdata, &exchange, sizeof(exchange));
+	write_uint16(rdata + sizeof(exchange), 10);
+	memset(rrs, 0, sizeof(rrs));
+	rrs[0].owner = owner;
+	rrs[0].rdata = rdata;
+	rrs[0].type = TYPE_MX;
+	rrs[0].klass = CLASS_IN;
+	rrs[0].rdlength = sizeof(uint16_t);
+	rrs[0].rdata_count = 2;
+	rrs[0].rdata_domains = 1;
+	rrs[1] = rrs[0];
+	memset(&rrset, 0, sizeof(rrset));
+	rrset.rrs = rrs;
+	rrset.rr_count = 2;
+	rrset.type = TYPE_MX;
+	rrset_wire_min_update(&rrset);
+	/* owner 1, fixed 10, pref 2, exchange 1 */
+	CuAssert(tc, "wire_min", rrset.wire_min == 2*14);
+
+	/* it fits, 36 + 16 bytes as in query_encode_rr_1 */
+	CuAssert(tc, "rrset fits", encode_rrset(q, QHEADERSZ + 52, owner,
+		&rrset) == 2);
+	CuAssert(tc, "rrset fits pos", buffer_position(q->packet)
+		== QHEADERSZ + 52);
+	CuAssert(tc, "rrset fits tc", !TC(q->packet));
+
+	/* it may fit by the wire_min, it is encoded and removed again */
+	CuAssert(tc, "rrset partial", encode_rrset(q, QHEADERSZ + 51, owner,
+		&rrset) == 0);
+	CuAssert(tc, "rrset partial pos", buffer_position(q->packet)
+		== QHEADERSZ);
+	CuAssert(tc, "rrset partial tc", TC(q->packet));
+	CuAssert(tc, "rrset partial names", q->compressed_dname_count == 0);
+
+	/* it cannot fit, nothing is encoded */
+	CuAssert(tc, "rrset early", encode_rrset(q, QHEADERSZ + 27, owner,
+		&rrset) == 0);
+	CuAssert(tc, "rrset early pos", buffer_position(q->packet)
+		== QHEADERSZ);
+	CuAssert(tc, "rrset early tc", TC(q->packet));
+	CuAssert(tc, "rrset early names", q->compressed_dname_count == 0);
+
+	region_destroy(region);
+}
+
+/* encode the SOA in the authority section after the question for qname,
+ * returns the length of the packet */
+static size_t encode_soa_nx(query_type* q, domain_type* qname,
+	domain_type* apex, rrset_type* rrset)
+{
+	const dname_type* name = domain_dname(qname);
+	int done = 0;
+	query_reset(q, 512, 0);
+	memset(buffer_begin(q->packet), 0, QHEADERSZ);
+	buffer_set_position(q->packet, QHEADERSZ);
+	buffer_write(q->packet, dname_name(name), name->name_size);
+	buffer_write_u16(q->packet, TYPE_A);
+	buffer_write_u16(q->packet, CLASS_IN);
+	query_add_compression_domain(q, qname, QHEADERSZ);
+	if(packet_encode_rrset(q, apex, rrset, AUTHORITY_SECTION, 512,
+		&done) != 1)
+		return 0;
+	return buffer_position(q->packet);
+}
+
+/* the SOA from the soa_nx_wire of the zone is the same as the encoded
+ * one, for a query name in the zone and one that is not */
+static void query_encode_soa_nx_1(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	domain_table_type* table = domain_table_create(region);
+	query_type* q = query_create(region);
+	domain_type* apex = domain_table_insert(table,
+		dname_parse(region, "example.com."));
+	domain_type* ns = domain_table_insert(table,
+		dname_parse(region, "ns1.example.com."));
+	domain_type* host = domain_table_insert(table,
+		dname_parse(region, "host.example.org."));
+	domain_type* www = domain_table_insert(table,
+		dname_parse(region, "www.example.com."));
+	uint8_t rdata[2*sizeof(domain_type*) + 20];
+	uint8_t first[128];
+	rr_type rr;
+	rrset_type rrset;
+	zone_type zone;
+	size_t len, i;
+
+	/* SOA ns1.example.com. host.example.org. 1 2 3 4 5 */
+	memcpy(rdata, &ns, sizeof(ns));
+	memcpy(rdata + sizeof(ns), &host, sizeof(host));
+	for(i = 0; i < 5; i++)
+		write_uint32(rdata + 2*sizeof(ns) + 4*i, (uint32_t)(i+1));
+	memset(&rr, 0, sizeof(rr));
+	rr.owner = apex;
+	rr.rdata = rdata;
+	rr.ttl = 5;
+	rr.type = TYPE_SOA;
+	rr.klass = CLASS_IN;
+	rr.rdlength = 20;
+	rr.rdata_count = 7;
+	rr.rdata_domains = 2;
+	memset(&rrset, 0, sizeof(rrset));
+	rrset.rrs = &rr;
+	rrset.rr_count = 1;
+	rrset.type = TYPE_SOA;
+	rrset.zone = &zone;
+	rrset_wire_min_update(&rrset);
+	memset(&zone, 0, sizeof(zone));
+	zone.apex = apex;
+	zone.region = region;
+	zone.soa_nx_rrset = &rrset;
+
+	len = encode_soa_nx(q, www, apex, &rrset);
+	CuAssert(tc, "soa_nx encode", len != 0 && len <= sizeof(first));
+	memcpy(first, buffer_begin(q->packet), len);
+
+	zone_soa_nx_wire_update(&zone);
+	CuAssert(tc, "soa_nx wire", zone.soa_nx_wire != NULL);
+	/* the owner and ns1 have a pointer to the apex */
+	CuAssert(tc, "soa_nx ptrs", zone.soa_nx_wire->ptr_count == 2);
+	CuAssert(tc, "soa_nx same", encode_soa_nx(q, www, apex, &rrset)
+		== len && memcmp(first, buffer_begin(q->packet), len) == 0);
+
+	/* the apex is not in the packet, the encoder is used */
+	len = encode_soa_nx(q, host, apex, &rrset);
+	CuAssert(tc, "soa_nx other", len != 0 && len <= sizeof(first));
+	memcpy(first, buffer_begin(q->packet), len);
+	zone.soa_nx_wire = NULL;
+	CuAssert(tc, "soa_nx other same", encode_soa_nx(q, host, apex,
+		&rrset) == len && memcmp(first, buffer_begin(q->packet),
+		len) == 0);
+
+	region_destroy(region);
+}
+
+/* encode the rrs in maxlen, returns the length or 0 if they do not fit */
+static size_t encode_rrs(query_type* q, size_t maxlen, domain_type* owner,
+	rr_type* rrs, size_t count)
+{
+	size_t i;
+	query_reset(q, maxlen, 0);
+	buffer_set_position(q->packet, QHEADERSZ);
+	for(i = 0; i < count; i++) {
+		if(!packet_encode_rr(q, owner, &rrs[i], 3600))
+			return 0;
+	}
+	return buffer_position(q->packet);
+}
+
+/* the names at the offsets of the layout of packet_init are encoded
+ * the same as with the descriptors, checked and unchecked */
+static void query_encode_layout_1(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	domain_table_type* table = domain_table_create(region);
+	query_type* q = query_create(region);
+	domain_type* owner = domain_table_insert(table,
+		dname_parse(region, "www.example.com."));
+	domain_type* mail = domain_table_insert(table,
+		dname_parse(region, "mail.example.com."));
+	domain_type* ns = domain_table_insert(table,
+		dname_parse(region, "ns1.example.net."));
+	uint8_t mx[sizeof(domain_type*) + 2];
+	uint8_t soa[2*sizeof(domain_type*) + 20];
+	uint8_t srv[sizeof(domain_type*) + 6];
+	uint8_t first[256];
+	rr_type rrs[3];
+	size_t len, i;
+
+	/* MX 10 mail.example.com. */
+	memcpy(mx, &mail, sizeof(mail));
+	write_uint16(mx + sizeof(mail), 10);
+	/* SOA ns1.example.net. mail.example.com. 1 2 3 4 5 */
+	memcpy(soa, &ns, sizeof(ns));
+	memcpy(soa + sizeof(ns), &mail, sizeof(mail));
+	for(i = 0; i < 5; i++)
+		write_uint32(soa + 2*sizeof(ns) + 4*i, (uint32_t)(i+1));
+	/* SRV 1 2 53 ns1.example.net., the name is not compressed */
+	memcpy(srv, &ns, sizeof(ns));
+	write_uint16(srv + sizeof(ns), 1);
+	write_uint16(srv + sizeof(ns) + 2, 2);
+	write_uint16(srv + sizeof(ns) + 4, 53);
+	memset(rrs, 0, sizeof(rrs));
+	for(i = 0; i < 3; i++) {
+		rrs[i].owner = owner;
+		rrs[i].klass = CLASS_IN;
+	}
+	rrs[0].rdata = mx;
+	rrs[0].type = TYPE_MX;
+	rrs[0].rdlength = 2;
+	rrs[0].rdata_count = 2;
+	rrs[0].rdata_domains = 1;
+	rrs[1].rdata = soa;
+	rrs[1].type = TYPE_SOA;
+	rrs[1].rdlength = 20;
+	rrs[1].rdata_count = 7;
+	rrs[1].rdata_domains = 2;
+	rrs[2].rdata = srv;
+	rrs[2].type = TYPE_SRV;
+	rrs[2].rdlength = 6;
+	rrs[2].rdata_count = 4;
+	rrs[2].rdata_domains = 1;
+
+	len = encode_rrs(q, 512, owner, rrs, 3);
+	CuAssert(tc, "layout len", len != 0 && len <= sizeof(first));
+	memcpy(first, buffer_begin(q->packet), len);
+
+	packet_init();
+	CuAssert(tc, "layout unchecked", encode_rrs(q, 512, owner, rrs, 3)
+		== len && memcmp(first + QHEADERSZ, buffer_at(q->packet,
+		QHEADERSZ), len - QHEADERSZ) == 0);
+	CuAssert(tc, "layout checked", encode_rrs(q, len, owner, rrs, 3)
+		== len && memcmp(first + QHEADERSZ, buffer_at(q->packet,
+		QHEADERSZ), len - QHEADERSZ) == 0);
+	CuAssert(tc, "layout truncate", encode_rrs(q, len-1, owner, rrs, 3)
+		== 0);
+
+	region_destroy(region);
+}
+
+#ifdef BIND8_STATS
+static void query_latency_1(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	query_type* q = query_create(region);
+	int b;
+
+	/* the buckets are in order and every bucket has its start */
+	CuAssert(tc, "latency 0", query_latency_bucket(0) == 0);
+	CuAssert(tc, "latency 511", query_latency_bucket(511) == 0);
+	CuAssert(tc, "latency 512", query_latency_bucket(512) == 1);
+	CuAssert(tc, "latency 767", query_latency_bucket(767) == 1);
+	CuAssert(tc, "latency 768", query_latency_bucket(768) == 2);
+	CuAssert(tc, "latency 1024", query_latency_bucket(1024) == 3);
+	CuAssert(tc, "latency big", query_latency_bucket((uint64_t)1<<40)
+		== LATENCY_BUCKETS-1);
+	for(b=1; b<LATENCY_BUCKETS; b++) {
+		uint64_t s = query_latency_bucket_start(b);
+		CuAssert(tc, "latency start", s > query_latency_bucket_start(b-1));
+		CuAssert(tc, "latency start bucket", query_latency_bucket(s) == b);
+		CuAssert(tc, "latency before start",
+			query_latency_bucket(s-1) == b-1);
+	}
+
+	/* the answer classes from the header of the answer */
+	query_reset(q, 512, 0);
+	buffer_clear(q->packet);
+	memset(buffer_begin(q->packet), 0, QHEADERSZ);
+	q->qtype = TYPE_A;
+	q->qclass = CLASS_IN;
+	AA_SET(q->packet);
+	ANCOUNT_SET(q->packet, 1);
+	CuAssert(tc, "class positive", query_latency_class(q)
+		== LATENCY_POSITIVE);
+	ANCOUNT_SET(q->packet, 0);
+	NSCOUNT_SET(q->packet, 1);
+	CuAssert(tc, "class nodata", query_latency_class(q)
+		== LATENCY_NODATA);
+	AA_CLR(q->packet);
+	CuAssert(tc, "class referral", query_latency_class(q)
+		== LATENCY_REFERRAL);
+	AA_SET(q->packet);
+	RCODE_SET(q->packet, RCODE_NXDOMAIN);
+	CuAssert(tc, "class nxdomain", query_latency_class(q)
+		== LATENCY_NXDOMAIN);
+	RCODE_SET(q->packet, RCODE_REFUSE);
+	CuAssert(tc, "class other", query_latency_class(q)
+		== LATENCY_OTHER);
+	RCODE_SET(q->packet, RCODE_OK);
+	q->qtype = TYPE_AXFR;
+	CuAssert(tc, "class axfr", query_latency_class(q) == LATENCY_AXFR);
+
+	region_destroy(region);
+}
+#endif /* BIND8_STATS */
+
+static void query_topk_1(CuTest *tc)
+{
+	struct nsd n;
+	struct topk_entry* t, *top;
+	size_t size = 16, num, i;
+	char key[32];
+	int idx;
+
+	memset(&n, 0, sizeof(n));
+	n.child_count = 1;
+	n.top_size = size;
+	for(idx=0; idx<2; idx++)
+		n.top_map[idx] = (char*)xalloc_array_zero(1,
+			TOPK_TABLES*size*sizeof(struct topk_entry) + 64);
+
+	/* the heavy hitter stays, among many keys that are seen once */
+	t = topk_tables(&n, 0, 0);
+	for(i=0; i<1000; i++) {
+		topk_update(t, size, (uint8_t*)"heavy", 5);
+		snprintf(key, sizeof(key), "k%d", (int)i);
+		topk_update(t, size, (uint8_t*)key, strlen(key));
+	}
+	for(i=0; i<size; i++)
+		CuAssert(tc, "topk seq even", (t[i].seq&1) == 0);
+	/* the counts of the same key in the other block are added */
+	t = topk_tables(&n, 1, 0);
+	for(i=0; i<10; i++)
+		topk_update(t, size, (uint8_t*)"heavy", 5);
+
+	top = topk_merge(&n, TOPK_QNAME, &num);
+	CuAssert(tc, "topk merge", top != NULL && num > 1 && num <= 2*size);
+	CuAssert(tc, "topk heavy", top[0].len == 5 &&
+		memcmp(top[0].key, "heavy", 5) == 0);
+	CuAssert(tc, "topk count", top[0].count >= 1010 &&
+		top[0].count - top[0].err <= 1010);
+	for(i=1; i<num; i++)
+		CuAssert(tc, "topk sorted", top[i].count <= top[i-1].count);
+	free(top);
+
+	/* the other tables are empty */
+	top = topk_merge(&n, TOPK_ZONE, &num);
+	CuAssert(tc, "topk empty", num == 0);
+	free(top);
+
+	for(idx=0; idx<2; idx++)
+		free(n.top_map[idx]);
+}
@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <time.h>
 #include "radtree.h"
+#include "radrcu.h"
 #include "region-allocator.h"
 #include "util.h"
 
@@ -22,6 +23,8 @@
 static void radtree_1(CuTest* tc);
 static void radtree_2(CuTest* tc);
 static void radtree_3(CuTest* tc);
+static void radtree_4(CuTest* tc);
+static void radtree_5(CuTest* tc);
 
 CuSuite* reg_cutest_radtree(void)
 {
@@ -29,6 +32,8 @@ CuSuite* reg_cutest_radtree(void)
 	SUITE_ADD_TEST(suite, radtree_1);
 	SUITE_ADD_TEST(suite, radtree_2);
 	SUITE_ADD_TEST(suite, radtree_3);
+	SUITE_ADD_TEST(suite, radtree_4);
+	SUITE_ADD_TEST(suite, radtree_5);
 	return suite;
 }
 
@@ -66,15 +71,16 @@ static size_t test_check_invariants(struct radnode* n)
 		for(idx=0; idx<n->len; idx++) {
 			struct radsel* r = &n->array[idx];
 			if(r->node == NULL) {
-				CuAssert(tc, "empty node", r->str == NULL);
 				CuAssert(tc, "empty node", r->len == 0);
+				CuAssert(tc, "empty node", r->node_array == NULL);
 			} else {
-				if(r->len == 0) {
-					CuAssert(tc, "emptystr", r->str == NULL);
-				} else {
-					CuAssert(tc, "filledstr", r->str != NULL);
+				if(r->len > RADSEL_INLINE) {
+					CuAssert(tc, "filledstr", radsel_str(r) != NULL);
 				}
 				CuAssert(tc, "invariant parent", r->node->parent == n);
+				CuAssert(tc, "invariant node array", r->node_array == r->node->array);
+				CuAssert(tc, "invariant node offset", r->node_offset == r->node->offset);
+				CuAssert(tc, "invariant node len", r->node_len == r->node->len);
 				CuAssert(tc, "invariant pidx", r->node->pidx == idx);
 				num += test_check_invariants(r->node);
 			}
@@ -112,7 +118,7 @@ test_check_list_keys(struct radnode* n, struct teststr** all, size_t* all_idx,
 		fullkey[newlen++] = idx + n->offset;
 		if(r->len != 0) {
 			CuAssert(tc, "testkey len", newlen+r->len < fullkey_max);
-			memmove(fullkey+newlen, r->str, r->len);
+			memmove(fullkey+newlen, radsel_str(r), r->len);
 			newlen += r->len;
 		}
 		test_check_list_keys(r->node, all, all_idx, all_num, fullkey,
@@ -489,20 +495,16 @@ static void test_node_print(struct radnode* n, int depth)
 	for(idx=0; idx<n->len; idx++) {
 		struct radsel* d = &n->array[idx];
 		if(!d->node) {
-			CuAssert(tc, "print", d->str == NULL);
 			CuAssert(tc, "print", d->len == 0);
 			continue;
 		}
 		for(i=0; i<depth; i++) fprintf(stderr, " ");
 		if(n->offset+idx == 0) fprintf(stderr, "[.]");
 		else fprintf(stderr, "[%c]", n->offset + idx);
-		if(d->str) {
+		if(d->len != 0) {
 			fprintf(stderr, "+'");
-			test_print_str(d->str, d->len);
+			test_print_str(radsel_str(d), d->len);
 			fprintf(stderr, "'");
-			CuAssert(tc, "print", d->len != 0);
-		} else {
-			CuAssert(tc, "print", d->len == 0);
 		}
 		if(d->node) {
 			fprintf(stderr, " node=%p\n", d->node);
@@ -814,3 +816,188 @@ static void radtree_3(CuTest* t)
 	tc = t;
 	unit_radix();
 }
+
+/* bulk load of sorted strings, then add and del as usual */
+static void radtree_4(CuTest* t)
+{
+	struct region* region = region_create(xalloc, free);
+	struct radtree* rt;
+	struct teststr* all[1000];
+	uint8_t* k[1000];
+	radstrlen_t l[1000];
+	void* e[1000];
+	struct radnode* nodes[1000];
+	unsigned round, num, i, j;
+	tc = t;
+	for(round=0; round<10; round++) {
+		rt = radix_tree_create(region);
+		num = get_ran_val(300);
+		for(i=0; i<num; i++) {
+			uint8_t key[32];
+			radstrlen_t len = get_ran_val(20);
+			/* few letters, so that the keys share prefixes */
+			for(j=0; j<len; j++)
+				key[j] = 'a' + get_ran_val(3);
+			key[len] = 0;
+			all[i] = (struct teststr*)calloc(1, sizeof(*all[i]));
+			CuAssert(tc, "bulk", all[i] != NULL);
+			all[i]->mystr = (uint8_t*)strdup((char*)key);
+			all[i]->mylen = len;
+		}
+		qsort(all, num, sizeof(struct teststr*), &test_sort_cmp);
+		/* remove duplicates */
+		for(i=0, j=0; i<num; i++) {
+			if(j > 0 && test_sort_cmp(&all[j-1], &all[i]) == 0) {
+				free(all[i]->mystr);
+				free(all[i]);
+				continue;
+			}
+			all[j++] = all[i];
+		}
+		num = j;
+		for(i=0; i<num; i++) {
+			k[i] = all[i]->mystr;
+			l[i] = all[i]->mylen;
+			e[i] = all[i];
+		}
+		/* the keys that start with 'c' are added below the root */
+		for(j=0; j<num && (l[j]==0 || k[j][0] < 'c'); j++)
+			;
+		for(i=j; i<num && k[i][0] == 'c'; i++)
+			;
+		CuAssert(tc, "bulk", i == num);
+		if(j == 0)
+			j = num;
+		CuAssert(tc, "bulk", radix_tree_bulk_load(rt, k, l, e, nodes,
+			j));
+		if(j < num) {
+			CuAssert(tc, "bulk", radix_bulk_insert(rt, rt->root, 0,
+				k+j, l+j, e+j, nodes+j, num-j));
+			/* no edges for keys that are in the tree */
+			CuAssert(tc, "bulk", !radix_bulk_insert(rt, rt->root,
+				0, k+j, l+j, e+j, nodes+j, 1));
+		}
+		for(i=0; i<num; i++)
+			all[i]->mynode = nodes[i];
+		CuAssert(tc, "bulk count", rt->count == num);
+		test_checks(rt);
+		test_browse(rt);
+		/* the arrays are allocated exactly, the root grows for
+		 * the insert below it */
+		for(i=0; i<num; i++)
+			CuAssert(tc, "bulk cap", nodes[i] == rt->root ||
+				nodes[i]->len == nodes[i]->capacity);
+		test_ran_add_del(rt);
+		radix_tree_delete(rt);
+	}
+	region_destroy(region);
+}
+
+/** check the radrcu tree, the edges are sorted and there are no nodes
+ * without an element and with fewer than two edges, return the count */
+static size_t rcu_check(struct radrcu_node* n, int isroot)
+{
+	size_t num = (n->elem?1:0);
+	unsigned i;
+	if(!isroot && !n->elem)
+		CuAssert(tc, "rcu no empty nodes", n->len >= 2);
+	for(i=0; i<n->len; i++) {
+		if(i > 0)
+			CuAssert(tc, "rcu sorted", n->edge[i-1].byte <
+				n->edge[i].byte);
+		num += rcu_check(n->edge[i].node, 0);
+	}
+	return num;
+}
+
+/* radrcu: random inserts and removes against the set of keys, and a
+ * reader that keeps the old tree until it leaves */
+static void radtree_5(CuTest* t)
+{
+#define RCU_KEYS 300
+	uint8_t key[RCU_KEYS][8];
+	radstrlen_t len[RCU_KEYS];
+	int in[RCU_KEYS];
+	struct radrcu_tree* rt = radrcu_tree_create(2);
+	struct radrcu_tree snap;
+	size_t i, j, num = 0, waiting;
+	uint8_t dname[] = {3, 'w', 'w', 'w', 2, 'n', 'l', 0};
+	uint8_t upper[] = {3, 'W', 'w', 'W', 2, 'N', 'l', 0};
+	tc = t;
+	CuAssert(tc, "rcu create", rt != NULL);
+	for(i=0; i<RCU_KEYS; i++) {
+		/* a small alphabet, for keys that are prefixes of others */
+		len[i] = (radstrlen_t)(random()%8);
+		for(j=0; j<len[i]; j++)
+			key[i][j] = (uint8_t)('a' + random()%3);
+		in[i] = 0;
+	}
+	for(i=0; i<RCU_KEYS; i++)
+		for(j=0; j<i; j++)
+			if(len[j] != RCU_KEYS && len[i] == len[j] &&
+				memcmp(key[i], key[j], len[i]) == 0)
+				len[i] = RCU_KEYS; /* duplicate, unused */
+	for(i=0; i<20000; i++) {
+		size_t k = random()%RCU_KEYS;
+		if(len[k] == RCU_KEYS)
+			continue;
+		if(in[k]) {
+			CuAssert(tc, "rcu remove", radrcu_remove(rt, key[k],
+				len[k]) == &in[k]);
+			in[k] = 0;
+			num--;
+		} else {
+			CuAssert(tc, "rcu insert", radrcu_insert(rt, key[k],
+				len[k], &in[k]));
+			CuAssert(tc, "rcu dup", !radrcu_insert(rt, key[k],
+				len[k], &in[k]));
+			in[k] = 1;
+			num++;
+		}
+		if(i%1000 == 0) {
+			for(j=0; j<RCU_KEYS; j++)
+				if(len[j] != RCU_KEYS)
+					CuAssert(tc, "rcu search", radrcu_search(
+						rt, key[j], len[j]) == (in[j]?
+						(void*)&in[j]:NULL));
+			CuAssert(tc, "rcu count", rt->count == num &&
+				rcu_check(rt->root, 1) == num);
+			/* no readers, everything replaced is freed */
+			CuAssert(tc, "rcu reclaim", radrcu_reclaim(rt) == 0);
+		}
+	}
+
+	/* a reader keeps the nodes of the tree it entered */
+	radrcu_read_lock(rt, 1);
+	snap = *rt;
+	for(j=0; j<RCU_KEYS; j++) {
+		if(len[j] == RCU_KEYS)
+			continue;
+		if(in[j])
+			(void)radrcu_remove(rt, key[j], len[j]);
+		else	(void)radrcu_insert(rt, key[j], len[j], &in[j]);
+	}
+	waiting = radrcu_reclaim(rt);
+	CuAssert(tc, "rcu grace", waiting != 0);
+	for(j=0; j<RCU_KEYS; j++)
+		if(len[j] != RCU_KEYS)
+			CuAssert(tc, "rcu old tree", radrcu_search(&snap,
+				key[j], len[j]) == (in[j]?(void*)&in[j]:NULL));
+	/* a reader that enters now does not hold the old nodes */
+	radrcu_read_lock(rt, 0);
+	CuAssert(tc, "rcu grace", radrcu_reclaim(rt) == waiting);
+	radrcu_read_unlock(rt, 1);
+	CuAssert(tc, "rcu grace over", radrcu_reclaim(rt) == 0);
+	radrcu_read_unlock(rt, 0);
+
+	/* domain names, case insensitive */
+	CuAssert(tc, "rcu name", radrcu_name_insert(rt, dname, sizeof(dname),
+		&num));
+	CuAssert(tc, "rcu name", radrcu_name_search(rt, upper,
+		sizeof(upper)) == &num);
+	CuAssert(tc, "rcu name", radrcu_name_remove(rt, upper,
+		sizeof(upper)) == &num);
+	CuAssert(tc, "rcu name", radrcu_name_search(rt, dname,
+		sizeof(dname)) == NULL);
+	radrcu_tree_delete(rt);
+}
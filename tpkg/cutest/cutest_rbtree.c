@@ -26,6 +26,7 @@ static void rbtree_7(CuTest *tc);
 static void rbtree_8(CuTest *tc);
 static void rbtree_9(CuTest *tc);
 static void rbtree_10(CuTest *tc);
+static void rbtree_11(CuTest *tc);
 static int testcompare(const void *lhs, const void *rhs);
 
 CuSuite* reg_cutest_rbtree(void)
@@ -46,6 +47,7 @@ CuSuite* reg_cutest_rbtree(void)
 	SUITE_ADD_TEST(suite, rbtree_8);
 	SUITE_ADD_TEST(suite, rbtree_9);
 	SUITE_ADD_TEST(suite, rbtree_10);
+	SUITE_ADD_TEST(suite, rbtree_11);
         
 	return suite;
 }
@@ -744,3 +746,41 @@ static void rbtree_10(CuTest *tc)
 	/* last test remove region */
 	region_destroy(reg);
 }
+
+/* test the bulk build from sorted nodes */
+static void rbtree_11(CuTest *tc)
+{
+	region_type* r = region_create(malloc, free);
+	struct testnode nodes[300];
+	rbnode_t* sorted[301];
+	rbtree_t* t;
+	int key;
+	size_t num, i;
+	for(num=0; num<300; num++) {
+		t = rbtree_create(r, testcompare);
+		for(i=0; i<num; i++) {
+			nodes[i].x = (int)i*2;
+			nodes[i].node.key = &nodes[i].x;
+			sorted[i] = &nodes[i].node;
+		}
+		/* a duplicate is dropped */
+		if(num > 0)
+			sorted[num] = sorted[num-1];
+		rbtree_bulk_build(t, sorted, num?num+1:0);
+		CuAssertTrue(tc, t->count == num);
+		test_tree_integrity(tc, t);
+		/* and the tree works as usual afterwards */
+		for(i=0; i<num; i+=3) {
+			key = (int)i*2;
+			CuAssertTrue(tc, rbtree_delete(t, &key) != NULL);
+			test_tree_integrity(tc, t);
+		}
+		for(i=0; i<num; i+=7) {
+			key = (int)i*2+1;
+			CuAssertTrue(tc, rbtree_search(t, &key) == NULL);
+		}
+		if(tc->failed > 0)
+			break;
+	}
+	region_destroy(r);
+}
@@ -21,11 +21,19 @@
 #endif
 
 static void region_1(CuTest *tc);
+static void region_2(CuTest *tc);
+static void region_3(CuTest *tc);
+static void region_4(CuTest *tc);
+static void region_5(CuTest *tc);
 
 CuSuite* reg_cutest_region(void)
 {
 	CuSuite* suite = CuSuiteNew();
 	SUITE_ADD_TEST(suite, region_1); /* test recycle */
+	SUITE_ADD_TEST(suite, region_2); /* test overflow of arena */
+	SUITE_ADD_TEST(suite, region_3); /* test slabs */
+	SUITE_ADD_TEST(suite, region_4); /* test walk of the blocks */
+	SUITE_ADD_TEST(suite, region_5); /* test profile per tag */
 	return suite;
 }
 
@@ -126,6 +134,37 @@ add_size_tree(rbtree_t* tree, size_t sz)
 	return p;
 }
 
+static void delete_item(rbtree_t* tree, struct sizenode* p,
+	struct blocklist* bl);
+
+/* the memory of a freed block is used for another size once its slab
+ * is empty, forget the freed blocks that overlap the new block */
+static void
+forget_overlapped(rbtree_t* tree, void* block, size_t sz)
+{
+	struct sizenode* p;
+	struct blocklist* bl;
+	int again = 1;
+	while(again) {
+		again = 0;
+		RBTREE_FOR(p, struct sizenode*, tree) {
+			for(bl = p->list; bl; bl = bl->next) {
+				if(bl->alloced || (bl->block == block &&
+					p->size == align_size(sz)))
+					continue;
+				if((char*)bl->block < (char*)block+align_size(sz)
+				  && (char*)block < (char*)bl->block+p->size) {
+					delete_item(tree, p, bl);
+					again = 1;
+					break;
+				}
+			}
+			if(again)
+				break;
+		}
+	}
+}
+
 static void
 test_alloc(CuTest *tc, rbtree_t* tree, region_type* region)
 {
@@ -146,6 +185,7 @@ test_alloc(CuTest *tc, rbtree_t* tree, region_type* region)
 	if(0) printf("test alloc sz=%d(%d)\n", (int)sz, (int)align_size(sz));
 	block = region_alloc(region, sz);
 	CuAssert(tc, "region_alloc nonnull", block != NULL);
+	forget_overlapped(tree, block, sz);
 
 	/* see if it already exists */
 	ret = CheckExist(tree, block, &bl, &p);
@@ -309,3 +349,203 @@ region_1(CuTest *tc)
 	region_destroy(region);
 	region_destroy(tree_region);
 }
+
+/* test overflow detection of a region used as an arena */
+static void
+region_2(CuTest *tc)
+{
+	region_type* region = region_create_custom(xalloc, free, 4096, 4096,
+		DEFAULT_INITIAL_CLEANUP_SIZE, 0);
+	int i;
+	CuAssertTrue(tc, !region_overflowed(region));
+	/* fills the arena, but does not overflow */
+	for(i=0; i<4096/64; i++)
+		CuAssertTrue(tc, region_alloc(region, 64) != NULL);
+	CuAssertTrue(tc, !region_overflowed(region));
+	/* one more needs a new chunk */
+	CuAssertTrue(tc, region_alloc(region, 64) != NULL);
+	CuAssertTrue(tc, region_overflowed(region));
+	region_free_all(region);
+	CuAssertTrue(tc, !region_overflowed(region));
+	/* larger than the arena is a separate allocation */
+	CuAssertTrue(tc, region_alloc(region, 5000) != NULL);
+	CuAssertTrue(tc, region_overflowed(region));
+	region_free_all(region);
+	CuAssertTrue(tc, !region_overflowed(region));
+	region_destroy(region);
+}
+
+/* test the slabs of a recycling region */
+static void
+region_3(CuTest *tc)
+{
+	region_type* region = region_create_custom(xalloc, free,
+		DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+		DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+	void* a[1000];
+	void* b[1000];
+	int i;
+	for(i=0; i<1000; i++) {
+		a[i] = region_alloc(region, 40);
+		b[i] = region_alloc(region, 100);
+		CuAssertTrue(tc, a[i] && b[i]);
+		memset(a[i], 1, 40);
+		memset(b[i], 2, 100);
+	}
+	CuAssertTrue(tc, region_get_slab_used(region) ==
+		1000*align_size(40) + 1000*align_size(100));
+	CuAssertTrue(tc, region_get_slab_mem(region) >=
+		region_get_slab_used(region));
+	/* free every other, the slabs stay */
+	for(i=0; i<1000; i+=2)
+		region_recycle(region, a[i], 40);
+	CuAssertTrue(tc, region_get_slab_used(region) ==
+		500*align_size(40) + 1000*align_size(100));
+	/* the freed objects are used again */
+	for(i=0; i<1000; i+=2) {
+		a[i] = region_alloc(region, 40);
+		CuAssertTrue(tc, a[i] != NULL);
+	}
+	/* free all, the slabs are given back */
+	for(i=0; i<1000; i++) {
+		region_recycle(region, a[i], 40);
+		region_recycle(region, b[i], 100);
+	}
+	CuAssertTrue(tc, region_get_slab_used(region) == 0);
+	CuAssertTrue(tc, region_get_slab_mem(region) == 0);
+	/* and reused for other sizes */
+	for(i=0; i<1000; i++) {
+		a[i] = region_alloc(region, 200);
+		CuAssertTrue(tc, a[i] != NULL);
+		memset(a[i], 3, 200);
+	}
+	for(i=0; i<1000; i++)
+		CuAssertTrue(tc, ((unsigned char*)a[i])[199] == 3);
+	region_destroy(region);
+}
+
+struct walk_blocks {
+	int num;
+	char* start[100];
+	size_t size[100];
+};
+
+static void
+walk_block(void* block, size_t size, void* arg)
+{
+	struct walk_blocks* w = (struct walk_blocks*)arg;
+	if(w->num < 100) {
+		w->start[w->num] = (char*)block;
+		w->size[w->num] = size;
+	}
+	w->num++;
+}
+
+/* the object is inside one of the blocks */
+static int
+walk_has(struct walk_blocks* w, void* p, size_t len)
+{
+	int i;
+	for(i=0; i<w->num && i<100; i++)
+		if((char*)p >= w->start[i] &&
+			(char*)p+len <= w->start[i]+w->size[i])
+			return 1;
+	return 0;
+}
+
+/* test the walk of the memory blocks of a region */
+static void
+region_4(CuTest *tc)
+{
+	region_type* region = region_create_custom(xalloc, free,
+		DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+		DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+	struct walk_blocks w;
+	void* small[50], *medium[50], *large[3];
+	int i;
+	for(i=0; i<50; i++) {
+		small[i] = region_alloc(region, 24);
+		medium[i] = region_alloc(region, 1000);
+	}
+	for(i=0; i<3; i++)
+		large[i] = region_alloc(region, DEFAULT_LARGE_OBJECT_SIZE*2);
+	memset(&w, 0, sizeof(w));
+	region_walk_blocks(region, walk_block, &w);
+	CuAssertTrue(tc, w.num > 0 && w.num <= 100);
+	for(i=0; i<50; i++) {
+		CuAssertTrue(tc, walk_has(&w, small[i], 24));
+		CuAssertTrue(tc, walk_has(&w, medium[i], 1000));
+	}
+	for(i=0; i<3; i++)
+		CuAssertTrue(tc, walk_has(&w, large[i],
+			DEFAULT_LARGE_OBJECT_SIZE*2));
+	region_destroy(region);
+}
+
+/* test the counters per tag of the profile */
+static void
+region_5(CuTest *tc)
+{
+	region_type* region = region_create_custom(xalloc, free,
+		DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+		DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+	region_type* other = region_create(xalloc, free);
+	struct region_tag_stat tags[REGION_TAG_COUNT];
+	void* a, *b, *large;
+	size_t pre;
+	int old;
+
+	/* the memory that is there before is counted for the tag */
+	(void)region_alloc(region, 100);
+	pre = region_get_mem(region);
+	memset(tags, 0, sizeof(tags));
+	CuAssertTrue(tc, region_set_profile(region, tags));
+	CuAssertTrue(tc, tags[REGION_TAG_OTHER].bytes == pre);
+	CuAssertTrue(tc, tags[REGION_TAG_OTHER].allocs == 1);
+
+	old = region_set_tag(region, REGION_TAG_RRSETS);
+	CuAssertTrue(tc, old == REGION_TAG_OTHER);
+	a = region_alloc(region, 24);
+	(void)region_alloc(region, 24);
+	large = region_alloc(region, DEFAULT_LARGE_OBJECT_SIZE*2);
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].bytes ==
+		2*align_size(24) + DEFAULT_LARGE_OBJECT_SIZE*2);
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].allocs == 3);
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].recycle_miss == 3);
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].recycle_hit == 0);
+
+	/* a recycled object is a hit when it is allocated again */
+	region_recycle(region, a, 24);
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].bytes ==
+		align_size(24) + DEFAULT_LARGE_OBJECT_SIZE*2);
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].recycles == 1);
+	b = region_alloc(region, 24);
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].recycle_hit == 1);
+	region_recycle(region, large, DEFAULT_LARGE_OBJECT_SIZE*2);
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].bytes == 2*align_size(24));
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].high ==
+		align_size(24)*2 + DEFAULT_LARGE_OBJECT_SIZE*2);
+
+	/* a region that shares the array, without recycling */
+	(void)region_set_tag(other, REGION_TAG_TCP);
+	CuAssertTrue(tc, region_set_profile(other, tags));
+	(void)region_alloc(other, 64);
+	CuAssertTrue(tc, tags[REGION_TAG_TCP].bytes ==
+		region_get_mem(other));
+	CuAssertTrue(tc, tags[REGION_TAG_TCP].recycle_miss == 0);
+	region_destroy(other);
+	CuAssertTrue(tc, tags[REGION_TAG_TCP].bytes == 0);
+	CuAssertTrue(tc, tags[REGION_TAG_TCP].high != 0);
+
+	/* an object recycled with another tag does not wrap around */
+	(void)region_set_tag(region, REGION_TAG_NSEC3);
+	region_recycle(region, b, 24);
+	CuAssertTrue(tc, tags[REGION_TAG_NSEC3].bytes == 0);
+
+	region_free_all(region);
+	CuAssertTrue(tc, tags[REGION_TAG_OTHER].bytes == 0);
+	CuAssertTrue(tc, tags[REGION_TAG_RRSETS].bytes == 0);
+	CuAssertTrue(tc, strcmp(region_tag_name(REGION_TAG_RRSETS),
+		"rrsets") == 0);
+	region_destroy(region);
+}
@@ -15,12 +15,16 @@
 
 #ifdef RATELIMIT
 static void rrl_1(CuTest *tc);
+static void rrl_2(CuTest *tc);
+static void rrl_3(CuTest *tc);
 
 CuSuite* reg_cutest_rrl(void)
 {
         CuSuite* suite = CuSuiteNew();
 
 	SUITE_ADD_TEST(suite, rrl_1);
+	SUITE_ADD_TEST(suite, rrl_2);
+	SUITE_ADD_TEST(suite, rrl_3);
 	return suite;
 }
 
@@ -36,7 +40,7 @@ static void rrl_1(CuTest *tc)
 	uint32_t m = 400; /* ratelimit */
 	memset(&q, 0, sizeof(q));
 
-	rrl_init(0);
+	rrl_init();
 
 	CuAssert(tc, "rrl 1st query", 1 == rrl_update(&q, hash, source, c, now, m));
 	for(i=1; i<rate; i++) {
@@ -70,4 +74,81 @@ static void rrl_1(CuTest *tc)
 	now += 1;
 	CuAssert(tc, "rrl time check", rate/4+1 == rrl_update(&q, hash, source, c, now, m));
 }
+
+/* rates that hash to the same bucket keep their own counts */
+static void rrl_2(CuTest *tc)
+{
+	query_type q;
+	uint64_t source = 0x200;
+	uint32_t now = 456;
+	uint32_t hash = 0x1234;
+	uint16_t c = rrl_type_nxdomain;
+	uint32_t i;
+	uint32_t m = 400; /* ratelimit */
+	memset(&q, 0, sizeof(q));
+
+	rrl_init();
+
+	for(i=0; i<10; i++) {
+		CuAssert(tc, "rrl first source", i+1 == rrl_update(&q, hash, source, c, now, m));
+	}
+	/* same hash, other sources, in the next buckets */
+	for(i=0; i<5; i++) {
+		CuAssert(tc, "rrl second source", i+1 == rrl_update(&q, hash, source+1, c, now, m));
+	}
+	CuAssert(tc, "rrl third source", 1 == rrl_update(&q, hash, source+2, c, now, m));
+	/* same hash position, other hash */
+	CuAssert(tc, "rrl other hash", 1 == rrl_update(&q, hash+1, source, c, now, m));
+	CuAssert(tc, "rrl first source kept", 11 == rrl_update(&q, hash, source, c, now, m));
+	CuAssert(tc, "rrl second source kept", 6 == rrl_update(&q, hash, source+1, c, now, m));
+}
+/* the adaptive limits follow the load, between the configured limits and
+ * factor times them */
+static void rrl_3(CuTest *tc)
+{
+	uint32_t lm, wlm, prev;
+	int i;
+
+	rrl_set_limit(200, 2000, 2);
+	rrl_get_limits(&lm, &wlm);
+	CuAssert(tc, "rrl configured", lm == 200 && wlm == 2000);
+	rrl_adapt(0);
+	rrl_get_limits(&lm, &wlm);
+	CuAssert(tc, "rrl not adaptive", lm == 200 && wlm == 2000);
+
+	/* it starts at the configured limits */
+	rrl_set_adaptive(4);
+	rrl_get_limits(&lm, &wlm);
+	CuAssert(tc, "rrl adaptive start", lm == 200 && wlm == 2000);
+	/* room, the limits go up, to the factor */
+	prev = lm;
+	for(i=0; i<100; i++) {
+		rrl_adapt(RRL_LOAD_FULL/8);
+		rrl_get_limits(&lm, &wlm);
+		CuAssert(tc, "rrl adaptive up", lm >= prev && lm <= 800);
+		prev = lm;
+	}
+	CuAssert(tc, "rrl adaptive room", lm == 800 && wlm == 8000);
+	/* half full, in between */
+	for(i=0; i<200; i++)
+		rrl_adapt(RRL_LOAD_FULL/2);
+	rrl_get_limits(&lm, &wlm);
+	CuAssert(tc, "rrl adaptive half", lm > 200 && lm < 800);
+	/* full batches, down to the configured limits */
+	prev = lm;
+	for(i=0; i<100; i++) {
+		rrl_adapt(RRL_LOAD_FULL);
+		rrl_get_limits(&lm, &wlm);
+		CuAssert(tc, "rrl adaptive down", lm <= prev && lm >= 200);
+		prev = lm;
+	}
+	CuAssert(tc, "rrl adaptive full", lm == 200 && wlm == 2000);
+	/* a reconfig keeps the factor and the load */
+	rrl_set_limit(100, 1000, 2);
+	rrl_get_limits(&lm, &wlm);
+	CuAssert(tc, "rrl adaptive reconfig", lm == 100 && wlm == 1000);
+
+	rrl_set_adaptive(0);
+	rrl_set_limit(RRL_LIMIT/2, RRL_WLIST_LIMIT/2, RRL_SLIP);
+}
 #endif /* RATELIMIT */
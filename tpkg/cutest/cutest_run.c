@@ -24,6 +24,12 @@ CuSuite * reg_cutest_region(void);
 CuSuite * reg_cutest_udb(void);
 CuSuite * reg_cutest_udb_radtree(void);
 CuSuite * reg_cutest_namedb(void);
+CuSuite * reg_cutest_anscache(void);
+CuSuite * reg_cutest_axfrcache(void);
+CuSuite * reg_cutest_query(void);
+CuSuite * reg_cutest_ixfr(void);
+CuSuite * reg_cutest_tsig(void);
+CuSuite * reg_cutest_zlexer(void);
 #ifdef RATELIMIT
 CuSuite * reg_cutest_rrl(void);
 #endif
@@ -66,6 +72,12 @@ int runalltests(void)
 	CuSuiteAddSuite(suite, reg_cutest_rbtree());
 	CuSuiteAddSuite(suite, reg_cutest_util());
 	CuSuiteAddSuite(suite, reg_cutest_iterated_hash());
+	CuSuiteAddSuite(suite, reg_cutest_anscache());
+	CuSuiteAddSuite(suite, reg_cutest_axfrcache());
+	CuSuiteAddSuite(suite, reg_cutest_query());
+	CuSuiteAddSuite(suite, reg_cutest_ixfr());
+	CuSuiteAddSuite(suite, reg_cutest_tsig());
+	CuSuiteAddSuite(suite, reg_cutest_zlexer());
 #ifdef HAVE_MMAP
 	CuSuiteAddSuite(suite, reg_cutest_udb());
 	CuSuiteAddSuite(suite, reg_cutest_udb_radtree());
@@ -0,0 +1,118 @@
+/*
+	test the HMAC contexts of tsig-openssl.c
+*/
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "tpkg/cutest/cutest.h"
+#include "tsig.h"
+#include "options.h"
+#if defined(HAVE_SSL)
+#include <openssl/hmac.h>
+#endif
+
+static void tsig_key_context_1(CuTest *tc);
+
+CuSuite* reg_cutest_tsig(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, tsig_key_context_1);
+	return suite;
+}
+
+#if defined(HAVE_SSL)
+/* digest of the message with the algorithm and the key, in ctx */
+static size_t
+tsig_test_digest(tsig_algorithm_type* algo, tsig_key_type* key, void* ctx,
+	uint8_t* digest)
+{
+	const char* msg = "a message to sign, longer than one word";
+	size_t size = algo->maximum_digest_size;
+	algo->hmac_init_context(ctx, algo, key);
+	algo->hmac_update(ctx, msg, strlen(msg));
+	algo->hmac_final(ctx, digest, &size);
+	return size;
+}
+
+/* the same digest straight from OpenSSL */
+static size_t
+tsig_test_hmac(const char* md, tsig_key_type* key, uint8_t* digest)
+{
+	const char* msg = "a message to sign, longer than one word";
+	unsigned int len = 0;
+	HMAC(EVP_get_digestbyname(md), key->data, (int)key->size,
+		(const unsigned char*)msg, strlen(msg), digest, &len);
+	return len;
+}
+#endif /* HAVE_SSL */
+
+static void tsig_key_context_1(CuTest *tc)
+{
+#if defined(HAVE_SSL)
+	/* the tsig module keeps the region, it is not destroyed */
+	region_type* region = region_create(xalloc, free);
+	region_type* ctxregion = region_create(xalloc, free);
+	nsd_options_t* opt;
+	key_options_t* k;
+	tsig_algorithm_type* sha256, *sha1;
+	uint8_t d1[EVP_MAX_MD_SIZE], d2[EVP_MAX_MD_SIZE];
+	size_t s1, s2;
+	void* ctx;
+
+	tsig_init(region);
+	sha256 = tsig_get_algorithm_by_name("hmac-sha256");
+	sha1 = tsig_get_algorithm_by_name("hmac-sha1");
+	CuAssert(tc, "algorithms", sha256 && sha1);
+	opt = nsd_options_create(region);
+	k = key_options_create(region);
+	k->name = "k1.";
+	k->algorithm = "hmac-sha256";
+	k->secret = "K2tf3TRjvQkVCmJF3/Z9vA==";
+	key_options_add_modify(opt, k);
+	k = key_options_find(opt, "k1.");
+	CuAssert(tc, "key added", k && k->tsig_key);
+	CuAssert(tc, "no context before use", k->tsig_key->key_context == NULL);
+	ctx = sha256->hmac_create_context(ctxregion);
+
+	/* the first use makes the key context, the next ones copy it */
+	s1 = tsig_test_digest(sha256, k->tsig_key, ctx, d1);
+	CuAssert(tc, "key context", k->tsig_key->key_context != NULL &&
+		k->tsig_key->key_algorithm == sha256);
+	s2 = tsig_test_hmac("sha256", k->tsig_key, d2);
+	CuAssert(tc, "first digest", s1 == 32 && s1 == s2 &&
+		memcmp(d1, d2, s1) == 0);
+	s1 = tsig_test_digest(sha256, k->tsig_key, ctx, d1);
+	CuAssert(tc, "copied digest", s1 == s2 && memcmp(d1, d2, s1) == 0);
+
+	/* another algorithm with the key does not use the key context */
+	s1 = tsig_test_digest(sha1, k->tsig_key, ctx, d1);
+	s2 = tsig_test_hmac("sha1", k->tsig_key, d2);
+	CuAssert(tc, "other algorithm", s1 == 20 && s1 == s2 &&
+		memcmp(d1, d2, s1) == 0);
+	CuAssert(tc, "key context kept", k->tsig_key->key_algorithm == sha256);
+
+	/* a new secret drops the key context */
+	k = key_options_create(region);
+	k->name = "k1.";
+	k->algorithm = "hmac-sha256";
+	k->secret = "aGVsbG8gd29ybGQsIHRoaXMgaXMgYSBrZXk=";
+	key_options_add_modify(opt, k);
+	k = key_options_find(opt, "k1.");
+	CuAssert(tc, "context cleared", k->tsig_key->key_context == NULL);
+	s1 = tsig_test_digest(sha256, k->tsig_key, ctx, d1);
+	s2 = tsig_test_hmac("sha256", k->tsig_key, d2);
+	CuAssert(tc, "new secret", s1 == s2 && memcmp(d1, d2, s1) == 0);
+
+	key_options_remove(opt, "k1.");
+	region_destroy(ctxregion);
+#else
+	(void)tc;
+#endif /* HAVE_SSL */
+}
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include "tpkg/cutest/cutest.h"
 #include "udb.h"
 
@@ -15,6 +16,9 @@ static void udb_1(CuTest* tc);
 static void udb_2(CuTest* tc);
 static void udb_3(CuTest* tc);
 static void udb_4(CuTest* tc);
+static void udb_5(CuTest* tc);
+static void udb_6(CuTest* tc);
+static void udb_7(CuTest* tc);
 
 CuSuite* reg_cutest_udb(void)
 {
@@ -23,6 +27,9 @@ CuSuite* reg_cutest_udb(void)
 	SUITE_ADD_TEST(suite, udb_2);
 	SUITE_ADD_TEST(suite, udb_3);
 	SUITE_ADD_TEST(suite, udb_4);
+	SUITE_ADD_TEST(suite, udb_5);
+	SUITE_ADD_TEST(suite, udb_6);
+	SUITE_ADD_TEST(suite, udb_7);
 	return suite;
 }
 
@@ -359,6 +366,146 @@ static void test_A(void)
 	free(fname);
 }
 
+/** test compaction that moves a limited amount per call */
+static void test_compact_limit(void)
+{
+	char* fname = udbtest_get_temp_file(".udb");
+	udb_base* udb;
+	udb_ptr p[MAX_NUM_A];
+	uint64_t prev;
+	int i, calls = 0;
+	udb = udb_base_create_new(fname, testAwalk, NULL);
+	for(i=0; i<MAX_NUM_A; i++) {
+		udb_ptr_init(&p[i], udb);
+		udb_ptr_set(&p[i], udb, udb_alloc_space(udb->alloc, 200));
+		CuAssertTrue(tc, p[i].data != 0);
+		memset(UDB_PTR(&p[i]), i%255, 200);
+	}
+	/* free every other one, without compaction, the file is full
+	 * of holes */
+	udb_compact_inhibited(udb, 1);
+	for(i=0; i<MAX_NUM_A; i+=2) {
+		udb_void d = p[i].data;
+		udb_ptr_set(&p[i], udb, 0);
+		CuAssertTrue(tc, udb_alloc_free(udb->alloc, d, 200));
+	}
+	udb_compact_inhibited(udb, 0);
+	check_udb_structure(tc, udb);
+
+	/* a couple of chunks per call */
+	udb_compact_limit(udb, 1024);
+	prev = udb->alloc->disk->nextgrow;
+	while(udb->useful_compact && calls < MAX_NUM_A) {
+		CuAssertTrue(tc, udb_compact(udb));
+		check_udb_structure(tc, udb);
+		CuAssertTrue(tc, udb->alloc->disk->nextgrow <= prev);
+		prev = udb->alloc->disk->nextgrow;
+		calls++;
+	}
+	CuAssertTrue(tc, !udb->useful_compact);
+	CuAssertTrue(tc, calls > 1);
+	/* the data stayed the same, it moved */
+	for(i=1; i<MAX_NUM_A; i+=2) {
+		int j;
+		uint8_t* d = (uint8_t*)UDB_PTR(&p[i]);
+		for(j=0; j<200; j++)
+			CuAssertTrue(tc, d[j] == i%255);
+	}
+	for(i=0; i<MAX_NUM_A; i++)
+		udb_ptr_unlink(&p[i], udb);
+	udb_base_close(udb);
+	udb_base_free(udb);
+	if(unlink(fname) != 0)
+		perror("unlink");
+	free(fname);
+}
+
+/** test the published copy, that is opened read-only */
+static void test_publish(void)
+{
+	char* fname = udbtest_get_temp_file(".udb");
+	char* pname = udbtest_get_temp_file(".pub");
+	udb_base* udb, *ro;
+	udb_ptr p;
+	udb_void d;
+	int fd;
+	udb = udb_base_create_new(fname, testAwalk, NULL);
+	udb_ptr_init(&p, udb);
+	udb_ptr_set(&p, udb, udb_alloc_space(udb->alloc, 200));
+	CuAssertTrue(tc, p.data != 0);
+	memset(UDB_PTR(&p), 0x5a, 200);
+	d = p.data;
+	CuAssertTrue(tc, udb_base_publish(udb, pname));
+	/* the udb itself is still open */
+	CuAssertTrue(tc, udb->glob_data->clean_close == 0);
+
+	fd = open(pname, O_RDONLY);
+	CuAssertTrue(tc, fd != -1);
+	ro = udb_base_create_fd(pname, fd, testAwalk, NULL);
+	CuAssertTrue(tc, ro != NULL);
+	CuAssertTrue(tc, ro->readonly);
+	CuAssertTrue(tc, ro->base_size == udb->base_size);
+	CuAssertTrue(tc, memcmp(UDB_REL(ro->base, d), UDB_PTR(&p), 200) == 0);
+	/* compaction and close do not write to it */
+	CuAssertTrue(tc, udb_compact(ro));
+	udb_base_close(ro);
+	udb_base_free(ro);
+
+	udb_ptr_unlink(&p, udb);
+	udb_base_close(udb);
+	udb_base_free(udb);
+	if(unlink(fname) != 0)
+		perror("unlink");
+	if(unlink(pname) != 0)
+		perror("unlink");
+	free(fname);
+	free(pname);
+}
+
+/** test the room to grow into, the file grows without a remap */
+static void test_reserve(void)
+{
+	char* fname = udbtest_get_temp_file(".udb");
+	udb_base* udb;
+	udb_ptr p[MAX_NUM_A];
+	void* base;
+	int i, j;
+	udb = udb_base_create_new(fname, testAwalk, NULL);
+	if(!udb_base_reserve(udb, (uint64_t)64*1024*1024)) {
+		/* no MAP_NORESERVE or a 32-bit system */
+		CuAssertTrue(tc, udb->map_size == 0);
+	} else {
+		CuAssertTrue(tc, udb->map_size >= 64*1024*1024);
+		CuAssertTrue(tc, udb->glob_data->fsize == udb->base_size);
+	}
+	base = udb->base;
+	for(i=0; i<MAX_NUM_A; i++) {
+		udb_ptr_init(&p[i], udb);
+		udb_ptr_set(&p[i], udb, udb_alloc_space(udb->alloc, 2000));
+		CuAssertTrue(tc, p[i].data != 0);
+		memset(UDB_PTR(&p[i]), i%255, 2000);
+	}
+	CuAssertTrue(tc, udb->glob_data->fsize == udb->base_size);
+	if(udb->map_size) {
+		/* it grew in the room of the mapping */
+		CuAssertTrue(tc, udb->base == base);
+		CuAssertTrue(tc, udb->remap_count == 0);
+	}
+	for(i=0; i<MAX_NUM_A; i++) {
+		uint8_t* d = (uint8_t*)UDB_PTR(&p[i]);
+		for(j=0; j<2000; j++)
+			CuAssertTrue(tc, d[j] == i%255);
+	}
+	check_udb_structure(tc, udb);
+	for(i=0; i<MAX_NUM_A; i++)
+		udb_ptr_unlink(&p[i], udb);
+	udb_base_close(udb);
+	udb_base_free(udb);
+	if(unlink(fname) != 0)
+		perror("unlink");
+	free(fname);
+}
+
 /*** end test A for create and delete chunks ***/
 
 /** test structure sizes for compiler padding */
@@ -454,3 +601,21 @@ static void udb_4(CuTest* t)
 	tc = t;
 	test_A();
 }
+
+static void udb_5(CuTest* t)
+{
+	tc = t;
+	test_compact_limit();
+}
+
+static void udb_6(CuTest* t)
+{
+	tc = t;
+	test_publish();
+}
+
+static void udb_7(CuTest* t)
+{
+	tc = t;
+	test_reserve();
+}
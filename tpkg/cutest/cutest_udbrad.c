@@ -28,13 +28,21 @@ void check_udb(void);
 /* a chunk type not in use by radtree or the builtin types */
 #define TESTSTR_CHUNK_TYPE 253
 
-/** get the lookup array for a node */
+/** get the lookup array for a node, a leaf has no array */
 static struct udb_radarray_d* lookup(udb_ptr* n)
 {
 	return (struct udb_radarray_d*)UDB_REL(*n->base,
 		RADNODE(n)->lookup.data);
 }
 
+/** get the number of entries in the lookup array, 0 for a leaf */
+static uint16_t lookup_count(udb_ptr* n)
+{
+	if(RADNODE(n)->lookup.data == 0)
+		return 0;
+	return lookup(n)->len;
+}
+
 /** get a string in the lookup array */
 static uint8_t* lookup_string(udb_ptr* n, unsigned i)
 {
@@ -83,50 +91,48 @@ static size_t test_check_invariants(udb_base* udb, udb_ptr* n)
 {
 	size_t num = 0;
 	udb_ptr s;
+	unsigned idx;
+	udb_radstrlen_t maxlen;
 	if(udb_ptr_is_null(n)) return 0;
 	if(RADNODE(n)->elem.data) num++;
+	if(RADNODE(n)->lookup.data == 0) {
+		/* a leaf has no array */
+		CuAssert(tc, "invariant leaf offset", RADNODE(n)->offset == 0);
+		return num;
+	}
 	CuAssert(tc, "invariant len<=cap",
 		lookup(n)->len <= lookup(n)->capacity);
 	CuAssert(tc, "invariant cap<=256", lookup(n)->capacity <= 256);
 	CuAssert(tc, "invariant offset",
 		((int)RADNODE(n)->offset) + ((int)lookup(n)->len) <= 256);
-	if(lookup(n)->len == 0) {
-		CuAssert(tc, "invariant empty cap", lookup(n)->capacity == 0);
-		CuAssert(tc, "invariant empty strcap", lookup(n)->str_cap == 0);
-		CuAssert(tc, "invariant empty len", lookup(n)->len == 0);
-		CuAssert(tc, "invariant empty offset", RADNODE(n)->offset == 0);
-	} else {
-		unsigned idx;
-		udb_radstrlen_t maxlen;
-		CuAssert(tc, "invariant nonempty cap",
-			lookup(n)->capacity != 0);
-		CuAssert(tc, "invariant len>cap/2",
-			lookup(n)->len >= lookup(n)->capacity/2);
-		for(idx=0; idx<lookup(n)->len; idx++) {
-			struct udb_radsel_d* r = &lookup(n)->array[idx];
-			if(r->node.data == 0) {
-				CuAssert(tc, "empty node", r->len == 0);
-				/* there may be unused space in the
-				 * string, it is undefined */
-			} else {
-				/* r->len == 0 is an empty string */
-				CuAssert(tc, "strcap",
-					r->len <= lookup(n)->str_cap);
-				udb_ptr_new(&s, udb, &r->node);
-				CuAssert(tc, "invariant parent",
-					n->data == RADNODE(&s)->parent.data);
-				CuAssert(tc, "invariant pidx",
-					RADNODE(&s)->pidx == idx);
-				num += test_check_invariants(udb, &s);
-				udb_ptr_unlink(&s, udb);
-			}
-		}
-		maxlen = udb_radarray_max_len(n);
-		CuAssert(tc, "maxlen", maxlen <= lookup(n)->str_cap);
-		if(maxlen != lookup(n)->str_cap) {
-			CuAssert(tc, "maxlen", maxlen >= lookup(n)->str_cap/2);
+	/* a node without children has no array */
+	CuAssert(tc, "invariant array not empty", lookup(n)->len != 0);
+	CuAssert(tc, "invariant nonempty cap", lookup(n)->capacity != 0);
+	CuAssert(tc, "invariant len>cap/2",
+		lookup(n)->len >= lookup(n)->capacity/2);
+	for(idx=0; idx<lookup(n)->len; idx++) {
+		struct udb_radsel_d* r = &lookup(n)->array[idx];
+		if(r->node.data == 0) {
+			CuAssert(tc, "empty node", r->len == 0);
+			/* there may be unused space in the
+			 * string, it is undefined */
+		} else {
+			/* r->len == 0 is an empty string */
+			CuAssert(tc, "strcap", r->len <= lookup(n)->str_cap);
+			udb_ptr_new(&s, udb, &r->node);
+			CuAssert(tc, "invariant parent",
+				n->data == RADNODE(&s)->parent.data);
+			CuAssert(tc, "invariant pidx",
+				RADNODE(&s)->pidx == idx);
+			num += test_check_invariants(udb, &s);
+			udb_ptr_unlink(&s, udb);
 		}
 	}
+	maxlen = udb_radarray_max_len(n);
+	CuAssert(tc, "maxlen", maxlen <= lookup(n)->str_cap);
+	if(maxlen != lookup(n)->str_cap) {
+		CuAssert(tc, "maxlen", maxlen >= lookup(n)->str_cap/2);
+	}
 	return num;
 }
 
@@ -152,7 +158,7 @@ test_check_list_keys(udb_base* udb, udb_ptr* n, struct teststr** all,
 		all[ (*all_idx)++ ] = TESTSTR(&t);
 		udb_ptr_unlink(&t, udb);
 	}
-	for(idx=0; idx<lookup(n)->len; idx++) {
+	for(idx=0; idx<lookup_count(n); idx++) {
 		udb_ptr s;
 		struct udb_radsel_d* r = &lookup(n)->array[idx];
 		udb_radstrlen_t newlen = fullkey_len;
@@ -378,7 +384,7 @@ static uint64_t udb_radtree_size_node(udb_base* udb, udb_ptr* n)
 	if(n->data == 0)
 		return 0;
 	s = sizeof(struct udb_radnode_d) + size_of_lookup_ext(n);
-	for(i=0; i<lookup(n)->len; i++)  {
+	for(i=0; i<lookup_count(n); i++)  {
 		udb_ptr sub;
 		udb_ptr_new(&sub, udb, &lookup(n)->array[i].node);
 		s += udb_radtree_size_node(udb, &sub);
@@ -484,7 +490,9 @@ static void test_node_print(udb_base* udb, udb_ptr* n, int depth)
 	fprintf(stderr, " pidx=%d off=%d(%c) len=%d cap=%d strcap=%d parent=%llu lookup=%llu\n",
 		RADNODE(n)->pidx, RADNODE(n)->offset,
 		isprint(RADNODE(n)->offset)?RADNODE(n)->offset:'.',
-		lookup(n)->len, lookup(n)->capacity, lookup(n)->str_cap,
+		(int)lookup_count(n),
+		RADNODE(n)->lookup.data?lookup(n)->capacity:0,
+		RADNODE(n)->lookup.data?lookup(n)->str_cap:0,
 		(long long unsigned)RADNODE(n)->parent.data,
 		(long long unsigned)RADNODE(n)->lookup.data);
 	for(i=0; i<depth; i++) fprintf(stderr, " ");
@@ -503,7 +511,7 @@ static void test_node_print(udb_base* udb, udb_ptr* n, int depth)
 		CuAssertTrue(tc, TESTSTR(&s)->mynode.data == n->data);
 	} else fprintf(stderr, "  elem NULL\n");
 	udb_ptr_zero(&s, udb);
-	for(idx=0; idx<lookup(n)->len; idx++) {
+	for(idx=0; idx<lookup_count(n); idx++) {
 		struct udb_radsel_d* d = &lookup(n)->array[idx];
 		if(!d->node.data) {
 			CuAssertTrue(tc, d->len == 0);
@@ -13,11 +13,15 @@
 #include "tpkg/cutest/cutest.h"
 #include "region-allocator.h"
 #include "util.h"
+#include "buffer.h"
+#include "hash.h"
 
 static void util_1(CuTest *tc);
 static void util_2(CuTest *tc);
 static void util_3(CuTest *tc);
 static void util_4(CuTest *tc);
+static void util_5(CuTest *tc);
+static void util_6(CuTest *tc);
 
 CuSuite* reg_cutest_util(void)
 {
@@ -27,6 +31,8 @@ CuSuite* reg_cutest_util(void)
 	SUITE_ADD_TEST(suite, util_2);
 	SUITE_ADD_TEST(suite, util_3);
 	SUITE_ADD_TEST(suite, util_4);
+	SUITE_ADD_TEST(suite, util_5);
+	SUITE_ADD_TEST(suite, util_6);
 	return suite;
 }
 
@@ -158,3 +164,52 @@ static void util_4(CuTest *tc)
 	/* strings differ only in case */
 	CuAssert(tc, "test results of pton ntop", strcasecmp(buf, teststr)==0);
 }
+
+static void util_5(CuTest *tc)
+{
+	/* test buffer_print_u32 and buffer_print_str, like buffer_printf */
+	region_type* region = region_create(xalloc, free);
+	buffer_type* buf = buffer_create(region, 4);
+	uint32_t vals[] = { 0, 7, 10, 65535, 100000, 4294967295U };
+	char expect[64];
+	size_t i;
+	for(i=0; i<sizeof(vals)/sizeof(vals[0]); i++) {
+		buffer_clear(buf);
+		buffer_print_str(buf, "ttl ");
+		buffer_print_u32(buf, vals[i]);
+		snprintf(expect, sizeof(expect), "ttl %u", (unsigned)vals[i]);
+		CuAssert(tc, "print len", buffer_position(buf) ==
+			strlen(expect));
+		/* the terminating zero is after the position */
+		CuAssert(tc, "print str", strcmp((char*)buffer_begin(buf),
+			expect) == 0);
+	}
+	region_destroy(region);
+}
+
+static void util_6(CuTest *tc)
+{
+	/* test hash_bytes, for every length up to the 48 byte rounds and
+	 * past them, the data and key and seed change the hash */
+	uint8_t data[128];
+	uint64_t h[129], oldkey = hash_get_key();
+	size_t i, j;
+	for(i=0; i<sizeof(data); i++)
+		data[i] = (uint8_t)(i*7+1);
+	hash_set_key(1);
+	for(i=0; i<=sizeof(data); i++) {
+		h[i] = hash_bytes(data, i, 0);
+		CuAssert(tc, "hash same", h[i] == hash_bytes(data, i, 0));
+		CuAssert(tc, "hash seed", h[i] != hash_bytes(data, i, 1));
+		for(j=0; j<i; j++) {
+			CuAssert(tc, "hash length", h[i] != h[j]);
+			data[j] ^= 0x10;
+			CuAssert(tc, "hash data", h[i] != hash_bytes(data, i, 0));
+			data[j] ^= 0x10;
+		}
+	}
+	hash_set_key(2);
+	for(i=0; i<=sizeof(data); i++)
+		CuAssert(tc, "hash key", h[i] != hash_bytes(data, i, 0));
+	hash_set_key(oldkey);
+}
@@ -0,0 +1,276 @@
+/*
+	test the zone file lexer, zlexer.lex or zscan.c, whichever is
+	built. The expected tokens follow the rules in zlexer.lex, so that
+	both lexers accept the same input.
+*/
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tpkg/cutest/cutest.h"
+#include "namedb.h"
+#include "options.h"
+#include "zonec.h"
+#include "zparser.h"
+
+char* udbtest_get_temp_file(char* suffix);
+
+static void zlexer_1(CuTest *tc);
+static void zlexer_2(CuTest *tc);
+static void zlexer_3(CuTest *tc);
+static void zlexer_4(CuTest *tc);
+static void zlexer_5(CuTest *tc);
+
+CuSuite* reg_cutest_zlexer(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, zlexer_1);
+	SUITE_ADD_TEST(suite, zlexer_2);
+	SUITE_ADD_TEST(suite, zlexer_3);
+	SUITE_ADD_TEST(suite, zlexer_4);
+	SUITE_ADD_TEST(suite, zlexer_5);
+	return suite;
+}
+
+/* append the token to the text, with its value */
+static void
+zlexer_print(char* out, size_t outlen, int token)
+{
+	size_t n = strlen(out), i;
+	if(n > 0 && n+1 < outlen) {
+		out[n++] = ' ';
+		out[n] = 0;
+	}
+	switch(token) {
+	case STR:
+	case BITLAB:
+		snprintf(out+n, outlen-n, "%s(", token==STR?"STR":"BITLAB");
+		for(i=0; i<yylval.data.len; i++) {
+			n = strlen(out);
+			snprintf(out+n, outlen-n, (isprint((unsigned char)
+				yylval.data.str[i])?"%c":"\\%03u"),
+				(unsigned)(unsigned char)yylval.data.str[i]);
+		}
+		n = strlen(out);
+		snprintf(out+n, outlen-n, ")");
+		break;
+	case '.':
+		snprintf(out+n, outlen-n, ".");
+		break;
+	case '@':
+		snprintf(out+n, outlen-n, "@");
+		break;
+	case SP:
+		snprintf(out+n, outlen-n, "SP");
+		break;
+	case NL:
+		snprintf(out+n, outlen-n, "NL");
+		break;
+	case PREV:
+		snprintf(out+n, outlen-n, "PREV");
+		break;
+	case URR:
+		snprintf(out+n, outlen-n, "URR");
+		break;
+	case DOLLAR_TTL:
+		snprintf(out+n, outlen-n, "$TTL");
+		break;
+	case DOLLAR_ORIGIN:
+		snprintf(out+n, outlen-n, "$ORIGIN");
+		break;
+	case T_TTL:
+		snprintf(out+n, outlen-n, "TTL(%u)", (unsigned)yylval.ttl);
+		break;
+	case T_RRCLASS:
+		snprintf(out+n, outlen-n, "CLASS(%s)",
+			rrclass_to_string(yylval.klass));
+		break;
+	default:
+		/* the type tokens */
+		snprintf(out+n, outlen-n, "TYPE(%s)",
+			rrtype_to_string(yylval.type));
+		break;
+	}
+}
+
+/* scan the string and check the tokens */
+static void
+zlexer_check(CuTest* tc, const char* str, const char* expect)
+{
+	char in[1024], out[4096];
+	int token;
+	out[0] = 0;
+	snprintf(in, sizeof(in), "%s", str);
+	parser_push_stringbuf(in);
+	while((token = yylex()) != 0)
+		zlexer_print(out, sizeof(out), token);
+	parser_pop_stringbuf();
+	if(strcmp(out, expect) != 0)
+		printf("zlexer: input %s\ngot    %s\nwanted %s\n", str, out,
+			expect);
+	CuAssertStrEquals(tc, expect, out);
+}
+
+/* the parser that the lexer uses, with the origin */
+static namedb_type*
+zlexer_setup(const char* origin)
+{
+	namedb_type* db = namedb_open("", NULL);
+	zparser_init("string", 3600, CLASS_IN, dname_parse(db->region,
+		origin));
+	return db;
+}
+
+/* write the text to the file */
+static void
+zlexer_write(const char* fname, const char* text)
+{
+	FILE* out = fopen(fname, "w");
+	if(!out) {
+		printf("failed to write %s\n", fname);
+		exit(1);
+	}
+	fputs(text, out);
+	fclose(out);
+}
+
+/* owners, types and rdata names, of the zone in the order of the file */
+static void
+zlexer_rr(rr_type* rr, void* arg)
+{
+	char* out = (char*)arg;
+	size_t n = strlen(out);
+	snprintf(out+n, 4096-n, "%s %s",
+		dname_to_string(domain_dname(rr->owner), NULL),
+		rrtype_to_string(rr->type));
+	n = strlen(out);
+	if(rr->type == TYPE_CNAME || rr->type == TYPE_NS)
+		snprintf(out+n, 4096-n, " %s", dname_to_string(domain_dname(
+			rr_rdata_domain(rr, 0)), NULL));
+	n = strlen(out);
+	snprintf(out+n, 4096-n, "\n");
+}
+
+/* words, dots, names, the owner and the ttl, class and type */
+static void zlexer_1(CuTest *tc)
+{
+	namedb_type* db = zlexer_setup("example.org.");
+	zlexer_check(tc, "www.example.com. 3600 IN A 192.0.2.1\n",
+		"STR(www) . STR(example) . STR(com) . SP TTL(3600) SP "
+		"CLASS(IN) SP TYPE(A) SP STR(192) . STR(0) . STR(2) . "
+		"STR(1) NL");
+	zlexer_check(tc, "@ A 192.0.2.1\n",
+		"@ SP TYPE(A) SP STR(192) . STR(0) . STR(2) . STR(1) NL");
+	zlexer_check(tc, "@x IN 1h TYPE65534 @\n",
+		"STR(@x) SP CLASS(IN) SP TTL(3600) SP TYPE(TYPE65534) SP @ NL");
+	zlexer_check(tc, "\tIN\tMX 10 mail\n",
+		"PREV CLASS(IN) SP TYPE(MX) SP STR(10) SP STR(mail) NL");
+	zlexer_check(tc, "a\"b TXT c$d\n",
+		"STR(a\"b) SP TYPE(TXT) SP STR(c$d) NL");
+	namedb_close(db);
+}
+
+/* escapes, \DDD, escaped delimiters and the \# unknown rdata marker */
+static void zlexer_2(CuTest *tc)
+{
+	namedb_type* db = zlexer_setup("example.org.");
+	zlexer_check(tc, "a\\.b\\065\\ c TXT x\\\\y \\\"z\n",
+		"STR(a.bA c) SP TYPE(TXT) SP STR(x\\y) SP STR(\"z) NL");
+	zlexer_check(tc, "a\\(b TXT \\;x ;c\n",
+		"STR(a(b) SP TYPE(TXT) SP STR(;x) NL");
+	zlexer_check(tc, "a\\000b TXT \\255\n",
+		"STR(a\\000b) SP TYPE(TXT) SP STR(\\255) NL");
+	zlexer_check(tc, "x TYPE65534 \\# 1 00\n",
+		"STR(x) SP TYPE(TYPE65534) SP URR SP STR(1) SP STR(00) NL");
+	zlexer_check(tc, "x TYPE65534 \\#x\n",
+		"STR(x) SP TYPE(TYPE65534) SP STR(#x) NL");
+	namedb_close(db);
+}
+
+/* parentheses, comments and newlines within them */
+static void zlexer_3(CuTest *tc)
+{
+	namedb_type* db = zlexer_setup("example.org.");
+	zlexer_check(tc, "@ SOA ns host ( 1 2\n 3 4 5 ) ; c\n",
+		"@ SP TYPE(SOA) SP STR(ns) SP STR(host) SP SP SP STR(1) SP "
+		"STR(2) SP SP STR(3) SP STR(4) SP STR(5) SP SP NL");
+	zlexer_check(tc, "; only a comment\n(a) TXT (b\n;c\nd)\n",
+		"NL SP STR(a) SP SP TYPE(TXT) SP SP STR(b) SP SP STR(d) SP NL");
+	namedb_close(db);
+}
+
+/* quoted strings, the quotes are stripped, and bitlabels */
+static void zlexer_4(CuTest *tc)
+{
+	namedb_type* db = zlexer_setup("example.org.");
+	zlexer_check(tc, "x TXT \"a b\" \"c\\\"d\" \"\" \"(;.)\"\n",
+		"STR(x) SP TYPE(TXT) SP STR(a b) SP STR(c\"d) SP STR() SP "
+		"STR((;.)) NL");
+	zlexer_check(tc, "x TXT \"a\nb\\065\"\n",
+		"STR(x) SP TYPE(TXT) SP STR(a\\010bA) NL");
+	/* like flex, the longest match is a word */
+	zlexer_check(tc, "\\[b1010/4] A 192.0.2.1\n",
+		"STR([b1010/4]) SP TYPE(A) SP STR(192) . STR(0) . STR(2) . "
+		"STR(1) NL");
+	zlexer_check(tc, "\\[ b1010/4]\n",
+		"BITLAB( b1010/4) NL");
+	zlexer_check(tc, "\\[.x\\]y] A\n",
+		"BITLAB(.x]y) SP TYPE(A) NL");
+	namedb_close(db);
+}
+
+/* $ORIGIN, $TTL, $INCLUDE and unknown directives, parsed from a file */
+static void zlexer_5(CuTest *tc)
+{
+	namedb_type* db = zlexer_setup("example.org.");
+	char* zfile = udbtest_get_temp_file("zlexer.zone");
+	char* ifile = udbtest_get_temp_file("zlexer.inc");
+	char text[1024], out[4096];
+	zone_options_t* zo;
+	zone_type* zone;
+
+	zlexer_check(tc, "$ORIGIN example.org.\n$TTL 300\n$ttl 1h\n",
+		"$ORIGIN SP STR(example) . STR(org) . NL $TTL SP STR(300) "
+		"NL $TTL SP STR(1h) NL");
+	zlexer_check(tc, "$FOO bar\n", "PREV STR(bar) NL");
+
+	zlexer_write(ifile, "a A 192.0.2.1\n$ORIGIN y.example.org.\nb A "
+		"192.0.2.2\n");
+	snprintf(text, sizeof(text), "$ORIGIN example.org.\n"
+		"$TTL 300\n"
+		"@ SOA ns host ( 1 2 3\n"
+		"\t4 5 ) ; comment\n"
+		"$INCLUDE %s sub.example.org. ; comment\n"
+		"b CNAME a.sub\n"
+		"$ORIGIN x.example.org.\n"
+		"c TXT \"a;b\" \\\"q\n"
+		"  NS ns.example.org.\n", ifile);
+	zlexer_write(zfile, text);
+
+	zo = (zone_options_t*)region_alloc_zero(db->region, sizeof(*zo));
+	zo->name = "example.org.";
+	zone = namedb_zone_create(db, dname_parse(db->region, zo->name), zo);
+	out[0] = 0;
+	CuAssertTrue(tc, zonec_read_stream(zo->name, zfile, zone, zlexer_rr,
+		out) == 0);
+	CuAssertStrEquals(tc, "example.org. SOA\n"
+		"a.sub.example.org. A\n"
+		"b.y.example.org. A\n"
+		"b.example.org. CNAME a.sub.example.org.\n"
+		"c.x.example.org. TXT\n"
+		"c.x.example.org. NS ns.example.org.\n", out);
+
+	unlink(zfile);
+	unlink(ifile);
+	free(zfile);
+	free(ifile);
+	namedb_close(db);
+}
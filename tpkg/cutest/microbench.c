@@ -0,0 +1,568 @@
+/* microbench - time the core data structures of nsd.
+ * Copyright 2026, NLnet Labs.
+ * BSD, see LICENSE.
+ *
+ * The names and the order of the operations come from a seeded random
+ * generator, so that runs with the same options do the same work.  The
+ * results are printed as tab separated lines, one per benchmark, for
+ * comparison by scripts:
+ *	bench	run	items	ops	nsec	nsec/op
+ */
+
+#include "config.h"
+#include "dname.h"
+#include "dns.h"
+#include "hash.h"
+#include "lookup3.h"
+#include "radtree.h"
+#include "rbtree.h"
+#include "region-allocator.h"
+#include "udb.h"
+#include "udbradtree.h"
+#include "util.h"
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+/** a name of the benchmark set */
+struct bname {
+	/** the rbtree node, the key is the dname */
+	rbnode_t node;
+	/** the name as text */
+	char* str;
+	/** the name in uncompressed wireformat */
+	uint8_t* wire;
+	/** length of the wireformat */
+	size_t wirelen;
+	/** the name as dname_type */
+	const dname_type* dname;
+};
+
+/** the names */
+static struct bname* names = NULL;
+/** number of names */
+static size_t num = 1000000;
+/** the names in the random search order */
+static struct bname** order = NULL;
+/** random state */
+static uint64_t ranstate;
+/** the run number */
+static int run;
+/** the benchmarks that are run, NULL for all */
+static const char* only = NULL;
+
+/** print usage text */
+static void
+usage(void)
+{
+	printf("usage:	microbench [options]\n");
+	printf(" -h		this help\n");
+	printf(" -n num		number of names, default 1000000\n");
+	printf(" -r runs		repeat the benchmarks, default 1\n");
+	printf(" -s seed		seed of the random generator, default 1\n");
+	printf(" -b name		run only the benchmarks that start with "
+	       "name:\n");
+	printf("		radtree rbtree udbrad region dname lookup3 hash\n");
+	printf("output is tab separated: bench run items ops nsec nsec/op\n");
+}
+
+/** repeatable random numbers, xorshift64* */
+static uint64_t
+ran(void)
+{
+	ranstate ^= ranstate >> 12;
+	ranstate ^= ranstate << 25;
+	ranstate ^= ranstate >> 27;
+	return ranstate * 2685821657736338717ULL;
+}
+
+/** nanoseconds of a monotonic clock */
+static uint64_t
+now_nsec(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+	{
+		struct timeval tv;
+		if(gettimeofday(&tv, NULL) != 0)
+			return 0;
+		return (uint64_t)tv.tv_sec*1000000000 +
+			(uint64_t)tv.tv_usec*1000;
+	}
+}
+
+/** see if the benchmark is selected */
+static int
+selected(const char* bench)
+{
+	return only == NULL || strncmp(bench, only, strlen(only)) == 0;
+}
+
+/** print the result line of a benchmark */
+static void
+report(const char* bench, size_t items, size_t ops, uint64_t start)
+{
+	uint64_t nsec = now_nsec() - start;
+	printf("%s\t%d\t%llu\t%llu\t%llu\t%.2f\n", bench, run,
+		(unsigned long long)items, (unsigned long long)ops,
+		(unsigned long long)nsec, ops?(double)nsec/(double)ops:0.);
+	fflush(stdout);
+}
+
+/** make the names; they share parents and top level labels like the
+ * names of a zone do, and the hex counter makes them unique */
+static void
+make_names(region_type* region)
+{
+	static const char* tld[] = {"com", "net", "org", "nl", "de", "uk",
+		"ru", "example", "arpa", "info"};
+	static const char alpha[] = "abcdefghijklmnopqrstuvwxyz0123456789-";
+	char buf[MAXDOMAINLEN*4];
+	uint8_t wire[MAXDOMAINLEN];
+	size_t i, j;
+	names = (struct bname*)xalloc_array_zero(num, sizeof(*names));
+	order = (struct bname**)xalloc_array_zero(num, sizeof(*order));
+	for(i=0; i<num; i++) {
+		char lab[16];
+		size_t lablen = 1 + ran()%12;
+		int len;
+		for(j=0; j<lablen; j++)
+			lab[j] = alpha[ran()%(sizeof(alpha)-2)];
+		lab[lablen] = 0;
+		snprintf(buf, sizeof(buf), "%s%llx.p%u.%s.", lab,
+			(unsigned long long)i, (unsigned)(ran()%1000),
+			tld[ran()%(sizeof(tld)/sizeof(tld[0]))]);
+		len = dname_parse_wire(wire, buf);
+		if(len == 0) {
+			fprintf(stderr, "cannot parse %s\n", buf);
+			exit(1);
+		}
+		names[i].str = region_strdup(region, buf);
+		names[i].wire = region_alloc_init(region, wire, len);
+		names[i].wirelen = (size_t)len;
+		names[i].dname = dname_make(region, wire, 1);
+		names[i].node.key = names[i].dname;
+		order[i] = &names[i];
+	}
+	/* shuffle the search order */
+	for(i=num; i>1; i--) {
+		struct bname* t;
+		j = ran()%i;
+		t = order[i-1];
+		order[i-1] = order[j];
+		order[j] = t;
+	}
+}
+
+/** radtree insert, search and walk */
+static void
+bench_radtree(void)
+{
+	region_type* region;
+	struct radtree* rt;
+	struct radnode* n;
+	uint64_t start;
+	size_t i, found = 0;
+	if(!selected("radtree"))
+		return;
+	region = region_create(xalloc, free);
+	rt = radix_tree_create(region);
+
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		(void)radname_insert(rt, names[i].wire, names[i].wirelen,
+			&names[i]);
+	report("radtree_insert", num, num, start);
+
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		if(radname_search(rt, order[i]->wire, order[i]->wirelen))
+			found++;
+	report("radtree_search", num, num, start);
+
+	start = now_nsec();
+	for(i=0, n=radix_first(rt); n; n=radix_next(n))
+		i++;
+	report("radtree_next", num, i, start);
+
+	if(found != num || i != num)
+		fprintf(stderr, "radtree: found %u walked %u of %u\n",
+			(unsigned)found, (unsigned)i, (unsigned)num);
+	radix_tree_delete(rt);
+	region_destroy(region);
+}
+
+/** compare function for the rbtree of names */
+static int
+bench_dname_cmp(const void* a, const void* b)
+{
+	return dname_compare((const dname_type*)a, (const dname_type*)b);
+}
+
+/** rbtree insert, search and walk */
+static void
+bench_rbtree(void)
+{
+	region_type* region;
+	rbtree_t* tree;
+	rbnode_t* n;
+	uint64_t start;
+	size_t i, found = 0;
+	if(!selected("rbtree"))
+		return;
+	region = region_create(xalloc, free);
+	tree = rbtree_create(region, bench_dname_cmp);
+
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		(void)rbtree_insert(tree, &names[i].node);
+	report("rbtree_insert", num, num, start);
+
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		if(rbtree_search(tree, order[i]->dname))
+			found++;
+	report("rbtree_search", num, num, start);
+
+	start = now_nsec();
+	for(i=0, n=rbtree_first(tree); n != RBTREE_NULL; n=rbtree_next(n))
+		i++;
+	report("rbtree_next", num, i, start);
+
+	if(found != num || i != num)
+		fprintf(stderr, "rbtree: found %u walked %u of %u\n",
+			(unsigned)found, (unsigned)i, (unsigned)num);
+	region_destroy(region);
+}
+
+/** walk through relptrs in the udb chunks of the benchmark */
+static void
+bench_udb_walk(void* base, void* warg, uint8_t t, void* d, uint64_t s,
+	udb_walk_relptr_cb* cb, void* arg)
+{
+	(void)warg;
+	switch(t) {
+	case udb_chunk_type_radtree:
+		udb_radix_tree_walk_chunk(base, d, s, cb, arg);
+		break;
+	case udb_chunk_type_radnode:
+		udb_radix_node_walk_chunk(base, d, s, cb, arg);
+		break;
+	case udb_chunk_type_radarray:
+		udb_radix_array_walk_chunk(base, d, s, cb, arg);
+		break;
+	default:
+		/* no rel ptrs */
+		break;
+	}
+}
+
+/** udb radix tree insert, search and walk, in a temporary file */
+static void
+bench_udbrad(void)
+{
+	char fname[64];
+	udb_base* udb;
+	udb_ptr rt, elem, n;
+	uint64_t start;
+	size_t i, found = 0;
+	if(!selected("udbrad"))
+		return;
+	snprintf(fname, sizeof(fname), "/tmp/microbench-%u.udb",
+		(unsigned)getpid());
+	udb = udb_base_create_new(fname, bench_udb_walk, NULL);
+	if(!udb) {
+		fprintf(stderr, "cannot create %s\n", fname);
+		return;
+	}
+	if(!udb_radix_tree_create(udb, &rt)) {
+		fprintf(stderr, "udb_radix_tree_create failed\n");
+		goto out;
+	}
+
+	/* the elements are small data chunks, like the domains of a zone */
+	start = now_nsec();
+	for(i=0; i<num; i++) {
+		if(!udb_ptr_alloc_space(&elem, udb, udb_chunk_type_data,
+			sizeof(uint64_t)))
+			break;
+		if(udb_radname_insert(udb, &rt, names[i].wire,
+			names[i].wirelen, &elem, &n)) {
+			found++;
+			udb_ptr_unlink(&n, udb);
+		}
+		udb_ptr_unlink(&elem, udb);
+	}
+	report("udbrad_insert", num, num, start);
+	if(found != num)
+		fprintf(stderr, "udbrad: inserted %u of %u\n",
+			(unsigned)found, (unsigned)num);
+
+	found = 0;
+	start = now_nsec();
+	for(i=0; i<num; i++) {
+		if(udb_radname_search(udb, &rt, order[i]->wire,
+			order[i]->wirelen, &n))
+			found++;
+		udb_ptr_unlink(&n, udb);
+	}
+	report("udbrad_search", num, num, start);
+
+	start = now_nsec();
+	for(i=0, udb_radix_first(udb, &rt, &n); !udb_ptr_is_null(&n);
+		udb_radix_next(udb, &n))
+		i++;
+	udb_ptr_unlink(&n, udb);
+	report("udbrad_next", num, i, start);
+
+	if(found != num || i != num)
+		fprintf(stderr, "udbrad: found %u walked %u of %u\n",
+			(unsigned)found, (unsigned)i, (unsigned)num);
+	udb_ptr_unlink(&rt, udb);
+out:
+	udb_base_close(udb);
+	udb_base_free(udb);
+	if(unlink(fname) != 0)
+		perror(fname);
+}
+
+/** region allocation patterns */
+static void
+bench_region(void)
+{
+	region_type* region;
+	void** ptrs;
+	size_t* sizes;
+	uint64_t start;
+	size_t i, round, rounds = 8, batch = num<100000?num:100000;
+	if(!selected("region"))
+		return;
+	ptrs = (void**)xalloc_array_zero(batch, sizeof(*ptrs));
+	sizes = (size_t*)xalloc_array_zero(batch, sizeof(*sizes));
+	/* sizes like those of the domains, rrsets and rdatas */
+	for(i=0; i<batch; i++)
+		sizes[i] = 8 + (ran()%16)*8;
+
+	/* small allocations, freed all at once, like a query region */
+	region = region_create(xalloc, free);
+	start = now_nsec();
+	for(round=0; round<rounds; round++) {
+		for(i=0; i<batch; i++)
+			ptrs[i] = region_alloc(region, sizes[i]);
+		region_free_all(region);
+	}
+	report("region_alloc_free_all", batch, batch*rounds, start);
+	region_destroy(region);
+
+	/* allocations that are recycled, like the namedb region */
+	region = region_create_custom(xalloc, free, DEFAULT_CHUNK_SIZE,
+		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+	for(i=0; i<batch; i++)
+		ptrs[i] = region_alloc(region, sizes[i]);
+	start = now_nsec();
+	for(round=0; round<rounds; round++) {
+		for(i=0; i<batch; i++) {
+			size_t j = ran()%batch;
+			region_recycle(region, ptrs[j], sizes[j]);
+			ptrs[j] = region_alloc(region, sizes[j]);
+		}
+	}
+	report("region_recycle_alloc", batch, batch*rounds, start);
+	region_destroy(region);
+
+	/* the same pattern with malloc, for comparison */
+	for(i=0; i<batch; i++)
+		ptrs[i] = xalloc(sizes[i]);
+	start = now_nsec();
+	for(round=0; round<rounds; round++) {
+		for(i=0; i<batch; i++) {
+			size_t j = ran()%batch;
+			free(ptrs[j]);
+			ptrs[j] = xalloc(sizes[j]);
+		}
+	}
+	report("region_malloc_free", batch, batch*rounds, start);
+	for(i=0; i<batch; i++)
+		free(ptrs[i]);
+	free(ptrs);
+	free(sizes);
+}
+
+/** dname parse and compare */
+static void
+bench_dname(void)
+{
+	region_type* region;
+	uint8_t wire[MAXDOMAINLEN];
+	uint64_t start;
+	size_t i;
+	int sum = 0;
+	if(!selected("dname"))
+		return;
+	region = region_create(xalloc, free);
+
+	start = now_nsec();
+	for(i=0; i<num; i++) {
+		(void)dname_parse(region, order[i]->str);
+		if((i&0xfff) == 0xfff)
+			region_free_all(region);
+	}
+	report("dname_parse", num, num, start);
+	region_free_all(region);
+
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		sum += dname_parse_wire(wire, order[i]->str);
+	report("dname_parse_wire", num, num, start);
+
+	/* the names in random order compare like lookups in a tree */
+	start = now_nsec();
+	for(i=1; i<num; i++)
+		sum += dname_compare(order[i-1]->dname, order[i]->dname);
+	report("dname_compare", num, num-1, start);
+
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		sum += dname_is_subdomain(order[i]->dname,
+			names[i].dname);
+	report("dname_is_subdomain", num, num, start);
+
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		sum += dname_equal_nocase(order[i]->wire, order[i]->wire,
+			order[i]->wirelen);
+	report("dname_equal_nocase", num, num, start);
+
+	/* keep the work from being optimized away */
+	if(sum == 42)
+		printf("#\n");
+	region_destroy(region);
+}
+
+/** lookup3 hash of the names */
+static void
+bench_lookup3(void)
+{
+	uint64_t start;
+	uint32_t h = 0;
+	size_t i;
+	if(!selected("lookup3"))
+		return;
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		h = hashlittle(order[i]->wire, order[i]->wirelen, h);
+	report("lookup3_hashlittle", num, num, start);
+	if(h == 42)
+		printf("#\n");
+}
+
+/** make the ratelimit key of the name, the source netblock and the
+ * type flags before the name, like rrl.c hashes them */
+static size_t
+bench_rrl_key(uint8_t* buf, struct bname* n)
+{
+	uint64_t source = ran() & 0xffffff;
+	uint16_t flags = (uint16_t)(1<<(ran()%8));
+	memcpy(buf, &source, sizeof(source));
+	memcpy(buf+sizeof(source), &flags, sizeof(flags));
+	memcpy(buf+sizeof(source)+sizeof(flags), n->wire, n->wirelen);
+	return sizeof(source)+sizeof(flags)+n->wirelen;
+}
+
+/** the keyed hash against lookup3, on the names and on the keys of the
+ * ratelimit, with the same names and the same random sources */
+static void
+bench_hash(void)
+{
+	uint64_t start, h = 0;
+	uint8_t* keys;
+	size_t* lens;
+	size_t i;
+	uint32_t h3 = 0;
+	if(!selected("hash"))
+		return;
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		h = hash_bytes(order[i]->wire, order[i]->wirelen, h);
+	report("hash_names", num, num, start);
+
+	/* the keys are made before the timing */
+	keys = (uint8_t*)xalloc_array_zero(num, MAXDOMAINLEN+16);
+	lens = (size_t*)xalloc_array_zero(num, sizeof(*lens));
+	for(i=0; i<num; i++)
+		lens[i] = bench_rrl_key(keys + i*(MAXDOMAINLEN+16), order[i]);
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		h3 = hashlittle(keys + i*(MAXDOMAINLEN+16), lens[i], h3);
+	report("hash_rrl_lookup3", num, num, start);
+	start = now_nsec();
+	for(i=0; i<num; i++)
+		h ^= hash_bytes(keys + i*(MAXDOMAINLEN+16), lens[i], 0);
+	report("hash_rrl_keyed", num, num, start);
+	free(keys);
+	free(lens);
+	if(h == 42 || h3 == 42)
+		printf("#\n");
+}
+
+/** main program for microbench */
+int
+main(int argc, char* argv[])
+{
+	int c, runs = 1;
+	unsigned long long seed = 1;
+	region_type* region;
+	while( (c=getopt(argc, argv, "b:hn:r:s:")) != -1) {
+		switch(c) {
+		case 'b':
+			only = optarg;
+			break;
+		case 'n':
+			num = (size_t)strtoull(optarg, NULL, 10);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		default:
+		case 'h':
+			usage();
+			return 1;
+		}
+	}
+	argc -= optind;
+	if(argc != 0 || num < 2 || runs < 1) {
+		usage();
+		return 1;
+	}
+	log_init("microbench");
+	ranstate = seed?seed:1;
+	hash_set_key(ranstate);
+	region = region_create(xalloc, free);
+	make_names(region);
+
+	printf("# bench\trun\titems\tops\tnsec\tnsec/op\n");
+	for(run=1; run<=runs; run++) {
+		bench_radtree();
+		bench_rbtree();
+		bench_udbrad();
+		bench_region();
+		bench_dname();
+		bench_lookup3();
+		bench_hash();
+	}
+
+	free(names);
+	free(order);
+	region_destroy(region);
+	return 0;
+}
@@ -17,24 +17,6 @@
 #include "dname.h"
 #include "rdata.h"
 
-static uint16_t *compressed_dname_offsets = 0;
-static uint32_t compression_table_capacity = 0;
-static uint32_t compression_table_size = 0;
-/* fake compression table implementation, copy from server.c */
-static void init_dname_compr(nsd_type* nsd)
-{
-	size_t needed = domain_table_count(nsd->db->domains) + 1;
-	needed += EXTRA_DOMAIN_NUMBERS;
-	if(compression_table_capacity < needed) {
-		compressed_dname_offsets = (uint16_t *) xalloc(
-					needed * sizeof(uint16_t));
-		compression_table_capacity = needed;
-		compression_table_size=domain_table_count(nsd->db->domains)+1;
-	}
-	memset(compressed_dname_offsets, 0, needed * sizeof(uint16_t));
-        compressed_dname_offsets[0] = QHEADERSZ; /* The original query name */
-}
-
 /* create the answer to one query */
 static int run_query(query_type* q, nsd_type* nsd, buffer_type* in, int bsz)
 {
@@ -98,10 +80,7 @@ qsetup(nsd_type* nsd, region_type* region, query_type** query, char* config)
 	namedb_check_zonefiles(nsd, nsd->options, NULL, NULL);
 
 	/* setup query */
-	compression_table_capacity = 0;
-	init_dname_compr(nsd);
-	*query = query_create(region, compressed_dname_offsets,
-		compression_table_size);
+	*query = query_create(region);
 }
 
 void
@@ -311,11 +290,10 @@ buffer_spool_rr(buffer_type* output, rr_type* rr, int qsection)
 		result = print_rdata(output, d, rr);
 		if (!result) {
 			/* Some RDATA failed to print, so do unknown format. */
-			result = rdata_atoms_to_unknown_string(output, d,
-				rr->rdata_count, rr->rdatas);
+			result = rdata_to_unknown_string(output, rr);
 			if(!result) {
 				buffer_printf(output,
-					"rdata_atoms_to_unknown_string failed");
+					"rdata_to_unknown_string failed");
 			}
 		}
 	}
@@ -555,7 +533,6 @@ int runqtest(char* config, char* qfile, int verbose)
 	if(qs->write)
 		do_write(qs, query, &nsd, "qfile.out");
 
-	free(compressed_dname_offsets);
 	region_destroy(region);
 	return 0;
 }
@@ -505,14 +505,13 @@ print_udb_rr(uint8_t* name, udb_ptr* urr)
 	rr.klass = RR(urr)->klass;
 	rr.ttl = RR(urr)->ttl;
 	buffer_create_from(&buffer, RR(urr)->wire, RR(urr)->len);
-	c = rdata_wireformat_to_rdata_atoms(region, owners, RR(urr)->type,
-		RR(urr)->len, &buffer, &rr.rdatas);
+	c = rdata_wireformat_to_rdata(region, owners, RR(urr)->len, &buffer,
+		&rr);
 	if(c == -1) {
 		printf("cannot parse wireformat\n");
 		region_destroy(region);
 		return;
 	}
-	rr.rdata_count = c;
 
 	print_rr(stdout, NULL, &rr, tmpregion, tmpbuffer);
 
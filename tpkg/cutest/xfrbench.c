@@ -0,0 +1,690 @@
+/* xfrbench - time the zone transfer and reload path of nsd.
+ * Copyright 2026, NLnet Labs.
+ * BSD, see LICENSE.
+ *
+ * Synthetic signed zones, with an NSEC3 chain, are written as AXFR files
+ * in the format that xfrd writes, and after them an IXFR that changes a
+ * part of the names.  The files are applied with the tasks of a reload,
+ * like the reload process does: apply_ixfr_for_zone, the prehash of the
+ * NSEC3 chain, and the writes to nsd.db that follow the reload.  The names
+ * and the rdata come from a seeded random generator, so that runs with the
+ * same options do the same work.  The results are printed as tab separated
+ * lines, one per phase, for comparison by scripts:
+ *	phase	run	zones	rrs	nsec	rr/s	maxrss_kb
+ */
+
+#include "config.h"
+#include "nsd.h"
+#include "options.h"
+#include "namedb.h"
+#include "difffile.h"
+#include "xfrd-disk.h"
+#include "iterated_hash.h"
+#include "packet.h"
+#include "udb.h"
+#include "util.h"
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+/** size of the messages in the transfer files */
+#define XFR_MSG_SIZE 16384
+/** the length of the signatures, like RSASHA256 with a 1024 bit key */
+#define SIG_LEN 128
+/** the TTL of the RRs */
+#define BENCH_TTL 3600
+
+struct nsd nsd;
+/** number of names in a zone */
+static size_t num = 100000;
+/** number of zones */
+static int num_zones = 1;
+/** percent of the names that the IXFR changes */
+static double churn = 1.0;
+/** directory for the transfer files and the database */
+static const char* dir = "/tmp";
+/** do not use nsd.db */
+static int memonly = 0;
+/** random seed */
+static uint64_t seed = 1;
+/** the run number */
+static int run;
+/** the number of the next transfer file */
+static uint64_t filenr = 1;
+
+/** print usage text */
+static void
+usage(void)
+{
+	printf("usage:	xfrbench [options]\n");
+	printf(" -h		this help\n");
+	printf(" -n num		number of names per zone, default 100000\n");
+	printf(" -z num		number of zones, applied in one reload, "
+	       "default 1\n");
+	printf(" -c pct		percent of the names that the IXFR changes, "
+	       "default 1\n");
+	printf(" -d dir		directory for temporary files, default /tmp\n");
+	printf(" -m		keep the zones in memory, without nsd.db\n");
+	printf(" -r runs		repeat the transfers, default 1\n");
+	printf(" -s seed		seed of the random generator, default 1\n");
+	printf("output is tab separated: phase run zones rrs nsec rr/s "
+	       "maxrss_kb\n");
+}
+
+/** repeatable random numbers for a key, splitmix64 */
+static uint64_t
+ran_key(uint64_t key)
+{
+	uint64_t z = key + seed*0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/** nanoseconds of a monotonic clock */
+static uint64_t
+now_nsec(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+	{
+		struct timeval tv;
+		if(gettimeofday(&tv, NULL) != 0)
+			return 0;
+		return (uint64_t)tv.tv_sec*1000000000 +
+			(uint64_t)tv.tv_usec*1000;
+	}
+}
+
+/** the peak resident size of the process in kb */
+static unsigned long long
+maxrss_kb(void)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) == 0)
+		return (unsigned long long)ru.ru_maxrss;
+#endif
+	return 0;
+}
+
+/** print the result line of a phase */
+static void
+report(const char* phase, uint64_t rrs, uint64_t nsec)
+{
+	printf("%s\t%d\t%d\t%llu\t%llu\t%.0f\t%llu\n", phase, run, num_zones,
+		(unsigned long long)rrs, (unsigned long long)nsec,
+		nsec?(double)rrs*1e9/(double)nsec:0., maxrss_kb());
+	fflush(stdout);
+}
+
+/** the apex of zone z in wireformat, returns the length */
+static size_t
+apex_wire(int z, uint8_t* buf)
+{
+	char str[64];
+	int len;
+	snprintf(str, sizeof(str), "z%d.bench.", z);
+	len = dname_parse_wire(buf, str);
+	if(len == 0) {
+		fprintf(stderr, "cannot parse %s\n", str);
+		exit(1);
+	}
+	return (size_t)len;
+}
+
+/** the name idx of zone z, 0 is the apex and 1 the nameserver */
+static size_t
+name_wire(int z, size_t idx, uint8_t* buf)
+{
+	uint8_t apex[MAXDOMAINLEN];
+	size_t apexlen = apex_wire(z, apex);
+	int len;
+	if(idx == 0) {
+		memmove(buf, apex, apexlen);
+		return apexlen;
+	}
+	if(idx == 1)
+		len = snprintf((char*)buf+1, 64, "ns1");
+	else	len = snprintf((char*)buf+1, 64, "h%llx",
+			(unsigned long long)idx);
+	buf[0] = (uint8_t)len;
+	memmove(buf+1+len, apex, apexlen);
+	return 1 + (size_t)len + apexlen;
+}
+
+/** the number of labels of the name, for the RRSIG, without the root */
+static uint8_t
+name_labels(const uint8_t* wire)
+{
+	uint8_t n = 0;
+	while(*wire) {
+		n++;
+		wire += 1 + *wire;
+	}
+	return n;
+}
+
+/** the transfer file that is written */
+struct xfr_out {
+	buffer_type* packet;
+	uint16_t count;
+	uint32_t parts;
+	uint64_t rrs;
+	const char* zone;
+	uint32_t old_serial, new_serial;
+	uint64_t filenr;
+};
+
+/** write the message to the transfer file */
+static void
+out_flush(struct xfr_out* o)
+{
+	if(o->count == 0)
+		return;
+	ANCOUNT_SET(o->packet, o->count);
+	diff_write_packet(o->zone, "bench", o->old_serial, o->new_serial,
+		o->parts, buffer_begin(o->packet), buffer_position(o->packet),
+		&nsd, o->filenr);
+	o->parts++;
+	o->count = 0;
+	memset(buffer_begin(o->packet), 0, QHEADERSZ);
+	buffer_set_position(o->packet, QHEADERSZ);
+}
+
+/** add an RR to the transfer */
+static void
+out_rr(struct xfr_out* o, const uint8_t* owner, size_t ownerlen,
+	uint16_t type, const uint8_t* rdata, size_t rdlen)
+{
+	if(buffer_position(o->packet) + ownerlen + 10 + rdlen > XFR_MSG_SIZE
+		|| o->count == 65535)
+		out_flush(o);
+	buffer_write(o->packet, owner, ownerlen);
+	buffer_write_u16(o->packet, type);
+	buffer_write_u16(o->packet, CLASS_IN);
+	buffer_write_u32(o->packet, BENCH_TTL);
+	buffer_write_u16(o->packet, (uint16_t)rdlen);
+	buffer_write(o->packet, rdata, rdlen);
+	o->count++;
+	o->rrs++;
+}
+
+/** start a transfer file for zone z */
+static void
+out_start(struct xfr_out* o, region_type* region, const char* zone,
+	uint32_t old_serial, uint32_t new_serial)
+{
+	memset(o, 0, sizeof(*o));
+	o->packet = buffer_create(region, XFR_MSG_SIZE);
+	memset(buffer_begin(o->packet), 0, QHEADERSZ);
+	buffer_set_position(o->packet, QHEADERSZ);
+	o->zone = zone;
+	o->old_serial = old_serial;
+	o->new_serial = new_serial;
+	o->filenr = filenr++;
+}
+
+/** finish the transfer file, and add the task for the reload */
+static void
+out_finish(struct xfr_out* o, udb_base* task, udb_ptr* last,
+	const dname_type* apex, int is_axfr)
+{
+	out_flush(o);
+	diff_write_commit(o->zone, o->old_serial, o->new_serial, o->parts, 1,
+		"xfrbench", &nsd, o->filenr);
+	if(!task_new_apply_xfr(task, last, apex, o->old_serial,
+		o->new_serial, o->filenr, is_axfr)) {
+		fprintf(stderr, "cannot add task\n");
+		exit(1);
+	}
+}
+
+/** the SOA rdata of zone z */
+static size_t
+soa_rdata(int z, uint32_t serial, uint8_t* buf)
+{
+	uint8_t apex[MAXDOMAINLEN];
+	size_t apexlen = apex_wire(z, apex), len = 0;
+	len = name_wire(z, 1, buf);
+	buf[len] = 10;
+	memmove(buf+len+1, "hostmaster", 10);
+	memmove(buf+len+11, apex, apexlen);
+	len += 11 + apexlen;
+	write_uint32(buf+len, serial);
+	write_uint32(buf+len+4, 3600);
+	write_uint32(buf+len+8, 900);
+	write_uint32(buf+len+12, 604800);
+	write_uint32(buf+len+16, 3600);
+	return len + 20;
+}
+
+/** the RRSIG rdata over type at owner, for the version of the data */
+static size_t
+rrsig_rdata(int z, const uint8_t* owner, uint16_t type, uint64_t key,
+	uint8_t* buf)
+{
+	size_t len, i;
+	write_uint16(buf, type);
+	buf[2] = 8; /* RSASHA256 */
+	buf[3] = name_labels(owner);
+	write_uint32(buf+4, BENCH_TTL);
+	write_uint32(buf+8, 2000000000);
+	write_uint32(buf+12, 1700000000);
+	write_uint16(buf+16, 12345);
+	len = 18 + apex_wire(z, buf+18);
+	for(i=0; i<SIG_LEN; i+=8) {
+		uint64_t r = ran_key(key*8 + i);
+		memmove(buf+len+i, &r, 8);
+	}
+	return len + SIG_LEN;
+}
+
+/** the A and RRSIG A of name idx, for the version of its data */
+static void
+out_address(struct xfr_out* o, int z, size_t idx, uint32_t version)
+{
+	uint8_t owner[MAXDOMAINLEN], rdata[512];
+	size_t ownerlen = name_wire(z, idx, owner);
+	uint64_t key = ((uint64_t)z<<48) ^ ((uint64_t)idx<<8) ^ version;
+	uint32_t addr = 0x0a000000 | (uint32_t)(ran_key(key) & 0xffffff);
+	write_uint32(rdata, addr);
+	out_rr(o, owner, ownerlen, TYPE_A, rdata, 4);
+	out_rr(o, owner, ownerlen, TYPE_RRSIG, rdata, rrsig_rdata(z, owner,
+		TYPE_A, key, rdata));
+}
+
+#ifdef NSEC3
+/** the NSEC3 hash of a name, with its index */
+struct bhash {
+	uint8_t hash[SHA_DIGEST_LENGTH];
+	size_t idx;
+};
+
+static int
+bhash_cmp(const void* a, const void* b)
+{
+	return memcmp(((const struct bhash*)a)->hash,
+		((const struct bhash*)b)->hash, SHA_DIGEST_LENGTH);
+}
+
+/** the type bitmap, for the window 0 types */
+static size_t
+bitmap_rdata(const uint16_t* types, size_t n, uint8_t* buf)
+{
+	size_t i, len = 0;
+	memset(buf, 0, 34);
+	for(i=0; i<n; i++) {
+		buf[2 + types[i]/8] |= (uint8_t)(0x80 >> (types[i]%8));
+		if((size_t)types[i]/8 + 1 > len)
+			len = (size_t)types[i]/8 + 1;
+	}
+	buf[0] = 0;
+	buf[1] = (uint8_t)len;
+	return 2 + len;
+}
+
+/** the NSEC3 chain of the zone, with the RRSIGs */
+static void
+out_nsec3(struct xfr_out* o, int z, uint32_t version)
+{
+	static const uint16_t apex_types[] = { TYPE_NS, TYPE_SOA,
+		TYPE_RRSIG, TYPE_DNSKEY, TYPE_NSEC3PARAM };
+	static const uint16_t name_types[] = { TYPE_A, TYPE_RRSIG };
+	struct bhash* h = (struct bhash*)xalloc_array_zero(num,
+		sizeof(*h));
+	uint8_t wire[MAXDOMAINLEN], owner[MAXDOMAINLEN], rdata[1024];
+	uint8_t apex[MAXDOMAINLEN];
+	size_t apexlen = apex_wire(z, apex), i, len, ownerlen;
+	char b32[64];
+	int b32len;
+
+	for(i=0; i<num; i++) {
+		len = name_wire(z, i, wire);
+		h[i].idx = i;
+		(void)iterated_hash(h[i].hash, NULL, 0, wire, (int)len, 0);
+	}
+	qsort(h, num, sizeof(*h), bhash_cmp);
+	for(i=0; i<num; i++) {
+		b32len = b32_ntop(h[i].hash, SHA_DIGEST_LENGTH, b32,
+			sizeof(b32));
+		if(b32len <= 0) {
+			fprintf(stderr, "cannot encode hash\n");
+			exit(1);
+		}
+		owner[0] = (uint8_t)b32len;
+		memmove(owner+1, b32, b32len);
+		memmove(owner+1+b32len, apex, apexlen);
+		ownerlen = 1 + (size_t)b32len + apexlen;
+		rdata[0] = NSEC3_SHA1_HASH;
+		rdata[1] = 0;
+		write_uint16(rdata+2, 0);
+		rdata[4] = 0; /* no salt */
+		rdata[5] = SHA_DIGEST_LENGTH;
+		memmove(rdata+6, h[(i+1)%num].hash, SHA_DIGEST_LENGTH);
+		len = 6 + SHA_DIGEST_LENGTH;
+		if(h[i].idx == 0)
+			len += bitmap_rdata(apex_types, sizeof(apex_types)/
+				sizeof(apex_types[0]), rdata+len);
+		else	len += bitmap_rdata(name_types, sizeof(name_types)/
+				sizeof(name_types[0]), rdata+len);
+		out_rr(o, owner, ownerlen, TYPE_NSEC3, rdata, len);
+		out_rr(o, owner, ownerlen, TYPE_RRSIG, rdata, rrsig_rdata(z,
+			owner, TYPE_NSEC3, ((uint64_t)z<<48) ^
+			((uint64_t)h[i].idx<<8) ^ version ^ 0x80, rdata));
+	}
+	free(h);
+}
+#endif /* NSEC3 */
+
+/** write the AXFR of zone z */
+static uint64_t
+write_axfr(int z, uint32_t serial, udb_base* task, udb_ptr* last)
+{
+	region_type* region = region_create(xalloc, free);
+	struct xfr_out o;
+	uint8_t apex[MAXDOMAINLEN], rdata[1024];
+	size_t apexlen = apex_wire(z, apex), len, i;
+	const dname_type* dname = dname_make(region, apex, 1);
+	uint64_t key = ((uint64_t)z<<48) ^ serial;
+
+	out_start(&o, region, dname_to_string(dname, NULL), 0, serial);
+	len = soa_rdata(z, serial, rdata);
+	out_rr(&o, apex, apexlen, TYPE_SOA, rdata, len);
+	out_rr(&o, apex, apexlen, TYPE_RRSIG, rdata, rrsig_rdata(z, apex,
+		TYPE_SOA, key ^ 0x10, rdata));
+	len = name_wire(z, 1, rdata);
+	out_rr(&o, apex, apexlen, TYPE_NS, rdata, len);
+	out_rr(&o, apex, apexlen, TYPE_RRSIG, rdata, rrsig_rdata(z, apex,
+		TYPE_NS, key ^ 0x20, rdata));
+	write_uint16(rdata, 257);
+	rdata[2] = 3;
+	rdata[3] = 8;
+	for(i=0; i<SIG_LEN; i++)
+		rdata[4+i] = (uint8_t)ran_key(i);
+	out_rr(&o, apex, apexlen, TYPE_DNSKEY, rdata, 4+SIG_LEN);
+	out_rr(&o, apex, apexlen, TYPE_RRSIG, rdata, rrsig_rdata(z, apex,
+		TYPE_DNSKEY, key ^ 0x30, rdata));
+#ifdef NSEC3
+	rdata[0] = NSEC3_SHA1_HASH;
+	rdata[1] = 0;
+	write_uint16(rdata+2, 0);
+	rdata[4] = 0;
+	out_rr(&o, apex, apexlen, TYPE_NSEC3PARAM, rdata, 5);
+	out_rr(&o, apex, apexlen, TYPE_RRSIG, rdata, rrsig_rdata(z, apex,
+		TYPE_NSEC3PARAM, key ^ 0x40, rdata));
+#endif
+	for(i=1; i<num; i++)
+		out_address(&o, z, i, serial);
+#ifdef NSEC3
+	out_nsec3(&o, z, serial);
+#endif
+	len = soa_rdata(z, serial, rdata);
+	out_rr(&o, apex, apexlen, TYPE_SOA, rdata, len);
+	out_finish(&o, task, last, dname, 1);
+	region_destroy(region);
+	return o.rrs;
+}
+
+/** write the IXFR of zone z, that changes the addresses of a part of the
+ * names from the old serial to the new serial */
+static uint64_t
+write_ixfr(int z, uint32_t old_serial, uint32_t new_serial, udb_base* task,
+	udb_ptr* last)
+{
+	region_type* region = region_create(xalloc, free);
+	struct xfr_out o;
+	uint8_t apex[MAXDOMAINLEN], rdata[1024];
+	size_t apexlen = apex_wire(z, apex), i, step;
+	const dname_type* dname = dname_make(region, apex, 1);
+	size_t changed = (size_t)((double)num * churn / 100.);
+
+	if(changed < 1)
+		changed = 1;
+	step = (num-1) / changed;
+	if(step < 1)
+		step = 1;
+	out_start(&o, region, dname_to_string(dname, NULL), old_serial,
+		new_serial);
+	out_rr(&o, apex, apexlen, TYPE_SOA, rdata, soa_rdata(z, new_serial,
+		rdata));
+	out_rr(&o, apex, apexlen, TYPE_SOA, rdata, soa_rdata(z, old_serial,
+		rdata));
+	for(i=1; i<num; i+=step)
+		out_address(&o, z, i, old_serial);
+	out_rr(&o, apex, apexlen, TYPE_SOA, rdata, soa_rdata(z, new_serial,
+		rdata));
+	for(i=1; i<num; i+=step)
+		out_address(&o, z, i, new_serial);
+	out_rr(&o, apex, apexlen, TYPE_SOA, rdata, soa_rdata(z, new_serial,
+		rdata));
+	out_finish(&o, task, last, dname, 0);
+	region_destroy(region);
+	return o.rrs;
+}
+
+/** process the tasks like the reload does, and time the phases */
+static void
+bench_reload(udb_base* u, const char* name, uint64_t rrs)
+{
+	udb_ptr t, next, last_task;
+	uint64_t start, apply, prehash, flush;
+	char phase[64];
+
+	memset(&nsd.reload_timing, 0, sizeof(nsd.reload_timing));
+	start = now_nsec();
+	udb_ptr_init(&last_task, u);
+	udb_ptr_init(&next, u);
+	udb_ptr_new(&t, u, udb_base_get_userdata(u));
+	udb_base_set_userdata(u, 0);
+	diff_udb_defer(1);
+	task_coalesce_xfr(u, &t);
+	task_prefetch_xfr(&nsd, u, &t);
+	while(!udb_ptr_is_null(&t)) {
+		udb_ptr_set_rptr(&next, u, &TASKLIST(&t)->next);
+		udb_rptr_zero(&TASKLIST(&t)->next, u);
+		task_process_in_reload(&nsd, u, &last_task, &t);
+		udb_ptr_set_ptr(&t, u, &next);
+	}
+	diff_udb_defer(0);
+	apply = now_nsec() - start;
+
+	/* the new servers run, and the changes go to nsd.db */
+	start = now_nsec();
+	if(diff_udb_pending())
+		(void)diff_udb_flush(nsd.db);
+	if(nsd.db->udb)
+		udb_base_sync(nsd.db->udb, 1);
+	flush = now_nsec() - start;
+
+	prehash = nsd.reload_timing.phase[RELOAD_PHASE_PREHASH];
+	snprintf(phase, sizeof(phase), "%s_apply", name);
+	report(phase, rrs, apply - prehash);
+	snprintf(phase, sizeof(phase), "%s_prehash", name);
+	report(phase, rrs, prehash);
+	snprintf(phase, sizeof(phase), "%s_udb", name);
+	report(phase, rrs, flush);
+	snprintf(phase, sizeof(phase), "%s_reload", name);
+	report(phase, rrs, apply + flush);
+
+	udb_ptr_unlink(&t, u);
+	udb_ptr_unlink(&next, u);
+	udb_ptr_unlink(&last_task, u);
+	/* the results for xfrd */
+	task_clear(u);
+}
+
+/** configure the zones, and create them in the database */
+static void
+bench_setup(void)
+{
+	pattern_options_t* pat;
+	char dbfile[1024];
+	int z;
+
+	nsd.options = nsd_options_create(region_create_custom(xalloc, free,
+		DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+		DEFAULT_INITIAL_CLEANUP_SIZE, 1));
+	nsd.region = region_create(xalloc, free);
+	nsd.pid = getpid();
+	nsd.options->xfrdir = region_strdup(nsd.options->region, dir);
+	xfrd_make_tempdir(&nsd);
+	pat = pattern_options_create(nsd.options->region);
+	pat->pname = region_strdup(nsd.options->region, "bench");
+	if(!nsd_options_insert_pattern(nsd.options, pat)) {
+		fprintf(stderr, "cannot add pattern\n");
+		exit(1);
+	}
+	if(memonly) {
+		nsd.options->database = "";
+	} else {
+		snprintf(dbfile, sizeof(dbfile), "%s/xfrbench.%d.db", dir,
+			(int)nsd.pid);
+		nsd.options->database = region_strdup(nsd.options->region,
+			dbfile);
+	}
+	nsd.db = namedb_open(nsd.options->database, nsd.options);
+	if(!nsd.db) {
+		fprintf(stderr, "cannot open the database %s: %s\n",
+			nsd.options->database, strerror(errno));
+		exit(1);
+	}
+	for(z=0; z<num_zones; z++) {
+		uint8_t apex[MAXDOMAINLEN];
+		zone_options_t* zo = zone_options_create(
+			nsd.options->region);
+		const dname_type* dname;
+		(void)apex_wire(z, apex);
+		dname = dname_make(nsd.options->region, apex, 1);
+		zo->name = region_strdup(nsd.options->region,
+			dname_to_string(dname, NULL));
+		zo->pattern = pat;
+		if(!nsd_options_insert_zone(nsd.options, zo)) {
+			fprintf(stderr, "cannot add zone %s\n", zo->name);
+			exit(1);
+		}
+		(void)namedb_zone_create(nsd.db, dname, zo);
+	}
+}
+
+/** close the database and remove the temporary files */
+static void
+bench_cleanup(udb_base* task, const char* taskfile)
+{
+	const char* dbfile = nsd.options->database;
+	udb_base_free(task);
+	unlink(taskfile);
+	namedb_close(nsd.db);
+	if(dbfile && dbfile[0])
+		unlink(dbfile);
+	xfrd_del_tempdir(&nsd);
+	region_destroy(nsd.options->region);
+	region_destroy(nsd.region);
+}
+
+/* dummy functions to link */
+int writepid(struct nsd * ATTR_UNUSED(nsd))
+{
+	return 0;
+}
+void unlinkpid(const char * ATTR_UNUSED(file))
+{
+}
+void bind8_stats(struct nsd * ATTR_UNUSED(nsd))
+{
+}
+void sig_handler(int ATTR_UNUSED(sig))
+{
+}
+
+/** main program for xfrbench */
+int
+main(int argc, char* argv[])
+{
+	int c, z, runs = 1;
+	char taskfile[1024];
+	udb_base* task;
+	udb_ptr last;
+	uint64_t start, rrs;
+	uint32_t serial;
+	while( (c=getopt(argc, argv, "c:d:hmn:r:s:z:")) != -1) {
+		switch(c) {
+		case 'c':
+			churn = atof(optarg);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'm':
+			memonly = 1;
+			break;
+		case 'n':
+			num = (size_t)strtoull(optarg, NULL, 10);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'z':
+			num_zones = atoi(optarg);
+			break;
+		default:
+		case 'h':
+			usage();
+			return 1;
+		}
+	}
+	argc -= optind;
+	if(argc != 0 || num < 2 || runs < 1 || num_zones < 1 ||
+		churn <= 0 || churn > 100) {
+		usage();
+		return 1;
+	}
+	log_init("xfrbench");
+	memset(&nsd, 0, sizeof(nsd));
+	bench_setup();
+	snprintf(taskfile, sizeof(taskfile), "%s/xfrbench.%d.task", dir,
+		(int)nsd.pid);
+	task = task_file_create(taskfile);
+	if(!task) {
+		fprintf(stderr, "cannot create %s\n", taskfile);
+		exit(1);
+	}
+	udb_ptr_init(&last, task);
+
+	printf("# phase\trun\tzones\trrs\tnsec\trr/s\tmaxrss_kb\n");
+	for(run=1; run<=runs; run++) {
+		serial = (uint32_t)run*2 - 1;
+		start = now_nsec();
+		rrs = 0;
+		for(z=0; z<num_zones; z++)
+			rrs += write_axfr(z, serial, task, &last);
+		udb_ptr_zero(&last, task);
+		report("axfr_write", rrs, now_nsec() - start);
+		bench_reload(task, "axfr", rrs);
+
+		start = now_nsec();
+		rrs = 0;
+		for(z=0; z<num_zones; z++)
+			rrs += write_ixfr(z, serial, serial+1, task, &last);
+		udb_ptr_zero(&last, task);
+		report("ixfr_write", rrs, now_nsec() - start);
+		bench_reload(task, "ixfr", rrs);
+	}
+
+	udb_ptr_unlink(&last, task);
+	bench_cleanup(task, taskfile);
+	return 0;
+}
@@ -11,6 +11,9 @@
 
 #if defined(HAVE_SSL)
 
+#ifdef USE_SERVER_THREADS
+#include <pthread.h>
+#endif
 #include "tsig-openssl.h"
 #include "tsig.h"
 #include "util.h"
@@ -21,6 +24,7 @@ static void init_context(void *context,
 			 tsig_key_type *key);
 static void update(void *context, const void *data, size_t size);
 static void final(void *context, uint8_t *digest, size_t *size);
+static void free_key_context(void *context);
 
 static int
 tsig_openssl_init_algorithm(region_type* region,
@@ -50,6 +54,7 @@ tsig_openssl_init_algorithm(region_type* region,
 	algorithm->hmac_init_context = init_context;
 	algorithm->hmac_update = update;
 	algorithm->hmac_final = final;
+	algorithm->hmac_free_key_context = free_key_context;
 	tsig_add_algorithm(algorithm);
 
 	return 1;
@@ -77,23 +82,48 @@ tsig_openssl_init(region_type *region)
 	return count;
 }
 
+static HMAC_CTX *
+hmac_context_new(void)
+{
+#ifdef HAVE_HMAC_CTX_NEW
+	return HMAC_CTX_new();
+#else
+	HMAC_CTX *context = (HMAC_CTX *) xalloc(sizeof(HMAC_CTX));
+	HMAC_CTX_init(context);
+	return context;
+#endif
+}
+
 static void
-cleanup_context(void *data)
+free_key_context(void *data)
 {
 	HMAC_CTX *context = (HMAC_CTX *) data;
+#ifdef HAVE_HMAC_CTX_NEW
+	HMAC_CTX_free(context);
+#else
 	HMAC_CTX_cleanup(context);
+	free(context);
+#endif
 }
 
 static void *
 create_context(region_type *region)
 {
-	HMAC_CTX *context
-		= (HMAC_CTX *) region_alloc(region, sizeof(HMAC_CTX));
-	region_add_cleanup(region, cleanup_context, context);
-	HMAC_CTX_init(context);
+	HMAC_CTX *context = hmac_context_new();
+	region_add_cleanup(region, free_key_context, context);
 	return context;
 }
 
+/*
+ * The key is hashed into the inner and outer pads once, on the first
+ * use of the key, and that state is copied for every message.  A key
+ * used with another algorithm than the first one is set up every time.
+ * The server threads share the keys, the first use is made under a lock.
+ */
+#ifdef USE_SERVER_THREADS
+static pthread_mutex_t key_context_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static void
 init_context(void *context,
 			  tsig_algorithm_type *algorithm,
@@ -101,7 +131,29 @@ init_context(void *context,
 {
 	HMAC_CTX *ctx = (HMAC_CTX *) context;
 	const EVP_MD *md = (const EVP_MD *) algorithm->data;
-	HMAC_Init_ex(ctx, key->data, key->size, md, NULL);
+#ifdef USE_SERVER_THREADS
+	pthread_mutex_lock(&key_context_lock);
+#endif
+	if (!key->key_context) {
+		HMAC_CTX *key_ctx = hmac_context_new();
+		HMAC_Init_ex(key_ctx, key->data, key->size, md, NULL);
+		key->key_context = key_ctx;
+		key->key_algorithm = algorithm;
+	} else if (key->key_algorithm != algorithm) {
+#ifdef USE_SERVER_THREADS
+		pthread_mutex_unlock(&key_context_lock);
+#endif
+		HMAC_Init_ex(ctx, key->data, key->size, md, NULL);
+		return;
+	}
+#ifdef USE_SERVER_THREADS
+	pthread_mutex_unlock(&key_context_lock);
+#endif
+#ifndef HAVE_HMAC_CTX_NEW
+	/* the copy does not free the digest state it overwrites */
+	HMAC_CTX_cleanup(ctx);
+#endif
+	HMAC_CTX_copy(ctx, (HMAC_CTX *) key->key_context);
 }
 
 static void
@@ -124,6 +124,16 @@ tsig_del_key(tsig_key_type *key)
 	region_recycle(tsig_region, entry, sizeof(tsig_key_table_type));
 }
 
+void
+tsig_key_clear_context(tsig_key_type *key)
+{
+	if(!key || !key->key_context)
+		return;
+	key->key_algorithm->hmac_free_key_context(key->key_context);
+	key->key_context = NULL;
+	key->key_algorithm = NULL;
+}
+
 tsig_key_type*
 tsig_find_key(const dname_type* name)
 {
@@ -201,7 +211,7 @@ tsig_get_algorithm_by_name(const char *name)
 const char *
 tsig_error(int error_code)
 {
-	static char message[1000];
+	static NSD_THREAD_LOCAL char message[1000];
 
 	switch (error_code) {
 	case TSIG_ERROR_NOERROR:
@@ -90,6 +90,11 @@ struct tsig_algorithm
 	 * least maximum_digest_size bytes.
 	 */
 	void  (*hmac_final)(void *context, uint8_t *digest, size_t *size);
+
+	/*
+	 * Free the HMAC context that init_context kept with the key.
+	 */
+	void  (*hmac_free_key_context)(void *context);
 };
 
 /*
@@ -100,6 +105,13 @@ struct tsig_key
 	const dname_type *name;
 	size_t            size;
 	uint8_t		 *data;
+	/*
+	 * The HMAC context after the key is hashed in, for the
+	 * key_algorithm.  Made when the key is first used, copied into
+	 * the context of each message.  NULL if not made.
+	 */
+	void		 *key_context;
+	tsig_algorithm_type *key_algorithm;
 };
 
 struct tsig_record
@@ -142,6 +154,12 @@ int tsig_init(region_type *region);
 void tsig_add_key(tsig_key_type *key);
 void tsig_del_key(tsig_key_type *key);
 
+/*
+ * Free the HMAC context kept with the key, before the key data
+ * changes.
+ */
+void tsig_key_clear_context(tsig_key_type *key);
+
 /*
  * Add the specified algorithm to the TSIG algorithm table.
  */
@@ -12,6 +12,7 @@
 #include <assert.h>
 #include "lookup3.h"
 #include "util.h"
+#include "usdt.h"
 
 /* mmap and friends */
 #include <sys/types.h>
@@ -89,6 +90,7 @@ udb_base_create_fd(const char* fname, int fd, udb_walk_relptr_func walkfunc,
 	udb->walkfunc = walkfunc;
 	udb->walkarg = arg;
 	udb->fd = fd;
+	udb->readonly = ((fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDONLY);
 	udb->ram_size = 1024;
 	udb->ram_mask = (int)udb->ram_size - 1;
 	udb->ram_hash = (udb_ptr**)xalloc_array_zero(sizeof(udb_ptr*),
@@ -173,7 +175,7 @@ udb_base_create_fd(const char* fname, int fd, udb_walk_relptr_func walkfunc,
 	/* note the size_t casts must be there for portability, on some
 	 * systems the layout of memory is otherwise broken. */
 	udb->base = mmap(NULL, (size_t)udb->base_size,
-		(int)PROT_READ|PROT_WRITE, (int)MAP_SHARED,
+		(int)PROT_READ|(udb->readonly?0:PROT_WRITE), (int)MAP_SHARED,
 		(int)udb->fd, (off_t)0);
 #else
 	udb->base = MAP_FAILED; errno = ENOSYS;
@@ -208,7 +210,8 @@ udb_base_create_fd(const char* fname, int fd, udb_walk_relptr_func walkfunc,
 		udb_alloc_compact(udb, udb->alloc);
 		udb_base_sync(udb, 1);
 	}
-	udb->glob_data->clean_close = 0;
+	if(!udb->readonly)
+		udb->glob_data->clean_close = 0;
 
 	return udb;
 }
@@ -316,19 +319,21 @@ void udb_base_close(udb_base* udb)
 {
 	if(!udb)
 		return;
-	if(udb->fd != -1 && udb->base && udb->alloc) {
+	if(udb->fd != -1 && udb->base && udb->alloc && !udb->readonly) {
 		uint64_t nsize = udb->alloc->disk->nextgrow;
 		if(nsize < udb->base_size)
 			udb_base_shrink(udb, nsize);
 	}
 	if(udb->fd != -1) {
-		udb->glob_data->clean_close = 1;
+		if(!udb->readonly)
+			udb->glob_data->clean_close = 1;
 		close(udb->fd);
 		udb->fd = -1;
 	}
 	if(udb->base) {
 #ifdef HAVE_MMAP
-		if(munmap(udb->base, udb->base_size) == -1) {
+		if(munmap(udb->base, udb->map_size?udb->map_size:
+			udb->base_size) == -1) {
 			log_msg(LOG_ERR, "munmap: %s", strerror(errno));
 		}
 #endif
@@ -363,7 +368,7 @@ void udb_base_free_keep_mmap(udb_base* udb)
 
 void udb_base_sync(udb_base* udb, int wait)
 {
-	if(!udb) return;
+	if(!udb || udb->readonly) return;
 #ifdef HAVE_MMAP
 	if(msync(udb->base, udb->base_size, wait?MS_SYNC:MS_ASYNC) != 0) {
 		log_msg(LOG_ERR, "msync(%s) error %s",
@@ -374,6 +379,89 @@ void udb_base_sync(udb_base* udb, int wait)
 #endif
 }
 
+int udb_base_publish(udb_base* udb, const char* fname)
+{
+	char tmp[1024];
+	udb_glob_d g;
+	size_t pos, len;
+	int fd;
+	if(!udb || !udb->base)
+		return 0;
+	snprintf(tmp, sizeof(tmp), "%s.%u", fname, (unsigned)getpid());
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(fd == -1) {
+		log_msg(LOG_ERR, "%s: %s", tmp, strerror(errno));
+		return 0;
+	}
+	/* the header of the copy says it is closed, the udb is open */
+	memcpy(&g, udb->glob_data, sizeof(g));
+	g.clean_close = 1;
+	if(!write_fdata(tmp, fd, udb->base, sizeof(uint64_t)) ||
+		!write_fdata(tmp, fd, &g, sizeof(g)))
+		goto fail;
+	pos = sizeof(uint64_t)+sizeof(g);
+	while(pos < udb->base_size) {
+		len = udb->base_size - pos;
+		if(len > 1024*1024)
+			len = 1024*1024;
+		if(!write_fdata(tmp, fd, (char*)udb->base+pos, len))
+			goto fail;
+		pos += len;
+	}
+	if(fsync(fd) != 0) {
+		log_msg(LOG_ERR, "fsync(%s): %s", tmp, strerror(errno));
+		close(fd);
+		goto fail;
+	}
+	close(fd);
+	if(rename(tmp, fname) != 0) {
+		log_msg(LOG_ERR, "rename(%s, %s): %s", tmp, fname,
+			strerror(errno));
+		goto fail;
+	}
+	return 1;
+fail:
+	/* write_fdata has closed the fd */
+	unlink(tmp);
+	return 0;
+}
+
+int udb_base_lock(udb_base* udb, int write)
+{
+	/* a lock on the file, other processes that have the udb mmaped
+	 * lock it too, it is released when the process exits */
+	struct flock fl;
+	if(!udb || udb->fd == -1) return 0;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = write?F_WRLCK:F_RDLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 0;
+	while(fcntl(udb->fd, write?F_SETLKW:F_SETLK, &fl) == -1) {
+		if(errno == EINTR)
+			continue;
+		if(write)
+			log_msg(LOG_ERR, "lock(%s) error %s", udb->fname,
+				strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+void udb_base_unlock(udb_base* udb)
+{
+	struct flock fl;
+	if(!udb || udb->fd == -1) return;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 0;
+	if(fcntl(udb->fd, F_SETLK, &fl) == -1)
+		log_msg(LOG_ERR, "unlock(%s) error %s", udb->fname,
+			strerror(errno));
+}
+
 /** hash a chunk pointer */
 static uint32_t
 chunk_hash_ptr(udb_void p)
@@ -509,15 +597,49 @@ uint8_t udb_base_get_userflags(udb_base* udb)
 	return udb->glob_data->userflags;
 }
 
+#ifdef HAVE_MMAP
+/** the mapping of the udb is at nb now */
+static void
+udb_base_moved(udb_base* udb, udb_alloc* alloc, void* nb)
+{
+	if(nb != udb->base) {
+		/* fix up realpointers in udb and alloc */
+		/* but mremap may have been nice and not move the base */
+		udb->base = nb;
+		udb->glob_data = (udb_glob_d*)(nb+sizeof(uint64_t));
+		/* use passed alloc pointer because the udb->alloc may not
+		 * be initialized yet */
+		alloc->disk = (udb_alloc_d*)((void*)udb->glob_data
+			+sizeof(*udb->glob_data));
+	}
+}
+#endif /* HAVE_MMAP */
+
 /** re-mmap the udb to specified size */
 static void*
 udb_base_remap(udb_base* udb, udb_alloc* alloc, uint64_t nsize)
 {
 #ifdef HAVE_MMAP
 	void* nb;
+	size_t oldlen = udb->base_size, len = (size_t)nsize;
+	int flags = MAP_SHARED;
+	if(udb->map_size) {
+		/* the file grows or shrinks in the room of the mapping */
+		if(nsize <= udb->map_size) {
+			udb->base_size = nsize;
+			return udb->base;
+		}
+		/* past the room, reserve again with twice the size */
+		oldlen = udb->map_size;
+		len = (size_t)nsize*2;
+#ifdef MAP_NORESERVE
+		flags |= MAP_NORESERVE;
+#endif
+	}
+	udb->remap_count++;
 	/* for use with valgrind, do not use mremap, but the other version */
 #ifdef MREMAP_MAYMOVE
-	nb = mremap(udb->base, udb->base_size, nsize, MREMAP_MAYMOVE);
+	nb = mremap(udb->base, oldlen, len, MREMAP_MAYMOVE);
 	if(nb == MAP_FAILED) {
 		log_msg(LOG_ERR, "mremap(%s, size %u) error %s",
 			udb->fname, (unsigned)nsize, strerror(errno));
@@ -525,21 +647,21 @@ udb_base_remap(udb_base* udb, udb_alloc* alloc, uint64_t nsize)
 	}
 #else /* !HAVE MREMAP */
 	/* use munmap-mmap to simulate mremap */
-	if(munmap(udb->base, udb->base_size) != 0) {
+	if(munmap(udb->base, oldlen) != 0) {
 		log_msg(LOG_ERR, "munmap(%s) error %s",
 			udb->fname, strerror(errno));
 	}
 	/* provide hint for new location */
 	/* note the size_t casts must be there for portability, on some
 	 * systems the layout of memory is otherwise broken. */
-	nb = mmap(udb->base, (size_t)nsize, (int)PROT_READ|PROT_WRITE,
-		(int)MAP_SHARED, (int)udb->fd, (off_t)0);
+	nb = mmap(udb->base, len, (int)PROT_READ|PROT_WRITE,
+		flags, (int)udb->fd, (off_t)0);
 	/* retry the mmap without basept in case of ENOMEM (FreeBSD8),
 	 * the kernel can then try to mmap it at a different location
 	 * where more memory is available */
 	if(nb == MAP_FAILED && errno == ENOMEM) {
-		nb = mmap(NULL, (size_t)nsize, (int)PROT_READ|PROT_WRITE,
-			(int)MAP_SHARED, (int)udb->fd, (off_t)0);
+		nb = mmap(NULL, len, (int)PROT_READ|PROT_WRITE,
+			flags, (int)udb->fd, (off_t)0);
 	}
 	if(nb == MAP_FAILED) {
 		log_msg(LOG_ERR, "mmap(%s, size %u) error %s",
@@ -548,17 +670,15 @@ udb_base_remap(udb_base* udb, udb_alloc* alloc, uint64_t nsize)
 		return 0;
 	}
 #endif /* HAVE MREMAP */
-	if(nb != udb->base) {
-		/* fix up realpointers in udb and alloc */
-		/* but mremap may have been nice and not move the base */
-		udb->base = nb;
-		udb->glob_data = (udb_glob_d*)(nb+sizeof(uint64_t));
-		/* use passed alloc pointer because the udb->alloc may not
-		 * be initialized yet */
-		alloc->disk = (udb_alloc_d*)((void*)udb->glob_data
-			+sizeof(*udb->glob_data));
-	}
+	(void)flags;
+	udb_base_moved(udb, alloc, nb);
 	udb->base_size = nsize;
+	if(udb->map_size)
+		udb->map_size = len;
+#ifdef MADV_HUGEPAGE
+	if(udb->hugepages)
+		(void)madvise(udb->base, len, MADV_HUGEPAGE);
+#endif
 	return nb;
 #else /* HAVE_MMAP */
 	(void)udb; (void)alloc; (void)nsize;
@@ -584,6 +704,25 @@ udb_base_grow_and_remap(udb_base* udb, uint64_t nsize)
 
 	assert(nsize > 0);
 	udb->glob_data->dirty_alloc = udb_dirty_fsize;
+#ifdef HAVE_POSIX_FALLOCATE
+	/* reserve the blocks on disk, a full disk fails here and not
+	 * later when a page of the mapping is written */
+	if(nsize > udb->glob_data->fsize) {
+		int r = posix_fallocate(udb->fd, (off_t)udb->glob_data->fsize,
+			(off_t)(nsize - udb->glob_data->fsize));
+		if(r == 0) {
+			udb->glob_data->fsize = nsize;
+			udb->glob_data->dirty_alloc = udb_dirty_clean;
+			return udb_base_remap(udb, udb->alloc, nsize);
+		}
+		if(r != EINVAL && r != EOPNOTSUPP) {
+			log_msg(LOG_ERR, "grow(%s, size %u) error %s",
+				udb->fname, (unsigned)nsize, strerror(r));
+			return 0;
+		}
+		/* the file system cannot do it, write the last byte */
+	}
+#endif /* HAVE_POSIX_FALLOCATE */
 #ifdef HAVE_PWRITE
 	if((w=pwrite(udb->fd, &z, sizeof(z), (off_t)(nsize-1))) == -1) {
 #else
@@ -1136,9 +1275,10 @@ grow_extra_check(udb_alloc* alloc, uint64_t ge)
 			return bsz*2;
 	} else {
 		uint64_t gnow = ge - bsz;
-		/* above 1Mb, grow at least 1 Mb, or 12.5% of current size,
-		 * in whole megabytes rounded up. */
-		uint64_t want = ((bsz / 8) & ~(mb-1)) + mb;
+		/* above 1Mb, grow at least 1 Mb, or 25% of current size,
+		 * in whole megabytes rounded up.  A large transfer grows
+		 * the file a few times, not a step for every megabyte. */
+		uint64_t want = ((bsz / 4) & ~(mb-1)) + mb;
 		if(gnow < want)
 			return bsz + want;
 	}
@@ -1155,10 +1295,10 @@ enough_free(udb_alloc* alloc)
 		if(((size_t)alloc->disk->nextgrow)*3 <= alloc->udb->base_size)
 			return 1;
 	} else {
-		/* grown 12.5%, shrink 25% if possible, at least one mb */
+		/* grown 25%, shrink 33% if possible, at least one mb */
 		/* between 1mb and 4mb size, it shrinks by 1mb if possible */
 		uint64_t space = alloc->udb->base_size - alloc->disk->nextgrow;
-		if(space >= 1024*1024 && (space*4 >= alloc->udb->base_size
+		if(space >= 1024*1024 && (space*3 >= alloc->udb->base_size
 			|| alloc->udb->base_size < 4*1024*1024))
 			return 1;
 	}
@@ -1559,10 +1699,18 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 	uint64_t at = alloc->disk->nextgrow;
 	udb_void xl_start = 0;
 	uint64_t xl_sz = 0;
+	uint64_t moved = 0;
 	if(alloc->udb->inhibit_compact)
 		return 1;
+	NSD_PROBE1(udb__compact__start, at);
 	alloc->udb->useful_compact = 0;
 	while(at > alloc->udb->glob_data->hsize) {
+		if(alloc->udb->compact_limit &&
+			moved >= alloc->udb->compact_limit) {
+			/* continue with the rest next time */
+			alloc->udb->useful_compact = 1;
+			break;
+		}
 		/* grab last entry */
 		exp = (int)*((uint8_t*)UDB_REL(base, at-1));
 		if(exp == UDB_EXP_XL) {
@@ -1589,6 +1737,7 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 				free_xl_space(base, alloc, xl+xlsz, m);
 				move_xl_list(base, alloc, xl_start, xl_sz, m);
 				alloc->udb->glob_data->dirty_alloc = udb_dirty_clean;
+				moved += xl_sz;
 			}
 			xl_start = xl;
 			xl_sz += xlsz;
@@ -1619,6 +1768,7 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 			 * move it to its new position, adjust rel_ptrs */
 			alloc->udb->glob_data->dirty_alloc = udb_dirty_compact;
 			move_chunk(base, alloc, last, exp, esz, e2);
+			moved += esz;
 			if(xl_start) {
 				last = coagulate_and_push(base, alloc,
 					last, exp, esz);
@@ -1668,6 +1818,7 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 			alloc->udb->glob_data->dirty_alloc = udb_dirty_clean;
 		}
 	}
+	NSD_PROBE1(udb__compact__done, moved);
 
 	/* if enough free, shrink the file; re-mmap */
 	if(enough_free(alloc)) {
@@ -1682,7 +1833,7 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 int
 udb_compact(udb_base* udb)
 {
-	if(!udb) return 1;
+	if(!udb || udb->readonly) return 1;
 	if(!udb->useful_compact) return 1;
 	DEBUG(DEBUG_DBACCESS, 1, (LOG_INFO, "Compacting database..."));
 	return udb_alloc_compact(udb->base, udb->alloc);
@@ -1694,6 +1845,81 @@ void udb_compact_inhibited(udb_base* udb, int inhibit)
 	udb->inhibit_compact = inhibit;
 }
 
+void udb_base_hugepages(udb_base* udb)
+{
+	if(!udb) return;
+	udb->hugepages = 1;
+#if defined(HAVE_MMAP) && defined(MADV_HUGEPAGE)
+	if(madvise(udb->base, udb->map_size?udb->map_size:udb->base_size,
+		MADV_HUGEPAGE) != 0) {
+		log_msg(LOG_ERR, "madvise(%s, MADV_HUGEPAGE) error %s",
+			udb->fname, strerror(errno));
+	}
+#endif
+}
+
+int udb_base_reserve(udb_base* udb, uint64_t size)
+{
+#if defined(HAVE_MMAP) && defined(MAP_NORESERVE)
+	void* nb;
+	/* a 32-bit system has no address space to spare */
+	if(!udb || !udb->base || udb->readonly || udb->map_size ||
+		sizeof(void*) < 8)
+		return 0;
+	if(size < (uint64_t)udb->base_size*4)
+		size = (uint64_t)udb->base_size*4;
+	/* the pages after the end of the file are not backed, MAP_NORESERVE
+	 * keeps them out of the accounting of the system */
+	nb = mmap(NULL, (size_t)size, (int)PROT_READ|PROT_WRITE,
+		(int)(MAP_SHARED|MAP_NORESERVE), (int)udb->fd, (off_t)0);
+	if(nb == MAP_FAILED) {
+		log_msg(LOG_WARNING, "mmap(%s, size %llu) for room to grow: "
+			"%s", udb->fname, (unsigned long long)size,
+			strerror(errno));
+		return 0;
+	}
+	if(munmap(udb->base, udb->base_size) != 0) {
+		log_msg(LOG_ERR, "munmap(%s) error %s",
+			udb->fname, strerror(errno));
+	}
+	udb_base_moved(udb, udb->alloc, nb);
+	udb->map_size = (size_t)size;
+#ifdef MADV_HUGEPAGE
+	if(udb->hugepages)
+		(void)madvise(udb->base, udb->map_size, MADV_HUGEPAGE);
+#endif
+	return 1;
+#else
+	(void)udb; (void)size;
+	return 0;
+#endif /* HAVE_MMAP && MAP_NORESERVE */
+}
+
+void udb_base_prefault(udb_base* udb, int populate)
+{
+	if(!udb || !udb->base) return;
+#if defined(HAVE_MMAP) && defined(MADV_POPULATE_READ)
+	/* older kernels return EINVAL, then the read ahead is done */
+	if(populate && madvise(udb->base, udb->base_size,
+		MADV_POPULATE_READ) == 0)
+		return;
+#else
+	(void)populate;
+#endif
+#if defined(HAVE_MMAP) && defined(MADV_WILLNEED)
+	if(madvise(udb->base, udb->base_size, MADV_WILLNEED) != 0) {
+		log_msg(LOG_ERR, "madvise(%s, MADV_WILLNEED) error %s",
+			udb->fname, strerror(errno));
+	}
+#endif
+}
+
+void udb_compact_limit(udb_base* udb, uint64_t limit)
+{
+	if(!udb) return;
+	udb->compact_limit = limit;
+}
+
 #ifdef UDB_CHECK
 /** check that rptrs are really zero before free */
 void udb_check_rptr_zero(void* base, udb_rel_ptr* p, void* arg)
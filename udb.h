@@ -182,6 +182,11 @@ struct udb_base {
 	void* base;
 	/** size of mmap */
 	size_t base_size;
+	/** size of the mapping with the room reserved after the file to
+	 * grow into, 0 if the mapping is base_size */
+	size_t map_size;
+	/** number of times the file was mapped again at another size */
+	uint64_t remap_count;
 	/** fd of mmap (if -1, closed). */
 	int fd;
 
@@ -209,6 +214,13 @@ struct udb_base {
 	int inhibit_compact;
 	/** compaction is useful; deletions performed. */
 	int useful_compact;
+	/** max bytes to move in one compaction, 0 for no limit. */
+	uint64_t compact_limit;
+	/** the mapping is marked for huge pages, also after a remap */
+	int hugepages;
+	/** the fd is O_RDONLY, the file is mapped read-only and it is not
+	 * written, compacted or resized */
+	int readonly;
 };
 
 typedef enum udb_chunk_type udb_chunk_type;
@@ -366,7 +378,8 @@ udb_base* udb_base_create_new(const char* fname, udb_walk_relptr_func walkfunc,
 	void* arg);
 
 /**
- * Create udb from (O_RDWR) fd.
+ * Create udb from (O_RDWR) fd.  With an O_RDONLY fd the file is mapped
+ * read-only, it has to be cleanly closed.
  * @param fname: file name.
  * @param fd: file descriptor.
  * @param walkfunc: function to walk through relptrs in chunk.
@@ -402,6 +415,32 @@ void udb_base_free_keep_mmap(udb_base* udb);
  */
 void udb_base_sync(udb_base* udb, int wait);
 
+/**
+ * Write a copy of the udb to a file, that is marked cleanly closed, for
+ * other processes that map it read-only.  The copy is written to a
+ * temporary file that is renamed over fname, the file that the readers
+ * have open is never changed.
+ * @param udb: the udb, not in the middle of a change.
+ * @param fname: the file name of the copy.
+ * @return 0 on failure (logged).
+ */
+int udb_base_publish(udb_base* udb, const char* fname);
+
+/**
+ * Lock the udb file against other processes.
+ * @param udb: the udb.
+ * @param write: if true, an exclusive lock, that waits for the readers;
+ *	else a shared lock, that is not taken while the file is write locked.
+ * @return 0 if not locked.
+ */
+int udb_base_lock(udb_base* udb, int write);
+
+/**
+ * Release the lock on the udb file.
+ * @param udb: the udb.
+ */
+void udb_base_unlock(udb_base* udb);
+
 /**
  * The mmap size is updated to reflect changes by another process.
  * @param udb: the udb.
@@ -562,6 +601,45 @@ int udb_alloc_grow(udb_alloc* alloc, size_t sz, size_t num);
  */
 int udb_compact(udb_base* udb);
 
+/** bytes of data that reload moves per compaction, 32 Mb */
+#define UDB_COMPACT_STEP (32*1024*1024)
+
+/**
+ * set the max number of bytes that one compaction moves.  When the
+ * limit is reached the compaction stops, and the next udb_compact
+ * continues where it left off.
+ * @param udb: the udb base
+ * @param limit: number of bytes, 0 is no limit.
+ */
+void udb_compact_limit(udb_base* udb, uint64_t limit);
+
+/**
+ * mark the mapping of the udb for transparent huge pages, if the system
+ * has MADV_HUGEPAGE.  The mark is set again when the file is remapped.
+ * @param udb: the udb base
+ */
+void udb_base_hugepages(udb_base* udb);
+
+/**
+ * map the file with room after it to grow into, without a remap, also
+ * when another process grows the file.  The pages after the end of the
+ * file are not used.  The room is size, and at least four times the file.
+ * Only with MAP_NORESERVE on a 64-bit system, and not for a read-only file.
+ * @param udb: the udb base
+ * @param size: the size of the mapping.
+ * @return false if not done, the mapping is as it was.
+ */
+int udb_base_reserve(udb_base* udb, uint64_t size);
+
+/**
+ * fault in the pages of the mapping of the udb.  The file is read ahead
+ * with MADV_WILLNEED, with populate the pages are also mapped into this
+ * process with MADV_POPULATE_READ, if the system has it.
+ * @param udb: the udb base
+ * @param populate: map the pages in, not only read the file.
+ */
+void udb_base_prefault(udb_base* udb, int populate);
+
 /** 
  * set the udb to inhibit or uninhibit compaction.  Does not perform
  * the compaction itself if enabled, for that call udb_compact.
@@ -0,0 +1,346 @@
+/*
+ * udbanswer.c -- answer queries for lazy zones straight from the udb.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include <string.h>
+#include "udbanswer.h"
+#include "answer.h"
+#include "nsd.h"
+#include "options.h"
+#include "packet.h"
+#include "udbzone.h"
+#include "util.h"
+
+#define UDB_ANSWER_RRSET(udb, p) ((struct rrset_d*)UDB_REL((udb)->base, (p)))
+#define UDB_ANSWER_RR(udb, p) ((struct rr_d*)UDB_REL((udb)->base, (p)))
+
+/** An rrset in the udb, to be put in the answer */
+struct udb_answer_rrset {
+	rr_section_type section;
+	/* the owner, NULL for the query name */
+	domain_type* owner;
+	struct rrset_d* rrset;
+	/* the RRSIGs of the owner, if they go with it */
+	struct rrset_d* rrsig;
+};
+
+/** The rrsets of the answer, in the order of the sections */
+struct udb_answer {
+	size_t count;
+	struct udb_answer_rrset rrsets[UDB_ANSWER_MAX];
+};
+
+/** true if the answer for the type needs no more than the rrset */
+static int
+udb_answer_qtype(uint16_t qtype)
+{
+	switch(qtype) {
+	/* these add the additional records of the rdata names */
+	case TYPE_NS:
+	case TYPE_MB:
+	case TYPE_MX:
+	case TYPE_KX:
+	case TYPE_RT:
+	/* the answer can come from the parent zone */
+	case TYPE_DS:
+	/* the RRSIGs are added to the rrsets */
+	case TYPE_RRSIG:
+	case TYPE_NSEC3:
+	case TYPE_IXFR:
+	case TYPE_AXFR:
+	case TYPE_MAILB:
+	case TYPE_MAILA:
+	case TYPE_ANY:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+/** find the rrset of the type of a domain in the udb, or NULL */
+static struct rrset_d*
+udb_answer_find_rrset(udb_base* udb, struct domain_d* d, uint16_t type)
+{
+	udb_void p;
+	for(p = d->rrsets.data; p; p = UDB_ANSWER_RRSET(udb, p)->next.data) {
+		struct rrset_d* rrset = UDB_ANSWER_RRSET(udb, p);
+		if(rrset->type == type)
+			return (rrset->rrs.data?rrset:NULL);
+	}
+	return NULL;
+}
+
+/** find a domain name of the zone in the udb, or NULL */
+static struct domain_d*
+udb_answer_find_domain(udb_base* udb, udb_ptr* z, const uint8_t* nm,
+	size_t len)
+{
+	struct domain_d* d;
+	udb_ptr p;
+	if(!udb_domain_find(udb, z, nm, len, &p))
+		return NULL;
+	d = DOMAIN(&p);
+	udb_ptr_unlink(&p, udb);
+	return d;
+}
+
+/** add an rrset to the answer, if it is not in the answer already */
+static int
+udb_answer_add(struct udb_answer* answer, rr_section_type section,
+	domain_type* owner, struct rrset_d* rrset, struct rrset_d* rrsig)
+{
+	size_t i;
+	for(i = 0; i < answer->count; i++)
+		if(answer->rrsets[i].rrset == rrset)
+			return 1;
+	if(answer->count >= UDB_ANSWER_MAX)
+		return 0;
+	answer->rrsets[answer->count].section = section;
+	answer->rrsets[answer->count].owner = owner;
+	answer->rrsets[answer->count].rrset = rrset;
+	answer->rrsets[answer->count].rrsig = rrsig;
+	answer->count++;
+	return 1;
+}
+
+/**
+ * Look up the answer in the udb zone.  Returns false if it is not a
+ * plain answer, that can be made from the udb.
+ */
+static int
+udb_answer_lookup(query_type* q, udb_base* udb, udb_ptr* z,
+	zone_type* zone, struct udb_answer* answer)
+{
+	const dname_type* qname = q->qname;
+	const dname_type* apex = domain_dname(zone->apex);
+	int dnssec = q->edns.dnssec_ok && zone_is_secure(zone);
+	struct domain_d* d;
+	struct rrset_d* rrset;
+	size_t i;
+
+	if(!(d = udb_answer_find_domain(udb, z, dname_name(qname),
+		qname->name_size)))
+		return 0;
+	if(!(rrset = udb_answer_find_rrset(udb, d, q->qtype)))
+		return 0;
+	(void)udb_answer_add(answer, ANSWER_SECTION, NULL, rrset,
+		dnssec?udb_answer_find_rrset(udb, d, TYPE_RRSIG):NULL);
+
+	/* the name and the names above it, up to the apex, must not be a
+	 * delegation */
+	for(i = qname->label_count; i > apex->label_count; i--) {
+		const uint8_t* nm = dname_name(qname) +
+			dname_label_offsets(qname)[i-1];
+		struct domain_d* p = udb_answer_find_domain(udb, z, nm,
+			qname->name_size - dname_label_offsets(qname)[i-1]);
+		if(p && udb_answer_find_rrset(udb, p, TYPE_NS))
+			return 0;
+	}
+
+	/* the addresses of the name servers in the authority section */
+	if(!zone->ns_rrset || q->qtype == TYPE_DNSKEY)
+		return 1;
+	for(i = 0; i < zone->ns_rrset->rr_count; i++) {
+		domain_type* ns = rr_rdata_domain(
+			&zone->ns_rrset->rrs[i], 0);
+		const dname_type* nsname = domain_dname(ns);
+		struct rrset_d* a, * aaaa;
+		struct domain_d* p;
+		if(!dname_is_subdomain(nsname, apex))
+			continue;
+		/* it may be made from a wildcard in the zone */
+		if(!(p = udb_answer_find_domain(udb, z, dname_name(nsname),
+			nsname->name_size)))
+			return 0;
+		a = udb_answer_find_rrset(udb, p, TYPE_A);
+		aaaa = udb_answer_find_rrset(udb, p, TYPE_AAAA);
+		rrset = (dnssec && (a || aaaa))?
+			udb_answer_find_rrset(udb, p, TYPE_RRSIG):NULL;
+		if(a && !udb_answer_add(answer, ADDITIONAL_A_SECTION, ns,
+			a, rrset))
+			return 0;
+		if(aaaa && !udb_answer_add(answer, ADDITIONAL_AAAA_SECTION,
+			ns, aaaa, rrset))
+			return 0;
+	}
+	return 1;
+}
+
+/** encode an RR from the udb, the rdata is copied as it is stored */
+static int
+udb_encode_rr(query_type* q, domain_type* owner, struct rr_d* rr,
+	uint32_t ttl)
+{
+	size_t truncation_mark = buffer_position(q->packet);
+	if(!buffer_available(q->packet, MAXDOMAINLEN + 10 + rr->len))
+		return 0;
+	if(owner)
+		encode_dname(q, owner);
+	else	buffer_write_u16(q->packet, 0xc000 | QHEADERSZ);
+	buffer_write_u16(q->packet, rr->type);
+	buffer_write_u16(q->packet, rr->klass);
+	buffer_write_u32(q->packet, ttl);
+	buffer_write_u16(q->packet, rr->len);
+	buffer_write(q->packet, rr->wire, rr->len);
+	if(!query_overflow(q))
+		return 1;
+	buffer_set_position(q->packet, truncation_mark);
+	query_clear_dname_offsets(q, truncation_mark);
+	return 0;
+}
+
+/**
+ * Encode an rrset from the udb, with its RRSIGs, like packet_encode_rrset.
+ * Returns the number of RRs encoded.
+ */
+static int
+udb_encode_rrset(query_type* q, udb_base* udb, struct udb_answer_rrset* a,
+#ifdef MINIMAL_RESPONSES
+	size_t minimal_respsize, int* done)
+#else
+	size_t ATTR_UNUSED(minimal_respsize), int* ATTR_UNUSED(done))
+#endif
+{
+	size_t truncation_mark = buffer_position(q->packet);
+	struct rr_d* rr = NULL;
+	uint32_t ttl = UDB_ANSWER_RR(udb, a->rrset->rrs.data)->ttl;
+	int added = 0, all_added = 1;
+	udb_void p;
+
+	for(p = a->rrset->rrs.data; p; p = rr->next.data) {
+		rr = UDB_ANSWER_RR(udb, p);
+		if(!udb_encode_rr(q, a->owner, rr, rr->ttl)) {
+			all_added = 0;
+			break;
+		}
+		++added;
+	}
+	if(all_added && a->rrsig) {
+		for(p = a->rrsig->rrs.data; p; p = rr->next.data) {
+			rr = UDB_ANSWER_RR(udb, p);
+			if(rr->len < sizeof(uint16_t) ||
+				read_uint16(rr->wire) != a->rrset->type)
+				continue;
+			if(!udb_encode_rr(q, a->owner, rr,
+				a->rrset->type==TYPE_SOA?ttl:rr->ttl)) {
+				all_added = 0;
+				break;
+			}
+			++added;
+		}
+	}
+
+#ifdef MINIMAL_RESPONSES
+	if((!all_added || buffer_position(q->packet) > minimal_respsize)
+		&& !q->tcp && a->section >= OPTIONAL_AUTHORITY_SECTION) {
+		buffer_set_position(q->packet, truncation_mark);
+		query_clear_dname_offsets(q, truncation_mark);
+		added = 0;
+		*done = 1;
+	}
+#endif
+	if(!all_added && a->section == ANSWER_SECTION) {
+		/* the zone is read for the truncated answer */
+		buffer_set_position(q->packet, truncation_mark);
+		query_clear_dname_offsets(q, truncation_mark);
+		added = 0;
+	}
+	return added;
+}
+
+/**
+ * Encode the answer in the sections of the packet, like encode_answer.
+ * Returns false if the answer rrset does not fit.
+ */
+static int
+udb_encode_answer(query_type* q, udb_base* udb, zone_type* zone,
+	struct udb_answer* answer)
+{
+	uint16_t counts[RR_SECTION_COUNT];
+	rr_section_type section;
+	size_t i;
+	int minimal_respsize = IPV4_MINIMAL_RESPONSE_SIZE;
+	int done = 0;
+
+#if defined(INET6) && defined(MINIMAL_RESPONSES)
+	if (q->addr.ss_family == AF_INET6)
+		minimal_respsize = IPV6_MINIMAL_RESPONSE_SIZE;
+#endif
+	memset(counts, 0, sizeof(counts));
+
+	if(!(counts[ANSWER_SECTION] = udb_encode_rrset(q, udb,
+		&answer->rrsets[0], minimal_respsize, &done)))
+		return 0;
+	if(zone->ns_rrset && q->qtype != TYPE_DNSKEY) {
+		counts[OPTIONAL_AUTHORITY_SECTION] = packet_encode_rrset(q,
+			zone->apex, zone->ns_rrset, OPTIONAL_AUTHORITY_SECTION,
+			minimal_respsize, &done);
+	}
+	for(section = ADDITIONAL_A_SECTION; !TC(q->packet) && !done &&
+		section < RR_SECTION_COUNT; ++section) {
+		for(i = 1; !TC(q->packet) && i < answer->count; ++i) {
+			if(answer->rrsets[i].section == section)
+				counts[section] += udb_encode_rrset(q, udb,
+					&answer->rrsets[i], minimal_respsize,
+					&done);
+		}
+	}
+
+	ANCOUNT_SET(q->packet, counts[ANSWER_SECTION]);
+	NSCOUNT_SET(q->packet, counts[OPTIONAL_AUTHORITY_SECTION]);
+	ARCOUNT_SET(q->packet,
+		    counts[ADDITIONAL_A_SECTION]
+		    + counts[ADDITIONAL_AAAA_SECTION]);
+	return 1;
+}
+
+int
+udb_answer_query(struct nsd* nsd, struct query* q,
+	domain_type* closest_encloser)
+{
+	namedb_type* db = nsd->db;
+	zone_type* zone;
+	struct udb_answer answer;
+	udb_base* udb;
+	udb_ptr z;
+	size_t mark = buffer_position(q->packet);
+	int r = 0;
+
+	if(q->qclass != CLASS_IN || round_robin || !udb_answer_qtype(q->qtype))
+		return 0;
+	zone = domain_find_zone(db, closest_encloser);
+	if(!zone || !zone->is_lazy || !zone->soa_rrset)
+		return 0;
+	if(zone->opts && zone->opts->pattern &&
+		zone->opts->pattern->request_xfr != 0 && !zone->is_ok)
+		return 0;
+	if(!(udb = namedb_udb_read_start(db)))
+		return 0;
+	if(!udb_zone_search(udb, &z, dname_name(domain_dname(zone->apex)),
+		domain_dname(zone->apex)->name_size)) {
+		namedb_udb_read_end(db, udb);
+		return 0;
+	}
+	answer.count = 0;
+	if(udb_answer_lookup(q, udb, &z, zone, &answer)) {
+		uint16_t offset = dname_label_offsets(q->qname)[
+			domain_dname(closest_encloser)->label_count - 1]
+			+ QHEADERSZ;
+		q->zone = zone;
+		query_add_compression_domain(q, closest_encloser, offset);
+		r = udb_encode_answer(q, udb, zone, &answer);
+		query_clear_compression_tables(q);
+		if(r)
+			AA_SET(q->packet);
+		else	buffer_set_position(q->packet, mark);
+	}
+	udb_ptr_unlink(&z, udb);
+	namedb_udb_read_end(db, udb);
+	return r;
+}
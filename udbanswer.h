@@ -0,0 +1,27 @@
+/*
+ * udbanswer.h -- answer queries for lazy zones straight from the udb.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+#ifndef UDBANSWER_H
+#define UDBANSWER_H
+#include "query.h"
+
+/** most rrsets in an answer from the udb, with the additional rrsets */
+#define UDB_ANSWER_MAX 64
+
+/**
+ * Answer a query for a name in a lazy zone from the udb, without reading
+ * the zone into memory.  The rdata is copied from the mapped udb into the
+ * packet.  Only an exact match of the query name and type, outside of
+ * delegations, is answered this way; for the other answers the zone has
+ * to be read.  The closest encloser is that of the lookup in memory.
+ * Returns true if the answer is in the packet.
+ */
+int udb_answer_query(struct nsd* nsd, struct query* q,
+	domain_type* closest_encloser);
+
+#endif /* UDBANSWER_H */
@@ -35,6 +35,8 @@ static size_t size_of_radarray(struct udb_radarray_d* a)
 static size_t size_of_lookup(udb_ptr* node)
 {
 	assert(udb_ptr_get_type(node) == udb_chunk_type_radnode);
+	if(RADNODE(node)->lookup.data == 0)
+		return 0;
 	return size_of_radarray((struct udb_radarray_d*)UDB_REL(*node->base,
 		RADNODE(node)->lookup.data));
 }
@@ -52,14 +54,23 @@ static size_t size_of_lookup_needed(uint16_t capacity, udb_radstrlen_t str_cap)
 		sizeof(struct udb_radsel_d)+(size_t)str_cap);
 }
 
-/** get the lookup array for a node */
+/** get the lookup array for a node, a leaf has no array */
 static struct udb_radarray_d* lookup(udb_ptr* n)
 {
 	assert(udb_ptr_get_type(n) == udb_chunk_type_radnode);
+	assert(RADNODE(n)->lookup.data != 0);
 	return (struct udb_radarray_d*)UDB_REL(*n->base,
 		RADNODE(n)->lookup.data);
 }
 
+/** get the number of entries in the lookup array, 0 for a leaf */
+static uint16_t lookup_count(udb_ptr* n)
+{
+	if(RADNODE(n)->lookup.data == 0)
+		return 0;
+	return lookup(n)->len;
+}
+
 /** get a length in the lookup array */
 static udb_radstrlen_t lookup_len(udb_ptr* n, unsigned i)
 {
@@ -84,7 +95,7 @@ static struct udb_radnode_d* lookup_node(udb_ptr* n, unsigned i)
 static void udb_radarray_zero_ptrs(udb_base* udb, udb_ptr* n)
 {
 	unsigned i;
-	for(i=0; i<lookup(n)->len; i++) {
+	for(i=0; i<lookup_count(n); i++) {
 		udb_rptr_zero(&lookup(n)->array[i].node, udb);
 	}
 }
@@ -114,14 +125,16 @@ static void udb_radnode_del_postorder(udb_base* udb, udb_ptr* n)
 		return;
 	/* clear subnodes */
 	udb_ptr_init(&sub, udb);
-	for(i=0; i<lookup(n)->len; i++) {
+	for(i=0; i<lookup_count(n); i++) {
 		udb_ptr_set_rptr(&sub, udb, &lookup(n)->array[i].node);
 		udb_rptr_zero(&lookup(n)->array[i].node, udb);
 		udb_radnode_del_postorder(udb, &sub);
 	}
 	udb_ptr_unlink(&sub, udb);
 	/* clear lookup */
-	udb_rel_ptr_free_space(&RADNODE(n)->lookup, udb, size_of_lookup(n));
+	if(RADNODE(n)->lookup.data)
+		udb_rel_ptr_free_space(&RADNODE(n)->lookup, udb,
+			size_of_lookup(n));
 	udb_rptr_zero(&RADNODE(n)->parent, udb);
 	udb_rptr_zero(&RADNODE(n)->elem, udb);
 	udb_ptr_free_space(n, udb, sizeof(struct udb_radnode_d));
@@ -180,7 +193,7 @@ static int udb_radix_find_prefix_node(udb_base* udb, udb_ptr* rt, uint8_t* k,
 			break;
 		}
 		byte -= RADNODE(&n)->offset;
-		if(byte >= lookup(&n)->len) {
+		if(byte >= lookup_count(&n)) {
 			break;
 		}
 		pos++;
@@ -272,29 +285,6 @@ static int udb_radnode_array_grow(udb_base* udb, udb_ptr* n, size_t want)
 	return 1;
 }
 
-/** make empty array in radnode */
-static int udb_radnode_array_create(udb_base* udb, udb_ptr* n)
-{
-	/* is there an array? */
-	if(RADNODE(n)->lookup.data == 0) {
-		/* create array */
-		udb_ptr a;
-		uint16_t cap = 0;
-		udb_radstrlen_t len = 0;
-		if(!udb_ptr_alloc_space(&a, udb, udb_chunk_type_radarray,
-			size_of_lookup_needed(cap, len)))
-			return 0;
-		memset(UDB_PTR(&a), 0, size_of_lookup_needed(cap, len));
-		udb_rptr_set_ptr(&RADNODE(n)->lookup, udb, &a);
-		RADARRAY(&a)->len = cap;
-		RADARRAY(&a)->capacity = cap;
-		RADARRAY(&a)->str_cap = len;
-		RADNODE(n)->offset = 0;
-		udb_ptr_unlink(&a, udb);
-	}
-	return 1;
-}
-
 /** make space in radnode for another byte, or longer strings */
 static int udb_radnode_array_space(udb_base* udb, udb_ptr* n, uint8_t byte,
 	udb_radstrlen_t len)
@@ -644,11 +634,8 @@ udb_void udb_radix_insert(udb_base* udb, udb_ptr* rt, uint8_t* k,
 		return 0; /* alloc failure */
 	}
 	memset(UDB_PTR(&add), 0, sizeof(struct udb_radnode_d));
+	/* the new node is a leaf, it gets an array when it gets children */
 	udb_rptr_set_ptr(&RADNODE(&add)->elem, udb, elem);
-	if(!udb_radnode_array_create(udb, &add)) {
-		udb_ptr_free_space(&add, udb, sizeof(struct udb_radnode_d));
-		return 0; /* alloc failure */
-	}
 	udb_ptr_init(&n, udb);
 	result_data = &n.data;
 
@@ -705,7 +692,7 @@ udb_void udb_radix_insert(udb_base* udb, udb_ptr* rt, uint8_t* k,
 
 		/* see if it falls outside of array */
 		if(byte < RADNODE(&n)->offset || byte-RADNODE(&n)->offset >=
-			lookup(&n)->len) {
+			lookup_count(&n)) {
 			/* make space in the array for it; adjusts offset */
 			if(!udb_radnode_array_space(udb, &n, byte,
 				len-(pos+1))) {
@@ -826,6 +813,15 @@ udb_radarray_reduce(udb_base* udb, udb_ptr* n, uint16_t cap,
 	assert(lookup(n)->len <= cap);
 	assert(cap <= lookup(n)->capacity);
 	assert(strcap <= lookup(n)->str_cap);
+	if(cap == 0) {
+		/* no children, the node becomes a leaf without an array */
+		if(RADNODE(n)->lookup.data) {
+			udb_radarray_zero_ptrs(udb, n);
+			udb_rel_ptr_free_space(&RADNODE(n)->lookup, udb,
+				size_of_lookup(n));
+		}
+		return 1;
+	}
 	if(!udb_ptr_alloc_space(&a, udb, udb_chunk_type_radarray,
 		size_of_lookup_needed(cap, strcap)))
 		return 0;
@@ -865,7 +861,10 @@ static udb_radstrlen_t udb_radarray_max_len(udb_ptr* n)
 static int
 udb_radarray_reduce_if_needed(udb_base* udb, udb_ptr* n)
 {
-	udb_radstrlen_t maxlen = udb_radarray_max_len(n);
+	udb_radstrlen_t maxlen;
+	if(RADNODE(n)->lookup.data == 0)
+		return 1; /* a leaf has no array */
+	maxlen = udb_radarray_max_len(n);
 	if((lookup(n)->len <= lookup(n)->capacity/2 || lookup(n)->len == 0
 		|| maxlen <= lookup(n)->str_cap/2 || maxlen == 0) &&
 		(lookup(n)->len != lookup(n)->capacity ||
@@ -878,8 +877,10 @@ static int
 udb_radnode_array_clean_all(udb_base* udb, udb_ptr* n)
 {
 	RADNODE(n)->offset = 0;
+	if(RADNODE(n)->lookup.data == 0)
+		return 1;
 	lookup(n)->len = 0;
-	/* reallocate lookup to a smaller capacity structure */
+	/* remove the lookup, the node is a leaf */
 	return udb_radarray_reduce(udb, n, 0, 0);
 }
 
@@ -1006,9 +1007,9 @@ udb_radnode_cleanup(udb_base* udb, udb_ptr* rt, udb_ptr* n)
 			/* cannot delete node with a data element */
 			udb_ptr_zero(n, udb);
 			return 1;
-		} else if(lookup(n)->len == 1 && RADNODE(n)->parent.data) {
+		} else if(lookup_count(n) == 1 && RADNODE(n)->parent.data) {
 			return udb_radnode_cleanup_onechild(udb, n);
-		} else if(lookup(n)->len == 0) {
+		} else if(lookup_count(n) == 0) {
 			udb_ptr par;
 			if(!RADNODE(n)->parent.data) {
 				/* root deleted */
@@ -1068,6 +1069,8 @@ udb_void udb_radix_search(udb_ptr* rt, uint8_t* k, udb_radstrlen_t len)
 	while(n != *rt->base) {
 		if(pos == len)
 			return UDB_SYSTOREL(*rt->base, n);
+		if(n->lookup.data == 0)
+			return 0; /* a leaf */
 		byte = k[pos];
 		if(byte < n->offset)
 			return 0;
@@ -1096,13 +1099,13 @@ udb_radnode_last_in_subtree(udb_base* udb, udb_ptr* n)
 {
 	int idx;
 	/* try last entry in array first */
-	for(idx=((int)lookup(n)->len)-1; idx >= 0; idx--) {
+	for(idx=((int)lookup_count(n))-1; idx >= 0; idx--) {
 		if(lookup(n)->array[idx].node.data) {
 			udb_ptr s;
 			udb_ptr_init(&s, udb);
 			udb_ptr_set_rptr(&s, udb, &lookup(n)->array[idx].node);
 			/* does it have entries in its subtrees? */
-			if(lookup(&s)->len > 0) {
+			if(lookup_count(&s) > 0) {
 				udb_radnode_last_in_subtree(udb, &s);
 				if(!udb_ptr_is_null(&s)) {
 					udb_ptr_set_ptr(n, udb, &s);
@@ -1150,7 +1153,7 @@ udb_radnode_first_in_subtree(udb_base* udb, udb_ptr* n)
 {
 	unsigned idx;
 	/* try every subnode */
-	for(idx=0; idx<lookup(n)->len; idx++) {
+	for(idx=0; idx<lookup_count(n); idx++) {
 		if(lookup(n)->array[idx].node.data) {
 			udb_ptr s;
 			udb_ptr_init(&s, udb);
@@ -1227,7 +1230,7 @@ int udb_radix_find_less_equal(udb_base* udb, udb_ptr* rt, uint8_t* k,
 			return udb_ret_self_or_prev(udb, &n, result);
 		}
 		byte -= RADNODE(&n)->offset;
-		if(byte >= lookup(&n)->len) {
+		if(byte >= lookup_count(&n)) {
 			/* so, the previous is the last of array, or itself */
 			/* or something before this element */
 			udb_ptr_set_ptr(result, udb, &n);
@@ -1342,7 +1345,7 @@ void udb_radix_next(udb_base* udb, udb_ptr* n)
 {
 	udb_ptr s;
 	udb_ptr_init(&s, udb);
-	if(lookup(n)->len) {
+	if(lookup_count(n)) {
 		/* go down */
 		udb_ptr_set_ptr(&s, udb, n);
 		udb_radnode_first_in_subtree(udb, &s);
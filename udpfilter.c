@@ -0,0 +1,254 @@
+/*
+ * udpfilter.c -- socket filter on the UDP sockets.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * With udp-filter a classic BPF program on the UDP sockets drops the
+ * packets that the servers would discard anyway, in the kernel, before
+ * they take a slot in the receive batch and a syscall: shorter than a
+ * DNS header, with the QR bit, an opcode other than QUERY and NOTIFY, a
+ * qdcount that is not 1, and from the prefixes of udp-filter-deny.  The
+ * program is made from the config, the same for all sockets, it checks
+ * the version of the IP header for the IPv4 or IPv6 source address.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <string.h>
+#ifdef USE_UDP_FILTER
+#include <linux/filter.h>
+#endif
+#include "udpfilter.h"
+#include "nsd.h"
+#include "options.h"
+#include "packet.h"
+#include "util.h"
+
+#ifdef USE_UDP_FILTER
+/* the filter of a UDP socket sees the UDP header at offset 0 */
+#define UF_DNS 8
+#define UF_DROP 0
+#define UF_PASS 0xffffffffU
+/* room kept for the IPv6 start and the last return */
+#define UF_RESERVE 16
+
+/* the program that is made */
+struct uf_prog {
+	struct sock_filter* insn;
+	unsigned num;
+	/* the number of prefixes that did not fit */
+	unsigned skipped;
+};
+
+static void
+uf_add(struct uf_prog* p, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+	p->insn[p->num].code = code;
+	p->insn[p->num].jt = jt;
+	p->insn[p->num].jf = jf;
+	p->insn[p->num].k = k;
+	p->num++;
+}
+
+/* is there room for n more instructions */
+static int
+uf_room(struct uf_prog* p, unsigned n)
+{
+	if(p->num + n + UF_RESERVE > BPF_MAXINSNS) {
+		p->skipped++;
+		return 0;
+	}
+	return 1;
+}
+
+/* the DNS header checks, the packets that fail them are dropped */
+static void
+uf_header(struct uf_prog* p)
+{
+	uf_add(p, BPF_LD|BPF_W|BPF_LEN, 0, 0, 0);
+	uf_add(p, BPF_JMP|BPF_JGE|BPF_K, 0, 7, UF_DNS+QHEADERSZ);
+	uf_add(p, BPF_LD|BPF_B|BPF_ABS, 0, 0, UF_DNS+2);
+	uf_add(p, BPF_JMP|BPF_JSET|BPF_K, 5, 0, QR_MASK);
+	uf_add(p, BPF_ALU|BPF_AND|BPF_K, 0, 0, OPCODE_MASK);
+	uf_add(p, BPF_JMP|BPF_JEQ|BPF_K, 1, 0, OPCODE_QUERY<<OPCODE_SHIFT);
+	uf_add(p, BPF_JMP|BPF_JEQ|BPF_K, 0, 2, OPCODE_NOTIFY<<OPCODE_SHIFT);
+	uf_add(p, BPF_LD|BPF_H|BPF_ABS, 0, 0, UF_DNS+4);
+	uf_add(p, BPF_JMP|BPF_JEQ|BPF_K, 1, 0, 1);
+	uf_add(p, BPF_RET|BPF_K, 0, 0, UF_DROP);
+}
+
+/* the IPv4 source is in X, drop it if it is in the prefix */
+static void
+uf_prefix4(struct uf_prog* p, acl_options_t* acl)
+{
+	uint32_t a = ntohl(acl->addr.addr.s_addr);
+	uint32_t m = ntohl(acl->range_mask.addr.s_addr);
+	if(!uf_room(p, 4))
+		return;
+	uf_add(p, BPF_MISC|BPF_TXA, 0, 0, 0);
+	switch(acl->rangetype) {
+	case acl_range_single:
+		uf_add(p, BPF_JMP|BPF_JEQ|BPF_K, 0, 1, a);
+		break;
+	case acl_range_mask:
+	case acl_range_subnet:
+		uf_add(p, BPF_ALU|BPF_AND|BPF_K, 0, 0, m);
+		uf_add(p, BPF_JMP|BPF_JEQ|BPF_K, 0, 1, a&m);
+		break;
+	case acl_range_minmax:
+		uf_add(p, BPF_JMP|BPF_JGE|BPF_K, 0, 2, a);
+		uf_add(p, BPF_JMP|BPF_JGT|BPF_K, 1, 0, m);
+		break;
+	}
+	uf_add(p, BPF_RET|BPF_K, 0, 0, UF_DROP);
+}
+
+#ifdef INET6
+/* the IPv6 source is in M[0..3], drop it if it is in the prefix */
+static void
+uf_prefix6(struct uf_prog* p, acl_options_t* acl)
+{
+	uint32_t a[4], m[4];
+	unsigned i, n = 0, size = 1;
+	if(acl->rangetype == acl_range_minmax) {
+		log_msg(LOG_WARNING, "udp-filter-deny: %s, an IPv6 range is "
+			"not supported, use a prefix", acl->ip_address_spec);
+		return;
+	}
+	for(i=0; i<4; i++) {
+		memcpy(&a[i], acl->addr.addr6.s6_addr+4*i, 4);
+		a[i] = ntohl(a[i]);
+		if(acl->rangetype == acl_range_single)
+			m[i] = 0xffffffffU;
+		else {
+			memcpy(&m[i], acl->range_mask.addr6.s6_addr+4*i, 4);
+			m[i] = ntohl(m[i]);
+		}
+		if(m[i] != 0)
+			size += (m[i] == 0xffffffffU)?2:3;
+	}
+	if(!uf_room(p, size))
+		return;
+	for(i=0; i<4; i++) {
+		if(m[i] == 0)
+			continue;
+		uf_add(p, BPF_LD|BPF_MEM, 0, 0, i);
+		n++;
+		if(m[i] != 0xffffffffU) {
+			uf_add(p, BPF_ALU|BPF_AND|BPF_K, 0, 0, m[i]);
+			n++;
+		}
+		/* a mismatch jumps over the rest and the return */
+		n++;
+		uf_add(p, BPF_JMP|BPF_JEQ|BPF_K, 0, (uint8_t)(size-n),
+			a[i]&m[i]);
+	}
+	uf_add(p, BPF_RET|BPF_K, 0, 0, UF_DROP);
+}
+#endif /* INET6 */
+
+/* the prefixes of udp-filter-deny, by the version of the IP header */
+static void
+uf_prefixes(struct uf_prog* p, acl_options_t* deny)
+{
+	acl_options_t* acl;
+	unsigned ja;
+	uf_add(p, BPF_LD|BPF_B|BPF_ABS, 0, 0, (uint32_t)SKF_NET_OFF);
+	uf_add(p, BPF_ALU|BPF_RSH|BPF_K, 0, 0, 4);
+	uf_add(p, BPF_JMP|BPF_JEQ|BPF_K, 1, 0, 4);
+	ja = p->num;
+	uf_add(p, BPF_JMP|BPF_JA, 0, 0, 0);
+	uf_add(p, BPF_LD|BPF_W|BPF_ABS, 0, 0, (uint32_t)SKF_NET_OFF+12);
+	uf_add(p, BPF_MISC|BPF_TAX, 0, 0, 0);
+	for(acl = deny; acl; acl = acl->next) {
+		if(!acl->is_ipv6)
+			uf_prefix4(p, acl);
+	}
+	uf_add(p, BPF_RET|BPF_K, 0, 0, UF_PASS);
+	p->insn[ja].k = p->num - (ja+1);
+#ifdef INET6
+	for(ja=0; ja<4; ja++) {
+		uf_add(p, BPF_LD|BPF_W|BPF_ABS, 0, 0,
+			(uint32_t)SKF_NET_OFF+8+4*ja);
+		uf_add(p, BPF_ST, 0, 0, ja);
+	}
+	for(acl = deny; acl; acl = acl->next) {
+		if(acl->is_ipv6)
+			uf_prefix6(p, acl);
+	}
+#endif
+	uf_add(p, BPF_RET|BPF_K, 0, 0, UF_PASS);
+}
+
+/* the UDP sockets of reuseport server c, the first is nsd->udp */
+static struct nsd_socket*
+uf_sockets(struct nsd* nsd, size_t c)
+{
+	if(c == 0)
+		return nsd->udp;
+	return nsd->children[c].udp;
+}
+#endif /* USE_UDP_FILTER */
+
+void
+udp_filter_attach(struct nsd* nsd, struct nsd_options* opt)
+{
+#ifdef USE_UDP_FILTER
+	struct uf_prog p;
+	struct sock_fprog fprog;
+	struct nsd_socket* sockets;
+	size_t c, i, n = nsd->reuseport?nsd->reuseport:1;
+	int dummy = 0;
+
+	p.insn = NULL;
+	p.num = 0;
+	p.skipped = 0;
+	if(opt->udp_filter) {
+		p.insn = (struct sock_filter*)xalloc_array_zero(BPF_MAXINSNS,
+			sizeof(struct sock_filter));
+		uf_header(&p);
+		if(opt->udp_filter_deny)
+			uf_prefixes(&p, opt->udp_filter_deny);
+		else	uf_add(&p, BPF_RET|BPF_K, 0, 0, UF_PASS);
+		if(p.skipped)
+			log_msg(LOG_WARNING, "udp-filter: %u prefixes of "
+				"udp-filter-deny do not fit in the filter",
+				p.skipped);
+		fprog.len = (unsigned short)p.num;
+		fprog.filter = p.insn;
+	}
+	for(c = 0; c < n; c++) {
+		if(!(sockets = uf_sockets(nsd, c)))
+			continue;
+		for(i = 0; i < nsd->ifs; i++) {
+			if(sockets[i].s == -1)
+				continue;
+			if(opt->udp_filter) {
+				if(setsockopt(sockets[i].s, SOL_SOCKET,
+					SO_ATTACH_FILTER, &fprog,
+					sizeof(fprog)) < 0)
+					log_msg(LOG_ERR, "setsockopt(..., "
+						"SO_ATTACH_FILTER, ...) failed: "
+						"%s", strerror(errno));
+			} else if(setsockopt(sockets[i].s, SOL_SOCKET,
+				SO_DETACH_FILTER, &dummy, sizeof(dummy)) < 0 &&
+				errno != ENOENT) {
+				log_msg(LOG_ERR, "setsockopt(..., "
+					"SO_DETACH_FILTER, ...) failed: %s",
+					strerror(errno));
+			}
+		}
+	}
+	free(p.insn);
+#else
+	(void)nsd;
+	if(opt->udp_filter)
+		log_msg(LOG_WARNING, "udp-filter: not supported on this "
+			"system, the packets are checked by the servers");
+#endif /* USE_UDP_FILTER */
+}
@@ -0,0 +1,26 @@
+/*
+ * udpfilter.h -- socket filter on the UDP sockets.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef UDPFILTER_H
+#define UDPFILTER_H
+
+struct nsd;
+struct nsd_options;
+
+/**
+ * Attach the filter of udp-filter: and udp-filter-deny: to the UDP
+ * sockets, or detach it if udp-filter is no.  The sockets are shared by
+ * the processes, the filter is replaced for all of them at once; main
+ * does it at the start, xfrd with nsd-control reconfig.
+ * @param nsd: the sockets, nsd->udp and those of reuseport.
+ * @param opt: the options with the filter.
+ */
+void udp_filter_attach(struct nsd* nsd, struct nsd_options* opt);
+
+#endif /* UDPFILTER_H */
@@ -0,0 +1,45 @@
+/*
+ * usdt.h -- static probes for dtrace, bpftrace and systemtap.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * The probes are in provider nsd.  With sys/sdt.h a probe is a nop
+ * instruction and a note in the binary, that a tracer turns on when it
+ * attaches, so the probes are stable over changes in inlining.  Names
+ * like query__start are seen by the tracer as query-start.
+ *
+ *	query__start(query, len)		query_process() entry
+ *	query__done(query, state, rcode)	query_process() exit,
+ *						rcode -1 if discarded
+ *	lookup__zone(query, qname, zone)	answer_lookup_zone(), the wire
+ *						qname and the zone, or NULL
+ *	rrl__update(hash, source, rate)		rrl_update(), the new rate
+ *	reload__start()				server_reload() phases
+ *	reload__tasks()				the tasks from xfrd are done
+ *	reload__fork(children)			the new servers are forked
+ *	reload__done()
+ *	xfr__packet(zone, len, result)		a zone transfer packet in xfrd,
+ *						the zone name and parse result
+ *	udb__compact__start(size)		udb_alloc_compact()
+ *	udb__compact__done(moved)
+ */
+
+#ifndef USDT_H
+#define USDT_H
+
+#ifdef USE_USDT
+#include <sys/sdt.h>
+#define NSD_PROBE(name) DTRACE_PROBE(nsd, name)
+#define NSD_PROBE1(name, a) DTRACE_PROBE1(nsd, name, a)
+#define NSD_PROBE2(name, a, b) DTRACE_PROBE2(nsd, name, a, b)
+#define NSD_PROBE3(name, a, b, c) DTRACE_PROBE3(nsd, name, a, b, c)
+#else
+#define NSD_PROBE(name) /* nothing */
+#define NSD_PROBE1(name, a) /* nothing */
+#define NSD_PROBE2(name, a, b) /* nothing */
+#define NSD_PROBE3(name, a, b, c) /* nothing */
+#endif /* USE_USDT */
+
+#endif /* USDT_H */
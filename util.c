@@ -28,7 +28,7 @@
 #include "rdata.h"
 #include "zonec.h"
 
-#ifdef USE_MMAP_ALLOC
+#if defined(USE_MMAP_ALLOC) || defined(HAVE_MMAP)
 #include <sys/mman.h>
 
 #if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
@@ -37,7 +37,10 @@
 #define	MAP_ANON	MAP_ANONYMOUS
 #endif
 
-#endif /* USE_MMAP_ALLOC */
+#endif /* USE_MMAP_ALLOC || HAVE_MMAP */
+#ifdef HAVE_SSL
+#include <openssl/err.h>
+#endif
 
 #ifndef NDEBUG
 unsigned nsd_debug_facilities = 0xffff;
@@ -51,6 +54,9 @@ int verbosity = 0;
 static const char *global_ident = NULL;
 static log_function_type *current_log_function = log_file;
 static FILE *current_log_file = NULL;
+/* the pid and time of a message of another process, see log_msg_origin */
+static NSD_THREAD_LOCAL pid_t log_origin_pid = 0;
+static NSD_THREAD_LOCAL const struct timeval *log_origin_time = NULL;
 int log_time_asc = 1;
 
 void
@@ -126,6 +132,7 @@ log_file(int priority, const char *message)
 	size_t length;
 	lookup_table_type *priority_info;
 	const char *priority_text = "unknown";
+	int pid = (int)(log_origin_pid?log_origin_pid:getpid());
 
 	assert(global_ident);
 	assert(current_log_file);
@@ -142,7 +149,13 @@ log_file(int priority, const char *message)
 		char tmbuf[32];
 		tmbuf[0]=0;
 		tv.tv_usec = 0;
-		if(gettimeofday(&tv, NULL) == 0) {
+		if(log_origin_time) {
+			struct tm tm;
+			time_t now = (time_t)log_origin_time->tv_sec;
+			tv = *log_origin_time;
+			strftime(tmbuf, sizeof(tmbuf), "%Y-%m-%d %H:%M:%S",
+				localtime_r(&now, &tm));
+		} else if(gettimeofday(&tv, NULL) == 0) {
 			struct tm tm;
 			time_t now = (time_t)tv.tv_sec;
 			strftime(tmbuf, sizeof(tmbuf), "%Y-%m-%d %H:%M:%S",
@@ -150,11 +163,12 @@ log_file(int priority, const char *message)
 		}
 		fprintf(current_log_file, "[%s.%3.3d] %s[%d]: %s: %s",
 			tmbuf, (int)tv.tv_usec/1000,
-			global_ident, (int) getpid(), priority_text, message);
+			global_ident, pid, priority_text, message);
  	} else
 #endif /* have time functions */
 		fprintf(current_log_file, "[%d] %s[%d]: %s: %s",
-		(int)time(NULL), global_ident, (int) getpid(), priority_text, message);
+		(int)(log_origin_time?log_origin_time->tv_sec:time(NULL)),
+		global_ident, pid, priority_text, message);
 	length = strlen(message);
 	if (length == 0 || message[length - 1] != '\n') {
 		fprintf(current_log_file, "\n");
@@ -166,7 +180,9 @@ void
 log_syslog(int priority, const char *message)
 {
 #ifdef HAVE_SYSLOG_H
-	syslog(priority, "%s", message);
+	if(log_origin_pid)
+		syslog(priority, "[%d]: %s", (int)log_origin_pid, message);
+	else	syslog(priority, "%s", message);
 #endif /* !HAVE_SYSLOG_H */
 	log_file(priority, message);
 }
@@ -194,6 +210,33 @@ log_vmsg(int priority, const char *format, va_list args)
 	current_log_function(priority, message);
 }
 
+void
+log_msg_origin(int priority, pid_t pid, const struct timeval *tv,
+	const char *message)
+{
+	log_origin_pid = pid;
+	log_origin_time = tv;
+	current_log_function(priority, message);
+	log_origin_pid = 0;
+	log_origin_time = NULL;
+}
+
+#ifdef HAVE_SSL
+void
+log_crypto_err(const char* str)
+{
+	/* error:[error code]:[library name]:[function name]:[reason string] */
+	char buf[128];
+	unsigned long e;
+	ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+	log_msg(LOG_ERR, "%s crypto %s", str, buf);
+	while( (e=ERR_get_error()) ) {
+		ERR_error_string_n(e, buf, sizeof(buf));
+		log_msg(LOG_ERR, "and additionally crypto %s", buf);
+	}
+}
+#endif /* HAVE_SSL */
+
 void
 set_bit(uint8_t bits[], size_t index)
 {
@@ -351,6 +394,81 @@ mmap_free(void *ptr)
 
 #endif /* USE_MMAP_ALLOC */
 
+void *
+hugepage_alloc(size_t size)
+{
+	char *base;
+
+	size += HUGEPAGE_ALLOC_HEADER_SIZE;
+#if defined(HAVE_MMAP) && defined(MADV_HUGEPAGE)
+	if (size >= HUGEPAGE_SIZE) {
+		/* map one huge page more, and trim it to the alignment
+		 * that the kernel needs to put it on huge pages */
+		size_t len = (size + HUGEPAGE_SIZE - 1) & ~((size_t)HUGEPAGE_SIZE - 1);
+		size_t head;
+		char *m = mmap(NULL, len + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m == MAP_FAILED) {
+			log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
+			exit(1);
+		}
+		head = (HUGEPAGE_SIZE - ((size_t)m & (HUGEPAGE_SIZE - 1)))
+			& (HUGEPAGE_SIZE - 1);
+		if (head != 0)
+			(void)munmap(m, head);
+		(void)munmap(m + head + len, HUGEPAGE_SIZE - head);
+		base = m + head;
+		(void)madvise(base, len, MADV_HUGEPAGE);
+		*((size_t*) base) = len;
+		return base + HUGEPAGE_ALLOC_HEADER_SIZE;
+	}
+#endif /* HAVE_MMAP && MADV_HUGEPAGE */
+	base = (char*)xalloc(size);
+	*((size_t*) base) = size;
+	return base + HUGEPAGE_ALLOC_HEADER_SIZE;
+}
+
+void
+hugepage_free(void *ptr)
+{
+	char *base;
+
+	if (!ptr) return;
+	base = (char*)ptr - HUGEPAGE_ALLOC_HEADER_SIZE;
+#if defined(HAVE_MMAP) && defined(MADV_HUGEPAGE)
+	if (*((size_t*) base) >= HUGEPAGE_SIZE) {
+		if (munmap(base, *((size_t*) base)) == -1) {
+			log_msg(LOG_ERR, "munmap failed: %s", strerror(errno));
+		}
+		return;
+	}
+#endif /* HAVE_MMAP && MADV_HUGEPAGE */
+	free(base);
+}
+
+void
+hugepage_log_use(void)
+{
+	/* Linux lists the memory on huge pages in smaps_rollup */
+	FILE *in = fopen("/proc/self/smaps_rollup", "r");
+	char line[256];
+	unsigned long long anon = 0, file = 0, shmem = 0, rss = 0;
+	if (!in) {
+		VERBOSITY(1, (LOG_INFO, "huge pages: no /proc/self/smaps_rollup"
+			" to check how much memory is on huge pages"));
+		return;
+	}
+	while (fgets(line, (int)sizeof(line), in)) {
+		(void)sscanf(line, "Rss: %llu", &rss);
+		(void)sscanf(line, "AnonHugePages: %llu", &anon);
+		(void)sscanf(line, "FilePmdMapped: %llu", &file);
+		(void)sscanf(line, "ShmemPmdMapped: %llu", &shmem);
+	}
+	fclose(in);
+	log_msg(LOG_INFO, "huge pages: %llu kB of the %llu kB in memory, "
+		"%llu kB of the nsd.db mapping", anon, rss, file + shmem);
+}
+
 int
 write_data(FILE *file, const void *data, size_t size)
 {
@@ -444,6 +562,24 @@ timespec_subtract(struct timespec *left,
 	}
 }
 
+uint64_t
+latency_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t)ts.tv_sec*NANOSECONDS_PER_SECOND +
+			(uint64_t)ts.tv_nsec;
+	return 0;
+#else
+	struct timeval tv;
+	if(gettimeofday(&tv, NULL) == 0)
+		return (uint64_t)tv.tv_sec*NANOSECONDS_PER_SECOND +
+			(uint64_t)tv.tv_usec*1000;
+	return 0;
+#endif
+}
+
 uint32_t
 strtoserial(const char* nptr, const char** endptr)
 {
@@ -972,19 +1108,20 @@ print_rr(FILE *out,
 			}
 
 			set_previous_owner(state, owner);
-			buffer_printf(output, "%s",
-				dname_to_string(owner,
-					state->previous_owner_origin));
+			buffer_print_str(output, dname_to_string(owner,
+				state->previous_owner_origin));
 			region_free_all(rr_region);
 		}
 	} else {
-		buffer_printf(output, "%s", dname_to_string(owner, NULL));
+		buffer_print_str(output, dname_to_string(owner, NULL));
 	}
 
-	buffer_printf(output, "\t%lu\t%s\t%s",
-		(unsigned long) record->ttl,
-		rrclass_to_string(record->klass),
-		rrtype_to_string(record->type));
+	buffer_print_str(output, "\t");
+	buffer_print_u32(output, record->ttl);
+	buffer_print_str(output, "\t");
+	buffer_print_str(output, rrclass_to_string(record->klass));
+	buffer_print_str(output, "\t");
+	buffer_print_str(output, rrtype_to_string(record->type));
 
 	result = print_rdata(output, descriptor, record);
 	if (!result) {
@@ -992,12 +1129,11 @@ print_rr(FILE *out,
 		 * Some RDATA failed to print, so print the record's
 		 * RDATA in unknown format.
 		 */
-		result = rdata_atoms_to_unknown_string(output,
-			descriptor, record->rdata_count, record->rdatas);
+		result = rdata_to_unknown_string(output, record);
 	}
 
 	if (result) {
-		buffer_printf(output, "\n");
+		buffer_print_str(output, "\n");
 		buffer_flip(output);
 		result = write_data(out, buffer_current(output),
 		buffer_remaining(output));
@@ -32,6 +32,13 @@ struct region;
 #define PADDING(n, alignment)   \
 	(ALIGN_UP((n), (alignment)) - (n))
 
+/* start the load of the memory for a read soon, without waiting for it */
+#ifdef HAVE_BUILTIN_PREFETCH
+#define PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#else
+#define PREFETCH(p) /* nothing */
+#endif
+
 /*
  * Initialize the logging system.  All messages are logged to stderr
  * until log_open and log_set_log_function are called.
@@ -86,6 +93,21 @@ void log_msg(int priority, const char *format, ...)
  */
 void log_vmsg(int priority, const char *format, va_list args);
 
+/*
+ * Log the message of another process with its pid and the time it was
+ * made, with the current log function.  xfrd writes the messages of the
+ * servers with it, for log-async.
+ */
+void log_msg_origin(int priority, pid_t pid, const struct timeval *tv,
+	const char *message);
+
+#ifdef HAVE_SSL
+/*
+ * Log the message with the errors from the openssl error queue.
+ */
+void log_crypto_err(const char* str);
+#endif
+
 /*
  * Verbose output switch
  */
@@ -149,6 +171,20 @@ void *mmap_alloc(size_t size);
 void mmap_free(void *ptr);
 #endif /* USE_MMAP_ALLOC */
 
+/*
+ * Huge page allocator routines.  Allocations of HUGEPAGE_SIZE and more
+ * are mmapped, aligned and marked with MADV_HUGEPAGE, smaller ones come
+ * from malloc.  The size is stored in a header before the memory.
+ */
+#define HUGEPAGE_SIZE (2*1024*1024)
+#define HUGEPAGE_ALLOC_HEADER_SIZE 16
+/* region chunks that are exactly one huge page with the header */
+#define HUGEPAGE_ALLOC_CHUNK_SIZE (HUGEPAGE_SIZE - HUGEPAGE_ALLOC_HEADER_SIZE)
+void *hugepage_alloc(size_t size);
+void hugepage_free(void *ptr);
+/* log how much memory of the process is on huge pages, if known */
+void hugepage_log_use(void);
+
 /*
  * Write SIZE bytes of DATA to FILE.  Report an error on failure.
  *
@@ -261,6 +297,12 @@ int timespec_compare(const struct timespec *left, const struct timespec *right);
 void timespec_add(struct timespec *left, const struct timespec *right);
 void timespec_subtract(struct timespec *left, const struct timespec *right);
 
+/*
+ * Nanoseconds of a monotonic clock, for the latency statistics.  Only
+ * differences between two values mean something.
+ */
+uint64_t latency_clock(void);
+
 static inline void
 timeval_to_timespec(struct timespec *left,
 		    const struct timeval *right)
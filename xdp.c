@@ -0,0 +1,586 @@
+/*
+ * xdp.c -- AF_XDP fast path for the UDP queries.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#ifdef USE_XDP
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/if_xdp.h>
+#include <linux/if_ether.h>
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include "xdp.h"
+#include "nsd.h"
+#include "options.h"
+#include "util.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* sizes of the headers of the packets, without options */
+#define XDP_ETH_LEN 14
+#define XDP_IP4_LEN 20
+#define XDP_IP6_LEN 40
+#define XDP_UDP_LEN 8
+
+static long
+xdp_bpf(int cmd, union bpf_attr* attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+#define XDP_INSN(c, d, s, o, i) { (c), (d), (s), (o), (i) }
+#define XDP_MOV_REG(d, s) XDP_INSN(BPF_ALU64|BPF_MOV|BPF_X, d, s, 0, 0)
+#define XDP_MOV_IMM(d, i) XDP_INSN(BPF_ALU64|BPF_MOV|BPF_K, d, 0, 0, i)
+#define XDP_ADD_IMM(d, i) XDP_INSN(BPF_ALU64|BPF_ADD|BPF_K, d, 0, 0, i)
+#define XDP_AND_IMM(d, i) XDP_INSN(BPF_ALU64|BPF_AND|BPF_K, d, 0, 0, i)
+#define XDP_LOAD(sz, d, s, o) XDP_INSN(BPF_LDX|BPF_MEM|(sz), d, s, o, 0)
+#define XDP_JGT_REG(d, s, o) XDP_INSN(BPF_JMP|BPF_JGT|BPF_X, d, s, o, 0)
+#define XDP_JEQ_IMM(d, i, o) XDP_INSN(BPF_JMP|BPF_JEQ|BPF_K, d, 0, o, i)
+#define XDP_JNE_IMM(d, i, o) XDP_INSN(BPF_JMP|BPF_JNE|BPF_K, d, 0, o, i)
+#define XDP_JA(o) XDP_INSN(BPF_JMP|BPF_JA, 0, 0, o, 0)
+
+/*
+ * Load the XDP program, that redirects the IPv4 and IPv6 UDP packets to
+ * the port to the socket in the map for the receive queue, and passes
+ * the other packets, and the packets of queues without a socket, to the
+ * network stack.  The jump offsets count the instructions in between.
+ */
+static int
+xdp_load_program(int map_fd, uint16_t port)
+{
+	struct bpf_insn prog[] = {
+		XDP_MOV_REG(6, 1),			/* r6 = ctx */
+		XDP_LOAD(BPF_W, 2, 1, 0),		/* r2 = data */
+		XDP_LOAD(BPF_W, 3, 1, 4),		/* r3 = data_end */
+		XDP_MOV_REG(4, 2),
+		XDP_ADD_IMM(4, XDP_ETH_LEN),
+		XDP_JGT_REG(4, 3, 29),			/* to pass */
+		XDP_LOAD(BPF_H, 5, 2, 12),		/* ethertype */
+		XDP_JEQ_IMM(5, htons(ETH_P_IPV6), 14),	/* to ipv6 */
+		XDP_JNE_IMM(5, htons(ETH_P_IP), 26),	/* to pass */
+		/* ipv4 */
+		XDP_MOV_REG(4, 2),
+		XDP_ADD_IMM(4, XDP_ETH_LEN+XDP_IP4_LEN+XDP_UDP_LEN),
+		XDP_JGT_REG(4, 3, 23),
+		XDP_LOAD(BPF_B, 5, 2, XDP_ETH_LEN),	/* version, no options */
+		XDP_JNE_IMM(5, 0x45, 21),
+		XDP_LOAD(BPF_B, 5, 2, XDP_ETH_LEN+9),	/* protocol */
+		XDP_JNE_IMM(5, IPPROTO_UDP, 19),
+		XDP_LOAD(BPF_H, 5, 2, XDP_ETH_LEN+6),	/* not a fragment */
+		XDP_AND_IMM(5, htons(0x3fff)),
+		XDP_JNE_IMM(5, 0, 16),
+		XDP_LOAD(BPF_H, 5, 2, XDP_ETH_LEN+XDP_IP4_LEN+2),
+		XDP_JNE_IMM(5, htons(port), 14),
+		XDP_JA(7),				/* to redirect */
+		/* ipv6 */
+		XDP_MOV_REG(4, 2),
+		XDP_ADD_IMM(4, XDP_ETH_LEN+XDP_IP6_LEN+XDP_UDP_LEN),
+		XDP_JGT_REG(4, 3, 10),
+		XDP_LOAD(BPF_B, 5, 2, XDP_ETH_LEN+6),	/* next header */
+		XDP_JNE_IMM(5, IPPROTO_UDP, 8),
+		XDP_LOAD(BPF_H, 5, 2, XDP_ETH_LEN+XDP_IP6_LEN+2),
+		XDP_JNE_IMM(5, htons(port), 6),
+		/* redirect */
+		XDP_LOAD(BPF_W, 2, 6, 16),		/* rx_queue_index */
+		XDP_INSN(BPF_LD|BPF_DW|BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0,
+			map_fd),
+		XDP_INSN(0, 0, 0, 0, 0),
+		XDP_MOV_IMM(3, XDP_PASS),		/* if no socket */
+		XDP_INSN(BPF_JMP|BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		XDP_INSN(BPF_JMP|BPF_EXIT, 0, 0, 0, 0),
+		/* pass */
+		XDP_MOV_IMM(0, XDP_PASS),
+		XDP_INSN(BPF_JMP|BPF_EXIT, 0, 0, 0, 0)
+	};
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uint64_t)(uintptr_t)prog;
+	attr.insn_cnt = sizeof(prog)/sizeof(prog[0]);
+	attr.license = (uint64_t)(uintptr_t)"BSD";
+	strlcpy(attr.prog_name, "nsd_xdp", sizeof(attr.prog_name));
+	return (int)xdp_bpf(BPF_PROG_LOAD, &attr);
+}
+
+/* number of receive queues of the interface */
+static size_t
+xdp_num_queues(const char* ifname)
+{
+	struct ethtool_channels ch;
+	struct ifreq ifr;
+	size_t n = 1;
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	if(s == -1)
+		return n;
+	memset(&ch, 0, sizeof(ch));
+	memset(&ifr, 0, sizeof(ifr));
+	ch.cmd = ETHTOOL_GCHANNELS;
+	strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+	ifr.ifr_data = (void*)&ch;
+	if(ioctl(s, SIOCETHTOOL, &ifr) == 0 &&
+		ch.combined_count + ch.rx_count > 0)
+		n = ch.combined_count + ch.rx_count;
+	close(s);
+	return n;
+}
+
+static size_t
+xdp_mtu(const char* ifname)
+{
+	struct ifreq ifr;
+	size_t mtu = 1500;
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	if(s == -1)
+		return mtu;
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+	if(ioctl(s, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu > 0)
+		mtu = (size_t)ifr.ifr_mtu;
+	close(s);
+	return mtu;
+}
+
+static int
+xdp_ring_map(struct xdp_socket* xs, struct xdp_ring* r,
+	struct xdp_ring_offset* off, size_t entsize, off_t pgoff)
+{
+	r->maplen = off->desc + XDP_NUM_FRAMES*entsize;
+	r->map = mmap(NULL, r->maplen, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, xs->fd, pgoff);
+	if(r->map == MAP_FAILED) {
+		r->map = NULL;
+		return 0;
+	}
+	r->producer = (uint32_t*)((uint8_t*)r->map + off->producer);
+	r->consumer = (uint32_t*)((uint8_t*)r->map + off->consumer);
+	r->ring = (uint8_t*)r->map + off->desc;
+	r->mask = XDP_NUM_FRAMES-1;
+	return 1;
+}
+
+static void
+xdp_socket_delete(struct xdp_socket* xs)
+{
+	if(xs->fill.map) munmap(xs->fill.map, xs->fill.maplen);
+	if(xs->comp.map) munmap(xs->comp.map, xs->comp.maplen);
+	if(xs->rx.map) munmap(xs->rx.map, xs->rx.maplen);
+	if(xs->tx.map) munmap(xs->tx.map, xs->tx.maplen);
+	if(xs->fd != -1) close(xs->fd);
+	if(xs->umem) munmap(xs->umem, XDP_FRAME_SIZE*XDP_NUM_FRAMES);
+}
+
+/* create and bind the socket for the queue, with its frames on the fill
+ * ring.  Zero copy if the driver supports it. */
+static int
+xdp_socket_create(struct nsd_xdp* xdp, struct xdp_socket* xs,
+	const char* ifname)
+{
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	socklen_t optlen = sizeof(off);
+	int size = XDP_NUM_FRAMES;
+	uint64_t* fill;
+	uint32_t i;
+
+	xs->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if(xs->fd == -1) {
+		log_msg(LOG_ERR, "xdp: socket: %s", strerror(errno));
+		return 0;
+	}
+	/* shared, the server processes write the answers in it */
+	xs->umem = (uint8_t*)mmap(NULL, XDP_FRAME_SIZE*XDP_NUM_FRAMES,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(xs->umem == MAP_FAILED) {
+		xs->umem = NULL;
+		log_msg(LOG_ERR, "xdp: mmap umem: %s", strerror(errno));
+		return 0;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uint64_t)(uintptr_t)xs->umem;
+	reg.len = XDP_FRAME_SIZE*XDP_NUM_FRAMES;
+	reg.chunk_size = XDP_FRAME_SIZE;
+	if(setsockopt(xs->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0 ||
+		setsockopt(xs->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size,
+		sizeof(size)) != 0 ||
+		setsockopt(xs->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size,
+		sizeof(size)) != 0 ||
+		setsockopt(xs->fd, SOL_XDP, XDP_RX_RING, &size,
+		sizeof(size)) != 0 ||
+		setsockopt(xs->fd, SOL_XDP, XDP_TX_RING, &size,
+		sizeof(size)) != 0 ||
+		getsockopt(xs->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off,
+		&optlen) != 0) {
+		log_msg(LOG_ERR, "xdp: setup rings: %s", strerror(errno));
+		return 0;
+	}
+	if(!xdp_ring_map(xs, &xs->fill, &off.fr, sizeof(uint64_t),
+		XDP_UMEM_PGOFF_FILL_RING) ||
+		!xdp_ring_map(xs, &xs->comp, &off.cr, sizeof(uint64_t),
+		XDP_UMEM_PGOFF_COMPLETION_RING) ||
+		!xdp_ring_map(xs, &xs->rx, &off.rx, sizeof(struct xdp_desc),
+		XDP_PGOFF_RX_RING) ||
+		!xdp_ring_map(xs, &xs->tx, &off.tx, sizeof(struct xdp_desc),
+		XDP_PGOFF_TX_RING)) {
+		log_msg(LOG_ERR, "xdp: mmap rings: %s", strerror(errno));
+		return 0;
+	}
+	fill = (uint64_t*)xs->fill.ring;
+	for(i=0; i<XDP_NUM_FRAMES; i++)
+		fill[i] = (uint64_t)i*XDP_FRAME_SIZE;
+	__atomic_store_n(xs->fill.producer, XDP_NUM_FRAMES, __ATOMIC_RELEASE);
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = xdp->ifindex;
+	sxdp.sxdp_queue_id = xs->queue;
+	sxdp.sxdp_flags = XDP_ZEROCOPY;
+	if(bind(xs->fd, (struct sockaddr*)&sxdp, sizeof(sxdp)) != 0) {
+		sxdp.sxdp_flags = XDP_COPY;
+		if(bind(xs->fd, (struct sockaddr*)&sxdp, sizeof(sxdp)) != 0) {
+			log_msg(LOG_ERR, "xdp: bind %s queue %u: %s", ifname,
+				(unsigned)xs->queue, strerror(errno));
+			return 0;
+		}
+	}
+	VERBOSITY(2, (LOG_INFO, "xdp: %s queue %u, %s", ifname,
+		(unsigned)xs->queue, sxdp.sxdp_flags==XDP_ZEROCOPY?
+		"zero copy":"copy mode"));
+	return 1;
+}
+
+static void
+xdp_delete(struct nsd_xdp* xdp)
+{
+	size_t i;
+	for(i=0; i<xdp->num; i++)
+		xdp_socket_delete(&xdp->socks[i]);
+	if(xdp->link_fd != -1) close(xdp->link_fd);
+	if(xdp->prog_fd != -1) close(xdp->prog_fd);
+	if(xdp->map_fd != -1) close(xdp->map_fd);
+	if(xdp->lock_file) fclose(xdp->lock_file);
+	free(xdp->socks);
+	free(xdp);
+}
+
+int
+xdp_init(struct nsd* nsd)
+{
+	const char* ifname = nsd->options->xdp_interface;
+	struct nsd_xdp* xdp;
+	union bpf_attr attr;
+	uint16_t port = 0;
+	size_t i;
+
+	if(nsd->ifs > 0) {
+		struct sockaddr* sa = nsd->udp[0].addr->ai_addr;
+		if(sa->sa_family == AF_INET)
+			port = ntohs(((struct sockaddr_in*)sa)->sin_port);
+		else if(sa->sa_family == AF_INET6)
+			port = ntohs(((struct sockaddr_in6*)sa)->sin6_port);
+	}
+	xdp = (struct nsd_xdp*)xalloc_zero(sizeof(*xdp));
+	xdp->map_fd = xdp->prog_fd = xdp->link_fd = -1;
+	xdp->ifindex = (int)if_nametoindex(ifname);
+	if(xdp->ifindex == 0) {
+		log_msg(LOG_ERR, "xdp: interface %s: %s", ifname,
+			strerror(errno));
+		xdp_delete(xdp);
+		return -1;
+	}
+	xdp->mtu = xdp_mtu(ifname);
+	xdp->num = xdp_num_queues(ifname);
+	if(xdp->num > nsd->child_count)
+		xdp->num = nsd->child_count;
+	if(!(xdp->lock_file = tmpfile())) {
+		log_msg(LOG_ERR, "xdp: tmpfile: %s", strerror(errno));
+		xdp_delete(xdp);
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = xdp->num;
+	if((xdp->map_fd = (int)xdp_bpf(BPF_MAP_CREATE, &attr)) == -1) {
+		log_msg(LOG_ERR, "xdp: create map: %s", strerror(errno));
+		xdp_delete(xdp);
+		return -1;
+	}
+
+	xdp->socks = (struct xdp_socket*)xalloc_array_zero(xdp->num,
+		sizeof(struct xdp_socket));
+	for(i=0; i<xdp->num; i++)
+		xdp->socks[i].fd = -1;
+	for(i=0; i<xdp->num; i++) {
+		struct xdp_socket* xs = &xdp->socks[i];
+		uint32_t key = (uint32_t)i;
+		uint32_t value;
+		xs->queue = (uint32_t)i;
+		if(!xdp_socket_create(xdp, xs, ifname)) {
+			xdp_delete(xdp);
+			return -1;
+		}
+		value = (uint32_t)xs->fd;
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = xdp->map_fd;
+		attr.key = (uint64_t)(uintptr_t)&key;
+		attr.value = (uint64_t)(uintptr_t)&value;
+		if(xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0) {
+			log_msg(LOG_ERR, "xdp: map update: %s",
+				strerror(errno));
+			xdp_delete(xdp);
+			return -1;
+		}
+	}
+
+	if((xdp->prog_fd = xdp_load_program(xdp->map_fd, port)) == -1) {
+		log_msg(LOG_ERR, "xdp: load program: %s", strerror(errno));
+		xdp_delete(xdp);
+		return -1;
+	}
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = xdp->prog_fd;
+	attr.link_create.target_ifindex = xdp->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	if((xdp->link_fd = (int)xdp_bpf(BPF_LINK_CREATE, &attr)) == -1) {
+		log_msg(LOG_ERR, "xdp: attach to %s: %s", ifname,
+			strerror(errno));
+		xdp_delete(xdp);
+		return -1;
+	}
+	VERBOSITY(1, (LOG_INFO, "xdp: %s, %d receive queues served by "
+		"AF_XDP sockets", ifname, (int)xdp->num));
+	nsd->xdp = xdp;
+	return 0;
+}
+
+int
+xdp_socket_lock(struct nsd_xdp* xdp, struct xdp_socket* xs)
+{
+	/* the lock is per process, and released when the process exits */
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = (off_t)xs->queue;
+	fl.l_len = 1;
+	return fcntl(fileno(xdp->lock_file), F_SETLK, &fl) == 0;
+}
+
+static uint32_t
+xdp_csum_add(uint32_t sum, const uint8_t* p, size_t len)
+{
+	while(len > 1) {
+		sum += ((uint32_t)p[0]<<8) | p[1];
+		p += 2;
+		len -= 2;
+	}
+	if(len)
+		sum += (uint32_t)p[0]<<8;
+	return sum;
+}
+
+static uint16_t
+xdp_csum_fold(uint32_t sum)
+{
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+static void
+xdp_swap(uint8_t* a, uint8_t* b, size_t len)
+{
+	uint8_t tmp[16];
+	memcpy(tmp, a, len);
+	memcpy(a, b, len);
+	memcpy(b, tmp, len);
+}
+
+/*
+ * Answer the packet in the frame, in place.  room is the space in the
+ * frame from the start of the packet.  Returns the length of the answer
+ * packet, or 0 if there is none.
+ */
+static size_t
+xdp_answer(struct nsd_xdp* xdp, uint8_t* pkt, size_t len, size_t room,
+	xdp_query_func_type func, void* arg)
+{
+	struct sockaddr_storage addr;
+	uint8_t* ip = pkt + XDP_ETH_LEN;
+	uint8_t* udp;
+	size_t udplen, max, anslen;
+
+	if(len < XDP_ETH_LEN)
+		return 0;
+	memset(&addr, 0, sizeof(addr));
+	if(read_uint16(pkt+12) == ETH_P_IP) {
+		struct sockaddr_in* sin = (struct sockaddr_in*)&addr;
+		size_t iplen;
+		if(len < XDP_ETH_LEN+XDP_IP4_LEN+XDP_UDP_LEN || ip[0] != 0x45
+			|| ip[9] != IPPROTO_UDP)
+			return 0;
+		iplen = read_uint16(ip+2);
+		udp = ip + XDP_IP4_LEN;
+		udplen = read_uint16(udp+4);
+		if(XDP_ETH_LEN+iplen > len || udplen < XDP_UDP_LEN ||
+			XDP_IP4_LEN+udplen > iplen)
+			return 0;
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, ip+12, 4);
+		memcpy(&sin->sin_port, udp, 2);
+		max = room - XDP_ETH_LEN - XDP_IP4_LEN - XDP_UDP_LEN;
+		if(xdp->mtu - XDP_IP4_LEN - XDP_UDP_LEN < max)
+			max = xdp->mtu - XDP_IP4_LEN - XDP_UDP_LEN;
+		anslen = (*func)(arg, udp+XDP_UDP_LEN, udplen-XDP_UDP_LEN,
+			max, &addr, sizeof(*sin));
+		if(anslen == 0)
+			return 0;
+		/* the IP header, without fragmentation */
+		xdp_swap(ip+12, ip+16, 4);
+		ip[1] = 0;
+		write_uint16(ip+2, XDP_IP4_LEN+XDP_UDP_LEN+anslen);
+		write_uint16(ip+4, 0);
+		write_uint16(ip+6, 0x4000);
+		ip[8] = 64;
+		write_uint16(ip+10, 0);
+		write_uint16(ip+10, xdp_csum_fold(xdp_csum_add(0, ip,
+			XDP_IP4_LEN)));
+		/* the UDP checksum is optional for IPv4 */
+		xdp_swap(udp, udp+2, 2);
+		write_uint16(udp+4, XDP_UDP_LEN+anslen);
+		write_uint16(udp+6, 0);
+		xdp_swap(pkt, pkt+6, 6);
+		return XDP_ETH_LEN+XDP_IP4_LEN+XDP_UDP_LEN+anslen;
+	} else if(read_uint16(pkt+12) == ETH_P_IPV6) {
+		struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&addr;
+		uint32_t sum;
+		uint16_t csum;
+		if(len < XDP_ETH_LEN+XDP_IP6_LEN+XDP_UDP_LEN ||
+			ip[6] != IPPROTO_UDP)
+			return 0;
+		udp = ip + XDP_IP6_LEN;
+		udplen = read_uint16(udp+4);
+		if(udplen < XDP_UDP_LEN || udplen > read_uint16(ip+4) ||
+			XDP_ETH_LEN+XDP_IP6_LEN+udplen > len)
+			return 0;
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr, ip+8, 16);
+		memcpy(&sin6->sin6_port, udp, 2);
+		if(IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr))
+			sin6->sin6_scope_id = (uint32_t)xdp->ifindex;
+		max = room - XDP_ETH_LEN - XDP_IP6_LEN - XDP_UDP_LEN;
+		if(xdp->mtu - XDP_IP6_LEN - XDP_UDP_LEN < max)
+			max = xdp->mtu - XDP_IP6_LEN - XDP_UDP_LEN;
+		anslen = (*func)(arg, udp+XDP_UDP_LEN, udplen-XDP_UDP_LEN,
+			max, &addr, sizeof(*sin6));
+		if(anslen == 0)
+			return 0;
+		write_uint32(ip, 0x60000000);
+		write_uint16(ip+4, XDP_UDP_LEN+anslen);
+		ip[7] = 64;
+		xdp_swap(ip+8, ip+24, 16);
+		xdp_swap(udp, udp+2, 2);
+		write_uint16(udp+4, XDP_UDP_LEN+anslen);
+		write_uint16(udp+6, 0);
+		/* the checksum over the pseudo header and the datagram */
+		sum = xdp_csum_add(0, ip+8, 32);
+		sum += XDP_UDP_LEN+anslen;
+		sum += IPPROTO_UDP;
+		sum = xdp_csum_add(sum, udp, XDP_UDP_LEN+anslen);
+		csum = xdp_csum_fold(sum);
+		write_uint16(udp+6, csum==0?0xffff:csum);
+		xdp_swap(pkt, pkt+6, 6);
+		return XDP_ETH_LEN+XDP_IP6_LEN+XDP_UDP_LEN+anslen;
+	}
+	return 0;
+}
+
+/* put the frames of the sent packets back on the fill ring */
+static void
+xdp_complete(struct xdp_socket* xs)
+{
+	uint64_t* comp = (uint64_t*)xs->comp.ring;
+	uint64_t* fill = (uint64_t*)xs->fill.ring;
+	uint32_t prod = __atomic_load_n(xs->comp.producer, __ATOMIC_ACQUIRE);
+	uint32_t cons = *xs->comp.consumer;
+	uint32_t fprod = *xs->fill.producer;
+	if(prod == cons)
+		return;
+	while(cons != prod) {
+		fill[fprod++ & xs->fill.mask] = comp[cons++ & xs->comp.mask];
+	}
+	__atomic_store_n(xs->comp.consumer, cons, __ATOMIC_RELEASE);
+	__atomic_store_n(xs->fill.producer, fprod, __ATOMIC_RELEASE);
+}
+
+void
+xdp_socket_handle(struct nsd_xdp* xdp, struct xdp_socket* xs,
+	xdp_query_func_type func, void* arg)
+{
+	struct xdp_desc* rx = (struct xdp_desc*)xs->rx.ring;
+	struct xdp_desc* tx = (struct xdp_desc*)xs->tx.ring;
+	uint64_t* fill = (uint64_t*)xs->fill.ring;
+	uint32_t prod, cons, fprod, tprod, n = 0, sent = 0;
+
+	/* the rings hold all the frames, and are never full */
+	xdp_complete(xs);
+	prod = __atomic_load_n(xs->rx.producer, __ATOMIC_ACQUIRE);
+	cons = *xs->rx.consumer;
+	fprod = *xs->fill.producer;
+	tprod = *xs->tx.producer;
+	while(cons != prod && n < XDP_BATCH) {
+		struct xdp_desc* d = &rx[cons++ & xs->rx.mask];
+		uint64_t addr = d->addr;
+		uint64_t offset = addr & (XDP_FRAME_SIZE-1);
+		size_t len;
+		n++;
+		if(offset + d->len > XDP_FRAME_SIZE)
+			len = 0;
+		else	len = xdp_answer(xdp, xs->umem + addr, d->len,
+				XDP_FRAME_SIZE - offset, func, arg);
+		if(len) {
+			struct xdp_desc* t = &tx[tprod++ & xs->tx.mask];
+			t->addr = addr;
+			t->len = (uint32_t)len;
+			t->options = 0;
+			sent++;
+		} else {
+			fill[fprod++ & xs->fill.mask] = addr - offset;
+		}
+	}
+	__atomic_store_n(xs->rx.consumer, cons, __ATOMIC_RELEASE);
+	__atomic_store_n(xs->fill.producer, fprod, __ATOMIC_RELEASE);
+	if(sent) {
+		__atomic_store_n(xs->tx.producer, tprod, __ATOMIC_RELEASE);
+		if(sendto(xs->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1 &&
+			errno != EAGAIN && errno != EBUSY && errno != ENOBUFS &&
+			errno != ENETDOWN)
+			log_msg(LOG_ERR, "xdp: sendto: %s", strerror(errno));
+		xdp_complete(xs);
+	}
+}
+
+#endif /* USE_XDP */
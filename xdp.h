@@ -0,0 +1,99 @@
+/*
+ * xdp.h -- AF_XDP fast path for the UDP queries.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef XDP_H
+#define XDP_H
+
+#ifdef USE_XDP
+struct nsd;
+
+/** size of a frame in the umem, a packet is received in one frame */
+#define XDP_FRAME_SIZE 4096
+/** number of frames of a socket, every ring can hold all of them */
+#define XDP_NUM_FRAMES 2048
+/** number of packets handled per event */
+#define XDP_BATCH 64
+
+/** One of the rings of an AF_XDP socket, mapped from the kernel */
+struct xdp_ring {
+	uint32_t* producer;
+	uint32_t* consumer;
+	/* the addresses (fill, completion) or descriptors (rx, tx) */
+	void* ring;
+	uint32_t mask;
+	/* the mmap of the ring */
+	void* map;
+	size_t maplen;
+};
+
+/**
+ * The AF_XDP socket of a receive queue.  Created at startup, with root
+ * privileges, the server processes inherit it.  The frames move from the
+ * fill ring to the rx ring, the answer is written in the frame of the
+ * query, and it moves to the tx ring, and from the completion ring back
+ * to the fill ring.  No frame is kept outside the rings, so a new server
+ * process can take over the socket from the one it replaces.
+ */
+struct xdp_socket {
+	int fd;
+	uint32_t queue;
+	/* the frames, shared with the kernel */
+	uint8_t* umem;
+	struct xdp_ring fill, comp, rx, tx;
+};
+
+/** The AF_XDP fast path on the xdp-interface */
+struct nsd_xdp {
+	int ifindex;
+	/* MTU of the interface, the answers are not fragmented */
+	size_t mtu;
+	/* the XSKMAP, the XDP program, and its link to the interface, the
+	 * program is detached when the last nsd process closes the link */
+	int map_fd;
+	int prog_fd;
+	int link_fd;
+	/* unlinked file with a byte lock per queue, held by the server
+	 * process that serves the socket of the queue */
+	FILE* lock_file;
+	/* the sockets, server N serves socket N-1 */
+	size_t num;
+	struct xdp_socket* socks;
+};
+
+/**
+ * Called for a UDP query from the fast path, with the DNS message, and
+ * the address of the client.  Write the answer over the query, at most
+ * max bytes.  Return the length of the answer, or 0 to drop the query.
+ */
+typedef size_t (*xdp_query_func_type)(void* arg, uint8_t* data, size_t len,
+	size_t max, struct sockaddr_storage* addr, socklen_t addrlen);
+
+/**
+ * Set up the sockets and attach the XDP program on the xdp-interface.
+ * Before the fork of the servers, with root privileges.
+ * Returns 0 on success, -1 on failure (logged).
+ */
+int xdp_init(struct nsd* nsd);
+
+/**
+ * Take the lock of the socket for this server process.  Fails while the
+ * socket is served by the server process that this one replaces.
+ * Returns true if locked.
+ */
+int xdp_socket_lock(struct nsd_xdp* xdp, struct xdp_socket* xs);
+
+/**
+ * Answer a batch of the received packets with func, after the socket
+ * has become readable.
+ */
+void xdp_socket_handle(struct nsd_xdp* xdp, struct xdp_socket* xs,
+	xdp_query_func_type func, void* arg);
+
+#endif /* USE_XDP */
+#endif /* XDP_H */
@@ -15,6 +15,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include "xfrd-disk.h"
 #include "xfrd.h"
 #include "buffer.h"
@@ -139,33 +140,122 @@ xfrd_read_state_soa(FILE* in, const char* id_acquired,
 	return 1;
 }
 
-void
-xfrd_read_state(struct xfrd_state* xfrd)
+/* the state of one zone, as it is read from the state file */
+struct xfrd_state_zone {
+	const dname_type* dname;
+	uint32_t state, masnum, nextmas, round_num, timeout;
+	xfrd_soa_t soa_nsd, soa_disk, soa_notified;
+	time_t soa_nsd_acquired, soa_disk_acquired, soa_notified_acquired;
+};
+
+/* set the state of the zone from what is read from the state file */
+static void
+xfrd_read_state_zone(struct xfrd_state* xfrd, const char* statefile,
+	struct xfrd_state_zone* r)
 {
-	const char* statefile = xfrd->nsd->options->xfrdfile;
-	FILE *in;
-	uint32_t filetime = 0;
-	uint32_t numzones, i;
-	region_type *tempregion;
+	xfrd_zone_t* zone;
+	xfrd_soa_t incoming_soa;
+	time_t incoming_acquired;
 
-	tempregion = region_create(xalloc, free);
-	if(!tempregion)
+	zone = (xfrd_zone_t*)rbtree_search(xfrd->zones, r->dname);
+	if(!zone) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: state file has info for not configured zone %s", dname_to_string(r->dname, 0)));
 		return;
+	}
 
-	in = fopen(statefile, "r");
-	if(!in) {
-		if(errno != ENOENT) {
-			log_msg(LOG_ERR, "xfrd: Could not open file %s for reading: %s",
-				statefile, strerror(errno));
-		} else {
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: no file %s. refreshing all zones.",
-				statefile));
-		}
-		region_destroy(tempregion);
+	if(r->soa_nsd_acquired>xfrd_time()+15 ||
+		r->soa_disk_acquired>xfrd_time()+15 ||
+		r->soa_notified_acquired>xfrd_time()+15)
+	{
+		log_msg(LOG_ERR, "xfrd: statefile %s contains"
+			" times in the future for zone %s. Ignoring.",
+			statefile, zone->apex_str);
 		return;
 	}
-	if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC) ||
-	   !xfrd_read_check_str(in, "filetime:") ||
+	zone->state = r->state;
+	zone->master_num = r->masnum;
+	zone->next_master = r->nextmas;
+	zone->round_num = r->round_num;
+	zone->timeout.tv_sec = r->timeout;
+	zone->timeout.tv_usec = 0;
+
+	/* read the zone OK, now set the master properly */
+	zone->master = acl_find_num(zone->zone_options->pattern->
+		request_xfr, zone->master_num);
+	if(!zone->master) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: masters changed for zone %s",
+			zone->apex_str));
+		zone->master = zone->zone_options->pattern->request_xfr;
+		zone->master_num = 0;
+		zone->round_num = 0;
+	}
+
+	/*
+	 * There is no timeout,
+	 * or there is a notification,
+	 * or there is a soa && current time is past refresh point
+	 */
+	if(r->timeout == 0 || r->soa_notified_acquired != 0 ||
+		(r->soa_disk_acquired != 0 &&
+		(uint32_t)xfrd_time() - r->soa_disk_acquired
+			> ntohl(r->soa_disk.refresh)))
+	{
+		zone->state = xfrd_zone_refreshing;
+		xfrd_set_refresh_now(zone);
+	}
+
+	/* There is a soa && current time is past expiry point */
+	if(r->soa_disk_acquired!=0 &&
+		(uint32_t)xfrd_time() - r->soa_disk_acquired
+			> ntohl(r->soa_disk.expire))
+	{
+		zone->state = xfrd_zone_expired;
+		xfrd_set_refresh_now(zone);
+	} 
+
+	/* there is a zone read and it matches what we had before */
+	if(zone->soa_nsd_acquired && zone->state != xfrd_zone_expired
+		&& zone->soa_nsd.serial == r->soa_nsd.serial) {
+		xfrd_deactivate_zone(zone);
+		zone->state = r->state;
+		xfrd_set_timer(zone, r->timeout);
+	}	
+	if(zone->soa_nsd_acquired == 0 && r->soa_nsd_acquired == 0 &&
+		r->soa_disk_acquired == 0) {
+		/* continue expon backoff where we were + check now */
+		zone->fresh_xfr_timeout = r->timeout;
+	}
+
+	/* handle as an incoming SOA. */
+	incoming_soa = zone->soa_nsd;
+	incoming_acquired = zone->soa_nsd_acquired;
+	zone->soa_nsd = r->soa_nsd;
+	zone->soa_disk = r->soa_disk;
+	zone->soa_notified = r->soa_notified;
+	zone->soa_nsd_acquired = r->soa_nsd_acquired;
+	/* we had better use what we got from starting NSD, not
+	 * what we store in this file, because the actual zone
+	 * contents trumps the contents of this cache */
+	/* zone->soa_disk_acquired = r->soa_disk_acquired; */
+	zone->soa_notified_acquired = r->soa_notified_acquired;
+	/* the reload checks if the disk soa from the file is loaded */
+	xfrd_set_updating(zone);
+	if (zone->state == xfrd_zone_expired)
+	{
+		xfrd_send_expire_notification(zone);
+	}
+	xfrd_handle_incoming_soa(zone, &incoming_soa, incoming_acquired);
+}
+
+/* read the text state file, after the magic string */
+static void
+xfrd_read_state_text(struct xfrd_state* xfrd, FILE* in,
+	const char* statefile, region_type* tempregion)
+{
+	uint32_t filetime = 0;
+	uint32_t numzones, i;
+
+	if(!xfrd_read_check_str(in, "filetime:") ||
 	   !xfrd_read_i32(in, &filetime) ||
 	   (time_t)filetime > xfrd_time()+15 ||
 	   !xfrd_read_check_str(in, "numzones:") ||
@@ -173,157 +263,232 @@ xfrd_read_state(struct xfrd_state* xfrd)
 	{
 		log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 			statefile, (int)filetime, (long long)xfrd_time());
-		fclose(in);
-		region_destroy(tempregion);
 		return;
 	}
 
 	for(i=0; i<numzones; i++) {
 		char *p;
-		xfrd_zone_t* zone;
-		const dname_type* dname;
-		uint32_t state, masnum, nextmas, round_num, timeout;
-		xfrd_soa_t soa_nsd_read, soa_disk_read, soa_notified_read;
-		time_t soa_nsd_acquired_read,
-			soa_disk_acquired_read, soa_notified_acquired_read;
-		xfrd_soa_t incoming_soa;
-		time_t incoming_acquired;
+		struct xfrd_state_zone r;
 
-		if(nsd.signal_hint_shutdown) {
-			fclose(in);
-			region_destroy(tempregion);
+		if(nsd.signal_hint_shutdown)
 			return;
-		}
-
-		memset(&soa_nsd_read, 0, sizeof(soa_nsd_read));
-		memset(&soa_disk_read, 0, sizeof(soa_disk_read));
-		memset(&soa_notified_read, 0, sizeof(soa_notified_read));
 
+		memset(&r, 0, sizeof(r));
 		if(!xfrd_read_check_str(in, "zone:") ||
 		   !xfrd_read_check_str(in, "name:")  ||
 		   !(p=xfrd_read_token(in)) ||
-		   !(dname = dname_parse(tempregion, p)) ||
+		   !(r.dname = dname_parse(tempregion, p)) ||
 		   !xfrd_read_check_str(in, "state:") ||
-		   !xfrd_read_i32(in, &state) || (state>2) ||
+		   !xfrd_read_i32(in, &r.state) || (r.state>2) ||
 		   !xfrd_read_check_str(in, "master:") ||
-		   !xfrd_read_i32(in, &masnum) ||
+		   !xfrd_read_i32(in, &r.masnum) ||
 		   !xfrd_read_check_str(in, "next_master:") ||
-		   !xfrd_read_i32(in, &nextmas) ||
+		   !xfrd_read_i32(in, &r.nextmas) ||
 		   !xfrd_read_check_str(in, "round_num:") ||
-		   !xfrd_read_i32(in, &round_num) ||
+		   !xfrd_read_i32(in, &r.round_num) ||
 		   !xfrd_read_check_str(in, "next_timeout:") ||
-		   !xfrd_read_i32(in, &timeout) ||
+		   !xfrd_read_i32(in, &r.timeout) ||
 		   !xfrd_read_state_soa(in, "soa_nsd_acquired:", "soa_nsd:",
-			&soa_nsd_read, &soa_nsd_acquired_read) ||
+			&r.soa_nsd, &r.soa_nsd_acquired) ||
 		   !xfrd_read_state_soa(in, "soa_disk_acquired:", "soa_disk:",
-			&soa_disk_read, &soa_disk_acquired_read) ||
+			&r.soa_disk, &r.soa_disk_acquired) ||
 		   !xfrd_read_state_soa(in, "soa_notify_acquired:", "soa_notify:",
-			&soa_notified_read, &soa_notified_acquired_read))
+			&r.soa_notified, &r.soa_notified_acquired))
 		{
 			log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 				statefile, (int)filetime, (long long)xfrd_time());
-			fclose(in);
-			region_destroy(tempregion);
 			return;
 		}
+		xfrd_read_state_zone(xfrd, statefile, &r);
+		region_free_all(tempregion);
+	}
 
-		zone = (xfrd_zone_t*)rbtree_search(xfrd->zones, dname);
-		if(!zone) {
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: state file has info for not configured zone %s", p));
-			continue;
-		}
+	if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC)) {
+		log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
+			statefile, (int)filetime, (long long)xfrd_time());
+		return;
+	}
 
-		if(soa_nsd_acquired_read>xfrd_time()+15 ||
-			soa_disk_acquired_read>xfrd_time()+15 ||
-			soa_notified_acquired_read>xfrd_time()+15)
-		{
-			log_msg(LOG_ERR, "xfrd: statefile %s contains"
-				" times in the future for zone %s. Ignoring.",
-				statefile, zone->apex_str);
-			continue;
-		}
-		zone->state = state;
-		zone->master_num = masnum;
-		zone->next_master = nextmas;
-		zone->round_num = round_num;
-		zone->timeout.tv_sec = timeout;
-		zone->timeout.tv_usec = 0;
-
-		/* read the zone OK, now set the master properly */
-		zone->master = acl_find_num(zone->zone_options->pattern->
-			request_xfr, zone->master_num);
-		if(!zone->master) {
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: masters changed for zone %s",
-				zone->apex_str));
-			zone->master = zone->zone_options->pattern->request_xfr;
-			zone->master_num = 0;
-			zone->round_num = 0;
-		}
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: read %d zones from state file", (int)numzones));
+}
 
-		/*
-		 * There is no timeout,
-		 * or there is a notification,
-		 * or there is a soa && current time is past refresh point
-		 */
-		if(timeout == 0 || soa_notified_acquired_read != 0 ||
-			(soa_disk_acquired_read != 0 &&
-			(uint32_t)xfrd_time() - soa_disk_acquired_read
-				> ntohl(soa_disk_read.refresh)))
-		{
-			zone->state = xfrd_zone_refreshing;
-			xfrd_set_refresh_now(zone);
-		}
+/* make sure the buffer has count bytes to read, or the rest of the
+ * file.  false if there are not count bytes left. */
+static int
+xfrd_read_bin_fill(FILE* in, buffer_type* buf, size_t count)
+{
+	size_t left = buffer_remaining(buf), got;
+	if(left >= count)
+		return 1;
+	/* move the bytes that are left to the front and read more */
+	memmove(buffer_begin(buf), buffer_current(buf), left);
+	buffer_clear(buf);
+	got = fread(buffer_at(buf, left), 1, buffer_capacity(buf)-left, in);
+	buffer_set_limit(buf, left+got);
+	return left+got >= count;
+}
 
-		/* There is a soa && current time is past expiry point */
-		if(soa_disk_acquired_read!=0 &&
-			(uint32_t)xfrd_time() - soa_disk_acquired_read
-				> ntohl(soa_disk_read.expire))
-		{
-			zone->state = xfrd_zone_expired;
-			xfrd_set_refresh_now(zone);
-		} 
-
-		/* there is a zone read and it matches what we had before */
-		if(zone->soa_nsd_acquired && zone->state != xfrd_zone_expired
-			&& zone->soa_nsd.serial == soa_nsd_read.serial) {
-			xfrd_deactivate_zone(zone);
-			zone->state = state;
-			xfrd_set_timer(zone, timeout);
-		}	
-		if(zone->soa_nsd_acquired == 0 && soa_nsd_acquired_read == 0 &&
-			soa_disk_acquired_read == 0) {
-			/* continue expon backoff where we were + check now */
-			zone->fresh_xfr_timeout = timeout;
-		}
+/* times are 64 bit, high part first */
+static time_t
+xfrd_read_bin_time(buffer_type* buf)
+{
+	uint64_t hi = buffer_read_u32(buf);
+	return (time_t)((hi<<32) | buffer_read_u32(buf));
+}
 
-		/* handle as an incoming SOA. */
-		incoming_soa = zone->soa_nsd;
-		incoming_acquired = zone->soa_nsd_acquired;
-		zone->soa_nsd = soa_nsd_read;
-		zone->soa_disk = soa_disk_read;
-		zone->soa_notified = soa_notified_read;
-		zone->soa_nsd_acquired = soa_nsd_acquired_read;
-		/* we had better use what we got from starting NSD, not
-		 * what we store in this file, because the actual zone
-		 * contents trumps the contents of this cache */
-		/* zone->soa_disk_acquired = soa_disk_acquired_read; */
-		zone->soa_notified_acquired = soa_notified_acquired_read;
-		if (zone->state == xfrd_zone_expired)
-		{
-			xfrd_send_expire_notification(zone);
-		}
-		xfrd_handle_incoming_soa(zone, &incoming_soa, incoming_acquired);
+static int
+xfrd_read_bin_dname(buffer_type* buf, uint8_t* dname)
+{
+	/* 1 octet length, and the wireformat dname, like the xfrd_soa */
+	uint8_t len = buffer_read_u8(buf);
+	size_t i = 0;
+	if(len == 0 || !buffer_available(buf, len))
+		return 0;
+	dname[0] = len;
+	buffer_read(buf, dname+1, len);
+	/* the labels have to end with the root label at the length */
+	while(i < len && dname[1+i] != 0) {
+		if((dname[1+i]&0xc0))
+			return 0;
+		i += dname[1+i]+1;
 	}
+	return i+1 == len;
+}
 
-	if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC)) {
+static int
+xfrd_read_bin_soa(FILE* in, buffer_type* buf, xfrd_soa_t* soa,
+	time_t* soatime)
+{
+	(void)xfrd_read_bin_fill(in, buf, XFRD_BIN_SOA_MAX);
+	if(!buffer_available(buf, 8))
+		return 0;
+	*soatime = xfrd_read_bin_time(buf);
+	if(*soatime == 0)
+		return 1;
+	if(!buffer_available(buf, 10))
+		return 0;
+	/* the SOA is kept in network order */
+	soa->type = htons(buffer_read_u16(buf));
+	soa->klass = htons(buffer_read_u16(buf));
+	soa->ttl = htonl(buffer_read_u32(buf));
+	soa->rdata_count = htons(buffer_read_u16(buf));
+	if(!buffer_available(buf, 1) || !xfrd_read_bin_dname(buf, soa->prim_ns)
+	   || !buffer_available(buf, 1) || !xfrd_read_bin_dname(buf, soa->email)
+	   || !buffer_available(buf, 20))
+		return 0;
+	soa->serial = htonl(buffer_read_u32(buf));
+	soa->refresh = htonl(buffer_read_u32(buf));
+	soa->retry = htonl(buffer_read_u32(buf));
+	soa->expire = htonl(buffer_read_u32(buf));
+	soa->minimum = htonl(buffer_read_u32(buf));
+	return 1;
+}
+
+/* read the binary state file */
+static void
+xfrd_read_state_bin(struct xfrd_state* xfrd, FILE* in,
+	const char* statefile, region_type* tempregion)
+{
+	region_type* bufregion = region_create(xalloc, free);
+	buffer_type* buf = buffer_create(bufregion, XFRD_BIN_BUFSIZE);
+	uint32_t version = 0, numzones = 0, i;
+	time_t filetime = 0;
+	uint8_t name[MAXDOMAINLEN+2];
+
+	buffer_set_limit(buf, 0);
+	if(xfrd_read_bin_fill(in, buf, XFRD_BIN_HEADER) &&
+	   memcmp(buffer_current(buf), XFRD_BIN_MAGIC, 8) == 0) {
+		buffer_skip(buf, 8);
+		version = buffer_read_u32(buf);
+		filetime = xfrd_read_bin_time(buf);
+		numzones = buffer_read_u32(buf);
+	}
+	if(version != XFRD_BIN_VERSION || filetime > xfrd_time()+15) {
 		log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 			statefile, (int)filetime, (long long)xfrd_time());
-		region_destroy(tempregion);
-		fclose(in);
+		region_destroy(bufregion);
 		return;
 	}
 
+	for(i=0; i<numzones; i++) {
+		struct xfrd_state_zone r;
+
+		if(nsd.signal_hint_shutdown) {
+			region_destroy(bufregion);
+			return;
+		}
+
+		memset(&r, 0, sizeof(r));
+		(void)xfrd_read_bin_fill(in, buf, XFRD_BIN_ZONE_MAX);
+		if(!buffer_available(buf, 1) ||
+		   !xfrd_read_bin_dname(buf, name) ||
+		   !(r.dname = dname_make(tempregion, name+1, 1)) ||
+		   !buffer_available(buf, 17))
+			break;
+		r.state = buffer_read_u8(buf);
+		r.masnum = buffer_read_u32(buf);
+		r.nextmas = buffer_read_u32(buf);
+		r.round_num = buffer_read_u32(buf);
+		r.timeout = buffer_read_u32(buf);
+		if(r.state>2 ||
+		   !xfrd_read_bin_soa(in, buf, &r.soa_nsd, &r.soa_nsd_acquired) ||
+		   !xfrd_read_bin_soa(in, buf, &r.soa_disk,
+			&r.soa_disk_acquired) ||
+		   !xfrd_read_bin_soa(in, buf, &r.soa_notified,
+			&r.soa_notified_acquired))
+			break;
+		xfrd_read_state_zone(xfrd, statefile, &r);
+		region_free_all(tempregion);
+	}
+	if(i != numzones || !xfrd_read_bin_fill(in, buf, 8) ||
+	   memcmp(buffer_current(buf), XFRD_BIN_MAGIC, 8) != 0) {
+		log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
+			statefile, (int)filetime, (long long)xfrd_time());
+		region_destroy(bufregion);
+		return;
+	}
+	region_destroy(bufregion);
+
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: read %d zones from state file", (int)numzones));
+}
+
+void
+xfrd_read_state(struct xfrd_state* xfrd)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	FILE *in;
+	char magic[8];
+	region_type *tempregion;
+
+	tempregion = region_create(xalloc, free);
+	if(!tempregion)
+		return;
+
+	in = fopen(statefile, "r");
+	if(!in) {
+		if(errno != ENOENT) {
+			log_msg(LOG_ERR, "xfrd: Could not open file %s for reading: %s",
+				statefile, strerror(errno));
+		} else {
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: no file %s. refreshing all zones.",
+				statefile));
+		}
+		region_destroy(tempregion);
+		return;
+	}
+	/* the binary file starts with its magic, the text file may also
+	 * start with whitespace or comments */
+	if(fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+		memcmp(magic, XFRD_BIN_MAGIC, sizeof(magic)) == 0) {
+		rewind(in);
+		xfrd_read_state_bin(xfrd, in, statefile, tempregion);
+	} else {
+		rewind(in);
+		if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC)) {
+			log_msg(LOG_ERR, "xfrd: corrupt state file %s",
+				statefile);
+		} else	xfrd_read_state_text(xfrd, in, statefile, tempregion);
+	}
 	fclose(in);
 	region_destroy(tempregion);
 }
@@ -416,22 +581,12 @@ xfrd_write_state_soa(FILE* out, const char* id,
 	fprintf(out, "\n");
 }
 
-void
-xfrd_write_state(struct xfrd_state* xfrd)
+static void
+xfrd_write_state_text(struct xfrd_state* xfrd, FILE* out)
 {
 	rbnode_t* p;
-	const char* statefile = xfrd->nsd->options->xfrdfile;
-	FILE *out;
 	time_t now = xfrd_time();
 
-	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: write file %s", statefile));
-	out = fopen(statefile, "w");
-	if(!out) {
-		log_msg(LOG_ERR, "xfrd: Could not open file %s for writing: %s",
-				statefile, strerror(errno));
-		return;
-	}
-
 	fprintf(out, "%s\n", XFRD_FILE_MAGIC);
 	fprintf(out, "# This file is written on exit by nsd xfr daemon.\n");
 	fprintf(out, "# This file contains slave zone information:\n");
@@ -481,6 +636,106 @@ xfrd_write_state(struct xfrd_state* xfrd)
 	}
 
 	fprintf(out, "%s\n", XFRD_FILE_MAGIC);
+}
+
+static void
+xfrd_write_bin_time(buffer_type* buf, time_t t)
+{
+	buffer_write_u32(buf, (uint32_t)((uint64_t)t>>32));
+	buffer_write_u32(buf, (uint32_t)t);
+}
+
+static void
+xfrd_write_bin_dname(buffer_type* buf, uint8_t* dname)
+{
+	buffer_write_u8(buf, dname[0]);
+	buffer_write(buf, dname+1, dname[0]);
+}
+
+static void
+xfrd_write_state_soa_bin(buffer_type* buf, xfrd_soa_t* soa, time_t soatime)
+{
+	xfrd_write_bin_time(buf, soatime);
+	if(!soatime)
+		return;
+	buffer_write_u16(buf, ntohs(soa->type));
+	buffer_write_u16(buf, ntohs(soa->klass));
+	buffer_write_u32(buf, ntohl(soa->ttl));
+	buffer_write_u16(buf, ntohs(soa->rdata_count));
+	xfrd_write_bin_dname(buf, soa->prim_ns);
+	xfrd_write_bin_dname(buf, soa->email);
+	buffer_write_u32(buf, ntohl(soa->serial));
+	buffer_write_u32(buf, ntohl(soa->refresh));
+	buffer_write_u32(buf, ntohl(soa->retry));
+	buffer_write_u32(buf, ntohl(soa->expire));
+	buffer_write_u32(buf, ntohl(soa->minimum));
+}
+
+/* write the buffer to the file, false on error */
+static int
+xfrd_write_bin_flush(FILE* out, buffer_type* buf)
+{
+	size_t len = buffer_position(buf);
+	buffer_clear(buf);
+	return fwrite(buffer_begin(buf), 1, len, out) == len;
+}
+
+static int
+xfrd_write_state_bin(struct xfrd_state* xfrd, FILE* out)
+{
+	rbnode_t* p;
+	region_type* tempregion = region_create(xalloc, free);
+	buffer_type* buf = buffer_create(tempregion, XFRD_BIN_BUFSIZE);
+	int ok = 1;
+
+	buffer_write(buf, XFRD_BIN_MAGIC, 8);
+	buffer_write_u32(buf, XFRD_BIN_VERSION);
+	xfrd_write_bin_time(buf, xfrd_time());
+	buffer_write_u32(buf, (uint32_t)xfrd->zones->count);
+	for(p = rbtree_first(xfrd->zones); p && p!=RBTREE_NULL; p=rbtree_next(p))
+	{
+		xfrd_zone_t* zone = (xfrd_zone_t*)p;
+		if(buffer_remaining(buf) < XFRD_BIN_ZONE_MAX+3*XFRD_BIN_SOA_MAX)
+			ok = ok && xfrd_write_bin_flush(out, buf);
+		buffer_write_u8(buf, zone->apex->name_size);
+		buffer_write(buf, dname_name(zone->apex), zone->apex->name_size);
+		buffer_write_u8(buf, (uint8_t)zone->state);
+		buffer_write_u32(buf, (uint32_t)zone->master_num);
+		buffer_write_u32(buf, (uint32_t)zone->next_master);
+		buffer_write_u32(buf, (uint32_t)zone->round_num);
+		buffer_write_u32(buf, (zone->zone_handler_flags&EV_TIMEOUT)?
+			(uint32_t)zone->timeout.tv_sec:0);
+		xfrd_write_state_soa_bin(buf, &zone->soa_nsd,
+			zone->soa_nsd_acquired);
+		xfrd_write_state_soa_bin(buf, &zone->soa_disk,
+			zone->soa_disk_acquired);
+		xfrd_write_state_soa_bin(buf, &zone->soa_notified,
+			zone->soa_notified_acquired);
+	}
+	buffer_write(buf, XFRD_BIN_MAGIC, 8);
+	ok = ok && xfrd_write_bin_flush(out, buf);
+	region_destroy(tempregion);
+	return ok;
+}
+
+void
+xfrd_write_state(struct xfrd_state* xfrd)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	FILE *out;
+
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: write file %s", statefile));
+	out = fopen(statefile, "w");
+	if(!out) {
+		log_msg(LOG_ERR, "xfrd: Could not open file %s for writing: %s",
+				statefile, strerror(errno));
+		return;
+	}
+	if(xfrd->nsd->options->xfrdfile_text)
+		xfrd_write_state_text(xfrd, out);
+	else if(!xfrd_write_state_bin(xfrd, out))
+		log_msg(LOG_ERR, "xfrd: Could not write file %s: %s",
+			statefile, strerror(errno));
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: written %d zones to state file",
 		(int)xfrd->zones->count));
 	fclose(out);
@@ -564,3 +819,28 @@ xfrd_unlink_xfrfile(struct nsd* nsd, uint64_t number)
 			strerror(errno));
 	}
 }
+
+off_t
+xfrd_prefetch_xfrfile(struct nsd* nsd, uint64_t number)
+{
+	off_t size = 0;
+#ifdef HAVE_POSIX_FADVISE
+	char fname[1024];
+	struct stat st;
+	int fd;
+	tempxfrname(fname, sizeof(fname), nsd, number);
+	fd = open(fname, O_RDONLY);
+	if(fd == -1)
+		return 0; /* the apply logs the error */
+	if(fstat(fd, &st) == 0) {
+		size = st.st_size;
+		/* the kernel reads it in the background, while the
+		 * transfers before it are applied */
+		(void)posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+	}
+	close(fd);
+#else
+	(void)nsd; (void)number;
+#endif
+	return size;
+}
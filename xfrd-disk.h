@@ -15,6 +15,21 @@ struct nsd;
 
 /* magic string to identify xfrd state file */
 #define XFRD_FILE_MAGIC "NSDXFRD1"
+/* magic of the binary state file, at the start and at the end.  The
+ * header has the magic, the version, the filetime and the number of
+ * zones.  Every zone is its apex, state, master, next_master,
+ * round_num and next_timeout, and then the soa_nsd, soa_disk and
+ * soa_notify as the 64 bit acquired time, and if that is not 0, the
+ * SOA rdata.  Numbers are in network order, dnames are 1 octet length
+ * and the wireformat. */
+#define XFRD_BIN_MAGIC "NSDXFRDB"
+#define XFRD_BIN_VERSION 1
+#define XFRD_BIN_HEADER (8+4+8+4)
+/* maximum size of a zone without its SOAs, and of one SOA */
+#define XFRD_BIN_ZONE_MAX (1+MAXDOMAINLEN+1+4*4)
+#define XFRD_BIN_SOA_MAX (8+2+2+4+2+2*(1+MAXDOMAINLEN)+5*4)
+/* the file is read and written in blocks of this size */
+#define XFRD_BIN_BUFSIZE 65536
 
 /* read from state file as many zones as possible (until error/eof).*/
 void xfrd_read_state(struct xfrd_state* xfrd);
@@ -29,5 +44,7 @@ void xfrd_del_tempdir(struct nsd* nsd);
 FILE* xfrd_open_xfrfile(struct nsd* nsd, uint64_t number, char* mode);
 /* unlink temp file */
 void xfrd_unlink_xfrfile(struct nsd* nsd, uint64_t number);
+/* start to read the temp file into the page cache, returns its size */
+off_t xfrd_prefetch_xfrfile(struct nsd* nsd, uint64_t number);
 
 #endif /* XFRD_DISK_H */
@@ -25,24 +25,48 @@ static void notify_enable(struct notify_zone_t* zone,
 /* setup the notify active state */
 static void setup_notify_active(struct notify_zone_t* zone);
 
-/* returns if the notify send is done for the notify_current acl */
-static int xfrd_handle_notify_reply(struct notify_zone_t* zone, buffer_type* packet);
+/* returns if the notify send is done for the dest of the pkt */
+static int xfrd_handle_notify_reply(struct notify_pkt* p, buffer_type* packet);
 
-/* handle zone notify send */
+/* handle zone notify send timer */
 static void xfrd_handle_notify_send(int fd, short event, void* arg);
 
-static void xfrd_notify_next(struct notify_zone_t* zone);
+/* handle reply or timeout for a notify in flight */
+static void xfrd_handle_notify_pkt(int fd, short event, void* arg);
 
-static void xfrd_notify_send_udp(struct notify_zone_t* zone, buffer_type* packet);
+/* send to the next secondaries, as many as there are free pkts */
+static void xfrd_notify_next(struct notify_zone_t* zone, buffer_type* packet);
+
+static void xfrd_notify_send_udp(struct notify_pkt* p, buffer_type* packet);
+
+/* stop the event of the pkt and close its socket */
+static void
+notify_pkt_stop(struct notify_pkt* p)
+{
+	if(!p->handler_added)
+		return;
+	event_del(&p->handler);
+	if(p->handler.ev_fd != -1) {
+		close(p->handler.ev_fd);
+	}
+	p->handler_added = 0;
+}
 
 static void
 notify_send_disable(struct notify_zone_t* zone)
 {
+	int i;
 	zone->notify_send_enable = 0;
-	event_del(&zone->notify_send_handler);
-	if(zone->notify_send_handler.ev_fd != -1) {
-		close(zone->notify_send_handler.ev_fd);
+	if(zone->notify_timer_added) {
+		event_del(&zone->notify_send_handler);
+		zone->notify_timer_added = 0;
 	}
+	for(i=0; i<zone->pkts_num; i++)
+		notify_pkt_stop(&zone->pkts[i]);
+	region_recycle(xfrd->region, zone->pkts,
+		sizeof(struct notify_pkt)*zone->pkts_num);
+	zone->pkts = NULL;
+	zone->pkts_num = 0;
 }
 
 void
@@ -138,8 +162,9 @@ xfrd_del_notify(xfrd_state_t* xfrd, const dname_type* dname)
 }
 
 static int
-xfrd_handle_notify_reply(struct notify_zone_t* zone, buffer_type* packet)
+xfrd_handle_notify_reply(struct notify_pkt* p, buffer_type* packet)
 {
+	struct notify_zone_t* zone = p->zone;
 	if((OPCODE(packet) != OPCODE_NOTIFY) ||
 		(QR(packet) == 0)) {
 		log_msg(LOG_ERR, "xfrd: zone %s: received bad notify reply opcode/flags",
@@ -147,7 +172,7 @@ xfrd_handle_notify_reply(struct notify_zone_t* zone, buffer_type* packet)
 		return 0;
 	}
 	/* we know it is OPCODE NOTIFY, QUERY_REPLY and for this zone */
-	if(ID(packet) != zone->notify_query_id) {
+	if(ID(packet) != p->notify_query_id) {
 		log_msg(LOG_ERR, "xfrd: zone %s: received notify-ack with bad ID",
 			zone->apex_str);
 		return 0;
@@ -156,44 +181,53 @@ xfrd_handle_notify_reply(struct notify_zone_t* zone, buffer_type* packet)
 	if(RCODE(packet) != RCODE_OK) {
 		log_msg(LOG_ERR, "xfrd: zone %s: received notify response error %s from %s",
 			zone->apex_str, rcode2str(RCODE(packet)),
-			zone->notify_current->ip_address_spec);
+			p->dest->ip_address_spec);
 		if(RCODE(packet) == RCODE_IMPL)
 			return 1; /* rfc1996: notimpl notify reply: consider retries done */
 		return 0;
 	}
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s: host %s acknowledges notify",
-		zone->apex_str, zone->notify_current->ip_address_spec));
+		zone->apex_str, p->dest->ip_address_spec));
 	return 1;
 }
 
 static void
-xfrd_notify_next(struct notify_zone_t* zone)
+xfrd_notify_next(struct notify_zone_t* zone, buffer_type* packet)
 {
-	/* advance to next in acl */
-	zone->notify_current = zone->notify_current->next;
-	zone->notify_retry = 0;
-	if(zone->notify_current == 0) {
+	int i, busy = 0;
+	/* advance in the acl list, for every free pkt */
+	for(i=0; i<zone->pkts_num; i++) {
+		struct notify_pkt* p = &zone->pkts[i];
+		if(!p->dest && zone->notify_current) {
+			p->dest = zone->notify_current;
+			p->notify_retry = 0;
+			zone->notify_current = zone->notify_current->next;
+			xfrd_notify_send_udp(p, packet);
+		}
+		if(p->dest)
+			busy = 1;
+	}
+	if(!busy) {
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
 			"xfrd: zone %s: no more notify-send acls. stop notify.",
 			zone->apex_str));
 		notify_disable(zone);
-		return;
 	}
 }
 
 static void
-xfrd_notify_send_udp(struct notify_zone_t* zone, buffer_type* packet)
+xfrd_notify_send_udp(struct notify_pkt* p, buffer_type* packet)
 {
+	struct notify_zone_t* zone = p->zone;
 	int fd;
-	if(zone->notify_send_enable) {
-		notify_send_disable(zone);
-	}
+	notify_pkt_stop(p);
 	/* Set timeout for next reply */
 	zone->notify_timeout.tv_sec = XFRD_NOTIFY_RETRY_TIMOUT;
+	zone->notify_timeout.tv_usec = 0;
 	/* send NOTIFY to secondary. */
 	xfrd_setup_packet(packet, TYPE_SOA, CLASS_IN, zone->apex,
 		qid_generate());
-	zone->notify_query_id = ID(packet);
+	p->notify_query_id = ID(packet);
 	OPCODE_SET(packet, OPCODE_NOTIFY);
 	AA_SET(packet);
 	if(zone->current_soa->serial != 0) {
@@ -201,92 +235,117 @@ xfrd_notify_send_udp(struct notify_zone_t* zone, buffer_type* packet)
 		ANCOUNT_SET(packet, 1);
 		xfrd_write_soa_buffer(packet, zone->apex, zone->current_soa);
 	}
-	if(zone->notify_current->key_options) {
-		xfrd_tsig_sign_request(packet, &zone->notify_tsig, zone->notify_current);
+	if(p->dest->key_options) {
+		xfrd_tsig_sign_request(packet, &zone->notify_tsig, p->dest);
 	}
 	buffer_flip(packet);
-	fd = xfrd_send_udp(zone->notify_current, packet,
+	fd = xfrd_send_udp(p->dest, packet,
 		zone->options->pattern->outgoing_interface);
 	if(fd == -1) {
 		log_msg(LOG_ERR, "xfrd: zone %s: could not send notify #%d to %s",
-			zone->apex_str, zone->notify_retry,
-			zone->notify_current->ip_address_spec);
-		event_set(&zone->notify_send_handler, -1, EV_TIMEOUT,
-			xfrd_handle_notify_send, zone);
-		if(event_base_set(xfrd->event_base, &zone->notify_send_handler) != 0)
+			zone->apex_str, p->notify_retry,
+			p->dest->ip_address_spec);
+		event_set(&p->handler, -1, EV_TIMEOUT,
+			xfrd_handle_notify_pkt, p);
+		if(event_base_set(xfrd->event_base, &p->handler) != 0)
 			log_msg(LOG_ERR, "notify_send: event_base_set failed");
-		if(evtimer_add(&zone->notify_send_handler, &zone->notify_timeout) != 0)
+		if(evtimer_add(&p->handler, &zone->notify_timeout) != 0)
 			log_msg(LOG_ERR, "notify_send: evtimer_add failed");
-		zone->notify_send_enable = 1;
+		p->handler_added = 1;
 		return;
 	}
-	event_set(&zone->notify_send_handler, fd, EV_READ | EV_TIMEOUT,
-		xfrd_handle_notify_send, zone);
-	if(event_base_set(xfrd->event_base, &zone->notify_send_handler) != 0)
+	event_set(&p->handler, fd, EV_PERSIST | EV_READ | EV_TIMEOUT,
+		xfrd_handle_notify_pkt, p);
+	if(event_base_set(xfrd->event_base, &p->handler) != 0)
 		log_msg(LOG_ERR, "notify_send: event_base_set failed");
-	if(event_add(&zone->notify_send_handler, &zone->notify_timeout) != 0)
+	if(event_add(&p->handler, &zone->notify_timeout) != 0)
 		log_msg(LOG_ERR, "notify_send: evtimer_add failed");
-	zone->notify_send_enable = 1;
+	p->handler_added = 1;
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s: sent notify #%d to %s",
-		zone->apex_str, zone->notify_retry,
-		zone->notify_current->ip_address_spec));
+		zone->apex_str, p->notify_retry, p->dest->ip_address_spec));
 }
 
 static void
-xfrd_handle_notify_send(int fd, short event, void* arg)
+xfrd_handle_notify_pkt(int fd, short event, void* arg)
 {
-	struct notify_zone_t* zone = (struct notify_zone_t*)arg;
+	struct notify_pkt* p = (struct notify_pkt*)arg;
+	struct notify_zone_t* zone = p->zone;
 	buffer_type* packet = xfrd_get_temp_buffer();
-	assert(zone->notify_current);
-	if(zone->is_waiting) {
-		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
-			"xfrd: notify waiting, skipped, %s", zone->apex_str));
-		return;
-	}
+	int done = 0;
+	assert(p->dest);
 	if((event & EV_READ)) {
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
 			"xfrd: zone %s: read notify ACK", zone->apex_str));
 		assert(fd != -1);
 		if(xfrd_udp_read_packet(packet, fd)) {
-			if(xfrd_handle_notify_reply(zone, packet))
-				xfrd_notify_next(zone);
+			if(xfrd_handle_notify_reply(p, packet))
+				done = 1;
 		}
 	} else if((event & EV_TIMEOUT)) {
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s: notify timeout",
 			zone->apex_str));
 		/* timeout, try again */
 	}
-	/* see if notify is still enabled */
-	if(zone->notify_current) {
-		zone->notify_retry++;
-		if(zone->notify_retry > zone->options->pattern->notify_retry) {
+	if(!done) {
+		p->notify_retry++;
+		if(p->notify_retry > zone->options->pattern->notify_retry) {
 			log_msg(LOG_ERR, "xfrd: zone %s: max notify send count reached, %s unreachable",
-				zone->apex_str, zone->notify_current->ip_address_spec);
-			xfrd_notify_next(zone);
+				zone->apex_str, p->dest->ip_address_spec);
+			done = 1;
 		}
 	}
-	if(zone->notify_current) {
+	if(!done) {
 		/* try again */
-		xfrd_notify_send_udp(zone, packet);
+		xfrd_notify_send_udp(p, packet);
+		return;
+	}
+	notify_pkt_stop(p);
+	p->dest = NULL;
+	/* this may stop the notify and free the pkts */
+	xfrd_notify_next(zone, packet);
+}
+
+static void
+xfrd_handle_notify_send(int ATTR_UNUSED(fd), short ATTR_UNUSED(event),
+	void* arg)
+{
+	struct notify_zone_t* zone = (struct notify_zone_t*)arg;
+	zone->notify_timer_added = 0;
+	if(zone->is_waiting) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
+			"xfrd: notify waiting, skipped, %s", zone->apex_str));
+		return;
 	}
+	xfrd_notify_next(zone, xfrd_get_temp_buffer());
 }
 
 static void
 setup_notify_active(struct notify_zone_t* zone)
 {
-	zone->notify_retry = 0;
+	acl_options_t* acl;
+	int i, n = 0;
 	zone->notify_current = zone->options->pattern->notify;
 	zone->notify_timeout.tv_sec = 0;
 	zone->notify_timeout.tv_usec = 0;
 
 	if(zone->notify_send_enable)
 		notify_send_disable(zone);
+	/* the secondaries are notified in parallel, up to the max */
+	for(acl = zone->notify_current; acl && n < NOTIFY_CONCURRENT_MAX;
+		acl = acl->next)
+		n++;
+	zone->pkts = (struct notify_pkt*)region_alloc_zero(xfrd->region,
+		sizeof(struct notify_pkt)*n);
+	zone->pkts_num = n;
+	for(i=0; i<n; i++)
+		zone->pkts[i].zone = zone;
 	event_set(&zone->notify_send_handler, -1, EV_TIMEOUT,
 		xfrd_handle_notify_send, zone);
 	if(event_base_set(xfrd->event_base, &zone->notify_send_handler) != 0)
 		log_msg(LOG_ERR, "notifysend: event_base_set failed");
 	if(evtimer_add(&zone->notify_send_handler, &zone->notify_timeout) != 0)
 		log_msg(LOG_ERR, "notifysend: evtimer_add failed");
+	zone->notify_timer_added = 1;
 	zone->notify_send_enable = 1;
 }
 
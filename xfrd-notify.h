@@ -23,6 +23,7 @@
 #endif
 #include "tsig.h"
 #include "rbtree.h"
+#include "namedb.h"
 
 struct nsd;
 struct region;
@@ -32,6 +33,25 @@ struct zone;
 struct xfrd_soa;
 struct acl_options;
 struct xfrd_state;
+struct notify_zone_t;
+
+/* max number of secondaries of a zone that are notified at the same time */
+#define NOTIFY_CONCURRENT_MAX 8
+
+/**
+ * A notify in flight to one of the secondaries of a zone.
+ */
+struct notify_pkt {
+	/* the zone this notify is for */
+	struct notify_zone_t* zone;
+	/* the secondary that is notified, NULL if not in use */
+	struct acl_options* dest;
+	/* read and timeout event on the socket for the reply */
+	struct event handler;
+	int handler_added;
+	uint8_t notify_retry; /* how manieth retry in sending to dest */
+	uint16_t notify_query_id;
+};
 
 /**
  * This struct keeps track of outbound notifies for a zone.
@@ -45,16 +65,21 @@ struct notify_zone_t {
 	tsig_record_type notify_tsig; /* tsig state for notify */
 	struct zone_options* options;
 	struct xfrd_soa *current_soa; /* current SOA in NSD */
+	/* memory of the zone data in NSD, from the soainfo */
+	struct zone_mem_stat mem;
 
 	/* notify sending handler */
 	/* Not saved on disk (i.e. kill of daemon stops notifies) */
 	int notify_send_enable;
+	/* timer that starts the sends, and to retry a failed send */
 	struct event notify_send_handler;
+	int notify_timer_added;
 	struct timeval notify_timeout;
-	struct acl_options* notify_current; /* current slave to notify */
+	struct acl_options* notify_current; /* next slave to notify */
 	uint8_t notify_restart; /* restart notify after repattern */
-	uint8_t notify_retry; /* how manieth retry in sending to current */
-	uint16_t notify_query_id;
+	/* the notifies in flight, pkts_num of them are allocated */
+	struct notify_pkt* pkts;
+	int pkts_num;
 
 	/* is this notify waiting for a socket? */
 	uint8_t is_waiting;
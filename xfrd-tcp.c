@@ -46,17 +46,16 @@ xfrd_pipe_cmp(const void* a, const void* b)
 	return (uintptr_t)x < (uintptr_t)y ? -1 : 1;
 }
 
-xfrd_tcp_set_t* xfrd_tcp_set_create(struct region* region)
+xfrd_tcp_set_t* xfrd_tcp_set_create(struct region* region, int tcp_max)
 {
-	int i;
 	xfrd_tcp_set_t* tcp_set = region_alloc(region, sizeof(xfrd_tcp_set_t));
 	memset(tcp_set, 0, sizeof(xfrd_tcp_set_t));
 	tcp_set->tcp_count = 0;
 	tcp_set->tcp_waiting_first = 0;
 	tcp_set->tcp_waiting_last = 0;
-	for(i=0; i<XFRD_MAX_TCP; i++)
-		tcp_set->tcp_state[i] = xfrd_tcp_pipeline_create(region);
+	tcp_set->tcp_waiting_ixfr = 0;
 	tcp_set->pipetree = rbtree_create(region, &xfrd_pipe_cmp);
+	xfrd_tcp_set_max(tcp_set, region, tcp_max);
 	return tcp_set;
 }
 
@@ -204,8 +203,10 @@ xfrd_tcp_create(region_type* region, size_t bufsize)
 	return tcp_state;
 }
 
+/* find the pipeline to the master of the zone with the most unused IDs,
+ * NULL if there is no pipeline to that master */
 static struct xfrd_tcp_pipeline*
-pipeline_find(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
+pipeline_find_master(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 {
 	rbnode_t* sme = NULL;
 	struct xfrd_tcp_pipeline* r;
@@ -234,12 +235,82 @@ pipeline_find(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 		return NULL;
 	if(memcmp(&r->ip, &key->ip, key->ip_len) != 0)
 		return NULL;
+	return r;
+}
+
+/* find a pipeline to the master of the zone with an unused ID */
+static struct xfrd_tcp_pipeline*
+pipeline_find(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
+{
+	struct xfrd_tcp_pipeline* r = pipeline_find_master(set, zone);
 	/* correct master, is there a slot free for this transfer? */
-	if(r->num_unused == 0)
+	if(!r || r->num_unused == 0)
 		return NULL;
 	return r;
 }
 
+/* true if the master of the zone has tcp_master_max pipelines */
+static int
+pipeline_master_full(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
+{
+	struct xfrd_tcp_pipeline* r;
+	rbnode_t* n;
+	int count = 0;
+	if(set->tcp_master_max == 0)
+		return 0;
+	if(!(r = pipeline_find_master(set, zone)))
+		return 0;
+	/* the pipelines to the master are next to each other in the tree */
+	for(n = &r->node; n != RBTREE_NULL; n = rbtree_previous(n)) {
+		struct xfrd_tcp_pipeline* p = (struct xfrd_tcp_pipeline*)n->key;
+		if(p->ip_len != r->ip_len ||
+			memcmp(&p->ip, &r->ip, r->ip_len) != 0)
+			break;
+		if(++count >= set->tcp_master_max)
+			return 1;
+	}
+	return 0;
+}
+
+/* true if the zone is going to ask for an IXFR */
+static int
+tcp_zone_wants_ixfr(xfrd_zone_t* zone)
+{
+	return zone->soa_disk_acquired != 0 && !zone->master->use_axfr_only &&
+		!zone->master->ixfr_disabled;
+}
+
+/* add zone to tcp waiting list, after the zones that ask for an IXFR,
+ * if it asks for an IXFR itself, or else at the end */
+static void
+tcp_zone_waiting_list_add(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
+{
+	zone->tcp_waiting = 1;
+	if(tcp_zone_wants_ixfr(zone)) {
+		xfrd_zone_t* prev = set->tcp_waiting_ixfr;
+		zone->tcp_waiting_prev = prev;
+		zone->tcp_waiting_next = prev?prev->tcp_waiting_next:
+			set->tcp_waiting_first;
+		if(prev)
+			prev->tcp_waiting_next = zone;
+		else	set->tcp_waiting_first = zone;
+		if(zone->tcp_waiting_next)
+			zone->tcp_waiting_next->tcp_waiting_prev = zone;
+		else	set->tcp_waiting_last = zone;
+		set->tcp_waiting_ixfr = zone;
+		return;
+	}
+	zone->tcp_waiting_next = 0;
+	zone->tcp_waiting_prev = set->tcp_waiting_last;
+	if(!set->tcp_waiting_last) {
+		set->tcp_waiting_first = zone;
+		set->tcp_waiting_last = zone;
+	} else {
+		set->tcp_waiting_last->tcp_waiting_next = zone;
+		set->tcp_waiting_last = zone;
+	}
+}
+
 /* remove zone from tcp waiting list */
 static void
 tcp_zone_waiting_list_popfirst(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
@@ -249,6 +320,8 @@ tcp_zone_waiting_list_popfirst(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 	if(zone->tcp_waiting_next)
 		zone->tcp_waiting_next->tcp_waiting_prev = NULL;
 	else	set->tcp_waiting_last = 0;
+	if(set->tcp_waiting_ixfr == zone)
+		set->tcp_waiting_ixfr = 0;
 	zone->tcp_waiting_next = 0;
 	zone->tcp_waiting = 0;
 }
@@ -396,6 +469,23 @@ pipeline_setup_new_zone(xfrd_tcp_set_t* set, struct xfrd_tcp_pipeline* tp,
 	}
 }
 
+/* add a zone to a pipeline that is open to its master */
+static void
+pipeline_join(xfrd_tcp_set_t* set, struct xfrd_tcp_pipeline* tp,
+	xfrd_zone_t* zone)
+{
+	int i;
+	if(zone->zone_handler.ev_fd != -1)
+		xfrd_udp_release(zone);
+	for(i=0; i<set->tcp_state_num; i++) {
+		if(set->tcp_state[i] == tp)
+			zone->tcp_conn = i;
+	}
+	xfrd_deactivate_zone(zone);
+	xfrd_unset_timer(zone);
+	pipeline_setup_new_zone(set, tp, zone);
+}
+
 void
 xfrd_tcp_obtain(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 {
@@ -403,12 +493,12 @@ xfrd_tcp_obtain(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 	assert(zone->tcp_conn == -1);
 	assert(zone->tcp_waiting == 0);
 
-	if(set->tcp_count < XFRD_MAX_TCP) {
+	/* a master with its max of connections pipelines on those */
+	if(set->tcp_count < set->tcp_max && !pipeline_master_full(set, zone)) {
 		int i;
-		assert(!set->tcp_waiting_first);
 		set->tcp_count ++;
 		/* find a free tcp_buffer */
-		for(i=0; i<XFRD_MAX_TCP; i++) {
+		for(i=0; i<set->tcp_state_num; i++) {
 			if(set->tcp_state[i]->tcp_r->fd == -1) {
 				zone->tcp_conn = i;
 				break;
@@ -452,36 +542,47 @@ xfrd_tcp_obtain(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 	}
 	/* check for a pipeline to the same master with unused ID */
 	if((tp = pipeline_find(set, zone))!= NULL) {
-		int i;
-		if(zone->zone_handler.ev_fd != -1)
-			xfrd_udp_release(zone);
-		for(i=0; i<XFRD_MAX_TCP; i++) {
-			if(set->tcp_state[i] == tp)
-				zone->tcp_conn = i;
-		}
-		xfrd_deactivate_zone(zone);
-		xfrd_unset_timer(zone);
-		pipeline_setup_new_zone(set, tp, zone);
+		pipeline_join(set, tp, zone);
 		return;
 	}
 
-	/* wait, at end of line */
+	/* wait in line */
 	DEBUG(DEBUG_XFRD,2, (LOG_INFO, "xfrd: max number of tcp "
-		"connections (%d) reached.", XFRD_MAX_TCP));
-	zone->tcp_waiting_next = 0;
-	zone->tcp_waiting_prev = set->tcp_waiting_last;
-	zone->tcp_waiting = 1;
-	if(!set->tcp_waiting_last) {
-		set->tcp_waiting_first = zone;
-		set->tcp_waiting_last = zone;
-	} else {
-		set->tcp_waiting_last->tcp_waiting_next = zone;
-		set->tcp_waiting_last = zone;
-	}
+		"connections (%d) reached.", set->tcp_max));
+	tcp_zone_waiting_list_add(set, zone);
 	xfrd_deactivate_zone(zone);
 	xfrd_unset_timer(zone);
 }
 
+void
+xfrd_tcp_set_max(xfrd_tcp_set_t* set, struct region* region, int tcp_max)
+{
+	if(tcp_max > set->tcp_state_num) {
+		/* the pipes keep their index, zones refer to it with tcp_conn;
+		 * a smaller old array stays behind in the region */
+		int i;
+		struct xfrd_tcp_pipeline** a = (struct xfrd_tcp_pipeline**)
+			region_alloc_array(region, tcp_max, sizeof(*a));
+		for(i=0; i<set->tcp_state_num; i++)
+			a[i] = set->tcp_state[i];
+		for(i=set->tcp_state_num; i<tcp_max; i++)
+			a[i] = xfrd_tcp_pipeline_create(region);
+		set->tcp_state = a;
+		set->tcp_state_num = tcp_max;
+	}
+	/* with a lower max, the connections above it finish their work
+	 * and are not reused */
+	set->tcp_max = tcp_max;
+	/* with a higher max, waiting zones can start on the new ones */
+	while(set->tcp_count < set->tcp_max && set->tcp_waiting_first) {
+		xfrd_zone_t* zone = set->tcp_waiting_first;
+		tcp_zone_waiting_list_popfirst(set, zone);
+		xfrd_tcp_obtain(set, zone);
+		if(zone->tcp_waiting)
+			break;
+	}
+}
+
 int
 xfrd_tcp_open(xfrd_tcp_set_t* set, struct xfrd_tcp_pipeline* tp,
 	xfrd_zone_t* zone)
@@ -567,8 +668,7 @@ xfrd_tcp_setup_write_packet(struct xfrd_tcp_pipeline* tp, xfrd_zone_t* zone)
 	assert(zone->tcp_conn != -1);
 	assert(zone->tcp_waiting == 0);
 	/* start AXFR or IXFR for the zone */
-	if(zone->soa_disk_acquired == 0 || zone->master->use_axfr_only ||
-						zone->master->ixfr_disabled) {
+	if(!tcp_zone_wants_ixfr(zone)) {
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "request full zone transfer "
 						"(AXFR) for %s to %s",
 			zone->apex_str, zone->master->ip_address_spec));
@@ -946,15 +1046,22 @@ xfrd_tcp_pipe_release(xfrd_tcp_set_t* set, struct xfrd_tcp_pipeline* tp,
 	/* a waiting zone can use the free tcp slot (to another server) */
 	/* if that zone fails to set-up or connect, we try to start the next
 	 * waiting zone in the list */
-	while(set->tcp_count == XFRD_MAX_TCP && set->tcp_waiting_first) {
+	while(set->tcp_count <= set->tcp_max && set->tcp_waiting_first) {
 		int i;
+		struct xfrd_tcp_pipeline* other;
 
 		/* pop first waiting process */
 		xfrd_zone_t* zone = set->tcp_waiting_first;
-		/* start it */
 		assert(zone->tcp_conn == -1);
-		zone->tcp_conn = conn;
 		tcp_zone_waiting_list_popfirst(set, zone);
+		/* its master may have its max of connections already */
+		if(pipeline_master_full(set, zone) &&
+			(other = pipeline_find(set, zone)) != NULL) {
+			pipeline_join(set, other, zone);
+			continue;
+		}
+		/* start it */
+		zone->tcp_conn = conn;
 
 		/* stop udp (if any) */
 		if(zone->zone_handler.ev_fd != -1)
@@ -986,7 +1093,6 @@ xfrd_tcp_pipe_release(xfrd_tcp_set_t* set, struct xfrd_tcp_pipeline* tp,
 		return;
 	}
 	/* no task to start, cleanup */
-	assert(!set->tcp_waiting_first);
 	set->tcp_count --;
 	assert(set->tcp_count >= 0);
 }
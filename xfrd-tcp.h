@@ -28,7 +28,13 @@ typedef struct xfrd_tcp_set xfrd_tcp_set_t;
  */
 struct xfrd_tcp_set {
 	/* tcp connections, each has packet and read/wr state */
-	struct xfrd_tcp_pipeline *tcp_state[XFRD_MAX_TCP];
+	struct xfrd_tcp_pipeline **tcp_state;
+	/* number of tcp connections allocated in tcp_state */
+	int tcp_state_num;
+	/* max number of TCP connections in use, at most tcp_state_num */
+	int tcp_max;
+	/* max number of TCP connections to one master, 0 is no limit */
+	int tcp_master_max;
 	/* number of TCP connections in use. */
 	int tcp_count;
 	/* TCP timeout. */
@@ -37,6 +43,9 @@ struct xfrd_tcp_set {
 	rbtree_t* pipetree;
 	/* double linked list of zones waiting for a TCP connection */
 	struct xfrd_zone *tcp_waiting_first, *tcp_waiting_last;
+	/* the last zone in the waiting list that asks for an IXFR, those
+	 * wait in front of the zones that need an AXFR. NULL if none. */
+	struct xfrd_zone *tcp_waiting_ixfr;
 };
 
 /*
@@ -125,7 +134,10 @@ struct xfrd_tcp_pipeline {
 };
 
 /* create set of tcp connections */
-xfrd_tcp_set_t* xfrd_tcp_set_create(struct region* region);
+xfrd_tcp_set_t* xfrd_tcp_set_create(struct region* region, int tcp_max);
+/* set the max number of tcp connections, allocates more if needed */
+void xfrd_tcp_set_max(xfrd_tcp_set_t* set, struct region* region,
+	int tcp_max);
 
 /* init tcp state */
 xfrd_tcp_t* xfrd_tcp_create(struct region* region, size_t bufsize);
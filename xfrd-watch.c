@@ -0,0 +1,239 @@
+/*
+ * xfrd-watch.c - watch the zone files for changes.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * xfrd watches the directories of the zone files with inotify.  When a
+ * zone file is written, or another file is moved in its place, the zone
+ * gets a check_zonefiles task and a reload is scheduled, like after a
+ * zone transfer.  The reload then stats the changed zone files only,
+ * and not every zone file, as SIGHUP does.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#include "xfrd-watch.h"
+#include "xfrd.h"
+#include "options.h"
+#include "difffile.h"
+#include "nsd.h"
+#include "util.h"
+
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_INOTIFY_INIT1)
+/* the events of a zone file that is written or replaced */
+#define WATCH_MASK (IN_CLOSE_WRITE|IN_MOVED_TO)
+
+/* a zone that is in a watched file */
+struct watch_zone {
+	const dname_type* apex;
+	struct watch_zone* next;
+};
+
+/* a watched file, the directory watch and the name in the directory */
+struct watch_file {
+	rbnode_t node;
+	int wd;
+	char* name;
+	/* the zones that are read from this file */
+	struct watch_zone* zones;
+};
+
+struct xfrd_watch {
+	/* the inotify fd */
+	int fd;
+	struct event handler;
+	/* the watch_files, by wd and name */
+	rbtree_t* files;
+	/* the kernel has no room for more watches */
+	int full;
+};
+
+static int
+watch_file_cmp(const void* a, const void* b)
+{
+	const struct watch_file* x = (const struct watch_file*)a;
+	const struct watch_file* y = (const struct watch_file*)b;
+	if(x->wd != y->wd)
+		return x->wd < y->wd ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+/* queue the check of the zone files, NULL for all of them */
+static void
+watch_check(struct xfrd_state* xfrd, const dname_type* apex)
+{
+	task_new_check_zonefiles(xfrd->nsd->task[xfrd->nsd->mytask],
+		xfrd->last_task, apex);
+}
+
+static void
+xfrd_handle_watch(int fd, short event, void* arg)
+{
+	struct xfrd_state* xfrd = (struct xfrd_state*)arg;
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	struct watch_file key, *f;
+	struct watch_zone* z;
+	int changed = 0, overflow = 0;
+	ssize_t len;
+	char* p;
+	(void)event;
+	while((len = read(fd, u.buf, sizeof(u.buf))) > 0) {
+		for(p = u.buf; p < u.buf + len; p += sizeof(struct
+			inotify_event) + ((struct inotify_event*)p)->len) {
+			struct inotify_event* e = (struct inotify_event*)p;
+			if((e->mask&IN_Q_OVERFLOW)) {
+				overflow = 1;
+				continue;
+			}
+			if((e->mask&IN_IGNORED)) {
+				log_msg(LOG_WARNING, "zonefiles-watch: a zone "
+					"file directory is no longer watched");
+				continue;
+			}
+			if(e->len == 0)
+				continue;
+			key.node.key = &key;
+			key.wd = e->wd;
+			key.name = e->name;
+			f = (struct watch_file*)rbtree_search(xfrd->watch->files,
+				&key);
+			if(!f)
+				continue;
+			for(z = f->zones; z; z = z->next) {
+				/* the zone may have been deleted */
+				if(!zone_options_find(xfrd->nsd->options, z->apex))
+					continue;
+				DEBUG(DEBUG_XFRD,1, (LOG_INFO, "zonefiles-watch: "
+					"zone %s file changed",
+					dname_to_string(z->apex, NULL)));
+				watch_check(xfrd, z->apex);
+				changed = 1;
+			}
+		}
+	}
+	if(len == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+		errno != EINTR)
+		log_msg(LOG_ERR, "zonefiles-watch: read: %s", strerror(errno));
+	if(overflow) {
+		log_msg(LOG_WARNING, "zonefiles-watch: event queue overflow, "
+			"all zone files are checked");
+		watch_check(xfrd, NULL);
+		changed = 1;
+	}
+	if(changed)
+		xfrd_set_reload_timeout();
+}
+
+void
+xfrd_watch_zone(struct xfrd_state* xfrd, struct zone_options* zone)
+{
+	struct watch_file key, *f;
+	struct watch_zone* z;
+	const dname_type* apex;
+	char path[1024], *dir, *base;
+	int wd;
+	if(!xfrd->watch || xfrd->watch->full || !zone->pattern->zonefile ||
+		!zone->pattern->zonefile[0])
+		return;
+	/* relative names are in the working directory, like for the
+	 * reload that reads them */
+	strlcpy(path, config_make_zonefile(zone, xfrd->nsd), sizeof(path));
+	if((base = strrchr(path, '/')) != NULL) {
+		*base++ = 0;
+		dir = path[0]?path:"/";
+	} else {
+		dir = ".";
+		base = path;
+	}
+	if(base[0] == 0)
+		return;
+	/* a directory that is watched already returns the same wd */
+	wd = inotify_add_watch(xfrd->watch->fd, dir, WATCH_MASK|IN_ONLYDIR);
+	if(wd == -1) {
+		if(errno == ENOSPC) {
+			log_msg(LOG_ERR, "zonefiles-watch: no more watches, "
+				"increase fs.inotify.max_user_watches, the "
+				"other zone files are not watched");
+			xfrd->watch->full = 1;
+		} else	log_msg(LOG_ERR, "zonefiles-watch: cannot watch %s: %s",
+				dir, strerror(errno));
+		return;
+	}
+	key.node.key = &key;
+	key.wd = wd;
+	key.name = base;
+	f = (struct watch_file*)rbtree_search(xfrd->watch->files, &key);
+	if(!f) {
+		f = (struct watch_file*)region_alloc_zero(xfrd->region,
+			sizeof(*f));
+		f->node.key = f;
+		f->wd = wd;
+		f->name = region_strdup(xfrd->region, base);
+		rbtree_insert(xfrd->watch->files, &f->node);
+	}
+	apex = (const dname_type*)zone->node.key;
+	for(z = f->zones; z; z = z->next)
+		if(dname_compare(z->apex, apex) == 0)
+			return;
+	z = (struct watch_zone*)region_alloc(xfrd->region, sizeof(*z));
+	z->apex = dname_copy(xfrd->region, apex);
+	z->next = f->zones;
+	f->zones = z;
+}
+
+void
+xfrd_watch_init(struct xfrd_state* xfrd)
+{
+	zone_options_t* zone;
+	xfrd->watch = NULL;
+	if(!xfrd->nsd->options->zonefiles_watch)
+		return;
+	xfrd->watch = (struct xfrd_watch*)region_alloc_zero(xfrd->region,
+		sizeof(*xfrd->watch));
+	xfrd->watch->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if(xfrd->watch->fd == -1) {
+		log_msg(LOG_ERR, "zonefiles-watch: inotify_init1: %s",
+			strerror(errno));
+		xfrd->watch = NULL;
+		return;
+	}
+	xfrd->watch->files = rbtree_create(xfrd->region, watch_file_cmp);
+	RBTREE_FOR(zone, zone_options_t*, xfrd->nsd->options->zone_options)
+		xfrd_watch_zone(xfrd, zone);
+	event_set(&xfrd->watch->handler, xfrd->watch->fd, EV_PERSIST|EV_READ,
+		xfrd_handle_watch, xfrd);
+	if(event_base_set(xfrd->event_base, &xfrd->watch->handler) != 0)
+		log_msg(LOG_ERR, "xfrd watch: event_base_set failed");
+	if(event_add(&xfrd->watch->handler, NULL) != 0)
+		log_msg(LOG_ERR, "xfrd watch: event_add failed");
+	VERBOSITY(2, (LOG_INFO, "zonefiles-watch: watching %d zone files",
+		(int)xfrd->watch->files->count));
+}
+
+#else /* no inotify */
+
+void
+xfrd_watch_zone(struct xfrd_state* ATTR_UNUSED(xfrd),
+	struct zone_options* ATTR_UNUSED(zone))
+{
+}
+
+void
+xfrd_watch_init(struct xfrd_state* xfrd)
+{
+	xfrd->watch = NULL;
+	if(xfrd->nsd->options->zonefiles_watch)
+		log_msg(LOG_WARNING, "zonefiles-watch: not supported on this "
+			"system, the zone files are checked on SIGHUP");
+}
+#endif /* HAVE_SYS_INOTIFY_H && HAVE_INOTIFY_INIT1 */
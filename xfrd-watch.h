@@ -0,0 +1,26 @@
+/*
+ * xfrd-watch.h - watch the zone files for changes.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef XFRD_WATCH_H
+#define XFRD_WATCH_H
+
+struct xfrd_state;
+struct zone_options;
+
+/*
+ * Start to watch the zone files, if zonefiles-watch is enabled.  A zone
+ * file that is written or moved in place is checked at the next reload,
+ * and the other zone files are not.  Call after the zones are read.
+ */
+void xfrd_watch_init(struct xfrd_state* xfrd);
+
+/* watch the zone file of a zone that is added */
+void xfrd_watch_zone(struct xfrd_state* xfrd, struct zone_options* zone);
+
+#endif /* XFRD_WATCH_H */
@@ -19,8 +19,12 @@
 #include "xfrd-tcp.h"
 #include "xfrd-disk.h"
 #include "xfrd-notify.h"
+#include "xfrd-watch.h"
+#include "metrics.h"
+#include "logring.h"
 #include "options.h"
 #include "util.h"
+#include "usdt.h"
 #include "netio.h"
 #include "region-allocator.h"
 #include "nsd.h"
@@ -29,6 +33,8 @@
 #include "difffile.h"
 #include "ipc.h"
 #include "remote.h"
+#include "dnstap.h"
+#include "catalog.h"
 
 #define XFRD_TRANSFER_TIMEOUT_START 10 /* empty zone timeout is between x and 2*x seconds */
 #define XFRD_TRANSFER_TIMEOUT_MAX 86400 /* empty zone timeout max expbackoff */
@@ -69,8 +75,6 @@ static void xfrd_set_timer_retry(xfrd_zone_t* zone);
 /* set timer for refresh timeout (depends on zone_state) */
 static void xfrd_set_timer_refresh(xfrd_zone_t* zone);
 
-/* set reload timeout */
-static void xfrd_set_reload_timeout(void);
 /* handle reload timeout */
 static void xfrd_handle_reload(int fd, short event, void* arg);
 /* handle child timeout */
@@ -144,6 +148,7 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd->zonestat_safe = nsd->zonestatdesired;
 #endif
 	xfrd->activated_first = NULL;
+	xfrd->updating_first = NULL;
 	xfrd->ipc_pass = buffer_create(xfrd->region, QIOBUFSZ);
 	xfrd->last_task = region_alloc(xfrd->region, sizeof(*xfrd->last_task));
 	udb_ptr_init(xfrd->last_task, xfrd->nsd->task[xfrd->nsd->mytask]);
@@ -156,6 +161,7 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd->can_send_reload = !reload_active;
 	xfrd->reload_pid = nsd_pid;
 	xfrd->child_timer_added = 0;
+	xfrd->reload_timing = NULL;
 
 	xfrd->ipc_send_blocked = 0;
 	event_set(&xfrd->ipc_handler, socket, EV_PERSIST|EV_READ,
@@ -169,6 +175,18 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	/* not reading using ipc_conn yet */
 	xfrd->ipc_conn->is_reading = 0;
 	xfrd->ipc_conn->fd = socket;
+	xfrd->notify_pass = buffer_create(xfrd->region, QIOBUFSZ);
+	if(nsd->notify_fd != -1) {
+		event_set(&xfrd->notify_handler, nsd->notify_fd,
+			EV_PERSIST|EV_READ, xfrd_handle_ipc_notify, xfrd);
+		if(event_base_set(xfrd->event_base, &xfrd->notify_handler)
+			!= 0)
+			log_msg(LOG_ERR, "xfrd notify handler: event_base_set "
+				"failed");
+		if(event_add(&xfrd->notify_handler, NULL) != 0)
+			log_msg(LOG_ERR, "xfrd notify handler: event_add "
+				"failed");
+	}
 	xfrd->need_to_send_reload = 0;
 	xfrd->need_to_send_shutdown = 0;
 	xfrd->need_to_send_stats = 0;
@@ -176,6 +194,11 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd->write_zonefile_needed = 0;
 	if(nsd->options->zonefiles_write)
 		xfrd_write_timer_set();
+#ifdef USE_DNSTAP
+	xfrd->dnstap = dt_writer_create(xfrd->region, nsd, xfrd->event_base);
+#endif
+	xfrd->logring = logring_writer_create(xfrd->region, nsd,
+		xfrd->event_base);
 
 	xfrd->notify_waiting_first = NULL;
 	xfrd->notify_waiting_last = NULL;
@@ -184,8 +207,11 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 #ifdef HAVE_SSL
 	daemon_remote_attach(xfrd->nsd->rc, xfrd);
 #endif
+	daemon_metrics_attach(xfrd->nsd->metrics, xfrd);
 
-	xfrd->tcp_set = xfrd_tcp_set_create(xfrd->region);
+	xfrd->tcp_set = xfrd_tcp_set_create(xfrd->region,
+		nsd->options->xfrd_tcp_max);
+	xfrd->tcp_set->tcp_master_max = nsd->options->xfrd_tcp_master_max;
 	xfrd->tcp_set->tcp_timeout = nsd->tcp_timeout;
 #ifndef HAVE_ARC4RANDOM
 	srandom((unsigned long) getpid() * (unsigned long) time(NULL));
@@ -193,9 +219,15 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd pre-startup"));
 	xfrd_init_zones();
+	xfrd_watch_init(xfrd);
 	xfrd_receive_soa(socket, shortsoa);
 	if(nsd->options->xfrdfile != NULL && nsd->options->xfrdfile[0]!=0)
 		xfrd_read_state(xfrd);
+	/* the servers run, now the zone files are read */
+	if(nsd->options->progressive_start && (nsd->options->zonefiles_check
+		|| nsd->options->database == NULL ||
+		nsd->options->database[0] == 0))
+		xfrd_progressive_next(xfrd, 1);
 	
 	/* did we get killed before startup was successful? */
 	if(nsd->signal_hint_shutdown) {
@@ -321,6 +353,11 @@ xfrd_shutdown()
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd shutdown"));
 	event_del(&xfrd->ipc_handler);
 	close(xfrd->ipc_handler.ev_fd); /* notifies parent we stop */
+	if(xfrd->nsd->notify_fd != -1) {
+		event_del(&xfrd->notify_handler);
+		close(xfrd->nsd->notify_fd);
+		xfrd->nsd->notify_fd = -1;
+	}
 	if(xfrd->nsd->options->xfrdfile != NULL && xfrd->nsd->options->xfrdfile[0]!=0)
 		xfrd_write_state(xfrd);
 	if(xfrd->reload_added) {
@@ -334,9 +371,18 @@ xfrd_shutdown()
 	if(xfrd->nsd->options->zonefiles_write) {
 		event_del(&xfrd->write_timer);
 	}
+#ifdef USE_DNSTAP
+	/* write out the records that are in the rings */
+	dt_writer_close(xfrd->dnstap);
+	xfrd->dnstap = NULL;
+#endif
+	/* the last messages of the servers */
+	logring_writer_close(xfrd->logring);
+	xfrd->logring = NULL;
 #ifdef HAVE_SSL
 	daemon_remote_close(xfrd->nsd->rc); /* close sockets of rc */
 #endif
+	daemon_metrics_close(xfrd->nsd->metrics);
 	/* close sockets */
 	RBTREE_FOR(zone, xfrd_zone_t*, xfrd->zones)
 	{
@@ -436,6 +482,7 @@ xfrd_init_slave_zone(xfrd_state_t* xfrd, zone_options_t* zone_opt)
 	xzone->tcp_waiting = 0;
 	xzone->udp_waiting = 0;
 	xzone->is_activated = 0;
+	xzone->is_updating = 0;
 
 	tsig_create_record_custom(&xzone->tsig, NULL, 0, 0, 4);
 
@@ -481,6 +528,9 @@ xfrd_process_soa_info_task(struct task_list_d* task)
 	xfrd_soa_t soa;
 	xfrd_soa_t* soa_ptr = &soa;
 	xfrd_zone_t* zone;
+	struct notify_zone_t* nz;
+	struct zone_mem_stat mem;
+	memset(&mem, 0, sizeof(mem));
 	DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: process SOAINFO %s",
 		dname_to_string(task->zname, 0)));
 	zone = (xfrd_zone_t*)rbtree_search(xfrd->zones, task->zname);
@@ -519,10 +569,17 @@ xfrd_process_soa_info_task(struct task_list_d* task)
 		p += sizeof(uint32_t);
 		memmove(&soa.minimum, p, sizeof(uint32_t));
 		p += sizeof(uint32_t);
+		if(task->size >= (size_t)(p - (uint8_t*)task) + sizeof(mem))
+			memmove(&mem, p, sizeof(mem));
 		DEBUG(DEBUG_IPC,1, (LOG_INFO, "SOAINFO for %s %u",
 			dname_to_string(task->zname,0),
 			(unsigned)ntohl(soa.serial)));
 	}
+	/* the memory use of the zone, for zonestatus */
+	nz = (struct notify_zone_t*)rbtree_search(xfrd->notify_zones,
+		task->zname);
+	if(nz)
+		nz->mem = mem;
 
 	if(!zone) {
 		DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: zone %s master zone updated",
@@ -634,6 +691,34 @@ xfrd_deactivate_zone(xfrd_zone_t* z)
 	}
 }
 
+void
+xfrd_set_updating(xfrd_zone_t* z)
+{
+	if(!z->is_updating) {
+		/* push onto list */
+		z->updating_prev = NULL;
+		z->updating_next = xfrd->updating_first;
+		if(xfrd->updating_first)
+			xfrd->updating_first->updating_prev = z;
+		xfrd->updating_first = z;
+		z->is_updating = 1;
+	}
+}
+
+static void
+xfrd_unset_updating(xfrd_zone_t* z)
+{
+	if(z->is_updating) {
+		/* delete from updating list */
+		if(z->updating_prev)
+			z->updating_prev->updating_next = z->updating_next;
+		else	xfrd->updating_first = z->updating_next;
+		if(z->updating_next)
+			z->updating_next->updating_prev = z->updating_prev;
+		z->is_updating = 0;
+	}
+}
+
 void
 xfrd_del_slave_zone(xfrd_state_t* xfrd, const dname_type* dname)
 {
@@ -651,6 +736,8 @@ xfrd_del_slave_zone(xfrd_state_t* xfrd, const dname_type* dname)
 			z->tcp_waiting_next->tcp_waiting_prev =
 				z->tcp_waiting_prev;
 		else xfrd->tcp_set->tcp_waiting_last = z->tcp_waiting_prev;
+		if(xfrd->tcp_set->tcp_waiting_ixfr == z)
+			xfrd->tcp_set->tcp_waiting_ixfr = z->tcp_waiting_prev;
 		z->tcp_waiting = 0;
 	}
 	if(z->udp_waiting) {
@@ -666,6 +753,7 @@ xfrd_del_slave_zone(xfrd_state_t* xfrd, const dname_type* dname)
 		z->udp_waiting = 0;
 	}
 	xfrd_deactivate_zone(z);
+	xfrd_unset_updating(z);
 	if(z->tcp_conn != -1) {
 		xfrd_tcp_release(xfrd->tcp_set, z);
 	} else if(z->zone_handler.ev_fd != -1 && z->event_added) {
@@ -915,7 +1003,7 @@ xfrd_udp_obtain(xfrd_zone_t* zone)
 		/* no tcp and udp at the same time */
 		xfrd_tcp_release(xfrd->tcp_set, zone);
 	}
-	if(xfrd->udp_use_num < XFRD_MAX_UDP) {
+	if(xfrd->udp_use_num < (size_t)xfrd->nsd->options->xfrd_udp_max) {
 		int fd;
 		xfrd->udp_use_num++;
 		fd = xfrd_send_ixfr_request_udp(zone);
@@ -961,16 +1049,21 @@ xfrd_time()
 void
 xfrd_copy_soa(xfrd_soa_t* soa, rr_type* rr)
 {
-	const uint8_t* rr_ns_wire = dname_name(domain_dname(rdata_atom_domain(rr->rdatas[0])));
-	uint8_t rr_ns_len = domain_dname(rdata_atom_domain(rr->rdatas[0]))->name_size;
-	const uint8_t* rr_em_wire = dname_name(domain_dname(rdata_atom_domain(rr->rdatas[1])));
-	uint8_t rr_em_len = domain_dname(rdata_atom_domain(rr->rdatas[1]))->name_size;
+	const uint8_t* rr_ns_wire, *rr_em_wire;
+	uint8_t rr_ns_len, rr_em_len;
+	uint8_t* rr_wire;
 
 	if(rr->type != TYPE_SOA || rr->rdata_count != 7) {
 		log_msg(LOG_ERR, "xfrd: copy_soa called with bad rr, type %d rrs %u.",
 			rr->type, rr->rdata_count);
 		return;
 	}
+	rr_ns_wire = dname_name(domain_dname(rr_rdata_domain(rr, 0)));
+	rr_ns_len = domain_dname(rr_rdata_domain(rr, 0))->name_size;
+	rr_em_wire = dname_name(domain_dname(rr_rdata_domain(rr, 1)));
+	rr_em_len = domain_dname(rr_rdata_domain(rr, 1))->name_size;
+	/* serial, refresh, retry, expire and minimum */
+	rr_wire = rr_rdata_wire(rr);
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: copy_soa rr, type %d rrs %u, ttl %u.",
 			(int)rr->type, (unsigned)rr->rdata_count, (unsigned)rr->ttl));
 	soa->type = htons(rr->type);
@@ -985,11 +1078,11 @@ xfrd_copy_soa(xfrd_soa_t* soa, rr_type* rr)
 	memcpy(soa->email+1, rr_em_wire, rr_em_len);
 
 	/* already in network format */
-	memcpy(&soa->serial, rdata_atom_data(rr->rdatas[2]), sizeof(uint32_t));
-	memcpy(&soa->refresh, rdata_atom_data(rr->rdatas[3]), sizeof(uint32_t));
-	memcpy(&soa->retry, rdata_atom_data(rr->rdatas[4]), sizeof(uint32_t));
-	memcpy(&soa->expire, rdata_atom_data(rr->rdatas[5]), sizeof(uint32_t));
-	memcpy(&soa->minimum, rdata_atom_data(rr->rdatas[6]), sizeof(uint32_t));
+	memcpy(&soa->serial, rr_wire, sizeof(uint32_t));
+	memcpy(&soa->refresh, rr_wire+4, sizeof(uint32_t));
+	memcpy(&soa->retry, rr_wire+8, sizeof(uint32_t));
+	memcpy(&soa->expire, rr_wire+12, sizeof(uint32_t));
+	memcpy(&soa->minimum, rr_wire+16, sizeof(uint32_t));
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO,
 		"xfrd: copy_soa rr, serial %u refresh %u retry %u expire %u",
 		(unsigned)ntohl(soa->serial), (unsigned)ntohl(soa->refresh),
@@ -1074,6 +1167,7 @@ xfrd_handle_incoming_soa(xfrd_zone_t* zone,
 	if(soa == NULL) {
 		/* nsd no longer has a zone in memory */
 		zone->soa_nsd_acquired = 0;
+		xfrd_set_updating(zone);
 		xfrd_set_zone_state(zone, xfrd_zone_refreshing);
 		xfrd_set_refresh_now(zone);
 		return;
@@ -1186,47 +1280,50 @@ xfrd_udp_release(xfrd_zone_t* zone)
 	zone->zone_handler.ev_fd = -1;
 	zone->zone_handler_flags = 0;
 	zone->event_added = 0;
+	if(xfrd->udp_use_num > 0)
+		xfrd->udp_use_num--;
 	/* see if there are waiting zones */
-	if(xfrd->udp_use_num == XFRD_MAX_UDP)
-	{
-		while(xfrd->udp_waiting_first) {
-			/* snip off waiting list */
-			xfrd_zone_t* wz = xfrd->udp_waiting_first;
-			assert(wz->udp_waiting);
-			wz->udp_waiting = 0;
-			xfrd->udp_waiting_first = wz->udp_waiting_next;
-			if(wz->udp_waiting_next)
-				wz->udp_waiting_next->udp_waiting_prev = NULL;
-			if(xfrd->udp_waiting_last == wz)
-				xfrd->udp_waiting_last = NULL;
-			/* see if this zone needs udp connection */
-			if(wz->tcp_conn == -1) {
-				int fd = xfrd_send_ixfr_request_udp(wz);
-				if(fd != -1) {
-					if(wz->event_added)
-						event_del(&wz->zone_handler);
-					event_set(&wz->zone_handler, fd,
-						EV_READ|EV_TIMEOUT|EV_PERSIST,
-						xfrd_handle_zone, wz);
-					if(event_base_set(xfrd->event_base,
-						&wz->zone_handler) != 0)
-						log_msg(LOG_ERR, "cannot set event_base for ixfr");
-					if(event_add(&wz->zone_handler, &wz->timeout) != 0)
-						log_msg(LOG_ERR, "cannot add event for ixfr");
-					wz->zone_handler_flags = EV_READ|EV_TIMEOUT|EV_PERSIST;
-					wz->event_added = 1;
-					return;
-				} else {
-					/* make this zone do something with
-					 * this failure to act */
-					xfrd_set_refresh_now(wz);
-				}
+	xfrd_udp_start_waiting();
+}
+
+void
+xfrd_udp_start_waiting(void)
+{
+	while(xfrd->udp_waiting_first && xfrd->udp_use_num <
+		(size_t)xfrd->nsd->options->xfrd_udp_max) {
+		/* snip off waiting list */
+		xfrd_zone_t* wz = xfrd->udp_waiting_first;
+		assert(wz->udp_waiting);
+		wz->udp_waiting = 0;
+		xfrd->udp_waiting_first = wz->udp_waiting_next;
+		if(wz->udp_waiting_next)
+			wz->udp_waiting_next->udp_waiting_prev = NULL;
+		if(xfrd->udp_waiting_last == wz)
+			xfrd->udp_waiting_last = NULL;
+		/* see if this zone needs udp connection */
+		if(wz->tcp_conn == -1) {
+			int fd = xfrd_send_ixfr_request_udp(wz);
+			if(fd != -1) {
+				xfrd->udp_use_num++;
+				if(wz->event_added)
+					event_del(&wz->zone_handler);
+				event_set(&wz->zone_handler, fd,
+					EV_READ|EV_TIMEOUT|EV_PERSIST,
+					xfrd_handle_zone, wz);
+				if(event_base_set(xfrd->event_base,
+					&wz->zone_handler) != 0)
+					log_msg(LOG_ERR, "cannot set event_base for ixfr");
+				if(event_add(&wz->zone_handler, &wz->timeout) != 0)
+					log_msg(LOG_ERR, "cannot add event for ixfr");
+				wz->zone_handler_flags = EV_READ|EV_TIMEOUT|EV_PERSIST;
+				wz->event_added = 1;
+			} else {
+				/* make this zone do something with
+				 * this failure to act */
+				xfrd_set_refresh_now(wz);
 			}
 		}
 	}
-	/* no waiting zones */
-	if(xfrd->udp_use_num > 0)
-		xfrd->udp_use_num--;
 }
 
 static void
@@ -1908,6 +2005,28 @@ xfrd_pretty_time(time_t v)
 	return buf;
 }
 
+/*
+ * Put the apply_xfr task for the transfer on the tasklist after its first
+ * part, and reload now.  The reload applies the parts while xfrd writes
+ * them, and quits if xfrd removes the file because the transfer fails.
+ * Only without a database file, the reload then changes its own copy.
+ */
+static void
+xfrd_stream_apply_start(xfrd_zone_t* zone)
+{
+	if((xfrd->nsd->dbfile && xfrd->nsd->dbfile[0]) ||
+		xfrd->nsd->options->xfrd_reload_timeout == -1)
+		return;
+	if(!task_new_apply_xfr(xfrd->nsd->task[xfrd->nsd->mytask],
+		xfrd->last_task, zone->apex, zone->msg_old_serial,
+		zone->msg_new_serial, zone->xfrfilenumber, 0))
+		return;
+	zone->msg_stream = 1;
+	VERBOSITY(2, (LOG_INFO, "xfrd: zone %s transfer is applied while "
+		"it is received", zone->apex_str));
+	xfrd_set_reload_now(xfrd);
+}
+
 enum xfrd_packet_result
 xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 {
@@ -1915,7 +2034,9 @@ xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 	enum xfrd_packet_result res;
 
 	/* parse and check the packet - see if it ends the xfr */
-	switch((res=xfrd_parse_received_xfr_packet(zone, packet, &soa)))
+	res = xfrd_parse_received_xfr_packet(zone, packet, &soa);
+	NSD_PROBE3(xfr__packet, zone->apex_str, buffer_limit(packet), res);
+	switch(res)
 	{
 		case xfrd_packet_more:
 		case xfrd_packet_transfer:
@@ -1958,8 +2079,10 @@ xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 	/* dump reply on disk to diff file */
 	/* if first part, get new filenumber.  Numbers can wrap around, 64bit
 	 * is enough so we do not collide with older-transfers-in-progress */
-	if(zone->msg_seq_nr == 0)
+	if(zone->msg_seq_nr == 0) {
 		zone->xfrfilenumber = xfrd->xfrfilenumber++;
+		zone->msg_stream = 0;
+	}
 	diff_write_packet(dname_to_string(zone->apex,0),
 		zone->zone_options->pattern->pname,
 		zone->msg_old_serial, zone->msg_new_serial, zone->msg_seq_nr,
@@ -1971,6 +2094,9 @@ xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 		(int)zone->msg_new_serial));
 	zone->msg_seq_nr++;
 	if(res == xfrd_packet_more) {
+		/* the reload can apply the parts while the rest arrives */
+		if(zone->msg_seq_nr == 1 && xfrd->nsd->options->xfrd_stream_apply)
+			xfrd_stream_apply_start(zone);
 		/* wait for more */
 		return xfrd_packet_more;
 	}
@@ -1992,10 +2118,13 @@ xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 		zone->apex_str, (char*)buffer_begin(packet)));
 	/* reset msg seq nr, so if that is nonnull we know xfr file exists */
 	zone->msg_seq_nr = 0;
-	/* now put apply_xfr task on the tasklist */
-	if(!task_new_apply_xfr(xfrd->nsd->task[xfrd->nsd->mytask],
+	/* now put apply_xfr task on the tasklist, unless the reload is
+	 * applying it already */
+	if(!zone->msg_stream && !task_new_apply_xfr(
+		xfrd->nsd->task[xfrd->nsd->mytask],
 		xfrd->last_task, zone->apex, zone->msg_old_serial,
-		zone->msg_new_serial, zone->xfrfilenumber)) {
+		zone->msg_new_serial, zone->xfrfilenumber,
+		zone->msg_is_ixfr == 0)) {
 		/* delete the file and pretend transfer was bad to continue */
 		xfrd_unlink_xfrfile(xfrd->nsd, zone->xfrfilenumber);
 		xfrd_set_reload_timeout();
@@ -2004,6 +2133,7 @@ xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 	/* update the disk serial no. */
 	zone->soa_disk_acquired = xfrd_time();
 	zone->soa_disk = soa;
+	xfrd_set_updating(zone);
 	if(zone->soa_notified_acquired && (
 		zone->soa_notified.serial == 0 ||
 		compare_serial(htonl(zone->soa_disk.serial),
@@ -2025,17 +2155,19 @@ xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 			zone->apex_str));
 		zone->round_num = -1; /* next try start anew */
 		xfrd_set_timer_refresh(zone);
-		xfrd_set_reload_timeout();
+		if(!zone->msg_stream)
+			xfrd_set_reload_timeout();
 		return xfrd_packet_transfer;
 	} else {
 		/* try to get an even newer serial */
 		/* pretend it was bad to continue queries */
-		xfrd_set_reload_timeout();
+		if(!zone->msg_stream)
+			xfrd_set_reload_timeout();
 		return xfrd_packet_bad;
 	}
 }
 
-static void
+void
 xfrd_set_reload_timeout()
 {
 	if(xfrd->nsd->options->xfrd_reload_timeout == -1)
@@ -2212,9 +2344,10 @@ void
 xfrd_check_failed_updates()
 {
 	/* see if updates have not come through */
-	xfrd_zone_t* zone;
-	RBTREE_FOR(zone, xfrd_zone_t*, xfrd->zones)
+	xfrd_zone_t* zone, *next;
+	for(zone = xfrd->updating_first; zone; zone = next)
 	{
+		next = zone->updating_next;
 		/* zone has a disk soa, and no nsd soa or a different nsd soa */
 		if(zone->soa_disk_acquired != 0 &&
 			(zone->soa_nsd_acquired == 0 ||
@@ -2248,6 +2381,9 @@ xfrd_check_failed_updates()
 					xfrd_set_reload_timeout();
 				}
 			}
+		} else {
+			/* the disk soa is loaded */
+			xfrd_unset_updating(zone);
 		}
 	}
 }
@@ -2255,9 +2391,10 @@ xfrd_check_failed_updates()
 void
 xfrd_prepare_zones_for_reload()
 {
-	xfrd_zone_t* zone;
-	RBTREE_FOR(zone, xfrd_zone_t*, xfrd->zones)
+	xfrd_zone_t* zone, *next;
+	for(zone = xfrd->updating_first; zone; zone = next)
 	{
+		next = zone->updating_next;
 		/* zone has a disk soa, and no nsd soa or a different nsd soa */
 		if(zone->soa_disk_acquired != 0 &&
 			(zone->soa_nsd_acquired == 0 ||
@@ -2271,6 +2408,8 @@ xfrd_prepare_zones_for_reload()
 				 */
 				zone->soa_disk_acquired--;
 			}
+		} else {
+			xfrd_unset_updating(zone);
 		}
 	}
 }
@@ -2292,6 +2431,8 @@ xfrd_process_stat_info_task(xfrd_state_t* xfrd, struct task_list_d* task)
 	for(i=0; i<xfrd->nsd->child_count; i++) {
 		xfrd->nsd->children[i].query_count += *p++;
 	}
+	/* the old servers are done, the new ones use this stat_map block */
+	xfrd->nsd->stat_idx = (int)task->yesno;
 	/* got total, now see if users are interested in these statistics */
 #ifdef HAVE_SSL
 	daemon_remote_process_stats(xfrd->nsd->rc);
@@ -2305,19 +2446,28 @@ static void
 xfrd_process_zonestat_inc_task(xfrd_state_t* xfrd, struct task_list_d* task)
 {
 	xfrd->zonestat_safe = (unsigned)task->oldserial;
-	zonestat_remap(xfrd->nsd, 0, xfrd->zonestat_safe*sizeof(struct nsdst));
+	zonestat_remap(xfrd->nsd, 0, ZONESTAT_SIZE(xfrd->nsd,
+		xfrd->zonestat_safe));
 	xfrd->nsd->zonestatsize[0] = xfrd->zonestat_safe;
-	zonestat_remap(xfrd->nsd, 1, xfrd->zonestat_safe*sizeof(struct nsdst));
+	zonestat_remap(xfrd->nsd, 1, ZONESTAT_SIZE(xfrd->nsd,
+		xfrd->zonestat_safe));
 	xfrd->nsd->zonestatsize[1] = xfrd->zonestat_safe;
 }
 #endif /* USE_ZONE_STATS */
 
+/** process reload timing task */
+static void
+xfrd_process_reload_timing_task(xfrd_state_t* xfrd, struct task_list_d* task)
+{
+	if(!xfrd->reload_timing)
+		xfrd->reload_timing = (struct reload_timing*)region_alloc(
+			xfrd->region, sizeof(struct reload_timing));
+	memcpy(xfrd->reload_timing, task->zname, sizeof(struct reload_timing));
+}
+
 static void
 xfrd_handle_taskresult(xfrd_state_t* xfrd, struct task_list_d* task)
 {
-#ifndef BIND8_STATS
-	(void)xfrd;
-#endif
 	switch(task->task_type) {
 	case task_soa_info:
 		xfrd_process_soa_info_task(task);
@@ -2332,6 +2482,12 @@ xfrd_handle_taskresult(xfrd_state_t* xfrd, struct task_list_d* task)
 		xfrd_process_zonestat_inc_task(xfrd, task);
 		break;
 #endif
+	case task_reload_timing:
+		xfrd_process_reload_timing_task(xfrd, task);
+		break;
+	case task_catalog:
+		catalog_process_members(xfrd, task);
+		break;
 	default:
 		log_msg(LOG_WARNING, "unhandled task result in xfrd from "
 			"reload type %d", (int)task->task_type);
@@ -2356,6 +2512,56 @@ void xfrd_process_task_result(xfrd_state_t* xfrd, struct udb_base* taskudb)
 	task_clear(taskudb);
 }
 
+void
+xfrd_zonestat_inc_ifneeded(xfrd_state_t* xfrd)
+{
+#ifdef USE_ZONE_STATS
+	if(xfrd->nsd->options->zonestatnames->count != xfrd->zonestat_safe)
+		task_new_zonestat_inc(xfrd->nsd->task[xfrd->nsd->mytask],
+			xfrd->last_task, 
+			xfrd->nsd->options->zonestatnames->count);
+#else
+	(void)xfrd;
+#endif /* USE_ZONE_STATS */
+}
+
+void
+xfrd_progressive_next(xfrd_state_t* xfrd, int first)
+{
+	zone_options_t* zo;
+	uint32_t level = 0;
+	int found = 0, num = 0;
+	xfrd->progressive = 0;
+	/* the highest load-priority below the one that was read */
+	RBTREE_FOR(zo, zone_options_t*, xfrd->nsd->options->zone_options) {
+		uint32_t p = zo->pattern->load_priority;
+		if(!first && p >= xfrd->progressive_level)
+			continue;
+		if(!found || p > level) {
+			level = p;
+			found = 1;
+		}
+	}
+	if(!found) {
+		if(!first)
+			VERBOSITY(1, (LOG_INFO, "progressive-start: the zone "
+				"files are read"));
+		return;
+	}
+	RBTREE_FOR(zo, zone_options_t*, xfrd->nsd->options->zone_options) {
+		if(zo->pattern->load_priority != level)
+			continue;
+		task_new_check_zonefiles(xfrd->nsd->task[xfrd->nsd->mytask],
+			xfrd->last_task, (const dname_type*)zo->node.key);
+		num++;
+	}
+	VERBOSITY(1, (LOG_INFO, "progressive-start: reading %d zone files "
+		"of load-priority %u", num, (unsigned)level));
+	xfrd->progressive = XFRD_PROGRESSIVE_QUEUED;
+	xfrd->progressive_level = level;
+	xfrd_set_reload_now(xfrd);
+}
+
 void xfrd_set_reload_now(xfrd_state_t* xfrd)
 {
 	xfrd->need_to_send_reload = 1;
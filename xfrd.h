@@ -34,6 +34,9 @@ struct xfrd_tcp;
 struct xfrd_tcp_set;
 struct notify_zone_t;
 struct udb_ptr;
+struct dt_writer;
+struct logring_writer;
+struct reload_timing;
 typedef struct xfrd_state xfrd_state_t;
 typedef struct xfrd_zone xfrd_zone_t;
 typedef struct xfrd_soa xfrd_soa_t;
@@ -49,6 +52,8 @@ struct xfrd_state {
 	struct nsd* nsd;
 
 	struct xfrd_tcp_set* tcp_set;
+	/* the zone file watch, NULL if not watched */
+	struct xfrd_watch* watch;
 	/* packet buffer for udp packets */
 	struct buffer* packet;
 	/* udp waiting list, double linked list */
@@ -57,6 +62,9 @@ struct xfrd_state {
 	size_t udp_use_num;
 	/* activated waiting list, double linked list */
 	struct xfrd_zone *activated_first;
+	/* zones with a disk soa that may not be loaded yet, double linked
+	 * list, so that a reload does not walk all the zones */
+	struct xfrd_zone *updating_first;
 
 	/* current time is cached */
 	uint8_t got_time;
@@ -67,10 +75,11 @@ struct xfrd_state {
 
 	/* the zonestat array size that we last saw and is safe to use */
 	unsigned zonestat_safe;
-	/* size currently of the clear array */
+	/* number of zones in the clear arrays */
 	size_t zonestat_clear_num;
-	/* array of malloced entries with cumulative cleared stat values */
-	struct nsdst** zonestat_clear;
+	/* copy of the two zonestat arrays when the stats were last cleared,
+	 * that is subtracted from them before the next stats printout */
+	struct zonestat* zonestat_clear[2];
 
 	/* timer for NSD reload */
 	struct timeval reload_timeout;
@@ -88,12 +97,28 @@ struct xfrd_state {
 	struct event write_timer;
 	/* set to 1 if zones have received xfrs since the last write_timer */
 	int write_zonefile_needed;
+	/* timing of the last reload, for nsd-control status, or NULL */
+	struct reload_timing* reload_timing;
+	/* progressive-start: 0 done, XFRD_PROGRESSIVE_QUEUED the zone
+	 * files of load-priority progressive_level wait for the reload,
+	 * XFRD_PROGRESSIVE_SENT the reload reads them */
+	uint8_t progressive;
+	uint32_t progressive_level;
+#ifdef USE_DNSTAP
+	/* writes the dnstap rings of the servers to the output, or NULL */
+	struct dt_writer* dnstap;
+#endif
+	/* writes the log messages of the servers, or NULL */
+	struct logring_writer* logring;
 
 	/* communication channel with server_main */
 	struct event ipc_handler;
 	int ipc_handler_flags;
 	struct xfrd_tcp *ipc_conn;
 	struct buffer* ipc_pass;
+	/* the notifies that the servers pass on nsd->notify_fd */
+	struct event notify_handler;
+	struct buffer* notify_pass;
 	/* sending ipc to server_main */
 	uint8_t need_to_send_shutdown;
 	uint8_t need_to_send_reload;
@@ -206,6 +231,10 @@ struct xfrd_zone {
 	uint8_t is_activated;
 	xfrd_zone_t* activated_next;
 	xfrd_zone_t* activated_prev;
+	/* zone is on the updating list, its disk soa may not be loaded */
+	uint8_t is_updating;
+	xfrd_zone_t* updating_next;
+	xfrd_zone_t* updating_prev;
 
 	/* xfr message handling data */
 	/* query id */
@@ -217,6 +246,8 @@ struct xfrd_zone {
 	tsig_record_type tsig; /* tsig state for IXFR/AXFR */
 	uint64_t xfrfilenumber; /* identifier for file to store xfr into,
 				valid if msg_seq_nr nonzero */
+	uint8_t msg_stream; /* a reload applies the xfr file while it is
+				written, xfrd-stream-apply */
 };
 
 enum xfrd_packet_result {
@@ -236,11 +267,14 @@ enum xfrd_packet_result {
    And it should be below FD_SETSIZE, to be able to select() on replies.
    Note that also some sockets are used for writing the ixfr.db, xfrd.state
    files and for the pipes to the main parent process.
+   The number of TCP AXFR/IXFR concurrent connections is the xfrd-tcp-max
+   option, default 32, each preallocates its 64Kb buffers and ID arrays.
+   The number of UDP sockets for IXFR (SOA probe) queries is the
+   xfrd-udp-max option, default XFRD_MAX_UDP.
 */
-#define XFRD_MAX_TCP 32 /* max number of TCP AXFR/IXFR concurrent connections.*/
-			/* Each entry has 64Kb buffer preallocated.*/
-#define XFRD_MAX_UDP 64 /* max number of UDP sockets at a time for IXFR */
-#define XFRD_MAX_UDP_NOTIFY 64 /* max concurrent UDP sockets for NOTIFY */
+#define XFRD_MAX_UDP 64 /* default number of UDP sockets at a time for IXFR */
+#define XFRD_MAX_UDP_NOTIFY 64 /* max zones at a time sending NOTIFY, each
+				  with up to NOTIFY_CONCURRENT_MAX sockets */
 
 extern xfrd_state_t* xfrd;
 
@@ -272,6 +306,9 @@ void xfrd_set_refresh_now(xfrd_zone_t* zone);
 void xfrd_unset_timer(xfrd_zone_t* zone);
 /* remove the 'refresh now', remove it from the activated list */
 void xfrd_deactivate_zone(xfrd_zone_t* z);
+/* put the zone on the updating list, its disk soa has changed or the
+ * nsd soa is gone, the reload checks that the disk soa is loaded */
+void xfrd_set_updating(xfrd_zone_t* z);
 
 /*
  * Make a new request to next master server.
@@ -298,6 +335,12 @@ int xfrd_udp_read_packet(buffer_type* packet, int fd);
  */
 void xfrd_udp_release(xfrd_zone_t* zone);
 
+/*
+ * Start zones waiting for a udp socket, while there are free sockets.
+ * Used after release and when xfrd-udp-max is raised.
+ */
+void xfrd_udp_start_waiting(void);
+
 /*
  * Get a static buffer for temporary use (to build a packet).
  */
@@ -348,6 +391,17 @@ void xfrd_process_task_result(xfrd_state_t* xfrd, struct udb_base* taskudb);
 
 /* set to reload right away (for user controlled reload events) */
 void xfrd_set_reload_now(xfrd_state_t* xfrd);
+/* set to reload after xfrd-reload-timeout, like after a zone transfer */
+void xfrd_set_reload_timeout(void);
+
+#define XFRD_PROGRESSIVE_QUEUED 1
+#define XFRD_PROGRESSIVE_SENT 2
+/* progressive-start: queue the check of the zone files of the next lower
+ * load-priority, the highest if first, and start a reload for them */
+void xfrd_progressive_next(xfrd_state_t* xfrd, int first);
+
+/* the reload is told when the zonestat array of the options has grown */
+void xfrd_zonestat_inc_ifneeded(xfrd_state_t* xfrd);
 
 /* send expiry notifications to nsd */
 void xfrd_send_expire_notification(xfrd_zone_t* zone);
@@ -1137,7 +1137,7 @@ zadd_rdata_wireformat(uint16_t *data)
 	if (parser->current_rr.rdata_count >= MAXRDATALEN) {
 		zc_error_prev_line("too many rdata elements");
 	} else {
-		parser->current_rr.rdatas[parser->current_rr.rdata_count].data
+		parser->temporary_rdatas[parser->current_rr.rdata_count].data
 			= data;
 		++parser->current_rr.rdata_count;
 	}
@@ -1158,7 +1158,7 @@ zadd_rdata_txt_wireformat(uint16_t *data, int first)
 	/* First STR in str_seq, allocate 65K in first unused rdata
 	 * else find last used rdata */
 	if (first) {
-		rd = &parser->current_rr.rdatas[parser->current_rr.rdata_count];
+		rd = &parser->temporary_rdatas[parser->current_rr.rdata_count];
 		if ((rd->data = (uint16_t *) region_alloc(parser->rr_region,
 			sizeof(uint16_t) + 65535 * sizeof(uint8_t))) == NULL) {
 			zc_error_prev_line("Could not allocate memory for TXT RR");
@@ -1168,7 +1168,7 @@ zadd_rdata_txt_wireformat(uint16_t *data, int first)
 		rd->data[0] = 0;
 	}
 	else
-		rd = &parser->current_rr.rdatas[parser->current_rr.rdata_count-1];
+		rd = &parser->temporary_rdatas[parser->current_rr.rdata_count-1];
 	
 	if ((size_t)rd->data[0] + (size_t)data[0] > 65535) {
 		zc_error_prev_line("too large rdata element");
@@ -1179,36 +1179,13 @@ zadd_rdata_txt_wireformat(uint16_t *data, int first)
 	rd->data[0] += data[0];
 }
 
-/**
- * Clean up after last call of zadd_rdata_txt_wireformat
- */
-void
-zadd_rdata_txt_clean_wireformat()
-{
-	uint16_t *tmp_data;
-	rdata_atom_type *rd = &parser->current_rr.rdatas[parser->current_rr.rdata_count-1];
-	if(!rd || !rd->data)
-		return; /* previous syntax failure */
-	if ((tmp_data = (uint16_t *) region_alloc(parser->region, 
-		((size_t)rd->data[0]) + ((size_t)2))) != NULL) {
-		memcpy(tmp_data, rd->data, rd->data[0] + 2);
-		/* rd->data of u16+65535 freed when rr_region is freed */
-		rd->data = tmp_data;
-	}
-	else {
-		/* We could not get memory in non-volatile region */
-		zc_error_prev_line("could not allocate memory for rdata");
-		return;
-	}
-}
-
 void
 zadd_rdata_domain(domain_type *domain)
 {
 	if (parser->current_rr.rdata_count >= MAXRDATALEN) {
 		zc_error_prev_line("too many rdata elements");
 	} else {
-		parser->current_rr.rdatas[parser->current_rr.rdata_count].domain
+		parser->temporary_rdatas[parser->current_rr.rdata_count].domain
 			= domain;
 		domain->usage ++; /* new reference to domain */
 		++parser->current_rr.rdata_count;
@@ -1231,7 +1208,7 @@ parse_unknown_rdata(uint16_t type, uint16_t *wireformat)
 	}
 
 	buffer_create_from(&packet, wireformat + 1, *wireformat);
-	rdata_count = rdata_wireformat_to_rdata_atoms(parser->region,
+	rdata_count = rdata_wireformat_to_rdata_atoms(parser->rr_region,
 						      parser->db->domains,
 						      type,
 						      size,
@@ -1264,48 +1241,17 @@ parse_unknown_rdata(uint16_t type, uint16_t *wireformat)
 static int
 zrdatacmp(uint16_t type, rr_type *a, rr_type *b)
 {
-	int i = 0;
-
 	assert(a);
 	assert(b);
+	assert(a->type == type && b->type == type);
+	(void)type;
 
 	/* One is shorter than another */
 	if (a->rdata_count != b->rdata_count)
 		return 1;
 
 	/* Compare element by element */
-	for (i = 0; i < a->rdata_count; ++i) {
-		if (rdata_atom_is_domain(type, i)) {
-			if (rdata_atom_domain(a->rdatas[i])
-			    != rdata_atom_domain(b->rdatas[i]))
-			{
-				return 1;
-			}
-		} else if(rdata_atom_is_literal_domain(type, i)) {
-			if (rdata_atom_size(a->rdatas[i])
-			    != rdata_atom_size(b->rdatas[i]))
-				return 1;
-			if (!dname_equal_nocase(rdata_atom_data(a->rdatas[i]),
-				   rdata_atom_data(b->rdatas[i]),
-				   rdata_atom_size(a->rdatas[i])))
-				return 1;
-		} else {
-			if (rdata_atom_size(a->rdatas[i])
-			    != rdata_atom_size(b->rdatas[i]))
-			{
-				return 1;
-			}
-			if (memcmp(rdata_atom_data(a->rdatas[i]),
-				   rdata_atom_data(b->rdatas[i]),
-				   rdata_atom_size(a->rdatas[i])) != 0)
-			{
-				return 1;
-			}
-		}
-	}
-
-	/* Otherwise they are equal */
-	return 0;
+	return !rdata_equal(a, b, NULL);
 }
 
 /*
@@ -1362,6 +1308,22 @@ has_soa(domain_type* domain)
 	return 0;
 }
 
+/* print the progress of the parse, every so often */
+static void
+parse_progress(void)
+{
+	if(parser->line % ZONEC_PCT_COUNT == 0 && time(NULL) > startzonec + ZONEC_PCT_TIME) {
+		struct stat buf;
+		startzonec = time(NULL);
+		buf.st_size = 0;
+		fstat(fileno(yyin), &buf);
+		if(buf.st_size == 0) buf.st_size = 1;
+		VERBOSITY(1, (LOG_INFO, "parse %s %d %%",
+			parser->current_zone->opts->name,
+			(int)((uint64_t)parser_file_position()*(uint64_t)100/(uint64_t)buf.st_size)));
+	}
+}
+
 int
 process_rr(void)
 {
@@ -1369,9 +1331,7 @@ process_rr(void)
 	rr_type *rr = &parser->current_rr;
 	rrset_type *rrset;
 	size_t max_rdlength;
-	int i;
-	rrtype_descriptor_type *descriptor
-		= rrtype_descriptor_by_type(rr->type);
+	int i, tag;
 
 	/* We only support IN class */
 	if (rr->klass != CLASS_IN) {
@@ -1383,8 +1343,7 @@ process_rr(void)
 	}
 
 	/* Make sure the maximum RDLENGTH does not exceed 65535 bytes.	*/
-	max_rdlength = rdata_maximum_wireformat_size(
-		descriptor, rr->rdata_count, rr->rdatas);
+	max_rdlength = rr_rdata_wireformat_size(rr);
 
 	if (max_rdlength > MAX_RDLENGTH) {
 		zc_error_prev_line("maximum rdata length exceeds %d octets", MAX_RDLENGTH);
@@ -1417,19 +1376,33 @@ process_rr(void)
 		return 0;
 	}
 
+	/* the streaming check has the RR, it is not stored */
+	if (parser->stream_rr) {
+		parser->stream_rr(rr, parser->stream_arg);
+		parse_progress();
+		++totalrrs;
+		return 1;
+	}
+
 	/* Do we have this type of rrset already? */
 	rrset = domain_find_rrset(rr->owner, zone, rr->type);
 	if (!rrset) {
+		tag = region_set_tag(parser->region, REGION_TAG_RRSETS);
 		rrset = (rrset_type *) region_alloc(parser->region,
 						    sizeof(rrset_type));
 		rrset->zone = zone;
 		rrset->rr_count = 1;
 		rrset->rrs = (rr_type *) region_alloc(parser->region,
 						      sizeof(rr_type));
+		(void)region_set_tag(parser->region, tag);
+		rr_share_rdata(parser->db, parser->region, rr);
 		rrset->rrs[0] = *rr;
+		rrset->type = rr->type;
+		rrset_wire_min_update(rrset);
 
 		/* Add it */
 		domain_add_rrset(rr->owner, rrset);
+		zone_mem_rrset(zone, rr->owner, rrset, 1);
 	} else {
 		rr_type* o;
 		if (rr->type != TYPE_RRSIG && rrset->rrs[0].ttl != rr->ttl) {
@@ -1446,6 +1419,10 @@ process_rr(void)
 
 		/* Discard the duplicates... */
 		if (i < rrset->rr_count) {
+			tag = region_set_tag(parser->region, REGION_TAG_RDATA);
+			region_recycle(parser->region, rr->rdata,
+				rr_rdata_size(rr));
+			(void)region_set_tag(parser->region, tag);
 			return 0;
 		}
 		if(rrset->rr_count == 65535) {
@@ -1454,14 +1431,19 @@ process_rr(void)
 		}
 
 		/* Add it... */
+		rr_share_rdata(parser->db, parser->region, rr);
 		o = rrset->rrs;
+		tag = region_set_tag(parser->region, REGION_TAG_RRSETS);
 		rrset->rrs = (rr_type *) region_alloc_array(parser->region,
 			(rrset->rr_count + 1), sizeof(rr_type));
 		memcpy(rrset->rrs, o, (rrset->rr_count) * sizeof(rr_type));
 		region_recycle(parser->region, o,
 			(rrset->rr_count) * sizeof(rr_type));
+		(void)region_set_tag(parser->region, tag);
 		rrset->rrs[rrset->rr_count] = *rr;
 		++rrset->rr_count;
+		rrset_wire_min_update(rrset);
+		zone_mem_rr(zone, rr, 1);
 	}
 
 	if(rr->type == TYPE_DNAME && rrset->rr_count > 1) {
@@ -1495,20 +1477,51 @@ process_rr(void)
 	if(rr->owner == zone->apex)
 		apex_rrset_checks(parser->db, rrset, rr->owner);
 
-	if(parser->line % ZONEC_PCT_COUNT == 0 && time(NULL) > startzonec + ZONEC_PCT_TIME) {
-		struct stat buf;
-		startzonec = time(NULL);
-		buf.st_size = 0;
-		fstat(fileno(yyin), &buf);
-		if(buf.st_size == 0) buf.st_size = 1;
-		VERBOSITY(1, (LOG_INFO, "parse %s %d %%",
-			parser->current_zone->opts->name,
-			(int)((uint64_t)ftell(yyin)*(uint64_t)100/(uint64_t)buf.st_size)));
-	}
+	parse_progress();
 	++totalrrs;
 	return 1;
 }
 
+/* lower the usage of the domain, and remove it if it is not used */
+static void
+stream_release_domain(domain_type* domain)
+{
+	assert(domain->usage > 0);
+	domain->usage --;
+	if(domain->usage == 0)
+		domain_table_deldomain(parser->db, domain);
+}
+
+void
+zonec_stream_release(void)
+{
+	rr_type* rr = &parser->current_rr;
+	domain_type* hold = parser->prev_dname;
+	size_t i;
+
+	if(hold == error_domain)
+		hold = NULL;
+	/* the origin is kept for the next relative names */
+	if(parser->origin != error_domain)
+		parser->origin->usage ++;
+	/* the owner name is kept, for the next RRs without an owner */
+	if(hold != parser->stream_hold) {
+		if(hold)
+			hold->usage ++;
+		if(parser->stream_hold)
+			stream_release_domain(parser->stream_hold);
+		parser->stream_hold = hold;
+	}
+	for(i = 0; i < rr->rdata_count; i++) {
+		if(rdata_atom_is_domain(rr->type, i))
+			stream_release_domain(parser->temporary_rdatas[i].domain);
+	}
+	if(parser->origin != error_domain)
+		stream_release_domain(parser->origin);
+	if(parser->owner_cursor.last != hold)
+		parser->owner_cursor.last = NULL;
+}
+
 /*
  * Find rrset type for any zone
  */
@@ -1590,9 +1603,11 @@ zonec_read(const char* name, const char* zonefile, zone_type* zone)
 		return 0;
 	}
 	parser->current_zone = zone;
+	parser->region = zone->region;
 
 	/* Parse and process all RRs.  */
 	yyparse();
+	parser->region = parser->db->region;
 
 	/* remove origin if it was unused */
 	if(parser->origin != error_domain)
@@ -1622,6 +1637,56 @@ zonec_read(const char* name, const char* zonefile, zone_type* zone)
 }
 
 
+unsigned int
+zonec_read_stream(const char* name, const char* zonefile, zone_type* zone,
+	void (*func)(rr_type* rr, void* arg), void* arg)
+{
+	const dname_type *dname;
+	region_type* region = parser->region;
+
+	totalrrs = 0;
+	startzonec = time(NULL);
+	parser->errors = 0;
+
+	dname = dname_parse(parser->rr_region, name);
+	if (!dname) {
+		zc_error("incorrect zone name '%s'", name);
+		return 0;
+	}
+#ifndef ROOT_SERVER
+	if (dname->label_count == 1) {
+		zc_error("not configured as a root server");
+		return 0;
+	}
+#endif
+	if (!zone_open(zonefile, 3600, CLASS_IN, dname)) {
+		zc_error("cannot open '%s': %s", zonefile, strerror(errno));
+		return 0;
+	}
+	parser->current_zone = zone;
+	/* the rdata is freed after every RR */
+	parser->region = parser->rr_region;
+	parser->stream_rr = func;
+	parser->stream_arg = arg;
+	parser->stream_hold = NULL;
+
+	yyparse();
+
+	if(parser->stream_hold) {
+		stream_release_domain(parser->stream_hold);
+		parser->stream_hold = NULL;
+	}
+	parser->owner_cursor.last = NULL;
+	parser->stream_rr = NULL;
+	parser->stream_arg = NULL;
+	parser->region = region;
+	if(parser->origin != error_domain)
+		domain_table_deldomain(parser->db, parser->origin);
+	fclose(yyin);
+	parser->filename = NULL;
+	return parser->errors;
+}
+
 /*
  * setup parse
  */
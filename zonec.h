@@ -47,6 +47,8 @@ struct zparser {
 	zone_type *current_zone;
 	domain_type *origin;
 	domain_type *prev_dname;
+	/* the owner names are inserted with it */
+	struct domain_cursor owner_cursor;
 	domain_type *default_apex;
 
 	int error_occurred;
@@ -55,6 +57,13 @@ struct zparser {
 
 	rr_type current_rr;
 	rdata_atom_type *temporary_rdatas;
+
+	/* if set, the RRs are given to it and not stored, see
+	 * zonec_read_stream */
+	void (*stream_rr)(rr_type* rr, void* arg);
+	void* stream_arg;
+	/* the previous owner name, that is kept for the next RR */
+	domain_type* stream_hold;
 };
 
 extern zparser_type *parser;
@@ -82,8 +91,12 @@ void zc_error_prev_line(const char *fmt, ...) ATTR_FORMAT(printf, 1, 2);
 
 void parser_push_stringbuf(char* str);
 void parser_pop_stringbuf(void);
+/* position in the file that is read, for the progress report */
+long parser_file_position(void);
 
 int process_rr(void);
+/* after an RR in the streaming parse, remove the names that it used */
+void zonec_stream_release(void);
 uint16_t *zparser_conv_hex(region_type *region, const char *hex, size_t len);
 uint16_t *zparser_conv_hex_length(region_type *region, const char *hex, size_t len);
 uint16_t *zparser_conv_time(region_type *region, const char *time);
@@ -117,7 +130,6 @@ void parse_unknown_rdata(uint16_t type, uint16_t *wireformat);
 uint32_t zparser_ttl2int(const char *ttlstr, int* error);
 void zadd_rdata_wireformat(uint16_t *data);
 void zadd_rdata_txt_wireformat(uint16_t *data, int first);
-void zadd_rdata_txt_clean_wireformat();
 void zadd_rdata_domain(domain_type *domain);
 
 void set_bitnsec(uint8_t  bits[NSEC_WINDOW_COUNT][NSEC_WINDOW_BITS_SIZE],
@@ -136,6 +148,12 @@ void zonec_desetup_parser(void);
 /* parse a zone into memory. name is origin. zonefile is file to read.
  * returns number of errors; failure may have read a partial zone */
 unsigned int zonec_read(const char *name, const char *zonefile, zone_type* zone);
+/* parse a zone file in one pass, and give every RR to func, the RRs are
+ * not stored in the zone.  The domain names are removed after the RR that
+ * uses them, so the memory does not grow with the zone.  The checks that
+ * need the whole zone are for func to do.  returns number of errors */
+unsigned int zonec_read_stream(const char *name, const char *zonefile,
+	zone_type* zone, void (*func)(rr_type* rr, void* arg), void* arg);
 /* parse a string into the region. and with given domaintable. global parser
  * is restored afterwards. zone needs apex set. returns last domain name
  * parsed and the number rrs parse. return number of errors, 0 is success.
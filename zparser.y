@@ -17,6 +17,7 @@
 #include "dname.h"
 #include "namedb.h"
 #include "zonec.h"
+#include "rdata.h"
 
 /* these need to be global, otherwise they cannot be used inside yacc */
 zparser_type *parser;
@@ -80,7 +81,7 @@ nsec3_add_params(const char* hash_algo_str, const char* flag_str,
 %token <type>  T_UTYPE
 
 %type <type>	type_and_rdata
-%type <domain>	owner dname abs_dname
+%type <domain>	owner owner_dname abs_owner_dname dname abs_dname
 %type <dname>	rel_dname label
 %type <data>	wire_dname wire_abs_dname wire_rel_dname wire_label
 %type <data>	concatenated_str_seq str_sp_seq str_dot_seq dotted_str
@@ -100,7 +101,6 @@ line:	NL
 	    region_free_all(parser->rr_region);
 	    parser->current_rr.type = 0;
 	    parser->current_rr.rdata_count = 0;
-	    parser->current_rr.rdatas = parser->temporary_rdatas;
 	    parser->error_occurred = 0;
     }
     |	origin_directive
@@ -108,27 +108,27 @@ line:	NL
 	    region_free_all(parser->rr_region);
 	    parser->current_rr.type = 0;
 	    parser->current_rr.rdata_count = 0;
-	    parser->current_rr.rdatas = parser->temporary_rdatas;
 	    parser->error_occurred = 0;
     }
     |	rr
     {	/* rr should be fully parsed */
 	    if (!parser->error_occurred) {
-			    parser->current_rr.rdatas
-				    =(rdata_atom_type *)region_alloc_array_init(
-					    parser->region,
-					    parser->current_rr.rdatas,
-					    parser->current_rr.rdata_count,
-					    sizeof(rdata_atom_type));
-
-			    process_rr();
+			    if(!rdata_atoms_to_rdata(parser->region,
+				    &parser->current_rr,
+				    parser->current_rr.rdata_count,
+				    parser->temporary_rdatas))
+				    zc_error_prev_line("maximum rdata length "
+					    "exceeds %d octets", MAX_RDLENGTH);
+			    else
+				    process_rr();
 	    }
+	    if (parser->stream_rr)
+		    zonec_stream_release();
 
 	    region_free_all(parser->rr_region);
 
 	    parser->current_rr.type = 0;
 	    parser->current_rr.rdata_count = 0;
-	    parser->current_rr.rdatas = parser->temporary_rdatas;
 	    parser->error_occurred = 0;
     }
     |	error NL
@@ -161,6 +161,8 @@ origin_directive:	DOLLAR_ORIGIN sp abs_dname trail
 		$3->usage ++;
 	    	domain_table_deldomain(parser->db, parser->origin);
 		$3->usage --;
+		/* the last owner can be deleted with it */
+		parser->owner_cursor.last = NULL;
 	    }
 	    parser->origin = $3;
     }
@@ -177,7 +179,7 @@ rr:	owner classttl type_and_rdata
     }
     ;
 
-owner:	dname sp
+owner:	owner_dname sp
     {
 	    parser->prev_dname = $1;
 	    $$ = $1;
@@ -215,6 +217,50 @@ classttl:	/* empty - fill in the default, def. ttl and IN class */
     }
     ;
 
+/* the owner names are inserted with the cursor, they come mostly in
+ * canonical order */
+owner_dname:	abs_owner_dname
+    |	rel_dname
+    {
+	    if ($1 == error_dname) {
+		    $$ = error_domain;
+	    } else if(parser->origin == error_domain) {
+		    zc_error("cannot concatenate origin to domain name, because origin failed to parse");
+		    $$ = error_domain;
+	    } else if ($1->name_size + domain_dname(parser->origin)->name_size - 1 > MAXDOMAINLEN) {
+		    zc_error("domain name exceeds %d character limit", MAXDOMAINLEN);
+		    $$ = error_domain;
+	    } else {
+		    $$ = domain_table_insert_cursor(
+			    parser->db->domains,
+			    &parser->owner_cursor,
+			    dname_concatenate(
+				    parser->rr_region,
+				    $1,
+				    domain_dname(parser->origin)));
+	    }
+    }
+    ;
+
+abs_owner_dname:	'.'
+    {
+	    $$ = parser->db->domains->root;
+    }
+    |	'@'
+    {
+	    $$ = parser->origin;
+    }
+    |	rel_dname '.'
+    {
+	    if ($1 != error_dname) {
+		    $$ = domain_table_insert_cursor(parser->db->domains,
+			    &parser->owner_cursor, $1);
+	    } else {
+		    $$ = error_domain;
+	    }
+    }
+    ;
+
 dname:	abs_dname
     |	rel_dname
     {
@@ -647,7 +693,7 @@ type_and_rdata:
 
 rdata_a:	dotted_str trail
     {
-	    zadd_rdata_wireformat(zparser_conv_a(parser->region, $1.str));
+	    zadd_rdata_wireformat(zparser_conv_a(parser->rr_region, $1.str));
     }
     ;
 
@@ -663,25 +709,25 @@ rdata_soa:	dname sp dname sp STR sp STR sp STR sp STR sp STR trail
 	    /* convert the soa data */
 	    zadd_rdata_domain($1);	/* prim. ns */
 	    zadd_rdata_domain($3);	/* email */
-	    zadd_rdata_wireformat(zparser_conv_serial(parser->region, $5.str)); /* serial */
-	    zadd_rdata_wireformat(zparser_conv_period(parser->region, $7.str)); /* refresh */
-	    zadd_rdata_wireformat(zparser_conv_period(parser->region, $9.str)); /* retry */
-	    zadd_rdata_wireformat(zparser_conv_period(parser->region, $11.str)); /* expire */
-	    zadd_rdata_wireformat(zparser_conv_period(parser->region, $13.str)); /* minimum */
+	    zadd_rdata_wireformat(zparser_conv_serial(parser->rr_region, $5.str)); /* serial */
+	    zadd_rdata_wireformat(zparser_conv_period(parser->rr_region, $7.str)); /* refresh */
+	    zadd_rdata_wireformat(zparser_conv_period(parser->rr_region, $9.str)); /* retry */
+	    zadd_rdata_wireformat(zparser_conv_period(parser->rr_region, $11.str)); /* expire */
+	    zadd_rdata_wireformat(zparser_conv_period(parser->rr_region, $13.str)); /* minimum */
     }
     ;
 
 rdata_wks:	dotted_str sp STR sp concatenated_str_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_a(parser->region, $1.str)); /* address */
-	    zadd_rdata_wireformat(zparser_conv_services(parser->region, $3.str, $5.str)); /* protocol and services */
+	    zadd_rdata_wireformat(zparser_conv_a(parser->rr_region, $1.str)); /* address */
+	    zadd_rdata_wireformat(zparser_conv_services(parser->rr_region, $3.str, $5.str)); /* protocol and services */
     }
     ;
 
 rdata_hinfo:	STR sp STR trail
     {
-	    zadd_rdata_wireformat(zparser_conv_text(parser->region, $1.str, $1.len)); /* CPU */
-	    zadd_rdata_wireformat(zparser_conv_text(parser->region, $3.str, $3.len)); /* OS*/
+	    zadd_rdata_wireformat(zparser_conv_text(parser->rr_region, $1.str, $1.len)); /* CPU */
+	    zadd_rdata_wireformat(zparser_conv_text(parser->rr_region, $3.str, $3.len)); /* OS*/
     }
     ;
 
@@ -695,14 +741,13 @@ rdata_minfo:	dname sp dname trail
 
 rdata_mx:	STR sp dname trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str));  /* priority */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str));  /* priority */
 	    zadd_rdata_domain($3);	/* MX host */
     }
     ;
 
 rdata_txt:	str_seq trail
     {
-	zadd_rdata_txt_clean_wireformat();
     }
     ;
 
@@ -717,7 +762,7 @@ rdata_rp:	dname sp dname trail
 /* RFC 1183 */
 rdata_afsdb:	STR sp dname trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str)); /* subtype */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str)); /* subtype */
 	    zadd_rdata_domain($3); /* domain name */
     }
     ;
@@ -725,26 +770,26 @@ rdata_afsdb:	STR sp dname trail
 /* RFC 1183 */
 rdata_x25:	STR trail
     {
-	    zadd_rdata_wireformat(zparser_conv_text(parser->region, $1.str, $1.len)); /* X.25 address. */
+	    zadd_rdata_wireformat(zparser_conv_text(parser->rr_region, $1.str, $1.len)); /* X.25 address. */
     }
     ;
 
 /* RFC 1183 */
 rdata_isdn:	STR trail
     {
-	    zadd_rdata_wireformat(zparser_conv_text(parser->region, $1.str, $1.len)); /* address */
+	    zadd_rdata_wireformat(zparser_conv_text(parser->rr_region, $1.str, $1.len)); /* address */
     }
     |	STR sp STR trail
     {
-	    zadd_rdata_wireformat(zparser_conv_text(parser->region, $1.str, $1.len)); /* address */
-	    zadd_rdata_wireformat(zparser_conv_text(parser->region, $3.str, $3.len)); /* sub-address */
+	    zadd_rdata_wireformat(zparser_conv_text(parser->rr_region, $1.str, $1.len)); /* address */
+	    zadd_rdata_wireformat(zparser_conv_text(parser->rr_region, $3.str, $3.len)); /* sub-address */
     }
     ;
 
 /* RFC 1183 */
 rdata_rt:	STR sp dname trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str)); /* preference */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str)); /* preference */
 	    zadd_rdata_domain($3); /* intermediate host */
     }
     ;
@@ -756,7 +801,7 @@ rdata_nsap:	str_dot_seq trail
 	    if (strncasecmp($1.str, "0x", 2) != 0) {
 		    zc_error_prev_line("NSAP rdata must start with '0x'");
 	    } else {
-		    zadd_rdata_wireformat(zparser_conv_hex(parser->region, $1.str + 2, $1.len - 2)); /* NSAP */
+		    zadd_rdata_wireformat(zparser_conv_hex(parser->rr_region, $1.str + 2, $1.len - 2)); /* NSAP */
 	    }
     }
     ;
@@ -764,7 +809,7 @@ rdata_nsap:	str_dot_seq trail
 /* RFC 2163 */
 rdata_px:	STR sp dname sp dname trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str)); /* preference */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str)); /* preference */
 	    zadd_rdata_domain($3); /* MAP822 */
 	    zadd_rdata_domain($5); /* MAPX400 */
     }
@@ -772,29 +817,29 @@ rdata_px:	STR sp dname sp dname trail
 
 rdata_aaaa:	dotted_str trail
     {
-	    zadd_rdata_wireformat(zparser_conv_aaaa(parser->region, $1.str));  /* IPv6 address */
+	    zadd_rdata_wireformat(zparser_conv_aaaa(parser->rr_region, $1.str));  /* IPv6 address */
     }
     ;
 
 rdata_loc:	concatenated_str_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_loc(parser->region, $1.str)); /* Location */
+	    zadd_rdata_wireformat(zparser_conv_loc(parser->rr_region, $1.str)); /* Location */
     }
     ;
 
 rdata_nxt:	dname sp nxt_seq trail
     {
 	    zadd_rdata_domain($1); /* nxt name */
-	    zadd_rdata_wireformat(zparser_conv_nxt(parser->region, nxtbits)); /* nxt bitlist */
+	    zadd_rdata_wireformat(zparser_conv_nxt(parser->rr_region, nxtbits)); /* nxt bitlist */
 	    memset(nxtbits, 0, sizeof(nxtbits));
     }
     ;
 
 rdata_srv:	STR sp STR sp STR sp dname trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str)); /* prio */
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $3.str)); /* weight */
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $5.str)); /* port */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str)); /* prio */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $3.str)); /* weight */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $5.str)); /* port */
 	    zadd_rdata_domain($7); /* target name */
     }
     ;
@@ -802,11 +847,11 @@ rdata_srv:	STR sp STR sp STR sp dname trail
 /* RFC 2915 */
 rdata_naptr:	STR sp STR sp STR sp STR sp STR sp dname trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str)); /* order */
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $3.str)); /* preference */
-	    zadd_rdata_wireformat(zparser_conv_text(parser->region, $5.str, $5.len)); /* flags */
-	    zadd_rdata_wireformat(zparser_conv_text(parser->region, $7.str, $7.len)); /* service */
-	    zadd_rdata_wireformat(zparser_conv_text(parser->region, $9.str, $9.len)); /* regexp */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str)); /* order */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $3.str)); /* preference */
+	    zadd_rdata_wireformat(zparser_conv_text(parser->rr_region, $5.str, $5.len)); /* flags */
+	    zadd_rdata_wireformat(zparser_conv_text(parser->rr_region, $7.str, $7.len)); /* service */
+	    zadd_rdata_wireformat(zparser_conv_text(parser->rr_region, $9.str, $9.len)); /* regexp */
 	    zadd_rdata_domain($11); /* target name */
     }
     ;
@@ -814,7 +859,7 @@ rdata_naptr:	STR sp STR sp STR sp STR sp STR sp dname trail
 /* RFC 2230 */
 rdata_kx:	STR sp dname trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str)); /* preference */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str)); /* preference */
 	    zadd_rdata_domain($3); /* exchanger */
     }
     ;
@@ -822,10 +867,10 @@ rdata_kx:	STR sp dname trail
 /* RFC 2538 */
 rdata_cert:	STR sp STR sp STR sp str_sp_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_certificate_type(parser->region, $1.str)); /* type */
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $3.str)); /* key tag */
-	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->region, $5.str)); /* algorithm */
-	    zadd_rdata_wireformat(zparser_conv_b64(parser->region, $7.str)); /* certificate or CRL */
+	    zadd_rdata_wireformat(zparser_conv_certificate_type(parser->rr_region, $1.str)); /* type */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $3.str)); /* key tag */
+	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->rr_region, $5.str)); /* algorithm */
+	    zadd_rdata_wireformat(zparser_conv_b64(parser->rr_region, $7.str)); /* certificate or CRL */
     }
     ;
 
@@ -835,66 +880,66 @@ rdata_apl:	rdata_apl_seq trail
 
 rdata_apl_seq:	dotted_str
     {
-	    zadd_rdata_wireformat(zparser_conv_apl_rdata(parser->region, $1.str));
+	    zadd_rdata_wireformat(zparser_conv_apl_rdata(parser->rr_region, $1.str));
     }
     |	rdata_apl_seq sp dotted_str
     {
-	    zadd_rdata_wireformat(zparser_conv_apl_rdata(parser->region, $3.str));
+	    zadd_rdata_wireformat(zparser_conv_apl_rdata(parser->rr_region, $3.str));
     }
     ;
 
 rdata_ds:	STR sp STR sp STR sp str_sp_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str)); /* keytag */
-	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->region, $3.str)); /* alg */
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $5.str)); /* type */
-	    zadd_rdata_wireformat(zparser_conv_hex(parser->region, $7.str, $7.len)); /* hash */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str)); /* keytag */
+	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->rr_region, $3.str)); /* alg */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $5.str)); /* type */
+	    zadd_rdata_wireformat(zparser_conv_hex(parser->rr_region, $7.str, $7.len)); /* hash */
     }
     ;
 
 rdata_dlv:	STR sp STR sp STR sp str_sp_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str)); /* keytag */
-	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->region, $3.str)); /* alg */
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $5.str)); /* type */
-	    zadd_rdata_wireformat(zparser_conv_hex(parser->region, $7.str, $7.len)); /* hash */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str)); /* keytag */
+	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->rr_region, $3.str)); /* alg */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $5.str)); /* type */
+	    zadd_rdata_wireformat(zparser_conv_hex(parser->rr_region, $7.str, $7.len)); /* hash */
     }
     ;
 
 rdata_sshfp:	STR sp STR sp str_sp_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $1.str)); /* alg */
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $3.str)); /* fp type */
-	    zadd_rdata_wireformat(zparser_conv_hex(parser->region, $5.str, $5.len)); /* hash */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $1.str)); /* alg */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $3.str)); /* fp type */
+	    zadd_rdata_wireformat(zparser_conv_hex(parser->rr_region, $5.str, $5.len)); /* hash */
     }
     ;
 
 rdata_dhcid:	str_sp_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_b64(parser->region, $1.str)); /* data blob */
+	    zadd_rdata_wireformat(zparser_conv_b64(parser->rr_region, $1.str)); /* data blob */
     }
     ;
 
 rdata_rrsig:	STR sp STR sp STR sp STR sp STR sp STR sp STR sp wire_dname sp str_sp_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_rrtype(parser->region, $1.str)); /* rr covered */
-	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->region, $3.str)); /* alg */
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $5.str)); /* # labels */
-	    zadd_rdata_wireformat(zparser_conv_period(parser->region, $7.str)); /* # orig TTL */
-	    zadd_rdata_wireformat(zparser_conv_time(parser->region, $9.str)); /* sig exp */
-	    zadd_rdata_wireformat(zparser_conv_time(parser->region, $11.str)); /* sig inc */
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $13.str)); /* key id */
-	    zadd_rdata_wireformat(zparser_conv_dns_name(parser->region, 
+	    zadd_rdata_wireformat(zparser_conv_rrtype(parser->rr_region, $1.str)); /* rr covered */
+	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->rr_region, $3.str)); /* alg */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $5.str)); /* # labels */
+	    zadd_rdata_wireformat(zparser_conv_period(parser->rr_region, $7.str)); /* # orig TTL */
+	    zadd_rdata_wireformat(zparser_conv_time(parser->rr_region, $9.str)); /* sig exp */
+	    zadd_rdata_wireformat(zparser_conv_time(parser->rr_region, $11.str)); /* sig inc */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $13.str)); /* key id */
+	    zadd_rdata_wireformat(zparser_conv_dns_name(parser->rr_region, 
 				(const uint8_t*) $15.str,$15.len)); /* sig name */
-	    zadd_rdata_wireformat(zparser_conv_b64(parser->region, $17.str)); /* sig data */
+	    zadd_rdata_wireformat(zparser_conv_b64(parser->rr_region, $17.str)); /* sig data */
     }
     ;
 
 rdata_nsec:	wire_dname nsec_seq
     {
-	    zadd_rdata_wireformat(zparser_conv_dns_name(parser->region, 
+	    zadd_rdata_wireformat(zparser_conv_dns_name(parser->rr_region, 
 				(const uint8_t*) $1.str, $1.len)); /* nsec name */
-	    zadd_rdata_wireformat(zparser_conv_nsec(parser->region, nsecbits)); /* nsec bitlist */
+	    zadd_rdata_wireformat(zparser_conv_nsec(parser->rr_region, nsecbits)); /* nsec bitlist */
 	    memset(nsecbits, 0, sizeof(nsecbits));
             nsec_highest_rcode = 0;
     }
@@ -905,8 +950,8 @@ rdata_nsec3:   STR sp STR sp STR sp STR sp STR nsec_seq
 #ifdef NSEC3
 	    nsec3_add_params($1.str, $3.str, $5.str, $7.str, $7.len);
 
-	    zadd_rdata_wireformat(zparser_conv_b32(parser->region, $9.str)); /* next hashed name */
-	    zadd_rdata_wireformat(zparser_conv_nsec(parser->region, nsecbits)); /* nsec bitlist */
+	    zadd_rdata_wireformat(zparser_conv_b32(parser->rr_region, $9.str)); /* next hashed name */
+	    zadd_rdata_wireformat(zparser_conv_nsec(parser->rr_region, nsecbits)); /* nsec bitlist */
 	    memset(nsecbits, 0, sizeof(nsecbits));
 	    nsec_highest_rcode = 0;
 #else
@@ -927,43 +972,43 @@ rdata_nsec3_param:   STR sp STR sp STR sp STR trail
 
 rdata_tlsa:	STR sp STR sp STR sp str_sp_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $1.str)); /* usage */
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $3.str)); /* selector */
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $5.str)); /* matching type */
-	    zadd_rdata_wireformat(zparser_conv_hex(parser->region, $7.str, $7.len)); /* ca data */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $1.str)); /* usage */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $3.str)); /* selector */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $5.str)); /* matching type */
+	    zadd_rdata_wireformat(zparser_conv_hex(parser->rr_region, $7.str, $7.len)); /* ca data */
     }
     ;
 
 rdata_dnskey:	STR sp STR sp STR sp str_sp_seq trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str)); /* flags */
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $3.str)); /* proto */
-	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->region, $5.str)); /* alg */
-	    zadd_rdata_wireformat(zparser_conv_b64(parser->region, $7.str)); /* hash */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str)); /* flags */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $3.str)); /* proto */
+	    zadd_rdata_wireformat(zparser_conv_algorithm(parser->rr_region, $5.str)); /* alg */
+	    zadd_rdata_wireformat(zparser_conv_b64(parser->rr_region, $7.str)); /* hash */
     }
     ;
 
 rdata_ipsec_base: STR sp STR sp STR sp dotted_str
     {
 	    const dname_type* name = 0;
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $1.str)); /* precedence */
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $3.str)); /* gateway type */
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $5.str)); /* algorithm */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $1.str)); /* precedence */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $3.str)); /* gateway type */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $5.str)); /* algorithm */
 	    switch(atoi($3.str)) {
 		case IPSECKEY_NOGATEWAY: 
-			zadd_rdata_wireformat(alloc_rdata_init(parser->region, "", 0));
+			zadd_rdata_wireformat(alloc_rdata_init(parser->rr_region, "", 0));
 			break;
 		case IPSECKEY_IP4:
-			zadd_rdata_wireformat(zparser_conv_a(parser->region, $7.str));
+			zadd_rdata_wireformat(zparser_conv_a(parser->rr_region, $7.str));
 			break;
 		case IPSECKEY_IP6:
-			zadd_rdata_wireformat(zparser_conv_aaaa(parser->region, $7.str));
+			zadd_rdata_wireformat(zparser_conv_aaaa(parser->rr_region, $7.str));
 			break;
 		case IPSECKEY_DNAME:
 			/* convert and insert the dname */
 			if(strlen($7.str) == 0)
 				zc_error_prev_line("IPSECKEY must specify gateway name");
-			if(!(name = dname_parse(parser->region, $7.str)))
+			if(!(name = dname_parse(parser->rr_region, $7.str)))
 				zc_error_prev_line("IPSECKEY bad gateway dname %s", $7.str);
 			if($7.str[strlen($7.str)-1] != '.') {
 				if(parser->origin == error_domain) {
@@ -973,7 +1018,7 @@ rdata_ipsec_base: STR sp STR sp STR sp dotted_str
 				name = dname_concatenate(parser->rr_region, name, 
 					domain_dname(parser->origin));
 			}
-			zadd_rdata_wireformat(alloc_rdata_init(parser->region,
+			zadd_rdata_wireformat(alloc_rdata_init(parser->rr_region,
 				dname_name(name), name->name_size));
 			break;
 		default:
@@ -984,7 +1029,7 @@ rdata_ipsec_base: STR sp STR sp STR sp dotted_str
 
 rdata_ipseckey:	rdata_ipsec_base sp str_sp_seq trail
     {
-	   zadd_rdata_wireformat(zparser_conv_b64(parser->region, $3.str)); /* public key */
+	   zadd_rdata_wireformat(zparser_conv_b64(parser->rr_region, $3.str)); /* public key */
     }
     | rdata_ipsec_base trail
     ;
@@ -992,66 +1037,66 @@ rdata_ipseckey:	rdata_ipsec_base sp str_sp_seq trail
 /* RFC 6742 */ 
 rdata_nid:	STR sp dotted_str trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str));  /* preference */
-	    zadd_rdata_wireformat(zparser_conv_ilnp64(parser->region, $3.str));  /* NodeID */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str));  /* preference */
+	    zadd_rdata_wireformat(zparser_conv_ilnp64(parser->rr_region, $3.str));  /* NodeID */
     }
     ;
 
 rdata_l32:	STR sp dotted_str trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str));  /* preference */
-	    zadd_rdata_wireformat(zparser_conv_a(parser->region, $3.str));  /* Locator32 */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str));  /* preference */
+	    zadd_rdata_wireformat(zparser_conv_a(parser->rr_region, $3.str));  /* Locator32 */
     }
     ;
 
 rdata_l64:	STR sp dotted_str trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str));  /* preference */
-	    zadd_rdata_wireformat(zparser_conv_ilnp64(parser->region, $3.str));  /* Locator64 */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str));  /* preference */
+	    zadd_rdata_wireformat(zparser_conv_ilnp64(parser->rr_region, $3.str));  /* Locator64 */
     }
     ;
 
 rdata_lp:	STR sp dname trail
     {
-	    zadd_rdata_wireformat(zparser_conv_short(parser->region, $1.str));  /* preference */
+	    zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, $1.str));  /* preference */
 	    zadd_rdata_domain($3);  /* FQDN */
     }
     ;
 
 rdata_eui48:	STR trail
     {
-	    zadd_rdata_wireformat(zparser_conv_eui(parser->region, $1.str, 48));
+	    zadd_rdata_wireformat(zparser_conv_eui(parser->rr_region, $1.str, 48));
     }
     ;
 
 rdata_eui64:	STR trail
     {
-	    zadd_rdata_wireformat(zparser_conv_eui(parser->region, $1.str, 64));
+	    zadd_rdata_wireformat(zparser_conv_eui(parser->rr_region, $1.str, 64));
     }
     ;
 
 /* RFC 6844 */
 rdata_caa:	STR sp STR sp STR trail
     {
-	    zadd_rdata_wireformat(zparser_conv_byte(parser->region, $1.str)); /* Flags */
-	    zadd_rdata_wireformat(zparser_conv_tag(parser->region, $3.str, $3.len)); /* Tag */
-	    zadd_rdata_wireformat(zparser_conv_long_text(parser->region, $5.str, $5.len)); /* Value */
+	    zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, $1.str)); /* Flags */
+	    zadd_rdata_wireformat(zparser_conv_tag(parser->rr_region, $3.str, $3.len)); /* Tag */
+	    zadd_rdata_wireformat(zparser_conv_long_text(parser->rr_region, $5.str, $5.len)); /* Value */
     }
     ;
 
 rdata_unknown:	URR sp STR sp str_sp_seq trail
     {
 	    /* $2 is the number of octects, currently ignored */
-	    $$ = zparser_conv_hex(parser->region, $5.str, $5.len);
+	    $$ = zparser_conv_hex(parser->rr_region, $5.str, $5.len);
 
     }
     |	URR sp STR trail
     {
-	    $$ = zparser_conv_hex(parser->region, "", 0);
+	    $$ = zparser_conv_hex(parser->rr_region, "", 0);
     }
     |	URR error NL
     {
-	    $$ = zparser_conv_hex(parser->region, "", 0);
+	    $$ = zparser_conv_hex(parser->rr_region, "", 0);
     }
     ;
 %%
@@ -1080,6 +1125,10 @@ zparser_create(region_type *region, region_type *rr_region, namedb_type *db)
 	result->origin = NULL;
 	result->prev_dname = NULL;
 	result->default_apex = NULL;
+	result->owner_cursor.last = NULL;
+	result->stream_rr = NULL;
+	result->stream_arg = NULL;
+	result->stream_hold = NULL;
 
 	result->temporary_rdatas = (rdata_atom_type *) region_alloc_array(
 		result->region, MAXRDATALEN, sizeof(rdata_atom_type));
@@ -1104,12 +1153,12 @@ zparser_init(const char *filename, uint32_t ttl, uint16_t klass,
 	parser->origin = domain_table_insert(parser->db->domains, origin);
 	parser->prev_dname = parser->origin;
 	parser->default_apex = parser->origin;
+	parser->owner_cursor.last = NULL;
 	parser->error_occurred = 0;
 	parser->errors = 0;
 	parser->line = 1;
 	parser->filename = filename;
 	parser->current_rr.rdata_count = 0;
-	parser->current_rr.rdatas = parser->temporary_rdatas;
 }
 
 void
@@ -1188,15 +1237,15 @@ static void
 nsec3_add_params(const char* hashalgo_str, const char* flag_str,
 	const char* iter_str, const char* salt_str, int salt_len)
 {
-	zadd_rdata_wireformat(zparser_conv_byte(parser->region, hashalgo_str));
-	zadd_rdata_wireformat(zparser_conv_byte(parser->region, flag_str));
-	zadd_rdata_wireformat(zparser_conv_short(parser->region, iter_str));
+	zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, hashalgo_str));
+	zadd_rdata_wireformat(zparser_conv_byte(parser->rr_region, flag_str));
+	zadd_rdata_wireformat(zparser_conv_short(parser->rr_region, iter_str));
 
 	/* salt */
 	if(strcmp(salt_str, "-") != 0) 
-		zadd_rdata_wireformat(zparser_conv_hex_length(parser->region, 
+		zadd_rdata_wireformat(zparser_conv_hex_length(parser->rr_region, 
 			salt_str, salt_len)); 
 	else 
-		zadd_rdata_wireformat(alloc_rdata_init(parser->region, "", 1));
+		zadd_rdata_wireformat(alloc_rdata_init(parser->rr_region, "", 1));
 }
 #endif /* NSEC3 */
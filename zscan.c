@@ -0,0 +1,736 @@
+/*
+ * zscan.c - hand-written lexical analyzer for (DNS) zone files.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * It returns the same tokens as zlexer.lex, but it works on the
+ * complete input in memory (mmapped), and the strings that it returns
+ * point into that memory, they are terminated in place.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define ZSCAN_SSE2 1
+#endif
+
+#include "zonec.h"
+#include "dname.h"
+#include "zparser.h"
+
+enum lexer_state {
+	EXPECT_OWNER,
+	PARSING_OWNER,
+	PARSING_TTL_CLASS_TYPE,
+	PARSING_RDATA
+};
+
+/** an input buffer, a file or a string */
+struct zscan_buf {
+	/* the input, writable, the tokens are terminated in it */
+	char* data;
+	size_t len;
+	/* position of the next character to scan */
+	size_t pos;
+	/* the data is mmapped, otherwise it is allocated */
+	int mapped;
+	/* the file, or NULL for a string buffer */
+	FILE* file;
+	/* the next character is at the beginning of a line */
+	int bol;
+	/* the character at pos, if it has been overwritten with the zero
+	 * that terminates the previous token, or -1 */
+	int delim;
+	/* the input ended, or scanning stopped with an error */
+	int eof;
+	/* the file specific parser state of the includer */
+	const char* filename;
+	unsigned int line;
+	domain_type* origin;
+	/* the includer, or the buffer in use before a string buffer */
+	struct zscan_buf* prev;
+};
+
+FILE* yyin = NULL;
+/* the buffer that is scanned */
+static struct zscan_buf* zscan_cur = NULL;
+/* include files that have ended, their data is in use by the tokens of
+ * the parse, and it is freed when the next file is opened */
+static struct zscan_buf* zscan_done = NULL;
+static int include_depth = 0;
+static int paren_open = 0;
+static enum lexer_state lexer_state = EXPECT_OWNER;
+
+/* character classes */
+#define ZC_DELIM 0x01 /* ends a word: space, tab, newline, ();. */
+#define ZC_QUOTE 0x02 /* special in a quoted string: " \\ and newline */
+static uint8_t zscan_class[256];
+static int zscan_class_init = 0;
+
+static void
+zscan_init_classes(void)
+{
+	const char* d = " \t\n\r();.";
+	const char* q = "\"\\\n";
+	for(; *d; d++)
+		zscan_class[(uint8_t)*d] |= ZC_DELIM;
+	for(; *q; q++)
+		zscan_class[(uint8_t)*q] |= ZC_QUOTE;
+	zscan_class_init = 1;
+}
+
+/** free the buffer, and its data */
+static void
+zscan_buf_free(struct zscan_buf* b)
+{
+#ifdef HAVE_MMAP
+	if(b->mapped)
+		munmap(b->data, b->len);
+	else
+#endif
+		free(b->data);
+	free(b);
+}
+
+/** free the include files that have ended */
+static void
+zscan_free_done(void)
+{
+	while(zscan_done) {
+		struct zscan_buf* prev = zscan_done->prev;
+		zscan_buf_free(zscan_done);
+		zscan_done = prev;
+	}
+}
+
+/** free the current buffer and its includers, the innermost file has
+ * been closed by the caller, like flex, the include files are closed */
+static void
+zscan_reset(void)
+{
+	struct zscan_buf* b = zscan_cur;
+	while(b && b->file) {
+		struct zscan_buf* prev = b->prev;
+		if(b != zscan_cur)
+			fclose(b->file);
+		zscan_buf_free(b);
+		b = prev;
+	}
+	zscan_cur = b;
+	include_depth = 0;
+	paren_open = 0;
+	lexer_state = EXPECT_OWNER;
+	zscan_free_done();
+}
+
+/** open the file for scanning, mmap it or read it into memory */
+static struct zscan_buf*
+zscan_open(FILE* file)
+{
+	struct zscan_buf* b = (struct zscan_buf*)xalloc_zero(sizeof(*b));
+	size_t cap = 0;
+#ifdef HAVE_MMAP
+	struct stat st;
+#endif
+	b->file = file;
+	b->bol = 1;
+	b->delim = -1;
+#ifdef HAVE_MMAP
+	/* a private mapping, so the tokens can be terminated in it */
+	if(fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) &&
+		st.st_size > 0) {
+		void* m = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE, fileno(file), 0);
+		if(m != MAP_FAILED) {
+			b->data = (char*)m;
+			b->len = (size_t)st.st_size;
+			b->mapped = 1;
+#ifdef MADV_SEQUENTIAL
+			madvise(m, b->len, MADV_SEQUENTIAL);
+#endif
+			return b;
+		}
+	}
+#endif /* HAVE_MMAP */
+	/* no mmap, or not a regular file, read it */
+	while(!feof(file)) {
+		size_t r;
+		if(b->len == cap) {
+			cap = (cap?cap*2:65536);
+			b->data = (char*)xrealloc(b->data, cap);
+		}
+		r = fread(b->data + b->len, 1, cap - b->len, file);
+		if(r == 0 && ferror(file)) {
+			zc_error("cannot read zone file: %s", strerror(errno));
+			break;
+		}
+		b->len += r;
+	}
+	return b;
+}
+
+/* Start string scan */
+void
+parser_push_stringbuf(char* str)
+{
+	struct zscan_buf* b = (struct zscan_buf*)xalloc_zero(sizeof(*b));
+	b->len = strlen(str);
+	b->data = (char*)xalloc(b->len+1);
+	memmove(b->data, str, b->len+1);
+	b->bol = 1;
+	b->delim = -1;
+	b->prev = zscan_cur;
+	zscan_cur = b;
+}
+
+void
+parser_pop_stringbuf(void)
+{
+	struct zscan_buf* b = zscan_cur;
+	if(!b || b->file)
+		return;
+	zscan_cur = b->prev;
+	zscan_buf_free(b);
+}
+
+void
+yyrestart(FILE* file)
+{
+	zscan_reset();
+	yyin = file;
+}
+
+int
+yylex_destroy(void)
+{
+	zscan_reset();
+	while(zscan_cur) {
+		/* string buffers */
+		struct zscan_buf* prev = zscan_cur->prev;
+		zscan_buf_free(zscan_cur);
+		zscan_cur = prev;
+	}
+	return 0;
+}
+
+/* position in the current file, for the progress report */
+long
+parser_file_position(void)
+{
+	return zscan_cur?(long)zscan_cur->pos:0;
+}
+
+/*
+ * Analyze "word" to see if it matches an RR type, possibly by using
+ * the "TYPExxx" notation.  If it matches, the corresponding token is
+ * returned and the TYPE parameter is set to the RR type value.
+ */
+static int
+rrtype_to_token(const char *word, uint16_t *type)
+{
+	uint16_t t = rrtype_from_string(word);
+	if (t != 0) {
+		rrtype_descriptor_type *entry = rrtype_descriptor_by_type(t);
+		*type = t;
+		return entry->token;
+	}
+
+	return 0;
+}
+
+/*
+ * Remove \DDD constructs from the input. See RFC 1035, section 5.1.
+ */
+static size_t
+zoctet(char *text)
+{
+	/*
+	 * s follows the string, p lags behind and rebuilds the new
+	 * string
+	 */
+	char *s;
+	char *p;
+
+	for (s = p = text; *s; ++s, ++p) {
+		assert(p <= s);
+		if (s[0] != '\\') {
+			/* Ordinary character.  */
+			*p = *s;
+		} else if (isdigit((unsigned char)s[1]) && isdigit((unsigned char)s[2]) && isdigit((unsigned char)s[3])) {
+			/* \DDD escape.  */
+			int val = (hexdigit_to_int(s[1]) * 100 +
+				   hexdigit_to_int(s[2]) * 10 +
+				   hexdigit_to_int(s[3]));
+			if (0 <= val && val <= 255) {
+				s += 3;
+				*p = val;
+			} else {
+				zc_warning("text escape \\DDD overflow");
+				*p = *++s;
+			}
+		} else if (s[1] != '\0') {
+			/* \X where X is any character, keep X.  */
+			*p = *++s;
+		} else {
+			/* Trailing backslash, ignore it.  */
+			zc_warning("trailing backslash ignored");
+			--p;
+		}
+	}
+	*p = '\0';
+	return p - text;
+}
+
+/* the text is zero terminated, writable and stays valid for the parse,
+ * escapes is true if the text can contain a backslash */
+static int
+parse_token(int token, char *text, size_t len, int escapes)
+{
+	if (lexer_state == EXPECT_OWNER) {
+		lexer_state = PARSING_OWNER;
+	} else if (lexer_state == PARSING_TTL_CLASS_TYPE) {
+		const char *t;
+		int token;
+		uint16_t rrclass;
+
+		/* type */
+		token = rrtype_to_token(text, &yylval.type);
+		if (token != 0) {
+			lexer_state = PARSING_RDATA;
+			return token;
+		}
+
+		/* class */
+		rrclass = rrclass_from_string(text);
+		if (rrclass != 0) {
+			yylval.klass = rrclass;
+			return T_RRCLASS;
+		}
+
+		/* ttl */
+		yylval.ttl = strtottl(text, &t);
+		if (*t == '\0') {
+			return T_TTL;
+		}
+	}
+
+	if(escapes)
+		len = zoctet(text);
+	yylval.data.str = text;
+	yylval.data.len = len;
+	return token;
+}
+
+/** return a copy of the text in the rr_region, for tokens that cannot be
+ * terminated in the input */
+static char*
+zscan_copy(const char* text, size_t len)
+{
+	char* s = (char*)region_alloc(parser->rr_region, len+1);
+	memmove(s, text, len);
+	s[len] = 0;
+	return s;
+}
+
+/** find the first delimiter or backslash from p */
+static const char*
+zscan_word_end(const char* p, const char* end)
+{
+#ifdef ZSCAN_SSE2
+	const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'),
+		nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r'),
+		po = _mm_set1_epi8('('), pc = _mm_set1_epi8(')'),
+		sc = _mm_set1_epi8(';'), dot = _mm_set1_epi8('.'),
+		bs = _mm_set1_epi8('\\');
+	while(p + 16 <= end) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, sp),
+					_mm_cmpeq_epi8(v, tab)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, nl),
+					_mm_cmpeq_epi8(v, cr))),
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, po),
+					_mm_cmpeq_epi8(v, pc)),
+				_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(v, sc),
+						_mm_cmpeq_epi8(v, dot)),
+					_mm_cmpeq_epi8(v, bs))));
+		int mask = _mm_movemask_epi8(m);
+		if(mask)
+			return p + __builtin_ctz((unsigned)mask);
+		p += 16;
+	}
+#endif /* ZSCAN_SSE2 */
+	while(p < end && !(zscan_class[(uint8_t)*p]&ZC_DELIM) && *p != '\\')
+		p++;
+	return p;
+}
+
+/** handle the $INCLUDE directive, the text is the rest of the line */
+static void
+zscan_include(char* text)
+{
+	char *tmp;
+	domain_type *origin = parser->origin;
+	int error_occurred = parser->error_occurred;
+
+	if (include_depth >= MAXINCLUDES ) {
+		zc_error("includes nested too deeply, skipped (>%d)",
+			 MAXINCLUDES);
+	} else {
+		FILE *input;
+
+		/* Remove trailing comment.  */
+		tmp = strrchr(text, ';');
+		if (tmp) {
+			*tmp = '\0';
+		}
+		strip_string(text);
+
+		/* Parse origin for include file.  */
+		tmp = strrchr(text, ' ');
+		if (!tmp) {
+			tmp = strrchr(text, '\t');
+		}
+		if (tmp) {
+			const dname_type *dname;
+
+			/* split the original text */
+			*tmp = '\0';
+			strip_string(text);
+
+			dname = dname_parse(parser->region, tmp + 1);
+			if (!dname) {
+				zc_error("incorrect include origin '%s'",
+					 tmp + 1);
+			} else if (*(tmp + strlen(tmp + 1)) != '.') {
+				zc_error("$INCLUDE directive requires absolute domain name");
+			} else {
+				origin = domain_table_insert(
+					parser->db->domains, dname);
+			}
+		}
+
+		if (strlen(text) == 0) {
+			zc_error("missing file name in $INCLUDE directive");
+		} else if (!(input = fopen(text, "r"))) {
+			zc_error("cannot open include file '%s': %s",
+				 text, strerror(errno));
+		} else {
+			/* Initialize parser for include file.  */
+			struct zscan_buf* b = zscan_open(input);
+			b->filename = parser->filename;
+			b->line = parser->line;
+			b->origin = parser->origin;
+			b->prev = zscan_cur;
+			zscan_cur = b;
+			yyin = input;
+			include_depth++;
+			parser->filename = region_strdup(parser->region, text);
+			parser->line = 1;
+			parser->origin = origin;
+			lexer_state = EXPECT_OWNER;
+		}
+	}
+
+	parser->error_occurred = error_occurred;
+}
+
+/** the include file has ended, continue with the includer */
+static void
+zscan_pop_include(void)
+{
+	struct zscan_buf* b = zscan_cur;
+	fclose(b->file);
+	parser->filename = b->filename;
+	parser->line = b->line;
+	parser->origin = b->origin;
+	zscan_cur = b->prev;
+	yyin = zscan_cur->file;
+	include_depth--;
+	/* keep the data, tokens may point into it */
+	b->prev = zscan_done;
+	zscan_done = b;
+	zscan_cur->bol = 1;
+}
+
+/** the word starting at data[pos] ends at e, return it as a token */
+static int
+zscan_word(struct zscan_buf* b, size_t e, int escapes, int token)
+{
+	char* text;
+	size_t len = e - b->pos;
+	if(e < b->len) {
+		/* terminate the word in place, keep the delimiter */
+		b->delim = (uint8_t)b->data[e];
+		b->data[e] = 0;
+		text = b->data + b->pos;
+	} else {
+		text = zscan_copy(b->data + b->pos, len);
+	}
+	if(len > 0 && text[len-1] == '\n')
+		b->bol = 1; /* escaped newline */
+	b->pos = e;
+	return parse_token(token, text, len, escapes);
+}
+
+/** true if a word ends at pos, at a delimiter or the end of the input */
+static int
+zscan_delim_at(struct zscan_buf* b, size_t pos)
+{
+	return pos >= b->len ||
+		(zscan_class[(uint8_t)b->data[pos]]&ZC_DELIM);
+}
+
+/** the scanning stopped on an error, the next call starts a new file */
+static int
+zscan_terminate(struct zscan_buf* b)
+{
+	b->eof = 1;
+	b->delim = -1;
+	return 0;
+}
+
+int
+yylex(void)
+{
+	struct zscan_buf* b;
+	if(!zscan_class_init)
+		zscan_init_classes();
+	/* after the end of the file, the next call reads a new yyin */
+	if(zscan_cur && zscan_cur->file && zscan_cur->eof)
+		zscan_reset();
+	if(!zscan_cur) {
+		if(!yyin)
+			return 0;
+		zscan_free_done();
+		zscan_cur = zscan_open(yyin);
+		paren_open = 0;
+		lexer_state = EXPECT_OWNER;
+	}
+
+	for(;;) {
+		size_t pos, e;
+		int c, bol;
+		b = zscan_cur;
+		if(b->eof)
+			return 0;
+		pos = b->pos;
+		if(pos >= b->len) {
+			b->bol = 1;
+			if(b->file && b->prev && b->prev->file) {
+				zscan_pop_include();
+				continue;
+			}
+			return zscan_terminate(b);
+		}
+		if(b->delim != -1) {
+			c = b->delim;
+			b->delim = -1;
+		} else	c = (uint8_t)b->data[pos];
+		bol = b->bol;
+		b->bol = 0;
+
+		switch(c) {
+		case ' ':
+		case '\t':
+			e = pos+1;
+			while(e < b->len && (b->data[e] == ' ' ||
+				b->data[e] == '\t'))
+				e++;
+			if(e < b->len && b->data[e] == ';') {
+				/* spaces before a comment are ignored */
+				b->pos = e;
+				continue;
+			}
+			b->pos = e;
+			if (!paren_open && lexer_state == EXPECT_OWNER) {
+				lexer_state = PARSING_TTL_CLASS_TYPE;
+				return PREV;
+			}
+			if (lexer_state == PARSING_OWNER) {
+				lexer_state = PARSING_TTL_CLASS_TYPE;
+			}
+			return SP;
+		case ';': {
+			/* comment, until the end of the line */
+			const char* nl = memchr(b->data+pos, '\n',
+				b->len-pos);
+			b->pos = (nl?(size_t)(nl-b->data):b->len);
+			continue;
+		}
+		case '\n':
+		case '\r':
+			b->pos = pos+1;
+			if(c == '\n')
+				b->bol = 1;
+			++parser->line;
+			if (!paren_open) {
+				lexer_state = EXPECT_OWNER;
+				return NL;
+			}
+			return SP;
+		case '(':
+			if (paren_open) {
+				zc_error("nested parentheses");
+				return zscan_terminate(b);
+			}
+			b->pos = pos+1;
+			paren_open = 1;
+			return SP;
+		case ')':
+			if (!paren_open) {
+				zc_error("closing parentheses without opening parentheses");
+				return zscan_terminate(b);
+			}
+			b->pos = pos+1;
+			paren_open = 0;
+			return SP;
+		case '.':
+			b->pos = pos+1;
+			return parse_token('.', zscan_copy(".", 1), 1, 0);
+		case '"':
+			/* quoted string, strip the quotes */
+			e = pos+1;
+			while(e < b->len) {
+				while(e < b->len && !(zscan_class[
+					(uint8_t)b->data[e]]&ZC_QUOTE))
+					e++;
+				if(e >= b->len || b->data[e] == '"')
+					break;
+				if(b->data[e] == '\\')
+					e++;
+				if(e < b->len && b->data[e] == '\n')
+					++parser->line;
+				e++;
+			}
+			if(e >= b->len) {
+				zc_error("EOF inside quoted string");
+				return zscan_terminate(b);
+			}
+			b->data[e] = 0;
+			b->pos = e+1;
+			return parse_token(STR, b->data+pos+1, e-pos-1, 1);
+		case '$':
+			if(bol) {
+				const char* w = b->data+pos+1;
+				e = pos+1;
+				while(e < b->len && isalpha((uint8_t)b->data[e]))
+					e++;
+				if(e-pos-1 == 3 && strncasecmp(w, "TTL", 3)==0) {
+					b->pos = e;
+					lexer_state = PARSING_RDATA;
+					return DOLLAR_TTL;
+				}
+				if(e-pos-1 == 6 && strncasecmp(w, "ORIGIN", 6)==0) {
+					b->pos = e;
+					lexer_state = PARSING_RDATA;
+					return DOLLAR_ORIGIN;
+				}
+				if(e-pos-1 == 7 && strncasecmp(w, "INCLUDE", 7)==0) {
+					/* the rest of the line is the file */
+					size_t s = e;
+					while(e < b->len && b->data[e] != '\n')
+						e++;
+					b->pos = e;
+					if(s == e) {
+						int error_occurred =
+							parser->error_occurred;
+						zc_error("missing file name in $INCLUDE directive");
+						/* the newline is consumed */
+						if(e < b->len)
+							b->pos = e+1;
+						b->bol = 1;
+						++parser->line;
+						parser->error_occurred =
+							error_occurred;
+						continue;
+					}
+					zscan_include(zscan_copy(b->data+s,
+						e-s));
+					continue;
+				}
+				if(e > pos+1) {
+					char* d = zscan_copy(b->data+pos,
+						e-pos);
+					b->pos = e;
+					zc_warning("Unknown directive: %s", d);
+					continue;
+				}
+			}
+			b->pos = pos+1;
+			zc_error("unknown character '%c' (\\%03d) seen - is this a zonefile?",
+				 c, c);
+			continue;
+		case '\\':
+			/* \[ starts a bitlabel, if it is not the start of a
+			 * longer word, flex takes the longest match */
+			if(pos+1 < b->len && b->data[pos+1] == '[' &&
+				zscan_delim_at(b, pos+2)) {
+				/* strip the leading and ending brackets */
+				e = pos+2;
+				while(e < b->len && b->data[e] != ']') {
+					if(b->data[e] == '\\' && e+1 < b->len &&
+						b->data[e+1] != '\n')
+						e++;
+					else if(b->data[e] == '\n')
+						++parser->line;
+					e++;
+				}
+				if(e >= b->len) {
+					zc_error("EOF inside bitlabel");
+					return zscan_terminate(b);
+				}
+				b->data[e] = 0;
+				b->pos = e+1;
+				return parse_token(BITLAB, b->data+pos+2,
+					e-pos-2, 1);
+			}
+			if(pos+1 < b->len && b->data[pos+1] == '#' &&
+				zscan_delim_at(b, pos+2)) {
+				char* t = zscan_copy("\\#", 2);
+				b->pos = pos+2;
+				return parse_token(URR, t, 2, 1);
+			}
+			/* fallthrough */
+		default:
+			if(c == '@' && zscan_delim_at(b, pos+1)) {
+				b->pos = pos+1;
+				return parse_token('@', zscan_copy("@", 1),
+					1, 0);
+			}
+			/* a word, until a delimiter, with escaped chars */
+			e = pos;
+			if(c != '\\')
+				e++;
+			for(;;) {
+				e = (size_t)(zscan_word_end(b->data+e,
+					b->data+b->len) - b->data);
+				if(e >= b->len || b->data[e] != '\\')
+					break;
+				/* escaped char, or a trailing backslash */
+				e += (e+1 < b->len)?2:1;
+			}
+			return zscan_word(b, e, memchr(b->data+pos, '\\',
+				e-pos) != NULL, STR);
+		}
+	}
+}